@@ -0,0 +1,416 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2024 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Find the critical path of a boot and the actions that block it.
+
+The analysis works on a capture directory holding some of these files:
+
+  boot_trace.json  init's boot trace, as written by `dump_boot_trace`. On
+                   userdebug builds, bootstat-debug.rc writes it to
+                   /data/bootchart/boot_trace.json once boot completes if
+                   persist.bootstat.dump_boot_trace is 1.
+  getprop.txt      The output of `adb shell getprop`, for ro.boottime.*.
+  dmesg.txt        The kernel log, for ueventd's coldboot time.
+  schedstat.bin    Samples from bootchart's schedstat mode, see init/README.md.
+
+Only boot_trace.json is required. Use --capture to pull these files from a
+device that has just booted.
+
+init's second stage runs actions one at a time on its main thread, so the
+target (by default, the action triggered by sys.boot_completed=1) can't be
+reached before every action that ran ahead of it. The critical path is the
+first stage phases from the ro.boottime.* properties, followed by the actions
+of the trace up to the target. Any gaps between actions are time init spent
+idle, waiting for the trigger of the next action. The slowest commands on that
+path are the top blocking actions. If schedstat samples are available, each
+of them is labelled with how busy the CPUs were and which cgroups used them.
+
+Examples:
+
+Capture a boot and analyze it:
+
+$ ./boot_critical_path.py --capture=base
+$ ./boot_critical_path.py base
+
+Report what regressed by 20ms or more between two builds:
+
+$ ./boot_critical_path.py base exp --threshold=20
+"""
+
+import argparse
+import collections
+import json
+import os
+import re
+import struct
+import subprocess
+import sys
+
+# The JSON trace event categories of init's boot trace, see init/boot_trace.cpp.
+_ACTION = 'action'
+_COMMAND = 'command'
+
+_DEFAULT_TARGET = 'sys.boot_completed=1'
+
+# Units of the ro.boottime.* properties, in ns.
+_NS = 1
+_MS = 1000000
+
+# Gaps between actions shorter than this are bookkeeping in init, not waiting.
+_MIN_IDLE_US = 1000
+
+_SCHEDSTAT_HEADER = struct.Struct('<4sIIIQQ')
+_SCHEDSTAT_RECORD = struct.Struct('<qIIII')
+
+Segment = collections.namedtuple('Segment', 'kind name location start_us dur_us')
+
+
+def _ms(us):
+    return us / 1000.0
+
+
+class Schedstat(object):
+    """Samples from bootchart's schedstat mode."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            data = f.read()
+        magic, version, self.interval_us, source_count, record_count, _ = (
+            _SCHEDSTAT_HEADER.unpack_from(data, 0))
+        if magic != b'BCSS' or version != 1:
+            raise ValueError('%s is not a schedstat sample file' % path)
+        offset = _SCHEDSTAT_HEADER.size
+        self.names = []
+        for _ in range(source_count):
+            (length,) = struct.unpack_from('<I', data, offset)
+            offset += 4
+            self.names.append(data[offset:offset + length].decode(errors='replace'))
+            offset += length
+        self.cpus = [i for i, name in enumerate(self.names)
+                     if re.match(r'cpu\d+$', name)]
+        self.records = []
+        for i in range(record_count):
+            ts_ns, source, run_us, _, _ = _SCHEDSTAT_RECORD.unpack_from(
+                data, offset + i * _SCHEDSTAT_RECORD.size)
+            self.records.append((ts_ns // 1000, source, run_us))
+
+    def usage(self, start_us, dur_us, top=2):
+        """Returns the CPU busy fraction and the busiest cgroups over a span."""
+        if not self.cpus or dur_us <= 0:
+            return None, []
+        cpu_us = 0
+        cgroup_us = collections.Counter()
+        cpus = set(self.cpus)
+        for ts_us, source, run_us in self.records:
+            # A sample covers the interval leading up to its timestamp.
+            if ts_us <= start_us or ts_us - self.interval_us >= start_us + dur_us:
+                continue
+            if source in cpus:
+                cpu_us += run_us
+            else:
+                cgroup_us[self.names[source]] += run_us
+        busy = min(1.0, cpu_us / float(len(self.cpus) * dur_us))
+        return busy, cgroup_us.most_common(top)
+
+
+class Boot(object):
+    """One captured boot."""
+
+    def __init__(self, directory, target):
+        self.directory = directory
+        self.props = self._read_props(os.path.join(directory, 'getprop.txt'))
+        self.coldboot_us = self._read_coldboot(os.path.join(directory, 'dmesg.txt'))
+        self.events = self._read_trace(os.path.join(directory, 'boot_trace.json'))
+        self.schedstat = None
+        schedstat_path = os.path.join(directory, 'schedstat.bin')
+        if os.path.exists(schedstat_path):
+            self.schedstat = Schedstat(schedstat_path)
+        self.path = self._critical_path(target)
+
+    @staticmethod
+    def _read_props(path):
+        props = {}
+        if not os.path.exists(path):
+            return props
+        with open(path) as f:
+            for line in f:
+                match = re.match(r'\[([^\]]+)\]: \[([^\]]*)\]', line)
+                if match:
+                    props[match.group(1)] = match.group(2)
+        return props
+
+    @staticmethod
+    def _read_coldboot(path):
+        if not os.path.exists(path):
+            return None
+        with open(path, errors='replace') as f:
+            for line in f:
+                match = re.search(r'Coldboot took ([0-9.]+) seconds', line)
+                if match:
+                    return int(float(match.group(1)) * 1000000)
+        return None
+
+    @staticmethod
+    def _read_trace(path):
+        with open(path) as f:
+            trace = json.load(f)
+        events = [e for e in trace['traceEvents'] if e.get('ph') == 'X']
+        events.sort(key=lambda e: (e['ts'], -e['dur']))
+        return events
+
+    def _prop_us(self, name, ns_per_unit):
+        """Returns the integer property |name|, converted to us."""
+        try:
+            return int(self.props[name]) * ns_per_unit // 1000
+        except (KeyError, ValueError):
+            return None
+
+    def phases(self):
+        """Returns the boot phases before init's second stage, as Segments."""
+        phases = []
+        start = self._prop_us('ro.boottime.init', _NS)
+        if start is None:
+            return phases
+        phases.append(Segment('phase', 'kernel', '', 0, start))
+        first_stage = self._prop_us('ro.boottime.init.first_stage', _NS)
+        if first_stage is not None:
+            phases.append(Segment('phase', 'first stage', '', start, first_stage))
+            start += first_stage
+        selinux = self._prop_us('ro.boottime.init.selinux', _NS)
+        if selinux is not None:
+            phases.append(Segment('phase', 'selinux', '', start, selinux))
+        return phases
+
+    def details(self):
+        """Returns timings that overlap the critical path, keyed by name."""
+        details = collections.OrderedDict()
+        modules = self._prop_us('ro.boottime.init.modules', _MS)
+        if modules is not None:
+            details['module loading (first stage)'] = modules
+        if self.coldboot_us is not None:
+            details['ueventd coldboot'] = self.coldboot_us
+        cold_boot_wait = self._prop_us('ro.boottime.init.cold_boot_wait', _MS)
+        if cold_boot_wait is not None:
+            details['init waiting for coldboot'] = cold_boot_wait
+        for name in sorted(self.props):
+            if name.startswith('ro.boottime.init.mount_all.'):
+                details['mount_all ' + name.rsplit('.', 1)[1]] = self._prop_us(name, _MS)
+        return details
+
+    def service_starts(self):
+        """Returns the time each service was first started, in us."""
+        starts = {}
+        for name in self.props:
+            if not name.startswith('ro.boottime.') or name.startswith('ro.boottime.init'):
+                continue
+            value = self._prop_us(name, _NS)
+            if value is not None:
+                starts[name[len('ro.boottime.'):]] = value
+        return starts
+
+    def _critical_path(self, target):
+        actions = [e for e in self.events if e.get('cat') == _ACTION]
+        if not actions:
+            raise ValueError('%s has no actions in its boot trace' % self.directory)
+
+        end = None
+        for action in actions:
+            if target in action['name']:
+                end = action['ts'] + action['dur']
+                break
+        if end is None:
+            try:
+                end = int(float(target) * 1000)
+            except ValueError:
+                sys.stderr.write('%s: no action matches %r, using the end of the trace\n' %
+                                 (self.directory, target))
+                end = max(e['ts'] + e['dur'] for e in self.events)
+        self.target_us = end
+
+        path = self.phases()
+        trace_start = actions[0]['ts']
+        if path:
+            second_stage = path[-1].start_us + path[-1].dur_us
+            if trace_start > second_stage + _MIN_IDLE_US:
+                # init's trace is a ring buffer and may have lost the first actions.
+                path.append(Segment('untraced', 'early second stage', '', second_stage,
+                                    trace_start - second_stage))
+
+        previous_end = trace_start
+        for action in actions:
+            if action['ts'] >= end:
+                break
+            gap = action['ts'] - previous_end
+            if gap >= _MIN_IDLE_US:
+                path.append(Segment('idle', 'waiting for ' + action['name'], '', previous_end,
+                                    gap))
+            path.append(Segment(_ACTION, action['name'], action['args'].get('location', ''),
+                                action['ts'], action['dur']))
+            previous_end = max(previous_end, action['ts'] + action['dur'])
+        return path
+
+    def blocking(self):
+        """Returns the commands run by the actions on the critical path."""
+        spans = [(s.start_us, s.start_us + s.dur_us) for s in self.path if s.kind == _ACTION]
+        commands = []
+        for event in self.events:
+            if event.get('cat') != _COMMAND or event['ts'] >= self.target_us:
+                continue
+            if any(start <= event['ts'] < end for start, end in spans):
+                commands.append(Segment(_COMMAND, event['name'],
+                                        event['args'].get('location', ''), event['ts'],
+                                        event['dur']))
+        return commands
+
+
+def _cpu_label(boot, segment):
+    if boot.schedstat is None:
+        return ''
+    busy, cgroups = boot.schedstat.usage(segment.start_us, segment.dur_us)
+    if busy is None:
+        return ''
+    label = ' [cpu %d%%' % round(busy * 100)
+    if cgroups:
+        label += ': ' + ', '.join('%s %.0fms' % (name, _ms(us)) for name, us in cgroups)
+    return label + ']'
+
+
+def _describe(segment):
+    text = '%s %s' % (segment.kind, segment.name)
+    if segment.location:
+        text += ' (%s)' % segment.location
+    return text
+
+
+def report(boot, top):
+    print('Boot %s: target reached at %.1fms' % (boot.directory, _ms(boot.target_us)))
+
+    print('\nCritical path:')
+    for segment in boot.path:
+        print('  %10.1fms %9.1fms  %s%s' % (_ms(segment.start_us), _ms(segment.dur_us),
+                                           _describe(segment), _cpu_label(boot, segment)))
+
+    totals = collections.Counter()
+    for segment in boot.path:
+        totals[segment.kind] += segment.dur_us
+    print('\nTime on the critical path by kind:')
+    for kind, us in totals.most_common():
+        print('  %-10s %9.1fms' % (kind, _ms(us)))
+
+    details = boot.details()
+    if details:
+        print('\nOverlapping timings:')
+        for name, us in details.items():
+            print('  %-32s %9.1fms' % (name, _ms(us)))
+
+    print('\nTop blocking commands:')
+    for segment in sorted(boot.blocking(), key=lambda s: -s.dur_us)[:top]:
+        print('  %9.1fms  %s%s' % (_ms(segment.dur_us), _describe(segment),
+                                   _cpu_label(boot, segment)))
+
+
+def _totals_by_key(segments):
+    totals = collections.OrderedDict()
+    for segment in segments:
+        key = _describe(segment)
+        totals[key] = totals.get(key, 0) + segment.dur_us
+    return totals
+
+
+def _print_deltas(title, base, exp, threshold_us):
+    rows = []
+    for key in set(base) | set(exp):
+        delta = exp.get(key, 0) - base.get(key, 0)
+        if abs(delta) >= threshold_us:
+            rows.append((delta, key))
+    if not rows:
+        return
+    print('\n%s:' % title)
+    print('  %10s %10s %10s' % ('base', 'exp', 'delta'))
+    for delta, key in sorted(rows, reverse=True):
+        base_text = '%.1f' % _ms(base[key]) if key in base else '-'
+        exp_text = '%.1f' % _ms(exp[key]) if key in exp else '-'
+        print('  %10s %10s %+10.1f  %s' % (base_text, exp_text, _ms(delta), key))
+
+
+def compare(base, exp, threshold_us):
+    print('Target reached at %.1fms in %s and %.1fms in %s (%+.1fms)' % (
+        _ms(base.target_us), base.directory, _ms(exp.target_us), exp.directory,
+        _ms(exp.target_us - base.target_us)))
+    print('Showing changes of %.1fms or more; times are in ms.' % _ms(threshold_us))
+
+    _print_deltas('Critical path', _totals_by_key(base.path), _totals_by_key(exp.path),
+                  threshold_us)
+    _print_deltas('Blocking commands', _totals_by_key(base.blocking()),
+                  _totals_by_key(exp.blocking()), threshold_us)
+    _print_deltas('Overlapping timings', base.details(), exp.details(), threshold_us)
+    _print_deltas('Service start times', base.service_starts(), exp.service_starts(),
+                  threshold_us)
+
+
+def capture(directory, serial):
+    adb = ['adb'] + (['-s', serial] if serial else [])
+    if not os.path.isdir(directory):
+        os.makedirs(directory)
+    for name, command in (('getprop.txt', ['shell', 'getprop']),
+                          ('dmesg.txt', ['shell', 'dmesg'])):
+        with open(os.path.join(directory, name), 'wb') as f:
+            subprocess.check_call(adb + command, stdout=f)
+    for name in ('boot_trace.json', 'schedstat.bin'):
+        result = subprocess.call(adb + ['pull', '/data/bootchart/' + name,
+                                        os.path.join(directory, name)])
+        if result != 0 and name == 'boot_trace.json':
+            sys.exit('Failed to pull the boot trace; is persist.bootstat.dump_boot_trace=1 '
+                     'set, and adb running as root?')
+
+
+def init_arguments():
+    parser = argparse.ArgumentParser(
+        description=__doc__.split('\n\n')[0],
+        epilog=__doc__[__doc__.index('\n\n') + 2:],
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('boots', nargs='*', metavar='capture_dir',
+                        help='One capture directory to analyze, or two to compare.')
+    parser.add_argument('--capture', metavar='DIR',
+                        help='Pull the files for the current boot into DIR.')
+    parser.add_argument('-s', '--serial', default=os.getenv('ANDROID_SERIAL'),
+                        help='Android serial number of the device for --capture.')
+    parser.add_argument('--target', default=_DEFAULT_TARGET,
+                        help='Part of the trigger of the action that ends the boot, or a '
+                        'time in ms. Defaults to %s.' % _DEFAULT_TARGET)
+    parser.add_argument('--top', type=int, default=15,
+                        help='Number of blocking commands to list.')
+    parser.add_argument('--threshold', type=float, default=10,
+                        help='Smallest change in ms reported when comparing two boots.')
+    return parser.parse_args()
+
+
+def main():
+    args = init_arguments()
+    if args.capture:
+        capture(args.capture, args.serial)
+        if not args.boots:
+            return
+    if len(args.boots) == 1:
+        report(Boot(args.boots[0], args.target), args.top)
+    elif len(args.boots) == 2:
+        compare(Boot(args.boots[0], args.target), Boot(args.boots[1], args.target),
+                int(args.threshold * 1000))
+    else:
+        sys.exit('Expected one capture directory to analyze or two to compare.')
+
+
+if __name__ == '__main__':
+    main()
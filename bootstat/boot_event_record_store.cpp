@@ -17,12 +17,16 @@
 #include "boot_event_record_store.h"
 
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
-#include <utime.h>
+#include <unistd.h>
 
 #include <chrono>
 #include <cstdlib>
+#include <map>
 #include <string>
 #include <utility>
 
@@ -30,11 +34,32 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
+#include <android-base/unique_fd.h>
 
 namespace {
 
 const char BOOTSTAT_DATA_DIR[] = "/data/misc/bootstat/";
 
+// The record log lives next to the legacy per-event files. The leading dot
+// keeps it (and its compaction scratch file) out of the legacy scan.
+const char RECORD_LOG_FILE[] = ".records";
+const char RECORD_LOG_TEMP_SUFFIX[] = ".tmp";
+
+// Once an append leaves the record log larger than this, the log is compacted
+// right away rather than waiting for the next LogBootEvents pass.
+const off_t MAX_RECORD_LOG_SIZE = 64 * 1024;
+
+// A single fixed-size record in the record log. Records are only ever
+// appended; a later record for an event supersedes the earlier ones.
+struct RecordLogEntry {
+  // NUL-terminated event name.
+  char event[124];
+  int32_t value;
+};
+static_assert(sizeof(RecordLogEntry) == 128, "RecordLogEntry must stay 128 bytes");
+
+typedef std::map<std::string, int32_t> RecordMap;
+
 // Given a boot even record file at |path|, extracts the event's relative time
 // from the record into |uptime|.
 bool ParseRecordEventTime(const std::string& path, int32_t* uptime) {
@@ -51,6 +76,112 @@ bool ParseRecordEventTime(const std::string& path, int32_t* uptime) {
   return true;
 }
 
+// Parses the record log |contents| into |records|, letting later records for
+// an event replace earlier ones. A trailing partial record, left by an append
+// that was cut short, is ignored. Returns the number of well-formed records.
+size_t ParseRecordLog(const std::string& contents, RecordMap* records) {
+  DCHECK_NE(static_cast<RecordMap*>(nullptr), records);
+
+  size_t count = 0;
+  for (size_t offset = 0; offset + sizeof(RecordLogEntry) <= contents.size();
+       offset += sizeof(RecordLogEntry)) {
+    RecordLogEntry entry;
+    memcpy(&entry, contents.data() + offset, sizeof(entry));
+
+    const size_t length = strnlen(entry.event, sizeof(entry.event));
+    if (length == 0 || length == sizeof(entry.event)) {
+      LOG(ERROR) << "Skipping malformed boot event record at offset " << offset;
+      continue;
+    }
+
+    (*records)[std::string(entry.event, length)] = entry.value;
+    ++count;
+  }
+
+  return count;
+}
+
+// Reads the record log at |path| into |records|. A missing log holds no
+// records.
+bool ReadRecordLog(const std::string& path, RecordMap* records) {
+  std::string contents;
+  if (!android::base::ReadFileToString(path, &contents)) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    PLOG(ERROR) << "Failed to read " << path;
+    return false;
+  }
+
+  ParseRecordLog(contents, records);
+  return true;
+}
+
+// Adds the records kept in the legacy one-file-per-event layout under
+// |store_path| to |records|, without replacing records from the log, which are
+// always newer. The paths of the legacy files are appended to |paths| if it is
+// non-null.
+void ReadLegacyRecords(const std::string& store_path, RecordMap* records,
+                       std::vector<std::string>* paths) {
+  std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(store_path.c_str()), closedir);
+
+  // This case could happen due to external manipulation of the filesystem,
+  // so crash out if the record store doesn't exist.
+  CHECK_NE(static_cast<DIR*>(nullptr), dir.get());
+
+  struct dirent* entry;
+  while ((entry = readdir(dir.get())) != NULL) {
+    // Only parse regular files, and skip the record log itself.
+    if (entry->d_type != DT_REG || entry->d_name[0] == '.') {
+      continue;
+    }
+
+    const std::string event = entry->d_name;
+    const std::string path = store_path + event;
+    int32_t uptime;
+    if (!ParseRecordEventTime(path, &uptime)) {
+      LOG(ERROR) << "Failed to parse boot time event: " << event;
+      continue;
+    }
+
+    records->emplace(event, uptime);
+    if (paths != nullptr) {
+      paths->push_back(path);
+    }
+  }
+}
+
+// Opens the record log at |path| with |flags| and takes a |lock| (LOCK_SH or
+// LOCK_EX) on it. Compact() renames a fresh log over |path| while holding the
+// exclusive lock, so the open is retried until the locked file is still the
+// one at |path|; appends can then never land in a log that was replaced.
+android::base::unique_fd OpenLockedRecordLog(const std::string& path, int flags, int lock) {
+  while (true) {
+    android::base::unique_fd log_fd(
+        TEMP_FAILURE_RETRY(open(path.c_str(), flags | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR)));
+    if (log_fd == -1) {
+      PLOG(ERROR) << "Failed to open " << path;
+      return log_fd;
+    }
+
+    if (TEMP_FAILURE_RETRY(flock(log_fd, lock)) == -1) {
+      PLOG(ERROR) << "Failed to lock " << path;
+      return android::base::unique_fd();
+    }
+
+    struct stat fd_stat;
+    struct stat path_stat;
+    if (fstat(log_fd, &fd_stat) == -1) {
+      PLOG(ERROR) << "Failed to read " << path;
+      return android::base::unique_fd();
+    }
+    if (stat(path.c_str(), &path_stat) == 0 && fd_stat.st_dev == path_stat.st_dev &&
+        fd_stat.st_ino == path_stat.st_ino) {
+      return log_fd;
+    }
+  }
+}
+
 }  // namespace
 
 BootEventRecordStore::BootEventRecordStore() {
@@ -63,42 +194,56 @@ void BootEventRecordStore::AddBootEvent(const std::string& event) {
   AddBootEventWithValue(event, uptime.count());
 }
 
-// The implementation of AddBootEventValue makes use of the mtime file
-// attribute to store the value associated with a boot event in order to
-// optimize on-disk size requirements and small-file thrashing.
+// Boot events are appended to a single log of fixed-size records, so adding an
+// event costs a single write() rather than creating and stat'ing a file per
+// event. Small O_APPEND writes are atomic, so concurrent bootstat invocations
+// never interleave their records.
 void BootEventRecordStore::AddBootEventWithValue(const std::string& event, int32_t value) {
-  std::string record_path = GetBootEventPath(event);
-  int record_fd = creat(record_path.c_str(), S_IRUSR | S_IWUSR);
-  if (record_fd == -1) {
-    PLOG(ERROR) << "Failed to create " << record_path;
+  RecordLogEntry entry = {};
+  if (event.empty() || event.size() >= sizeof(entry.event)) {
+    LOG(ERROR) << "Invalid boot event name: " << event;
     return;
   }
+  memcpy(entry.event, event.data(), event.size());
+  entry.value = value;
 
-  // Fill out the stat structure for |record_path| in order to get the atime to
-  // set in the utime() call.
-  struct stat file_stat;
-  if (stat(record_path.c_str(), &file_stat) == -1) {
-    PLOG(ERROR) << "Failed to read " << record_path;
-    close(record_fd);
-    return;
-  }
+  const std::string log_path = GetRecordLogPath();
+  off_t log_size;
+  {
+    android::base::unique_fd log_fd(OpenLockedRecordLog(log_path, O_WRONLY | O_APPEND, LOCK_SH));
+    if (log_fd == -1) {
+      return;
+    }
 
-  // Set the |modtime| of the file to store the value of the boot event while
-  // preserving the |actime| (as read by stat).
-  struct utimbuf times = {/* actime */ file_stat.st_atime, /* modtime */ value};
-  if (utime(record_path.c_str(), &times) == -1) {
-    PLOG(ERROR) << "Failed to set mtime for " << record_path;
-    close(record_fd);
-    return;
+    ssize_t written = TEMP_FAILURE_RETRY(write(log_fd, &entry, sizeof(entry)));
+    if (written != static_cast<ssize_t>(sizeof(entry))) {
+      PLOG(ERROR) << "Failed to append " << event << " to " << log_path;
+      return;
+    }
+
+    log_size = lseek(log_fd, 0, SEEK_CUR);
   }
 
-  close(record_fd);
+  if (log_size > MAX_RECORD_LOG_SIZE) {
+    Compact();
+  }
 }
 
 bool BootEventRecordStore::GetBootEvent(const std::string& event, BootEventRecord* record) const {
   CHECK_NE(static_cast<BootEventRecord*>(nullptr), record);
   CHECK(!event.empty());
 
+  RecordMap records;
+  if (ReadRecordLog(GetRecordLogPath(), &records)) {
+    auto it = records.find(event);
+    if (it != records.end()) {
+      *record = *it;
+      return true;
+    }
+  }
+
+  // Fall back to the legacy layout for records written before the log existed
+  // that have not been compacted into it yet.
   const std::string record_path = GetBootEventPath(event);
   int32_t uptime;
   if (!ParseRecordEventTime(record_path, &uptime)) {
@@ -111,32 +256,77 @@ bool BootEventRecordStore::GetBootEvent(const std::string& event, BootEventRecor
 }
 
 std::vector<BootEventRecordStore::BootEventRecord> BootEventRecordStore::GetAllBootEvents() const {
-  std::vector<BootEventRecord> events;
+  RecordMap records;
+  ReadRecordLog(GetRecordLogPath(), &records);
 
-  std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(store_path_.c_str()), closedir);
+  // Once Compact() has run the record log is the only file in the store, so
+  // this scan no longer stats anything.
+  ReadLegacyRecords(store_path_, &records, nullptr);
 
-  // This case could happen due to external manipulation of the filesystem,
-  // so crash out if the record store doesn't exist.
-  CHECK_NE(static_cast<DIR*>(nullptr), dir.get());
+  return std::vector<BootEventRecord>(records.begin(), records.end());
+}
 
-  struct dirent* entry;
-  while ((entry = readdir(dir.get())) != NULL) {
-    // Only parse regular files.
-    if (entry->d_type != DT_REG) {
-      continue;
-    }
+void BootEventRecordStore::Compact() {
+  const std::string log_path = GetRecordLogPath();
+  android::base::unique_fd log_fd(OpenLockedRecordLog(log_path, O_RDONLY, LOCK_EX));
+  if (log_fd == -1) {
+    return;
+  }
 
-    const std::string event = entry->d_name;
-    BootEventRecord record;
-    if (!GetBootEvent(event, &record)) {
-      LOG(ERROR) << "Failed to parse boot time event: " << event;
+  std::string contents;
+  if (!android::base::ReadFdToString(log_fd, &contents)) {
+    PLOG(ERROR) << "Failed to read " << log_path;
+    return;
+  }
+
+  RecordMap records;
+  const size_t log_records = ParseRecordLog(contents, &records);
+  const bool log_is_compact =
+      log_records == records.size() && contents.size() == log_records * sizeof(RecordLogEntry);
+
+  std::vector<std::string> legacy_paths;
+  ReadLegacyRecords(store_path_, &records, &legacy_paths);
+  if (log_is_compact && legacy_paths.empty()) {
+    return;
+  }
+
+  std::string compacted;
+  compacted.reserve(records.size() * sizeof(RecordLogEntry));
+  for (const auto& record : records) {
+    RecordLogEntry entry = {};
+    if (record.first.size() >= sizeof(entry.event)) {
+      LOG(ERROR) << "Dropping boot event with an overlong name: " << record.first;
       continue;
     }
+    memcpy(entry.event, record.first.data(), record.first.size());
+    entry.value = record.second;
+    compacted.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+  }
 
-    events.push_back(record);
+  // Write the compacted log next to the current one and rename it into place,
+  // so readers see either the old or the new log in full.
+  const std::string temp_path = log_path + RECORD_LOG_TEMP_SUFFIX;
+  if (!android::base::WriteStringToFile(compacted, temp_path, S_IRUSR | S_IWUSR, getuid(),
+                                        getgid())) {
+    PLOG(ERROR) << "Failed to write " << temp_path;
+    unlink(temp_path.c_str());
+    return;
+  }
+  if (rename(temp_path.c_str(), log_path.c_str()) == -1) {
+    PLOG(ERROR) << "Failed to replace " << log_path;
+    unlink(temp_path.c_str());
+    return;
   }
 
-  return events;
+  for (const auto& path : legacy_paths) {
+    // Records too long for the log were dropped above; keep their files.
+    if (path.size() - store_path_.size() >= sizeof(RecordLogEntry::event)) {
+      continue;
+    }
+    if (unlink(path.c_str()) == -1) {
+      PLOG(ERROR) << "Failed to remove " << path;
+    }
+  }
 }
 
 void BootEventRecordStore::SetStorePath(const std::string& path) {
@@ -148,3 +338,8 @@ std::string BootEventRecordStore::GetBootEventPath(const std::string& event) con
   DCHECK_EQ('/', store_path_.back());
   return store_path_ + event;
 }
+
+std::string BootEventRecordStore::GetRecordLogPath() const {
+  DCHECK_EQ('/', store_path_.back());
+  return store_path_ + RECORD_LOG_FILE;
+}
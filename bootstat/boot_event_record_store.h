@@ -48,6 +48,11 @@ class BootEventRecordStore {
   // Returns a list of all of the boot events persisted in the record store.
   std::vector<BootEventRecord> GetAllBootEvents() const;
 
+  // Rewrites the record log so that it holds a single record per boot event,
+  // folding in (and removing) any records left in the legacy one-file-per-event
+  // layout.
+  void Compact();
+
  private:
   // The tests call SetStorePath to override the default store location with a
   // more test-friendly path.
@@ -56,13 +61,21 @@ class BootEventRecordStore {
   FRIEND_TEST(BootEventRecordStoreTest, AddBootEventWithValue);
   FRIEND_TEST(BootEventRecordStoreTest, GetBootEvent);
   FRIEND_TEST(BootEventRecordStoreTest, GetBootEventNoFileContent);
+  FRIEND_TEST(BootEventRecordStoreTest, AddBootEventReplacesValue);
+  FRIEND_TEST(BootEventRecordStoreTest, AddBootEventNameTooLong);
+  FRIEND_TEST(BootEventRecordStoreTest, CompactRecordLog);
+  FRIEND_TEST(BootEventRecordStoreTest, CompactMigratesLegacyRecords);
 
   // Sets the filesystem path of the record store.
   void SetStorePath(const std::string& path);
 
-  // Constructs the full path of the given boot |event|.
+  // Constructs the full path of the given boot |event| in the legacy
+  // one-file-per-event layout.
   std::string GetBootEventPath(const std::string& event) const;
 
+  // Constructs the full path of the append-only record log.
+  std::string GetRecordLogPath() const;
+
   // The filesystem path of the record store.
   std::string store_path_;
 
@@ -223,3 +223,82 @@ TEST_F(BootEventRecordStoreTest, GetBootEventNoFileContent) {
   EXPECT_EQ("devonian", record.first);
   EXPECT_EQ(2718, record.second);
 }
+
+TEST_F(BootEventRecordStoreTest, AddBootEventReplacesValue) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  store.AddBootEventWithValue("ordovician", 1);
+  store.AddBootEventWithValue("silurian", 2);
+  store.AddBootEventWithValue("ordovician", 3);
+
+  BootEventRecordStore::BootEventRecord record;
+  EXPECT_TRUE(store.GetBootEvent("ordovician", &record));
+  EXPECT_EQ(3, record.second);
+
+  auto events = store.GetAllBootEvents();
+  EXPECT_THAT(events, UnorderedElementsAreArray({
+                          std::make_pair(std::string("ordovician"), 3),
+                          std::make_pair(std::string("silurian"), 2),
+                      }));
+}
+
+TEST_F(BootEventRecordStoreTest, AddBootEventNameTooLong) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  store.AddBootEventWithValue(std::string(256, 'x'), 1);
+
+  EXPECT_TRUE(store.GetAllBootEvents().empty());
+}
+
+TEST_F(BootEventRecordStoreTest, CompactRecordLog) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  for (int32_t i = 0; i < 10; ++i) {
+    store.AddBootEventWithValue("cambrian", i);
+    store.AddBootEventWithValue("ediacaran", i * 2);
+  }
+
+  struct stat log_stat;
+  ASSERT_EQ(0, stat(store.GetRecordLogPath().c_str(), &log_stat));
+  const off_t uncompacted_size = log_stat.st_size;
+
+  store.Compact();
+
+  ASSERT_EQ(0, stat(store.GetRecordLogPath().c_str(), &log_stat));
+  EXPECT_EQ(uncompacted_size / 10, log_stat.st_size);
+
+  auto events = store.GetAllBootEvents();
+  EXPECT_THAT(events, UnorderedElementsAreArray({
+                          std::make_pair(std::string("cambrian"), 9),
+                          std::make_pair(std::string("ediacaran"), 18),
+                      }));
+
+  // Records appended after compaction still supersede the compacted ones.
+  store.AddBootEventWithValue("cambrian", 100);
+  BootEventRecordStore::BootEventRecord record;
+  EXPECT_TRUE(store.GetBootEvent("cambrian", &record));
+  EXPECT_EQ(100, record.second);
+}
+
+TEST_F(BootEventRecordStoreTest, CompactMigratesLegacyRecords) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  const std::string legacy_path = store.GetBootEventPath("mississippian");
+  EXPECT_TRUE(CreateEmptyBootEventRecord(legacy_path, 1618));
+  EXPECT_TRUE(CreateEmptyBootEventRecord(store.GetBootEventPath("pennsylvanian"), 1));
+  store.AddBootEventWithValue("pennsylvanian", 2);
+
+  store.Compact();
+
+  EXPECT_EQ(-1, access(legacy_path.c_str(), F_OK));
+
+  auto events = store.GetAllBootEvents();
+  EXPECT_THAT(events, UnorderedElementsAreArray({
+                          std::make_pair(std::string("mississippian"), 1618),
+                          std::make_pair(std::string("pennsylvanian"), 2),
+                      }));
+}
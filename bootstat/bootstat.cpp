@@ -152,10 +152,10 @@ const std::unordered_map<std::string_view, AtomInfo> kBootEventToAtomInfo = {
       android::util::BOOT_TIME_EVENT_ERROR_CODE__EVENT__FACTORY_RESET_CURRENT_TIME_FAILURE}},
 };
 
-// Scans the boot event record store for record files and logs each boot event
-// via EventLog.
+// Compacts the boot event record store and logs each boot event via EventLog.
 void LogBootEvents() {
   BootEventRecordStore boot_event_store;
+  boot_event_store.Compact();
   auto events = boot_event_store.GetAllBootEvents();
   std::vector<std::string_view> notSupportedEvents;
   for (const auto& event : events) {
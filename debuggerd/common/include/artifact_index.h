@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Copyright 2026, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+// tombstoned keeps an index next to the tombstones and traces it writes, so that they can be
+// listed and rotated without opening each one. The file is an array of ArtifactIndexEntry, one
+// per artifact slot: entry N describes tombstone_NN (or trace_NN) in the same directory.
+static constexpr const char* kArtifactIndexFileName = "index";
+
+static constexpr uint32_t kArtifactIndexMagic = 0x58444e49;  // "INDX"
+
+struct ArtifactIndexEntry {
+  // kArtifactIndexMagic if the slot has been written, zero otherwise.
+  uint32_t magic;
+  int32_t pid;
+  // The fatal signal, or zero for dumps that were requested rather than caused by a crash.
+  int32_t signal;
+  // Non-zero if the artifacts were stored zstd-compressed, with a ".zst" suffix.
+  uint32_t compressed;
+  // Seconds since the epoch at which the dump completed.
+  int64_t timestamp;
+  char process_name[64];
+};
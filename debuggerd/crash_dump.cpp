@@ -17,21 +17,28 @@
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <grp.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <limits>
 #include <map>
 #include <memory>
 #include <set>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include <android-base/cmsg.h>
 #include <android-base/errno_restorer.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -196,6 +203,7 @@ static bool g_tombstoned_connected = false;
 static unique_fd g_tombstoned_socket;
 static unique_fd g_output_fd;
 static unique_fd g_proto_fd;
+static bool g_text_deferred = false;
 
 static void DefuseSignalHandlers() {
   // Don't try to dump ourselves.
@@ -235,6 +243,18 @@ static void Initialize(char** argv) {
   });
 }
 
+static void CheckDumpType(DebuggerdDumpType dump_type) {
+  switch (dump_type) {
+    case kDebuggerdNativeBacktrace:
+    case kDebuggerdTombstone:
+    case kDebuggerdTombstoneProto:
+      break;
+
+    default:
+      LOG(FATAL) << "invalid requested dump type: " << static_cast<int>(dump_type);
+  }
+}
+
 static void ParseArgs(int argc, char** argv, pid_t* pseudothread_tid, DebuggerdDumpType* dump_type) {
   if (argc != 4) {
     LOG(FATAL) << "wrong number of args: " << argc << " (expected 4)";
@@ -254,15 +274,7 @@ static void ParseArgs(int argc, char** argv, pid_t* pseudothread_tid, DebuggerdD
   }
 
   *dump_type = static_cast<DebuggerdDumpType>(dump_type_int);
-  switch (*dump_type) {
-    case kDebuggerdNativeBacktrace:
-    case kDebuggerdTombstone:
-    case kDebuggerdTombstoneProto:
-      break;
-
-    default:
-      LOG(FATAL) << "invalid requested dump type: " << dump_type_int;
-  }
+  CheckDumpType(*dump_type);
 }
 
 static void ReadCrashInfo(unique_fd& fd, siginfo_t* siginfo,
@@ -385,65 +397,34 @@ static void InstallSigPipeHandler() {
   sigaction(SIGPIPE, &action, nullptr);
 }
 
-int main(int argc, char** argv) {
-  DefuseSignalHandlers();
-  InstallSigPipeHandler();
+// Who a pre-spawned crash_dump becomes before it reads the memory of the process it dumps, as an
+// exec'd crash_dump would already be.
+struct TargetCredentials {
+  uid_t uid;
+  gid_t gid;
+  std::vector<gid_t> groups;
+};
 
-  // There appears to be a bug in the kernel where our death causes SIGHUP to
-  // be sent to our process group if we exit while it has stopped jobs (e.g.
-  // because of wait_for_debugger). Use setsid to create a new process group to
-  // avoid hitting this.
-  setsid();
-
-  atrace_begin(ATRACE_TAG, "before reparent");
-  pid_t target_process = getppid();
-
-  // Open /proc/`getppid()` before we daemonize.
-  std::string target_proc_path = "/proc/" + std::to_string(target_process);
-  int target_proc_fd = open(target_proc_path.c_str(), O_DIRECTORY | O_RDONLY);
-  if (target_proc_fd == -1) {
-    PLOG(FATAL) << "failed to open " << target_proc_path;
-  }
-
-  // Make sure getppid() hasn't changed.
-  if (getppid() != target_process) {
-    LOG(FATAL) << "parent died";
+static void SwitchCredentials(const TargetCredentials& creds) {
+  if (setgroups(creds.groups.size(), creds.groups.data()) != 0) {
+    PLOG(FATAL) << "failed to set supplementary groups";
   }
-  atrace_end(ATRACE_TAG);
-
-  // Reparent ourselves to init, so that the signal handler can waitpid on the
-  // original process to avoid leaving a zombie for non-fatal dumps.
-  // Move the input/output pipes off of stdout/stderr, out of paranoia.
-  unique_fd output_pipe(dup(STDOUT_FILENO));
-  unique_fd input_pipe(dup(STDIN_FILENO));
-
-  unique_fd fork_exit_read, fork_exit_write;
-  if (!Pipe(&fork_exit_read, &fork_exit_write)) {
-    PLOG(FATAL) << "failed to create pipe";
+  if (setresgid(creds.gid, creds.gid, creds.gid) != 0) {
+    PLOG(FATAL) << "failed to switch to gid " << creds.gid;
   }
-
-  pid_t forkpid = fork();
-  if (forkpid == -1) {
-    PLOG(FATAL) << "fork failed";
-  } else if (forkpid == 0) {
-    fork_exit_read.reset();
-  } else {
-    // We need the pseudothread to live until we get around to verifying the vm pid against it.
-    // The last thing it does is block on a waitpid on us, so wait until our child tells us to die.
-    fork_exit_write.reset();
-    char buf;
-    TEMP_FAILURE_RETRY(read(fork_exit_read.get(), &buf, sizeof(buf)));
-    _exit(0);
+  if (setresuid(creds.uid, creds.uid, creds.uid) != 0) {
+    PLOG(FATAL) << "failed to switch to uid " << creds.uid;
   }
+}
 
-  ATRACE_NAME("after reparent");
-  pid_t pseudothread_tid;
-  DebuggerdDumpType dump_type;
+// Dumps |target_process|, once crash_dump is no longer its child. |input_pipe| carries the
+// crash info, |output_pipe| is written to once the threads are traced, and |release_pseudothread|
+// is closed once the pseudothread is no longer needed.
+static int DumpProcess(pid_t target_process, int target_proc_fd, pid_t pseudothread_tid,
+                       DebuggerdDumpType dump_type, unique_fd input_pipe, unique_fd output_pipe,
+                       unique_fd release_pseudothread, const TargetCredentials* target_creds) {
   ProcessInfo process_info;
 
-  Initialize(argv);
-  ParseArgs(argc, argv, &pseudothread_tid, &dump_type);
-
   // Die if we take too long.
   //
   // Note: processes with many threads and minidebug-info can take a bit to
@@ -485,7 +466,7 @@ int main(int argc, char** argv) {
       ThreadInfo info;
       info.pid = target_process;
       info.tid = thread;
-      info.uid = getuid();
+      info.uid = target_creds ? target_creds->uid : getuid();
       info.thread_name = get_thread_name(thread);
 
       unique_fd attr_fd(openat(target_proc_fd, "attr/current", O_RDONLY | O_CLOEXEC));
@@ -552,7 +533,7 @@ int main(int argc, char** argv) {
   }
 
   // The pseudothread can die now.
-  fork_exit_write.reset();
+  release_pseudothread.reset();
 
   // Defer the message until later, for readability.
   bool wait_for_debugger = android::base::GetBoolProperty(
@@ -578,6 +559,10 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (target_creds) {
+    SwitchCredentials(*target_creds);
+  }
+
   // Drop our capabilities now that we've fetched all of the information we need.
   drop_capabilities();
 
@@ -585,7 +570,7 @@ int main(int argc, char** argv) {
     ATRACE_NAME("tombstoned_connect");
     LOG(INFO) << "obtaining output fd from tombstoned, type: " << dump_type;
     g_tombstoned_connected = tombstoned_connect(g_target_thread, &g_tombstoned_socket, &g_output_fd,
-                                                &g_proto_fd, dump_type);
+                                                &g_proto_fd, dump_type, &g_text_deferred);
   }
 
   if (g_tombstoned_connected) {
@@ -641,8 +626,14 @@ int main(int argc, char** argv) {
 
     {
       ATRACE_NAME("engrave_tombstone");
-      engrave_tombstone(std::move(g_output_fd), std::move(g_proto_fd), &unwinder, thread_info,
-                        g_target_thread, process_info, &open_files, &amfd_data);
+      // The target stays stopped until the dump is done, so unwind its threads in parallel to
+      // keep processes with many threads from being frozen long enough to trip watchdogs.
+      size_t unwind_threads = std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+      // When tombstoned renders the text tombstone itself, only the lines that go to logcat
+      // and ActivityManager are produced here.
+      unique_fd text_fd = g_text_deferred ? unique_fd() : std::move(g_output_fd);
+      engrave_tombstone(std::move(text_fd), std::move(g_proto_fd), &unwinder, thread_info,
+                        g_target_thread, process_info, &open_files, &amfd_data, unwind_threads);
     }
   }
 
@@ -668,9 +659,226 @@ int main(int argc, char** argv) {
 
   // Close stdout before we notify tombstoned of completion.
   close(STDOUT_FILENO);
-  if (g_tombstoned_connected && !tombstoned_notify_completion(g_tombstoned_socket.get())) {
+  if (g_tombstoned_connected &&
+      !tombstoned_notify_completion(g_tombstoned_socket.get(), fatal_signal ? signo : 0,
+                                    get_process_name(target_process).c_str())) {
     LOG(ERROR) << "failed to notify tombstoned of completion";
   }
 
   return 0;
 }
+
+// Reads the supplementary groups of the target, and checks that it has no capabilities, which a
+// pre-spawned crash_dump can't take on.
+static void ReadTargetStatus(int target_proc_fd, TargetCredentials* creds) {
+  unique_fd status_fd(openat(target_proc_fd, "status", O_RDONLY | O_CLOEXEC));
+  std::string status;
+  if (!android::base::ReadFdToString(status_fd, &status)) {
+    PLOG(FATAL) << "failed to read target status";
+  }
+
+  bool found_caps = false;
+  for (std::string_view line : android::base::Split(status, "\n")) {
+    if (android::base::ConsumePrefix(&line, "Groups:")) {
+      for (const auto& group : android::base::Split(android::base::Trim(line), " ")) {
+        gid_t gid;
+        if (!group.empty() && android::base::ParseUint(group, &gid)) {
+          creds->groups.push_back(gid);
+        }
+      }
+    } else if (android::base::ConsumePrefix(&line, "CapPrm:")) {
+      uint64_t caps;
+      if (!android::base::ParseUint("0x" + android::base::Trim(line), &caps)) {
+        LOG(FATAL) << "failed to parse target capabilities: " << line;
+      }
+      if (caps != 0) {
+        LOG(FATAL) << "target has capabilities, it needs an exec'd crash_dump";
+      }
+      found_caps = true;
+    }
+  }
+  if (!found_caps) {
+    LOG(FATAL) << "failed to find target capabilities";
+  }
+}
+
+static pid_t GetPidfdPid(int pidfd) {
+  std::string fdinfo;
+  if (!android::base::ReadFileToString(StringPrintf("/proc/self/fdinfo/%d", pidfd), &fdinfo)) {
+    PLOG(FATAL) << "failed to read pidfd info";
+  }
+  for (std::string_view line : android::base::Split(fdinfo, "\n")) {
+    pid_t pid;
+    if (android::base::ConsumePrefix(&line, "Pid:") &&
+        android::base::ParseInt(android::base::Trim(line), &pid)) {
+      return pid;
+    }
+  }
+  LOG(FATAL) << "failed to find pid in pidfd info";
+  return -1;
+}
+
+// Checks a request against the process that sent it, and dumps that process.
+static int ServeDumpRequest(unique_fd client) {
+  CrashDumpRequest request;
+  unique_fd input_pipe, output_pipe, pidfd;
+  ssize_t rc = android::base::ReceiveFileDescriptors(client, &request, sizeof(request),
+                                                     &input_pipe, &output_pipe, &pidfd);
+  if (rc == -1) {
+    PLOG(FATAL) << "failed to read dump request";
+  } else if (rc != sizeof(request)) {
+    LOG(FATAL) << "read " << rc << " bytes of dump request, expected " << sizeof(request);
+  }
+
+  ucred cr;
+  socklen_t cr_len = sizeof(cr);
+  if (getsockopt(client.get(), SOL_SOCKET, SO_PEERCRED, &cr, &cr_len) != 0) {
+    PLOG(FATAL) << "failed to get peer credentials";
+  }
+  pid_t target_process = cr.pid;
+  g_target_thread = target_process;
+
+  // The pid from the socket could have been reused by now, but not while the pidfd's process is
+  // alive: if it still is once /proc/<pid> is open, that's the right directory.
+  if (GetPidfdPid(pidfd.get()) != target_process) {
+    LOG(FATAL) << "pidfd doesn't refer to the sender";
+  }
+  std::string target_proc_path = "/proc/" + std::to_string(target_process);
+  int target_proc_fd = open(target_proc_path.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+  if (target_proc_fd == -1) {
+    PLOG(FATAL) << "failed to open " << target_proc_path;
+  }
+  if (syscall(__NR_pidfd_send_signal, pidfd.get(), 0, nullptr, 0) != 0) {
+    PLOG(FATAL) << "target exited";
+  }
+
+  // Exec'd, crash_dump can trust its arguments; here they come from the target.
+  if (!pid_contains_tid(target_proc_fd, request.crashing_tid) ||
+      !pid_contains_tid(target_proc_fd, request.pseudothread_tid)) {
+    LOG(FATAL) << "requested threads aren't in process " << target_process;
+  }
+  g_target_thread = request.crashing_tid;
+  CheckDumpType(request.dump_type);
+
+  TargetCredentials creds = {.uid = cr.uid, .gid = cr.gid};
+  if (creds.uid == 0) {
+    LOG(FATAL) << "target is root, it needs an exec'd crash_dump";
+  }
+  ReadTargetStatus(target_proc_fd, &creds);
+
+  return DumpProcess(target_process, target_proc_fd, request.pseudothread_tid, request.dump_type,
+                     std::move(input_pipe), std::move(output_pipe), std::move(client), &creds);
+}
+
+// Runs as a service that keeps a crash_dump forked ahead of time, waiting for a crashing process
+// to hand it a dump. That takes exec'ing and linking crash_dump, which is most of the time a
+// process spends crashing before its threads are stopped, off of the crash path.
+static int RunServer() {
+  int server_fd = android_get_control_socket(kCrashDumpSocketName);
+  if (server_fd == -1) {
+    LOG(FATAL) << "failed to get socket " << kCrashDumpSocketName << " from init";
+  }
+
+  // Workers are never waited for.
+  signal(SIGCHLD, SIG_IGN);
+
+  while (true) {
+    unique_fd accepted_read, accepted_write;
+    if (!Pipe(&accepted_read, &accepted_write)) {
+      PLOG(FATAL) << "failed to create pipe";
+    }
+
+    pid_t worker = fork();
+    if (worker == -1) {
+      PLOG(ERROR) << "fork failed";
+      sleep(1);
+      continue;
+    } else if (worker == 0) {
+      signal(SIGCHLD, SIG_DFL);
+      accepted_read.reset();
+
+      unique_fd client(TEMP_FAILURE_RETRY(accept4(server_fd, nullptr, nullptr, SOCK_CLOEXEC)));
+      if (client == -1) {
+        PLOG(FATAL) << "accept failed";
+      }
+      close(server_fd);
+
+      // Have the next worker forked while this one dumps.
+      accepted_write.reset();
+      _exit(ServeDumpRequest(std::move(client)));
+    }
+
+    // Wait for the worker to take a request, or to die trying.
+    accepted_write.reset();
+    char buf;
+    TEMP_FAILURE_RETRY(read(accepted_read.get(), &buf, sizeof(buf)));
+  }
+}
+
+int main(int argc, char** argv) {
+  DefuseSignalHandlers();
+  InstallSigPipeHandler();
+
+  // There appears to be a bug in the kernel where our death causes SIGHUP to
+  // be sent to our process group if we exit while it has stopped jobs (e.g.
+  // because of wait_for_debugger). Use setsid to create a new process group to
+  // avoid hitting this.
+  setsid();
+
+  if (argc == 2 && strcmp(argv[1], "--server") == 0) {
+    Initialize(argv);
+    return RunServer();
+  }
+
+  atrace_begin(ATRACE_TAG, "before reparent");
+  pid_t target_process = getppid();
+
+  // Open /proc/`getppid()` before we daemonize.
+  std::string target_proc_path = "/proc/" + std::to_string(target_process);
+  int target_proc_fd = open(target_proc_path.c_str(), O_DIRECTORY | O_RDONLY);
+  if (target_proc_fd == -1) {
+    PLOG(FATAL) << "failed to open " << target_proc_path;
+  }
+
+  // Make sure getppid() hasn't changed.
+  if (getppid() != target_process) {
+    LOG(FATAL) << "parent died";
+  }
+  atrace_end(ATRACE_TAG);
+
+  // Reparent ourselves to init, so that the signal handler can waitpid on the
+  // original process to avoid leaving a zombie for non-fatal dumps.
+  // Move the input/output pipes off of stdout/stderr, out of paranoia.
+  unique_fd output_pipe(dup(STDOUT_FILENO));
+  unique_fd input_pipe(dup(STDIN_FILENO));
+
+  unique_fd fork_exit_read, fork_exit_write;
+  if (!Pipe(&fork_exit_read, &fork_exit_write)) {
+    PLOG(FATAL) << "failed to create pipe";
+  }
+
+  pid_t forkpid = fork();
+  if (forkpid == -1) {
+    PLOG(FATAL) << "fork failed";
+  } else if (forkpid == 0) {
+    fork_exit_read.reset();
+  } else {
+    // We need the pseudothread to live until we get around to verifying the vm pid against it.
+    // The last thing it does is block on a waitpid on us, so wait until our child tells us to die.
+    fork_exit_write.reset();
+    char buf;
+    TEMP_FAILURE_RETRY(read(fork_exit_read.get(), &buf, sizeof(buf)));
+    _exit(0);
+  }
+
+  ATRACE_NAME("after reparent");
+  pid_t pseudothread_tid;
+  DebuggerdDumpType dump_type;
+
+  Initialize(argv);
+  ParseArgs(argc, argv, &pseudothread_tid, &dump_type);
+
+  return DumpProcess(target_process, target_proc_fd, pseudothread_tid, dump_type,
+                     std::move(input_pipe), std::move(output_pipe), std::move(fork_exit_write),
+                     nullptr);
+}
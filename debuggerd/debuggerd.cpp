@@ -19,13 +19,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
+#include <string>
 #include <string_view>
 #include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <debuggerd/client.h>
 #include <procinfo/process.h>
@@ -33,11 +41,20 @@
 
 using android::base::unique_fd;
 
+// Each dump still runs its own crash_dump, forked by the target's signal handler.
+static constexpr size_t kMaxConcurrentDumps = 4;
+
 static void usage(int exit_code) {
-  fprintf(stderr, "usage: debuggerd [-bj] PID\n");
+  fprintf(stderr, "usage: debuggerd [-bj] PID...\n");
+  fprintf(stderr, "       debuggerd [-bj] --cgroup PATH\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "-b, --backtrace    just a backtrace rather than a full tombstone\n");
   fprintf(stderr, "-j                 collect java traces\n");
+  fprintf(stderr, "--cgroup PATH      dump every process in the cgroup at PATH\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "When dumping several processes, up to %zu are dumped at once and their\n",
+          kMaxConcurrentDumps);
+  fprintf(stderr, "output is printed in the order the pids were given.\n");
   _exit(exit_code);
 }
 
@@ -57,40 +74,19 @@ static std::thread spawn_redirect_thread(unique_fd fd) {
   });
 }
 
-int main(int argc, char* argv[]) {
-  if (argc <= 1) usage(0);
-  if (argc > 3) usage(1);
-
-  DebuggerdDumpType dump_type = kDebuggerdTombstone;
-
-  if (argc == 3) {
-    std::string_view flag = argv[1];
-    if (flag == "-b" || flag == "--backtrace") {
-      dump_type = kDebuggerdNativeBacktrace;
-    } else if (flag == "-j") {
-      dump_type = kDebuggerdJavaBacktrace;
-    } else {
-      usage(1);
-    }
-  }
-
-  pid_t pid;
-  if (!android::base::ParseInt(argv[argc - 1], &pid, 1, std::numeric_limits<pid_t>::max())) {
-    usage(1);
-  }
-
-  if (getuid() != 0) {
-    errx(1, "root is required");
-  }
-
+// Resolves |pid| to the pid of its main thread, which is where the dump signal has to go.
+static bool get_main_thread(pid_t pid, pid_t* main_pid, std::string* error) {
   // Check to see if the process exists and that we can actually send a signal to it.
   android::procinfo::ProcessInfo proc_info;
   if (!android::procinfo::GetProcessInfo(pid, &proc_info)) {
-    err(1, "failed to fetch info for process %d", pid);
+    *error = android::base::StringPrintf("failed to fetch info for process %d: %s", pid,
+                                         strerror(errno));
+    return false;
   }
 
   if (proc_info.state == android::procinfo::kProcessStateZombie) {
-    errx(1, "process %d is a zombie", pid);
+    *error = android::base::StringPrintf("process %d is a zombie", pid);
+    return false;
   }
 
   // Send a signal to the main thread pid, not a side thread. The signal
@@ -101,10 +97,25 @@ int main(int argc, char* argv[]) {
   // See b/194346289 for extra details.
   if (kill(proc_info.pid, 0) != 0) {
     if (pid == proc_info.pid) {
-      err(1, "cannot send signal to process %d", pid);
+      *error = android::base::StringPrintf("cannot send signal to process %d: %s", pid,
+                                           strerror(errno));
     } else {
-      err(1, "cannot send signal to main thread %d (requested thread %d)", proc_info.pid, pid);
+      *error = android::base::StringPrintf(
+          "cannot send signal to main thread %d (requested thread %d): %s", proc_info.pid, pid,
+          strerror(errno));
     }
+    return false;
+  }
+
+  *main_pid = proc_info.pid;
+  return true;
+}
+
+static int dump_one(pid_t pid, DebuggerdDumpType dump_type) {
+  pid_t main_pid;
+  std::string error;
+  if (!get_main_thread(pid, &main_pid, &error)) {
+    errx(1, "%s", error.c_str());
   }
 
   unique_fd piperead, pipewrite;
@@ -113,15 +124,153 @@ int main(int argc, char* argv[]) {
   }
 
   std::thread redirect_thread = spawn_redirect_thread(std::move(piperead));
-  if (!debuggerd_trigger_dump(proc_info.pid, dump_type, 0, std::move(pipewrite))) {
+  if (!debuggerd_trigger_dump(main_pid, dump_type, 0, std::move(pipewrite))) {
     redirect_thread.join();
-    if (pid == proc_info.pid) {
+    if (pid == main_pid) {
       errx(1, "failed to dump process %d", pid);
     } else {
-      errx(1, "failed to dump main thread %d (requested thread %d)", proc_info.pid, pid);
+      errx(1, "failed to dump main thread %d (requested thread %d)", main_pid, pid);
     }
   }
 
   redirect_thread.join();
   return 0;
 }
+
+struct PendingDump {
+  pid_t pid;
+  bool done = false;
+  std::string output;
+  std::string error;
+};
+
+static void perform_dump(PendingDump* dump, DebuggerdDumpType dump_type) {
+  pid_t main_pid;
+  if (!get_main_thread(dump->pid, &main_pid, &dump->error)) {
+    return;
+  }
+
+  unique_fd piperead, pipewrite;
+  if (!Pipe(&piperead, &pipewrite)) {
+    dump->error = android::base::StringPrintf("failed to create pipe: %s", strerror(errno));
+    return;
+  }
+
+  std::thread reader([dump, fd{std::move(piperead)}]() {
+    android::base::ReadFdToString(fd.get(), &dump->output);
+  });
+  if (!debuggerd_trigger_dump(main_pid, dump_type, 0, std::move(pipewrite))) {
+    dump->error = android::base::StringPrintf("failed to dump process %d", dump->pid);
+  }
+  reader.join();
+}
+
+// Dumps |pids| with up to kMaxConcurrentDumps dumps in flight. Each dump is buffered and
+// written to stdout as soon as all the ones before it are, so the output keeps the order of
+// |pids| while still streaming.
+static int dump_many(const std::vector<pid_t>& pids, DebuggerdDumpType dump_type) {
+  std::vector<PendingDump> dumps(pids.size());
+  for (size_t i = 0; i < pids.size(); ++i) {
+    dumps[i].pid = pids[i];
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::atomic<size_t> next = 0;
+  auto worker = [&]() {
+    for (size_t i = next++; i < dumps.size(); i = next++) {
+      perform_dump(&dumps[i], dump_type);
+      std::lock_guard<std::mutex> lock(mutex);
+      dumps[i].done = true;
+      cv.notify_one();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < std::min(kMaxConcurrentDumps, dumps.size()); ++i) {
+    workers.emplace_back(worker);
+  }
+
+  int rc = 0;
+  for (auto& dump : dumps) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&dump]() { return dump.done; });
+    }
+    if (!dump.error.empty()) {
+      warnx("%s", dump.error.c_str());
+      rc = 1;
+    }
+    android::base::WriteStringToFd(dump.output, STDOUT_FILENO);
+    std::string().swap(dump.output);
+  }
+
+  for (auto& thread : workers) {
+    thread.join();
+  }
+  return rc;
+}
+
+static bool read_cgroup_pids(const char* path, std::vector<pid_t>* pids) {
+  std::string content;
+  if (!android::base::ReadFileToString(std::string(path) + "/cgroup.procs", &content)) {
+    return false;
+  }
+  for (const auto& line : android::base::Split(content, "\n")) {
+    pid_t pid;
+    if (android::base::ParseInt(line, &pid, 1)) {
+      pids->push_back(pid);
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc <= 1) usage(0);
+
+  DebuggerdDumpType dump_type = kDebuggerdTombstone;
+  const char* cgroup = nullptr;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i) {
+    std::string_view flag = argv[i];
+    if (flag == "-b" || flag == "--backtrace") {
+      dump_type = kDebuggerdNativeBacktrace;
+    } else if (flag == "-j") {
+      dump_type = kDebuggerdJavaBacktrace;
+    } else if (flag == "--cgroup" && i + 1 < argc) {
+      cgroup = argv[++i];
+    } else {
+      usage(1);
+    }
+  }
+
+  std::vector<pid_t> pids;
+  for (; i < argc; ++i) {
+    pid_t pid;
+    if (!android::base::ParseInt(argv[i], &pid, 1, std::numeric_limits<pid_t>::max())) {
+      usage(1);
+    }
+    pids.push_back(pid);
+  }
+
+  if (cgroup != nullptr) {
+    if (!pids.empty()) usage(1);
+    if (!read_cgroup_pids(cgroup, &pids)) {
+      err(1, "failed to read processes of cgroup %s", cgroup);
+    }
+    if (pids.empty()) {
+      return 0;
+    }
+  } else if (pids.empty()) {
+    usage(1);
+  }
+
+  if (getuid() != 0) {
+    errx(1, "root is required");
+  }
+
+  if (pids.size() == 1 && cgroup == nullptr) {
+    return dump_one(pids[0], dump_type);
+  }
+  return dump_many(pids, dump_type);
+}
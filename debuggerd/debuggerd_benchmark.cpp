@@ -22,7 +22,10 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 #include <debuggerd/client.h>
@@ -63,7 +66,7 @@ static std::chrono::duration<double> GetMaximumPause(std::atomic<ThreadState>& s
   return max_diff;
 }
 
-static void PerformDump() {
+static void PerformDump(DebuggerdDumpType dump_type = kDebuggerdNativeBacktrace) {
   pid_t target = getpid();
   pid_t forkpid = fork();
   if (forkpid == -1) {
@@ -84,7 +87,7 @@ static void PerformDump() {
       err(1, "failed to open /dev/null");
     }
 
-    if (!debuggerd_trigger_dump(target, kDebuggerdNativeBacktrace, 1000, std::move(output_fd))) {
+    if (!debuggerd_trigger_dump(target, dump_type, 1000, std::move(output_fd))) {
       errx(1, "failed to trigger dump");
     }
 
@@ -122,7 +125,38 @@ static void BM_maximum_pause_debuggerd(benchmark::State& state) {
   BM_maximum_pause_impl(state, []() { PerformDump(); });
 }
 
+// Dumps a tombstone of a process with state.range(0) idle threads, each of which has to be
+// unwound while the process is stopped.
+static void BM_maximum_pause_debuggerd_tombstone(benchmark::State& state) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  std::vector<std::thread> threads;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    threads.emplace_back([&]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return done; });
+    });
+  }
+
+  BM_maximum_pause_impl(state, []() { PerformDump(kDebuggerdTombstone); });
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+  }
+  cv.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
 BENCHMARK(BM_maximum_pause_noop)->Iterations(128)->UseManualTime();
 BENCHMARK(BM_maximum_pause_debuggerd)->Iterations(128)->UseManualTime();
+BENCHMARK(BM_maximum_pause_debuggerd_tombstone)
+    ->Arg(16)
+    ->Arg(256)
+    ->Iterations(16)
+    ->UseManualTime();
 
 BENCHMARK_MAIN();
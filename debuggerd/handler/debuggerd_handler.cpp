@@ -315,6 +315,87 @@ static DebuggerdDumpType get_dump_type(const debugger_thread_info* thread_info)
   return kDebuggerdTombstoneProto;
 }
 
+static bool has_capabilities() {
+  __user_cap_header_struct capheader;
+  memset(&capheader, 0, sizeof(capheader));
+  capheader.version = _LINUX_CAPABILITY_VERSION_3;
+  capheader.pid = 0;
+
+  __user_cap_data_struct capdata[2];
+  if (capget(&capheader, &capdata[0]) == -1) {
+    // Assume the worst.
+    return true;
+  }
+  return capdata[0].permitted != 0 || capdata[1].permitted != 0;
+}
+
+// Hands the dump to the pre-spawned crash_dump, if one is running, which saves exec'ing one.
+// Returns the connection on success; crash_dump closes its end once the pseudothread is no longer
+// needed. On failure, the caller should exec crash_dump as usual.
+static unique_fd request_prespawned_dump(const debugger_thread_info* thread_info,
+                                         int crash_info_fd, int reply_fd) {
+  // The pre-spawned crash_dump takes on the credentials of the process it dumps, but it can't take
+  // on capabilities: processes that have any need a crash_dump that inherits them.
+  if (getuid() == 0 || has_capabilities()) {
+    return {};
+  }
+
+  // Lets crash_dump check that the process on the other end of the socket is still the same one.
+  unique_fd pidfd(syscall(__NR_pidfd_open, __getpid(), 0));
+  if (pidfd == -1) {
+    return {};
+  }
+
+  unique_fd sock(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+  if (sock == -1) {
+    return {};
+  }
+
+  sockaddr_un addr = {.sun_family = AF_UNIX};
+  async_safe_format_buffer(addr.sun_path, sizeof(addr.sun_path), "/dev/socket/%s",
+                           kCrashDumpSocketName);
+  if (TEMP_FAILURE_RETRY(connect(sock.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) !=
+      0) {
+    return {};
+  }
+
+  // Don't hand our memory to anyone but crash_dump.
+  ucred cr;
+  socklen_t cr_len = sizeof(cr);
+  if (getsockopt(sock.get(), SOL_SOCKET, SO_PEERCRED, &cr, &cr_len) != 0 || cr.uid != 0) {
+    async_safe_format_log(ANDROID_LOG_ERROR, "libc", "%s isn't served by crash_dump",
+                          addr.sun_path);
+    return {};
+  }
+
+  CrashDumpRequest request = {
+      .crashing_tid = thread_info->crashing_tid,
+      .pseudothread_tid = thread_info->pseudothread_tid,
+      .dump_type = get_dump_type(thread_info),
+  };
+  iovec iov = {.iov_base = &request, .iov_len = sizeof(request)};
+  int fds[] = {crash_info_fd, reply_fd, pidfd.get()};
+  char cmsg_buf[CMSG_SPACE(sizeof(fds))] = {};
+  msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = cmsg_buf,
+      .msg_controllen = sizeof(cmsg_buf),
+  };
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (TEMP_FAILURE_RETRY(sendmsg(sock.get(), &msg, 0)) != static_cast<ssize_t>(sizeof(request))) {
+    async_safe_format_log(ANDROID_LOG_ERROR, "libc", "failed to send dump request: %s",
+                          strerror(errno));
+    return {};
+  }
+  return sock;
+}
+
 static int debuggerd_dispatch_pseudothread(void* arg) {
   debugger_thread_info* thread_info = static_cast<debugger_thread_info*>(arg);
 
@@ -377,35 +458,40 @@ static int debuggerd_dispatch_pseudothread(void* arg) {
     fatal("failed to write crash info, wrote %zd bytes, expected %zd", rc, expected);
   }
 
-  // Don't use fork(2) to avoid calling pthread_atfork handlers.
-  pid_t crash_dump_pid = __fork();
-  if (crash_dump_pid == -1) {
-    async_safe_format_log(ANDROID_LOG_FATAL, "libc",
-                          "failed to fork in debuggerd signal handler: %s", strerror(errno));
-  } else if (crash_dump_pid == 0) {
-    TEMP_FAILURE_RETRY(dup2(input_write.get(), STDOUT_FILENO));
-    TEMP_FAILURE_RETRY(dup2(output_read.get(), STDIN_FILENO));
-    input_read.reset();
-    input_write.reset();
-    output_read.reset();
-    output_write.reset();
-
-    raise_caps();
-
-    char main_tid[10];
-    char pseudothread_tid[10];
-    char debuggerd_dump_type[10];
-    async_safe_format_buffer(main_tid, sizeof(main_tid), "%d", thread_info->crashing_tid);
-    async_safe_format_buffer(pseudothread_tid, sizeof(pseudothread_tid), "%d",
-                             thread_info->pseudothread_tid);
-    async_safe_format_buffer(debuggerd_dump_type, sizeof(debuggerd_dump_type), "%d",
-                             get_dump_type(thread_info));
-
-    execle(CRASH_DUMP_PATH, CRASH_DUMP_NAME, main_tid, pseudothread_tid, debuggerd_dump_type,
-           nullptr, nullptr);
-    async_safe_format_log(ANDROID_LOG_FATAL, "libc", "failed to exec crash_dump helper: %s",
-                          strerror(errno));
-    return 1;
+  unique_fd crash_dump_server =
+      request_prespawned_dump(thread_info, output_read.get(), input_write.get());
+  pid_t crash_dump_pid = -1;
+  if (crash_dump_server == -1) {
+    // Don't use fork(2) to avoid calling pthread_atfork handlers.
+    crash_dump_pid = __fork();
+    if (crash_dump_pid == -1) {
+      async_safe_format_log(ANDROID_LOG_FATAL, "libc",
+                            "failed to fork in debuggerd signal handler: %s", strerror(errno));
+    } else if (crash_dump_pid == 0) {
+      TEMP_FAILURE_RETRY(dup2(input_write.get(), STDOUT_FILENO));
+      TEMP_FAILURE_RETRY(dup2(output_read.get(), STDIN_FILENO));
+      input_read.reset();
+      input_write.reset();
+      output_read.reset();
+      output_write.reset();
+
+      raise_caps();
+
+      char main_tid[10];
+      char pseudothread_tid[10];
+      char debuggerd_dump_type[10];
+      async_safe_format_buffer(main_tid, sizeof(main_tid), "%d", thread_info->crashing_tid);
+      async_safe_format_buffer(pseudothread_tid, sizeof(pseudothread_tid), "%d",
+                               thread_info->pseudothread_tid);
+      async_safe_format_buffer(debuggerd_dump_type, sizeof(debuggerd_dump_type), "%d",
+                               get_dump_type(thread_info));
+
+      execle(CRASH_DUMP_PATH, CRASH_DUMP_NAME, main_tid, pseudothread_tid, debuggerd_dump_type,
+             nullptr, nullptr);
+      async_safe_format_log(ANDROID_LOG_FATAL, "libc", "failed to exec crash_dump helper: %s",
+                            strerror(errno));
+      return 1;
+    }
   }
 
   input_write.reset();
@@ -438,13 +524,19 @@ static int debuggerd_dispatch_pseudothread(void* arg) {
     }
   }
 
-  // Don't leave a zombie child.
-  int status;
-  if (TEMP_FAILURE_RETRY(waitpid(crash_dump_pid, &status, 0)) == -1) {
-    async_safe_format_log(ANDROID_LOG_FATAL, "libc", "failed to wait for crash_dump helper: %s",
-                          strerror(errno));
-  } else if (WIFSTOPPED(status) || WIFSIGNALED(status)) {
-    async_safe_format_log(ANDROID_LOG_FATAL, "libc", "crash_dump helper crashed or stopped");
+  if (crash_dump_server != -1) {
+    // The pre-spawned crash_dump isn't our child. Stay alive until it's done verifying the vm
+    // process against us, as an exec'd one would have us wait for its reparenting fork to exit.
+    TEMP_FAILURE_RETRY(read(crash_dump_server.get(), &buf, sizeof(buf)));
+  } else {
+    // Don't leave a zombie child.
+    int status;
+    if (TEMP_FAILURE_RETRY(waitpid(crash_dump_pid, &status, 0)) == -1) {
+      async_safe_format_log(ANDROID_LOG_FATAL, "libc", "failed to wait for crash_dump helper: %s",
+                            strerror(errno));
+    } else if (WIFSTOPPED(status) || WIFSIGNALED(status)) {
+      async_safe_format_log(ANDROID_LOG_FATAL, "libc", "crash_dump helper crashed or stopped");
+    }
   }
 
   if (success) {
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace unwindstack {
+struct FrameData;
+}
+
+// Function names resolved by earlier dumps, kept in one file per build id under a directory
+// shared by all crash_dump processes. Looking a pc up in the mmapped file avoids reading and
+// searching the library's symbol tables again.
+//
+// Each file starts with a SymbolCacheHeader, followed by records of the form
+//   uint64_t rel_pc, uint64_t function_offset, uint32_t name_length, char name[name_length]
+// Records are only ever appended, a truncated trailing record is ignored.
+struct SymbolCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+
+  static constexpr uint32_t kMagic = 0x4d595344;  // "DSYM"
+  static constexpr uint32_t kVersion = 1;
+};
+
+class SymbolCache {
+ public:
+  // Returns the cache in the directory named by the debuggerd.symbol_cache.dir property, or
+  // nullptr if it isn't set.
+  static SymbolCache* Get();
+
+  explicit SymbolCache(std::string dir) : dir_(std::move(dir)) {}
+
+  // Fills in the function name and offset of |frame|, which must have been unwound without
+  // resolving names. Safe to call from several threads at once.
+  void FillInFunctionName(unwindstack::FrameData* frame);
+
+  // Appends the names resolved since the last call to the cache files.
+  void Flush();
+
+  // Files are not extended past this size.
+  static constexpr size_t kMaxFileSize = 4 * 1024 * 1024;
+
+ private:
+  struct Entry {
+    std::string_view name;
+    uint64_t function_offset;
+  };
+
+  struct Record {
+    uint64_t rel_pc;
+    uint64_t function_offset;
+    std::string name;
+  };
+
+  struct File {
+    ~File();
+
+    void* map = nullptr;
+    size_t map_size = 0;
+    // rel_pc -> name, pointing into |map| or |pending|
+    std::unordered_map<uint64_t, Entry> entries;
+    // names resolved by this process, a deque keeps them in place
+    std::deque<Record> pending;
+    // number of |pending| records already written out
+    size_t flushed = 0;
+  };
+
+  File* GetFile(const std::string& build_id);
+
+  std::string dir_;
+  std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<File>> files_;
+};
@@ -21,9 +21,12 @@
 #include <android/fdsan.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -31,35 +34,60 @@
 #include <utility>
 #include <vector>
 
-#include <android-base/file.h>
+#include <android-base/unique_fd.h>
 #include <log/log.h>
 #include <unwindstack/Memory.h>
 
 #include "libdebuggerd/utility.h"
 #include "private/bionic_fdsan.h"
 
+// Layout of the records returned by getdents64(2).
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
 void populate_open_files_list(OpenFilesList* list, pid_t pid) {
+  // Processes can have tens of thousands of fds, so read the directory in large batches and
+  // resolve each link relative to it rather than going through readdir and full paths.
   std::string fd_dir_name = "/proc/" + std::to_string(pid) + "/fd";
-  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(fd_dir_name.c_str()), closedir);
-  if (dir == nullptr) {
+  android::base::unique_fd dir_fd(open(fd_dir_name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (dir_fd == -1) {
     ALOGE("failed to open directory %s: %s", fd_dir_name.c_str(), strerror(errno));
     return;
   }
 
-  struct dirent* de;
-  while ((de = readdir(dir.get())) != nullptr) {
-    if (*de->d_name == '.') {
-      continue;
+  std::vector<char> buf(64 * 1024);
+  char target[PATH_MAX];
+  while (true) {
+    long rc = syscall(__NR_getdents64, dir_fd.get(), buf.data(), buf.size());
+    if (rc <= 0) {
+      if (rc == -1) {
+        ALOGE("failed to read directory %s: %s", fd_dir_name.c_str(), strerror(errno));
+      }
+      return;
     }
 
-    int fd = atoi(de->d_name);
-    std::string path = fd_dir_name + "/" + std::string(de->d_name);
-    std::string target;
-    if (android::base::Readlink(path, &target)) {
-      (*list)[fd].path = target;
-    } else {
-      (*list)[fd].path = "???";
-      ALOGE("failed to readlink %s: %s", path.c_str(), strerror(errno));
+    for (long offset = 0; offset < rc;) {
+      auto* de = reinterpret_cast<linux_dirent64*>(buf.data() + offset);
+      offset += de->d_reclen;
+      if (*de->d_name == '.') {
+        continue;
+      }
+
+      // The kernel lists fds in increasing order, so this appends to the map.
+      int fd = atoi(de->d_name);
+      auto it = list->emplace_hint(list->end(), fd, FDInfo());
+      ssize_t len = readlinkat(dir_fd.get(), de->d_name, target, sizeof(target));
+      if (len >= 0) {
+        it->second.path = std::string(target, len);
+      } else {
+        it->second.path = "???";
+        ALOGE("failed to readlink %s/%s: %s", fd_dir_name.c_str(), de->d_name, strerror(errno));
+      }
     }
   }
 }
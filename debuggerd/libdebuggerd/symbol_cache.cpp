@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DEBUG"
+
+#include "libdebuggerd/symbol_cache.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/properties.h>
+#include <android-base/unique_fd.h>
+#include <async_safe/log.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/SharedString.h>
+#include <unwindstack/Unwinder.h>
+
+using android::base::unique_fd;
+
+static bool read_value(const char*& pos, const char* end, void* value, size_t size) {
+  if (static_cast<size_t>(end - pos) < size) {
+    return false;
+  }
+  memcpy(value, pos, size);
+  pos += size;
+  return true;
+}
+
+SymbolCache* SymbolCache::Get() {
+  static SymbolCache* cache = []() -> SymbolCache* {
+    std::string dir = android::base::GetProperty("debuggerd.symbol_cache.dir", "");
+    return dir.empty() ? nullptr : new SymbolCache(dir);
+  }();
+  return cache;
+}
+
+SymbolCache::File::~File() {
+  if (map != nullptr) {
+    munmap(map, map_size);
+  }
+}
+
+SymbolCache::File* SymbolCache::GetFile(const std::string& build_id) {
+  auto it = files_.find(build_id);
+  if (it != files_.end()) {
+    return it->second.get();
+  }
+
+  auto file = std::make_unique<File>();
+  unique_fd fd(open((dir_ + "/" + build_id).c_str(), O_RDONLY | O_CLOEXEC));
+  struct stat st;
+  if (fd != -1 && fstat(fd.get(), &st) == 0 &&
+      static_cast<size_t>(st.st_size) >= sizeof(SymbolCacheHeader)) {
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (map != MAP_FAILED) {
+      file->map = map;
+      file->map_size = st.st_size;
+    }
+  }
+
+  if (file->map != nullptr) {
+    const char* pos = static_cast<const char*>(file->map);
+    const char* end = pos + file->map_size;
+    SymbolCacheHeader header;
+    read_value(pos, end, &header, sizeof(header));
+    if (header.magic == SymbolCacheHeader::kMagic &&
+        header.version == SymbolCacheHeader::kVersion) {
+      uint64_t rel_pc, function_offset;
+      uint32_t name_length;
+      while (read_value(pos, end, &rel_pc, sizeof(rel_pc)) &&
+             read_value(pos, end, &function_offset, sizeof(function_offset)) &&
+             read_value(pos, end, &name_length, sizeof(name_length)) &&
+             static_cast<size_t>(end - pos) >= name_length) {
+        file->entries[rel_pc] = {std::string_view(pos, name_length), function_offset};
+        pos += name_length;
+      }
+    }
+  }
+
+  return (files_[build_id] = std::move(file)).get();
+}
+
+void SymbolCache::FillInFunctionName(unwindstack::FrameData* frame) {
+  if (frame->map_info == nullptr) {
+    return;
+  }
+  std::string build_id = frame->map_info->GetPrintableBuildID();
+  if (build_id.empty()) {
+    frame->map_info->GetFunctionName(frame->rel_pc, &frame->function_name,
+                                     &frame->function_offset);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    File* file = GetFile(build_id);
+    auto it = file->entries.find(frame->rel_pc);
+    if (it != file->entries.end()) {
+      frame->function_name = std::string(it->second.name);
+      frame->function_offset = it->second.function_offset;
+      return;
+    }
+  }
+
+  // Resolve outside of the lock, this is the slow part.
+  unwindstack::SharedString name;
+  uint64_t function_offset = 0;
+  if (!frame->map_info->GetFunctionName(frame->rel_pc, &name, &function_offset)) {
+    function_offset = 0;
+  }
+  frame->function_name = name;
+  frame->function_offset = function_offset;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  File* file = GetFile(build_id);
+  if (file->entries.count(frame->rel_pc) == 0) {
+    Record& record = file->pending.emplace_back(
+        Record{frame->rel_pc, function_offset, static_cast<const std::string&>(name)});
+    file->entries[record.rel_pc] = {record.name, record.function_offset};
+  }
+}
+
+void SymbolCache::Flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& [build_id, file] : files_) {
+    if (file->flushed == file->pending.size()) {
+      continue;
+    }
+
+    std::string path = dir_ + "/" + build_id;
+    unique_fd fd(open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644));
+    bool created = fd != -1;
+    if (!created) {
+      fd.reset(open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC));
+    }
+    struct stat st;
+    if (fd == -1 || fstat(fd.get(), &st) != 0) {
+      async_safe_format_log(ANDROID_LOG_WARN, LOG_TAG, "failed to open symbol cache %s: %s",
+                            path.c_str(), strerror(errno));
+      continue;
+    }
+
+    std::string buffer;
+    if (created) {
+      SymbolCacheHeader header = {SymbolCacheHeader::kMagic, SymbolCacheHeader::kVersion};
+      buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    for (size_t i = file->flushed; i < file->pending.size(); ++i) {
+      const Record& record = file->pending[i];
+      uint32_t name_length = record.name.size();
+      buffer.append(reinterpret_cast<const char*>(&record.rel_pc), sizeof(record.rel_pc));
+      buffer.append(reinterpret_cast<const char*>(&record.function_offset),
+                    sizeof(record.function_offset));
+      buffer.append(reinterpret_cast<const char*>(&name_length), sizeof(name_length));
+      buffer.append(record.name);
+    }
+    file->flushed = file->pending.size();
+
+    if (st.st_size + buffer.size() > kMaxFileSize) {
+      continue;
+    }
+    // A single append keeps records from concurrent crash_dump processes from interleaving.
+    if (!android::base::WriteFully(fd.get(), buffer.data(), buffer.size())) {
+      async_safe_format_log(ANDROID_LOG_WARN, LOG_TAG, "failed to write symbol cache %s: %s",
+                            path.c_str(), strerror(errno));
+    }
+  }
+}
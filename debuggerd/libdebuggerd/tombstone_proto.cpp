@@ -33,10 +33,14 @@
 #include <sys/sysinfo.h>
 #include <time.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <optional>
 #include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <async_safe/log.h>
 
@@ -57,12 +61,16 @@
 
 #include <procinfo/process.h>
 #include <unwindstack/AndroidUnwinder.h>
+#include <unwindstack/DexFiles.h>
 #include <unwindstack/Error.h>
+#include <unwindstack/JitDebug.h>
 #include <unwindstack/MapInfo.h>
 #include <unwindstack/Maps.h>
 #include <unwindstack/Regs.h>
+#include <unwindstack/Unwinder.h>
 
 #include "libdebuggerd/open_files_list.h"
+#include "libdebuggerd/symbol_cache.h"
 #include "libdebuggerd/utility.h"
 #include "util.h"
 
@@ -429,14 +437,17 @@ static void dump_thread_backtrace(std::vector<unwindstack::FrameData>& frames, T
   }
 }
 
-static void dump_thread(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwinder,
-                        const ThreadInfo& thread_info, bool memory_dump = false) {
-  Thread thread;
-
+static void fill_in_thread(Thread& thread, const ThreadInfo& thread_info) {
   thread.set_id(thread_info.tid);
   thread.set_name(thread_info.thread_name);
   thread.set_tagged_addr_ctrl(thread_info.tagged_addr_ctrl);
   thread.set_pac_enabled_keys(thread_info.pac_enabled_keys);
+}
+
+static void dump_thread(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwinder,
+                        const ThreadInfo& thread_info, bool memory_dump = false) {
+  Thread thread;
+  fill_in_thread(thread, thread_info);
 
   unwindstack::AndroidUnwinderData data;
   // Indicate we want a copy of the initial registers.
@@ -459,8 +470,107 @@ static void dump_thread(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwi
   threads[thread_info.tid] = thread;
 }
 
+// Unwinds threads from captured registers with its own unwindstack::Unwinder and jit/dex
+// state, so that several of them can run at once. The maps, and through them the elf cache,
+// and the process memory are shared with |unwinder|. Function names come from the SymbolCache
+// when one is configured.
+class ThreadUnwinder {
+ public:
+  ThreadUnwinder(unwindstack::AndroidUnwinder* unwinder, unwindstack::ArchEnum arch)
+      : unwinder_(unwinder),
+        process_memory_(unwinder->GetProcessMemory()),
+        jit_debug_(unwindstack::CreateJitDebug(arch, process_memory_)),
+        dex_files_(unwindstack::CreateDexFiles(arch, process_memory_)),
+        symbol_cache_(SymbolCache::Get()) {}
+
+  void Unwind(const ThreadInfo& thread_info, Thread& thread) {
+    fill_in_thread(thread, thread_info);
+
+    std::unique_ptr<unwindstack::Regs> initial_regs(thread_info.registers->Clone());
+    std::unique_ptr<unwindstack::Regs> regs(thread_info.registers->Clone());
+    unwindstack::Unwinder unwinder(kMaxFrames, unwinder_->GetMaps(), regs.get(),
+                                   process_memory_);
+    unwinder.SetJitDebug(jit_debug_.get());
+    unwinder.SetDexFiles(dex_files_.get());
+    unwinder.SetResolveNames(symbol_cache_ == nullptr);
+    unwinder.Unwind();
+
+    if (unwinder.NumFrames() == 0) {
+      async_safe_format_log(ANDROID_LOG_ERROR, LOG_TAG, "Unwind failed for tid %d: Error %s",
+                            thread_info.tid,
+                            unwindstack::GetErrorCodeString(unwinder.LastErrorCode()));
+    } else {
+      std::vector<unwindstack::FrameData> frames = unwinder.ConsumeFrames();
+      if (symbol_cache_ != nullptr) {
+        for (auto& frame : frames) {
+          symbol_cache_->FillInFunctionName(&frame);
+        }
+      }
+      dump_thread_backtrace(frames, thread);
+    }
+    dump_registers(unwinder_, initial_regs, thread, /* memory_dump */ false);
+  }
+
+ private:
+  unwindstack::AndroidUnwinder* unwinder_;
+  std::shared_ptr<unwindstack::Memory> process_memory_;
+  std::unique_ptr<unwindstack::JitDebug> jit_debug_;
+  std::unique_ptr<unwindstack::DexFiles> dex_files_;
+  SymbolCache* symbol_cache_;
+};
+
+// Dumps all threads other than |target_thread|, unwinding up to |unwind_threads| of them at a
+// time. Threads are stored by tid, so the output doesn't depend on which one finishes first.
+static void dump_other_threads(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwinder,
+                               const std::map<pid_t, ThreadInfo>& threads, pid_t target_thread,
+                               size_t unwind_threads) {
+  std::vector<const ThreadInfo*> pending;
+  for (const auto& [tid, thread_info] : threads) {
+    if (tid == target_thread) {
+      continue;
+    }
+    // Threads without captured registers are unwound through ptrace, which only works from the
+    // thread that attached.
+    if (unwind_threads <= 1 || thread_info.registers == nullptr) {
+      dump_thread(tombstone, unwinder, thread_info);
+    } else {
+      pending.push_back(&thread_info);
+    }
+  }
+  if (pending.empty()) {
+    return;
+  }
+
+  std::vector<Thread> results(pending.size());
+  std::atomic<size_t> next = 0;
+  auto worker = [&]() {
+    ThreadUnwinder thread_unwinder(unwinder, pending[0]->registers->Arch());
+    for (size_t i = next++; i < pending.size(); i = next++) {
+      thread_unwinder.Unwind(*pending[i], results[i]);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(unwind_threads, pending.size()); ++i) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+  if (SymbolCache* symbol_cache = SymbolCache::Get()) {
+    symbol_cache->Flush();
+  }
+
+  auto& dumped = *tombstone->mutable_threads();
+  for (size_t i = 0; i < pending.size(); ++i) {
+    dumped[pending[i]->tid] = std::move(results[i]);
+  }
+}
+
 static void dump_mappings(Tombstone* tombstone, unwindstack::Maps* maps,
                           std::shared_ptr<unwindstack::Memory>& process_memory) {
+  tombstone->mutable_memory_mappings()->Reserve(maps->Total());
   for (const auto& map_info : *maps) {
     auto* map = tombstone->add_memory_mappings();
     map->set_begin_address(map_info->start());
@@ -481,7 +591,7 @@ static void dump_mappings(Tombstone* tombstone, unwindstack::Maps* maps,
 
     std::string build_id = map_info->GetPrintableBuildID();
     if (!build_id.empty()) {
-      map->set_build_id(build_id);
+      map->set_build_id(std::move(build_id));
     }
 
     map->set_load_bias(map_info->GetLoadBias(process_memory));
@@ -613,7 +723,8 @@ static void dump_tags_around_fault_addr(Signal* signal, const Tombstone& tombsto
 
 void engrave_tombstone_proto(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwinder,
                              const std::map<pid_t, ThreadInfo>& threads, pid_t target_thread,
-                             const ProcessInfo& process_info, const OpenFilesList* open_files) {
+                             const ProcessInfo& process_info, const OpenFilesList* open_files,
+                             size_t unwind_threads) {
   Tombstone result;
 
   result.set_arch(get_arch());
@@ -676,11 +787,7 @@ void engrave_tombstone_proto(Tombstone* tombstone, unwindstack::AndroidUnwinder*
   // Dump the main thread, but save the memory around the registers.
   dump_thread(&result, unwinder, main_thread, /* memory_dump */ true);
 
-  for (const auto& [tid, thread_info] : threads) {
-    if (tid != target_thread) {
-      dump_thread(&result, unwinder, thread_info);
-    }
-  }
+  dump_other_threads(&result, unwinder, threads, target_thread, unwind_threads);
 
   dump_probable_cause(&result, unwinder, process_info, main_thread);
 
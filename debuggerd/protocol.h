@@ -29,6 +29,13 @@ constexpr char kTombstonedCrashSocketName[] = "tombstoned_crash";
 constexpr char kTombstonedJavaTraceSocketName[] = "tombstoned_java_trace";
 constexpr char kTombstonedInterceptSocketName[] = "tombstoned_intercept";
 
+// Served by a pre-spawned crash_dump of the matching bitness, see crash_dump64.rc.
+#if defined(__LP64__)
+constexpr char kCrashDumpSocketName[] = "crash_dump64";
+#else
+constexpr char kCrashDumpSocketName[] = "crash_dump32";
+#endif
+
 enum class CrashPacketType : uint8_t {
   // Initial request from crash_dump.
   kDumpRequest = 0,
@@ -49,11 +56,25 @@ struct DumpRequest {
   int32_t pid;
 };
 
+struct PerformDump {
+  // Only for kDebuggerdTombstoneProto: tombstoned renders the text tombstone from the proto
+  // after the dump completes, so crash_dump should only write the proto.
+  bool text_deferred;
+};
+
+// Metadata recorded in the artifact index, see artifact_index.h.
+struct CompletedDump {
+  int32_t signal;
+  char process_name[64];
+};
+
 // The full packet must always be written, regardless of whether the union is used.
 struct TombstonedCrashPacket {
   CrashPacketType packet_type;
   union {
     DumpRequest dump_request;
+    PerformDump perform_dump;
+    CompletedDump completed_dump;
   } packet;
 };
 
@@ -80,6 +101,15 @@ struct InterceptResponse {
   char error_message[127];  // always null-terminated
 };
 
+// Sent from handler to a pre-spawned crash_dump, in place of the arguments an exec'd one gets.
+// Comes with three file descriptors via SCM_RIGHTS: the read end of the pipe carrying the
+// CrashInfo, the write end of the pipe crash_dump replies on, and a pidfd for the sender.
+struct CrashDumpRequest {
+  int32_t crashing_tid;
+  int32_t pseudothread_tid;
+  DebuggerdDumpType dump_type;
+};
+
 // Sent from handler to crash_dump via pipe.
 struct __attribute__((__packed__)) CrashInfoHeader {
   uint32_t version;
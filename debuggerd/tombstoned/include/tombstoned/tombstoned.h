@@ -22,11 +22,17 @@
 
 #include "dump_type.h"
 
+// If |text_deferred| is non-null, it's set to whether tombstoned renders the text tombstone
+// itself, in which case only the proto should be written.
 bool tombstoned_connect(pid_t pid, android::base::unique_fd* tombstoned_socket,
                         android::base::unique_fd* text_output_fd,
-                        android::base::unique_fd* proto_output_fd, DebuggerdDumpType dump_type);
+                        android::base::unique_fd* proto_output_fd, DebuggerdDumpType dump_type,
+                        bool* text_deferred = nullptr);
 
 bool tombstoned_connect(pid_t pid, android::base::unique_fd* tombstoned_socket,
                         android::base::unique_fd* text_output_fd, DebuggerdDumpType dump_type);
 
 bool tombstoned_notify_completion(int tombstoned_socket);
+
+// Like the above, but also records the signal and process name in tombstoned's artifact index.
+bool tombstoned_notify_completion(int tombstoned_socket, int signal, const char* process_name);
@@ -17,37 +17,51 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <array>
+#include <condition_variable>
 #include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <event2/event.h>
 #include <event2/listener.h>
 #include <event2/thread.h>
 
 #include <android-base/cmsg.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/unique_fd.h>
 #include <cutils/sockets.h>
+#include <zstd.h>
 
+#include "artifact_index.h"
 #include "debuggerd/handler.h"
 #include "dump_type.h"
+#include "libdebuggerd/tombstone.h"
 #include "protocol.h"
+#include "tombstone.pb.h"
 #include "util.h"
 
 #include "intercept_manager.h"
 
+using android::base::GetBoolProperty;
 using android::base::GetIntProperty;
+using android::base::ReadFileToString;
 using android::base::SendFileDescriptors;
 using android::base::StringPrintf;
+using android::base::WriteStringToFd;
 
 using android::base::borrowed_fd;
 using android::base::unique_fd;
@@ -71,6 +85,7 @@ struct CrashArtifact {
 };
 
 struct CrashArtifactPaths {
+  size_t slot;
   std::string text;
   std::optional<std::string> proto;
 };
@@ -92,6 +107,9 @@ struct Crash {
   event* crash_event = nullptr;
 
   DebuggerdDumpType crash_type;
+
+  // Whether crash_dump was told to skip the text tombstone, which we render from the proto.
+  bool text_deferred = false;
 };
 
 class CrashQueue {
@@ -101,6 +119,7 @@ class CrashQueue {
       : file_name_prefix_(file_name_prefix),
         dir_path_(dir_path),
         dir_fd_(open(dir_path.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC)),
+        index_fd_(openat(dir_fd_, kArtifactIndexFileName, O_RDWR | O_CREAT | O_CLOEXEC, 0660)),
         max_artifacts_(max_artifacts),
         next_artifact_(0),
         max_concurrent_dumps_(max_concurrent_dumps),
@@ -109,6 +128,9 @@ class CrashQueue {
     if (dir_fd_ == -1) {
       PLOG(FATAL) << "failed to open directory: " << dir_path;
     }
+    if (index_fd_ == -1) {
+      PLOG(ERROR) << "failed to open artifact index in " << dir_path;
+    }
 
     // NOTE: If max_artifacts_ <= max_concurrent_dumps_, then theoretically the
     // same filename could be handed out to multiple processes.
@@ -194,6 +216,7 @@ class CrashQueue {
 
   CrashArtifactPaths get_next_artifact_paths() {
     CrashArtifactPaths result;
+    result.slot = next_artifact_;
     result.text = StringPrintf("%s%02d", file_name_prefix_.c_str(), next_artifact_);
 
     if (supports_proto_) {
@@ -226,8 +249,49 @@ class CrashQueue {
 
   void on_crash_completed() { --num_concurrent_dumps_; }
 
+  void record_in_index(size_t slot, const ArtifactIndexEntry& entry) {
+    if (index_fd_ == -1) {
+      return;
+    }
+    off_t offset = slot * sizeof(entry);
+    if (TEMP_FAILURE_RETRY(pwrite(index_fd_, &entry, sizeof(entry), offset)) != sizeof(entry)) {
+      PLOG(ERROR) << "failed to update artifact index in " << dir_path_;
+    }
+  }
+
  private:
+  // Picks the first unused slot, or the oldest one, without having to stat every artifact.
+  // Returns false if the index doesn't cover every slot yet.
+  bool find_oldest_artifact_from_index() {
+    if (index_fd_ == -1) {
+      return false;
+    }
+
+    std::vector<ArtifactIndexEntry> entries(max_artifacts_);
+    ssize_t size = entries.size() * sizeof(ArtifactIndexEntry);
+    if (TEMP_FAILURE_RETRY(pread(index_fd_, entries.data(), size, 0)) != size) {
+      return false;
+    }
+
+    size_t oldest = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].magic != kArtifactIndexMagic) {
+        oldest = i;
+        break;
+      }
+      if (entries[i].timestamp < entries[oldest].timestamp) {
+        oldest = i;
+      }
+    }
+    next_artifact_ = oldest;
+    return true;
+  }
+
   void find_oldest_artifact() {
+    if (find_oldest_artifact_from_index()) {
+      return;
+    }
+
     size_t oldest_tombstone = 0;
     time_t oldest_time = std::numeric_limits<time_t>::max();
 
@@ -258,6 +322,7 @@ class CrashQueue {
 
   const std::string dir_path_;
   const int dir_fd_;
+  const int index_fd_;
 
   const size_t max_artifacts_;
   int next_artifact_;
@@ -275,6 +340,98 @@ class CrashQueue {
 // Whether java trace dumps are produced via tombstoned.
 static constexpr bool kJavaTraceDumpsEnabled = true;
 
+// Whether text tombstones are rendered here from the proto instead of by crash_dump. This takes
+// the text formatting and its many small writes out of the time the crashing process is stopped.
+static bool text_rendering_deferred() {
+  static bool deferred = GetBoolProperty("tombstoned.defer_text_tombstone", false);
+  return deferred;
+}
+
+// Whether tombstones and traces are stored zstd-compressed, with a ".zst" suffix.
+static bool artifact_compression_enabled() {
+  static bool compress = GetBoolProperty("tombstoned.compress_artifacts", false);
+  return compress;
+}
+
+static std::optional<std::string> store_artifact(borrowed_fd fd, borrowed_fd dirfd,
+                                                 const std::string& path);
+
+// Renders text tombstones from their protos on a background thread, so that the event loop can
+// keep handing out the next dump while the previous one is being converted.
+class TextRenderer {
+ public:
+  struct Job {
+    CrashArtifact text;
+    unique_fd proto_fd;
+    int dir_fd = -1;
+    std::string path;
+  };
+
+  static TextRenderer* instance() {
+    static TextRenderer* renderer = new TextRenderer();
+    return renderer;
+  }
+
+  void enqueue(Job&& job) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_.joinable()) {
+      thread_ = std::thread(&TextRenderer::run, this);
+    }
+    jobs_.emplace_back(std::move(job));
+    cv_.notify_one();
+  }
+
+ private:
+  TextRenderer() = default;
+
+  void run() {
+    while (true) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !jobs_.empty(); });
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      render(job);
+    }
+  }
+
+  static void render(const Job& job) {
+    Tombstone tombstone;
+    if (!tombstone.ParseFromFileDescriptor(job.proto_fd.get())) {
+      LOG(ERROR) << "failed to parse proto tombstone for " << job.path;
+    } else {
+      std::string text;
+      tombstone_proto_to_text(tombstone, [&text](const std::string& line, bool) {
+        text.append(line);
+        text.push_back('\n');
+      });
+      if (!WriteStringToFd(text, job.text.fd)) {
+        PLOG(ERROR) << "failed to write text tombstone for " << job.path;
+      }
+    }
+
+    if (auto stored_path = store_artifact(job.text.fd, job.dir_fd, job.path); stored_path) {
+      // NOTE: Several tools parse this log message, see crash_completed.
+      LOG(ERROR) << "Tombstone written to: " << *stored_path;
+    }
+
+    if (job.text.temporary_path) {
+      if (unlinkat(job.dir_fd.get(), job.text.temporary_path->c_str(), 0) != 0) {
+        PLOG(ERROR) << "failed to unlink temporary tombstone at " << job.path;
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Job> jobs_;
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(TextRenderer);
+};
+
 // Forward declare the callbacks so they can be placed in a sensible order.
 static void crash_accept_cb(evconnlistener* listener, evutil_socket_t sockfd, sockaddr*, int,
                             void*);
@@ -300,6 +457,11 @@ static void perform_request(std::unique_ptr<Crash> crash) {
   }
 
   TombstonedCrashPacket response = {.packet_type = CrashPacketType::kPerformDump};
+  if (!intercepted && crash->crash_type == kDebuggerdTombstoneProto &&
+      text_rendering_deferred()) {
+    response.packet.perform_dump.text_deferred = true;
+    crash->text_deferred = true;
+  }
 
   ssize_t rc = -1;
   if (crash->output.proto) {
@@ -428,6 +590,106 @@ static bool rename_tombstone_fd(borrowed_fd fd, borrowed_fd dirfd, const std::st
   return true;
 }
 
+static bool write_compressed_artifact(borrowed_fd fd, borrowed_fd dirfd, const std::string& path) {
+  std::string contents;
+  if (!ReadFileToString(StringPrintf("/proc/self/fd/%d", fd.get()), &contents)) {
+    PLOG(ERROR) << "failed to read tombstone for " << path;
+    return false;
+  }
+
+  std::string compressed(ZSTD_compressBound(contents.size()), '\0');
+  size_t size = ZSTD_compress(compressed.data(), compressed.size(), contents.data(),
+                              contents.size(), ZSTD_CLEVEL_DEFAULT);
+  if (ZSTD_isError(size)) {
+    LOG(ERROR) << "failed to compress tombstone for " << path << ": " << ZSTD_getErrorName(size);
+    return false;
+  }
+  compressed.resize(size);
+
+  // Write under a temporary name so that readers never see a partial file.
+  std::string tmp_path = path + ".tmp";
+  unique_fd out(openat(dirfd.get(), tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0660));
+  if (out == -1) {
+    PLOG(ERROR) << "failed to create " << tmp_path;
+    return false;
+  }
+  if (!WriteStringToFd(compressed, out) ||
+      renameat(dirfd.get(), tmp_path.c_str(), dirfd.get(), path.c_str()) != 0) {
+    PLOG(ERROR) << "failed to write compressed tombstone at " << path;
+    unlinkat(dirfd.get(), tmp_path.c_str(), 0);
+    return false;
+  }
+  return true;
+}
+
+// Stores the artifact in |fd| at |path|, or compressed at |path|.zst, removing whichever of the
+// two was left in the slot by an earlier crash. Returns the path that was written.
+static std::optional<std::string> store_artifact(borrowed_fd fd, borrowed_fd dirfd,
+                                                 const std::string& path) {
+  std::string compressed_path = path + ".zst";
+  const std::string& stale_path = artifact_compression_enabled() ? path : compressed_path;
+  if (unlinkat(dirfd.get(), stale_path.c_str(), 0) != 0 && errno != ENOENT) {
+    PLOG(ERROR) << "failed to unlink tombstone at " << stale_path;
+  }
+
+  if (!artifact_compression_enabled()) {
+    if (!rename_tombstone_fd(fd, dirfd, path)) {
+      return {};
+    }
+    return path;
+  }
+
+  if (!write_compressed_artifact(fd, dirfd, compressed_path)) {
+    return {};
+  }
+  return compressed_path;
+}
+
+static void record_artifact(CrashQueue* queue, const Crash* crash, const CompletedDump& completed,
+                            size_t slot) {
+  ArtifactIndexEntry entry = {};
+  entry.magic = kArtifactIndexMagic;
+  entry.pid = crash->crash_pid;
+  entry.signal = completed.signal;
+  entry.compressed = artifact_compression_enabled();
+  entry.timestamp = time(nullptr);
+
+  // Clients that don't send a process name, like ART for its traces, are still running.
+  std::string process_name(completed.process_name,
+                           strnlen(completed.process_name, sizeof(completed.process_name)));
+  if (process_name.empty()) {
+    process_name = get_process_name(crash->crash_pid);
+  }
+  strlcpy(entry.process_name, process_name.c_str(), sizeof(entry.process_name));
+
+  queue->record_in_index(slot, entry);
+}
+
+// Links the proto tombstone now and leaves the text tombstone to the TextRenderer.
+static void complete_deferred_text(CrashQueue* queue, Crash* crash,
+                                   const CrashArtifactPaths& paths) {
+  CrashArtifact& proto = *crash->output.proto;
+  store_artifact(proto.fd, queue->dir_fd(), *paths.proto);
+
+  std::string fd_path = StringPrintf("/proc/self/fd/%d", proto.fd.get());
+  TextRenderer::Job job;
+  job.proto_fd.reset(open(fd_path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (job.proto_fd == -1) {
+    PLOG(ERROR) << "failed to reopen proto tombstone for " << paths.text;
+  }
+  job.text = std::move(crash->output.text);
+  job.dir_fd = queue->dir_fd().get();
+  job.path = paths.text;
+  TextRenderer::instance()->enqueue(std::move(job));
+
+  if (proto.temporary_path) {
+    if (unlinkat(queue->dir_fd().get(), proto.temporary_path->c_str(), 0) != 0) {
+      PLOG(ERROR) << "failed to unlink temporary proto tombstone";
+    }
+  }
+}
+
 static void crash_completed(borrowed_fd sockfd, std::unique_ptr<Crash> crash) {
   TombstonedCrashPacket request = {};
   CrashQueue* queue = CrashQueue::for_crash(crash);
@@ -454,15 +716,22 @@ static void crash_completed(borrowed_fd sockfd, std::unique_ptr<Crash> crash) {
   }
 
   CrashArtifactPaths paths = queue->get_next_artifact_paths();
+  record_artifact(queue, crash.get(), request.packet.completed_dump, paths.slot);
+
+  if (crash->text_deferred && crash->output.proto && paths.proto) {
+    complete_deferred_text(queue, crash.get(), paths);
+    return;
+  }
 
-  if (rename_tombstone_fd(crash->output.text.fd, queue->dir_fd(), paths.text)) {
+  if (auto text_path = store_artifact(crash->output.text.fd, queue->dir_fd(), paths.text);
+      text_path) {
     if (crash->crash_type == kDebuggerdJavaBacktrace) {
-      LOG(ERROR) << "Traces for pid " << crash->crash_pid << " written to: " << paths.text;
+      LOG(ERROR) << "Traces for pid " << crash->crash_pid << " written to: " << *text_path;
     } else {
       // NOTE: Several tools parse this log message to figure out where the
       // tombstone associated with a given native crash was written. Any changes
       // to this message must be carefully considered.
-      LOG(ERROR) << "Tombstone written to: " << paths.text;
+      LOG(ERROR) << "Tombstone written to: " << *text_path;
     }
   }
 
@@ -470,7 +739,7 @@ static void crash_completed(borrowed_fd sockfd, std::unique_ptr<Crash> crash) {
     if (!paths.proto) {
       LOG(ERROR) << "missing path for proto tombstone";
     } else {
-      rename_tombstone_fd(crash->output.proto->fd, queue->dir_fd(), *paths.proto);
+      store_artifact(crash->output.proto->fd, queue->dir_fd(), *paths.proto);
     }
   }
 
@@ -17,6 +17,7 @@
 #include "tombstoned/tombstoned.h"
 
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <utility>
@@ -38,7 +39,8 @@ bool tombstoned_connect(pid_t pid, unique_fd* tombstoned_socket, unique_fd* text
 }
 
 bool tombstoned_connect(pid_t pid, unique_fd* tombstoned_socket, unique_fd* text_output_fd,
-                        unique_fd* proto_output_fd, DebuggerdDumpType dump_type) {
+                        unique_fd* proto_output_fd, DebuggerdDumpType dump_type,
+                        bool* text_deferred) {
   unique_fd sockfd(
       socket_local_client((dump_type != kDebuggerdJavaBacktrace ? kTombstonedCrashSocketName
                                                                 : kTombstonedJavaTraceSocketName),
@@ -94,12 +96,25 @@ bool tombstoned_connect(pid_t pid, unique_fd* tombstoned_socket, unique_fd* text
   if (proto_output_fd) {
     *proto_output_fd = std::move(tmp_proto_fd);
   }
+  if (text_deferred) {
+    *text_deferred = packet.packet_type == CrashPacketType::kPerformDump &&
+                     packet.packet.perform_dump.text_deferred;
+  }
   return true;
 }
 
 bool tombstoned_notify_completion(int tombstoned_socket) {
+  return tombstoned_notify_completion(tombstoned_socket, 0, nullptr);
+}
+
+bool tombstoned_notify_completion(int tombstoned_socket, int signal, const char* process_name) {
   TombstonedCrashPacket packet = {};
   packet.packet_type = CrashPacketType::kCompletedDump;
+  packet.packet.completed_dump.signal = signal;
+  if (process_name) {
+    strlcpy(packet.packet.completed_dump.process_name, process_name,
+            sizeof(packet.packet.completed_dump.process_name));
+  }
   if (TEMP_FAILURE_RETRY(write(tombstoned_socket, &packet, sizeof(packet))) != sizeof(packet)) {
     return false;
   }
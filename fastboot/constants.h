@@ -36,6 +36,11 @@
 #define FB_CMD_GSI "gsi"
 #define FB_CMD_SNAPSHOT_UPDATE "snapshot-update"
 #define FB_CMD_FETCH "fetch"
+#define FB_CMD_FETCH_STREAM "fetch-stream"
+#define FB_CMD_FLASH_COMPRESSED "flash-compressed"
+#define FB_CMD_FLASH_STREAM "flash-stream"
+#define FB_CMD_FLASH_BUNDLE "flash-bundle"
+#define FB_CMD_HASH_PARTITION "hash-partition"
 
 #define RESPONSE_OKAY "OKAY"
 #define RESPONSE_FAIL "FAIL"
@@ -45,6 +50,10 @@
 #define FB_COMMAND_SZ 64
 #define FB_RESPONSE_SZ 256
 
+// Frame header for flash-compressed and fetch-stream: compressed length, uncompressed length.
+#define FB_COMPRESSED_FRAME_HEADER_SZ 8
+#define FB_COMPRESSED_FRAME_MAX_SZ (1024 * 1024)
+
 #define FB_VAR_VERSION "version"
 #define FB_VAR_VERSION_BOOTLOADER "version-bootloader"
 #define FB_VAR_VERSION_BASEBAND "version-baseband"
@@ -79,4 +88,15 @@
 #define FB_VAR_SECURITY_PATCH_LEVEL "security-patch-level"
 #define FB_VAR_TREBLE_ENABLED "treble-enabled"
 #define FB_VAR_MAX_FETCH_SIZE "max-fetch-size"
+#define FB_VAR_FETCH_COMPRESSION "fetch-compression"
 #define FB_VAR_DMESG "dmesg"
+#define FB_VAR_FLASH_COMPRESSION "flash-compression"
+#define FB_VAR_MAX_FLASH_STREAM_SIZE "max-flash-stream-size"
+#define FB_VAR_PARTITION_HASH "partition-hash"
+#define FB_VAR_BATCH "batch"
+#define FB_VAR_MAX_GETVAR_BATCH_SIZE "max-getvar-batch-size"
+#define FB_VAR_MAX_BUNDLE_IMAGES "max-bundle-images"
+
+// flash-bundle images start after a header of this many bytes.
+#define FB_BUNDLE_HEADER_SIZE 4096
+#define FB_BUNDLE_MAGIC "fastboot-bundle"
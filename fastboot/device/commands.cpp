@@ -16,10 +16,15 @@
 
 #include "commands.h"
 
+#include <endian.h>
 #include <inttypes.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
 #include <unordered_set>
 
 #include <android-base/logging.h>
@@ -37,6 +42,8 @@
 #include <liblp/builder.h>
 #include <liblp/liblp.h>
 #include <libsnapshot/snapshot.h>
+#include <lz4.h>
+#include <openssl/sha.h>
 #include <storage_literals/storage_literals.h>
 #include <uuid/uuid.h>
 
@@ -147,6 +154,12 @@ const std::unordered_map<std::string, VariableHandlers> kVariableMap = {
         {FB_VAR_SECURITY_PATCH_LEVEL, {GetSecurityPatchLevel, nullptr}},
         {FB_VAR_TREBLE_ENABLED, {GetTrebleEnabled, nullptr}},
         {FB_VAR_MAX_FETCH_SIZE, {GetMaxFetchSize, nullptr}},
+        {FB_VAR_FLASH_COMPRESSION, {GetFlashCompression, nullptr}},
+        {FB_VAR_FETCH_COMPRESSION, {GetFetchCompression, nullptr}},
+        {FB_VAR_MAX_FLASH_STREAM_SIZE, {GetMaxFlashStreamSize, nullptr}},
+        {FB_VAR_PARTITION_HASH, {GetPartitionHash, nullptr}},
+        {FB_VAR_MAX_GETVAR_BATCH_SIZE, {GetMaxGetvarBatchSize, nullptr}},
+        {FB_VAR_MAX_BUNDLE_IMAGES, {GetMaxBundleImages, nullptr}},
 };
 
 static bool GetVarAll(FastbootDevice* device) {
@@ -161,11 +174,51 @@ const std::unordered_map<std::string, std::function<bool(FastbootDevice*)>> kSpe
         {"dmesg", GetDmesg},
 };
 
+// "getvar:batch:VAR[,VAR...]", where each VAR may have arguments of its own, sends a line
+// with "OKAY" and the value, or "FAIL" and an error message, for each variable in order, as
+// a single DATA transfer.
+static bool GetVarBatch(FastbootDevice* device, const std::vector<std::string>& args) {
+    // The command was split on ':', which also separates each variable from its arguments.
+    std::string vars = android::base::Join(std::vector<std::string>(args.begin() + 2, args.end()),
+                                           ":");
+    if (vars.empty()) {
+        return device->WriteFail("Missing argument");
+    }
+
+    std::string results;
+    for (const auto& var : android::base::Split(vars, ",")) {
+        std::vector<std::string> var_args = android::base::Split(var, ":");
+        auto found_variable = kVariableMap.find(var_args[0]);
+        if (found_variable == kVariableMap.end()) {
+            results += "FAILUnknown variable\n";
+            continue;
+        }
+
+        std::string message;
+        std::vector<std::string> getvar_args(var_args.begin() + 1, var_args.end());
+        bool ok = found_variable->second.get(device, getvar_args, &message);
+        results += (ok ? "OKAY" : "FAIL") + message + "\n";
+    }
+
+    if (!device->WriteStatus(FastbootResult::DATA,
+                             android::base::StringPrintf("%08zx", results.size()))) {
+        return false;
+    }
+    if (!device->HandleData(false, results.data(), results.size())) {
+        return false;
+    }
+    return device->WriteOkay("");
+}
+
 bool GetVarHandler(FastbootDevice* device, const std::vector<std::string>& args) {
     if (args.size() < 2) {
         return device->WriteFail("Missing argument");
     }
 
+    if (args[1] == FB_VAR_BATCH) {
+        return GetVarBatch(device, args);
+    }
+
     // "all" and "dmesg" are multiline and handled specially.
     auto found_special = kSpecialVars.find(args[1]);
     if (found_special != kSpecialVars.end()) {
@@ -617,6 +670,155 @@ bool FlashHandler(FastbootDevice* device, const std::vector<std::string>& args)
     return device->WriteStatus(FastbootResult::OKAY, "Flashing succeeded");
 }
 
+bool FlashCompressedHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    // args: flash-compressed, algorithm, uncompressed size in hex, partition.
+    if (args.size() < 4) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
+    }
+
+    if (GetDeviceLockStatus()) {
+        return device->WriteStatus(FastbootResult::FAIL,
+                                   "Flashing is not allowed on locked devices");
+    }
+
+    if (args[1] != "lz4") {
+        return device->WriteFail("Unsupported compression: " + args[1]);
+    }
+    uint64_t size;
+    if (!android::base::ParseUint("0x" + args[2], &size) || size == 0) {
+        return device->WriteFail("Invalid size");
+    }
+
+    const auto& partition_name = args[3];
+    if (IsProtectedPartitionDuringMerge(device, partition_name)) {
+        auto message = "Cannot flash " + partition_name + " while a snapshot update is in progress";
+        return device->WriteFail(message);
+    }
+
+    if (LogicalPartitionExists(device, partition_name)) {
+        CancelPartitionSnapshot(device, partition_name);
+    }
+
+    return FlashCompressed(device, partition_name, size);
+}
+
+bool FlashStreamHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    // args: flash-stream, size as for download, partition.
+    if (args.size() < 3) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
+    }
+
+    if (GetDeviceLockStatus()) {
+        return device->WriteStatus(FastbootResult::FAIL,
+                                   "Flashing is not allowed on locked devices");
+    }
+
+    if (args[1].length() != 8) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size (length of size != 8)");
+    }
+    unsigned int size;
+    if (!android::base::ParseUint("0x" + args[1], &size, kMaxFlashStreamSize) || size == 0) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size");
+    }
+
+    const auto& partition_name = args[2];
+    if (IsProtectedPartitionDuringMerge(device, partition_name)) {
+        auto message = "Cannot flash " + partition_name + " while a snapshot update is in progress";
+        return device->WriteFail(message);
+    }
+
+    if (LogicalPartitionExists(device, partition_name)) {
+        CancelPartitionSnapshot(device, partition_name);
+    }
+
+    return FlashStream(device, partition_name, size);
+}
+
+bool FlashBundleHandler(FastbootDevice* device, const std::vector<std::string>& /* args */) {
+    if (GetDeviceLockStatus()) {
+        return device->WriteStatus(FastbootResult::FAIL,
+                                   "Flashing is not allowed on locked devices");
+    }
+
+    std::vector<BundleImage> images;
+    std::string error;
+    if (!ParseBundle(device->download_data(), &images, &error)) {
+        return device->WriteFail(error);
+    }
+
+    // Only logical partitions can be bundled, since their extents tell whether
+    // they can be written concurrently.
+    for (const auto& image : images) {
+        const auto& partition_name = image.partition_name;
+        if (IsProtectedPartitionDuringMerge(device, partition_name)) {
+            auto message =
+                    "Cannot flash " + partition_name + " while a snapshot update is in progress";
+            return device->WriteFail(message);
+        }
+        if (!LogicalPartitionExists(device, partition_name)) {
+            return device->WriteFail(partition_name + " is not a logical partition");
+        }
+        CancelPartitionSnapshot(device, partition_name);
+    }
+
+    return FlashBundle(device, images);
+}
+
+bool HashPartitionHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    // args: hash-partition, partition, chunk size in hex.
+    if (args.size() < 3) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
+    }
+
+    // The hashes would reveal the contents of the partition just as fetch does.
+    if (GetDeviceLockStatus()) {
+        return device->WriteFail("Hashing is not allowed on locked devices");
+    }
+
+    unsigned int chunk_size;
+    if (!android::base::ParseUint("0x" + args[2], &chunk_size, kMaxHashChunkSize) ||
+        chunk_size == 0 || chunk_size % 4096 != 0) {
+        return device->WriteFail("Invalid chunk size");
+    }
+
+    const auto& partition_name = args[1];
+    PartitionHandle handle;
+    if (!OpenPartition(device, partition_name, &handle, O_RDONLY)) {
+        return device->WriteFail("Cannot open " + partition_name);
+    }
+    uint64_t partition_size = get_block_device_size(handle.fd());
+    if (partition_size == 0) {
+        return device->WriteFail("Partition " + partition_name + " has size 0");
+    }
+    uint64_t num_chunks = (partition_size + chunk_size - 1) / chunk_size;
+    if (num_chunks * SHA256_DIGEST_LENGTH > kMaxFetchSizeDefault) {
+        return device->WriteFail("Chunk size too small");
+    }
+
+    // Hash everything before replying, so that a read error can still be reported.
+    std::vector<char> hashes(num_chunks * SHA256_DIGEST_LENGTH);
+    std::vector<char> buf(chunk_size);
+    posix_fadvise(handle.fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (uint64_t i = 0; i < num_chunks; i++) {
+        size_t len = std::min<uint64_t>(chunk_size, partition_size - i * chunk_size);
+        if (!android::base::ReadFully(handle.fd(), buf.data(), len)) {
+            PLOG(ERROR) << "Unable to read " << partition_name << " chunk " << i;
+            return device->WriteFail("Unable to read " + partition_name);
+        }
+        SHA256(reinterpret_cast<const uint8_t*>(buf.data()), len,
+               reinterpret_cast<uint8_t*>(&hashes[i * SHA256_DIGEST_LENGTH]));
+    }
+
+    if (!device->WriteStatus(FastbootResult::DATA,
+                             android::base::StringPrintf("%08zx", hashes.size()))) {
+        return false;
+    }
+    if (!device->HandleData(false, &hashes)) {
+        return false;
+    }
+    return device->WriteOkay(android::base::StringPrintf("Hashed %" PRIu64 " chunks", num_chunks));
+}
+
 bool UpdateSuperHandler(FastbootDevice* device, const std::vector<std::string>& args) {
     if (args.size() < 2) {
         return device->WriteFail("Invalid arguments");
@@ -727,6 +929,35 @@ class PartitionFetcher {
         return *fetcher.ret_;
     }
 
+    static bool FetchStream(FastbootDevice* device, const std::vector<std::string>& args) {
+        // args: fetch-stream, algorithm, partition, offset in hex, size in hex.
+        if constexpr (!kEnableFetch) {
+            return device->WriteFail("Fetch is not allowed on user build");
+        }
+
+        if (GetDeviceLockStatus()) {
+            return device->WriteFail("Fetch is not allowed on locked devices");
+        }
+
+        if (args.size() < 5) {
+            return device->WriteFail("Invalid arguments");
+        }
+        if (args[1] != "none" && args[1] != "lz4") {
+            return device->WriteFail("Unsupported compression: " + args[1]);
+        }
+
+        // The same arguments as fetch, without the algorithm.
+        std::vector<std::string> fetch_args{args[0], args[2], "0x" + args[3], "0x" + args[4]};
+        PartitionFetcher fetcher(device, fetch_args);
+        fetcher.stream_ = true;
+        fetcher.compress_ = args[1] == "lz4";
+        if (fetcher.Open()) {
+            fetcher.Stream();
+        }
+        CHECK(fetcher.ret_.has_value());
+        return *fetcher.ret_;
+    }
+
   private:
     PartitionFetcher(FastbootDevice* device, const std::vector<std::string>& args)
         : device_(device), args_(&args) {}
@@ -798,7 +1029,8 @@ class PartitionFetcher {
             return false;
         }
 
-        if (total_size_to_read_ > kMaxFetchSizeDefault) {
+        // fetch-stream frames the data, so it isn't bound by the 32-bit size of a DATA reply.
+        if (!stream_ && total_size_to_read_ > kMaxFetchSizeDefault) {
             ret_ = device_->WriteFail(android::base::StringPrintf(
                     "Cannot fetch 0x%" PRIx64
                     " bytes because it exceeds maximum transport size 0x%x",
@@ -855,6 +1087,131 @@ class PartitionFetcher {
                 start_offset_, total_size_to_read_));
     }
 
+    struct Frame {
+        uint32_t header[FB_COMPRESSED_FRAME_HEADER_SZ / sizeof(uint32_t)];
+        std::vector<char> data;
+    };
+
+    Frame MakeFrame(const char* data, uint32_t len) {
+        Frame frame;
+        if (compress_) {
+            frame.data.resize(LZ4_compressBound(len));
+            int compressed_len =
+                    LZ4_compress_default(data, frame.data.data(), len, frame.data.size());
+            // Frames that don't shrink are sent as they are, with both lengths equal.
+            if (compressed_len > 0 && static_cast<uint32_t>(compressed_len) < len) {
+                frame.data.resize(compressed_len);
+            } else {
+                frame.data.assign(data, data + len);
+            }
+        } else {
+            frame.data.assign(data, data + len);
+        }
+        frame.header[0] = htole32(frame.data.size());
+        frame.header[1] = htole32(len);
+        return frame;
+    }
+
+    // Assume Open() returns true.
+    // Frames are read, and compressed, on a second thread while earlier ones are sent. Since the
+    // data is framed, a read error ends the stream early and is reported with FAIL.
+    void Stream() {
+        CHECK(start_offset_ <= std::numeric_limits<off64_t>::max());
+        if (lseek64(handle_.fd(), start_offset_, SEEK_SET) != static_cast<off64_t>(start_offset_)) {
+            ret_ = device_->WriteFail(android::base::StringPrintf(
+                    "On partition %s, unable to lseek(0x%" PRIx64 ": %s", partition_name_.c_str(),
+                    start_offset_, strerror(errno)));
+            return;
+        }
+        posix_fadvise(handle_.fd(), start_offset_, total_size_to_read_, POSIX_FADV_SEQUENTIAL);
+
+        // The largest uncompressed frame that will be sent.
+        auto max_frame_size = android::base::StringPrintf("%08x", FB_COMPRESSED_FRAME_MAX_SZ);
+        if (!device_->WriteStatus(FastbootResult::DATA, max_frame_size)) {
+            ret_ = false;
+            return;
+        }
+
+        std::mutex lock;
+        std::condition_variable cv;
+        std::deque<Frame> frames;
+        bool done = false;
+        bool cancelled = false;
+        auto reader = std::async(std::launch::async, [&]() -> int {
+            std::vector<char> buf(FB_COMPRESSED_FRAME_MAX_SZ);
+            uint64_t end_offset = start_offset_ + total_size_to_read_;
+            int error = 0;
+            for (uint64_t offset = start_offset_; offset < end_offset;) {
+                uint32_t len = std::min<uint64_t>(buf.size(), end_offset - offset);
+                if (!android::base::ReadFully(handle_.fd(), buf.data(), len)) {
+                    error = errno;
+                    PLOG(ERROR) << std::hex << "Unable to read 0x" << len << " bytes from "
+                                << partition_name_ << " @ offset 0x" << offset;
+                    break;
+                }
+                Frame frame = MakeFrame(buf.data(), len);
+                std::unique_lock<std::mutex> guard(lock);
+                cv.wait(guard, [&] { return cancelled || frames.size() < kFetchStreamQueueDepth; });
+                if (cancelled) break;
+                frames.emplace_back(std::move(frame));
+                cv.notify_all();
+                offset += len;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            done = true;
+            cv.notify_all();
+            return error;
+        });
+
+        bool sent = true;
+        for (;;) {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                cv.wait(guard, [&] { return done || !frames.empty(); });
+                if (frames.empty()) break;
+                frame = std::move(frames.front());
+                frames.pop_front();
+                cv.notify_all();
+            }
+            if (!device_->HandleData(false, reinterpret_cast<char*>(frame.header),
+                                     sizeof(frame.header)) ||
+                !device_->HandleData(false, frame.data.data(), frame.data.size())) {
+                PLOG(ERROR) << "Unable to send a frame of " << partition_name_;
+                sent = false;
+                break;
+            }
+        }
+        if (!sent) {
+            std::lock_guard<std::mutex> guard(lock);
+            cancelled = true;
+            cv.notify_all();
+        }
+        int error = reader.get();
+        if (!sent) {
+            ret_ = false;
+            return;
+        }
+
+        // A header with both lengths 0 ends the stream.
+        uint32_t end[FB_COMPRESSED_FRAME_HEADER_SZ / sizeof(uint32_t)] = {};
+        if (!device_->HandleData(false, reinterpret_cast<char*>(end), sizeof(end))) {
+            ret_ = false;
+            return;
+        }
+        if (error) {
+            ret_ = device_->WriteFail(android::base::StringPrintf(
+                    "Unable to read %s: %s", partition_name_.c_str(), strerror(error)));
+            return;
+        }
+        ret_ = device_->WriteOkay(android::base::StringPrintf(
+                "Fetched %s (offset=0x%" PRIx64 ", size=0x%" PRIx64 ")", partition_name_.c_str(),
+                start_offset_, total_size_to_read_));
+    }
+
+    // Frames read ahead of the transfer by Stream().
+    static constexpr size_t kFetchStreamQueueDepth = 4;
+
     static constexpr std::array<const char*, 3> kAllowedPartitions{
             "vendor_boot",
             "vendor_boot_a",
@@ -868,6 +1225,8 @@ class PartitionFetcher {
     uint64_t partition_size_ = 0;
     uint64_t start_offset_ = 0;
     uint64_t total_size_to_read_ = 0;
+    bool stream_ = false;
+    bool compress_ = false;
 
     // What FetchHandler should return.
     std::optional<bool> ret_ = std::nullopt;
@@ -877,3 +1236,7 @@ class PartitionFetcher {
 bool FetchHandler(FastbootDevice* device, const std::vector<std::string>& args) {
     return PartitionFetcher::Fetch(device, args);
 }
+
+bool FetchStreamHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    return PartitionFetcher::FetchStream(device, args);
+}
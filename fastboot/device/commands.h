@@ -21,6 +21,13 @@
 
 constexpr unsigned int kMaxDownloadSizeDefault = 0x10000000;
 constexpr unsigned int kMaxFetchSizeDefault = 0x10000000;
+// flash-stream never holds the image in memory, so it is only limited by the
+// 32-bit size in the protocol.
+constexpr unsigned int kMaxFlashStreamSize = 0xfffff000;
+// Largest chunk hashed by hash-partition, which holds one chunk in memory.
+constexpr unsigned int kMaxHashChunkSize = 0x4000000;
+// Most images written at once by flash-bundle, one thread each.
+constexpr unsigned int kMaxBundleImages = 16;
 
 class FastbootDevice;
 
@@ -52,3 +59,8 @@ bool OemCmdHandler(FastbootDevice* device, const std::vector<std::string>& args)
 bool GsiHandler(FastbootDevice* device, const std::vector<std::string>& args);
 bool SnapshotUpdateHandler(FastbootDevice* device, const std::vector<std::string>& args);
 bool FetchHandler(FastbootDevice* device, const std::vector<std::string>& args);
+bool FetchStreamHandler(FastbootDevice* device, const std::vector<std::string>& args);
+bool FlashCompressedHandler(FastbootDevice* device, const std::vector<std::string>& args);
+bool FlashStreamHandler(FastbootDevice* device, const std::vector<std::string>& args);
+bool HashPartitionHandler(FastbootDevice* device, const std::vector<std::string>& args);
+bool FlashBundleHandler(FastbootDevice* device, const std::vector<std::string>& args);
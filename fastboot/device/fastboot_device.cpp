@@ -84,6 +84,11 @@ FastbootDevice::FastbootDevice()
               {FB_CMD_GSI, GsiHandler},
               {FB_CMD_SNAPSHOT_UPDATE, SnapshotUpdateHandler},
               {FB_CMD_FETCH, FetchHandler},
+              {FB_CMD_FETCH_STREAM, FetchStreamHandler},
+              {FB_CMD_FLASH_COMPRESSED, FlashCompressedHandler},
+              {FB_CMD_FLASH_STREAM, FlashStreamHandler},
+              {FB_CMD_HASH_PARTITION, HashPartitionHandler},
+              {FB_CMD_FLASH_BUNDLE, FlashBundleHandler},
       }),
       boot_control_hal_(IBootControl::getService()),
       health_hal_(get_health_service()),
@@ -178,6 +183,20 @@ bool FastbootDevice::HandleData(bool read, char* data, uint64_t size) {
     return true;
 }
 
+bool FastbootDevice::HandleDataStream(uint64_t size,
+                                      const std::function<bool(const char*, size_t)>& consume) {
+    auto read_data_size = this->get_transport()->ReadStream(size, consume);
+    if (read_data_size == -1) {
+        LOG(ERROR) << "stream read from transport failed";
+        return false;
+    }
+    if (static_cast<size_t>(read_data_size) != size) {
+        LOG(ERROR) << "stream read expected " << size << " bytes, got " << read_data_size;
+        return false;
+    }
+    return true;
+}
+
 void FastbootDevice::ExecuteCommands() {
     char command[FB_RESPONSE_SZ + 1];
     for (;;) {
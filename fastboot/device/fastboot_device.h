@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -41,6 +42,8 @@ class FastbootDevice {
     bool WriteStatus(FastbootResult result, const std::string& message);
     bool HandleData(bool read, std::vector<char>* data);
     bool HandleData(bool read, char* data, uint64_t size);
+    // Reads |size| bytes from the transport, handing them to |consume| as they arrive.
+    bool HandleDataStream(uint64_t size, const std::function<bool(const char*, size_t)>& consume);
     std::string GetCurrentSlot();
 
     // Shortcuts for writing status results.
@@ -15,30 +15,40 @@
  */
 #include "flashing.h"
 
+#include <endian.h>
 #include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <future>
 #include <memory>
 #include <optional>
 #include <set>
 #include <string>
+#include <tuple>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <ext4_utils/ext4_utils.h>
+#include <fs_mgr.h>
 #include <fs_mgr_overlayfs.h>
 #include <fstab/fstab.h>
 #include <libavb/libavb.h>
 #include <liblp/builder.h>
 #include <liblp/liblp.h>
 #include <libsnapshot/snapshot.h>
+#include <lz4.h>
 #include <sparse/sparse.h>
 
+#include "commands.h"
+#include "constants.h"
 #include "fastboot_device.h"
 #include "utility.h"
 
@@ -110,8 +120,8 @@ int FlashRawDataChunk(PartitionHandle* handle, const char* data, size_t len) {
     return 0;
 }
 
-int FlashRawData(PartitionHandle* handle, const std::vector<char>& downloaded_data) {
-    int ret = FlashRawDataChunk(handle, downloaded_data.data(), downloaded_data.size());
+int FlashRawData(PartitionHandle* handle, const char* data, size_t len) {
+    int ret = FlashRawDataChunk(handle, data, len);
     if (ret < 0) {
         return -errno;
     }
@@ -131,9 +141,8 @@ int WriteCallback(void* priv, const void* data, size_t len) {
     return FlashRawDataChunk(handle, reinterpret_cast<const char*>(data), len);
 }
 
-int FlashSparseData(PartitionHandle* handle, std::vector<char>& downloaded_data) {
-    struct sparse_file* file = sparse_file_import_buf(downloaded_data.data(),
-                                                      downloaded_data.size(), true, false);
+int FlashSparseData(PartitionHandle* handle, char* data, size_t len) {
+    struct sparse_file* file = sparse_file_import_buf(data, len, true, false);
     if (!file) {
         // Invalid sparse format
         LOG(ERROR) << "Unable to open sparse data for flashing";
@@ -142,16 +151,28 @@ int FlashSparseData(PartitionHandle* handle, std::vector<char>& downloaded_data)
     return sparse_file_callback(file, false, false, WriteCallback, reinterpret_cast<void*>(handle));
 }
 
-int FlashBlockDevice(PartitionHandle* handle, std::vector<char>& downloaded_data) {
+int FlashBlockDevice(PartitionHandle* handle, char* data, size_t len) {
     lseek64(handle->fd(), 0, SEEK_SET);
-    if (downloaded_data.size() >= sizeof(SPARSE_HEADER_MAGIC) &&
-        *reinterpret_cast<uint32_t*>(downloaded_data.data()) == SPARSE_HEADER_MAGIC) {
-        return FlashSparseData(handle, downloaded_data);
+    if (len >= sizeof(SPARSE_HEADER_MAGIC) &&
+        *reinterpret_cast<uint32_t*>(data) == SPARSE_HEADER_MAGIC) {
+        return FlashSparseData(handle, data, len);
     } else {
-        return FlashRawData(handle, downloaded_data);
+        return FlashRawData(handle, data, len);
     }
 }
 
+int FlashBlockDevice(PartitionHandle* handle, std::vector<char>& downloaded_data) {
+    return FlashBlockDevice(handle, downloaded_data.data(), downloaded_data.size());
+}
+
+// The AVB footer of these partitions must be at the end of the block device,
+// rather than at the end of the image.
+static bool HasAVBFooterAtEnd(const std::string& partition_name) {
+    return partition_name == "boot" || partition_name == "boot_a" || partition_name == "boot_b" ||
+           partition_name == "init_boot" || partition_name == "init_boot_a" ||
+           partition_name == "init_boot_b";
+}
+
 static void CopyAVBFooter(std::vector<char>* data, const uint64_t block_device_size) {
     if (data->size() < AVB_FOOTER_SIZE) {
         return;
@@ -189,10 +210,7 @@ int Flash(FastbootDevice* device, const std::string& partition_name) {
         LOG(ERROR) << "Cannot flash " << data.size() << " bytes to block device of size "
                    << block_device_size;
         return -EOVERFLOW;
-    } else if (data.size() < block_device_size &&
-               (partition_name == "boot" || partition_name == "boot_a" ||
-                partition_name == "boot_b" || partition_name == "init_boot" ||
-                partition_name == "init_boot_a" || partition_name == "init_boot_b")) {
+    } else if (data.size() < block_device_size && HasAVBFooterAtEnd(partition_name)) {
         CopyAVBFooter(&data, block_device_size);
     }
     if (android::base::GetProperty("ro.system.build.type", "") != "user") {
@@ -203,6 +221,472 @@ int Flash(FastbootDevice* device, const std::string& partition_name) {
     return result;
 }
 
+namespace {
+
+// Writes a raw image to a partition front to back, as it is received, and
+// applies the same AVB footer rule as CopyAVBFooter at the end.
+class RawImageWriter {
+  public:
+    RawImageWriter(PartitionHandle* handle, const std::string& partition_name,
+                   uint64_t block_device_size)
+        : handle_(handle),
+          copy_footer_(HasAVBFooterAtEnd(partition_name)),
+          block_device_size_(block_device_size) {}
+
+    int Write(const char* data, size_t len) {
+        if (written_ + len > block_device_size_) {
+            LOG(ERROR) << "Cannot flash more than " << block_device_size_
+                       << " bytes to block device";
+            return -EOVERFLOW;
+        }
+        if (FlashRawDataChunk(handle_, data, len) < 0) {
+            return -errno;
+        }
+        written_ += len;
+
+        // Keep the last AVB_FOOTER_SIZE bytes written.
+        if (len >= AVB_FOOTER_SIZE) {
+            tail_.assign(data + len - AVB_FOOTER_SIZE, data + len);
+        } else {
+            tail_.insert(tail_.end(), data, data + len);
+            if (tail_.size() > AVB_FOOTER_SIZE) {
+                tail_.erase(tail_.begin(), tail_.end() - AVB_FOOTER_SIZE);
+            }
+        }
+        return 0;
+    }
+
+    // Zeroes the rest of the block device and puts the footer at its end, if
+    // the image ended with one.
+    int Finish() {
+        if (!copy_footer_ || written_ >= block_device_size_ || tail_.size() != AVB_FOOTER_SIZE ||
+            memcmp(tail_.data(), AVB_FOOTER_MAGIC, AVB_FOOTER_MAGIC_LEN)) {
+            return 0;
+        }
+        const std::vector<char> zeroes(1024 * 1024, 0);
+        uint64_t footer_offset = block_device_size_ - AVB_FOOTER_SIZE;
+        while (written_ < footer_offset) {
+            size_t len = std::min<uint64_t>(zeroes.size(), footer_offset - written_);
+            if (FlashRawDataChunk(handle_, zeroes.data(), len) < 0) {
+                return -errno;
+            }
+            written_ += len;
+        }
+        if (FlashRawDataChunk(handle_, tail_.data(), tail_.size()) < 0) {
+            return -errno;
+        }
+        return 0;
+    }
+
+    uint64_t written() const { return written_; }
+
+  private:
+    PartitionHandle* handle_;
+    const bool copy_footer_;
+    const uint64_t block_device_size_;
+    uint64_t written_ = 0;
+    std::vector<char> tail_;
+};
+
+}  // namespace
+
+bool FlashCompressed(FastbootDevice* device, const std::string& partition_name, uint64_t size) {
+    PartitionHandle handle;
+    if (!OpenPartition(device, partition_name, &handle, O_WRONLY | O_DIRECT)) {
+        return device->WriteFail(strerror(ENOENT));
+    }
+    uint64_t block_device_size = get_block_device_size(handle.fd());
+    if (size > block_device_size) {
+        LOG(ERROR) << "Cannot flash " << size << " bytes to block device of size "
+                   << block_device_size;
+        return device->WriteFail(strerror(EOVERFLOW));
+    }
+    if (android::base::GetProperty("ro.system.build.type", "") != "user") {
+        WipeOverlayfsForPartition(device, partition_name);
+    }
+    lseek64(handle.fd(), 0, SEEK_SET);
+
+    const uint32_t max_frame_size = FB_COMPRESSED_FRAME_MAX_SZ;
+    std::vector<char> compressed(max_frame_size);
+    std::vector<char> frame(max_frame_size);
+    if (!device->WriteStatus(FastbootResult::DATA,
+                             android::base::StringPrintf("%08x", max_frame_size))) {
+        return false;
+    }
+
+    // Once a write fails, the rest of the stream is still read, so that the
+    // host gets to see the failure instead of a stalled transfer.
+    RawImageWriter writer(&handle, partition_name, block_device_size);
+    int error = 0;
+    for (;;) {
+        uint32_t header[FB_COMPRESSED_FRAME_HEADER_SZ / sizeof(uint32_t)];
+        if (!device->HandleData(true, reinterpret_cast<char*>(header), sizeof(header))) {
+            return false;
+        }
+        uint32_t compressed_len = le32toh(header[0]);
+        uint32_t len = le32toh(header[1]);
+        if (!compressed_len && !len) {
+            break;
+        }
+        if (len > max_frame_size) {
+            return device->WriteFail("Transfer aborted");
+        }
+        if (!len || !compressed_len || compressed_len > len) {
+            return device->WriteFail("Invalid compressed frame");
+        }
+        if (!device->HandleData(true, compressed.data(), compressed_len)) {
+            return false;
+        }
+        if (error) {
+            continue;
+        }
+
+        if (writer.written() + len > size) {
+            LOG(ERROR) << "Compressed stream is larger than " << size << " bytes";
+            error = -EOVERFLOW;
+            continue;
+        }
+        const char* data = compressed.data();
+        if (compressed_len < len) {
+            int rv = LZ4_decompress_safe(compressed.data(), frame.data(), compressed_len, len);
+            if (rv != static_cast<int>(len)) {
+                LOG(ERROR) << "Corrupt lz4 frame at offset " << writer.written();
+                error = -EINVAL;
+                continue;
+            }
+            data = frame.data();
+        }
+        error = writer.Write(data, len);
+    }
+
+    if (!error && writer.written() != size) {
+        LOG(ERROR) << "Compressed stream ended after " << writer.written() << " of " << size
+                   << " bytes";
+        error = -EINVAL;
+    }
+    if (!error) {
+        error = writer.Finish();
+    }
+    sync();
+    if (error) {
+        return device->WriteFail(strerror(-error));
+    }
+    return device->WriteOkay("Flashing succeeded");
+}
+
+namespace {
+
+// Receives the flash-stream payload from a pipe, on its own thread, so that
+// writing overlaps with the transfer. The pipe is always read to the end,
+// even after an error, so that the receiving side never blocks.
+class StreamFlasher {
+  public:
+    StreamFlasher(PartitionHandle* handle, const std::string& partition_name,
+                  uint64_t block_device_size, android::base::unique_fd&& pipe)
+        : handle_(handle),
+          block_device_size_(block_device_size),
+          raw_writer_(handle, partition_name, block_device_size),
+          pipe_(std::move(pipe)) {}
+
+    int RunSparse() {
+        sparse_stream_callbacks callbacks = {
+                .header = OnHeader,
+                .data = OnData,
+                .fill = OnFill,
+                .skip = nullptr,
+        };
+        int rv = sparse_file_import_stream(pipe_.get(), false, false, &callbacks, this);
+        Drain();
+        return rv;
+    }
+
+    int RunRaw() {
+        // Whole aligned buffers, so that the writes stay O_DIRECT.
+        std::unique_ptr<void, decltype(&free)> buffer{nullptr, free};
+        void* p;
+        if (posix_memalign(&p, 4096, kBufferSize)) {
+            Drain();
+            return -ENOMEM;
+        }
+        buffer.reset(p);
+        int error = 0;
+        for (;;) {
+            size_t len = 0;
+            while (len < kBufferSize) {
+                ssize_t n = TEMP_FAILURE_RETRY(
+                        read(pipe_.get(), static_cast<char*>(buffer.get()) + len, kBufferSize - len));
+                if (n <= 0) break;
+                len += n;
+            }
+            if (!len) break;
+            if (!error) {
+                error = raw_writer_.Write(static_cast<char*>(buffer.get()), len);
+            }
+        }
+        return error ? error : raw_writer_.Finish();
+    }
+
+  private:
+    static constexpr size_t kBufferSize = 1024 * 1024;
+
+    static int OnHeader(void* priv, unsigned int block_size, int64_t len) {
+        auto self = reinterpret_cast<StreamFlasher*>(priv);
+        if (static_cast<uint64_t>(len) > self->block_device_size_) {
+            LOG(ERROR) << "Cannot flash " << len << " bytes to block device of size "
+                       << self->block_device_size_;
+            return -EOVERFLOW;
+        }
+        self->block_size_ = block_size;
+        return 0;
+    }
+
+    int Seek(unsigned int block) {
+        off64_t offset = static_cast<off64_t>(block) * block_size_;
+        if (lseek64(handle_->fd(), offset, SEEK_SET) != offset) {
+            int rv = -errno;
+            PLOG(ERROR) << "lseek failed";
+            return rv;
+        }
+        return 0;
+    }
+
+    static int OnData(void* priv, const void* data, size_t len, unsigned int block) {
+        auto self = reinterpret_cast<StreamFlasher*>(priv);
+        if (int rv = self->Seek(block); rv < 0) {
+            return rv;
+        }
+        if (FlashRawDataChunk(self->handle_, reinterpret_cast<const char*>(data), len) < 0) {
+            return -errno;
+        }
+        return 0;
+    }
+
+    static int OnFill(void* priv, uint32_t fill_val, uint64_t len, unsigned int block) {
+        auto self = reinterpret_cast<StreamFlasher*>(priv);
+        if (int rv = self->Seek(block); rv < 0) {
+            return rv;
+        }
+        std::vector<uint32_t> fill(std::min<uint64_t>(len, kBufferSize) / sizeof(uint32_t),
+                                   fill_val);
+        while (len) {
+            size_t chunk = std::min<uint64_t>(len, fill.size() * sizeof(uint32_t));
+            if (FlashRawDataChunk(self->handle_, reinterpret_cast<const char*>(fill.data()),
+                                  chunk) < 0) {
+                return -errno;
+            }
+            len -= chunk;
+        }
+        return 0;
+    }
+
+    void Drain() {
+        char buf[4096];
+        while (TEMP_FAILURE_RETRY(read(pipe_.get(), buf, sizeof(buf))) > 0) {
+        }
+    }
+
+    PartitionHandle* handle_;
+    const uint64_t block_device_size_;
+    unsigned int block_size_ = 0;
+    RawImageWriter raw_writer_;
+    android::base::unique_fd pipe_;
+};
+
+}  // namespace
+
+bool FlashStream(FastbootDevice* device, const std::string& partition_name, uint32_t size) {
+    PartitionHandle handle;
+    if (!OpenPartition(device, partition_name, &handle, O_WRONLY | O_DIRECT)) {
+        return device->WriteFail(strerror(ENOENT));
+    }
+    uint64_t block_device_size = get_block_device_size(handle.fd());
+    if (android::base::GetProperty("ro.system.build.type", "") != "user") {
+        WipeOverlayfsForPartition(device, partition_name);
+    }
+    lseek64(handle.fd(), 0, SEEK_SET);
+
+    android::base::unique_fd pipe_read, pipe_write;
+    if (!android::base::Pipe(&pipe_read, &pipe_write)) {
+        PLOG(ERROR) << "pipe failed";
+        return device->WriteFail(strerror(errno));
+    }
+    // Best effort; a larger pipe just means fewer wakeups.
+    fcntl(pipe_write.get(), F_SETPIPE_SZ, 1024 * 1024);
+
+    if (!device->WriteStatus(FastbootResult::DATA, android::base::StringPrintf("%08x", size))) {
+        return false;
+    }
+
+    std::vector<char> buffer(1024 * 1024);
+    size_t len = std::min<size_t>(size, buffer.size());
+    if (!device->HandleData(true, buffer.data(), len)) {
+        return false;
+    }
+    bool sparse = len >= sizeof(SPARSE_HEADER_MAGIC) &&
+                  *reinterpret_cast<uint32_t*>(buffer.data()) == SPARSE_HEADER_MAGIC;
+
+    StreamFlasher flasher(&handle, partition_name, block_device_size, std::move(pipe_read));
+    std::future<int> result = std::async(std::launch::async, [&]() -> int {
+        return sparse ? flasher.RunSparse() : flasher.RunRaw();
+    });
+
+    bool received = true;
+    if (!android::base::WriteFully(pipe_write, buffer.data(), len)) {
+        PLOG(ERROR) << "write to pipe failed";
+        received = false;
+    } else if (size > len) {
+        // Hand the rest to the flasher as it arrives, without pausing the transfer in between.
+        received = device->HandleDataStream(size - len, [&](const char* data, size_t n) {
+            if (!android::base::WriteFully(pipe_write, data, n)) {
+                PLOG(ERROR) << "write to pipe failed";
+                return false;
+            }
+            return true;
+        });
+    }
+    pipe_write.reset();
+
+    int error = result.get();
+    sync();
+    if (!received) {
+        return false;
+    }
+    if (error) {
+        return device->WriteFail(strerror(-error));
+    }
+    return device->WriteOkay("Flashing succeeded");
+}
+
+bool ParseBundle(const std::vector<char>& data, std::vector<BundleImage>* images,
+                 std::string* error) {
+    if (data.size() < FB_BUNDLE_HEADER_SIZE) {
+        *error = "Bundle is too short";
+        return false;
+    }
+    std::string header(data.data(), strnlen(data.data(), FB_BUNDLE_HEADER_SIZE));
+    std::vector<std::string> lines = android::base::Split(header, "\n");
+    if (lines.size() < 3 || lines[0] != FB_BUNDLE_MAGIC || !lines.back().empty()) {
+        *error = "Invalid bundle header";
+        return false;
+    }
+    lines.erase(lines.begin());
+    lines.pop_back();
+
+    std::set<std::string> names;
+    images->clear();
+    for (const auto& line : lines) {
+        std::vector<std::string> fields = android::base::Split(line, " ");
+        BundleImage image;
+        if (fields.size() != 3 || !android::base::ParseUint(fields[1], &image.offset) ||
+            !android::base::ParseUint(fields[2], &image.size)) {
+            *error = "Invalid bundle entry: " + line;
+            return false;
+        }
+        image.partition_name = fields[0];
+        if (image.offset < FB_BUNDLE_HEADER_SIZE || image.offset > data.size() ||
+            image.size == 0 || image.size > data.size() - image.offset) {
+            *error = "Bundle entry out of bounds: " + line;
+            return false;
+        }
+        if (!names.emplace(image.partition_name).second) {
+            *error = image.partition_name + " is in the bundle twice";
+            return false;
+        }
+        images->emplace_back(std::move(image));
+    }
+    if (images->size() > kMaxBundleImages) {
+        *error = "Too many images in bundle";
+        return false;
+    }
+    return true;
+}
+
+// Returns whether the partitions of |images| share any extent in super, in
+// which case they cannot be written at the same time, or cannot be found.
+static bool PartitionExtentsOverlap(FastbootDevice* device,
+                                    const std::vector<BundleImage>& images) {
+    // Block device name, first sector and sector count of every linear extent.
+    std::vector<std::tuple<std::string, uint64_t, uint64_t>> extents;
+    for (const auto& image : images) {
+        std::string slot_suffix = GetSuperSlotSuffix(device, image.partition_name);
+        uint32_t slot_number = SlotNumberForSlotSuffix(slot_suffix);
+        auto path = FindPhysicalPartition(fs_mgr_get_super_partition_name(slot_number));
+        if (!path) {
+            return true;
+        }
+        std::unique_ptr<LpMetadata> metadata = ReadMetadata(path->c_str(), slot_number);
+        if (!metadata) {
+            return true;
+        }
+        const LpMetadataPartition* partition =
+                FindLogicalPartition(*metadata.get(), image.partition_name);
+        if (!partition) {
+            return true;
+        }
+        for (uint32_t i = 0; i < partition->num_extents; i++) {
+            const auto& extent = metadata->extents[partition->first_extent_index + i];
+            if (extent.target_type != LP_TARGET_TYPE_LINEAR) {
+                continue;
+            }
+            const auto& block_device = metadata->block_devices[extent.target_source];
+            extents.emplace_back(GetBlockDevicePartitionName(block_device), extent.target_data,
+                                 extent.num_sectors);
+        }
+    }
+
+    std::sort(extents.begin(), extents.end());
+    for (size_t i = 1; i < extents.size(); i++) {
+        const auto& [prev_device, prev_start, prev_sectors] = extents[i - 1];
+        const auto& [device_name, start, sectors] = extents[i];
+        if (device_name == prev_device && start < prev_start + prev_sectors) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FlashBundle(FastbootDevice* device, const std::vector<BundleImage>& images) {
+    if (PartitionExtentsOverlap(device, images)) {
+        return device->WriteFail("Bundle partitions overlap in super");
+    }
+
+    // Map every partition up front; each is then written by a thread of its own.
+    std::vector<PartitionHandle> handles(images.size());
+    for (size_t i = 0; i < images.size(); i++) {
+        const auto& name = images[i].partition_name;
+        if (!OpenPartition(device, name, &handles[i], O_WRONLY | O_DIRECT)) {
+            return device->WriteFail("Cannot open " + name);
+        }
+        if (images[i].size > get_block_device_size(handles[i].fd())) {
+            return device->WriteFail("Image is too large for " + name);
+        }
+        if (android::base::GetProperty("ro.system.build.type", "") != "user") {
+            WipeOverlayfsForPartition(device, name);
+        }
+    }
+
+    std::vector<char> data = std::move(device->download_data());
+    std::vector<std::future<int>> results;
+    for (size_t i = 0; i < images.size(); i++) {
+        results.emplace_back(std::async(std::launch::async, [&, i]() -> int {
+            return FlashBlockDevice(&handles[i], data.data() + images[i].offset, images[i].size);
+        }));
+    }
+
+    std::string failed;
+    for (size_t i = 0; i < images.size(); i++) {
+        if (int error = results[i].get(); error < 0 && failed.empty()) {
+            failed = images[i].partition_name + ": " + strerror(-error);
+        }
+    }
+    sync();
+    if (!failed.empty()) {
+        return device->WriteFail(failed);
+    }
+    return device->WriteOkay(
+            android::base::StringPrintf("Flashed %zu partitions", images.size()));
+}
+
 static void RemoveScratchPartition() {
     AutoMountMetadata mount_metadata;
     android::fs_mgr::TeardownAllOverlayForMountPoint();
@@ -16,10 +16,31 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include <string>
 #include <vector>
 
 class FastbootDevice;
 
 int Flash(FastbootDevice* device, const std::string& partition_name);
+// Receives an lz4 frame stream of |size| uncompressed bytes and writes it to
+// the partition as it arrives. Writes the final status itself.
+bool FlashCompressed(FastbootDevice* device, const std::string& partition_name, uint64_t size);
+// Receives a raw or sparse image of |size| bytes and writes it to the
+// partition while it is still arriving. Writes the final status itself.
+bool FlashStream(FastbootDevice* device, const std::string& partition_name, uint32_t size);
 bool UpdateSuper(FastbootDevice* device, const std::string& super_name, bool wipe);
+
+struct BundleImage {
+    std::string partition_name;
+    // Location of the image in the downloaded bundle.
+    uint64_t offset;
+    uint64_t size;
+};
+// Parses the header of a flash-bundle download.
+bool ParseBundle(const std::vector<char>& data, std::vector<BundleImage>* images,
+                 std::string* error);
+// Writes each image of the downloaded bundle to its logical partition, several
+// partitions at a time. Writes the final status itself.
+bool FlashBundle(FastbootDevice* device, const std::vector<BundleImage>& images);
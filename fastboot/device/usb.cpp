@@ -185,6 +185,143 @@ static int usb_ffs_do_aio(usb_handle* h, const void* data, int len, bool read) {
     }
 }
 
+static ssize_t usb_ffs_read_stream(usb_handle* h, char* data, size_t len,
+                                   const usb_read_consumer& consume) {
+    size_t chunk_size = h->num_bufs * h->io_size;
+    if (data == nullptr) {
+        h->stream_bufs.resize(chunk_size);
+    }
+
+    size_t total = 0;
+    while (total < len) {
+        size_t read_len = std::min(len - total, chunk_size);
+        char* buf = data ? data + total : h->stream_bufs.data();
+        int n = usb_ffs_read(h, buf, read_len, true);
+        if (n < 0) {
+            return -1;
+        }
+        if (data == nullptr && !consume(buf, n)) {
+            return -1;
+        }
+        total += n;
+        if (static_cast<size_t>(n) < read_len) {
+            break;
+        }
+    }
+    return total;
+}
+
+static ssize_t usb_ffs_aio_read_stream(usb_handle* h, char* data, size_t len,
+                                       const usb_read_consumer& consume) {
+    constexpr int64_t kPending = INT64_MIN;
+
+    aio_block* aiob = &h->read_aiob;
+    size_t num_bufs = h->num_bufs;
+    if (data == nullptr) {
+        h->stream_bufs.resize(num_bufs * h->io_size);
+    }
+
+    // Slots are used as a ring: requests on the endpoint complete in the order they were
+    // queued, so data is consumed from |head| in order while new requests go in at |tail|.
+    std::vector<size_t> lengths(num_bufs);
+    std::vector<int64_t> results(num_bufs, kPending);
+    std::vector<struct iocb*> batch;
+    size_t head = 0, tail = 0;
+    size_t in_flight = 0;  // Submitted and not yet consumed.
+    size_t pending = 0;    // Submitted and not yet completed.
+    size_t requested = 0, total = 0;
+
+    auto submit = [&]() -> bool {
+        batch.clear();
+        while (in_flight < num_bufs && requested < len) {
+            size_t buf_len = std::min(len - requested, h->io_size);
+            char* buf = data ? data + requested : &h->stream_bufs[tail * h->io_size];
+            io_prep(&aiob->iocb[tail], aiob->fd, buf, buf_len, 0, true);
+            aiob->iocb[tail].aio_data = tail;
+            lengths[tail] = buf_len;
+            results[tail] = kPending;
+            batch.push_back(&aiob->iocb[tail]);
+            tail = (tail + 1) % num_bufs;
+            in_flight++;
+            requested += buf_len;
+        }
+        if (batch.empty()) {
+            return true;
+        }
+        int n = TEMP_FAILURE_RETRY(io_submit(aiob->ctx, batch.size(), batch.data()));
+        int submitted = std::max(n, 0);
+        pending += submitted;
+        if (static_cast<size_t>(submitted) < batch.size()) {
+            PLOG(ERROR) << "aio: got error submitting stream read";
+            in_flight -= batch.size() - submitted;
+            return false;
+        }
+        return true;
+    };
+
+    bool ok = submit();
+    bool done = false;
+    while (ok && !done && in_flight > 0) {
+        int n = TEMP_FAILURE_RETRY(
+                io_getevents(aiob->ctx, 1, num_bufs, aiob->events.data(), nullptr));
+        if (n < 0) {
+            PLOG(ERROR) << "aio: got error waiting stream read";
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            results[aiob->events[i].data] = aiob->events[i].res;
+        }
+        pending -= n;
+
+        while (in_flight > 0 && results[head] != kPending) {
+            int64_t res = results[head];
+            if (res < 0) {
+                errno = -res;
+                PLOG(ERROR) << "aio: got error event on stream read";
+                ok = false;
+                break;
+            }
+            if (data == nullptr && !consume(&h->stream_bufs[head * h->io_size], res)) {
+                ok = false;
+                break;
+            }
+            total += res;
+            in_flight--;
+            if (static_cast<size_t>(res) < lengths[head]) {
+                // The host ended the transfer early.
+                done = true;
+                break;
+            }
+            head = (head + 1) % num_bufs;
+        }
+        if (ok && !done) {
+            ok = submit();
+        }
+    }
+
+    // The buffers of any requests still outstanding can't be released or reused until the
+    // requests have been cancelled and reaped.
+    if (pending > 0) {
+        for (size_t i = 0; i < num_bufs; i++) {
+            if (results[i] == kPending) {
+                io_event event;
+                io_cancel(aiob->ctx, &aiob->iocb[i], &event);
+            }
+        }
+        while (pending > 0) {
+            int n = TEMP_FAILURE_RETRY(
+                    io_getevents(aiob->ctx, pending, num_bufs, aiob->events.data(), nullptr));
+            if (n < 0) {
+                PLOG(ERROR) << "aio: got error reaping cancelled stream reads";
+                return -1;
+            }
+            pending -= n;
+        }
+    }
+    return ok ? static_cast<ssize_t>(total) : -1;
+}
+
 static int usb_ffs_aio_read(usb_handle* h, void* data, int len, bool /* allow_partial */) {
     return usb_ffs_do_aio(h, data, len, true);
 }
@@ -214,12 +351,15 @@ usb_handle* create_usb_handle(unsigned num_bufs, unsigned io_size) {
         // unless backported. Fall back on the non-aio functions instead.
         h->write = usb_ffs_write;
         h->read = usb_ffs_read;
+        h->read_stream = usb_ffs_read_stream;
     } else {
         h->write = usb_ffs_aio_write;
         h->read = usb_ffs_aio_read;
+        h->read_stream = usb_ffs_aio_read_stream;
         aio_block_init(&h->read_aiob, num_bufs);
         aio_block_init(&h->write_aiob, num_bufs);
     }
+    h->num_bufs = num_bufs;
     h->io_size = io_size;
     h->close = usb_ffs_close;
     return h;
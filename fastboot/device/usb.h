@@ -20,6 +20,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <vector>
 
@@ -35,6 +36,9 @@ struct aio_block {
     int fd;
 };
 
+// Receives data read by usb_handle::read_stream. Returning false stops the stream.
+using usb_read_consumer = std::function<bool(const char* data, size_t len)>;
+
 struct usb_handle {
     usb_handle() {}
 
@@ -46,6 +50,12 @@ struct usb_handle {
     int (*read)(usb_handle* h, void* data, int len, bool allow_partial);
     void (*close)(usb_handle* h);
 
+    // Reads |len| bytes, keeping up to num_bufs requests of io_size in flight until the transfer
+    // completes. Data is read into |data|, or if it is null, into a ring of buffers and handed to
+    // |consume| in order. Stops early at a short read. Returns the number of bytes read or -1.
+    ssize_t (*read_stream)(usb_handle* h, char* data, size_t len,
+                           const usb_read_consumer& consume);
+
     // FunctionFS
     android::base::unique_fd control;
     android::base::unique_fd bulk_out;  // "out" from the host's perspective => source for adbd
@@ -57,7 +67,11 @@ struct usb_handle {
     struct aio_block write_aiob;
 
     bool reads_zero_packets;
+    size_t num_bufs;
     size_t io_size;
+
+    // Ring of num_bufs buffers of io_size for read_stream, allocated on first use.
+    std::vector<char> stream_bufs;
 };
 
 usb_handle* create_usb_handle(unsigned num_bufs, unsigned io_size);
@@ -25,6 +25,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+
 #include <android-base/logging.h>
 #include <android-base/properties.h>
 
@@ -32,8 +34,12 @@ constexpr int kMaxPacketSizeFs = 64;
 constexpr int kMaxPacketSizeHs = 512;
 constexpr int kMaxPacketsizeSs = 1024;
 
-constexpr size_t kFbFfsNumBufs = 16;
+// Defaults for the number of transfers kept in flight and their size, which can be overridden
+// with fastbootd.usb.ffs.num_bufs and fastbootd.usb.ffs.io_size.
+constexpr size_t kFbFfsNumBufs = 32;
 constexpr size_t kFbFfsBufSize = 16384;
+constexpr size_t kFbFfsMaxNumBufs = 256;
+constexpr size_t kFbFfsMaxBufSize = 1024 * 1024;
 
 constexpr const char* kUsbFfsFastbootEp0 = "/dev/usb-ffs/fastboot/ep0";
 constexpr const char* kUsbFfsFastbootOut = "/dev/usb-ffs/fastboot/ep1";
@@ -241,7 +247,13 @@ err:
 }
 
 ClientUsbTransport::ClientUsbTransport()
-    : handle_(std::unique_ptr<usb_handle>(create_usb_handle(kFbFfsNumBufs, kFbFfsBufSize))) {
+    : num_bufs_(std::max<size_t>(1, android::base::GetUintProperty<size_t>(
+                                            "fastbootd.usb.ffs.num_bufs", kFbFfsNumBufs,
+                                            kFbFfsMaxNumBufs))),
+      io_size_(std::max<size_t>(kMaxPacketSizeHs, android::base::GetUintProperty<size_t>(
+                                                          "fastbootd.usb.ffs.io_size",
+                                                          kFbFfsBufSize, kFbFfsMaxBufSize))),
+      handle_(std::unique_ptr<usb_handle>(create_usb_handle(num_bufs_, io_size_))) {
     if (!InitFunctionFs(handle_.get())) {
         handle_.reset(nullptr);
     }
@@ -257,9 +269,17 @@ ssize_t ClientUsbTransport::Read(void* data, size_t len) {
         return -1;
     }
     char* char_data = static_cast<char*>(data);
+    if (len > num_bufs_ * io_size_) {
+        // Keep transfers in flight for the whole read rather than waiting for each batch.
+        auto bytes_read = handle_->read_stream(handle_.get(), char_data, len, nullptr);
+        if (bytes_read < 0) {
+            PLOG(ERROR) << "ClientUsbTransport: read failed";
+        }
+        return bytes_read;
+    }
     size_t bytes_read_total = 0;
     while (bytes_read_total < len) {
-        auto bytes_to_read = std::min(len - bytes_read_total, kFbFfsNumBufs * kFbFfsBufSize);
+        auto bytes_to_read = std::min(len - bytes_read_total, num_bufs_ * io_size_);
         auto bytes_read_now =
                 handle_->read(handle_.get(), char_data, bytes_to_read, true /* allow_partial */);
         if (bytes_read_now < 0) {
@@ -275,6 +295,18 @@ ssize_t ClientUsbTransport::Read(void* data, size_t len) {
     return bytes_read_total;
 }
 
+ssize_t ClientUsbTransport::ReadStream(size_t len,
+                                       const std::function<bool(const char*, size_t)>& consume) {
+    if (handle_ == nullptr || len > SSIZE_MAX) {
+        return -1;
+    }
+    auto bytes_read = handle_->read_stream(handle_.get(), nullptr, len, consume);
+    if (bytes_read < 0) {
+        PLOG(ERROR) << "ClientUsbTransport: stream read failed";
+    }
+    return bytes_read;
+}
+
 ssize_t ClientUsbTransport::Write(const void* data, size_t len) {
     if (handle_ == nullptr || len > SSIZE_MAX) {
         return -1;
@@ -282,7 +314,7 @@ ssize_t ClientUsbTransport::Write(const void* data, size_t len) {
     const char* char_data = reinterpret_cast<const char*>(data);
     size_t bytes_written_total = 0;
     while (bytes_written_total < len) {
-        auto bytes_to_write = std::min(len - bytes_written_total, kFbFfsNumBufs * kFbFfsBufSize);
+        auto bytes_to_write = std::min(len - bytes_written_total, num_bufs_ * io_size_);
         auto bytes_written_now = handle_->write(handle_.get(), char_data, bytes_to_write);
         if (bytes_written_now < 0) {
             return bytes_written_total == 0 ? -1 : bytes_written_total;
@@ -27,11 +27,14 @@ class ClientUsbTransport : public Transport {
     ~ClientUsbTransport() override = default;
 
     ssize_t Read(void* data, size_t len) override;
+    ssize_t ReadStream(size_t len, const std::function<bool(const char*, size_t)>& consume) override;
     ssize_t Write(const void* data, size_t len) override;
     int Close() override;
     int Reset() override;
 
   private:
+    size_t num_bufs_;
+    size_t io_size_;
     std::unique_ptr<usb_handle> handle_;
 
     DISALLOW_COPY_AND_ASSIGN(ClientUsbTransport);
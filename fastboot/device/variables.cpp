@@ -522,6 +522,47 @@ bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string
     return true;
 }
 
+bool GetMaxFlashStreamSize(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                           std::string* message) {
+    *message = android::base::StringPrintf("0x%X", kMaxFlashStreamSize);
+    return true;
+}
+
+bool GetMaxBundleImages(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                        std::string* message) {
+    *message = std::to_string(kMaxBundleImages);
+    return true;
+}
+
+bool GetFlashCompression(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                         std::string* message) {
+    *message = "lz4";
+    return true;
+}
+
+bool GetFetchCompression(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                         std::string* message) {
+    if (!kEnableFetch) {
+        *message = "fetch not supported on user builds";
+        return false;
+    }
+    *message = "none,lz4";
+    return true;
+}
+
+bool GetPartitionHash(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                      std::string* message) {
+    *message = "sha256";
+    return true;
+}
+
+bool GetMaxGetvarBatchSize(FastbootDevice* /* device */,
+                           const std::vector<std::string>& /* args */, std::string* message) {
+    // Commands are read into a buffer of the largest response size.
+    *message = android::base::StringPrintf("0x%X", FB_RESPONSE_SZ);
+    return true;
+}
+
 bool GetDmesg(FastbootDevice* device) {
     if (GetDeviceLockStatus()) {
         return device->WriteFail("Cannot use when device flashing is locked");
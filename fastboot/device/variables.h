@@ -82,6 +82,18 @@ bool GetTrebleEnabled(FastbootDevice* device, const std::vector<std::string>& ar
                       std::string* message);
 bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
                      std::string* message);
+bool GetMaxFlashStreamSize(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                           std::string* message);
+bool GetMaxBundleImages(FastbootDevice* device, const std::vector<std::string>& args,
+                        std::string* message);
+bool GetFlashCompression(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                         std::string* message);
+bool GetFetchCompression(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                         std::string* message);
+bool GetMaxGetvarBatchSize(FastbootDevice* device, const std::vector<std::string>& args,
+                           std::string* message);
+bool GetPartitionHash(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                      std::string* message);
 
 // Complex cases.
 bool GetDmesg(FastbootDevice* device);
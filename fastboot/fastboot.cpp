@@ -42,9 +42,17 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif
 
 #include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <optional>
 #include <regex>
 #include <string>
 #include <thread>
@@ -62,6 +70,7 @@
 #include <build/version.h>
 #include <libavb/libavb.h>
 #include <liblp/liblp.h>
+#include <openssl/sha.h>
 #include <platform_tools_version.h>
 #include <sparse/sparse.h>
 #include <ziparchive/zip_archive.h>
@@ -103,6 +112,21 @@ static std::string g_dtb_path;
 
 static bool g_disable_verity = false;
 static bool g_disable_verification = false;
+static bool g_disable_compression = false;
+static bool g_disable_flash_stream = false;
+static bool g_skip_unchanged = false;
+// Most bytes of unzipped images flashall/update keeps ahead of the image being flashed.
+static uint64_t g_prefetch_budget = 2ULL * 1024 * 1024 * 1024;
+// Whether the device accepts lz4 flash-compressed; -1 until queried.
+static int g_flash_compression = -1;
+// Whether the device supports hash-partition, -1 if not queried yet.
+static int g_partition_hash = -1;
+// Most images the device accepts in a flash-bundle, 0 if it doesn't support them; -1 until queried.
+static int64_t g_max_bundle_images = -1;
+
+// When flashing several devices at once, the update package is extracted here
+// a single time, before one process is forked per device.
+static std::string g_update_dir;
 
 fastboot::FastBootDriver* fb = nullptr;
 
@@ -473,6 +497,9 @@ static int show_help() {
             " -w                         Wipe userdata.\n"
             " -s SERIAL                  Specify a USB device.\n"
             " -s tcp|udp:HOST[:PORT]     Specify a network device.\n"
+            "                            Repeat -s to run the commands on several devices\n"
+            "                            in parallel.\n"
+            " --all-devices              Run the commands on every USB device in parallel.\n"
             " -S SIZE[K|M|G]             Break into sparse files no larger than SIZE.\n"
             " --force                    Force a flash operation that may be unsafe.\n"
             " --slot SLOT                Use SLOT; 'all' for both slots, 'other' for\n"
@@ -482,6 +509,18 @@ static int show_help() {
             " --skip-reboot              Don't reboot device after flashing.\n"
             " --disable-verity           Sets disable-verity when flashing vbmeta.\n"
             " --disable-verification     Sets disable-verification when flashing vbmeta.\n"
+            " --disable-compression      Don't send or fetch compressed images, even if the\n"
+            "                            device supports it.\n"
+            " --disable-flash-stream     Download images before flashing them, even if\n"
+            "                            the device can flash them as they arrive.\n"
+            " --skip-unchanged           Only send the parts of images that differ from\n"
+            "                            what is already on the device, if it supports it.\n"
+            " --prefetch-budget SIZE[K|M|G]\n"
+            "                            Unzip upcoming images of an update package ahead\n"
+            "                            of time, using at most SIZE of temporary files\n"
+            "                            (default: 2G). Point TMPDIR at a tmpfs such as\n"
+            "                            /dev/shm, if it has room, to keep unzipping off\n"
+            "                            the disk.\n"
             " --fs-options=OPTION[,OPTION]\n"
             "                            Enable filesystem features. OPTION supports casefold, projid, compress\n"
             // TODO: remove --unbuffered?
@@ -608,10 +647,10 @@ static int make_temporary_fd(const char* /*what*/) {
 
 #else
 
-static std::string make_temporary_template() {
+static std::string make_temporary_template(const char* name = "userdata") {
     const char* tmpdir = getenv("TMPDIR");
     if (tmpdir == nullptr) tmpdir = P_tmpdir;
-    return std::string(tmpdir) + "/fastboot_userdata_XXXXXX";
+    return std::string(tmpdir) + "/fastboot_" + name + "_XXXXXX";
 }
 
 static int make_temporary_fd(const char* what) {
@@ -637,19 +676,20 @@ static unique_fd unzip_to_file(ZipArchiveHandle zip, const char* entry_name) {
         return unique_fd();
     }
 
-    fprintf(stderr, "extracting %s (%" PRIu64 " MB) to disk...", entry_name,
-            zip_entry.uncompressed_length / 1024 / 1024);
+    // This can run on flashall's loader thread, so print a single line once done rather than
+    // leaving a partial line that other output would break up.
     double start = now();
     int error = ExtractEntryToFile(zip, &zip_entry, fd.get());
     if (error != 0) {
-        die("\nfailed to extract '%s': %s", entry_name, ErrorCodeString(error));
+        die("failed to extract '%s': %s", entry_name, ErrorCodeString(error));
     }
 
     if (lseek(fd.get(), 0, SEEK_SET) != 0) {
-        die("\nlseek on extracted file '%s' failed: %s", entry_name, strerror(errno));
+        die("lseek on extracted file '%s' failed: %s", entry_name, strerror(errno));
     }
 
-    fprintf(stderr, " took %.3fs\n", now() - start);
+    fprintf(stderr, "extracted %s (%" PRIu64 " MB) to disk in %.3fs\n", entry_name,
+            zip_entry.uncompressed_length / 1024 / 1024, now() - start);
 
     return fd;
 }
@@ -770,6 +810,19 @@ static void HandlePartitionExists(const std::vector<std::string>& options) {
 }
 
 static void CheckRequirements(const std::string& data, bool force_flash) {
+    std::vector<std::string> vars = {"product"};
+    for (const auto& line : Split(data, "\n")) {
+        std::string name;
+        std::string product;
+        bool invert;
+        std::vector<std::string> options;
+        if (ParseRequirementLine(line, &name, &product, &invert, &options) &&
+            name != "partition-exists") {
+            vars.emplace_back(name);
+        }
+    }
+    fb->GetVars(vars);
+
     std::string cur_product;
     if (fb->GetVar("product", &cur_product) != fastboot::SUCCESS) {
         fprintf(stderr, "getvar:product FAILED (%s)\n", fb->Error().c_str());
@@ -825,10 +878,7 @@ static void DumpInfo() {
 
 }
 
-static struct sparse_file** load_sparse_files(int fd, int64_t max_size) {
-    struct sparse_file* s = sparse_file_import_auto(fd, false, true);
-    if (!s) die("cannot sparse read file");
-
+static struct sparse_file** resparse_file(sparse_file* s, int64_t max_size) {
     if (max_size <= 0 || max_size > std::numeric_limits<uint32_t>::max()) {
       die("invalid max size %" PRId64, max_size);
     }
@@ -845,6 +895,13 @@ static struct sparse_file** load_sparse_files(int fd, int64_t max_size) {
     return out_s;
 }
 
+static struct sparse_file** load_sparse_files(int fd, int64_t max_size) {
+    struct sparse_file* s = sparse_file_import_auto(fd, false, true);
+    if (!s) die("cannot sparse read file");
+
+    return resparse_file(s, max_size);
+}
+
 static uint64_t get_uint_var(const char* var_name) {
     std::string value_str;
     if (fb->GetVar(var_name, &value_str) != fastboot::SUCCESS || value_str.empty()) {
@@ -870,7 +927,13 @@ static int64_t get_sparse_limit(int64_t size) {
         // Unlimited, so see what the target device's limit is.
         // TODO: shouldn't we apply this limit even if you've used -S?
         if (target_sparse_limit == -1) {
-            target_sparse_limit = static_cast<int64_t>(get_uint_var("max-download-size"));
+            // flash-stream doesn't stage images in the device's memory, so it
+            // has its own, larger, limit.
+            uint64_t stream_limit =
+                    g_disable_flash_stream ? 0 : get_uint_var(FB_VAR_MAX_FLASH_STREAM_SIZE);
+            fb->EnableFlashStream(stream_limit > 0);
+            target_sparse_limit = static_cast<int64_t>(
+                    stream_limit ? stream_limit : get_uint_var("max-download-size"));
         }
         if (target_sparse_limit > 0) {
             limit = target_sparse_limit;
@@ -1078,6 +1141,170 @@ static void copy_avb_footer(const std::string& partition, struct fastboot_buffer
     lseek(buf->fd.get(), 0, SEEK_SET);
 }
 
+static bool supports_flash_compression() {
+    if (g_disable_compression) {
+        return false;
+    }
+    if (g_flash_compression == -1) {
+        std::string value;
+        g_flash_compression = 0;
+        if (fb->GetVar(FB_VAR_FLASH_COMPRESSION, &value) == fastboot::SUCCESS) {
+            for (const auto& algorithm : Split(value, ",")) {
+                if (Trim(algorithm) == "lz4") g_flash_compression = 1;
+            }
+        }
+    }
+    return g_flash_compression == 1;
+}
+
+// flash-compressed writes the stream as is, so it can't carry sparse images.
+static bool is_sparse_image(int fd) {
+    uint32_t magic = 0;
+    if (!android::base::ReadFullyAtOffset(fd, &magic, sizeof(magic), 0)) {
+        return false;
+    }
+    return magic == htole32(0xed26ff3a);
+}
+
+static bool supports_partition_hash() {
+    if (g_partition_hash == -1) {
+        std::string value;
+        g_partition_hash = fb->GetVar(FB_VAR_PARTITION_HASH, &value) == fastboot::SUCCESS &&
+                           Trim(value) == "sha256";
+    }
+    return g_partition_hash == 1;
+}
+
+// --skip-unchanged compares images with the device in chunks of this size.
+static constexpr uint32_t HASH_CHUNK_SIZE = 1 * 1024 * 1024;
+
+// Digests of each HASH_CHUNK_SIZE chunk of an expanded image. A chunk that is not entirely
+// covered by the image, because of a "don't care" region or because the image ends first, can't
+// be compared with the device and is marked as such.
+class ChunkHasher {
+  public:
+    explicit ChunkHasher(uint64_t partition_size) : partition_size_(partition_size) { SHA256_Init(&ctx_); }
+
+    static int Write(void* priv, const void* data, size_t len) {
+        auto* self = reinterpret_cast<ChunkHasher*>(priv);
+        while (len > 0) {
+            size_t n = std::min<uint64_t>(len, HASH_CHUNK_SIZE - self->offset_ % HASH_CHUNK_SIZE);
+            if (data) {
+                SHA256_Update(&self->ctx_, data, n);
+                data = reinterpret_cast<const char*>(data) + n;
+                self->current_.has_data = true;
+            } else {
+                self->current_.complete = false;
+            }
+            self->offset_ += n;
+            len -= n;
+            if (self->offset_ % HASH_CHUNK_SIZE == 0) self->EndChunk();
+        }
+        return 0;
+    }
+
+    // Ends the last, partial, chunk of the image.
+    void Finish() {
+        if (offset_ % HASH_CHUNK_SIZE == 0) return;
+        if (offset_ < partition_size_) current_.complete = false;
+        EndChunk();
+    }
+
+    struct Chunk {
+        bool has_data = false;
+        bool complete = true;
+        uint8_t digest[SHA256_DIGEST_LENGTH];
+    };
+    const std::vector<Chunk>& chunks() const { return chunks_; }
+
+  private:
+    void EndChunk() {
+        SHA256_Final(current_.digest, &ctx_);
+        chunks_.emplace_back(current_);
+        current_ = {};
+        SHA256_Init(&ctx_);
+    }
+
+    uint64_t partition_size_;
+    uint64_t offset_ = 0;
+    SHA256_CTX ctx_;
+    Chunk current_;
+    std::vector<Chunk> chunks_;
+};
+
+// Flashes only the chunks of an image that differ from what the partition already holds, as a
+// sparse image in which everything else is "don't care". Returns false, without flashing
+// anything, if the device or the image doesn't allow it.
+static bool flash_changed_chunks(const std::string& partition, struct fastboot_buffer* buf) {
+    if (!supports_partition_hash()) {
+        return false;
+    }
+    uint64_t partition_size = get_partition_size(partition);
+    if (partition_size == 0) {
+        return false;
+    }
+
+    lseek(buf->fd.get(), 0, SEEK_SET);
+    std::unique_ptr<sparse_file, decltype(&sparse_file_destroy)> s(
+            sparse_file_import_auto(buf->fd.get(), false, false), sparse_file_destroy);
+    if (!s) die("cannot sparse read file");
+    const unsigned int block_size = sparse_file_block_size(s.get());
+    const int64_t image_size = sparse_file_len(s.get(), false, false);
+    if (HASH_CHUNK_SIZE % block_size != 0 || image_size > static_cast<int64_t>(partition_size)) {
+        return false;
+    }
+
+    std::string digests;
+    fb->HashPartition(partition, HASH_CHUNK_SIZE, &digests);
+
+    ChunkHasher hasher(partition_size);
+    if (sparse_file_callback(s.get(), false, false, ChunkHasher::Write, &hasher) < 0) {
+        die("cannot read image for %s", partition.c_str());
+    }
+    hasher.Finish();
+
+    const auto& chunks = hasher.chunks();
+    std::unique_ptr<sparse_file, decltype(&sparse_file_destroy)> changed(
+            sparse_file_new(block_size, image_size), sparse_file_destroy);
+    if (!changed) die("cannot allocate sparse file");
+    const unsigned int blocks_per_chunk = HASH_CHUNK_SIZE / block_size;
+    size_t num_changed = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        const auto& chunk = chunks[i];
+        if (!chunk.has_data) continue;
+        if (chunk.complete && digests.size() >= (i + 1) * SHA256_DIGEST_LENGTH &&
+            !memcmp(chunk.digest, &digests[i * SHA256_DIGEST_LENGTH], SHA256_DIGEST_LENGTH)) {
+            continue;
+        }
+        if (sparse_file_copy_blocks(changed.get(), s.get(), i * blocks_per_chunk,
+                                    (i + 1) * blocks_per_chunk) < 0) {
+            die("cannot copy chunk %zu of %s", i, partition.c_str());
+        }
+        num_changed++;
+    }
+    fprintf(stderr, "%zu of %zu MB of '%s' changed\n", num_changed * HASH_CHUNK_SIZE / 1024 / 1024,
+            chunks.size() * HASH_CHUNK_SIZE / 1024 / 1024, partition.c_str());
+
+    // Even with nothing left to write, the device still gets a flash command, so that it does
+    // whatever else it does when a partition is flashed.
+    int64_t sz = sparse_file_len(changed.get(), true, false);
+    int64_t limit = get_sparse_limit(sz);
+    if (!limit) {
+        fb->FlashPartition(partition, changed.get(), sz, 1, 1);
+        return true;
+    }
+    sparse_file** files = resparse_file(changed.get(), limit);
+    size_t count = 0;
+    while (files[count]) count++;
+    for (size_t i = 0; i < count; i++) {
+        fb->FlashPartition(partition, files[i], sparse_file_len(files[i], true, false), i + 1,
+                           count);
+        sparse_file_destroy(files[i]);
+    }
+    free(files);
+    return true;
+}
+
 static void flash_buf(const std::string& partition, struct fastboot_buffer *buf)
 {
     sparse_file** s;
@@ -1101,6 +1328,10 @@ static void flash_buf(const std::string& partition, struct fastboot_buffer *buf)
         }
     }
 
+    if (g_skip_unchanged && flash_changed_chunks(partition, buf)) {
+        return;
+    }
+
     switch (buf->type) {
         case FB_BUFFER_SPARSE: {
             std::vector<std::pair<sparse_file*, int64_t>> sparse_files;
@@ -1118,13 +1349,110 @@ static void flash_buf(const std::string& partition, struct fastboot_buffer *buf)
             break;
         }
         case FB_BUFFER_FD:
-            fb->FlashPartition(partition, buf->fd, buf->sz);
+            if (!supports_flash_compression() || is_sparse_image(buf->fd.get()) ||
+                fb->FlashPartitionCompressed(partition, buf->fd, buf->sz) == fastboot::BAD_ARG) {
+                fb->FlashPartition(partition, buf->fd, buf->sz);
+            }
             break;
         default:
             die("unknown buffer type: %d", buf->type);
     }
 }
 
+static int64_t max_bundle_images() {
+    if (g_max_bundle_images == -1) {
+        g_max_bundle_images = get_uint_var(FB_VAR_MAX_BUNDLE_IMAGES);
+    }
+    return g_max_bundle_images;
+}
+
+// Images of logical partitions, collected into a single flash-bundle download
+// that fastbootd writes to all the partitions in parallel.
+class FlashBundle {
+  public:
+    FlashBundle(uint64_t max_size, size_t max_images)
+        : max_size_(max_size), max_images_(max_images) {}
+
+    // Adds |buf|, first sending the images collected so far if it doesn't fit
+    // with them. Returns false if |buf| can't be sent in a bundle.
+    bool Add(const std::string& partition, const fastboot_buffer& buf);
+    // Sends the images collected so far, if any.
+    void Flash();
+    bool empty() const { return partitions_.empty(); }
+
+  private:
+    bool Fits(const std::string& partition, uint64_t size) const;
+
+    const uint64_t max_size_;
+    const size_t max_images_;
+    unique_fd fd_;
+    std::string header_;
+    std::vector<std::string> partitions_;
+    uint64_t size_ = FB_BUNDLE_HEADER_SIZE;
+};
+
+bool FlashBundle::Fits(const std::string& partition, uint64_t size) const {
+    std::string line = android::base::StringPrintf("%s %" PRIu64 " %" PRIu64 "\n",
+                                                   partition.c_str(), size_, size);
+    return partitions_.size() < max_images_ && size_ + size <= max_size_ &&
+           strlen(FB_BUNDLE_MAGIC "\n") + header_.size() + line.size() < FB_BUNDLE_HEADER_SIZE;
+}
+
+bool FlashBundle::Add(const std::string& partition, const fastboot_buffer& buf) {
+    // Sparse buffers are already split to fit the download size on their own.
+    if (buf.type != FB_BUFFER_FD) {
+        return false;
+    }
+    uint64_t size = buf.sz;
+    if (!Fits(partition, size)) {
+        Flash();
+        if (!Fits(partition, size)) {
+            return false;
+        }
+    }
+
+    if (fd_ < 0) {
+        fd_.reset(make_temporary_fd("flash bundle"));
+    }
+    if (lseek(fd_.get(), size_, SEEK_SET) < 0) {
+        die("lseek on flash bundle failed: %s", strerror(errno));
+    }
+    std::vector<char> data(std::min<uint64_t>(size, 1024 * 1024));
+    for (uint64_t offset = 0; offset < size; offset += data.size()) {
+        size_t len = std::min<uint64_t>(data.size(), size - offset);
+        if (!android::base::ReadFullyAtOffset(buf.fd, data.data(), len, offset) ||
+            !android::base::WriteFully(fd_, data.data(), len)) {
+            die("failed to add %s to flash bundle: %s", partition.c_str(), strerror(errno));
+        }
+    }
+
+    header_ += android::base::StringPrintf("%s %" PRIu64 " %" PRIu64 "\n", partition.c_str(),
+                                           size_, size);
+    partitions_.emplace_back(partition);
+    size_ += size;
+    return true;
+}
+
+void FlashBundle::Flash() {
+    if (partitions_.empty()) {
+        return;
+    }
+
+    std::string header = FB_BUNDLE_MAGIC "\n" + header_;
+    header.resize(FB_BUNDLE_HEADER_SIZE, '\0');
+    if (lseek(fd_.get(), 0, SEEK_SET) < 0 || !android::base::WriteFully(fd_, header.data(),
+                                                                        header.size())) {
+        die("failed to write flash bundle header: %s", strerror(errno));
+    }
+    fb->Download("bundle", fd_, size_);
+    fb->RawCommand(FB_CMD_FLASH_BUNDLE, "Writing " + android::base::Join(partitions_, ", "));
+
+    fd_.reset();
+    header_.clear();
+    partitions_.clear();
+    size_ = FB_BUNDLE_HEADER_SIZE;
+}
+
 static std::string get_current_slot() {
     std::string current_slot;
     if (fb->GetVar("current-slot", &current_slot) != fastboot::SUCCESS) return "";
@@ -1273,18 +1601,41 @@ static bool is_retrofit_device() {
     return android::base::StartsWith(value, "system_");
 }
 
+// Returns the compression to fetch with, or an empty string if the device has no fetch-stream.
+static std::string get_fetch_stream_compression() {
+    std::string value;
+    if (fb->GetVar(FB_VAR_FETCH_COMPRESSION, &value) != fastboot::SUCCESS) {
+        return "";
+    }
+    if (!g_disable_compression) {
+        for (const auto& algorithm : Split(value, ",")) {
+            if (Trim(algorithm) == "lz4") return "lz4";
+        }
+    }
+    return "none";
+}
+
 // Fetch a partition from the device to a given fd. This is a wrapper over FetchToFd to fetch
-// the full image.
+// the full image, or over FetchStreamToFd if the device can send it all in one go.
 static uint64_t fetch_partition(const std::string& partition, borrowed_fd fd) {
-    uint64_t fetch_size = get_uint_var(FB_VAR_MAX_FETCH_SIZE);
-    if (fetch_size == 0) {
-        die("Unable to get %s. Device does not support fetch command.", FB_VAR_MAX_FETCH_SIZE);
-    }
     uint64_t partition_size = get_partition_size(partition);
     if (partition_size <= 0) {
         die("Invalid partition size for partition %s: %" PRId64, partition.c_str(), partition_size);
     }
 
+    if (auto compression = get_fetch_stream_compression(); !compression.empty()) {
+        if (fb->FetchStreamToFd(partition, fd, 0, partition_size, compression) !=
+            fastboot::RetCode::SUCCESS) {
+            die("Unable to fetch %s", partition.c_str());
+        }
+        return partition_size;
+    }
+
+    uint64_t fetch_size = get_uint_var(FB_VAR_MAX_FETCH_SIZE);
+    if (fetch_size == 0) {
+        die("Unable to get %s. Device does not support fetch command.", FB_VAR_MAX_FETCH_SIZE);
+    }
+
     uint64_t offset = 0;
     while (offset < partition_size) {
         uint64_t chunk_size = std::min(fetch_size, partition_size - offset);
@@ -1391,6 +1742,10 @@ static void reboot_to_userspace_fastboot() {
     // Reset target_sparse_limit after reboot to userspace fastboot. Max
     // download sizes may differ in bootloader and fastbootd.
     target_sparse_limit = -1;
+    g_flash_compression = -1;
+    g_partition_hash = -1;
+    g_max_bundle_images = -1;
+    fb->EnableFlashStream(false);
 }
 
 static void CancelSnapshotIfNeeded() {
@@ -1406,6 +1761,8 @@ class ImageSource {
     virtual ~ImageSource() {};
     virtual bool ReadFile(const std::string& name, std::vector<char>* out) const = 0;
     virtual unique_fd OpenFile(const std::string& name) const = 0;
+    // Bytes of temporary storage OpenFile() uses for |name|; 0 if it opens the file in place.
+    virtual uint64_t ExtractedSize(const std::string& /* name */) const { return 0; }
 };
 
 class FlashAllTool {
@@ -1419,9 +1776,31 @@ class FlashAllTool {
     void CheckRequirements();
     void DetermineSecondarySlot();
     void CollectImages();
+    void PrefetchVars(const std::vector<std::pair<const Image*, std::string>>& images);
     void FlashImages(const std::vector<std::pair<const Image*, std::string>>& images);
-    void FlashImage(const Image& image, const std::string& slot, fastboot_buffer* buf);
+    void FlashImage(const Image& image, const std::string& slot, fastboot_buffer* buf,
+                    FlashBundle* bundle);
     void UpdateSuperPartition();
+    void ReportTimings();
+
+    struct PreparedImage {
+        fastboot_buffer buf;
+        bool loaded = false;
+        int error = 0;
+        double load_time = 0;
+    };
+    PreparedImage PrepareImage(const Image& image);
+
+    struct ImageTiming {
+        std::string name;
+        // Time spent opening (unzipping) and loading (resparsing) the image.
+        double load;
+        // Time the device sat idle waiting for the image to be loaded.
+        double wait;
+        // Time spent downloading and flashing the image.
+        double flash;
+    };
+    std::vector<ImageTiming> timings_;
 
     const ImageSource& source_;
     std::string slot_override_;
@@ -1444,6 +1823,9 @@ FlashAllTool::FlashAllTool(const ImageSource& source, const std::string& slot_ov
 }
 
 void FlashAllTool::Flash() {
+    fb->GetVars({"version-bootloader", "version-baseband", "serialno", "current-slot",
+                 "slot-count", "is-userspace", "super-partition-name", FB_VAR_MAX_DOWNLOAD_SIZE,
+                 FB_VAR_SNAPSHOT_UPDATE_STATUS});
     DumpInfo();
     CheckRequirements();
 
@@ -1462,10 +1844,12 @@ void FlashAllTool::Flash() {
 
     // First flash boot partitions. We allow this to happen either in userspace
     // or in bootloader fastboot.
+    PrefetchVars(boot_images_);
     FlashImages(boot_images_);
 
     // Sync the super partition. This will reboot to userspace fastboot if needed.
     UpdateSuperPartition();
+    PrefetchVars(os_images_);
 
     // Resize any logical partition to 0, so each partition is reset to 0
     // extents, and will achieve more optimal allocation.
@@ -1480,6 +1864,8 @@ void FlashAllTool::Flash() {
 
     // Flash OS images, resizing logical partitions as needed.
     FlashImages(os_images_);
+
+    ReportTimings();
 }
 
 void FlashAllTool::CheckRequirements() {
@@ -1524,30 +1910,178 @@ void FlashAllTool::CollectImages() {
     }
 }
 
+// Reads the variables flashing |images| needs, a batch at a time.
+void FlashAllTool::PrefetchVars(const std::vector<std::pair<const Image*, std::string>>& images) {
+    std::vector<std::string> vars;
+    for (const auto& [image, slot] : images) {
+        vars.emplace_back("has-slot:"s + image->part_name);
+    }
+    fb->GetVars(vars);
+
+    // Partition names now come out of the cache.
+    vars.clear();
+    for (const auto& [image, slot] : images) {
+        do_for_partitions(
+                image->part_name, slot,
+                [&](const std::string& partition) { vars.emplace_back("is-logical:" + partition); },
+                false);
+    }
+    fb->GetVars(vars);
+}
+
+// Runs on the loader thread, so it must not talk to the device.
+FlashAllTool::PreparedImage FlashAllTool::PrepareImage(const Image& image) {
+    PreparedImage prepared;
+    double start = now();
+    unique_fd fd = source_.OpenFile(image.img_name);
+    prepared.loaded = fd >= 0 && load_buf_fd(std::move(fd), &prepared.buf);
+    prepared.error = errno;
+    prepared.load_time = now() - start;
+    return prepared;
+}
+
 void FlashAllTool::FlashImages(const std::vector<std::pair<const Image*, std::string>>& images) {
+    if (images.empty()) {
+        return;
+    }
+
+    // Upcoming images are unzipped and resparsed, in flashing order, by a pool of loader threads
+    // while earlier ones are downloaded and flashed. Loading needs the device's download limit,
+    // so query it here, where it is safe to talk to the device, before the loaders start.
+    get_sparse_limit(0);
+
+    // Logical partitions that fit in a download are sent together, for fastbootd to write them
+    // in parallel. Images that need changes on the way to the device are left alone.
+    std::unique_ptr<FlashBundle> bundle;
+    if (!g_skip_unchanged && !g_disable_verity && !g_disable_verification &&
+        is_userspace_fastboot() && max_bundle_images() > 1) {
+        bundle = std::make_unique<FlashBundle>(get_uint_var(FB_VAR_MAX_DOWNLOAD_SIZE),
+                                               max_bundle_images());
+    }
+
+    // Loaders only run ahead while the unzipped images waiting to be flashed fit in
+    // --prefetch-budget; the image the device is waiting for is always loaded.
+    std::vector<uint64_t> sizes;
     for (const auto& [image, slot] : images) {
-        fastboot_buffer buf;
-        unique_fd fd = source_.OpenFile(image->img_name);
-        if (fd < 0 || !load_buf_fd(std::move(fd), &buf)) {
-            if (image->optional_if_no_image) {
-                continue;
+        sizes.emplace_back(source_.ExtractedSize(image->img_name));
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::optional<PreparedImage>> prepared(images.size());
+    size_t next_load = 0;
+    size_t next_flash = 0;
+    uint64_t pending_bytes = 0;
+
+    auto loader = [&, this]() -> void {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [&]() -> bool {
+                return next_load == images.size() || next_load == next_flash ||
+                       pending_bytes + sizes[next_load] <= g_prefetch_budget;
+            });
+            if (next_load == images.size()) {
+                return;
             }
-            die("could not load '%s': %s", image->img_name, strerror(errno));
+            size_t i = next_load++;
+            pending_bytes += sizes[i];
+
+            lock.unlock();
+            PreparedImage image = PrepareImage(*images[i].first);
+            lock.lock();
+
+            prepared[i] = std::move(image);
+            cv.notify_all();
         }
-        FlashImage(*image, slot, &buf);
+    };
+
+    size_t num_loaders = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+                                          images.size());
+    std::vector<std::thread> loaders;
+    for (size_t i = 0; i < num_loaders; i++) {
+        loaders.emplace_back(loader);
+    }
+
+    for (size_t i = 0; i < images.size(); i++) {
+        const auto& [image, slot] = images[i];
+
+        double wait_start = now();
+        std::unique_lock<std::mutex> lock(mutex);
+        next_flash = i;
+        cv.notify_all();
+        cv.wait(lock, [&]() -> bool { return prepared[i].has_value(); });
+        PreparedImage image_buf = std::move(*prepared[i]);
+        prepared[i].reset();
+        lock.unlock();
+        double wait = now() - wait_start;
+
+        if (!image_buf.loaded) {
+            if (!image->optional_if_no_image) {
+                die("could not load '%s': %s", image->img_name, strerror(image_buf.error));
+            }
+        } else {
+            double flash_start = now();
+            FlashImage(*image, slot, &image_buf.buf, bundle.get());
+            std::string name = image->part_name;
+            if (!slot.empty()) {
+                name += "_" + slot;
+            }
+            timings_.push_back({name, image_buf.load_time, wait, now() - flash_start});
+        }
+
+        // Closing the buffer frees its unzipped temporary file.
+        image_buf = {};
+        lock.lock();
+        pending_bytes -= sizes[i];
+        cv.notify_all();
+    }
+
+    for (auto& thread : loaders) {
+        thread.join();
     }
+
+    if (bundle && !bundle->empty()) {
+        double flash_start = now();
+        bundle->Flash();
+        timings_.push_back({"bundle", 0, 0, now() - flash_start});
+    }
+}
+
+void FlashAllTool::ReportTimings() {
+    if (timings_.empty()) {
+        return;
+    }
+
+    ImageTiming total = {"total", 0, 0, 0};
+    fprintf(stderr, "--------------------------------------------\n");
+    fprintf(stderr, "%-24s %8s %8s %8s\n", "Image", "Load", "Wait", "Flash");
+    for (const auto& timing : timings_) {
+        fprintf(stderr, "%-24s %7.3fs %7.3fs %7.3fs\n", timing.name.c_str(), timing.load,
+                timing.wait, timing.flash);
+        total.load += timing.load;
+        total.wait += timing.wait;
+        total.flash += timing.flash;
+    }
+    fprintf(stderr, "%-24s %7.3fs %7.3fs %7.3fs\n", total.name.c_str(), total.load, total.wait,
+            total.flash);
+    fprintf(stderr, "--------------------------------------------\n");
 }
 
-void FlashAllTool::FlashImage(const Image& image, const std::string& slot, fastboot_buffer* buf) {
+void FlashAllTool::FlashImage(const Image& image, const std::string& slot, fastboot_buffer* buf,
+                              FlashBundle* bundle) {
     auto flash = [&, this](const std::string& partition_name) {
         std::vector<char> signature_data;
-        if (source_.ReadFile(image.sig_name, &signature_data)) {
+        bool signed_image = source_.ReadFile(image.sig_name, &signature_data);
+        if (signed_image) {
             fb->Download("signature", signature_data);
             fb->RawCommand("signature", "installing signature");
         }
 
         if (is_logical(partition_name)) {
             fb->ResizePartition(partition_name, std::to_string(buf->image_size));
+            if (bundle && !signed_image && bundle->Add(partition_name, *buf)) {
+                return;
+            }
         }
         flash_buf(partition_name.c_str(), buf);
     };
@@ -1591,32 +2125,102 @@ void FlashAllTool::UpdateSuperPartition() {
 
 class ZipImageSource final : public ImageSource {
   public:
-    explicit ZipImageSource(ZipArchiveHandle zip) : zip_(zip) {}
+    ZipImageSource(ZipArchiveHandle zip, const std::string& path) : zip_(zip), path_(path) {}
+    ~ZipImageSource();
     bool ReadFile(const std::string& name, std::vector<char>* out) const override;
     unique_fd OpenFile(const std::string& name) const override;
+    uint64_t ExtractedSize(const std::string& name) const override;
 
   private:
     ZipArchiveHandle zip_;
+    std::string path_;
+    // FlashAllTool reads from its loader threads and the main thread. |zip_| is only used under
+    // |mutex_|; each concurrent OpenFile() unzips from a handle of its own, taken from
+    // |spare_zips_| or newly opened, so that several entries can be extracted at once.
+    mutable std::mutex mutex_;
+    mutable std::vector<ZipArchiveHandle> spare_zips_;
 };
 
+ZipImageSource::~ZipImageSource() {
+    for (ZipArchiveHandle zip : spare_zips_) {
+        CloseArchive(zip);
+    }
+}
+
 bool ZipImageSource::ReadFile(const std::string& name, std::vector<char>* out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
     return UnzipToMemory(zip_, name, out);
 }
 
 unique_fd ZipImageSource::OpenFile(const std::string& name) const {
-    return unzip_to_file(zip_, name.c_str());
+    ZipArchiveHandle zip;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!spare_zips_.empty()) {
+            zip = spare_zips_.back();
+            spare_zips_.pop_back();
+        } else if (int error = OpenArchive(path_.c_str(), &zip); error != 0) {
+            die("failed to open zip file '%s': %s", path_.c_str(), ErrorCodeString(error));
+        }
+    }
+
+    unique_fd fd = unzip_to_file(zip, name.c_str());
+    int saved_errno = errno;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    spare_zips_.emplace_back(zip);
+    errno = saved_errno;
+    return fd;
+}
+
+uint64_t ZipImageSource::ExtractedSize(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ZipEntry64 zip_entry;
+    if (FindEntry(zip_, name, &zip_entry) != 0) {
+        return 0;
+    }
+    return zip_entry.uncompressed_length;
+}
+
+class DirectoryImageSource final : public ImageSource {
+  public:
+    explicit DirectoryImageSource(const std::string& dir) : dir_(dir) {}
+    bool ReadFile(const std::string& name, std::vector<char>* out) const override;
+    unique_fd OpenFile(const std::string& name) const override;
+
+  private:
+    std::string dir_;
+};
+
+bool DirectoryImageSource::ReadFile(const std::string& name, std::vector<char>* out) const {
+    return ReadFileToVector(dir_ + "/" + name, out);
+}
+
+unique_fd DirectoryImageSource::OpenFile(const std::string& name) const {
+    auto path = dir_ + "/" + name;
+    return unique_fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_BINARY)));
 }
 
 static void do_update(const char* filename, const std::string& slot_override, bool skip_secondary,
                       bool force_flash) {
+    if (!g_update_dir.empty()) {
+        DirectoryImageSource source(g_update_dir);
+        FlashAllTool tool(source, slot_override, skip_secondary, false, force_flash);
+        tool.Flash();
+        return;
+    }
+
     ZipArchiveHandle zip;
     int error = OpenArchive(filename, &zip);
     if (error != 0) {
         die("failed to open zip file '%s': %s", filename, ErrorCodeString(error));
     }
 
-    FlashAllTool tool(ZipImageSource(zip), slot_override, skip_secondary, false, force_flash);
-    tool.Flash();
+    {
+        ZipImageSource source(zip, filename);
+        FlashAllTool tool(source, slot_override, skip_secondary, false, force_flash);
+        tool.Flash();
+    }
 
     CloseArchive(zip);
 }
@@ -1872,6 +2476,215 @@ static void do_wipe_super(const std::string& image, const std::string& slot_over
     }
 }
 
+#if !defined(_WIN32)
+
+static int collect_devices_callback(usb_ifc_info* info);
+static std::vector<std::string> g_usb_devices;
+
+static std::vector<std::string> find_usb_devices() {
+    g_usb_devices.clear();
+    usb_open(collect_devices_callback);
+    return g_usb_devices;
+}
+
+static int collect_devices_callback(usb_ifc_info* info) {
+    if (match_fastboot_with_serial(info, nullptr) == 0 && info->writable) {
+        // Devices without a serial number can still be matched by path.
+        g_usb_devices.emplace_back(info->serial_number[0] ? info->serial_number
+                                                          : info->device_path);
+    }
+    return -1;
+}
+
+static pid_t g_update_dir_owner = -1;
+
+static void remove_update_dir() {
+    // Children inherit this handler across fork, but only the parent may remove the images.
+    if (g_update_dir.empty() || getpid() != g_update_dir_owner) {
+        return;
+    }
+    if (DIR* dir = opendir(g_update_dir.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') {
+                unlink((g_update_dir + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(g_update_dir.c_str());
+}
+
+// Extracts the images of an update package into g_update_dir, so that every device flashed
+// from it reads the same files rather than extracting its own copy.
+static void extract_update_package(const char* filename) {
+    ZipArchiveHandle zip;
+    int error = OpenArchive(filename, &zip);
+    if (error != 0) {
+        die("failed to open zip file '%s': %s", filename, ErrorCodeString(error));
+    }
+
+    std::string dir = make_temporary_template("update");
+    if (mkdtemp(&dir[0]) == nullptr) {
+        die("failed to create temporary directory %s: %s", dir.c_str(), strerror(errno));
+    }
+    g_update_dir = dir;
+    g_update_dir_owner = getpid();
+    atexit(remove_update_dir);
+
+    void* cookie;
+    error = StartIteration(zip, &cookie);
+    if (error != 0) {
+        die("failed to read zip file '%s': %s", filename, ErrorCodeString(error));
+    }
+    ZipEntry64 entry;
+    std::string name;
+    while ((error = Next(cookie, &entry, &name)) == 0) {
+        // Images live at the top level of the package.
+        if (name.empty() || name.find('/') != std::string::npos) {
+            continue;
+        }
+        auto path = dir + "/" + name;
+        unique_fd fd(TEMP_FAILURE_RETRY(
+                open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600)));
+        if (fd == -1) {
+            die("failed to create '%s': %s", path.c_str(), strerror(errno));
+        }
+        double start = now();
+        error = ExtractEntryToFile(zip, &entry, fd.get());
+        if (error != 0) {
+            die("failed to extract '%s': %s", name.c_str(), ErrorCodeString(error));
+        }
+        fprintf(stderr, "extracted %s (%" PRIu64 " MB) to disk in %.3fs\n", name.c_str(),
+                entry.uncompressed_length / 1024 / 1024, now() - start);
+    }
+    EndIteration(cookie);
+    if (error != -1) {
+        die("failed to read zip file '%s': %s", filename, ErrorCodeString(error));
+    }
+    CloseArchive(zip);
+}
+
+struct DeviceRun {
+    std::string serial;
+    pid_t pid = -1;
+    unique_fd output;
+    std::string partial_line;
+    std::string last_line;
+    double elapsed = 0;
+};
+
+static void print_device_output(DeviceRun* run, bool eof) {
+    size_t start = 0;
+    size_t end;
+    while ((end = run->partial_line.find('\n', start)) != std::string::npos) {
+        auto line = run->partial_line.substr(start, end - start);
+        fprintf(stderr, "[%s] %s\n", run->serial.c_str(), line.c_str());
+        if (!Trim(line).empty()) run->last_line = line;
+        start = end + 1;
+    }
+    run->partial_line.erase(0, start);
+    if (eof && !run->partial_line.empty()) {
+        fprintf(stderr, "[%s] %s\n", run->serial.c_str(), run->partial_line.c_str());
+        run->last_line = run->partial_line;
+        run->partial_line.clear();
+    }
+}
+
+// Forks one process per device. Each child returns, with |serial| naming its device, to run the
+// commands as usual; a failure in one of them only fails that device. The parent never returns:
+// it prints the output of every child, prefixed with its serial, then a summary, and exits.
+static void fork_per_device(const std::vector<std::string>& serials) {
+    fflush(stdout);
+    fflush(stderr);
+
+    std::vector<DeviceRun> runs(serials.size());
+    for (size_t i = 0; i < serials.size(); i++) {
+        int fds[2];
+        if (pipe(fds) == -1) {
+            die("pipe failed: %s", strerror(errno));
+        }
+        pid_t pid = fork();
+        if (pid == -1) {
+            die("fork failed: %s", strerror(errno));
+        }
+        if (pid == 0) {
+            for (size_t j = 0; j < i; j++) {
+                runs[j].output.reset();
+            }
+            dup2(fds[1], STDOUT_FILENO);
+            dup2(fds[1], STDERR_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+            // A progress line and its OKAY are printed separately; keep the pair together.
+            setvbuf(stdout, nullptr, _IOLBF, 0);
+            setvbuf(stderr, nullptr, _IOLBF, 0);
+            serial = serials[i].c_str();
+            return;
+        }
+        close(fds[1]);
+        runs[i].serial = serials[i];
+        runs[i].pid = pid;
+        runs[i].output.reset(fds[0]);
+    }
+
+    const double start = now();
+    size_t remaining = runs.size();
+    while (remaining > 0) {
+        std::vector<pollfd> pfds;
+        std::vector<DeviceRun*> polled;
+        for (auto& run : runs) {
+            if (run.output == -1) continue;
+            pollfd pfd;
+            pfd.fd = run.output.get();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            pfds.emplace_back(pfd);
+            polled.emplace_back(&run);
+        }
+        if (poll(pfds.data(), pfds.size(), -1) == -1) {
+            if (errno == EINTR) continue;
+            die("poll failed: %s", strerror(errno));
+        }
+        for (size_t i = 0; i < pfds.size(); i++) {
+            if (!pfds[i].revents) continue;
+            DeviceRun* run = polled[i];
+            char buf[4096];
+            ssize_t n = TEMP_FAILURE_RETRY(read(run->output.get(), buf, sizeof(buf)));
+            if (n > 0) {
+                run->partial_line.append(buf, n);
+                print_device_output(run, false);
+                continue;
+            }
+            print_device_output(run, true);
+            run->output.reset();
+            run->elapsed = now() - start;
+            remaining--;
+        }
+    }
+
+    size_t failed = 0;
+    fprintf(stderr, "\n");
+    for (auto& run : runs) {
+        int status;
+        if (TEMP_FAILURE_RETRY(waitpid(run.pid, &status, 0)) == -1) {
+            status = -1;
+        }
+        bool ok = status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (ok) {
+            fprintf(stderr, "%-22s OKAY   [%7.3fs]\n", run.serial.c_str(), run.elapsed);
+        } else {
+            fprintf(stderr, "%-22s FAILED [%7.3fs] %s\n", run.serial.c_str(), run.elapsed,
+                    run.last_line.c_str());
+            failed++;
+        }
+    }
+    fprintf(stderr, "Finished on %zu of %zu devices. Total time: %.3fs\n", runs.size() - failed,
+            runs.size(), now() - start);
+    exit(failed ? 1 : 0);
+}
+
+#endif
+
 int FastBootTool::Main(int argc, char* argv[]) {
     bool wants_wipe = false;
     bool wants_reboot = false;
@@ -1894,9 +2707,15 @@ int FastBootTool::Main(int argc, char* argv[]) {
     g_boot_img_hdr.page_size = 2048;
     g_boot_img_hdr.dtb_addr = 0x01100000;
 
+    std::vector<std::string> serials;
+    bool all_devices = false;
+
     const struct option longopts[] = {
+        {"all-devices", no_argument, 0, 0},
         {"base", required_argument, 0, 0},
         {"cmdline", required_argument, 0, 0},
+        {"disable-compression", no_argument, 0, 0},
+        {"disable-flash-stream", no_argument, 0, 0},
         {"disable-verification", no_argument, 0, 0},
         {"disable-verity", no_argument, 0, 0},
         {"force", no_argument, 0, 0},
@@ -1907,10 +2726,12 @@ int FastBootTool::Main(int argc, char* argv[]) {
         {"os-patch-level", required_argument, 0, 0},
         {"os-version", required_argument, 0, 0},
         {"page-size", required_argument, 0, 0},
+        {"prefetch-budget", required_argument, 0, 0},
         {"ramdisk-offset", required_argument, 0, 0},
         {"set-active", optional_argument, 0, 'a'},
         {"skip-reboot", no_argument, 0, 0},
         {"skip-secondary", no_argument, 0, 0},
+        {"skip-unchanged", no_argument, 0, 0},
         {"slot", required_argument, 0, 0},
         {"tags-offset", required_argument, 0, 0},
         {"dtb", required_argument, 0, 0},
@@ -1927,10 +2748,16 @@ int FastBootTool::Main(int argc, char* argv[]) {
     while ((c = getopt_long(argc, argv, "a::hls:S:vw", longopts, &longindex)) != -1) {
         if (c == 0) {
             std::string name{longopts[longindex].name};
-            if (name == "base") {
+            if (name == "all-devices") {
+                all_devices = true;
+            } else if (name == "base") {
                 g_base_addr = strtoul(optarg, 0, 16);
             } else if (name == "cmdline") {
                 g_cmdline = optarg;
+            } else if (name == "disable-compression") {
+                g_disable_compression = true;
+            } else if (name == "disable-flash-stream") {
+                g_disable_flash_stream = true;
             } else if (name == "disable-verification") {
                 g_disable_verification = true;
             } else if (name == "disable-verity") {
@@ -1952,12 +2779,18 @@ int FastBootTool::Main(int argc, char* argv[]) {
             } else if (name == "page-size") {
                 g_boot_img_hdr.page_size = strtoul(optarg, nullptr, 0);
                 if (g_boot_img_hdr.page_size == 0) die("invalid page size");
+            } else if (name == "prefetch-budget") {
+                if (!android::base::ParseByteCount(optarg, &g_prefetch_budget)) {
+                    die("invalid prefetch budget");
+                }
             } else if (name == "ramdisk-offset") {
                 g_boot_img_hdr.ramdisk_addr = strtoul(optarg, 0, 16);
             } else if (name == "skip-reboot") {
                 skip_reboot = true;
             } else if (name == "skip-secondary") {
                 skip_secondary = true;
+            } else if (name == "skip-unchanged") {
+                g_skip_unchanged = true;
             } else if (name == "slot") {
                 slot_override = optarg;
             } else if (name == "dtb-offset") {
@@ -1987,6 +2820,7 @@ int FastBootTool::Main(int argc, char* argv[]) {
                     break;
                 case 's':
                     serial = optarg;
+                    serials.emplace_back(optarg);
                     break;
                 case 'S':
                     if (!android::base::ParseByteCount(optarg, &sparse_limit)) {
@@ -2021,6 +2855,24 @@ int FastBootTool::Main(int argc, char* argv[]) {
         return show_help();
     }
 
+    if (all_devices || serials.size() > 1) {
+#if defined(_WIN32)
+        die("running on several devices at once is not supported on Windows");
+#else
+        if (all_devices) {
+            if (!serials.empty()) die("--all-devices cannot be used with -s");
+            serials = find_usb_devices();
+            if (serials.empty()) die("no fastboot devices found");
+        }
+        // Other commands could take "update" as an argument, so only a leading update is
+        // extracted up front; anything else is handled by each device on its own.
+        if (argc > 0 && !strcmp(*argv, "update")) {
+            extract_update_package(argc > 1 ? argv[1] : "update.zip");
+        }
+        fork_per_device(serials);
+#endif
+    }
+
     Transport* transport = open_device();
     if (transport == nullptr) {
         return 1;
@@ -2032,6 +2884,7 @@ int FastBootTool::Main(int argc, char* argv[]) {
     };
     fastboot::FastBootDriver fastboot_driver(transport, driver_callbacks, false);
     fb = &fastboot_driver;
+    fb->EnableVarCache(true);
 
     const double start = now();
 
@@ -36,9 +36,12 @@
 #include <string.h>
 #include <algorithm>
 #include <chrono>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <memory>
 #include <regex>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -47,6 +50,7 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
+#include <lz4.h>
 #include <storage_literals/storage_literals.h>
 
 #include "constants.h"
@@ -96,9 +100,164 @@ RetCode FastBootDriver::Flash(const std::string& partition, std::string* respons
     return RawCommand(FB_CMD_FLASH ":" + partition, "Writing '" + partition + "'", response, info);
 }
 
+// Variables that change without any command being sent, or whose value is too large to cache.
+static bool IsVarCacheable(const std::string& key) {
+    static const std::vector<std::string> kUncacheableVars = {
+            "all", FB_VAR_DMESG, FB_VAR_BATCH, FB_VAR_BATTERY_VOLTAGE, FB_VAR_BATTERY_SOC_OK,
+    };
+    std::string name = key.substr(0, key.find(':'));
+    return std::find(kUncacheableVars.begin(), kUncacheableVars.end(), name) ==
+           kUncacheableVars.end();
+}
+
 RetCode FastBootDriver::GetVar(const std::string& key, std::string* val,
                                std::vector<std::string>* info) {
-    return RawCommand(FB_CMD_GETVAR ":" + key, val, info);
+    bool cacheable = var_cache_enabled_ && !info && IsVarCacheable(key);
+    if (cacheable) {
+        if (auto iter = var_cache_.find(key); iter != var_cache_.end()) {
+            error_ = "";
+            if (iter->second.ret == DEVICE_FAIL) {
+                error_ = android::base::StringPrintf("remote: '%s'", iter->second.value.c_str());
+            }
+            if (val) *val = iter->second.value;
+            return iter->second.ret;
+        }
+    }
+
+    std::string value;
+    RetCode ret = RawCommand(FB_CMD_GETVAR ":" + key, &value, info);
+    if (cacheable && (ret == SUCCESS || ret == DEVICE_FAIL)) {
+        var_cache_[key] = {ret, value};
+    }
+    if (val) *val = std::move(value);
+    return ret;
+}
+
+RetCode FastBootDriver::GetVars(const std::vector<std::string>& keys) {
+    std::vector<std::string> wanted;
+    for (const auto& key : keys) {
+        if (!var_cache_enabled_ || !IsVarCacheable(key) || var_cache_.count(key) ||
+            std::find(wanted.begin(), wanted.end(), key) != wanted.end()) {
+            continue;
+        }
+        wanted.emplace_back(key);
+    }
+    if (wanted.empty()) {
+        return SUCCESS;
+    }
+
+    if (max_getvar_batch_size_ < 0) {
+        std::string size;
+        max_getvar_batch_size_ = 0;
+        if (GetVar(FB_VAR_MAX_GETVAR_BATCH_SIZE, &size) == SUCCESS) {
+            max_getvar_batch_size_ = strtoll(size.c_str(), nullptr, 0);
+        }
+    }
+
+    // Fill each command up to the device's limit.
+    const std::string prefix = FB_CMD_GETVAR ":" FB_VAR_BATCH ":";
+    const uint64_t limit = max_getvar_batch_size_;
+    std::vector<std::string> batch;
+    size_t batch_size = prefix.size();
+    auto flush = [&, this]() -> RetCode {
+        RetCode ret = SUCCESS;
+        if (batch.size() > 1) {
+            ret = GetVarBatch(batch);
+        } else if (batch.size() == 1) {
+            ret = GetVar(batch[0], nullptr);
+        }
+        batch.clear();
+        batch_size = prefix.size();
+        return ret == DEVICE_FAIL ? SUCCESS : ret;
+    };
+
+    RetCode ret;
+    for (const auto& key : wanted) {
+        // Keys that contain the separator, or that do not fit in a command even alone, are read
+        // one at a time.
+        if (key.find(',') != std::string::npos || prefix.size() + key.size() > limit) {
+            ret = GetVar(key, nullptr);
+            if (ret != SUCCESS && ret != DEVICE_FAIL) {
+                return ret;
+            }
+            continue;
+        }
+        if (!batch.empty() && batch_size + 1 + key.size() > limit && (ret = flush())) {
+            return ret;
+        }
+        batch_size += (batch.empty() ? 0 : 1) + key.size();
+        batch.emplace_back(key);
+    }
+    return flush();
+}
+
+RetCode FastBootDriver::GetVarBatch(const std::vector<std::string>& keys) {
+    std::string cmd = FB_CMD_GETVAR ":" FB_VAR_BATCH ":" + android::base::Join(keys, ',');
+    std::string results;
+    RetCode ret = RunAndReadBuffer(cmd, nullptr, nullptr, [&](const char* data, uint64_t size) {
+        results.append(data, size);
+        return SUCCESS;
+    });
+    if (ret) {
+        return ret;
+    }
+
+    std::vector<std::string> lines = android::base::Split(results, "\n");
+    if (lines.size() != keys.size() + 1 || !lines.back().empty()) {
+        error_ = android::base::StringPrintf("getvar batch returned %zu results for %zu variables",
+                                             lines.size() - 1, keys.size());
+        return BAD_DEV_RESP;
+    }
+    std::map<std::string, CachedVar> values;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (android::base::StartsWith(lines[i], "OKAY")) {
+            values[keys[i]] = {SUCCESS, lines[i].substr(strlen("OKAY"))};
+        } else if (android::base::StartsWith(lines[i], "FAIL")) {
+            values[keys[i]] = {DEVICE_FAIL, lines[i].substr(strlen("FAIL"))};
+        } else {
+            error_ = "getvar batch returned a bad result: " + lines[i];
+            return BAD_DEV_RESP;
+        }
+    }
+    var_cache_.merge(values);
+    return SUCCESS;
+}
+
+void FastBootDriver::EnableVarCache(bool enable) {
+    var_cache_enabled_ = enable;
+    var_cache_.clear();
+}
+
+// Commands that only move data, or write partition contents, leave variables alone, unless
+// they write the super partition's metadata. Resizing a logical partition only changes its
+// size; any other command may change anything.
+void FastBootDriver::InvalidateVarCache(const std::string& cmd) {
+    static const std::vector<std::string> kPreservingCommands = {
+            FB_CMD_GETVAR, FB_CMD_DOWNLOAD,    FB_CMD_UPLOAD,
+            FB_CMD_FLASH,  FB_CMD_ERASE,       FB_CMD_FETCH,
+            "signature",   FB_CMD_FLASH_STREAM, FB_CMD_FLASH_COMPRESSED,
+            FB_CMD_HASH_PARTITION,
+    };
+    std::string name = cmd.substr(0, cmd.find(':'));
+    if (name != FB_CMD_GETVAR && cmd.find("super", name.size()) != std::string::npos) {
+        var_cache_.clear();
+        return;
+    }
+    if (std::find(kPreservingCommands.begin(), kPreservingCommands.end(), name) !=
+        kPreservingCommands.end()) {
+        return;
+    }
+    if (name == FB_CMD_RESIZE_PARTITION) {
+        for (auto iter = var_cache_.begin(); iter != var_cache_.end();) {
+            if (android::base::StartsWith(iter->first, FB_VAR_PARTITION_SIZE ":")) {
+                iter = var_cache_.erase(iter);
+            } else {
+                iter++;
+            }
+        }
+        return;
+    }
+    var_cache_.clear();
 }
 
 RetCode FastBootDriver::GetVarAll(std::vector<std::string>* response) {
@@ -137,6 +296,12 @@ RetCode FastBootDriver::SnapshotUpdateCommand(const std::string& command, std::s
 
 RetCode FastBootDriver::FlashPartition(const std::string& partition,
                                        const std::vector<char>& data) {
+    if (flash_stream_) {
+        return FlashStream(partition, data.size(),
+                           StringPrintf("Sending and writing '%s' (%zu KB)", partition.c_str(),
+                                        data.size() / 1024),
+                           [&]() { return SendBuffer(data); });
+    }
     RetCode ret;
     if ((ret = Download(partition, data))) {
         return ret;
@@ -146,6 +311,12 @@ RetCode FastBootDriver::FlashPartition(const std::string& partition,
 
 RetCode FastBootDriver::FlashPartition(const std::string& partition, android::base::borrowed_fd fd,
                                        uint32_t size) {
+    if (flash_stream_) {
+        return FlashStream(partition, size,
+                           StringPrintf("Sending and writing '%s' (%u KB)", partition.c_str(),
+                                        size / 1024),
+                           [&]() { return SendBuffer(fd, size); });
+    }
     RetCode ret;
     if ((ret = Download(partition, fd, size))) {
         return ret;
@@ -155,6 +326,12 @@ RetCode FastBootDriver::FlashPartition(const std::string& partition, android::ba
 
 RetCode FastBootDriver::FlashPartition(const std::string& partition, sparse_file* s, uint32_t size,
                                        size_t current, size_t total) {
+    if (flash_stream_) {
+        return FlashStream(partition, size,
+                           StringPrintf("Sending and writing sparse '%s' %zu/%zu (%u KB)",
+                                        partition.c_str(), current, total, size / 1024),
+                           [&]() { return SendSparse(s, false); });
+    }
     RetCode ret;
     if ((ret = Download(partition, s, size, current, total, false))) {
         return ret;
@@ -162,6 +339,123 @@ RetCode FastBootDriver::FlashPartition(const std::string& partition, sparse_file
     return Flash(partition);
 }
 
+namespace {
+
+struct CompressedFrame {
+    // errno of a failed read, since errno is per thread.
+    int error = 0;
+    uint8_t header[FB_COMPRESSED_FRAME_HEADER_SZ];
+    std::vector<char> data;
+};
+
+void PutLe32(uint8_t* p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+uint32_t GetLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+CompressedFrame CompressFrame(android::base::borrowed_fd fd, uint64_t offset, uint32_t len) {
+    CompressedFrame frame;
+    std::vector<char> in(len);
+    if (!android::base::ReadFullyAtOffset(fd, in.data(), len, offset)) {
+        frame.error = errno ? errno : EIO;
+        return frame;
+    }
+    frame.data.resize(LZ4_compressBound(len));
+    int compressed_len =
+            LZ4_compress_default(in.data(), frame.data.data(), len, frame.data.size());
+    if (compressed_len <= 0 || static_cast<uint32_t>(compressed_len) >= len) {
+        // Incompressible; a frame with equal lengths is stored as is.
+        frame.data = std::move(in);
+    } else {
+        frame.data.resize(compressed_len);
+    }
+    PutLe32(frame.header, frame.data.size());
+    PutLe32(frame.header + 4, len);
+    return frame;
+}
+
+}  // namespace
+
+RetCode FastBootDriver::FlashPartitionCompressed(const std::string& partition,
+                                                 android::base::borrowed_fd fd, uint64_t size,
+                                                 unsigned int num_threads) {
+    std::string cmd = StringPrintf("%s:lz4:%" PRIx64 ":%s", FB_CMD_FLASH_COMPRESSED, size,
+                                   partition.c_str());
+    if (cmd.size() > FB_COMMAND_SZ || !size) {
+        error_ = "Cannot use " FB_CMD_FLASH_COMPRESSED " for this image";
+        return BAD_ARG;
+    }
+    if (!num_threads) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    prolog_(StringPrintf("Sending and writing '%s' (%" PRIu64 " KB, lz4)", partition.c_str(),
+                         size / 1024));
+    auto result = [&]() -> RetCode {
+        RetCode ret;
+        int max_frame_size = 0;
+        if ((ret = RawCommand(cmd, nullptr, nullptr, &max_frame_size))) {
+            return ret;
+        }
+        if (max_frame_size <= 0) {
+            error_ = "Device did not send a frame size";
+            return BAD_DEV_RESP;
+        }
+        // Whole blocks, so that the device can keep writing with O_DIRECT.
+        uint32_t frame_size = std::min<uint32_t>(max_frame_size, FB_COMPRESSED_FRAME_MAX_SZ);
+        if (frame_size >= 4096) {
+            frame_size &= ~4095u;
+        }
+
+        // Keep a few frames per thread queued, and send them in order. Any
+        // jobs still queued on an early return are waited for by ~future().
+        std::deque<std::future<CompressedFrame>> frames;
+        uint64_t offset = 0;
+        int read_error = 0;
+        while (offset < size || !frames.empty()) {
+            while (offset < size && frames.size() < 2 * num_threads) {
+                uint32_t len = std::min<uint64_t>(frame_size, size - offset);
+                frames.emplace_back(std::async(std::launch::async, CompressFrame, fd, offset, len));
+                offset += len;
+            }
+            CompressedFrame frame = frames.front().get();
+            frames.pop_front();
+            if (frame.error) {
+                read_error = frame.error;
+                break;
+            }
+            if ((ret = SendBuffer(frame.header, sizeof(frame.header))) ||
+                (ret = SendBuffer(frame.data.data(), frame.data.size()))) {
+                return ret;
+            }
+        }
+
+        // A header with both lengths 0 ends the stream. If the image could not
+        // be read, an oversized frame makes the device abort instead.
+        uint8_t end[FB_COMPRESSED_FRAME_HEADER_SZ] = {};
+        if (read_error) {
+            PutLe32(end + 4, UINT32_MAX);
+        }
+        if ((ret = SendBuffer(end, sizeof(end)))) {
+            return ret;
+        }
+        ret = HandleResponse();
+        if (read_error) {
+            error_ = StringPrintf("Reading image failed (%s)", strerror(read_error));
+            return IO_ERROR;
+        }
+        return ret;
+    }();
+    epilog_(result);
+    return result;
+}
+
 RetCode FastBootDriver::Partitions(std::vector<std::tuple<std::string, uint64_t>>* partitions) {
     std::vector<std::string> all;
     RetCode ret;
@@ -270,6 +564,35 @@ RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* resp
         return ret;
     }
 
+    if ((ret = SendSparse(s, use_crc))) {
+        return ret;
+    }
+
+    return HandleResponse(response, info);
+}
+
+RetCode FastBootDriver::FlashStream(const std::string& partition, uint32_t size,
+                                    const std::string& message,
+                                    const std::function<RetCode()>& send) {
+    prolog_(message);
+    auto result = [&]() -> RetCode {
+        RetCode ret;
+        std::string cmd = StringPrintf("%s:%08" PRIx32 ":%s", FB_CMD_FLASH_STREAM, size,
+                                       partition.c_str());
+        if ((ret = RawCommand(cmd))) {
+            return ret;
+        }
+        if ((ret = send())) {
+            return ret;
+        }
+        return HandleResponse();
+    }();
+    epilog_(result);
+    return result;
+}
+
+RetCode FastBootDriver::SendSparse(sparse_file* s, bool use_crc) {
+    RetCode ret;
     struct SparseCBPrivate {
         FastBootDriver* self;
         std::vector<char> tpbuf;
@@ -291,8 +614,7 @@ RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* resp
     if (cb_priv.tpbuf.size() && (ret = SendBuffer(cb_priv.tpbuf))) {
         return ret;
     }
-
-    return HandleResponse(response, info);
+    return SUCCESS;
 }
 
 RetCode FastBootDriver::Upload(const std::string& outfile, std::string* response,
@@ -384,6 +706,95 @@ RetCode FastBootDriver::FetchToFd(const std::string& partition, android::base::b
     return ret;
 }
 
+RetCode FastBootDriver::FetchStreamToFd(const std::string& partition,
+                                        android::base::borrowed_fd fd, uint64_t offset,
+                                        uint64_t size, const std::string& compression) {
+    std::string cmd = StringPrintf("%s:%s:%s:%" PRIx64 ":%" PRIx64, FB_CMD_FETCH_STREAM,
+                                   compression.c_str(), partition.c_str(), offset, size);
+    if (cmd.size() > FB_COMMAND_SZ) {
+        error_ = "Cannot use " FB_CMD_FETCH_STREAM " for this partition";
+        return BAD_ARG;
+    }
+
+    prolog_(StringPrintf("Fetching %s (offset=%" PRIx64 ", size=%" PRIx64 ", %s)",
+                         partition.c_str(), offset, size, compression.c_str()));
+    auto result = [&]() -> RetCode {
+        RetCode ret;
+        int max_frame_size = 0;
+        if ((ret = RawCommand(cmd, nullptr, nullptr, &max_frame_size))) {
+            return ret;
+        }
+        if (max_frame_size <= 0) {
+            error_ = "Device did not send a frame size";
+            return BAD_DEV_RESP;
+        }
+
+        std::vector<char> compressed(max_frame_size);
+        std::vector<char> frame(max_frame_size);
+        uint64_t received = 0;
+        for (;;) {
+            uint8_t header[FB_COMPRESSED_FRAME_HEADER_SZ];
+            if ((ret = ReadBuffer(header, sizeof(header)))) {
+                return ret;
+            }
+            uint32_t compressed_len = GetLe32(header);
+            uint32_t len = GetLe32(header + 4);
+            if (!compressed_len && !len) {
+                break;
+            }
+            if (!len || !compressed_len || compressed_len > len ||
+                len > static_cast<uint32_t>(max_frame_size) || received + len > size) {
+                error_ = "Device sent an invalid frame";
+                return BAD_DEV_RESP;
+            }
+            if ((ret = ReadBuffer(compressed.data(), compressed_len))) {
+                return ret;
+            }
+            const char* data = compressed.data();
+            if (compressed_len < len) {
+                int rv = LZ4_decompress_safe(compressed.data(), frame.data(), compressed_len, len);
+                if (rv != static_cast<int>(len)) {
+                    error_ = StringPrintf("Corrupt lz4 frame at offset %" PRIu64, received);
+                    return BAD_DEV_RESP;
+                }
+                data = frame.data();
+            }
+            if (!android::base::WriteFully(fd, data, len)) {
+                error_ = StringPrintf("Cannot write: %s", strerror(errno));
+                return IO_ERROR;
+            }
+            received += len;
+        }
+
+        // A read error on the device ends the stream early, followed by FAIL.
+        if ((ret = HandleResponse())) {
+            return ret;
+        }
+        if (received != size) {
+            error_ = StringPrintf("Device sent %" PRIu64 " of %" PRIu64 " bytes", received, size);
+            return BAD_DEV_RESP;
+        }
+        return SUCCESS;
+    }();
+    epilog_(result);
+    return result;
+}
+
+RetCode FastBootDriver::HashPartition(const std::string& partition, uint32_t chunk_size,
+                                      std::string* digests, std::string* response,
+                                      std::vector<std::string>* info) {
+    prolog_(android::base::StringPrintf("Hashing '%s'", partition.c_str()));
+    digests->clear();
+    std::string cmd = android::base::StringPrintf(FB_CMD_HASH_PARTITION ":%s:%x",
+                                                  partition.c_str(), chunk_size);
+    RetCode ret = RunAndReadBuffer(cmd, response, info, [&](const char* data, uint64_t size) {
+        digests->append(data, size);
+        return SUCCESS;
+    });
+    epilog_(ret);
+    return ret;
+}
+
 // Helpers
 void FastBootDriver::SetInfoCallback(std::function<void(const std::string&)> info) {
     info_ = info;
@@ -435,10 +846,16 @@ RetCode FastBootDriver::RawCommand(const std::string& cmd, const std::string& me
 RetCode FastBootDriver::RawCommand(const std::string& cmd, std::string* response,
                                    std::vector<std::string>* info, int* dsize) {
     error_ = "";  // Clear any pending error
-    if (cmd.size() > FB_COMMAND_SZ && !disable_checks_) {
+    // getvar:batch commands may be as long as the device says.
+    size_t max_size = FB_COMMAND_SZ;
+    if (android::base::StartsWith(cmd, FB_CMD_GETVAR ":" FB_VAR_BATCH ":")) {
+        max_size = std::max<int64_t>(max_size, max_getvar_batch_size_);
+    }
+    if (cmd.size() > max_size && !disable_checks_) {
         error_ = "Command length to RawCommand() is too long";
         return BAD_ARG;
     }
+    InvalidateVarCache(cmd);
 
     if (transport_->Write(cmd.c_str(), cmd.size()) != static_cast<int>(cmd.size())) {
         error_ = ErrnoStr("Write to device failed");
@@ -624,6 +1041,8 @@ int FastBootDriver::SparseWriteCallback(std::vector<char>& tpbuf, const char* da
 
 Transport* FastBootDriver::set_transport(Transport* transport) {
     std::swap(transport_, transport);
+    var_cache_.clear();
+    max_getvar_batch_size_ = -1;
     return transport;
 }
 
@@ -29,6 +29,7 @@
 #include <cstdlib>
 #include <deque>
 #include <limits>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -97,6 +98,11 @@ class FastBootDriver {
     RetCode GetVar(const std::string& key, std::string* val,
                    std::vector<std::string>* info = nullptr);
     RetCode GetVarAll(std::vector<std::string>* response);
+    // Queries |keys| with as few getvar:batch commands as the device allows, or one getvar per
+    // key if it does not support them, so that later GetVar() calls hit the variable cache.
+    // Failing to read a variable is not an error; its failure is cached like a value. Does
+    // nothing unless the cache is enabled.
+    RetCode GetVars(const std::vector<std::string>& keys);
     RetCode Reboot(std::string* response = nullptr, std::vector<std::string>* info = nullptr);
     RetCode RebootTo(std::string target, std::string* response = nullptr,
                      std::vector<std::string>* info = nullptr);
@@ -110,6 +116,14 @@ class FastBootDriver {
     RetCode FetchToFd(const std::string& partition, android::base::borrowed_fd fd,
                       int64_t offset = -1, int64_t size = -1, std::string* response = nullptr,
                       std::vector<std::string>* info = nullptr);
+    // Fetches |size| bytes at |offset| with a single fetch-stream command, writing each frame
+    // to |fd| as it arrives. |compression| is "none" or an algorithm from fetch-compression.
+    RetCode FetchStreamToFd(const std::string& partition, android::base::borrowed_fd fd,
+                            uint64_t offset, uint64_t size, const std::string& compression);
+    // Stores the digest of every |chunk_size| bytes of |partition|, end to end, in |digests|.
+    RetCode HashPartition(const std::string& partition, uint32_t chunk_size, std::string* digests,
+                          std::string* response = nullptr,
+                          std::vector<std::string>* info = nullptr);
 
     /* HIGHER LEVEL COMMANDS -- Composed of the commands above */
     RetCode FlashPartition(const std::string& partition, const std::vector<char>& data);
@@ -117,6 +131,11 @@ class FastBootDriver {
                            uint32_t sz);
     RetCode FlashPartition(const std::string& partition, sparse_file* s, uint32_t sz,
                            size_t current, size_t total);
+    // Sends a raw (non-sparse) image with flash-compressed. Frames are lz4
+    // compressed on |num_threads| threads, 0 meaning one per CPU. Returns
+    // BAD_ARG, without talking to the device, if the command would not fit.
+    RetCode FlashPartitionCompressed(const std::string& partition, android::base::borrowed_fd fd,
+                                     uint64_t size, unsigned int num_threads = 0);
 
     RetCode Partitions(std::vector<std::tuple<std::string, uint64_t>>* partitions);
     RetCode Require(const std::string& var, const std::vector<std::string>& allowed, bool* reqmet,
@@ -124,6 +143,11 @@ class FastBootDriver {
 
     /* HELPERS */
     void SetInfoCallback(std::function<void(const std::string&)> info);
+    // Makes FlashPartition() use flash-stream, which writes the image while it
+    // is being sent, instead of download followed by flash.
+    void EnableFlashStream(bool enable) { flash_stream_ = enable; }
+    // Makes GetVar() remember the variables it reads, until a command that could change them.
+    void EnableVarCache(bool enable);
     static const std::string RCString(RetCode rc);
     std::string Error();
     RetCode WaitForDisconnect();
@@ -155,6 +179,9 @@ class FastBootDriver {
     RetCode SendBuffer(const void* buf, size_t size);
 
     RetCode ReadBuffer(void* buf, size_t size);
+    RetCode SendSparse(sparse_file* s, bool use_crc);
+    RetCode FlashStream(const std::string& partition, uint32_t size, const std::string& message,
+                        const std::function<RetCode()>& send);
 
     RetCode UploadInner(const std::string& outfile, std::string* response = nullptr,
                         std::vector<std::string>* info = nullptr);
@@ -164,11 +191,24 @@ class FastBootDriver {
 
     int SparseWriteCallback(std::vector<char>& tpbuf, const char* data, size_t len);
 
+    struct CachedVar {
+        RetCode ret;
+        std::string value;
+    };
+    RetCode GetVarBatch(const std::vector<std::string>& keys);
+    void InvalidateVarCache(const std::string& cmd);
+
     std::string error_;
     std::function<void(const std::string&)> prolog_;
     std::function<void(int)> epilog_;
     std::function<void(const std::string&)> info_;
     bool disable_checks_;
+    bool flash_stream_ = false;
+    bool var_cache_enabled_ = false;
+    std::map<std::string, CachedVar> var_cache_;
+    // Longest getvar:batch command the device accepts, 0 if it doesn't support them, -1 until
+    // queried.
+    int64_t max_getvar_batch_size_ = -1;
 };
 
 }  // namespace fastboot
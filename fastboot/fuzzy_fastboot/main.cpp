@@ -33,6 +33,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <fstream>
@@ -48,6 +49,7 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <gtest/gtest.h>
+#include <openssl/sha.h>
 #include <sparse/sparse.h>
 
 #include "fastboot_driver.h"
@@ -269,6 +271,46 @@ TEST_F(LogicalPartitionCompliance, CreateResizeDeleteLP) {
             << "delete logical-partition failed";
 }
 
+TEST_F(LogicalPartitionCompliance, FlashBundle) {
+    ASSERT_TRUE(UserSpaceFastboot());
+    std::string var;
+    if (fb->GetVar("max-bundle-images", &var) != SUCCESS) {
+        GTEST_SKIP() << "flash-bundle not supported";
+    }
+    std::string slot_suffix;
+    if (fb->GetVar("current-slot", &var) == SUCCESS && !var.empty()) {
+        slot_suffix = "_" + var;
+    }
+
+    const std::vector<std::string> partitions = {"test_bundle_1" + slot_suffix,
+                                                 "test_bundle_2" + slot_suffix};
+    std::string header = FB_BUNDLE_MAGIC "\n";
+    std::vector<char> images;
+    for (const auto& partition : partitions) {
+        ASSERT_EQ(fb->CreatePartition(partition, "8192"), SUCCESS)
+                << "create-logical-partition failed";
+        header += android::base::StringPrintf("%s %zu %d\n", partition.c_str(),
+                                              FB_BUNDLE_HEADER_SIZE + images.size(), 8192);
+        std::vector<char> image = RandomBuf(8192);
+        images.insert(images.end(), image.begin(), image.end());
+    }
+    header.resize(FB_BUNDLE_HEADER_SIZE, '\0');
+    std::vector<char> bundle(header.begin(), header.end());
+    bundle.insert(bundle.end(), images.begin(), images.end());
+
+    EXPECT_EQ(fb->Download(bundle), SUCCESS) << "Download failed";
+    EXPECT_EQ(fb->RawCommand("flash-bundle"), SUCCESS) << "flash-bundle failed: " << fb->Error();
+
+    // An image running past the end of the download.
+    bundle.resize(FB_BUNDLE_HEADER_SIZE + 8192);
+    EXPECT_EQ(fb->Download(bundle), SUCCESS) << "Download failed";
+    EXPECT_EQ(fb->RawCommand("flash-bundle"), DEVICE_FAIL) << "Truncated bundle was accepted";
+
+    for (const auto& partition : partitions) {
+        EXPECT_EQ(fb->DeletePartition(partition), SUCCESS) << "delete-logical-partition failed";
+    }
+}
+
 // Conformance tests
 TEST_F(Conformance, GetVar) {
     std::string product;
@@ -373,6 +415,30 @@ TEST_F(Conformance, GetVarDownloadSize) {
     AssertHexUint32("max-download-size", var);
 }
 
+// Not a conformance requirement: reports how fast the host can push a large
+// download, which is dominated by the transport's bulk transfer path.
+TEST_F(Conformance, DownloadThroughput) {
+    std::string var;
+    ASSERT_EQ(fb->GetVar("max-download-size", &var), SUCCESS) << "getvar:max-download-size failed";
+    // The transport sniffer keeps a copy of everything sent, so cap the size.
+    const size_t size = std::min<size_t>(strtoll(var.c_str(), nullptr, 16), 64 * 1024 * 1024);
+    ASSERT_GT(size, 0) << "max-download-size must be non-zero";
+
+    std::vector<char> buf(size);
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = static_cast<char>(i * 31 + (i >> 12));
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(fb->Download(buf), SUCCESS) << "Download of " << size << " bytes failed";
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const double mbps = size / (1024.0 * 1024.0) / elapsed.count();
+    RecordProperty("download_bytes", std::to_string(size));
+    RecordProperty("download_mb_per_sec", android::base::StringPrintf("%.1f", mbps));
+    printf("Downloaded %zu bytes in %.3fs (%.1f MB/s)\n", size, elapsed.count(), mbps);
+}
+
 // If fetch is supported, getvar:max-fetch-size must return a hex string.
 TEST_F(Conformance, GetVarFetchSize) {
     std::string var;
@@ -658,6 +724,102 @@ TEST_F(Conformance, SparseVersionCheck) {
     }
 }
 
+// Only required if the device advertises getvar:flash-compression.
+TEST_F(Conformance, FlashCompressed) {
+    std::string var;
+    if (fb->GetVar("flash-compression", &var) != SUCCESS ||
+        var.find("lz4") == std::string::npos) {
+        GTEST_SKIP() << "flash-compressed:lz4 not supported";
+    }
+
+    // Compressible, incompressible and partial frames.
+    std::vector<char> buf(2 * 1024 * 1024, 'a');
+    std::vector<char> random = RandomBuf(1024 * 1024 + 1);
+    buf.insert(buf.end(), random.begin(), random.end());
+    TemporaryFile image;
+    ASSERT_TRUE(android::base::WriteFully(image.fd, buf.data(), buf.size()));
+    EXPECT_EQ(fb->FlashPartitionCompressed("userdata", image.fd, buf.size()), SUCCESS)
+            << "flash-compressed failed: " << fb->Error();
+}
+
+// Only required if the device advertises getvar:max-flash-stream-size.
+TEST_F(Conformance, FlashStream) {
+    std::string var;
+    if (fb->GetVar("max-flash-stream-size", &var) != SUCCESS) {
+        GTEST_SKIP() << "flash-stream not supported";
+    }
+    AssertHexUint32("max-flash-stream-size", var);
+
+    fb->EnableFlashStream(true);
+    std::vector<char> buf = RandomBuf(1024 * 1024 + 1);
+    EXPECT_EQ(fb->FlashPartition("userdata", buf), SUCCESS)
+            << "flash-stream of a raw image failed: " << fb->Error();
+
+    SparseWrapper sparse(4096, 64 * 4096);
+    ASSERT_TRUE(*sparse) << "Sparse image creation failed";
+    buf = RandomBuf(4096);
+    ASSERT_EQ(sparse_file_add_data(*sparse, buf.data(), buf.size(), 1), 0)
+            << "Adding data failed to sparse file: " << sparse.Rep();
+    ASSERT_EQ(sparse_file_add_fill(*sparse, 0xdeadbeef, 8 * 4096, 10), 0)
+            << "Adding fill to sparse file failed: " << sparse.Rep();
+    int64_t size = sparse_file_len(*sparse, true, false);
+    EXPECT_EQ(fb->FlashPartition("userdata", *sparse, size, 1, 1), SUCCESS)
+            << "flash-stream of a sparse image failed: " << fb->Error();
+    fb->EnableFlashStream(false);
+}
+
+TEST_F(Conformance, HashPartition) {
+    std::string var;
+    if (fb->GetVar("partition-hash", &var) != SUCCESS) {
+        GTEST_SKIP() << "hash-partition not supported";
+    }
+    ASSERT_EQ(var, "sha256");
+
+    const uint32_t chunk_size = 1024 * 1024;
+    std::vector<char> buf = RandomBuf(2 * chunk_size);
+    ASSERT_EQ(fb->FlashPartition("userdata", buf), SUCCESS) << "Flashing userdata failed";
+
+    std::string digests;
+    ASSERT_EQ(fb->HashPartition("userdata", chunk_size, &digests), SUCCESS)
+            << "hash-partition failed: " << fb->Error();
+    ASSERT_GE(digests.size(), 2 * SHA256_DIGEST_LENGTH);
+    ASSERT_EQ(digests.size() % SHA256_DIGEST_LENGTH, 0);
+    for (size_t i = 0; i < 2; i++) {
+        uint8_t digest[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const uint8_t*>(&buf[i * chunk_size]), chunk_size, digest);
+        EXPECT_EQ(memcmp(digest, &digests[i * SHA256_DIGEST_LENGTH], sizeof(digest)), 0)
+                << "Digest of chunk " << i << " does not match the flashed data";
+    }
+
+    EXPECT_EQ(fb->RawCommand("hash-partition:userdata:800"), DEVICE_FAIL)
+            << "Chunk sizes must be a multiple of 4096";
+}
+
+TEST_F(Conformance, GetVarBatch) {
+    std::string var;
+    if (fb->GetVar("max-getvar-batch-size", &var) != SUCCESS) {
+        GTEST_SKIP() << "getvar:batch not supported";
+    }
+
+    const std::vector<std::string> keys = {"product", "not-a-variable", "max-download-size"};
+    std::vector<std::pair<RetCode, std::string>> expected;
+    for (const auto& key : keys) {
+        RetCode ret = fb->GetVar(key, &var);
+        expected.emplace_back(ret, var);
+    }
+
+    // With the cache on, these reads are answered from what the batch cached.
+    fb->EnableVarCache(true);
+    EXPECT_EQ(fb->GetVars(keys), SUCCESS) << "getvar:batch failed: " << fb->Error();
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(fb->GetVar(keys[i], &var), expected[i].first) << keys[i];
+        EXPECT_EQ(var, expected[i].second) << keys[i];
+    }
+    fb->EnableVarCache(false);
+
+    EXPECT_EQ(fb->RawCommand("getvar:batch"), DEVICE_FAIL) << "A batch needs variables";
+}
+
 TEST_F(UnlockPermissions, Download) {
     std::vector<char> buf{'a', 'o', 's', 'p'};
     EXPECT_EQ(fb->Download(buf), SUCCESS) << "Download 4-byte payload failed";
@@ -698,6 +860,36 @@ TEST_F(UnlockPermissions, FetchVendorBoot) {
     }
 }
 
+// fetch-stream must send the same bytes as fetch, with and without compression.
+TEST_F(UnlockPermissions, FetchStreamVendorBoot) {
+    std::string var;
+    if (fb->GetVar("fetch-compression", &var) != SUCCESS) {
+        GTEST_SKIP() << "This test is skipped because fetch-stream is not supported.";
+    }
+    std::vector<std::tuple<std::string, uint64_t>> parts;
+    EXPECT_EQ(fb->Partitions(&parts), SUCCESS) << "getvar:all failed";
+    for (const auto& [partition, partition_size] : parts) {
+        if (!android::base::StartsWith(partition, "vendor_boot")) continue;
+        TemporaryFile expected;
+        uint64_t expected_size = std::min<uint64_t>(partition_size, 1024 * 1024);
+        ASSERT_EQ(fb->FetchToFd(partition, expected.fd, 0, expected_size), SUCCESS);
+        std::string expected_data;
+        ASSERT_TRUE(android::base::ReadFileToString(expected.path, &expected_data));
+
+        for (const auto& compression : android::base::Split(var, ",")) {
+            TemporaryFile fetched;
+            ASSERT_EQ(fb->FetchStreamToFd(partition, fetched.fd, 0, partition_size, compression),
+                      SUCCESS)
+                    << "Unable to fetch-stream " << partition << " with " << compression;
+            std::string fetched_data;
+            ASSERT_TRUE(android::base::ReadFileToString(fetched.path, &fetched_data));
+            ASSERT_EQ(fetched_data.size(), partition_size);
+            EXPECT_EQ(fetched_data.substr(0, expected_data.size()), expected_data)
+                    << compression << " fetch-stream of " << partition << " differs from fetch";
+        }
+    }
+}
+
 TEST_F(LockPermissions, DownloadFlash) {
     std::vector<char> buf{'a', 'o', 's', 'p'};
     EXPECT_EQ(fb->Download(buf), SUCCESS) << "Download failed in locked mode";
@@ -1082,6 +1274,27 @@ TEST_F(Fuzz, SparseTooManyChunks) {
     }
 }
 
+TEST_F(Fuzz, FlashCompressedInvalidFrame) {
+    std::string var;
+    if (fb->GetVar("flash-compression", &var) != SUCCESS ||
+        var.find("lz4") == std::string::npos) {
+        GTEST_SKIP() << "flash-compressed:lz4 not supported";
+    }
+
+    int max_frame_size = 0;
+    ASSERT_EQ(fb->RawCommand("flash-compressed:lz4:1000:userdata", nullptr, nullptr,
+                             &max_frame_size),
+              SUCCESS)
+            << "Device rejected flash-compressed";
+    ASSERT_GT(max_frame_size, 0) << "flash-compressed must reply with DATA";
+
+    // Claims more compressed bytes than uncompressed ones.
+    const std::vector<char> header = {'\x00', '\x10', '\x00', '\x00',
+                                      '\x00', '\x01', '\x00', '\x00'};
+    ASSERT_EQ(SendBuffer(header), SUCCESS) << "Sending frame header failed";
+    EXPECT_EQ(HandleResponse(), DEVICE_FAIL) << "An invalid frame should be rejected";
+}
+
 TEST_F(Fuzz, USBResetSpam) {
     auto start = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed;
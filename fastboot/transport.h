@@ -16,6 +16,12 @@
 
 #pragma once
 
+#include <sys/types.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
 #include <android-base/macros.h>
 
 // General interface to allow the fastboot protocol to be used over different
@@ -29,6 +35,27 @@ class Transport {
     // read or -1 on error.
     virtual ssize_t Read(void* data, size_t len) = 0;
 
+    // Reads |len| bytes, passing them to |consume| in order as they arrive, and stops early if
+    // |consume| returns false. Returns the number of bytes actually read or -1 on error.
+    // Transports that can keep reading while |consume| runs should override this.
+    virtual ssize_t ReadStream(size_t len,
+                               const std::function<bool(const char*, size_t)>& consume) {
+        std::vector<char> buffer(std::min<size_t>(len, 1024 * 1024));
+        size_t total = 0;
+        while (total < len) {
+            size_t chunk = std::min(len - total, buffer.size());
+            ssize_t n = Read(buffer.data(), chunk);
+            if (n < 0 || !consume(buffer.data(), n)) {
+                return -1;
+            }
+            total += n;
+            if (static_cast<size_t>(n) < chunk) {
+                break;
+            }
+        }
+        return total;
+    }
+
     // Writes |len| bytes from |data|. Returns the number of bytes actually
     // written or -1 on error.
     virtual ssize_t Write(const void* data, size_t len) = 0;
@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <stdio.h>
 
+#include <algorithm>
 #include <list>
 #include <memory>
 #include <vector>
@@ -131,9 +132,16 @@ class UdpTransport : public Transport {
                                    uint8_t* rx_data, size_t rx_length, int attempts,
                                    std::string* error);
 
+    // Sends |length| bytes from |data| keeping up to |window_size_| packets in flight, and
+    // retransmits only the packets that haven't been acknowledged. Returns the same as SendData().
+    ssize_t SendWindowed(Id id, const uint8_t* tx_data, size_t tx_length, int attempts,
+                         std::string* error);
+
     std::unique_ptr<Socket> socket_;
     int sequence_ = -1;
     size_t max_data_length_ = kMinPacketSize - kHeaderSize;
+    // Negotiated with version 2 devices; 1 is the version 1 stop-and-wait behavior.
+    size_t window_size_ = 1;
     std::vector<uint8_t> rx_packet_;
 
     DISALLOW_COPY_AND_ASSIGN(UdpTransport);
@@ -151,7 +159,7 @@ std::unique_ptr<UdpTransport> UdpTransport::NewTransport(std::unique_ptr<Socket>
 }
 
 bool UdpTransport::InitializeProtocol(std::string* error) {
-    uint8_t rx_data[4];
+    uint8_t rx_data[6];
 
     sequence_ = 0;
     rx_packet_.resize(kMinPacketSize);
@@ -182,9 +190,10 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     }
 
     // The first two data bytes contain the version, the second two bytes contain the target max
-    // supported packet size, which must be at least 512 bytes.
-    uint16_t version = ExtractUint16(rx_data);
-    if (version < kProtocolVersion) {
+    // supported packet size, which must be at least 512 bytes. Version 2 devices add their
+    // window size.
+    uint16_t version = std::min(ExtractUint16(rx_data), kProtocolVersion);
+    if (version < kMinProtocolVersion) {
         *error = android::base::StringPrintf("target reported invalid protocol version %d",
                                              version);
         return false;
@@ -199,6 +208,11 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     max_data_length_ = packet_size - kHeaderSize;
     rx_packet_.resize(packet_size);
 
+    window_size_ = 1;
+    if (version >= 2 && rx_bytes >= 6) {
+        window_size_ = std::clamp<uint16_t>(ExtractUint16(rx_data + 4), 1, kHostMaxWindowSize);
+    }
+
     return true;
 }
 
@@ -211,6 +225,12 @@ ssize_t UdpTransport::SendData(Id id, const uint8_t* tx_data, size_t tx_length,
         return -1;
     }
 
+    // Only writes of more than one packet benefit from a window; reads are always sent one packet
+    // at a time, so the device's data can come back in its response.
+    if (window_size_ > 1 && id == kIdFastboot && tx_length > max_data_length_) {
+        return SendWindowed(id, tx_data, tx_length, attempts, error);
+    }
+
     Header header;
     size_t packet_data_length;
     ssize_t ret = 0;
@@ -325,6 +345,87 @@ ssize_t UdpTransport::SendSinglePacketHelper(
     return total_data_bytes;
 }
 
+ssize_t UdpTransport::SendWindowed(Id id, const uint8_t* tx_data, size_t tx_length,
+                                   const int attempts, std::string* error) {
+    const size_t num_packets = (tx_length + max_data_length_ - 1) / max_data_length_;
+    std::vector<bool> acked(num_packets);
+
+    auto header = [&](size_t i) {
+        Header header;
+        header.Set(id, sequence_ + i, i + 1 < num_packets ? kFlagContinuation : kFlagNone);
+        return header;
+    };
+    auto send = [&](size_t i) -> bool {
+        size_t offset = i * max_data_length_;
+        size_t length = std::min(max_data_length_, tx_length - offset);
+        if (!socket_->Send({{header(i).bytes(), kHeaderSize}, {tx_data + offset, length}})) {
+            *error = Socket::GetErrorMessage();
+            return false;
+        }
+        return true;
+    };
+
+    error->clear();
+    ssize_t total_data_bytes = 0;
+    int attempts_left = attempts;
+    // Every packet before |base| has been acknowledged, and every packet before |next| sent.
+    size_t base = 0;
+    size_t next = 0;
+    while (base < num_packets) {
+        for (; next < num_packets && next < base + window_size_; ++next) {
+            if (!send(next)) return -1;
+        }
+
+        ssize_t bytes = socket_->Receive(rx_packet_.data(), rx_packet_.size(), kResponseTimeoutMs);
+        if (bytes == -1) {
+            if (!socket_->ReceiveTimedOut()) {
+                *error = Socket::GetErrorMessage();
+                return -1;
+            }
+            if (--attempts_left <= 0) {
+                *error = "no response from target";
+                return -1;
+            }
+            for (size_t i = base; i < next; ++i) {
+                if (!acked[i] && !send(i)) return -1;
+            }
+            continue;
+        } else if (bytes < static_cast<ssize_t>(kHeaderSize)) {
+            *error = "protocol error: incomplete header";
+            return -1;
+        }
+
+        // Ignore anything that doesn't answer a packet in flight, e.g. a duplicate response to a
+        // packet that was retransmitted.
+        uint16_t offset =
+                static_cast<uint16_t>(ExtractUint16(&rx_packet_[kIndexSeqH]) - sequence_ - base);
+        size_t index = base + offset;
+        if (index >= next || !header(index).Matches(rx_packet_.data())) {
+            continue;
+        }
+        if (rx_packet_[kIndexId] == kIdError) {
+            *error = "target reported error: " +
+                     std::string(rx_packet_.data() + kHeaderSize, rx_packet_.data() + bytes);
+            return -1;
+        }
+        if (rx_packet_[kIndexFlags] & kFlagContinuation) {
+            *error = "protocol error: continuation in response to a windowed write";
+            return -1;
+        }
+        if (!acked[index]) {
+            acked[index] = true;
+            total_data_bytes += bytes - kHeaderSize;
+            attempts_left = attempts;
+        }
+        while (base < num_packets && acked[base]) {
+            ++base;
+        }
+    }
+
+    sequence_ += num_packets;
+    return total_data_bytes;
+}
+
 ssize_t UdpTransport::Read(void* data, size_t length) {
     // Read from the target by sending an empty packet.
     std::string error;
@@ -56,6 +56,12 @@ static std::string InitPacket(uint16_t sequence, uint16_t version, uint16_t max_
            PacketValue(version) + PacketValue(max_packet_size);
 }
 
+// Returns a version 2 Init response packet with a 2-byte |window_size|.
+static std::string InitPacketV2(uint16_t sequence, uint16_t max_packet_size,
+                                uint16_t window_size) {
+    return InitPacket(sequence, 2, max_packet_size) + PacketValue(window_size);
+}
+
 // Returns a Fastboot packet with |data|.
 static std::string FastbootPacket(uint16_t sequence, const std::string& data = "",
                                   char flags = kFlagNone) {
@@ -134,6 +140,31 @@ TEST_F(UdpConnectTest, InitializationVersionMismatch) {
     EXPECT_FALSE(UdpConnect());
 }
 
+// Tests that a version 2 host still connects to version 1 devices, and to version 2 devices with
+// or without a window.
+TEST_F(UdpConnectTest, InitializationWindowNegotiation) {
+    mock_socket_->ExpectSend(QueryPacket(0));
+    mock_socket_->AddReceive(QueryPacket(0, 0));
+    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->AddReceive(InitPacket(0, 1, 1024));
+
+    EXPECT_TRUE(UdpConnect());
+
+    mock_socket_->ExpectSend(QueryPacket(0));
+    mock_socket_->AddReceive(QueryPacket(0, 0));
+    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->AddReceive(InitPacketV2(0, 1024, 16));
+
+    EXPECT_TRUE(UdpConnect());
+
+    mock_socket_->ExpectSend(QueryPacket(0));
+    mock_socket_->AddReceive(QueryPacket(0, 0));
+    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->AddReceive(InitPacketV2(0, 1024, 0));
+
+    EXPECT_TRUE(UdpConnect());
+}
+
 TEST_F(UdpConnectTest, QueryResponseTimeoutFailure) {
     for (int i = 0; i < kMaxConnectAttempts; ++i) {
         mock_socket_->ExpectSend(QueryPacket(0));
@@ -310,14 +341,21 @@ class UdpTest : public ::testing::Test {
 
     // Sets up |mock_socket_| to correctly initialize the protocol and creates |transport_|. This
     // can be called multiple times in a test if needed.
-    bool InitializeTransport(uint16_t starting_sequence, int device_max_packet_size = 512) {
+    // A non-zero |device_window_size| makes the device a version 2 device with that window.
+    bool InitializeTransport(uint16_t starting_sequence, int device_max_packet_size = 512,
+                             int device_window_size = 0) {
         mock_socket_ = new SocketMock;
         mock_socket_->ExpectSend(QueryPacket(0));
         mock_socket_->AddReceive(QueryPacket(0, starting_sequence));
         mock_socket_->ExpectSend(
                 InitPacket(starting_sequence, kProtocolVersion, kHostMaxPacketSize));
-        mock_socket_->AddReceive(
-                InitPacket(starting_sequence, kProtocolVersion, device_max_packet_size));
+        if (device_window_size) {
+            mock_socket_->AddReceive(
+                    InitPacketV2(starting_sequence, device_max_packet_size, device_window_size));
+        } else {
+            mock_socket_->AddReceive(
+                    InitPacket(starting_sequence, kProtocolVersion, device_max_packet_size));
+        }
 
         std::string error;
         transport_ = Connect(std::unique_ptr<Socket>(mock_socket_), &error);
@@ -522,6 +560,78 @@ TEST_F(UdpTest, ErrorResponse) {
     EXPECT_FALSE(Write("foo"));
 }
 
+// Tests that writes to a version 2 device keep up to a window of packets in flight.
+TEST_F(UdpTest, WindowedWrite) {
+    ASSERT_TRUE(InitializeTransport(0xFFFE, 512, 3));
+
+    std::string data;
+    for (char c : {'a', 'b', 'c', 'd', 'e'}) {
+        data += std::string(c == 'e' ? 100 : 508, c);
+    }
+    auto packet = [&](uint16_t sequence, size_t i) {
+        return FastbootPacket(sequence, data.substr(i * 508, 508),
+                              i < 4 ? kFlagContinuation : kFlagNone);
+    };
+
+    mock_socket_->ExpectSend(packet(0xFFFF, 0));
+    mock_socket_->ExpectSend(packet(0x0000, 1));
+    mock_socket_->ExpectSend(packet(0x0001, 2));
+    mock_socket_->AddReceive(FastbootPacket(0xFFFF));
+    mock_socket_->ExpectSend(packet(0x0002, 3));
+    mock_socket_->AddReceive(FastbootPacket(0x0000));
+    mock_socket_->ExpectSend(packet(0x0003, 4));
+    mock_socket_->AddReceive(FastbootPacket(0x0001));
+    mock_socket_->AddReceive(FastbootPacket(0x0002));
+    mock_socket_->AddReceive(FastbootPacket(0x0003));
+
+    EXPECT_TRUE(Write(data));
+
+    // Single-packet writes and reads are still sent one at a time.
+    mock_socket_->ExpectSend(FastbootPacket(0x0004, "foo"));
+    mock_socket_->AddReceive(FastbootPacket(0x0004));
+    mock_socket_->ExpectSend(FastbootPacket(0x0005));
+    mock_socket_->AddReceive(FastbootPacket(0x0005, "bar"));
+
+    EXPECT_TRUE(Write("foo"));
+    EXPECT_TRUE(Read("bar"));
+}
+
+// Tests that only the packets that weren't acknowledged are retransmitted, and that stale or
+// duplicate responses are ignored.
+TEST_F(UdpTest, WindowedWriteSelectiveRetransmit) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 4));
+
+    std::string data(3 * 508, 'x');
+    std::string payload(508, 'x');
+
+    mock_socket_->ExpectSend(FastbootPacket(1, payload, kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, payload, kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(3, payload));
+    mock_socket_->AddReceive(FastbootPacket(3));
+    mock_socket_->AddReceive(FastbootPacket(0));
+    mock_socket_->AddReceive(FastbootPacket(1));
+    mock_socket_->AddReceive(FastbootPacket(3));
+    mock_socket_->AddReceiveTimeout();
+    mock_socket_->ExpectSend(FastbootPacket(2, payload, kFlagContinuation));
+    mock_socket_->AddReceive(FastbootPacket(2));
+
+    EXPECT_TRUE(Write(data));
+}
+
+// Tests that an error response during a windowed write fails it without retransmission.
+TEST_F(UdpTest, WindowedWriteError) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 2));
+
+    std::string data(2 * 508, 'x');
+    std::string payload(508, 'x');
+
+    mock_socket_->ExpectSend(FastbootPacket(1, payload, kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, payload));
+    mock_socket_->AddReceive(ErrorPacket(2, "test error"));
+
+    EXPECT_FALSE(Write(data));
+}
+
 // Tests that attempting to use a closed transport returns -1 without making any socket calls.
 TEST_F(UdpTest, CloseTransport) {
     char buffer[32];
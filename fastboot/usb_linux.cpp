@@ -30,6 +30,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +46,7 @@
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
+#include <algorithm>
 #include <chrono>
 #include <memory>
 #include <thread>
@@ -85,6 +87,15 @@ using namespace std::chrono_literals;
 // kernel.
 #define MAX_USBFS_BULK_SIZE (16 * 1024)
 
+// Large writes are split into asynchronous URBs, several of which are kept in
+// flight so that the host controller always has the next one queued. URBs
+// start out at MAX_URB_SIZE and are halved whenever the kernel refuses one
+// (older kernels, usbfs_memory_mb, or host controllers without scatter-gather
+// support); the working size is remembered for the lifetime of the transport.
+// Below MAX_USBFS_BULK_SIZE, the synchronous path is used instead.
+#define MAX_URB_SIZE (1024 * 1024)
+#define MAX_URBS_IN_FLIGHT 4
+
 struct usb_handle
 {
     char fname[64];
@@ -106,8 +117,13 @@ class LinuxUsbTransport : public UsbTransport {
     int WaitForDisconnect() override;
 
   private:
+    ssize_t WriteSync(const unsigned char* data, size_t len);
+    ssize_t WriteAsync(const unsigned char* data, size_t len);
+    void DiscardUrbs(usbdevfs_urb* urbs, int in_flight);
+
     std::unique_ptr<usb_handle> handle_;
     const uint32_t ms_timeout_;
+    size_t urb_size_ = MAX_URB_SIZE;
 
     DISALLOW_COPY_AND_ASSIGN(LinuxUsbTransport);
 };
@@ -402,22 +418,31 @@ LinuxUsbTransport::~LinuxUsbTransport() {
 
 ssize_t LinuxUsbTransport::Write(const void* _data, size_t len)
 {
-    unsigned char *data = (unsigned char*) _data;
-    unsigned count = 0;
-    struct usbdevfs_bulktransfer bulk;
-    int n;
+    const unsigned char* data = (const unsigned char*)_data;
 
     if (handle_->ep_out == 0 || handle_->desc == -1) {
         return -1;
     }
 
+    if (len > MAX_USBFS_BULK_SIZE && urb_size_ >= MAX_USBFS_BULK_SIZE) {
+        return WriteAsync(data, len);
+    }
+    return WriteSync(data, len);
+}
+
+ssize_t LinuxUsbTransport::WriteSync(const unsigned char* data, size_t len)
+{
+    unsigned count = 0;
+    struct usbdevfs_bulktransfer bulk;
+    int n;
+
     do {
         int xfer;
         xfer = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
 
         bulk.ep = handle_->ep_out;
         bulk.len = xfer;
-        bulk.data = data;
+        bulk.data = const_cast<unsigned char*>(data);
         bulk.timeout = ms_timeout_;
 
         n = ioctl(handle_->desc, USBDEVFS_BULK, &bulk);
@@ -435,6 +460,119 @@ ssize_t LinuxUsbTransport::Write(const void* _data, size_t len)
     return count;
 }
 
+// Cancels and reaps every URB still owned by the kernel, so that none of them
+// refers to the caller's buffer once Write() returns.
+void LinuxUsbTransport::DiscardUrbs(usbdevfs_urb* urbs, int in_flight)
+{
+    for (int i = 0; i < MAX_URBS_IN_FLIGHT; i++) {
+        if (urbs[i].buffer) {
+            ioctl(handle_->desc, USBDEVFS_DISCARDURB, &urbs[i]);
+        }
+    }
+    while (in_flight > 0) {
+        usbdevfs_urb* urb = nullptr;
+        if (TEMP_FAILURE_RETRY(ioctl(handle_->desc, USBDEVFS_REAPURB, &urb)) < 0) {
+            // The device is gone; the kernel has already dropped the URBs.
+            break;
+        }
+        urb->buffer = nullptr;
+        in_flight--;
+    }
+}
+
+ssize_t LinuxUsbTransport::WriteAsync(const unsigned char* data, size_t len)
+{
+    struct usbdevfs_urb urbs[MAX_URBS_IN_FLIGHT];
+    memset(urbs, 0, sizeof(urbs));
+
+    size_t submitted = 0;
+    size_t completed = 0;
+    int in_flight = 0;
+
+    while (completed < len) {
+        // Keep the queue full. A slot is free when its buffer is null.
+        for (int i = 0; i < MAX_URBS_IN_FLIGHT && submitted < len; i++) {
+            usbdevfs_urb* urb = &urbs[i];
+            if (urb->buffer) {
+                continue;
+            }
+            size_t xfer = std::min(len - submitted, urb_size_);
+            urb->type = USBDEVFS_URB_TYPE_BULK;
+            urb->endpoint = handle_->ep_out;
+            urb->buffer = const_cast<unsigned char*>(data + submitted);
+            urb->buffer_length = xfer;
+            urb->status = 0;
+            urb->actual_length = 0;
+            if (ioctl(handle_->desc, USBDEVFS_SUBMITURB, urb) < 0) {
+                int saved_errno = errno;
+                urb->buffer = nullptr;
+                if ((saved_errno == ENOMEM || saved_errno == EINVAL) && in_flight > 0) {
+                    // Out of usbfs memory; wait for a URB to complete before
+                    // trying again.
+                    break;
+                }
+                if ((saved_errno == ENOMEM || saved_errno == EINVAL) &&
+                    urb_size_ / 2 >= MAX_USBFS_BULK_SIZE) {
+                    urb_size_ /= 2;
+                    DBG("[ usb urb size reduced to %zu ]\n", urb_size_);
+                    i--;
+                    continue;
+                }
+                DBG("ERROR: submit urb errno = %d (%s)\n", saved_errno, strerror(saved_errno));
+                DiscardUrbs(urbs, in_flight);
+                if (in_flight == 0 && submitted == 0 && saved_errno != ENODEV) {
+                    // Async URBs do not work at all here; remember that, and
+                    // send everything synchronously.
+                    urb_size_ = 0;
+                    return WriteSync(data, len);
+                }
+                errno = saved_errno;
+                return -1;
+            }
+            submitted += xfer;
+            in_flight++;
+        }
+
+        // usbfs signals POLLOUT when a completed URB is ready to be reaped.
+        struct pollfd pfd = {};
+        pfd.fd = handle_->desc;
+        pfd.events = POLLOUT;
+        int timeout = ms_timeout_ ? static_cast<int>(ms_timeout_) : -1;
+        int n = TEMP_FAILURE_RETRY(poll(&pfd, 1, timeout));
+        if (n <= 0) {
+            DBG("ERROR: urb poll n = %d, errno = %d (%s)\n", n, errno, strerror(errno));
+            int saved_errno = n == 0 ? ETIMEDOUT : errno;
+            DiscardUrbs(urbs, in_flight);
+            errno = saved_errno;
+            return -1;
+        }
+
+        usbdevfs_urb* urb = nullptr;
+        while (ioctl(handle_->desc, USBDEVFS_REAPURBNDELAY, &urb) == 0) {
+            in_flight--;
+            bool ok = urb->status == 0 && urb->actual_length == urb->buffer_length;
+            urb->buffer = nullptr;
+            if (!ok) {
+                DBG("ERROR: urb status = %d, actual = %d/%d\n", urb->status, urb->actual_length,
+                    urb->buffer_length);
+                DiscardUrbs(urbs, in_flight);
+                errno = urb->status ? -urb->status : EIO;
+                return -1;
+            }
+            completed += urb->buffer_length;
+        }
+        if (errno != EAGAIN) {
+            int saved_errno = errno;
+            DBG("ERROR: reap urb errno = %d (%s)\n", errno, strerror(errno));
+            DiscardUrbs(urbs, in_flight);
+            errno = saved_errno;
+            return -1;
+        }
+    }
+
+    return completed;
+}
+
 ssize_t LinuxUsbTransport::Read(void* _data, size_t len)
 {
     unsigned char *data = (unsigned char*) _data;
@@ -25,11 +25,13 @@
 #include <unistd.h>
 #endif
 
+#include <algorithm>
 #include <functional>
 #include <thread>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 
 namespace android {
@@ -38,41 +40,50 @@ namespace fs_mgr {
 using namespace std::literals;
 using android::base::unique_fd;
 
-bool PollForFile(const std::string& path, const std::chrono::milliseconds relative_timeout) {
-    auto start_time = std::chrono::steady_clock::now();
-
-    while (true) {
-        if (!access(path.c_str(), F_OK) || errno != ENOENT) return true;
-
-        std::this_thread::sleep_for(50ms);
-
-        auto now = std::chrono::steady_clock::now();
-        auto time_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
-        if (time_elapsed > relative_timeout) return false;
+// Whether |path| exists, or no longer exists if |exists| is false.
+static bool IsSettled(const std::string& path, bool exists) {
+    if (exists) {
+        return !access(path.c_str(), F_OK) || errno != ENOENT;
     }
+    return access(path.c_str(), F_OK) && errno == ENOENT;
+}
+
+// Removes the paths that are in the awaited state from |paths|.
+static void RemoveSettled(std::vector<std::string>* paths, bool exists) {
+    paths->erase(std::remove_if(paths->begin(), paths->end(),
+                                [exists](const auto& path) { return IsSettled(path, exists); }),
+                 paths->end());
 }
 
-bool PollForFileDeleted(const std::string& path, const std::chrono::milliseconds relative_timeout) {
+static bool PollForFiles(std::vector<std::string> paths, bool exists,
+                         const std::chrono::milliseconds relative_timeout,
+                         std::vector<std::string>* missing) {
     auto start_time = std::chrono::steady_clock::now();
 
     while (true) {
-        if (access(path.c_str(), F_OK) && errno == ENOENT) return true;
+        RemoveSettled(&paths, exists);
+        if (paths.empty()) return true;
 
         std::this_thread::sleep_for(50ms);
 
         auto now = std::chrono::steady_clock::now();
         auto time_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
-        if (time_elapsed > relative_timeout) return false;
+        if (time_elapsed > relative_timeout) {
+            if (missing) *missing = std::move(paths);
+            return false;
+        }
     }
 }
 
 #if defined(__linux__)
+// Waits for every one of a set of paths to be created or deleted, with a single inotify instance
+// and a single deadline for all of them.
 class OneShotInotify {
   public:
-    OneShotInotify(const std::string& path, uint32_t mask,
+    OneShotInotify(const std::vector<std::string>& paths, uint32_t mask,
                    const std::chrono::milliseconds relative_timeout);
 
-    bool Wait();
+    bool Wait(std::vector<std::string>* missing);
 
   private:
     bool CheckCompleted();
@@ -83,16 +94,17 @@ class OneShotInotify {
     Result WaitImpl();
 
     unique_fd inotify_fd_;
-    std::string path_;
+    // The paths that have not reached the awaited state yet.
+    std::vector<std::string> paths_;
     uint32_t mask_;
     std::chrono::time_point<std::chrono::steady_clock> start_time_;
     std::chrono::milliseconds relative_timeout_;
     bool finished_;
 };
 
-OneShotInotify::OneShotInotify(const std::string& path, uint32_t mask,
+OneShotInotify::OneShotInotify(const std::vector<std::string>& paths, uint32_t mask,
                                const std::chrono::milliseconds relative_timeout)
-    : path_(path),
+    : paths_(paths),
       mask_(mask),
       start_time_(std::chrono::steady_clock::now()),
       relative_timeout_(relative_timeout),
@@ -106,15 +118,20 @@ OneShotInotify::OneShotInotify(const std::string& path, uint32_t mask,
         return;
     }
 
-    std::string watch_path;
-    if (mask == IN_CREATE) {
-        watch_path = android::base::Dirname(path);
-    } else {
-        watch_path = path;
-    }
-    if (inotify_add_watch(inotify_fd, watch_path.c_str(), mask) < 0) {
-        PLOG(ERROR) << "inotify_add_watch failed";
-        return;
+    // Paths that share a directory share its watch, which inotify_add_watch() takes care of.
+    for (const auto& path : paths_) {
+        std::string watch_path;
+        if (mask == IN_CREATE) {
+            watch_path = android::base::Dirname(path);
+        } else {
+            watch_path = path;
+        }
+        if (inotify_add_watch(inotify_fd, watch_path.c_str(), mask) < 0) {
+            // The path may have been deleted since it was checked.
+            if (mask == IN_DELETE_SELF && errno == ENOENT) continue;
+            PLOG(ERROR) << "inotify_add_watch failed";
+            return;
+        }
     }
 
     // It's possible the condition was met before the add_watch. Check for
@@ -124,17 +141,20 @@ OneShotInotify::OneShotInotify(const std::string& path, uint32_t mask,
     inotify_fd_ = std::move(inotify_fd);
 }
 
-bool OneShotInotify::Wait() {
+bool OneShotInotify::Wait(std::vector<std::string>* missing) {
     Result result = WaitImpl();
     if (result == Result::Success) return true;
-    if (result == Result::Timeout) return false;
+    if (result == Result::Timeout) {
+        if (missing) *missing = paths_;
+        return false;
+    }
 
     // Some kind of error with inotify occurred, so fallback to a poll.
     std::chrono::milliseconds timeout(RemainingMs());
     if (mask_ == IN_CREATE) {
-        return PollForFile(path_, timeout);
+        return PollForFiles(paths_, true, timeout, missing);
     } else if (mask_ == IN_DELETE_SELF) {
-        return PollForFileDeleted(path_, timeout);
+        return PollForFiles(paths_, false, timeout, missing);
     } else {
         LOG(ERROR) << "Unknown inotify mask: " << mask_;
         return false;
@@ -165,7 +185,7 @@ OneShotInotify::Result OneShotInotify::WaitImpl() {
             return Result::Error;
         }
         if (event.revents & POLLERR) {
-            LOG(ERROR) << "error reading inotify for " << path_;
+            LOG(ERROR) << "error reading inotify for " << android::base::Join(paths_, ", ");
             return Result::Error;
         }
 
@@ -179,12 +199,14 @@ OneShotInotify::Result OneShotInotify::WaitImpl() {
 
 bool OneShotInotify::CheckCompleted() {
     if (mask_ == IN_CREATE) {
-        finished_ = !access(path_.c_str(), F_OK) || errno != ENOENT;
+        RemoveSettled(&paths_, true);
     } else if (mask_ == IN_DELETE_SELF) {
-        finished_ = access(path_.c_str(), F_OK) && errno == ENOENT;
+        RemoveSettled(&paths_, false);
     } else {
         LOG(ERROR) << "Unexpected mask: " << mask_;
+        return finished_;
     }
+    finished_ = paths_.empty();
     return finished_;
 }
 
@@ -215,22 +237,28 @@ int64_t OneShotInotify::RemainingMs() const {
 }
 #endif
 
-bool WaitForFile(const std::string& path, const std::chrono::milliseconds relative_timeout) {
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds relative_timeout,
+                  std::vector<std::string>* missing) {
 #if defined(__linux__)
-    OneShotInotify inotify(path, IN_CREATE, relative_timeout);
-    return inotify.Wait();
+    OneShotInotify inotify(paths, IN_CREATE, relative_timeout);
+    return inotify.Wait(missing);
 #else
-    return PollForFile(path, relative_timeout);
+    return PollForFiles(paths, true, relative_timeout, missing);
 #endif
 }
 
+bool WaitForFile(const std::string& path, const std::chrono::milliseconds relative_timeout) {
+    return WaitForFiles({path}, relative_timeout);
+}
+
 // Wait at most |relative_timeout| milliseconds for |path| to stop existing.
 bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds relative_timeout) {
 #if defined(__linux__)
-    OneShotInotify inotify(path, IN_DELETE_SELF, relative_timeout);
-    return inotify.Wait();
+    OneShotInotify inotify({path}, IN_DELETE_SELF, relative_timeout);
+    return inotify.Wait(nullptr);
 #else
-    return PollForFileDeleted(path, relative_timeout);
+    return PollForFiles({path}, false, relative_timeout, nullptr);
 #endif
 }
 
@@ -37,6 +37,7 @@
 #include <array>
 #include <chrono>
 #include <functional>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
@@ -53,6 +54,7 @@
 #include <android-base/unique_fd.h>
 #include <cutils/android_filesystem_config.h>
 #include <cutils/android_reboot.h>
+#include <cutils/iosched_policy.h>
 #include <cutils/partition_utils.h>
 #include <cutils/properties.h>
 #include <ext4_utils/ext4.h>
@@ -240,12 +242,12 @@ static void check_fs(const std::string& blk_device, const std::string& fs_type,
         } else {
             LINFO << "Running " << E2FSCK_BIN << " on " << realpath(blk_device);
             if (should_force_check(*fs_stat)) {
-                ret = logwrap_fork_execvp(ARRAY_SIZE(e2fsck_forced_argv), e2fsck_forced_argv,
-                                          &status, false, LOG_KLOG | LOG_FILE, false,
-                                          FSCK_LOG_FILE);
+                ret = fs_mgr_run_fs_helper(target, ARRAY_SIZE(e2fsck_forced_argv),
+                                           e2fsck_forced_argv, &status, LOG_KLOG | LOG_FILE,
+                                           FSCK_LOG_FILE);
             } else {
-                ret = logwrap_fork_execvp(ARRAY_SIZE(e2fsck_argv), e2fsck_argv, &status, false,
-                                          LOG_KLOG | LOG_FILE, false, FSCK_LOG_FILE);
+                ret = fs_mgr_run_fs_helper(target, ARRAY_SIZE(e2fsck_argv), e2fsck_argv, &status,
+                                           LOG_KLOG | LOG_FILE, FSCK_LOG_FILE);
             }
 
             if (ret < 0) {
@@ -270,14 +272,14 @@ static void check_fs(const std::string& blk_device, const std::string& fs_type,
             if (should_force_check(*fs_stat)) {
                 LINFO << "Running " << F2FS_FSCK_BIN << " -f -c 10000 --debug-cache "
                       << realpath(blk_device);
-                ret = logwrap_fork_execvp(ARRAY_SIZE(f2fs_fsck_forced_argv), f2fs_fsck_forced_argv,
-                                          &status, false, LOG_KLOG | LOG_FILE, false,
-                                          FSCK_LOG_FILE);
+                ret = fs_mgr_run_fs_helper(target, ARRAY_SIZE(f2fs_fsck_forced_argv),
+                                           f2fs_fsck_forced_argv, &status, LOG_KLOG | LOG_FILE,
+                                           FSCK_LOG_FILE);
             } else {
                 LINFO << "Running " << F2FS_FSCK_BIN << " -a -c 10000 --debug-cache "
                       << realpath(blk_device);
-                ret = logwrap_fork_execvp(ARRAY_SIZE(f2fs_fsck_argv), f2fs_fsck_argv, &status,
-                                          false, LOG_KLOG | LOG_FILE, false, FSCK_LOG_FILE);
+                ret = fs_mgr_run_fs_helper(target, ARRAY_SIZE(f2fs_fsck_argv), f2fs_fsck_argv,
+                                           &status, LOG_KLOG | LOG_FILE, FSCK_LOG_FILE);
             }
             if (ret < 0) {
                 /* No need to check for error in fork, we can't really handle it now */
@@ -358,6 +360,34 @@ static bool tune2fs_available(void) {
     return access(TUNE2FS_BIN, X_OK) == 0;
 }
 
+int fs_mgr_run_fs_helper(const std::string& mount_point, int argc, const char* const argv[],
+                         int* status, int log_target, const char* log_file) {
+    // logwrap forks from this thread, so lowering the priority of the thread
+    // for the duration of the call is enough to lower the helper's.
+    IoSchedClass saved_class = IoSchedClass_NONE;
+    int saved_prio = 0;
+    bool restore = false;
+    if (mount_point == "/cache") {
+        if (android_get_ioprio(0, &saved_class, &saved_prio) ||
+            android_set_ioprio(0, IoSchedClass_IDLE, 7)) {
+            PWARNING << __FUNCTION__ << "(): could not lower ioprio for " << argv[0];
+        } else {
+            restore = true;
+        }
+    }
+
+    Timer t;
+    auto ret = logwrap_fork_execvp(argc, argv, status, false, log_target, false, log_file);
+    LINFO << argv[0] << " for " << mount_point << " took " << t.duration().count() << "ms";
+
+    if (restore) {
+        auto save_errno = errno;
+        android_set_ioprio(0, saved_class, saved_prio);
+        errno = save_errno;
+    }
+    return ret;
+}
+
 static bool run_command(const char* argv[], int argc) {
     int ret;
 
@@ -1347,10 +1377,151 @@ static bool IsMountPointMounted(const std::string& mount_point) {
     return GetEntryForMountPoint(&fstab, mount_point) != nullptr;
 }
 
+// Whether fs_mgr_mount_all() should attempt |entry| in |mount_mode|, rather than leaving it to
+// first stage mount, vold or another mount mode.
+static bool IsMountAllCandidate(const FstabEntry& entry, int mount_mode) {
+    // If a filesystem should have been mounted in the first stage, we
+    // ignore it here. With one exception, if the filesystem is
+    // formattable, then it can only be formatted in the second stage,
+    // so we allow it to mount here.
+    if (entry.fs_mgr_flags.first_stage_mount &&
+        (!entry.fs_mgr_flags.formattable || IsMountPointMounted(entry.mount_point))) {
+        return false;
+    }
+
+    // Don't mount entries that are managed by vold or not for the mount mode.
+    if (entry.fs_mgr_flags.vold_managed || entry.fs_mgr_flags.recovery_only ||
+        ((mount_mode == MOUNT_MODE_LATE) && !entry.fs_mgr_flags.late_mount) ||
+        ((mount_mode == MOUNT_MODE_EARLY) && entry.fs_mgr_flags.late_mount)) {
+        return false;
+    }
+
+    // Skip swap and raw partition entries such as boot, recovery, etc.
+    if (entry.fs_type == "swap" || entry.fs_type == "emmc" || entry.fs_type == "mtd") {
+        return false;
+    }
+
+    return true;
+}
+
+// Entries that don't need encryption, formatting, label translation or checkpointing, all of which
+// fs_mgr_mount_all() handles one entry at a time in fstab order.
+static bool CanMountInParallel(const FstabEntry& entry) {
+    return entry.mount_point != "/" && entry.mount_point != "/system" &&
+           entry.mount_point != "/data" && !entry.fs_mgr_flags.formattable &&
+           !entry.fs_mgr_flags.file_encryption && !entry.fs_mgr_flags.logical &&
+           !entry.fs_mgr_flags.checkpoint_blk && !entry.fs_mgr_flags.checkpoint_fs &&
+           !StartsWith(entry.blk_device, "LABEL=");
+}
+
+static bool IsParentMountPoint(const std::string& parent, const std::string& child) {
+    return parent.size() < child.size() && StartsWith(child, parent) &&
+           (parent.back() == '/' || child[parent.size()] == '/');
+}
+
+struct ParallelMountResult {
+    bool found_device = false;
+    bool mounted = false;
+    int end_idx = -1;
+    int attempted_idx = -1;
+    int mount_errno = 0;
+};
+
+// Waits for, checks and mounts every mount point whose entries CanMountInParallel(), each on its
+// own thread once the closest parent mount point in |fstab| is mounted. A mount point is left to
+// fs_mgr_mount_all() if any of its parents is. Returns the outcome of mount_with_alternatives()
+// for each mount point, keyed by the index of its first entry.
+static std::map<int, ParallelMountResult> MountAllParallel(const Fstab& fstab, int mount_mode) {
+    struct MountPoint {
+        int start_idx;
+        int parent;
+        bool parallel;
+    };
+    std::vector<MountPoint> mount_points;
+    for (int i = 0; i < static_cast<int>(fstab.size()); i++) {
+        if (!IsMountAllCandidate(fstab[i], mount_mode)) {
+            continue;
+        }
+        // Like mount_with_alternatives(), include all consecutive entries for the mount point.
+        MountPoint mount_point = {i, -1, true};
+        const auto& path = fstab[i].mount_point;
+        for (; i < static_cast<int>(fstab.size()) && fstab[i].mount_point == path; i++) {
+            mount_point.parallel &= CanMountInParallel(fstab[i]);
+        }
+        i--;
+        mount_points.emplace_back(mount_point);
+    }
+
+    auto path_of = [&](int k) -> const std::string& {
+        return fstab[mount_points[k].start_idx].mount_point;
+    };
+    for (int k = 0; k < static_cast<int>(mount_points.size()); k++) {
+        auto& mount_point = mount_points[k];
+        for (int j = 0; j < static_cast<int>(mount_points.size()); j++) {
+            if (!IsParentMountPoint(path_of(j), path_of(k))) {
+                continue;
+            }
+            // A parent listed after its child is mounted over it in fstab order.
+            if (j > k || !mount_points[j].parallel) {
+                mount_point.parallel = false;
+            }
+            if (mount_point.parent == -1 || path_of(j).size() > path_of(mount_point.parent).size()) {
+                mount_point.parent = j;
+            }
+        }
+    }
+
+    std::map<int, ParallelMountResult> results;
+    std::vector<std::promise<void>> mounted(mount_points.size());
+    std::vector<std::shared_future<void>> mounted_futures;
+    for (auto& promise : mounted) {
+        mounted_futures.emplace_back(promise.get_future().share());
+    }
+    for (const auto& mount_point : mount_points) {
+        if (mount_point.parallel) {
+            results.emplace(mount_point.start_idx, ParallelMountResult{});
+        }
+    }
+
+    Timer t;
+    std::vector<std::thread> threads;
+    for (int k = 0; k < static_cast<int>(mount_points.size()); k++) {
+        const auto& mount_point = mount_points[k];
+        if (!mount_point.parallel) {
+            mounted[k].set_value();
+            continue;
+        }
+        threads.emplace_back([&, k, mount_point] {
+            if (mount_point.parent != -1) {
+                mounted_futures[mount_point.parent].wait();
+            }
+            const auto& entry = fstab[mount_point.start_idx];
+            auto& result = results.at(mount_point.start_idx);
+            if (entry.fs_mgr_flags.wait && !WaitForFile(entry.blk_device, 20s)) {
+                LERROR << "Skipping '" << entry.blk_device << "' during mount_all";
+            } else {
+                result.found_device = true;
+                result.mounted = mount_with_alternatives(fstab, mount_point.start_idx,
+                                                         &result.end_idx, &result.attempted_idx);
+                result.mount_errno = errno;
+            }
+            // The time into mount_all at which the mount point was ready, which shows the
+            // critical path through the mount points.
+            SetProperty("ro.boottime.init.mount_parallel." + Basename(entry.mount_point),
+                        std::to_string(t.duration().count()));
+            mounted[k].set_value();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return results;
+}
+
 // When multiple fstab records share the same mount_point, it will try to mount each
 // one in turn, and ignore any duplicates after a first successful mount.
 // Returns -1 on error, and  FS_MGR_MNTALL_* otherwise.
-MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
+MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode, bool parallel) {
     int encryptable = FS_MGR_MNTALL_DEV_NOT_ENCRYPTABLE;
     int error_count = 0;
     CheckpointManager checkpoint_manager;
@@ -1362,31 +1533,17 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
         return {FS_MGR_MNTALL_FAIL, userdata_mounted};
     }
 
+    std::map<int, ParallelMountResult> parallel_mounts;
+    if (parallel && mount_mode != MOUNT_MODE_ONLY_USERDATA) {
+        parallel_mounts = MountAllParallel(*fstab, mount_mode);
+    }
+
     // Keep i int to prevent unsigned integer overflow from (i = top_idx - 1),
     // where top_idx is 0. It will give SIGABRT
     for (int i = 0; i < static_cast<int>(fstab->size()); i++) {
         auto& current_entry = (*fstab)[i];
 
-        // If a filesystem should have been mounted in the first stage, we
-        // ignore it here. With one exception, if the filesystem is
-        // formattable, then it can only be formatted in the second stage,
-        // so we allow it to mount here.
-        if (current_entry.fs_mgr_flags.first_stage_mount &&
-            (!current_entry.fs_mgr_flags.formattable ||
-             IsMountPointMounted(current_entry.mount_point))) {
-            continue;
-        }
-
-        // Don't mount entries that are managed by vold or not for the mount mode.
-        if (current_entry.fs_mgr_flags.vold_managed || current_entry.fs_mgr_flags.recovery_only ||
-            ((mount_mode == MOUNT_MODE_LATE) && !current_entry.fs_mgr_flags.late_mount) ||
-            ((mount_mode == MOUNT_MODE_EARLY) && current_entry.fs_mgr_flags.late_mount)) {
-            continue;
-        }
-
-        // Skip swap and raw partition entries such as boot, recovery, etc.
-        if (current_entry.fs_type == "swap" || current_entry.fs_type == "emmc" ||
-            current_entry.fs_type == "mtd") {
+        if (!IsMountAllCandidate(current_entry, mount_mode)) {
             continue;
         }
 
@@ -1404,6 +1561,12 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
             continue;
         }
 
+        // The device of a mount point handled by MountAllParallel() was already waited for.
+        auto parallel_mount = parallel_mounts.find(i);
+        if (parallel_mount != parallel_mounts.end() && !parallel_mount->second.found_device) {
+            continue;
+        }
+
         // Translate LABEL= file system labels into block devices.
         if (is_extfs(current_entry.fs_type)) {
             if (!TranslateExtLabels(&current_entry)) {
@@ -1459,10 +1622,19 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
         int top_idx = i;
         int attempted_idx = -1;
 
-        bool mret = mount_with_alternatives(*fstab, i, &last_idx_inspected, &attempted_idx);
+        bool mret;
+        int mount_errno;
+        if (parallel_mount != parallel_mounts.end()) {
+            mret = parallel_mount->second.mounted;
+            last_idx_inspected = parallel_mount->second.end_idx;
+            attempted_idx = parallel_mount->second.attempted_idx;
+            mount_errno = parallel_mount->second.mount_errno;
+        } else {
+            mret = mount_with_alternatives(*fstab, i, &last_idx_inspected, &attempted_idx);
+            mount_errno = errno;
+        }
         auto& attempted_entry = (*fstab)[attempted_idx];
         i = last_idx_inspected;
-        int mount_errno = errno;
 
         // Handle success and deal with encryptability.
         if (mret) {
@@ -16,7 +16,9 @@
 
 #include <algorithm>
 #include <iterator>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/file.h>
@@ -114,26 +116,82 @@ bool fs_mgr_get_boot_config_from_kernel(const std::string& cmdline, const std::s
     return false;
 }
 
+namespace {
+
+// /proc/bootconfig and /proc/cmdline don't change for the lifetime of the boot, so each is read
+// and parsed once per process. A failed read isn't remembered, since /proc may not be mounted yet.
+class BootConfigSource {
+  public:
+    using Parser = std::vector<std::pair<std::string, std::string>> (*)(const std::string&);
+
+    BootConfigSource(const char* path, Parser parser) : path_(path), parser_(parser) {}
+
+    bool Get(const std::string& android_key, std::string* out_val) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!loaded_) {
+            std::string contents;
+            if (!android::base::ReadFileToString(path_, &contents)) return false;
+            if (!contents.empty() && contents.back() == '\n') {
+                contents.pop_back();
+            }
+            for (auto& [key, value] : parser_(contents)) {
+                // The first occurrence of a key wins, as in a linear search.
+                values_.emplace(std::move(key), std::move(value));
+            }
+            loaded_ = true;
+        }
+        auto it = values_.find("androidboot." + android_key);
+        if (it == values_.end()) {
+            *out_val = "";
+            return false;
+        }
+        *out_val = it->second;
+        return true;
+    }
+
+  private:
+    const char* path_;
+    Parser parser_;
+    std::mutex mutex_;
+    bool loaded_ = false;
+    std::unordered_map<std::string, std::string> values_;
+};
+
+// Values of the android device tree node by key, including the keys that are missing from it.
+// The device tree is fixed once it's visible, so it is only cached for dt compatible devices.
+bool GetDtBootConfig(const std::string& key, std::string* out_val) {
+    static std::mutex mutex;
+    static auto values = new std::unordered_map<std::string, std::string>();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = values->find(key);
+    if (it == values->end()) {
+        std::string value;
+        std::string file_name = get_android_dt_dir() + "/" + key;
+        if (android::base::ReadFileToString(file_name, &value) && !value.empty()) {
+            value.pop_back();  // Trims the trailing '\0' out.
+        }
+        it = values->emplace(key, std::move(value)).first;
+    }
+    if (it->second.empty()) return false;
+    *out_val = it->second;
+    return true;
+}
+
+}  // namespace
+
 // Tries to get the given boot config value from bootconfig.
 // Returns true if successfully found, false otherwise.
 bool fs_mgr_get_boot_config_from_bootconfig_source(const std::string& key, std::string* out_val) {
-    std::string bootconfig;
-    if (!android::base::ReadFileToString("/proc/bootconfig", &bootconfig)) return false;
-    if (!bootconfig.empty() && bootconfig.back() == '\n') {
-        bootconfig.pop_back();
-    }
-    return fs_mgr_get_boot_config_from_bootconfig(bootconfig, key, out_val);
+    static auto source = new BootConfigSource("/proc/bootconfig", fs_mgr_parse_proc_bootconfig);
+    return source->Get(key, out_val);
 }
 
 // Tries to get the given boot config value from kernel cmdline.
 // Returns true if successfully found, false otherwise.
 bool fs_mgr_get_boot_config_from_kernel_cmdline(const std::string& key, std::string* out_val) {
-    std::string cmdline;
-    if (!android::base::ReadFileToString("/proc/cmdline", &cmdline)) return false;
-    if (!cmdline.empty() && cmdline.back() == '\n') {
-        cmdline.pop_back();
-    }
-    return fs_mgr_get_boot_config_from_kernel(cmdline, key, out_val);
+    static auto source = new BootConfigSource("/proc/cmdline", fs_mgr_parse_cmdline);
+    return source->Get(key, out_val);
 }
 
 // Tries to get the boot config value in device tree, properties and
@@ -143,14 +201,8 @@ bool fs_mgr_get_boot_config(const std::string& key, std::string* out_val) {
     FS_MGR_CHECK(out_val != nullptr);
 
     // firstly, check the device tree
-    if (is_dt_compatible()) {
-        std::string file_name = get_android_dt_dir() + "/" + key;
-        if (android::base::ReadFileToString(file_name, out_val)) {
-            if (!out_val->empty()) {
-                out_val->pop_back();  // Trims the trailing '\0' out.
-                return true;
-            }
-        }
+    if (is_dt_compatible() && GetDtBootConfig(key, out_val)) {
+        return true;
     }
 
     // next, check if we have "ro.boot" property already
@@ -31,6 +31,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <sstream>
 
 #include <android-base/file.h>
@@ -152,10 +153,7 @@ std::unique_ptr<LpMetadata> ReadCurrentMetadata(const std::string& block_device)
 }
 
 bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& super_device) {
-    CreateLogicalPartitionParams params = {
-            .block_device = super_device,
-            .metadata = &metadata,
-    };
+    std::vector<CreateLogicalPartitionParams> partitions;
     for (const auto& partition : metadata.partitions) {
         if (!partition.num_extents) {
             LINFO << "Skipping zero-length logical partition: " << GetPartitionName(partition);
@@ -166,13 +164,42 @@ bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& supe
             continue;
         }
 
-        params.partition = &partition;
+        partitions.emplace_back(CreateLogicalPartitionParams{
+                .block_device = super_device,
+                .metadata = &metadata,
+                .partition = &partition,
+        });
+    }
+
+    std::vector<std::string> ignore_paths;
+    return CreateLogicalPartitions(std::move(partitions), &ignore_paths);
+}
 
-        std::string ignore_path;
-        if (!CreateLogicalPartition(params, &ignore_path)) {
-            LERROR << "Could not create logical partition: " << GetPartitionName(partition);
+bool CreateLogicalPartitions(std::vector<CreateLogicalPartitionParams> partitions,
+                             std::vector<std::string>* paths) {
+    std::vector<CreateLogicalPartitionParams::OwnedData> owned_data(partitions.size());
+    std::vector<std::pair<std::string, DmTable>> devices;
+    std::chrono::milliseconds timeout_ms = {};
+    for (size_t i = 0; i < partitions.size(); i++) {
+        auto& params = partitions[i];
+        if (!params.InitDefaults(&owned_data[i])) return false;
+
+        DmTable table;
+        if (!CreateDmTableInternal(params, &table)) {
+            LERROR << "Could not create logical partition: " << params.GetPartitionName();
             return false;
         }
+        devices.emplace_back(params.device_name, std::move(table));
+        timeout_ms = std::max(timeout_ms, params.timeout_ms);
+    }
+
+    DeviceMapper& dm = DeviceMapper::Instance();
+    if (!dm.CreateDevices(devices, paths, timeout_ms)) {
+        LERROR << "Could not create " << devices.size() << " logical partitions";
+        return false;
+    }
+    for (size_t i = 0; i < devices.size(); i++) {
+        LINFO << "Created logical partition " << devices[i].first << " on device " << (*paths)[i];
     }
     return true;
 }
@@ -97,8 +97,8 @@ static int format_ext4(const std::string& fs_blkdev, const std::string& fs_mnt_p
     mke2fs_args.push_back(fs_blkdev.c_str());
     mke2fs_args.push_back(size_str.c_str());
 
-    rc = logwrap_fork_execvp(mke2fs_args.size(), mke2fs_args.data(), nullptr, false, LOG_KLOG,
-                             false, nullptr);
+    rc = fs_mgr_run_fs_helper(fs_mnt_point, mke2fs_args.size(), mke2fs_args.data(), nullptr,
+                              LOG_KLOG);
     if (rc) {
         LERROR << "mke2fs returned " << rc;
         return rc;
@@ -107,8 +107,8 @@ static int format_ext4(const std::string& fs_blkdev, const std::string& fs_mnt_p
     const char* const e2fsdroid_args[] = {
             "/system/bin/e2fsdroid", "-e", "-a", fs_mnt_point.c_str(), fs_blkdev.c_str(), nullptr};
 
-    rc = logwrap_fork_execvp(arraysize(e2fsdroid_args), e2fsdroid_args, nullptr, false, LOG_KLOG,
-                             false, nullptr);
+    rc = fs_mgr_run_fs_helper(fs_mnt_point, arraysize(e2fsdroid_args), e2fsdroid_args, nullptr,
+                              LOG_KLOG);
     if (rc) {
         LERROR << "e2fsdroid returned " << rc;
     }
@@ -116,8 +116,9 @@ static int format_ext4(const std::string& fs_blkdev, const std::string& fs_mnt_p
     return rc;
 }
 
-static int format_f2fs(const std::string& fs_blkdev, uint64_t dev_sz, bool needs_projid,
-                       bool needs_casefold, bool fs_compress, const std::string& zoned_device) {
+static int format_f2fs(const std::string& fs_blkdev, const std::string& fs_mnt_point,
+                       uint64_t dev_sz, bool needs_projid, bool needs_casefold, bool fs_compress,
+                       const std::string& zoned_device) {
     if (!dev_sz) {
         int rc = get_dev_sz(fs_blkdev, &dev_sz);
         if (rc) {
@@ -156,7 +157,7 @@ static int format_f2fs(const std::string& fs_blkdev, uint64_t dev_sz, bool needs
         args.push_back(size_str.c_str());
     }
 
-    return logwrap_fork_execvp(args.size(), args.data(), nullptr, false, LOG_KLOG, false, nullptr);
+    return fs_mgr_run_fs_helper(fs_mnt_point, args.size(), args.data(), nullptr, LOG_KLOG);
 }
 
 int fs_mgr_do_format(const FstabEntry& entry) {
@@ -170,8 +171,8 @@ int fs_mgr_do_format(const FstabEntry& entry) {
     }
 
     if (entry.fs_type == "f2fs") {
-        return format_f2fs(entry.blk_device, entry.length, needs_projid, needs_casefold,
-                           entry.fs_mgr_flags.fs_compress, entry.zoned_device);
+        return format_f2fs(entry.blk_device, entry.mount_point, entry.length, needs_projid,
+                           needs_casefold, entry.fs_mgr_flags.fs_compress, entry.zoned_device);
     } else if (entry.fs_type == "ext4") {
         return format_ext4(entry.blk_device, entry.mount_point, needs_projid,
                            entry.fs_mgr_flags.ext_meta_csum);
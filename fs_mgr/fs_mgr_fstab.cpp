@@ -22,10 +22,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
@@ -51,6 +55,7 @@ namespace fs_mgr {
 namespace {
 
 constexpr char kDefaultAndroidDtDir[] = "/proc/device-tree/firmware/android";
+constexpr char kSkipMountConfig[] = "/system/system_ext/etc/init/config/skip_mount.cfg";
 
 struct FlagList {
     const char *name;
@@ -467,6 +472,62 @@ std::string GetFstabPath() {
     return "";
 }
 
+// Use different fstab paths for normal boot and recovery boot, respectively
+std::string GetDefaultFstabPath() {
+    if (access("/system/bin/recovery", F_OK) == 0) {
+        return "/etc/recovery.fstab";
+    }
+    return GetFstabPath();
+}
+
+// Tells apart the versions of a file, or a missing file, that the default fstab was read from.
+struct FileIdentity {
+    dev_t dev = 0;
+    ino_t ino = 0;
+    off_t size = 0;
+    int64_t mtime_ns = 0;
+
+    bool operator==(const FileIdentity& r) const {
+        return dev == r.dev && ino == r.ino && size == r.size && mtime_ns == r.mtime_ns;
+    }
+};
+
+FileIdentity GetFileIdentity(const std::string& path) {
+    struct stat sb;
+    if (path.empty() || stat(path.c_str(), &sb) != 0) {
+        return {};
+    }
+    return {sb.st_dev, sb.st_ino, sb.st_size,
+            static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec};
+}
+
+// Everything outside the immutable device tree that ReadDefaultFstab() depends on. First stage
+// init mounts partitions that bring in other fstab files, and the skip mount config, in the
+// middle of the process lifetime.
+struct DefaultFstabInputs {
+    std::string fstab_path;
+    FileIdentity fstab_file;
+    FileIdentity skip_mount_config;
+    int first_api_level = 0;
+
+    bool operator==(const DefaultFstabInputs& r) const {
+        return fstab_path == r.fstab_path && fstab_file == r.fstab_file &&
+               skip_mount_config == r.skip_mount_config && first_api_level == r.first_api_level;
+    }
+};
+
+struct DefaultFstabCache {
+    std::mutex mutex;
+    DefaultFstabInputs inputs;
+    std::shared_ptr<const Fstab> fstab;
+};
+
+DefaultFstabCache& GetDefaultFstabCache() {
+    // Never destroyed, so that it can be used from other static destructors.
+    static auto cache = new DefaultFstabCache();
+    return *cache;
+}
+
 /* Extracts <device>s from the by-name symlinks specified in a fstab:
  *   /dev/block/<type>/<device>/by-name/<partition>
  *
@@ -799,8 +860,6 @@ bool SkipMountingPartitions(Fstab*, bool) {
 // /system/system_ext because GSI is a single system.img that includes the contents of system_ext
 // partition and product partition under /system/system_ext and /system/product, respectively.
 bool SkipMountingPartitions(Fstab* fstab, bool verbose) {
-    static constexpr char kSkipMountConfig[] = "/system/system_ext/etc/init/config/skip_mount.cfg";
-
     std::string skip_config;
     auto save_errno = errno;
     if (!ReadFileToString(kSkipMountConfig, &skip_config)) {
@@ -842,14 +901,7 @@ bool ReadDefaultFstab(Fstab* fstab) {
     fstab->clear();
     ReadFstabFromDt(fstab, false /* verbose */);
 
-    std::string default_fstab_path;
-    // Use different fstab paths for normal boot and recovery boot, respectively
-    if (access("/system/bin/recovery", F_OK) == 0) {
-        default_fstab_path = "/etc/recovery.fstab";
-    } else {  // normal boot
-        default_fstab_path = GetFstabPath();
-    }
-
+    std::string default_fstab_path = GetDefaultFstabPath();
     Fstab default_fstab;
     if (!default_fstab_path.empty() && ReadFstabFromFile(default_fstab_path, &default_fstab)) {
         for (auto&& entry : default_fstab) {
@@ -862,6 +914,60 @@ bool ReadDefaultFstab(Fstab* fstab) {
     return !fstab->empty();
 }
 
+std::shared_ptr<const Fstab> GetDefaultFstab() {
+    // Identify the inputs before reading them, so that a change racing with the read leaves a
+    // mismatch behind rather than a stale cache.
+    DefaultFstabInputs inputs;
+    inputs.fstab_path = GetDefaultFstabPath();
+    inputs.fstab_file = GetFileIdentity(inputs.fstab_path);
+    inputs.skip_mount_config = GetFileIdentity(kSkipMountConfig);
+    inputs.first_api_level = android::base::GetIntProperty("ro.product.first_api_level", 0);
+
+    auto& cache = GetDefaultFstabCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (cache.fstab && cache.inputs == inputs) {
+        return cache.fstab;
+    }
+
+    auto fstab = std::make_shared<Fstab>();
+    if (!ReadDefaultFstab(fstab.get())) {
+        return nullptr;
+    }
+    cache.inputs = std::move(inputs);
+    cache.fstab = std::move(fstab);
+    return cache.fstab;
+}
+
+void InvalidateDefaultFstabCache() {
+    auto& cache = GetDefaultFstabCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.fstab.reset();
+}
+
+std::shared_ptr<const FstabEntry> GetDefaultFstabEntryForMountPoint(const std::string& path) {
+    auto fstab = GetDefaultFstab();
+    auto entry = GetEntryForMountPoint(fstab.get(), path);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+    // Shares ownership of the whole Fstab, which keeps the entry alive without copying it.
+    return std::shared_ptr<const FstabEntry>(std::move(fstab), entry);
+}
+
+const FstabEntry* GetEntryForMountPoint(const Fstab* fstab, const std::string& path) {
+    if (fstab == nullptr) {
+        return nullptr;
+    }
+
+    for (const auto& entry : *fstab) {
+        if (entry.mount_point == path) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
 FstabEntry* GetEntryForMountPoint(Fstab* fstab, const std::string& path) {
     if (fstab == nullptr) {
         return nullptr;
@@ -929,12 +1035,12 @@ std::set<std::string> GetBootDevices() {
     }
 
     // Fallback to extract boot devices from fstab.
-    Fstab fstab;
-    if (!ReadDefaultFstab(&fstab)) {
+    auto fstab = GetDefaultFstab();
+    if (!fstab) {
         return {};
     }
 
-    return ExtraBootDevices(fstab);
+    return ExtraBootDevices(*fstab);
 }
 
 std::string GetVerityDeviceName(const FstabEntry& entry) {
@@ -962,10 +1068,15 @@ const std::string& get_android_dt_dir() {
 }
 
 bool is_dt_compatible() {
+    // Only a positive answer is remembered, the device tree may not be visible yet.
+    static std::atomic<bool> compatible = false;
+    if (compatible.load(std::memory_order_relaxed)) return true;
+
     std::string file_name = get_android_dt_dir() + "/compatible";
     std::string dt_value;
     if (android::fs_mgr::ReadDtFile(file_name, &dt_value)) {
         if (dt_value == "android,firmware") {
+            compatible.store(true, std::memory_order_relaxed);
             return true;
         }
     }
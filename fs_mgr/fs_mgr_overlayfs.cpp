@@ -32,9 +32,12 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -366,15 +369,11 @@ bool fs_mgr_rw_access(const std::string& path) {
     return ret;
 }
 
-bool fs_mgr_overlayfs_already_mounted(const std::string& mount_point, bool overlay_only = true) {
-    Fstab fstab;
-    auto save_errno = errno;
-    if (!ReadFstabFromFile("/proc/mounts", &fstab)) {
-        return false;
-    }
-    errno = save_errno;
+// Same as below, against an already parsed copy of /proc/mounts.
+bool fs_mgr_overlayfs_already_mounted(const Fstab& mounts, const std::string& mount_point,
+                                      bool overlay_only = true) {
     const auto lowerdir = kLowerdirOption + mount_point;
-    for (const auto& entry : fstab) {
+    for (const auto& entry : mounts) {
         if (overlay_only && "overlay" != entry.fs_type && "overlayfs" != entry.fs_type) continue;
         if (mount_point != entry.mount_point) continue;
         if (!overlay_only) return true;
@@ -388,7 +387,45 @@ bool fs_mgr_overlayfs_already_mounted(const std::string& mount_point, bool overl
     return false;
 }
 
-bool fs_mgr_wants_overlayfs(FstabEntry* entry) {
+bool fs_mgr_overlayfs_already_mounted(const std::string& mount_point, bool overlay_only = true) {
+    Fstab mounts;
+    auto save_errno = errno;
+    if (!ReadFstabFromFile("/proc/mounts", &mounts)) {
+        return false;
+    }
+    errno = save_errno;
+    return fs_mgr_overlayfs_already_mounted(mounts, mount_point, overlay_only);
+}
+
+// fs_mgr_overlayfs_enabled() statfs()es the mount point and reads the
+// superblock of its device, neither of which changes for a readonly mount
+// once it is mounted. The verdict is kept for the life of the process, so
+// the candidate list is only probed once however often it is asked for.
+bool fs_mgr_overlayfs_enabled_cached(const Fstab& mounts, FstabEntry* entry) {
+    struct Verdict {
+        bool enabled;
+        std::string blk_device;
+    };
+    static std::mutex verdicts_lock;
+    static std::map<std::pair<std::string, std::string>, Verdict> verdicts;
+
+    // Before the mount point is mounted, the probe can only guess.
+    if (!fs_mgr_overlayfs_already_mounted(mounts, entry->mount_point, false)) {
+        return fs_mgr_overlayfs_enabled(entry);
+    }
+
+    std::lock_guard<std::mutex> guard(verdicts_lock);
+    auto key = std::make_pair(entry->mount_point, entry->blk_device);
+    auto it = verdicts.find(key);
+    if (it == verdicts.end()) {
+        auto enabled = fs_mgr_overlayfs_enabled(entry);
+        it = verdicts.emplace(key, Verdict{enabled, entry->blk_device}).first;
+    }
+    entry->blk_device = it->second.blk_device;
+    return it->second.enabled;
+}
+
+bool fs_mgr_wants_overlayfs(const Fstab& mounts, FstabEntry* entry) {
     // Don't check entries that are managed by vold.
     if (entry->fs_mgr_flags.vold_managed || entry->fs_mgr_flags.recovery_only) return false;
 
@@ -404,7 +441,7 @@ bool fs_mgr_wants_overlayfs(FstabEntry* entry) {
     // /system and /vendor are never bound(sic) to.
     if (entry->flags & MS_UNBINDABLE) return false;
 
-    if (!fs_mgr_overlayfs_enabled(entry)) return false;
+    if (!fs_mgr_overlayfs_enabled_cached(mounts, entry)) return false;
 
     return true;
 }
@@ -728,6 +765,11 @@ std::vector<mount_info> ReadMountinfoFromFile(const std::string& path) {
     return info;
 }
 
+// Overlays are mounted concurrently, but every one of them parks its
+// submounts in /dev and may have to flip the propagation of /dev to move
+// them back.
+std::mutex gDevPropagationLock;
+
 bool fs_mgr_overlayfs_mount(const std::string& mount_point) {
     auto options = fs_mgr_get_overlayfs_options(mount_point);
     if (options.empty()) return false;
@@ -745,13 +787,11 @@ bool fs_mgr_overlayfs_mount(const std::string& mount_point) {
     auto parent_made_private = false;
     auto dev_private = false;
     auto dev_made_private = false;
+    std::unique_lock<std::mutex> dev_lock(gDevPropagationLock, std::defer_lock);
     for (auto& entry : ReadMountinfoFromFile("/proc/self/mountinfo")) {
         if ((entry.mount_point == mount_point) && !entry.shared_flag) {
             parent_private = true;
         }
-        if ((entry.mount_point == "/dev") && !entry.shared_flag) {
-            dev_private = true;
-        }
 
         if (!android::base::StartsWith(entry.mount_point, mount_point + "/")) {
             continue;
@@ -762,6 +802,16 @@ bool fs_mgr_overlayfs_mount(const std::string& mount_point) {
             continue;
         }
 
+        // Only sample /dev once no other overlay can be changing it.
+        if (!dev_lock.owns_lock()) {
+            dev_lock.lock();
+            for (const auto& info : ReadMountinfoFromFile("/proc/self/mountinfo")) {
+                if ((info.mount_point == "/dev") && !info.shared_flag) {
+                    dev_private = true;
+                }
+            }
+        }
+
         // use as the bound directory in /dev.
         auto new_context = fs_mgr_get_context(entry.mount_point);
         if (!new_context.empty() && setfscreatecon(new_context.c_str())) {
@@ -1056,45 +1106,42 @@ static bool CreateDynamicScratch(std::string* scratch_device, bool* partition_ex
         changed = true;
     }
     // Take half of free space, minimum 512MB or maximum free - margin.
+    // A scratch partition that already has space is reused as it is:
+    // growing it means remapping and reformatting it, which drops every
+    // override made so far and costs an mkfs on each remount cycle.
     static constexpr auto kMinimumSize = uint64_t(512 * 1024 * 1024);
-    if (partition->size() < kMinimumSize) {
-        auto partition_size =
-                builder->AllocatableSpace() - builder->UsedSpace() + partition->size();
-        if ((partition_size > kMinimumSize) || !partition->size()) {
-            // Leave some space for free space jitter of a few erase
-            // blocks, in case they are needed for any individual updates
-            // to any other partition that needs to be flashed while
-            // overlayfs is in force.  Of course if margin_size is not
-            // enough could normally get a flash failure, so
-            // ResizePartition() will delete the scratch partition in
-            // order to fulfill.  Deleting scratch will destroy all of
-            // the adb remount overrides :-( .
-            auto margin_size = uint64_t(3 * 256 * 1024);
-            BlockDeviceInfo info;
-            if (builder->GetBlockDeviceInfo(fs_mgr_get_super_partition_name(slot_number), &info)) {
-                margin_size = 3 * info.logical_block_size;
-            }
+    if (!partition->size()) {
+        auto partition_size = builder->AllocatableSpace() - builder->UsedSpace();
+        // Leave some space for free space jitter of a few erase
+        // blocks, in case they are needed for any individual updates
+        // to any other partition that needs to be flashed while
+        // overlayfs is in force.  Of course if margin_size is not
+        // enough could normally get a flash failure, so
+        // ResizePartition() will delete the scratch partition in
+        // order to fulfill.  Deleting scratch will destroy all of
+        // the adb remount overrides :-( .
+        auto margin_size = uint64_t(3 * 256 * 1024);
+        BlockDeviceInfo info;
+        if (builder->GetBlockDeviceInfo(fs_mgr_get_super_partition_name(slot_number), &info)) {
+            margin_size = 3 * info.logical_block_size;
+        }
+        partition_size = std::max(std::min(kMinimumSize, partition_size - margin_size),
+                                  partition_size / 2);
+        if (!builder->ResizePartition(partition, partition_size)) {
+            // Try to free up space by deallocating partitions in the other slot.
+            TruncatePartitionsWithSuffix(builder.get(), fs_mgr_get_other_slot_suffix());
+
+            partition_size = builder->AllocatableSpace() - builder->UsedSpace();
             partition_size = std::max(std::min(kMinimumSize, partition_size - margin_size),
                                       partition_size / 2);
-            if (partition_size > partition->size()) {
-                if (!builder->ResizePartition(partition, partition_size)) {
-                    // Try to free up space by deallocating partitions in the other slot.
-                    TruncatePartitionsWithSuffix(builder.get(), fs_mgr_get_other_slot_suffix());
-
-                    partition_size =
-                            builder->AllocatableSpace() - builder->UsedSpace() + partition->size();
-                    partition_size = std::max(std::min(kMinimumSize, partition_size - margin_size),
-                                              partition_size / 2);
-                    if (!builder->ResizePartition(partition, partition_size)) {
-                        LERROR << "resize " << partition_name;
-                        return false;
-                    }
-                }
-                if (!partition_create) DestroyLogicalPartition(partition_name);
-                changed = true;
-                *partition_exists = false;
+            if (!builder->ResizePartition(partition, partition_size)) {
+                LERROR << "resize " << partition_name;
+                return false;
             }
         }
+        if (!partition_create) DestroyLogicalPartition(partition_name);
+        changed = true;
+        *partition_exists = false;
     }
     // land the update back on to the partition
     if (changed) {
@@ -1275,11 +1322,16 @@ bool fs_mgr_overlayfs_invalid() {
 }  // namespace
 
 Fstab fs_mgr_overlayfs_candidate_list(const Fstab& fstab) {
+    Fstab mounts;
+    auto save_errno = errno;
+    ReadFstabFromFile("/proc/mounts", &mounts);
+    errno = save_errno;
+
     Fstab candidates;
     for (const auto& entry : fstab) {
         FstabEntry new_entry = entry;
-        if (!fs_mgr_overlayfs_already_mounted(entry.mount_point) &&
-            !fs_mgr_wants_overlayfs(&new_entry)) {
+        if (!fs_mgr_overlayfs_already_mounted(mounts, entry.mount_point) &&
+            !fs_mgr_wants_overlayfs(mounts, &new_entry)) {
             continue;
         }
         auto new_mount_point = fs_mgr_mount_point(entry.mount_point);
@@ -1330,20 +1382,53 @@ bool fs_mgr_overlayfs_mount_all(Fstab* fstab) {
     auto ret = false;
     if (fs_mgr_overlayfs_invalid()) return ret;
 
-    auto scratch_can_be_mounted = true;
+    Fstab mounts;
+    auto save_errno = errno;
+    ReadFstabFromFile("/proc/mounts", &mounts);
+    errno = save_errno;
+
+    std::vector<std::string> mount_points;
     for (const auto& entry : fs_mgr_overlayfs_candidate_list(*fstab)) {
         if (fs_mgr_is_verity_enabled(entry)) continue;
         auto mount_point = fs_mgr_mount_point(entry.mount_point);
-        if (fs_mgr_overlayfs_already_mounted(mount_point)) {
+        if (fs_mgr_overlayfs_already_mounted(mounts, mount_point)) {
             ret = true;
             continue;
         }
-        if (scratch_can_be_mounted) {
-            scratch_can_be_mounted = false;
-            TryMountScratch();
+        mount_points.emplace_back(std::move(mount_point));
+    }
+    if (mount_points.empty()) return ret;
+
+    TryMountScratch();
+
+    // Candidates never nest, so their overlays are independent of each
+    // other and can be mounted at the same time.
+    std::vector<char> mounted(mount_points.size());
+    std::vector<int> mount_errno(mount_points.size());
+    auto mount_one = [&](size_t i) {
+        errno = save_errno;
+        mounted[i] = fs_mgr_overlayfs_mount(mount_points[i]);
+        mount_errno[i] = errno;
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < mount_points.size(); i++) {
+        threads.emplace_back(mount_one, i);
+    }
+    mount_one(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Report the errno of the last failed mount, as a serial loop would.
+    for (size_t i = 0; i < mount_points.size(); i++) {
+        if (mounted[i]) {
+            ret = true;
+        } else {
+            errno = mount_errno[i];
         }
-        if (fs_mgr_overlayfs_mount(mount_point)) ret = true;
     }
+    // The overlays can shadow the fstab files under /odm, /vendor and /system.
+    if (ret) InvalidateDefaultFstabCache();
     return ret;
 }
 
@@ -1559,12 +1644,12 @@ bool fs_mgr_overlayfs_setup(const char* backing, const char* mount_point, bool*
 
 bool fs_mgr_overlayfs_is_setup() {
     if (fs_mgr_overlayfs_already_mounted(kScratchMountPoint, false)) return true;
-    Fstab fstab;
-    if (!ReadDefaultFstab(&fstab)) {
+    auto fstab = GetDefaultFstab();
+    if (!fstab) {
         return false;
     }
     if (fs_mgr_overlayfs_invalid()) return false;
-    for (const auto& entry : fs_mgr_overlayfs_candidate_list(fstab)) {
+    for (const auto& entry : fs_mgr_overlayfs_candidate_list(*fstab)) {
         if (fs_mgr_is_verity_enabled(entry)) continue;
         if (fs_mgr_overlayfs_already_mounted(fs_mgr_mount_point(entry.mount_point))) return true;
     }
@@ -99,6 +99,14 @@ bool fs_mgr_is_f2fs(const std::string& blk_device);
 
 bool fs_mgr_teardown_verity(android::fs_mgr::FstabEntry* fstab);
 
+// Runs a filesystem helper (mkfs, fsck, ...) for |mount_point| through logwrap
+// and logs how long it took. The helper inherits the I/O priority of the
+// calling thread, and helpers for partitions that nothing in boot waits on
+// (the legacy /cache) run at idle priority, so they never slow down helpers
+// for other partitions running in parallel.
+int fs_mgr_run_fs_helper(const std::string& mount_point, int argc, const char* const argv[],
+                         int* status, int log_target, const char* log_file = nullptr);
+
 namespace android {
 namespace fs_mgr {
 bool UnmapDevice(const std::string& name);
@@ -188,13 +188,13 @@ bool EnsurePathUnmounted(Fstab* fstab, const std::string& path) {
 }
 
 std::string GetSystemRoot() {
-    Fstab fstab;
-    if (!ReadDefaultFstab(&fstab)) {
+    auto fstab = GetDefaultFstab();
+    if (!fstab) {
         LERROR << "Failed to read default fstab";
         return "";
     }
 
-    auto entry = GetEntryForMountPoint(&fstab, kSystemRoot);
+    auto entry = GetEntryForMountPoint(fstab.get(), kSystemRoot);
     if (entry == nullptr) {
         return "/";
     }
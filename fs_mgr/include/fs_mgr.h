@@ -78,7 +78,10 @@ struct HashtreeInfo {
 // defined above, and the second element tells whether this call to fs_mgr_mount_all was responsible
 // for mounting userdata. Later is required for init to correctly enqueue fs-related events as part
 // of userdata remount during userspace reboot.
-MountAllResult fs_mgr_mount_all(android::fs_mgr::Fstab* fstab, int mount_mode);
+// With |parallel|, mount points that don't need encryption, formatting or checkpointing are
+// checked and mounted concurrently, each once its parent mount point is mounted.
+MountAllResult fs_mgr_mount_all(android::fs_mgr::Fstab* fstab, int mount_mode,
+                                bool parallel = false);
 
 #define FS_MGR_DOMNT_FAILED (-1)
 #define FS_MGR_DOMNT_BUSY (-2)
@@ -16,6 +16,7 @@
 
 #include <chrono>
 #include <string>
+#include <vector>
 
 namespace android {
 namespace fs_mgr {
@@ -28,6 +29,12 @@ namespace fs_mgr {
 // block indefinitely.
 bool WaitForFile(const std::string& path, const std::chrono::milliseconds relative_timeout);
 
+// Like WaitForFile(), but waits for all of |paths| with a single deadline, returning as soon as
+// the last of them exists. On timeout, the paths that still don't exist are stored in |missing|.
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds relative_timeout,
+                  std::vector<std::string>* missing = nullptr);
+
 // Wait at most |relative_timeout| milliseconds for |path| to stop existing.
 // Note that this only returns true if the inode itself no longer exists, i.e.,
 // all outstanding file descriptors have been closed.
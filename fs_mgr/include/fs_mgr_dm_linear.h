@@ -101,6 +101,14 @@ struct CreateLogicalPartitionParams {
 
 bool CreateLogicalPartition(CreateLogicalPartitionParams params, std::string* path);
 
+// Create block devices for several logical partitions at once. The device
+// mapper ioctls for every partition are issued first, and the device paths are
+// then waited for together, for up to the largest |timeout_ms| in |partitions|.
+// On success, |paths| holds the path of each partition, in the same order. On
+// failure, none of the partitions are left mapped.
+bool CreateLogicalPartitions(std::vector<CreateLogicalPartitionParams> partitions,
+                             std::vector<std::string>* paths);
+
 // Destroy the block device for a logical partition, by name. If |timeout_ms|
 // is non-zero, then this will block until the device path has been unlinked.
 bool DestroyLogicalPartition(const std::string& name);
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -101,7 +102,20 @@ bool ReadFstabFromDt(Fstab* fstab, bool verbose = true);
 bool ReadDefaultFstab(Fstab* fstab);
 bool SkipMountingPartitions(Fstab* fstab, bool verbose = false);
 
+// Returns the Fstab that ReadDefaultFstab() would read, or nullptr if there is none. It is read on
+// first use and then shared, unmodified, by every caller in the process. It is read again only
+// after the fstab file or the skip mount config it came from changes, or after
+// InvalidateDefaultFstabCache().
+std::shared_ptr<const Fstab> GetDefaultFstab();
+// Drops the cached default fstab, for callers that change the files it is read from, e.g. by
+// mounting overlays over them.
+void InvalidateDefaultFstabCache();
+// Returns the first entry of the default fstab for the mount point without copying it. The entry
+// keeps the cached Fstab it belongs to alive.
+std::shared_ptr<const FstabEntry> GetDefaultFstabEntryForMountPoint(const std::string& path);
+
 FstabEntry* GetEntryForMountPoint(Fstab* fstab, const std::string& path);
+const FstabEntry* GetEntryForMountPoint(const Fstab* fstab, const std::string& path);
 // The Fstab can contain multiple entries for the same mount point with different configurations.
 std::vector<FstabEntry*> GetEntriesForMountPoint(Fstab* fstab, const std::string& path);
 
@@ -73,7 +73,9 @@ bool DeviceMapper::CreateDevice(const std::string& name, const std::string& uuid
         snprintf(io.uuid, sizeof(io.uuid), "%s", uuid.c_str());
     }
 
-    if (ioctl(fd_, DM_DEV_CREATE, &io)) {
+    int ret = ioctl(fd_, DM_DEV_CREATE, &io);
+    InvalidateCache();
+    if (ret) {
         PLOG(ERROR) << "DM_DEV_CREATE failed for [" << name << "]";
         return false;
     }
@@ -108,7 +110,9 @@ bool DeviceMapper::DeleteDevice(const std::string& name,
     struct dm_ioctl io;
     InitIo(&io, name);
 
-    if (ioctl(fd_, DM_DEV_REMOVE, &io)) {
+    int ret = ioctl(fd_, DM_DEV_REMOVE, &io);
+    InvalidateCache();
+    if (ret) {
         PLOG(ERROR) << "DM_DEV_REMOVE failed for [" << name << "]";
         return false;
     }
@@ -142,7 +146,9 @@ bool DeviceMapper::DeleteDeviceDeferred(const std::string& name) {
     InitIo(&io, name);
 
     io.flags |= DM_DEFERRED_REMOVE;
-    if (ioctl(fd_, DM_DEV_REMOVE, &io)) {
+    int ret = ioctl(fd_, DM_DEV_REMOVE, &io);
+    InvalidateCache();
+    if (ret) {
         PLOG(ERROR) << "DM_DEV_REMOVE with DM_DEFERRED_REMOVE failed for [" << name << "]";
         return false;
     }
@@ -175,29 +181,37 @@ bool DeviceMapper::CreateEmptyDevice(const std::string& name) {
     return CreateDevice(name, uuid);
 }
 
-bool DeviceMapper::WaitForDevice(const std::string& name,
-                                 const std::chrono::milliseconds& timeout_ms, std::string* path) {
+bool DeviceMapper::GetWaitPaths(const std::string& name, std::string* unique_path,
+                                std::string* path) {
     // We use the unique path for testing whether the device is ready. After
     // that, it's safe to use the dm-N path which is compatible with callers
     // that expect it to be formatted as such.
-    std::string unique_path;
-    if (!GetDeviceUniquePath(name, &unique_path) || !GetDmDevicePathByName(name, path)) {
-        DeleteDevice(name);
+    if (!GetDeviceUniquePath(name, unique_path) || !GetDmDevicePathByName(name, path)) {
         return false;
     }
 
-    if (timeout_ms <= std::chrono::milliseconds::zero()) {
-        return true;
-    }
-
     if (IsRecovery()) {
         bool non_ab_device = android::base::GetProperty("ro.build.ab_update", "").empty();
         int sdk = android::base::GetIntProperty("ro.build.version.sdk", 0);
         if (non_ab_device && sdk && sdk <= 29) {
             LOG(INFO) << "Detected ueventd incompatibility, reverting to legacy libdm behavior.";
-            unique_path = *path;
+            *unique_path = *path;
         }
     }
+    return true;
+}
+
+bool DeviceMapper::WaitForDevice(const std::string& name,
+                                 const std::chrono::milliseconds& timeout_ms, std::string* path) {
+    std::string unique_path;
+    if (!GetWaitPaths(name, &unique_path, path)) {
+        DeleteDevice(name);
+        return false;
+    }
+
+    if (timeout_ms <= std::chrono::milliseconds::zero()) {
+        return true;
+    }
 
     if (!WaitForFile(unique_path, timeout_ms)) {
         LOG(ERROR) << "Failed waiting for device path: " << unique_path;
@@ -226,10 +240,53 @@ bool DeviceMapper::CreateDevice(const std::string& name, const DmTable& table, s
     return true;
 }
 
+bool DeviceMapper::CreateDevices(const std::vector<std::pair<std::string, DmTable>>& devices,
+                                 std::vector<std::string>* paths,
+                                 const std::chrono::milliseconds& timeout_ms) {
+    std::vector<std::string> created;
+    auto delete_created = [&]() -> void {
+        for (const auto& name : created) {
+            DeleteDevice(name);
+        }
+        paths->clear();
+    };
+
+    paths->clear();
+    std::vector<std::string> unique_paths;
+    for (const auto& [name, table] : devices) {
+        if (!CreateEmptyDevice(name)) {
+            delete_created();
+            return false;
+        }
+        created.emplace_back(name);
+
+        std::string unique_path, path;
+        if (!LoadTableAndActivate(name, table) || !GetWaitPaths(name, &unique_path, &path)) {
+            delete_created();
+            return false;
+        }
+        unique_paths.emplace_back(std::move(unique_path));
+        paths->emplace_back(std::move(path));
+    }
+
+    if (timeout_ms <= std::chrono::milliseconds::zero()) {
+        return true;
+    }
+
+    std::vector<std::string> missing;
+    if (!WaitForFiles(unique_paths, timeout_ms, &missing)) {
+        for (const auto& path : missing) {
+            LOG(ERROR) << "Failed waiting for device path: " << path;
+        }
+        delete_created();
+        return false;
+    }
+    return true;
+}
+
 bool DeviceMapper::GetDeviceUniquePath(const std::string& name, std::string* path) {
     struct dm_ioctl io;
-    InitIo(&io, name);
-    if (ioctl(fd_, DM_DEV_STATUS, &io) < 0) {
+    if (!GetDeviceStatus(name, &io)) {
         PLOG(ERROR) << "Failed to get device path: " << name;
         return false;
     }
@@ -244,8 +301,7 @@ bool DeviceMapper::GetDeviceUniquePath(const std::string& name, std::string* pat
 
 std::optional<DeviceMapper::Info> DeviceMapper::GetDetailedInfo(const std::string& name) const {
     struct dm_ioctl io;
-    InitIo(&io, name);
-    if (ioctl(fd_, DM_DEV_STATUS, &io) < 0) {
+    if (!GetDeviceStatus(name, &io)) {
         return std::nullopt;
     }
     return Info(io.flags);
@@ -253,8 +309,7 @@ std::optional<DeviceMapper::Info> DeviceMapper::GetDetailedInfo(const std::strin
 
 DmDeviceState DeviceMapper::GetState(const std::string& name) const {
     struct dm_ioctl io;
-    InitIo(&io, name);
-    if (ioctl(fd_, DM_DEV_STATUS, &io) < 0) {
+    if (!GetDeviceStatus(name, &io)) {
         return DmDeviceState::INVALID;
     }
     if ((io.flags & DM_ACTIVE_PRESENT_FLAG) && !(io.flags & DM_SUSPEND_FLAG)) {
@@ -273,7 +328,9 @@ bool DeviceMapper::ChangeState(const std::string& name, DmDeviceState state) {
 
     if (state == DmDeviceState::SUSPENDED) io.flags = DM_SUSPEND_FLAG;
 
-    if (ioctl(fd_, DM_DEV_SUSPEND, &io) < 0) {
+    int ret = ioctl(fd_, DM_DEV_SUSPEND, &io);
+    InvalidateCache();
+    if (ret < 0) {
         PLOG(ERROR) << "DM_DEV_SUSPEND "
                     << (state == DmDeviceState::SUSPENDED ? "suspend" : "resume") << " failed";
         return false;
@@ -301,13 +358,17 @@ bool DeviceMapper::LoadTableAndActivate(const std::string& name, const DmTable&
     if (table.readonly()) {
         io->flags |= DM_READONLY_FLAG;
     }
-    if (ioctl(fd_, DM_TABLE_LOAD, io)) {
+    int ret = ioctl(fd_, DM_TABLE_LOAD, io);
+    InvalidateCache();
+    if (ret) {
         PLOG(ERROR) << "DM_TABLE_LOAD failed";
         return false;
     }
 
     InitIo(io, name);
-    if (ioctl(fd_, DM_DEV_SUSPEND, io)) {
+    ret = ioctl(fd_, DM_DEV_SUSPEND, io);
+    InvalidateCache();
+    if (ret) {
         PLOG(ERROR) << "DM_TABLE_SUSPEND resume failed";
         return false;
     }
@@ -395,6 +456,23 @@ bool DeviceMapper::GetTargetByName(const std::string& name, DmTargetTypeInfo* in
 bool DeviceMapper::GetAvailableDevices(std::vector<DmBlockDevice>* devices) {
     devices->clear();
 
+    uint64_t generation;
+    bool use_cache;
+    {
+        std::lock_guard<std::mutex> lock(cache_lock_);
+        generation = cache_generation_;
+        use_cache = cache_enabled_;
+        if (use_cache && devices_cache_ && devices_cache_->generation == generation) {
+            *devices = devices_cache_->value;
+            return true;
+        }
+    }
+    auto cache_devices = [&]() -> void {
+        if (!use_cache) return;
+        std::lock_guard<std::mutex> lock(cache_lock_);
+        devices_cache_ = {generation, *devices};
+    };
+
     // calculate the space needed to read a maximum of 256 targets, each with
     // name with maximum length of 16 bytes
     uint32_t payload_size = sizeof(struct dm_name_list);
@@ -432,6 +510,7 @@ bool DeviceMapper::GetAvailableDevices(std::vector<DmBlockDevice>* devices) {
 
     // if there are no devices created yet, return success with empty vector
     if (io->data_size == sizeof(*io)) {
+        cache_devices();
         return true;
     }
 
@@ -452,6 +531,7 @@ bool DeviceMapper::GetAvailableDevices(std::vector<DmBlockDevice>* devices) {
         dm_dev = reinterpret_cast<struct dm_name_list*>(static_cast<char*>(buffer.get()) + next);
     }
 
+    cache_devices();
     return true;
 }
 
@@ -459,8 +539,7 @@ bool DeviceMapper::GetAvailableDevices(std::vector<DmBlockDevice>* devices) {
 // returns the path to it's device node (or symlink to the device node)
 bool DeviceMapper::GetDmDevicePathByName(const std::string& name, std::string* path) {
     struct dm_ioctl io;
-    InitIo(&io, name);
-    if (ioctl(fd_, DM_DEV_STATUS, &io) < 0) {
+    if (!GetDeviceStatus(name, &io)) {
         PLOG(WARNING) << "DM_DEV_STATUS failed for " << name;
         return false;
     }
@@ -474,8 +553,7 @@ bool DeviceMapper::GetDmDevicePathByName(const std::string& name, std::string* p
 // returns its UUID.
 bool DeviceMapper::GetDmDeviceUuidByName(const std::string& name, std::string* uuid) {
     struct dm_ioctl io;
-    InitIo(&io, name);
-    if (ioctl(fd_, DM_DEV_STATUS, &io) < 0) {
+    if (!GetDeviceStatus(name, &io)) {
         PLOG(WARNING) << "DM_DEV_STATUS failed for " << name;
         return false;
     }
@@ -486,8 +564,7 @@ bool DeviceMapper::GetDmDeviceUuidByName(const std::string& name, std::string* u
 
 bool DeviceMapper::GetDeviceNumber(const std::string& name, dev_t* dev) {
     struct dm_ioctl io;
-    InitIo(&io, name);
-    if (ioctl(fd_, DM_DEV_STATUS, &io) < 0) {
+    if (!GetDeviceStatus(name, &io)) {
         PLOG(WARNING) << "DM_DEV_STATUS failed for " << name;
         return false;
     }
@@ -509,7 +586,35 @@ bool DeviceMapper::GetTableStatus(const std::string& name, std::vector<TargetInf
 }
 
 bool DeviceMapper::GetTableInfo(const std::string& name, std::vector<TargetInfo>* table) {
-    return GetTable(name, DM_STATUS_TABLE_FLAG, table);
+    uint64_t generation;
+    bool use_cache;
+    {
+        std::lock_guard<std::mutex> lock(cache_lock_);
+        generation = cache_generation_;
+        use_cache = cache_enabled_;
+        if (use_cache) {
+            auto iter = table_cache_.find(name);
+            if (iter != table_cache_.end() && iter->second.generation == generation) {
+                const auto& targets = iter->second.value;
+                table->insert(table->end(), targets.begin(), targets.end());
+                return true;
+            }
+        }
+    }
+
+    if (!use_cache) {
+        return GetTable(name, DM_STATUS_TABLE_FLAG, table);
+    }
+
+    std::vector<TargetInfo> targets;
+    if (!GetTable(name, DM_STATUS_TABLE_FLAG, &targets)) {
+        return false;
+    }
+    table->insert(table->end(), targets.begin(), targets.end());
+
+    std::lock_guard<std::mutex> lock(cache_lock_);
+    table_cache_[name] = {generation, std::move(targets)};
+    return true;
 }
 
 // private methods of DeviceMapper
@@ -556,6 +661,53 @@ bool DeviceMapper::GetTable(const std::string& name, uint32_t flags,
     return true;
 }
 
+bool DeviceMapper::GetDeviceStatus(const std::string& name, struct dm_ioctl* io) const {
+    uint64_t generation;
+    bool use_cache;
+    {
+        std::lock_guard<std::mutex> lock(cache_lock_);
+        generation = cache_generation_;
+        use_cache = cache_enabled_;
+        if (use_cache) {
+            auto iter = status_cache_.find(name);
+            if (iter != status_cache_.end() && iter->second.generation == generation) {
+                const auto& status = iter->second.value;
+                *io = status.io;
+                errno = status.error;
+                return status.error == 0;
+            }
+        }
+    }
+
+    InitIo(io, name);
+    int error = 0;
+    if (ioctl(fd_, DM_DEV_STATUS, io) < 0) {
+        error = errno;
+    }
+    if (use_cache) {
+        std::lock_guard<std::mutex> lock(cache_lock_);
+        status_cache_[name] = {generation, {error, *io}};
+    }
+    errno = error;
+    return error == 0;
+}
+
+void DeviceMapper::InvalidateCache() {
+    std::lock_guard<std::mutex> lock(cache_lock_);
+    cache_generation_++;
+}
+
+void DeviceMapper::SetCacheEnabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(cache_lock_);
+    cache_enabled_ = enabled;
+    cache_generation_++;
+    if (!enabled) {
+        status_cache_.clear();
+        table_cache_.clear();
+        devices_cache_.reset();
+    }
+}
+
 void DeviceMapper::InitIo(struct dm_ioctl* io, const std::string& name) const {
     CHECK(io != nullptr) << "nullptr passed to dm_ioctl initialization";
     memset(io, 0, sizeof(*io));
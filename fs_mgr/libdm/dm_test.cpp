@@ -690,3 +690,98 @@ TEST(libdm, CreateEmptyDevice) {
     // Empty device should be in suspended state.
     ASSERT_EQ(DmDeviceState::SUSPENDED, dm.GetState("empty-device"));
 }
+
+TEST(libdm, CreateDevices) {
+    unique_fd tmp(CreateTempFile("file_1", 4096));
+    ASSERT_GE(tmp, 0);
+    LoopDevice loop(tmp, 10s);
+    ASSERT_TRUE(loop.valid());
+
+    std::vector<std::pair<std::string, DmTable>> devices;
+    for (const auto& name : {"libdm-test-batch-0", "libdm-test-batch-1"}) {
+        DmTable table;
+        ASSERT_TRUE(table.Emplace<DmTargetLinear>(0, 1, loop.device(), 0));
+        devices.emplace_back(name, std::move(table));
+    }
+
+    DeviceMapper& dm = DeviceMapper::Instance();
+    auto guard = android::base::make_scope_guard([&]() {
+        for (const auto& [name, table] : devices) {
+            dm.DeleteDeviceIfExists(name, 5s);
+        }
+    });
+
+    std::vector<std::string> paths;
+    ASSERT_TRUE(dm.CreateDevices(devices, &paths, 5s));
+    ASSERT_EQ(devices.size(), paths.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        EXPECT_EQ(DmDeviceState::ACTIVE, dm.GetState(devices[i].first));
+
+        std::string path;
+        ASSERT_TRUE(dm.GetDmDevicePathByName(devices[i].first, &path));
+        EXPECT_EQ(path, paths[i]);
+        EXPECT_EQ(0, access(paths[i].c_str(), F_OK));
+    }
+}
+
+TEST(libdm, CreateDevicesDeletesAllOnFailure) {
+    unique_fd tmp(CreateTempFile("file_1", 4096));
+    ASSERT_GE(tmp, 0);
+    LoopDevice loop(tmp, 10s);
+    ASSERT_TRUE(loop.valid());
+
+    std::vector<std::pair<std::string, DmTable>> devices;
+    DmTable table;
+    ASSERT_TRUE(table.Emplace<DmTargetLinear>(0, 1, loop.device(), 0));
+    devices.emplace_back("libdm-test-batch-ok", std::move(table));
+    // An empty table cannot be loaded.
+    devices.emplace_back("libdm-test-batch-bad", DmTable());
+
+    DeviceMapper& dm = DeviceMapper::Instance();
+    std::vector<std::string> paths;
+    ASSERT_FALSE(dm.CreateDevices(devices, &paths, 5s));
+    EXPECT_TRUE(paths.empty());
+    EXPECT_EQ(DmDeviceState::INVALID, dm.GetState("libdm-test-batch-ok"));
+    EXPECT_EQ(DmDeviceState::INVALID, dm.GetState("libdm-test-batch-bad"));
+}
+
+TEST(libdm, CacheInvalidatedByChanges) {
+    unique_fd tmp(CreateTempFile("file_1", 4096));
+    ASSERT_GE(tmp, 0);
+    LoopDevice loop(tmp, 10s);
+    ASSERT_TRUE(loop.valid());
+
+    DeviceMapper& dm = DeviceMapper::Instance();
+    dm.SetCacheEnabled(true);
+    auto guard = android::base::make_scope_guard([&]() {
+        dm.SetCacheEnabled(false);
+        dm.DeleteDeviceIfExists("libdm-test-cache", 5s);
+    });
+
+    ASSERT_EQ(DmDeviceState::INVALID, dm.GetState("libdm-test-cache"));
+
+    DmTable table;
+    ASSERT_TRUE(table.Emplace<DmTargetLinear>(0, 1, loop.device(), 0));
+    std::string path;
+    ASSERT_TRUE(dm.CreateDevice("libdm-test-cache", table, &path, 5s));
+    ASSERT_EQ(DmDeviceState::ACTIVE, dm.GetState("libdm-test-cache"));
+
+    std::vector<DeviceMapper::TargetInfo> targets;
+    ASSERT_TRUE(dm.GetTableInfo("libdm-test-cache", &targets));
+    ASSERT_EQ(1U, targets.size());
+    EXPECT_EQ("linear", DeviceMapper::GetTargetType(targets[0].spec));
+
+    DmTable zero_table;
+    ASSERT_TRUE(zero_table.Emplace<DmTargetZero>(0, 1));
+    ASSERT_TRUE(dm.LoadTableAndActivate("libdm-test-cache", zero_table));
+    targets.clear();
+    ASSERT_TRUE(dm.GetTableInfo("libdm-test-cache", &targets));
+    ASSERT_EQ(1U, targets.size());
+    EXPECT_EQ("zero", DeviceMapper::GetTargetType(targets[0].spec));
+
+    ASSERT_TRUE(dm.ChangeState("libdm-test-cache", DmDeviceState::SUSPENDED));
+    EXPECT_EQ(DmDeviceState::SUSPENDED, dm.GetState("libdm-test-cache"));
+
+    ASSERT_TRUE(dm.DeleteDevice("libdm-test-cache", 5s));
+    EXPECT_EQ(DmDeviceState::INVALID, dm.GetState("libdm-test-cache"));
+}
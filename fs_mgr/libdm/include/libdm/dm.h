@@ -30,6 +30,7 @@
 #include <chrono>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <utility>
@@ -192,6 +193,20 @@ class DeviceMapper final : public IDeviceMapper {
     // use the timeout variant above.
     bool CreateDevice(const std::string& name, const DmTable& table);
 
+    // Creates and activates several devices, each with a (name, table) pair
+    // from |devices|. All the ioctls are issued up front, and the device paths
+    // are then waited for together, so that the uevents for every device are
+    // processed by ueventd while waiting once rather than once per device.
+    // On success, |paths| holds the GetDmDevicePathByName result for each
+    // device, in the order of |devices|.
+    //
+    // If any device fails to be created or to appear within |timeout_ms|,
+    // every device created by this call is deleted and false is returned. A
+    // |timeout_ms| of 0ms does not wait, as in CreateDevice above.
+    bool CreateDevices(const std::vector<std::pair<std::string, DmTable>>& devices,
+                       std::vector<std::string>* paths,
+                       const std::chrono::milliseconds& timeout_ms);
+
     // Loads the device mapper table from parameter into the underlying device
     // mapper device with given name and activate / resumes the device in the
     // process. A device with the given name must already exist.
@@ -285,6 +300,16 @@ class DeviceMapper final : public IDeviceMapper {
     // Returns mapping <partition-name, /dev/block/dm-x>
     std::map<std::string, std::string> FindDmPartitions();
 
+    // Enables or disables caching of DM_DEV_STATUS, DM_LIST_DEVICES and
+    // GetTableInfo results. Every device creation, deletion, table load or
+    // state change made through this DeviceMapper starts a new cache
+    // generation, and results from an older generation are never returned.
+    //
+    // Changes made by other processes, and deferred removals completing, are
+    // not seen while the cache is enabled, so it must only be enabled while
+    // this process is the one managing the devices it queries.
+    void SetCacheEnabled(bool enabled);
+
   private:
     // Maximum possible device mapper targets registered in the kernel.
     // This is only used to read the list of targets from kernel so we allocate
@@ -298,12 +323,39 @@ class DeviceMapper final : public IDeviceMapper {
     static constexpr uint32_t kMaxPossibleDmDevices = 256;
 
     bool CreateDevice(const std::string& name, const std::string& uuid = {});
+
+    // Returns the unique path to wait on for |name|, and its dm-N path.
+    bool GetWaitPaths(const std::string& name, std::string* unique_path, std::string* path);
     bool GetTable(const std::string& name, uint32_t flags, std::vector<TargetInfo>* table);
     void InitIo(struct dm_ioctl* io, const std::string& name = std::string()) const;
 
+    // Issues DM_DEV_STATUS for |name|, or returns the cached result. On
+    // failure, errno is set as it was by the ioctl.
+    bool GetDeviceStatus(const std::string& name, struct dm_ioctl* io) const;
+    // Starts a new cache generation, after a device has been changed.
+    void InvalidateCache();
+
     DeviceMapper();
 
     int fd_;
+
+    template <typename T>
+    struct CacheEntry {
+        uint64_t generation;
+        T value;
+    };
+    struct DeviceStatus {
+        int error;
+        struct dm_ioctl io;
+    };
+
+    mutable std::mutex cache_lock_;
+    bool cache_enabled_ = false;
+    uint64_t cache_generation_ = 0;
+    mutable std::map<std::string, CacheEntry<DeviceStatus>> status_cache_;
+    std::map<std::string, CacheEntry<std::vector<TargetInfo>>> table_cache_;
+    std::optional<CacheEntry<std::vector<DmBlockDevice>>> devices_cache_;
+
     // Non-copyable & Non-movable
     DeviceMapper(const DeviceMapper&) = delete;
     DeviceMapper& operator=(const DeviceMapper&) = delete;
@@ -70,6 +70,8 @@ class DmTable {
     void set_readonly(bool readonly) { readonly_ = readonly; }
     bool readonly() const { return readonly_; }
 
+    DmTable(DmTable&&) = default;
+    DmTable& operator=(DmTable&&) = default;
     ~DmTable() = default;
 
   private:
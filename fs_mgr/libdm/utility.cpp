@@ -58,6 +58,32 @@ bool WaitForFile(const std::string& path, const std::chrono::milliseconds& timeo
     return WaitForCondition(condition, timeout_ms);
 }
 
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds& timeout_ms, std::vector<std::string>* missing) {
+    std::vector<std::string> pending = paths;
+    auto condition = [&]() -> WaitResult {
+        for (auto iter = pending.begin(); iter != pending.end();) {
+            if (access(iter->c_str(), F_OK) == 0) {
+                iter = pending.erase(iter);
+                continue;
+            }
+            if (errno != ENOENT) {
+                PLOG(ERROR) << "access failed: " << *iter;
+                return WaitResult::Fail;
+            }
+            ++iter;
+        }
+        return pending.empty() ? WaitResult::Done : WaitResult::Wait;
+    };
+    if (WaitForCondition(condition, timeout_ms)) {
+        return true;
+    }
+    if (missing) {
+        *missing = std::move(pending);
+    }
+    return false;
+}
+
 bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds& timeout_ms) {
     auto condition = [&]() -> WaitResult {
         if (access(path.c_str(), F_OK) == 0) {
@@ -16,6 +16,8 @@
 
 #include <chrono>
 #include <functional>
+#include <string>
+#include <vector>
 
 namespace android {
 namespace dm {
@@ -23,6 +25,11 @@ namespace dm {
 enum class WaitResult { Wait, Done, Fail };
 
 bool WaitForFile(const std::string& path, const std::chrono::milliseconds& timeout_ms);
+// Waits for all of |paths| to exist. On timeout, the paths that are still
+// missing are stored in |missing|, if it is not null.
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds& timeout_ms,
+                  std::vector<std::string>* missing = nullptr);
 bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds& timeout_ms);
 bool WaitForCondition(const std::function<WaitResult()>& condition,
                       const std::chrono::milliseconds& timeout_ms);
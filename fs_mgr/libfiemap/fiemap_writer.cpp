@@ -48,6 +48,9 @@ using namespace android::dm;
 // We cap the maximum number of extents as a robustness measure.
 static constexpr uint32_t kMaxExtents = 50000;
 
+// How much WriteZeroes() writes at a time.
+static constexpr size_t kZeroBufferSize = 1024 * 1024;
+
 // TODO: Fallback to using fibmap if FIEMAP_EXTENT_MERGED is set.
 static constexpr const uint32_t kUnsupportedExtentFlags =
         FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_UNWRITTEN | FIEMAP_EXTENT_DELALLOC |
@@ -379,13 +382,22 @@ static bool PinFile(int file_fd, const std::string& file_path, uint32_t fs_type)
     return true;
 }
 
-// write zeroes in 'blocksz' byte increments until we reach file_size to make sure the data
+// write zeroes in multiples of 'blocksz' until we reach file_size to make sure the data
 // blocks are actually written to by the file system and thus getting rid of the holes in the
 // file.
+//
+// Note that fallocate(FALLOC_FL_ZERO_RANGE) or BLKZEROOUT can't replace these writes. The
+// former leaves the extents unwritten, and the latter zeroes the blocks behind the file
+// system's back, so they stay marked unwritten too. Data written through the block device
+// would then read back as zeroes through the file, which is why ReadFiemap() rejects
+// unwritten extents.
 static FiemapStatus WriteZeroes(int file_fd, const std::string& file_path, size_t blocksz,
                                 uint64_t file_size,
                                 const std::function<bool(uint64_t, uint64_t)>& on_progress) {
-    auto buffer = std::unique_ptr<void, decltype(&free)>(calloc(1, blocksz), free);
+    // Write several blocks per call, since a syscall per block dominates the time taken to
+    // allocate large files. file_size is block aligned, so every write is too.
+    size_t bufsz = std::max(kZeroBufferSize - (kZeroBufferSize % blocksz), blocksz);
+    auto buffer = std::unique_ptr<void, decltype(&free)>(calloc(1, bufsz), free);
     if (buffer == nullptr) {
         LOG(ERROR) << "failed to allocate memory for writing file";
         return FiemapStatus::Error();
@@ -399,13 +411,14 @@ static FiemapStatus WriteZeroes(int file_fd, const std::string& file_path, size_
 
     int permille = -1;
     while (offset < file_size) {
-        if (!::android::base::WriteFully(file_fd, buffer.get(), blocksz)) {
-            PLOG(ERROR) << "Failed to write" << blocksz << " bytes at offset" << offset
+        size_t len = std::min(static_cast<uint64_t>(bufsz), file_size - offset);
+        if (!::android::base::WriteFully(file_fd, buffer.get(), len)) {
+            PLOG(ERROR) << "Failed to write" << len << " bytes at offset" << offset
                         << " in file " << file_path;
             return FiemapStatus::FromErrno(errno);
         }
 
-        offset += blocksz;
+        offset += len;
 
         // Don't invoke the callback every iteration - wait until a significant
         // chunk (here, 1/1000th) of the data has been processed.
@@ -307,6 +307,35 @@ TEST_F(SplitFiemapTest, DeleteOnFail) {
     ASSERT_EQ(errno, ENOENT);
 }
 
+TEST_F(SplitFiemapTest, CreateProgress) {
+    static constexpr size_t kSize = 1024 * 768;
+    uint64_t last = 0;
+    auto callback = [&](uint64_t done, uint64_t total) -> bool {
+        EXPECT_GE(done, last);
+        EXPECT_LT(done, kSize);
+        EXPECT_EQ(total, kSize);
+        last = done;
+        return true;
+    };
+    auto ptr = SplitFiemap::Create(testfile, kSize, 1024 * 32, std::move(callback));
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_GT(last, 0);
+    EXPECT_EQ(ptr->size(), kSize);
+}
+
+TEST_F(SplitFiemapTest, CancelCreate) {
+    size_t invocations = 0;
+    auto callback = [&](uint64_t, uint64_t) -> bool { return ++invocations < 5; };
+    auto ptr = SplitFiemap::Create(testfile, 1024 * 768, 1024 * 32, std::move(callback));
+    ASSERT_EQ(ptr, nullptr);
+
+    for (int i = 0; i < 24; i++) {
+        std::string piece = android::base::StringPrintf("%s.%04d", testfile.c_str(), i);
+        EXPECT_NE(access(piece.c_str(), F_OK), 0) << piece;
+    }
+    EXPECT_NE(access(testfile.c_str(), F_OK), 0);
+}
+
 TEST_F(SplitFiemapTest, CorruptSplit) {
     unique_fd fd(open(testfile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0700));
     ASSERT_GE(fd, 0);
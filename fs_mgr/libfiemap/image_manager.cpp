@@ -204,6 +204,11 @@ FiemapStatus ImageManager::CreateBackingImage(
     if (!UpdateMetadata(metadata_dir_, name, fw.get(), size, readonly)) {
         return FiemapStatus::Error();
     }
+    // The extents were just read back from the file system, so later checks
+    // can rely on the cache. This is only an optimization.
+    if (!UpdateExtentCache(metadata_dir_, name, data_path)) {
+        LOG(WARNING) << "Could not cache extents for image " << name;
+    }
 
     if (flags & CREATE_IMAGE_ZERO_FILL) {
         auto res = ZeroFillNewImage(name, 0);
@@ -665,6 +670,9 @@ bool ImageManager::Validate() {
     for (const auto& partition : metadata->partitions) {
         auto name = GetPartitionName(partition);
         auto image_path = GetImageHeaderPath(name);
+        if (IsExtentCacheValid(metadata_dir_, *metadata.get(), name, image_path)) {
+            continue;
+        }
         auto fiemap = SplitFiemap::Open(image_path);
         if (fiemap == nullptr) {
             LOG(ERROR) << "SplitFiemap::Open(\"" << image_path << "\") failed";
@@ -810,6 +818,9 @@ bool ImageManager::ValidateImageMaps() {
     for (const auto& partition : metadata->partitions) {
         auto name = GetPartitionName(partition);
         auto image_path = GetImageHeaderPath(name);
+        if (IsExtentCacheValid(metadata_dir_, *metadata.get(), name, image_path)) {
+            continue;
+        }
         auto fiemap = SplitFiemap::Open(image_path);
         if (fiemap == nullptr) {
             LOG(ERROR) << "SplitFiemap::Open(\"" << image_path << "\") failed";
@@ -849,6 +860,7 @@ bool ImageManager::ValidateImageMaps() {
             LOG(ERROR) << "Metadata for " << image_path << " does not match fiemap";
             return false;
         }
+        UpdateExtentCache(metadata_dir_, name, image_path);
     }
 
     return true;
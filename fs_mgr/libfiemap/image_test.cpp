@@ -124,6 +124,27 @@ TEST_F(NativeTest, DisableImage) {
     ASSERT_TRUE(!manager_->BackingImageExists(base_name_));
 }
 
+TEST_F(NativeTest, ExtentCache) {
+    ASSERT_TRUE(manager_->CreateBackingImage(base_name_, kTestImageSize, false, nullptr));
+
+    auto cache_file = kMetadataPath + "/"s + base_name_ + ".extents";
+    std::string cached;
+    ASSERT_TRUE(android::base::ReadFileToString(cache_file, &cached));
+    ASSERT_FALSE(cached.empty());
+    ASSERT_TRUE(manager_->Validate());
+    ASSERT_TRUE(manager_->ValidateImageMaps());
+
+    // A stale cache falls back to reading the extents, and is then refreshed.
+    ASSERT_TRUE(android::base::WriteStringToFile("file 0 0 0\n", cache_file));
+    ASSERT_TRUE(manager_->ValidateImageMaps());
+    std::string refreshed;
+    ASSERT_TRUE(android::base::ReadFileToString(cache_file, &refreshed));
+    EXPECT_EQ(refreshed, cached);
+
+    ASSERT_TRUE(manager_->DeleteBackingImage(base_name_));
+    EXPECT_NE(access(cache_file.c_str(), F_OK), 0);
+}
+
 TEST_F(NativeTest, GetMappedImageDevice) {
     ASSERT_TRUE(manager_->CreateBackingImage(base_name_, kTestImageSize, false, nullptr));
 
@@ -16,12 +16,18 @@
 
 #include "metadata.h"
 
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <libfiemap/fiemap_writer.h>
 #include <liblp/builder.h>
 
 #include "utility.h"
@@ -162,6 +168,9 @@ bool FillPartitionExtents(MetadataBuilder* builder, Partition* partition, SplitF
 }
 
 bool RemoveImageMetadata(const std::string& metadata_dir, const std::string& partition_name) {
+    if (!RemoveExtentCache(metadata_dir, partition_name)) {
+        return false;
+    }
     if (!MetadataExists(metadata_dir)) {
         return true;
     }
@@ -221,5 +230,117 @@ bool AddAttributes(const std::string& metadata_dir, const std::string& partition
     return SaveMetadata(builder.get(), metadata_dir);
 }
 
+static std::string GetExtentCacheFile(const std::string& metadata_dir,
+                                      const std::string& partition_name) {
+    return JoinPaths(metadata_dir, partition_name) + ".extents";
+}
+
+// Describe an image as one line per backing file, each holding its inode,
+// generation and size, followed by one line per extent of its partition in
+// |metadata|. The description is only produced if every file is still pinned.
+static bool DescribeImage(const LpMetadata& metadata, const std::string& partition_name,
+                          const std::string& image_header, std::string* description) {
+    std::vector<std::string> files;
+    if (!SplitFiemap::GetSplitFileList(image_header, &files)) {
+        return false;
+    }
+
+    description->clear();
+    for (const auto& file : files) {
+        android::base::unique_fd fd(open(file.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+        if (fd < 0) {
+            PLOG(ERROR) << "open: " << file;
+            return false;
+        }
+        struct stat s;
+        if (fstat(fd.get(), &s)) {
+            PLOG(ERROR) << "fstat: " << file;
+            return false;
+        }
+        // Not every file system has generation numbers, and the inode alone
+        // is still meaningful there.
+        unsigned int generation = 0;
+        if (ioctl(fd.get(), FS_IOC_GETVERSION, &generation) && errno != ENOTTY &&
+            errno != EOPNOTSUPP) {
+            PLOG(ERROR) << "FS_IOC_GETVERSION: " << file;
+            return false;
+        }
+        if (!FiemapWriter::HasPinnedExtents(file)) {
+            return false;
+        }
+        android::base::StringAppendF(description, "file %llu %u %lld\n",
+                                     static_cast<unsigned long long>(s.st_ino), generation,
+                                     static_cast<long long>(s.st_size));
+    }
+
+    auto partition = FindPartition(metadata, partition_name);
+    if (!partition) {
+        LOG(ERROR) << "Could not find image in metadata: " << partition_name;
+        return false;
+    }
+    for (uint32_t i = 0; i < partition->num_extents; i++) {
+        const auto& extent = metadata.extents[partition->first_extent_index + i];
+        android::base::StringAppendF(description, "extent %u %u %llu %llu\n", extent.target_type,
+                                     extent.target_source,
+                                     static_cast<unsigned long long>(extent.target_data),
+                                     static_cast<unsigned long long>(extent.num_sectors));
+    }
+    return true;
+}
+
+bool UpdateExtentCache(const std::string& metadata_dir, const std::string& partition_name,
+                       const std::string& image_header) {
+    auto metadata = OpenMetadata(metadata_dir);
+    if (!metadata) {
+        return false;
+    }
+
+    std::string description;
+    if (!DescribeImage(*metadata.get(), partition_name, image_header, &description)) {
+        RemoveExtentCache(metadata_dir, partition_name);
+        return false;
+    }
+
+    auto cache_file = GetExtentCacheFile(metadata_dir, partition_name);
+    if (!android::base::WriteStringToFile(description, cache_file)) {
+        PLOG(ERROR) << "Could not write extent cache: " << cache_file;
+        RemoveExtentCache(metadata_dir, partition_name);
+        return false;
+    }
+    return true;
+}
+
+bool IsExtentCacheValid(const std::string& metadata_dir, const LpMetadata& metadata,
+                        const std::string& partition_name, const std::string& image_header) {
+    auto cache_file = GetExtentCacheFile(metadata_dir, partition_name);
+    std::string cached;
+    if (!android::base::ReadFileToString(cache_file, &cached)) {
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "Could not read extent cache: " << cache_file;
+        }
+        return false;
+    }
+
+    std::string description;
+    if (!DescribeImage(metadata, partition_name, image_header, &description)) {
+        return false;
+    }
+    if (description != cached) {
+        LOG(INFO) << "Extent cache is stale for image " << partition_name;
+        return false;
+    }
+    return true;
+}
+
+bool RemoveExtentCache(const std::string& metadata_dir, const std::string& partition_name) {
+    auto cache_file = GetExtentCacheFile(metadata_dir, partition_name);
+    std::string err;
+    if (!android::base::RemoveFileIfExists(cache_file, &err)) {
+        LOG(ERROR) << "Could not remove extent cache: " << err;
+        return false;
+    }
+    return true;
+}
+
 }  // namespace fiemap
 }  // namespace android
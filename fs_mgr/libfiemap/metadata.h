@@ -35,6 +35,16 @@ bool AddAttributes(const std::string& metadata_dir, const std::string& partition
 bool RemoveImageMetadata(const std::string& metadata_dir, const std::string& partition_name);
 bool RemoveAllMetadata(const std::string& dir);
 
+// The extent cache records the identity of the files backing an image, and the
+// extents lp_metadata has for it, once those extents were verified against the
+// file system. While the cache matches, the extents can be trusted without
+// querying FIEMAP/FIBMAP again.
+bool UpdateExtentCache(const std::string& metadata_dir, const std::string& partition_name,
+                       const std::string& image_header);
+bool IsExtentCacheValid(const std::string& metadata_dir, const android::fs_mgr::LpMetadata& metadata,
+                        const std::string& partition_name, const std::string& image_header);
+bool RemoveExtentCache(const std::string& metadata_dir, const std::string& partition_name);
+
 bool FillPartitionExtents(android::fs_mgr::MetadataBuilder* builder,
                           android::fs_mgr::Partition* partition, android::fiemap::SplitFiemap* file,
                           uint64_t partition_size);
@@ -19,11 +19,15 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -42,6 +46,21 @@ using android::base::unique_fd;
 // We use a four-digit suffix at the end of filenames.
 static const size_t kMaxFilePieces = 500;
 
+// Allocating a piece mostly waits on the disk, so a few pieces in flight keep
+// the device busy without fragmenting the file system.
+static const size_t kMaxAllocationThreads = 4;
+
+static FiemapStatus GetBlockSize(const std::string& file_path, uint64_t* block_size) {
+    std::string dir = android::base::Dirname(file_path);
+    struct statfs sfs;
+    if (statfs(dir.c_str(), &sfs)) {
+        PLOG(ERROR) << "Failed to read file system status at: " << dir;
+        return FiemapStatus::FromErrno(errno);
+    }
+    *block_size = sfs.f_bsize;
+    return FiemapStatus::Ok();
+}
+
 std::unique_ptr<SplitFiemap> SplitFiemap::Create(const std::string& file_path, uint64_t file_size,
                                                  uint64_t max_piece_size,
                                                  ProgressCallback progress) {
@@ -73,51 +92,111 @@ FiemapStatus SplitFiemap::Create(const std::string& file_path, uint64_t file_siz
     // Remove any existing file.
     RemoveSplitFiles(file_path);
 
-    // Call |progress| only when the total percentage would significantly change.
+    uint64_t block_size;
+    if (auto status = GetBlockSize(file_path, &block_size); !status.is_ok()) {
+        return status;
+    }
+
+    // FiemapWriter rounds every piece up to the block size, so the size of
+    // each piece is known before any of them is allocated.
+    std::vector<uint64_t> piece_sizes;
+    uint64_t remaining_bytes = file_size;
+    while (remaining_bytes) {
+        if (piece_sizes.size() >= kMaxFilePieces) {
+            LOG(ERROR) << "Requested size " << file_size << " created too many split files";
+            return FiemapStatus::Error();
+        }
+        uint64_t piece_size = std::min(max_piece_size, remaining_bytes);
+        if (piece_size % block_size) {
+            piece_size += block_size - (piece_size % block_size);
+        }
+        piece_sizes.emplace_back(piece_size);
+
+        // The aligned size could be bigger than remaining_bytes. If so, set
+        // remaining_bytes to 0 to avoid underflow.
+        remaining_bytes = remaining_bytes > piece_size ? (remaining_bytes - piece_size) : 0;
+    }
+
+    // Pieces report progress from their own threads. Calls to |progress| are
+    // serialized, and only made when the total percentage would significantly
+    // change.
+    std::mutex lock;
+    FiemapStatus status = FiemapStatus::Ok();
+    bool cancelled = false;
     int permille = -1;
     uint64_t total_bytes_written = 0;
-    auto on_progress = [&](uint64_t written, uint64_t) -> bool {
-        uint64_t actual_written = total_bytes_written + written;
-        int new_permille = (actual_written * 1000) / file_size;
-        if (new_permille != permille && actual_written < file_size) {
-            if (progress && !progress(actual_written, file_size)) {
+    std::vector<uint64_t> piece_bytes_written(piece_sizes.size());
+    auto on_progress = [&](size_t piece, uint64_t written) -> bool {
+        std::lock_guard<std::mutex> guard(lock);
+        if (cancelled) {
+            return false;
+        }
+        total_bytes_written += written - piece_bytes_written[piece];
+        piece_bytes_written[piece] = written;
+
+        int new_permille = (total_bytes_written * 1000) / file_size;
+        if (new_permille != permille && total_bytes_written < file_size) {
+            if (progress && !progress(total_bytes_written, file_size)) {
+                cancelled = true;
                 return false;
             }
             permille = new_permille;
         }
         return true;
     };
-    std::unique_ptr<SplitFiemap> out(new SplitFiemap());
-    out->creating_ = true;
-    out->list_file_ = file_path;
 
-    // Create the split files.
-    uint64_t remaining_bytes = file_size;
-    while (remaining_bytes) {
-        if (out->files_.size() >= kMaxFilePieces) {
-            LOG(ERROR) << "Requested size " << file_size << " created too many split files";
-            out.reset();
-            return FiemapStatus::Error();
-        }
-        std::string chunk_path =
-                android::base::StringPrintf("%s.%04d", file_path.c_str(), (int)out->files_.size());
-        uint64_t chunk_size = std::min(max_piece_size, remaining_bytes);
-        FiemapUniquePtr writer;
-        auto status = FiemapWriter::Open(chunk_path, chunk_size, &writer, true, on_progress);
-        if (!status.is_ok()) {
-            out.reset();
-            return status;
+    // Each piece is an independent file, so they are allocated in parallel.
+    // Once any piece fails, no new piece is started and the pieces in flight
+    // are cancelled through their progress callback.
+    std::vector<FiemapUniquePtr> writers(piece_sizes.size());
+    std::atomic<size_t> next_piece = 0;
+    auto allocate_pieces = [&]() -> void {
+        for (size_t piece = next_piece++; piece < piece_sizes.size(); piece = next_piece++) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (cancelled) {
+                    return;
+                }
+            }
+            std::string chunk_path =
+                    android::base::StringPrintf("%s.%04d", file_path.c_str(), (int)piece);
+            auto piece_progress = [&, piece](uint64_t written, uint64_t) -> bool {
+                return on_progress(piece, written);
+            };
+            auto piece_status = FiemapWriter::Open(chunk_path, piece_sizes[piece], &writers[piece],
+                                                   true, piece_progress);
+            if (!piece_status.is_ok()) {
+                std::lock_guard<std::mutex> guard(lock);
+                if (status.is_ok()) {
+                    status = piece_status;
+                }
+                cancelled = true;
+                return;
+            }
         }
+    };
 
-        // To make sure the alignment doesn't create too much inconsistency, we
-        // account the *actual* size, not the requested size.
-        total_bytes_written += writer->size();
-
-        // writer->size() is block size aligned and could be bigger than remaining_bytes
-        // If remaining_bytes is bigger, set remaining_bytes to 0 to avoid underflow error.
-        remaining_bytes = remaining_bytes > writer->size() ? (remaining_bytes - writer->size()) : 0;
+    std::vector<std::thread> threads;
+    size_t num_threads = std::min(kMaxAllocationThreads, piece_sizes.size());
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(allocate_pieces);
+    }
+    allocate_pieces();
+    for (auto& thread : threads) {
+        thread.join();
+    }
 
-        out->AddFile(std::move(writer));
+    std::unique_ptr<SplitFiemap> out(new SplitFiemap());
+    out->creating_ = true;
+    out->list_file_ = file_path;
+    for (auto& writer : writers) {
+        if (writer) {
+            out->AddFile(std::move(writer));
+        }
+    }
+    if (!status.is_ok()) {
+        out.reset();
+        return status;
     }
 
     // Create the split file list.
@@ -18,8 +18,11 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <iterator>
 #include <sstream>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
@@ -117,12 +120,7 @@ bool HashtreeDmVeritySetup(FstabEntry* fstab_entry, const FsAvbHashtreeDescripto
     return true;
 }
 
-std::unique_ptr<FsAvbHashtreeDescriptor> GetHashtreeDescriptor(
-        const std::string& partition_name, const std::vector<VBMetaData>& vbmeta_images) {
-    bool found = false;
-    const uint8_t* desc_partition_name;
-    auto hashtree_desc = std::make_unique<FsAvbHashtreeDescriptor>();
-
+HashtreeDescriptorIndex::HashtreeDescriptorIndex(const std::vector<VBMetaData>& vbmeta_images) {
     for (const auto& vbmeta : vbmeta_images) {
         size_t num_descriptors;
         std::unique_ptr<const AvbDescriptor* [], decltype(&avb_free)> descriptors(
@@ -132,52 +130,66 @@ std::unique_ptr<FsAvbHashtreeDescriptor> GetHashtreeDescriptor(
             continue;
         }
 
-        for (size_t n = 0; n < num_descriptors && !found; n++) {
+        for (size_t n = 0; n < num_descriptors; n++) {
             AvbDescriptor desc;
             if (!avb_descriptor_validate_and_byteswap(descriptors[n], &desc)) {
                 LWARNING << "Descriptor[" << n << "] is invalid";
                 continue;
             }
-            if (desc.tag == AVB_DESCRIPTOR_TAG_HASHTREE) {
-                desc_partition_name =
-                        (const uint8_t*)descriptors[n] + sizeof(AvbHashtreeDescriptor);
-                if (!avb_hashtree_descriptor_validate_and_byteswap(
-                        (AvbHashtreeDescriptor*)descriptors[n], hashtree_desc.get())) {
-                    continue;
-                }
-                if (hashtree_desc->partition_name_len != partition_name.length()) {
-                    continue;
-                }
-                // Notes that desc_partition_name is not NUL-terminated.
-                std::string hashtree_partition_name((const char*)desc_partition_name,
-                                                    hashtree_desc->partition_name_len);
-                if (hashtree_partition_name == partition_name) {
-                    found = true;
-                }
+            if (desc.tag != AVB_DESCRIPTOR_TAG_HASHTREE) {
+                continue;
             }
+
+            FsAvbHashtreeDescriptor hashtree_desc;
+            if (!avb_hashtree_descriptor_validate_and_byteswap(
+                        (AvbHashtreeDescriptor*)descriptors[n], &hashtree_desc)) {
+                continue;
+            }
+
+            // Notes that desc_partition_name is not NUL-terminated.
+            const uint8_t* desc_partition_name =
+                    (const uint8_t*)descriptors[n] + sizeof(AvbHashtreeDescriptor);
+            std::string partition_name((const char*)desc_partition_name,
+                                       hashtree_desc.partition_name_len);
+            if (index_.count(partition_name)) {
+                continue;
+            }
+
+            const uint8_t* desc_salt = desc_partition_name + hashtree_desc.partition_name_len;
+            hashtree_desc.salt = BytesToHex(desc_salt, hashtree_desc.salt_len);
+
+            const uint8_t* desc_digest = desc_salt + hashtree_desc.salt_len;
+            hashtree_desc.root_digest = BytesToHex(desc_digest, hashtree_desc.root_digest_len);
+
+            hashtree_desc.partition_name = partition_name;
+            index_.emplace(std::move(partition_name), descriptors_.size());
+            descriptors_.emplace_back(std::move(hashtree_desc));
         }
+    }
+}
 
-        if (found) break;
+const FsAvbHashtreeDescriptor* HashtreeDescriptorIndex::Find(
+        const std::string& partition_name) const {
+    auto iter = index_.find(partition_name);
+    if (iter == index_.end()) {
+        return nullptr;
     }
+    return &descriptors_[iter->second];
+}
 
-    if (!found) {
+std::unique_ptr<FsAvbHashtreeDescriptor> GetHashtreeDescriptor(
+        const std::string& partition_name, const std::vector<VBMetaData>& vbmeta_images) {
+    HashtreeDescriptorIndex hashtree_index(vbmeta_images);
+    const FsAvbHashtreeDescriptor* hashtree_desc = hashtree_index.Find(partition_name);
+    if (!hashtree_desc) {
         LERROR << "Hashtree descriptor not found: " << partition_name;
         return nullptr;
     }
-
-    hashtree_desc->partition_name = partition_name;
-
-    const uint8_t* desc_salt = desc_partition_name + hashtree_desc->partition_name_len;
-    hashtree_desc->salt = BytesToHex(desc_salt, hashtree_desc->salt_len);
-
-    const uint8_t* desc_digest = desc_salt + hashtree_desc->salt_len;
-    hashtree_desc->root_digest = BytesToHex(desc_digest, hashtree_desc->root_digest_len);
-
-    return hashtree_desc;
+    return std::make_unique<FsAvbHashtreeDescriptor>(*hashtree_desc);
 }
 
 bool LoadAvbHashtreeToEnableVerity(FstabEntry* fstab_entry, bool wait_for_verity_dev,
-                                   const std::vector<VBMetaData>& vbmeta_images,
+                                   const HashtreeDescriptorIndex& hashtree_index,
                                    const std::string& ab_suffix,
                                    const std::string& ab_other_suffix) {
     // Derives partition_name from blk_device to query the corresponding AVB HASHTREE descriptor
@@ -189,9 +201,9 @@ bool LoadAvbHashtreeToEnableVerity(FstabEntry* fstab_entry, bool wait_for_verity
         return false;
     }
 
-    std::unique_ptr<FsAvbHashtreeDescriptor> hashtree_descriptor =
-            GetHashtreeDescriptor(partition_name, vbmeta_images);
+    const FsAvbHashtreeDescriptor* hashtree_descriptor = hashtree_index.Find(partition_name);
     if (!hashtree_descriptor) {
+        LERROR << "Hashtree descriptor not found: " << partition_name;
         return false;
     }
 
@@ -565,28 +577,53 @@ VBMetaVerifyResult LoadAndVerifyVbmetaByPartition(
     if (!vbmeta) {
         return VBMetaVerifyResult::kError;
     }
-    if (out_vbmeta_images) {
-        out_vbmeta_images->emplace_back(std::move(*vbmeta));
-    }
 
     // Only loads chained vbmeta if AVB verification is NOT disabled.
+    std::vector<ChainInfo> chain_partitions;
     if (!verification_disabled && load_chained_vbmeta) {
         bool fatal_error = false;
-        auto chain_partitions = GetChainPartitionInfo(*out_vbmeta_images->rbegin(), &fatal_error);
+        chain_partitions = GetChainPartitionInfo(*vbmeta, &fatal_error);
         if (fatal_error) {
             return VBMetaVerifyResult::kError;
         }
-        for (auto& chain : chain_partitions) {
-            auto sub_ret = LoadAndVerifyVbmetaByPartition(
-                chain.partition_name, ab_suffix, ab_other_suffix, chain.public_key_blob,
-                allow_verification_error, load_chained_vbmeta, rollback_protection,
-                device_path_constructor, true, /* is_chained_vbmeta */
-                out_vbmeta_images);
-            if (sub_ret != VBMetaVerifyResult::kSuccess) {
-                verify_result = sub_ret;  // might be 'ERROR' or 'ERROR VERIFICATION'.
-                if (verify_result == VBMetaVerifyResult::kError) {
-                    return verify_result;  // stop here if we got an 'ERROR'.
-                }
+    }
+    if (out_vbmeta_images) {
+        out_vbmeta_images->emplace_back(std::move(*vbmeta));
+    }
+
+    // Chained partitions don't depend on each other, so they are loaded and
+    // verified concurrently. Their images are still appended in descriptor
+    // order, since that is the order the vbmeta digest is computed in.
+    std::vector<std::vector<VBMetaData>> chained_images(chain_partitions.size());
+    std::vector<VBMetaVerifyResult> chained_results(chain_partitions.size());
+    auto load_chain = [&](size_t i) -> void {
+        chained_results[i] = LoadAndVerifyVbmetaByPartition(
+                chain_partitions[i].partition_name, ab_suffix, ab_other_suffix,
+                chain_partitions[i].public_key_blob, allow_verification_error, load_chained_vbmeta,
+                rollback_protection, device_path_constructor, true, /* is_chained_vbmeta */
+                out_vbmeta_images ? &chained_images[i] : nullptr);
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < chain_partitions.size(); i++) {
+        threads.emplace_back(load_chain, i);
+    }
+    if (!chain_partitions.empty()) {
+        load_chain(0);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < chain_partitions.size(); i++) {
+        if (out_vbmeta_images) {
+            std::move(chained_images[i].begin(), chained_images[i].end(),
+                      std::back_inserter(*out_vbmeta_images));
+        }
+        auto sub_ret = chained_results[i];
+        if (sub_ret != VBMetaVerifyResult::kSuccess) {
+            verify_result = sub_ret;  // might be 'ERROR' or 'ERROR VERIFICATION'.
+            if (verify_result == VBMetaVerifyResult::kError) {
+                return verify_result;  // stop here if we got an 'ERROR'.
             }
         }
     }
@@ -18,6 +18,7 @@
 
 #include <ostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <fstab/fstab.h>
@@ -37,6 +38,22 @@ struct ChainInfo {
         : partition_name(chain_partition_name), public_key_blob(chain_public_key_blob) {}
 };
 
+// Indexes the AVB HASHTREE descriptors of a set of vbmeta images by partition
+// name, so that each lookup is constant time. The descriptors are parsed once
+// and kept in one contiguous array. If several images describe the same
+// partition, the first one wins, as it would with a linear search.
+class HashtreeDescriptorIndex {
+  public:
+    explicit HashtreeDescriptorIndex(const std::vector<VBMetaData>& vbmeta_images);
+
+    // Returns nullptr if no descriptor was found for |partition_name|.
+    const FsAvbHashtreeDescriptor* Find(const std::string& partition_name) const;
+
+  private:
+    std::vector<FsAvbHashtreeDescriptor> descriptors_;
+    std::unordered_map<std::string, size_t> index_;
+};
+
 // AvbHashtreeDescriptor to dm-verity table setup.
 std::unique_ptr<FsAvbHashtreeDescriptor> GetHashtreeDescriptor(
         const std::string& partition_name, const std::vector<VBMetaData>& vbmeta_images);
@@ -47,9 +64,9 @@ bool ConstructVerityTable(const FsAvbHashtreeDescriptor& hashtree_desc,
 bool HashtreeDmVeritySetup(FstabEntry* fstab_entry, const FsAvbHashtreeDescriptor& hashtree_desc,
                            bool wait_for_verity_dev);
 
-// Searches a Avb hashtree descriptor in vbmeta_images for fstab_entry, to enable dm-verity.
+// Looks up the Avb hashtree descriptor for fstab_entry in hashtree_index, to enable dm-verity.
 bool LoadAvbHashtreeToEnableVerity(FstabEntry* fstab_entry, bool wait_for_verity_dev,
-                                   const std::vector<VBMetaData>& vbmeta_images,
+                                   const HashtreeDescriptorIndex& hashtree_index,
                                    const std::string& ab_suffix, const std::string& ab_other_suffix);
 
 // Converts AVB partition name to a device partition name.
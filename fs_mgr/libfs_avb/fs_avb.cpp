@@ -182,6 +182,19 @@ bool AvbVerifier::VerifyVbmetaImages(const std::vector<VBMetaData>& vbmeta_image
 
 // class AvbHandle
 // ---------------
+AvbHandle::AvbHandle() : status_(AvbHandleStatus::kUninitialized) {}
+
+AvbHandle::~AvbHandle() = default;
+
+const HashtreeDescriptorIndex& AvbHandle::hashtree_index() {
+    // vbmeta_images_ doesn't change once the handle is returned by a factory
+    // method, and SetUpAvbHashtree() may be called from several threads.
+    std::call_once(hashtree_index_once_, [this]() {
+        hashtree_index_ = std::make_unique<HashtreeDescriptorIndex>(vbmeta_images_);
+    });
+    return *hashtree_index_;
+}
+
 AvbUniquePtr AvbHandle::LoadAndVerifyVbmeta(
         const std::string& partition_name, const std::string& ab_suffix,
         const std::string& ab_other_suffix, const std::string& expected_public_key_path,
@@ -491,7 +504,7 @@ AvbHashtreeResult AvbHandle::SetUpAvbHashtree(FstabEntry* fstab_entry, bool wait
         return AvbHashtreeResult::kDisabled;
     }
 
-    if (!LoadAvbHashtreeToEnableVerity(fstab_entry, wait_for_verity_dev, vbmeta_images_,
+    if (!LoadAvbHashtreeToEnableVerity(fstab_entry, wait_for_verity_dev, hashtree_index(),
                                        fs_mgr_get_slot_suffix(), fs_mgr_get_other_slot_suffix())) {
         return AvbHashtreeResult::kFail;
     }
@@ -18,6 +18,7 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -40,6 +41,7 @@ struct VBMetaInfo {
 };
 
 class FsManagerAvbOps;
+class HashtreeDescriptorIndex;
 
 class AvbHandle;
 using AvbUniquePtr = std::unique_ptr<AvbHandle>;
@@ -130,6 +132,8 @@ class AvbHandle {
     const VBMetaInfo& vbmeta_info() const { return vbmeta_info_; }
     AvbHandleStatus status() const { return status_; }
 
+    ~AvbHandle();
+
     AvbHandle(const AvbHandle&) = delete;             // no copy
     AvbHandle& operator=(const AvbHandle&) = delete;  // no assignment
 
@@ -137,12 +141,17 @@ class AvbHandle {
     AvbHandle& operator=(AvbHandle&&) noexcept = delete;  // no move assignment
 
   private:
-    AvbHandle() : status_(AvbHandleStatus::kUninitialized) {}
+    AvbHandle();
+
+    // Indexes the HASHTREE descriptors of vbmeta_images_ on first use.
+    const HashtreeDescriptorIndex& hashtree_index();
 
     std::vector<VBMetaData> vbmeta_images_;
     VBMetaInfo vbmeta_info_;  // A summary info for vbmeta_images_.
     AvbHandleStatus status_;
     std::string avb_version_;
+    std::once_flag hashtree_index_once_;
+    std::unique_ptr<HashtreeDescriptorIndex> hashtree_index_;
 };
 
 }  // namespace fs_mgr
@@ -33,7 +33,9 @@ using android::fs_mgr::FstabEntry;
 using android::fs_mgr::GetAvbFooter;
 using android::fs_mgr::GetAvbPropertyDescriptor;
 using android::fs_mgr::GetChainPartitionInfo;
+using android::fs_mgr::GetHashtreeDescriptor;
 using android::fs_mgr::GetTotalSize;
+using android::fs_mgr::HashtreeDescriptorIndex;
 using android::fs_mgr::LoadAndVerifyVbmetaByPartition;
 using android::fs_mgr::LoadAndVerifyVbmetaByPath;
 using android::fs_mgr::ValidatePublicKeyBlob;
@@ -291,6 +293,46 @@ TEST_F(AvbUtilTest, GetAvbPropertyDescriptor_Basic) {
     EXPECT_EQ("", GetAvbPropertyDescriptor("non-existent", vbmeta_images));
 }
 
+TEST_F(AvbUtilTest, HashtreeDescriptorIndex) {
+    const size_t image_size = 5 * 1024 * 1024;
+    const size_t partition_size = 10 * 1024 * 1024;
+    base::FilePath system_path = GenerateImage("system.img", image_size);
+    AddAvbFooter(system_path, "hashtree", "system", partition_size, "SHA256_RSA2048", 10,
+                 data_dir_.Append("testkey_rsa2048.pem"), "d00df00d",
+                 "--internal_release_string \"unit test\"");
+    base::FilePath vendor_path = GenerateImage("vendor.img", image_size);
+    AddAvbFooter(vendor_path, "hashtree", "vendor", partition_size, "SHA256_RSA2048", 10,
+                 data_dir_.Append("testkey_rsa2048.pem"), "ba5eba11",
+                 "--internal_release_string \"unit test\"");
+    base::FilePath boot_path = GenerateImage("boot.img", image_size);
+    AddAvbFooter(boot_path, "hash", "boot", partition_size, "SHA256_RSA2048", 10,
+                 data_dir_.Append("testkey_rsa2048.pem"), "d00df00d",
+                 "--internal_release_string \"unit test\"");
+
+    GenerateVBMetaImage("vbmeta.img", "SHA256_RSA4096", 0, data_dir_.Append("testkey_rsa4096.pem"),
+                        {system_path, vendor_path, boot_path}, /* include_descriptor_image_paths */
+                        {},                                    /* chain_partitions */
+                        "--internal_release_string \"unit test\"");
+    std::vector<VBMetaData> vbmeta_images;
+    vbmeta_images.emplace_back(LoadVBMetaData("vbmeta.img"));
+
+    HashtreeDescriptorIndex hashtree_index(vbmeta_images);
+    auto system_desc = hashtree_index.Find("system");
+    ASSERT_NE(nullptr, system_desc);
+    EXPECT_EQ("system", system_desc->partition_name);
+    EXPECT_EQ("d00df00d", system_desc->salt);
+    auto vendor_desc = hashtree_index.Find("vendor");
+    ASSERT_NE(nullptr, vendor_desc);
+    EXPECT_EQ("vendor", vendor_desc->partition_name);
+    EXPECT_EQ("ba5eba11", vendor_desc->salt);
+    EXPECT_EQ(vendor_desc->root_digest,
+              GetHashtreeDescriptor("vendor", vbmeta_images)->root_digest);
+
+    // Only HASHTREE descriptors are indexed.
+    EXPECT_EQ(nullptr, hashtree_index.Find("boot"));
+    EXPECT_EQ(nullptr, hashtree_index.Find("odm"));
+}
+
 TEST_F(AvbUtilTest, GetAvbPropertyDescriptor_SecurityPatchLevel) {
     // Generates a raw boot.img
     const size_t boot_image_size = 5 * 1024 * 1024;
@@ -1268,6 +1310,14 @@ TEST_F(AvbUtilTest, LoadAndVerifyVbmetaByPartition) {
     EXPECT_TRUE(CompareVBMeta(vbmeta_system_path, vbmeta_images[2]));
     EXPECT_TRUE(CompareVBMeta(system_path, vbmeta_images[3]));
 
+    // Chained vbmeta images are still verified when the images aren't kept.
+    EXPECT_EQ(VBMetaVerifyResult::kSuccess,
+              LoadAndVerifyVbmetaByPartition(
+                  "vbmeta" /* partition_name */, "" /* ab_suffix */, "" /* other_suffix */,
+                  "" /* expected_public_key_blob*/, false /* allow_verification_error */,
+                  true /* load_chained_vbmeta */, true /* rollback_protection */, vbmeta_image_path,
+                  false /* is_chained_vbmeta*/, nullptr /* out_vbmeta_images */));
+
     // Skip loading chained vbmeta images.
     vbmeta_images.clear();
     EXPECT_EQ(VBMetaVerifyResult::kSuccess,
@@ -20,6 +20,8 @@
 
 #include <algorithm>
 #include <limits>
+#include <map>
+#include <optional>
 
 #include <android-base/unique_fd.h>
 
@@ -610,10 +612,7 @@ void MetadataBuilder::ExtentsToFreeList(const std::vector<Interval>& extents,
 }
 
 auto MetadataBuilder::GetFreeRegions() const -> std::vector<Interval> {
-    std::vector<Interval> free_regions;
-
-    // Collect all extents in the partition table, per-device, then sort them
-    // by starting sector.
+    // Collect all extents in the partition table, per-device.
     std::vector<std::vector<Interval>> device_extents(block_devices_.size());
     for (const auto& partition : partitions_) {
         for (const auto& extent : partition->extents()) {
@@ -627,6 +626,12 @@ auto MetadataBuilder::GetFreeRegions() const -> std::vector<Interval> {
                                  linear->physical_sector() + extent->num_sectors());
         }
     }
+    return GetFreeRegions(std::move(device_extents));
+}
+
+auto MetadataBuilder::GetFreeRegions(std::vector<std::vector<Interval>> device_extents) const
+        -> std::vector<Interval> {
+    std::vector<Interval> free_regions;
 
     // Add 0-length intervals for the first and last sectors. This will cause
     // ExtentToFreeList() to treat the space in between as available.
@@ -711,10 +716,11 @@ bool MetadataBuilder::GrowPartition(Partition* partition, uint64_t aligned_size,
     CHECK_NE(sectors_per_block, 0);
     CHECK(sectors_needed % sectors_per_block == 0);
 
+    size_t num_preferred = free_regions.size();
     if (IsABDevice() && ShouldHalveSuper() && GetPartitionSlotSuffix(partition->name()) == "_b") {
         // Allocate "a" partitions top-down and "b" partitions bottom-up, to
         // minimize fragmentation during OTA.
-        free_regions = PrioritizeSecondHalfOfSuper(free_regions);
+        free_regions = PrioritizeSecondHalfOfSuper(free_regions, &num_preferred);
     }
 
     // Note we store new extents in a temporary vector, and only commit them
@@ -729,6 +735,16 @@ bool MetadataBuilder::GrowPartition(Partition* partition, uint64_t aligned_size,
         new_extents.emplace_back(std::move(extent));
     }
 
+    if (allocation_policy_ == AllocationPolicy::kContiguous && sectors_needed) {
+        const LinearExtent* last_extent = nullptr;
+        if (!new_extents.empty()) {
+            last_extent = new_extents.back().get();
+        } else if (!partition->extents().empty()) {
+            last_extent = partition->extents().back()->AsLinearExtent();
+        }
+        PrioritizeContiguousRegion(last_extent, sectors_needed, num_preferred, &free_regions);
+    }
+
     for (auto& region : free_regions) {
         // Note: this comes first, since we may enter the loop not needing any
         // more sectors.
@@ -772,7 +788,7 @@ bool MetadataBuilder::GrowPartition(Partition* partition, uint64_t aligned_size,
 }
 
 std::vector<Interval> MetadataBuilder::PrioritizeSecondHalfOfSuper(
-        const std::vector<Interval>& free_list) {
+        const std::vector<Interval>& free_list, size_t* num_preferred) {
     const auto& super = block_devices_[0];
     uint64_t first_sector = super.first_logical_sector;
     uint64_t last_sector = super.size / LP_SECTOR_SIZE;
@@ -804,10 +820,139 @@ std::vector<Interval> MetadataBuilder::PrioritizeSecondHalfOfSuper(
             second_half.emplace_back(region);
         }
     }
+    if (num_preferred) {
+        *num_preferred = second_half.size();
+    }
     second_half.insert(second_half.end(), first_half.begin(), first_half.end());
     return second_half;
 }
 
+void MetadataBuilder::PrioritizeContiguousRegion(const LinearExtent* last_extent,
+                                                 uint64_t sectors_needed, size_t num_preferred,
+                                                 std::vector<Interval>* free_regions) const {
+    const uint64_t sectors_per_block = geometry_.logical_block_size / LP_SECTOR_SIZE;
+
+    // Look for a region in the preferred part of the list first, so that the
+    // A/B halves of super are still respected.
+    auto find_region = [&](size_t begin, size_t end) -> std::optional<size_t> {
+        std::optional<size_t> best;
+        for (size_t i = begin; i < end; i++) {
+            const auto& region = (*free_regions)[i];
+            uint64_t usable = (region.length() / sectors_per_block) * sectors_per_block;
+            if (usable < sectors_needed) {
+                continue;
+            }
+            // Continuing the last extent means no new dm-linear target at all.
+            if (last_extent && region.device_index == last_extent->device_index() &&
+                region.start == last_extent->end_sector()) {
+                return i;
+            }
+            if (!best || region.length() < (*free_regions)[*best].length()) {
+                best = i;
+            }
+        }
+        return best;
+    };
+
+    auto index = find_region(0, num_preferred);
+    if (!index) {
+        index = find_region(num_preferred, free_regions->size());
+    }
+    if (!index || *index == 0) {
+        return;
+    }
+    Interval region = (*free_regions)[*index];
+    free_regions->erase(free_regions->begin() + *index);
+    free_regions->insert(free_regions->begin(), region);
+}
+
+auto MetadataBuilder::PlanCompaction() const -> std::vector<ExtentMove> {
+    // The extents of every partition, updated as moves are planned.
+    std::map<std::string, std::vector<Interval>> extents;
+    std::vector<const Partition*> candidates;
+    for (const auto& partition : partitions_) {
+        auto& intervals = extents[partition->name()];
+        bool linear_only = true;
+        for (const auto& extent : partition->extents()) {
+            if (LinearExtent* linear = extent->AsLinearExtent()) {
+                intervals.emplace_back(linear->AsInterval());
+            } else {
+                linear_only = false;
+            }
+        }
+        if (linear_only && intervals.size() > 1) {
+            candidates.emplace_back(partition.get());
+        }
+    }
+
+    // Defragment the partitions with the most extents first, since they
+    // gain the most from the space that is free.
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Partition* a, const Partition* b) -> bool {
+                         return a->extents().size() > b->extents().size();
+                     });
+
+    std::vector<ExtentMove> moves;
+    for (const Partition* partition : candidates) {
+        std::vector<std::vector<Interval>> device_extents(block_devices_.size());
+        for (const auto& [name, intervals] : extents) {
+            for (const auto& interval : intervals) {
+                device_extents[interval.device_index].emplace_back(interval);
+            }
+        }
+
+        // Take the smallest free region that can hold the whole partition.
+        uint64_t num_sectors = partition->size() / LP_SECTOR_SIZE;
+        std::optional<Interval> best;
+        for (const auto& region : GetFreeRegions(std::move(device_extents))) {
+            if (region.length() >= num_sectors && (!best || region.length() < best->length())) {
+                best = region;
+            }
+        }
+        if (!best) {
+            continue;
+        }
+
+        Interval to(best->device_index, best->start, best->start + num_sectors);
+        auto& intervals = extents[partition->name()];
+        moves.emplace_back(ExtentMove{partition->name(), intervals, to});
+        intervals = {to};
+    }
+    return moves;
+}
+
+bool MetadataBuilder::RelocatePartition(Partition* partition, const Interval& region) {
+    if (partition->BytesOnDisk() != partition->size() ||
+        region.length() * LP_SECTOR_SIZE != partition->size()) {
+        LERROR << "Cannot relocate partition " << partition->name() << " of size "
+               << partition->size() << " to a region of " << region.length() << " sectors";
+        return false;
+    }
+    if (region.device_index >= block_devices_.size()) {
+        LERROR << "Invalid block device index " << region.device_index << " for partition "
+               << partition->name();
+        return false;
+    }
+    const auto& block_device = block_devices_[region.device_index];
+    if (region.start < block_device.first_logical_sector ||
+        region.end > block_device.size / LP_SECTOR_SIZE) {
+        LERROR << "Region " << region.start << ".." << region.end
+               << " is outside of the usable space of its block device";
+        return false;
+    }
+
+    LinearExtent candidate(region.length(), region.device_index, region.start);
+    if (IsAnyRegionAllocated(candidate)) {
+        LERROR << "Region " << region.start << ".." << region.end
+               << " is already allocated, cannot relocate " << partition->name();
+        return false;
+    }
+
+    partition->RemoveExtents();
+    partition->AddExtent(region.AsExtent());
+    return true;
+}
+
 std::unique_ptr<LinearExtent> MetadataBuilder::ExtendFinalExtent(
         Partition* partition, const std::vector<Interval>& free_list,
         uint64_t sectors_needed) const {
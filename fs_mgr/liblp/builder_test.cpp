@@ -1091,3 +1091,88 @@ TEST_F(BuilderTest, VerifyExtent) {
     ASSERT_FALSE(target_builder->VerifyExtentsAgainstSourceMetadata(
             *source_builder, 0, *target_builder, 1, std::vector<std::string>{"vendor"}));
 }
+
+// Leaves a 16KiB hole between "a" and "b", followed by "c" and free space.
+static unique_ptr<MetadataBuilder> CreateFragmentedBuilder() {
+    auto builder = MetadataBuilder::New(1_MiB, 1024, 2);
+    if (!builder) return nullptr;
+    for (const auto& name : {"a", "hole", "b", "c"}) {
+        Partition* partition = builder->AddPartition(name, 0);
+        if (!partition || !builder->ResizePartition(partition, 16_KiB)) return nullptr;
+    }
+    builder->RemovePartition("hole");
+    return builder;
+}
+
+TEST_F(BuilderTest, FirstFitAllocation) {
+    auto builder = CreateFragmentedBuilder();
+    ASSERT_NE(builder, nullptr);
+    Partition* b = builder->FindPartition("b");
+    ASSERT_NE(b, nullptr);
+
+    ASSERT_TRUE(builder->ResizePartition(b, 64_KiB));
+    EXPECT_EQ(b->extents().size(), 3);
+}
+
+TEST_F(BuilderTest, ContiguousAllocation) {
+    auto builder = CreateFragmentedBuilder();
+    ASSERT_NE(builder, nullptr);
+    builder->SetAllocationPolicy(AllocationPolicy::kContiguous);
+    Partition* b = builder->FindPartition("b");
+    ASSERT_NE(b, nullptr);
+
+    // The hole is too small, so the allocation goes to the free space at the
+    // end in one piece.
+    ASSERT_TRUE(builder->ResizePartition(b, 64_KiB));
+    EXPECT_EQ(b->extents().size(), 2);
+
+    // The hole fits the whole allocation for "c", and is preferred over the
+    // larger region at the end. It ends where "b" originally started.
+    Partition* c = builder->FindPartition("c");
+    ASSERT_NE(c, nullptr);
+    LinearExtent* original_b = b->extents()[0]->AsLinearExtent();
+    ASSERT_NE(original_b, nullptr);
+    ASSERT_TRUE(builder->ResizePartition(c, 32_KiB));
+    ASSERT_EQ(c->extents().size(), 2);
+    LinearExtent* added = c->extents()[1]->AsLinearExtent();
+    ASSERT_NE(added, nullptr);
+    EXPECT_EQ(added->end_sector(), original_b->physical_sector());
+
+    // Growing the last partition continues its final extent.
+    ASSERT_TRUE(builder->ResizePartition(b, 128_KiB));
+    EXPECT_EQ(b->extents().size(), 2);
+}
+
+TEST_F(BuilderTest, PlanCompaction) {
+    auto builder = CreateFragmentedBuilder();
+    ASSERT_NE(builder, nullptr);
+    Partition* b = builder->FindPartition("b");
+    ASSERT_NE(b, nullptr);
+    ASSERT_TRUE(builder->ResizePartition(b, 64_KiB));
+    ASSERT_EQ(b->extents().size(), 3);
+
+    auto moves = builder->PlanCompaction();
+    ASSERT_EQ(moves.size(), 1);
+    EXPECT_EQ(moves[0].partition_name, "b");
+    EXPECT_EQ(moves[0].from.size(), 3);
+    EXPECT_EQ(moves[0].to.length() * LP_SECTOR_SIZE, 64_KiB);
+    for (const auto& from : moves[0].from) {
+        EXPECT_EQ(Interval::Intersect(from, moves[0].to).length(), 0);
+    }
+
+    // Planning does not change the metadata.
+    EXPECT_EQ(b->extents().size(), 3);
+
+    ASSERT_TRUE(builder->RelocatePartition(b, moves[0].to));
+    ASSERT_EQ(b->extents().size(), 1);
+    EXPECT_EQ(b->size(), 64_KiB);
+    EXPECT_TRUE(builder->PlanCompaction().empty());
+
+    // The destination must be free and match the partition size.
+    Partition* c = builder->FindPartition("c");
+    ASSERT_NE(c, nullptr);
+    const auto& new_b = moves[0].to;
+    EXPECT_FALSE(builder->RelocatePartition(c, Interval(0, new_b.start, new_b.start + 32)));
+    const auto& old_b = moves[0].from[0];
+    EXPECT_FALSE(builder->RelocatePartition(c, Interval(0, old_b.start, old_b.start + 8)));
+}
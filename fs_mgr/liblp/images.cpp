@@ -19,6 +19,10 @@
 #include <limits.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include <android-base/file.h>
 
 #include "reader.h"
@@ -193,13 +197,7 @@ bool ImageBuilder::Export(const std::string& file) {
         LERROR << "Cannot export to a single image on retrofit builds.";
         return false;
     }
-    // No gzip compression; no checksum.
-    int ret = sparse_file_write(device_images_[0].get(), fd, false, sparsify_, false);
-    if (ret != 0) {
-        LERROR << "sparse_file_write failed (error code " << ret << ")";
-        return false;
-    }
-    return true;
+    return WriteDeviceImage(0, fd);
 }
 
 bool ImageBuilder::ExportFiles(const std::string& output_dir) {
@@ -214,16 +212,41 @@ bool ImageBuilder::ExportFiles(const std::string& output_dir) {
             PERROR << "open failed: " << file_path;
             return false;
         }
-        // No gzip compression; no checksum.
-        int ret = sparse_file_write(device_images_[i].get(), fd, false, sparsify_, false);
-        if (ret != 0) {
-            LERROR << "sparse_file_write failed (error code " << ret << ")";
+        if (!WriteDeviceImage(i, fd)) {
             return false;
         }
     }
     return true;
 }
 
+bool ImageBuilder::WriteDeviceImage(size_t index, borrowed_fd fd) {
+    // Writing a super image with large partition images takes a while, say how far along it is.
+    struct Progress {
+        std::string name;
+        int64_t last_reported = 0;
+    } progress = {GetBlockDevicePartitionName(metadata_.block_devices[index])};
+    auto report = [](void* priv, int64_t done, int64_t total) {
+        auto progress = reinterpret_cast<Progress*>(priv);
+        if (total <= 0 || (done - progress->last_reported) * 10 < total) {
+            return;
+        }
+        LINFO << "Writing " << progress->name << ": " << (done * 100 / total) << "%";
+        progress->last_reported = done;
+    };
+
+    // libsparse spreads the checksumming and I/O over threads for images this large. No gzip
+    // compression; no checksum.
+    sparse_file* file = device_images_[index].get();
+    sparse_file_set_progress(file, report, &progress);
+    int ret = sparse_file_write(file, fd.get(), false, sparsify_, false);
+    sparse_file_set_progress(file, nullptr, nullptr);
+    if (ret != 0) {
+        LERROR << "sparse_file_write failed (error code " << ret << ")";
+        return false;
+    }
+    return true;
+}
+
 bool ImageBuilder::AddData(sparse_file* file, const std::string& blob, uint64_t sector) {
     uint32_t block;
     if (!SectorToBlock(sector, &block)) {
@@ -282,14 +305,15 @@ bool ImageBuilder::Build() {
         return false;
     }
 
+    std::vector<const LpMetadataPartition*> partitions;
+    std::vector<std::string> files;
     for (const auto& partition : metadata_.partitions) {
         auto iter = images_.find(GetPartitionName(partition));
         if (iter == images_.end()) {
             continue;
         }
-        if (!AddPartitionImage(partition, iter->second)) {
-            return false;
-        }
+        partitions.emplace_back(&partition);
+        files.emplace_back(iter->second);
         images_.erase(iter);
     }
 
@@ -297,112 +321,54 @@ bool ImageBuilder::Build() {
         LERROR << "Partition image was specified but no partition was found.";
         return false;
     }
-    return true;
-}
 
-static inline bool HasFillValue(uint32_t* buffer, size_t count) {
-    uint32_t fill_value = buffer[0];
-    for (size_t i = 1; i < count; i++) {
-        if (fill_value != buffer[i]) {
+    std::vector<sparse_file*> images;
+    if (!ReadImageFiles(files, &images)) {
+        return false;
+    }
+    for (size_t i = 0; i < partitions.size(); i++) {
+        if (!AddPartitionImage(*partitions[i], images[i])) {
             return false;
         }
     }
     return true;
 }
 
-bool ImageBuilder::AddPartitionImage(const LpMetadataPartition& partition,
-                                     const std::string& file) {
-    // Track which extent we're processing.
-    uint32_t extent_index = partition.first_extent_index;
-
-    const LpMetadataExtent& extent = metadata_.extents[extent_index];
-    if (extent.target_type != LP_TARGET_TYPE_LINEAR) {
-        LERROR << "Partition should only have linear extents: " << GetPartitionName(partition);
-        return false;
-    }
-
-    int fd = OpenImageFile(file);
-    if (fd < 0) {
-        LERROR << "Could not open image for partition: " << GetPartitionName(partition);
-        return false;
-    }
-
+bool ImageBuilder::AddPartitionImage(const LpMetadataPartition& partition, sparse_file* image) {
     // Make sure the image does not exceed the partition size.
-    uint64_t file_length;
-    if (!GetDescriptorSize(fd, &file_length)) {
-        LERROR << "Could not compute image size";
-        return false;
-    }
+    uint64_t image_length = sparse_file_expanded_len(image);
     uint64_t partition_size = ComputePartitionSize(partition);
-    if (file_length > partition_size) {
+    if (image_length > partition_size) {
         LERROR << "Image for partition '" << GetPartitionName(partition)
-               << "' is greater than its size (" << file_length << ", expected " << partition_size
+               << "' is greater than its size (" << image_length << ", expected " << partition_size
                << ")";
         return false;
     }
-    if (SeekFile64(fd, 0, SEEK_SET)) {
-        PERROR << "lseek failed";
-        return false;
-    }
 
-    // We track the current logical sector and the position the current extent
-    // ends at.
-    uint64_t output_sector = 0;
-    uint64_t extent_last_sector = extent.num_sectors;
-
-    // We also track the output device and the current output block within that
-    // device.
-    uint32_t output_block;
-    if (!SectorToBlock(extent.target_data, &output_block)) {
-        return false;
-    }
-    sparse_file* output_device = device_images_[extent.target_source].get();
-
-    // Proceed to read the file and build sparse images.
-    uint64_t pos = 0;
-    uint64_t remaining = file_length;
-    while (remaining) {
-        // Check if we need to advance to the next extent.
-        if (output_sector == extent_last_sector) {
-            extent_index++;
-            if (extent_index >= partition.first_extent_index + partition.num_extents) {
-                LERROR << "image is larger than extent table";
-                return false;
-            }
-
-            const LpMetadataExtent& extent = metadata_.extents[extent_index];
-            extent_last_sector += extent.num_sectors;
-            output_device = device_images_[extent.target_source].get();
-            if (!SectorToBlock(extent.target_data, &output_block)) {
-                return false;
-            }
+    // Place each extent's share of the image's chunks, as they are, at the extent's position.
+    uint64_t image_blocks = (image_length + block_size_ - 1) / block_size_;
+    uint64_t image_block = 0;
+    for (uint32_t i = 0; i < partition.num_extents && image_block < image_blocks; i++) {
+        const LpMetadataExtent& extent = metadata_.extents[partition.first_extent_index + i];
+        if (extent.target_type != LP_TARGET_TYPE_LINEAR) {
+            LERROR << "Partition should only have linear extents: " << GetPartitionName(partition);
+            return false;
         }
 
-        uint32_t buffer[block_size_ / sizeof(uint32_t)];
-        size_t read_size = remaining >= sizeof(buffer) ? sizeof(buffer) : size_t(remaining);
-        if (!android::base::ReadFully(fd, buffer, sizeof(buffer))) {
-            PERROR << "read failed";
+        uint32_t output_block;
+        if (!SectorToBlock(extent.target_data, &output_block)) {
             return false;
         }
-        if (read_size != sizeof(buffer) || !HasFillValue(buffer, read_size / sizeof(uint32_t))) {
-            int rv = sparse_file_add_fd(output_device, fd, pos, read_size, output_block);
-            if (rv) {
-                LERROR << "sparse_file_add_fd failed with code: " << rv;
-                return false;
-            }
-        } else {
-            int rv = sparse_file_add_fill(output_device, buffer[0], read_size, output_block);
-            if (rv) {
-                LERROR << "sparse_file_add_fill failed with code: " << rv;
-                return false;
-            }
+        uint64_t extent_blocks = extent.num_sectors * LP_SECTOR_SIZE / block_size_;
+        uint64_t end_block = std::min(image_block + extent_blocks, image_blocks);
+        int rv = sparse_file_copy_blocks_to(device_images_[extent.target_source].get(),
+                                            output_block, image, image_block, end_block);
+        if (rv) {
+            LERROR << "sparse_file_copy_blocks_to failed with code: " << rv;
+            return false;
         }
-        pos += read_size;
-        remaining -= read_size;
-        output_sector += block_size_ / LP_SECTOR_SIZE;
-        output_block++;
+        image_block = end_block;
     }
-
     return true;
 }
 
@@ -442,34 +408,101 @@ bool ImageBuilder::CheckExtentOrdering() {
     return true;
 }
 
-int ImageBuilder::OpenImageFile(const std::string& file) {
+// Reads an image file into a sparse file with the given block size. Chunks of a sparse image refer
+// to the image file, and a raw image is sparsified, with the chunks holding data referring to it.
+static bool ReadImageFile(const std::string& file, uint32_t block_size, unique_fd* fd,
+                          ImageBuilder::SparsePtr* image) {
     unique_fd source_fd = GetControlFileOrOpen(file.c_str(), O_RDONLY | O_CLOEXEC | O_BINARY);
     if (source_fd < 0) {
         PERROR << "open image file failed: " << file;
-        return -1;
+        return false;
     }
 
-    SparsePtr source(sparse_file_import(source_fd, true, true), sparse_file_destroy);
-    if (!source) {
-        int fd = source_fd.get();
-        temp_fds_.push_back(std::move(source_fd));
-        return fd;
+    ImageBuilder::SparsePtr source(sparse_file_import(source_fd, true, true), sparse_file_destroy);
+    if (source && sparse_file_block_size(source.get()) == block_size) {
+        *fd = std::move(source_fd);
+        *image = std::move(source);
+        return true;
     }
-
-    TemporaryFile tf;
-    if (tf.fd < 0) {
-        PERROR << "make temporary file failed";
-        return -1;
+    if (source) {
+        // Chunks can't be placed at a different block size, so unsparse the image first.
+        TemporaryFile tf;
+        if (tf.fd < 0) {
+            PERROR << "make temporary file failed";
+            return false;
+        }
+        int rv = sparse_file_write(source.get(), tf.fd, false, false, false);
+        if (rv) {
+            LERROR << "sparse_file_write failed with code: " << rv;
+            return false;
+        }
+        source_fd.reset(tf.release());
     }
 
-    // We temporarily unsparse the file, rather than try to merge its chunks.
-    int rv = sparse_file_write(source.get(), tf.fd, false, false, false);
+    uint64_t file_length;
+    if (!GetDescriptorSize(source_fd, &file_length)) {
+        LERROR << "Could not compute image size";
+        return false;
+    }
+    if (SeekFile64(source_fd, 0, SEEK_SET)) {
+        PERROR << "lseek failed";
+        return false;
+    }
+    ImageBuilder::SparsePtr raw(sparse_file_new(block_size, file_length), sparse_file_destroy);
+    if (!raw) {
+        LERROR << "Could not allocate sparse file of size " << file_length;
+        return false;
+    }
+    int rv = sparse_file_read(raw.get(), source_fd, SPARSE_READ_MODE_NORMAL, false);
     if (rv) {
-        LERROR << "sparse_file_write failed with code: " << rv;
-        return -1;
+        LERROR << "sparse_file_read failed with code: " << rv;
+        return false;
+    }
+    *fd = std::move(source_fd);
+    *image = std::move(raw);
+    return true;
+}
+
+// Reading an image means verifying its checksum if it is sparse, or looking for blocks to sparsify
+// if it is not. Either way every byte is read, so the images are read in parallel.
+bool ImageBuilder::ReadImageFiles(const std::vector<std::string>& files,
+                                  std::vector<sparse_file*>* images) {
+    std::vector<unique_fd> fds(files.size());
+    std::vector<SparsePtr> sources;
+    for (size_t i = 0; i < files.size(); i++) {
+        sources.emplace_back(nullptr, sparse_file_destroy);
+    }
+    std::unique_ptr<bool[]> ok = std::make_unique<bool[]>(files.size());
+
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for (size_t i; (i = next.fetch_add(1)) < files.size();) {
+            ok[i] = ReadImageFile(files[i], block_size_, &fds[i], &sources[i]);
+        }
+    };
+    size_t num_threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+                                          files.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    bool success = true;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!ok[i]) {
+            LERROR << "Could not read image: " << files[i];
+            success = false;
+            continue;
+        }
+        images->emplace_back(sources[i].get());
+        temp_fds_.emplace_back(std::move(fds[i]));
+        source_images_.emplace_back(std::move(sources[i]));
     }
-    temp_fds_.push_back(android::base::unique_fd(tf.release()));
-    return temp_fds_.back().get();
+    return success;
 }
 
 bool WriteToImageFile(const std::string& file, const LpMetadata& metadata, uint32_t block_size,
@@ -18,6 +18,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <liblp/liblp.h>
@@ -48,8 +49,9 @@ class ImageBuilder {
 
   private:
     bool AddData(sparse_file* file, const std::string& blob, uint64_t sector);
-    bool AddPartitionImage(const LpMetadataPartition& partition, const std::string& file);
-    int OpenImageFile(const std::string& file);
+    bool AddPartitionImage(const LpMetadataPartition& partition, sparse_file* image);
+    bool ReadImageFiles(const std::vector<std::string>& files, std::vector<sparse_file*>* images);
+    bool WriteDeviceImage(size_t index, android::base::borrowed_fd fd);
     bool SectorToBlock(uint64_t sector, uint32_t* block);
     uint64_t BlockToSector(uint64_t block) const;
     bool CheckExtentOrdering();
@@ -63,6 +65,9 @@ class ImageBuilder {
     std::vector<SparsePtr> device_images_;
     std::string all_metadata_;
     std::map<std::string, std::string> images_;
+    // The partition images, whose chunks are added to device_images_ without being expanded, and
+    // the files they refer to.
+    std::vector<SparsePtr> source_images_;
     std::vector<android::base::unique_fd> temp_fds_;
 };
 
@@ -192,6 +192,28 @@ struct Interval {
                                            const std::vector<Interval>& b);
 };
 
+// A proposed relocation of a partition's extents into a single region, as
+// returned by MetadataBuilder::PlanCompaction().
+struct ExtentMove {
+    std::string partition_name;
+    // The partition's extents before the move, in logical order.
+    std::vector<Interval> from;
+    // The free region the partition's contents should be copied to.
+    Interval to;
+};
+
+// How free space is chosen when growing a partition.
+enum class AllocationPolicy {
+    // Use free regions in order, splitting the partition across as many
+    // regions as needed.
+    kFirstFit,
+    // Prefer a single region that can hold the whole new allocation: first
+    // one that continues the partition's last extent, otherwise the smallest
+    // region that is large enough. Falls back to kFirstFit if no region is
+    // large enough.
+    kContiguous,
+};
+
 class MetadataBuilder {
   public:
     // Construct an empty logical partition table builder given the specified
@@ -368,6 +390,22 @@ class MetadataBuilder {
     // Return the list of free regions not occupied by extents in the metadata.
     std::vector<Interval> GetFreeRegions() const;
 
+    // Set the policy used by ResizePartition() to place new extents. The
+    // default is kFirstFit.
+    void SetAllocationPolicy(AllocationPolicy policy) { allocation_policy_ = policy; }
+
+    // Propose moves that would each put a fragmented partition into a single
+    // extent, using only space that is free at that point: a partition's
+    // current extents are never overlapped by its own destination. The moves
+    // must be applied in order, since space released by one move may be used
+    // by a later one. The metadata is not modified.
+    std::vector<ExtentMove> PlanCompaction() const;
+
+    // Replace the extents of |partition| with the single region |region|,
+    // which must be free and exactly as large as the partition. The caller is
+    // responsible for copying the partition's contents to |region| first.
+    bool RelocatePartition(Partition* partition, const Interval& region);
+
     uint64_t logical_block_size() const;
 
   private:
@@ -408,7 +446,12 @@ class MetadataBuilder {
     bool IsAnyRegionAllocated(const LinearExtent& candidate) const;
     void ExtentsToFreeList(const std::vector<Interval>& extents,
                            std::vector<Interval>* free_regions) const;
-    std::vector<Interval> PrioritizeSecondHalfOfSuper(const std::vector<Interval>& free_list);
+    std::vector<Interval> GetFreeRegions(std::vector<std::vector<Interval>> device_extents) const;
+    std::vector<Interval> PrioritizeSecondHalfOfSuper(const std::vector<Interval>& free_list,
+                                                      size_t* num_preferred = nullptr);
+    void PrioritizeContiguousRegion(const LinearExtent* last_extent, uint64_t sectors_needed,
+                                    size_t num_preferred,
+                                    std::vector<Interval>* free_regions) const;
     std::unique_ptr<LinearExtent> ExtendFinalExtent(Partition* partition,
                                                     const std::vector<Interval>& free_list,
                                                     uint64_t sectors_needed) const;
@@ -422,6 +465,7 @@ class MetadataBuilder {
     std::vector<std::unique_ptr<PartitionGroup>> groups_;
     std::vector<LpMetadataBlockDevice> block_devices_;
     bool auto_slot_suffixing_;
+    AllocationPolicy allocation_policy_ = AllocationPolicy::kFirstFit;
 };
 
 // Read BlockDeviceInfo for a given block device. This always returns false
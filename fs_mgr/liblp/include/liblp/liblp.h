@@ -60,7 +60,8 @@ bool UpdatePartitionTable(const IPartitionOpener& opener, const std::string& sup
                           const LpMetadata& metadata, uint32_t slot_number);
 
 // Read logical partition metadata from its predetermined location on a block
-// device. If readback fails, we also attempt to load from a backup copy.
+// device. If readback fails, we also attempt to load from a backup copy. The
+// result is a copy of the slot held by GetMetadataView().
 std::unique_ptr<LpMetadata> ReadMetadata(const IPartitionOpener& opener,
                                          const std::string& super_partition, uint32_t slot_number);
 
@@ -70,6 +71,51 @@ bool UpdatePartitionTable(const std::string& super_partition, const LpMetadata&
                           uint32_t slot_number);
 std::unique_ptr<LpMetadata> ReadMetadata(const std::string& super_partition, uint32_t slot_number);
 
+// Every metadata slot of a super partition, read from the device in a single
+// pass over the metadata region and validated once. A view is immutable, so
+// it can be shared between threads.
+class MetadataView final {
+  public:
+    // Read and validate the whole metadata region of |fd|. Each slot falls
+    // back to its backup copy independently. Returns nullptr if the region
+    // cannot be read or neither geometry copy is valid.
+    static std::unique_ptr<MetadataView> Load(int fd);
+
+    const LpMetadataGeometry& geometry() const { return geometry_; }
+
+    // Returns the metadata of |slot_number|, with slot suffixes applied, or
+    // nullptr if the slot number is invalid or neither copy of the slot was
+    // valid.
+    const LpMetadata* GetSlot(uint32_t slot_number) const;
+
+    // Returns whether the primary geometry and the primary header of
+    // |slot_number| on |fd| are unchanged since this view was loaded. Since
+    // the header checksums the tables, this is enough to trust the cached
+    // slot. Slots that were loaded from a backup copy are never current.
+    bool IsCurrent(int fd, uint32_t slot_number) const;
+
+  private:
+    struct Slot {
+        std::unique_ptr<LpMetadata> metadata;
+        bool from_primary = false;
+        LpMetadataHeader primary_header;
+    };
+
+    MetadataView() = default;
+
+    LpMetadataGeometry geometry_;
+    bool geometry_from_primary_ = false;
+    std::unique_ptr<uint8_t[]> primary_geometry_;
+    std::vector<Slot> slots_;
+};
+
+// Returns the metadata view of |super_partition| shared by the whole process,
+// reloading it if the on-disk copy of |slot_number| changed since it was last
+// read. Returns nullptr if the metadata could not be read.
+std::shared_ptr<const MetadataView> GetMetadataView(const IPartitionOpener& opener,
+                                                    const std::string& super_partition,
+                                                    uint32_t slot_number);
+
 // Returns whether an image is an "empty" image or not. An empty image contains
 // only metadata. Unlike a flashed block device, there are no reserved bytes or
 // backup sections, and only one slot is stored (even if multiple slots are
@@ -367,6 +367,44 @@ TEST_F(LiblpTest, ReadBackupMetadata) {
     EXPECT_EQ(ReadMetadata(opener, "super", 0), nullptr);
 }
 
+// Test that the metadata view is shared until the disk changes.
+TEST_F(LiblpTest, SharedMetadataView) {
+    unique_fd fd = CreateFlashedDisk();
+    ASSERT_GE(fd, 0);
+
+    DefaultPartitionOpener opener(fd);
+
+    std::shared_ptr<const MetadataView> view = GetMetadataView(opener, "super", 0);
+    ASSERT_NE(view, nullptr);
+    EXPECT_EQ(GetMetadataView(opener, "super", 1), view);
+    EXPECT_EQ(view->GetSlot(kMetadataSlots), nullptr);
+    ASSERT_NE(view->GetSlot(1), nullptr);
+    EXPECT_EQ(view->GetSlot(1)->partitions.size(), 1);
+
+    unique_ptr<MetadataBuilder> builder = MetadataBuilder::New(*view->GetSlot(1));
+    ASSERT_NE(builder, nullptr);
+    ASSERT_NE(builder->AddPartition("vendor", LP_PARTITION_ATTR_NONE), nullptr);
+    unique_ptr<LpMetadata> exported = builder->Export();
+    ASSERT_NE(exported, nullptr);
+    ASSERT_TRUE(UpdatePartitionTable(opener, "super", *exported.get(), 1));
+
+    // Slot 0 did not change, so it is still served from the old view.
+    EXPECT_EQ(GetMetadataView(opener, "super", 0), view);
+
+    std::shared_ptr<const MetadataView> updated = GetMetadataView(opener, "super", 1);
+    ASSERT_NE(updated, nullptr);
+    EXPECT_NE(updated, view);
+    ASSERT_NE(updated->GetSlot(1), nullptr);
+    EXPECT_EQ(updated->GetSlot(1)->partitions.size(), 2);
+
+    // Views already handed out are never modified.
+    EXPECT_EQ(view->GetSlot(1)->partitions.size(), 1);
+
+    unique_ptr<LpMetadata> imported = ReadMetadata(opener, "super", 1);
+    ASSERT_NE(imported, nullptr);
+    EXPECT_EQ(imported->partitions.size(), 2);
+}
+
 // Test that we don't attempt to write metadata if it would overflow its
 // reserved space.
 TEST_F(LiblpTest, TooManyPartitions) {
@@ -627,6 +665,83 @@ TEST_F(LiblpTest, FlashSparseImage) {
     ASSERT_NE(ReadBackupMetadata(fd.get(), geometry, 0), nullptr);
 }
 
+// Test that partition images are split across the extents of their partitions, and that a sparse
+// image ends up with the same contents as a raw one.
+TEST_F(LiblpTest, BuildImageWithPartitionImages) {
+    static constexpr uint32_t kBlockSize = 4096;
+    BlockDeviceInfo device_info("super", 4 * 1024 * 1024, 0, 0, kBlockSize);
+    unique_ptr<MetadataBuilder> builder = MetadataBuilder::New(device_info, kBlockSize, 2);
+    ASSERT_NE(builder, nullptr);
+
+    // Leave "system" with two extents, by growing it past "gap" and then removing "gap".
+    Partition* vendor = builder->AddPartition("vendor", LP_PARTITION_ATTR_NONE);
+    ASSERT_NE(vendor, nullptr);
+    ASSERT_TRUE(builder->ResizePartition(vendor, 4 * kBlockSize));
+    Partition* system = builder->AddPartition("system", LP_PARTITION_ATTR_NONE);
+    ASSERT_NE(system, nullptr);
+    ASSERT_TRUE(builder->ResizePartition(system, 4 * kBlockSize));
+    Partition* gap = builder->AddPartition("gap", LP_PARTITION_ATTR_NONE);
+    ASSERT_NE(gap, nullptr);
+    ASSERT_TRUE(builder->ResizePartition(gap, 2 * kBlockSize));
+    ASSERT_TRUE(builder->ResizePartition(system, 10 * kBlockSize));
+    builder->RemovePartition("gap");
+
+    unique_ptr<LpMetadata> exported = builder->Export();
+    ASSERT_NE(exported, nullptr);
+    ASSERT_EQ(exported->partitions.size(), static_cast<size_t>(2));
+    ASSERT_EQ(exported->partitions[1].num_extents, static_cast<uint32_t>(2));
+
+    // Blocks of zeroes, of a fill value, and of data, with a partial block at the end.
+    string system_data(9 * kBlockSize + 100, '\0');
+    for (size_t i = 0; i < system_data.size(); i++) {
+        size_t block = i / kBlockSize;
+        system_data[i] = (block % 3 == 0) ? 0 : (block % 3 == 1) ? 0x5a : static_cast<char>(i);
+    }
+    TemporaryFile system_image;
+    ASSERT_TRUE(android::base::WriteStringToFd(system_data, system_image.fd));
+
+    string vendor_data(3 * kBlockSize, '\0');
+    for (size_t i = 0; i < vendor_data.size(); i++) {
+        vendor_data[i] = static_cast<char>(i * 7);
+    }
+    TemporaryFile vendor_image;
+    {
+        ImageBuilder::SparsePtr vendor_sparse(sparse_file_new(kBlockSize, vendor_data.size()),
+                                              sparse_file_destroy);
+        ASSERT_NE(vendor_sparse, nullptr);
+        ASSERT_EQ(sparse_file_add_data(vendor_sparse.get(), vendor_data.data(), vendor_data.size(),
+                                       0),
+                  0);
+        ASSERT_EQ(sparse_file_write(vendor_sparse.get(), vendor_image.fd, false, true, false), 0);
+    }
+
+    ImageBuilder image(*exported.get(), kBlockSize,
+                       {{"system", system_image.path}, {"vendor", vendor_image.path}}, false);
+    ASSERT_TRUE(image.IsValid());
+    ASSERT_TRUE(image.Build());
+    ASSERT_EQ(image.device_images().size(), static_cast<size_t>(1));
+
+    TemporaryFile super_image;
+    ASSERT_EQ(sparse_file_write(image.device_images()[0].get(), super_image.fd, false, false, false),
+              0);
+
+    auto read_partition = [&](const LpMetadataPartition& partition, size_t size) -> string {
+        string data;
+        for (uint32_t i = 0; i < partition.num_extents && data.size() < size; i++) {
+            const auto& extent = exported->extents[partition.first_extent_index + i];
+            string buffer(min<size_t>(extent.num_sectors * LP_SECTOR_SIZE, size - data.size()), '\0');
+            if (!android::base::ReadFullyAtOffset(super_image.fd, buffer.data(), buffer.size(),
+                                                  extent.target_data * LP_SECTOR_SIZE)) {
+                return {};
+            }
+            data += buffer;
+        }
+        return data;
+    };
+    EXPECT_EQ(read_partition(exported->partitions[0], vendor_data.size()), vendor_data);
+    EXPECT_EQ(read_partition(exported->partitions[1], system_data.size()), system_data);
+}
+
 TEST_F(LiblpTest, AutoSlotSuffixing) {
     unique_ptr<MetadataBuilder> builder = CreateDefaultBuilder();
     ASSERT_NE(builder, nullptr);
@@ -22,6 +22,8 @@
 #include <unistd.h>
 
 #include <functional>
+#include <map>
+#include <mutex>
 
 #include <android-base/file.h>
 #include <android-base/unique_fd.h>
@@ -436,42 +438,151 @@ bool AdjustMetadataForSlot(LpMetadata* metadata, uint32_t slot_number) {
 
 }  // namespace
 
-std::unique_ptr<LpMetadata> ReadMetadata(const IPartitionOpener& opener,
-                                         const std::string& super_partition, uint32_t slot_number) {
-    android::base::unique_fd fd = opener.Open(super_partition, O_RDONLY);
-    if (fd < 0) {
-        PERROR << __PRETTY_FUNCTION__ << " open failed: " << super_partition;
+std::unique_ptr<MetadataView> MetadataView::Load(int fd) {
+    // The reserved area and both geometry copies come first, followed by the
+    // primary and backup copies of every slot. The geometry is needed to know
+    // how large the rest is, so the region is read in two passes.
+    const size_t geometry_region_size = LP_PARTITION_RESERVED_BYTES + LP_METADATA_GEOMETRY_SIZE * 2;
+    std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(geometry_region_size);
+    if (SeekFile64(fd, 0, SEEK_SET) < 0) {
+        PERROR << __PRETTY_FUNCTION__ << " lseek failed";
+        return nullptr;
+    }
+    if (!android::base::ReadFully(fd, buffer.get(), geometry_region_size)) {
+        PERROR << __PRETTY_FUNCTION__ << " read " << geometry_region_size << " bytes failed";
         return nullptr;
     }
 
-    LpMetadataGeometry geometry;
-    if (!ReadLogicalPartitionGeometry(fd, &geometry)) {
+    std::unique_ptr<MetadataView> view(new MetadataView());
+    view->primary_geometry_ = std::make_unique<uint8_t[]>(LP_METADATA_GEOMETRY_SIZE);
+    memcpy(view->primary_geometry_.get(), buffer.get() + GetPrimaryGeometryOffset(),
+           LP_METADATA_GEOMETRY_SIZE);
+    view->geometry_from_primary_ =
+            ParseGeometry(buffer.get() + GetPrimaryGeometryOffset(), &view->geometry_);
+    if (!view->geometry_from_primary_ &&
+        !ParseGeometry(buffer.get() + GetBackupGeometryOffset(), &view->geometry_)) {
         return nullptr;
     }
-    if (slot_number >= geometry.metadata_slot_count) {
-        LERROR << __PRETTY_FUNCTION__ << " invalid metadata slot number";
+
+    const LpMetadataGeometry& geometry = view->geometry_;
+    uint64_t slots_size = uint64_t(geometry.metadata_max_size) * geometry.metadata_slot_count * 2;
+    if (slots_size > SIZE_MAX) {
+        LERROR << "Logical partition metadata region is too large: " << slots_size;
+        return nullptr;
+    }
+    std::unique_ptr<uint8_t[]> slots(new (std::nothrow) uint8_t[slots_size]);
+    if (!slots) {
+        LERROR << "Out of memory reading logical partition metadata.";
+        return nullptr;
+    }
+    if (!android::base::ReadFully(fd, slots.get(), slots_size)) {
+        PERROR << __PRETTY_FUNCTION__ << " read " << slots_size << " bytes failed";
         return nullptr;
     }
 
-    std::vector<int64_t> offsets = {
-            GetPrimaryMetadataOffset(geometry, slot_number),
-            GetBackupMetadataOffset(geometry, slot_number),
-    };
-    std::unique_ptr<LpMetadata> metadata;
+    view->slots_.resize(geometry.metadata_slot_count);
+    for (uint32_t slot_number = 0; slot_number < geometry.metadata_slot_count; slot_number++) {
+        const uint8_t* primary =
+                slots.get() + GetPrimaryMetadataOffset(geometry, slot_number) - geometry_region_size;
+        const uint8_t* backup =
+                slots.get() + GetBackupMetadataOffset(geometry, slot_number) - geometry_region_size;
 
-    for (const auto& offset : offsets) {
-        if (SeekFile64(fd, offset, SEEK_SET) < 0) {
-            PERROR << __PRETTY_FUNCTION__ << " lseek failed, offset " << offset;
-            continue;
+        Slot& slot = view->slots_[slot_number];
+        memcpy(&slot.primary_header, primary, sizeof(slot.primary_header));
+        slot.metadata = ParseMetadata(geometry, primary, geometry.metadata_max_size);
+        slot.from_primary = slot.metadata != nullptr;
+        if (!slot.metadata) {
+            slot.metadata = ParseMetadata(geometry, backup, geometry.metadata_max_size);
         }
-        if ((metadata = ParseMetadata(geometry, fd)) != nullptr) {
-            break;
+        if (slot.metadata && !AdjustMetadataForSlot(slot.metadata.get(), slot_number)) {
+            slot.metadata = nullptr;
         }
     }
-    if (!metadata || !AdjustMetadataForSlot(metadata.get(), slot_number)) {
+    return view;
+}
+
+const LpMetadata* MetadataView::GetSlot(uint32_t slot_number) const {
+    if (slot_number >= slots_.size()) {
         return nullptr;
     }
-    return metadata;
+    return slots_[slot_number].metadata.get();
+}
+
+bool MetadataView::IsCurrent(int fd, uint32_t slot_number) const {
+    if (!geometry_from_primary_ || slot_number >= slots_.size() ||
+        !slots_[slot_number].from_primary) {
+        return false;
+    }
+
+    std::unique_ptr<uint8_t[]> geometry = std::make_unique<uint8_t[]>(LP_METADATA_GEOMETRY_SIZE);
+    if (SeekFile64(fd, GetPrimaryGeometryOffset(), SEEK_SET) < 0 ||
+        !android::base::ReadFully(fd, geometry.get(), LP_METADATA_GEOMETRY_SIZE)) {
+        return false;
+    }
+    if (memcmp(geometry.get(), primary_geometry_.get(), LP_METADATA_GEOMETRY_SIZE) != 0) {
+        return false;
+    }
+
+    LpMetadataHeader header;
+    if (SeekFile64(fd, GetPrimaryMetadataOffset(geometry_, slot_number), SEEK_SET) < 0 ||
+        !android::base::ReadFully(fd, &header, sizeof(header))) {
+        return false;
+    }
+    return memcmp(&header, &slots_[slot_number].primary_header, sizeof(header)) == 0;
+}
+
+static std::mutex gMetadataViewsLock;
+static std::map<std::string, std::shared_ptr<const MetadataView>> gMetadataViews;
+
+std::shared_ptr<const MetadataView> GetMetadataView(const IPartitionOpener& opener,
+                                                    const std::string& super_partition,
+                                                    uint32_t slot_number) {
+    android::base::unique_fd fd = opener.Open(super_partition, O_RDONLY);
+    if (fd < 0) {
+        PERROR << __PRETTY_FUNCTION__ << " open failed: " << super_partition;
+        return nullptr;
+    }
+
+    std::shared_ptr<const MetadataView> view;
+    {
+        std::lock_guard<std::mutex> lock(gMetadataViewsLock);
+        if (auto iter = gMetadataViews.find(super_partition); iter != gMetadataViews.end()) {
+            view = iter->second;
+        }
+    }
+    // The disk is compared outside the lock, since other threads only need it
+    // to look up or replace the view.
+    if (view && view->IsCurrent(fd, slot_number)) {
+        return view;
+    }
+
+    view = MetadataView::Load(fd);
+
+    std::lock_guard<std::mutex> lock(gMetadataViewsLock);
+    if (view) {
+        gMetadataViews[super_partition] = view;
+    } else {
+        gMetadataViews.erase(super_partition);
+    }
+    return view;
+}
+
+std::unique_ptr<LpMetadata> ReadMetadata(const IPartitionOpener& opener,
+                                         const std::string& super_partition, uint32_t slot_number) {
+    std::shared_ptr<const MetadataView> view =
+            GetMetadataView(opener, super_partition, slot_number);
+    if (!view) {
+        return nullptr;
+    }
+    if (slot_number >= view->geometry().metadata_slot_count) {
+        LERROR << __PRETTY_FUNCTION__ << " invalid metadata slot number";
+        return nullptr;
+    }
+    const LpMetadata* metadata = view->GetSlot(slot_number);
+    if (!metadata) {
+        return nullptr;
+    }
+    return std::make_unique<LpMetadata>(*metadata);
 }
 
 std::unique_ptr<LpMetadata> ReadMetadata(const std::string& super_partition, uint32_t slot_number) {
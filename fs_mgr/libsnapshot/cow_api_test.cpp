@@ -354,6 +354,63 @@ TEST_F(CowTest, CompressTwoBlocks) {
     ASSERT_TRUE(reader.ReadData(*op, &sink));
 }
 
+TEST_F(CowTest, CompressMultiThreaded) {
+    CowOptions options;
+    options.compression = "gz";
+    options.num_compress_threads = 4;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    const size_t num_blocks = 37;
+    std::string data;
+    for (size_t i = 0; i < num_blocks; i++) {
+        std::string block = "Block number " + std::to_string(i);
+        block.resize(options.block_size, static_cast<char>(i));
+        data += block;
+    }
+
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddXorBlocks(100, data.data(), data.size(), 24, 10));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+
+    StringSink sink;
+    size_t replace_blocks = 0;
+    size_t xor_blocks = 0;
+    while (!iter->Done()) {
+        auto op = &iter->Get();
+        if (op->type == kCowReplaceOp) {
+            ASSERT_EQ(op->compression, kCowCompressGz);
+            ASSERT_EQ(op->new_block, 50 + replace_blocks);
+            sink.Reset();
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(), data.substr(replace_blocks * options.block_size,
+                                                 options.block_size));
+            replace_blocks++;
+        } else if (op->type == kCowXorOp) {
+            ASSERT_EQ(op->compression, kCowCompressGz);
+            ASSERT_EQ(op->new_block, 100 + xor_blocks);
+            ASSERT_EQ(op->source, (24 + xor_blocks) * options.block_size + 10);
+            sink.Reset();
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(),
+                      data.substr(xor_blocks * options.block_size, options.block_size));
+            xor_blocks++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(replace_blocks, num_blocks);
+    ASSERT_EQ(xor_blocks, num_blocks);
+}
+
 // Only return 1-byte buffers, to stress test the partial read logic in
 // CowReader.
 class HorribleStringSink : public StringSink {
@@ -392,8 +449,312 @@ TEST_P(CompressionTest, HorribleSink) {
     ASSERT_EQ(sink.stream(), data);
 }
 
+TEST_P(CompressionTest, MmapReader) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.cluster_ops = 4;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data;
+    for (size_t i = 0; i < 6; i++) {
+        std::string block = "Mapped block " + std::to_string(i);
+        block.resize(options.block_size, static_cast<char>(i));
+        data += block;
+    }
+
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddLabel(1));
+    ASSERT_TRUE(writer.AddZeroBlocks(60, 3));
+    ASSERT_TRUE(writer.AddCopy(70, 10));
+    ASSERT_TRUE(writer.AddLabel(2));
+    ASSERT_TRUE(writer.Finalize());
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    CowReader mapped(CowReader::ReaderFlags::USERSPACE_MERGE | CowReader::ReaderFlags::MMAP);
+    ASSERT_TRUE(mapped.Parse(cow_->fd));
+    auto clone = mapped.CloneCowReader();
+
+    // Ops must be identical whichever way they were read, including cluster ops.
+    auto iter = reader.GetOpIter();
+    auto mapped_iter = clone->GetOpIter();
+    size_t num_ops = 0;
+    while (!iter->Done()) {
+        ASSERT_FALSE(mapped_iter->Done());
+        ASSERT_EQ(memcmp(&iter->Get(), &mapped_iter->Get(), sizeof(CowOperation)), 0);
+
+        StringSink sink, mapped_sink;
+        if (iter->Get().type == kCowReplaceOp) {
+            ASSERT_TRUE(reader.ReadData(iter->Get(), &sink));
+            ASSERT_TRUE(clone->ReadData(mapped_iter->Get(), &mapped_sink));
+            ASSERT_EQ(sink.stream(), mapped_sink.stream());
+        }
+        iter->Next();
+        mapped_iter->Next();
+        num_ops++;
+    }
+    ASSERT_TRUE(mapped_iter->Done());
+    ASSERT_GT(num_ops, options.cluster_ops);
+
+    // Walk the mapped ops backwards, too.
+    while (!mapped_iter->RDone()) {
+        mapped_iter->Prev();
+        num_ops--;
+    }
+    ASSERT_EQ(num_ops, 0);
+
+    auto merge_iter = mapped.GetMergeOpIter();
+    size_t replace_ops = 0;
+    while (!merge_iter->Done()) {
+        auto op = &merge_iter->Get();
+        if (op->type == kCowReplaceOp) {
+            HorribleStringSink sink;
+            ASSERT_TRUE(mapped.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(),
+                      data.substr((op->new_block - 50) * options.block_size, options.block_size));
+            replace_ops++;
+        }
+        merge_iter->Next();
+    }
+    ASSERT_EQ(replace_ops, 6);
+}
+
 INSTANTIATE_TEST_SUITE_P(CowApi, CompressionTest, testing::Values("none", "gz", "brotli"));
 
+TEST_F(CowTest, CompressZstdDictionary) {
+    CowOptions options;
+    options.compression = "zstd";
+    options.compression_level = 9;
+    options.compression_dictionary = "This is some data, believe it. More data!";
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data = "This is some data, believe it";
+    data.resize(options.block_size, '\0');
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    CowHeader header;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+    ASSERT_TRUE(reader.GetHeader(&header));
+    ASSERT_EQ(header.header_size, sizeof(CowHeader) + options.compression_dictionary.size());
+
+    std::string dictionary;
+    ASSERT_TRUE(reader.GetCompressionDictionary(&dictionary));
+    ASSERT_EQ(dictionary, options.compression_dictionary);
+
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+    ASSERT_FALSE(iter->Done());
+    auto op = &iter->Get();
+
+    StringSink sink;
+    ASSERT_EQ(op->type, kCowReplaceOp);
+    ASSERT_EQ(op->compression, kCowCompressZstd);
+    ASSERT_EQ(op->new_block, 50);
+    ASSERT_TRUE(reader.ReadData(*op, &sink));
+    ASSERT_EQ(sink.stream(), data);
+}
+
+TEST_F(CowTest, DictionaryRequiresZstd) {
+    CowOptions options;
+    options.compression = "gz";
+    options.compression_dictionary = "dictionary";
+    CowWriter writer(options);
+    ASSERT_FALSE(writer.Initialize(cow_->fd));
+}
+
+TEST_F(CowTest, CompressionUnits) {
+    CowOptions options;
+    options.compression = "gz";
+    options.compression_factor = 4;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    // Two full units plus a remainder which is compressed block by block.
+    const size_t num_blocks = 10;
+    std::string data;
+    for (size_t i = 0; i < num_blocks; i++) {
+        std::string block = "Block number " + std::to_string(i);
+        block.resize(options.block_size, static_cast<char>(i));
+        data += block;
+    }
+
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    CowHeader header;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+    ASSERT_TRUE(reader.GetHeader(&header));
+    ASSERT_EQ(header.minor_version, kCowVersionMinorCompressionUnits);
+
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+
+    StringSink sink;
+    size_t blocks = 0;
+    while (!iter->Done()) {
+        auto op = &iter->Get();
+        if (op->type == kCowReplaceOp) {
+            ASSERT_EQ(GetCompressionAlgorithm(*op), kCowCompressGz);
+            ASSERT_EQ(GetCompressionUnitBlocks(*op), blocks < 8 ? 4u : 1u);
+            ASSERT_EQ(op->new_block, 50 + blocks);
+            sink.Reset();
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(),
+                      data.substr(blocks * options.block_size, options.block_size));
+            blocks++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(blocks, num_blocks);
+
+    // Random access across units must still return the right block.
+    auto merge_iter = reader.GetMergeOpIter();
+    while (!merge_iter->Done()) {
+        auto op = &merge_iter->Get();
+        HorribleStringSink horrible_sink;
+        ASSERT_TRUE(reader.ReadData(*op, &horrible_sink));
+        ASSERT_EQ(horrible_sink.stream(),
+                  data.substr((op->new_block - 50) * options.block_size, options.block_size));
+        merge_iter->Next();
+    }
+}
+
+TEST_F(CowTest, InvalidCompressionFactor) {
+    CowOptions options;
+    options.compression = "gz";
+    options.compression_factor = 3;
+    CowWriter writer(options);
+    ASSERT_FALSE(writer.Initialize(cow_->fd));
+}
+
+TEST_F(CowTest, DetectZeroBlocks) {
+    CowOptions options;
+    options.compression = "gz";
+    options.cluster_ops = 0;
+    options.detect_zero_blocks = true;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data = "This is some data, believe it";
+    data.resize(options.block_size, '\0');
+    std::string zero(options.block_size, '\0');
+    std::string blocks = data + zero + zero + data + zero;
+
+    ASSERT_TRUE(writer.AddRawBlocks(50, blocks.data(), blocks.size()));
+    ASSERT_TRUE(writer.Finalize());
+    ASSERT_EQ(writer.GetNumDetectedZeroBlocks(), 3);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    std::vector<uint8_t> expected = {kCowReplaceOp, kCowZeroOp, kCowZeroOp, kCowReplaceOp,
+                                     kCowZeroOp};
+    auto iter = reader.GetOpIter();
+    for (size_t i = 0; i < expected.size(); i++) {
+        ASSERT_FALSE(iter->Done());
+        auto op = &iter->Get();
+        ASSERT_EQ(op->type, expected[i]);
+        ASSERT_EQ(op->new_block, 50 + i);
+        if (op->type == kCowReplaceOp) {
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(), data);
+        }
+        iter->Next();
+    }
+    ASSERT_TRUE(iter->Done());
+}
+
+TEST_F(CowTest, DetectZeroBlocksDisabled) {
+    CowOptions options;
+    options.cluster_ops = 0;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string zero(options.block_size * 2, '\0');
+    ASSERT_TRUE(writer.AddRawBlocks(50, zero.data(), zero.size()));
+    ASSERT_TRUE(writer.Finalize());
+    ASSERT_EQ(writer.GetNumDetectedZeroBlocks(), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    auto iter = reader.GetOpIter();
+    size_t num_ops = 0;
+    while (!iter->Done()) {
+        ASSERT_EQ(iter->Get().type, kCowReplaceOp);
+        iter->Next();
+        num_ops++;
+    }
+    ASSERT_EQ(num_ops, 2);
+}
+
+TEST_F(CowTest, QueuedWrites) {
+    CowOptions options;
+    options.compression = "lz4";
+    options.cluster_ops = 4;
+    options.write_queue_depth = 4;
+    auto writer = std::make_unique<CowWriter>(options);
+
+    ASSERT_TRUE(writer->Initialize(cow_->fd));
+
+    const size_t num_blocks = 20;
+    std::string data;
+    for (size_t i = 0; i < num_blocks; i++) {
+        std::string block = "Queued block " + std::to_string(i);
+        block.resize(options.block_size, static_cast<char>(i));
+        data += block;
+    }
+
+    // Queued writes must be durable at each label, so that appending can
+    // resume from it.
+    ASSERT_TRUE(writer->AddRawBlocks(50, data.data(), data.size() / 2));
+    ASSERT_TRUE(writer->AddLabel(1));
+    ASSERT_TRUE(writer->AddCopy(10, 20));
+    ASSERT_TRUE(writer->AddLabel(2));
+
+    writer = std::make_unique<CowWriter>(options);
+    ASSERT_TRUE(writer->InitializeAppend(cow_->fd, 1));
+    ASSERT_TRUE(writer->AddRawBlocks(50 + num_blocks / 2, data.data() + data.size() / 2,
+                                     data.size() / 2));
+    ASSERT_TRUE(writer->Finalize());
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    auto iter = reader.GetOpIter();
+    size_t blocks = 0;
+    while (!iter->Done()) {
+        auto op = &iter->Get();
+        ASSERT_NE(op->type, kCowCopyOp);
+        if (op->type == kCowReplaceOp) {
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(op->new_block, 50 + blocks);
+            ASSERT_EQ(sink.stream(),
+                      data.substr(blocks * options.block_size, options.block_size));
+            blocks++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(blocks, num_blocks);
+}
+
 TEST_F(CowTest, GetSize) {
     CowOptions options;
     options.cluster_ops = 0;
@@ -779,6 +1140,53 @@ TEST_F(CowTest, ClusterTest) {
     ASSERT_TRUE(iter->Done());
 }
 
+TEST_F(CowTest, ClusterPrefetch) {
+    CowOptions options;
+    options.compression = "gz";
+    options.cluster_ops = 4;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    const size_t num_blocks = 10;
+    std::string data;
+    for (size_t i = 0; i < num_blocks; i++) {
+        std::string block = "Prefetched block " + std::to_string(i);
+        block.resize(options.block_size, static_cast<char>(i));
+        data += block;
+    }
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+    reader.SetClusterPrefetch(true);
+
+    std::vector<CowOperation> ops;
+    auto iter = reader.GetOpIter();
+    while (!iter->Done()) {
+        if (iter->Get().type == kCowReplaceOp) {
+            ops.emplace_back(iter->Get());
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(ops.size(), num_blocks);
+
+    // Read in COW order, then out of order so that clusters are refetched.
+    std::vector<size_t> order(num_blocks);
+    std::iota(order.begin(), order.end(), 0);
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (auto i : order) {
+            const auto& op = ops[i];
+            HorribleStringSink sink;
+            ASSERT_TRUE(reader.ReadData(op, &sink));
+            ASSERT_EQ(sink.stream(),
+                      data.substr((op.new_block - 50) * options.block_size, options.block_size));
+        }
+        std::reverse(order.begin(), order.end());
+    }
+}
+
 TEST_F(CowTest, ClusterAppendTest) {
     CowOptions options;
     options.cluster_ops = 3;
@@ -1211,6 +1619,122 @@ TEST_F(CowTest, RevMergeOpItrTest) {
     ASSERT_TRUE(iter->Done());
 }
 
+TEST_F(CowTest, DeferredMergePrep) {
+    CowOptions options;
+    options.cluster_ops = 5;
+    options.num_merge_ops = 1;
+    CowWriter writer(options);
+    uint32_t sequence[] = {2, 10, 6, 7, 3, 5};
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data = "This is some data, believe it";
+    data.resize(options.block_size, '\0');
+
+    ASSERT_TRUE(writer.AddSequenceData(6, sequence));
+    ASSERT_TRUE(writer.AddCopy(6, 13));
+    ASSERT_TRUE(writer.AddRawBlocks(12, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddCopy(3, 15));
+    ASSERT_TRUE(writer.AddCopy(2, 11));
+    ASSERT_TRUE(writer.AddZeroBlocks(4, 1));
+    ASSERT_TRUE(writer.AddCopy(5, 16));
+    ASSERT_TRUE(writer.AddCopy(10, 12));
+    ASSERT_TRUE(writer.AddCopy(7, 14));
+    ASSERT_TRUE(writer.Finalize());
+
+    CowReader reader(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    CowReader deferred(CowReader::ReaderFlags::USERSPACE_MERGE |
+                       CowReader::ReaderFlags::DEFER_MERGE_PREP);
+    ASSERT_TRUE(deferred.Parse(cow_->fd));
+
+    // Data can be read while merge ops are still being prepared.
+    auto iter = deferred.GetOpIter();
+    while (!iter->Done() && iter->Get().type != kCowReplaceOp) {
+        iter->Next();
+    }
+    ASSERT_FALSE(iter->Done());
+    StringSink sink;
+    ASSERT_TRUE(deferred.ReadData(iter->Get(), &sink));
+    ASSERT_EQ(sink.stream(), data);
+
+    ASSERT_TRUE(deferred.WaitForMergeOps());
+    ASSERT_EQ(deferred.get_num_total_data_ops(), reader.get_num_total_data_ops());
+    ASSERT_EQ(deferred.get_num_ordered_ops_to_merge(), reader.get_num_ordered_ops_to_merge());
+
+    auto merge_iter = reader.GetMergeOpIter();
+    auto deferred_iter = deferred.CloneCowReader()->GetMergeOpIter();
+    ASSERT_NE(deferred_iter, nullptr);
+    while (!merge_iter->Done()) {
+        ASSERT_FALSE(deferred_iter->Done());
+        ASSERT_EQ(merge_iter->Get().new_block, deferred_iter->Get().new_block);
+        merge_iter->Next();
+        deferred_iter->Next();
+    }
+    ASSERT_TRUE(deferred_iter->Done());
+}
+
+TEST_F(CowTest, ExportImportParsedState) {
+    CowOptions options;
+    options.cluster_ops = 5;
+    CowWriter writer(options);
+    uint32_t sequence[] = {2, 10, 6, 7, 3, 5};
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data = "This is some data, believe it";
+    data.resize(options.block_size, '\0');
+
+    ASSERT_TRUE(writer.AddSequenceData(6, sequence));
+    ASSERT_TRUE(writer.AddCopy(6, 13));
+    ASSERT_TRUE(writer.AddRawBlocks(12, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddCopy(3, 15));
+    ASSERT_TRUE(writer.AddCopy(2, 11));
+    ASSERT_TRUE(writer.AddZeroBlocks(4, 1));
+    ASSERT_TRUE(writer.AddCopy(5, 16));
+    ASSERT_TRUE(writer.AddCopy(10, 12));
+    ASSERT_TRUE(writer.AddCopy(7, 14));
+    ASSERT_TRUE(writer.Finalize());
+
+    CowReader reader(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    TemporaryFile state;
+    ASSERT_TRUE(reader.ExportParsedState(state.fd));
+
+    ASSERT_EQ(lseek(state.fd, 0, SEEK_SET), 0);
+    CowReader imported(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(imported.ImportParsedState(cow_->fd, state.fd));
+    ASSERT_EQ(imported.get_num_total_data_ops(), reader.get_num_total_data_ops());
+    ASSERT_EQ(imported.get_num_ordered_ops_to_merge(), reader.get_num_ordered_ops_to_merge());
+
+    auto merge_iter = reader.GetMergeOpIter();
+    auto imported_iter = imported.GetMergeOpIter();
+    while (!merge_iter->Done()) {
+        ASSERT_FALSE(imported_iter->Done());
+        ASSERT_EQ(merge_iter->Get().type, imported_iter->Get().type);
+        ASSERT_EQ(merge_iter->Get().new_block, imported_iter->Get().new_block);
+        if (imported_iter->Get().type == kCowReplaceOp) {
+            StringSink sink;
+            ASSERT_TRUE(imported.ReadData(imported_iter->Get(), &sink));
+            ASSERT_EQ(sink.stream(), data);
+        }
+        merge_iter->Next();
+        imported_iter->Next();
+    }
+    ASSERT_TRUE(imported_iter->Done());
+
+    // State exported from a COW which has changed since is not used.
+    CowHeader header;
+    ASSERT_TRUE(reader.GetHeader(&header));
+    header.num_merge_ops = 1;
+    ASSERT_TRUE(android::base::WriteFullyAtOffset(cow_->fd, &header, sizeof(header), 0));
+    ASSERT_EQ(lseek(state.fd, 0, SEEK_SET), 0);
+    CowReader stale(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_FALSE(stale.ImportParsedState(cow_->fd, state.fd));
+}
+
 TEST_F(CowTest, LegacyRevMergeOpItrTest) {
     CowOptions options;
     options.cluster_ops = 5;
@@ -1260,6 +1784,41 @@ TEST_F(CowTest, LegacyRevMergeOpItrTest) {
     ASSERT_TRUE(iter->Done());
 }
 
+TEST(CowOpIndexTest, Lookup) {
+    CowOpIndex<uint32_t, uint64_t> index;
+    // Unsorted, sparse, with a duplicate key.
+    index.Add(40, 4);
+    index.Add(10, 1);
+    index.Add(1000000, 7);
+    index.Add(20, 2);
+    index.Add(10, 100);
+    index.Add(30, 3);
+    index.Finalize();
+
+    ASSERT_EQ(index.size(), 5);
+    ASSERT_NE(index.Find(10), nullptr);
+    // The first entry for a key wins.
+    ASSERT_EQ(*index.Find(10), 1);
+    ASSERT_EQ(*index.Find(20), 2);
+    ASSERT_EQ(*index.Find(30), 3);
+    ASSERT_EQ(*index.Find(40), 4);
+    ASSERT_EQ(*index.Find(1000000), 7);
+    ASSERT_EQ(index.Find(0), nullptr);
+    ASSERT_EQ(index.Find(25), nullptr);
+    ASSERT_EQ(index.Find(2000000), nullptr);
+
+    CowOpIndex<uint32_t, uint32_t> dense;
+    for (uint32_t i = 0; i < 10000; i++) {
+        dense.Add(i * 3, i);
+    }
+    dense.Finalize();
+    for (uint32_t i = 0; i < 10000; i++) {
+        ASSERT_NE(dense.Find(i * 3), nullptr);
+        ASSERT_EQ(*dense.Find(i * 3), i);
+        ASSERT_EQ(dense.Find(i * 3 + 1), nullptr);
+    }
+}
+
 TEST_F(CowTest, InvalidMergeOrderTest) {
     CowOptions options;
     options.cluster_ops = 5;
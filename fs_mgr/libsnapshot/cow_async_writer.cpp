@@ -0,0 +1,185 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "cow_async_writer.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+
+#ifdef __ANDROID__
+#include <liburing.h>
+#else
+// Never instantiated; only here so that |ring_| can be destroyed.
+struct io_uring {};
+#endif
+
+namespace android {
+namespace snapshot {
+
+CowAsyncWriter::CowAsyncWriter(android::base::borrowed_fd fd, uint32_t queue_depth)
+    : fd_(fd), queue_depth_(queue_depth) {}
+
+std::unique_ptr<CowAsyncWriter> CowAsyncWriter::Open(android::base::borrowed_fd fd,
+                                                     uint32_t queue_depth) {
+    if (!queue_depth) {
+        return nullptr;
+    }
+    std::unique_ptr<CowAsyncWriter> writer(new CowAsyncWriter(fd, queue_depth));
+    if (!writer->Init()) {
+        return nullptr;
+    }
+    return writer;
+}
+
+#ifdef __ANDROID__
+
+bool CowAsyncWriter::Init() {
+    ring_ = std::make_unique<struct io_uring>();
+    int ret = io_uring_queue_init(queue_depth_, ring_.get(), 0);
+    if (ret) {
+        LOG(ERROR) << "io_uring_queue_init failed with ret: " << ret;
+        return false;
+    }
+    ring_initialized_ = true;
+
+    requests_.resize(queue_depth_);
+    for (size_t i = 0; i < queue_depth_; i++) {
+        free_slots_.emplace_back(queue_depth_ - i - 1);
+    }
+    LOG(INFO) << "COW writes use io_uring with queue depth: " << queue_depth_;
+    return true;
+}
+
+CowAsyncWriter::~CowAsyncWriter() {
+    if (ring_initialized_) {
+        Flush();
+        io_uring_queue_exit(ring_.get());
+    }
+}
+
+bool CowAsyncWriter::Write(const void* data, size_t size, uint64_t offset) {
+    if (free_slots_.empty() && !ReapOne()) {
+        return false;
+    }
+
+    size_t slot = free_slots_.back();
+    free_slots_.pop_back();
+
+    auto& request = requests_[slot];
+    request.data.assign(reinterpret_cast<const uint8_t*>(data), size);
+    request.offset = offset;
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+    if (!sqe) {
+        LOG(ERROR) << "io_uring_get_sqe failed";
+        return false;
+    }
+    io_uring_prep_write(sqe, fd_.get(), request.data.data(), request.data.size(), offset);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(slot));
+    unsubmitted_++;
+    return true;
+}
+
+bool CowAsyncWriter::Submit() {
+    if (!unsubmitted_) {
+        return true;
+    }
+    int ret = io_uring_submit(ring_.get());
+    if (ret < 0) {
+        LOG(ERROR) << "io_uring_submit failed with ret: " << ret;
+        return false;
+    }
+    in_flight_ += ret;
+    unsubmitted_ -= ret;
+    return true;
+}
+
+bool CowAsyncWriter::ReapOne() {
+    // Keep the device busy with anything queued since the last submission.
+    if (!Submit()) {
+        return false;
+    }
+    if (!in_flight_) {
+        LOG(ERROR) << "No io_uring writes in flight";
+        return false;
+    }
+
+    struct io_uring_cqe* cqe;
+    int ret = io_uring_wait_cqe(ring_.get(), &cqe);
+    if (ret) {
+        LOG(ERROR) << "io_uring_wait_cqe failed: " << ret;
+        return false;
+    }
+    auto slot = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+    int res = cqe->res;
+    io_uring_cqe_seen(ring_.get(), cqe);
+    in_flight_--;
+
+    // Short or failed writes (for example, on kernels without
+    // IORING_OP_WRITE) are completed synchronously.
+    auto& request = requests_[slot];
+    size_t written = res > 0 ? res : 0;
+    if (written < request.data.size() &&
+        !android::base::WriteFullyAtOffset(fd_, request.data.data() + written,
+                                           request.data.size() - written,
+                                           request.offset + written)) {
+        PLOG(ERROR) << "write failed at offset " << request.offset << ", io_uring res: " << res;
+        return false;
+    }
+    free_slots_.emplace_back(slot);
+    return true;
+}
+
+bool CowAsyncWriter::Flush() {
+    if (!Submit()) {
+        return false;
+    }
+    while (in_flight_) {
+        if (!ReapOne()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#else
+
+bool CowAsyncWriter::Init() {
+    return false;
+}
+
+CowAsyncWriter::~CowAsyncWriter() {}
+
+bool CowAsyncWriter::Write(const void*, size_t, uint64_t) {
+    return false;
+}
+
+bool CowAsyncWriter::Submit() {
+    return false;
+}
+
+bool CowAsyncWriter::ReapOne() {
+    return false;
+}
+
+bool CowAsyncWriter::Flush() {
+    return false;
+}
+
+#endif
+
+}  // namespace snapshot
+}  // namespace android
@@ -0,0 +1,75 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+struct io_uring;
+
+namespace android {
+namespace snapshot {
+
+// Queues positional writes to a COW with io_uring, so that up to
+// |queue_depth| writes are in flight at once. Data is copied into the
+// queue, so callers may reuse their buffers as soon as Write() returns.
+//
+// Writes are only guaranteed to have reached the file after Flush().
+class CowAsyncWriter final {
+  public:
+    // Returns nullptr if io_uring is not available, in which case the caller
+    // should write synchronously.
+    static std::unique_ptr<CowAsyncWriter> Open(android::base::borrowed_fd fd,
+                                                uint32_t queue_depth);
+
+    ~CowAsyncWriter();
+
+    bool Write(const void* data, size_t size, uint64_t offset);
+
+    // Submit all queued writes and wait for them to complete.
+    bool Flush();
+
+  private:
+    struct Request {
+        std::basic_string<uint8_t> data;
+        uint64_t offset = 0;
+    };
+
+    CowAsyncWriter(android::base::borrowed_fd fd, uint32_t queue_depth);
+
+    bool Init();
+    bool Submit();
+    bool ReapOne();
+
+    android::base::borrowed_fd fd_;
+    uint32_t queue_depth_;
+    std::unique_ptr<struct io_uring> ring_;
+    bool ring_initialized_ = false;
+
+    std::vector<Request> requests_;
+    std::vector<size_t> free_slots_;
+    size_t unsubmitted_ = 0;
+    size_t in_flight_ = 0;
+};
+
+}  // namespace snapshot
+}  // namespace android
@@ -0,0 +1,482 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for the COW path: the op indexes, CowWriter, CowReader and the
+// decompressors. Synthetic data is generated on the fly. To also measure a
+// real COW, for example one produced by make_cow_from_ab_ota, pass
+// --cow_file=<path>.
+//
+// For results that can be tracked across releases, use google-benchmark's
+// JSON output:
+//   libsnapshot_cow_benchmark --benchmark_out=cow.json --benchmark_out_format=json
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <libsnapshot/cow_reader.h>
+#include <libsnapshot/cow_writer.h>
+
+#include "cow_compress.h"
+#include "cow_decompress.h"
+
+namespace android {
+namespace snapshot {
+
+using android::base::unique_fd;
+
+// A 6GiB partition has ~1.5M 4KiB blocks.
+static constexpr uint32_t kNumBlocks = 1572864;
+
+static size_t HeapUsage() {
+    struct mallinfo info = mallinfo();
+    return info.uordblks;
+}
+
+static std::vector<uint32_t> ShuffledBlocks(size_t count) {
+    std::vector<uint32_t> blocks(count);
+    for (uint32_t i = 0; i < count; i++) {
+        blocks[i] = i;
+    }
+    std::shuffle(blocks.begin(), blocks.end(), std::mt19937(0));
+    return blocks;
+}
+
+static void BM_BlockMap_UnorderedMap(benchmark::State& state) {
+    auto blocks = ShuffledBlocks(state.range(0));
+
+    size_t heap_before = HeapUsage();
+    std::unordered_map<uint32_t, int> map;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        map.insert({blocks[i], i});
+    }
+    state.counters["heap_bytes"] = HeapUsage() - heap_before;
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.at(blocks[i]));
+        i = (i + 1) % blocks.size();
+    }
+}
+BENCHMARK(BM_BlockMap_UnorderedMap)->Arg(kNumBlocks / 16)->Arg(kNumBlocks);
+
+static void BM_BlockMap_CowOpIndex(benchmark::State& state) {
+    auto blocks = ShuffledBlocks(state.range(0));
+
+    size_t heap_before = HeapUsage();
+    CowOpIndex<uint32_t, uint32_t> index;
+    index.reserve(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+        index.Add(blocks[i], i);
+    }
+    index.Finalize();
+    state.counters["heap_bytes"] = HeapUsage() - heap_before;
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.Find(blocks[i]));
+        i = (i + 1) % blocks.size();
+    }
+}
+BENCHMARK(BM_BlockMap_CowOpIndex)->Arg(kNumBlocks / 16)->Arg(kNumBlocks);
+
+static void BM_DataLoc_UnorderedMap(benchmark::State& state) {
+    auto blocks = ShuffledBlocks(state.range(0));
+
+    size_t heap_before = HeapUsage();
+    std::unordered_map<uint64_t, uint64_t> map;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        map.insert({blocks[i], i * 4096});
+    }
+    state.counters["heap_bytes"] = HeapUsage() - heap_before;
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.at(blocks[i]));
+        i = (i + 1) % blocks.size();
+    }
+}
+BENCHMARK(BM_DataLoc_UnorderedMap)->Arg(kNumBlocks / 16)->Arg(kNumBlocks);
+
+static void BM_DataLoc_CowOpIndex(benchmark::State& state) {
+    auto blocks = ShuffledBlocks(state.range(0));
+
+    size_t heap_before = HeapUsage();
+    CowOpIndex<uint32_t, uint64_t> index;
+    index.reserve(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+        index.Add(blocks[i], i * 4096);
+    }
+    index.Finalize();
+    state.counters["heap_bytes"] = HeapUsage() - heap_before;
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.Find(blocks[i]));
+        i = (i + 1) % blocks.size();
+    }
+}
+BENCHMARK(BM_DataLoc_CowOpIndex)->Arg(kNumBlocks / 16)->Arg(kNumBlocks);
+
+static constexpr uint32_t kBlockSize = 4096;
+
+struct Algorithm {
+    const char* name;
+    CowCompressionAlgorithm type;
+};
+
+static const Algorithm kAlgorithms[] = {
+        {"none", kCowCompressNone}, {"gz", kCowCompressGz},     {"brotli", kCowCompressBrotli},
+        {"lz4", kCowCompressLz4},   {"zstd", kCowCompressZstd},
+};
+
+static void AllAlgorithms(benchmark::internal::Benchmark* b) {
+    for (size_t i = 0; i < std::size(kAlgorithms); i++) {
+        b->Arg(i);
+    }
+}
+
+// Roughly mimic a filesystem image: mostly text-like blocks which compress
+// a few times over, and some incompressible ones.
+static std::string SyntheticBlocks(size_t num_blocks) {
+    static const char* kWords[] = {"system", "vendor", "lib", "android", "so", "apk",
+                                   "0000",   "ffff",   "/",   "\n",       ".",  "_"};
+    std::mt19937 rng(0);
+    std::string data;
+    data.reserve(num_blocks * kBlockSize);
+    for (size_t i = 0; i < num_blocks; i++) {
+        std::string block;
+        if (i % 8 == 7) {
+            while (block.size() < kBlockSize) {
+                block.push_back(static_cast<char>(rng()));
+            }
+        } else {
+            while (block.size() < kBlockSize) {
+                block += kWords[rng() % std::size(kWords)];
+            }
+        }
+        block.resize(kBlockSize);
+        data += block;
+    }
+    return data;
+}
+
+static bool WriteCow(android::base::borrowed_fd fd, const char* compression,
+                     const std::string& data) {
+    CowOptions options;
+    options.compression = compression;
+    options.scratch_space = false;
+    CowWriter writer(options);
+    if (ftruncate(fd.get(), 0) < 0 || !writer.Initialize(fd)) {
+        return false;
+    }
+    return writer.AddRawBlocks(0, data.data(), data.size()) && writer.Finalize();
+}
+
+// Discards data, reusing one buffer.
+class DiscardSink final : public IByteSink {
+  public:
+    void* GetBuffer(size_t requested, size_t* actual) override {
+        if (buffer_.size() < requested) {
+            buffer_.resize(requested);
+        }
+        *actual = requested;
+        return buffer_.data();
+    }
+    bool ReturnData(void*, size_t) override { return true; }
+
+  private:
+    std::basic_string<uint8_t> buffer_;
+};
+
+class BufferStream final : public IByteStream {
+  public:
+    explicit BufferStream(const std::basic_string<uint8_t>& data) : data_(data) {}
+
+    bool Read(void* buffer, size_t length, size_t* read) override {
+        *read = std::min(length, data_.size() - pos_);
+        memcpy(buffer, data_.data() + pos_, *read);
+        pos_ += *read;
+        return true;
+    }
+    size_t Size() const override { return data_.size(); }
+
+  private:
+    const std::basic_string<uint8_t>& data_;
+    size_t pos_ = 0;
+};
+
+static std::vector<CowOperation> GetReplaceOps(CowReader* reader) {
+    std::vector<CowOperation> ops;
+    auto iter = reader->GetOpIter();
+    while (!iter->Done()) {
+        if (iter->Get().type == kCowReplaceOp) {
+            ops.emplace_back(iter->Get());
+        }
+        iter->Next();
+    }
+    return ops;
+}
+
+static void BM_CowWriter(benchmark::State& state) {
+    const auto& algorithm = kAlgorithms[state.range(0)];
+    const size_t num_blocks = 256;
+    auto data = SyntheticBlocks(num_blocks);
+
+    TemporaryFile file;
+    for (auto _ : state) {
+        if (!WriteCow(file.fd, algorithm.name, data)) {
+            state.SkipWithError("Failed to write COW");
+            return;
+        }
+    }
+    state.SetLabel(algorithm.name);
+    state.SetItemsProcessed(state.iterations() * num_blocks);
+    state.SetBytesProcessed(state.iterations() * data.size());
+    state.counters["cow_bytes"] = lseek(file.fd, 0, SEEK_END);
+}
+BENCHMARK(BM_CowWriter)->Apply(AllAlgorithms)->Unit(benchmark::kMillisecond);
+
+static void BM_CowReaderParse(benchmark::State& state) {
+    const size_t num_ops = state.range(0);
+    auto block = SyntheticBlocks(1);
+
+    // Parse time depends on the op count, so most ops are copies, which
+    // carry no data.
+    TemporaryFile file;
+    CowOptions options;
+    options.compression = "lz4";
+    options.scratch_space = false;
+    CowWriter writer(options);
+    if (!writer.Initialize(android::base::borrowed_fd{file.fd})) {
+        state.SkipWithError("Failed to create COW");
+        return;
+    }
+    for (size_t i = 0; i < num_ops; i++) {
+        bool ok = (i % 16) ? writer.AddCopy(i, num_ops + i)
+                           : writer.AddRawBlocks(i, block.data(), block.size());
+        if (!ok) {
+            state.SkipWithError("Failed to write COW");
+            return;
+        }
+    }
+    if (!writer.Finalize()) {
+        state.SkipWithError("Failed to finalize COW");
+        return;
+    }
+
+    for (auto _ : state) {
+        CowReader reader;
+        if (!reader.Parse(android::base::borrowed_fd{file.fd})) {
+            state.SkipWithError("Failed to parse COW");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * num_ops);
+}
+BENCHMARK(BM_CowReaderParse)->RangeMultiplier(8)->Range(512, 262144)->Unit(benchmark::kMillisecond);
+
+static void ReadDataBenchmark(benchmark::State& state, bool random) {
+    const auto& algorithm = kAlgorithms[state.range(0)];
+    auto data = SyntheticBlocks(4096);
+
+    TemporaryFile file;
+    CowReader reader;
+    if (!WriteCow(file.fd, algorithm.name, data) ||
+        !reader.Parse(android::base::borrowed_fd{file.fd})) {
+        state.SkipWithError("Failed to create COW");
+        return;
+    }
+    auto ops = GetReplaceOps(&reader);
+    if (random) {
+        std::shuffle(ops.begin(), ops.end(), std::mt19937(0));
+    }
+
+    DiscardSink sink;
+    size_t i = 0;
+    for (auto _ : state) {
+        if (!reader.ReadData(ops[i], &sink)) {
+            state.SkipWithError("Failed to read data");
+            return;
+        }
+        i = (i + 1) % ops.size();
+    }
+    state.SetLabel(algorithm.name);
+    state.SetBytesProcessed(state.iterations() * kBlockSize);
+}
+
+static void BM_ReadData_Sequential(benchmark::State& state) {
+    ReadDataBenchmark(state, false);
+}
+BENCHMARK(BM_ReadData_Sequential)->Apply(AllAlgorithms);
+
+static void BM_ReadData_Random(benchmark::State& state) {
+    ReadDataBenchmark(state, true);
+}
+BENCHMARK(BM_ReadData_Random)->Apply(AllAlgorithms);
+
+static std::unique_ptr<IDecompressor> CreateDecompressor(CowCompressionAlgorithm type) {
+    switch (type) {
+        case kCowCompressNone:
+            return IDecompressor::Uncompressed();
+        case kCowCompressGz:
+            return IDecompressor::Gz();
+        case kCowCompressBrotli:
+            return IDecompressor::Brotli();
+        case kCowCompressLz4:
+            return IDecompressor::Lz4();
+        case kCowCompressZstd:
+            return IDecompressor::Zstd();
+        default:
+            return nullptr;
+    }
+}
+
+static void BM_Decompress(benchmark::State& state) {
+    const auto& algorithm = kAlgorithms[state.range(0)];
+    const size_t num_blocks = 256;
+    auto data = SyntheticBlocks(num_blocks);
+
+    std::vector<std::basic_string<uint8_t>> compressed;
+    if (algorithm.type == kCowCompressNone) {
+        for (size_t i = 0; i < num_blocks; i++) {
+            auto block = reinterpret_cast<const uint8_t*>(data.data()) + i * kBlockSize;
+            compressed.emplace_back(block, kBlockSize);
+        }
+    } else {
+        auto compressor = ICompressor::Create(algorithm.type, 0, {});
+        if (!compressor || !CompressWorker::CompressBlocks(compressor.get(), kBlockSize,
+                                                           data.data(), num_blocks, &compressed)) {
+            state.SkipWithError("Failed to compress");
+            return;
+        }
+    }
+
+    DiscardSink sink;
+    size_t i = 0;
+    size_t compressed_bytes = 0;
+    for (auto _ : state) {
+        BufferStream stream(compressed[i]);
+        auto decompressor = CreateDecompressor(algorithm.type);
+        decompressor->set_stream(&stream);
+        decompressor->set_sink(&sink);
+        if (!decompressor->Decompress(kBlockSize)) {
+            state.SkipWithError("Failed to decompress");
+            return;
+        }
+        compressed_bytes += compressed[i].size();
+        i = (i + 1) % compressed.size();
+    }
+    state.SetLabel(algorithm.name);
+    state.SetBytesProcessed(state.iterations() * kBlockSize);
+    state.counters["ratio"] =
+            static_cast<double>(state.iterations() * kBlockSize) / std::max<size_t>(compressed_bytes, 1);
+}
+BENCHMARK(BM_Decompress)->Apply(AllAlgorithms);
+
+static void BM_RealCow_Parse(benchmark::State& state, const std::string& path) {
+    unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        state.SkipWithError("Failed to open COW");
+        return;
+    }
+    size_t num_ops = 0;
+    for (auto _ : state) {
+        CowReader reader;
+        if (!reader.Parse(android::base::borrowed_fd{fd})) {
+            state.SkipWithError("Failed to parse COW");
+            return;
+        }
+        CowFooter footer;
+        num_ops = reader.GetFooter(&footer) ? footer.op.num_ops : 0;
+    }
+    state.counters["ops"] = num_ops;
+}
+
+static void BM_RealCow_ReadData(benchmark::State& state, const std::string& path, bool random) {
+    unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    CowReader reader;
+    if (fd < 0 || !reader.Parse(android::base::borrowed_fd{fd})) {
+        state.SkipWithError("Failed to open COW");
+        return;
+    }
+    auto ops = GetReplaceOps(&reader);
+    if (ops.empty()) {
+        state.SkipWithError("COW has no replace ops");
+        return;
+    }
+    if (random) {
+        std::shuffle(ops.begin(), ops.end(), std::mt19937(0));
+    }
+
+    CowHeader header;
+    reader.GetHeader(&header);
+
+    DiscardSink sink;
+    size_t i = 0;
+    for (auto _ : state) {
+        if (!reader.ReadData(ops[i], &sink)) {
+            state.SkipWithError("Failed to read data");
+            return;
+        }
+        i = (i + 1) % ops.size();
+    }
+    state.SetBytesProcessed(state.iterations() * header.block_size);
+}
+
+}  // namespace snapshot
+}  // namespace android
+
+int main(int argc, char** argv) {
+    using namespace android::snapshot;
+
+    android::base::SetMinimumLogSeverity(android::base::ERROR);
+
+    std::string cow_file;
+    static constexpr char kCowFileFlag[] = "--cow_file=";
+    int new_argc = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind(kCowFileFlag, 0) == 0) {
+            cow_file = arg.substr(strlen(kCowFileFlag));
+        } else {
+            argv[new_argc++] = argv[i];
+        }
+    }
+    argc = new_argc;
+
+    if (!cow_file.empty()) {
+        benchmark::RegisterBenchmark("BM_RealCow_Parse", BM_RealCow_Parse, cow_file)
+                ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark("BM_RealCow_ReadData_Sequential", BM_RealCow_ReadData,
+                                     cow_file, false);
+        benchmark::RegisterBenchmark("BM_RealCow_ReadData_Random", BM_RealCow_ReadData, cow_file,
+                                     true);
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,334 @@
+//
+// Copyright (C) 2020 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <limits>
+#include <queue>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <brotli/encode.h>
+#include <libsnapshot/cow_format.h>
+#include <libsnapshot/cow_reader.h>
+#include <libsnapshot/cow_writer.h>
+#include <lz4.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "cow_compress.h"
+
+namespace android {
+namespace snapshot {
+
+class GzCompressor final : public ICompressor {
+  public:
+    explicit GzCompressor(int level) : level_(level ? level : Z_BEST_COMPRESSION) {}
+
+    std::basic_string<uint8_t> Compress(const void* data, size_t length) override {
+        const auto bound = compressBound(length);
+        std::basic_string<uint8_t> buffer(bound, '\0');
+
+        uLongf dest_len = bound;
+        auto rv = compress2(buffer.data(), &dest_len, reinterpret_cast<const Bytef*>(data), length,
+                            level_);
+        if (rv != Z_OK) {
+            LOG(ERROR) << "compress2 returned: " << rv;
+            return {};
+        }
+        buffer.resize(dest_len);
+        return buffer;
+    }
+
+  private:
+    int level_;
+};
+
+class BrotliCompressor final : public ICompressor {
+  public:
+    explicit BrotliCompressor(int level) : level_(level ? level : BROTLI_DEFAULT_QUALITY) {}
+
+    std::basic_string<uint8_t> Compress(const void* data, size_t length) override {
+        const auto bound = BrotliEncoderMaxCompressedSize(length);
+        if (!bound) {
+            LOG(ERROR) << "BrotliEncoderMaxCompressedSize returned 0";
+            return {};
+        }
+        std::basic_string<uint8_t> buffer(bound, '\0');
+
+        size_t encoded_size = bound;
+        auto rv = BrotliEncoderCompress(level_, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE, length,
+                                        reinterpret_cast<const uint8_t*>(data), &encoded_size,
+                                        buffer.data());
+        if (!rv) {
+            LOG(ERROR) << "BrotliEncoderCompress failed";
+            return {};
+        }
+        buffer.resize(encoded_size);
+        return buffer;
+    }
+
+  private:
+    int level_;
+};
+
+class Lz4Compressor final : public ICompressor {
+  public:
+    std::basic_string<uint8_t> Compress(const void* data, size_t length) override {
+        const auto bound = LZ4_compressBound(length);
+        if (!bound) {
+            LOG(ERROR) << "LZ4_compressBound returned 0";
+            return {};
+        }
+        std::basic_string<uint8_t> buffer(bound, '\0');
+
+        const auto compressed_size =
+                LZ4_compress_default(static_cast<const char*>(data),
+                                     reinterpret_cast<char*>(buffer.data()), length, buffer.size());
+        if (compressed_size <= 0) {
+            LOG(ERROR) << "LZ4_compress_default failed, input size: " << length
+                       << ", compression bound: " << bound << ", ret: " << compressed_size;
+            return {};
+        }
+        buffer.resize(compressed_size);
+        return buffer;
+    }
+};
+
+class ZstdCompressor final : public ICompressor {
+  public:
+    ZstdCompressor(int level, const std::string& dictionary)
+        : level_(level ? level : ZSTD_CLEVEL_DEFAULT),
+          context_(ZSTD_createCCtx(), ZSTD_freeCCtx),
+          dictionary_(nullptr, ZSTD_freeCDict) {
+        if (!dictionary.empty()) {
+            dictionary_.reset(ZSTD_createCDict(dictionary.data(), dictionary.size(), level_));
+        }
+    }
+
+    bool Init(bool has_dictionary) {
+        if (!context_) {
+            LOG(ERROR) << "ZSTD_createCCtx failed";
+            return false;
+        }
+        if (has_dictionary && !dictionary_) {
+            LOG(ERROR) << "ZSTD_createCDict failed";
+            return false;
+        }
+        return true;
+    }
+
+    std::basic_string<uint8_t> Compress(const void* data, size_t length) override {
+        const auto bound = ZSTD_compressBound(length);
+        std::basic_string<uint8_t> buffer(bound, '\0');
+
+        size_t compressed_size;
+        if (dictionary_) {
+            compressed_size = ZSTD_compress_usingCDict(context_.get(), buffer.data(), buffer.size(),
+                                                       data, length, dictionary_.get());
+        } else {
+            compressed_size = ZSTD_compressCCtx(context_.get(), buffer.data(), buffer.size(), data,
+                                                length, level_);
+        }
+        if (ZSTD_isError(compressed_size)) {
+            LOG(ERROR) << "ZSTD compression failed: " << ZSTD_getErrorName(compressed_size);
+            return {};
+        }
+        buffer.resize(compressed_size);
+        return buffer;
+    }
+
+  private:
+    int level_;
+    std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context_;
+    std::unique_ptr<ZSTD_CDict, decltype(&ZSTD_freeCDict)> dictionary_;
+};
+
+std::unique_ptr<ICompressor> ICompressor::Gz() {
+    return std::make_unique<GzCompressor>(0);
+}
+
+std::unique_ptr<ICompressor> ICompressor::Brotli() {
+    return std::make_unique<BrotliCompressor>(0);
+}
+
+std::unique_ptr<ICompressor> ICompressor::Lz4() {
+    return std::make_unique<Lz4Compressor>();
+}
+
+std::unique_ptr<ICompressor> ICompressor::Zstd(int level, const std::string& dictionary) {
+    if (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()) {
+        LOG(ERROR) << "Invalid zstd compression level: " << level;
+        return nullptr;
+    }
+    auto compressor = std::make_unique<ZstdCompressor>(level, dictionary);
+    if (!compressor->Init(!dictionary.empty())) {
+        return nullptr;
+    }
+    return compressor;
+}
+
+std::unique_ptr<ICompressor> ICompressor::Create(CowCompressionAlgorithm compression, int level,
+                                                 const std::string& dictionary) {
+    switch (compression) {
+        case kCowCompressGz:
+            if (level < 0 || level > Z_BEST_COMPRESSION) {
+                LOG(ERROR) << "Invalid gz compression level: " << level;
+                return nullptr;
+            }
+            return std::make_unique<GzCompressor>(level);
+        case kCowCompressBrotli:
+            if (level < 0 || level > BROTLI_MAX_QUALITY) {
+                LOG(ERROR) << "Invalid brotli compression level: " << level;
+                return nullptr;
+            }
+            return std::make_unique<BrotliCompressor>(level);
+        case kCowCompressLz4:
+            return Lz4();
+        case kCowCompressZstd:
+            return Zstd(level, dictionary);
+        default:
+            LOG(ERROR) << "unhandled compression type: " << compression;
+            return nullptr;
+    }
+}
+
+bool CompressWorker::CompressBlocks(const void* buffer, size_t num_blocks,
+                                    std::vector<std::basic_string<uint8_t>>* compressed_data) {
+    return CompressBlocks(compressor_.get(), block_size_, buffer, num_blocks, compressed_data);
+}
+
+bool CompressWorker::CompressBlocks(ICompressor* compressor, size_t block_size,
+                                    const void* buffer, size_t num_blocks,
+                                    std::vector<std::basic_string<uint8_t>>* compressed_data) {
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(buffer);
+    while (num_blocks) {
+        auto data = compressor->Compress(iter, block_size);
+        if (data.empty()) {
+            PLOG(ERROR) << "CompressBlocks: Compression failed";
+            return false;
+        }
+        if (data.size() > std::numeric_limits<uint16_t>::max()) {
+            LOG(ERROR) << "Compressed block is too large: " << data.size();
+            return false;
+        }
+
+        compressed_data->emplace_back(std::move(data));
+        num_blocks -= 1;
+        iter += block_size;
+    }
+    return true;
+}
+
+bool CompressWorker::RunThread() {
+    while (true) {
+        // Wait for work
+        CompressWork blocks;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            while (work_queue_.empty() && !stopped_) {
+                cv_.wait(lock);
+            }
+
+            if (stopped_) {
+                return true;
+            }
+
+            blocks = std::move(work_queue_.front());
+            work_queue_.pop();
+        }
+
+        // Compress blocks
+        bool ret = CompressBlocks(blocks.buffer, blocks.num_blocks, &blocks.compressed_data);
+        blocks.compression_status = ret;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            compressed_queue_.push(std::move(blocks));
+        }
+
+        // Notify completion
+        cv_.notify_all();
+
+        if (!ret) {
+            LOG(ERROR) << "CompressBlocks failed";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CompressWorker::EnqueueCompressBlocks(const void* buffer, size_t num_blocks) {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+
+        CompressWork blocks = {};
+        blocks.buffer = buffer;
+        blocks.num_blocks = num_blocks;
+        work_queue_.push(std::move(blocks));
+    }
+    cv_.notify_all();
+}
+
+bool CompressWorker::GetCompressedBuffers(std::vector<std::basic_string<uint8_t>>* compressed_buf) {
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (compressed_queue_.empty() && !stopped_) {
+            cv_.wait(lock);
+        }
+
+        if (stopped_) {
+            return true;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        while (compressed_queue_.size() > 0) {
+            CompressWork blocks = std::move(compressed_queue_.front());
+            compressed_queue_.pop();
+
+            if (blocks.compression_status) {
+                compressed_buf->insert(compressed_buf->end(),
+                                       std::make_move_iterator(blocks.compressed_data.begin()),
+                                       std::make_move_iterator(blocks.compressed_data.end()));
+            } else {
+                LOG(ERROR) << "Block compression failed";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void CompressWorker::Finalize() {
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        stopped_ = true;
+    }
+    cv_.notify_all();
+}
+
+CompressWorker::CompressWorker(std::unique_ptr<ICompressor>&& compressor, uint32_t block_size)
+    : compressor_(std::move(compressor)), block_size_(block_size) {}
+
+CompressWorker::~CompressWorker() {}
+
+}  // namespace snapshot
+}  // namespace android
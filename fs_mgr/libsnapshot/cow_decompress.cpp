@@ -16,16 +16,37 @@
 
 #include "cow_decompress.h"
 
+#include <string.h>
+
 #include <utility>
 
 #include <android-base/logging.h>
 #include <brotli/decode.h>
 #include <lz4.h>
 #include <zlib.h>
+#include <zstd.h>
 
 namespace android {
 namespace snapshot {
 
+// Return the entire stream, without copying it if the stream is mapped.
+// Otherwise, the stream is read into |storage|.
+static const uint8_t* ReadWholeStream(IByteStream* stream, std::string* storage, size_t* length) {
+    if (auto data = stream->Peek(length); data && *length == stream->Size()) {
+        return data;
+    }
+    storage->resize(stream->Size());
+    size_t bytes_read = 0;
+    stream->Read(storage->data(), storage->size(), &bytes_read);
+    if (bytes_read != storage->size()) {
+        LOG(ERROR) << "Failed to read all input at once. Expected: " << storage->size()
+                   << " actual: " << bytes_read;
+        return nullptr;
+    }
+    *length = storage->size();
+    return reinterpret_cast<const uint8_t*>(storage->data());
+}
+
 class NoDecompressor final : public IDecompressor {
   public:
     bool Decompress(size_t) override;
@@ -33,6 +54,30 @@ class NoDecompressor final : public IDecompressor {
 
 bool NoDecompressor::Decompress(size_t) {
     size_t stream_remaining = stream_->Size();
+
+    // A mapped stream can be copied straight into the sink.
+    size_t mapped_length;
+    const uint8_t* mapped = stream_->Peek(&mapped_length);
+    if (mapped && mapped_length == stream_remaining) {
+        while (stream_remaining) {
+            size_t buffer_size = stream_remaining;
+            void* buffer = sink_->GetBuffer(buffer_size, &buffer_size);
+            if (!buffer) {
+                LOG(ERROR) << "Could not acquire buffer from sink";
+                return false;
+            }
+            size_t to_copy = std::min(buffer_size, stream_remaining);
+            memcpy(buffer, mapped, to_copy);
+            if (!sink_->ReturnData(buffer, to_copy)) {
+                LOG(ERROR) << "Could not return buffer to sink";
+                return false;
+            }
+            mapped += to_copy;
+            stream_remaining -= to_copy;
+        }
+        return true;
+    }
+
     while (stream_remaining) {
         size_t buffer_size = stream_remaining;
         uint8_t* buffer = reinterpret_cast<uint8_t*>(sink_->GetBuffer(buffer_size, &buffer_size));
@@ -97,6 +142,15 @@ bool StreamDecompressor::Decompress(size_t output_bytes) {
     stream_remaining_ = stream_->Size();
     output_bytes_ = output_bytes;
 
+    // A mapped stream can be handed to the decoder in one piece.
+    size_t mapped_length;
+    if (auto mapped = stream_->Peek(&mapped_length); mapped && mapped_length == stream_remaining_) {
+        if (!DecompressInput(mapped, mapped_length)) {
+            return false;
+        }
+        stream_remaining_ = 0;
+    }
+
     uint8_t chunk[kChunkSize];
     while (stream_remaining_) {
         size_t read = std::min(stream_remaining_, sizeof(chunk));
@@ -274,17 +328,14 @@ class Lz4Decompressor final : public IDecompressor {
             return false;
         }
         std::string input_buffer;
-        input_buffer.resize(stream_->Size());
-        size_t bytes_read = 0;
-        stream_->Read(input_buffer.data(), input_buffer.size(), &bytes_read);
-        if (bytes_read != input_buffer.size()) {
-            LOG(ERROR) << "Failed to read all input at once. Expected: " << input_buffer.size()
-                       << " actual: " << bytes_read;
+        size_t input_size;
+        const uint8_t* input = ReadWholeStream(stream_, &input_buffer, &input_size);
+        if (!input) {
             return false;
         }
         const int bytes_decompressed =
-                LZ4_decompress_safe(input_buffer.data(), static_cast<char*>(output_buffer),
-                                    input_buffer.size(), output_size);
+                LZ4_decompress_safe(reinterpret_cast<const char*>(input),
+                                    static_cast<char*>(output_buffer), input_size, output_size);
         if (bytes_decompressed != output_size) {
             LOG(ERROR) << "Failed to decompress LZ4 block, expected output size: " << output_size
                        << ", actual: " << bytes_decompressed;
@@ -299,5 +350,61 @@ std::unique_ptr<IDecompressor> IDecompressor::Lz4() {
     return std::make_unique<Lz4Decompressor>();
 }
 
+class ZstdDecompressor final : public IDecompressor {
+  public:
+    explicit ZstdDecompressor(const std::string* dictionary)
+        : dictionary_(dictionary), context_(ZSTD_createDCtx(), ZSTD_freeDCtx) {}
+
+    bool Decompress(const size_t output_size) override {
+        if (!context_) {
+            LOG(ERROR) << "ZSTD_createDCtx failed";
+            return false;
+        }
+        size_t actual_buffer_size = 0;
+        auto&& output_buffer = sink_->GetBuffer(output_size, &actual_buffer_size);
+        if (actual_buffer_size != output_size) {
+            LOG(ERROR) << "Failed to allocate buffer of size " << output_size << " only got "
+                       << actual_buffer_size << " bytes";
+            return false;
+        }
+        std::string input_buffer;
+        size_t input_size;
+        const uint8_t* input = ReadWholeStream(stream_, &input_buffer, &input_size);
+        if (!input) {
+            return false;
+        }
+
+        size_t bytes_decompressed;
+        if (dictionary_ && !dictionary_->empty()) {
+            bytes_decompressed = ZSTD_decompress_usingDict(
+                    context_.get(), output_buffer, output_size, input, input_size,
+                    dictionary_->data(), dictionary_->size());
+        } else {
+            bytes_decompressed = ZSTD_decompressDCtx(context_.get(), output_buffer, output_size,
+                                                     input, input_size);
+        }
+        if (ZSTD_isError(bytes_decompressed)) {
+            LOG(ERROR) << "Failed to decompress ZSTD block: "
+                       << ZSTD_getErrorName(bytes_decompressed);
+            return false;
+        }
+        if (bytes_decompressed != output_size) {
+            LOG(ERROR) << "Failed to decompress ZSTD block, expected output size: " << output_size
+                       << ", actual: " << bytes_decompressed;
+            return false;
+        }
+        sink_->ReturnData(output_buffer, output_size);
+        return true;
+    }
+
+  private:
+    const std::string* dictionary_;
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context_;
+};
+
+std::unique_ptr<IDecompressor> IDecompressor::Zstd(const std::string* dictionary) {
+    return std::make_unique<ZstdDecompressor>(dictionary);
+}
+
 }  // namespace snapshot
 }  // namespace android
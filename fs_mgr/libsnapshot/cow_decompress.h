@@ -29,6 +29,11 @@ class IByteStream {
     // parameter. If the end of the stream is reached, 0 is returned.
     virtual bool Read(void* buffer, size_t length, size_t* read) = 0;
 
+    // If the unread remainder of the stream is directly addressable, return
+    // a pointer to it and store its length in the out-parameter, without
+    // consuming it. Otherwise, return nullptr; callers must then use Read().
+    virtual const uint8_t* Peek(size_t*) { return nullptr; }
+
     // Size of the stream.
     virtual size_t Size() const = 0;
 };
@@ -43,6 +48,9 @@ class IDecompressor {
     static std::unique_ptr<IDecompressor> Brotli();
     static std::unique_ptr<IDecompressor> Lz4();
 
+    // |dictionary| is optional, and must outlive the decompressor.
+    static std::unique_ptr<IDecompressor> Zstd(const std::string* dictionary = nullptr);
+
     // |output_bytes| is the expected total number of bytes to sink.
     virtual bool Decompress(size_t output_bytes) = 0;
 
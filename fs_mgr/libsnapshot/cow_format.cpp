@@ -46,14 +46,22 @@ std::ostream& operator<<(std::ostream& os, CowOperation const& op) {
     else
         os << (int)op.type << "?,";
     os << "compression:";
-    if (op.compression == kCowCompressNone)
+    auto compression = GetCompressionAlgorithm(op);
+    if (compression == kCowCompressNone)
         os << "kCowCompressNone,   ";
-    else if (op.compression == kCowCompressGz)
+    else if (compression == kCowCompressGz)
         os << "kCowCompressGz,     ";
-    else if (op.compression == kCowCompressBrotli)
+    else if (compression == kCowCompressBrotli)
         os << "kCowCompressBrotli, ";
+    else if (compression == kCowCompressLz4)
+        os << "kCowCompressLz4,    ";
+    else if (compression == kCowCompressZstd)
+        os << "kCowCompressZstd,   ";
     else
-        os << (int)op.compression << "?, ";
+        os << (int)compression << "?, ";
+    if (GetCompressionUnitBlocks(op) > 1) {
+        os << "unit_blocks:" << GetCompressionUnitBlocks(op) << ",\t";
+    }
     os << "data_length:" << op.data_length << ",\t";
     os << "new_block:" << op.new_block << ",\t";
     os << "source:" << op.source;
@@ -105,5 +113,16 @@ bool IsOrderedOp(const CowOperation& op) {
     }
 }
 
+CowCompressionAlgorithm GetCompressionAlgorithm(const CowOperation& op) {
+    return static_cast<CowCompressionAlgorithm>(op.compression & kCowCompressionAlgorithmMask);
+}
+
+uint32_t GetCompressionUnitBlocks(const CowOperation& op) {
+    if (op.type != kCowReplaceOp) {
+        return 1;
+    }
+    return 1U << (op.compression >> kCowCompressionUnitShift);
+}
+
 }  // namespace snapshot
 }  // namespace android
@@ -14,6 +14,8 @@
 // limitations under the License.
 //
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -41,6 +43,37 @@ CowReader::CowReader(ReaderFlags reader_flag)
       merge_op_blocks_(std::make_shared<std::vector<uint32_t>>()),
       reader_flag_(reader_flag) {}
 
+CowReader::~CowReader() {
+    // Deferred merge preparation still reads from the COW.
+    WaitForMergeOps();
+    owned_fd_ = {};
+}
+
+CowOpStore::CowOpStore(std::vector<CowOperation>&& ops)
+    : ops_(std::move(ops)), num_ops_(ops_.size()) {}
+
+CowOpStore::CowOpStore(std::shared_ptr<const uint8_t> mapping,
+                       std::vector<uint64_t>&& cluster_offsets,
+                       std::vector<uint64_t>&& cluster_first_op, uint64_t ops_per_cluster,
+                       size_t num_ops)
+    : mapping_(std::move(mapping)),
+      cluster_offsets_(std::move(cluster_offsets)),
+      cluster_first_op_(std::move(cluster_first_op)),
+      ops_per_cluster_(ops_per_cluster),
+      num_ops_(num_ops) {}
+
+uint64_t CowOpStore::MappedOffset(size_t index) const {
+    // Every cluster but the last is full unless it was cut short by a label
+    // or footer, so the cluster can almost always be computed directly.
+    size_t cluster = index / ops_per_cluster_;
+    if (cluster >= cluster_first_op_.size() || cluster_first_op_[cluster] > index ||
+        (cluster + 1 < cluster_first_op_.size() && cluster_first_op_[cluster + 1] <= index)) {
+        auto iter = std::upper_bound(cluster_first_op_.begin(), cluster_first_op_.end(), index);
+        cluster = std::distance(cluster_first_op_.begin(), iter) - 1;
+    }
+    return cluster_offsets_[cluster] + (index - cluster_first_op_[cluster]) * sizeof(CowOperation);
+}
+
 static void SHA256(const void*, size_t, uint8_t[]) {
 #if 0
     SHA256_CTX c;
@@ -51,11 +84,14 @@ static void SHA256(const void*, size_t, uint8_t[]) {
 }
 
 std::unique_ptr<CowReader> CowReader::CloneCowReader() {
-    auto cow = std::make_unique<CowReader>();
+    WaitForMergeOps();
+
+    auto cow = std::make_unique<CowReader>(reader_flag_);
     cow->owned_fd_.reset();
     cow->header_ = header_;
     cow->footer_ = footer_;
     cow->fd_size_ = fd_size_;
+    cow->mapping_ = mapping_;
     cow->last_label_ = last_label_;
     cow->ops_ = ops_;
     cow->merge_op_blocks_ = merge_op_blocks_;
@@ -65,6 +101,10 @@ std::unique_ptr<CowReader> CowReader::CloneCowReader() {
     cow->num_ordered_ops_to_merge_ = num_ordered_ops_to_merge_;
     cow->has_seq_ops_ = has_seq_ops_;
     cow->data_loc_ = data_loc_;
+    cow->units_ = units_;
+    cow->compression_dictionary_ = compression_dictionary_;
+    cow->merge_prep_ok_ = merge_prep_ok_;
+    cow->cluster_data_ = cluster_data_;
     return cow;
 }
 
@@ -91,12 +131,203 @@ bool CowReader::InitForMerge(android::base::unique_fd&& fd) {
     return true;
 }
 
+// Fixed part of the state written by ExportParsedState(). The variable-sized
+// tables follow it, each as a count followed by the entries.
+struct ParsedCowState {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t op_size;
+    uint8_t has_last_label;
+    uint8_t has_seq_ops;
+    uint64_t fd_size;
+    // The header as it is on disk; |header| may have been adjusted since.
+    CowHeader disk_header;
+    CowHeader header;
+    CowFooter footer;
+    uint64_t last_label;
+    uint64_t merge_op_start;
+    uint64_t num_total_data_ops;
+    uint64_t num_ordered_ops_to_merge;
+} __attribute__((packed));
+
+static constexpr uint32_t kParsedCowStateMagic = 0x53776f43;  // "CowS"
+static constexpr uint32_t kParsedCowStateVersion = 1;
+
+template <typename T>
+static bool WriteTable(android::base::borrowed_fd fd, const T* data, uint64_t count) {
+    return android::base::WriteFully(fd, &count, sizeof(count)) &&
+           android::base::WriteFully(fd, data, count * sizeof(T));
+}
+
+template <typename T>
+static bool WriteTable(android::base::borrowed_fd fd, const std::vector<T>& table) {
+    return WriteTable(fd, table.data(), table.size());
+}
+
+// |max_bytes| bounds the allocation, should the state be truncated or corrupt.
+template <typename T>
+static bool ReadTable(android::base::borrowed_fd fd, uint64_t max_bytes, std::vector<T>* table) {
+    uint64_t count;
+    if (!android::base::ReadFully(fd, &count, sizeof(count))) {
+        return false;
+    }
+    if (count > max_bytes / sizeof(T)) {
+        LOG(ERROR) << "Invalid table size in COW state: " << count;
+        return false;
+    }
+    table->resize(count);
+    return android::base::ReadFully(fd, table->data(), count * sizeof(T));
+}
+
+bool CowReader::ExportParsedState(android::base::borrowed_fd state_fd) {
+    if (!WaitForMergeOps()) {
+        return false;
+    }
+    if (!ops_ || ops_->mapped() || !footer_ || !block_map_) {
+        LOG(ERROR) << "COW state cannot be exported";
+        return false;
+    }
+
+    ParsedCowState state = {};
+    state.magic = kParsedCowStateMagic;
+    state.version = kParsedCowStateVersion;
+    state.op_size = sizeof(CowOperation);
+    state.has_last_label = last_label_.has_value();
+    state.has_seq_ops = has_seq_ops_;
+    state.fd_size = fd_size_;
+    if (!android::base::ReadFullyAtOffset(fd_, &state.disk_header, sizeof(state.disk_header), 0)) {
+        PLOG(ERROR) << "read header failed";
+        return false;
+    }
+    state.header = header_;
+    state.footer = footer_.value();
+    state.last_label = last_label_.value_or(0);
+    state.merge_op_start = merge_op_start_;
+    state.num_total_data_ops = num_total_data_ops_;
+    state.num_ordered_ops_to_merge = num_ordered_ops_to_merge_;
+
+    // Ops that are not mapped are stored contiguously.
+    const CowOperation* ops = ops_->size() ? &(*ops_)[0] : nullptr;
+    if (!android::base::WriteFully(state_fd, &state, sizeof(state)) ||
+        !WriteTable(state_fd, ops, ops_->size()) || !WriteTable(state_fd, *merge_op_blocks_) ||
+        !WriteTable(state_fd, block_map_->keys()) || !WriteTable(state_fd, block_map_->values()) ||
+        !WriteTable(state_fd, data_loc_->keys()) || !WriteTable(state_fd, data_loc_->values()) ||
+        !WriteTable(state_fd, units_->keys()) || !WriteTable(state_fd, units_->values()) ||
+        !WriteTable(state_fd, *cluster_data_)) {
+        PLOG(ERROR) << "write COW state failed";
+        return false;
+    }
+    return true;
+}
+
+bool CowReader::ImportParsedState(android::base::borrowed_fd fd,
+                                  android::base::borrowed_fd state_fd) {
+    WaitForMergeOps();
+
+    struct stat st;
+    if (fstat(state_fd.get(), &st) < 0) {
+        PLOG(ERROR) << "fstat COW state failed";
+        return false;
+    }
+    ParsedCowState state;
+    if (!android::base::ReadFully(state_fd, &state, sizeof(state))) {
+        PLOG(ERROR) << "read COW state failed";
+        return false;
+    }
+    if (state.magic != kParsedCowStateMagic || state.version != kParsedCowStateVersion ||
+        state.op_size != sizeof(CowOperation)) {
+        LOG(ERROR) << "Unknown COW state, magic: " << state.magic
+                   << " version: " << state.version;
+        return false;
+    }
+
+    auto pos = lseek(fd.get(), 0, SEEK_END);
+    if (pos < 0) {
+        PLOG(ERROR) << "lseek end failed";
+        return false;
+    }
+    CowHeader disk_header;
+    if (!android::base::ReadFullyAtOffset(fd, &disk_header, sizeof(disk_header), 0)) {
+        PLOG(ERROR) << "read header failed";
+        return false;
+    }
+    if (static_cast<uint64_t>(pos) != state.fd_size ||
+        memcmp(&disk_header, &state.disk_header, sizeof(disk_header)) != 0) {
+        LOG(ERROR) << "COW changed since its state was exported";
+        return false;
+    }
+
+    uint64_t max_bytes = st.st_size;
+    std::vector<CowOperation> ops;
+    auto merge_op_blocks = std::make_shared<std::vector<uint32_t>>();
+    std::vector<uint32_t> block_map_keys, block_map_values, data_loc_keys;
+    std::vector<uint64_t> data_loc_values, units_keys;
+    std::vector<CompressionUnit> units_values;
+    auto cluster_data = std::make_shared<std::vector<ClusterData>>();
+    if (!ReadTable(state_fd, max_bytes, &ops) ||
+        !ReadTable(state_fd, max_bytes, merge_op_blocks.get()) ||
+        !ReadTable(state_fd, max_bytes, &block_map_keys) ||
+        !ReadTable(state_fd, max_bytes, &block_map_values) ||
+        !ReadTable(state_fd, max_bytes, &data_loc_keys) ||
+        !ReadTable(state_fd, max_bytes, &data_loc_values) ||
+        !ReadTable(state_fd, max_bytes, &units_keys) ||
+        !ReadTable(state_fd, max_bytes, &units_values) ||
+        !ReadTable(state_fd, max_bytes, cluster_data.get())) {
+        PLOG(ERROR) << "read COW state failed";
+        return false;
+    }
+    if (block_map_keys.size() != block_map_values.size() ||
+        data_loc_keys.size() != data_loc_values.size() ||
+        units_keys.size() != units_values.size()) {
+        LOG(ERROR) << "Inconsistent COW state";
+        return false;
+    }
+    for (auto index : block_map_values) {
+        if (index >= ops.size()) {
+            LOG(ERROR) << "Invalid op index in COW state: " << index;
+            return false;
+        }
+    }
+
+    fd_ = fd;
+    fd_size_ = state.fd_size;
+    header_ = state.header;
+    footer_ = state.footer;
+    last_label_.reset();
+    if (state.has_last_label) {
+        last_label_ = {static_cast<uint64_t>(state.last_label)};
+    }
+    has_seq_ops_ = state.has_seq_ops;
+    merge_op_start_ = state.merge_op_start;
+    num_total_data_ops_ = state.num_total_data_ops;
+    num_ordered_ops_to_merge_ = state.num_ordered_ops_to_merge;
+    mapping_ = nullptr;
+    ops_ = std::make_shared<CowOpStore>(std::move(ops));
+    merge_op_blocks_ = merge_op_blocks;
+    block_map_ = std::make_shared<CowOpIndex<uint32_t, uint32_t>>();
+    block_map_->Assign(std::move(block_map_keys), std::move(block_map_values));
+    data_loc_ = std::make_shared<CowOpIndex<uint32_t, uint64_t>>();
+    data_loc_->Assign(std::move(data_loc_keys), std::move(data_loc_values));
+    units_ = std::make_shared<CowOpIndex<uint64_t, CompressionUnit>>();
+    units_->Assign(std::move(units_keys), std::move(units_values));
+    cluster_data_ = cluster_data;
+    prefetch_buffer_.clear();
+    merge_prep_ok_ = true;
+
+    // The dictionary is small; read it rather than carry it in the state.
+    return ParseCompressionDictionary();
+}
+
 bool CowReader::Parse(android::base::unique_fd&& fd, std::optional<uint64_t> label) {
     owned_fd_ = std::move(fd);
     return Parse(android::base::borrowed_fd{owned_fd_}, label);
 }
 
 bool CowReader::Parse(android::base::borrowed_fd fd, std::optional<uint64_t> label) {
+    // Don't race a previous parse's merge preparation.
+    WaitForMergeOps();
+    merge_prep_ok_ = true;
+
     fd_ = fd;
 
     auto pos = lseek(fd_.get(), 0, SEEK_END);
@@ -144,26 +375,84 @@ bool CowReader::Parse(android::base::borrowed_fd fd, std::optional<uint64_t> lab
         return false;
     }
 
-    if ((header_.major_version > kCowVersionMajor) || (header_.minor_version != kCowVersionMinor)) {
+    if ((header_.major_version > kCowVersionMajor) ||
+        (header_.minor_version > kCowVersionMinorCompressionUnits)) {
         LOG(ERROR) << "Header version mismatch";
         LOG(ERROR) << "Major version: " << header_.major_version
                    << "Expected: " << kCowVersionMajor;
         LOG(ERROR) << "Minor version: " << header_.minor_version
-                   << "Expected: " << kCowVersionMinor;
+                   << "Expected: " << kCowVersionMinorCompressionUnits;
         return false;
     }
 
-    if (!ParseOps(label)) {
+    if (HasFlag(ReaderFlags::MMAP) && !MapCow()) {
+        return false;
+    }
+    if (!ParseCompressionDictionary() || !ParseOps(label)) {
         return false;
     }
     // If we're resuming a write, we're not ready to merge
     if (label.has_value()) return true;
+    if (!PrepBlockMap()) return false;
+    if (HasFlag(ReaderFlags::DEFER_MERGE_PREP)) {
+        merge_prep_ = std::async(std::launch::async, &CowReader::PrepMergeOps, this);
+        return true;
+    }
     return PrepMergeOps();
 }
 
+bool CowReader::WaitForMergeOps() {
+    std::lock_guard<std::mutex> lock(merge_prep_lock_);
+    if (merge_prep_.valid()) {
+        merge_prep_ok_ = merge_prep_.get();
+    }
+    return merge_prep_ok_;
+}
+
+bool CowReader::MapCow() {
+    void* addr = mmap(nullptr, fd_size_, PROT_READ, MAP_SHARED, fd_.get(), 0);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "mmap COW failed, size: " << fd_size_;
+        return false;
+    }
+    size_t size = fd_size_;
+    mapping_ = std::shared_ptr<const uint8_t>(reinterpret_cast<const uint8_t*>(addr),
+                                              [size](const uint8_t* p) {
+                                                  munmap(const_cast<uint8_t*>(p), size);
+                                              });
+    return true;
+}
+
+bool CowReader::ParseCompressionDictionary() {
+    compression_dictionary_ = nullptr;
+    if (header_.header_size <= sizeof(CowHeader)) {
+        return true;
+    }
+
+    auto dictionary = std::make_shared<std::string>();
+    dictionary->resize(header_.header_size - sizeof(CowHeader));
+    if (!android::base::ReadFullyAtOffset(fd_, dictionary->data(), dictionary->size(),
+                                          sizeof(CowHeader))) {
+        PLOG(ERROR) << "read compression dictionary failed";
+        return false;
+    }
+    compression_dictionary_ = dictionary;
+    return true;
+}
+
+bool CowReader::GetCompressionDictionary(std::string* dictionary) {
+    if (!compression_dictionary_) {
+        dictionary->clear();
+        return false;
+    }
+    *dictionary = *compression_dictionary_;
+    return true;
+}
+
 bool CowReader::ParseOps(std::optional<uint64_t> label) {
     uint64_t pos;
-    auto data_loc = std::make_shared<std::unordered_map<uint64_t, uint64_t>>();
+    auto data_loc = std::make_shared<CowOpIndex<uint32_t, uint64_t>>();
+    auto units = std::make_shared<CowOpIndex<uint64_t, CompressionUnit>>();
 
     // Skip the scratch space
     if (header_.major_version >= 2 && (header_.buffer_size > 0)) {
@@ -191,32 +480,53 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
         data_pos = pos + sizeof(CowOperation);
     }
 
-    auto ops_buffer = std::make_shared<std::vector<CowOperation>>();
+    const bool mapped = mapping_ != nullptr;
+    std::vector<CowOperation> ops_buffer;
+    std::vector<uint64_t> cluster_offsets;
+    std::vector<uint64_t> cluster_first_op;
     uint64_t current_op_num = 0;
     uint64_t cluster_ops = header_.cluster_ops ?: 1;
+    auto cluster_data = std::make_shared<std::vector<ClusterData>>();
     bool done = false;
 
     // Alternating op clusters and data
     while (!done) {
+        const uint64_t cluster_start = pos;
+        bool cluster_ended = false;
         uint64_t to_add = std::min(cluster_ops, (fd_size_ - pos) / sizeof(CowOperation));
         if (to_add == 0) break;
-        ops_buffer->resize(current_op_num + to_add);
-        if (!android::base::ReadFully(fd_, &ops_buffer->data()[current_op_num],
-                                      to_add * sizeof(CowOperation))) {
-            PLOG(ERROR) << "read op failed";
-            return false;
+
+        const CowOperation* cluster;
+        if (mapped) {
+            cluster = reinterpret_cast<const CowOperation*>(mapping_.get() + pos);
+            cluster_offsets.emplace_back(pos);
+            cluster_first_op.emplace_back(current_op_num);
+        } else {
+            ops_buffer.resize(current_op_num + to_add);
+            if (!android::base::ReadFully(fd_, &ops_buffer[current_op_num],
+                                          to_add * sizeof(CowOperation))) {
+                PLOG(ERROR) << "read op failed";
+                return false;
+            }
+            cluster = &ops_buffer[current_op_num];
         }
+
         // Parse current cluster to find start of next cluster
-        while (current_op_num < ops_buffer->size()) {
-            auto& current_op = ops_buffer->data()[current_op_num];
+        for (uint64_t cluster_op_num = 0; cluster_op_num < to_add; cluster_op_num++) {
+            const auto& current_op = cluster[cluster_op_num];
             current_op_num++;
             if (current_op.type == kCowXorOp) {
-                data_loc->insert({current_op.new_block, data_pos});
+                data_loc->Add(current_op.new_block, data_pos);
+            } else if (current_op.type == kCowReplaceOp && current_op.data_length &&
+                       GetCompressionUnitBlocks(current_op) > 1) {
+                CompressionUnit unit = {current_op.new_block, current_op.data_length};
+                units->Add(current_op.source, unit);
             }
             pos += sizeof(CowOperation) + GetNextOpOffset(current_op, header_.cluster_ops);
             data_pos += current_op.data_length + GetNextDataOffset(current_op, header_.cluster_ops);
 
             if (current_op.type == kCowClusterOp) {
+                cluster_ended = true;
                 break;
             } else if (current_op.type == kCowLabelOp) {
                 last_label_ = {current_op.source};
@@ -230,14 +540,22 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
                 footer_.emplace();
                 CowFooter* footer = &footer_.value();
                 memcpy(&footer_->op, &current_op, sizeof(footer->op));
-                off_t offs = lseek(fd_.get(), pos, SEEK_SET);
-                if (offs < 0 || pos != static_cast<uint64_t>(offs)) {
-                    PLOG(ERROR) << "lseek next op failed " << offs;
-                    return false;
-                }
-                if (!android::base::ReadFully(fd_, &footer->data, sizeof(footer->data))) {
-                    LOG(ERROR) << "Could not read COW footer";
-                    return false;
+                if (mapped) {
+                    if (fd_size_ < sizeof(footer->data) || pos > fd_size_ - sizeof(footer->data)) {
+                        LOG(ERROR) << "Could not read COW footer";
+                        return false;
+                    }
+                    memcpy(&footer->data, mapping_.get() + pos, sizeof(footer->data));
+                } else {
+                    off_t offs = lseek(fd_.get(), pos, SEEK_SET);
+                    if (offs < 0 || pos != static_cast<uint64_t>(offs)) {
+                        PLOG(ERROR) << "lseek next op failed " << offs;
+                        return false;
+                    }
+                    if (!android::base::ReadFully(fd_, &footer->data, sizeof(footer->data))) {
+                        LOG(ERROR) << "Could not read COW footer";
+                        return false;
+                    }
                 }
 
                 // Drop the footer from the op stream.
@@ -249,16 +567,32 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
             }
         }
 
+        // A cluster's data sits between its op area and the next cluster.
+        if (cluster_ended && header_.cluster_ops) {
+            uint64_t data_begin = cluster_start + header_.cluster_ops * sizeof(CowOperation);
+            if (pos > data_begin) {
+                cluster_data->push_back({data_begin, pos});
+            }
+        }
+
+        if (mapped) {
+            if (pos > fd_size_) {
+                LOG(ERROR) << "next op position " << pos << " is beyond end of COW";
+                return false;
+            }
+            continue;
+        }
+
         // Position for next cluster read
         off_t offs = lseek(fd_.get(), pos, SEEK_SET);
         if (offs < 0 || pos != static_cast<uint64_t>(offs)) {
             PLOG(ERROR) << "lseek next op failed " << offs;
             return false;
         }
-        ops_buffer->resize(current_op_num);
+        ops_buffer.resize(current_op_num);
     }
 
-    LOG(DEBUG) << "COW file read complete. Total ops: " << ops_buffer->size();
+    LOG(DEBUG) << "COW file read complete. Total ops: " << current_op_num;
     // To successfully parse a COW file, we need either:
     //  (1) a label to read up to, and for that label to be found, or
     //  (2) a valid footer.
@@ -282,12 +616,12 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
     memset(csum, 0, sizeof(uint8_t) * 32);
 
     if (footer_) {
-        if (ops_buffer->size() != footer_->op.num_ops) {
+        if (current_op_num != footer_->op.num_ops) {
             LOG(ERROR) << "num ops does not match, expected " << footer_->op.num_ops << ", found "
-                       << ops_buffer->size();
+                       << current_op_num;
             return false;
         }
-        if (ops_buffer->size() * sizeof(CowOperation) != footer_->op.ops_size) {
+        if (current_op_num * sizeof(CowOperation) != footer_->op.ops_size) {
             LOG(ERROR) << "ops size does not match ";
             return false;
         }
@@ -296,16 +630,33 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
             LOG(ERROR) << "ops checksum does not match";
             return false;
         }
-        SHA256(ops_buffer->data(), footer_->op.ops_size, csum);
+        // Mapped op clusters are not contiguous, so only in-memory ops are
+        // checksummed.
+        if (!mapped) {
+            SHA256(ops_buffer.data(), footer_->op.ops_size, csum);
+        }
         if (memcmp(csum, footer_->data.ops_checksum, sizeof(csum)) != 0) {
             LOG(ERROR) << "ops checksum does not match";
             return false;
         }
     }
 
-    ops_ = ops_buffer;
-    ops_->shrink_to_fit();
+    cluster_data->shrink_to_fit();
+    cluster_data_ = cluster_data;
+    prefetch_buffer_.clear();
+
+    if (mapped) {
+        ops_ = std::make_shared<CowOpStore>(mapping_, std::move(cluster_offsets),
+                                            std::move(cluster_first_op), cluster_ops,
+                                            current_op_num);
+    } else {
+        ops_buffer.shrink_to_fit();
+        ops_ = std::make_shared<CowOpStore>(std::move(ops_buffer));
+    }
+    data_loc->Finalize();
+    units->Finalize();
     data_loc_ = data_loc;
+    units_ = units;
 
     return true;
 }
@@ -414,23 +765,50 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
 // Merge-2 - Batch-merge {Replace-op-7, Replace-op-6, Zero-op-8,
 //                        Replace-op-4, Zero-op-9, Replace-op-5 }
 //==============================================================
+bool CowReader::PrepBlockMap() {
+    auto block_map = std::make_shared<CowOpIndex<uint32_t, uint32_t>>();
+
+    block_map->reserve(ops_->size());
+    for (size_t i = 0; i < ops_->size(); i++) {
+        auto& current_op = (*ops_)[i];
+        if (IsMetadataOp(current_op)) {
+            continue;
+        }
+        block_map->Add(current_op.new_block, i);
+    }
+    block_map->Finalize();
+
+    block_map_ = block_map;
+    return true;
+}
+
+// Sequence ops may be read while the main thread serves ReadData(), so this
+// must not move the shared file offset.
+bool CowReader::ReadSequenceData(const CowOperation& op, uint32_t* blocks) {
+    if (!ValidateDataRange(op.source, op.data_length)) {
+        return false;
+    }
+    if (mapping_) {
+        memcpy(blocks, mapping_.get() + op.source, op.data_length);
+        return true;
+    }
+    return android::base::ReadFullyAtOffset(fd_, blocks, op.data_length, op.source);
+}
+
 bool CowReader::PrepMergeOps() {
     auto merge_op_blocks = std::make_shared<std::vector<uint32_t>>();
     std::vector<int> other_ops;
     auto seq_ops_set = std::unordered_set<uint32_t>();
-    auto block_map = std::make_shared<std::unordered_map<uint32_t, int>>();
     size_t num_seqs = 0;
-    size_t read;
 
     for (size_t i = 0; i < ops_->size(); i++) {
-        auto& current_op = ops_->data()[i];
+        auto& current_op = (*ops_)[i];
 
         if (current_op.type == kCowSequenceOp) {
             size_t seq_len = current_op.data_length / sizeof(uint32_t);
 
             merge_op_blocks->resize(merge_op_blocks->size() + seq_len);
-            if (!GetRawBytes(current_op.source, &merge_op_blocks->data()[num_seqs],
-                             current_op.data_length, &read)) {
+            if (!ReadSequenceData(current_op, &merge_op_blocks->data()[num_seqs])) {
                 PLOG(ERROR) << "Failed to read sequence op!";
                 return false;
             }
@@ -449,10 +827,9 @@ bool CowReader::PrepMergeOps() {
         } else if (seq_ops_set.count(current_op.new_block) == 0) {
             other_ops.push_back(current_op.new_block);
         }
-        block_map->insert({current_op.new_block, i});
     }
     for (auto block : *merge_op_blocks) {
-        if (block_map->count(block) == 0) {
+        if (!block_map_->Contains(block)) {
             LOG(ERROR) << "Invalid Sequence Ops. Could not find Cow Op for new block " << block;
             return false;
         }
@@ -469,7 +846,7 @@ bool CowReader::PrepMergeOps() {
     //
     // dm-snapshot-merge requires decreasing order as we iterate the blocks
     // in reverse order.
-    if (reader_flag_ == ReaderFlags::USERSPACE_MERGE) {
+    if (HasFlag(ReaderFlags::USERSPACE_MERGE)) {
         std::sort(other_ops.begin(), other_ops.end());
     } else {
         std::sort(other_ops.begin(), other_ops.end(), std::greater<int>());
@@ -482,13 +859,15 @@ bool CowReader::PrepMergeOps() {
         merge_op_start_ = header_.num_merge_ops;
     }
 
-    block_map_ = block_map;
     merge_op_blocks_ = merge_op_blocks;
     return true;
 }
 
 bool CowReader::VerifyMergeOps() {
     auto itr = GetMergeOpIter(true);
+    if (!itr) {
+        return false;
+    }
     std::unordered_map<uint64_t, CowOperation> overwritten_blocks;
     while (!itr->Done()) {
         CowOperation op = itr->Get();
@@ -544,7 +923,7 @@ bool CowReader::GetLastLabel(uint64_t* label) {
 
 class CowOpIter final : public ICowOpIter {
   public:
-    CowOpIter(std::shared_ptr<std::vector<CowOperation>>& ops);
+    CowOpIter(std::shared_ptr<CowOpStore>& ops);
 
     bool Done() override;
     const CowOperation& Get() override;
@@ -554,43 +933,42 @@ class CowOpIter final : public ICowOpIter {
     bool RDone() override;
 
   private:
-    std::shared_ptr<std::vector<CowOperation>> ops_;
-    std::vector<CowOperation>::iterator op_iter_;
+    std::shared_ptr<CowOpStore> ops_;
+    size_t op_index_ = 0;
 };
 
-CowOpIter::CowOpIter(std::shared_ptr<std::vector<CowOperation>>& ops) {
+CowOpIter::CowOpIter(std::shared_ptr<CowOpStore>& ops) {
     ops_ = ops;
-    op_iter_ = ops_->begin();
 }
 
 bool CowOpIter::RDone() {
-    return op_iter_ == ops_->begin();
+    return op_index_ == 0;
 }
 
 void CowOpIter::Prev() {
     CHECK(!RDone());
-    op_iter_--;
+    op_index_--;
 }
 
 bool CowOpIter::Done() {
-    return op_iter_ == ops_->end();
+    return op_index_ == ops_->size();
 }
 
 void CowOpIter::Next() {
     CHECK(!Done());
-    op_iter_++;
+    op_index_++;
 }
 
 const CowOperation& CowOpIter::Get() {
     CHECK(!Done());
-    return (*op_iter_);
+    return (*ops_)[op_index_];
 }
 
 class CowRevMergeOpIter final : public ICowOpIter {
   public:
-    explicit CowRevMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
+    explicit CowRevMergeOpIter(std::shared_ptr<CowOpStore> ops,
                                std::shared_ptr<std::vector<uint32_t>> merge_op_blocks,
-                               std::shared_ptr<std::unordered_map<uint32_t, int>> map,
+                               std::shared_ptr<CowOpIndex<uint32_t, uint32_t>> map,
                                uint64_t start);
 
     bool Done() override;
@@ -601,18 +979,18 @@ class CowRevMergeOpIter final : public ICowOpIter {
     bool RDone() override;
 
   private:
-    std::shared_ptr<std::vector<CowOperation>> ops_;
+    std::shared_ptr<CowOpStore> ops_;
     std::shared_ptr<std::vector<uint32_t>> merge_op_blocks_;
-    std::shared_ptr<std::unordered_map<uint32_t, int>> map_;
+    std::shared_ptr<CowOpIndex<uint32_t, uint32_t>> map_;
     std::vector<uint32_t>::reverse_iterator block_riter_;
     uint64_t start_;
 };
 
 class CowMergeOpIter final : public ICowOpIter {
   public:
-    explicit CowMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
+    explicit CowMergeOpIter(std::shared_ptr<CowOpStore> ops,
                             std::shared_ptr<std::vector<uint32_t>> merge_op_blocks,
-                            std::shared_ptr<std::unordered_map<uint32_t, int>> map, uint64_t start);
+                            std::shared_ptr<CowOpIndex<uint32_t, uint32_t>> map, uint64_t start);
 
     bool Done() override;
     const CowOperation& Get() override;
@@ -622,16 +1000,16 @@ class CowMergeOpIter final : public ICowOpIter {
     bool RDone() override;
 
   private:
-    std::shared_ptr<std::vector<CowOperation>> ops_;
+    std::shared_ptr<CowOpStore> ops_;
     std::shared_ptr<std::vector<uint32_t>> merge_op_blocks_;
-    std::shared_ptr<std::unordered_map<uint32_t, int>> map_;
+    std::shared_ptr<CowOpIndex<uint32_t, uint32_t>> map_;
     std::vector<uint32_t>::iterator block_iter_;
     uint64_t start_;
 };
 
-CowMergeOpIter::CowMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
+CowMergeOpIter::CowMergeOpIter(std::shared_ptr<CowOpStore> ops,
                                std::shared_ptr<std::vector<uint32_t>> merge_op_blocks,
-                               std::shared_ptr<std::unordered_map<uint32_t, int>> map,
+                               std::shared_ptr<CowOpIndex<uint32_t, uint32_t>> map,
                                uint64_t start) {
     ops_ = ops;
     merge_op_blocks_ = merge_op_blocks;
@@ -661,12 +1039,12 @@ void CowMergeOpIter::Next() {
 
 const CowOperation& CowMergeOpIter::Get() {
     CHECK(!Done());
-    return ops_->data()[map_->at(*block_iter_)];
+    return (*ops_)[*map_->Find(*block_iter_)];
 }
 
-CowRevMergeOpIter::CowRevMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
+CowRevMergeOpIter::CowRevMergeOpIter(std::shared_ptr<CowOpStore> ops,
                                      std::shared_ptr<std::vector<uint32_t>> merge_op_blocks,
-                                     std::shared_ptr<std::unordered_map<uint32_t, int>> map,
+                                     std::shared_ptr<CowOpIndex<uint32_t, uint32_t>> map,
                                      uint64_t start) {
     ops_ = ops;
     merge_op_blocks_ = merge_op_blocks;
@@ -696,7 +1074,7 @@ void CowRevMergeOpIter::Next() {
 
 const CowOperation& CowRevMergeOpIter::Get() {
     CHECK(!Done());
-    return ops_->data()[map_->at(*block_riter_)];
+    return (*ops_)[*map_->Find(*block_riter_)];
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetOpIter() {
@@ -704,22 +1082,97 @@ std::unique_ptr<ICowOpIter> CowReader::GetOpIter() {
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetRevMergeOpIter(bool ignore_progress) {
+    if (!WaitForMergeOps()) {
+        LOG(ERROR) << "Merge ops are not available";
+        return nullptr;
+    }
     return std::make_unique<CowRevMergeOpIter>(ops_, merge_op_blocks_, block_map_,
                                                ignore_progress ? 0 : merge_op_start_);
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetMergeOpIter(bool ignore_progress) {
+    if (!WaitForMergeOps()) {
+        LOG(ERROR) << "Merge ops are not available";
+        return nullptr;
+    }
     return std::make_unique<CowMergeOpIter>(ops_, merge_op_blocks_, block_map_,
                                             ignore_progress ? 0 : merge_op_start_);
 }
 
-bool CowReader::GetRawBytes(uint64_t offset, void* buffer, size_t len, size_t* read) {
+bool CowReader::ValidateDataRange(uint64_t offset, size_t len) {
     // Validate the offset, taking care to acknowledge possible overflow of offset+len.
     if (offset < header_.header_size || offset >= fd_size_ - sizeof(CowFooter) || len >= fd_size_ ||
         offset + len > fd_size_ - sizeof(CowFooter)) {
         LOG(ERROR) << "invalid data offset: " << offset << ", " << len << " bytes";
         return false;
     }
+    return true;
+}
+
+const uint8_t* CowReader::GetMappedBytes(uint64_t offset, size_t len) {
+    if (!mapping_ || !ValidateDataRange(offset, len)) {
+        return nullptr;
+    }
+    return mapping_.get() + offset;
+}
+
+void CowReader::SetClusterPrefetch(bool enabled) {
+    prefetch_enabled_ = enabled;
+    if (!enabled) {
+        prefetch_buffer_.clear();
+        prefetch_buffer_.shrink_to_fit();
+    }
+}
+
+bool CowReader::PrefetchCluster(uint64_t offset, size_t len) {
+    if (!cluster_data_ || cluster_data_->empty()) {
+        return false;
+    }
+    auto iter = std::upper_bound(
+            cluster_data_->begin(), cluster_data_->end(), offset,
+            [](uint64_t value, const ClusterData& cluster) { return value < cluster.begin; });
+    if (iter == cluster_data_->begin()) {
+        return false;
+    }
+    --iter;
+    if (offset + len > iter->end) {
+        return false;
+    }
+
+    size_t size = iter->end - iter->begin;
+    if (size > kMaxClusterPrefetchSize) {
+        return false;
+    }
+    prefetch_buffer_.resize(size);
+    if (!android::base::ReadFullyAtOffset(fd_, prefetch_buffer_.data(), size, iter->begin)) {
+        PLOG(ERROR) << "Failed to prefetch cluster data at offset " << iter->begin;
+        prefetch_buffer_.clear();
+        return false;
+    }
+    prefetch_begin_ = iter->begin;
+    return true;
+}
+
+bool CowReader::GetRawBytes(uint64_t offset, void* buffer, size_t len, size_t* read) {
+    if (!ValidateDataRange(offset, len)) {
+        return false;
+    }
+    if (mapping_) {
+        memcpy(buffer, mapping_.get() + offset, len);
+        *read = len;
+        return true;
+    }
+    if (prefetch_enabled_) {
+        auto contains = [&]() -> bool {
+            return !prefetch_buffer_.empty() && offset >= prefetch_begin_ &&
+                   offset + len <= prefetch_begin_ + prefetch_buffer_.size();
+        };
+        if (contains() || (PrefetchCluster(offset, len) && contains())) {
+            memcpy(buffer, prefetch_buffer_.data() + (offset - prefetch_begin_), len);
+            *read = len;
+            return true;
+        }
+    }
     if (lseek(fd_.get(), offset, SEEK_SET) < 0) {
         PLOG(ERROR) << "lseek to read raw bytes failed";
         return false;
@@ -754,6 +1207,17 @@ class CowDataStream final : public IByteStream {
         return true;
     }
 
+    const uint8_t* Peek(size_t* length) override {
+        if (!remaining_) {
+            return nullptr;
+        }
+        const uint8_t* data = reader_->GetMappedBytes(offset_, remaining_);
+        if (data) {
+            *length = remaining_;
+        }
+        return data;
+    }
+
     size_t Size() const override { return data_length_; }
 
   private:
@@ -763,29 +1227,64 @@ class CowDataStream final : public IByteStream {
     size_t remaining_;
 };
 
-bool CowReader::ReadData(const CowOperation& op, IByteSink* sink) {
-    std::unique_ptr<IDecompressor> decompressor;
-    switch (op.compression) {
+std::unique_ptr<IDecompressor> CowReader::GetDecompressor(CowCompressionAlgorithm compression) {
+    switch (compression) {
         case kCowCompressNone:
-            decompressor = IDecompressor::Uncompressed();
-            break;
+            return IDecompressor::Uncompressed();
         case kCowCompressGz:
-            decompressor = IDecompressor::Gz();
-            break;
+            return IDecompressor::Gz();
         case kCowCompressBrotli:
-            decompressor = IDecompressor::Brotli();
-            break;
+            return IDecompressor::Brotli();
         case kCowCompressLz4:
-            decompressor = IDecompressor::Lz4();
-            break;
+            return IDecompressor::Lz4();
+        case kCowCompressZstd:
+            return IDecompressor::Zstd(compression_dictionary_.get());
         default:
-            LOG(ERROR) << "Unknown compression type: " << op.compression;
-            return false;
+            LOG(ERROR) << "Unknown compression type: " << compression;
+            return nullptr;
+    }
+}
+
+// Sink which decompresses into a fixed-size, caller owned buffer.
+class UnitSink final : public IByteSink {
+  public:
+    explicit UnitSink(std::basic_string<uint8_t>* buffer) : buffer_(buffer) {}
+
+    void* GetBuffer(size_t requested, size_t* actual) override {
+        if (pos_ >= buffer_->size()) {
+            return nullptr;
+        }
+        *actual = std::min(requested, buffer_->size() - pos_);
+        return buffer_->data() + pos_;
+    }
+    bool ReturnData(void*, size_t length) override {
+        pos_ += length;
+        return true;
+    }
+
+  private:
+    std::basic_string<uint8_t>* buffer_;
+    size_t pos_ = 0;
+};
+
+bool CowReader::ReadData(const CowOperation& op, IByteSink* sink) {
+    if (GetCompressionUnitBlocks(op) > 1) {
+        return ReadUnitData(op, sink);
+    }
+
+    std::unique_ptr<IDecompressor> decompressor = GetDecompressor(GetCompressionAlgorithm(op));
+    if (!decompressor) {
+        return false;
     }
 
     uint64_t offset;
     if (op.type == kCowXorOp) {
-        offset = data_loc_->at(op.new_block);
+        auto data_loc = data_loc_->Find(op.new_block);
+        if (!data_loc) {
+            LOG(ERROR) << "No data found for xor op at block " << op.new_block;
+            return false;
+        }
+        offset = *data_loc;
     } else {
         offset = op.source;
     }
@@ -795,5 +1294,83 @@ bool CowReader::ReadData(const CowOperation& op, IByteSink* sink) {
     return decompressor->Decompress(header_.block_size);
 }
 
+const CowReader::DecompressedUnit* CowReader::GetDecompressedUnit(const CowOperation& op) {
+    for (size_t i = 0; i < unit_cache_.size(); i++) {
+        if (!unit_cache_[i].data.empty() && unit_cache_[i].source == op.source) {
+            if (i != 0) {
+                std::swap(unit_cache_[0], unit_cache_[i]);
+            }
+            return &unit_cache_[0];
+        }
+    }
+
+    auto unit_info = units_->Find(op.source);
+    if (!unit_info) {
+        LOG(ERROR) << "No compression unit found at offset " << op.source;
+        return nullptr;
+    }
+
+    std::unique_ptr<IDecompressor> decompressor = GetDecompressor(GetCompressionAlgorithm(op));
+    if (!decompressor) {
+        return nullptr;
+    }
+
+    // Evict the least recently used entry.
+    std::swap(unit_cache_[0], unit_cache_[1]);
+    DecompressedUnit* unit = &unit_cache_[0];
+    unit->source = op.source;
+    unit->data.resize(header_.block_size * GetCompressionUnitBlocks(op));
+
+    UnitSink unit_sink(&unit->data);
+    CowDataStream stream(this, op.source, unit_info->data_length);
+    decompressor->set_stream(&stream);
+    decompressor->set_sink(&unit_sink);
+    if (!decompressor->Decompress(unit->data.size())) {
+        unit->data.clear();
+        return nullptr;
+    }
+    return unit;
+}
+
+bool CowReader::ReadUnitData(const CowOperation& op, IByteSink* sink) {
+    auto unit_info = units_->Find(op.source);
+    if (!unit_info) {
+        LOG(ERROR) << "No compression unit found at offset " << op.source;
+        return false;
+    }
+    uint64_t unit_start = unit_info->new_block;
+    uint64_t index = op.new_block - unit_start;
+    if (op.new_block < unit_start || index >= GetCompressionUnitBlocks(op)) {
+        LOG(ERROR) << "Block " << op.new_block << " is not part of compression unit at offset "
+                   << op.source;
+        return false;
+    }
+
+    const DecompressedUnit* unit = GetDecompressedUnit(op);
+    if (!unit) {
+        return false;
+    }
+
+    const uint8_t* data = unit->data.data() + index * header_.block_size;
+    size_t remaining = header_.block_size;
+    while (remaining) {
+        size_t actual;
+        void* buffer = sink->GetBuffer(remaining, &actual);
+        if (!buffer || !actual) {
+            LOG(ERROR) << "Could not acquire buffer from sink";
+            return false;
+        }
+        size_t to_copy = std::min(actual, remaining);
+        memcpy(buffer, data, to_copy);
+        if (!sink->ReturnData(buffer, to_copy)) {
+            LOG(ERROR) << "Could not return buffer to sink";
+            return false;
+        }
+        data += to_copy;
+        remaining -= to_copy;
+    }
+    return true;
+}
+
 }  // namespace snapshot
 }  // namespace android
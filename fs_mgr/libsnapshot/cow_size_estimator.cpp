@@ -0,0 +1,314 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <libsnapshot/cow_size_estimator.h>
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#include <android-base/logging.h>
+#include <libsnapshot/cow_writer.h>
+#include <openssl/sha.h>
+
+namespace android {
+namespace snapshot {
+
+using android::base::borrowed_fd;
+using android::base::unique_fd;
+
+// Number of blocks read from an image at a time.
+static constexpr size_t kChunkBlocks = 256;
+
+// The first 128 bits of a block's SHA256. Collisions only skew the estimate,
+// and halving the hash halves the memory used for large source images.
+struct BlockHash {
+    uint64_t lo;
+    uint64_t hi;
+
+    bool operator==(const BlockHash& other) const { return lo == other.lo && hi == other.hi; }
+};
+
+struct BlockHashHasher {
+    size_t operator()(const BlockHash& hash) const { return hash.lo; }
+};
+
+static BlockHash HashBlock(const uint8_t* data, size_t size) {
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    SHA256(data, size, digest);
+
+    BlockHash hash;
+    memcpy(&hash, digest, sizeof(hash));
+    return hash;
+}
+
+// Reads up to |size| bytes, stopping early only at the end of the file.
+static bool ReadChunk(borrowed_fd fd, uint8_t* data, size_t size, size_t* bytes_read) {
+    *bytes_read = 0;
+    while (*bytes_read < size) {
+        ssize_t rv = TEMP_FAILURE_RETRY(read(fd.get(), data + *bytes_read, size - *bytes_read));
+        if (rv < 0) {
+            PLOG(ERROR) << "read failed";
+            return false;
+        }
+        if (rv == 0) {
+            break;
+        }
+        *bytes_read += rv;
+    }
+    return true;
+}
+
+// Reads the next chunk of an image as whole blocks; a trailing partial block
+// is padded with zeroes.
+static bool ReadBlocks(borrowed_fd fd, std::vector<uint8_t>* buffer, uint32_t block_size,
+                       size_t* num_blocks) {
+    size_t bytes_read;
+    if (!ReadChunk(fd, buffer->data(), buffer->size(), &bytes_read)) {
+        return false;
+    }
+    *num_blocks = (bytes_read + block_size - 1) / block_size;
+    memset(buffer->data() + bytes_read, 0, *num_blocks * block_size - bytes_read);
+    return true;
+}
+
+CowSizeEstimator::CowSizeEstimator(const CowEstimateOptions& options) : options_(options) {}
+
+void CowSizeEstimator::AddPartition(const std::string& name, unique_fd&& target,
+                                    unique_fd&& source) {
+    partitions_.push_back({std::move(target), std::move(source)});
+    estimates_.emplace_back();
+    estimates_.back().name = name;
+}
+
+bool CowSizeEstimator::Run() {
+    // Start with the largest images, so that one big partition does not end
+    // up running alone after all the small ones are done.
+    std::vector<uint64_t> sizes(partitions_.size());
+    for (size_t i = 0; i < partitions_.size(); i++) {
+        struct stat s;
+        if (fstat(partitions_[i].target.get(), &s) < 0) {
+            PLOG(ERROR) << "fstat failed: " << estimates_[i].name;
+            return false;
+        }
+        sizes[i] = s.st_size;
+    }
+    std::vector<size_t> order(partitions_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) -> bool { return sizes[a] > sizes[b]; });
+
+    uint32_t num_threads = options_.num_threads;
+    if (!num_threads) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    num_threads = std::min<uint32_t>(num_threads, partitions_.size());
+
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> failed = false;
+    auto worker = [&]() -> void {
+        while (!failed) {
+            size_t i = next++;
+            if (i >= order.size()) {
+                return;
+            }
+            const auto& partition = partitions_[order[i]];
+            auto* estimate = &estimates_[order[i]];
+
+            LOG(INFO) << "Analyzing " << estimate->name << " ...";
+            if (!EstimatePartition(options_, partition.target, partition.source, estimate)) {
+                LOG(ERROR) << "Could not estimate COW size for " << estimate->name;
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return !failed;
+}
+
+uint64_t CowSizeEstimator::GetTotalCowSize(const std::string& compression) const {
+    uint64_t total = 0;
+    for (const auto& estimate : estimates_) {
+        if (auto iter = estimate.cow_size.find(compression); iter != estimate.cow_size.end()) {
+            total += iter->second;
+        }
+    }
+    return total;
+}
+
+bool CowSizeEstimator::EstimatePartition(const CowEstimateOptions& options, borrowed_fd target,
+                                         borrowed_fd source, PartitionCowEstimate* estimate) {
+    const uint32_t block_size = options.block_size;
+    if (!block_size) {
+        LOG(ERROR) << "Invalid block size";
+        return false;
+    }
+
+    std::vector<std::string> compressions = {"none"};
+    for (const auto& compression : options.compressions) {
+        if (!compression.empty() &&
+            std::find(compressions.begin(), compressions.end(), compression) ==
+                    compressions.end()) {
+            compressions.emplace_back(compression);
+        }
+    }
+
+    std::vector<std::unique_ptr<CowWriter>> writers;
+    for (const auto& compression : compressions) {
+        CowOptions cow_options;
+        cow_options.block_size = block_size;
+        cow_options.compression = compression;
+        cow_options.compression_factor = options.compression_factor;
+        if (compression != "none") {
+            cow_options.compression_level = options.compression_level;
+        }
+
+        auto writer = std::make_unique<CowWriter>(cow_options);
+        if (!writer->Initialize(borrowed_fd{-1})) {
+            LOG(ERROR) << "Could not initialize COW writer for " << compression;
+            return false;
+        }
+        writers.emplace_back(std::move(writer));
+    }
+
+    std::vector<uint8_t> buffer(kChunkBlocks * block_size);
+    size_t num_blocks;
+
+    std::vector<BlockHash> source_hashes;
+    std::unordered_map<BlockHash, uint64_t, BlockHashHasher> source_blocks;
+    if (source.get() >= 0) {
+        while (true) {
+            if (!ReadBlocks(source, &buffer, block_size, &num_blocks)) {
+                return false;
+            }
+            if (!num_blocks) {
+                break;
+            }
+            for (size_t i = 0; i < num_blocks; i++) {
+                auto hash = HashBlock(buffer.data() + i * block_size, block_size);
+                source_blocks[hash] = source_hashes.size();
+                source_hashes.emplace_back(hash);
+            }
+        }
+    }
+
+    enum class Op { kNone, kZero, kReplace };
+
+    const std::vector<uint8_t> zeroes(block_size, 0);
+    std::string name = std::move(estimate->name);
+    *estimate = {};
+    estimate->name = std::move(name);
+    uint64_t block = 0;
+    while (true) {
+        if (!ReadBlocks(target, &buffer, block_size, &num_blocks)) {
+            return false;
+        }
+        if (!num_blocks) {
+            break;
+        }
+
+        // Zero and replace blocks are handed to the writers in runs, so that
+        // the compression factor applies as it would in a real COW.
+        Op run_op = Op::kNone;
+        size_t run_start = 0;
+        auto flush_run = [&](size_t end) -> bool {
+            size_t run_length = end - run_start;
+            for (const auto& writer : writers) {
+                if (run_op == Op::kZero && !writer->AddZeroBlocks(block + run_start, run_length)) {
+                    return false;
+                }
+                if (run_op == Op::kReplace &&
+                    !writer->AddRawBlocks(block + run_start, buffer.data() + run_start * block_size,
+                                          run_length * block_size)) {
+                    return false;
+                }
+            }
+            run_op = Op::kNone;
+            return true;
+        };
+
+        for (size_t i = 0; i < num_blocks; i++) {
+            const uint8_t* data = buffer.data() + i * block_size;
+            Op op = Op::kNone;
+            std::optional<uint64_t> copy_source;
+
+            if (!memcmp(data, zeroes.data(), block_size)) {
+                op = Op::kZero;
+                estimate->zero_blocks++;
+            } else if (source_hashes.empty()) {
+                op = Op::kReplace;
+                estimate->replace_blocks++;
+            } else {
+                auto hash = HashBlock(data, block_size);
+                if (block + i < source_hashes.size() && source_hashes[block + i] == hash) {
+                    estimate->unchanged_blocks++;
+                } else if (auto iter = source_blocks.find(hash); iter != source_blocks.end()) {
+                    copy_source = iter->second;
+                    estimate->copy_blocks++;
+                } else {
+                    op = Op::kReplace;
+                    estimate->replace_blocks++;
+                }
+            }
+
+            if (op != run_op) {
+                if (run_op != Op::kNone && !flush_run(i)) {
+                    return false;
+                }
+                run_op = op;
+                run_start = i;
+            }
+            if (copy_source) {
+                for (const auto& writer : writers) {
+                    if (!writer->AddCopy(block + i, *copy_source)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        if (run_op != Op::kNone && !flush_run(num_blocks)) {
+            return false;
+        }
+        block += num_blocks;
+    }
+    estimate->num_blocks = block;
+
+    for (size_t i = 0; i < writers.size(); i++) {
+        if (!writers[i]->Finalize()) {
+            LOG(ERROR) << "Could not finalize COW writer for " << compressions[i];
+            return false;
+        }
+        estimate->cow_size[compressions[i]] = writers[i]->GetCowSize();
+    }
+    return true;
+}
+
+}  // namespace snapshot
+}  // namespace android
@@ -0,0 +1,129 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+#include <libsnapshot/cow_reader.h>
+#include <libsnapshot/cow_size_estimator.h>
+#include <libsnapshot/cow_writer.h>
+
+namespace android {
+namespace snapshot {
+
+using android::base::unique_fd;
+
+static constexpr uint32_t kBlockSize = 4096;
+
+class CowSizeEstimatorTest : public ::testing::Test {
+  protected:
+    // Block |i| of an image is filled with the byte |contents[i]|, 0 being
+    // a zero block.
+    std::unique_ptr<TemporaryFile> MakeImage(const std::string& contents) {
+        auto file = std::make_unique<TemporaryFile>();
+        for (char c : contents) {
+            std::string block(kBlockSize, c);
+            EXPECT_TRUE(android::base::WriteStringToFd(block, file->fd));
+        }
+        return file;
+    }
+
+    unique_fd Open(const TemporaryFile& file) {
+        return unique_fd(open(file.path, O_RDONLY | O_CLOEXEC));
+    }
+};
+
+TEST_F(CowSizeEstimatorTest, Classify) {
+    std::string source = {'a', 'b', 'c', 'd'};
+    std::string target = {'a', 'c', 'x', '\0', 'y', 'd'};
+    auto source_file = MakeImage(source);
+    auto target_file = MakeImage(target);
+
+    CowEstimateOptions options;
+    PartitionCowEstimate estimate;
+    ASSERT_TRUE(CowSizeEstimator::EstimatePartition(options, Open(*target_file), Open(*source_file),
+                                                    &estimate));
+    ASSERT_EQ(estimate.num_blocks, 6);
+    ASSERT_EQ(estimate.unchanged_blocks, 1);
+    ASSERT_EQ(estimate.copy_blocks, 2);
+    ASSERT_EQ(estimate.zero_blocks, 1);
+    ASSERT_EQ(estimate.replace_blocks, 2);
+}
+
+TEST_F(CowSizeEstimatorTest, MatchesCowWriter) {
+    std::string target = {'x', 'x', '\0', 'y', 'z'};
+    auto target_file = MakeImage(target);
+
+    CowEstimateOptions options;
+    options.compressions = {"gz", "lz4"};
+    PartitionCowEstimate estimate;
+    ASSERT_TRUE(CowSizeEstimator::EstimatePartition(options, Open(*target_file), unique_fd{},
+                                                    &estimate));
+    ASSERT_EQ(estimate.cow_size.size(), 3);
+
+    for (const auto& [compression, size] : estimate.cow_size) {
+        CowOptions cow_options;
+        cow_options.compression = compression;
+        CowWriter writer(cow_options);
+        ASSERT_TRUE(writer.Initialize(unique_fd{}));
+
+        std::string data;
+        ASSERT_TRUE(android::base::ReadFileToString(target_file->path, &data));
+        ASSERT_TRUE(writer.AddRawBlocks(0, data.data(), 2 * kBlockSize));
+        ASSERT_TRUE(writer.AddZeroBlocks(2, 1));
+        ASSERT_TRUE(writer.AddRawBlocks(3, data.data() + 3 * kBlockSize, 2 * kBlockSize));
+        ASSERT_TRUE(writer.Finalize());
+        ASSERT_EQ(writer.GetCowSize(), size) << compression;
+    }
+    ASSERT_LT(estimate.cow_size["gz"], estimate.cow_size["none"]);
+}
+
+TEST_F(CowSizeEstimatorTest, Parallel) {
+    auto source_file = MakeImage("abcd");
+    auto target1 = MakeImage("abxy");
+    auto target2 = MakeImage("dcba");
+    auto target3 = MakeImage("zzzzzzzz");
+
+    CowEstimateOptions options;
+    options.num_threads = 2;
+    CowSizeEstimator estimator(options);
+    estimator.AddPartition("one", Open(*target1), Open(*source_file));
+    estimator.AddPartition("two", Open(*target2), Open(*source_file));
+    estimator.AddPartition("three", Open(*target3), {});
+    ASSERT_TRUE(estimator.Run());
+
+    const auto& estimates = estimator.estimates();
+    ASSERT_EQ(estimates.size(), 3);
+    ASSERT_EQ(estimates[0].name, "one");
+    ASSERT_EQ(estimates[0].replace_blocks, 2);
+    ASSERT_EQ(estimates[1].name, "two");
+    ASSERT_EQ(estimates[1].copy_blocks, 4);
+    ASSERT_EQ(estimates[2].name, "three");
+    ASSERT_EQ(estimates[2].replace_blocks, 8);
+
+    uint64_t total = 0;
+    for (const auto& estimate : estimates) {
+        total += estimate.cow_size.at("gz");
+    }
+    ASSERT_EQ(estimator.GetTotalCowSize("gz"), total);
+}
+
+}  // namespace snapshot
+}  // namespace android
@@ -23,12 +23,12 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
-#include <brotli/encode.h>
 #include <libsnapshot/cow_format.h>
 #include <libsnapshot/cow_reader.h>
 #include <libsnapshot/cow_writer.h>
-#include <lz4.h>
-#include <zlib.h>
+
+#include "cow_async_writer.h"
+#include "cow_compress.h"
 
 namespace android {
 namespace snapshot {
@@ -109,6 +109,55 @@ CowWriter::CowWriter(const CowOptions& options) : ICowWriter(options), fd_(-1) {
     SetupHeaders();
 }
 
+CowWriter::~CowWriter() {
+    for (size_t i = 0; i < compress_threads_.size(); i++) {
+        CompressWorker* worker = compress_threads_[i].get();
+        if (worker) {
+            worker->Finalize();
+        }
+    }
+
+    bool ret = true;
+    for (auto& t : threads_) {
+        ret = t.get() && ret;
+    }
+
+    if (!ret) {
+        LOG(ERROR) << "Compression failed";
+    }
+    compress_threads_.clear();
+}
+
+bool CowWriter::InitCompressor() {
+    if (!compression_) {
+        return true;
+    }
+    compressor_ = ICompressor::Create(compression_, options_.compression_level,
+                                      options_.compression_dictionary);
+    return compressor_ != nullptr;
+}
+
+bool CowWriter::InitWorkers() {
+    if (!compression_ || num_compress_threads_ <= 1 || !compress_threads_.empty()) {
+        return true;
+    }
+    for (int i = 0; i < num_compress_threads_; i++) {
+        // Each worker gets its own compressor, since compression contexts
+        // cannot be shared across threads.
+        auto compressor = ICompressor::Create(compression_, options_.compression_level,
+                                              options_.compression_dictionary);
+        if (!compressor) {
+            return false;
+        }
+        auto wt = std::make_unique<CompressWorker>(std::move(compressor), options_.block_size);
+        threads_.emplace_back(std::async(std::launch::async, &CompressWorker::RunThread, wt.get()));
+        compress_threads_.push_back(std::move(wt));
+    }
+
+    LOG(INFO) << num_compress_threads_ << " thread used for compression";
+    return true;
+}
+
 void CowWriter::SetupHeaders() {
     header_ = {};
     header_.magic = kCowMagicNumber;
@@ -121,6 +170,9 @@ void CowWriter::SetupHeaders() {
     header_.num_merge_ops = options_.num_merge_ops;
     header_.cluster_ops = options_.cluster_ops;
     header_.buffer_size = 0;
+    if (options_.compression_factor > 1) {
+        header_.minor_version = kCowVersionMinorCompressionUnits;
+    }
     footer_ = {};
     footer_.op.data_length = 64;
     footer_.op.type = kCowFooterOp;
@@ -133,6 +185,8 @@ bool CowWriter::ParseOptions() {
         compression_ = kCowCompressBrotli;
     } else if (options_.compression == "lz4") {
         compression_ = kCowCompressLz4;
+    } else if (options_.compression == "zstd") {
+        compression_ = kCowCompressZstd;
     } else if (options_.compression == "none") {
         compression_ = kCowCompressNone;
     } else if (!options_.compression.empty()) {
@@ -143,6 +197,47 @@ bool CowWriter::ParseOptions() {
         LOG(ERROR) << "Clusters must contain at least two operations to function.";
         return false;
     }
+    if (options_.num_compress_threads > 1) {
+        num_compress_threads_ = options_.num_compress_threads;
+    }
+    if (options_.compression_factor == 0 ||
+        (options_.compression_factor & (options_.compression_factor - 1)) != 0 ||
+        options_.compression_factor > kCowMaxCompressionFactor) {
+        LOG(ERROR) << "Invalid compression factor: " << options_.compression_factor;
+        return false;
+    }
+    compression_factor_ = options_.compression_factor;
+    if (!options_.compression_dictionary.empty()) {
+        if (compression_ != kCowCompressZstd) {
+            LOG(ERROR) << "Compression dictionaries are only supported with zstd";
+            return false;
+        }
+        if (options_.compression_dictionary.size() >
+            std::numeric_limits<uint16_t>::max() - sizeof(CowHeader)) {
+            LOG(ERROR) << "Compression dictionary is too large: "
+                       << options_.compression_dictionary.size() << " bytes";
+            return false;
+        }
+    }
+    return true;
+}
+
+void CowWriter::InitAsyncWriter() {
+    async_writer_ = nullptr;
+    if (is_dev_null_ || !options_.write_queue_depth) {
+        return;
+    }
+    async_writer_ = CowAsyncWriter::Open(fd_, options_.write_queue_depth);
+    if (!async_writer_) {
+        LOG(INFO) << "io_uring unavailable, writing COW synchronously";
+    }
+}
+
+bool CowWriter::FlushWrites() {
+    if (async_writer_ && !async_writer_->Flush()) {
+        LOG(ERROR) << "Failed to flush queued COW writes";
+        return false;
+    }
     return true;
 }
 
@@ -178,7 +273,12 @@ bool CowWriter::Initialize(borrowed_fd fd) {
         return false;
     }
 
-    return OpenForWrite();
+    if (!OpenForWrite()) {
+        return false;
+    }
+
+    InitAsyncWriter();
+    return InitCompressor() && InitWorkers();
 }
 
 bool CowWriter::InitializeAppend(android::base::unique_fd&& fd, uint64_t label) {
@@ -191,11 +291,16 @@ bool CowWriter::InitializeAppend(android::base::borrowed_fd fd, uint64_t label)
         return false;
     }
 
-    return OpenForAppend(label);
+    if (!OpenForAppend(label)) {
+        return false;
+    }
+
+    InitAsyncWriter();
+    return InitCompressor() && InitWorkers();
 }
 
 void CowWriter::InitPos() {
-    next_op_pos_ = sizeof(header_) + header_.buffer_size;
+    next_op_pos_ = header_.header_size + header_.buffer_size;
     cluster_size_ = header_.cluster_ops * sizeof(CowOperation);
     if (header_.cluster_ops) {
         next_data_pos_ = next_op_pos_ + cluster_size_;
@@ -223,6 +328,11 @@ bool CowWriter::OpenForWrite() {
         header_.buffer_size = BUFFER_REGION_DEFAULT_SIZE;
     }
 
+    // The compression dictionary lives in the header area, between the header
+    // struct and the scratch space.
+    const auto& dictionary = options_.compression_dictionary;
+    header_.header_size = sizeof(CowHeader) + dictionary.size();
+
     // Headers are not complete, but this ensures the file is at the right
     // position.
     if (!android::base::WriteFully(fd_, &header_, sizeof(header_))) {
@@ -230,6 +340,12 @@ bool CowWriter::OpenForWrite() {
         return false;
     }
 
+    if (!dictionary.empty() &&
+        !android::base::WriteFully(fd_, dictionary.data(), dictionary.size())) {
+        PLOG(ERROR) << "writing compression dictionary failed";
+        return false;
+    }
+
     if (options_.scratch_space) {
         // Initialize the scratch space
         std::string data(header_.buffer_size, 0);
@@ -244,7 +360,7 @@ bool CowWriter::OpenForWrite() {
         return false;
     }
 
-    if (lseek(fd_.get(), sizeof(header_) + header_.buffer_size, SEEK_SET) < 0) {
+    if (lseek(fd_.get(), header_.header_size + header_.buffer_size, SEEK_SET) < 0) {
         PLOG(ERROR) << "lseek failed";
         return false;
     }
@@ -265,6 +381,30 @@ bool CowWriter::OpenForAppend(uint64_t label) {
     options_.block_size = header_.block_size;
     options_.cluster_ops = header_.cluster_ops;
 
+    // The dictionary is fixed when the COW is created. Keep using it so that
+    // appended ops can be decompressed with the same dictionary.
+    std::string dictionary;
+    reader->GetCompressionDictionary(&dictionary);
+    if (!options_.compression_dictionary.empty() && options_.compression_dictionary != dictionary) {
+        LOG(ERROR) << "Compression dictionary does not match the existing COW";
+        return false;
+    }
+    options_.compression_dictionary = std::move(dictionary);
+
+    // Compression units need a reader which understands them. Upgrade the
+    // header of an existing COW before appending any such operations.
+    if (compression_factor_ > 1 && header_.minor_version < kCowVersionMinorCompressionUnits) {
+        header_.minor_version = kCowVersionMinorCompressionUnits;
+        if (lseek(fd_.get(), 0, SEEK_SET) < 0) {
+            PLOG(ERROR) << "lseek failed";
+            return false;
+        }
+        if (!android::base::WriteFully(fd_, &header_, sizeof(header_))) {
+            PLOG(ERROR) << "rewriting header failed";
+            return false;
+        }
+    }
+
     // Reset this, since we're going to reimport all operations.
     footer_.op.num_ops = 0;
     InitPos();
@@ -295,8 +435,67 @@ bool CowWriter::EmitCopy(uint64_t new_block, uint64_t old_block) {
     return WriteOperation(op);
 }
 
+// Reduce the block 64 bytes at a time. The fixed-size inner loop is
+// vectorized by the compiler (SSE2 on x86, NEON on arm64).
+static bool IsZeroBlock(const uint8_t* data, size_t size) {
+    static constexpr size_t kStride = 64;
+    static constexpr size_t kWords = kStride / sizeof(uint64_t);
+
+    size_t pos = 0;
+    for (; pos + kStride <= size; pos += kStride) {
+        uint64_t words[kWords];
+        memcpy(words, data + pos, kStride);
+        uint64_t acc = 0;
+        for (size_t i = 0; i < kWords; i++) {
+            acc |= words[i];
+        }
+        if (acc) {
+            return false;
+        }
+    }
+    for (; pos < size; pos++) {
+        if (data[pos]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool CowWriter::EmitRawBlocks(uint64_t new_block_start, const void* data, size_t size) {
-    return EmitBlocks(new_block_start, data, size, 0, 0, kCowReplaceOp);
+    if (!options_.detect_zero_blocks) {
+        return EmitBlocks(new_block_start, data, size, 0, 0, kCowReplaceOp);
+    }
+
+    // Split the range into runs of zero and non-zero blocks, so that
+    // non-zero runs can still be compressed together.
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+    const size_t num_blocks = size / header_.block_size;
+    size_t run_start = 0;
+    bool run_is_zero = false;
+    for (size_t i = 0; i <= num_blocks; i++) {
+        bool zero = i < num_blocks && IsZeroBlock(iter + i * header_.block_size, header_.block_size);
+        if (i == run_start) {
+            run_is_zero = zero;
+            continue;
+        }
+        if (i < num_blocks && zero == run_is_zero) {
+            continue;
+        }
+
+        const size_t run_blocks = i - run_start;
+        if (run_is_zero) {
+            if (!EmitZeroBlocks(new_block_start + run_start, run_blocks)) {
+                return false;
+            }
+            num_detected_zero_blocks_ += run_blocks;
+        } else if (!EmitBlocks(new_block_start + run_start, iter + run_start * header_.block_size,
+                               run_blocks * header_.block_size, 0, 0, kCowReplaceOp)) {
+            return false;
+        }
+        run_start = i;
+        run_is_zero = zero;
+    }
+    return true;
 }
 
 bool CowWriter::EmitXorBlocks(uint32_t new_block_start, const void* data, size_t size,
@@ -304,46 +503,178 @@ bool CowWriter::EmitXorBlocks(uint32_t new_block_start, const void* data, size_t
     return EmitBlocks(new_block_start, data, size, old_block, offset, kCowXorOp);
 }
 
+bool CowWriter::CompressBlocks(size_t num_blocks, const void* data) {
+    size_t num_threads = (num_blocks == 1) ? 1 : num_compress_threads_;
+    size_t num_blocks_per_thread = num_blocks / num_threads;
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+    compressed_buf_.clear();
+    if (num_threads <= 1) {
+        return CompressWorker::CompressBlocks(compressor_.get(), options_.block_size, data,
+                                              num_blocks, &compressed_buf_);
+    }
+
+    // Submit the blocks per thread. The retrieval of
+    // compressed buffers has to be done in the same order.
+    // We should not poll for completed buffers in a different order as the
+    // buffers are tightly coupled with block ordering.
+    for (size_t i = 0; i < num_threads; i++) {
+        CompressWorker* worker = compress_threads_[i].get();
+        if (i == num_threads - 1) {
+            num_blocks_per_thread = num_blocks;
+        }
+        worker->EnqueueCompressBlocks(iter, num_blocks_per_thread);
+        iter += (num_blocks_per_thread * header_.block_size);
+        num_blocks -= num_blocks_per_thread;
+    }
+
+    for (size_t i = 0; i < num_threads; i++) {
+        CompressWorker* worker = compress_threads_[i].get();
+        if (!worker->GetCompressedBuffers(&compressed_buf_)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool CowWriter::EmitBlocks(uint64_t new_block_start, const void* data, size_t size,
                            uint64_t old_block, uint16_t offset, uint8_t type) {
-    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
     CHECK(!merge_in_progress_);
-    for (size_t i = 0; i < size / header_.block_size; i++) {
-        CowOperation op = {};
-        op.new_block = new_block_start + i;
-        op.type = type;
-        if (type == kCowXorOp) {
-            op.source = (old_block + i) * header_.block_size + offset;
-        } else {
-            op.source = next_data_pos_;
+    if (type != kCowReplaceOp || !compression_ || compression_factor_ <= 1) {
+        return EmitBlockOps(new_block_start, data, size, old_block, offset, type);
+    }
+
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+    const size_t unit_size = header_.block_size * compression_factor_;
+    while (size >= unit_size) {
+        bool emitted;
+        if (!EmitCompressionUnit(new_block_start, iter, &emitted)) {
+            return false;
         }
+        // Fall back to individual blocks if the unit did not compress well
+        // enough to fit in a single operation.
+        if (!emitted && !EmitBlockOps(new_block_start, iter, unit_size, 0, 0, type)) {
+            return false;
+        }
+        new_block_start += compression_factor_;
+        iter += unit_size;
+        size -= unit_size;
+    }
+    if (!size) {
+        return true;
+    }
+    return EmitBlockOps(new_block_start, iter, size, 0, 0, type);
+}
+
+bool CowWriter::EmitCompressionUnit(uint64_t new_block_start, const void* data, bool* emitted) {
+    *emitted = false;
+
+    auto compressed = compressor_->Compress(data, header_.block_size * compression_factor_);
+    if (compressed.empty()) {
+        PLOG(ERROR) << "EmitCompressionUnit: compression failed";
+        return false;
+    }
+    if (compressed.size() > std::numeric_limits<uint16_t>::max()) {
+        return true;
+    }
 
-        if (compression_) {
-            auto data = Compress(iter, header_.block_size);
-            if (data.empty()) {
-                PLOG(ERROR) << "AddRawBlocks: compression failed";
+    const uint8_t unit_shift = __builtin_ctz(compression_factor_);
+    const uint8_t compression = compression_ | (unit_shift << kCowCompressionUnitShift);
+    const uint64_t unit_source = next_data_pos_;
+    for (uint32_t i = 0; i < compression_factor_; i++) {
+        CowOperation op = {};
+        op.type = kCowReplaceOp;
+        op.compression = compression;
+        op.new_block = new_block_start + i;
+        op.source = unit_source;
+        if (i == 0) {
+            op.data_length = static_cast<uint16_t>(compressed.size());
+            if (!WriteOperation(op, compressed.data(), compressed.size())) {
+                PLOG(ERROR) << "EmitCompressionUnit: write failed";
                 return false;
             }
-            if (data.size() > std::numeric_limits<uint16_t>::max()) {
-                LOG(ERROR) << "Compressed block is too large: " << data.size() << " bytes";
+        } else if (!WriteOperation(op)) {
+            PLOG(ERROR) << "EmitCompressionUnit: write failed";
+            return false;
+        }
+    }
+    *emitted = true;
+    return true;
+}
+
+bool CowWriter::EmitBlockOps(uint64_t new_block_start, const void* data, size_t size,
+                             uint64_t old_block, uint16_t offset, uint8_t type) {
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+
+    // Update engine can potentially send 100MB of blocks at a time. We
+    // don't want to process all those blocks in one shot as it can
+    // stress the memory. Hence, process the blocks in batches so that
+    // memory usage stays bounded.
+    const size_t kProcessingBlocks = 4096;
+    size_t num_blocks = (size / header_.block_size);
+    size_t i = 0;
+
+    while (num_blocks) {
+        size_t pending_blocks = (std::min(kProcessingBlocks, num_blocks));
+
+        if (compression_ && num_compress_threads_ > 1) {
+            if (!CompressBlocks(pending_blocks, iter)) {
                 return false;
             }
-            op.compression = compression_;
-            op.data_length = static_cast<uint16_t>(data.size());
+            CHECK(pending_blocks == compressed_buf_.size());
+        }
 
-            if (!WriteOperation(op, data.data(), data.size())) {
-                PLOG(ERROR) << "AddRawBlocks: write failed";
-                return false;
+        num_blocks -= pending_blocks;
+
+        size_t blk = 0;
+        while (pending_blocks) {
+            CowOperation op = {};
+            op.new_block = new_block_start + i;
+            op.type = type;
+            if (type == kCowXorOp) {
+                op.source = (old_block + i) * header_.block_size + offset;
+            } else {
+                op.source = next_data_pos_;
             }
-        } else {
-            op.data_length = static_cast<uint16_t>(header_.block_size);
-            if (!WriteOperation(op, iter, header_.block_size)) {
-                PLOG(ERROR) << "AddRawBlocks: write failed";
-                return false;
+
+            if (compression_) {
+                std::basic_string<uint8_t> inline_data;
+                const std::basic_string<uint8_t>* data;
+                if (num_compress_threads_ > 1) {
+                    data = &compressed_buf_[blk];
+                } else {
+                    inline_data = compressor_->Compress(iter, header_.block_size);
+                    if (inline_data.empty()) {
+                        PLOG(ERROR) << "AddRawBlocks: compression failed";
+                        return false;
+                    }
+                    if (inline_data.size() > std::numeric_limits<uint16_t>::max()) {
+                        LOG(ERROR) << "Compressed block is too large: " << inline_data.size()
+                                   << " bytes";
+                        return false;
+                    }
+                    data = &inline_data;
+                }
+                op.compression = compression_;
+                op.data_length = static_cast<uint16_t>(data->size());
+
+                if (!WriteOperation(op, data->data(), data->size())) {
+                    PLOG(ERROR) << "AddRawBlocks: write failed";
+                    return false;
+                }
+            } else {
+                op.data_length = static_cast<uint16_t>(header_.block_size);
+                if (!WriteOperation(op, iter, header_.block_size)) {
+                    PLOG(ERROR) << "AddRawBlocks: write failed";
+                    return false;
+                }
             }
-        }
 
-        iter += header_.block_size;
+            iter += header_.block_size;
+            i += 1;
+            blk += 1;
+            pending_blocks -= 1;
+        }
     }
     return true;
 }
@@ -404,67 +735,6 @@ bool CowWriter::EmitClusterIfNeeded() {
     return true;
 }
 
-std::basic_string<uint8_t> CowWriter::Compress(const void* data, size_t length) {
-    switch (compression_) {
-        case kCowCompressGz: {
-            const auto bound = compressBound(length);
-            std::basic_string<uint8_t> buffer(bound, '\0');
-
-            uLongf dest_len = bound;
-            auto rv = compress2(buffer.data(), &dest_len, reinterpret_cast<const Bytef*>(data),
-                                length, Z_BEST_COMPRESSION);
-            if (rv != Z_OK) {
-                LOG(ERROR) << "compress2 returned: " << rv;
-                return {};
-            }
-            buffer.resize(dest_len);
-            return buffer;
-        }
-        case kCowCompressBrotli: {
-            const auto bound = BrotliEncoderMaxCompressedSize(length);
-            if (!bound) {
-                LOG(ERROR) << "BrotliEncoderMaxCompressedSize returned 0";
-                return {};
-            }
-            std::basic_string<uint8_t> buffer(bound, '\0');
-
-            size_t encoded_size = bound;
-            auto rv = BrotliEncoderCompress(
-                    BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE, length,
-                    reinterpret_cast<const uint8_t*>(data), &encoded_size, buffer.data());
-            if (!rv) {
-                LOG(ERROR) << "BrotliEncoderCompress failed";
-                return {};
-            }
-            buffer.resize(encoded_size);
-            return buffer;
-        }
-        case kCowCompressLz4: {
-            const auto bound = LZ4_compressBound(length);
-            if (!bound) {
-                LOG(ERROR) << "LZ4_compressBound returned 0";
-                return {};
-            }
-            std::basic_string<uint8_t> buffer(bound, '\0');
-
-            const auto compressed_size = LZ4_compress_default(
-                    static_cast<const char*>(data), reinterpret_cast<char*>(buffer.data()), length,
-                    buffer.size());
-            if (compressed_size <= 0) {
-                LOG(ERROR) << "LZ4_compress_default failed, input size: " << length
-                           << ", compression bound: " << bound << ", ret: " << compressed_size;
-                return {};
-            }
-            buffer.resize(compressed_size);
-            return buffer;
-        }
-        default:
-            LOG(ERROR) << "unhandled compression type: " << compression_;
-            break;
-    }
-    return {};
-}
-
 // TODO: Fix compilation issues when linking libcrypto library
 // when snapuserd is compiled as part of ramdisk.
 static void SHA256(const void*, size_t, uint8_t[]) {
@@ -507,6 +777,12 @@ bool CowWriter::Finalize() {
         extra_cluster = true;
     }
 
+    // The footer and truncation below are written synchronously, after
+    // everything queued so far.
+    if (!FlushWrites()) {
+        return false;
+    }
+
     footer_.op.ops_size = ops_.size();
     if (lseek(fd_.get(), next_op_pos_, SEEK_SET) < 0) {
         PLOG(ERROR) << "Failed to seek to footer position.";
@@ -566,12 +842,18 @@ bool CowWriter::GetDataPos(uint64_t* pos) {
 }
 
 bool CowWriter::WriteOperation(const CowOperation& op, const void* data, size_t size) {
-    if (lseek(fd_.get(), next_op_pos_, SEEK_SET) < 0) {
-        PLOG(ERROR) << "lseek failed for writing operation.";
-        return false;
-    }
-    if (!android::base::WriteFully(fd_, reinterpret_cast<const uint8_t*>(&op), sizeof(op))) {
-        return false;
+    if (async_writer_) {
+        if (!async_writer_->Write(&op, sizeof(op), next_op_pos_)) {
+            return false;
+        }
+    } else {
+        if (lseek(fd_.get(), next_op_pos_, SEEK_SET) < 0) {
+            PLOG(ERROR) << "lseek failed for writing operation.";
+            return false;
+        }
+        if (!android::base::WriteFully(fd_, reinterpret_cast<const uint8_t*>(&op), sizeof(op))) {
+            return false;
+        }
     }
     if (data != nullptr && size > 0) {
         if (!WriteRawData(data, size)) return false;
@@ -597,6 +879,9 @@ void CowWriter::AddOperation(const CowOperation& op) {
 }
 
 bool CowWriter::WriteRawData(const void* data, size_t size) {
+    if (async_writer_) {
+        return async_writer_->Write(data, size, next_data_pos_);
+    }
     if (lseek(fd_.get(), next_data_pos_, SEEK_SET) < 0) {
         PLOG(ERROR) << "lseek failed for writing data.";
         return false;
@@ -612,6 +897,9 @@ bool CowWriter::Sync() {
     if (is_dev_null_) {
         return true;
     }
+    if (!FlushWrites()) {
+        return false;
+    }
     if (fsync(fd_.get()) < 0) {
         PLOG(ERROR) << "fsync failed";
         return false;
@@ -21,7 +21,6 @@
 #include <iostream>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <unordered_set>
 
 #include <android-base/file.h>
@@ -29,19 +28,20 @@
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <gflags/gflags.h>
-#include <libsnapshot/cow_writer.h>
-#include <openssl/sha.h>
+#include <libsnapshot/cow_size_estimator.h>
 #include <sparse/sparse.h>
 #include <ziparchive/zip_archive.h>
 
 DEFINE_string(source_tf, "", "Source target files (dir or zip file)");
 DEFINE_string(ota_tf, "", "Target files of the build for an OTA");
-DEFINE_string(compression, "gz", "Compression (options: none, gz, brotli)");
+DEFINE_string(compression, "gz",
+              "Comma-separated list of compression algorithms to estimate (options: gz, brotli, "
+              "lz4, zstd). The uncompressed size is always reported.");
+DEFINE_uint32(threads, 0, "Number of partitions analyzed in parallel (0: one per CPU)");
 
 namespace android {
 namespace snapshot {
 
-using android::base::borrowed_fd;
 using android::base::unique_fd;
 
 static constexpr size_t kBlockSize = 4096;
@@ -215,16 +215,20 @@ class NonAbEstimator final {
 
   private:
     bool OpenPackages();
-    bool AnalyzePartition(const std::string& partition_name);
-    std::unordered_map<std::string, uint64_t> GetBlockMap(borrowed_fd fd);
+    bool AddPartition(CowSizeEstimator* estimator, const std::string& partition_name);
 
     std::string ota_tf_path_;
     std::string source_tf_path_;
     std::unique_ptr<TargetFilesPackage> ota_tf_;
     std::unique_ptr<TargetFilesPackage> source_tf_;
-    uint64_t size_ = 0;
+    std::unordered_set<std::string> source_partitions_;
 };
 
+static void PrintSize(const std::string& label, uint64_t size) {
+    int64_t size_in_mb = int64_t(double(size) / 1024.0 / 1024.0);
+    std::cout << label << ": " << size << " (" << size_in_mb << "MiB)\n";
+}
+
 bool NonAbEstimator::Run() {
     if (!OpenPackages()) {
         return false;
@@ -235,15 +239,35 @@ bool NonAbEstimator::Run() {
         LOG(ERROR) << "No dynamic partitions found in META/misc_info.txt";
         return false;
     }
+
+    CowEstimateOptions options;
+    options.block_size = kBlockSize;
+    options.compressions = android::base::Split(FLAGS_compression, ",");
+    options.num_threads = FLAGS_threads;
+
+    CowSizeEstimator estimator(options);
     for (const auto& partition : partitions) {
-        if (!AnalyzePartition(partition)) {
+        if (!AddPartition(&estimator, partition)) {
             return false;
         }
     }
+    if (!estimator.Run()) {
+        return false;
+    }
 
-    int64_t size_in_mb = int64_t(double(size_) / 1024.0 / 1024.0);
-
-    std::cout << "Estimated COW size: " << size_ << " (" << size_in_mb << "MiB)\n";
+    for (const auto& estimate : estimator.estimates()) {
+        std::cout << estimate.name << ": " << estimate.num_blocks << " blocks, "
+                  << estimate.zero_blocks << " zero, " << estimate.unchanged_blocks
+                  << " unchanged, " << estimate.copy_blocks << " copy, "
+                  << estimate.replace_blocks << " replace\n";
+        for (const auto& [compression, size] : estimate.cow_size) {
+            PrintSize("  COW size (" + compression + ")", size);
+        }
+    }
+    for (const auto& compression : estimator.estimates()[0].cow_size) {
+        PrintSize("Estimated COW size (" + compression.first + ")",
+                  estimator.GetTotalCowSize(compression.first));
+    }
     return true;
 }
 
@@ -257,20 +281,12 @@ bool NonAbEstimator::OpenPackages() {
         if (!source_tf_->Open()) {
             return false;
         }
+        source_partitions_ = source_tf_->GetDynamicPartitionNames();
     }
     return true;
 }
 
-static std::string SHA256(const std::string& input) {
-    std::string hash(32, '\0');
-    SHA256_CTX c;
-    SHA256_Init(&c);
-    SHA256_Update(&c, input.data(), input.size());
-    SHA256_Final(reinterpret_cast<unsigned char*>(hash.data()), &c);
-    return hash;
-}
-
-bool NonAbEstimator::AnalyzePartition(const std::string& partition_name) {
+bool NonAbEstimator::AddPartition(CowSizeEstimator* estimator, const std::string& partition_name) {
     auto path = "IMAGES/" + partition_name + ".img";
     auto fd = ota_tf_->OpenImage(path);
     if (fd < 0) {
@@ -278,29 +294,10 @@ bool NonAbEstimator::AnalyzePartition(const std::string& partition_name) {
     }
 
     unique_fd source_fd;
-    uint64_t source_size = 0;
-    std::unordered_map<std::string, uint64_t> source_blocks;
     if (source_tf_) {
-        auto dap = source_tf_->GetDynamicPartitionNames();
-
         source_fd = source_tf_->OpenImage(path);
-        if (source_fd >= 0) {
-            struct stat s;
-            if (fstat(source_fd.get(), &s)) {
-                PLOG(ERROR) << "fstat failed";
-                return false;
-            }
-            source_size = s.st_size;
-
-            std::cout << "Hashing blocks for " << partition_name << "...\n";
-            source_blocks = GetBlockMap(source_fd);
-            if (source_blocks.empty()) {
-                LOG(ERROR) << "Could not build a block map for source partition: "
-                           << partition_name;
-                return false;
-            }
-        } else {
-            if (dap.count(partition_name)) {
+        if (source_fd < 0) {
+            if (source_partitions_.count(partition_name)) {
                 return false;
             }
             LOG(ERROR) << "Warning: " << partition_name
@@ -308,107 +305,10 @@ bool NonAbEstimator::AnalyzePartition(const std::string& partition_name) {
         }
     }
 
-    TemporaryFile cow;
-    if (cow.fd < 0) {
-        PLOG(ERROR) << "mkstemp failed";
-        return false;
-    }
-
-    CowOptions options;
-    options.block_size = kBlockSize;
-    options.compression = FLAGS_compression;
-
-    auto writer = std::make_unique<CowWriter>(options);
-    if (!writer->Initialize(borrowed_fd{cow.fd})) {
-        LOG(ERROR) << "Could not initialize COW writer";
-        return false;
-    }
-
-    LOG(INFO) << "Analyzing " << partition_name << " ...";
-
-    std::string zeroes(kBlockSize, '\0');
-    std::string chunk(kBlockSize, '\0');
-    std::string src_chunk(kBlockSize, '\0');
-    uint64_t next_block_number = 0;
-    while (true) {
-        if (!android::base::ReadFully(fd, chunk.data(), chunk.size())) {
-            if (errno) {
-                PLOG(ERROR) << "read failed";
-                return false;
-            }
-            break;
-        }
-
-        uint64_t block_number = next_block_number++;
-        if (chunk == zeroes) {
-            if (!writer->AddZeroBlocks(block_number, 1)) {
-                LOG(ERROR) << "Could not add zero block";
-                return false;
-            }
-            continue;
-        }
-
-        uint64_t source_offset = block_number * kBlockSize;
-        if (source_fd >= 0 && source_offset <= source_size) {
-            off64_t offset = block_number * kBlockSize;
-            if (android::base::ReadFullyAtOffset(source_fd, src_chunk.data(), src_chunk.size(),
-                                                 offset)) {
-                if (chunk == src_chunk) {
-                    continue;
-                }
-            } else if (errno) {
-                PLOG(ERROR) << "pread failed";
-                return false;
-            }
-        }
-
-        auto hash = SHA256(chunk);
-        if (auto iter = source_blocks.find(hash); iter != source_blocks.end()) {
-            if (!writer->AddCopy(block_number, iter->second)) {
-                return false;
-            }
-            continue;
-        }
-
-        if (!writer->AddRawBlocks(block_number, chunk.data(), chunk.size())) {
-            return false;
-        }
-    }
-
-    if (!writer->Finalize()) {
-        return false;
-    }
-
-    struct stat s;
-    if (fstat(cow.fd, &s) < 0) {
-        PLOG(ERROR) << "fstat failed";
-        return false;
-    }
-
-    size_ += s.st_size;
+    estimator->AddPartition(partition_name, std::move(fd), std::move(source_fd));
     return true;
 }
 
-std::unordered_map<std::string, uint64_t> NonAbEstimator::GetBlockMap(borrowed_fd fd) {
-    std::string chunk(kBlockSize, '\0');
-
-    std::unordered_map<std::string, uint64_t> block_map;
-    uint64_t block_number = 0;
-    while (true) {
-        if (!android::base::ReadFully(fd, chunk.data(), chunk.size())) {
-            if (errno) {
-                PLOG(ERROR) << "read failed";
-                return {};
-            }
-            break;
-        }
-        auto hash = SHA256(chunk);
-        block_map[hash] = block_number;
-        block_number++;
-    }
-    return block_map;
-}
-
 }  // namespace snapshot
 }  // namespace android
 
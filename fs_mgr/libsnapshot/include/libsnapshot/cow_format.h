@@ -24,6 +24,10 @@ static constexpr uint64_t kCowMagicNumber = 0x436f77634f572121ULL;
 static constexpr uint32_t kCowVersionMajor = 2;
 static constexpr uint32_t kCowVersionMinor = 0;
 
+// Minor version which allows runs of contiguous replace ops to be compressed
+// together as a single unit. See kCowCompressionUnitShift below.
+static constexpr uint32_t kCowVersionMinorCompressionUnits = 1;
+
 static constexpr uint32_t kCowVersionManifest = 2;
 
 static constexpr size_t BLOCK_SZ = 4096;
@@ -58,7 +62,8 @@ struct CowHeader {
     uint16_t major_version;
     uint16_t minor_version;
 
-    // Size of this struct.
+    // Size of the header area. This is the size of this struct, followed by
+    // the zstd compression dictionary, if any.
     uint16_t header_size;
 
     // Size of footer struct
@@ -115,10 +120,18 @@ struct CowOperation {
 
     // If this operation reads from the data section of the COW, this contains
     // the compression type of that data (see constants below).
+    //
+    // Starting with kCowVersionMinorCompressionUnits, the upper four bits of
+    // replace operations hold log2 of the number of blocks which were
+    // compressed together as one unit.
     uint8_t compression;
 
     // If this operation reads from the data section of the COW, this contains
     // the length.
+    //
+    // For replace operations which are part of a compression unit, only the
+    // first operation of the unit carries the compressed length; the other
+    // operations of the unit have a length of zero.
     uint16_t data_length;
 
     // The block of data in the new image that this operation modifies.
@@ -130,7 +143,8 @@ struct CowOperation {
     //
     // For replace operations, this is a byte offset within the COW's data
     // sections (eg, not landing within the header or metadata). It is an
-    // absolute position within the image.
+    // absolute position within the image. All replace operations of a
+    // compression unit point at the start of the unit's data.
     //
     // For zero operations (replace with all zeroes), this is unused and must
     // be zero.
@@ -158,9 +172,16 @@ enum CowCompressionAlgorithm : uint8_t {
     kCowCompressNone = 0,
     kCowCompressGz = 1,
     kCowCompressBrotli = 2,
-    kCowCompressLz4 = 3
+    kCowCompressLz4 = 3,
+    kCowCompressZstd = 4,
 };
 
+static constexpr uint8_t kCowCompressionAlgorithmMask = 0x0f;
+static constexpr uint8_t kCowCompressionUnitShift = 4;
+
+// Largest number of blocks which can be compressed together as one unit.
+static constexpr uint32_t kCowMaxCompressionFactor = 16;
+
 static constexpr uint8_t kCowReadAheadNotStarted = 0;
 static constexpr uint8_t kCowReadAheadInProgress = 1;
 static constexpr uint8_t kCowReadAheadDone = 2;
@@ -196,5 +217,12 @@ bool IsMetadataOp(const CowOperation& op);
 // Ops that have dependencies on old blocks, and must take care in their merge order
 bool IsOrderedOp(const CowOperation& op);
 
+// Return the compression algorithm of an operation, without the unit size.
+CowCompressionAlgorithm GetCompressionAlgorithm(const CowOperation& op);
+
+// Return the number of blocks compressed together with this operation. This
+// is 1 for operations which are not part of a compression unit.
+uint32_t GetCompressionUnitBlocks(const CowOperation& op);
+
 }  // namespace snapshot
 }  // namespace android
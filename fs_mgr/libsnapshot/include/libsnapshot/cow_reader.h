@@ -16,10 +16,17 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <array>
 #include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_format.h>
@@ -28,6 +35,7 @@ namespace android {
 namespace snapshot {
 
 class ICowOpIter;
+class IDecompressor;
 
 // A ByteSink object handles requests for a buffer of a specific size. It
 // always owns the underlying buffer. It's designed to minimize potential
@@ -108,15 +116,173 @@ class ICowOpIter {
     virtual bool RDone() = 0;
 };
 
+// Read-only map from |Key| to |Value|, stored as two sorted arrays and
+// searched with a binary search. For the millions of entries a large COW can
+// have, this is several times smaller than an unordered_map, and lookups stay
+// within a few cache lines.
+template <typename Key, typename Value>
+class CowOpIndex {
+  public:
+    void reserve(size_t count) {
+        keys_.reserve(count);
+        values_.reserve(count);
+    }
+
+    // Entries may be added in any order. Finalize() must be called before
+    // any lookups.
+    void Add(Key key, const Value& value) {
+        keys_.push_back(key);
+        values_.push_back(value);
+    }
+
+    // Sort the index. If a key was added more than once, the first entry wins.
+    void Finalize() {
+        if (!std::is_sorted(keys_.begin(), keys_.end())) {
+            std::vector<uint32_t> order(keys_.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(),
+                             [this](uint32_t a, uint32_t b) { return keys_[a] < keys_[b]; });
+
+            std::vector<Key> keys(keys_.size());
+            std::vector<Value> values(values_.size());
+            for (size_t i = 0; i < order.size(); i++) {
+                keys[i] = keys_[order[i]];
+                values[i] = values_[order[i]];
+            }
+            keys_ = std::move(keys);
+            values_ = std::move(values);
+        }
+
+        size_t out = 0;
+        for (size_t i = 0; i < keys_.size(); i++) {
+            if (out > 0 && keys_[out - 1] == keys_[i]) {
+                continue;
+            }
+            keys_[out] = keys_[i];
+            values_[out] = values_[i];
+            out++;
+        }
+        keys_.resize(out);
+        values_.resize(out);
+        keys_.shrink_to_fit();
+        values_.shrink_to_fit();
+    }
+
+    // Return the value for |key|, or nullptr if it is not present.
+    const Value* Find(Key key) const {
+        size_t lo = 0;
+        size_t hi = keys_.size();
+
+        // Block numbers and data offsets in a COW are dense and close to
+        // uniformly spread, so an interpolation search usually lands on the
+        // key in one or two probes. Bound the number of probes and finish with
+        // a binary search in case the distribution is skewed.
+        for (int probes = 0; probes < 4 && hi - lo > 8; probes++) {
+            Key lo_key = keys_[lo];
+            Key hi_key = keys_[hi - 1];
+            if (key < lo_key || key > hi_key) {
+                return nullptr;
+            }
+            if (lo_key == hi_key) {
+                break;
+            }
+            double fraction = static_cast<double>(key - lo_key) / (hi_key - lo_key);
+            size_t pos = lo + static_cast<size_t>(fraction * (hi - 1 - lo));
+            if (keys_[pos] == key) {
+                return &values_[pos];
+            }
+            if (keys_[pos] < key) {
+                lo = pos + 1;
+            } else {
+                hi = pos;
+            }
+        }
+
+        auto begin = keys_.begin() + lo;
+        auto end = keys_.begin() + hi;
+        auto iter = std::lower_bound(begin, end, key);
+        if (iter == end || *iter != key) {
+            return nullptr;
+        }
+        return &values_[iter - keys_.begin()];
+    }
+
+    bool Contains(Key key) const { return Find(key) != nullptr; }
+    size_t size() const { return keys_.size(); }
+
+    // The sorted keys and their values, as left by Finalize().
+    const std::vector<Key>& keys() const { return keys_; }
+    const std::vector<Value>& values() const { return values_; }
+
+    // Replace the contents with the keys and values of a finalized index.
+    void Assign(std::vector<Key>&& keys, std::vector<Value>&& values) {
+        keys_ = std::move(keys);
+        values_ = std::move(values);
+    }
+
+    // Heap bytes used by the index.
+    size_t MemoryUsage() const {
+        return keys_.capacity() * sizeof(Key) + values_.capacity() * sizeof(Value);
+    }
+
+  private:
+    std::vector<Key> keys_;
+    std::vector<Value> values_;
+};
+
+// The parsed op stream of a COW. Ops are either copied into memory, or
+// referenced in place inside a read-only mapping of the COW file.
+class CowOpStore {
+  public:
+    explicit CowOpStore(std::vector<CowOperation>&& ops);
+
+    // |cluster_offsets| holds the file offset of each op cluster, and
+    // |cluster_first_op| the index of the cluster's first op.
+    CowOpStore(std::shared_ptr<const uint8_t> mapping, std::vector<uint64_t>&& cluster_offsets,
+               std::vector<uint64_t>&& cluster_first_op, uint64_t ops_per_cluster,
+               size_t num_ops);
+
+    const CowOperation& operator[](size_t index) const {
+        if (!mapping_) {
+            return ops_[index];
+        }
+        return *reinterpret_cast<const CowOperation*>(mapping_.get() + MappedOffset(index));
+    }
+
+    size_t size() const { return num_ops_; }
+    bool mapped() const { return mapping_ != nullptr; }
+
+  private:
+    uint64_t MappedOffset(size_t index) const;
+
+    std::vector<CowOperation> ops_;
+
+    std::shared_ptr<const uint8_t> mapping_;
+    std::vector<uint64_t> cluster_offsets_;
+    std::vector<uint64_t> cluster_first_op_;
+    uint64_t ops_per_cluster_ = 1;
+    size_t num_ops_ = 0;
+};
+
 class CowReader final : public ICowReader {
   public:
+    // Flags may be combined with operator|.
     enum class ReaderFlags {
         DEFAULT = 0,
         USERSPACE_MERGE = 1,
+        // Map the COW file read-only instead of reading it. Ops are not copied
+        // to the heap; iterators walk the mapped op clusters directly, and
+        // op data is decompressed (or copied, if uncompressed) straight from
+        // the mapping into the sink.
+        MMAP = 2,
+        // Only build the block index during Parse(), which is all that
+        // ReadData() and GetOpIter() need. The merge sequence is prepared on a
+        // background thread; anything that depends on it waits for it.
+        DEFER_MERGE_PREP = 4,
     };
 
     CowReader(ReaderFlags reader_flag = ReaderFlags::DEFAULT);
-    ~CowReader() { owned_fd_ = {}; }
+    ~CowReader();
 
     // Parse the COW, optionally, up to the given label. If no label is
     // specified, the COW must have an intact footer.
@@ -124,8 +290,25 @@ class CowReader final : public ICowReader {
     bool Parse(android::base::borrowed_fd fd, std::optional<uint64_t> label = {});
 
     bool InitForMerge(android::base::unique_fd&& fd);
+
+    // Write everything Parse() computed to |state_fd|, so that another
+    // process reading the same COW can restore it with ImportParsedState()
+    // instead of parsing the COW again. Not supported with ReaderFlags::MMAP,
+    // or for a COW parsed up to a label.
+    bool ExportParsedState(android::base::borrowed_fd state_fd);
+
+    // Restore, from the current offset of |state_fd|, the state written by
+    // ExportParsedState() in place of calling Parse(fd). Fails if the size or
+    // header of the COW at |fd| differ from those of the COW it was exported
+    // from, in which case the COW must be parsed instead.
+    bool ImportParsedState(android::base::borrowed_fd fd, android::base::borrowed_fd state_fd);
     bool VerifyMergeOps() override;
 
+    // Wait for deferred merge preparation to finish. Returns false if it
+    // failed. Without ReaderFlags::DEFER_MERGE_PREP, this returns
+    // immediately.
+    bool WaitForMergeOps();
+
     bool GetHeader(CowHeader* header) override;
     bool GetFooter(CowFooter* footer) override;
 
@@ -136,6 +319,8 @@ class CowReader final : public ICowReader {
     // whose lifetime depends on the CowOpIter object; the return
     // value of these will never be null.
     std::unique_ptr<ICowOpIter> GetOpIter() override;
+
+    // The merge iterators return nullptr if merge preparation failed.
     std::unique_ptr<ICowOpIter> GetRevMergeOpIter(bool ignore_progress = false) override;
     std::unique_ptr<ICowOpIter> GetMergeOpIter(bool ignore_progress = false) override;
 
@@ -143,25 +328,83 @@ class CowReader final : public ICowReader {
 
     bool GetRawBytes(uint64_t offset, void* buffer, size_t len, size_t* read);
 
+    // With ReaderFlags::MMAP, return a pointer to |len| bytes of the mapped
+    // COW at |offset|. Returns nullptr otherwise, or if the range is invalid.
+    const uint8_t* GetMappedBytes(uint64_t offset, size_t len);
+
+    // Serve op data from a buffer holding the data region of the most recently
+    // used cluster. A read outside the buffer fetches the containing cluster's
+    // whole data region with a single read. This suits callers which read
+    // ops in COW order, such as merge and verification. Has no effect on
+    // unclustered or mapped COWs.
+    void SetClusterPrefetch(bool enabled);
+
+    // Return the zstd compression dictionary stored in the header area. Returns
+    // false if the COW does not have one.
+    bool GetCompressionDictionary(std::string* dictionary);
+
     // Returns the total number of data ops that should be merged. This is the
     // count of the merge sequence before removing already-merged operations.
     // It may be different than the actual data op count, for example, if there
     // are duplicate ops in the stream.
-    uint64_t get_num_total_data_ops() { return num_total_data_ops_; }
+    uint64_t get_num_total_data_ops() {
+        WaitForMergeOps();
+        return num_total_data_ops_;
+    }
 
-    uint64_t get_num_ordered_ops_to_merge() { return num_ordered_ops_to_merge_; }
+    uint64_t get_num_ordered_ops_to_merge() {
+        WaitForMergeOps();
+        return num_ordered_ops_to_merge_;
+    }
 
     void CloseCowFd() { owned_fd_ = {}; }
 
     // Creates a clone of the current CowReader without the file handlers
     std::unique_ptr<CowReader> CloneCowReader();
 
-    void UpdateMergeOpsCompleted(int num_merge_ops) { header_.num_merge_ops += num_merge_ops; }
+    void UpdateMergeOpsCompleted(int num_merge_ops) {
+        WaitForMergeOps();
+        header_.num_merge_ops += num_merge_ops;
+    }
 
   private:
+    // First operation of a group of replace blocks compressed as one unit.
+    struct CompressionUnit {
+        uint64_t new_block;
+        uint16_t data_length;
+    } __attribute__((packed));
+
+    // Data region of a cluster, from the end of its op area to the start of
+    // the next cluster.
+    struct ClusterData {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    // Larger clusters are read op by op.
+    static constexpr size_t kMaxClusterPrefetchSize = 2 * 1024 * 1024;
+
+    // A decompressed compression unit, keyed by its data offset.
+    struct DecompressedUnit {
+        uint64_t source = 0;
+        std::basic_string<uint8_t> data;
+    };
+
+    bool HasFlag(ReaderFlags flag) const {
+        return (static_cast<int>(reader_flag_) & static_cast<int>(flag)) != 0;
+    }
+    bool MapCow();
+    bool ValidateDataRange(uint64_t offset, size_t len);
+    bool PrefetchCluster(uint64_t offset, size_t len);
     bool ParseOps(std::optional<uint64_t> label);
+    bool ParseCompressionDictionary();
+    bool PrepBlockMap();
     bool PrepMergeOps();
+    bool ReadSequenceData(const CowOperation& op, uint32_t* blocks);
     uint64_t FindNumCopyops();
+    std::unique_ptr<IDecompressor> GetDecompressor(CowCompressionAlgorithm compression);
+    bool ReadUnitData(const CowOperation& op, IByteSink* sink);
+    const DecompressedUnit* GetDecompressedUnit(const CowOperation& op);
 
     android::base::unique_fd owned_fd_;
     android::base::borrowed_fd fd_;
@@ -169,16 +412,38 @@ class CowReader final : public ICowReader {
     std::optional<CowFooter> footer_;
     uint64_t fd_size_;
     std::optional<uint64_t> last_label_;
-    std::shared_ptr<std::vector<CowOperation>> ops_;
+    std::shared_ptr<const uint8_t> mapping_;
+    std::shared_ptr<CowOpStore> ops_;
     std::shared_ptr<std::vector<uint32_t>> merge_op_blocks_;
     uint64_t merge_op_start_{};
-    std::shared_ptr<std::unordered_map<uint32_t, int>> block_map_;
+    std::shared_ptr<CowOpIndex<uint32_t, uint32_t>> block_map_;
     uint64_t num_total_data_ops_{};
     uint64_t num_ordered_ops_to_merge_{};
     bool has_seq_ops_{};
-    std::shared_ptr<std::unordered_map<uint64_t, uint64_t>> data_loc_;
+    std::shared_ptr<CowOpIndex<uint32_t, uint64_t>> data_loc_;
+    std::shared_ptr<CowOpIndex<uint64_t, CompressionUnit>> units_;
+    std::shared_ptr<std::string> compression_dictionary_;
     ReaderFlags reader_flag_;
+
+    // Pending merge preparation, with ReaderFlags::DEFER_MERGE_PREP.
+    std::mutex merge_prep_lock_;
+    std::future<bool> merge_prep_;
+    bool merge_prep_ok_ = true;
+
+    std::shared_ptr<std::vector<ClusterData>> cluster_data_;
+    bool prefetch_enabled_ = false;
+    uint64_t prefetch_begin_ = 0;
+    std::basic_string<uint8_t> prefetch_buffer_;
+
+    // The two most recently decompressed units. Reads of consecutive blocks
+    // from the same unit only decompress it once. |unit_cache_[0]| is the most
+    // recently used entry.
+    std::array<DecompressedUnit, 2> unit_cache_;
 };
 
+constexpr CowReader::ReaderFlags operator|(CowReader::ReaderFlags a, CowReader::ReaderFlags b) {
+    return static_cast<CowReader::ReaderFlags>(static_cast<int>(a) | static_cast<int>(b));
+}
+
 }  // namespace snapshot
 }  // namespace android
@@ -0,0 +1,102 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+namespace android {
+namespace snapshot {
+
+struct CowEstimateOptions {
+    uint32_t block_size = 4096;
+
+    // Compression algorithms to estimate, as accepted by CowOptions. An
+    // uncompressed ("none") estimate is always produced as well.
+    std::vector<std::string> compressions = {"gz"};
+
+    // Passed through to CowOptions.
+    uint32_t compression_factor = 1;
+    int compression_level = 0;
+
+    // Number of partitions analyzed concurrently. 0 uses one thread per CPU.
+    uint32_t num_threads = 0;
+};
+
+struct PartitionCowEstimate {
+    std::string name;
+
+    uint64_t num_blocks = 0;
+    uint64_t zero_blocks = 0;
+    // Blocks identical to the same block of the source image.
+    uint64_t unchanged_blocks = 0;
+    // Blocks found elsewhere in the source image.
+    uint64_t copy_blocks = 0;
+    uint64_t replace_blocks = 0;
+
+    // Size of the COW, in bytes, for each compression algorithm, keyed by
+    // its name. "none" is the uncompressed size.
+    std::map<std::string, uint64_t> cow_size;
+};
+
+// Estimates the COW size of a Virtual A/B update from the target image of
+// each partition and, for incremental updates, its source image.
+//
+// Every image is read once, sequentially. Source blocks are hashed a single
+// time; the hashes both find blocks that moved and detect blocks that did
+// not change, so the source is never read a second time. COW operations are
+// fed to one /dev/null-backed CowWriter per compression algorithm, so all
+// estimates come out of the same pass, without writing a COW anywhere.
+// Partitions are analyzed in parallel.
+class CowSizeEstimator final {
+  public:
+    explicit CowSizeEstimator(const CowEstimateOptions& options);
+
+    // |source| may be invalid, e.g. for a full update or a new partition.
+    void AddPartition(const std::string& name, android::base::unique_fd&& target,
+                      android::base::unique_fd&& source);
+
+    bool Run();
+
+    // Results in the order partitions were added. Valid after Run().
+    const std::vector<PartitionCowEstimate>& estimates() const { return estimates_; }
+
+    // Sum over all partitions for |compression|.
+    uint64_t GetTotalCowSize(const std::string& compression) const;
+
+    // Analyze a single partition on the caller's thread.
+    static bool EstimatePartition(const CowEstimateOptions& options,
+                                  android::base::borrowed_fd target,
+                                  android::base::borrowed_fd source,
+                                  PartitionCowEstimate* estimate);
+
+  private:
+    struct Partition {
+        android::base::unique_fd target;
+        android::base::unique_fd source;
+    };
+
+    CowEstimateOptions options_;
+    std::vector<Partition> partitions_;
+    std::vector<PartitionCowEstimate> estimates_;
+};
+
+}  // namespace snapshot
+}  // namespace android
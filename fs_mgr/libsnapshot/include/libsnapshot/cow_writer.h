@@ -16,9 +16,15 @@
 
 #include <stdint.h>
 
+#include <condition_variable>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <queue>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_format.h>
@@ -41,6 +47,30 @@ struct CowOptions {
 
     // Preset the number of merged ops. Only useful for testing.
     uint64_t num_merge_ops = 0;
+
+    // Number of threads used to compress blocks. 0 or 1 compresses inline on
+    // the caller's thread.
+    int num_compress_threads = 0;
+
+    // Number of contiguous replace blocks compressed together as one unit.
+    // Must be a power of two, no larger than kCowMaxCompressionFactor. 1
+    // compresses every block individually.
+    uint32_t compression_factor = 1;
+
+    // Compression level. 0 selects the algorithm's default.
+    int compression_level = 0;
+
+    // Optional trained dictionary for zstd compression. It is stored in the
+    // COW header area, so it must be smaller than 64KiB.
+    std::string compression_dictionary;
+
+    // Write all-zero blocks passed to AddRawBlocks as zero ops.
+    bool detect_zero_blocks = false;
+
+    // Number of COW writes kept in flight with io_uring. Queued writes are
+    // flushed, and the COW synced, at every label. 0 writes synchronously, as
+    // does any platform without io_uring.
+    uint32_t write_queue_depth = 0;
 };
 
 // Interface for writing to a snapuserd COW. All operations are ordered; merges
@@ -98,9 +128,47 @@ class ICowWriter {
     CowOptions options_;
 };
 
+class CowAsyncWriter;
+class ICompressor;
+
+class CompressWorker {
+  public:
+    CompressWorker(std::unique_ptr<ICompressor>&& compressor, uint32_t block_size);
+    ~CompressWorker();
+    bool RunThread();
+    void EnqueueCompressBlocks(const void* buffer, size_t num_blocks);
+    bool GetCompressedBuffers(std::vector<std::basic_string<uint8_t>>* compressed_buf);
+    void Finalize();
+
+    static bool CompressBlocks(ICompressor* compressor, size_t block_size, const void* buffer,
+                               size_t num_blocks,
+                               std::vector<std::basic_string<uint8_t>>* compressed_data);
+
+  private:
+    struct CompressWork {
+        const void* buffer;
+        size_t num_blocks;
+        bool compression_status = false;
+        std::vector<std::basic_string<uint8_t>> compressed_data;
+    };
+
+    std::unique_ptr<ICompressor> compressor_;
+    uint32_t block_size_;
+
+    std::queue<CompressWork> work_queue_;
+    std::queue<CompressWork> compressed_queue_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    bool stopped_ = false;
+
+    bool CompressBlocks(const void* buffer, size_t num_blocks,
+                        std::vector<std::basic_string<uint8_t>>* compressed_data);
+};
+
 class CowWriter : public ICowWriter {
   public:
     explicit CowWriter(const CowOptions& options);
+    ~CowWriter();
 
     // Set up the writer.
     // The file starts from the beginning.
@@ -121,6 +189,9 @@ class CowWriter : public ICowWriter {
 
     uint32_t GetCowVersion() { return header_.major_version; }
 
+    // Number of raw blocks written as zero ops by zero-block detection.
+    uint64_t GetNumDetectedZeroBlocks() const { return num_detected_zero_blocks_; }
+
   protected:
     virtual bool EmitCopy(uint64_t new_block, uint64_t old_block) override;
     virtual bool EmitRawBlocks(uint64_t new_block_start, const void* data, size_t size) override;
@@ -135,6 +206,14 @@ class CowWriter : public ICowWriter {
     bool EmitClusterIfNeeded();
     bool EmitBlocks(uint64_t new_block_start, const void* data, size_t size, uint64_t old_block,
                     uint16_t offset, uint8_t type);
+    bool EmitBlockOps(uint64_t new_block_start, const void* data, size_t size, uint64_t old_block,
+                      uint16_t offset, uint8_t type);
+    bool EmitCompressionUnit(uint64_t new_block_start, const void* data, bool* emitted);
+    bool CompressBlocks(size_t num_blocks, const void* data);
+    bool InitCompressor();
+    bool InitWorkers();
+    void InitAsyncWriter();
+    bool FlushWrites();
     void SetupHeaders();
     bool ParseOptions();
     bool OpenForWrite();
@@ -143,7 +222,6 @@ class CowWriter : public ICowWriter {
     bool WriteRawData(const void* data, size_t size);
     bool WriteOperation(const CowOperation& op, const void* data = nullptr, size_t size = 0);
     void AddOperation(const CowOperation& op);
-    std::basic_string<uint8_t> Compress(const void* data, size_t length);
     void InitPos();
 
     bool SetFd(android::base::borrowed_fd fd);
@@ -164,6 +242,15 @@ class CowWriter : public ICowWriter {
     bool is_dev_null_ = false;
     bool merge_in_progress_ = false;
     bool is_block_device_ = false;
+    std::unique_ptr<CowAsyncWriter> async_writer_;
+
+    std::unique_ptr<ICompressor> compressor_;
+    uint32_t compression_factor_ = 1;
+    int num_compress_threads_ = 1;
+    std::vector<std::unique_ptr<CompressWorker>> compress_threads_;
+    std::vector<std::future<bool>> threads_;
+    std::vector<std::basic_string<uint8_t>> compressed_buf_;
+    uint64_t num_detected_zero_blocks_ = 0;
 
     // :TODO: this is not efficient, but stringstream ubsan aborts because some
     // bytes overflow a signed char.
@@ -34,6 +34,8 @@ class MockSnapshotManager : public ISnapshotManager {
                 (const std::function<bool()>& callback, const std::function<bool()>& before_cancel),
                 (override));
     MOCK_METHOD(UpdateState, GetUpdateState, (double* progress), (override));
+    MOCK_METHOD(bool, GetMergeProgress, (std::vector<SnapshotMergeProgress> * progress),
+                (override));
     MOCK_METHOD(bool, UpdateUsesCompression, (), (override));
     MOCK_METHOD(bool, UpdateUsesUserSnapshots, (), (override));
     MOCK_METHOD(Return, CreateUpdateSnapshots,
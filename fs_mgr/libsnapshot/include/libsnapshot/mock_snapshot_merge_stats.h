@@ -33,6 +33,8 @@ class MockSnapshotMergeStats final : public ISnapshotMergeStats {
     MOCK_METHOD(void, set_boot_complete_to_merge_start_time_ms, (uint32_t), (override));
     MOCK_METHOD(void, set_merge_failure_code, (MergeFailureCode), (override));
     MOCK_METHOD(void, set_source_build_fingerprint, (const std::string&), (override));
+    MOCK_METHOD(void, set_merge_progress, (const std::vector<SnapshotMergeProgress>&),
+                (override));
     MOCK_METHOD(uint64_t, cow_file_size, (), (override));
     MOCK_METHOD(uint64_t, total_cow_size_bytes, (), (override));
     MOCK_METHOD(uint64_t, estimated_cow_size_bytes, (), (override));
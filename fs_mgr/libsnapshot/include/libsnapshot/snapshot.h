@@ -17,9 +17,11 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <ostream>
 #include <string>
@@ -83,6 +85,29 @@ static constexpr char kVirtualAbCompressionProp[] = "ro.virtual_ab.compression.e
 bool OptimizeSourceCopyOperation(const chromeos_update_engine::InstallOperation& operation,
                                  chromeos_update_engine::InstallOperation* optimized);
 
+// Merge progress of one snapshot. For userspace snapshots the unit is a COW
+// operation; for dm-snapshot it is a COW chunk.
+struct SnapshotMergeProgress {
+    std::string name;
+    uint64_t merged_ops = 0;
+    uint64_t total_ops = 0;
+    // Recent merge rate; 0 if not known yet.
+    double ops_per_sec = 0.0;
+    bool completed = false;
+
+    double Percentage() const {
+        if (completed || !total_ops) return completed ? 100.0 : 0.0;
+        return std::min(100.0, merged_ops * 100.0 / total_ops);
+    }
+    // Returns nullopt if the rate is not known yet.
+    std::optional<std::chrono::seconds> EstimatedTimeRemaining() const {
+        if (completed || merged_ops >= total_ops) return std::chrono::seconds(0);
+        if (ops_per_sec <= 0.0) return {};
+        return std::chrono::seconds(
+                static_cast<int64_t>((total_ops - merged_ops) / ops_per_sec + 0.5));
+    }
+};
+
 enum class CreateResult : unsigned int {
     ERROR,
     CREATED,
@@ -192,6 +217,10 @@ class ISnapshotManager {
     //   Other: 0
     virtual UpdateState GetUpdateState(double* progress = nullptr) = 0;
 
+    // Per-snapshot merge progress, with a rate estimate. |progress| is empty
+    // unless a merge is in progress or has completed.
+    virtual bool GetMergeProgress(std::vector<SnapshotMergeProgress>* progress) = 0;
+
     // Returns true if compression is enabled for the current update. This always returns false if
     // UpdateState is None, or no snapshots have been created.
     virtual bool UpdateUsesCompression() = 0;
@@ -305,6 +334,8 @@ class ISnapshotManager {
     virtual ISnapshotMergeStats* GetSnapshotMergeStatsInstance() = 0;
 };
 
+class StatusFileCache;
+
 class SnapshotManager final : public ISnapshotManager {
     using CreateLogicalPartitionParams = android::fs_mgr::CreateLogicalPartitionParams;
     using IPartitionOpener = android::fs_mgr::IPartitionOpener;
@@ -357,6 +388,7 @@ class SnapshotManager final : public ISnapshotManager {
     UpdateState ProcessUpdateState(const std::function<bool()>& callback = {},
                                    const std::function<bool()>& before_cancel = {}) override;
     UpdateState GetUpdateState(double* progress = nullptr) override;
+    bool GetMergeProgress(std::vector<SnapshotMergeProgress>* progress) override;
     bool UpdateUsesCompression() override;
     bool UpdateUsesUserSnapshots() override;
     Return CreateUpdateSnapshots(const DeltaArchiveManifest& manifest) override;
@@ -391,6 +423,12 @@ class SnapshotManager final : public ISnapshotManager {
         uevent_regen_callback_ = callback;
     }
 
+    // Map the partitions of CreateLogicalAndSnapshotPartitions() on up to
+    // |num_threads| threads, so that the device-mapper stacks of independent
+    // partitions are built concurrently and their waits for uevents overlap.
+    // 0 or 1 maps the partitions one after another.
+    void SetParallelMapping(uint32_t num_threads) { mapping_threads_ = num_threads; }
+
     // If true, compression is enabled for this update. This is used by
     // first-stage to decide whether to launch snapuserd.
     bool IsSnapuserdRequired();
@@ -473,11 +511,15 @@ class SnapshotManager final : public ISnapshotManager {
             : path_(path), fd_(std::move(fd)), lock_mode_(lock_mode) {}
         ~LockedFile();
         int lock_mode() const { return lock_mode_; }
+        // Status writes made under an exclusive lock are synced to disk
+        // before it is released.
+        void set_status_cache(std::shared_ptr<StatusFileCache> cache) { cache_ = cache; }
 
       private:
         std::string path_;
         android::base::unique_fd fd_;
         int lock_mode_;
+        std::shared_ptr<StatusFileCache> cache_;
     };
     static std::unique_ptr<LockedFile> OpenFile(const std::string& file, int lock_flags);
 
@@ -666,6 +708,13 @@ class SnapshotManager final : public ISnapshotManager {
 
     bool MapAllPartitions(LockedFile* lock, const std::string& super_device, uint32_t slot,
                           const std::chrono::milliseconds& timeout_ms);
+    // Helper of MapAllPartitions, mapping |partitions| on mapping_threads_
+    // threads.
+    bool MapPartitionsInParallel(LockedFile* lock,
+                                 std::vector<CreateLogicalPartitionParams>* partitions);
+    // Helper of MapAllPartitions, mapping |partitions|, none of which have a
+    // live snapshot, with a single batch of device-mapper operations.
+    bool MapLinearPartitions(std::vector<CreateLogicalPartitionParams> partitions);
 
     // Reason for calling MapPartitionWithSnapshot.
     enum class SnapshotContext {
@@ -697,6 +746,11 @@ class SnapshotManager final : public ISnapshotManager {
             const std::string& partition_name, const SnapshotStatus& status,
             const SnapshotPaths& paths);
 
+    // Sets |live_snapshot_status| to the status of the snapshot that has to be
+    // mapped on top of the partition in |params|, or nullopt if there is none.
+    bool GetLiveSnapshotStatus(LockedFile* lock, const CreateLogicalPartitionParams& params,
+                               std::optional<SnapshotStatus>* live_snapshot_status);
+
     // Map the base device, COW devices, and snapshot device.
     bool MapPartitionWithSnapshot(LockedFile* lock, CreateLogicalPartitionParams params,
                                   SnapshotContext context, SnapshotPaths* paths);
@@ -833,7 +887,23 @@ class SnapshotManager final : public ISnapshotManager {
     std::unique_ptr<SnapuserdClient> snapuserd_client_;
     std::unique_ptr<LpMetadata> old_partition_metadata_;
     std::optional<bool> is_snapshot_userspace_;
+    std::shared_ptr<StatusFileCache> status_cache_;
     MergeConsistencyChecker merge_consistency_checker_;
+    uint32_t mapping_threads_ = 0;
+    // Serializes what MapPartitionWithSnapshot shares between threads when
+    // partitions are mapped in parallel: the lazily initialized members
+    // above, the image manager, the snapuserd client and the uevent
+    // regeneration callback.
+    std::recursive_mutex mapping_lock_;
+    // Last dm-snapshot merge progress sample of each snapshot, from which
+    // GetMergeProgress() derives a rate.
+    struct MergeProgressSample {
+        std::chrono::steady_clock::time_point time;
+        uint64_t merged_ops;
+        double ops_per_sec;
+    };
+    std::mutex merge_progress_lock_;
+    std::map<std::string, MergeProgressSample> merge_progress_samples_;
 };
 
 }  // namespace snapshot
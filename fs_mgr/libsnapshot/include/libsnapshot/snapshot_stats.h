@@ -16,6 +16,7 @@
 
 #include <chrono>
 #include <memory>
+#include <vector>
 
 #include <android/snapshot/snapshot.pb.h>
 #include <libsnapshot/snapshot.h>
@@ -33,6 +34,9 @@ class ISnapshotMergeStats {
     virtual void set_boot_complete_to_merge_start_time_ms(uint32_t ms) = 0;
     virtual void set_merge_failure_code(MergeFailureCode code) = 0;
     virtual void set_source_build_fingerprint(const std::string& fingerprint) = 0;
+    // Record the latest per-partition merge progress, see
+    // ISnapshotManager::GetMergeProgress().
+    virtual void set_merge_progress(const std::vector<SnapshotMergeProgress>& progress) = 0;
     virtual uint64_t cow_file_size() = 0;
     virtual uint64_t total_cow_size_bytes() = 0;
     virtual uint64_t estimated_cow_size_bytes() = 0;
@@ -79,6 +83,7 @@ class SnapshotMergeStats : public ISnapshotMergeStats {
     MergeFailureCode merge_failure_code() override;
     void set_source_build_fingerprint(const std::string& fingerprint) override;
     std::string source_build_fingerprint() override;
+    void set_merge_progress(const std::vector<SnapshotMergeProgress>& progress) override;
     std::unique_ptr<Result> Finish() override;
     bool WriteState() override;
 
@@ -34,6 +34,7 @@ class SnapshotManagerStub : public ISnapshotManager {
     UpdateState ProcessUpdateState(const std::function<bool()>& callback = {},
                                    const std::function<bool()>& before_cancel = {}) override;
     UpdateState GetUpdateState(double* progress = nullptr) override;
+    bool GetMergeProgress(std::vector<SnapshotMergeProgress>* progress) override;
     bool UpdateUsesCompression() override;
     bool UpdateUsesUserSnapshots() override;
     Return CreateUpdateSnapshots(
@@ -15,6 +15,7 @@
 #pragma once
 
 #include <optional>
+#include <string>
 
 #include <android-base/unique_fd.h>
 
@@ -59,6 +60,11 @@ class ISnapshotWriter : public ICowWriter {
 };
 
 // Send writes to a COW or a raw device directly, based on a threshold.
+//
+// Raw and zero blocks written to adjacent ranges by consecutive calls are held back and passed to
+// the CowWriter as one range, so that it can compress them together as one unit. They are flushed
+// before any other operation, and by Finalize(). Errors while emitting held-back blocks are
+// returned by the call that flushes them.
 class CompressedSnapshotWriter final : public ISnapshotWriter {
   public:
     CompressedSnapshotWriter(const CowOptions& options);
@@ -83,10 +89,19 @@ class CompressedSnapshotWriter final : public ISnapshotWriter {
     bool EmitSequenceData(size_t num_ops, const uint32_t* data) override;
 
   private:
+    enum class PendingType { kNone, kRaw, kZero };
+
     std::unique_ptr<CowReader> OpenCowReader() const;
+    bool FlushPending();
+
     android::base::unique_fd cow_device_;
 
     std::unique_ptr<CowWriter> cow_;
+
+    PendingType pending_type_ = PendingType::kNone;
+    uint64_t pending_start_ = 0;
+    uint64_t pending_blocks_ = 0;
+    std::string pending_data_;
 };
 
 // Write directly to a dm-snapshot device.
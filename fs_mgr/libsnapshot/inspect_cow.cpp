@@ -13,15 +13,24 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 //
+#include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_reader.h>
 
@@ -41,13 +50,15 @@ static void usage(void) {
     LOG(ERROR) << "Usage: inspect_cow [-sd] <COW_FILE>";
     LOG(ERROR) << "\t -s Run Silent";
     LOG(ERROR) << "\t -d Attempt to decompress";
+    LOG(ERROR) << "\t -j <N> Decompress with N threads";
     LOG(ERROR) << "\t -b Show data for failed decompress";
     LOG(ERROR) << "\t -l Show ops";
     LOG(ERROR) << "\t -m Show ops in reverse merge order";
     LOG(ERROR) << "\t -n Show ops in merge order";
     LOG(ERROR) << "\t -a Include merged ops in any merge order listing";
     LOG(ERROR) << "\t -o Shows sequence op block order";
-    LOG(ERROR) << "\t -v Verifies merge order has no conflicts\n";
+    LOG(ERROR) << "\t -v Verifies merge order has no conflicts, and sequence ops";
+    LOG(ERROR) << "\t -t Show detailed statistics\n";
 }
 
 enum OpIter { Normal, RevMerge, Merge };
@@ -61,6 +72,8 @@ struct Options {
     bool verify_sequence;
     OpIter iter_type;
     bool include_merged;
+    bool show_stats;
+    unsigned threads;
 };
 
 // Sink that always appends to the end of a string.
@@ -99,6 +112,239 @@ static void ShowBad(CowReader& reader, const struct CowOperation& op) {
     }
 }
 
+static const char* CompressionName(CowCompressionAlgorithm compression) {
+    switch (compression) {
+        case kCowCompressNone:
+            return "none";
+        case kCowCompressGz:
+            return "gz";
+        case kCowCompressBrotli:
+            return "brotli";
+        case kCowCompressLz4:
+            return "lz4";
+        case kCowCompressZstd:
+            return "zstd";
+        default:
+            return "unknown";
+    }
+}
+
+struct CompressionStats {
+    uint64_t ops = 0;
+    uint64_t compressed_bytes = 0;
+    uint64_t uncompressed_bytes = 0;
+};
+
+// Upper bounds of the compression ratio histogram buckets. The last bucket is unbounded. Ratios
+// under 1 mean that the data grew when it was compressed.
+static constexpr std::array<double, 6> kRatioBuckets = {1.0, 1.5, 2.0, 3.0, 4.0, 8.0};
+
+struct DetailedStats {
+    std::map<uint8_t, uint64_t> ops_by_type;
+    std::array<uint64_t, kRatioBuckets.size() + 1> ratio_histogram = {};
+    // Source block of each copy op, by the block it writes.
+    std::unordered_map<uint64_t, uint64_t> copy_sources;
+    // Bytes read and written by the merge, and staged through the read-ahead scratch space.
+    uint64_t merge_read_bytes = 0;
+    uint64_t merge_write_bytes = 0;
+    uint64_t read_ahead_bytes = 0;
+};
+
+static const char* OpTypeName(uint8_t type) {
+    switch (type) {
+        case kCowCopyOp:
+            return "copy";
+        case kCowReplaceOp:
+            return "replace";
+        case kCowZeroOp:
+            return "zero";
+        case kCowLabelOp:
+            return "label";
+        case kCowClusterOp:
+            return "cluster";
+        case kCowXorOp:
+            return "xor";
+        case kCowSequenceOp:
+            return "sequence";
+        case kCowFooterOp:
+            return "footer";
+        default:
+            return "unknown";
+    }
+}
+
+static void AddDetailedStats(const CowOperation& op, uint32_t block_size, DetailedStats* stats) {
+    stats->ops_by_type[op.type]++;
+
+    if ((op.type == kCowReplaceOp || op.type == kCowXorOp) && op.data_length) {
+        double ratio = static_cast<double>(block_size) * GetCompressionUnitBlocks(op) /
+                       op.data_length;
+        auto bucket = std::upper_bound(kRatioBuckets.begin(), kRatioBuckets.end(), ratio);
+        stats->ratio_histogram[bucket - kRatioBuckets.begin()]++;
+    }
+
+    switch (op.type) {
+        case kCowCopyOp:
+            stats->copy_sources[op.new_block] = op.source;
+            stats->merge_read_bytes += block_size;
+            stats->read_ahead_bytes += block_size;
+            break;
+        case kCowXorOp:
+            // An unaligned source spans two blocks.
+            stats->merge_read_bytes += (op.source % block_size ? 2 : 1) * block_size;
+            stats->merge_read_bytes += op.data_length;
+            stats->read_ahead_bytes += block_size;
+            break;
+        case kCowReplaceOp:
+            stats->merge_read_bytes += op.data_length;
+            break;
+        case kCowZeroOp:
+            break;
+        default:
+            return;
+    }
+    stats->merge_write_bytes += block_size;
+}
+
+// Returns the length of every chain of copy ops in which each op copies a block that the next one
+// overwrites, by the block its first op writes. Such chains must be merged in order. A cycle,
+// e.g. two swapped blocks, is cut where it closes.
+static std::unordered_map<uint64_t, uint32_t> GetCopyChainDepths(
+        const std::unordered_map<uint64_t, uint64_t>& copy_sources) {
+    // A depth of zero marks a block on the chain being walked.
+    std::unordered_map<uint64_t, uint32_t> depths;
+    std::vector<uint64_t> chain;
+    for (const auto& [start, _] : copy_sources) {
+        if (depths.count(start)) continue;
+
+        uint32_t depth = 0;
+        for (uint64_t block = start;;) {
+            auto done = depths.find(block);
+            if (done != depths.end()) {
+                depth = done->second;
+                break;
+            }
+            auto source = copy_sources.find(block);
+            if (source == copy_sources.end()) break;
+            depths[block] = 0;
+            chain.emplace_back(block);
+            block = source->second;
+        }
+        while (!chain.empty()) {
+            depths[chain.back()] = ++depth;
+            chain.pop_back();
+        }
+    }
+    return depths;
+}
+
+static void ShowDetailedStats(const DetailedStats& stats) {
+    std::cout << "\nOps by type:\n";
+    for (const auto& [type, count] : stats.ops_by_type) {
+        std::cout << "  " << OpTypeName(type) << ": " << count << "\n";
+    }
+
+    std::cout << "Compression ratio histogram:\n";
+    for (size_t i = 0; i < stats.ratio_histogram.size(); i++) {
+        if (i < kRatioBuckets.size()) {
+            std::cout << "  < " << std::fixed << std::setprecision(1) << kRatioBuckets[i];
+        } else {
+            std::cout << "  >= " << std::fixed << std::setprecision(1) << kRatioBuckets.back();
+        }
+        std::cout << ": " << stats.ratio_histogram[i] << "\n";
+    }
+
+    std::map<uint32_t, uint64_t> depth_histogram;
+    for (const auto& [_, depth] : GetCopyChainDepths(stats.copy_sources)) {
+        depth_histogram[depth]++;
+    }
+    std::cout << "Copy chain depth histogram:\n";
+    for (const auto& [depth, count] : depth_histogram) {
+        std::cout << "  " << depth << ": " << count << "\n";
+    }
+    std::cout << "Max copy chain depth: "
+              << (depth_histogram.empty() ? 0 : depth_histogram.rbegin()->first) << "\n";
+
+    std::cout << "Estimated merge I/O: " << stats.merge_read_bytes << " bytes read, "
+              << stats.merge_write_bytes << " bytes written, " << stats.read_ahead_bytes
+              << " bytes through read-ahead\n";
+}
+
+// Checks that the sequence ops list every copy and xor op exactly once, and nothing else.
+static bool VerifySequenceOps(const std::vector<uint32_t>& sequence,
+                              const std::unordered_set<uint64_t>& ordered_blocks,
+                              const std::unordered_set<uint64_t>& all_blocks) {
+    bool success = true;
+    std::unordered_set<uint64_t> seen;
+    for (auto block : sequence) {
+        if (!seen.emplace(block).second) {
+            std::cerr << "Block " << block << " appears more than once in sequence ops\n";
+            success = false;
+        }
+        if (!all_blocks.count(block)) {
+            std::cerr << "Sequence ops list block " << block << ", which has no op\n";
+            success = false;
+        }
+    }
+    for (auto block : ordered_blocks) {
+        if (!seen.count(block)) {
+            std::cerr << "Ordered op for block " << block << " is missing from sequence ops\n";
+            success = false;
+        }
+    }
+    return success;
+}
+
+// Decompresses |ops| on |num_threads| threads. Each thread has its own clone of |reader| and its
+// own file descriptor, and takes a contiguous range of ops so that it reads the COW mostly in
+// order. Returns the indices of the ops that failed to decompress, in order.
+static bool ParallelDecompress(CowReader& reader, const std::string& path,
+                               const std::vector<CowOperation>& ops, unsigned num_threads,
+                               std::vector<size_t>* failed) {
+    num_threads = std::max(1u, std::min<unsigned>(num_threads, ops.size()));
+    std::vector<std::unique_ptr<CowReader>> readers;
+    for (unsigned i = 0; i < num_threads; i++) {
+        android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (fd < 0) {
+            PLOG(ERROR) << "open failed: " << path;
+            return false;
+        }
+        auto clone = reader.CloneCowReader();
+        if (!clone->InitForMerge(std::move(fd))) {
+            LOG(ERROR) << "could not set up reader: " << path;
+            return false;
+        }
+        clone->SetClusterPrefetch(true);
+        readers.emplace_back(std::move(clone));
+    }
+
+    std::vector<std::vector<size_t>> failed_by_thread(num_threads);
+    auto decompress = [&](unsigned thread) {
+        size_t begin = ops.size() * thread / num_threads;
+        size_t end = ops.size() * (thread + 1) / num_threads;
+        StringSink sink;
+        for (size_t i = begin; i < end; i++) {
+            if (!readers[thread]->ReadData(ops[i], &sink)) {
+                failed_by_thread[thread].emplace_back(i);
+            }
+            sink.Reset();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads; i++) {
+        threads.emplace_back(decompress, i);
+    }
+    decompress(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (const auto& indices : failed_by_thread) {
+        failed->insert(failed->end(), indices.begin(), indices.end());
+    }
+    return true;
+}
+
 static bool Inspect(const std::string& path, Options opt) {
     android::base::unique_fd fd(open(path.c_str(), O_RDONLY));
     if (fd < 0) {
@@ -129,6 +375,10 @@ static bool Inspect(const std::string& path, Options opt) {
         std::cout << "Block size: " << header.block_size << "\n";
         std::cout << "Num merge ops: " << header.num_merge_ops << "\n";
         std::cout << "RA buffer size: " << header.buffer_size << "\n";
+        if (header.header_size > sizeof(CowHeader)) {
+            std::cout << "Compression dictionary size: "
+                      << header.header_size - sizeof(CowHeader) << "\n";
+        }
         std::cout << "\n";
         if (has_footer) {
             std::cout << "Total Ops size: " << footer.op.ops_size << "\n";
@@ -137,12 +387,13 @@ static bool Inspect(const std::string& path, Options opt) {
         }
     }
 
+    // The merge order is checked on its own reader while the ops are walked below.
+    std::future<bool> merge_ops_verified;
     if (opt.verify_sequence) {
-        if (reader.VerifyMergeOps()) {
-            std::cout << "\nMerge sequence is consistent.\n";
-        } else {
-            std::cout << "\nMerge sequence is inconsistent!\n";
-        }
+        merge_ops_verified =
+                std::async(std::launch::async, [clone = reader.CloneCowReader()]() {
+                    return clone->VerifyMergeOps();
+                });
     }
 
     std::unique_ptr<ICowOpIter> iter;
@@ -156,21 +407,31 @@ static bool Inspect(const std::string& path, Options opt) {
     StringSink sink;
     bool success = true;
     uint64_t xor_ops = 0, copy_ops = 0, replace_ops = 0, zero_ops = 0;
+    std::map<CowCompressionAlgorithm, CompressionStats> compression_stats;
+    DetailedStats detailed_stats;
+    std::vector<CowOperation> decompress_ops;
+    std::vector<uint32_t> sequence;
+    std::unordered_set<uint64_t> ordered_blocks, all_blocks;
+    bool has_sequence = false;
     while (!iter->Done()) {
         const CowOperation& op = iter->Get();
 
         if (!opt.silent && opt.show_ops) std::cout << op << "\n";
 
         if (opt.decompress && op.type == kCowReplaceOp && op.compression != kCowCompressNone) {
-            if (!reader.ReadData(op, &sink)) {
-                std::cerr << "Failed to decompress for :" << op << "\n";
-                success = false;
-                if (opt.show_bad) ShowBad(reader, op);
+            if (opt.threads > 1) {
+                decompress_ops.emplace_back(op);
+            } else {
+                if (!reader.ReadData(op, &sink)) {
+                    std::cerr << "Failed to decompress for :" << op << "\n";
+                    success = false;
+                    if (opt.show_bad) ShowBad(reader, op);
+                }
+                sink.Reset();
             }
-            sink.Reset();
         }
 
-        if (op.type == kCowSequenceOp && opt.show_seq) {
+        if (op.type == kCowSequenceOp && (opt.show_seq || opt.verify_sequence)) {
             size_t read;
             std::vector<uint32_t> merge_op_blocks;
             size_t seq_len = op.data_length / sizeof(uint32_t);
@@ -179,7 +440,11 @@ static bool Inspect(const std::string& path, Options opt) {
                 PLOG(ERROR) << "Failed to read sequence op!";
                 return false;
             }
-            if (!opt.silent) {
+            has_sequence = true;
+            if (opt.verify_sequence) {
+                sequence.insert(sequence.end(), merge_op_blocks.begin(), merge_op_blocks.end());
+            }
+            if (!opt.silent && opt.show_seq) {
                 std::cout << "Sequence for " << op << " is :\n";
                 for (size_t i = 0; i < seq_len; i++) {
                     std::cout << std::setfill('0') << std::setw(6) << merge_op_blocks[i] << ", ";
@@ -188,6 +453,20 @@ static bool Inspect(const std::string& path, Options opt) {
             }
         }
 
+        if ((op.type == kCowReplaceOp || op.type == kCowXorOp) && op.data_length) {
+            auto& stats = compression_stats[GetCompressionAlgorithm(op)];
+            stats.ops++;
+            stats.compressed_bytes += op.data_length;
+            stats.uncompressed_bytes += header.block_size * GetCompressionUnitBlocks(op);
+        }
+
+        if (opt.verify_sequence && !IsMetadataOp(op)) {
+            all_blocks.emplace(op.new_block);
+            if (IsOrderedOp(op)) ordered_blocks.emplace(op.new_block);
+        }
+
+        if (opt.show_stats) AddDetailedStats(op, header.block_size, &detailed_stats);
+
         if (op.type == kCowCopyOp) {
             copy_ops++;
         } else if (op.type == kCowReplaceOp) {
@@ -201,11 +480,53 @@ static bool Inspect(const std::string& path, Options opt) {
         iter->Next();
     }
 
+    if (!decompress_ops.empty()) {
+        std::vector<size_t> failed;
+        if (!ParallelDecompress(reader, path, decompress_ops, opt.threads, &failed)) {
+            return false;
+        }
+        for (auto i : failed) {
+            std::cerr << "Failed to decompress for :" << decompress_ops[i] << "\n";
+            success = false;
+            if (opt.show_bad) ShowBad(reader, decompress_ops[i]);
+        }
+    }
+
+    if (opt.verify_sequence) {
+        if (merge_ops_verified.get()) {
+            std::cout << "\nMerge sequence is consistent.\n";
+        } else {
+            std::cout << "\nMerge sequence is inconsistent!\n";
+        }
+        // COWs without sequence ops are merged in op order.
+        if (has_sequence) {
+            if (VerifySequenceOps(sequence, ordered_blocks, all_blocks)) {
+                std::cout << "Sequence ops are consistent.\n";
+            } else {
+                std::cout << "Sequence ops are inconsistent!\n";
+                success = false;
+            }
+        }
+    }
+
     if (!opt.silent) {
         auto total_ops = replace_ops + zero_ops + copy_ops + xor_ops;
         std::cout << "Total-data-ops: " << total_ops << "Replace-ops: " << replace_ops
                   << " Zero-ops: " << zero_ops << " Copy-ops: " << copy_ops
                   << " Xor_ops: " << xor_ops << std::endl;
+
+        for (const auto& [compression, stats] : compression_stats) {
+            double ratio = stats.compressed_bytes
+                                   ? static_cast<double>(stats.uncompressed_bytes) /
+                                             stats.compressed_bytes
+                                   : 0;
+            std::cout << "Compression " << CompressionName(compression) << ": " << stats.ops
+                      << " ops, " << stats.uncompressed_bytes << " bytes -> "
+                      << stats.compressed_bytes << " bytes, ratio: " << std::fixed
+                      << std::setprecision(2) << ratio << std::endl;
+        }
+
+        if (opt.show_stats) ShowDetailedStats(detailed_stats);
     }
 
     return success;
@@ -219,11 +540,15 @@ int main(int argc, char** argv) {
     struct android::snapshot::Options opt;
     opt.silent = false;
     opt.decompress = false;
+    opt.show_ops = false;
     opt.show_bad = false;
+    opt.show_seq = false;
     opt.iter_type = android::snapshot::Normal;
     opt.verify_sequence = false;
     opt.include_merged = false;
-    while ((ch = getopt(argc, argv, "sdbmnolva")) != -1) {
+    opt.show_stats = false;
+    opt.threads = 1;
+    while ((ch = getopt(argc, argv, "sdbj:mnolvat")) != -1) {
         switch (ch) {
             case 's':
                 opt.silent = true;
@@ -234,6 +559,12 @@ int main(int argc, char** argv) {
             case 'b':
                 opt.show_bad = true;
                 break;
+            case 'j':
+                if (!android::base::ParseUint(optarg, &opt.threads) || opt.threads == 0) {
+                    android::snapshot::usage();
+                    return 1;
+                }
+                break;
             case 'm':
                 opt.iter_type = android::snapshot::RevMerge;
                 break;
@@ -252,6 +583,9 @@ int main(int argc, char** argv) {
             case 'a':
                 opt.include_merged = true;
                 break;
+            case 't':
+                opt.show_stats = true;
+                break;
             default:
                 android::snapshot::usage();
         }
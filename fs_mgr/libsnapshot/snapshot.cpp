@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <sys/unistd.h>
 
+#include <atomic>
 #include <filesystem>
 #include <optional>
 #include <thread>
@@ -48,6 +49,7 @@
 #include "partition_cow_creator.h"
 #include "snapshot_metadata_updater.h"
 #include "snapshot_reader.h"
+#include "status_cache.h"
 #include "utility.h"
 
 namespace android {
@@ -86,6 +88,8 @@ using namespace std::string_literals;
 static constexpr char kBootIndicatorPath[] = "/metadata/ota/snapshot-boot";
 static constexpr char kRollbackIndicatorPath[] = "/metadata/ota/rollback-indicator";
 static constexpr auto kUpdateStateCheckInterval = 2s;
+// Number of in-flight COW writes when the update uses io_uring.
+static constexpr uint32_t kCowWriteQueueDepth = 64;
 
 MergeFailureCode CheckMergeConsistency(const std::string& name, const SnapshotStatus& status);
 
@@ -118,7 +122,10 @@ std::unique_ptr<SnapshotManager> SnapshotManager::NewForFirstStageMount(IDeviceI
 }
 
 SnapshotManager::SnapshotManager(IDeviceInfo* device)
-    : dm_(device->GetDeviceMapper()), device_(device), metadata_dir_(device_->GetMetadataDir()) {
+    : dm_(device->GetDeviceMapper()),
+      device_(device),
+      metadata_dir_(device_->GetMetadataDir()),
+      status_cache_(std::make_shared<StatusFileCache>()) {
     merge_consistency_checker_ = android::snapshot::CheckMergeConsistency;
 }
 
@@ -466,6 +473,7 @@ bool SnapshotManager::MapDmUserCow(LockedFile* lock, const std::string& name,
         misc_name += "-init";
     }
 
+    std::unique_lock<std::recursive_mutex> guard(mapping_lock_);
     if (!EnsureSnapuserdConnected()) {
         return false;
     }
@@ -496,6 +504,7 @@ bool SnapshotManager::MapDmUserCow(LockedFile* lock, const std::string& name,
 
         base_sectors = dev_sz >> 9;
     }
+    guard.unlock();
 
     DmTable table;
     table.Emplace<DmTargetUser>(0, base_sectors, misc_name);
@@ -513,6 +522,7 @@ bool SnapshotManager::MapDmUserCow(LockedFile* lock, const std::string& name,
         return false;
     }
 
+    guard.lock();
     if (UpdateUsesUserSnapshots(lock)) {
         // Now that the dm-user device is created, initialize the daemon and
         // spin up the worker threads.
@@ -622,6 +632,7 @@ bool SnapshotManager::MapSnapshot(LockedFile* lock, const std::string& name,
 
 std::optional<std::string> SnapshotManager::MapCowImage(
         const std::string& name, const std::chrono::milliseconds& timeout_ms) {
+    std::lock_guard<std::recursive_mutex> guard(mapping_lock_);
     if (!EnsureImageManager()) return std::nullopt;
     auto cow_image_name = GetCowImageDeviceName(name);
 
@@ -719,6 +730,7 @@ bool SnapshotManager::DeleteSnapshot(LockedFile* lock, const std::string& name)
 
     std::string error;
     auto file_path = GetSnapshotStatusFilePath(name);
+    status_cache_->Invalidate(file_path);
     if (!android::base::RemoveFileIfExists(file_path, &error)) {
         LOG(ERROR) << "Failed to remove status file " << file_path << ": " << error;
         return false;
@@ -968,8 +980,11 @@ bool SnapshotManager::GetSingleTarget(const std::string& dm_name, TableQuery que
 }
 
 bool SnapshotManager::IsSnapshotDevice(const std::string& dm_name, TargetInfo* target) {
+    // The target type only changes when a new table is loaded, so unless the
+    // caller wants the status, query the table, which DeviceMapper can cache.
     DeviceMapper::TargetInfo snap_target;
-    if (!GetSingleTarget(dm_name, TableQuery::Status, &snap_target)) {
+    auto query = target ? TableQuery::Status : TableQuery::Table;
+    if (!GetSingleTarget(dm_name, query, &snap_target)) {
         return false;
     }
     auto type = DeviceMapper::GetTargetType(snap_target.spec);
@@ -1027,6 +1042,11 @@ UpdateState SnapshotManager::ProcessUpdateState(const std::function<bool()>& cal
             return result.state;
         }
 
+        std::vector<SnapshotMergeProgress> progress;
+        if (GetMergeProgress(&progress)) {
+            SnapshotMergeStats::GetInstance(*this)->set_merge_progress(progress);
+        }
+
         if (callback && !callback()) {
             return result.state;
         }
@@ -1043,7 +1063,13 @@ auto SnapshotManager::CheckMergeState(const std::function<bool()>& before_cancel
         return MergeResult(UpdateState::MergeFailed, MergeFailureCode::AcquireLock);
     }
 
+    // Checking each snapshot queries the same devices several times. While
+    // the lock is held, they are only changed through this process, so let
+    // DeviceMapper cache the results.
+    auto& dm = DeviceMapper::Instance();
+    dm.SetCacheEnabled(true);
     auto result = CheckMergeState(lock.get(), before_cancel);
+    dm.SetCacheEnabled(false);
     LOG(INFO) << "CheckMergeState for snapshots returned: " << result.state;
 
     if (result.state == UpdateState::MergeCompleted) {
@@ -2084,6 +2110,95 @@ UpdateState SnapshotManager::GetUpdateState(double* progress) {
     return state;
 }
 
+bool SnapshotManager::GetMergeProgress(std::vector<SnapshotMergeProgress>* progress) {
+    progress->clear();
+
+    auto lock = LockShared();
+    if (!lock) {
+        return false;
+    }
+
+    SnapshotUpdateStatus update_status = ReadSnapshotUpdateStatus(lock.get());
+    if (update_status.state() != UpdateState::Merging &&
+        update_status.state() != UpdateState::MergeCompleted) {
+        return true;
+    }
+
+    std::vector<std::string> snapshots;
+    if (!ListSnapshots(lock.get(), &snapshots)) {
+        LOG(ERROR) << "Could not list snapshots";
+        return false;
+    }
+
+    bool userspace_snapshots = UpdateUsesUserSnapshots(lock.get());
+    if (userspace_snapshots && update_status.state() == UpdateState::Merging &&
+        !EnsureSnapuserdConnected()) {
+        return false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (const auto& snapshot : snapshots) {
+        SnapshotStatus snapshot_status;
+        if (!ReadSnapshotStatus(lock.get(), snapshot, &snapshot_status)) {
+            return false;
+        }
+
+        SnapshotMergeProgress entry;
+        entry.name = snapshot;
+        if (update_status.state() == UpdateState::MergeCompleted ||
+            snapshot_status.state() == SnapshotState::MERGE_COMPLETED) {
+            entry.completed = true;
+            progress->emplace_back(std::move(entry));
+            continue;
+        }
+
+        if (userspace_snapshots) {
+            auto dm_user_name = GetDmUserCowName(snapshot, GetSnapshotDriver(lock.get()));
+            SnapuserdMergeProgress snapuserd_progress;
+            if (!snapuserd_client_->GetMergeOpsProgress(dm_user_name, &snapuserd_progress)) {
+                LOG(WARNING) << "Could not get merge progress of " << dm_user_name;
+                continue;
+            }
+            entry.merged_ops = snapuserd_progress.merged_ops;
+            entry.total_ops = snapuserd_progress.total_ops;
+            entry.ops_per_sec = snapuserd_progress.ops_per_sec;
+        } else {
+            DmTargetSnapshot::Status dm_status;
+            if (!IsSnapshotDevice(snapshot) ||
+                !QuerySnapshotStatus(snapshot, nullptr, &dm_status)) {
+                continue;
+            }
+
+            // Sectors allocated shrinks from its value at the start of the
+            // merge down to the metadata sectors.
+            uint64_t initial = snapshot_status.sectors_allocated();
+            uint64_t metadata = snapshot_status.metadata_sectors();
+            if (initial > metadata) {
+                entry.total_ops = (initial - metadata) / kSnapshotChunkSize;
+            }
+            if (initial > dm_status.sectors_allocated) {
+                entry.merged_ops = std::min<uint64_t>(
+                        (initial - dm_status.sectors_allocated) / kSnapshotChunkSize,
+                        entry.total_ops);
+            }
+
+            std::lock_guard<std::mutex> guard(merge_progress_lock_);
+            auto& sample = merge_progress_samples_[snapshot];
+            if (sample.time != std::chrono::steady_clock::time_point{} &&
+                entry.merged_ops >= sample.merged_ops && now > sample.time) {
+                std::chrono::duration<double> elapsed = now - sample.time;
+                entry.ops_per_sec = (entry.merged_ops - sample.merged_ops) / elapsed.count();
+            } else {
+                entry.ops_per_sec = sample.ops_per_sec;
+            }
+            sample = {now, entry.merged_ops, entry.ops_per_sec};
+        }
+        entry.completed = entry.total_ops && entry.merged_ops >= entry.total_ops;
+        progress->emplace_back(std::move(entry));
+    }
+    return true;
+}
+
 bool SnapshotManager::UpdateUsesCompression() {
     auto lock = LockShared();
     if (!lock) return false;
@@ -2122,6 +2237,8 @@ bool SnapshotManager::UpdateUsesUserSnapshots() {
 }
 
 bool SnapshotManager::UpdateUsesUserSnapshots(LockedFile* lock) {
+    std::lock_guard<std::recursive_mutex> guard(mapping_lock_);
+
     // See UpdateUsesUserSnapshots()
     if (is_snapshot_userspace_.has_value()) {
         return is_snapshot_userspace_.value();
@@ -2230,6 +2347,10 @@ bool SnapshotManager::MapAllPartitions(LockedFile* lock, const std::string& supe
         return false;
     }
 
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<CreateLogicalPartitionParams> partitions;
+    std::vector<CreateLogicalPartitionParams> linear_partitions;
     for (const auto& partition : metadata->partitions) {
         if (GetPartitionGroupName(metadata->groups[partition.group_index]) == kCowGroupName) {
             LOG(INFO) << "Skip mapping partition " << GetPartitionName(partition) << " in group "
@@ -2244,15 +2365,101 @@ bool SnapshotManager::MapAllPartitions(LockedFile* lock, const std::string& supe
                 .partition_opener = &opener,
                 .timeout_ms = timeout_ms,
         };
-        if (!MapPartitionWithSnapshot(lock, std::move(params), SnapshotContext::Mount, nullptr)) {
+
+        // Partitions without a snapshot are plain linear devices, which are
+        // all created in one batch below.
+        if (partition.num_extents) {
+            std::optional<SnapshotStatus> live_snapshot_status;
+            if (!GetLiveSnapshotStatus(lock, params, &live_snapshot_status)) {
+                return false;
+            }
+            if (!live_snapshot_status.has_value()) {
+                linear_partitions.emplace_back(std::move(params));
+                continue;
+            }
+        }
+        partitions.emplace_back(std::move(params));
+    }
+
+    if (!linear_partitions.empty() && !MapLinearPartitions(std::move(linear_partitions))) {
+        return false;
+    }
+
+    if (mapping_threads_ > 1 && partitions.size() > 1) {
+        if (!MapPartitionsInParallel(lock, &partitions)) {
             return false;
         }
+    } else {
+        for (auto& params : partitions) {
+            auto partition_begin = std::chrono::steady_clock::now();
+            auto name = params.GetPartitionName();
+            if (!MapPartitionWithSnapshot(lock, std::move(params), SnapshotContext::Mount,
+                                          nullptr)) {
+                return false;
+            }
+            LOG(INFO) << "Mapped " << name << " in "
+                      << duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - partition_begin)
+                                 .count()
+                      << "ms";
+        }
     }
 
-    LOG(INFO) << "Created logical partitions with snapshot.";
+    LOG(INFO) << "Created logical partitions with snapshot in "
+              << duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin)
+                         .count()
+              << "ms";
     return true;
 }
 
+bool SnapshotManager::MapPartitionsInParallel(
+        LockedFile* lock, std::vector<CreateLogicalPartitionParams>* partitions) {
+    CHECK(lock);
+
+    // Populate the lazily read update state once, rather than having every
+    // thread contend for it.
+    UpdateUsesUserSnapshots(lock);
+
+    std::atomic<size_t> next_partition = 0;
+    std::atomic<bool> failed = false;
+    auto map_partitions = [&]() -> void {
+        while (!failed) {
+            size_t index = next_partition++;
+            if (index >= partitions->size()) {
+                return;
+            }
+
+            auto begin = std::chrono::steady_clock::now();
+            auto& params = (*partitions)[index];
+            auto name = params.GetPartitionName();
+            if (!MapPartitionWithSnapshot(lock, std::move(params), SnapshotContext::Mount,
+                                          nullptr)) {
+                LOG(ERROR) << "Could not map partition: " << name;
+                failed = true;
+                return;
+            }
+            LOG(INFO) << "Mapped " << name << " in "
+                      << duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - begin)
+                                 .count()
+                      << "ms";
+        }
+    };
+
+    size_t num_threads = std::min<size_t>(mapping_threads_, partitions->size());
+    LOG(INFO) << "Mapping " << partitions->size() << " partitions on " << num_threads
+              << " threads";
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back(map_partitions);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return !failed;
+}
+
 static std::chrono::milliseconds GetRemainingTime(
         const std::chrono::milliseconds& timeout,
         const std::chrono::time_point<std::chrono::steady_clock>& begin) {
@@ -2270,6 +2477,86 @@ static std::chrono::milliseconds GetRemainingTime(
     return remaining_time;
 }
 
+bool SnapshotManager::MapLinearPartitions(std::vector<CreateLogicalPartitionParams> partitions) {
+    auto begin = std::chrono::steady_clock::now();
+    auto timeout_ms = partitions[0].timeout_ms;
+
+    std::vector<std::string> names;
+    for (const auto& params : partitions) {
+        names.emplace_back(params.GetPartitionName());
+    }
+
+    std::vector<std::string> paths;
+    if (!android::fs_mgr::CreateLogicalPartitions(std::move(partitions), &paths)) {
+        return false;
+    }
+
+    AutoDeviceList created_devices;
+    for (const auto& name : names) {
+        created_devices.EmplaceBack<AutoUnmapDevice>(&dm_, name);
+    }
+
+    for (const auto& path : paths) {
+        auto remaining_time = GetRemainingTime(timeout_ms, begin);
+        if (remaining_time.count() < 0) {
+            return false;
+        }
+        if (!WaitForDevice(path, remaining_time)) {
+            return false;
+        }
+    }
+    created_devices.Release();
+
+    LOG(INFO) << "Mapped " << paths.size() << " partitions without snapshots in "
+              << duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin)
+                         .count()
+              << "ms";
+    return true;
+}
+
+// Determine if there is a live snapshot for the SnapshotStatus of the partition; i.e. if the
+// partition still has a snapshot that needs to be mapped. If no live snapshot or merge
+// completed, |live_snapshot_status| is set to nullopt.
+bool SnapshotManager::GetLiveSnapshotStatus(LockedFile* lock,
+                                            const CreateLogicalPartitionParams& params,
+                                            std::optional<SnapshotStatus>* live_snapshot_status) {
+    live_snapshot_status->reset();
+
+    if (!(params.partition->attributes & LP_PARTITION_ATTR_UPDATED)) {
+        LOG(INFO) << "Detected re-flashing of partition, will skip snapshot: "
+                  << params.GetPartitionName();
+        return true;
+    }
+    auto file_path = GetSnapshotStatusFilePath(params.GetPartitionName());
+    if (access(file_path.c_str(), F_OK) != 0) {
+        if (errno != ENOENT) {
+            PLOG(INFO) << "Can't map snapshot for " << params.GetPartitionName()
+                       << ": Can't access " << file_path;
+            return false;
+        }
+        return true;
+    }
+    SnapshotStatus status;
+    if (!ReadSnapshotStatus(lock, params.GetPartitionName(), &status)) {
+        return false;
+    }
+    // No live snapshot if merge is completed.
+    if (status.state() == SnapshotState::MERGE_COMPLETED) {
+        return true;
+    }
+
+    if (status.state() == SnapshotState::NONE ||
+        status.cow_partition_size() + status.cow_file_size() == 0) {
+        LOG(WARNING) << "Snapshot status for " << params.GetPartitionName()
+                     << " is invalid, ignoring: state = " << SnapshotState_Name(status.state())
+                     << ", cow_partition_size = " << status.cow_partition_size()
+                     << ", cow_file_size = " << status.cow_file_size();
+        return true;
+    }
+    *live_snapshot_status = std::move(status);
+    return true;
+}
+
 bool SnapshotManager::MapPartitionWithSnapshot(LockedFile* lock,
                                                CreateLogicalPartitionParams params,
                                                SnapshotContext context, SnapshotPaths* paths) {
@@ -2295,45 +2582,10 @@ bool SnapshotManager::MapPartitionWithSnapshot(LockedFile* lock,
         return true;  // leave path empty to indicate that nothing is mapped.
     }
 
-    // Determine if there is a live snapshot for the SnapshotStatus of the partition; i.e. if the
-    // partition still has a snapshot that needs to be mapped.  If no live snapshot or merge
-    // completed, live_snapshot_status is set to nullopt.
     std::optional<SnapshotStatus> live_snapshot_status;
-    do {
-        if (!(params.partition->attributes & LP_PARTITION_ATTR_UPDATED)) {
-            LOG(INFO) << "Detected re-flashing of partition, will skip snapshot: "
-                      << params.GetPartitionName();
-            break;
-        }
-        auto file_path = GetSnapshotStatusFilePath(params.GetPartitionName());
-        if (access(file_path.c_str(), F_OK) != 0) {
-            if (errno != ENOENT) {
-                PLOG(INFO) << "Can't map snapshot for " << params.GetPartitionName()
-                           << ": Can't access " << file_path;
-                return false;
-            }
-            break;
-        }
-        live_snapshot_status = std::make_optional<SnapshotStatus>();
-        if (!ReadSnapshotStatus(lock, params.GetPartitionName(), &*live_snapshot_status)) {
-            return false;
-        }
-        // No live snapshot if merge is completed.
-        if (live_snapshot_status->state() == SnapshotState::MERGE_COMPLETED) {
-            live_snapshot_status.reset();
-        }
-
-        if (live_snapshot_status->state() == SnapshotState::NONE ||
-            live_snapshot_status->cow_partition_size() + live_snapshot_status->cow_file_size() ==
-                    0) {
-            LOG(WARNING) << "Snapshot status for " << params.GetPartitionName()
-                         << " is invalid, ignoring: state = "
-                         << SnapshotState_Name(live_snapshot_status->state())
-                         << ", cow_partition_size = " << live_snapshot_status->cow_partition_size()
-                         << ", cow_file_size = " << live_snapshot_status->cow_file_size();
-            live_snapshot_status.reset();
-        }
-    } while (0);
+    if (!GetLiveSnapshotStatus(lock, params, &live_snapshot_status)) {
+        return false;
+    }
 
     if (live_snapshot_status.has_value()) {
         // dm-snapshot requires the base device to be writable.
@@ -2784,6 +3036,9 @@ auto SnapshotManager::OpenFile(const std::string& file, int lock_flags)
 }
 
 SnapshotManager::LockedFile::~LockedFile() {
+    if (cache_ && lock_mode_ == LOCK_EX) {
+        cache_->Sync();
+    }
     if (TEMP_FAILURE_RETRY(flock(fd_, LOCK_UN)) < 0) {
         PLOG(ERROR) << "Failed to unlock file: " << path_;
     }
@@ -2803,7 +3058,11 @@ std::string SnapshotManager::GetLockPath() const {
 
 std::unique_ptr<SnapshotManager::LockedFile> SnapshotManager::OpenLock(int lock_flags) {
     auto lock_file = GetLockPath();
-    return OpenFile(lock_file, lock_flags);
+    auto lock = OpenFile(lock_file, lock_flags);
+    if (lock) {
+        lock->set_status_cache(status_cache_);
+    }
+    return lock;
 }
 
 std::unique_ptr<SnapshotManager::LockedFile> SnapshotManager::LockShared() {
@@ -2871,7 +3130,7 @@ SnapshotUpdateStatus SnapshotManager::ReadSnapshotUpdateStatus(LockedFile* lock)
 
     SnapshotUpdateStatus status = {};
     std::string contents;
-    if (!android::base::ReadFileToString(GetStateFilePath(), &contents)) {
+    if (!status_cache_->Read(GetStateFilePath(), &contents)) {
         PLOG(ERROR) << "Read state file failed";
         status.set_state(UpdateState::None);
         return status;
@@ -2963,7 +3222,7 @@ bool SnapshotManager::WriteSnapshotUpdateStatus(LockedFile* lock,
     }
 #endif
 
-    if (!WriteStringToFileAtomic(contents, GetStateFilePath())) {
+    if (!status_cache_->Write(GetStateFilePath(), contents)) {
         PLOG(ERROR) << "Could not write to state file";
         return false;
     }
@@ -2986,14 +3245,14 @@ bool SnapshotManager::ReadSnapshotStatus(LockedFile* lock, const std::string& na
     CHECK(lock);
     auto path = GetSnapshotStatusFilePath(name);
 
-    unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
-    if (fd < 0) {
+    std::string contents;
+    if (!status_cache_->Read(path, &contents)) {
         PLOG(ERROR) << "Open failed: " << path;
         return false;
     }
 
-    if (!status->ParseFromFileDescriptor(fd.get())) {
-        PLOG(ERROR) << "Unable to parse " << path << " as SnapshotStatus";
+    if (!status->ParseFromString(contents)) {
+        LOG(ERROR) << "Unable to parse " << path << " as SnapshotStatus";
         return false;
     }
 
@@ -3019,7 +3278,7 @@ bool SnapshotManager::WriteSnapshotStatus(LockedFile* lock, const SnapshotStatus
         return false;
     }
 
-    if (!WriteStringToFileAtomic(content, path)) {
+    if (!status_cache_->Write(path, content)) {
         PLOG(ERROR) << "Unable to write SnapshotStatus to " << path;
         return false;
     }
@@ -3611,6 +3870,10 @@ std::unique_ptr<ISnapshotWriter> SnapshotManager::OpenCompressedSnapshotWriter(
     CowOptions cow_options;
     cow_options.compression = status.compression_algorithm();
     cow_options.max_blocks = {status.device_size() / cow_options.block_size};
+    cow_options.detect_zero_blocks = true;
+    if (UpdateUsesIouring(lock)) {
+        cow_options.write_queue_depth = kCowWriteQueueDepth;
+    }
     // Disable scratch space for vts tests
     if (device()->IsTestDevice()) {
         cow_options.scratch_space = false;
@@ -4077,6 +4340,7 @@ bool SnapshotManager::WaitForDevice(const std::string& device,
     // In first-stage init, we rely on init setting a callback which can
     // regenerate uevents and populate /dev for us.
     if (uevent_regen_callback_) {
+        std::lock_guard<std::recursive_mutex> guard(mapping_lock_);
         if (!uevent_regen_callback_(device)) {
             LOG(ERROR) << "Failed to find device after regenerating uevents: " << device;
             return false;
@@ -4120,6 +4384,7 @@ bool SnapshotManager::PerformSecondStageInitTransition() {
 
 const LpMetadata* SnapshotManager::ReadOldPartitionMetadata(LockedFile* lock) {
     CHECK(lock);
+    std::lock_guard<std::recursive_mutex> guard(mapping_lock_);
 
     if (!old_partition_metadata_) {
         auto path = GetOldPartitionMetadataPath();
@@ -16,6 +16,10 @@
 
 #include "snapshot_reader.h"
 
+#include <fcntl.h>
+
+#include <algorithm>
+
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <ext4_utils/ext4_utils.h>
@@ -25,6 +29,14 @@ namespace snapshot {
 
 using android::base::borrowed_fd;
 
+// Sequential reads of the source device are read ahead by this much at first, doubling on each
+// readahead up to the maximum.
+static constexpr size_t kMinReadaheadSize = 128 * 1024;
+static constexpr size_t kMaxReadaheadSize = 2 * 1024 * 1024;
+
+// Number of decoded blocks kept for unaligned reads.
+static constexpr size_t kBlockCacheSize = 16;
+
 // Not supported.
 bool ReadOnlyFileDescriptor::Open(const char*, int, mode_t) {
     errno = EINVAL;
@@ -79,6 +91,8 @@ bool ReadFdFileDescriptor::Flush() {
 
 bool CompressedSnapshotReader::SetCow(std::unique_ptr<CowReader>&& cow) {
     cow_ = std::move(cow);
+    ops_.clear();
+    block_cache_.clear();
 
     CowHeader header;
     if (!cow_->GetHeader(&header)) {
@@ -167,6 +181,15 @@ ssize_t CompressedSnapshotReader::Read(void* buf, size_t count) {
     // Chop off the first N bytes if the position is not block-aligned.
     size_t start_offset = offset_ % block_size_;
 
+    if (offset_ != last_read_end_) {
+        sequential_ = false;
+        readahead_end_ = 0;
+        readahead_size_ = kMinReadaheadSize;
+    } else {
+        sequential_ = true;
+    }
+    last_read_end_ = offset_ + count;
+
     MemoryByteSink sink(buf, count);
 
     size_t initial_bytes = std::min(block_size_ - start_offset, sink.remaining());
@@ -176,12 +199,13 @@ ssize_t CompressedSnapshotReader::Read(void* buf, size_t count) {
     }
     offset_ += rv;
 
-    for (uint64_t chunk = start_chunk + 1; chunk < end_chunk; chunk++) {
-        ssize_t rv = ReadBlock(chunk, &sink, 0);
+    for (uint64_t chunk = start_chunk + 1; chunk < end_chunk;) {
+        ssize_t rv = ReadBlocks(chunk, end_chunk - chunk, &sink);
         if (rv < 0) {
             return -1;
         }
         offset_ += rv;
+        chunk += rv / block_size_;
     }
 
     if (sink.remaining()) {
@@ -224,6 +248,88 @@ class PartialSink : public MemoryByteSink {
     char discard_[BLOCK_SZ];
 };
 
+const CowOperation* CompressedSnapshotReader::GetOp(uint64_t chunk) const {
+    if (chunk < ops_.size()) {
+        return ops_[chunk];
+    }
+    return nullptr;
+}
+
+bool CompressedSnapshotReader::ReadSource(void* buffer, size_t count, off64_t offset) {
+    borrowed_fd fd = GetSourceFd();
+    if (fd < 0) {
+        // GetSourceFd sets errno.
+        return false;
+    }
+    if (!android::base::ReadFullyAtOffset(fd, buffer, count, offset)) {
+        PLOG(ERROR) << "read " << *source_device_;
+        // ReadFullyAtOffset sets errno.
+        return false;
+    }
+
+    // Copy operations make the source reads of a sequential read jump around, which defeats the
+    // kernel's own readahead, so ask for the data after this read explicitly.
+    off64_t end = offset + count;
+    if (sequential_ && end + static_cast<off64_t>(readahead_size_ / 2) > readahead_end_) {
+        off64_t start = std::max(end, readahead_end_);
+        readahead_end_ = end + readahead_size_;
+        posix_fadvise(fd.get(), start, readahead_end_ - start, POSIX_FADV_WILLNEED);
+        readahead_size_ = std::min(readahead_size_ * 2, kMaxReadaheadSize);
+    }
+    return true;
+}
+
+// Reads whole chunks starting at |chunk|: as many of the next |max_chunks| as a single read of the
+// source device or a single memset covers, or else the one chunk with compressed data.
+ssize_t CompressedSnapshotReader::ReadBlocks(uint64_t chunk, uint64_t max_chunks,
+                                             IByteSink* sink) {
+    const CowOperation* op = GetOp(chunk);
+    if (op && op->type != kCowCopyOp && op->type != kCowZeroOp) {
+        return ReadBlock(chunk, sink, 0);
+    }
+
+    uint64_t count = 1;
+    if (!op || op->type == kCowCopyOp) {
+        auto source_chunk = [](const CowOperation* cow_op, uint64_t new_chunk) -> uint64_t {
+            return cow_op ? cow_op->source : new_chunk;
+        };
+        uint64_t source = source_chunk(op, chunk);
+        for (; count < max_chunks; count++) {
+            const CowOperation* next = GetOp(chunk + count);
+            if ((next && next->type != kCowCopyOp) ||
+                source_chunk(next, chunk + count) != source + count) {
+                break;
+            }
+        }
+    } else {
+        for (; count < max_chunks; count++) {
+            const CowOperation* next = GetOp(chunk + count);
+            if (!next || next->type != kCowZeroOp) {
+                break;
+            }
+        }
+    }
+
+    size_t bytes_to_read = count * block_size_;
+    size_t actual;
+    void* buffer = sink->GetBuffer(bytes_to_read, &actual);
+    if (!buffer || actual < bytes_to_read) {
+        LOG(ERROR) << "Asked for buffer of size " << bytes_to_read << ", got " << actual;
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (op && op->type == kCowZeroOp) {
+        memset(buffer, 0, bytes_to_read);
+    } else {
+        uint64_t source = op ? op->source : chunk;
+        if (!ReadSource(buffer, bytes_to_read, source * block_size_)) {
+            return -1;
+        }
+    }
+    return bytes_to_read;
+}
+
 ssize_t CompressedSnapshotReader::ReadBlock(uint64_t chunk, IByteSink* sink, size_t start_offset,
                                             const std::optional<uint64_t>& max_bytes) {
     size_t bytes_to_read = block_size_;
@@ -235,10 +341,7 @@ ssize_t CompressedSnapshotReader::ReadBlock(uint64_t chunk, IByteSink* sink, siz
     // one chunk.
     CHECK(start_offset + bytes_to_read <= block_size_);
 
-    const CowOperation* op = nullptr;
-    if (chunk < ops_.size()) {
-        op = ops_[chunk];
-    }
+    const CowOperation* op = GetOp(chunk);
 
     size_t actual;
     void* buffer = sink->GetBuffer(bytes_to_read, &actual);
@@ -252,50 +355,55 @@ ssize_t CompressedSnapshotReader::ReadBlock(uint64_t chunk, IByteSink* sink, siz
     }
 
     if (!op || op->type == kCowCopyOp) {
-        borrowed_fd fd = GetSourceFd();
-        if (fd < 0) {
-            // GetSourceFd sets errno.
-            return -1;
-        }
-
         if (op) {
             chunk = op->source;
         }
 
         off64_t offset = (chunk * block_size_) + start_offset;
-        if (!android::base::ReadFullyAtOffset(fd, buffer, bytes_to_read, offset)) {
-            PLOG(ERROR) << "read " << *source_device_;
-            // ReadFullyAtOffset sets errno.
+        if (!ReadSource(buffer, bytes_to_read, offset)) {
             return -1;
         }
     } else if (op->type == kCowZeroOp) {
         memset(buffer, 0, bytes_to_read);
-    } else if (op->type == kCowReplaceOp) {
+    } else if (bytes_to_read == block_size_) {
+        if (!ReadCowData(op, buffer, 0, bytes_to_read)) {
+            return -1;
+        }
+    } else {
+        // The rest of the block is likely to be read next, so decode all of it once.
+        const uint8_t* block = GetDecodedBlock(chunk, op);
+        if (!block) {
+            return -1;
+        }
+        memcpy(buffer, block + start_offset, bytes_to_read);
+    }
+
+    // MemoryByteSink doesn't do anything in ReturnBuffer, so don't bother calling it.
+    return bytes_to_read;
+}
+
+// Decodes the data of a replace or xor operation into |buffer|, skipping the first |start_offset|
+// bytes of the block.
+bool CompressedSnapshotReader::ReadCowData(const CowOperation* op, void* buffer,
+                                           size_t start_offset, size_t bytes_to_read) {
+    if (op->type == kCowReplaceOp) {
         PartialSink partial_sink(buffer, bytes_to_read, start_offset);
         if (!cow_->ReadData(*op, &partial_sink)) {
             LOG(ERROR) << "CompressedSnapshotReader failed to read replace op";
             errno = EIO;
-            return -1;
+            return false;
         }
     } else if (op->type == kCowXorOp) {
-        borrowed_fd fd = GetSourceFd();
-        if (fd < 0) {
-            // GetSourceFd sets errno.
-            return -1;
-        }
-
         off64_t offset = op->source + start_offset;
         char data[BLOCK_SZ];
-        if (!android::base::ReadFullyAtOffset(fd, &data, bytes_to_read, offset)) {
-            PLOG(ERROR) << "read " << *source_device_;
-            // ReadFullyAtOffset sets errno.
-            return -1;
+        if (!ReadSource(&data, bytes_to_read, offset)) {
+            return false;
         }
         PartialSink partial_sink(buffer, bytes_to_read, start_offset);
         if (!cow_->ReadData(*op, &partial_sink)) {
             LOG(ERROR) << "CompressedSnapshotReader failed to read xor op";
             errno = EIO;
-            return -1;
+            return false;
         }
         for (size_t i = 0; i < bytes_to_read; i++) {
             ((char*)buffer)[i] ^= data[i];
@@ -303,11 +411,37 @@ ssize_t CompressedSnapshotReader::ReadBlock(uint64_t chunk, IByteSink* sink, siz
     } else {
         LOG(ERROR) << "CompressedSnapshotReader unknown op type: " << uint32_t(op->type);
         errno = EINVAL;
-        return -1;
+        return false;
     }
+    return true;
+}
 
-    // MemoryByteSink doesn't do anything in ReturnBuffer, so don't bother calling it.
-    return bytes_to_read;
+const uint8_t* CompressedSnapshotReader::GetDecodedBlock(uint64_t chunk, const CowOperation* op) {
+    cache_clock_++;
+    for (auto& entry : block_cache_) {
+        if (entry.chunk == chunk && !entry.data.empty()) {
+            entry.last_use = cache_clock_;
+            return entry.data.data();
+        }
+    }
+
+    CachedBlock* entry;
+    if (block_cache_.size() < kBlockCacheSize) {
+        entry = &block_cache_.emplace_back();
+    } else {
+        entry = &*std::min_element(block_cache_.begin(), block_cache_.end(),
+                                   [](const CachedBlock& a, const CachedBlock& b) {
+                                       return a.last_use < b.last_use;
+                                   });
+    }
+    entry->chunk = chunk;
+    entry->last_use = cache_clock_;
+    entry->data.resize(block_size_);
+    if (!ReadCowData(op, entry->data.data(), 0, block_size_)) {
+        entry->data.clear();
+        return nullptr;
+    }
+    return entry->data.data();
 }
 
 off64_t CompressedSnapshotReader::Seek(off64_t offset, int whence) {
@@ -336,6 +470,7 @@ uint64_t CompressedSnapshotReader::BlockDevSize() {
 bool CompressedSnapshotReader::Close() {
     cow_ = nullptr;
     source_fd_ = {};
+    block_cache_.clear();
     return true;
 }
 
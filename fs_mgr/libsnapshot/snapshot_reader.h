@@ -65,8 +65,21 @@ class CompressedSnapshotReader : public ReadOnlyFileDescriptor {
     bool Flush() override;
 
   private:
+    // A block decoded from a replace or xor operation, kept for reads of the rest of the block.
+    struct CachedBlock {
+        uint64_t chunk = 0;
+        uint64_t last_use = 0;
+        std::vector<uint8_t> data;
+    };
+
     ssize_t ReadBlock(uint64_t chunk, IByteSink* sink, size_t start_offset,
                       const std::optional<uint64_t>& max_bytes = {});
+    ssize_t ReadBlocks(uint64_t chunk, uint64_t max_chunks, IByteSink* sink);
+    bool ReadCowData(const CowOperation* op, void* buffer, size_t start_offset,
+                     size_t bytes_to_read);
+    const uint8_t* GetDecodedBlock(uint64_t chunk, const CowOperation* op);
+    bool ReadSource(void* buffer, size_t count, off64_t offset);
+    const CowOperation* GetOp(uint64_t chunk) const;
     android::base::borrowed_fd GetSourceFd();
 
     std::unique_ptr<CowReader> cow_;
@@ -79,6 +92,15 @@ class CompressedSnapshotReader : public ReadOnlyFileDescriptor {
     off64_t offset_ = 0;
 
     std::vector<const CowOperation*> ops_;
+
+    // Sequential readahead of the source device.
+    bool sequential_ = false;
+    off64_t last_read_end_ = -1;
+    off64_t readahead_end_ = 0;
+    size_t readahead_size_ = 0;
+
+    std::vector<CachedBlock> block_cache_;
+    uint64_t cache_clock_ = 0;
 };
 
 }  // namespace snapshot
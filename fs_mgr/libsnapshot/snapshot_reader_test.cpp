@@ -142,9 +142,36 @@ class OfflineSnapshotTest : public ::testing::Test {
         ASSERT_EQ(value, MakeNewBlockString()[1000]);
     }
 
+    void TestSequentialReads(ISnapshotWriter* writer) {
+        std::string xor_block = base_blocks_[0].substr(kBlockSize / 2, kBlockSize / 2) +
+                                base_blocks_[1].substr(0, kBlockSize / 2);
+        for (int i = 0; i < 100; i++) {
+            xor_block[i] = (char)~(xor_block[i]);
+        }
+        std::string expected = base_blocks_[0] + xor_block + base_blocks_[2] + base_blocks_[0] +
+                               base_blocks_[4] + MakeNewBlockString() + base_blocks_[6] +
+                               std::string(kBlockSize * 2, 0) + base_blocks_[9];
+
+        // Read the whole device in steps that are not block-aligned, so that most reads start and
+        // end in the middle of a block.
+        for (size_t step : {size_t(1000), size_t(kBlockSize + 100), size_t(kBlockSize * 3)}) {
+            auto reader = writer->OpenReader();
+            ASSERT_NE(reader, nullptr);
+
+            std::string data;
+            while (data.size() < expected.size()) {
+                std::string chunk(std::min(step, expected.size() - data.size()), 'x');
+                ASSERT_EQ(reader->Read(chunk.data(), chunk.size()), chunk.size());
+                data += chunk;
+            }
+            ASSERT_EQ(data, expected) << "step " << step;
+        }
+    }
+
     void TestReads(ISnapshotWriter* writer) {
         ASSERT_NO_FATAL_FAILURE(TestBlockReads(writer));
         ASSERT_NO_FATAL_FAILURE(TestByteReads(writer));
+        ASSERT_NO_FATAL_FAILURE(TestSequentialReads(writer));
     }
 
     std::string MakeNewBlockString() {
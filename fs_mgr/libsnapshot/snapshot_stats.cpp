@@ -14,6 +14,7 @@
 
 #include <libsnapshot/snapshot_stats.h>
 
+#include <algorithm>
 #include <sstream>
 
 #include <android-base/file.h>
@@ -132,6 +133,36 @@ std::string SnapshotMergeStats::source_build_fingerprint() {
     return report_.source_build_fingerprint();
 }
 
+void SnapshotMergeStats::set_merge_progress(const std::vector<SnapshotMergeProgress>& progress) {
+    for (const auto& entry : progress) {
+        PartitionMergeReport* partition = nullptr;
+        for (auto& existing : *report_.mutable_partition_merge_reports()) {
+            if (existing.name() == entry.name) {
+                partition = &existing;
+                break;
+            }
+        }
+        if (!partition) {
+            partition = report_.add_partition_merge_reports();
+            partition->set_name(entry.name);
+        }
+
+        // The counts of a completed snapshot may no longer be known; keep
+        // the last ones sampled.
+        if (entry.total_ops) {
+            partition->set_total_ops(entry.total_ops);
+        }
+        partition->set_merged_ops(entry.completed ? partition->total_ops() : entry.merged_ops);
+        if (entry.ops_per_sec > 0.0) {
+            partition->set_ops_per_sec(entry.ops_per_sec);
+            partition->set_min_ops_per_sec(partition->min_ops_per_sec() > 0.0
+                                                   ? std::min(partition->min_ops_per_sec(),
+                                                              entry.ops_per_sec)
+                                                   : entry.ops_per_sec);
+        }
+    }
+}
+
 class SnapshotMergeStatsResultImpl : public SnapshotMergeStats::Result {
   public:
     SnapshotMergeStatsResultImpl(const SnapshotMergeReport& report,
@@ -140,6 +140,7 @@ class SnapshotMergeStatsStub : public ISnapshotMergeStats {
     void set_merge_failure_code(MergeFailureCode) override {}
     MergeFailureCode merge_failure_code() override { return MergeFailureCode::Ok; }
     void set_source_build_fingerprint(const std::string&) override {}
+    void set_merge_progress(const std::vector<SnapshotMergeProgress>&) override {}
     std::string source_build_fingerprint() override { return {}; }
     bool WriteState() override { return false; }
     SnapshotMergeReport* report() override { return &report_; }
@@ -170,6 +171,11 @@ bool SnapshotManagerStub::UnmapAllSnapshots() {
     return false;
 }
 
+bool SnapshotManagerStub::GetMergeProgress(std::vector<SnapshotMergeProgress>*) {
+    LOG(ERROR) << __FUNCTION__ << " should never be called.";
+    return false;
+}
+
 void SnapshotManagerStub::UpdateCowStats(ISnapshotMergeStats*) {
     LOG(ERROR) << __FUNCTION__ << " should never be called.";
 }
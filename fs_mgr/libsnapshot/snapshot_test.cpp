@@ -586,9 +586,18 @@ TEST_F(SnapshotTest, Merge) {
     // We should not be able to cancel an update now.
     ASSERT_FALSE(sm->CancelUpdate());
 
+    std::vector<SnapshotMergeProgress> progress;
+    ASSERT_TRUE(sm->GetMergeProgress(&progress));
+    ASSERT_EQ(progress.size(), 1);
+    ASSERT_EQ(progress[0].name, "test_partition_b");
+    ASSERT_LE(progress[0].merged_ops, progress[0].total_ops);
+
     ASSERT_EQ(sm->ProcessUpdateState(), UpdateState::MergeCompleted);
     ASSERT_EQ(sm->GetUpdateState(), UpdateState::None);
 
+    ASSERT_TRUE(sm->GetMergeProgress(&progress));
+    ASSERT_TRUE(progress.empty());
+
     // The device should no longer be a snapshot or snapshot-merge.
     ASSERT_FALSE(sm->IsSnapshotDevice("test_partition_b"));
 
@@ -1234,6 +1243,47 @@ TEST_F(SnapshotUpdateTest, FullUpdateFlow) {
     }
 }
 
+// Test that first stage mount can map the snapshotted partitions on
+// multiple threads.
+TEST_F(SnapshotUpdateTest, ParallelMapping) {
+    AddOperationForPartitions();
+
+    // Execute the update.
+    ASSERT_TRUE(sm->BeginUpdate());
+    ASSERT_TRUE(sm->CreateUpdateSnapshots(manifest_));
+
+    // Write some data to target partitions.
+    for (const auto& name : {"sys_b", "vnd_b", "prd_b"}) {
+        ASSERT_TRUE(WriteSnapshotAndHash(name));
+    }
+
+    ASSERT_TRUE(sm->FinishedSnapshotWrites(false));
+
+    // Simulate shutting down the device.
+    ASSERT_TRUE(UnmapAll());
+
+    // After reboot, init does first stage mount.
+    auto init = NewManagerForFirstStageMount("_b");
+    ASSERT_NE(init, nullptr);
+    init->SetParallelMapping(4);
+    ASSERT_TRUE(init->NeedSnapshotsInFirstStageMount());
+    ASSERT_TRUE(init->CreateLogicalAndSnapshotPartitions("super", snapshot_timeout_));
+
+    // Check that the target partitions have the same content.
+    for (const auto& name : {"sys_b", "vnd_b", "prd_b"}) {
+        ASSERT_TRUE(IsPartitionUnchanged(name));
+    }
+
+    // Initiate the merge and wait for it to be completed.
+    ASSERT_TRUE(init->InitiateMerge());
+    ASSERT_EQ(UpdateState::MergeCompleted, init->ProcessUpdateState());
+
+    for (const auto& name : {"sys_b", "vnd_b", "prd_b"}) {
+        ASSERT_TRUE(IsPartitionUnchanged(name))
+                << "Content of " << name << " changes after the merge";
+    }
+}
+
 TEST_F(SnapshotUpdateTest, DuplicateOps) {
     if (!ShouldUseCompression()) {
         GTEST_SKIP() << "Compression-only test";
@@ -16,6 +16,8 @@
 
 #include <libsnapshot/snapshot_writer.h>
 
+#include <algorithm>
+
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <payload_consumer/file_descriptor.h>
@@ -28,6 +30,10 @@ using android::base::borrowed_fd;
 using android::base::unique_fd;
 using chromeos_update_engine::FileDescriptor;
 
+// Largest number of held-back raw blocks. A multiple of kCowMaxCompressionFactor, so that flushing
+// a long run doesn't change how it is split into compression units.
+static constexpr uint64_t kMaxPendingRawBlocks = 256;
+
 ISnapshotWriter::ISnapshotWriter(const CowOptions& options) : ICowWriter(options) {}
 
 void ISnapshotWriter::SetSourceDevice(const std::string& source_device) {
@@ -60,13 +66,34 @@ bool CompressedSnapshotWriter::SetCowDevice(android::base::unique_fd&& cow_devic
 }
 
 bool CompressedSnapshotWriter::Finalize() {
-    return cow_->Finalize();
+    return FlushPending() && cow_->Finalize();
 }
 
 uint64_t CompressedSnapshotWriter::GetCowSize() {
+    if (!FlushPending()) {
+        LOG(ERROR) << "Could not flush pending blocks before computing COW size";
+    }
     return cow_->GetCowSize();
 }
 
+bool CompressedSnapshotWriter::FlushPending() {
+    PendingType type = pending_type_;
+    pending_type_ = PendingType::kNone;
+    switch (type) {
+        case PendingType::kNone:
+            return true;
+        case PendingType::kRaw: {
+            bool ok = cow_->AddRawBlocks(pending_start_, pending_data_.data(),
+                                         pending_data_.size());
+            pending_data_.clear();
+            return ok;
+        }
+        case PendingType::kZero:
+            return cow_->AddZeroBlocks(pending_start_, pending_blocks_);
+    }
+    return true;
+}
+
 std::unique_ptr<CowReader> CompressedSnapshotWriter::OpenCowReader() const {
     unique_fd cow_fd(dup(cow_device_.get()));
     if (cow_fd < 0) {
@@ -92,6 +119,9 @@ bool CompressedSnapshotWriter::VerifyMergeOps() const noexcept {
 }
 
 std::unique_ptr<FileDescriptor> CompressedSnapshotWriter::OpenReader() {
+    if (!FlushPending()) {
+        return nullptr;
+    }
     auto cow = OpenCowReader();
 
     auto reader = std::make_unique<CompressedSnapshotReader>();
@@ -112,29 +142,67 @@ std::unique_ptr<FileDescriptor> CompressedSnapshotWriter::OpenReader() {
 }
 
 bool CompressedSnapshotWriter::EmitCopy(uint64_t new_block, uint64_t old_block) {
-    return cow_->AddCopy(new_block, old_block);
+    // The COW format has no copy ranges; each copy is its own operation.
+    return FlushPending() && cow_->AddCopy(new_block, old_block);
 }
 
 bool CompressedSnapshotWriter::EmitRawBlocks(uint64_t new_block_start, const void* data,
                                              size_t size) {
-    return cow_->AddRawBlocks(new_block_start, data, size);
+    const char* bytes = reinterpret_cast<const char*>(data);
+    while (size > 0) {
+        if (pending_type_ != PendingType::kRaw ||
+            pending_start_ + pending_blocks_ != new_block_start) {
+            if (!FlushPending()) {
+                return false;
+            }
+            pending_type_ = PendingType::kRaw;
+            pending_start_ = new_block_start;
+            pending_blocks_ = 0;
+        }
+
+        uint64_t blocks = std::min<uint64_t>(size / options_.block_size,
+                                             kMaxPendingRawBlocks - pending_blocks_);
+        size_t length = blocks * options_.block_size;
+        pending_data_.append(bytes, length);
+        pending_blocks_ += blocks;
+        new_block_start += blocks;
+        bytes += length;
+        size -= length;
+
+        if (pending_blocks_ == kMaxPendingRawBlocks && !FlushPending()) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool CompressedSnapshotWriter::EmitXorBlocks(uint32_t new_block_start, const void* data,
                                              size_t size, uint32_t old_block, uint16_t offset) {
-    return cow_->AddXorBlocks(new_block_start, data, size, old_block, offset);
+    return FlushPending() &&
+           cow_->AddXorBlocks(new_block_start, data, size, old_block, offset);
 }
 
 bool CompressedSnapshotWriter::EmitZeroBlocks(uint64_t new_block_start, uint64_t num_blocks) {
-    return cow_->AddZeroBlocks(new_block_start, num_blocks);
+    if (pending_type_ == PendingType::kZero &&
+        pending_start_ + pending_blocks_ == new_block_start) {
+        pending_blocks_ += num_blocks;
+        return true;
+    }
+    if (!FlushPending()) {
+        return false;
+    }
+    pending_type_ = PendingType::kZero;
+    pending_start_ = new_block_start;
+    pending_blocks_ = num_blocks;
+    return true;
 }
 
 bool CompressedSnapshotWriter::EmitLabel(uint64_t label) {
-    return cow_->AddLabel(label);
+    return FlushPending() && cow_->AddLabel(label);
 }
 
 bool CompressedSnapshotWriter::EmitSequenceData(size_t num_ops, const uint32_t* data) {
-    return cow_->AddSequenceData(num_ops, data);
+    return FlushPending() && cow_->AddSequenceData(num_ops, data);
 }
 
 bool CompressedSnapshotWriter::Initialize() {
@@ -59,4 +59,50 @@ TEST_F(CompressedSnapshotWriterTest, ReadAfterWrite) {
     ASSERT_EQ(read_back, buffer);
 }
 
+TEST_F(CompressedSnapshotWriterTest, CombineAdjacentWrites) {
+    TemporaryFile cow_device_file{};
+    android::snapshot::CowOptions options{.block_size = BLOCK_SIZE};
+    options.compression = "gz";
+    options.compression_factor = 4;
+    android::snapshot::CompressedSnapshotWriter snapshot_writer{options};
+    snapshot_writer.SetCowDevice(android::base::unique_fd{dup(cow_device_file.fd)});
+    ASSERT_TRUE(snapshot_writer.Initialize());
+
+    // Write eight blocks one at a time, then two adjacent zero extents.
+    std::vector<unsigned char> buffer(BLOCK_SIZE * 8);
+    for (size_t i = 0; i < buffer.size(); i++) {
+        buffer[i] = (i / BLOCK_SIZE) + 1;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        ASSERT_TRUE(snapshot_writer.AddRawBlocks(i, buffer.data() + i * BLOCK_SIZE, BLOCK_SIZE));
+    }
+    ASSERT_TRUE(snapshot_writer.AddZeroBlocks(8, 1));
+    ASSERT_TRUE(snapshot_writer.AddZeroBlocks(9, 2));
+    ASSERT_TRUE(snapshot_writer.Finalize());
+
+    // The single-block writes were compressed together as two units.
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(android::base::unique_fd{dup(cow_device_file.fd)}));
+    size_t replace_ops = 0;
+    size_t zero_ops = 0;
+    for (auto iter = reader.GetOpIter(); !iter->Done(); iter->Next()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowReplaceOp) {
+            ASSERT_EQ(GetCompressionUnitBlocks(op), 4);
+            replace_ops++;
+        } else if (op.type == kCowZeroOp) {
+            zero_ops++;
+        }
+    }
+    ASSERT_EQ(replace_ops, 8);
+    ASSERT_EQ(zero_ops, 3);
+
+    auto cow_reader = snapshot_writer.OpenReader();
+    ASSERT_NE(cow_reader, nullptr);
+    std::vector<unsigned char> read_back(BLOCK_SIZE * 11);
+    ASSERT_EQ(cow_reader->Read(read_back.data(), read_back.size()), read_back.size());
+    buffer.resize(BLOCK_SIZE * 11, 0);
+    ASSERT_EQ(read_back, buffer);
+}
+
 }  // namespace android::snapshot
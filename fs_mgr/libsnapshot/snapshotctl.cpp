@@ -20,6 +20,7 @@
 #include <iostream>
 #include <map>
 #include <sstream>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -38,7 +39,9 @@ int Usage() {
                  "  merge\n"
                  "    Deprecated.\n"
                  "  map\n"
-                 "    Map all partitions at /dev/block/mapper\n";
+                 "    Map all partitions at /dev/block/mapper\n"
+                 "  merge-progress\n"
+                 "    Print the merge progress and rate of each partition.\n";
     return EX_USAGE;
 }
 
@@ -61,6 +64,29 @@ bool UnmapCmdHandler(int, char** argv) {
     return SnapshotManager::New()->UnmapAllSnapshots();
 }
 
+bool MergeProgressCmdHandler(int /*argc*/, char** argv) {
+    android::base::InitLogging(argv, &android::base::StderrLogger);
+    std::vector<SnapshotMergeProgress> progress;
+    if (!SnapshotManager::New()->GetMergeProgress(&progress)) {
+        return false;
+    }
+    for (const auto& entry : progress) {
+        std::cout << entry.name << ": ";
+        if (entry.completed) {
+            std::cout << "merge completed\n";
+            continue;
+        }
+        std::cout << entry.merged_ops << "/" << entry.total_ops << " ops ("
+                  << static_cast<int>(entry.Percentage()) << "%), " << entry.ops_per_sec
+                  << " ops/s";
+        if (auto remaining = entry.EstimatedTimeRemaining()) {
+            std::cout << ", " << remaining->count() << "s remaining";
+        }
+        std::cout << "\n";
+    }
+    return true;
+}
+
 bool MergeCmdHandler(int /*argc*/, char** argv) {
     android::base::InitLogging(argv, &android::base::StderrLogger);
     LOG(WARNING) << "Deprecated. Call update_engine_client --merge instead.";
@@ -71,6 +97,7 @@ static std::map<std::string, std::function<bool(int, char**)>> kCmdMap = {
         // clang-format off
         {"dump", DumpCmdHandler},
         {"merge", MergeCmdHandler},
+        {"merge-progress", MergeProgressCmdHandler},
         {"map", MapCmdHandler},
         {"unmap", UnmapCmdHandler},
         // clang-format on
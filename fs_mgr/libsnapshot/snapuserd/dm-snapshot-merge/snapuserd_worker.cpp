@@ -93,7 +93,10 @@ void WorkerThread::ConstructKernelCowHeader() {
 
 // Start the replace operation. This will read the
 // internal COW format and if the block is compressed,
-// it will be de-compressed.
+// it will be de-compressed. If the block is part of a
+// multi-block compression unit, the reader decompresses
+// the whole unit (or reuses its cached copy) and only
+// the requested block is copied into the buffer.
 bool WorkerThread::ProcessReplaceOp(const CowOperation* cow_op) {
     if (!reader_->ReadData(*cow_op, &bufsink_)) {
         SNAP_LOG(ERROR) << "ProcessReplaceOp failed for block " << cow_op->new_block;
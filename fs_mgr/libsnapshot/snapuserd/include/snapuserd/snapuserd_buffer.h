@@ -19,16 +19,49 @@
 #include <stdlib.h>
 
 #include <iostream>
+#include <memory>
 
 #include <libsnapshot/cow_reader.h>
 
 namespace android {
 namespace snapshot {
 
+// Zero-initialized memory from the heap or, when pinned, from an anonymous
+// mapping that is locked into RAM so that it is never reclaimed under memory
+// pressure. Pinned buffers of 2MiB or more are aligned and advised for
+// transparent huge pages; whether the kernel actually backs them with huge
+// pages depends on its THP settings.
+class MemoryBuffer {
+  public:
+    MemoryBuffer() = default;
+    ~MemoryBuffer() { Release(); }
+    MemoryBuffer(const MemoryBuffer&) = delete;
+    MemoryBuffer& operator=(const MemoryBuffer&) = delete;
+
+    // If pinning fails, the buffer falls back to unlocked memory.
+    void Allocate(size_t size, bool pin);
+    void Release();
+
+    uint8_t* get() const { return data_; }
+    size_t size() const { return size_; }
+    // Bytes actually mapped, including the rounding up to whole pages
+    size_t mapped_size() const { return mapped_size_; }
+    bool locked() const { return locked_; }
+
+  private:
+    std::unique_ptr<uint8_t[]> heap_;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t mapped_size_ = 0;
+    bool locked_ = false;
+};
+
 class BufferSink : public IByteSink {
   public:
-    void Initialize(size_t size);
+    void Initialize(size_t size, bool pin = false);
     void* GetBufPtr() { return buffer_.get(); }
+    size_t GetBufferSize() const { return buffer_size_; }
+    const MemoryBuffer& GetMemory() const { return buffer_; }
     void Clear() { memset(GetBufPtr(), 0, buffer_size_); }
     void* GetPayloadBuffer(size_t size);
     void* GetBuffer(size_t requested, size_t* actual) override;
@@ -39,15 +72,21 @@ class BufferSink : public IByteSink {
     void* GetPayloadBufPtr();
 
   private:
-    std::unique_ptr<uint8_t[]> buffer_;
+    MemoryBuffer buffer_;
     loff_t buffer_offset_;
     size_t buffer_size_;
 };
 
+// Decompresses the XOR data of an op in chunks of up to |size| bytes and
+// XORs each chunk into the destination as it is returned, so that the
+// decompressed data never has to be stored in full.
 class XorSink : public IByteSink {
   public:
     void Initialize(BufferSink* sink, size_t size);
+    // XOR into the payload of the BufferSink at its current offset.
     void Reset();
+    // XOR into |target| instead.
+    void Reset(void* target, size_t target_size);
     void* GetBuffer(size_t requested, size_t* actual) override;
     bool ReturnData(void* buffer, size_t len) override;
 
@@ -56,6 +95,8 @@ class XorSink : public IByteSink {
     std::unique_ptr<uint8_t[]> buffer_;
     size_t buffer_size_;
     size_t returned_;
+    uint8_t* target_ = nullptr;
+    size_t target_size_ = 0;
 };
 
 }  // namespace snapshot
@@ -36,6 +36,34 @@ static constexpr char kSnapuserdSocketProxy[] = "snapuserd_proxy";
 // Ensure that the second-stage daemon for snapuserd is running.
 bool EnsureSnapuserdStarted();
 
+// Latency summary of one handler stat, in microseconds.
+struct SnapuserdHandlerStat {
+    std::string name;
+    uint64_t count;
+    uint64_t avg_us;
+    uint64_t p50_us;
+    uint64_t p90_us;
+    uint64_t p99_us;
+    uint64_t max_us;
+};
+
+// Memory held by one handler, in bytes.
+struct SnapuserdMemoryUsage {
+    uint64_t metadata_bytes;
+    uint64_t index_bytes;
+    uint64_t buffer_bytes;
+    uint64_t cache_bytes;
+    uint64_t locked_bytes;
+};
+
+// Op-level merge progress of one handler. |ops_per_sec| is a smoothed
+// recent merge rate, 0 if not known yet.
+struct SnapuserdMergeProgress {
+    uint64_t merged_ops;
+    uint64_t total_ops;
+    double ops_per_sec;
+};
+
 class SnapuserdClient {
   private:
     android::base::unique_fd sockfd_;
@@ -93,6 +121,39 @@ class SnapuserdClient {
     // Check the update verification status - invoked by update_verifier during
     // boot
     bool QueryUpdateVerification();
+
+    // Returns the hit and miss counts of the decompressed block caches,
+    // summed over all the snapshots served by the daemon.
+    bool GetBlockCacheStats(uint64_t* hits, uint64_t* misses);
+
+    // Tune the merge rate controller. When enabled, merges slow down to as
+    // little as |min_rate_percent| of full speed while the average dm-user
+    // request latency exceeds |latency_threshold_us| or the "some avg10" I/O
+    // pressure exceeds |io_pressure_threshold| percent.
+    bool SetMergeThrottle(bool enabled, uint32_t latency_threshold_us,
+                          uint32_t io_pressure_threshold, uint32_t min_rate_percent);
+
+    // Returns the overall merge completion percentage along with the number
+    // of partitions currently merging, waiting for a merge slot, and done.
+    bool GetMergeProgress(double* percentage, uint32_t* num_running, uint32_t* num_queued,
+                          uint32_t* num_completed);
+
+    // Returns the request and merge latency histograms of a handler, one
+    // entry per stat.
+    bool GetHandlerStats(const std::string& misc_name, std::vector<SnapuserdHandlerStat>* stats);
+
+    // Returns the memory held by a handler, and how much of it is locked
+    // into RAM.
+    bool GetHandlerMemoryUsage(const std::string& misc_name, SnapuserdMemoryUsage* usage);
+
+    // Returns the number of COW ops a handler has merged so far, out of the
+    // total, and its current merge rate.
+    bool GetMergeOpsProgress(const std::string& misc_name, SnapuserdMergeProgress* progress);
+
+    // Returns a memfd holding the parsed COW metadata of the handlers, which
+    // a new instance of snapuserd started with -metadata_fd uses instead of
+    // parsing the COWs again. Returns an invalid fd on failure.
+    android::base::unique_fd ExportMetadata();
 };
 
 }  // namespace snapshot
@@ -0,0 +1,31 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+
+namespace android {
+namespace snapshot {
+
+// dst[i] ^= src[i] for |len| bytes. The buffers may be unaligned but must
+// not overlap. The kernel (NEON, AVX2, SSE2 or portable) is picked once at
+// runtime based on the CPU.
+void XorBlocks(void* dst, const void* src, size_t len);
+
+// Name of the kernel used by XorBlocks(), for logging and benchmarks.
+const char* GetXorImplementation();
+
+}  // namespace snapshot
+}  // namespace android
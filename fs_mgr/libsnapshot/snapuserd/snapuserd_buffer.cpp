@@ -15,15 +15,84 @@
  */
 
 #include <snapuserd/snapuserd_buffer.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <android-base/logging.h>
 #include <snapuserd/snapuserd_kernel.h>
+#include <snapuserd/snapuserd_xor.h>
 
 namespace android {
 namespace snapshot {
 
-void BufferSink::Initialize(size_t size) {
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+static size_t AlignUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void MemoryBuffer::Allocate(size_t size, bool pin) {
+    Release();
+    size_ = size;
+
+    if (pin) {
+        bool huge = size >= kHugePageSize;
+        size_t alignment = huge ? kHugePageSize : static_cast<size_t>(getpagesize());
+        size_t length = AlignUp(size, alignment);
+
+        // Over-map so that the buffer can start on a huge page boundary, and
+        // trim the excess on both sides.
+        size_t map_length = huge ? length + kHugePageSize : length;
+        void* addr = mmap(nullptr, map_length, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr != MAP_FAILED) {
+            uintptr_t start = AlignUp(reinterpret_cast<uintptr_t>(addr), alignment);
+            size_t head = start - reinterpret_cast<uintptr_t>(addr);
+            if (head) {
+                munmap(addr, head);
+            }
+            if (map_length - head - length) {
+                munmap(reinterpret_cast<void*>(start + length), map_length - head - length);
+            }
+
+            data_ = reinterpret_cast<uint8_t*>(start);
+            mapped_size_ = length;
+            if (huge && madvise(data_, length, MADV_HUGEPAGE) < 0) {
+                PLOG(VERBOSE) << "madvise(MADV_HUGEPAGE) failed";
+            }
+            if (mlock(data_, length) < 0) {
+                PLOG(WARNING) << "mlock of " << length << " bytes failed";
+            } else {
+                locked_ = true;
+            }
+            return;
+        }
+        PLOG(ERROR) << "mmap of " << map_length << " bytes failed, using unpinned memory";
+    }
+
+    heap_ = std::make_unique<uint8_t[]>(size);
+    data_ = heap_.get();
+    mapped_size_ = size;
+}
+
+void MemoryBuffer::Release() {
+    if (heap_) {
+        heap_ = nullptr;
+    } else if (data_) {
+        // munmap() also drops the lock
+        munmap(data_, mapped_size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    mapped_size_ = 0;
+    locked_ = false;
+}
+
+void BufferSink::Initialize(size_t size, bool pin) {
     buffer_size_ = size;
     buffer_offset_ = 0;
-    buffer_ = std::make_unique<uint8_t[]>(size);
+    buffer_.Allocate(size, pin);
 }
 
 void* BufferSink::GetPayloadBuffer(size_t size) {
@@ -68,6 +137,14 @@ void XorSink::Initialize(BufferSink* sink, size_t size) {
 
 void XorSink::Reset() {
     returned_ = 0;
+    target_ = nullptr;
+    target_size_ = 0;
+}
+
+void XorSink::Reset(void* target, size_t target_size) {
+    returned_ = 0;
+    target_ = reinterpret_cast<uint8_t*>(target);
+    target_size_ = target_size;
 }
 
 void* XorSink::GetBuffer(size_t requested, size_t* actual) {
@@ -80,14 +157,19 @@ void* XorSink::GetBuffer(size_t requested, size_t* actual) {
 }
 
 bool XorSink::ReturnData(void* buffer, size_t len) {
-    uint8_t* xor_data = reinterpret_cast<uint8_t*>(buffer);
-    uint8_t* buff = reinterpret_cast<uint8_t*>(bufsink_->GetPayloadBuffer(len + returned_));
-    if (buff == nullptr) {
-        return false;
-    }
-    for (size_t i = 0; i < len; i++) {
-        buff[returned_ + i] ^= xor_data[i];
+    uint8_t* buff;
+    if (target_) {
+        if (target_size_ - returned_ < len) {
+            return false;
+        }
+        buff = target_;
+    } else {
+        buff = reinterpret_cast<uint8_t*>(bufsink_->GetPayloadBuffer(len + returned_));
+        if (buff == nullptr) {
+            return false;
+        }
     }
+    XorBlocks(buff + returned_, buffer, len);
     returned_ += len;
     return true;
 }
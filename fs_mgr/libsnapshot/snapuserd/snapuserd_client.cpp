@@ -29,7 +29,9 @@
 #include <chrono>
 #include <sstream>
 
+#include <android-base/cmsg.h>
 #include <android-base/logging.h>
+#include <android-base/parsedouble.h>
 #include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/strings.h>
@@ -279,5 +281,142 @@ bool SnapuserdClient::QueryUpdateVerification() {
     return response == "success";
 }
 
+bool SnapuserdClient::GetBlockCacheStats(uint64_t* hits, uint64_t* misses) {
+    std::string msg = "cache_stats";
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return false;
+    }
+    std::string response = Receivemsg();
+    auto parts = android::base::Split(response, ",");
+    if (parts.size() != 2 || !android::base::ParseUint(parts[0], hits) ||
+        !android::base::ParseUint(parts[1], misses)) {
+        LOG(ERROR) << "Invalid cache_stats response: " << response;
+        return false;
+    }
+    return true;
+}
+
+bool SnapuserdClient::SetMergeThrottle(bool enabled, uint32_t latency_threshold_us,
+                                       uint32_t io_pressure_threshold,
+                                       uint32_t min_rate_percent) {
+    std::string msg = "merge_throttle," + std::to_string(enabled ? 1 : 0) + "," +
+                      std::to_string(latency_threshold_us) + "," +
+                      std::to_string(io_pressure_threshold) + "," +
+                      std::to_string(min_rate_percent);
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return false;
+    }
+    std::string response = Receivemsg();
+    return response == "success";
+}
+
+bool SnapuserdClient::GetMergeProgress(double* percentage, uint32_t* num_running,
+                                       uint32_t* num_queued, uint32_t* num_completed) {
+    std::string msg = "merge_progress";
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return false;
+    }
+    std::string response = Receivemsg();
+    auto parts = android::base::Split(response, ",");
+    if (parts.size() != 4 || !android::base::ParseDouble(parts[0], percentage) ||
+        !android::base::ParseUint(parts[1], num_running) ||
+        !android::base::ParseUint(parts[2], num_queued) ||
+        !android::base::ParseUint(parts[3], num_completed)) {
+        LOG(ERROR) << "Invalid merge_progress response: " << response;
+        return false;
+    }
+    return true;
+}
+
+bool SnapuserdClient::GetHandlerStats(const std::string& misc_name,
+                                      std::vector<SnapuserdHandlerStat>* stats) {
+    stats->clear();
+    for (size_t index = 0;; index++) {
+        std::string msg = "handler_stats," + misc_name + "," + std::to_string(index);
+        if (!Sendmsg(msg)) {
+            LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+            return false;
+        }
+        std::string response = Receivemsg();
+        if (response == "fail") {
+            // Past the last stat, or no such handler.
+            return !stats->empty();
+        }
+
+        auto parts = android::base::Split(response, ",");
+        SnapuserdHandlerStat stat;
+        if (parts.size() != 7 || !android::base::ParseUint(parts[1], &stat.count) ||
+            !android::base::ParseUint(parts[2], &stat.avg_us) ||
+            !android::base::ParseUint(parts[3], &stat.p50_us) ||
+            !android::base::ParseUint(parts[4], &stat.p90_us) ||
+            !android::base::ParseUint(parts[5], &stat.p99_us) ||
+            !android::base::ParseUint(parts[6], &stat.max_us)) {
+            LOG(ERROR) << "Invalid handler_stats response: " << response;
+            return false;
+        }
+        stat.name = parts[0];
+        stats->emplace_back(std::move(stat));
+    }
+}
+
+bool SnapuserdClient::GetMergeOpsProgress(const std::string& misc_name,
+                                          SnapuserdMergeProgress* progress) {
+    std::string msg = "merge_ops_progress," + misc_name;
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return false;
+    }
+    std::string response = Receivemsg();
+    auto parts = android::base::Split(response, ",");
+    if (parts.size() != 3 || !android::base::ParseUint(parts[0], &progress->merged_ops) ||
+        !android::base::ParseUint(parts[1], &progress->total_ops) ||
+        !android::base::ParseDouble(parts[2], &progress->ops_per_sec)) {
+        LOG(ERROR) << "Invalid merge_ops_progress response: " << response;
+        return false;
+    }
+    return true;
+}
+
+android::base::unique_fd SnapuserdClient::ExportMetadata() {
+    std::string msg = "export_metadata";
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return {};
+    }
+
+    // The memfd only comes along with a successful response.
+    char response[PACKET_SIZE];
+    android::base::unique_fd fd;
+    ssize_t rv = android::base::ReceiveFileDescriptors(sockfd_, response, sizeof(response), &fd);
+    if (rv < 0 || std::string(response, rv) != "success" || fd < 0) {
+        LOG(ERROR) << "snapuserd did not export its metadata";
+        return {};
+    }
+    return fd;
+}
+
+bool SnapuserdClient::GetHandlerMemoryUsage(const std::string& misc_name,
+                                            SnapuserdMemoryUsage* usage) {
+    std::string msg = "memory_usage," + misc_name;
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return false;
+    }
+    std::string response = Receivemsg();
+    auto parts = android::base::Split(response, ",");
+    if (parts.size() != 5 || !android::base::ParseUint(parts[0], &usage->metadata_bytes) ||
+        !android::base::ParseUint(parts[1], &usage->index_bytes) ||
+        !android::base::ParseUint(parts[2], &usage->buffer_bytes) ||
+        !android::base::ParseUint(parts[3], &usage->cache_bytes) ||
+        !android::base::ParseUint(parts[4], &usage->locked_bytes)) {
+        LOG(ERROR) << "Invalid memory_usage response: " << response;
+        return false;
+    }
+    return true;
+}
+
 }  // namespace snapshot
 }  // namespace android
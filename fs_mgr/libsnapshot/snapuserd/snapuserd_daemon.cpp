@@ -29,6 +29,21 @@ DEFINE_bool(socket_handoff, false,
             "If true, perform a socket hand-off with an existing snapuserd instance, then exit.");
 DEFINE_bool(user_snapshot, false, "If true, user-space snapshots are used");
 DEFINE_bool(io_uring, false, "If true, io_uring feature is enabled");
+DEFINE_uint32(block_cache_mb, 4,
+              "Size in MiB of the decompressed block cache of each snapshot; 0 disables it");
+DEFINE_uint32(max_concurrent_merges, 2,
+              "Maximum number of partitions merged at the same time; 0 means no limit");
+DEFINE_uint32(read_ahead_buffer_kb, 2048,
+              "Size in KiB of the read-ahead region of snapshots without scratch space");
+DEFINE_bool(pin_memory, false,
+            "If true, snapshot metadata and I/O buffers are locked into RAM and backed by huge "
+            "pages where possible");
+DEFINE_uint32(verify_bandwidth_mb, 0,
+              "Read bandwidth budget in MiB/s of the update verification of each snapshot; 0 "
+              "means no limit");
+DEFINE_int32(metadata_fd, -1,
+             "Descriptor of the COW metadata exported by the previous daemon, used instead of "
+             "parsing the COWs given with -no_socket");
 
 namespace android {
 namespace snapshot {
@@ -96,6 +111,11 @@ bool Daemon::StartServerForUserspaceSnapshots(int arg_start, int argc, char** ar
     if (FLAGS_io_uring) {
         user_server_.SetIouringEnabled();
     }
+    user_server_.SetBlockCacheSize(static_cast<size_t>(FLAGS_block_cache_mb) << 20);
+    user_server_.SetMaxConcurrentMerges(FLAGS_max_concurrent_merges);
+    user_server_.SetReadAheadBufferSize(static_cast<size_t>(FLAGS_read_ahead_buffer_kb) << 10);
+    user_server_.SetPinMemory(FLAGS_pin_memory);
+    user_server_.SetVerifyBandwidthLimit(static_cast<uint64_t>(FLAGS_verify_bandwidth_mb) << 20);
 
     if (FLAGS_socket_handoff) {
         return user_server_.RunForSocketHandoff();
@@ -107,6 +127,11 @@ bool Daemon::StartServerForUserspaceSnapshots(int arg_start, int argc, char** ar
         return user_server_.Run();
     }
 
+    // Handlers whose metadata is missing or stale parse their COW as usual.
+    if (FLAGS_metadata_fd >= 0) {
+        user_server_.SetHandoffMetadata(android::base::unique_fd(FLAGS_metadata_fd));
+    }
+
     for (int i = arg_start; i < argc; i++) {
         auto parts = android::base::Split(argv[i], ",");
         if (parts.size() != 4) {
@@ -118,6 +143,7 @@ bool Daemon::StartServerForUserspaceSnapshots(int arg_start, int argc, char** ar
             return false;
         }
     }
+    user_server_.DropHandoffMetadata();
 
     // Skip the accept() call to avoid spurious log spam. The server will still
     // run until all handlers have completed.
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <snapuserd/snapuserd_xor.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace android {
+namespace snapshot {
+
+using XorFn = void (*)(uint8_t* dst, const uint8_t* src, size_t len);
+
+static void XorTail(uint8_t* dst, const uint8_t* src, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+static void XorPortable(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, sizeof(a));
+        memcpy(&b, src + i, sizeof(b));
+        a ^= b;
+        memcpy(dst + i, &a, sizeof(a));
+    }
+    XorTail(dst + i, src + i, len - i);
+}
+
+#if defined(__ARM_NEON)
+static void XorNeon(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        uint8x16_t a0 = vld1q_u8(dst + i);
+        uint8x16_t a1 = vld1q_u8(dst + i + 16);
+        uint8x16_t a2 = vld1q_u8(dst + i + 32);
+        uint8x16_t a3 = vld1q_u8(dst + i + 48);
+        vst1q_u8(dst + i, veorq_u8(a0, vld1q_u8(src + i)));
+        vst1q_u8(dst + i + 16, veorq_u8(a1, vld1q_u8(src + i + 16)));
+        vst1q_u8(dst + i + 32, veorq_u8(a2, vld1q_u8(src + i + 32)));
+        vst1q_u8(dst + i + 48, veorq_u8(a3, vld1q_u8(src + i + 48)));
+    }
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+    }
+    XorTail(dst + i, src + i, len - i);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static void XorSse2(uint8_t* dst, const uint8_t* src,
+                                                    size_t len) {
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i + 16));
+        __m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i + 32));
+        __m128i a3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i + 48));
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16)));
+        a2 = _mm_xor_si128(a2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32)));
+        a3 = _mm_xor_si128(a3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), a0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 16), a1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 32), a2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 48), a3);
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        a = _mm_xor_si128(a, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), a);
+    }
+    XorTail(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void XorAvx2(uint8_t* dst, const uint8_t* src,
+                                                    size_t len) {
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i + 32));
+        __m256i a2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i + 64));
+        __m256i a3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i + 96));
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+        a1 = _mm256_xor_si256(a1,
+                              _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32)));
+        a2 = _mm256_xor_si256(a2,
+                              _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 64)));
+        a3 = _mm256_xor_si256(a3,
+                              _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 96)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), a1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 64), a2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 96), a3);
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        a = _mm256_xor_si256(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a);
+    }
+    XorSse2(dst + i, src + i, len - i);
+}
+#endif
+
+struct XorImpl {
+    XorFn fn;
+    const char* name;
+};
+
+static XorImpl SelectXorImpl() {
+#if defined(__ARM_NEON)
+    return {XorNeon, "neon"};
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {XorAvx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {XorSse2, "sse2"};
+    }
+    return {XorPortable, "portable"};
+#else
+    return {XorPortable, "portable"};
+#endif
+}
+
+static const XorImpl& GetXorImpl() {
+    static const XorImpl impl = SelectXorImpl();
+    return impl;
+}
+
+void XorBlocks(void* dst, const void* src, size_t len) {
+    GetXorImpl().fn(static_cast<uint8_t*>(dst), static_cast<const uint8_t*>(src), len);
+}
+
+const char* GetXorImplementation() {
+    return GetXorImpl().name;
+}
+
+}  // namespace snapshot
+}  // namespace android
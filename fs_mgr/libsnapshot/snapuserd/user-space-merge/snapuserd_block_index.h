@@ -0,0 +1,126 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <libsnapshot/cow_format.h>
+
+namespace android {
+namespace snapshot {
+
+// Maps the destination block of every unmerged COW operation to the
+// operation itself. This is a two-level table: the first level is indexed
+// by the upper bits of the block number and points to pages covering 4096
+// blocks each, which are only allocated for the regions of the partition
+// the COW actually touches. A page holds one presence bit per block plus,
+// for every 64 blocks, the index of the first of their operations in a
+// block-ordered array. Lookups are O(1): a bit test and a popcount.
+//
+// Operations are added with Insert() in any order; Build() must be called
+// before the first Find().
+class BlockIndex {
+  public:
+    static constexpr uint32_t kGroupShift = 6;
+    static constexpr uint32_t kPageShift = 12;
+    static constexpr uint32_t kGroupsPerPage = 1U << (kPageShift - kGroupShift);
+
+    void Insert(uint64_t block, const CowOperation* cow_op) {
+        staging_.emplace_back(block, cow_op);
+    }
+
+    void Build() {
+        // If a block was inserted more than once, the last operation wins.
+        std::stable_sort(staging_.begin(), staging_.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        ops_.clear();
+        pages_.clear();
+        ops_.reserve(staging_.size());
+        for (size_t i = 0; i < staging_.size(); i++) {
+            if (i + 1 < staging_.size() && staging_[i + 1].first == staging_[i].first) {
+                continue;
+            }
+
+            uint64_t block = staging_[i].first;
+            uint64_t page = block >> kPageShift;
+            if (page >= pages_.size()) {
+                pages_.resize(page + 1);
+            }
+            if (!pages_[page]) {
+                pages_[page] = std::make_unique<Page>();
+            }
+
+            uint32_t group = (block >> kGroupShift) & (kGroupsPerPage - 1);
+            if (!pages_[page]->bits[group]) {
+                pages_[page]->base[group] = ops_.size();
+            }
+            pages_[page]->bits[group] |= 1ULL << (block & ((1U << kGroupShift) - 1));
+            ops_.push_back(staging_[i].second);
+        }
+
+        std::vector<std::pair<uint64_t, const CowOperation*>>().swap(staging_);
+        ops_.shrink_to_fit();
+        pages_.shrink_to_fit();
+    }
+
+    // Returns the operation for |block|, or nullptr if the block is not
+    // mapped to any COW operation.
+    const CowOperation* Find(uint64_t block) const {
+        uint64_t page = block >> kPageShift;
+        if (page >= pages_.size() || !pages_[page]) {
+            return nullptr;
+        }
+
+        const Page& p = *pages_[page];
+        uint32_t group = (block >> kGroupShift) & (kGroupsPerPage - 1);
+        uint64_t bit = 1ULL << (block & ((1U << kGroupShift) - 1));
+        if (!(p.bits[group] & bit)) {
+            return nullptr;
+        }
+        return ops_[p.base[group] + __builtin_popcountll(p.bits[group] & (bit - 1))];
+    }
+
+    size_t size() const { return ops_.size(); }
+    bool empty() const { return ops_.empty(); }
+
+    // Bytes used by the index, not counting the operations themselves.
+    size_t GetMemoryUsage() const {
+        size_t num_pages = 0;
+        for (const auto& page : pages_) {
+            num_pages += (page != nullptr);
+        }
+        return ops_.capacity() * sizeof(const CowOperation*) +
+               pages_.capacity() * sizeof(std::unique_ptr<Page>) + num_pages * sizeof(Page);
+    }
+
+  private:
+    struct Page {
+        uint64_t bits[kGroupsPerPage] = {};
+        uint32_t base[kGroupsPerPage] = {};
+    };
+
+    std::vector<std::pair<uint64_t, const CowOperation*>> staging_;
+    std::vector<const CowOperation*> ops_;
+    std::vector<std::unique_ptr<Page>> pages_;
+};
+
+}  // namespace snapshot
+}  // namespace android
@@ -0,0 +1,245 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the block lookup done on every dm-user read: a binary search over
+// a sorted vector of (sector, op) pairs against BlockIndex. Synthetic layouts
+// model a full OTA, an incremental OTA with clustered changes and a sparse
+// one. To benchmark the layout of a real COW, for example one produced by
+// make_cow_from_ab_ota, pass --cow_file=<path>.
+
+#include <fcntl.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <libsnapshot/cow_reader.h>
+
+#include "snapuserd_block_index.h"
+
+namespace android {
+namespace snapshot {
+
+using android::base::unique_fd;
+
+// A 6GiB partition has ~1.5M 4KiB blocks.
+static constexpr uint64_t kNumBlocks = 1572864;
+static constexpr uint64_t kSectorsPerBlock = 8;
+
+using ChunkVec = std::vector<std::pair<uint64_t, const CowOperation*>>;
+
+struct Layout {
+    std::vector<CowOperation> ops;
+    uint64_t num_blocks;
+};
+
+enum LayoutType { kFull, kIncremental, kSparse };
+
+static Layout MakeLayout(LayoutType type) {
+    Layout layout;
+    layout.num_blocks = kNumBlocks;
+
+    std::mt19937 rng(0);
+    uint64_t block = 0;
+    while (block < kNumBlocks) {
+        uint64_t run = 1;
+        if (type == kIncremental) {
+            // Runs of 1-64 changed blocks, ~10% of the partition
+            run = std::min<uint64_t>(1 + rng() % 64, kNumBlocks - block);
+        }
+        if (type == kFull || type == kIncremental) {
+            for (uint64_t i = 0; i < run; i++) {
+                CowOperation op = {};
+                op.type = kCowReplaceOp;
+                op.new_block = block + i;
+                layout.ops.emplace_back(op);
+            }
+        } else {
+            // Isolated blocks, ~1% of the partition
+            CowOperation op = {};
+            op.type = kCowReplaceOp;
+            op.new_block = block;
+            layout.ops.emplace_back(op);
+        }
+
+        switch (type) {
+            case kFull:
+                block += run;
+                break;
+            case kIncremental:
+                block += run + rng() % (run * 18);
+                break;
+            case kSparse:
+                block += 1 + rng() % 200;
+                break;
+        }
+    }
+    return layout;
+}
+
+static bool LoadCowLayout(const std::string& path, Layout* layout) {
+    unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        return false;
+    }
+    CowReader reader;
+    if (!reader.Parse(android::base::borrowed_fd{fd})) {
+        return false;
+    }
+
+    layout->num_blocks = 0;
+    for (auto iter = reader.GetOpIter(); !iter->Done(); iter->Next()) {
+        const CowOperation& op = iter->Get();
+        if (IsMetadataOp(op)) {
+            continue;
+        }
+        layout->ops.emplace_back(op);
+        layout->num_blocks = std::max<uint64_t>(layout->num_blocks, op.new_block + 1);
+    }
+    return true;
+}
+
+// Blocks looked up by the benchmark: a scan over the whole device, as
+// done by update verification, or random reads.
+static std::vector<uint64_t> MakeQueries(const Layout& layout, bool random) {
+    std::vector<uint64_t> queries(layout.num_blocks);
+    for (uint64_t i = 0; i < layout.num_blocks; i++) {
+        queries[i] = i;
+    }
+    if (random) {
+        std::shuffle(queries.begin(), queries.end(), std::mt19937(0));
+    }
+    return queries;
+}
+
+static void RunChunkVec(benchmark::State& state, const Layout& layout, bool random) {
+    ChunkVec chunk_vec;
+    chunk_vec.reserve(layout.ops.size());
+    for (const auto& op : layout.ops) {
+        chunk_vec.emplace_back(op.new_block * kSectorsPerBlock, &op);
+    }
+    std::sort(chunk_vec.begin(), chunk_vec.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    auto queries = MakeQueries(layout, random);
+    for (auto _ : state) {
+        size_t found = 0;
+        for (uint64_t block : queries) {
+            uint64_t sector = block * kSectorsPerBlock;
+            auto it = std::lower_bound(
+                    chunk_vec.begin(), chunk_vec.end(), std::make_pair(sector, nullptr),
+                    [](const auto& a, const auto& b) { return a.first < b.first; });
+            found += (it != chunk_vec.end() && it->first == sector);
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+    state.counters["bytes"] = chunk_vec.capacity() * sizeof(ChunkVec::value_type);
+}
+
+static void RunBlockIndex(benchmark::State& state, const Layout& layout, bool random) {
+    BlockIndex index;
+    for (const auto& op : layout.ops) {
+        index.Insert(op.new_block, &op);
+    }
+    index.Build();
+
+    auto queries = MakeQueries(layout, random);
+    for (auto _ : state) {
+        size_t found = 0;
+        for (uint64_t block : queries) {
+            found += (index.Find(block) != nullptr);
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+    state.counters["bytes"] = index.GetMemoryUsage();
+}
+
+// range(0): layout type, range(1): random queries
+static void BM_ChunkVec(benchmark::State& state) {
+    Layout layout = MakeLayout(static_cast<LayoutType>(state.range(0)));
+    RunChunkVec(state, layout, state.range(1));
+}
+BENCHMARK(BM_ChunkVec)
+        ->ArgsProduct({{kFull, kIncremental, kSparse}, {0, 1}})
+        ->Unit(benchmark::kMillisecond);
+
+static void BM_BlockIndex(benchmark::State& state) {
+    Layout layout = MakeLayout(static_cast<LayoutType>(state.range(0)));
+    RunBlockIndex(state, layout, state.range(1));
+}
+BENCHMARK(BM_BlockIndex)
+        ->ArgsProduct({{kFull, kIncremental, kSparse}, {0, 1}})
+        ->Unit(benchmark::kMillisecond);
+
+static void BM_RealCow_ChunkVec(benchmark::State& state, const Layout* layout, bool random) {
+    RunChunkVec(state, *layout, random);
+}
+
+static void BM_RealCow_BlockIndex(benchmark::State& state, const Layout* layout, bool random) {
+    RunBlockIndex(state, *layout, random);
+}
+
+}  // namespace snapshot
+}  // namespace android
+
+int main(int argc, char** argv) {
+    using namespace android::snapshot;
+
+    android::base::SetMinimumLogSeverity(android::base::ERROR);
+
+    std::string cow_file;
+    static constexpr char kCowFileFlag[] = "--cow_file=";
+    int new_argc = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind(kCowFileFlag, 0) == 0) {
+            cow_file = arg.substr(strlen(kCowFileFlag));
+        } else {
+            argv[new_argc++] = argv[i];
+        }
+    }
+    argc = new_argc;
+
+    Layout cow_layout;
+    if (!cow_file.empty()) {
+        if (!LoadCowLayout(cow_file, &cow_layout)) {
+            LOG(ERROR) << "Failed to load COW: " << cow_file;
+            return 1;
+        }
+        for (bool random : {false, true}) {
+            const char* suffix = random ? "_Random" : "_Sequential";
+            benchmark::RegisterBenchmark((std::string("BM_RealCow_ChunkVec") + suffix).c_str(),
+                                         BM_RealCow_ChunkVec, &cow_layout, random)
+                    ->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark((std::string("BM_RealCow_BlockIndex") + suffix).c_str(),
+                                         BM_RealCow_BlockIndex, &cow_layout, random)
+                    ->Unit(benchmark::kMillisecond);
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
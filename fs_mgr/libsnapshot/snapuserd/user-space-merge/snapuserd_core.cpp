@@ -18,6 +18,8 @@
 
 #include <sys/utsname.h>
 
+#include <cmath>
+
 #include <android-base/chrono_utils.h>
 #include <android-base/properties.h>
 #include <android-base/scopeguard.h>
@@ -37,6 +39,7 @@ SnapshotHandler::SnapshotHandler(std::string misc_name, std::string cow_device,
     backing_store_device_ = std::move(backing_device);
     control_device_ = "/dev/dm-user/" + misc_name_;
     base_path_merge_ = std::move(base_path_merge);
+    stats_.SetName(misc_name_);
 }
 
 bool SnapshotHandler::InitializeWorkers() {
@@ -73,6 +76,7 @@ bool SnapshotHandler::InitializeWorkers() {
                                                      GetSharedPtr());
 
     update_verify_ = std::make_unique<UpdateVerify>(misc_name_);
+    update_verify_->SetBandwidthLimit(verify_bandwidth_limit_);
 
     return true;
 }
@@ -90,6 +94,44 @@ void SnapshotHandler::UpdateMergeCompletionPercentage() {
                     << " total-ops: " << reader_->get_num_total_data_ops();
 }
 
+void SnapshotHandler::UpdateMergeRate(int num_merge_ops) {
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(merge_rate_lock_);
+    if (last_merge_commit_) {
+        std::chrono::duration<double> elapsed = now - *last_merge_commit_;
+        if (elapsed.count() > 0) {
+            // Exponential moving average, weighted by time so that the
+            // estimate does not depend on how large the commits are.
+            double rate = num_merge_ops / elapsed.count();
+            double weight = 1.0 - std::exp(-elapsed / kMergeRateWindow);
+            if (merge_ops_per_sec_ == 0.0) {
+                weight = 1.0;
+            }
+            merge_ops_per_sec_ += weight * (rate - merge_ops_per_sec_);
+        }
+    }
+    last_merge_commit_ = now;
+}
+
+MergeOpsProgress SnapshotHandler::GetMergeOpsProgress() {
+    struct CowHeader* ch = reinterpret_cast<struct CowHeader*>(mapped_addr_);
+
+    MergeOpsProgress progress;
+    progress.merged_ops = ch->num_merge_ops;
+    progress.total_ops = reader_->get_num_total_data_ops();
+
+    std::lock_guard<std::mutex> lock(merge_rate_lock_);
+    progress.ops_per_sec = merge_ops_per_sec_;
+    return progress;
+}
+
+uint64_t SnapshotHandler::GetNumMergeOpsRemaining() {
+    struct CowHeader* ch = reinterpret_cast<struct CowHeader*>(mapped_addr_);
+    uint64_t total_ops = reader_->get_num_total_data_ops();
+    return total_ops > ch->num_merge_ops ? total_ops - ch->num_merge_ops : 0;
+}
+
 bool SnapshotHandler::CommitMerge(int num_merge_ops) {
     struct CowHeader* ch = reinterpret_cast<struct CowHeader*>(mapped_addr_);
     ch->num_merge_ops += num_merge_ops;
@@ -131,6 +173,7 @@ bool SnapshotHandler::CommitMerge(int num_merge_ops) {
     // even if there is a miss on reading a latest updated value.
     // Subsequent polling will eventually converge to completion.
     UpdateMergeCompletionPercentage();
+    UpdateMergeRate(num_merge_ops);
 
     return true;
 }
@@ -158,18 +201,41 @@ void SnapshotHandler::CheckMergeCompletionStatus() {
 
     SNAP_LOG(INFO) << "Merge-status: Total-Merged-ops: " << ch->num_merge_ops
                    << " Total-data-ops: " << reader_->get_num_total_data_ops();
+    SNAP_LOG(INFO) << "Handler stats (stat,count,avg_us,p50_us,p90_us,p99_us,max_us):\n"
+                   << stats_.ToString();
+
+    auto usage = GetMemoryUsage();
+    SNAP_LOG(INFO) << "Memory usage: metadata: " << usage.metadata_bytes
+                   << " index: " << usage.index_bytes << " buffers: " << usage.buffer_bytes
+                   << " cache: " << usage.cache_bytes << " locked: " << usage.locked_bytes;
 }
 
 bool SnapshotHandler::ReadMetadata() {
-    reader_ = std::make_unique<CowReader>(CowReader::ReaderFlags::USERSPACE_MERGE);
+    // Merge ordering is prepared in the background while the metadata
+    // region is mapped.
+    reader_ = std::make_unique<CowReader>(CowReader::ReaderFlags::USERSPACE_MERGE |
+                                          CowReader::ReaderFlags::DEFER_MERGE_PREP);
     CowHeader header;
     CowOptions options;
 
-    SNAP_LOG(DEBUG) << "ReadMetadata: Parsing cow file";
+    bool imported = false;
+    if (parsed_metadata_fd_ >= 0) {
+        imported = ImportParsedMetadata();
+        parsed_metadata_fd_ = -1;
+        if (!imported) {
+            SNAP_LOG(WARNING) << "Could not use the metadata handed off, parsing the COW";
+            reader_ = std::make_unique<CowReader>(CowReader::ReaderFlags::USERSPACE_MERGE |
+                                                  CowReader::ReaderFlags::DEFER_MERGE_PREP);
+        }
+    }
 
-    if (!reader_->Parse(cow_fd_)) {
-        SNAP_LOG(ERROR) << "Failed to parse";
-        return false;
+    if (!imported) {
+        SNAP_LOG(DEBUG) << "ReadMetadata: Parsing cow file";
+
+        if (!reader_->Parse(cow_fd_)) {
+            SNAP_LOG(ERROR) << "Failed to parse";
+            return false;
+        }
     }
 
     if (!reader_->GetHeader(&header)) {
@@ -189,6 +255,11 @@ bool SnapshotHandler::ReadMetadata() {
         return false;
     }
 
+    if (!reader_->WaitForMergeOps()) {
+        SNAP_LOG(ERROR) << "Failed to prepare merge ops";
+        return false;
+    }
+
     UpdateMergeCompletionPercentage();
 
     // Initialize the iterator for reading metadata
@@ -212,7 +283,7 @@ bool SnapshotHandler::ReadMetadata() {
             xor_ops += 1;
         }
 
-        chunk_vec_.push_back(std::make_pair(ChunkToSector(cow_op->new_block), cow_op));
+        block_index_.Insert(cow_op->new_block, cow_op);
 
         if (IsOrderedOp(*cow_op)) {
             ra_thread_ = true;
@@ -235,27 +306,52 @@ bool SnapshotHandler::ReadMetadata() {
         cowop_iter->Next();
     }
 
-    chunk_vec_.shrink_to_fit();
-
-    // Sort the vector based on sectors as we need this during un-aligned access
-    std::sort(chunk_vec_.begin(), chunk_vec_.end(), compare);
+    block_index_.Build();
 
     PrepareReadAhead();
 
     SNAP_LOG(INFO) << "Merged-ops: " << header.num_merge_ops
                    << " Total-data-ops: " << reader_->get_num_total_data_ops()
-                   << " Unmerged-ops: " << chunk_vec_.size() << " Copy-ops: " << copy_ops
+                   << " Unmerged-ops: " << block_index_.size() << " Copy-ops: " << copy_ops
                    << " Zero-ops: " << zero_ops << " Replace-ops: " << replace_ops
                    << " Xor-ops: " << xor_ops;
 
     return true;
 }
 
+bool SnapshotHandler::ImportParsedMetadata() {
+    if (lseek(parsed_metadata_fd_, parsed_metadata_offset_, SEEK_SET) < 0) {
+        SNAP_PLOG(ERROR) << "lseek parsed metadata failed";
+        return false;
+    }
+    if (!reader_->ImportParsedState(cow_fd_, parsed_metadata_fd_)) {
+        return false;
+    }
+    // The cache only saves decompressing blocks again; go on without it.
+    if (!block_cache_.Import(parsed_metadata_fd_)) {
+        SNAP_LOG(WARNING) << "Could not restore the block cache";
+    }
+    SNAP_LOG(INFO) << "Restored metadata handed off by the previous daemon";
+    return true;
+}
+
+bool SnapshotHandler::ExportParsedMetadata(android::base::borrowed_fd fd) {
+    if (MergeInitiated()) {
+        SNAP_LOG(ERROR) << "Metadata cannot be exported once merge has been initiated";
+        return false;
+    }
+    if (!reader_->ExportParsedState(fd) || !block_cache_.Export(fd)) {
+        SNAP_LOG(ERROR) << "Failed to export metadata";
+        return false;
+    }
+    return true;
+}
+
 bool SnapshotHandler::MmapMetadata() {
     CowHeader header;
     reader_->GetHeader(&header);
 
-    total_mapped_addr_length_ = header.header_size + BUFFER_REGION_DEFAULT_SIZE;
+    total_mapped_addr_length_ = header.header_size + GetBufferRegionSize();
 
     if (header.major_version >= 2 && header.buffer_size > 0) {
         scratch_space_ = true;
@@ -276,6 +372,21 @@ bool SnapshotHandler::MmapMetadata() {
         return false;
     }
 
+    if (pin_memory_) {
+        // Every dm-user read looks up the merge state in this mapping, so
+        // keep it resident. Transparent huge pages only apply to the
+        // anonymous (shmem) mapping; a file backed scratch space is just
+        // locked.
+        if (!scratch_space_ && madvise(mapped_addr_, total_mapped_addr_length_, MADV_HUGEPAGE)) {
+            SNAP_PLOG(VERBOSE) << "madvise(MADV_HUGEPAGE) of metadata failed";
+        }
+        if (mlock(mapped_addr_, total_mapped_addr_length_)) {
+            SNAP_PLOG(WARNING) << "mlock of metadata failed";
+        } else {
+            metadata_locked_ = true;
+        }
+    }
+
     return true;
 }
 
@@ -284,6 +395,25 @@ void SnapshotHandler::UnmapBufferRegion() {
     if (ret < 0) {
         SNAP_PLOG(ERROR) << "munmap failed";
     }
+    metadata_locked_ = false;
+}
+
+void SnapshotHandler::AccountBufferMemory(const MemoryBuffer& buffer) {
+    buffer_bytes_ += buffer.mapped_size();
+    if (buffer.locked()) {
+        locked_buffer_bytes_ += buffer.mapped_size();
+    }
+}
+
+HandlerMemoryUsage SnapshotHandler::GetMemoryUsage() {
+    HandlerMemoryUsage usage;
+    usage.metadata_bytes = total_mapped_addr_length_;
+    usage.index_bytes = block_index_.GetMemoryUsage();
+    usage.buffer_bytes = buffer_bytes_;
+    usage.cache_bytes = block_cache_.GetMemoryUsage();
+    usage.locked_bytes =
+            locked_buffer_bytes_ + (metadata_locked_ ? total_mapped_addr_length_ : 0);
+    return usage;
 }
 
 bool SnapshotHandler::InitCowDevice() {
@@ -338,11 +468,17 @@ bool SnapshotHandler::Start() {
         partition_verification = false;
     }
 
-    std::future<bool> merge_thread =
-            std::async(std::launch::async, &Worker::RunMergeThread, merge_thread_.get());
+    std::future<bool> merge_thread = std::async(std::launch::async, [this]() -> bool {
+        bool ret = merge_thread_->RunMergeThread();
+        if (merge_finished_callback_) {
+            merge_finished_callback_();
+        }
+        return ret;
+    });
 
     // Now that the worker threads are up, scan the partitions.
     if (partition_verification) {
+        update_verify_->SetIouringEnabled(IsIouringSupported());
         update_verify_->VerifyUpdatePartition();
     }
 
@@ -399,17 +535,7 @@ uint64_t SnapshotHandler::GetBufferMetadataOffset() {
  *
  */
 size_t SnapshotHandler::GetBufferMetadataSize() {
-    CowHeader header;
-    reader_->GetHeader(&header);
-    size_t buffer_size = header.buffer_size;
-
-    // If there is no scratch space, then just use the
-    // anonymous memory
-    if (buffer_size == 0) {
-        buffer_size = BUFFER_REGION_DEFAULT_SIZE;
-    }
-
-    return ((buffer_size * sizeof(struct ScratchMetadata)) / BLOCK_SZ);
+    return ((GetBufferRegionSize() * sizeof(struct ScratchMetadata)) / BLOCK_SZ);
 }
 
 size_t SnapshotHandler::GetBufferDataOffset() {
@@ -423,17 +549,29 @@ size_t SnapshotHandler::GetBufferDataOffset() {
  * (2MB - 8K = 2088960 bytes) will be the buffer region to hold the data.
  */
 size_t SnapshotHandler::GetBufferDataSize() {
+    return (GetBufferRegionSize() - GetBufferMetadataSize());
+}
+
+size_t SnapshotHandler::GetBufferRegionSize() {
     CowHeader header;
     reader_->GetHeader(&header);
-    size_t buffer_size = header.buffer_size;
 
-    // If there is no scratch space, then just use the
-    // anonymous memory
-    if (buffer_size == 0) {
-        buffer_size = BUFFER_REGION_DEFAULT_SIZE;
+    // The scratch space size is fixed when the COW is written. If there
+    // is no scratch space, then just use the anonymous memory whose size
+    // is configurable.
+    if (header.buffer_size) {
+        return header.buffer_size;
     }
+    return read_ahead_buffer_size_;
+}
+
+void SnapshotHandler::SetReadAheadBufferSize(size_t size) {
+    // Keep the metadata, one ScratchMetadata per block, block aligned
+    static constexpr size_t kAlignment = BLOCK_SZ * BLOCK_SZ / sizeof(struct ScratchMetadata);
+    static constexpr size_t kMaxSize = 32_MiB;
 
-    return (buffer_size - GetBufferMetadataSize());
+    size = std::min(size, kMaxSize) & ~(kAlignment - 1);
+    read_ahead_buffer_size_ = std::max(size, kAlignment);
 }
 
 struct BufferState* SnapshotHandler::GetBufferState() {
@@ -445,6 +583,178 @@ struct BufferState* SnapshotHandler::GetBufferState() {
     return ra_state;
 }
 
+void BlockCache::SetCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(lock_);
+    max_blocks_ = capacity / BLOCK_SZ;
+    while (lru_.size() > max_blocks_) {
+        map_.erase(lru_.back().chunk);
+        lru_.pop_back();
+    }
+}
+
+bool BlockCache::Lookup(chunk_t chunk, void* buffer) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!max_blocks_) {
+        return false;
+    }
+
+    auto it = map_.find(chunk);
+    if (it == map_.end()) {
+        misses_ += 1;
+        return false;
+    }
+
+    // Move the entry to the front of the list - most recently used
+    lru_.splice(lru_.begin(), lru_, it->second);
+    memcpy(buffer, it->second->data.get(), BLOCK_SZ);
+    hits_ += 1;
+    return true;
+}
+
+void BlockCache::Insert(chunk_t chunk, const void* buffer) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!max_blocks_ || map_.count(chunk)) {
+        return;
+    }
+
+    if (lru_.size() >= max_blocks_) {
+        // Recycle the least recently used entry along with its buffer
+        map_.erase(lru_.back().chunk);
+        lru_.splice(lru_.begin(), lru_, std::prev(lru_.end()));
+        lru_.front().chunk = chunk;
+    } else {
+        lru_.push_front({chunk, std::make_unique<uint8_t[]>(BLOCK_SZ)});
+    }
+
+    memcpy(lru_.front().data.get(), buffer, BLOCK_SZ);
+    map_[chunk] = lru_.begin();
+}
+
+void BlockCache::GetStats(uint64_t* hits, uint64_t* misses) {
+    std::lock_guard<std::mutex> lock(lock_);
+    *hits = hits_;
+    *misses = misses_;
+}
+
+bool BlockCache::Export(android::base::borrowed_fd fd) {
+    std::lock_guard<std::mutex> lock(lock_);
+    uint64_t count = lru_.size();
+    if (!android::base::WriteFully(fd, &count, sizeof(count))) {
+        return false;
+    }
+    for (auto it = lru_.rbegin(); it != lru_.rend(); it++) {
+        uint64_t chunk = it->chunk;
+        if (!android::base::WriteFully(fd, &chunk, sizeof(chunk)) ||
+            !android::base::WriteFully(fd, it->data.get(), BLOCK_SZ)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BlockCache::Import(android::base::borrowed_fd fd) {
+    uint64_t count;
+    if (!android::base::ReadFully(fd, &count, sizeof(count))) {
+        return false;
+    }
+    auto buffer = std::make_unique<uint8_t[]>(BLOCK_SZ);
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t chunk;
+        if (!android::base::ReadFully(fd, &chunk, sizeof(chunk)) ||
+            !android::base::ReadFully(fd, buffer.get(), BLOCK_SZ)) {
+            return false;
+        }
+        Insert(chunk, buffer.get());
+    }
+    return true;
+}
+
+size_t BlockCache::GetMemoryUsage() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return lru_.size() * BLOCK_SZ;
+}
+
+// Requests older than this do not count as foreground I/O
+static constexpr auto kIoActivityWindow = 1s;
+// /proc/pressure/io is sampled at most this often
+static constexpr auto kIoPressureInterval = 250ms;
+// Pause between merge batches at the lowest merge rate
+static constexpr auto kMaxMergeBackoff = 50ms;
+static constexpr uint32_t kRateIncreasePercent = 10;
+
+void MergeThrottle::SetPolicy(const MergeThrottlePolicy& policy) {
+    std::lock_guard<std::mutex> lock(lock_);
+    policy_ = policy;
+    policy_.min_rate_percent = std::clamp(policy_.min_rate_percent, 1u, 100u);
+    if (!policy_.enabled) {
+        rate_percent_ = 100;
+    }
+}
+
+MergeThrottlePolicy MergeThrottle::GetPolicy() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return policy_;
+}
+
+void MergeThrottle::RecordIoLatency(std::chrono::microseconds latency) {
+    // Exponentially weighted moving average; updates from concurrent
+    // workers may race, which is fine for a heuristic.
+    uint64_t sample = latency.count();
+    uint64_t avg = latency_avg_us_.load(std::memory_order_relaxed);
+    latency_avg_us_.store(avg ? (avg * 7 + sample) / 8 : sample, std::memory_order_relaxed);
+
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    last_io_ns_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+                      std::memory_order_relaxed);
+}
+
+bool MergeThrottle::IsUnderIoPressure(const MergeThrottlePolicy& policy) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_pressure_read_ >= kIoPressureInterval) {
+        last_pressure_read_ = now;
+
+        // Format: some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+        std::string pressure;
+        if (!android::base::ReadFileToString("/proc/pressure/io", &pressure) ||
+            sscanf(pressure.c_str(), "some avg10=%lf", &io_pressure_) != 1) {
+            io_pressure_ = 0;
+        }
+    }
+    return io_pressure_ > policy.io_pressure_threshold;
+}
+
+uint32_t MergeThrottle::Update() {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!policy_.enabled) {
+        return rate_percent_;
+    }
+
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    auto last_io = std::chrono::nanoseconds(last_io_ns_.load(std::memory_order_relaxed));
+    bool io_active = (now - last_io) < kIoActivityWindow &&
+                     latency_avg_us_.load(std::memory_order_relaxed) > policy_.latency_threshold_us;
+
+    uint32_t rate = rate_percent_;
+    if (io_active || IsUnderIoPressure(policy_)) {
+        rate = std::max(policy_.min_rate_percent, rate / 2);
+    } else {
+        rate = std::min(100u, rate + kRateIncreasePercent);
+    }
+    rate_percent_ = rate;
+    return rate;
+}
+
+int MergeThrottle::Scale(int full) {
+    return std::max(1, static_cast<int>(static_cast<int64_t>(full) * rate_percent_ / 100));
+}
+
+void MergeThrottle::Backoff() {
+    uint32_t rate = rate_percent_;
+    if (rate < 100) {
+        std::this_thread::sleep_for(kMaxMergeBackoff * (100 - rate) / 100);
+    }
+}
+
 bool SnapshotHandler::IsIouringSupported() {
     struct utsname uts;
     unsigned int major, minor;
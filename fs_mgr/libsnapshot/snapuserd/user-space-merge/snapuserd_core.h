@@ -19,12 +19,18 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <future>
 #include <iostream>
 #include <limits>
+#include <list>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -42,8 +48,12 @@
 #include <liburing.h>
 #include <snapuserd/snapuserd_buffer.h>
 #include <snapuserd/snapuserd_kernel.h>
+#include <snapuserd/snapuserd_xor.h>
 #include <storage_literals/storage_literals.h>
 
+#include "snapuserd_block_index.h"
+#include "snapuserd_stats.h"
+
 namespace android {
 namespace snapshot {
 
@@ -56,6 +66,13 @@ static_assert(PAYLOAD_BUFFER_SZ >= BLOCK_SZ);
 
 static constexpr int kNumWorkerThreads = 4;
 
+// Number of dm-user requests each I/O worker keeps outstanding
+// when the requests are read through io_uring
+static constexpr int kNumDmUserRequestSlots = 4;
+
+// Time constant of the merge rate estimate
+static constexpr std::chrono::seconds kMergeRateWindow = 30s;
+
 #define SNAP_LOG(level) LOG(level) << misc_name_ << ": "
 #define SNAP_PLOG(level) PLOG(level) << misc_name_ << ": "
 
@@ -91,6 +108,111 @@ struct MergeGroupState {
         : merge_state_(state), num_ios_in_progress(n_ios) {}
 };
 
+// Bounded LRU of decompressed replace-op blocks keyed by the destination
+// chunk. A single instance is shared by all the worker threads of a
+// SnapshotHandler, so that blocks read repeatedly during boot (dex, odex,
+// libraries) are decompressed from the COW device only once.
+class BlockCache {
+  public:
+    // Capacity is in bytes and is rounded down to a whole number of blocks.
+    // A capacity of zero disables the cache and drops every cached block.
+    void SetCapacity(size_t capacity);
+
+    // Copy the cached block for |chunk| into |buffer|. Returns false on a
+    // miss, in which case |buffer| is left untouched.
+    bool Lookup(chunk_t chunk, void* buffer);
+    void Insert(chunk_t chunk, const void* buffer);
+
+    void GetStats(uint64_t* hits, uint64_t* misses);
+    size_t GetMemoryUsage();
+
+    // Write the cached blocks to |fd|, or insert the blocks written by
+    // Export(), least recently used first.
+    bool Export(android::base::borrowed_fd fd);
+    bool Import(android::base::borrowed_fd fd);
+
+  private:
+    struct Entry {
+        chunk_t chunk;
+        std::unique_ptr<uint8_t[]> data;
+    };
+
+    std::mutex lock_;
+    size_t max_blocks_ = 0;
+    std::list<Entry> lru_;
+    std::unordered_map<chunk_t, std::list<Entry>::iterator> map_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+// Memory held by a SnapshotHandler, in bytes. |locked_bytes| is the part of
+// the metadata mapping and of the buffers that is locked into RAM.
+struct HandlerMemoryUsage {
+    uint64_t metadata_bytes = 0;
+    uint64_t index_bytes = 0;
+    uint64_t buffer_bytes = 0;
+    uint64_t cache_bytes = 0;
+    uint64_t locked_bytes = 0;
+};
+
+// Op-level merge progress of a SnapshotHandler. |ops_per_sec| is smoothed
+// over roughly the last kMergeRateWindow of merging, and is 0 until two
+// merge commits have been made.
+struct MergeOpsProgress {
+    uint64_t merged_ops = 0;
+    uint64_t total_ops = 0;
+    double ops_per_sec = 0.0;
+};
+
+// Tunables of the merge rate controller. These can be updated at runtime
+// through the "merge_throttle" server command.
+struct MergeThrottlePolicy {
+    bool enabled = true;
+    // Average dm-user request latency above which foreground I/O is
+    // considered to be contending with the merge.
+    uint32_t latency_threshold_us = 5000;
+    // "some avg10" of /proc/pressure/io, in percent, above which the
+    // device is considered to be under I/O pressure.
+    uint32_t io_pressure_threshold = 10;
+    // Lowest merge rate, in percent of full speed.
+    uint32_t min_rate_percent = 10;
+};
+
+// Adapts the merge rate to the foreground I/O load. Worker threads report
+// the latency of every dm-user request; the merge thread calls Update()
+// once per batch, which halves the rate when the device is loaded and
+// ramps it back up additively when idle. The rate scales both the merge
+// batch sizes and the io_uring queue depth used for merging.
+class MergeThrottle {
+  public:
+    void SetPolicy(const MergeThrottlePolicy& policy);
+    MergeThrottlePolicy GetPolicy();
+
+    void RecordIoLatency(std::chrono::microseconds latency);
+
+    // Re-evaluate the load and return the current rate in percent.
+    uint32_t Update();
+    uint32_t GetRatePercent() { return rate_percent_; }
+
+    // Scale |full| by the current rate; never returns less than one.
+    int Scale(int full);
+    // Pause between merge batches when running below full speed.
+    void Backoff();
+
+  private:
+    bool IsUnderIoPressure(const MergeThrottlePolicy& policy);
+
+    std::mutex lock_;
+    MergeThrottlePolicy policy_;
+    std::atomic<uint32_t> rate_percent_ = 100;
+
+    std::atomic<uint64_t> latency_avg_us_ = 0;
+    std::atomic<int64_t> last_io_ns_ = 0;
+
+    std::chrono::steady_clock::time_point last_pressure_read_;
+    double io_pressure_ = 0;
+};
+
 class ReadAhead {
   public:
     ReadAhead(const std::string& cow_device, const std::string& backing_device,
@@ -150,9 +272,15 @@ class ReadAhead {
     bool overlap_;
     std::vector<uint64_t> blocks_;
     int total_blocks_merged_ = 0;
-    std::unique_ptr<uint8_t[]> ra_temp_buffer_;
+    // Read-ahead is double buffered: the next window is read into one
+    // buffer while the merge thread merges the window in the other.
+    static constexpr int kNumReadAheadBuffers = 2;
+    MemoryBuffer ra_buffers_[kNumReadAheadBuffers];
+    int ra_buffer_index_ = 0;
+    uint8_t* ra_temp_buffer_ = nullptr;
     std::unique_ptr<uint8_t[]> ra_temp_meta_buffer_;
     BufferSink bufsink_;
+    XorSink xorsink_;
 
     uint64_t total_ra_blocks_completed_ = 0;
     bool read_ahead_async_ = false;
@@ -173,6 +301,13 @@ class UpdateVerify {
     void VerifyUpdatePartition();
     bool CheckPartitionVerification();
 
+    // Read each range with a queue of asynchronous reads instead of one
+    // read at a time.
+    void SetIouringEnabled(bool io_uring) { io_uring_enabled_ = io_uring; }
+    // Cap on the combined read rate of the verification threads, so that
+    // verification does not starve foreground I/O. Zero means no cap.
+    void SetBandwidthLimit(uint64_t bytes_per_sec) { bandwidth_limit_ = bytes_per_sec; }
+
   private:
     enum class UpdateVerifyState {
         VERIFY_UNKNOWN,
@@ -185,16 +320,29 @@ class UpdateVerify {
     std::mutex m_lock_;
     std::condition_variable m_cv_;
 
+    bool io_uring_enabled_ = false;
+    uint64_t bandwidth_limit_ = 0;
+    std::mutex bandwidth_lock_;
+    std::chrono::steady_clock::time_point next_read_time_;
+
     int kMinThreadsToVerify = 1;
     int kMaxThreadsToVerify = 4;
     uint64_t kThresholdSize = 512_MiB;
     uint64_t kBlockSizeVerify = 1_MiB;
+    int kQueueDepthVerify = 4;
 
     bool IsBlockAligned(uint64_t read_size) { return ((read_size & (BLOCK_SZ - 1)) == 0); }
     void UpdatePartitionVerificationState(UpdateVerifyState state);
     bool VerifyPartition(const std::string& partition_name, const std::string& dm_block_device);
+    // Read [begin, end) of the block device
     bool VerifyBlocks(const std::string& partition_name, const std::string& dm_block_device,
-                      off_t offset, int skip_blocks, uint64_t dev_sz);
+                      uint64_t begin, uint64_t end);
+    bool VerifyBlocksAsync(const std::string& partition_name, int fd, uint64_t begin,
+                           uint64_t end, bool* ring_failed);
+    bool VerifyBlocksSync(const std::string& partition_name, int fd, uint64_t begin,
+                          uint64_t end);
+    // Wait until |bytes| more can be read within the bandwidth limit
+    void ThrottleRead(uint64_t bytes);
 };
 
 class Worker {
@@ -224,6 +372,7 @@ class Worker {
 
     // IO Path
     bool ProcessIORequest();
+    bool ProcessDmUserRequest();
     bool IsBlockAligned(size_t size) { return ((size & (BLOCK_SZ - 1)) == 0); }
 
     bool ReadDataFromBaseDevice(sector_t sector, size_t read_size);
@@ -231,8 +380,7 @@ class Worker {
 
     bool ReadAlignedSector(sector_t sector, size_t sz, bool header_response);
     bool ReadUnalignedSector(sector_t sector, size_t size);
-    int ReadUnalignedSector(sector_t sector, size_t size,
-                            std::vector<std::pair<sector_t, const CowOperation*>>::iterator& it);
+    int ReadUnalignedSector(sector_t sector, size_t size, const CowOperation* cow_op);
     bool RespondIOError(bool header_response);
 
     // Processing COW operations
@@ -261,6 +409,16 @@ class Worker {
     bool InitializeIouring();
     void FinalizeIouring();
 
+    // io_uring based IO path
+    bool InitializeIoRequestRing();
+    void FinalizeIoRequestRing();
+    bool RunIoRequestLoop();
+    bool QueueDmUserHeaderRead(size_t slot);
+    bool WaitForIoCompletion();
+    void HandleIoCompletion(struct io_uring_cqe* cqe);
+    bool ReadDataFromBaseDeviceAsync(sector_t sector, size_t read_size);
+    bool ReapBaseDeviceReads();
+
     std::unique_ptr<CowReader> reader_;
     BufferSink bufsink_;
     XorSink xorsink_;
@@ -290,6 +448,26 @@ class Worker {
     int queue_depth_ = 8;
     std::unique_ptr<struct io_uring> ring_;
 
+    // I/O workers share |ring_| between the dm-user header reads, one
+    // per request slot, and the base device reads of the request being
+    // processed. Base device reads are only queued while a request
+    // is processed and are all reaped before it is responded to.
+    struct BaseDeviceRead {
+        void* buffer;
+        size_t size;
+        loff_t offset;
+    };
+    bool io_async_ = false;
+    int io_queue_depth_ = 64;
+    struct dm_user_header slot_headers_[kNumDmUserRequestSlots];
+    bool slot_pending_[kNumDmUserRequestSlots] = {};
+    std::deque<size_t> ready_slots_;
+    size_t ios_in_flight_ = 0;
+    bool io_stopped_ = false;
+    std::vector<BaseDeviceRead> base_reads_;
+    size_t base_reads_in_flight_ = 0;
+    bool base_reads_failed_ = false;
+
     std::shared_ptr<SnapshotHandler> snapuserd_;
 };
 
@@ -320,12 +498,7 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     std::unique_ptr<CowReader> CloneReaderForWorker();
     std::shared_ptr<SnapshotHandler> GetSharedPtr() { return shared_from_this(); }
 
-    std::vector<std::pair<sector_t, const CowOperation*>>& GetChunkVec() { return chunk_vec_; }
-
-    static bool compare(std::pair<sector_t, const CowOperation*> p1,
-                        std::pair<sector_t, const CowOperation*> p2) {
-        return p1.first < p2.first;
-    }
+    const BlockIndex& GetBlockIndex() { return block_index_; }
 
     void UnmapBufferRegion();
     bool MmapMetadata();
@@ -334,6 +507,14 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     void* GetMappedAddr() { return mapped_addr_; }
     void PrepareReadAhead();
     std::unordered_map<uint64_t, void*>& GetReadAheadMap() { return read_ahead_buffer_map_; }
+    // Buffer holding the data of the read-ahead window being merged;
+    // published by the RA thread before MERGE_BEGIN.
+    void SetReadAheadMergeBuffer(void* buffer) { ra_merge_buffer_ = buffer; }
+    void* GetReadAheadMergeBuffer() { return ra_merge_buffer_; }
+    bool HasScratchSpace() { return scratch_space_; }
+    // Size of the read-ahead region used when the COW has no scratch
+    // space. Must be called before InitCowDevice().
+    void SetReadAheadBufferSize(size_t size);
 
     // State transitions for merge
     void InitiateMerge();
@@ -358,6 +539,7 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     size_t GetBufferMetadataSize();
     size_t GetBufferDataOffset();
     size_t GetBufferDataSize();
+    size_t GetBufferRegionSize();
 
     // Total number of blocks to be merged in a given read-ahead buffer region
     void SetMergedBlockCountForNextCommit(int x) { total_ra_blocks_merged_ = x; }
@@ -366,6 +548,14 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     void SetIouringEnabled(bool io_uring_enabled) { is_io_uring_enabled_ = io_uring_enabled; }
     bool MergeInitiated() { return merge_initiated_; }
     double GetMergePercentage() { return merge_completion_percentage_; }
+    MergeOpsProgress GetMergeOpsProgress();
+    // Number of COW ops not merged yet
+    uint64_t GetNumMergeOpsRemaining();
+    // Invoked from the merge thread once it exits, whether the merge
+    // completed, failed or was never started.
+    void SetMergeFinishedCallback(std::function<void()> callback) {
+        merge_finished_callback_ = std::move(callback);
+    }
 
     // Merge Block State Transitions
     void SetMergeCompleted(size_t block_index);
@@ -375,16 +565,55 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     bool GetRABuffer(std::unique_lock<std::mutex>* lock, uint64_t block, void* buffer);
     MERGE_GROUP_STATE ProcessMergingBlock(uint64_t new_block, void* buffer);
 
+    // Merge rate control
+    MergeThrottle& GetMergeThrottle() { return merge_throttle_; }
+
+    // Request and merge latency histograms
+    HandlerStats& GetStats() { return stats_; }
+
+    // Cache of decompressed replace-op blocks
+    void SetBlockCacheSize(size_t size) { block_cache_.SetCapacity(size); }
+    BlockCache& GetBlockCache() { return block_cache_; }
+
+    // Back the metadata mapping and the I/O buffers with memory locked into
+    // RAM, using huge pages where possible. Must be called before
+    // InitCowDevice().
+    void SetPinMemory(bool pin) { pin_memory_ = pin; }
+    bool ShouldPinMemory() { return pin_memory_; }
+
+    // Read bandwidth budget of update verification, in bytes per second;
+    // zero means no limit.
+    void SetVerifyBandwidthLimit(uint64_t bytes_per_sec) {
+        verify_bandwidth_limit_ = bytes_per_sec;
+    }
+    // Called by the worker and read-ahead threads for each buffer they
+    // allocate.
+    void AccountBufferMemory(const MemoryBuffer& buffer);
+    HandlerMemoryUsage GetMemoryUsage();
+
     bool IsIouringSupported();
     bool CheckPartitionVerification() { return update_verify_->CheckPartitionVerification(); }
 
+    // Write the parsed COW and the block cache to |fd|, for a new instance of
+    // the daemon to pick up instead of parsing the COW again.
+    bool ExportParsedMetadata(android::base::borrowed_fd fd);
+    // Restore the state written by ExportParsedMetadata() at |offset| of |fd|
+    // instead of parsing the COW. The COW is still parsed if the state cannot
+    // be used. Must be called before InitCowDevice().
+    void SetParsedMetadata(android::base::borrowed_fd fd, uint64_t offset) {
+        parsed_metadata_fd_ = fd.get();
+        parsed_metadata_offset_ = offset;
+    }
+
   private:
     bool ReadMetadata();
+    bool ImportParsedMetadata();
     sector_t ChunkToSector(chunk_t chunk) { return chunk << CHUNK_SHIFT; }
     chunk_t SectorToChunk(sector_t sector) { return sector >> CHUNK_SHIFT; }
     bool IsBlockAligned(uint64_t read_size) { return ((read_size & (BLOCK_SZ - 1)) == 0); }
     struct BufferState* GetBufferState();
     void UpdateMergeCompletionPercentage();
+    void UpdateMergeRate(int num_merge_ops);
 
     // COW device
     std::string cow_device_;
@@ -402,15 +631,20 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
 
     std::unique_ptr<CowReader> reader_;
 
-    // chunk_vec stores the pseudo mapping of sector
-    // to COW operations.
-    std::vector<std::pair<sector_t, const CowOperation*>> chunk_vec_;
+    // block_index stores the mapping of each destination
+    // block to its COW operation.
+    BlockIndex block_index_;
 
     std::mutex lock_;
     std::condition_variable cv;
 
     void* mapped_addr_;
     size_t total_mapped_addr_length_;
+    bool metadata_locked_ = false;
+    bool pin_memory_ = false;
+    uint64_t verify_bandwidth_limit_ = 0;
+    std::atomic<uint64_t> buffer_bytes_ = 0;
+    std::atomic<uint64_t> locked_buffer_bytes_ = 0;
 
     std::vector<std::unique_ptr<Worker>> worker_threads_;
     // Read-ahead related
@@ -430,14 +664,28 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     std::unique_ptr<Worker> merge_thread_;
     double merge_completion_percentage_;
 
+    // Merge rate estimate, updated on every merge commit
+    std::mutex merge_rate_lock_;
+    std::optional<std::chrono::steady_clock::time_point> last_merge_commit_;
+    double merge_ops_per_sec_ = 0.0;
+
     bool merge_initiated_ = false;
     bool attached_ = false;
     bool is_socket_present_;
     bool is_io_uring_enabled_ = false;
     bool scratch_space_ = false;
+    size_t read_ahead_buffer_size_ = BUFFER_REGION_DEFAULT_SIZE;
+    void* ra_merge_buffer_ = nullptr;
 
     std::unique_ptr<struct io_uring> ring_;
     std::unique_ptr<UpdateVerify> update_verify_;
+
+    BlockCache block_cache_;
+    int parsed_metadata_fd_ = -1;
+    uint64_t parsed_metadata_offset_ = 0;
+    std::function<void()> merge_finished_callback_;
+    MergeThrottle merge_throttle_;
+    HandlerStats stats_;
 };
 
 }  // namespace snapshot
@@ -23,6 +23,11 @@ using namespace android;
 using namespace android::dm;
 using android::base::unique_fd;
 
+// user_data tags of the requests queued by the I/O workers. Base
+// device reads are tagged with their index in |base_reads_|.
+static constexpr uint64_t kDmUserReadTag = 1ULL << 63;
+static constexpr uint64_t kCancelTag = 1ULL << 62;
+
 Worker::Worker(const std::string& cow_device, const std::string& backing_device,
                const std::string& control_device, const std::string& misc_name,
                const std::string& base_path_merge, std::shared_ptr<SnapshotHandler> snapuserd) {
@@ -74,13 +79,35 @@ bool Worker::InitReader() {
 
 // Start the replace operation. This will read the
 // internal COW format and if the block is compressed,
-// it will be de-compressed.
+// it will be de-compressed. If the block is part of a
+// multi-block compression unit, the reader decompresses
+// the whole unit (or reuses its cached copy) and only
+// the requested block is copied into the buffer.
+//
+// Decompressed blocks are kept in the handler's block cache
+// so that repeated reads of the same block skip the COW
+// device altogether.
 bool Worker::ProcessReplaceOp(const CowOperation* cow_op) {
-    if (!reader_->ReadData(*cow_op, &bufsink_)) {
-        SNAP_LOG(ERROR) << "ProcessReplaceOp failed for block " << cow_op->new_block;
+    void* buffer = bufsink_.GetPayloadBuffer(BLOCK_SZ);
+    if (buffer == nullptr) {
+        SNAP_LOG(ERROR) << "ProcessReplaceOp: Failed to get payload buffer";
         return false;
     }
 
+    BlockCache& cache = snapuserd_->GetBlockCache();
+    if (cache.Lookup(cow_op->new_block, buffer)) {
+        return true;
+    }
+
+    {
+        ScopedStatTimer timer(&snapuserd_->GetStats(), HandlerStat::kDecompress);
+        if (!reader_->ReadData(*cow_op, &bufsink_)) {
+            SNAP_LOG(ERROR) << "ProcessReplaceOp failed for block " << cow_op->new_block;
+            return false;
+        }
+    }
+
+    cache.Insert(cow_op->new_block, buffer);
     return true;
 }
 
@@ -205,18 +232,26 @@ bool Worker::ProcessCowOp(const CowOperation* cow_op) {
         return false;
     }
 
+    HandlerStats* stats = &snapuserd_->GetStats();
+
     switch (cow_op->type) {
         case kCowReplaceOp: {
+            ScopedStatTimer timer(stats, HandlerStat::kReplaceOp);
             return ProcessReplaceOp(cow_op);
         }
 
         case kCowZeroOp: {
+            ScopedStatTimer timer(stats, HandlerStat::kZeroOp);
             return ProcessZeroOp();
         }
 
-        case kCowCopyOp:
-            [[fallthrough]];
+        case kCowCopyOp: {
+            ScopedStatTimer timer(stats, HandlerStat::kCopyOp);
+            return ProcessOrderedOp(cow_op);
+        }
+
         case kCowXorOp: {
+            ScopedStatTimer timer(stats, HandlerStat::kXorOp);
             return ProcessOrderedOp(cow_op);
         }
 
@@ -233,7 +268,8 @@ void Worker::InitializeBufsink() {
     // If the dm-user requests a big IO, the IO will be broken into chunks
     // of PAYLOAD_BUFFER_SZ.
     size_t buf_size = sizeof(struct dm_user_header) + PAYLOAD_BUFFER_SZ;
-    bufsink_.Initialize(buf_size);
+    bufsink_.Initialize(buf_size, snapuserd_->ShouldPinMemory());
+    snapuserd_->AccountBufferMemory(bufsink_.GetMemory());
 }
 
 bool Worker::Init() {
@@ -253,10 +289,16 @@ bool Worker::Init() {
 
 bool Worker::RunThread() {
     SNAP_LOG(INFO) << "Processing snapshot I/O requests....";
-    // Start serving IO
-    while (true) {
-        if (!ProcessIORequest()) {
-            break;
+
+    if (InitializeIoRequestRing()) {
+        RunIoRequestLoop();
+        FinalizeIoRequestRing();
+    } else {
+        // Start serving IO
+        while (true) {
+            if (!ProcessIORequest()) {
+                break;
+            }
         }
     }
 
@@ -307,6 +349,7 @@ bool Worker::ReadDataFromBaseDevice(sector_t sector, size_t read_size) {
         return false;
     }
 
+    ScopedStatTimer timer(&snapuserd_->GetStats(), HandlerStat::kBaseRead);
     loff_t offset = sector << SECTOR_SHIFT;
     if (!android::base::ReadFullyAtOffset(base_path_merge_fd_, buffer, read_size, offset)) {
         SNAP_PLOG(ERROR) << "ReadDataFromBaseDevice failed. fd: " << base_path_merge_fd_
@@ -320,7 +363,7 @@ bool Worker::ReadDataFromBaseDevice(sector_t sector, size_t read_size) {
 bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response) {
     struct dm_user_header* header = bufsink_.GetHeaderPtr();
     size_t remaining_size = sz;
-    std::vector<std::pair<sector_t, const CowOperation*>>& chunk_vec = snapuserd_->GetChunkVec();
+    const BlockIndex& block_index = snapuserd_->GetBlockIndex();
     bool io_error = false;
     int ret = 0;
 
@@ -338,15 +381,13 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
             // present in the mapping.
             size_t size = std::min(BLOCK_SZ, read_size);
 
-            auto it = std::lower_bound(chunk_vec.begin(), chunk_vec.end(),
-                                       std::make_pair(sector, nullptr), SnapshotHandler::compare);
-            bool not_found = (it == chunk_vec.end() || it->first != sector);
+            const CowOperation* cow_op = block_index.Find(SectorToChunk(sector));
 
-            if (not_found) {
+            if (cow_op == nullptr) {
                 // Block not found in map - which means this block was not
                 // changed as per the OTA. Just route the I/O to the base
                 // device.
-                if (!ReadDataFromBaseDevice(sector, size)) {
+                if (!ReadDataFromBaseDeviceAsync(sector, size)) {
                     SNAP_LOG(ERROR) << "ReadDataFromBaseDevice failed";
                     header->type = DM_USER_RESP_ERROR;
                 }
@@ -355,7 +396,7 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
             } else {
                 // We found the sector in mapping. Check the type of COW OP and
                 // process it.
-                if (!ProcessCowOp(it->second)) {
+                if (!ProcessCowOp(cow_op)) {
                     SNAP_LOG(ERROR) << "ProcessCowOp failed";
                     header->type = DM_USER_RESP_ERROR;
                 }
@@ -365,6 +406,9 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
 
             // Just return the header if it is an error
             if (header->type == DM_USER_RESP_ERROR) {
+                // Payload buffer must not be reused while base
+                // device reads are still in flight
+                ReapBaseDeviceReads();
                 if (!RespondIOError(header_response)) {
                     return false;
                 }
@@ -379,6 +423,14 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
             bufsink_.UpdateBufferOffset(ret);
         }
 
+        if (!io_error && !ReapBaseDeviceReads()) {
+            SNAP_LOG(ERROR) << "ReadDataFromBaseDevice failed";
+            if (!RespondIOError(header_response)) {
+                return false;
+            }
+            io_error = true;
+        }
+
         if (!io_error) {
             if (!WriteDmUserPayload(total_bytes_read, header_response)) {
                 return false;
@@ -395,21 +447,20 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
     return true;
 }
 
-int Worker::ReadUnalignedSector(
-        sector_t sector, size_t size,
-        std::vector<std::pair<sector_t, const CowOperation*>>::iterator& it) {
+int Worker::ReadUnalignedSector(sector_t sector, size_t size, const CowOperation* cow_op) {
     size_t skip_sector_size = 0;
+    sector_t aligned_sector = ChunkToSector(cow_op->new_block);
 
     SNAP_LOG(DEBUG) << "ReadUnalignedSector: sector " << sector << " size: " << size
-                    << " Aligned sector: " << it->first;
+                    << " Aligned sector: " << aligned_sector;
 
-    if (!ProcessCowOp(it->second)) {
+    if (!ProcessCowOp(cow_op)) {
         SNAP_LOG(ERROR) << "ReadUnalignedSector: " << sector << " failed of size: " << size
-                        << " Aligned sector: " << it->first;
+                        << " Aligned sector: " << aligned_sector;
         return -1;
     }
 
-    int num_sectors_skip = sector - it->first;
+    int num_sectors_skip = sector - aligned_sector;
 
     if (num_sectors_skip > 0) {
         skip_sector_size = num_sectors_skip << SECTOR_SHIFT;
@@ -418,7 +469,7 @@ int Worker::ReadUnalignedSector(
 
         if (skip_sector_size == BLOCK_SZ) {
             SNAP_LOG(ERROR) << "Invalid un-aligned IO request at sector: " << sector
-                            << " Base-sector: " << it->first;
+                            << " Base-sector: " << aligned_sector;
             return -1;
         }
 
@@ -434,10 +485,7 @@ bool Worker::ReadUnalignedSector(sector_t sector, size_t size) {
     struct dm_user_header* header = bufsink_.GetHeaderPtr();
     header->type = DM_USER_RESP_SUCCESS;
     bufsink_.ResetBufferOffset();
-    std::vector<std::pair<sector_t, const CowOperation*>>& chunk_vec = snapuserd_->GetChunkVec();
-
-    auto it = std::lower_bound(chunk_vec.begin(), chunk_vec.end(), std::make_pair(sector, nullptr),
-                               SnapshotHandler::compare);
+    const BlockIndex& block_index = snapuserd_->GetBlockIndex();
 
     // |-------|-------|-------|
     // 0       1       2       3
@@ -446,73 +494,32 @@ bool Worker::ReadUnalignedSector(sector_t sector, size_t size) {
     // Block 1 - op 2
     // Block 2 - op 3
     //
-    // chunk_vec will have block 0, 1, 2 which maps to relavant COW ops.
+    // block_index will have block 0, 1, 2 which maps to relavant COW ops.
     //
-    // Each block is 4k bytes. Thus, the last block will span 8 sectors
-    // ranging till block 3 (However, block 3 won't be in chunk_vec as
-    // it doesn't have any mapping to COW ops. Now, if we get an I/O request for a sector
-    // spanning between block 2 and block 3, we need to step back
-    // and get hold of the last element.
+    // Each block is 4k bytes and spans 8 sectors. An un-aligned I/O request
+    // is served from the COW op of the block which contains the requested
+    // sector. If that block is not mapped to any COW op (block 3 and beyond
+    // in the above example), the data is read from the base device.
     //
-    // Additionally, we need to make sure that the requested sector is
-    // indeed within the range of the final sector. It is perfectly valid
-    // to get an I/O request for block 3 and beyond which are not mapped
-    // to any COW ops. In that case, we just need to read from the base
-    // device.
-    bool merge_complete = false;
+    // This also covers the window wherein a partition merge is complete but
+    // snapshot state in /metadata is not yet deleted; if the device is
+    // rebooted, subsequent attempt will mount the snapshot. However, since
+    // the merge was completed we wouldn't have any mapping to COW ops thus
+    // block_index will be empty and the I/O is routed to the base device.
     bool header_response = true;
-    if (it == chunk_vec.end()) {
-        if (chunk_vec.size() > 0) {
-            // I/O request beyond the last mapped sector
-            it = std::prev(chunk_vec.end());
-        } else {
-            // This can happen when a partition merge is complete but snapshot
-            // state in /metadata is not yet deleted; during this window if the
-            // device is rebooted, subsequent attempt will mount the snapshot.
-            // However, since the merge was completed we wouldn't have any
-            // mapping to COW ops thus chunk_vec will be empty. In that case,
-            // mark this as merge_complete and route the I/O to the base device.
-            merge_complete = true;
-        }
-    } else if (it->first != sector) {
-        if (it != chunk_vec.begin()) {
-            --it;
-        }
-    } else {
-        return ReadAlignedSector(sector, size, header_response);
-    }
+    const CowOperation* cow_op = block_index.Find(SectorToChunk(sector));
 
     loff_t requested_offset = sector << SECTOR_SHIFT;
 
-    loff_t final_offset = 0;
-    if (!merge_complete) {
-        final_offset = it->first << SECTOR_SHIFT;
-    }
-
-    // Since a COW op span 4k block size, we need to make sure that the requested
-    // offset is within the 4k region. Consider the following case:
-    //
-    // |-------|-------|-------|
-    // 0       1       2       3
-    //
-    // Block 0 - op 1
-    // Block 1 - op 2
-    //
-    // We have an I/O request for a sector between block 2 and block 3. However,
-    // we have mapping to COW ops only for block 0 and block 1. Thus, the
-    // requested offset in this case is beyond the last mapped COW op size (which
-    // is block 1 in this case).
-
     size_t total_bytes_read = 0;
     size_t remaining_size = size;
     int ret = 0;
-    if (!merge_complete && (requested_offset >= final_offset) &&
-        (requested_offset - final_offset) < BLOCK_SZ) {
+    if (cow_op != nullptr) {
         // Read the partial un-aligned data
-        ret = ReadUnalignedSector(sector, remaining_size, it);
+        ret = ReadUnalignedSector(sector, remaining_size, cow_op);
         if (ret < 0) {
             SNAP_LOG(ERROR) << "ReadUnalignedSector failed for sector: " << sector
-                            << " size: " << size << " it->sector: " << it->first;
+                            << " size: " << size << " block: " << cow_op->new_block;
             return RespondIOError(header_response);
         }
 
@@ -609,12 +616,16 @@ bool Worker::DmuserReadRequest() {
 }
 
 bool Worker::ProcessIORequest() {
-    struct dm_user_header* header = bufsink_.GetHeaderPtr();
-
     if (!ReadDmUserHeader()) {
         return false;
     }
 
+    return ProcessDmUserRequest();
+}
+
+bool Worker::ProcessDmUserRequest() {
+    struct dm_user_header* header = bufsink_.GetHeaderPtr();
+
     SNAP_LOG(DEBUG) << "Daemon: msg->seq: " << std::dec << header->seq;
     SNAP_LOG(DEBUG) << "Daemon: msg->len: " << std::dec << header->len;
     SNAP_LOG(DEBUG) << "Daemon: msg->sector: " << std::dec << header->sector;
@@ -623,9 +634,15 @@ bool Worker::ProcessIORequest() {
 
     switch (header->type) {
         case DM_USER_REQ_MAP_READ: {
+            auto begin = std::chrono::steady_clock::now();
             if (!DmuserReadRequest()) {
                 return false;
             }
+            auto latency = std::chrono::steady_clock::now() - begin;
+            snapuserd_->GetStats().Record(HandlerStat::kRequest, latency);
+            // Feed the merge rate controller
+            snapuserd_->GetMergeThrottle().RecordIoLatency(
+                    std::chrono::duration_cast<std::chrono::microseconds>(latency));
             break;
         }
 
@@ -641,5 +658,273 @@ bool Worker::ProcessIORequest() {
     return true;
 }
 
+// When io_uring is available, each I/O worker keeps
+// kNumDmUserRequestSlots reads outstanding on the dm-user
+// control device, so that the next requests are already
+// fetched while one is being processed. Reads routed to the
+// base device are queued, coalesced when contiguous, and
+// submitted in a single batch before the payload is sent
+// back to dm-user.
+bool Worker::InitializeIoRequestRing() {
+    if (!snapuserd_->IsIouringSupported()) {
+        return false;
+    }
+
+    ring_ = std::make_unique<struct io_uring>();
+
+    int ret = io_uring_queue_init(io_queue_depth_, ring_.get(), 0);
+    if (ret) {
+        SNAP_LOG(ERROR) << "I/O: io_uring_queue_init failed with ret: " << ret;
+        ring_ = nullptr;
+        return false;
+    }
+
+    io_async_ = true;
+
+    SNAP_LOG(INFO) << "I/O: io_uring initialized with queue depth: " << io_queue_depth_;
+    return true;
+}
+
+void Worker::FinalizeIoRequestRing() {
+    // Cancel the dm-user reads which are still outstanding. Kernel
+    // may still write into the request slots, hence wait for all
+    // the in-flight requests to complete before tearing down the ring.
+    for (size_t i = 0; i < kNumDmUserRequestSlots; i++) {
+        if (!slot_pending_[i]) {
+            continue;
+        }
+
+        struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+        if (!sqe) {
+            break;
+        }
+        io_uring_prep_cancel(sqe, reinterpret_cast<void*>(kDmUserReadTag | i), 0);
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(kCancelTag));
+        ios_in_flight_ += 1;
+    }
+    io_uring_submit(ring_.get());
+
+    while (ios_in_flight_) {
+        if (!WaitForIoCompletion()) {
+            break;
+        }
+    }
+
+    io_uring_queue_exit(ring_.get());
+    io_async_ = false;
+}
+
+bool Worker::RunIoRequestLoop() {
+    for (size_t i = 0; i < kNumDmUserRequestSlots; i++) {
+        if (!QueueDmUserHeaderRead(i)) {
+            return false;
+        }
+    }
+
+    while (true) {
+        int ret = io_uring_submit(ring_.get());
+        if (ret < 0) {
+            SNAP_LOG(ERROR) << "I/O: io_uring_submit failed for dm-user read: " << ret;
+            return false;
+        }
+
+        while (ready_slots_.empty() && !io_stopped_) {
+            if (!WaitForIoCompletion()) {
+                return false;
+            }
+        }
+
+        if (io_stopped_) {
+            return true;
+        }
+
+        size_t slot = ready_slots_.front();
+        ready_slots_.pop_front();
+
+        memcpy(bufsink_.GetHeaderPtr(), &slot_headers_[slot], sizeof(struct dm_user_header));
+        if (!ProcessDmUserRequest() || io_stopped_) {
+            return false;
+        }
+
+        if (!QueueDmUserHeaderRead(slot)) {
+            return false;
+        }
+    }
+}
+
+bool Worker::QueueDmUserHeaderRead(size_t slot) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+    if (!sqe) {
+        SNAP_LOG(ERROR) << "I/O: io_uring_get_sqe failed for dm-user read";
+        return false;
+    }
+
+    io_uring_prep_read(sqe, ctrl_fd_.get(), &slot_headers_[slot], sizeof(struct dm_user_header),
+                       0);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(kDmUserReadTag | slot));
+    // Reads on the control device block until dm-user has a request;
+    // punt them to the async workers right away.
+    sqe->flags |= IOSQE_ASYNC;
+
+    slot_pending_[slot] = true;
+    ios_in_flight_ += 1;
+    return true;
+}
+
+bool Worker::WaitForIoCompletion() {
+    struct io_uring_cqe* cqe;
+
+    int ret = io_uring_wait_cqe(ring_.get(), &cqe);
+    if (ret == -EINTR || ret == -EAGAIN) {
+        return true;
+    }
+    if (ret) {
+        SNAP_LOG(ERROR) << "I/O: io_uring_wait_cqe failed: " << ret;
+        io_stopped_ = true;
+        return false;
+    }
+
+    HandleIoCompletion(cqe);
+    io_uring_cqe_seen(ring_.get(), cqe);
+    return true;
+}
+
+void Worker::HandleIoCompletion(struct io_uring_cqe* cqe) {
+    uint64_t tag = cqe->user_data;
+    ios_in_flight_ -= 1;
+
+    if (tag == kCancelTag) {
+        return;
+    }
+
+    if (tag & kDmUserReadTag) {
+        size_t slot = tag & ~kDmUserReadTag;
+        slot_pending_[slot] = false;
+
+        if (cqe->res == sizeof(struct dm_user_header)) {
+            ready_slots_.push_back(slot);
+            return;
+        }
+
+        if (cqe->res != -ENOTBLK && cqe->res != -ECANCELED && cqe->res != -EINTR) {
+            SNAP_LOG(ERROR) << "Control-read failed with res: " << cqe->res;
+        }
+        SNAP_LOG(DEBUG) << "ReadDmUserHeader failed....";
+        io_stopped_ = true;
+        return;
+    }
+
+    if (base_reads_in_flight_) {
+        base_reads_in_flight_ -= 1;
+    }
+
+    // Reads left behind by a failed batch complete only when the
+    // ring is finalized; their requests are already gone.
+    if (tag >= base_reads_.size()) {
+        return;
+    }
+
+    // Short or failed base device reads are retried synchronously
+    const BaseDeviceRead& read = base_reads_[tag];
+    if (cqe->res != static_cast<int>(read.size) &&
+        !android::base::ReadFullyAtOffset(base_path_merge_fd_, read.buffer, read.size,
+                                          read.offset)) {
+        SNAP_PLOG(ERROR) << "ReadDataFromBaseDevice failed. fd: " << base_path_merge_fd_
+                         << " at offset: " << read.offset << " size: " << read.size;
+        base_reads_failed_ = true;
+    }
+}
+
+bool Worker::ReadDataFromBaseDeviceAsync(sector_t sector, size_t read_size) {
+    if (!io_async_) {
+        return ReadDataFromBaseDevice(sector, read_size);
+    }
+
+    CHECK(read_size <= BLOCK_SZ);
+
+    void* buffer = bufsink_.GetPayloadBuffer(BLOCK_SZ);
+    if (buffer == nullptr) {
+        SNAP_LOG(ERROR) << "ReadFromBaseDevice: Failed to get payload buffer";
+        return false;
+    }
+
+    loff_t offset = sector << SECTOR_SHIFT;
+
+    // Merge with the previous read if both the device range and
+    // the payload buffer are contiguous
+    if (!base_reads_.empty()) {
+        BaseDeviceRead& last = base_reads_.back();
+        if (last.offset + static_cast<loff_t>(last.size) == offset &&
+            static_cast<char*>(last.buffer) + last.size == buffer) {
+            last.size += read_size;
+            return true;
+        }
+    }
+
+    base_reads_.push_back({buffer, read_size, offset});
+    return true;
+}
+
+bool Worker::ReapBaseDeviceReads() {
+    if (base_reads_.empty()) {
+        return true;
+    }
+
+    ScopedStatTimer timer(&snapuserd_->GetStats(), HandlerStat::kBaseRead);
+
+    // Leave room in the ring for the dm-user reads
+    const size_t max_in_flight = io_queue_depth_ - kNumDmUserRequestSlots;
+    size_t next = 0;
+    bool submit_failed = false;
+    base_reads_failed_ = false;
+
+    while ((next < base_reads_.size() && !submit_failed) || base_reads_in_flight_) {
+        int queued = 0;
+        while (!submit_failed && next < base_reads_.size() &&
+               base_reads_in_flight_ + queued < max_in_flight) {
+            struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+            if (!sqe) {
+                break;
+            }
+
+            const BaseDeviceRead& read = base_reads_[next];
+            io_uring_prep_read(sqe, base_path_merge_fd_.get(), read.buffer, read.size,
+                               read.offset);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(next));
+            next += 1;
+            queued += 1;
+        }
+
+        if (!queued && !base_reads_in_flight_) {
+            SNAP_LOG(ERROR) << "I/O: io_uring_get_sqe failed for base device reads";
+            submit_failed = true;
+            break;
+        }
+
+        if (queued) {
+            int ret = io_uring_submit(ring_.get());
+            int submitted = std::max(ret, 0);
+            base_reads_in_flight_ += submitted;
+            // Requests which were not submitted stay in the ring and are
+            // drained when the ring is finalized
+            ios_in_flight_ += queued;
+            if (submitted != queued) {
+                SNAP_LOG(ERROR) << "I/O: io_uring_submit failed for base device reads: " << ret
+                                << " expected: " << queued;
+                submit_failed = true;
+                io_stopped_ = true;
+            }
+        }
+
+        if (base_reads_in_flight_ && !WaitForIoCompletion()) {
+            submit_failed = true;
+            break;
+        }
+    }
+
+    base_reads_.clear();
+    return !submit_failed && !base_reads_failed_;
+}
+
 }  // namespace snapshot
 }  // namespace android
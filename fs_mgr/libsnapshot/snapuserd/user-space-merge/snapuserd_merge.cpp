@@ -85,8 +85,14 @@ bool Worker::MergeReplaceZeroOps() {
 
     SNAP_LOG(INFO) << "MergeReplaceZeroOps started....";
 
+    MergeThrottle& throttle = snapuserd_->GetMergeThrottle();
+
     while (!cowop_iter_->Done()) {
-        int num_ops = PAYLOAD_BUFFER_SZ / BLOCK_SZ;
+        auto batch_begin = std::chrono::steady_clock::now();
+
+        // Merge fewer ops per batch while foreground I/O is contending
+        throttle.Update();
+        int num_ops = throttle.Scale(PAYLOAD_BUFFER_SZ / BLOCK_SZ);
         std::vector<const CowOperation*> replace_zero_vec;
         uint64_t source_offset;
 
@@ -152,6 +158,11 @@ bool Worker::MergeReplaceZeroOps() {
                     << "MergeReplaceZeroOps: Worker threads terminated - shutting down merge";
             return false;
         }
+
+        snapuserd_->GetStats().Record(HandlerStat::kMergeBatch,
+                                      std::chrono::steady_clock::now() - batch_begin);
+
+        throttle.Backoff();
     }
 
     // Any left over ops not flushed yet.
@@ -174,12 +185,10 @@ bool Worker::MergeReplaceZeroOps() {
 }
 
 bool Worker::MergeOrderedOpsAsync() {
-    void* mapped_addr = snapuserd_->GetMappedAddr();
-    void* read_ahead_buffer =
-            static_cast<void*>((char*)mapped_addr + snapuserd_->GetBufferDataOffset());
-
     SNAP_LOG(INFO) << "MergeOrderedOpsAsync started....";
 
+    MergeThrottle& throttle = snapuserd_->GetMergeThrottle();
+
     while (!cowop_iter_->Done()) {
         const CowOperation* cow_op = &cowop_iter_->Get();
         if (!IsOrderedOp(*cow_op)) {
@@ -189,16 +198,24 @@ bool Worker::MergeOrderedOpsAsync() {
         SNAP_LOG(DEBUG) << "Waiting for merge begin...";
         // Wait for RA thread to notify that the merge window
         // is ready for merging.
+        auto wait_begin = std::chrono::steady_clock::now();
         if (!snapuserd_->WaitForMergeBegin()) {
             return false;
         }
+        auto batch_begin = std::chrono::steady_clock::now();
+        snapuserd_->GetStats().Record(HandlerStat::kReadAheadStall, batch_begin - wait_begin);
 
         snapuserd_->SetMergeInProgress(ra_block_index_);
+        void* read_ahead_buffer = snapuserd_->GetReadAheadMergeBuffer();
 
         loff_t offset = 0;
         int num_ops = snapuserd_->GetTotalBlocksToMerge();
 
-        int pending_sqe = queue_depth_;
+        // Submit fewer writes at a time while foreground I/O is contending
+        throttle.Update();
+        const int merge_queue_depth = throttle.Scale(queue_depth_);
+
+        int pending_sqe = merge_queue_depth;
         int pending_ios_to_submit = 0;
         bool flush_required = false;
         blocks_merged_in_group_ = 0;
@@ -314,7 +331,7 @@ bool Worker::MergeOrderedOpsAsync() {
                     return false;
                 }
 
-                pending_sqe = queue_depth_;
+                pending_sqe = merge_queue_depth;
             }
 
             if (linear_blocks == 0) {
@@ -340,6 +357,9 @@ bool Worker::MergeOrderedOpsAsync() {
 
         SNAP_LOG(DEBUG) << "Block commit of size: " << snapuserd_->GetTotalBlocksToMerge();
 
+        snapuserd_->GetStats().Record(HandlerStat::kMergeBatch,
+                                      std::chrono::steady_clock::now() - batch_begin);
+
         // Mark the block as merge complete
         snapuserd_->SetMergeCompleted(ra_block_index_);
 
@@ -349,18 +369,18 @@ bool Worker::MergeOrderedOpsAsync() {
 
         // Get the next block
         ra_block_index_ += 1;
+
+        throttle.Backoff();
     }
 
     return true;
 }
 
 bool Worker::MergeOrderedOps() {
-    void* mapped_addr = snapuserd_->GetMappedAddr();
-    void* read_ahead_buffer =
-            static_cast<void*>((char*)mapped_addr + snapuserd_->GetBufferDataOffset());
-
     SNAP_LOG(INFO) << "MergeOrderedOps started....";
 
+    MergeThrottle& throttle = snapuserd_->GetMergeThrottle();
+
     while (!cowop_iter_->Done()) {
         const CowOperation* cow_op = &cowop_iter_->Get();
         if (!IsOrderedOp(*cow_op)) {
@@ -370,12 +390,17 @@ bool Worker::MergeOrderedOps() {
         SNAP_LOG(DEBUG) << "Waiting for merge begin...";
         // Wait for RA thread to notify that the merge window
         // is ready for merging.
+        auto wait_begin = std::chrono::steady_clock::now();
         if (!snapuserd_->WaitForMergeBegin()) {
             snapuserd_->SetMergeFailed(ra_block_index_);
             return false;
         }
+        auto batch_begin = std::chrono::steady_clock::now();
+        snapuserd_->GetStats().Record(HandlerStat::kReadAheadStall, batch_begin - wait_begin);
 
         snapuserd_->SetMergeInProgress(ra_block_index_);
+        void* read_ahead_buffer = snapuserd_->GetReadAheadMergeBuffer();
+        throttle.Update();
 
         loff_t offset = 0;
         int num_ops = snapuserd_->GetTotalBlocksToMerge();
@@ -425,6 +450,9 @@ bool Worker::MergeOrderedOps() {
         }
 
         SNAP_LOG(DEBUG) << "Block commit of size: " << snapuserd_->GetTotalBlocksToMerge();
+        snapuserd_->GetStats().Record(HandlerStat::kMergeBatch,
+                                      std::chrono::steady_clock::now() - batch_begin);
+
         // Mark the block as merge complete
         snapuserd_->SetMergeCompleted(ra_block_index_);
 
@@ -434,6 +462,8 @@ bool Worker::MergeOrderedOps() {
 
         // Get the next block
         ra_block_index_ += 1;
+
+        throttle.Backoff();
     }
 
     return true;
@@ -551,6 +581,10 @@ bool Worker::RunMergeThread() {
         return false;
     }
 
+    // Replace ops are merged in COW order, so serve their data a cluster at a
+    // time.
+    reader_->SetClusterPrefetch(true);
+
     InitializeIouring();
 
     if (!Merge()) {
@@ -170,6 +170,7 @@ bool ReadAhead::ReconstructDataFromCow() {
     }
 
     snapuserd_->SetMergedBlockCountForNextCommit(total_blocks_merged);
+    snapuserd_->SetReadAheadMergeBuffer(read_ahead_buffer_);
 
     snapuserd_->FinishReconstructDataFromCow();
 
@@ -283,7 +284,7 @@ bool ReadAhead::ReadAheadAsyncIO() {
             }
 
             io_uring_prep_read(sqe, backing_store_fd_.get(),
-                               (char*)ra_temp_buffer_.get() + buffer_offset, io_size,
+                               (char*)ra_temp_buffer_ + buffer_offset, io_size,
                                source_offset);
 
             buffer_offset += io_size;
@@ -330,7 +331,7 @@ bool ReadAhead::ReadAheadAsyncIO() {
 
             // Retrieve XOR'ed data
             if (xor_processing_required) {
-                ProcessXorData(block_index, xor_op_index, xor_op_vec, ra_temp_buffer_.get(),
+                ProcessXorData(block_index, xor_op_index, xor_op_vec, ra_temp_buffer_,
                                offset);
             }
 
@@ -440,9 +441,7 @@ void ReadAhead::ProcessXorData(size_t& block_xor_index, size_t& xor_index,
                 uint8_t* xor_data = reinterpret_cast<uint8_t*>((char*)bufsink_.GetPayloadBufPtr() +
                                                                xor_buf_offset);
 
-                for (size_t byte_offset = 0; byte_offset < BLOCK_SZ; byte_offset++) {
-                    buffer[byte_offset] ^= xor_data[byte_offset];
-                }
+                XorBlocks(buffer, xor_data, BLOCK_SZ);
 
                 // Move to next XOR op
                 xor_index += 1;
@@ -511,7 +510,7 @@ bool ReadAhead::ReadAheadSyncIO() {
 
         // Read from the base device consecutive set of blocks in one shot
         if (!android::base::ReadFullyAtOffset(backing_store_fd_,
-                                              (char*)ra_temp_buffer_.get() + buffer_offset, io_size,
+                                              (char*)ra_temp_buffer_ + buffer_offset, io_size,
                                               source_offset)) {
             SNAP_PLOG(ERROR) << "Ordered-op failed. Read from backing store: "
                              << backing_store_device_ << "at block :" << source_offset / BLOCK_SZ
@@ -547,11 +546,9 @@ bool ReadAhead::ReadAheadSyncIO() {
     CHECK(blocks_.size() == total_blocks_merged_);
 
     size_t xor_index = 0;
-    BufferSink bufsink;
-    bufsink.Initialize(BLOCK_SZ * 2);
 
     for (size_t block_index = 0; block_index < blocks_.size(); block_index++) {
-        void* bufptr = static_cast<void*>((char*)ra_temp_buffer_.get() + offset);
+        void* bufptr = static_cast<void*>((char*)ra_temp_buffer_ + offset);
         uint64_t new_block = blocks_[block_index];
 
         if (xor_index < xor_op_vec.size()) {
@@ -559,22 +556,16 @@ bool ReadAhead::ReadAheadSyncIO() {
 
             // Check if this block is an XOR op
             if (xor_op->new_block == new_block) {
-                // Read the xor'ed data from COW
-                if (!reader_->ReadData(*xor_op, &bufsink)) {
+                // Retrieve the original data: the xor'ed data read from COW
+                // is applied to the data read from base device as it is
+                // decompressed.
+                xorsink_.Reset(bufptr, BLOCK_SZ);
+                if (!reader_->ReadData(*xor_op, &xorsink_)) {
                     SNAP_LOG(ERROR)
                             << " ReadAhead - XorOp Read failed for block: " << xor_op->new_block;
                     snapuserd_->ReadAheadIOFailed();
                     return false;
                 }
-                // Pointer to the data read from base device
-                uint8_t* buffer = reinterpret_cast<uint8_t*>(bufptr);
-                // Get the xor'ed data read from COW device
-                uint8_t* xor_data = reinterpret_cast<uint8_t*>(bufsink.GetPayloadBufPtr());
-
-                // Retrieve the original data
-                for (size_t byte_offset = 0; byte_offset < BLOCK_SZ; byte_offset++) {
-                    buffer[byte_offset] ^= xor_data[byte_offset];
-                }
 
                 // Move to next XOR op
                 xor_index += 1;
@@ -655,16 +646,24 @@ bool ReadAhead::ReadAheadIOStart() {
         return false;
     }
 
-    // Copy the data to scratch space
-    memcpy(metadata_buffer_, ra_temp_meta_buffer_.get(), snapuserd_->GetBufferMetadataSize());
-    memcpy(read_ahead_buffer_, ra_temp_buffer_.get(), total_blocks_merged_ * BLOCK_SZ);
+    // The scratch space is only needed to recover from a crash when the
+    // window has overlapping blocks, as the source blocks are overwritten
+    // while merging. Otherwise, merge directly from the read-ahead buffer
+    // and skip the copy.
+    void* merge_buffer = ra_temp_buffer_;
+    if (overlap_ && snapuserd_->HasScratchSpace()) {
+        // Copy the data to scratch space
+        memcpy(metadata_buffer_, ra_temp_meta_buffer_.get(), snapuserd_->GetBufferMetadataSize());
+        memcpy(read_ahead_buffer_, ra_temp_buffer_, total_blocks_merged_ * BLOCK_SZ);
+        merge_buffer = read_ahead_buffer_;
+    }
 
     loff_t offset = 0;
     std::unordered_map<uint64_t, void*>& read_ahead_buffer_map = snapuserd_->GetReadAheadMap();
     read_ahead_buffer_map.clear();
 
     for (size_t block_index = 0; block_index < blocks_.size(); block_index++) {
-        void* bufptr = static_cast<void*>((char*)read_ahead_buffer_ + offset);
+        void* bufptr = static_cast<void*>((char*)merge_buffer + offset);
         uint64_t new_block = blocks_[block_index];
 
         read_ahead_buffer_map[new_block] = bufptr;
@@ -673,6 +672,7 @@ bool ReadAhead::ReadAheadIOStart() {
 
     total_ra_blocks_completed_ += total_blocks_merged_;
     snapuserd_->SetMergedBlockCountForNextCommit(total_blocks_merged_);
+    snapuserd_->SetReadAheadMergeBuffer(merge_buffer);
 
     // Flush the data only if we have a overlapping blocks in the region
     // Notify the Merge thread to resume merging this window
@@ -682,6 +682,12 @@ bool ReadAhead::ReadAheadIOStart() {
         return false;
     }
 
+    // Read the next window into the other buffer while this one is being
+    // merged. This buffer is not reused until the merge thread is done
+    // with it, as the next hand-off waits for WaitForMergeReady().
+    ra_buffer_index_ = (ra_buffer_index_ + 1) % kNumReadAheadBuffers;
+    ra_temp_buffer_ = ra_buffers_[ra_buffer_index_].get();
+
     return true;
 }
 
@@ -699,7 +705,9 @@ bool ReadAhead::InitializeIouring() {
     }
 
     // For xor ops processing
-    bufsink_.Initialize(PAYLOAD_BUFFER_SZ * 2);
+    bufsink_.Initialize(std::max(PAYLOAD_BUFFER_SZ * 2, snapuserd_->GetBufferDataSize()),
+                        snapuserd_->ShouldPinMemory());
+    snapuserd_->AccountBufferMemory(bufsink_.GetMemory());
     read_ahead_async_ = true;
 
     SNAP_LOG(INFO) << "Read-ahead: io_uring initialized with queue depth: " << queue_depth_;
@@ -764,6 +772,8 @@ bool ReadAhead::InitReader() {
     if (!reader_->InitForMerge(std::move(cow_fd_))) {
         return false;
     }
+    // Xor data is read in merge order, which largely follows the COW layout.
+    reader_->SetClusterPrefetch(true);
     return true;
 }
 
@@ -808,8 +818,16 @@ void ReadAhead::InitializeBuffer() {
             static_cast<void*>((char*)mapped_addr + snapuserd_->GetBufferMetadataOffset());
     read_ahead_buffer_ = static_cast<void*>((char*)mapped_addr + snapuserd_->GetBufferDataOffset());
 
-    ra_temp_buffer_ = std::make_unique<uint8_t[]>(snapuserd_->GetBufferDataSize());
+    for (int i = 0; i < kNumReadAheadBuffers; i++) {
+        ra_buffers_[i].Allocate(snapuserd_->GetBufferDataSize(), snapuserd_->ShouldPinMemory());
+        snapuserd_->AccountBufferMemory(ra_buffers_[i]);
+    }
+    ra_buffer_index_ = 0;
+    ra_temp_buffer_ = ra_buffers_[ra_buffer_index_].get();
     ra_temp_meta_buffer_ = std::make_unique<uint8_t[]>(snapuserd_->GetBufferMetadataSize());
+
+    // For xor ops processing with synchronous I/O
+    xorsink_.Initialize(&bufsink_, BLOCK_SZ);
 }
 
 }  // namespace snapshot
@@ -17,16 +17,22 @@
 #include <arpa/inet.h>
 #include <cutils/sockets.h>
 #include <errno.h>
+#include <linux/memfd.h>
 #include <netinet/in.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <android-base/cmsg.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/scopeguard.h>
 #include <fs_mgr/file_wait.h>
@@ -56,6 +62,13 @@ DaemonOps UserSnapshotServer::Resolveop(std::string& input) {
     if (input == "merge_percent") return DaemonOps::PERCENTAGE;
     if (input == "getstatus") return DaemonOps::GETSTATUS;
     if (input == "update-verify") return DaemonOps::UPDATE_VERIFY;
+    if (input == "cache_stats") return DaemonOps::CACHE_STATS;
+    if (input == "merge_throttle") return DaemonOps::MERGE_THROTTLE;
+    if (input == "merge_progress") return DaemonOps::MERGE_PROGRESS;
+    if (input == "handler_stats") return DaemonOps::HANDLER_STATS;
+    if (input == "memory_usage") return DaemonOps::MEMORY_USAGE;
+    if (input == "merge_ops_progress") return DaemonOps::MERGE_OPS_PROGRESS;
+    if (input == "export_metadata") return DaemonOps::EXPORT_METADATA;
 
     return DaemonOps::INVALID;
 }
@@ -250,7 +263,7 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
                     return Sendmsg(fd, "fail");
                 }
 
-                if (!StartMerge(*iter)) {
+                if (!StartMerge(&lock, *iter)) {
                     return Sendmsg(fd, "fail");
                 }
 
@@ -280,6 +293,11 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
                 }
 
                 std::string merge_status = GetMergeStatus(*iter);
+                // The merge was requested but is waiting for a slot
+                if ((*iter)->merge_state() == UserSnapshotDmUserHandler::MergeState::kQueued &&
+                    merge_status == "snapshot") {
+                    merge_status = "snapshot-merge";
+                }
                 return Sendmsg(fd, merge_status);
             }
         }
@@ -291,6 +309,133 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
 
             return Sendmsg(fd, "success");
         }
+        case DaemonOps::CACHE_STATS: {
+            // Message format: cache_stats
+            //
+            // Response: <hits>,<misses> summed over all the handlers
+            std::lock_guard<std::mutex> lock(lock_);
+            return Sendmsg(fd, GetBlockCacheStats(&lock));
+        }
+        case DaemonOps::MERGE_THROTTLE: {
+            // Message format:
+            // merge_throttle,<enabled>,<latency_threshold_us>,<io_pressure_threshold>,
+            //                <min_rate_percent>
+            //
+            // Applies to the merges in progress and to the ones started later.
+            if (out.size() != 5) {
+                LOG(ERROR) << "Malformed merge_throttle message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+            MergeThrottlePolicy policy;
+            uint32_t enabled;
+            if (!android::base::ParseUint(out[1], &enabled, 1u) ||
+                !android::base::ParseUint(out[2], &policy.latency_threshold_us) ||
+                !android::base::ParseUint(out[3], &policy.io_pressure_threshold, 100u) ||
+                !android::base::ParseUint(out[4], &policy.min_rate_percent, 100u) ||
+                policy.min_rate_percent == 0) {
+                LOG(ERROR) << "Invalid merge_throttle message: " << str;
+                return Sendmsg(fd, "fail");
+            }
+            policy.enabled = enabled;
+
+            std::lock_guard<std::mutex> lock(lock_);
+            SetMergeThrottlePolicy(&lock, policy);
+            return Sendmsg(fd, "success");
+        }
+        case DaemonOps::MERGE_PROGRESS: {
+            // Message format: merge_progress
+            //
+            // Response: <merge_percent>,<running>,<queued>,<completed>
+            std::lock_guard<std::mutex> lock(lock_);
+            return Sendmsg(fd, GetMergeProgress(&lock));
+        }
+        case DaemonOps::HANDLER_STATS: {
+            // Message format: handler_stats,<misc_name>,<index>
+            //
+            // Response: <stat>,<count>,<avg_us>,<p50_us>,<p90_us>,<p99_us>,<max_us>
+            //
+            // One stat is returned per query to stay within the packet size;
+            // "fail" is returned once |index| runs past the last stat.
+            if (out.size() != 3) {
+                LOG(ERROR) << "Malformed handler_stats message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+            size_t index;
+            if (!android::base::ParseUint(out[2], &index) ||
+                index >= static_cast<size_t>(HandlerStat::kNumStats)) {
+                return Sendmsg(fd, "fail");
+            }
+            std::lock_guard<std::mutex> lock(lock_);
+            auto iter = FindHandler(&lock, out[1]);
+            if (iter == dm_users_.end() || !(*iter)->snapuserd()) {
+                LOG(ERROR) << "Could not find handler: " << out[1];
+                return Sendmsg(fd, "fail");
+            }
+            auto& stats = (*iter)->snapuserd()->GetStats();
+            return Sendmsg(fd, stats.Format(static_cast<HandlerStat>(index)));
+        }
+        case DaemonOps::MEMORY_USAGE: {
+            // Message format: memory_usage,<misc_name>
+            //
+            // Response: <metadata>,<index>,<buffers>,<cache>,<locked>, in bytes
+            if (out.size() != 2) {
+                LOG(ERROR) << "Malformed memory_usage message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+            std::lock_guard<std::mutex> lock(lock_);
+            auto iter = FindHandler(&lock, out[1]);
+            if (iter == dm_users_.end() || !(*iter)->snapuserd()) {
+                LOG(ERROR) << "Could not find handler: " << out[1];
+                return Sendmsg(fd, "fail");
+            }
+            auto usage = (*iter)->snapuserd()->GetMemoryUsage();
+            return Sendmsg(fd, std::to_string(usage.metadata_bytes) + "," +
+                                       std::to_string(usage.index_bytes) + "," +
+                                       std::to_string(usage.buffer_bytes) + "," +
+                                       std::to_string(usage.cache_bytes) + "," +
+                                       std::to_string(usage.locked_bytes));
+        }
+        case DaemonOps::MERGE_OPS_PROGRESS: {
+            // Message format: merge_ops_progress,<misc_name>
+            //
+            // Response: <merged_ops>,<total_ops>,<ops_per_sec>
+            if (out.size() != 2) {
+                LOG(ERROR) << "Malformed merge_ops_progress message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+            std::lock_guard<std::mutex> lock(lock_);
+            auto iter = FindHandler(&lock, out[1]);
+            if (iter == dm_users_.end() || !(*iter)->snapuserd()) {
+                LOG(ERROR) << "Could not find handler: " << out[1];
+                return Sendmsg(fd, "fail");
+            }
+            auto progress = (*iter)->snapuserd()->GetMergeOpsProgress();
+            return Sendmsg(fd, std::to_string(progress.merged_ops) + "," +
+                                       std::to_string(progress.total_ops) + "," +
+                                       std::to_string(progress.ops_per_sec));
+        }
+        case DaemonOps::EXPORT_METADATA: {
+            // Message format: export_metadata
+            //
+            // Response: "success" along with a memfd holding the parsed
+            // metadata of the handlers, for a daemon started with
+            // -metadata_fd; "fail" otherwise.
+            unique_fd metadata;
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                metadata = ExportMetadata(&lock);
+            }
+            if (metadata < 0) {
+                return Sendmsg(fd, "fail");
+            }
+            static constexpr char kSuccess[] = "success";
+            if (android::base::SendFileDescriptors(fd, kSuccess, strlen(kSuccess),
+                                                   metadata.get()) < 0) {
+                PLOG(ERROR) << "Failed to send metadata";
+                return false;
+            }
+            return true;
+        }
         default: {
             LOG(ERROR) << "Received unknown message type from client";
             Sendmsg(fd, "fail");
@@ -317,6 +462,8 @@ void UserSnapshotServer::RunThread(std::shared_ptr<UserSnapshotDmUserHandler> ha
         std::lock_guard<std::mutex> lock(lock_);
         num_partitions_merge_complete_ += 1;
         handler->SetThreadTerminated();
+        merge_queue_.erase(std::remove(merge_queue_.begin(), merge_queue_.end(), handler),
+                           merge_queue_.end());
         auto iter = FindHandler(&lock, handler->misc_name());
         if (iter == dm_users_.end()) {
             // RemoveAndJoinHandler() already removed us from the list, and is
@@ -474,6 +621,14 @@ std::shared_ptr<UserSnapshotDmUserHandler> UserSnapshotServer::AddHandler(
         const std::string& backing_device, const std::string& base_path_merge) {
     auto snapuserd = std::make_shared<SnapshotHandler>(misc_name, cow_device_path, backing_device,
                                                        base_path_merge);
+    snapuserd->SetReadAheadBufferSize(read_ahead_buffer_size_);
+    snapuserd->SetPinMemory(pin_memory_);
+    // Sized first, so that the blocks handed off can be restored.
+    snapuserd->SetBlockCacheSize(block_cache_size_);
+    if (auto iter = handoff_metadata_offsets_.find(misc_name);
+        iter != handoff_metadata_offsets_.end()) {
+        snapuserd->SetParsedMetadata(handoff_metadata_fd_, iter->second);
+    }
     if (!snapuserd->InitCowDevice()) {
         LOG(ERROR) << "Failed to initialize Snapuserd";
         return nullptr;
@@ -481,6 +636,8 @@ std::shared_ptr<UserSnapshotDmUserHandler> UserSnapshotServer::AddHandler(
 
     snapuserd->SetSocketPresent(is_socket_present_);
     snapuserd->SetIouringEnabled(io_uring_enabled_);
+    snapuserd->SetVerifyBandwidthLimit(verify_bandwidth_limit_);
+    snapuserd->GetMergeThrottle().SetPolicy(merge_throttle_policy_);
 
     if (!snapuserd->InitializeWorkers()) {
         LOG(ERROR) << "Failed to initialize workers";
@@ -488,6 +645,9 @@ std::shared_ptr<UserSnapshotDmUserHandler> UserSnapshotServer::AddHandler(
     }
 
     auto handler = std::make_shared<UserSnapshotDmUserHandler>(snapuserd);
+    std::weak_ptr<UserSnapshotDmUserHandler> weak_handler = handler;
+    snapuserd->SetMergeFinishedCallback(
+            [this, weak_handler]() -> void { OnMergeFinished(weak_handler); });
     {
         std::lock_guard<std::mutex> lock(lock_);
         if (FindHandler(&lock, misc_name) != dm_users_.end()) {
@@ -511,16 +671,207 @@ bool UserSnapshotServer::StartHandler(const std::shared_ptr<UserSnapshotDmUserHa
     return true;
 }
 
-bool UserSnapshotServer::StartMerge(const std::shared_ptr<UserSnapshotDmUserHandler>& handler) {
+bool UserSnapshotServer::StartMerge(std::lock_guard<std::mutex>* proof_of_lock,
+                                    const std::shared_ptr<UserSnapshotDmUserHandler>& handler) {
+    CHECK(proof_of_lock);
+
     if (!handler->snapuserd()->IsAttached()) {
         LOG(ERROR) << "Handler not attached to dm-user - Merge thread cannot be started";
         return false;
     }
 
-    handler->snapuserd()->InitiateMerge();
+    using MergeState = UserSnapshotDmUserHandler::MergeState;
+    switch (handler->merge_state()) {
+        case MergeState::kIdle:
+            handler->set_merge_state(MergeState::kQueued);
+            merge_queue_.emplace_back(handler);
+            ScheduleMerges(proof_of_lock);
+            break;
+        case MergeState::kQueued:
+        case MergeState::kRunning:
+            break;
+        case MergeState::kFinished:
+            // The merge thread has exited, hence this will not
+            // occupy a merge slot.
+            handler->snapuserd()->InitiateMerge();
+            break;
+    }
+    return true;
+}
+
+// Start queued merges while there are free slots. Partitions with the
+// fewest ops left are merged first: they finish quickly and are switched
+// to dm-linear early, and interleaving fewer partitions keeps the writes
+// to the super partition mostly sequential.
+void UserSnapshotServer::ScheduleMerges(std::lock_guard<std::mutex>* proof_of_lock) {
+    CHECK(proof_of_lock);
+
+    while (!merge_queue_.empty() &&
+           (!max_concurrent_merges_ || num_merges_running_ < max_concurrent_merges_)) {
+        auto next = std::min_element(merge_queue_.begin(), merge_queue_.end(),
+                                     [](const auto& a, const auto& b) {
+                                         return a->snapuserd()->GetNumMergeOpsRemaining() <
+                                                b->snapuserd()->GetNumMergeOpsRemaining();
+                                     });
+        auto handler = *next;
+        merge_queue_.erase(next);
+
+        LOG(INFO) << "Starting merge: " << handler->misc_name() << " ops remaining: "
+                  << handler->snapuserd()->GetNumMergeOpsRemaining()
+                  << " merges running: " << num_merges_running_;
+
+        handler->set_merge_state(UserSnapshotDmUserHandler::MergeState::kRunning);
+        num_merges_running_ += 1;
+        handler->snapuserd()->InitiateMerge();
+    }
+}
+
+void UserSnapshotServer::OnMergeFinished(std::weak_ptr<UserSnapshotDmUserHandler> weak_handler) {
+    auto handler = weak_handler.lock();
+    if (!handler) {
+        return;
+    }
+
+    using MergeState = UserSnapshotDmUserHandler::MergeState;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (handler->merge_state() == MergeState::kRunning) {
+        CHECK(num_merges_running_ > 0);
+        num_merges_running_ -= 1;
+    } else if (handler->merge_state() == MergeState::kQueued) {
+        merge_queue_.erase(std::remove(merge_queue_.begin(), merge_queue_.end(), handler),
+                           merge_queue_.end());
+    }
+    handler->set_merge_state(MergeState::kFinished);
+
+    ScheduleMerges(&lock);
+}
+
+std::string UserSnapshotServer::GetMergeProgress(std::lock_guard<std::mutex>* proof_of_lock) {
+    double percentage = GetMergePercentage(proof_of_lock);
+
+    return std::to_string(percentage) + "," + std::to_string(num_merges_running_) + "," +
+           std::to_string(merge_queue_.size()) + "," +
+           std::to_string(num_partitions_merge_complete_);
+}
+
+// Layout of the metadata exported by ExportMetadata(): a header, then for
+// each handler an entry followed by the misc name and the handler's state.
+struct MetadataHandoffHeader {
+    uint32_t magic;
+    uint32_t num_handlers;
+};
+
+struct MetadataHandoffEntry {
+    uint32_t name_length;
+    uint32_t reserved;
+    uint64_t state_size;
+};
+
+static constexpr uint32_t kMetadataHandoffMagic = 0x4d647553;  // "SudM"
+
+unique_fd UserSnapshotServer::ExportMetadata(std::lock_guard<std::mutex>* proof_of_lock) {
+    CHECK(proof_of_lock);
+
+    unique_fd fd(syscall(__NR_memfd_create, "snapuserd_metadata", MFD_CLOEXEC));
+    if (fd < 0) {
+        PLOG(ERROR) << "memfd_create failed";
+        return {};
+    }
+
+    MetadataHandoffHeader header = {kMetadataHandoffMagic, 0};
+    if (!android::base::WriteFully(fd, &header, sizeof(header))) {
+        PLOG(ERROR) << "Failed to write metadata header";
+        return {};
+    }
+
+    for (const auto& handler : dm_users_) {
+        if (!handler->snapuserd() || handler->ThreadTerminated()) {
+            continue;
+        }
+
+        off_t start = lseek(fd.get(), 0, SEEK_CUR);
+        const auto& name = handler->misc_name();
+        MetadataHandoffEntry entry = {static_cast<uint32_t>(name.size()), 0, 0};
+        if (start < 0 || !android::base::WriteFully(fd, &entry, sizeof(entry)) ||
+            !android::base::WriteFully(fd, name.data(), name.size())) {
+            PLOG(ERROR) << "Failed to write metadata entry";
+            return {};
+        }
+
+        if (!handler->snapuserd()->ExportParsedMetadata(fd)) {
+            // The new daemon will parse this COW itself.
+            if (ftruncate(fd.get(), start) < 0 || lseek(fd.get(), start, SEEK_SET) < 0) {
+                PLOG(ERROR) << "Failed to drop metadata of " << name;
+                return {};
+            }
+            continue;
+        }
+
+        off_t end = lseek(fd.get(), 0, SEEK_CUR);
+        entry.state_size = end - start - sizeof(entry) - name.size();
+        if (end < 0 || !android::base::WriteFullyAtOffset(fd, &entry, sizeof(entry), start)) {
+            PLOG(ERROR) << "Failed to write metadata entry";
+            return {};
+        }
+        header.num_handlers++;
+    }
+
+    if (!header.num_handlers) {
+        return {};
+    }
+    if (!android::base::WriteFullyAtOffset(fd, &header, sizeof(header), 0)) {
+        PLOG(ERROR) << "Failed to write metadata header";
+        return {};
+    }
+
+    LOG(INFO) << "Exported metadata of " << header.num_handlers << " handlers";
+    return fd;
+}
+
+bool UserSnapshotServer::SetHandoffMetadata(unique_fd&& fd) {
+    MetadataHandoffHeader header;
+    if (!android::base::ReadFullyAtOffset(fd, &header, sizeof(header), 0)) {
+        PLOG(ERROR) << "Failed to read metadata header";
+        return false;
+    }
+    if (header.magic != kMetadataHandoffMagic) {
+        LOG(ERROR) << "Invalid metadata magic: " << header.magic;
+        return false;
+    }
+
+    std::unordered_map<std::string, uint64_t> offsets;
+    uint64_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.num_handlers; i++) {
+        MetadataHandoffEntry entry;
+        if (!android::base::ReadFullyAtOffset(fd, &entry, sizeof(entry), offset)) {
+            PLOG(ERROR) << "Failed to read metadata entry";
+            return false;
+        }
+        offset += sizeof(entry);
+
+        std::string name(entry.name_length, '\0');
+        if (!android::base::ReadFullyAtOffset(fd, name.data(), name.size(), offset)) {
+            PLOG(ERROR) << "Failed to read metadata entry";
+            return false;
+        }
+        offset += name.size();
+
+        offsets[name] = offset;
+        offset += entry.state_size;
+    }
+
+    LOG(INFO) << "Using metadata handed off for " << offsets.size() << " handlers";
+    handoff_metadata_fd_ = std::move(fd);
+    handoff_metadata_offsets_ = std::move(offsets);
     return true;
 }
 
+void UserSnapshotServer::DropHandoffMetadata() {
+    handoff_metadata_offsets_.clear();
+    handoff_metadata_fd_ = {};
+}
+
 auto UserSnapshotServer::FindHandler(std::lock_guard<std::mutex>* proof_of_lock,
                                      const std::string& misc_name) -> HandlerList::iterator {
     CHECK(proof_of_lock);
@@ -578,6 +929,41 @@ double UserSnapshotServer::GetMergePercentage(std::lock_guard<std::mutex>* proof
     return percentage;
 }
 
+std::string UserSnapshotServer::GetBlockCacheStats(std::lock_guard<std::mutex>* proof_of_lock) {
+    CHECK(proof_of_lock);
+    uint64_t total_hits = 0;
+    uint64_t total_misses = 0;
+
+    for (auto iter = dm_users_.begin(); iter != dm_users_.end(); iter++) {
+        if (!(*iter)->snapuserd()) {
+            continue;
+        }
+        uint64_t hits, misses;
+        (*iter)->snapuserd()->GetBlockCache().GetStats(&hits, &misses);
+        total_hits += hits;
+        total_misses += misses;
+    }
+
+    return std::to_string(total_hits) + "," + std::to_string(total_misses);
+}
+
+void UserSnapshotServer::SetMergeThrottlePolicy(std::lock_guard<std::mutex>* proof_of_lock,
+                                                const MergeThrottlePolicy& policy) {
+    CHECK(proof_of_lock);
+    merge_throttle_policy_ = policy;
+
+    for (auto iter = dm_users_.begin(); iter != dm_users_.end(); iter++) {
+        if ((*iter)->snapuserd()) {
+            (*iter)->snapuserd()->GetMergeThrottle().SetPolicy(policy);
+        }
+    }
+
+    LOG(INFO) << "Merge throttle: enabled: " << policy.enabled
+              << " latency_threshold_us: " << policy.latency_threshold_us
+              << " io_pressure_threshold: " << policy.io_pressure_threshold
+              << " min_rate_percent: " << policy.min_rate_percent;
+}
+
 bool UserSnapshotServer::RemoveAndJoinHandler(const std::string& misc_name) {
     std::shared_ptr<UserSnapshotDmUserHandler> handler;
     {
@@ -590,6 +976,8 @@ bool UserSnapshotServer::RemoveAndJoinHandler(const std::string& misc_name) {
         }
         handler = std::move(*iter);
         dm_users_.erase(iter);
+        merge_queue_.erase(std::remove(merge_queue_.begin(), merge_queue_.end(), handler),
+                           merge_queue_.end());
     }
 
     auto& th = handler->thread();
@@ -25,6 +25,7 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/unique_fd.h>
@@ -47,6 +48,13 @@ enum class DaemonOps {
     PERCENTAGE,
     GETSTATUS,
     UPDATE_VERIFY,
+    CACHE_STATS,
+    MERGE_THROTTLE,
+    MERGE_PROGRESS,
+    HANDLER_STATS,
+    MEMORY_USAGE,
+    MERGE_OPS_PROGRESS,
+    EXPORT_METADATA,
     INVALID,
 };
 
@@ -70,11 +78,17 @@ class UserSnapshotDmUserHandler {
     bool ThreadTerminated() { return thread_terminated_; }
     void SetThreadTerminated() { thread_terminated_ = true; }
 
+    // Merge scheduling state, protected by the server lock
+    enum class MergeState { kIdle, kQueued, kRunning, kFinished };
+    MergeState merge_state() const { return merge_state_; }
+    void set_merge_state(MergeState state) { merge_state_ = state; }
+
   private:
     std::thread thread_;
     std::shared_ptr<SnapshotHandler> snapuserd_;
     std::string misc_name_;
     bool thread_terminated_ = false;
+    MergeState merge_state_ = MergeState::kIdle;
 };
 
 class UserSnapshotServer {
@@ -87,11 +101,25 @@ class UserSnapshotServer {
     int num_partitions_merge_complete_ = 0;
     bool is_server_running_ = false;
     bool io_uring_enabled_ = false;
+    size_t block_cache_size_ = 0;
+    size_t read_ahead_buffer_size_ = BUFFER_REGION_DEFAULT_SIZE;
+    bool pin_memory_ = false;
+    uint64_t verify_bandwidth_limit_ = 0;
+    MergeThrottlePolicy merge_throttle_policy_;
+    // Maximum number of partitions merged at once; zero means no limit
+    uint32_t max_concurrent_merges_ = 0;
+    uint32_t num_merges_running_ = 0;
+    // Metadata exported by a previous daemon, and the offset of the state of
+    // each of its handlers
+    android::base::unique_fd handoff_metadata_fd_;
+    std::unordered_map<std::string, uint64_t> handoff_metadata_offsets_;
 
     std::mutex lock_;
 
     using HandlerList = std::vector<std::shared_ptr<UserSnapshotDmUserHandler>>;
     HandlerList dm_users_;
+    // Partitions waiting for a merge slot
+    HandlerList merge_queue_;
 
     void AddWatchedFd(android::base::borrowed_fd fd, int events);
     void AcceptClient();
@@ -117,7 +145,14 @@ class UserSnapshotServer {
                                       const std::string& misc_name);
 
     double GetMergePercentage(std::lock_guard<std::mutex>* proof_of_lock);
+    std::string GetBlockCacheStats(std::lock_guard<std::mutex>* proof_of_lock);
     void TerminateMergeThreads(std::lock_guard<std::mutex>* proof_of_lock);
+    void SetMergeThrottlePolicy(std::lock_guard<std::mutex>* proof_of_lock,
+                                const MergeThrottlePolicy& policy);
+    void ScheduleMerges(std::lock_guard<std::mutex>* proof_of_lock);
+    void OnMergeFinished(std::weak_ptr<UserSnapshotDmUserHandler> weak_handler);
+    std::string GetMergeProgress(std::lock_guard<std::mutex>* proof_of_lock);
+    android::base::unique_fd ExportMetadata(std::lock_guard<std::mutex>* proof_of_lock);
 
     bool UpdateVerification(std::lock_guard<std::mutex>* proof_of_lock);
 
@@ -136,7 +171,8 @@ class UserSnapshotServer {
                                                           const std::string& backing_device,
                                                           const std::string& base_path_merge);
     bool StartHandler(const std::shared_ptr<UserSnapshotDmUserHandler>& handler);
-    bool StartMerge(const std::shared_ptr<UserSnapshotDmUserHandler>& handler);
+    bool StartMerge(std::lock_guard<std::mutex>* proof_of_lock,
+                    const std::shared_ptr<UserSnapshotDmUserHandler>& handler);
     std::string GetMergeStatus(const std::shared_ptr<UserSnapshotDmUserHandler>& handler);
 
     void SetTerminating() { terminating_ = true; }
@@ -145,6 +181,26 @@ class UserSnapshotServer {
     bool IsServerRunning() { return is_server_running_; }
     void SetIouringEnabled() { io_uring_enabled_ = true; }
     bool IsIouringEnabled() { return io_uring_enabled_; }
+    // Memory cap, in bytes, of the decompressed block cache of each handler
+    void SetBlockCacheSize(size_t size) { block_cache_size_ = size; }
+    // Size of the read-ahead region of the handlers whose COW has no
+    // scratch space
+    void SetReadAheadBufferSize(size_t size) { read_ahead_buffer_size_ = size; }
+    // Lock the metadata mapping and I/O buffers of the handlers into RAM
+    void SetPinMemory(bool pin) { pin_memory_ = pin; }
+    // Read bandwidth budget, in bytes per second, of the update verification
+    // of each handler. Zero means no limit.
+    void SetVerifyBandwidthLimit(uint64_t bytes_per_sec) {
+        verify_bandwidth_limit_ = bytes_per_sec;
+    }
+    // Merges requested beyond this limit are queued, smallest remaining
+    // merge first. Zero means all partitions merge concurrently.
+    void SetMaxConcurrentMerges(uint32_t num_merges) { max_concurrent_merges_ = num_merges; }
+    // Restore the handlers added from now on from the metadata another
+    // instance exported with the "export_metadata" command, rather than
+    // parsing their COWs again. DropHandoffMetadata() releases it.
+    bool SetHandoffMetadata(android::base::unique_fd&& fd);
+    void DropHandoffMetadata();
 };
 
 }  // namespace snapshot
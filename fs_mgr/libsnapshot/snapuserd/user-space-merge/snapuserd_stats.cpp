@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_ALWAYS
+
+#include "snapuserd_stats.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include <android-base/stringprintf.h>
+#include <cutils/trace.h>
+
+namespace android {
+namespace snapshot {
+
+using android::base::StringAppendF;
+
+void LatencyHistogram::Record(uint64_t latency_us) {
+    size_t bucket = 0;
+    if (latency_us) {
+        bucket = std::min<size_t>(64 - __builtin_clzll(latency_us), kNumBuckets - 1);
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_us_.fetch_add(latency_us, std::memory_order_relaxed);
+
+    uint64_t max = max_us_.load(std::memory_order_relaxed);
+    while (latency_us > max &&
+           !max_us_.compare_exchange_weak(max, latency_us, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+    uint64_t total = count();
+    if (!total) {
+        return 0;
+    }
+
+    uint64_t target = std::max<uint64_t>(1, total * percentile / 100);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return std::min<uint64_t>(1ULL << i, max_us());
+        }
+    }
+    return max_us();
+}
+
+const char* HandlerStats::GetStatName(HandlerStat stat) {
+    switch (stat) {
+        case HandlerStat::kRequest:
+            return "request";
+        case HandlerStat::kReplaceOp:
+            return "replace_op";
+        case HandlerStat::kZeroOp:
+            return "zero_op";
+        case HandlerStat::kCopyOp:
+            return "copy_op";
+        case HandlerStat::kXorOp:
+            return "xor_op";
+        case HandlerStat::kBaseRead:
+            return "base_read";
+        case HandlerStat::kDecompress:
+            return "decompress";
+        case HandlerStat::kMergeBatch:
+            return "merge_batch";
+        case HandlerStat::kReadAheadStall:
+            return "read_ahead_stall";
+        default:
+            return "unknown";
+    }
+}
+
+void HandlerStats::SetName(const std::string& misc_name) {
+    for (size_t i = 0; i < kNumStats; i++) {
+        trace_names_[i] = "snapuserd:" + misc_name + ":" +
+                          GetStatName(static_cast<HandlerStat>(i)) + "_us";
+    }
+}
+
+void HandlerStats::Record(HandlerStat stat, std::chrono::steady_clock::duration latency) {
+    size_t index = static_cast<size_t>(stat);
+    uint64_t latency_us =
+            std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+
+    histograms_[index].Record(latency_us);
+
+    if (ATRACE_ENABLED()) {
+        ATRACE_INT64(trace_names_[index].c_str(), latency_us);
+    }
+}
+
+std::string HandlerStats::Format(HandlerStat stat) const {
+    const LatencyHistogram& histogram = histograms_[static_cast<size_t>(stat)];
+    uint64_t count = histogram.count();
+    return android::base::StringPrintf(
+            "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+            GetStatName(stat), count, count ? histogram.total_us() / count : 0,
+            histogram.Percentile(50), histogram.Percentile(90), histogram.Percentile(99),
+            histogram.max_us());
+}
+
+std::string HandlerStats::ToString() const {
+    std::string out;
+    for (size_t i = 0; i < kNumStats; i++) {
+        StringAppendF(&out, "%s\n", Format(static_cast<HandlerStat>(i)).c_str());
+    }
+    return out;
+}
+
+}  // namespace snapshot
+}  // namespace android
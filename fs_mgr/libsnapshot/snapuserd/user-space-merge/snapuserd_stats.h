@@ -0,0 +1,103 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace android {
+namespace snapshot {
+
+enum class HandlerStat {
+    // dm-user requests, end to end
+    kRequest,
+    // Blocks of a request, by the COW op they map to
+    kReplaceOp,
+    kZeroOp,
+    kCopyOp,
+    kXorOp,
+    // Reads passed through to the base device
+    kBaseRead,
+    // Reading and decompressing replace op data from the COW
+    kDecompress,
+    // One merge batch: a read-ahead window, or a batch of replace/zero ops
+    kMergeBatch,
+    // Merge thread waiting for the read-ahead thread
+    kReadAheadStall,
+    kNumStats,
+};
+
+// Lock-free latency histogram with power-of-two buckets in microseconds:
+// bucket 0 counts samples below 1us, bucket i samples in [2^(i-1), 2^i).
+class LatencyHistogram {
+  public:
+    static constexpr size_t kNumBuckets = 24;
+
+    void Record(uint64_t latency_us);
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t total_us() const { return total_us_.load(std::memory_order_relaxed); }
+    uint64_t max_us() const { return max_us_.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the given percentile (0-100)
+    uint64_t Percentile(double percentile) const;
+
+  private:
+    std::atomic<uint64_t> buckets_[kNumBuckets] = {};
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<uint64_t> total_us_ = 0;
+    std::atomic<uint64_t> max_us_ = 0;
+};
+
+// Counters and latency histograms of a SnapshotHandler. Samples are also
+// emitted as trace counters, named "snapuserd:<misc_name>:<stat>_us",
+// while tracing is enabled.
+class HandlerStats {
+  public:
+    void SetName(const std::string& misc_name);
+    void Record(HandlerStat stat, std::chrono::steady_clock::duration latency);
+
+    // <stat>,<count>,<avg_us>,<p50_us>,<p90_us>,<p99_us>,<max_us>
+    std::string Format(HandlerStat stat) const;
+    // All the stats, one per line, for logging
+    std::string ToString() const;
+
+    static const char* GetStatName(HandlerStat stat);
+
+  private:
+    static constexpr size_t kNumStats = static_cast<size_t>(HandlerStat::kNumStats);
+
+    LatencyHistogram histograms_[kNumStats];
+    std::string trace_names_[kNumStats];
+};
+
+// Records the time spent in a scope
+class ScopedStatTimer {
+  public:
+    ScopedStatTimer(HandlerStats* stats, HandlerStat stat)
+        : stats_(stats), stat_(stat), begin_(std::chrono::steady_clock::now()) {}
+    ~ScopedStatTimer() { stats_->Record(stat_, std::chrono::steady_clock::now() - begin_); }
+
+  private:
+    HandlerStats* stats_;
+    HandlerStat stat_;
+    std::chrono::steady_clock::time_point begin_;
+};
+
+}  // namespace snapshot
+}  // namespace android
@@ -92,16 +92,25 @@ void UpdateVerify::VerifyUpdatePartition() {
     succeeded = true;
 }
 
-bool UpdateVerify::VerifyBlocks(const std::string& partition_name,
-                                const std::string& dm_block_device, off_t offset, int skip_blocks,
-                                uint64_t dev_sz) {
-    unique_fd fd(TEMP_FAILURE_RETRY(open(dm_block_device.c_str(), O_RDONLY | O_DIRECT)));
-    if (fd < 0) {
-        SNAP_LOG(ERROR) << "open failed: " << dm_block_device;
-        return false;
+void UpdateVerify::ThrottleRead(uint64_t bytes) {
+    if (!bandwidth_limit_) {
+        return;
     }
 
-    loff_t file_offset = offset;
+    // Reads are spaced so that, across all the verification threads, no
+    // more than |bandwidth_limit_| bytes are issued per second.
+    std::chrono::steady_clock::time_point read_time;
+    {
+        std::lock_guard<std::mutex> lock(bandwidth_lock_);
+        auto now = std::chrono::steady_clock::now();
+        read_time = std::max(now, next_read_time_);
+        next_read_time_ = read_time + std::chrono::microseconds(bytes * 1000000 / bandwidth_limit_);
+    }
+    std::this_thread::sleep_until(read_time);
+}
+
+bool UpdateVerify::VerifyBlocksSync(const std::string& partition_name, int fd, uint64_t begin,
+                                    uint64_t end) {
     const uint64_t read_sz = kBlockSizeVerify;
 
     void* addr;
@@ -114,28 +123,162 @@ bool UpdateVerify::VerifyBlocks(const std::string& partition_name,
 
     std::unique_ptr<void, decltype(&::free)> buffer(addr, ::free);
 
-    uint64_t bytes_read = 0;
-
-    while (true) {
-        size_t to_read = std::min((dev_sz - file_offset), read_sz);
+    for (uint64_t file_offset = begin; file_offset < end; file_offset += read_sz) {
+        size_t to_read = std::min((end - file_offset), read_sz);
+        ThrottleRead(to_read);
 
-        if (!android::base::ReadFullyAtOffset(fd.get(), buffer.get(), to_read, file_offset)) {
-            SNAP_PLOG(ERROR) << "Failed to read block from block device: " << dm_block_device
+        if (!android::base::ReadFullyAtOffset(fd, buffer.get(), to_read, file_offset)) {
+            SNAP_PLOG(ERROR) << "Failed to read block from block device"
                              << " partition-name: " << partition_name
-                             << " at offset: " << file_offset << " read-size: " << to_read
-                             << " block-size: " << dev_sz;
+                             << " at offset: " << file_offset << " read-size: " << to_read;
             return false;
         }
+    }
+    return true;
+}
+
+bool UpdateVerify::VerifyBlocksAsync(const std::string& partition_name, int fd, uint64_t begin,
+                                     uint64_t end, bool* ring_failed) {
+    const uint64_t read_sz = kBlockSizeVerify;
+    const int queue_depth = kQueueDepthVerify;
 
-        bytes_read += to_read;
-        file_offset += (skip_blocks * kBlockSizeVerify);
-        if (file_offset >= dev_sz) {
-            break;
+    void* addr;
+    ssize_t page_size = getpagesize();
+    if (posix_memalign(&addr, page_size, read_sz * queue_depth) < 0) {
+        SNAP_PLOG(ERROR) << "posix_memalign failed "
+                         << " page_size: " << page_size << " read_sz: " << read_sz;
+        return false;
+    }
+    std::unique_ptr<void, decltype(&::free)> buffer(addr, ::free);
+
+    struct io_uring ring;
+    int ret = io_uring_queue_init(queue_depth, &ring, 0);
+    if (ret) {
+        SNAP_LOG(ERROR) << "io_uring_queue_init failed with ret: " << ret;
+        *ring_failed = true;
+        return false;
+    }
+
+    int inflight = 0;
+    // On failure, reap the reads still in flight before |buffer| is freed
+    auto ring_guard = android::base::make_scope_guard([&ring, &inflight]() {
+        struct io_uring_cqe* cqe;
+        while (inflight && !io_uring_wait_cqe(&ring, &cqe)) {
+            io_uring_cqe_seen(&ring, cqe);
+            inflight -= 1;
         }
+        io_uring_queue_exit(&ring);
+    });
+
+    struct Read {
+        uint64_t offset;
+        size_t size;
+    };
+    std::vector<Read> reads(queue_depth);
+    std::vector<int> free_slots;
+    for (int i = queue_depth - 1; i >= 0; i--) {
+        free_slots.push_back(i);
     }
 
-    SNAP_LOG(DEBUG) << "Verification success with bytes-read: " << bytes_read
-                    << " dev_sz: " << dev_sz << " partition_name: " << partition_name;
+    uint64_t next_offset = begin;
+    bool submitted = false;
+    while (next_offset < end || inflight) {
+        // Keep the queue full
+        int queued = 0;
+        while (next_offset < end && !free_slots.empty()) {
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            if (!sqe) {
+                break;
+            }
+            int slot = free_slots.back();
+            free_slots.pop_back();
+
+            reads[slot].offset = next_offset;
+            reads[slot].size = std::min((end - next_offset), read_sz);
+            ThrottleRead(reads[slot].size);
+
+            io_uring_prep_read(sqe, fd, (char*)buffer.get() + slot * read_sz, reads[slot].size,
+                               reads[slot].offset);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(slot)));
+            next_offset += reads[slot].size;
+            queued += 1;
+        }
+
+        if (queued) {
+            ret = io_uring_submit(&ring);
+            if (ret != queued) {
+                SNAP_LOG(ERROR) << "io_uring_submit failed with ret: " << ret
+                                << " expected: " << queued;
+                *ring_failed = (!submitted && ret < 0);
+                inflight += std::max(ret, 0);
+                return false;
+            }
+            inflight += queued;
+            submitted = true;
+        }
+
+        struct io_uring_cqe* cqe;
+        ret = io_uring_wait_cqe(&ring, &cqe);
+        if (ret) {
+            SNAP_LOG(ERROR) << "io_uring_wait_cqe failed with ret: " << ret;
+            return false;
+        }
+
+        int slot = static_cast<int>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        inflight -= 1;
+
+        const Read& read = reads[slot];
+        if (res < 0) {
+            SNAP_LOG(ERROR) << "Failed to read block from block device"
+                            << " partition-name: " << partition_name
+                            << " at offset: " << read.offset << " read-size: " << read.size
+                            << " error: " << strerror(-res);
+            return false;
+        }
+        if (static_cast<size_t>(res) < read.size) {
+            // Finish a short read synchronously
+            char* buf = (char*)buffer.get() + slot * read_sz + res;
+            if (!android::base::ReadFullyAtOffset(fd, buf, read.size - res, read.offset + res)) {
+                SNAP_PLOG(ERROR) << "Failed to read block from block device"
+                                 << " partition-name: " << partition_name
+                                 << " at offset: " << read.offset + res
+                                 << " read-size: " << read.size - res;
+                return false;
+            }
+        }
+        free_slots.push_back(slot);
+    }
+    return true;
+}
+
+bool UpdateVerify::VerifyBlocks(const std::string& partition_name,
+                                const std::string& dm_block_device, uint64_t begin,
+                                uint64_t end) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(dm_block_device.c_str(), O_RDONLY | O_DIRECT)));
+    if (fd < 0) {
+        SNAP_LOG(ERROR) << "open failed: " << dm_block_device;
+        return false;
+    }
+
+    bool ret;
+    if (io_uring_enabled_) {
+        bool ring_failed = false;
+        ret = VerifyBlocksAsync(partition_name, fd.get(), begin, end, &ring_failed);
+        if (!ret && ring_failed) {
+            SNAP_LOG(INFO) << "Falling back to synchronous reads for verification";
+            ret = VerifyBlocksSync(partition_name, fd.get(), begin, end);
+        }
+    } else {
+        ret = VerifyBlocksSync(partition_name, fd.get(), begin, end);
+    }
+    if (!ret) {
+        return false;
+    }
+
+    SNAP_LOG(DEBUG) << "Verification success with bytes-read: " << end - begin
+                    << " range: " << begin << "-" << end << " partition_name: " << partition_name;
 
     return true;
 }
@@ -175,6 +318,9 @@ bool UpdateVerify::VerifyPartition(const std::string& partition_name,
      * 100Mb. We can just finish them in a single thread. For bigger partitions
      * such as product, 4 threads are sufficient enough.
      *
+     * When io_uring is available, each thread keeps kQueueDepthVerify
+     * reads in flight.
+     *
      * TODO: With io_uring SQ_POLL support, we can completely cut this
      * down to just single thread for all partitions and potentially verify all
      * the partitions with zero syscalls. Additionally, since block layer
@@ -186,19 +332,16 @@ bool UpdateVerify::VerifyPartition(const std::string& partition_name,
         num_threads = kMaxThreadsToVerify;
     }
 
-    std::vector<std::future<bool>> threads;
-    off_t start_offset = 0;
-    const int skip_blocks = num_threads;
+    // Each thread reads a contiguous range of the device, so that reads
+    // from different threads do not interleave on the same region.
+    uint64_t range_size = (dev_sz + num_threads - 1) / num_threads;
+    range_size = (range_size + kBlockSizeVerify - 1) & ~(kBlockSizeVerify - 1);
 
-    while (num_threads) {
+    std::vector<std::future<bool>> threads;
+    for (uint64_t begin = 0; begin < dev_sz; begin += range_size) {
+        uint64_t end = std::min(begin + range_size, dev_sz);
         threads.emplace_back(std::async(std::launch::async, &UpdateVerify::VerifyBlocks, this,
-                                        partition_name, dm_block_device, start_offset, skip_blocks,
-                                        dev_sz));
-        start_offset += kBlockSizeVerify;
-        num_threads -= 1;
-        if (start_offset >= dev_sz) {
-            break;
-        }
+                                        partition_name, dm_block_device, begin, end));
     }
 
     bool ret = true;
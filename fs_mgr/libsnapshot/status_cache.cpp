@@ -0,0 +1,133 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "status_cache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include "utility.h"
+
+namespace android {
+namespace snapshot {
+
+using android::base::unique_fd;
+
+bool StatusFileCache::Matches(const Entry& entry, const struct stat& st) {
+    return entry.dev == st.st_dev && entry.ino == st.st_ino && entry.size == st.st_size &&
+           entry.mtime.tv_sec == st.st_mtim.tv_sec && entry.mtime.tv_nsec == st.st_mtim.tv_nsec &&
+           entry.ctime.tv_sec == st.st_ctim.tv_sec && entry.ctime.tv_nsec == st.st_ctim.tv_nsec;
+}
+
+void StatusFileCache::Store(const std::string& path, const struct stat& st,
+                            const std::string& contents) {
+    entries_[path] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim, st.st_ctim, contents};
+}
+
+bool StatusFileCache::Read(const std::string& path, std::string* contents) {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0) {
+        entries_.erase(path);
+        return false;
+    }
+
+    auto iter = entries_.find(path);
+    if (iter != entries_.end() && Matches(iter->second, st)) {
+        *contents = iter->second.contents;
+        hits_++;
+        return true;
+    }
+
+    unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+    if (fd < 0) {
+        entries_.erase(path);
+        return false;
+    }
+    // Key the entry on the file that was actually read; it may have been
+    // replaced since the stat() above.
+    if (fstat(fd.get(), &st) < 0 || !android::base::ReadFdToString(fd, contents)) {
+        entries_.erase(path);
+        return false;
+    }
+    Store(path, st, *contents);
+    return true;
+}
+
+bool StatusFileCache::Write(const std::string& path, const std::string& contents) {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    struct stat st;
+    auto iter = entries_.find(path);
+    if (iter != entries_.end() && iter->second.contents == contents &&
+        stat(path.c_str(), &st) == 0 && Matches(iter->second, st)) {
+        return true;
+    }
+
+    entries_.erase(path);
+    if (!WriteStringToFileAtomic(contents, path)) {
+        return false;
+    }
+    dirty_files_.emplace(path);
+
+    if (stat(path.c_str(), &st) == 0) {
+        Store(path, st, contents);
+    }
+    return true;
+}
+
+void StatusFileCache::Invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> guard(lock_);
+    entries_.erase(path);
+}
+
+bool StatusFileCache::Sync() {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    bool ok = true;
+    std::set<std::string> dirs;
+    for (const auto& path : dirty_files_) {
+        unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+        if (fd < 0) {
+            // Removed after it was written
+            if (errno != ENOENT) {
+                PLOG(ERROR) << "Open failed: " << path;
+                ok = false;
+            }
+        } else if (fsync(fd.get()) < 0) {
+            PLOG(ERROR) << "fsync failed: " << path;
+            ok = false;
+        }
+        dirs.emplace(android::base::Dirname(path));
+    }
+    dirty_files_.clear();
+
+    // Make the renames durable
+    for (const auto& dir : dirs) {
+        if (!FsyncDirectory(dir.c_str())) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+}  // namespace snapshot
+}  // namespace android
@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace android {
+namespace snapshot {
+
+// In-process cache of the small status files SnapshotManager keeps under its
+// metadata directory.
+//
+// An entry is only served if stat() shows the file is the one that was last
+// read or written through the cache. Status files are always replaced with a
+// rename, so a write from another process is seen as a new inode. Checking
+// costs one stat() of a hot inode rather than an open, a read and a parse.
+//
+// Writes go to the file immediately, but the fsync()s are deferred until
+// Sync(), which SnapshotManager calls before dropping an exclusive lock. The
+// files written while holding the lock are therefore made durable in one
+// batch. Writing the contents a file already has is a no-op.
+class StatusFileCache {
+  public:
+    // Returns false, with errno set, if |path| cannot be read.
+    bool Read(const std::string& path, std::string* contents);
+    bool Write(const std::string& path, const std::string& contents);
+    // Forget |path|, e.g. because the file was removed.
+    void Invalidate(const std::string& path);
+    // fsync() the files written since the last call, and their directories.
+    bool Sync();
+
+    // Number of reads served from memory, for tests.
+    uint64_t hits() const { return hits_; }
+
+  private:
+    struct Entry {
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        struct timespec ctime;
+        std::string contents;
+    };
+
+    static bool Matches(const Entry& entry, const struct stat& st);
+    void Store(const std::string& path, const struct stat& st, const std::string& contents);
+
+    std::mutex lock_;
+    std::map<std::string, Entry> entries_;
+    std::set<std::string> dirty_files_;
+    uint64_t hits_ = 0;
+};
+
+}  // namespace snapshot
+}  // namespace android
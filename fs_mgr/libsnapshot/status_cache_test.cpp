@@ -0,0 +1,101 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "status_cache.h"
+#include "utility.h"
+
+namespace android {
+namespace snapshot {
+
+class StatusFileCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override { path_ = std::string(dir_.path) + "/state"; }
+
+    TemporaryDir dir_;
+    std::string path_;
+    StatusFileCache cache_;
+};
+
+TEST_F(StatusFileCacheTest, ReadHit) {
+    ASSERT_TRUE(android::base::WriteStringToFile("initiated", path_));
+
+    std::string contents;
+    ASSERT_TRUE(cache_.Read(path_, &contents));
+    ASSERT_EQ(contents, "initiated");
+    ASSERT_EQ(cache_.hits(), 0u);
+
+    ASSERT_TRUE(cache_.Read(path_, &contents));
+    ASSERT_EQ(contents, "initiated");
+    ASSERT_EQ(cache_.hits(), 1u);
+}
+
+TEST_F(StatusFileCacheTest, ReadMissing) {
+    std::string contents;
+    ASSERT_FALSE(cache_.Read(path_, &contents));
+    ASSERT_EQ(errno, ENOENT);
+}
+
+TEST_F(StatusFileCacheTest, ExternalReplace) {
+    ASSERT_TRUE(cache_.Write(path_, "initiated"));
+
+    std::string contents;
+    ASSERT_TRUE(cache_.Read(path_, &contents));
+    ASSERT_EQ(contents, "initiated");
+
+    // Another process replacing the file must not be masked by the cache.
+    ASSERT_TRUE(WriteStringToFileAtomic("merging", path_));
+    ASSERT_TRUE(cache_.Read(path_, &contents));
+    ASSERT_EQ(contents, "merging");
+}
+
+TEST_F(StatusFileCacheTest, WriteUnchanged) {
+    ASSERT_TRUE(cache_.Write(path_, "initiated"));
+
+    struct stat before;
+    ASSERT_EQ(stat(path_.c_str(), &before), 0);
+
+    ASSERT_TRUE(cache_.Write(path_, "initiated"));
+
+    struct stat after;
+    ASSERT_EQ(stat(path_.c_str(), &after), 0);
+    ASSERT_EQ(before.st_ino, after.st_ino);
+
+    ASSERT_TRUE(cache_.Write(path_, "merging"));
+    ASSERT_EQ(stat(path_.c_str(), &after), 0);
+    ASSERT_NE(before.st_ino, after.st_ino);
+}
+
+TEST_F(StatusFileCacheTest, Invalidate) {
+    ASSERT_TRUE(cache_.Write(path_, "initiated"));
+    ASSERT_EQ(unlink(path_.c_str()), 0);
+    cache_.Invalidate(path_);
+
+    std::string contents;
+    ASSERT_FALSE(cache_.Read(path_, &contents));
+}
+
+TEST_F(StatusFileCacheTest, Sync) {
+    ASSERT_TRUE(cache_.Write(path_, "initiated"));
+    ASSERT_TRUE(cache_.Write(std::string(dir_.path) + "/other", "status"));
+    ASSERT_TRUE(cache_.Sync());
+    ASSERT_TRUE(cache_.Sync());
+}
+
+}  // namespace snapshot
+}  // namespace android
@@ -162,6 +162,19 @@ bool WriteStringToFileAtomic(const std::string& content, const std::string& path
     return true;
 }
 
+bool FsyncDirectory(const char* dirname) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC)));
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to open " << dirname;
+        return false;
+    }
+    if (fsync(fd.get()) < 0) {
+        PLOG(ERROR) << "Failed to fsync " << dirname;
+        return false;
+    }
+    return true;
+}
+
 std::ostream& operator<<(std::ostream& os, const Now&) {
     struct tm now;
     time_t t = time(nullptr);
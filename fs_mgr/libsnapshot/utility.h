@@ -121,6 +121,9 @@ Return InitializeKernelCow(const std::string& device);
 // is an open fd to |path|, because that fd has an old view of the file.
 bool WriteStringToFileAtomic(const std::string& content, const std::string& path);
 
+// fsync() a directory, e.g. to make a rename() into it durable.
+bool FsyncDirectory(const char* dirname);
+
 // Writes current time to a given stream.
 struct Now {};
 std::ostream& operator<<(std::ostream& os, const Now&);
@@ -15,6 +15,7 @@
 #include <chrono>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/unique_fd.h>
@@ -25,6 +26,7 @@ using namespace std::literals;
 using android::base::unique_fd;
 using android::fs_mgr::WaitForFile;
 using android::fs_mgr::WaitForFileDeleted;
+using android::fs_mgr::WaitForFiles;
 
 class FileWaitTest : public ::testing::Test {
   protected:
@@ -85,6 +87,35 @@ TEST_F(FileWaitTest, DeleteAsync) {
     thread.join();
 }
 
+TEST_F(FileWaitTest, CreateManyAsync) {
+    std::vector<std::string> paths = {test_file_ + ".0", test_file_ + ".1", test_file_ + ".2"};
+    std::thread thread([&paths] {
+        for (const auto& path : paths) {
+            std::this_thread::sleep_for(300ms);
+            unique_fd fd(open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0700));
+        }
+    });
+    EXPECT_TRUE(WaitForFiles(paths, 3s));
+    thread.join();
+    for (const auto& path : paths) {
+        unlink(path.c_str());
+    }
+}
+
+TEST_F(FileWaitTest, CreateSomeAsync) {
+    std::string created = test_file_ + ".created";
+    std::string missing_path = test_file_ + ".wontexist";
+    std::thread thread([&created] {
+        std::this_thread::sleep_for(300ms);
+        unique_fd fd(open(created.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0700));
+    });
+    std::vector<std::string> missing;
+    EXPECT_FALSE(WaitForFiles({created, missing_path}, 1s, &missing));
+    EXPECT_EQ(std::vector<std::string>{missing_path}, missing);
+    thread.join();
+    unlink(created.c_str());
+}
+
 TEST_F(FileWaitTest, BadPath) {
     ASSERT_FALSE(WaitForFile("/this/path/does/not/exist", 5ms));
     EXPECT_EQ(errno, ENOENT);
@@ -1032,6 +1032,32 @@ TEST(fs_mgr, DefaultFstabContainsUserdata) {
             << "Default fstab doesn't contain /data entry";
 }
 
+TEST(fs_mgr, GetDefaultFstab) {
+    Fstab fstab;
+    ASSERT_TRUE(ReadDefaultFstab(&fstab)) << "Failed to read default fstab";
+    auto cached = GetDefaultFstab();
+    ASSERT_NE(nullptr, cached);
+    ASSERT_EQ(fstab.size(), cached->size());
+    for (size_t i = 0; i < fstab.size(); i++) {
+        EXPECT_EQ(fstab[i].mount_point, (*cached)[i].mount_point);
+        EXPECT_EQ(fstab[i].blk_device, (*cached)[i].blk_device);
+        EXPECT_EQ(fstab[i].fs_type, (*cached)[i].fs_type);
+    }
+    // Repeated lookups share the cached Fstab.
+    EXPECT_EQ(cached, GetDefaultFstab());
+
+    auto entry = GetDefaultFstabEntryForMountPoint("/data");
+    ASSERT_NE(nullptr, entry);
+    EXPECT_EQ(GetEntryForMountPoint(cached.get(), "/data"), entry.get());
+    EXPECT_EQ(nullptr, GetDefaultFstabEntryForMountPoint("/no_such_mount_point"));
+
+    InvalidateDefaultFstabCache();
+    auto reread = GetDefaultFstab();
+    ASSERT_NE(nullptr, reread);
+    EXPECT_NE(cached, reread);
+    EXPECT_EQ(cached->size(), reread->size());
+}
+
 TEST(fs_mgr, UserdataMountedFromDefaultFstab) {
     if (getuid() != 0) {
         GTEST_SKIP() << "Must be run as root.";
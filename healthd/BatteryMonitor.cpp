@@ -29,12 +29,14 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <unordered_map>
 
 #include <aidl/android/hardware/health/HealthInfo.h>
-#include <android-base/file.h>
 #include <android-base/parseint.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <android/hardware/health/2.1/types.h>
 #include <android/hardware/health/translate-ndk.h>
 #include <batteryservice/BatteryService.h>
@@ -51,6 +53,12 @@
 #define MILLION 1.0e6
 #define DEFAULT_VBUS_VOLTAGE 5000000
 
+// Thresholds for adaptive_periodic_chores.
+#define ADAPTIVE_NEAR_FULL_LEVEL 90
+#define ADAPTIVE_HIGH_CURRENT_UA 1500000
+#define ADAPTIVE_IDLE_CURRENT_UA 100000
+#define ADAPTIVE_MAX_STRETCH_SHIFT 2  // 4x
+
 using HealthInfo_1_0 = android::hardware::health::V1_0::HealthInfo;
 using HealthInfo_2_0 = android::hardware::health::V2_0::HealthInfo;
 using HealthInfo_2_1 = android::hardware::health::V2_1::HealthInfo;
@@ -120,6 +128,55 @@ static std::optional<T> mapSysfsString(const char* str, SysfsStringEnumMap<T> ma
     return std::nullopt;
 }
 
+// Keeps power_supply attributes open across updates. sysfs regenerates an attribute whenever it
+// is read from offset 0, so a pread() picks up the current value without reopening the file.
+class SysfsAttributeCache {
+  public:
+    // Returns the length of the trimmed contents of |path|, or -1 if it can't be read.
+    int read(const String8& path, std::string* buf) {
+        buf->clear();
+        if (path.isEmpty()) return -1;
+
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mFds.find(path.c_str());
+        if (it != mFds.end() && readFd(it->second, buf)) {
+            return trim(buf);
+        }
+
+        // Not opened yet, or the power supply went away since. Reopen once, the attribute may
+        // belong to a device that was registered again under the same name.
+        android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+        if (fd == -1 || !readFd(fd, buf)) {
+            if (it != mFds.end()) mFds.erase(it);
+            return -1;
+        }
+        mFds[path.c_str()] = std::move(fd);
+        return trim(buf);
+    }
+
+  private:
+    static bool readFd(int fd, std::string* buf) {
+        buf->clear();
+        char chunk[256];
+        off_t offset = 0;
+        while (true) {
+            ssize_t n = TEMP_FAILURE_RETRY(pread(fd, chunk, sizeof(chunk), offset));
+            if (n < 0) return false;
+            if (n == 0) return true;
+            buf->append(chunk, n);
+            offset += n;
+        }
+    }
+
+    static int trim(std::string* buf) {
+        *buf = android::base::Trim(*buf);
+        return buf->length();
+    }
+
+    std::mutex mLock;
+    std::unordered_map<std::string, android::base::unique_fd> mFds;
+};
+
 static void initHealthInfo(HealthInfo* health_info) {
     *health_info = {
             .batteryCapacityLevel = BatteryCapacityLevel::UNSUPPORTED,
@@ -135,7 +192,12 @@ BatteryMonitor::BatteryMonitor()
       mBatteryDevicePresent(false),
       mBatteryFixedCapacity(0),
       mBatteryFixedTemperature(0),
-      mHealthInfo(std::make_unique<HealthInfo>()) {
+      mHealthInfo(std::make_unique<HealthInfo>()),
+      mHealthInfoChanged(true),
+      mBaseIntervalFast(-1),
+      mBaseIntervalSlow(-1),
+      mStableLevelUpdates(0),
+      mSysfsCache(std::make_unique<SysfsAttributeCache>()) {
     initHealthInfo(mHealthInfo.get());
 }
 
@@ -227,15 +289,11 @@ BatteryHealth getBatteryHealth(const char* status) {
     return *ret;
 }
 
-static int readFromFile(const String8& path, std::string* buf) {
-    buf->clear();
-    if (android::base::ReadFileToString(path.c_str(), buf)) {
-        *buf = android::base::Trim(*buf);
-    }
-    return buf->length();
+int BatteryMonitor::readFromFile(const String8& path, std::string* buf) {
+    return mSysfsCache->read(path, buf);
 }
 
-static BatteryMonitor::PowerSupplyType readPowerSupplyType(const String8& path) {
+BatteryMonitor::PowerSupplyType BatteryMonitor::readPowerSupplyType(const String8& path) {
     static SysfsStringEnumMap<int> supplyTypeMap[] = {
             {"Unknown", BatteryMonitor::ANDROID_POWER_SUPPLY_TYPE_UNKNOWN},
             {"Battery", BatteryMonitor::ANDROID_POWER_SUPPLY_TYPE_BATTERY},
@@ -268,7 +326,7 @@ static BatteryMonitor::PowerSupplyType readPowerSupplyType(const String8& path)
     return static_cast<BatteryMonitor::PowerSupplyType>(*ret);
 }
 
-static bool getBooleanField(const String8& path) {
+bool BatteryMonitor::getBooleanField(const String8& path) {
     std::string buf;
     bool value = false;
 
@@ -279,7 +337,7 @@ static bool getBooleanField(const String8& path) {
     return value;
 }
 
-static int getIntField(const String8& path) {
+int BatteryMonitor::getIntField(const String8& path) {
     std::string buf;
     int value = 0;
 
@@ -289,7 +347,7 @@ static int getIntField(const String8& path) {
     return value;
 }
 
-static bool isScopedPowerSupply(const char* name) {
+bool BatteryMonitor::isScopedPowerSupply(const char* name) {
     constexpr char kScopeDevice[] = "Device";
 
     String8 path;
@@ -299,6 +357,7 @@ static bool isScopedPowerSupply(const char* name) {
 }
 
 void BatteryMonitor::updateValues(void) {
+    const HealthInfo previous = *mHealthInfo;
     initHealthInfo(mHealthInfo.get());
 
     if (!mHealthdConfig->batteryPresentPath.isEmpty())
@@ -390,16 +449,17 @@ void BatteryMonitor::updateValues(void) {
             path.clear();
             path.appendFormat("%s/%s/current_max", POWER_SUPPLY_SYSFS_PATH,
                               mChargerNames[i].string());
-            int ChargingCurrent =
-                    (access(path.string(), R_OK) == 0) ? getIntField(path) : 0;
+            int ChargingCurrent = getIntField(path);
 
             path.clear();
             path.appendFormat("%s/%s/voltage_max", POWER_SUPPLY_SYSFS_PATH,
                               mChargerNames[i].string());
 
-            int ChargingVoltage =
-                (access(path.string(), R_OK) == 0) ? getIntField(path) :
-                DEFAULT_VBUS_VOLTAGE;
+            int ChargingVoltage = 0;
+            if (readFromFile(path, &buf) < 0)
+                ChargingVoltage = DEFAULT_VBUS_VOLTAGE;
+            else
+                android::base::ParseInt(buf, &ChargingVoltage);
 
             double power = ((double)ChargingCurrent / MILLION) *
                            ((double)ChargingVoltage / MILLION);
@@ -410,6 +470,48 @@ void BatteryMonitor::updateValues(void) {
             }
         }
     }
+
+    mHealthInfoChanged = !(previous == *mHealthInfo);
+
+    if (mHealthInfo->batteryLevel == previous.batteryLevel)
+        mStableLevelUpdates++;
+    else
+        mStableLevelUpdates = 0;
+    adjustPeriodicChores();
+}
+
+void BatteryMonitor::adjustPeriodicChores() {
+    if (!mHealthdConfig->adaptive_periodic_chores || !mHealthInfo->batteryPresent) return;
+
+    const HealthInfo& props = *mHealthInfo;
+    const bool charging = props.batteryStatus == BatteryStatus::CHARGING;
+    const bool highCurrent = abs(props.batteryCurrentMicroamps) >= ADAPTIVE_HIGH_CURRENT_UA;
+    const bool idleCurrent = !mHealthdConfig->batteryCurrentNowPath.isEmpty() &&
+                             abs(props.batteryCurrentMicroamps) < ADAPTIVE_IDLE_CURRENT_UA;
+
+    // The fast interval applies while a charger is online: watch closely near the end of the
+    // charge, where the charger tapers off, and at high charge currents.
+    int fast = mBaseIntervalFast;
+    if (fast > 0 && charging && (props.batteryLevel >= ADAPTIVE_NEAR_FULL_LEVEL || highCurrent))
+        fast = std::max(fast / 2, 1);
+
+    // The slow interval applies in suspend on battery. Each update that sees the level unchanged
+    // at an idle current draw doubles it, up to 4 times the configured value.
+    int slow = mBaseIntervalSlow;
+    if (slow > 0 && !charging) {
+        if (highCurrent) {
+            slow = std::max(slow / 2, 1);
+        } else if (idleCurrent && mStableLevelUpdates > 0) {
+            slow <<= std::min(mStableLevelUpdates, ADAPTIVE_MAX_STRETCH_SHIFT);
+        }
+    }
+
+    mHealthdConfig->periodic_chores_interval_fast = fast;
+    mHealthdConfig->periodic_chores_interval_slow = slow;
+}
+
+bool BatteryMonitor::healthInfoChanged() const {
+    return mHealthInfoChanged;
 }
 
 static void doLogValues(const HealthInfo& props, const struct healthd_config& healthd_config) {
@@ -812,6 +914,9 @@ void BatteryMonitor::init(struct healthd_config *hc) {
             KLOG_WARNING(LOG_TAG, "batteryFullChargeDesignCapacityUahPath. not found\n");
     }
 
+    mBaseIntervalFast = hc->periodic_chores_interval_fast;
+    mBaseIntervalSlow = hc->periodic_chores_interval_slow;
+
     if (property_get("ro.boot.fake_battery", pval, NULL) > 0
                                                && strtol(pval, NULL, 10) != 0) {
         mBatteryFixedCapacity = FAKE_BATTERY_CAPACITY;
@@ -55,6 +55,26 @@ static int get_split_offset() {
     return static_cast<int>(value);
 }
 
+static bool has_font(const animation::text_field& field) {
+    return field.font != nullptr && field.font->char_width != 0 && field.font->char_height != 0;
+}
+
+// Battery level shown by draw_percent().
+static int displayed_level(const animation* anim) {
+    return anim->cur_status == BATTERY_STATUS_FULL ? 100 : anim->cur_level;
+}
+
+static constexpr char CLOCK_FORMAT[] = "%H:%M";
+static constexpr int CLOCK_LENGTH = 6;
+
+// Returns false if the time can't be formatted.
+static bool format_clock(char (&clock_str)[CLOCK_LENGTH]) {
+    time_t rawtime;
+    time(&rawtime);
+    tm* time_info = localtime(&rawtime);
+    return strftime(clock_str, CLOCK_LENGTH, CLOCK_FORMAT, time_info) == CLOCK_LENGTH - 1;
+}
+
 HealthdDraw::HealthdDraw(animation* anim)
     : kSplitScreen(get_split_screen()), kSplitOffset(get_split_offset()) {
     graphics_available = true;
@@ -83,11 +103,29 @@ HealthdDraw::~HealthdDraw() {}
 
 void HealthdDraw::redraw_screen(const animation* batt_anim, GRSurface* surf_unknown) {
     if (!graphics_available) return;
+
+    drawn_state state;
+    state.valid = true;
+    state.unknown = batt_anim->cur_status == BATTERY_STATUS_UNKNOWN ||
+                    batt_anim->cur_level < 0 || batt_anim->num_frames == 0;
+    if (state.unknown) {
+        state.surface = surf_unknown;
+    } else {
+        state.surface = batt_anim->frames[batt_anim->cur_frame].surface;
+        state.percent = displayed_level(batt_anim);
+        char clock_str[CLOCK_LENGTH];
+        if (has_font(batt_anim->text_clock) && format_clock(clock_str)) state.clock = clock_str;
+    }
+    if (state == drawn_) {
+        LOGV("frame unchanged, skipping redraw\n");
+        return;
+    }
+    drawn_ = state;
+
     clear_screen();
 
     /* try to display *something* */
-    if (batt_anim->cur_status == BATTERY_STATUS_UNKNOWN || batt_anim->cur_level < 0 ||
-        batt_anim->num_frames == 0)
+    if (state.unknown)
         draw_unknown(surf_unknown);
     else
         draw_battery(batt_anim);
@@ -96,12 +134,14 @@ void HealthdDraw::redraw_screen(const animation* batt_anim, GRSurface* surf_unkn
 
 void HealthdDraw::blank_screen(bool blank, int drm) {
     if (!graphics_available) return;
+    drawn_.valid = false;
     gr_fb_blank(blank, drm);
 }
 
 /* support screen rotation for foldable phone */
 void HealthdDraw::rotate_screen(int drm) {
     if (!graphics_available) return;
+    drawn_.valid = false;
     if (drm == 0)
         gr_rotate(GRRotation::RIGHT /* landscape mode */);
     else
@@ -172,25 +212,16 @@ void HealthdDraw::determine_xy(const animation::text_field& field,
 }
 
 void HealthdDraw::draw_clock(const animation* anim) {
-    static constexpr char CLOCK_FORMAT[] = "%H:%M";
-    static constexpr int CLOCK_LENGTH = 6;
-
     const animation::text_field& field = anim->text_clock;
 
-    if (!graphics_available || field.font == nullptr || field.font->char_width == 0 ||
-        field.font->char_height == 0)
-        return;
-
-    time_t rawtime;
-    time(&rawtime);
-    tm* time_info = localtime(&rawtime);
+    if (!graphics_available || !has_font(field)) return;
 
     char clock_str[CLOCK_LENGTH];
-    size_t length = strftime(clock_str, CLOCK_LENGTH, CLOCK_FORMAT, time_info);
-    if (length != CLOCK_LENGTH - 1) {
+    if (!format_clock(clock_str)) {
         LOGE("Could not format time\n");
         return;
     }
+    const size_t length = CLOCK_LENGTH - 1;
 
     int x, y;
     determine_xy(field, length, &x, &y);
@@ -202,15 +233,11 @@ void HealthdDraw::draw_clock(const animation* anim) {
 
 void HealthdDraw::draw_percent(const animation* anim) {
     if (!graphics_available) return;
-    int cur_level = anim->cur_level;
-    if (anim->cur_status == BATTERY_STATUS_FULL) {
-        cur_level = 100;
-    }
-
+    int cur_level = displayed_level(anim);
     if (cur_level < 0) return;
 
     const animation::text_field& field = anim->text_percent;
-    if (field.font == nullptr || field.font->char_width == 0 || field.font->char_height == 0) {
+    if (!has_font(field)) {
         return;
     }
 
@@ -20,6 +20,8 @@
 #include <linux/input.h>
 #include <minui/minui.h>
 
+#include <string>
+
 #include "animation.h"
 
 using namespace android;
@@ -28,7 +30,8 @@ class HealthdDraw {
  public:
   virtual ~HealthdDraw();
 
-  // Redraws screen.
+  // Redraws screen. Does nothing if the screen already shows the same frame, percentage and
+  // clock, so repeated frames don't cost a clear, blit and flip.
   void redraw_screen(const animation* batt_anim, GRSurface* surf_unknown);
 
   // According to the index of Direct Rendering Manager,
@@ -84,6 +87,21 @@ class HealthdDraw {
  private:
   // Configures font using given animation.
   HealthdDraw(animation* anim);
+
+  // Content put on screen by the last redraw_screen().
+  struct drawn_state {
+    bool valid = false;
+    bool unknown = false;
+    const GRSurface* surface = nullptr;
+    int percent = -1;
+    std::string clock;
+
+    bool operator==(const drawn_state& other) const {
+      return valid == other.valid && unknown == other.unknown && surface == other.surface &&
+             percent == other.percent && clock == other.clock;
+    }
+  };
+  drawn_state drawn_;
 };
 
 #endif  // HEALTHD_DRAW_H
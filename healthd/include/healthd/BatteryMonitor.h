@@ -18,6 +18,7 @@
 #define HEALTHD_BATTERYMONITOR_H
 
 #include <memory>
+#include <string>
 
 #include <batteryservice/BatteryService.h>
 #include <utils/String8.h>
@@ -30,6 +31,9 @@ class HealthInfo;
 }  // namespace aidl::android::hardware::health
 
 namespace android {
+
+class SysfsAttributeCache;
+
 namespace hardware {
 namespace health {
 namespace V1_0 {
@@ -69,6 +73,9 @@ class BatteryMonitor {
     const aidl::android::hardware::health::HealthInfo& getHealthInfo() const;
 
     void updateValues(void);
+    // Whether the last updateValues() changed the health info, so that callers can skip
+    // publishing an unchanged one.
+    bool healthInfoChanged() const;
     void logValues(void);
     bool isChargerOnline();
 
@@ -76,12 +83,24 @@ class BatteryMonitor {
                           const struct healthd_config& healthd_config);
 
   private:
+    int readFromFile(const String8& path, std::string* buf);
+    PowerSupplyType readPowerSupplyType(const String8& path);
+    bool getBooleanField(const String8& path);
+    int getIntField(const String8& path);
+    bool isScopedPowerSupply(const char* name);
+    void adjustPeriodicChores();
+
     struct healthd_config *mHealthdConfig;
     Vector<String8> mChargerNames;
     bool mBatteryDevicePresent;
     int mBatteryFixedCapacity;
     int mBatteryFixedTemperature;
     std::unique_ptr<aidl::android::hardware::health::HealthInfo> mHealthInfo;
+    bool mHealthInfoChanged;
+    int mBaseIntervalFast;
+    int mBaseIntervalSlow;
+    int mStableLevelUpdates;
+    std::unique_ptr<SysfsAttributeCache> mSysfsCache;
 };
 
 }; // namespace android
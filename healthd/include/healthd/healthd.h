@@ -38,6 +38,13 @@
 //    remaining capacity).  The default value is 600 (10 minutes).  Value -1
 //    tuns off periodic chores (and wakeups) in these conditions.
 //
+// adaptive_periodic_chores: when true, BatteryMonitor rescales the two
+// intervals above after every update.  The slow interval is stretched up to
+// 4x while the battery level holds steady at a low current draw, and halved
+// under a high current draw.  The fast interval is halved while charging
+// close to full or at a high current.  The configured values are used as the
+// base and restored whenever none of these applies.
+//
 // power_supply sysfs attribute file paths.  Set these to specific paths
 // to use for the associated battery parameters.  healthd will search for
 // appropriate power_supply attribute files to use for any paths left empty:
@@ -77,6 +84,7 @@ struct healthd_config {
     int boot_min_cap;
     bool (*screen_on)(android::BatteryProperties *props);
     std::vector<android::String8> ignorePowerSupplyNames;
+    bool adaptive_periodic_chores;
 };
 
 enum EventWakeup {
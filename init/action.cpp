@@ -21,8 +21,10 @@
 #include <android-base/properties.h>
 #include <android-base/strings.h>
 
+#include "boot_trace.h"
 #include "util.h"
 
+using android::base::boot_clock;
 using android::base::Join;
 
 namespace android {
@@ -143,24 +145,84 @@ size_t Action::CheckAllCommands() const {
     return failures;
 }
 
-void Action::ExecuteOneCommand(std::size_t command) const {
+std::size_t Action::ExecuteCommands(std::size_t command) const {
     // We need a copy here since some Command execution may result in
     // changing commands_ vector by importing .rc files through parser
-    Command cmd = commands_[command];
-    ExecuteCommand(cmd);
+    std::vector<Command> commands;
+    commands.emplace_back(commands_[command]);
+    if (subcontext_ && commands.front().execute_in_subcontext()) {
+        for (auto i = command + 1; i < commands_.size() && commands_[i].execute_in_subcontext();
+             ++i) {
+            commands.emplace_back(commands_[i]);
+        }
+    }
+
+    if (commands.size() == 1) {
+        ExecuteCommand(commands.front());
+        return 1;
+    }
+    return ExecuteSubcontextCommands(commands);
 }
 
 void Action::ExecuteAllCommands() const {
-    for (const auto& c : commands_) {
-        ExecuteCommand(c);
+    for (std::size_t i = 0; i < commands_.size();) {
+        i += ExecuteCommands(i);
     }
 }
 
 void Action::ExecuteCommand(const Command& command) const {
-    android::base::Timer t;
+    auto start = boot_clock::now();
     auto result = command.InvokeFunc(subcontext_);
-    auto duration = t.duration();
+    auto duration =
+            std::chrono::duration_cast<std::chrono::microseconds>(boot_clock::now() - start);
+    LogCommandResult(command, result,
+                     std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+
+    bool subcontext = subcontext_ && command.execute_in_subcontext();
+    TraceCommand(command, start, duration, subcontext);
+    if (subcontext) {
+        BootTrace::GetInstance().Record({TraceEventType::kSubcontextRoundTrip, "1 command",
+                                         filename_ + ":" + std::to_string(command.line()), start,
+                                         duration, true});
+    }
+}
+
+void Action::TraceCommand(const Command& command, boot_clock::time_point start,
+                          std::chrono::microseconds duration, bool subcontext) const {
+    BootTrace::GetInstance().Record({TraceEventType::kCommand, command.BuildCommandString(),
+                                     filename_ + ":" + std::to_string(command.line()), start,
+                                     duration, subcontext});
+}
+
+// Each command of a vendor action costs a round trip to the subcontext, so runs of them are sent
+// together, and their results are reported as if they had been executed one by one.
+std::size_t Action::ExecuteSubcontextCommands(const std::vector<Command>& commands) const {
+    std::vector<std::vector<std::string>> args;
+    for (const auto& command : commands) {
+        args.emplace_back(command.args());
+    }
+
+    auto start = boot_clock::now();
+    auto results = subcontext_->ExecuteBatch(args);
+    auto duration = boot_clock::now() - start;
+
+    // The subcontext only reports how long each command took, so they are traced back to back
+    // from the start of the round trip.
+    auto command_start = start;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        LogCommandResult(commands[i], results[i].result, results[i].duration);
+        TraceCommand(commands[i], command_start, results[i].duration, true);
+        command_start += results[i].duration;
+    }
+    BootTrace::GetInstance().Record(
+            {TraceEventType::kSubcontextRoundTrip, std::to_string(results.size()) + " commands",
+             filename_ + ":" + std::to_string(commands.front().line()), start,
+             std::chrono::duration_cast<std::chrono::microseconds>(duration), true});
+    return results.size();
+}
 
+void Action::LogCommandResult(const Command& command, const Result<void>& result,
+                              std::chrono::milliseconds duration) const {
     // Any action longer than 50ms will be warned to user as slow operation
     if (!result.has_value() || duration > 50ms ||
         android::base::GetMinimumLogSeverity() <= android::base::DEBUG) {
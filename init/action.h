@@ -16,12 +16,14 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <queue>
 #include <string>
 #include <variant>
 #include <vector>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/strings.h>
 
 #include "builtins.h"
@@ -45,6 +47,8 @@ class Command {
     Result<void> CheckCommand() const;
 
     int line() const { return line_; }
+    bool execute_in_subcontext() const { return execute_in_subcontext_; }
+    const std::vector<std::string>& args() const { return args_; }
 
   private:
     BuiltinFunction func_;
@@ -66,7 +70,9 @@ class Action {
     Result<void> AddCommand(std::vector<std::string>&& args, int line);
     void AddCommand(BuiltinFunction f, std::vector<std::string>&& args, int line);
     size_t NumCommands() const;
-    void ExecuteOneCommand(std::size_t command) const;
+    // Executes |command| along with the subcontext commands that directly follow it, as many as
+    // the subcontext runs in one round trip. Returns the number of commands executed.
+    std::size_t ExecuteCommands(std::size_t command) const;
     void ExecuteAllCommands() const;
     bool CheckEvent(const EventTrigger& event_trigger) const;
     bool CheckEvent(const PropertyChange& property_change) const;
@@ -76,6 +82,10 @@ class Action {
     size_t CheckAllCommands() const;
 
     bool oneshot() const { return oneshot_; }
+    const std::string& event_trigger() const { return event_trigger_; }
+    const std::map<std::string, std::string>& property_triggers() const {
+        return property_triggers_;
+    }
     const std::string& filename() const { return filename_; }
     int line() const { return line_; }
     static void set_function_map(const BuiltinFunctionMap* function_map) {
@@ -85,6 +95,11 @@ class Action {
 
   private:
     void ExecuteCommand(const Command& command) const;
+    void TraceCommand(const Command& command, android::base::boot_clock::time_point start,
+                      std::chrono::microseconds duration, bool subcontext) const;
+    std::size_t ExecuteSubcontextCommands(const std::vector<Command>& commands) const;
+    void LogCommandResult(const Command& command, const Result<void>& result,
+                          std::chrono::milliseconds duration) const;
     bool CheckPropertyTriggers(const std::string& name = "",
                                const std::string& value = "") const;
 
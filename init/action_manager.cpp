@@ -18,6 +18,10 @@
 
 #include <android-base/logging.h>
 
+#include "boot_trace.h"
+
+using android::base::boot_clock;
+
 namespace android {
 namespace init {
 
@@ -37,9 +41,90 @@ ActionManager& ActionManager::GetInstance() {
 }
 
 void ActionManager::AddAction(std::unique_ptr<Action> action) {
+    IndexAction(action.get());
     actions_.emplace_back(std::move(action));
 }
 
+void ActionManager::IndexAction(const Action* action) {
+    event_trigger_index_[action->event_trigger()].emplace_back(action);
+    if (!action->event_trigger().empty()) {
+        return;
+    }
+    if (action->property_triggers().empty()) {
+        num_untriggered_actions_++;
+    }
+    for (const auto& [name, value] : action->property_triggers()) {
+        property_trigger_index_[name].emplace_back(action);
+    }
+}
+
+void ActionManager::UnindexAction(const Action* action) {
+    auto erase_from = [action](auto* index, const std::string& key) {
+        auto it = index->find(key);
+        if (it == index->end()) {
+            return;
+        }
+        auto& candidates = it->second;
+        candidates.erase(std::remove(candidates.begin(), candidates.end(), action),
+                         candidates.end());
+        if (candidates.empty()) {
+            index->erase(it);
+        }
+    };
+
+    erase_from(&event_trigger_index_, action->event_trigger());
+    if (!action->event_trigger().empty()) {
+        return;
+    }
+    if (action->property_triggers().empty()) {
+        num_untriggered_actions_--;
+    }
+    for (const auto& [name, value] : action->property_triggers()) {
+        erase_from(&property_trigger_index_, name);
+    }
+}
+
+void ActionManager::RebuildIndexes() {
+    event_trigger_index_.clear();
+    property_trigger_index_.clear();
+    num_untriggered_actions_ = 0;
+    for (const auto& action : actions_) {
+        IndexAction(action.get());
+    }
+}
+
+std::vector<const Action*> ActionManager::MatchingActions(const Event& event) const {
+    std::vector<const Action*> matches;
+    auto check_candidates = [&matches](const auto& index, const std::string& key,
+                                       const auto& candidate_event) {
+        if (auto it = index.find(key); it != index.end()) {
+            for (const auto* action : it->second) {
+                if (action->CheckEvent(candidate_event)) {
+                    matches.emplace_back(action);
+                }
+            }
+        }
+    };
+
+    if (auto trigger = std::get_if<EventTrigger>(&event)) {
+        check_candidates(event_trigger_index_, *trigger, *trigger);
+        return matches;
+    }
+    if (auto change = std::get_if<PropertyChange>(&event);
+        change && !change->first.empty() && !num_untriggered_actions_) {
+        check_candidates(property_trigger_index_, change->first, *change);
+        return matches;
+    }
+
+    // QueueAllPropertyActions() and builtin actions are rare enough to check every action.
+    for (const auto& action : actions_) {
+        if (std::visit([&action](const auto& e) { return action->CheckEvent(e); }, event)) {
+            matches.emplace_back(action.get());
+        }
+    }
+    return matches;
+}
+
 void ActionManager::QueueEventTrigger(const std::string& trigger) {
     auto lock = std::lock_guard{event_queue_lock_};
     event_queue_.emplace(trigger);
@@ -60,6 +145,7 @@ void ActionManager::QueueBuiltinAction(BuiltinFunction func, const std::string&
                                            std::map<std::string, std::string>{});
     action->AddCommand(std::move(func), {name}, 0);
 
+    IndexAction(action.get());
     event_queue_.emplace(action.get());
     actions_.emplace_back(std::move(action));
 }
@@ -69,11 +155,8 @@ void ActionManager::ExecuteOneCommand() {
         auto lock = std::lock_guard{event_queue_lock_};
         // Loop through the event queue until we have an action to execute
         while (current_executing_actions_.empty() && !event_queue_.empty()) {
-            for (const auto& action : actions_) {
-                if (std::visit([&action](const auto& event) { return action->CheckEvent(event); },
-                               event_queue_.front())) {
-                    current_executing_actions_.emplace(action.get());
-                }
+            for (const auto* action : MatchingActions(event_queue_.front())) {
+                current_executing_actions_.emplace(action);
             }
             event_queue_.pop();
         }
@@ -89,18 +172,24 @@ void ActionManager::ExecuteOneCommand() {
         std::string trigger_name = action->BuildTriggersString();
         LOG(INFO) << "processing action (" << trigger_name << ") from (" << action->filename()
                   << ":" << action->line() << ")";
+        current_action_started_ = boot_clock::now();
     }
 
-    action->ExecuteOneCommand(current_command_);
+    current_command_ += action->ExecuteCommands(current_command_);
 
     // If this was the last command in the current action, then remove
     // the action from the executing list.
     // If this action was oneshot, then also remove it from actions_.
-    ++current_command_;
     if (current_command_ == action->NumCommands()) {
+        BootTrace::GetInstance().Record(
+                {TraceEventType::kAction, action->BuildTriggersString(),
+                 action->filename() + ":" + std::to_string(action->line()), current_action_started_,
+                 std::chrono::duration_cast<std::chrono::microseconds>(boot_clock::now() -
+                                                                       current_action_started_)});
         current_executing_actions_.pop();
         current_command_ = 0;
         if (action->oneshot()) {
+            UnindexAction(action);
             auto eraser = [&action](std::unique_ptr<Action>& a) { return a.get() == action; };
             actions_.erase(std::remove_if(actions_.begin(), actions_.end(), eraser),
                            actions_.end());
@@ -18,6 +18,7 @@
 
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/thread_annotations.h>
@@ -30,16 +31,21 @@ namespace init {
 
 class ActionManager {
   public:
+    using Event = std::variant<EventTrigger, PropertyChange, BuiltinAction>;
+
     static ActionManager& GetInstance();
 
     // Exposed for testing
     ActionManager();
     size_t CheckAllCommands();
+    // Returns the actions that |event| triggers, in the order they were added.
+    std::vector<const Action*> MatchingActions(const Event& event) const;
 
     void AddAction(std::unique_ptr<Action> action);
     template <class UnaryPredicate>
     void RemoveActionIf(UnaryPredicate predicate) {
         actions_.erase(std::remove_if(actions_.begin(), actions_.end(), predicate), actions_.end());
+        RebuildIndexes();
     }
     void QueueEventTrigger(const std::string& trigger);
     void QueuePropertyChange(const std::string& name, const std::string& value);
@@ -54,12 +60,23 @@ class ActionManager {
     ActionManager(ActionManager const&) = delete;
     void operator=(ActionManager const&) = delete;
 
+    void IndexAction(const Action* action);
+    void UnindexAction(const Action* action);
+    void RebuildIndexes();
+
     std::vector<std::unique_ptr<Action>> actions_;
-    std::queue<std::variant<EventTrigger, PropertyChange, BuiltinAction>> event_queue_
-            GUARDED_BY(event_queue_lock_);
+    // Candidate actions for each event trigger and, for actions without an event trigger, for
+    // each property they trigger on. Each list is kept in the same order as actions_, so that
+    // dispatching an event only has to look at the actions it could trigger.
+    std::unordered_map<std::string, std::vector<const Action*>> event_trigger_index_;
+    std::unordered_map<std::string, std::vector<const Action*>> property_trigger_index_;
+    // Actions with neither kind of trigger match any property change.
+    size_t num_untriggered_actions_ = 0;
+    std::queue<Event> event_queue_ GUARDED_BY(event_queue_lock_);
     mutable std::mutex event_queue_lock_;
     std::queue<const Action*> current_executing_actions_;
     std::size_t current_command_;
+    android::base::boot_clock::time_point current_action_started_;
 };
 
 }  // namespace init
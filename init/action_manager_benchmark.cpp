@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "action_manager.h"
+#include "action_parser.h"
+#include "parser.h"
+
+namespace android {
+namespace init {
+
+// Consumes a section without doing anything with it, so that its lines are not parsed as
+// commands of the preceding action.
+class IgnoredSectionParser : public SectionParser {
+  public:
+    Result<void> ParseSection(std::vector<std::string>&&, const std::string&, int) override {
+        return {};
+    }
+};
+
+// Loads the actions of the device's own init scripts, skipping services and imports.
+static bool LoadSystemActions(ActionManager* action_manager) {
+    Action::set_function_map(&GetBuiltinFunctionMap());
+
+    Parser parser;
+    parser.AddSectionParser("on", std::make_unique<ActionParser>(action_manager, nullptr));
+    parser.AddSectionParser("service", std::make_unique<IgnoredSectionParser>());
+    parser.AddSectionParser("import", std::make_unique<IgnoredSectionParser>());
+    bool loaded = parser.ParseConfig("/system/etc/init/hw/init.rc");
+    for (const auto& dir : {"/system/etc/init", "/vendor/etc/init", "/odm/etc/init"}) {
+        loaded |= parser.ParseConfig(dir);
+    }
+    return loaded;
+}
+
+static void BenchmarkEventTriggers(benchmark::State& state) {
+    ActionManager action_manager;
+    if (!LoadSystemActions(&action_manager)) {
+        state.SkipWithError("No init scripts found");
+        return;
+    }
+
+    const std::vector<EventTrigger> triggers = {
+            "early-init", "init", "late-init", "post-fs", "post-fs-data", "zygote-start", "boot",
+            "nonexistent",
+    };
+    size_t matches = 0;
+    while (state.KeepRunning()) {
+        for (const auto& trigger : triggers) {
+            matches += action_manager.MatchingActions(trigger).size();
+        }
+    }
+    benchmark::DoNotOptimize(matches);
+    state.SetItemsProcessed(state.iterations() * triggers.size());
+}
+
+BENCHMARK(BenchmarkEventTriggers);
+
+static void BenchmarkPropertyChanges(benchmark::State& state) {
+    ActionManager action_manager;
+    if (!LoadSystemActions(&action_manager)) {
+        state.SkipWithError("No init scripts found");
+        return;
+    }
+
+    // Properties nothing triggers on are by far the most common changes.
+    const std::vector<PropertyChange> changes = {
+            {"sys.boot_completed", "1"},
+            {"vold.decrypt", "trigger_restart_framework"},
+            {"persist.sys.usb.config", "adb"},
+            {"init.svc.nonexistent", "running"},
+            {"ro.nonexistent", "1"},
+    };
+    size_t matches = 0;
+    while (state.KeepRunning()) {
+        for (const auto& change : changes) {
+            matches += action_manager.MatchingActions(change).size();
+        }
+    }
+    benchmark::DoNotOptimize(matches);
+    state.SetItemsProcessed(state.iterations() * changes.size());
+}
+
+BENCHMARK(BenchmarkPropertyChanges);
+
+}  // namespace init
+}  // namespace android
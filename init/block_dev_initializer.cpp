@@ -30,6 +30,7 @@ namespace init {
 
 using android::base::Timer;
 using namespace std::chrono_literals;
+using namespace std::string_literals;
 
 BlockDevInitializer::BlockDevInitializer() : uevent_listener_(16 * 1024 * 1024) {
     auto boot_devices = android::fs_mgr::GetBootDevices();
@@ -39,45 +40,60 @@ BlockDevInitializer::BlockDevInitializer() : uevent_listener_(16 * 1024 * 1024)
 }
 
 bool BlockDevInitializer::InitDeviceMapper() {
-    return InitMiscDevice("device-mapper");
+    return InitDeviceSet({.misc_devices = {"device-mapper"}});
 }
 
 bool BlockDevInitializer::InitDmUser(const std::string& name) {
-    return InitMiscDevice("dm-user!" + name);
+    return InitDeviceSet({.misc_devices = {"dm-user!" + name}});
 }
 
-bool BlockDevInitializer::InitMiscDevice(const std::string& name) {
-    const std::string dm_path = "/devices/virtual/misc/" + name;
-    bool found = false;
-    auto dm_callback = [this, &dm_path, &found](const Uevent& uevent) {
-        if (uevent.path == dm_path) {
-            device_handler_->HandleUevent(uevent);
-            found = true;
-            return ListenerAction::kStop;
+bool BlockDevInitializer::InitDevices(std::set<std::string> devices) {
+    return InitDeviceSet({.partitions = std::move(devices)});
+}
+
+// Creates "/dev/block/dm-XX" for dm nodes by running coldboot on /sys/block/dm-XX.
+bool BlockDevInitializer::InitDmDevice(const std::string& device) {
+    return InitDeviceSet({.dm_devices = {device}});
+}
+
+static bool IsEmpty(const DeviceSet& devices) {
+    return devices.misc_devices.empty() && devices.partitions.empty() &&
+           devices.dm_devices.empty();
+}
+
+static std::string Describe(const DeviceSet& devices) {
+    std::vector<std::string> names(devices.misc_devices.begin(), devices.misc_devices.end());
+    names.insert(names.end(), devices.partitions.begin(), devices.partitions.end());
+    names.insert(names.end(), devices.dm_devices.begin(), devices.dm_devices.end());
+    return android::base::Join(names, ", ");
+}
+
+ListenerAction BlockDevInitializer::HandleUevent(const Uevent& uevent, DeviceSet* devices) {
+    static constexpr std::string_view kMiscDevicesPath = "/devices/virtual/misc/";
+    if (android::base::StartsWith(uevent.path, kMiscDevicesPath)) {
+        auto iter = devices->misc_devices.find(uevent.path.substr(kMiscDevicesPath.size()));
+        if (iter == devices->misc_devices.end()) {
+            return ListenerAction::kContinue;
         }
-        return ListenerAction::kContinue;
-    };
-    uevent_listener_.RegenerateUeventsForPath("/sys" + dm_path, dm_callback);
-    if (!found) {
-        LOG(INFO) << name << " device not found in /sys, waiting for its uevent";
-        Timer t;
-        uevent_listener_.Poll(dm_callback, 10s);
-        LOG(INFO) << "Wait for " << name << " returned after " << t;
+        devices->misc_devices.erase(iter);
+        device_handler_->HandleUevent(uevent);
+        return IsEmpty(*devices) ? ListenerAction::kStop : ListenerAction::kContinue;
     }
-    if (!found) {
-        LOG(ERROR) << name << " device not found after polling timeout";
-        return false;
-    }
-    return true;
-}
 
-ListenerAction BlockDevInitializer::HandleUevent(const Uevent& uevent,
-                                                 std::set<std::string>* devices) {
-    // Ignore everything that is not a block device.
+    // Ignore everything else that is not a block device.
     if (uevent.subsystem != "block") {
         return ListenerAction::kContinue;
     }
 
+    for (auto iter = devices->dm_devices.begin(); iter != devices->dm_devices.end(); ++iter) {
+        if (uevent.device_name == basename(iter->c_str())) {
+            LOG(VERBOSE) << "Creating device-mapper device : " << *iter;
+            devices->dm_devices.erase(iter);
+            device_handler_->HandleUevent(uevent);
+            return IsEmpty(*devices) ? ListenerAction::kStop : ListenerAction::kContinue;
+        }
+    }
+
     auto name = uevent.partition_name;
     if (name.empty()) {
         size_t base_idx = uevent.path.rfind('/');
@@ -87,74 +103,69 @@ ListenerAction BlockDevInitializer::HandleUevent(const Uevent& uevent,
         name = uevent.path.substr(base_idx + 1);
     }
 
-    auto iter = devices->find(name);
-    if (iter == devices->end()) {
+    auto iter = devices->partitions.find(name);
+    if (iter == devices->partitions.end()) {
         auto partition_name = DeviceHandler::GetPartitionNameForDevice(uevent.device_name);
         if (!partition_name.empty()) {
-            iter = devices->find(partition_name);
+            iter = devices->partitions.find(partition_name);
         }
-        if (iter == devices->end()) {
+        if (iter == devices->partitions.end()) {
             return ListenerAction::kContinue;
         }
     }
 
     LOG(VERBOSE) << __PRETTY_FUNCTION__ << ": found partition: " << name;
 
-    devices->erase(iter);
+    devices->partitions.erase(iter);
     device_handler_->HandleUevent(uevent);
-    return devices->empty() ? ListenerAction::kStop : ListenerAction::kContinue;
+    return IsEmpty(*devices) ? ListenerAction::kStop : ListenerAction::kContinue;
 }
 
-bool BlockDevInitializer::InitDevices(std::set<std::string> devices) {
+bool BlockDevInitializer::InitDeviceSet(DeviceSet devices, std::chrono::milliseconds timeout) {
     auto uevent_callback = [&, this](const Uevent& uevent) -> ListenerAction {
         return HandleUevent(uevent, &devices);
     };
-    uevent_listener_.RegenerateUevents(uevent_callback);
 
-    // UeventCallback() will remove found partitions from |devices|. So if it
-    // isn't empty here, it means some partitions are not found.
-    if (!devices.empty()) {
-        LOG(INFO) << __PRETTY_FUNCTION__
-                  << ": partition(s) not found in /sys, waiting for their uevent(s): "
-                  << android::base::Join(devices, ", ");
-        Timer t;
-        uevent_listener_.Poll(uevent_callback, 10s);
-        LOG(INFO) << "Wait for partitions returned after " << t;
+    // Misc and dm devices have a known path in /sys, so only their own uevents are regenerated.
+    // Partitions may be anywhere under the block devices, which needs a walk of all of /sys.
+    std::vector<std::string> sys_paths;
+    for (const auto& name : devices.misc_devices) {
+        sys_paths.emplace_back("/sys/devices/virtual/misc/" + name);
     }
-
-    if (!devices.empty()) {
-        LOG(ERROR) << __PRETTY_FUNCTION__ << ": partition(s) not found after polling timeout: "
-                   << android::base::Join(devices, ", ");
-        return false;
+    for (const auto& device : devices.dm_devices) {
+        sys_paths.emplace_back("/sys/block/"s + basename(device.c_str()));
     }
-    return true;
-}
-
-// Creates "/dev/block/dm-XX" for dm nodes by running coldboot on /sys/block/dm-XX.
-bool BlockDevInitializer::InitDmDevice(const std::string& device) {
-    const std::string device_name(basename(device.c_str()));
-    const std::string syspath = "/sys/block/" + device_name;
-    bool found = false;
-
-    auto uevent_callback = [&device_name, &device, this, &found](const Uevent& uevent) {
-        if (uevent.device_name == device_name) {
-            LOG(VERBOSE) << "Creating device-mapper device : " << device;
-            device_handler_->HandleUevent(uevent);
-            found = true;
-            return ListenerAction::kStop;
+    for (const auto& sys_path : sys_paths) {
+        if (uevent_listener_.RegenerateUeventsForPath(sys_path, uevent_callback) ==
+            ListenerAction::kStop) {
+            return true;
         }
-        return ListenerAction::kContinue;
-    };
+    }
+    if (!devices.partitions.empty()) {
+        std::vector<std::string> uevent_paths;
+        if (uevent_listener_.RegenerateUevents(uevent_callback, &uevent_paths) ==
+            ListenerAction::kContinue) {
+            // The walk covered all of /sys, so ueventd may poke these instead of walking it again.
+            if (auto result = WriteUeventPaths(kColdbootUeventPathsFile, uevent_paths);
+                !result.ok()) {
+                LOG(WARNING) << result.error();
+            }
+        }
+    }
 
-    uevent_listener_.RegenerateUeventsForPath(syspath, uevent_callback);
-    if (!found) {
-        LOG(INFO) << "dm device '" << device << "' not found in /sys, waiting for its uevent";
+    // HandleUevent() removes the devices it finds, so any left here are not in /sys yet.
+    if (!IsEmpty(devices)) {
+        LOG(INFO) << __PRETTY_FUNCTION__
+                  << ": device(s) not found in /sys, waiting for their uevent(s): "
+                  << Describe(devices);
         Timer t;
-        uevent_listener_.Poll(uevent_callback, 10s);
-        LOG(INFO) << "wait for dm device '" << device << "' returned after " << t;
+        uevent_listener_.Poll(uevent_callback, timeout);
+        LOG(INFO) << "Wait for devices returned after " << t;
     }
-    if (!found) {
-        LOG(ERROR) << "dm device '" << device << "' not found after polling timeout";
+
+    if (!IsEmpty(devices)) {
+        LOG(ERROR) << __PRETTY_FUNCTION__ << ": device(s) not found after polling timeout: "
+                   << Describe(devices);
         return false;
     }
     return true;
@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <set>
 #include <string>
@@ -24,6 +25,16 @@
 namespace android {
 namespace init {
 
+// The devices that BlockDevInitializer::InitDeviceSet() creates.
+struct DeviceSet {
+    // Misc devices, such as "device-mapper" or "dm-user!<name>".
+    std::set<std::string> misc_devices;
+    // Block devices, by partition name or by the name of their node in /dev/block.
+    std::set<std::string> partitions;
+    // Device-mapper nodes, such as "/dev/block/dm-3".
+    std::set<std::string> dm_devices;
+};
+
 class BlockDevInitializer final {
   public:
     BlockDevInitializer();
@@ -33,10 +44,13 @@ class BlockDevInitializer final {
     bool InitDevices(std::set<std::string> devices);
     bool InitDmDevice(const std::string& device);
 
-  private:
-    ListenerAction HandleUevent(const Uevent& uevent, std::set<std::string>* devices);
+    // Creates all of |devices| from a single pass over their uevents in /sys, then waits for the
+    // hotplug uevents of any that are missing until the last one appears or |timeout| passes.
+    bool InitDeviceSet(DeviceSet devices,
+                       std::chrono::milliseconds timeout = std::chrono::seconds(10));
 
-    bool InitMiscDevice(const std::string& name);
+  private:
+    ListenerAction HandleUevent(const Uevent& uevent, DeviceSet* devices);
 
     std::unique_ptr<DeviceHandler> device_handler_;
     UeventListener uevent_listener_;
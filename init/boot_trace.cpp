@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "boot_trace.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+using android::base::StringAppendF;
+
+namespace android {
+namespace init {
+
+static const char* TypeName(TraceEventType type) {
+    switch (type) {
+        case TraceEventType::kAction:
+            return "action";
+        case TraceEventType::kCommand:
+            return "command";
+        case TraceEventType::kSubcontextRoundTrip:
+            return "subcontext";
+        case TraceEventType::kServiceStart:
+            return "service";
+    }
+    return "unknown";
+}
+
+static std::string JsonEscape(const std::string& in) {
+    std::string out;
+    for (unsigned char c : in) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            StringAppendF(&out, "\\u%04x", c);
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+BootTrace& BootTrace::GetInstance() {
+    static BootTrace instance(kDefaultCapacity);
+    return instance;
+}
+
+BootTrace::BootTrace(size_t capacity) : capacity_(capacity) {}
+
+void BootTrace::Record(TraceEvent event) {
+    if (capacity_ == 0) return;
+
+    if (events_.size() < capacity_) {
+        events_.emplace_back(std::move(event));
+    } else {
+        events_[next_] = std::move(event);
+    }
+    next_ = (next_ + 1) % capacity_;
+}
+
+std::vector<TraceEvent> BootTrace::Events() const {
+    if (events_.size() < capacity_) {
+        return events_;
+    }
+    std::vector<TraceEvent> events(events_.begin() + next_, events_.end());
+    events.insert(events.end(), events_.begin(), events_.begin() + next_);
+    return events;
+}
+
+std::string BootTrace::ToJson() const {
+    // Each type of event gets its own track, named through a metadata event.
+    static constexpr TraceEventType kTypes[] = {
+            TraceEventType::kAction,
+            TraceEventType::kCommand,
+            TraceEventType::kSubcontextRoundTrip,
+            TraceEventType::kServiceStart,
+    };
+
+    std::string json = "{\"traceEvents\":[";
+    for (auto type : kTypes) {
+        StringAppendF(&json,
+                      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                      "\"args\":{\"name\":\"%s\"}},",
+                      static_cast<int>(type) + 1, TypeName(type));
+    }
+
+    bool first = true;
+    for (const auto& event : Events()) {
+        auto ts = std::chrono::duration_cast<std::chrono::microseconds>(
+                event.start.time_since_epoch());
+        StringAppendF(&json,
+                      "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+                      "\"pid\":1,\"tid\":%d,\"args\":{\"location\":\"%s\",\"subcontext\":%s}}",
+                      first ? "" : ",", JsonEscape(event.name).c_str(), TypeName(event.type),
+                      static_cast<long long>(ts.count()),
+                      static_cast<long long>(event.duration.count()),
+                      static_cast<int>(event.type) + 1, JsonEscape(event.location).c_str(),
+                      event.subcontext ? "true" : "false");
+        first = false;
+    }
+    json += "],\"displayTimeUnit\":\"ms\"}\n";
+    return json;
+}
+
+void BootTrace::DumpState() const {
+    auto events = Events();
+    LOG(INFO) << "boot trace (" << events.size() << " events)";
+    for (const auto& event : events) {
+        auto ts = std::chrono::duration_cast<std::chrono::microseconds>(
+                event.start.time_since_epoch());
+        LOG(INFO) << "  " << TypeName(event.type) << " '" << event.name << "'"
+                  << (event.location.empty() ? "" : " (" + event.location + ")")
+                  << (event.subcontext ? " in subcontext" : "") << " at " << ts.count()
+                  << "us took " << event.duration.count() << "us";
+    }
+}
+
+}  // namespace init
+}  // namespace android
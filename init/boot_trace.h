@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <android-base/chrono_utils.h>
+
+namespace android {
+namespace init {
+
+enum class TraceEventType {
+    kAction,
+    kCommand,
+    kSubcontextRoundTrip,
+    kServiceStart,
+};
+
+struct TraceEvent {
+    TraceEventType type;
+    std::string name;      // The command, the action's triggers or the service's name.
+    std::string location;  // file:line of the command or action, if any.
+    android::base::boot_clock::time_point start;
+    std::chrono::microseconds duration;
+    bool subcontext = false;  // Whether the command ran in the vendor subcontext.
+};
+
+// The most recent actions, commands, subcontext round trips and service starts executed by init,
+// with their times, so that slow .rc commands can be found after the fact. It is only used from
+// init's main thread.
+class BootTrace {
+  public:
+    static constexpr size_t kDefaultCapacity = 2048;
+
+    static BootTrace& GetInstance();
+
+    // Exposed for testing
+    explicit BootTrace(size_t capacity);
+
+    // Once the buffer is full, each new event replaces the oldest one.
+    void Record(TraceEvent event);
+
+    // Returns the recorded events, oldest first.
+    std::vector<TraceEvent> Events() const;
+
+    // Returns the events in the Chrome JSON trace event format, which Perfetto's UI and
+    // trace_processor can open.
+    std::string ToJson() const;
+
+    void DumpState() const;
+
+  private:
+    std::vector<TraceEvent> events_;
+    size_t capacity_;
+    size_t next_ = 0;
+};
+
+}  // namespace init
+}  // namespace android
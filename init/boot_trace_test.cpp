@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "boot_trace.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+using android::base::boot_clock;
+
+namespace android {
+namespace init {
+
+static TraceEvent MakeEvent(const std::string& name) {
+    return {TraceEventType::kCommand, name, "init.rc:1", boot_clock::time_point(1s), 5us};
+}
+
+static std::vector<std::string> Names(const BootTrace& trace) {
+    std::vector<std::string> names;
+    for (const auto& event : trace.Events()) {
+        names.emplace_back(event.name);
+    }
+    return names;
+}
+
+TEST(boot_trace, Wraps) {
+    BootTrace trace(3);
+    trace.Record(MakeEvent("a"));
+    trace.Record(MakeEvent("b"));
+    EXPECT_EQ((std::vector<std::string>{"a", "b"}), Names(trace));
+
+    trace.Record(MakeEvent("c"));
+    trace.Record(MakeEvent("d"));
+    trace.Record(MakeEvent("e"));
+    EXPECT_EQ((std::vector<std::string>{"c", "d", "e"}), Names(trace));
+}
+
+TEST(boot_trace, Json) {
+    BootTrace trace(4);
+    trace.Record({TraceEventType::kServiceStart, "say \"hi\"", "", boot_clock::time_point(2ms),
+                  300us});
+
+    auto json = trace.ToJson();
+    EXPECT_NE(std::string::npos, json.find("\"traceEvents\":["));
+    EXPECT_NE(std::string::npos,
+              json.find("{\"name\":\"say \\\"hi\\\"\",\"cat\":\"service\",\"ph\":\"X\","
+                        "\"ts\":2000,\"dur\":300,"));
+}
+
+}  // namespace init
+}  // namespace android
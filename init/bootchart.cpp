@@ -18,6 +18,7 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,20 +27,29 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <processgroup/processgroup.h>
 
 using android::base::StringPrintf;
 using android::base::boot_clock;
+using android::base::unique_fd;
 using namespace std::chrono_literals;
 
 namespace android {
@@ -137,7 +147,343 @@ static void log_processes(FILE* log) {
   fputc('\n', log);
 }
 
-static void bootchart_thread_main() {
+// Binary sampling mode.
+//
+// The text logs above are sampled every 200 ms and re-read every /proc/<pid>/stat each time, which
+// is both too coarse to attribute boot CPU time and expensive enough to show up in the chart.
+// Writing "schedstat" to /data/bootchart/enabled switches to a sampler that reads the per-CPU
+// counters in /proc/schedstat and the cpu.stat of every leaf cgroup every 10 ms (or every
+// "interval=<ms>"). The counter files are kept open and re-read with pread(), and only non-zero
+// deltas are kept, in an in-memory ring buffer that is written to /data/bootchart/schedstat.bin
+// once bootcharting stops. Adding "perfetto" also writes the samples as a JSON trace of counter
+// events that the Perfetto UI can open directly.
+
+struct BootchartOptions {
+    bool schedstat = false;
+    bool perfetto = false;
+    std::chrono::milliseconds interval = 10ms;
+};
+
+static BootchartOptions parse_bootchart_options(const std::string& content) {
+    BootchartOptions options;
+    for (const auto& word : android::base::Split(content, " \t\n")) {
+        if (word.empty()) continue;
+        if (word == "schedstat") {
+            options.schedstat = true;
+        } else if (word == "perfetto") {
+            options.perfetto = true;
+        } else if (android::base::StartsWith(word, "interval=")) {
+            unsigned int interval_ms;
+            if (android::base::ParseUint(word.substr(strlen("interval=")), &interval_ms, 200u) &&
+                interval_ms > 0) {
+                options.interval = std::chrono::milliseconds(interval_ms);
+            } else {
+                LOG(WARNING) << "bootchart: ignoring invalid " << word;
+            }
+        } else {
+            LOG(WARNING) << "bootchart: ignoring unknown option " << word;
+        }
+    }
+    return options;
+}
+
+// Layout of /data/bootchart/schedstat.bin: this header, then |source_count| names (each a uint32_t
+// length followed by that many bytes), then |record_count| SchedstatRecords, oldest first.
+struct SchedstatFileHeader {
+    char magic[4];  // "BCSS"
+    uint32_t version;
+    uint32_t interval_us;
+    uint32_t source_count;
+    uint64_t record_count;
+    // Records overwritten in the ring buffer before they could be written out.
+    uint64_t dropped_records;
+};
+
+// Time spent running and waiting to run since the previous sample of |source|. Cgroups have no
+// wait time.
+struct SchedstatRecord {
+    int64_t timestamp_ns;
+    uint32_t source;
+    uint32_t run_us;
+    uint32_t wait_us;
+    uint32_t reserved;
+};
+
+class SchedstatSampler {
+  public:
+    explicit SchedstatSampler(std::chrono::milliseconds interval) : interval_(interval) {
+        ring_.resize(kRingCapacity);
+        schedstat_fd_.reset(TEMP_FAILURE_RETRY(open("/proc/schedstat", O_RDONLY | O_CLOEXEC)));
+        if (schedstat_fd_ == -1) PLOG(ERROR) << "bootchart: failed to open /proc/schedstat";
+        if (!CgroupGetControllerPath(CGROUPV2_CONTROLLER_NAME, &cgroup_root_)) {
+            LOG(WARNING) << "bootchart: no cgroup v2 hierarchy, sampling CPUs only";
+            cgroup_root_.clear();
+        }
+    }
+
+    void Sample() {
+        int64_t now = boot_clock::now().time_since_epoch().count();
+        SampleCpus(now);
+        if (!cgroup_root_.empty()) {
+            if (sample_count_ % kCgroupRescanSamples == 0) DiscoverCgroups(cgroup_root_, "", 0);
+            SampleCgroups(now);
+        }
+        sample_count_++;
+    }
+
+    void Write(bool perfetto) const {
+        WriteBinary("/data/bootchart/schedstat.bin");
+        if (perfetto) WriteTraceJson("/data/bootchart/schedstat.json");
+    }
+
+  private:
+    // 6 MiB; at 10 ms and a few dozen busy cgroups this holds the last minute or so of boot.
+    static constexpr size_t kRingCapacity = 1 << 18;
+    // New cgroups are picked up every this many samples.
+    static constexpr uint64_t kCgroupRescanSamples = 25;
+    // Android creates per-process cgroups at most a couple of levels below the root.
+    static constexpr int kMaxCgroupDepth = 3;
+
+    struct Source {
+        std::string name;
+        unique_fd fd;
+        bool has_last = false;
+        uint64_t last_run_ns = 0;
+        uint64_t last_wait_ns = 0;
+    };
+
+    uint32_t AddSource(std::string name, unique_fd fd) {
+        sources_.push_back(Source{std::move(name), std::move(fd)});
+        return sources_.size() - 1;
+    }
+
+    // Records the deltas against the previous cumulative |run_ns| and |wait_ns| of |id|.
+    void Update(uint32_t id, int64_t now, uint64_t run_ns, uint64_t wait_ns) {
+        Source& source = sources_[id];
+        bool had_last = source.has_last;
+        // Subtracting the truncated cumulative values keeps the sub-microsecond remainders from
+        // getting lost across samples.
+        uint64_t run_us = run_ns / 1000 - source.last_run_ns / 1000;
+        uint64_t wait_us = wait_ns / 1000 - source.last_wait_ns / 1000;
+        source.has_last = true;
+        source.last_run_ns = run_ns;
+        source.last_wait_ns = wait_ns;
+        if (!had_last || (run_us == 0 && wait_us == 0)) return;
+
+        SchedstatRecord& record = ring_[record_count_ % kRingCapacity];
+        record.timestamp_ns = now;
+        record.source = id;
+        record.run_us = std::min<uint64_t>(run_us, UINT32_MAX);
+        record.wait_us = std::min<uint64_t>(wait_us, UINT32_MAX);
+        record.reserved = 0;
+        record_count_++;
+    }
+
+    // Reads the whole of |fd| into buffer_ and NUL-terminates it.
+    bool Read(int fd) {
+        ssize_t n = TEMP_FAILURE_RETRY(pread(fd, buffer_, sizeof(buffer_) - 1, 0));
+        if (n <= 0) return false;
+        buffer_[n] = '\0';
+        return true;
+    }
+
+    void SampleCpus(int64_t now) {
+        if (schedstat_fd_ == -1 || !Read(schedstat_fd_)) return;
+
+        char* save;
+        for (char* line = strtok_r(buffer_, "\n", &save); line != nullptr;
+             line = strtok_r(nullptr, "\n", &save)) {
+            // cpu<N> followed by nine counters, the 7th and 8th being the time tasks spent running
+            // and waiting to run on that CPU, in ns. See Documentation/scheduler/sched-stats.rst.
+            unsigned int cpu;
+            uint64_t run_ns, wait_ns;
+            if (sscanf(line, "cpu%u %*u %*u %*u %*u %*u %*u %" SCNu64 " %" SCNu64, &cpu, &run_ns,
+                       &wait_ns) != 3) {
+                continue;
+            }
+            while (cpu_sources_.size() <= cpu) {
+                std::string name = StringPrintf("cpu%zu", cpu_sources_.size());
+                cpu_sources_.push_back(AddSource(std::move(name), unique_fd()));
+            }
+            Update(cpu_sources_[cpu], now, run_ns, wait_ns);
+        }
+    }
+
+    void SampleCgroups(int64_t now) {
+        for (uint32_t id : cgroup_sources_) {
+            Source& source = sources_[id];
+            if (source.fd == -1) continue;
+            uint64_t usage_us;
+            if (!Read(source.fd) || sscanf(buffer_, "usage_usec %" SCNu64, &usage_us) != 1) {
+                // The cgroup was removed; forget it until it shows up again.
+                source.fd.reset();
+                source.has_last = false;
+                continue;
+            }
+            Update(id, now, usage_us * 1000, 0);
+        }
+    }
+
+    // Starts sampling every leaf cgroup below |path| that isn't sampled yet. |name| is |path|
+    // relative to the cgroup root.
+    void DiscoverCgroups(const std::string& path, const std::string& name, int depth) {
+        std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(path.c_str()), closedir);
+        if (!dir) return;
+
+        bool leaf = true;
+        struct dirent* entry;
+        while ((entry = readdir(dir.get())) != nullptr) {
+            if (entry->d_type != DT_DIR || entry->d_name[0] == '.') continue;
+            leaf = false;
+            if (depth < kMaxCgroupDepth) {
+                DiscoverCgroups(path + "/" + entry->d_name,
+                                name.empty() ? entry->d_name : name + "/" + entry->d_name,
+                                depth + 1);
+            }
+        }
+        if (!leaf || depth == 0) return;
+
+        auto it = cgroup_ids_.find(name);
+        if (it != cgroup_ids_.end() && sources_[it->second].fd != -1) return;
+
+        unique_fd fd(TEMP_FAILURE_RETRY(open((path + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC)));
+        if (fd == -1) return;
+        if (it != cgroup_ids_.end()) {
+            sources_[it->second].fd = std::move(fd);
+            return;
+        }
+
+        // Per-process cgroups are named pid_<pid>; label them with the process as well.
+        std::string label = name;
+        const char* base = strrchr(name.c_str(), '/');
+        base = base ? base + 1 : name.c_str();
+        int pid;
+        std::string cmdline;
+        if (sscanf(base, "pid_%d", &pid) == 1 &&
+            android::base::ReadFileToString(StringPrintf("/proc/%d/cmdline", pid), &cmdline) &&
+            !cmdline.empty()) {
+            label += StringPrintf(" (%s)", cmdline.c_str());
+        }
+        uint32_t id = AddSource(std::move(label), std::move(fd));
+        cgroup_ids_.emplace(name, id);
+        cgroup_sources_.push_back(id);
+    }
+
+    // Calls |fn| on every record still in the ring buffer, oldest first.
+    template <typename F>
+    void ForEachRecord(F fn) const {
+        uint64_t first = record_count_ > kRingCapacity ? record_count_ - kRingCapacity : 0;
+        for (uint64_t i = first; i < record_count_; i++) fn(ring_[i % kRingCapacity]);
+    }
+
+    void WriteBinary(const char* path) const {
+        auto fp = fopen_unique(path, "we");
+        if (!fp) return;
+
+        uint64_t kept = std::min<uint64_t>(record_count_, kRingCapacity);
+        SchedstatFileHeader header = {};
+        memcpy(header.magic, "BCSS", sizeof(header.magic));
+        header.version = 1;
+        header.interval_us =
+                std::chrono::duration_cast<std::chrono::microseconds>(interval_).count();
+        header.source_count = sources_.size();
+        header.record_count = kept;
+        header.dropped_records = record_count_ - kept;
+        fwrite(&header, sizeof(header), 1, &*fp);
+        for (const auto& source : sources_) {
+            uint32_t length = source.name.size();
+            fwrite(&length, sizeof(length), 1, &*fp);
+            fwrite(source.name.data(), 1, length, &*fp);
+        }
+        ForEachRecord([&](const SchedstatRecord& record) {
+            fwrite(&record, sizeof(record), 1, &*fp);
+        });
+        if (ferror(&*fp)) PLOG(ERROR) << "bootchart: failed to write " << path;
+    }
+
+    // Chrome JSON trace format, which Perfetto imports: one counter track per source, in
+    // microseconds of CPU time per sample. Deltas of zero were never recorded, so a zero is
+    // emitted one interval after a source's last non-zero sample to end each burst.
+    void WriteTraceJson(const char* path) const {
+        auto fp = fopen_unique(path, "we");
+        if (!fp) return;
+
+        std::vector<std::string> names;
+        for (const auto& source : sources_) {
+            std::string name;
+            for (char c : source.name) {
+                if (c == '"' || c == '\\') name += '\\';
+                name += (static_cast<unsigned char>(c) < 0x20) ? ' ' : c;
+            }
+            names.push_back(std::move(name));
+        }
+
+        int64_t interval_ns = std::chrono::nanoseconds(interval_).count();
+        std::vector<int64_t> last_ns(sources_.size(), INT64_MIN);
+        bool first = true;
+        auto counter = [&](uint32_t source, int64_t ns, uint32_t run_us, uint32_t wait_us) {
+            fprintf(&*fp,
+                    "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,"
+                    "\"args\":{\"run_us\":%u,\"wait_us\":%u}}",
+                    first ? "" : ",\n", names[source].c_str(), ns / 1000.0, run_us, wait_us);
+            first = false;
+        };
+
+        fprintf(&*fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        ForEachRecord([&](const SchedstatRecord& record) {
+            int64_t last = last_ns[record.source];
+            if (last != INT64_MIN && record.timestamp_ns - last > interval_ns * 3 / 2) {
+                counter(record.source, last + interval_ns, 0, 0);
+            }
+            counter(record.source, record.timestamp_ns, record.run_us, record.wait_us);
+            last_ns[record.source] = record.timestamp_ns;
+        });
+        for (uint32_t source = 0; source < last_ns.size(); source++) {
+            if (last_ns[source] != INT64_MIN) {
+                counter(source, last_ns[source] + interval_ns, 0, 0);
+            }
+        }
+        fprintf(&*fp, "\n]}\n");
+        if (ferror(&*fp)) PLOG(ERROR) << "bootchart: failed to write " << path;
+    }
+
+    std::chrono::milliseconds interval_;
+    unique_fd schedstat_fd_;
+    std::string cgroup_root_;
+
+    std::vector<Source> sources_;
+    std::vector<uint32_t> cpu_sources_;
+    std::vector<uint32_t> cgroup_sources_;
+    std::map<std::string, uint32_t> cgroup_ids_;
+
+    std::vector<SchedstatRecord> ring_;
+    uint64_t record_count_ = 0;
+    uint64_t sample_count_ = 0;
+
+    char buffer_[16384];
+};
+
+static void bootchart_schedstat_main(const BootchartOptions& options) {
+    SchedstatSampler sampler(options.interval);
+
+    // Sample on a fixed schedule rather than sleeping a full interval after each sample, so the
+    // time spent sampling doesn't stretch the interval.
+    auto next = std::chrono::steady_clock::now();
+    while (true) {
+        sampler.Sample();
+        next = std::max(next + options.interval, std::chrono::steady_clock::now());
+
+        std::unique_lock<std::mutex> lock(g_bootcharting_finished_mutex);
+        if (g_bootcharting_finished_cv.wait_until(lock, next,
+                                                  [] { return g_bootcharting_finished; })) {
+            break;
+        }
+    }
+
+    sampler.Write(options.perfetto);
+}
+
+static void bootchart_thread_main(const BootchartOptions& options) {
   LOG(INFO) << "Bootcharting started";
 
   // Unshare the mount namespace of this thread so that the init process itself can switch
@@ -154,6 +500,14 @@ static void bootchart_thread_main() {
       PLOG(ERROR) << "Cannot create mount namespace";
       return;
   }
+
+  if (options.schedstat) {
+    log_header();
+    bootchart_schedstat_main(options);
+    LOG(INFO) << "Bootcharting finished";
+    return;
+  }
+
   // Open log files.
   auto stat_log = fopen_unique("/data/bootchart/proc_stat.log", "we");
   if (!stat_log) return;
@@ -180,14 +534,15 @@ static void bootchart_thread_main() {
 }
 
 static Result<void> do_bootchart_start() {
-    // We don't care about the content, but we do care that /data/bootchart/enabled actually exists.
+    // /data/bootchart/enabled has to exist; its content selects the sampling mode, see
+    // parse_bootchart_options().
     std::string start;
     if (!android::base::ReadFileToString("/data/bootchart/enabled", &start)) {
         LOG(VERBOSE) << "Not bootcharting";
         return {};
     }
 
-    g_bootcharting_thread = new std::thread(bootchart_thread_main);
+    g_bootcharting_thread = new std::thread(bootchart_thread_main, parse_bootchart_options(start));
     return {};
 }
 
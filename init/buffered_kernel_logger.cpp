@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "buffered_kernel_logger.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
+#include <system/thread_defs.h>
+
+using namespace std::chrono_literals;
+
+namespace android {
+namespace init {
+
+namespace {
+
+// Past this, lines are written synchronously until the thread catches up.
+constexpr size_t kMaxQueuedBytes = 256 * 1024;
+
+// Flushing happens on fatal paths, possibly from a signal handler that interrupted a thread holding
+// one of the locks. Rather than deadlock there, the lines are written without the queue.
+constexpr auto kFlushTimeout = 1s;
+
+// Formats a line as android::base::KernelLogger does.
+std::string FormatRecord(android::base::LogSeverity severity, const char* tag,
+                         const char* message) {
+    // Indexed by severity, from VERBOSE to FATAL.
+    static constexpr int kLogSeverityToKernelLogLevel[] = {
+            7,  // VERBOSE: KERN_DEBUG (there is no verbose kernel log level).
+            7,  // DEBUG: KERN_DEBUG.
+            6,  // INFO: KERN_INFO.
+            4,  // WARNING: KERN_WARNING.
+            3,  // ERROR: KERN_ERROR.
+            2,  // FATAL_WITHOUT_ABORT: KERN_CRIT.
+            2,  // FATAL: KERN_CRIT.
+    };
+    int level = kLogSeverityToKernelLogLevel[severity];
+    if (tag == nullptr) tag = "init";
+
+    // The kernel's printk buffer is only 1024 bytes.
+    char buf[1024];
+    size_t size = snprintf(buf, sizeof(buf), "<%d>%s: %s\n", level, tag, message);
+    if (size > sizeof(buf)) {
+        size = snprintf(buf, sizeof(buf), "<%d>%s: %zu-byte message too long for printk\n", level,
+                        tag, size);
+    }
+    return std::string(buf, size);
+}
+
+class KernelLogBuffer {
+  public:
+    void Log(android::base::LogSeverity severity, const char* tag, const char* message);
+    void Flush();
+
+  private:
+    bool StartLocked();
+    void WriteNow(std::string record);
+    void TakeQueue(std::vector<std::string>* lines);
+    void WriteLines(const std::vector<std::string>& lines);
+    void WriterThread();
+
+    // Held while lines are taken off the queue and written, which keeps them in order.
+    std::timed_mutex write_lock_;
+    std::timed_mutex queue_lock_;
+    std::condition_variable_any queue_cv_;
+    std::vector<std::string> queue_;
+    size_t queued_bytes_ = 0;
+    bool start_failed_ = false;
+    // The process whose thread drains the queue.
+    std::atomic<pid_t> owner_ = 0;
+    int fd_ = -1;
+};
+
+KernelLogBuffer& GetKernelLogBuffer() {
+    // Never destroyed, so that logging keeps working from other static destructors.
+    static auto buffer = new KernelLogBuffer();
+    return *buffer;
+}
+
+void KernelLogBuffer::Log(android::base::LogSeverity severity, const char* tag,
+                          const char* message) {
+    auto record = FormatRecord(severity, tag, message);
+    if (severity >= android::base::FATAL_WITHOUT_ABORT) {
+        WriteNow(std::move(record));
+        return;
+    }
+
+    pid_t owner = owner_.load(std::memory_order_acquire);
+    if (owner != 0 && owner != getpid()) {
+        WriteNow(std::move(record));
+        return;
+    }
+
+    std::unique_lock<std::timed_mutex> lock(queue_lock_);
+    if ((owner == 0 && !StartLocked()) || queued_bytes_ + record.size() > kMaxQueuedBytes) {
+        lock.unlock();
+        WriteNow(std::move(record));
+        return;
+    }
+    queued_bytes_ += record.size();
+    queue_.emplace_back(std::move(record));
+    if (queue_.size() == 1) queue_cv_.notify_one();
+}
+
+bool KernelLogBuffer::StartLocked() {
+    if (owner_.load(std::memory_order_relaxed) != 0) return true;
+    if (start_failed_) return false;
+
+    fd_ = TEMP_FAILURE_RETRY(open("/dev/kmsg", O_WRONLY | O_CLOEXEC));
+
+    // The thread must not take any signals, init handles them on its main thread.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int result = pthread_create(
+            &thread, nullptr,
+            [](void* arg) -> void* {
+                static_cast<KernelLogBuffer*>(arg)->WriterThread();
+                return nullptr;
+            },
+            this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    if (result != 0) {
+        start_failed_ = true;
+        return false;
+    }
+    pthread_detach(thread);
+
+    owner_.store(getpid(), std::memory_order_release);
+    atexit([] { GetKernelLogBuffer().Flush(); });
+    return true;
+}
+
+void KernelLogBuffer::WriteNow(std::string record) {
+    std::vector<std::string> lines;
+    pid_t owner = owner_.load(std::memory_order_acquire);
+    // A forked child leaves the queue it inherited, and the locks, to its parent.
+    std::unique_lock<std::timed_mutex> lock;
+    if (owner == getpid()) {
+        lock = std::unique_lock<std::timed_mutex>(write_lock_, kFlushTimeout);
+        if (lock.owns_lock()) TakeQueue(&lines);
+    }
+    lines.emplace_back(std::move(record));
+    WriteLines(lines);
+}
+
+void KernelLogBuffer::Flush() {
+    if (owner_.load(std::memory_order_acquire) != getpid()) return;
+
+    std::unique_lock<std::timed_mutex> lock(write_lock_, kFlushTimeout);
+    if (!lock.owns_lock()) return;
+    std::vector<std::string> lines;
+    TakeQueue(&lines);
+    WriteLines(lines);
+}
+
+// Must be called with |write_lock_| held.
+void KernelLogBuffer::TakeQueue(std::vector<std::string>* lines) {
+    std::unique_lock<std::timed_mutex> lock(queue_lock_, kFlushTimeout);
+    if (!lock.owns_lock()) return;
+    lines->swap(queue_);
+    queued_bytes_ = 0;
+}
+
+void KernelLogBuffer::WriteLines(const std::vector<std::string>& lines) {
+    int fd = fd_;
+    android::base::unique_fd own_fd;
+    if (fd == -1) {
+        // The thread never started; this is how KernelLogger writes every line.
+        own_fd.reset(TEMP_FAILURE_RETRY(open("/dev/kmsg", O_WRONLY | O_CLOEXEC)));
+        fd = own_fd.get();
+        if (fd == -1) return;
+    }
+    // Each write() is its own kernel log record, so the lines can't be merged into one.
+    for (const auto& line : lines) {
+        TEMP_FAILURE_RETRY(write(fd, line.data(), line.size()));
+    }
+}
+
+void KernelLogBuffer::WriterThread() {
+    setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_BACKGROUND);
+
+    std::vector<std::string> lines;
+    while (true) {
+        {
+            std::unique_lock<std::timed_mutex> lock(queue_lock_);
+            queue_cv_.wait(lock, [this] { return !queue_.empty(); });
+        }
+        std::lock_guard<std::timed_mutex> lock(write_lock_);
+        TakeQueue(&lines);
+        WriteLines(lines);
+        lines.clear();
+    }
+}
+
+}  // namespace
+
+void BufferedKernelLogger(android::base::LogId, android::base::LogSeverity severity,
+                          const char* tag, const char*, unsigned int, const char* message) {
+    GetKernelLogBuffer().Log(severity, tag, message);
+}
+
+void FlushKernelLog() {
+    GetKernelLogBuffer().Flush();
+}
+
+}  // namespace init
+}  // namespace android
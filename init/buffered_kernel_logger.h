@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/logging.h>
+
+namespace android {
+namespace init {
+
+// A drop-in replacement for android::base::KernelLogger that doesn't write to /dev/kmsg on the
+// calling thread. Lines are formatted as KernelLogger formats them and queued, and a background
+// priority thread writes them out, one record per line, in the order they were logged.
+//
+// FATAL lines are written synchronously, after everything queued before them. So is any line
+// logged while the queue is full, or from a child forked by the process that started the thread,
+// since the child has no thread to write its copy of the queue.
+void BufferedKernelLogger(android::base::LogId id, android::base::LogSeverity severity,
+                          const char* tag, const char* file, unsigned int line,
+                          const char* message);
+
+// Writes out every line queued so far and returns once they are written. This must be called
+// before exec(), which would discard the queue; it is called at exit() and before rebooting.
+void FlushKernelLog();
+
+}  // namespace init
+}  // namespace android
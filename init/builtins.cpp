@@ -69,11 +69,13 @@
 #include <system/thread_defs.h>
 
 #include "action_manager.h"
+#include "boot_trace.h"
 #include "bootchart.h"
 #include "builtin_arguments.h"
 // #include "fscrypt_init_extensions.h"
 #include "init.h"
 #include "mount_namespace.h"
+#include "parallel_restorecon.h"
 #include "parser.h"
 #include "property_service.h"
 #include "reboot.h"
@@ -153,6 +155,9 @@ static constexpr std::chrono::nanoseconds kCommandRetryTimeout = 5s;
 //     return {};
 // }
 
+// Threads that spawn services when ro.init.parallel_class_start is set.
+static constexpr size_t kClassStartThreads = 4;
+
 template <typename F>
 static void ForEachServiceInClass(const std::string& classname, F function) {
     for (const auto& service : ServiceList::GetInstance()) {
@@ -166,6 +171,22 @@ static Result<void> do_class_start(const BuiltinArguments& args) {
         return {};
     // Starting a class does not start services which are explicitly disabled.
     // They must  be started individually.
+    if (android::base::GetBoolProperty("ro.init.parallel_class_start", false)) {
+        std::vector<Service*> services;
+        for (const auto& service : ServiceList::GetInstance()) {
+            if (service->classnames().count(args[1])) {
+                services.emplace_back(service.get());
+            }
+        }
+        auto results = Service::StartAllIfNotDisabled(services, kClassStartThreads);
+        for (size_t i = 0; i < services.size(); i++) {
+            if (!results[i].ok()) {
+                LOG(ERROR) << "Could not start service '" << services[i]->name()
+                           << "' as part of class '" << args[1] << "': " << results[i].error();
+            }
+        }
+        return {};
+    }
     for (const auto& service : ServiceList::GetInstance()) {
         if (service->classnames().count(args[1])) {
             if (auto result = service->StartIfNotDisabled(); !result.ok()) {
@@ -661,7 +682,7 @@ static Result<void> do_mount_all(const BuiltinArguments& args) {
         }
     }
 
-    auto mount_fstab_result = fs_mgr_mount_all(&fstab, mount_all->mode);
+    auto mount_fstab_result = fs_mgr_mount_all(&fstab, mount_all->mode, mount_all->parallel);
     SetProperty(prop_name, std::to_string(t.duration().count()));
 
     if (mount_all->import_rc) {
@@ -884,6 +905,13 @@ static Result<void> do_sysclktz(const BuiltinArguments& args) {
 //     return {};
 // }
 
+static Result<void> do_dump_boot_trace(const BuiltinArguments& args) {
+    if (auto result = WriteFile(args[1], BootTrace::GetInstance().ToJson()); !result.ok()) {
+        return Error() << "Unable to write boot trace to '" << args[1] << "': " << result.error();
+    }
+    return {};
+}
+
 static Result<void> do_write(const BuiltinArguments& args) {
     if (auto result = WriteFile(args[1], args[2]); !result.ok()) {
         return ErrorIgnoreEnoent()
@@ -1057,6 +1085,11 @@ static Result<void> do_chmod(const BuiltinArguments& args) {
 
 //     // const auto& [flag, paths] = *restorecon_info;
 
+//     // if (flag & SELINUX_ANDROID_RESTORECON_RECURSE) {
+//     //     ParallelRestorecon restorecon({.flags = flag});
+//     //     return restorecon.Run(paths);
+//     // }
+
 //     int ret = 0;
 //     // for (const auto& path : paths) {
 //     //     if (selinux_android_restorecon(path.c_str(), flag) < 0) {
@@ -1390,6 +1423,7 @@ const BuiltinFunctionMap& GetBuiltinFunctionMap() {
         {"copy",                    {2,     2,    {true,   do_copy}}},
         {"copy_per_line",           {2,     2,    {true,   do_copy_per_line}}},
         {"domainname",              {1,     1,    {true,   do_domainname}}},
+        {"dump_boot_trace",         {1,     1,    {false,  do_dump_boot_trace}}},
         {"enable",                  {1,     1,    {false,  do_enable}}},
         {"exec",                    {1,     kMax, {false,  do_exec}}},
         {"exec_background",         {1,     kMax, {false,  do_exec_background}}},
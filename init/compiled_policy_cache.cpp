@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compiled_policy_cache.h"
+
+#include <fcntl.h>
+#include <openssl/sha.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+
+#include "util.h"
+
+using android::base::Dirname;
+using android::base::ReadFdToString;
+using android::base::ReadFileToString;
+using android::base::unique_fd;
+using android::base::WriteStringToFd;
+
+namespace android {
+namespace init {
+
+// Bumped whenever the way init compiles the same inputs changes.
+static constexpr const char kCompiledPolicyCacheVersion[] = "compiled_policy_cache 1";
+
+static std::string Sha256(const std::string& data) {
+    std::string digest(SHA256_DIGEST_LENGTH, '\0');
+    SHA256(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+           reinterpret_cast<uint8_t*>(digest.data()));
+    return digest;
+}
+
+CompiledPolicyCache::CompiledPolicyCache(const std::vector<std::string>& args) {
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, kCompiledPolicyCacheVersion, sizeof(kCompiledPolicyCacheVersion));
+    for (const auto& arg : args) {
+        struct stat st;
+        std::string contents;
+        if (stat(arg.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+            !ReadFileToString(arg, &contents, true /* follow symlinks */)) {
+            PLOG(WARNING) << "Could not read " << arg;
+            // Never matches a key that was computed from the file's contents.
+            contents = "unreadable";
+        }
+        // Sizes keep the boundaries between arguments and contents unambiguous.
+        uint64_t sizes[] = {arg.size(), contents.size()};
+        SHA256_Update(&ctx, sizes, sizeof(sizes));
+        SHA256_Update(&ctx, arg.data(), arg.size());
+        SHA256_Update(&ctx, contents.data(), contents.size());
+    }
+    key_.resize(SHA256_DIGEST_LENGTH);
+    SHA256_Final(reinterpret_cast<uint8_t*>(key_.data()), &ctx);
+}
+
+unique_fd CompiledPolicyCache::Load(const std::string& path) const {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Could not open compiled policy cache " << path;
+        }
+        return {};
+    }
+
+    struct stat st;
+    if (fstat(fd.get(), &st) == -1 || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        LOG(WARNING) << "Ignoring insecure compiled policy cache " << path;
+        return {};
+    }
+
+    // The header is the key followed by a digest of the policy, so that a corrupted policy is
+    // compiled again rather than rejected by the kernel.
+    std::string contents;
+    if (!ReadFdToString(fd, &contents)) {
+        PLOG(WARNING) << "Could not read compiled policy cache " << path;
+        return {};
+    }
+    const size_t header_size = 2 * SHA256_DIGEST_LENGTH;
+    if (contents.size() < header_size || contents.compare(0, key_.size(), key_) != 0) {
+        LOG(INFO) << "Compiled policy cache " << path << " is for a different policy";
+        return {};
+    }
+    if (contents.compare(key_.size(), SHA256_DIGEST_LENGTH, Sha256(contents.substr(header_size)))) {
+        LOG(WARNING) << "Ignoring corrupted compiled policy cache " << path;
+        return {};
+    }
+
+    if (lseek(fd.get(), header_size, SEEK_SET) == -1) {
+        PLOG(WARNING) << "Could not seek in compiled policy cache " << path;
+        return {};
+    }
+    return fd;
+}
+
+Result<void> CompiledPolicyCache::Save(const std::string& path, const std::string& policy) const {
+    auto dir = Dirname(path);
+    if (!mkdir_recursive(dir, 0700)) {
+        return ErrnoError() << "Could not create " << dir;
+    }
+
+    const std::string temp_path = path + ".tmp";
+    unique_fd fd(TEMP_FAILURE_RETRY(
+            open(temp_path.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0600)));
+    if (fd == -1) {
+        return ErrnoError() << "Could not open temporary compiled policy cache";
+    }
+    if (!WriteStringToFd(key_, fd) || !WriteStringToFd(Sha256(policy), fd) ||
+        !WriteStringToFd(policy, fd)) {
+        return ErrnoError() << "Unable to write compiled policy cache";
+    }
+    fsync(fd.get());
+    fd.reset();
+
+    if (rename(temp_path.c_str(), path.c_str())) {
+        int saved_errno = errno;
+        unlink(temp_path.c_str());
+        return Error(saved_errno) << "Unable to rename compiled policy cache";
+    }
+    return {};
+}
+
+}  // namespace init
+}  // namespace android
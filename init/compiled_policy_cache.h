@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+#include "result.h"
+
+namespace android {
+namespace init {
+
+// The SELinux policy compiled from the split CIL policy during a previous boot, so that secilc
+// doesn't need to run again while its inputs stay the same.
+//
+// The cache is keyed by a SHA-256 of the secilc command line and of the contents of every file
+// named on it, which includes secilc itself and all CIL files and mapping versions.
+class CompiledPolicyCache {
+  public:
+    // |args| is the secilc command line, without the output file.
+    explicit CompiledPolicyCache(const std::vector<std::string>& args);
+
+    // Returns the policy cached at |path|, positioned at its start, if it was compiled from the
+    // same inputs and is intact.
+    android::base::unique_fd Load(const std::string& path) const;
+    Result<void> Save(const std::string& path, const std::string& policy) const;
+
+  private:
+    std::string key_;
+};
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compiled_policy_cache.h"
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+using android::base::ReadFdToString;
+using android::base::ReadFileToString;
+using android::base::WriteStringToFile;
+
+using namespace std::string_literals;
+
+namespace android {
+namespace init {
+
+static std::string LoadPolicy(const CompiledPolicyCache& cache, const std::string& path) {
+    auto fd = cache.Load(path);
+    if (fd == -1) return "<none>";
+    std::string policy;
+    EXPECT_TRUE(ReadFdToString(fd, &policy));
+    return policy;
+}
+
+class CompiledPolicyCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        plat_cil_ = dir_.path + "/plat_sepolicy.cil"s;
+        cache_path_ = dir_.path + "/cache/compiled_sepolicy"s;
+        ASSERT_TRUE(WriteStringToFile("(allow a b (c (d)))\n", plat_cil_));
+        args_ = {"/system/bin/secilc", plat_cil_, "-c", "30"};
+    }
+
+    TemporaryDir dir_;
+    std::string plat_cil_;
+    std::string cache_path_;
+    std::vector<std::string> args_;
+};
+
+TEST_F(CompiledPolicyCacheTest, Roundtrip) {
+    std::string policy = "\x8c\xff\x7c\xf9 policy"s;
+
+    EXPECT_EQ("<none>", LoadPolicy(CompiledPolicyCache(args_), cache_path_));
+    ASSERT_TRUE(CompiledPolicyCache(args_).Save(cache_path_, policy).ok());
+    EXPECT_EQ(policy, LoadPolicy(CompiledPolicyCache(args_), cache_path_));
+}
+
+TEST_F(CompiledPolicyCacheTest, ChangedInputs) {
+    ASSERT_TRUE(CompiledPolicyCache(args_).Save(cache_path_, "policy").ok());
+
+    auto changed_args = args_;
+    changed_args[3] = "31";
+    EXPECT_EQ("<none>", LoadPolicy(CompiledPolicyCache(changed_args), cache_path_));
+
+    auto added_file = args_;
+    added_file.emplace_back(dir_.path + "/vendor_sepolicy.cil"s);
+    EXPECT_EQ("<none>", LoadPolicy(CompiledPolicyCache(added_file), cache_path_));
+
+    ASSERT_TRUE(WriteStringToFile("(allow a b (c (e)))\n", plat_cil_));
+    EXPECT_EQ("<none>", LoadPolicy(CompiledPolicyCache(args_), cache_path_));
+}
+
+TEST_F(CompiledPolicyCacheTest, Corrupted) {
+    CompiledPolicyCache cache(args_);
+    ASSERT_TRUE(cache.Save(cache_path_, "policy").ok());
+
+    std::string contents;
+    ASSERT_TRUE(ReadFileToString(cache_path_, &contents));
+    contents.back() ^= 1;
+    ASSERT_TRUE(WriteStringToFile(contents, cache_path_));
+    EXPECT_EQ("<none>", LoadPolicy(cache, cache_path_));
+
+    contents.pop_back();
+    ASSERT_TRUE(WriteStringToFile(contents, cache_path_));
+    EXPECT_EQ("<none>", LoadPolicy(cache, cache_path_));
+}
+
+}  // namespace init
+}  // namespace android
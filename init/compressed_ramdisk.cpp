@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compressed_ramdisk.h"
+
+#include <fcntl.h>
+#include <lz4.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+
+using android::base::ReadFileToString;
+using android::base::Split;
+using android::base::unique_fd;
+using android::base::WriteFully;
+
+namespace android {
+namespace init {
+
+namespace {
+
+// The lz4 legacy format, as written by `lz4 -l` and accepted by the kernel for initramfs, is a
+// magic number followed by blocks that each hold up to 8 MiB of independently compressed data.
+constexpr uint32_t kLz4LegacyMagic = 0x184C2102;
+constexpr size_t kLz4LegacyBlockSize = 8 << 20;
+
+constexpr uint32_t kZstdMagic = 0xFD2FB528;
+
+uint32_t ReadLe32(const char* p) {
+    auto u = reinterpret_cast<const uint8_t*>(p);
+    return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+// Runs |job| for every index below |count| on up to |num_threads| threads, including the calling
+// one. Returns the error of the first failed job.
+template <typename F>
+Result<void> RunParallel(size_t count, size_t num_threads, F job) {
+    std::vector<std::string> errors(count);
+    std::atomic<size_t> next = 0;
+    auto worker = [&] {
+        for (size_t i; (i = next++) < count;) {
+            if (auto result = job(i); !result.ok()) {
+                errors[i] = result.error().message();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(num_threads, count); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (const auto& error : errors) {
+        if (!error.empty()) {
+            return Error() << error;
+        }
+    }
+    return {};
+}
+
+Result<std::string> DecompressLz4Legacy(std::string_view data, size_t num_threads) {
+    struct Block {
+        size_t offset;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    for (size_t pos = sizeof(kLz4LegacyMagic); pos < data.size();) {
+        if (data.size() - pos < sizeof(uint32_t)) {
+            return Error() << "Truncated lz4 block header at offset " << pos;
+        }
+        uint32_t size = ReadLe32(data.data() + pos);
+        pos += sizeof(uint32_t);
+        // Concatenated archives repeat the magic number.
+        if (size == kLz4LegacyMagic) {
+            continue;
+        }
+        if (size > static_cast<size_t>(LZ4_compressBound(kLz4LegacyBlockSize)) ||
+            size > data.size() - pos) {
+            return Error() << "Invalid lz4 block size " << size << " at offset " << pos;
+        }
+        blocks.push_back({pos, size});
+        pos += size;
+    }
+
+    // Every block but the last normally fills its 8 MiB, so each is decompressed straight into its
+    // place in the output and only a short block in the middle needs moving afterwards.
+    std::string out(blocks.size() * kLz4LegacyBlockSize, '\0');
+    std::vector<size_t> sizes(blocks.size());
+    auto result = RunParallel(blocks.size(), num_threads, [&](size_t i) -> Result<void> {
+        int size = LZ4_decompress_safe(data.data() + blocks[i].offset,
+                                       out.data() + i * kLz4LegacyBlockSize, blocks[i].size,
+                                       kLz4LegacyBlockSize);
+        if (size < 0) {
+            return Error() << "Could not decompress lz4 block at offset " << blocks[i].offset;
+        }
+        sizes[i] = size;
+        return {};
+    });
+    if (!result.ok()) {
+        return result.error();
+    }
+
+    size_t end = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (end != i * kLz4LegacyBlockSize) {
+            memmove(out.data() + end, out.data() + i * kLz4LegacyBlockSize, sizes[i]);
+        }
+        end += sizes[i];
+    }
+    out.resize(end);
+    return out;
+}
+
+Result<std::string> DecompressZstdStream(std::string_view data) {
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    if (!dctx) {
+        return Error() << "Could not create zstd context";
+    }
+
+    std::string out;
+    size_t written = 0;
+    ZSTD_inBuffer input = {data.data(), data.size(), 0};
+    for (;;) {
+        if (out.size() - written < ZSTD_DStreamOutSize()) {
+            out.resize(std::max(out.size() * 2, written + ZSTD_DStreamOutSize()));
+        }
+        ZSTD_outBuffer output = {out.data(), out.size(), written};
+        size_t ret = ZSTD_decompressStream(dctx.get(), &output, &input);
+        if (ZSTD_isError(ret)) {
+            return Error() << "Could not decompress zstd stream: " << ZSTD_getErrorName(ret);
+        }
+        written = output.pos;
+        if (input.pos == input.size && output.pos < output.size) {
+            if (ret != 0) {
+                return Error() << "Truncated zstd stream";
+            }
+            break;
+        }
+    }
+    out.resize(written);
+    return out;
+}
+
+Result<std::string> DecompressZstd(std::string_view data, size_t num_threads) {
+    // Frames that record their decompressed size can each be decompressed into their place in
+    // the output in parallel. mkbootfs writes one such frame per 8 MiB, but other tools may not
+    // record the size, in which case the whole stream is decompressed on this thread instead.
+    struct Frame {
+        size_t offset;
+        size_t size;
+        size_t out_offset;
+        size_t out_size;
+    };
+    std::vector<Frame> frames;
+    size_t out_size = 0;
+    for (size_t pos = 0; pos < data.size();) {
+        size_t size = ZSTD_findFrameCompressedSize(data.data() + pos, data.size() - pos);
+        if (ZSTD_isError(size)) {
+            return Error() << "Invalid zstd frame at offset " << pos << ": "
+                           << ZSTD_getErrorName(size);
+        }
+        unsigned long long content_size = ZSTD_getFrameContentSize(data.data() + pos, size);
+        if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size == ZSTD_CONTENTSIZE_ERROR) {
+            return DecompressZstdStream(data);
+        }
+        frames.push_back({pos, size, out_size, static_cast<size_t>(content_size)});
+        out_size += content_size;
+        pos += size;
+    }
+
+    std::string out(out_size, '\0');
+    auto result = RunParallel(frames.size(), num_threads, [&](size_t i) -> Result<void> {
+        const auto& frame = frames[i];
+        size_t size = ZSTD_decompress(out.data() + frame.out_offset, frame.out_size,
+                                      data.data() + frame.offset, frame.size);
+        if (ZSTD_isError(size) || size != frame.out_size) {
+            return Error() << "Could not decompress zstd frame at offset " << frame.offset;
+        }
+        return {};
+    });
+    if (!result.ok()) {
+        return result.error();
+    }
+    return out;
+}
+
+// The newc format: a six character magic number followed by thirteen 8-digit hex fields.
+constexpr size_t kCpioHeaderSize = 6 + 13 * 8;
+
+enum CpioField {
+    kIno,
+    kMode,
+    kUid,
+    kGid,
+    kNlink,
+    kMtime,
+    kFileSize,
+    kDevMajor,
+    kDevMinor,
+    kRdevMajor,
+    kRdevMinor,
+    kNameSize,
+    kCheck,
+};
+
+bool ParseCpioHeader(std::string_view header, uint32_t (&fields)[13]) {
+    if (header.substr(0, 6) != "070701" && header.substr(0, 6) != "070702") {
+        return false;
+    }
+    for (size_t i = 0; i < 13; i++) {
+        uint32_t value = 0;
+        for (char c : header.substr(6 + i * 8, 8)) {
+            int digit;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            } else {
+                return false;
+            }
+            value = (value << 4) | digit;
+        }
+        fields[i] = value;
+    }
+    return true;
+}
+
+size_t Align4(size_t pos) {
+    return (pos + 3) & ~3;
+}
+
+bool IsSafeCpioPath(const std::string& name) {
+    if (name.empty() || name[0] == '/') {
+        return false;
+    }
+    for (const auto& component : Split(name, "/")) {
+        if (component == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+Result<void> ExtractCpioEntry(const std::string& path, const uint32_t (&fields)[13],
+                              std::string_view data) {
+    mode_t mode = fields[kMode];
+    mode_t perms = mode & 07777;
+    uid_t uid = fields[kUid];
+    gid_t gid = fields[kGid];
+
+    switch (mode & S_IFMT) {
+        case S_IFDIR:
+            // Directories may already exist in the ramdisk the archive is extracted into.
+            if (mkdir(path.c_str(), perms) != 0 && errno != EEXIST) {
+                return ErrnoError() << "mkdir(" << path << ") failed";
+            }
+            if (chmod(path.c_str(), perms) != 0) {
+                return ErrnoError() << "chmod(" << path << ") failed";
+            }
+            break;
+        case S_IFREG: {
+            unique_fd fd(TEMP_FAILURE_RETRY(
+                    open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                         perms)));
+            if (fd == -1) {
+                return ErrnoError() << "open(" << path << ") failed";
+            }
+            if (!WriteFully(fd, data.data(), data.size())) {
+                return ErrnoError() << "Could not write " << path;
+            }
+            if (fchmod(fd.get(), perms) != 0) {
+                return ErrnoError() << "fchmod(" << path << ") failed";
+            }
+            break;
+        }
+        case S_IFLNK:
+            unlink(path.c_str());
+            if (symlink(std::string(data).c_str(), path.c_str()) != 0) {
+                return ErrnoError() << "symlink(" << path << ") failed";
+            }
+            break;
+        case S_IFCHR:
+        case S_IFBLK:
+        case S_IFIFO:
+        case S_IFSOCK:
+            unlink(path.c_str());
+            if (mknod(path.c_str(), mode, makedev(fields[kRdevMajor], fields[kRdevMinor])) != 0) {
+                return ErrnoError() << "mknod(" << path << ") failed";
+            }
+            break;
+        default:
+            return Error() << "Unknown file type " << std::oct << mode << " for " << path;
+    }
+
+    if (lchown(path.c_str(), uid, gid) != 0) {
+        return ErrnoError() << "lchown(" << path << ") failed";
+    }
+    return {};
+}
+
+}  // namespace
+
+Result<std::string> DecompressRamdisk(std::string_view data, size_t num_threads) {
+    if (data.size() < sizeof(uint32_t)) {
+        return Error() << "Compressed ramdisk is too small";
+    }
+    switch (ReadLe32(data.data())) {
+        case kLz4LegacyMagic:
+            return DecompressLz4Legacy(data, std::max<size_t>(num_threads, 1));
+        case kZstdMagic:
+            return DecompressZstd(data, std::max<size_t>(num_threads, 1));
+        default:
+            return Error() << "Compressed ramdisk is neither lz4 legacy nor zstd";
+    }
+}
+
+Result<void> ExtractCpio(std::string_view archive, const std::string& dir) {
+    for (size_t pos = 0;;) {
+        if (archive.size() - pos < kCpioHeaderSize) {
+            return Error() << "Truncated cpio header at offset " << pos;
+        }
+        uint32_t fields[13];
+        if (!ParseCpioHeader(archive.substr(pos, kCpioHeaderSize), fields)) {
+            return Error() << "Invalid cpio header at offset " << pos;
+        }
+
+        // The name size includes its NUL terminator.
+        size_t name_offset = pos + kCpioHeaderSize;
+        if (fields[kNameSize] == 0 || fields[kNameSize] > archive.size() - name_offset) {
+            return Error() << "Invalid cpio name size at offset " << pos;
+        }
+        std::string name(archive.substr(name_offset, fields[kNameSize] - 1));
+        size_t data_offset = Align4(name_offset + fields[kNameSize]);
+        if (data_offset > archive.size() || fields[kFileSize] > archive.size() - data_offset) {
+            return Error() << "Truncated cpio data for " << name;
+        }
+        std::string_view data = archive.substr(data_offset, fields[kFileSize]);
+        pos = std::min(Align4(data_offset + fields[kFileSize]), archive.size());
+
+        if (name == "TRAILER!!!") {
+            return {};
+        }
+        if (name == ".") {
+            continue;
+        }
+        if (!IsSafeCpioPath(name)) {
+            return Error() << "Refusing to extract " << name << " outside of " << dir;
+        }
+        if (auto result = ExtractCpioEntry(dir + "/" + name, fields, data); !result.ok()) {
+            return result.error();
+        }
+    }
+}
+
+Result<void> ExtractCompressedRamdisk(const std::string& path, const std::string& dir,
+                                      size_t num_threads) {
+    std::string compressed;
+    if (!ReadFileToString(path, &compressed)) {
+        return ErrnoError() << "Could not read " << path;
+    }
+    if (unlink(path.c_str()) != 0) {
+        return ErrnoError() << "unlink(" << path << ") failed";
+    }
+
+    auto archive = DecompressRamdisk(compressed, num_threads);
+    if (!archive.ok()) {
+        return archive.error();
+    }
+    std::string().swap(compressed);
+
+    return ExtractCpio(*archive, dir);
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+#include <string_view>
+
+#include "result.h"
+
+namespace android {
+namespace init {
+
+// A cpio archive of the files first stage init needs, packaged into the first stage ramdisk by
+// `mkbootfs -c`. First stage init unpacks it into the ramdisk root before loading kernel modules.
+static constexpr const char kCompressedRamdiskLz4[] = "/second_stage_ramdisk.cpio.lz4";
+static constexpr const char kCompressedRamdiskZstd[] = "/second_stage_ramdisk.cpio.zst";
+
+// Decompresses |data|, which is either in the lz4 legacy format or a series of zstd frames.
+// Independent lz4 blocks and zstd frames are decompressed on up to |num_threads| threads.
+Result<std::string> DecompressRamdisk(std::string_view data, size_t num_threads);
+
+// Extracts the newc format cpio archive |archive| into the directory |dir|.
+Result<void> ExtractCpio(std::string_view archive, const std::string& dir);
+
+// Decompresses the archive at |path| and extracts it into |dir|. |path| is removed once read, so
+// that the compressed and the extracted files don't take up memory at the same time.
+Result<void> ExtractCompressedRamdisk(const std::string& path, const std::string& dir,
+                                      size_t num_threads);
+
+}  // namespace init
+}  // namespace android
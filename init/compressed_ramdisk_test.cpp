@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compressed_ramdisk.h"
+
+#include <lz4.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <gtest/gtest.h>
+
+using android::base::ReadFileToString;
+using android::base::StringAppendF;
+using android::base::WriteStringToFile;
+
+using namespace std::string_literals;
+
+namespace android {
+namespace init {
+
+static constexpr size_t kChunkSize = 8 << 20;
+
+static void AppendCpioEntry(std::string* archive, const std::string& name, mode_t mode,
+                            const std::string& data) {
+    StringAppendF(archive, "070701%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08zx%08x", 0,
+                  mode, 0, 0, 1, 0, static_cast<unsigned>(data.size()), 0, 0, 0, 0,
+                  name.size() + 1, 0);
+    *archive += name;
+    *archive += '\0';
+    archive->resize((archive->size() + 3) & ~3);
+    *archive += data;
+    archive->resize((archive->size() + 3) & ~3);
+}
+
+// Larger than two compressed chunks, so that the archive is decompressed on several threads.
+static std::string LargeFile() {
+    std::string large;
+    for (size_t i = 0; large.size() < 2 * kChunkSize + 12345; i++) {
+        large += std::to_string(i);
+    }
+    return large;
+}
+
+static std::string TestArchive() {
+    std::string archive;
+    AppendCpioEntry(&archive, "system", S_IFDIR | 0755, "");
+    AppendCpioEntry(&archive, "system/small", S_IFREG | 0644, "small file");
+    AppendCpioEntry(&archive, "system/large", S_IFREG | 0600, LargeFile());
+    AppendCpioEntry(&archive, "system/link", S_IFLNK | 0777, "small");
+    AppendCpioEntry(&archive, "TRAILER!!!", 0, "");
+    return archive;
+}
+
+static void CheckExtracted(const std::string& dir) {
+    std::string contents;
+    ASSERT_TRUE(ReadFileToString(dir + "/system/small", &contents));
+    EXPECT_EQ("small file", contents);
+    ASSERT_TRUE(ReadFileToString(dir + "/system/large", &contents));
+    EXPECT_TRUE(contents == LargeFile());
+
+    struct stat st;
+    ASSERT_EQ(0, stat((dir + "/system/large").c_str(), &st));
+    EXPECT_EQ(0600U, st.st_mode & 07777);
+    ASSERT_EQ(0, lstat((dir + "/system/link").c_str(), &st));
+    EXPECT_TRUE(S_ISLNK(st.st_mode));
+}
+
+static std::string CompressLz4Legacy(const std::string& data) {
+    std::string out = "\x02\x21\x4c\x18"s;
+    for (size_t pos = 0; pos < data.size(); pos += kChunkSize) {
+        size_t size = std::min(kChunkSize, data.size() - pos);
+        std::string block(LZ4_compressBound(size), '\0');
+        int compressed =
+                LZ4_compress_default(data.data() + pos, block.data(), size, block.size());
+        EXPECT_GT(compressed, 0);
+        uint32_t le_size = compressed;
+        out.append(reinterpret_cast<const char*>(&le_size), sizeof(le_size));
+        out.append(block.data(), compressed);
+    }
+    return out;
+}
+
+static std::string CompressZstd(const std::string& data) {
+    std::string out;
+    for (size_t pos = 0; pos < data.size(); pos += kChunkSize) {
+        size_t size = std::min(kChunkSize, data.size() - pos);
+        std::string frame(ZSTD_compressBound(size), '\0');
+        size_t compressed = ZSTD_compress(frame.data(), frame.size(), data.data() + pos, size, 1);
+        EXPECT_FALSE(ZSTD_isError(compressed));
+        out.append(frame.data(), compressed);
+    }
+    return out;
+}
+
+TEST(compressed_ramdisk, ExtractLz4) {
+    TemporaryDir dir;
+    std::string path = dir.path + "/ramdisk.cpio.lz4"s;
+    auto archive = TestArchive();
+    ASSERT_TRUE(WriteStringToFile(CompressLz4Legacy(archive), path));
+
+    auto result = ExtractCompressedRamdisk(path, dir.path, 4);
+    ASSERT_TRUE(result.ok()) << result.error();
+    EXPECT_NE(0, access(path.c_str(), F_OK));
+    CheckExtracted(dir.path);
+}
+
+TEST(compressed_ramdisk, ExtractZstd) {
+    TemporaryDir dir;
+    std::string path = dir.path + "/ramdisk.cpio.zst"s;
+    auto archive = TestArchive();
+    ASSERT_TRUE(WriteStringToFile(CompressZstd(archive), path));
+
+    auto result = ExtractCompressedRamdisk(path, dir.path, 4);
+    ASSERT_TRUE(result.ok()) << result.error();
+    CheckExtracted(dir.path);
+}
+
+TEST(compressed_ramdisk, DecompressAnyThreadCount) {
+    auto archive = TestArchive();
+    auto lz4 = CompressLz4Legacy(archive);
+    auto zstd = CompressZstd(archive);
+    for (size_t threads : {1, 3}) {
+        auto result = DecompressRamdisk(lz4, threads);
+        ASSERT_TRUE(result.ok()) << result.error();
+        EXPECT_TRUE(*result == archive);
+        result = DecompressRamdisk(zstd, threads);
+        ASSERT_TRUE(result.ok()) << result.error();
+        EXPECT_TRUE(*result == archive);
+    }
+}
+
+TEST(compressed_ramdisk, RejectsPathsOutsideDir) {
+    TemporaryDir dir;
+    std::string archive;
+    AppendCpioEntry(&archive, "../escaped", S_IFREG | 0644, "");
+    AppendCpioEntry(&archive, "TRAILER!!!", 0, "");
+
+    EXPECT_FALSE(ExtractCpio(archive, dir.path).ok());
+}
+
+TEST(compressed_ramdisk, RejectsTruncatedArchive) {
+    TemporaryDir dir;
+    auto archive = TestArchive();
+
+    EXPECT_FALSE(ExtractCpio(archive.substr(0, archive.size() / 2), dir.path).ok());
+    EXPECT_FALSE(DecompressRamdisk(CompressLz4Legacy(archive).substr(0, 1000), 2).ok());
+}
+
+}  // namespace init
+}  // namespace android
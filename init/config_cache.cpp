@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/mapped_file.h>
+#include <android-base/unique_fd.h>
+
+#include "util.h"
+
+using android::base::Dirname;
+using android::base::MappedFile;
+using android::base::unique_fd;
+using android::base::WriteStringToFd;
+
+namespace android {
+namespace init {
+
+static int64_t ToNanoseconds(const struct timespec& ts) {
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static bool StatMatches(const ConfigCacheProto::File& file, const struct stat& st) {
+    return file.inode() == st.st_ino && file.size() == static_cast<uint64_t>(st.st_size) &&
+           file.mtime_ns() == ToNanoseconds(st.st_mtim) &&
+           file.ctime_ns() == ToNanoseconds(st.st_ctim);
+}
+
+ConfigCache::ConfigCache(const std::string& fingerprint) {
+    auto lock = std::lock_guard{lock_};
+    used_.set_fingerprint(fingerprint);
+}
+
+std::unique_ptr<ConfigCache> ConfigCache::Load(const std::string& path,
+                                               const std::string& fingerprint) {
+    auto cache = std::unique_ptr<ConfigCache>(new ConfigCache(fingerprint));
+
+    unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Could not open config cache " << path;
+        }
+        return cache;
+    }
+
+    // The cache stands in for the config files themselves, so only trust it as much as
+    // ReadFile() would trust them.
+    struct stat st;
+    if (fstat(fd.get(), &st) == -1 || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        LOG(WARNING) << "Ignoring insecure config cache " << path;
+        return cache;
+    }
+    if (st.st_size == 0) {
+        return cache;
+    }
+
+    auto mapped = MappedFile::FromFd(fd, 0, st.st_size, PROT_READ);
+    if (!mapped || !cache->loaded_.ParseFromArray(mapped->data(), mapped->size())) {
+        LOG(WARNING) << "Could not parse config cache " << path;
+        cache->loaded_.Clear();
+        return cache;
+    }
+    if (cache->loaded_.fingerprint() != fingerprint) {
+        LOG(INFO) << "Config cache " << path << " is from a different build";
+        cache->loaded_.Clear();
+        return cache;
+    }
+
+    for (const auto& file : cache->loaded_.files()) {
+        cache->loaded_files_.emplace(file.path(), &file);
+    }
+    return cache;
+}
+
+std::optional<std::vector<Parser::ConfigLine>> ConfigCache::Find(const std::string& path,
+                                                                   const struct stat& st) {
+    auto it = loaded_files_.find(path);
+    if (it == loaded_files_.end() || !StatMatches(*it->second, st)) {
+        return {};
+    }
+    const auto& file = *it->second;
+
+    std::vector<Parser::ConfigLine> lines;
+    lines.reserve(file.lines_size());
+    for (const auto& line : file.lines()) {
+        lines.push_back({line.line(), {line.args().begin(), line.args().end()}});
+    }
+
+    auto lock = std::lock_guard{lock_};
+    *used_.add_files() = file;
+    return lines;
+}
+
+void ConfigCache::Add(const std::string& path, const struct stat& st,
+                      const std::vector<Parser::ConfigLine>& lines) {
+    ConfigCacheProto::File file;
+    file.set_path(path);
+    file.set_inode(st.st_ino);
+    file.set_size(st.st_size);
+    file.set_mtime_ns(ToNanoseconds(st.st_mtim));
+    file.set_ctime_ns(ToNanoseconds(st.st_ctim));
+    for (const auto& [line_number, args] : lines) {
+        auto line = file.add_lines();
+        line->set_line(line_number);
+        for (const auto& arg : args) {
+            line->add_args(arg);
+        }
+    }
+
+    auto lock = std::lock_guard{lock_};
+    *used_.add_files() = std::move(file);
+    dirty_ = true;
+}
+
+Result<void> ConfigCache::Save(const std::string& path) {
+    auto lock = std::lock_guard{lock_};
+    if (!dirty_) {
+        return {};
+    }
+
+    auto dir = Dirname(path);
+    if (!mkdir_recursive(dir, 0700)) {
+        return ErrnoError() << "Could not create " << dir;
+    }
+
+    const std::string temp_path = path + ".tmp";
+    unique_fd fd(TEMP_FAILURE_RETRY(
+            open(temp_path.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0600)));
+    if (fd == -1) {
+        return ErrnoError() << "Could not open temporary config cache";
+    }
+    std::string serialized_string;
+    if (!used_.SerializeToString(&serialized_string)) {
+        return Error() << "Unable to serialize config cache";
+    }
+    if (!WriteStringToFd(serialized_string, fd)) {
+        return ErrnoError() << "Unable to write config cache";
+    }
+    fsync(fd.get());
+    fd.reset();
+
+    if (rename(temp_path.c_str(), path.c_str())) {
+        int saved_errno = errno;
+        unlink(temp_path.c_str());
+        return Error(saved_errno) << "Unable to rename config cache";
+    }
+    dirty_ = false;
+    return {};
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/thread_annotations.h>
+
+#include "parser.h"
+#include "result.h"
+#include "system/core/init/config_cache.pb.h"
+
+namespace android {
+namespace init {
+
+// Tokenized config files from a previous boot, so that files that did not change since don't need
+// to be read and tokenized again.
+//
+// A cache is only used if it was written for the same build fingerprints, and each of its files
+// only if it still has the same inode, size, mtime and ctime. Files from a new build or pushed to
+// a remounted partition are thus read as text again. Find() and Add() may be called from any
+// thread.
+class ConfigCache {
+  public:
+    // Loads the cache at |path|. It starts out empty if it cannot be loaded or if it was written
+    // for a different |fingerprint|.
+    static std::unique_ptr<ConfigCache> Load(const std::string& path,
+                                             const std::string& fingerprint);
+
+    std::optional<std::vector<Parser::ConfigLine>> Find(const std::string& path,
+                                                        const struct stat& st);
+    void Add(const std::string& path, const struct stat& st,
+             const std::vector<Parser::ConfigLine>& lines);
+
+    // Writes every file found or added since Load() to |path|, if any file was added.
+    Result<void> Save(const std::string& path);
+
+  private:
+    explicit ConfigCache(const std::string& fingerprint);
+
+    ConfigCacheProto loaded_;
+    std::unordered_map<std::string, const ConfigCacheProto::File*> loaded_files_;
+
+    std::mutex lock_;
+    ConfigCacheProto used_ GUARDED_BY(lock_);
+    bool dirty_ GUARDED_BY(lock_) = false;
+};
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config_cache.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <gtest/gtest.h>
+
+using android::base::Join;
+using android::base::WriteStringToFile;
+
+using namespace std::string_literals;
+
+namespace android {
+namespace init {
+
+// Records each section and line it is given, so that parses can be compared.
+class RecordingParser : public SectionParser {
+  public:
+    explicit RecordingParser(std::vector<std::string>* records) : records_(records) {}
+
+    Result<void> ParseSection(std::vector<std::string>&& args, const std::string& filename,
+                              int line) override {
+        records_->emplace_back(std::to_string(line) + ": " + Join(args, ' '));
+        return {};
+    }
+    Result<void> ParseLineSection(std::vector<std::string>&& args, int line) override {
+        records_->emplace_back(std::to_string(line) + ":   " + Join(args, ' '));
+        return {};
+    }
+
+  private:
+    std::vector<std::string>* records_;
+};
+
+static std::vector<std::string> ParseWithCache(const std::string& path, ConfigCache* cache) {
+    std::vector<std::string> records;
+    Parser parser;
+    parser.AddSectionParser("on", std::make_unique<RecordingParser>(&records));
+    parser.set_config_cache(cache);
+    EXPECT_TRUE(parser.ParseConfig(path));
+    return records;
+}
+
+TEST(config_cache, Roundtrip) {
+    TemporaryDir dir;
+    std::string config = dir.path + "/test.rc"s;
+    std::string cache_path = dir.path + "/cache/config_cache"s;
+    ASSERT_TRUE(WriteStringToFile("on boot\n    setprop a \"b c\"\n\n# c\non late-init\n", config));
+
+    auto cache = ConfigCache::Load(cache_path, "fingerprint");
+    auto uncached = ParseWithCache(config, cache.get());
+    ASSERT_TRUE(cache->Save(cache_path).ok());
+
+    cache = ConfigCache::Load(cache_path, "fingerprint");
+    EXPECT_EQ(uncached, ParseWithCache(config, cache.get()));
+
+    // Everything came from the cache, so there is nothing new to save.
+    std::string unused_path = dir.path + "/unused"s;
+    ASSERT_TRUE(cache->Save(unused_path).ok());
+    EXPECT_NE(0, access(unused_path.c_str(), F_OK));
+}
+
+TEST(config_cache, FingerprintMismatch) {
+    TemporaryDir dir;
+    std::string config = dir.path + "/test.rc"s;
+    std::string cache_path = dir.path + "/config_cache"s;
+    ASSERT_TRUE(WriteStringToFile("on boot\n", config));
+
+    struct stat st;
+    ASSERT_EQ(0, stat(config.c_str(), &st));
+    auto cache = ConfigCache::Load(cache_path, "old");
+    cache->Add(config, st, {{1, {"on", "boot"}}});
+    ASSERT_TRUE(cache->Save(cache_path).ok());
+
+    EXPECT_TRUE(ConfigCache::Load(cache_path, "old")->Find(config, st).has_value());
+    EXPECT_FALSE(ConfigCache::Load(cache_path, "new")->Find(config, st).has_value());
+}
+
+TEST(config_cache, ChangedFile) {
+    TemporaryDir dir;
+    std::string config = dir.path + "/test.rc"s;
+    std::string cache_path = dir.path + "/config_cache"s;
+    ASSERT_TRUE(WriteStringToFile("on boot\n", config));
+
+    auto cache = ConfigCache::Load(cache_path, "fingerprint");
+    ParseWithCache(config, cache.get());
+    ASSERT_TRUE(cache->Save(cache_path).ok());
+
+    ASSERT_TRUE(WriteStringToFile("on early-init\n", config));
+    cache = ConfigCache::Load(cache_path, "fingerprint");
+    EXPECT_EQ(std::vector<std::string>{"1: on early-init"}, ParseWithCache(config, cache.get()));
+}
+
+}  // namespace init
+}  // namespace android
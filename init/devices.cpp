@@ -23,6 +23,7 @@
 
 #include <chrono>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <string>
 #include <thread>
@@ -133,7 +134,8 @@ Permissions::Permissions(const std::string& name, mode_t perm, uid_t uid, gid_t
       gid_(gid),
       prefix_(false),
       wildcard_(false),
-      no_fnm_pathname_(no_fnm_pathname) {
+      no_fnm_pathname_(no_fnm_pathname),
+      literal_prefix_length_(0) {
     // Set 'prefix_' or 'wildcard_' based on the below cases:
     //
     // 1) No '*' in 'name' -> Neither are set and Match() checks a given path for strict
@@ -153,6 +155,8 @@ Permissions::Permissions(const std::string& name, mode_t perm, uid_t uid, gid_t
             wildcard_ = true;
         }
     }
+    // fnmatch() only compares the text before its first special character literally.
+    literal_prefix_length_ = wildcard_ ? name_.find_first_of("*?[\\") : name_.length();
 }
 
 bool Permissions::Match(const std::string& path) const {
@@ -172,6 +176,27 @@ bool SysfsPermissions::MatchWithSubsystem(const std::string& path,
     return Match(path);
 }
 
+void PermissionsTrie::Insert(std::string_view prefix, size_t rule) {
+    size_t node = 0;
+    for (char c : prefix) {
+        auto [it, inserted] = nodes_[node].children.emplace(c, nodes_.size());
+        node = it->second;
+        if (inserted) nodes_.emplace_back();
+    }
+    nodes_[node].rules.emplace_back(rule);
+}
+
+void PermissionsTrie::FindCandidates(std::string_view path, std::vector<size_t>* rules) const {
+    size_t node = 0;
+    for (size_t i = 0;; ++i) {
+        rules->insert(rules->end(), nodes_[node].rules.begin(), nodes_[node].rules.end());
+        if (i == path.size()) return;
+        auto it = nodes_[node].children.find(path[i]);
+        if (it == nodes_[node].children.end()) return;
+        node = it->second;
+    }
+}
+
 void SysfsPermissions::SetPermissions(const std::string& path) const {
     std::string attribute_file = path + "/" + attribute_;
     LOG(VERBOSE) << "fixup " << attribute_file << " " << uid() << " " << gid() << " " << std::oct
@@ -256,7 +281,20 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
     // contain, so we prepend it...
     std::string path = "/sys" + upath;
 
-    for (const auto& s : sysfs_permissions_) {
+    // MatchWithSubsystem() also tries the path under the subsystem's class and bus directories.
+    std::string path_basename = Basename(path);
+    std::vector<size_t> candidates;
+    sysfs_permissions_trie_.FindCandidates(path, &candidates);
+    sysfs_permissions_trie_.FindCandidates("/sys/class/" + subsystem + "/" + path_basename,
+                                           &candidates);
+    sysfs_permissions_trie_.FindCandidates(
+            "/sys/bus/" + subsystem + "/devices/" + path_basename, &candidates);
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    // Every matching rule applies, in the order they were parsed.
+    for (size_t i : candidates) {
+        const auto& s = sysfs_permissions_[i];
         if (s.MatchWithSubsystem(path, subsystem)) s.SetPermissions(path);
     }
 
@@ -270,11 +308,20 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
 
 std::tuple<mode_t, uid_t, gid_t> DeviceHandler::GetDevicePermissions(
     const std::string& path, const std::vector<std::string>& links) const {
+    std::vector<size_t> candidates;
+    dev_permissions_trie_.FindCandidates(path, &candidates);
+    for (const auto& link : links) {
+        dev_permissions_trie_.FindCandidates(link, &candidates);
+    }
+
     // Search the perms list in reverse so that ueventd.$hardware can override ueventd.rc.
-    for (auto it = dev_permissions_.crbegin(); it != dev_permissions_.crend(); ++it) {
-        if (it->Match(path) || std::any_of(links.cbegin(), links.cend(),
-                                           [it](const auto& link) { return it->Match(link); })) {
-            return {it->perm(), it->uid(), it->gid()};
+    std::sort(candidates.begin(), candidates.end(), std::greater<size_t>());
+    for (size_t i : candidates) {
+        const auto& permissions = dev_permissions_[i];
+        if (permissions.Match(path) ||
+            std::any_of(links.cbegin(), links.cend(),
+                        [&permissions](const auto& link) { return permissions.Match(link); })) {
+            return {permissions.perm(), permissions.uid(), permissions.gid()};
         }
     }
     /* Default if nothing found. */
@@ -586,7 +633,14 @@ DeviceHandler::DeviceHandler(std::vector<Permissions> dev_permissions,
       subsystems_(std::move(subsystems)),
       boot_devices_(std::move(boot_devices)),
       skip_restorecon_(skip_restorecon),
-      sysfs_mount_point_("/sys") {}
+      sysfs_mount_point_("/sys") {
+    for (size_t i = 0; i < dev_permissions_.size(); ++i) {
+        dev_permissions_trie_.Insert(dev_permissions_[i].literal_prefix(), i);
+    }
+    for (size_t i = 0; i < sysfs_permissions_.size(); ++i) {
+        sysfs_permissions_trie_.Insert(sysfs_permissions_[i].literal_prefix(), i);
+    }
+}
 
 DeviceHandler::DeviceHandler()
     : DeviceHandler(std::vector<Permissions>{}, std::vector<SysfsPermissions>{},
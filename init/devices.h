@@ -21,8 +21,10 @@
 #include <sys/types.h>
 
 #include <algorithm>
+#include <map>
 #include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <android-base/file.h>
@@ -42,6 +44,11 @@ class Permissions {
 
     bool Match(const std::string& path) const;
 
+    // The part of the name that every matching path starts with.
+    std::string_view literal_prefix() const {
+        return std::string_view(name_).substr(0, literal_prefix_length_);
+    }
+
     mode_t perm() const { return perm_; }
     uid_t uid() const { return uid_; }
     gid_t gid() const { return gid_; }
@@ -57,6 +64,7 @@ class Permissions {
     bool prefix_;
     bool wildcard_;
     bool no_fnm_pathname_;
+    size_t literal_prefix_length_;
 };
 
 class SysfsPermissions : public Permissions {
@@ -74,6 +82,24 @@ class SysfsPermissions : public Permissions {
     const std::string attribute_;
 };
 
+// Files rules under their literal prefix, so that a path is only matched against the rules whose
+// literal prefix starts it instead of against every rule.
+class PermissionsTrie {
+  public:
+    PermissionsTrie() : nodes_(1) {}
+
+    void Insert(std::string_view prefix, size_t rule);
+    // Appends the rules filed under any prefix of |path|, in no particular order.
+    void FindCandidates(std::string_view path, std::vector<size_t>* rules) const;
+
+  private:
+    struct Node {
+        std::vector<size_t> rules;
+        std::map<char, size_t> children;
+    };
+    std::vector<Node> nodes_;
+};
+
 class Subsystem {
   public:
     friend class SubsystemParser;
@@ -141,6 +167,8 @@ class DeviceHandler : public UeventHandler {
 
     std::vector<Permissions> dev_permissions_;
     std::vector<SysfsPermissions> sysfs_permissions_;
+    PermissionsTrie dev_permissions_trie_;
+    PermissionsTrie sysfs_permissions_trie_;
     std::vector<Subsystem> subsystems_;
     std::set<std::string> boot_devices_;
     bool skip_restorecon_;
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <filesystem>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "devices.h"
+#include "ueventd_parser.h"
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace init {
+
+class DeviceHandlerTester {
+  public:
+    static std::tuple<mode_t, uid_t, gid_t> GetDevicePermissions(
+            const DeviceHandler& device_handler, const std::string& path) {
+        return device_handler.GetDevicePermissions(path, {});
+    }
+};
+
+static void RunDevicePermissions(benchmark::State& state, const DeviceHandler& device_handler,
+                                 const std::vector<std::string>& paths) {
+    while (state.KeepRunning()) {
+        for (const auto& path : paths) {
+            benchmark::DoNotOptimize(DeviceHandlerTester::GetDevicePermissions(device_handler, path));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+
+// Looks up the permissions of the device's own nodes under the device's ueventd.rc rules.
+static void BenchmarkDevicePermissions(benchmark::State& state) {
+    auto config = ParseConfig({"/system/etc/ueventd.rc", "/vendor/etc/ueventd.rc",
+                               "/odm/etc/ueventd.rc", "/vendor/ueventd.rc", "/odm/ueventd.rc"});
+    if (config.dev_permissions.empty()) {
+        state.SkipWithError("No ueventd.rc rules found");
+        return;
+    }
+    DeviceHandler device_handler(std::move(config.dev_permissions), {}, {}, {}, false);
+
+    std::vector<std::string> paths;
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator("/dev", ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        paths.emplace_back(it->path());
+    }
+    RunDevicePermissions(state, device_handler, paths);
+}
+
+BENCHMARK(BenchmarkDevicePermissions);
+
+// Looks up devices under a synthetic rule set of the given size, with a mix of exact, prefix and
+// wildcard rules like those found in ueventd.rc.
+static void BenchmarkDevicePermissionsSynthetic(benchmark::State& state) {
+    std::vector<Permissions> rules;
+    std::vector<std::string> paths;
+    for (int64_t i = 0; i < state.range(0); i += 4) {
+        rules.emplace_back(StringPrintf("/dev/node%" PRId64, i), 0660, 0, 0, false);
+        rules.emplace_back(StringPrintf("/dev/class%" PRId64 "/*", i), 0660, 0, 0, false);
+        rules.emplace_back(StringPrintf("/dev/dev%" PRId64 "*name", i), 0660, 0, 0, false);
+        rules.emplace_back(StringPrintf("/dev/*/sub%" PRId64, i), 0660, 0, 0, false);
+
+        paths.emplace_back(StringPrintf("/dev/node%" PRId64, i));
+        paths.emplace_back(StringPrintf("/dev/class%" PRId64 "/member", i));
+        paths.emplace_back(StringPrintf("/dev/dev%" PRId64 "_0name", i));
+        paths.emplace_back(StringPrintf("/dev/other/sub%" PRId64, i));
+    }
+    paths.emplace_back("/dev/unmatched");
+    DeviceHandler device_handler(std::move(rules), {}, {}, {}, false);
+
+    RunDevicePermissions(state, device_handler, paths);
+}
+
+BENCHMARK(BenchmarkDevicePermissionsSynthetic)->Arg(100)->Arg(400)->Arg(1600);
+
+}  // namespace init
+}  // namespace android
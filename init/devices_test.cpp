@@ -56,6 +56,12 @@ class DeviceHandlerTester {
         }
     }
 
+    static std::tuple<mode_t, uid_t, gid_t> GetDevicePermissions(
+            const DeviceHandler& device_handler, const std::string& path,
+            const std::vector<std::string>& links) {
+        return device_handler.GetDevicePermissions(path, links);
+    }
+
   private:
     DeviceHandler device_handler_;
 };
@@ -328,5 +334,59 @@ TEST(device_handler, SysfsPermissionsMatchWithSubsystemBus) {
     EXPECT_EQ(1001U, permissions.gid());
 }
 
+TEST(device_handler, PermissionsLiteralPrefix) {
+    EXPECT_EQ("/dev/null", Permissions("/dev/null", 0666, 0, 0, false).literal_prefix());
+    EXPECT_EQ("/dev/dri/", Permissions("/dev/dri/*", 0666, 0, 0, false).literal_prefix());
+    EXPECT_EQ("/dev/device", Permissions("/dev/device*name", 0666, 0, 0, false).literal_prefix());
+    EXPECT_EQ("/dev/tty", Permissions("/dev/tty?/*x", 0666, 0, 0, false).literal_prefix());
+    EXPECT_EQ("", Permissions("*", 0666, 0, 0, false).literal_prefix());
+}
+
+TEST(device_handler, DevPermissionsLastMatchWins) {
+    std::vector<Permissions> rules = {
+            {"*", 0600, 1, 1, false},
+            {"/dev/tty*", 0601, 2, 2, false},
+            {"/dev/ttyS*", 0602, 3, 3, false},
+            {"/dev/tty*0", 0603, 4, 4, false},
+            {"/dev/null", 0604, 5, 5, false},
+            {"/dev/input/*", 0605, 6, 6, false},
+            {"/dev/*/event*", 0606, 7, 7, false},
+            {"/dev/block/by-name/system", 0607, 8, 8, false},
+            {"/dev/tty", 0610, 9, 9, false},
+    };
+    DeviceHandler device_handler(rules, {}, {}, {}, false);
+
+    const std::vector<std::pair<std::string, std::vector<std::string>>> queries = {
+            {"/dev/null", {}},
+            {"/dev/nullx", {}},
+            {"/dev/tty", {}},
+            {"/dev/tty1", {}},
+            {"/dev/ttyS1", {}},
+            {"/dev/ttyS0", {}},
+            {"/dev/input/event3", {}},
+            {"/dev/input/mice", {}},
+            {"/dev/sda", {}},
+            {"/dev/block/sda", {"/dev/block/by-name/system", "/dev/block/by-name/vendor"}},
+            {"/dev/block/sdb", {"/dev/tty0"}},
+    };
+    for (const auto& [path, links] : queries) {
+        // The rules that come later in ueventd.rc override the earlier ones.
+        std::tuple<mode_t, uid_t, gid_t> expected = {0600, 0, 0};
+        for (auto it = rules.crbegin(); it != rules.crend(); ++it) {
+            if (it->Match(path) || std::any_of(links.begin(), links.end(), [&](const auto& link) {
+                    return it->Match(link);
+                })) {
+                expected = {it->perm(), it->uid(), it->gid()};
+                break;
+            }
+        }
+        EXPECT_EQ(expected,
+                  DeviceHandlerTester::GetDevicePermissions(device_handler, path, links))
+                << path;
+    }
+    EXPECT_EQ(0607U, std::get<0>(DeviceHandlerTester::GetDevicePermissions(
+                             device_handler, "/dev/block/sda", {"/dev/block/by-name/system"})));
+}
+
 }  // namespace init
 }  // namespace android
@@ -18,11 +18,18 @@
 
 #include <stdint.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <map>
 
+#include <android-base/logging.h>
+
+using android::base::boot_clock;
+
 namespace android {
 namespace init {
 
@@ -91,5 +98,63 @@ Result<std::vector<std::shared_ptr<Epoll::Handler>>> Epoll::Wait(
     return pending_functions;
 }
 
+Result<void> Epoll::AddTimer(boot_clock::time_point deadline, Handler handler) {
+    if (timer_fd_ == -1) {
+        timer_fd_.reset(timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC));
+        if (timer_fd_ == -1) {
+            return ErrnoError() << "timerfd_create failed";
+        }
+        if (auto result = RegisterHandler(timer_fd_, [this]() { RunExpiredTimers(); });
+            !result.ok()) {
+            timer_fd_.reset();
+            return result;
+        }
+    }
+
+    bool earliest = timers_.empty() || deadline < timers_.top().deadline;
+    timers_.push({deadline, next_timer_sequence_++, std::move(handler)});
+    if (earliest) {
+        return ArmTimerFd();
+    }
+    return {};
+}
+
+Result<void> Epoll::ArmTimerFd() {
+    itimerspec spec = {};
+    if (!timers_.empty()) {
+        auto ns = timers_.top().deadline.time_since_epoch().count();
+        // A zero it_value disarms the timer, so deadlines at or before boot are moved to 1ns.
+        ns = std::max<decltype(ns)>(ns, 1);
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+        return ErrnoError() << "timerfd_settime failed";
+    }
+    return {};
+}
+
+void Epoll::RunExpiredTimers() {
+    uint64_t expirations;
+    if (read(timer_fd_, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        PLOG(ERROR) << "Failed to read timerfd";
+    }
+
+    // Handlers may add timers of their own, so take the expired ones off the queue first.
+    std::vector<Handler> expired;
+    auto now = boot_clock::now();
+    while (!timers_.empty() && timers_.top().deadline <= now) {
+        expired.emplace_back(timers_.top().handler);
+        timers_.pop();
+    }
+    if (auto result = ArmTimerFd(); !result.ok()) {
+        LOG(ERROR) << result.error();
+    }
+
+    for (const auto& handler : expired) {
+        handler();
+    }
+}
+
 }  // namespace init
 }  // namespace android
@@ -24,8 +24,10 @@
 #include <map>
 #include <memory>
 #include <optional>
+#include <queue>
 #include <vector>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/unique_fd.h>
 #include <android-base/macros.h>
 
@@ -46,9 +48,32 @@ class Epoll {
     Result<std::vector<std::shared_ptr<Handler>>> Wait(
             std::optional<std::chrono::milliseconds> timeout);
 
+    // Runs |handler| as one of the functions returned by Wait() once |deadline| has passed.
+    // Timers with the same deadline run in the order they were added.
+    Result<void> AddTimer(android::base::boot_clock::time_point deadline, Handler handler);
+
   private:
+    struct Timer {
+        android::base::boot_clock::time_point deadline;
+        uint64_t sequence;
+        Handler handler;
+
+        bool operator>(const Timer& other) const {
+            return deadline != other.deadline ? deadline > other.deadline
+                                              : sequence > other.sequence;
+        }
+    };
+
+    Result<void> ArmTimerFd();
+    void RunExpiredTimers();
+
     android::base::unique_fd epoll_fd_;
     std::map<int, std::shared_ptr<Handler>> epoll_handlers_;
+
+    // All timers share one timerfd, armed for the earliest deadline in |timers_|.
+    android::base::unique_fd timer_fd_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    uint64_t next_timer_sequence_ = 0;
 };
 
 }  // namespace init
@@ -19,10 +19,15 @@
 #include <sys/unistd.h>
 
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/file.h>
 #include <gtest/gtest.h>
 
+using namespace std::chrono_literals;
+
+using android::base::boot_clock;
+
 namespace android {
 namespace init {
 
@@ -72,5 +77,32 @@ TEST(epoll, UnregisterHandler) {
     ASSERT_TRUE(handler_invoked);
 }
 
+TEST(epoll, Timers) {
+    Epoll epoll;
+    ASSERT_RESULT_OK(epoll.Open());
+
+    std::vector<int> order;
+    auto now = boot_clock::now();
+    ASSERT_RESULT_OK(epoll.AddTimer(now + 20ms, [&]() { order.emplace_back(3); }));
+    ASSERT_RESULT_OK(epoll.AddTimer(now + 10ms, [&]() { order.emplace_back(1); }));
+    ASSERT_RESULT_OK(epoll.AddTimer(now + 10ms, [&]() { order.emplace_back(2); }));
+
+    while (order.size() < 3) {
+        auto results = epoll.Wait(1s);
+        ASSERT_RESULT_OK(results);
+        ASSERT_FALSE(results->empty());
+        for (const auto& function : *results) {
+            (*function)();
+        }
+    }
+    ASSERT_GE(boot_clock::now(), now + 20ms);
+    ASSERT_EQ(order, (std::vector<int>{1, 2, 3}));
+
+    // Nothing is left to fire.
+    auto results = epoll.Wait(10ms);
+    ASSERT_RESULT_OK(results);
+    ASSERT_TRUE(results->empty());
+}
+
 }  // namespace init
 }  // namespace android
@@ -16,6 +16,7 @@
 
 #include "firmware_handler.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <fnmatch.h>
 #include <glob.h>
@@ -67,14 +68,28 @@ static void LoadFirmware(const std::string& firmware, const std::string& root, i
     // Start transfer.
     WriteFully(loading_fd, "1", 1);
 
-    // Copy the firmware.
-    int rc = sendfile(data_fd, fw_fd, nullptr, fw_size);
-    if (rc == -1) {
-        PLOG(ERROR) << "firmware: sendfile failed { '" << root << "', '" << firmware << "' }";
+    // The file is read once, front to back, and never again once the kernel has its copy.
+    posix_fadvise(fw_fd, 0, fw_size, POSIX_FADV_SEQUENTIAL);
+
+    // Copy the firmware. sendfile() into the sysfs data node may transfer less than asked for.
+    bool ok = true;
+    off_t offset = 0;
+    while (static_cast<size_t>(offset) < fw_size) {
+        ssize_t rc = sendfile(data_fd, fw_fd, &offset, fw_size - offset);
+        if (rc == -1 && errno == EINTR) continue;
+        if (rc <= 0) {
+            if (rc == 0) errno = EIO;
+            PLOG(ERROR) << "firmware: sendfile failed after " << offset << " of " << fw_size
+                        << " bytes { '" << root << "', '" << firmware << "' }";
+            ok = false;
+            break;
+        }
     }
 
+    posix_fadvise(fw_fd, 0, fw_size, POSIX_FADV_DONTNEED);
+
     // Tell the firmware whether to abort or commit.
-    const char* response = (rc != -1) ? "0" : "-1";
+    const char* response = ok ? "0" : "-1";
     WriteFully(loading_fd, response, strlen(response));
 }
 
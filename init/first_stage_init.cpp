@@ -39,6 +39,8 @@
 #include <modprobe/modprobe.h>
 #include <private/android_filesystem_config.h>
 
+#include "buffered_kernel_logger.h"
+#include "compressed_ramdisk.h"
 #include "debug_ramdisk.h"
 #include "first_stage_console.h"
 #include "first_stage_mount.h"
@@ -205,7 +207,8 @@ bool LoadKernelModules(bool recovery, bool want_console, bool want_parallel, int
         std::string dir_path = MODULE_BASE_DIR "/";
         dir_path.append(module_dir);
         Modprobe m({dir_path}, GetModuleLoadList(recovery, dir_path));
-        bool retval = m.LoadListedModules(!want_console);
+        bool retval = (want_parallel) ? m.LoadModulesParallel(std::thread::hardware_concurrency())
+                                      : m.LoadListedModules(!want_console);
         modules_loaded = m.GetModuleCount();
         if (modules_loaded > 0) {
             return retval;
@@ -328,9 +331,28 @@ int FirstStageMain(int argc, char** argv) {
         old_root_dir.reset();
     }
 
+    // The compressed archive is extracted into the ramdisk root, so it is freed along with the
+    // rest of the ramdisk below. It may hold the kernel modules, so do this before loading them.
+    for (const char* compressed_ramdisk : {kCompressedRamdiskLz4, kCompressedRamdiskZstd}) {
+        if (access(compressed_ramdisk, F_OK) != 0) {
+            continue;
+        }
+        boot_clock::time_point extract_start_time = boot_clock::now();
+        if (auto result = ExtractCompressedRamdisk(compressed_ramdisk, "/",
+                                                   std::thread::hardware_concurrency());
+            !result.ok()) {
+            LOG(FATAL) << "Failed to extract " << compressed_ramdisk << ": " << result.error();
+        }
+        auto extract_elapse_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                boot_clock::now() - extract_start_time);
+        LOG(INFO) << "Extracted " << compressed_ramdisk << " took " << extract_elapse_time.count()
+                  << " ms";
+    }
+
     auto want_console = ALLOW_FIRST_STAGE_CONSOLE ? FirstStageConsole(cmdline, bootconfig) : 0;
     auto want_parallel =
-            bootconfig.find("androidboot.load_modules_parallel = \"true\"") != std::string::npos;
+            bootconfig.find("androidboot.load_modules_parallel = \"true\"") != std::string::npos ||
+            cmdline.find("androidboot.load_modules_parallel=true") != std::string::npos;
 
     boot_clock::time_point module_start_time = boot_clock::now();
     int module_count = 0;
@@ -431,6 +453,7 @@ int FirstStageMain(int argc, char** argv) {
     dup2(fd, STDOUT_FILENO);
     dup2(fd, STDERR_FILENO);
     close(fd);
+    FlushKernelLog();
     execv(path, const_cast<char**>(args));
 
     // execv() only returns if an error happened, in which case we
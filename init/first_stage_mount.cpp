@@ -308,13 +308,10 @@ bool FirstStageMount::InitDevices() {
 // Found partitions will then be removed from it for the subsequent member
 // function to check which devices are NOT created.
 bool FirstStageMount::InitRequiredDevices(std::set<std::string> devices) {
-    if (!block_dev_init_.InitDeviceMapper()) {
-        return false;
-    }
-    if (devices.empty()) {
-        return true;
-    }
-    return block_dev_init_.InitDevices(std::move(devices));
+    // Wait for device-mapper and the partitions together, so that the wait ends as soon as the
+    // last of them appears.
+    return block_dev_init_.InitDeviceSet(
+            {.misc_devices = {"device-mapper"}, .partitions = std::move(devices)});
 }
 
 // bool FirstStageMount::InitDmLinearBackingDevices(const android::fs_mgr::LpMetadata& metadata) {
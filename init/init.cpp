@@ -61,6 +61,7 @@
 
 #include "action_parser.h"
 #include "builtins.h"
+#include "config_cache.h"
 #include "epoll.h"
 #include "first_stage_init.h"
 #include "first_stage_mount.h"
@@ -284,6 +285,7 @@ void DebugRebootLogging() {
 void DumpState() {
     ServiceList::GetInstance().DumpState();
     ActionManager::GetInstance().DumpState();
+    BootTrace::GetInstance().DumpState();
 }
 
 Parser CreateParser(ActionManager& action_manager, ServiceList& service_list) {
@@ -353,11 +355,29 @@ Parser CreateApexConfigParser(ActionManager& action_manager, ServiceList& servic
     return parser;
 }
 
+// Boot scripts tokenized during a previous boot. /metadata is mounted by first stage init, if the
+// device has it, and unlike /data it is always available before the boot scripts are parsed.
+static constexpr const char kConfigCachePath[] = "/metadata/init/config_cache";
+
+// The boot scripts come from all of these partitions, so the config cache has to be rebuilt when
+// any of them is updated.
+static std::string GetConfigCacheFingerprint() {
+    std::vector<std::string> fingerprints;
+    for (const auto& partition : {"", "system_ext.", "vendor.", "odm.", "product."}) {
+        fingerprints.emplace_back(
+                GetProperty(StringPrintf("ro.%sbuild.fingerprint", partition), ""));
+    }
+    return android::base::Join(fingerprints, '\n');
+}
+
 static void LoadBootScripts(ActionManager& action_manager, ServiceList& service_list) {
     Parser parser = CreateParser(action_manager, service_list);
 
     std::string bootscript = GetProperty("ro.boot.init_rc", "");
     if (bootscript.empty()) {
+        auto config_cache = ConfigCache::Load(kConfigCachePath, GetConfigCacheFingerprint());
+        parser.set_config_cache(config_cache.get());
+
         parser.ParseConfig("/system/etc/init/hw/init.rc");
         if (!parser.ParseConfig("/system/etc/init")) {
             late_import_paths.emplace_back("/system/etc/init");
@@ -374,6 +394,11 @@ static void LoadBootScripts(ActionManager& action_manager, ServiceList& service_
         if (!parser.ParseConfig("/product/etc/init")) {
             late_import_paths.emplace_back("/product/etc/init");
         }
+
+        parser.set_config_cache(nullptr);
+        if (auto result = config_cache->Save(kConfigCachePath); !result.ok()) {
+            LOG(WARNING) << "Could not save config cache: " << result.error();
+        }
     } else {
         parser.ParseConfig(bootscript);
     }
@@ -398,34 +423,25 @@ void PropertyChanged(const std::string& name, const std::string& value) {
     prop_waiter_state.CheckAndResetWait(name, value);
 }
 
-static std::optional<boot_clock::time_point> HandleProcessActions() {
-    std::optional<boot_clock::time_point> next_process_action_time;
-    for (const auto& s : ServiceList::GetInstance()) {
-        if ((s->flags() & SVC_RUNNING) && s->timeout_period()) {
-            auto timeout_time = s->time_started() + *s->timeout_period();
-            if (boot_clock::now() > timeout_time) {
-                s->Timeout();
-            } else {
-                if (!next_process_action_time || timeout_time < *next_process_action_time) {
-                    next_process_action_time = timeout_time;
-                }
-            }
-        }
+// Times out or restarts the service named |name| if it is due. Services add a timer for this
+// whenever they get a new deadline, so a timer whose deadline has since moved finds nothing due.
+static void HandleProcessAction(const std::string& name) {
+    if (IsShuttingDown()) return;
 
-        if (!(s->flags() & SVC_RESTARTING)) continue;
+    Service* s = ServiceList::GetInstance().FindService(name);
+    if (!s) return;
 
-        auto restart_time = s->time_started() + s->restart_period();
-        if (boot_clock::now() > restart_time) {
-            if (auto result = s->Start(); !result.ok()) {
-                LOG(ERROR) << "Could not restart process '" << s->name() << "': " << result.error();
-            }
-        } else {
-            if (!next_process_action_time || restart_time < *next_process_action_time) {
-                next_process_action_time = restart_time;
-            }
+    if ((s->flags() & SVC_RUNNING) && s->timeout_period() &&
+        boot_clock::now() >= s->time_started() + *s->timeout_period()) {
+        s->Timeout();
+    }
+
+    if ((s->flags() & SVC_RESTARTING) &&
+        boot_clock::now() >= s->time_started() + s->restart_period()) {
+        if (auto result = s->Start(); !result.ok()) {
+            LOG(ERROR) << "Could not restart process '" << s->name() << "': " << result.error();
         }
     }
-    return next_process_action_time;
 }
 
 static Result<void> DoControlStart(Service* service) {
@@ -932,6 +948,16 @@ int SecondStageMain(int argc, char** argv) {
         PLOG(FATAL) << result.error();
     }
 
+    Service::set_process_action_scheduler(
+            [&epoll](const Service& service, boot_clock::time_point time) {
+                if (auto result = epoll.AddTimer(
+                            time, [name = service.name()]() { HandleProcessAction(name); });
+                    !result.ok()) {
+                    LOG(ERROR) << "Could not schedule process action for '" << service.name()
+                               << "': " << result.error();
+                }
+            });
+
     InstallSignalFdHandler(&epoll);
     InstallInitNotifier(&epoll);
     StartPropertyService(&property_fd);
@@ -1027,17 +1053,6 @@ int SecondStageMain(int argc, char** argv) {
         if (!(prop_waiter_state.MightBeWaiting() || Service::is_exec_service_running())) {
             am.ExecuteOneCommand();
         }
-        if (!IsShuttingDown()) {
-            auto next_process_action_time = HandleProcessActions();
-
-            // If there's a process that needs restarting, wake up in time for that.
-            if (next_process_action_time) {
-                epoll_timeout = std::chrono::ceil<std::chrono::milliseconds>(
-                        *next_process_action_time - boot_clock::now());
-                if (*epoll_timeout < 0ms) epoll_timeout = 0ms;
-            }
-        }
-
         if (!(prop_waiter_state.MightBeWaiting() || Service::is_exec_service_running())) {
             // If there's more work to do, wake up again immediately.
             if (am.HasMoreCommands()) epoll_timeout = 0ms;
@@ -118,6 +118,56 @@ pass_test
     ASSERT_EQ(1u, parser.parse_error_count());
 }
 
+TEST(init, MatchingActions) {
+    std::string init_script =
+            R"init(
+on boot
+pass_test
+
+on property:init.test.matching.a=1
+pass_test
+
+on property:init.test.matching.a=*
+pass_test
+
+on property:init.test.matching.b=1
+pass_test
+
+on boot && property:init.test.matching.a=*
+pass_test
+)init";
+
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    ASSERT_TRUE(android::base::WriteStringToFd(init_script, tf.fd));
+
+    BuiltinFunctionMap test_function_map = {
+            {"pass_test", {0, 0, {false, [](const BuiltinArguments&) { return Result<void>{}; }}}},
+    };
+    Action::set_function_map(&test_function_map);
+
+    ActionManager am;
+    Parser parser;
+    parser.AddSectionParser("on", std::make_unique<ActionParser>(&am, nullptr));
+    ASSERT_TRUE(parser.ParseConfig(tf.path));
+    ASSERT_EQ(0u, parser.parse_error_count());
+
+    auto lines = [&am](const ActionManager::Event& event) {
+        std::vector<int> result;
+        for (const auto* action : am.MatchingActions(event)) {
+            result.emplace_back(action->line());
+        }
+        return result;
+    };
+
+    EXPECT_EQ(std::vector<int>({2}), lines(EventTrigger("boot")));
+    EXPECT_EQ(std::vector<int>(), lines(EventTrigger("init")));
+    EXPECT_EQ(std::vector<int>({5, 8}), lines(PropertyChange("init.test.matching.a", "1")));
+    EXPECT_EQ(std::vector<int>({8}), lines(PropertyChange("init.test.matching.a", "2")));
+    EXPECT_EQ(std::vector<int>({11}), lines(PropertyChange("init.test.matching.b", "1")));
+    EXPECT_EQ(std::vector<int>(), lines(PropertyChange("init.test.matching.c", "1")));
+}
+
 TEST(init, EventTriggerOrder) {
     std::string init_script =
         R"init(
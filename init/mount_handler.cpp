@@ -19,6 +19,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
@@ -27,6 +28,7 @@
 #include <algorithm>
 #include <filesystem>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -49,9 +51,16 @@ namespace init {
 
 namespace {
 
+// Parses a line of /proc/self/mountinfo:
+// ID PARENT_ID MAJOR:MINOR ROOT MOUNT_POINT OPTIONS [OPTIONAL_FIELDS...] - FS_TYPE SOURCE ...
 MountHandlerEntry ParseMount(const std::string& line) {
-    auto fields = android::base::Split(line, " ");
-    while (fields.size() < 3) fields.emplace_back("");
+    auto info = android::base::Split(android::base::Trim(line), " ");
+    // The fields of /proc/mounts: SOURCE MOUNT_POINT FS_TYPE.
+    std::vector<std::string> fields(3);
+    if (info.size() > 4) fields[1] = info[4];
+    auto separator = std::find(info.begin(), info.end(), "-");
+    if (info.end() - separator > 1) fields[2] = separator[1];
+    if (info.end() - separator > 2) fields[0] = separator[2];
     // if (fields[0] == "/dev/root") {
     //     auto& dm = dm::DeviceMapper::Instance();
     //     std::string path;
@@ -164,8 +173,9 @@ bool MountHandlerEntry::operator<(const MountHandlerEntry& r) const {
     return fs_type < r.fs_type;
 }
 
-MountHandler::MountHandler(Epoll* epoll) : epoll_(epoll), fp_(fopen("/proc/mounts", "re"), fclose) {
-    if (!fp_) PLOG(FATAL) << "Could not open /proc/mounts";
+MountHandler::MountHandler(Epoll* epoll)
+    : epoll_(epoll), fp_(fopen("/proc/self/mountinfo", "re"), fclose) {
+    if (!fp_) PLOG(FATAL) << "Could not open /proc/self/mountinfo";
     auto result = epoll->RegisterHandler(
             fileno(fp_.get()), [this]() { this->MountHandlerFunction(); }, EPOLLERR | EPOLLPRI);
     if (!result.ok()) LOG(FATAL) << result.error();
@@ -175,33 +185,66 @@ MountHandler::~MountHandler() {
     if (fp_) epoll_->UnregisterHandler(fileno(fp_.get()));
 }
 
+// Mounts are tracked by mount ID, so that only the lines for mounts that came or went since the
+// last scan are parsed, which also saves resolving their block devices again.
 void MountHandler::MountHandlerFunction() {
     rewind(fp_.get());
-    std::vector<MountHandlerEntry> touched;
-    auto untouched = mounts_;
+    generation_++;
+    std::vector<std::pair<int, std::string>> added;
+    std::vector<MountHandlerEntry> removed;
     char* buf = nullptr;
     size_t len = 0;
-    while (getline(&buf, &len, fp_.get()) != -1) {
-        auto buf_string = std::string(buf);
-        if (buf_string.find("/emulated") != std::string::npos) {
+    ssize_t nread;
+    while ((nread = getline(&buf, &len, fp_.get())) != -1) {
+        std::string_view line(buf, nread);
+        if (line.find("/emulated") != std::string::npos) {
             continue;
         }
-        auto entry = ParseMount(buf_string);
-        auto match = untouched.find(entry);
-        if (match == untouched.end()) {
-            touched.emplace_back(std::move(entry));
-        } else {
-            untouched.erase(match);
+        int id = atoi(buf);
+        auto it = mounts_.find(id);
+        if (it != mounts_.end()) {
+            if (it->second.line == line) {
+                it->second.generation = generation_;
+                continue;
+            }
+            // The mount went away and its ID was reused.
+            removed.emplace_back(std::move(it->second.entry));
+            mounts_.erase(it);
         }
+        added.emplace_back(id, line);
     }
     free(buf);
+
+    for (auto it = mounts_.begin(); it != mounts_.end();) {
+        if (it->second.generation != generation_) {
+            removed.emplace_back(std::move(it->second.entry));
+            it = mounts_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Count additions before removals, so that a remount, whose line changes but whose entry
+    // doesn't, leaves the properties alone.
+    std::vector<MountHandlerEntry> touched;
+    for (auto& [id, line] : added) {
+        auto entry = ParseMount(line);
+        if (entries_[entry]++ == 0) touched.emplace_back(entry);
+        mounts_.emplace(id, Mount{std::move(line), std::move(entry), generation_});
+    }
+    std::vector<MountHandlerEntry> untouched;
+    for (auto& entry : removed) {
+        auto it = entries_.find(entry);
+        if (it != entries_.end() && --it->second == 0) {
+            entries_.erase(it);
+            untouched.emplace_back(std::move(entry));
+        }
+    }
     for (auto& entry : untouched) {
         SetMountProperty(entry, false);
-        mounts_.erase(entry);
     }
     for (auto& entry : touched) {
         SetMountProperty(entry, true);
-        mounts_.emplace(std::move(entry));
     }
 }
 
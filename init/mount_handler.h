@@ -16,11 +16,13 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <stdio.h>
 
+#include <map>
 #include <memory>
-#include <set>
 #include <string>
+#include <unordered_map>
 
 #include "epoll.h"
 
@@ -48,11 +50,21 @@ class MountHandler {
     ~MountHandler();
 
   private:
+    struct Mount {
+        std::string line;
+        MountHandlerEntry entry;
+        uint64_t generation;
+    };
+
     void MountHandlerFunction();
 
     Epoll* epoll_;
     std::unique_ptr<FILE, decltype(&fclose)> fp_;
-    std::set<MountHandlerEntry> mounts_;
+    // The mounts from the last scan of /proc/self/mountinfo, by mount ID.
+    std::unordered_map<int, Mount> mounts_;
+    // How many mounts have each entry, since the same entry can be mounted more than once.
+    std::map<MountHandlerEntry, int> entries_;
+    uint64_t generation_ = 0;
 };
 
 }  // namespace init
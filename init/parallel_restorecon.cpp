@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parallel_restorecon.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+#include <android-base/chrono_utils.h>
+#include <android-base/logging.h>
+#include <selinux/android.h>
+
+namespace android {
+namespace init {
+
+ParallelRestorecon::ParallelRestorecon(const Options& options)
+    : ParallelRestorecon(options, selinux_android_restorecon) {}
+
+ParallelRestorecon::ParallelRestorecon(const Options& options, RestoreconFunction restorecon)
+    : options_(options), restorecon_(std::move(restorecon)) {}
+
+Result<void> ParallelRestorecon::Run(const std::vector<std::string>& paths) {
+    android::base::Timer t;
+
+    unsigned int num_threads = options_.num_threads;
+    if (!num_threads) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    queues_ = std::vector<WorkQueue>(num_threads);
+    queued_ = 0;
+    pending_ = 0;
+    directories_done_ = 0;
+    directories_total_ = 0;
+    result_ = {};
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        struct stat st;
+        if (lstat(paths[i].c_str(), &st) < 0) {
+            if (errno != ENOENT) {
+                std::lock_guard lock(mutex_);
+                if (result_.ok()) result_ = ErrnoError() << "lstat() failed for " << paths[i];
+            }
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            Push(i % num_threads, {paths[i], 0, st.st_dev});
+        } else {
+            Relabel(paths[i], options_.flags & ~SELINUX_ANDROID_RESTORECON_RECURSE);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back(&ParallelRestorecon::Worker, this, i);
+    }
+
+    {
+        std::unique_lock lock(mutex_);
+        auto done = [this]() { return pending_ == 0; };
+        if (options_.progress_interval.count() > 0) {
+            while (!done_cv_.wait_for(lock, options_.progress_interval, done)) {
+                LOG(INFO) << "restorecon: " << directories_done_ << " of " << directories_total_
+                          << " directories done";
+            }
+        } else {
+            done_cv_.wait(lock, done);
+        }
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    LOG(INFO) << "restorecon of " << directories_total_ << " directories on " << num_threads
+              << " threads took " << t;
+    return result_;
+}
+
+void ParallelRestorecon::Push(size_t worker, WorkItem item) {
+    // Count the item before it can be popped, so that |queued_| never goes below zero.
+    {
+        std::lock_guard lock(mutex_);
+        queued_++;
+        pending_++;
+        directories_total_++;
+    }
+    {
+        std::lock_guard lock(queues_[worker].mutex);
+        queues_[worker].items.emplace_back(std::move(item));
+    }
+    work_cv_.notify_one();
+}
+
+// Takes the newest item of the worker's own queue, which keeps it close to the directory it just
+// read, or else the oldest item of another queue, which is the one most likely to be a large tree.
+bool ParallelRestorecon::Pop(size_t worker, WorkItem* item) {
+    bool found = false;
+    {
+        auto& own = queues_[worker];
+        std::lock_guard lock(own.mutex);
+        if (!own.items.empty()) {
+            *item = std::move(own.items.back());
+            own.items.pop_back();
+            found = true;
+        }
+    }
+    for (size_t i = 1; !found && i < queues_.size(); i++) {
+        auto& victim = queues_[(worker + i) % queues_.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.items.empty()) {
+            *item = std::move(victim.items.front());
+            victim.items.pop_front();
+            found = true;
+        }
+    }
+    if (found) {
+        std::lock_guard lock(mutex_);
+        queued_--;
+    }
+    return found;
+}
+
+void ParallelRestorecon::Worker(size_t worker) {
+    WorkItem item;
+    while (true) {
+        {
+            std::unique_lock lock(mutex_);
+            work_cv_.wait(lock, [this]() { return queued_ > 0 || pending_ == 0; });
+            if (pending_ == 0) return;
+        }
+        // Another worker may have taken the item that woke this one up.
+        if (!Pop(worker, &item)) continue;
+
+        Process(worker, item);
+        FinishItem();
+    }
+}
+
+void ParallelRestorecon::Process(size_t worker, const WorkItem& item) {
+    unsigned int flags = options_.flags & ~SELINUX_ANDROID_RESTORECON_RECURSE;
+    if (item.depth >= options_.split_depth) {
+        Relabel(item.path, flags | SELINUX_ANDROID_RESTORECON_RECURSE);
+        return;
+    }
+
+    Relabel(item.path, flags);
+
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(item.path.c_str()), &closedir);
+    if (!dir) {
+        if (errno != ENOENT) PLOG(WARNING) << "opendir " << item.path;
+        return;
+    }
+
+    struct dirent* dent;
+    while ((dent = readdir(dir.get())) != nullptr) {
+        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir.get()), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+
+        std::string path = item.path + "/" + dent->d_name;
+        if (!S_ISDIR(st.st_mode)) {
+            Relabel(path, flags);
+        } else if (st.st_dev == item.device ||
+                   (options_.flags & SELINUX_ANDROID_RESTORECON_CROSS_FILESYSTEMS)) {
+            Push(worker, {std::move(path), item.depth + 1, st.st_dev});
+        }
+    }
+}
+
+void ParallelRestorecon::Relabel(const std::string& path, unsigned int flags) {
+    if (restorecon_(path.c_str(), flags) < 0 && errno != ENOENT) {
+        std::lock_guard lock(mutex_);
+        if (result_.ok()) {
+            result_ = ErrnoError() << "selinux_android_restorecon() failed for " << path;
+        }
+    }
+}
+
+void ParallelRestorecon::FinishItem() {
+    std::lock_guard lock(mutex_);
+    directories_done_++;
+    if (--pending_ == 0) {
+        work_cv_.notify_all();
+        done_cv_.notify_all();
+    }
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "result.h"
+
+namespace android {
+namespace init {
+
+// Relabels directory trees from several threads.
+//
+// The top |split_depth| levels of each tree are walked here: directories are relabelled on their
+// own and their subdirectories become work items, which idle threads steal from busy ones.
+// Directories at |split_depth| are handed to restorecon with SELINUX_ANDROID_RESTORECON_RECURSE,
+// so libselinux compares the file_contexts digest stored on each of them and skips subtrees
+// whose labels are already up to date.
+class ParallelRestorecon {
+  public:
+    using RestoreconFunction = std::function<int(const char* path, unsigned int flags)>;
+
+    struct Options {
+        // SELINUX_ANDROID_RESTORECON_* flags; RECURSE is implied.
+        unsigned int flags = 0;
+        // 0 uses one thread per CPU.
+        unsigned int num_threads = 0;
+        unsigned int split_depth = 2;
+        // How often to log progress; zero disables it.
+        std::chrono::milliseconds progress_interval = std::chrono::seconds(5);
+    };
+
+    explicit ParallelRestorecon(const Options& options);
+    // |restorecon| replaces selinux_android_restorecon(), for tests.
+    ParallelRestorecon(const Options& options, RestoreconFunction restorecon);
+
+    // Relabels everything under |paths|. Keeps going after failures and returns the first one.
+    Result<void> Run(const std::vector<std::string>& paths);
+
+    size_t directories_done() const { return directories_done_; }
+    size_t directories_total() const { return directories_total_; }
+
+  private:
+    struct WorkItem {
+        std::string path;
+        unsigned int depth;
+        dev_t device;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<WorkItem> items;
+    };
+
+    void Push(size_t worker, WorkItem item);
+    bool Pop(size_t worker, WorkItem* item);
+    void Worker(size_t worker);
+    void Process(size_t worker, const WorkItem& item);
+    void Relabel(const std::string& path, unsigned int flags);
+    void FinishItem();
+
+    Options options_;
+    RestoreconFunction restorecon_;
+    std::vector<WorkQueue> queues_;
+
+    // Guards everything below. Idle workers wait on |work_cv_| and Run() waits on |done_cv_|.
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    size_t queued_ = 0;
+    size_t pending_ = 0;
+    size_t directories_done_ = 0;
+    size_t directories_total_ = 0;
+    Result<void> result_;
+};
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parallel_restorecon.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <selinux/android.h>
+
+using namespace std::literals;
+
+namespace android {
+namespace init {
+
+class ParallelRestoreconTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        root_ = dir_.path;
+        for (const auto& path : {"/a", "/a/b", "/a/b/c", "/a/d", "/e"}) {
+            ASSERT_EQ(0, mkdir((root_ + path).c_str(), 0755)) << path;
+        }
+        ASSERT_TRUE(android::base::WriteStringToFile("", root_ + "/a/file"));
+        ASSERT_TRUE(android::base::WriteStringToFile("", root_ + "/a/b/c/file"));
+    }
+
+    ParallelRestorecon::RestoreconFunction Recorder() {
+        return [this](const char* path, unsigned int flags) {
+            std::lock_guard lock(mutex_);
+            EXPECT_EQ(0u, calls_.count(path)) << path << " was relabelled twice";
+            calls_[path] = flags;
+            return 0;
+        };
+    }
+
+    TemporaryDir dir_;
+    std::string root_;
+    std::mutex mutex_;
+    std::map<std::string, unsigned int> calls_;
+};
+
+TEST_F(ParallelRestoreconTest, SplitsTopLevels) {
+    ParallelRestorecon::Options options;
+    options.flags = SELINUX_ANDROID_RESTORECON_SKIPCE;
+    options.num_threads = 3;
+    options.split_depth = 2;
+    options.progress_interval = 0ms;
+
+    ParallelRestorecon restorecon(options, Recorder());
+    ASSERT_RESULT_OK(restorecon.Run({root_}));
+
+    constexpr unsigned int recurse = SELINUX_ANDROID_RESTORECON_RECURSE;
+    std::map<std::string, unsigned int> expected = {
+            {root_, 0},
+            {root_ + "/a", 0},
+            {root_ + "/e", 0},
+            {root_ + "/a/file", 0},
+            {root_ + "/a/b", recurse},
+            {root_ + "/a/d", recurse},
+    };
+    for (auto& [path, flags] : expected) {
+        flags |= SELINUX_ANDROID_RESTORECON_SKIPCE;
+    }
+    EXPECT_EQ(expected, calls_);
+    EXPECT_EQ(5u, restorecon.directories_total());
+    EXPECT_EQ(5u, restorecon.directories_done());
+}
+
+TEST_F(ParallelRestoreconTest, ReportsFailures) {
+    auto recorder = Recorder();
+    auto failing = [&](const char* path, unsigned int flags) {
+        recorder(path, flags);
+        if (path == root_ + "/e") {
+            errno = EACCES;
+            return -1;
+        }
+        return 0;
+    };
+
+    ParallelRestorecon::Options options;
+    options.num_threads = 2;
+    options.split_depth = 1;
+    options.progress_interval = 0ms;
+
+    ParallelRestorecon restorecon(options, failing);
+    auto result = restorecon.Run({root_, root_ + "/missing"});
+    ASSERT_FALSE(result.ok());
+    EXPECT_EQ(EACCES, result.error().code());
+
+    // A failure does not stop the rest of the walk.
+    EXPECT_EQ(3u, calls_.size());
+    EXPECT_EQ(1u, calls_.count(root_ + "/a"));
+}
+
+}  // namespace init
+}  // namespace android
@@ -17,8 +17,14 @@
 #include "parser.h"
 
 #include <dirent.h>
+#include <sys/stat.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
@@ -26,12 +32,16 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
+#include "config_cache.h"
 #include "tokenizer.h"
 #include "util.h"
 
 namespace android {
 namespace init {
 
+// Number of threads reading and tokenizing the files of a directory ahead of the parser.
+static constexpr size_t kMaxReaderThreads = 4;
+
 Parser::Parser() {}
 
 void Parser::AddSectionParser(const std::string& name, std::unique_ptr<SectionParser> parser) {
@@ -42,7 +52,7 @@ void Parser::AddSingleLineParser(const std::string& prefix, LineCallback callbac
     line_callbacks_.emplace_back(prefix, std::move(callback));
 }
 
-void Parser::ParseData(const std::string& filename, std::string* data) {
+std::vector<Parser::ConfigLine> Parser::Tokenize(std::string* data) {
     data->push_back('\n');
     data->push_back('\0');
 
@@ -51,9 +61,33 @@ void Parser::ParseData(const std::string& filename, std::string* data) {
     state.ptr = data->data();
     state.nexttoken = 0;
 
+    std::vector<ConfigLine> lines;
+    std::vector<std::string> args;
+    for (;;) {
+        switch (next_token(&state)) {
+            case T_EOF:
+                return lines;
+            case T_NEWLINE:
+                state.line++;
+                if (!args.empty()) {
+                    lines.push_back({state.line, std::move(args)});
+                    args.clear();
+                }
+                break;
+            case T_TEXT:
+                args.emplace_back(state.text);
+                break;
+        }
+    }
+}
+
+void Parser::ParseData(const std::string& filename, std::string* data) {
+    ParseLines(filename, Tokenize(data));
+}
+
+void Parser::ParseLines(const std::string& filename, std::vector<ConfigLine>&& lines) {
     SectionParser* section_parser = nullptr;
     int section_start_line = -1;
-    std::vector<std::string> args;
 
     // If we encounter a bad section start, there is no valid parser object to parse the subsequent
     // sections, so we must suppress errors until the next valid section is found.
@@ -72,63 +106,50 @@ void Parser::ParseData(const std::string& filename, std::string* data) {
         section_start_line = -1;
     };
 
-    for (;;) {
-        switch (next_token(&state)) {
-            case T_EOF:
-                end_section();
-
-                for (const auto& [section_name, section_parser] : section_parsers_) {
-                    section_parser->EndFile();
-                }
-
-                return;
-            case T_NEWLINE: {
-                state.line++;
-                if (args.empty()) break;
-                // If we have a line matching a prefix we recognize, call its callback and unset any
-                // current section parsers.  This is meant for /sys/ and /dev/ line entries for
-                // uevent.
-                auto line_callback = std::find_if(
-                    line_callbacks_.begin(), line_callbacks_.end(),
-                    [&args](const auto& c) { return android::base::StartsWith(args[0], c.first); });
-                if (line_callback != line_callbacks_.end()) {
-                    end_section();
-
-                    if (auto result = line_callback->second(std::move(args)); !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                    }
-                } else if (section_parsers_.count(args[0])) {
-                    end_section();
-                    section_parser = section_parsers_[args[0]].get();
-                    section_start_line = state.line;
-                    if (auto result =
-                                section_parser->ParseSection(std::move(args), filename, state.line);
-                        !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                        section_parser = nullptr;
-                        bad_section_found = true;
-                    }
-                } else if (section_parser) {
-                    if (auto result = section_parser->ParseLineSection(std::move(args), state.line);
-                        !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                    }
-                } else if (!bad_section_found) {
-                    parse_error_count_++;
-                    LOG(ERROR) << filename << ": " << state.line
-                               << ": Invalid section keyword found";
-                }
-                args.clear();
-                break;
+    for (auto& config_line : lines) {
+        const int line = config_line.line;
+        auto& args = config_line.args;
+        // If we have a line matching a prefix we recognize, call its callback and unset any
+        // current section parsers.  This is meant for /sys/ and /dev/ line entries for
+        // uevent.
+        auto line_callback = std::find_if(
+            line_callbacks_.begin(), line_callbacks_.end(),
+            [&args](const auto& c) { return android::base::StartsWith(args[0], c.first); });
+        if (line_callback != line_callbacks_.end()) {
+            end_section();
+
+            if (auto result = line_callback->second(std::move(args)); !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
             }
-            case T_TEXT:
-                args.emplace_back(state.text);
-                break;
+        } else if (section_parsers_.count(args[0])) {
+            end_section();
+            section_parser = section_parsers_[args[0]].get();
+            section_start_line = line;
+            if (auto result = section_parser->ParseSection(std::move(args), filename, line);
+                !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
+                section_parser = nullptr;
+                bad_section_found = true;
+            }
+        } else if (section_parser) {
+            if (auto result = section_parser->ParseLineSection(std::move(args), line);
+                !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
+            }
+        } else if (!bad_section_found) {
+            parse_error_count_++;
+            LOG(ERROR) << filename << ": " << line << ": Invalid section keyword found";
         }
     }
+
+    end_section();
+
+    for (const auto& [section_name, section_parser] : section_parsers_) {
+        section_parser->EndFile();
+    }
 }
 
 bool Parser::ParseConfigFileInsecure(const std::string& path) {
@@ -141,21 +162,49 @@ bool Parser::ParseConfigFileInsecure(const std::string& path) {
     return true;
 }
 
-bool Parser::ParseConfigFile(const std::string& path) {
-    LOG(INFO) << "Parsing file " << path << "...";
+Parser::TokenizedConfig Parser::ReadConfigFile(const std::string& path) const {
     android::base::Timer t;
+
+    // Symlinks and insecure files are left to ReadFile() to reject.
+    struct stat st;
+    bool cacheable = config_cache_ && lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+                     (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+    if (cacheable) {
+        if (auto lines = config_cache_->Find(path, st)) {
+            return {std::move(*lines), t.duration()};
+        }
+    }
+
     auto config_contents = ReadFile(path);
     if (!config_contents.ok()) {
-        LOG(INFO) << "Unable to read config file '" << path << "': " << config_contents.error();
+        return {config_contents.error(), t.duration()};
+    }
+    auto lines = Tokenize(&config_contents.value());
+    if (cacheable) {
+        config_cache_->Add(path, st, lines);
+    }
+    return {std::move(lines), t.duration()};
+}
+
+bool Parser::ParseTokenizedConfig(const std::string& path, TokenizedConfig&& config) {
+    LOG(INFO) << "Parsing file " << path << "...";
+    if (!config.lines.ok()) {
+        LOG(INFO) << "Unable to read config file '" << path << "': " << config.lines.error();
         return false;
     }
 
-    ParseData(path, &config_contents.value());
+    android::base::Timer t;
+    ParseLines(path, std::move(config.lines.value()));
 
-    LOG(VERBOSE) << "(Parsing " << path << " took " << t << ".)";
+    LOG(INFO) << "(Parsing " << path << " took " << t.duration().count() << "ms, after reading it in "
+              << config.read_time.count() << "ms.)";
     return true;
 }
 
+bool Parser::ParseConfigFile(const std::string& path) {
+    return ParseTokenizedConfig(path, ReadConfigFile(path));
+}
+
 std::vector<std::string> Parser::FilterVersionedConfigs(const std::vector<std::string>& configs,
                                                         int active_sdk) {
     std::vector<std::string> filtered_configs;
@@ -227,10 +276,41 @@ bool Parser::ParseConfigDir(const std::string& path) {
     }
     // Sort first so we load files in a consistent order (bug 31996208)
     std::sort(files.begin(), files.end());
-    for (const auto& file : files) {
-        if (!ParseConfigFile(file)) {
-            LOG(ERROR) << "could not import file '" << file << "'";
+
+    // Files are read and tokenized by a few threads, while this thread parses them in order as
+    // they become ready, so actions and services are added exactly as if they were read here.
+    std::vector<std::optional<TokenizedConfig>> configs(files.size());
+    std::mutex configs_lock;
+    std::condition_variable config_ready;
+    std::atomic<size_t> next_file = 0;
+    auto reader = [&]() -> void {
+        for (size_t i = next_file++; i < files.size(); i = next_file++) {
+            auto config = ReadConfigFile(files[i]);
+            {
+                auto lock = std::lock_guard{configs_lock};
+                configs[i] = std::move(config);
+            }
+            config_ready.notify_all();
         }
+    };
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < std::min(kMaxReaderThreads, files.size()); i++) {
+        readers.emplace_back(reader);
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        std::optional<TokenizedConfig> config;
+        {
+            auto lock = std::unique_lock{configs_lock};
+            config_ready.wait(lock, [&]() { return configs[i].has_value(); });
+            config.swap(configs[i]);
+        }
+        if (!ParseTokenizedConfig(files[i], std::move(*config))) {
+            LOG(ERROR) << "could not import file '" << files[i] << "'";
+        }
+    }
+    for (auto& thread : readers) {
+        thread.join();
     }
     return true;
 }
@@ -17,6 +17,7 @@
 #ifndef _INIT_PARSER_H_
 #define _INIT_PARSER_H_
 
+#include <chrono>
 #include <functional>
 #include <map>
 #include <memory>
@@ -59,8 +60,16 @@ class SectionParser {
     virtual void EndFile(){};
 };
 
+class ConfigCache;
+
 class Parser {
   public:
+    // A non-empty line of a config file and its line number.
+    struct ConfigLine {
+        int line;
+        std::vector<std::string> args;
+    };
+
     //  LineCallback is the type for callbacks that can parse a line starting with a given prefix.
     //
     //  They take the form of bool Callback(std::vector<std::string>&& args, std::string* err)
@@ -88,13 +97,29 @@ class Parser {
 
     size_t parse_error_count() const { return parse_error_count_; }
 
+    // Config files are looked up in and added to |config_cache| while it is set.
+    void set_config_cache(ConfigCache* config_cache) { config_cache_ = config_cache; }
+
   private:
+    // A config file that has been read and tokenized, but not parsed yet.
+    struct TokenizedConfig {
+        Result<std::vector<ConfigLine>> lines;
+        std::chrono::milliseconds read_time;
+    };
+
+    // Reading and tokenizing files does not modify the parser, so it can be done on any thread.
+    static std::vector<ConfigLine> Tokenize(std::string* data);
+    TokenizedConfig ReadConfigFile(const std::string& path) const;
+
     void ParseData(const std::string& filename, std::string* data);
+    void ParseLines(const std::string& filename, std::vector<ConfigLine>&& lines);
+    bool ParseTokenizedConfig(const std::string& path, TokenizedConfig&& config);
     bool ParseConfigDir(const std::string& path);
 
     std::map<std::string, std::unique_ptr<SectionParser>> section_parsers_;
     std::vector<std::pair<std::string, LineCallback>> line_callbacks_;
     size_t parse_error_count_ = 0;
+    ConfigCache* config_cache_ = nullptr;
 };
 
 }  // namespace init
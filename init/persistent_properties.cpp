@@ -26,6 +26,7 @@
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/properties.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 
@@ -45,6 +46,9 @@ std::string persistent_property_filename = "/data/property/persistent_properties
 namespace {
 
 constexpr const char kLegacyPersistentPropertyDir[] = "/data/property";
+// Long enough to fold together a burst of settings changes, short enough that losing power right
+// after one is unlikely.
+constexpr uint64_t kDefaultWriteDelayMs = 100;
 
 void AddPersistentProperty(const std::string& name, const std::string& value,
                            PersistentProperties* persistent_properties) {
@@ -207,9 +211,9 @@ Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_
     return {};
 }
 
-// Persistent properties are not written often, so we rather not keep any data in memory and read
-// then rewrite the persistent property file for each update.
-void WritePersistentProperty(const std::string& name, const std::string& value) {
+namespace {
+
+void WritePersistentProperties(const std::map<std::string, std::string>& updates) {
     auto persistent_properties = LoadPersistentPropertyFile();
 
     if (!persistent_properties.ok()) {
@@ -217,13 +221,14 @@ void WritePersistentProperty(const std::string& name, const std::string& value)
                    << persistent_properties.error();
         persistent_properties = LoadPersistentPropertiesFromMemory();
     }
-    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
-                           persistent_properties->mutable_properties()->end(),
-                           [&name](const auto& record) { return record.name() == name; });
-    if (it != persistent_properties->mutable_properties()->end()) {
-        it->set_name(name);
-        it->set_value(value);
-    } else {
+    auto remaining = updates;
+    for (auto& record : *persistent_properties->mutable_properties()) {
+        auto it = remaining.find(record.name());
+        if (it == remaining.end()) continue;
+        record.set_value(it->second);
+        remaining.erase(it);
+    }
+    for (const auto& [name, value] : remaining) {
         AddPersistentProperty(name, value, &persistent_properties.value());
     }
 
@@ -232,6 +237,86 @@ void WritePersistentProperty(const std::string& name, const std::string& value)
     }
 }
 
+}  // namespace
+
+// Persistent properties are not written often, so we rather not keep any data in memory and read
+// then rewrite the persistent property file for each update.
+void WritePersistentProperty(const std::string& name, const std::string& value) {
+    WritePersistentProperties({{name, value}});
+}
+
+PersistentPropertyWriter::PersistentPropertyWriter(std::chrono::milliseconds window)
+    : window_(window) {}
+
+PersistentPropertyWriter::~PersistentPropertyWriter() {
+    Flush();
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    pending_cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+PersistentPropertyWriter& PersistentPropertyWriter::GetInstance() {
+    static PersistentPropertyWriter writer(std::chrono::milliseconds(
+            android::base::GetUintProperty<uint64_t>("ro.persistent_properties.write_delay_ms",
+                                                     kDefaultWriteDelayMs)));
+    return writer;
+}
+
+void PersistentPropertyWriter::Write(const std::string& name, const std::string& value) {
+    if (window_.count() == 0) {
+        WritePersistentProperty(name, value);
+        std::lock_guard lock(mutex_);
+        file_writes_++;
+        return;
+    }
+
+    std::lock_guard lock(mutex_);
+    pending_[name] = value;
+    queued_++;
+    if (!thread_.joinable()) {
+        thread_ = std::thread(&PersistentPropertyWriter::ThreadFunction, this);
+    }
+    pending_cv_.notify_all();
+}
+
+void PersistentPropertyWriter::Flush() {
+    std::unique_lock lock(mutex_);
+    flush_target_ = queued_;
+    pending_cv_.notify_all();
+    stored_cv_.wait(lock, [this] { return stored_ >= flush_target_; });
+}
+
+size_t PersistentPropertyWriter::file_writes() const {
+    std::lock_guard lock(mutex_);
+    return file_writes_;
+}
+
+void PersistentPropertyWriter::ThreadFunction() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+        pending_cv_.wait(lock, [this] { return !pending_.empty() || stop_; });
+        if (pending_.empty()) return;
+
+        // Let later writes join this one, unless someone is waiting for it to be stored.
+        pending_cv_.wait_for(lock, window_, [this] { return flush_target_ > stored_ || stop_; });
+
+        auto updates = std::move(pending_);
+        pending_.clear();
+        uint64_t generation = queued_;
+        lock.unlock();
+
+        WritePersistentProperties(updates);
+
+        lock.lock();
+        stored_ = generation;
+        file_writes_++;
+        stored_cv_.notify_all();
+    }
+}
+
 PersistentProperties LoadPersistentProperties() {
     auto persistent_properties = LoadPersistentPropertyFile();
 
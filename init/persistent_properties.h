@@ -17,7 +17,12 @@
 #ifndef _INIT_PERSISTENT_PROPERTIES_H
 #define _INIT_PERSISTENT_PROPERTIES_H
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include "result.h"
 #include "system/core/init/persistent_properties.pb.h"
@@ -28,6 +33,39 @@ namespace init {
 PersistentProperties LoadPersistentProperties();
 void WritePersistentProperty(const std::string& name, const std::string& value);
 
+// Stores persistent properties from a background thread, folding the writes made within |window|
+// of the first one into a single rewrite of the persistent property file.
+class PersistentPropertyWriter {
+  public:
+    explicit PersistentPropertyWriter(std::chrono::milliseconds window);
+    ~PersistentPropertyWriter();
+
+    // The writer used by the property service. Its window comes from
+    // ro.persistent_properties.write_delay_ms; 0 writes every property synchronously.
+    static PersistentPropertyWriter& GetInstance();
+
+    void Write(const std::string& name, const std::string& value);
+    // Returns once every write queued before the call has been stored.
+    void Flush();
+
+    size_t file_writes() const;
+
+  private:
+    void ThreadFunction();
+
+    const std::chrono::milliseconds window_;
+    mutable std::mutex mutex_;
+    std::condition_variable pending_cv_;
+    std::condition_variable stored_cv_;
+    std::map<std::string, std::string> pending_;
+    uint64_t queued_ = 0;
+    uint64_t stored_ = 0;
+    uint64_t flush_target_ = 0;
+    size_t file_writes_ = 0;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
 // Exposed only for testing
 Result<PersistentProperties> LoadPersistentPropertyFile();
 Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_properties);
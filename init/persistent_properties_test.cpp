@@ -26,6 +26,7 @@
 #include "util.h"
 
 using namespace std::string_literals;
+using namespace std::chrono_literals;
 
 namespace android {
 namespace init {
@@ -155,5 +156,45 @@ TEST(persistent_properties, UpdatePropertyBadParse) {
     EXPECT_FALSE(it == read_back_properties.properties().end());
 }
 
+TEST(persistent_properties, WriterCoalescesWrites) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties = {
+        {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+    ASSERT_RESULT_OK(
+            WritePersistentPropertyFile(VectorToPersistentProperties(persistent_properties)));
+
+    // Flush() must not wait for the window to pass.
+    PersistentPropertyWriter writer(1h);
+    writer.Write("persist.sys.locale", "en-US");
+    writer.Write("persist.sys.timezone", "Europe/Paris");
+    writer.Write("persist.sys.locale", "pt-BR");
+    writer.Flush();
+    EXPECT_EQ(1u, writer.file_writes());
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected = {
+        {"persist.sys.timezone", "Europe/Paris"},
+        {"persist.sys.locale", "pt-BR"},
+    };
+    CheckPropertiesEqual(persistent_properties_expected, LoadPersistentProperties());
+}
+
+TEST(persistent_properties, WriterFlushesOnDestruction) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+    ASSERT_RESULT_OK(WritePersistentPropertyFile({}));
+
+    {
+        PersistentPropertyWriter writer(1h);
+        writer.Write("persist.sys.locale", "pt-BR");
+    }
+
+    CheckPropertiesEqual({{"persist.sys.locale", "pt-BR"}}, LoadPersistentProperties());
+}
+
 }  // namespace init
 }  // namespace android
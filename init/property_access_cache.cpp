@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "property_access_cache.h"
+
+namespace android {
+namespace init {
+
+bool PropertyAccessCache::CheckAccess(const std::string& source_context, uint32_t context_index,
+                                      uint32_t policy_seqno, const CheckFunction& check) {
+    if (policy_seqno != policy_seqno_) {
+        granted_.clear();
+        policy_seqno_ = policy_seqno;
+    }
+
+    auto it = granted_.find(source_context);
+    if (it != granted_.end() && context_index < it->second.size() && it->second[context_index]) {
+        hits_++;
+        return true;
+    }
+
+    misses_++;
+    if (!check()) return false;
+
+    if (it == granted_.end()) {
+        // Source contexts come from clients, so keep a misbehaving one from growing the cache.
+        if (granted_.size() >= kMaxSourceContexts) granted_.clear();
+        it = granted_.emplace(source_context, std::vector<bool>()).first;
+    }
+    if (context_index >= it->second.size()) it->second.resize(context_index + 1);
+    it->second[context_index] = true;
+    return true;
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace init {
+
+// Remembers which source contexts may set properties of which property contexts, so that a client
+// setting the same properties over and over only pays for selinux_check_access() once.
+//
+// Decisions are keyed on the source context and on the index of the property's context in the
+// property info area, and all of them are dropped when the policy load sequence number changes.
+// Only grants are cached: a denial is checked again every time so that it is audited every time.
+// Not thread safe; the property service only checks permissions from its own thread.
+class PropertyAccessCache {
+  public:
+    using CheckFunction = std::function<bool()>;
+
+    static constexpr size_t kMaxSourceContexts = 256;
+
+    // Returns whether |source_context| may set properties of the context with |context_index|,
+    // calling |check| if the decision is not cached.
+    bool CheckAccess(const std::string& source_context, uint32_t context_index,
+                     uint32_t policy_seqno, const CheckFunction& check);
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+  private:
+    std::unordered_map<std::string, std::vector<bool>> granted_;
+    uint32_t policy_seqno_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "property_access_cache.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+namespace init {
+
+TEST(property_access_cache, CachesGrants) {
+    PropertyAccessCache cache;
+    int checks = 0;
+    auto allow = [&checks] {
+        checks++;
+        return true;
+    };
+
+    EXPECT_TRUE(cache.CheckAccess("u:r:system_server:s0", 3, 1, allow));
+    EXPECT_TRUE(cache.CheckAccess("u:r:system_server:s0", 3, 1, allow));
+    EXPECT_EQ(1, checks);
+
+    // Another context index or another source context is a new decision.
+    EXPECT_TRUE(cache.CheckAccess("u:r:system_server:s0", 4, 1, allow));
+    EXPECT_TRUE(cache.CheckAccess("u:r:shell:s0", 3, 1, allow));
+    EXPECT_EQ(3, checks);
+    EXPECT_EQ(1u, cache.hits());
+    EXPECT_EQ(3u, cache.misses());
+}
+
+TEST(property_access_cache, ChecksDenialsEveryTime) {
+    PropertyAccessCache cache;
+    int checks = 0;
+    auto deny = [&checks] {
+        checks++;
+        return false;
+    };
+
+    EXPECT_FALSE(cache.CheckAccess("u:r:untrusted_app:s0", 3, 1, deny));
+    EXPECT_FALSE(cache.CheckAccess("u:r:untrusted_app:s0", 3, 1, deny));
+    EXPECT_EQ(2, checks);
+}
+
+TEST(property_access_cache, PolicyReloadDropsDecisions) {
+    PropertyAccessCache cache;
+    EXPECT_TRUE(cache.CheckAccess("u:r:system_server:s0", 3, 1, [] { return true; }));
+    EXPECT_FALSE(cache.CheckAccess("u:r:system_server:s0", 3, 2, [] { return false; }));
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "property_info_cache.h"
+
+#include <fcntl.h>
+#include <openssl/sha.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <property_info_parser/property_info_parser.h>
+
+#include "util.h"
+
+using android::base::Dirname;
+using android::base::ReadFdToString;
+using android::base::unique_fd;
+using android::base::WriteStringToFd;
+using android::properties::PropertyInfoArea;
+
+namespace android {
+namespace init {
+
+// Bumped whenever the way init builds property info from the same files changes.
+static constexpr const char kPropertyInfoCacheVersion[] = "property_info_cache 1";
+
+PropertyInfoCache::PropertyInfoCache(
+        const std::vector<std::pair<std::string, std::string>>& files) {
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, kPropertyInfoCacheVersion, sizeof(kPropertyInfoCacheVersion));
+    for (const auto& [name, contents] : files) {
+        // Sizes keep the boundaries between names and contents unambiguous.
+        uint64_t sizes[] = {name.size(), contents.size()};
+        SHA256_Update(&ctx, sizes, sizeof(sizes));
+        SHA256_Update(&ctx, name.data(), name.size());
+        SHA256_Update(&ctx, contents.data(), contents.size());
+    }
+    key_.resize(SHA256_DIGEST_LENGTH);
+    SHA256_Final(reinterpret_cast<uint8_t*>(key_.data()), &ctx);
+}
+
+std::optional<std::string> PropertyInfoCache::Load(const std::string& path) const {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Could not open property info cache " << path;
+        }
+        return {};
+    }
+
+    // The cached property info decides the SELinux context of every property, so only trust it
+    // as much as the property_contexts files themselves.
+    struct stat st;
+    if (fstat(fd.get(), &st) == -1 || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        LOG(WARNING) << "Ignoring insecure property info cache " << path;
+        return {};
+    }
+
+    std::string contents;
+    if (!ReadFdToString(fd, &contents)) {
+        PLOG(WARNING) << "Could not read property info cache " << path;
+        return {};
+    }
+    if (contents.size() < key_.size() || contents.compare(0, key_.size(), key_) != 0) {
+        LOG(INFO) << "Property info cache " << path << " is for different property contexts";
+        return {};
+    }
+    contents.erase(0, key_.size());
+
+    auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(contents.data());
+    if (contents.size() < sizeof(PropertyInfoArea) ||
+        property_info_area->size() != contents.size()) {
+        LOG(WARNING) << "Ignoring truncated property info cache " << path;
+        return {};
+    }
+    return contents;
+}
+
+Result<void> PropertyInfoCache::Save(const std::string& path,
+                                     const std::string& property_info) const {
+    auto dir = Dirname(path);
+    if (!mkdir_recursive(dir, 0700)) {
+        return ErrnoError() << "Could not create " << dir;
+    }
+
+    const std::string temp_path = path + ".tmp";
+    unique_fd fd(TEMP_FAILURE_RETRY(
+            open(temp_path.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0600)));
+    if (fd == -1) {
+        return ErrnoError() << "Could not open temporary property info cache";
+    }
+    if (!WriteStringToFd(key_, fd) || !WriteStringToFd(property_info, fd)) {
+        return ErrnoError() << "Unable to write property info cache";
+    }
+    fsync(fd.get());
+    fd.reset();
+
+    if (rename(temp_path.c_str(), path.c_str())) {
+        int saved_errno = errno;
+        unlink(temp_path.c_str());
+        return Error(saved_errno) << "Unable to rename property info cache";
+    }
+    return {};
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "result.h"
+
+namespace android {
+namespace init {
+
+// The serialized property info built from a set of property_contexts files during a previous boot,
+// so that the files don't need to be parsed and serialized again while they stay the same.
+//
+// The cache is keyed by a SHA-256 of the name and contents of each file, in the order they are
+// given, so any change to the files or to which partitions provide them builds it again.
+class PropertyInfoCache {
+  public:
+    // |files| holds the name and contents of every property_contexts file.
+    explicit PropertyInfoCache(const std::vector<std::pair<std::string, std::string>>& files);
+
+    // Returns the property info cached at |path|, if it was built from the same files.
+    std::optional<std::string> Load(const std::string& path) const;
+    Result<void> Save(const std::string& path, const std::string& property_info) const;
+
+  private:
+    std::string key_;
+};
+
+}  // namespace init
+}  // namespace android
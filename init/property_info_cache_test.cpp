@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "property_info_cache.h"
+
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <property_info_serializer/property_info_serializer.h>
+
+using android::properties::BuildTrie;
+using android::properties::PropertyInfoEntry;
+
+using namespace std::string_literals;
+
+namespace android {
+namespace init {
+
+static std::string SerializedPropertyInfo() {
+    auto property_infos = std::vector<PropertyInfoEntry>{{"test.", "u:object_r:test:s0", "", false}};
+    std::string serialized;
+    std::string error;
+    EXPECT_TRUE(BuildTrie(property_infos, "u:object_r:default_prop:s0", "string", &serialized,
+                          &error))
+            << error;
+    return serialized;
+}
+
+TEST(property_info_cache, Roundtrip) {
+    TemporaryDir dir;
+    std::string cache_path = dir.path + "/cache/property_info_cache"s;
+    auto files = std::vector<std::pair<std::string, std::string>>{
+            {"/plat_property_contexts", "test. u:object_r:test:s0\n"},
+            {"/vendor_property_contexts", ""},
+    };
+    auto property_info = SerializedPropertyInfo();
+
+    EXPECT_FALSE(PropertyInfoCache(files).Load(cache_path).has_value());
+    ASSERT_TRUE(PropertyInfoCache(files).Save(cache_path, property_info).ok());
+    EXPECT_EQ(property_info, PropertyInfoCache(files).Load(cache_path));
+}
+
+TEST(property_info_cache, ChangedFiles) {
+    TemporaryDir dir;
+    std::string cache_path = dir.path + "/property_info_cache"s;
+    auto files = std::vector<std::pair<std::string, std::string>>{
+            {"/plat_property_contexts", "test. u:object_r:test:s0\n"},
+    };
+    ASSERT_TRUE(PropertyInfoCache(files).Save(cache_path, SerializedPropertyInfo()).ok());
+
+    auto changed_contents = files;
+    changed_contents[0].second += "other. u:object_r:other:s0\n";
+    EXPECT_FALSE(PropertyInfoCache(changed_contents).Load(cache_path).has_value());
+
+    auto added_file = files;
+    added_file.emplace_back("/vendor_property_contexts", "");
+    EXPECT_FALSE(PropertyInfoCache(added_file).Load(cache_path).has_value());
+
+    // Moving text from one file's name to its contents must not give the same key.
+    auto moved_text = std::vector<std::pair<std::string, std::string>>{
+            {"/plat_property_contexts" "test.", " u:object_r:test:s0\n"},
+    };
+    EXPECT_FALSE(PropertyInfoCache(moved_text).Load(cache_path).has_value());
+}
+
+TEST(property_info_cache, InsecureCache) {
+    TemporaryDir dir;
+    std::string cache_path = dir.path + "/property_info_cache"s;
+    auto files = std::vector<std::pair<std::string, std::string>>{{"/plat_property_contexts", ""}};
+    ASSERT_TRUE(PropertyInfoCache(files).Save(cache_path, SerializedPropertyInfo()).ok());
+
+    ASSERT_EQ(0, chmod(cache_path.c_str(), 0666));
+    EXPECT_FALSE(PropertyInfoCache(files).Load(cache_path).has_value());
+}
+
+}  // namespace init
+}  // namespace android
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <poll.h>
 #include <sys/select.h>
@@ -39,6 +40,8 @@
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -58,6 +61,7 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <property_info_parser/property_info_parser.h>
+#include <private/android_filesystem_config.h>
 #include <property_info_serializer/property_info_serializer.h>
 // #include <selinux/android.h>
 // #include <selinux/label.h>
@@ -67,6 +71,8 @@
 #include "epoll.h"
 #include "init.h"
 #include "persistent_properties.h"
+#include "property_access_cache.h"
+#include "property_info_cache.h"
 #include "property_type.h"
 #include "proto_utils.h"
 #include "second_stage_resources.h"
@@ -106,13 +112,14 @@ constexpr auto VBMETA_DIGEST_PROP = "ro.boot.vbmeta.digest";
 constexpr auto DIGEST_SIZE_USED = 8;
 constexpr auto API_LEVEL_CURRENT = 10000;
 
-static bool persistent_properties_loaded = false;
+static std::atomic<bool> persistent_properties_loaded = false;
 
 static int property_set_fd = -1;
 static int from_init_socket = -1;
 static int init_socket = -1;
 static bool accept_messages = false;
 static std::mutex accept_messages_lock;
+static std::mutex property_area_lock;
 static std::thread property_service_thread;
 
 static PropertyInfoAreaFile property_info_area;
@@ -160,21 +167,34 @@ void StopSendingMessages() {
 //                                 &audit_data) == 0;
 // }
 
+// static PropertyAccessCache property_access_cache;
+
 // static bool CheckMacPerms(const std::string& name, const char* target_context,
 //                           const char* source_context, const ucred& cr) {
 //     if (!target_context || !source_context) {
 //         return false;
 //     }
 
-//     PropertyAuditData audit_data;
+//     auto check = [&]() {
+//         PropertyAuditData audit_data;
 
-//     audit_data.name = name.c_str();
-//     audit_data.cr = &cr;
+//         audit_data.name = name.c_str();
+//         audit_data.cr = &cr;
 
-//     bool has_access = (selinux_check_access(source_context, target_context, "property_service",
-//                                             "set", &audit_data) == 0);
+//         return selinux_check_access(source_context, target_context, "property_service", "set",
+//                                     &audit_data) == 0;
+//     };
 
-//     return has_access;
+//     // The target context always comes from the property info area, but control messages look
+//     // it up under a made up name, so find its index from the context itself. Without the
+//     // status page, policy reloads would go unnoticed, so don't cache at all.
+//     int context_index = property_info_area->FindContextIndex(target_context);
+//     int policy_seqno = selinux_status_policyload();
+//     if (context_index < 0 || policy_seqno < 0) {
+//         return check();
+//     }
+//     return property_access_cache.CheckAccess(source_context, context_index, policy_seqno,
+//                                              check);
 // }
 
 static uint32_t PropertySet(const std::string& name, const std::string& value, std::string* error) {
@@ -190,6 +210,9 @@ static uint32_t PropertySet(const std::string& name, const std::string& value, s
         return PROP_ERROR_INVALID_VALUE;
     }
 
+    // Everything above may run on several property service workers at once; updates of the
+    // property area and the messages about them are made one at a time and in order.
+    auto lock = std::lock_guard{property_area_lock};
     prop_info* pi = (prop_info*) __system_property_find(name.c_str());
     if (pi != nullptr) {
         // ro.* properties are actually "write-once".
@@ -210,11 +233,11 @@ static uint32_t PropertySet(const std::string& name, const std::string& value, s
     // Don't write properties to disk until after we have read all default
     // properties to prevent them from being overwritten by default values.
     if (persistent_properties_loaded && StartsWith(name, "persist.")) {
-        WritePersistentProperty(name, value);
+        PersistentPropertyWriter::GetInstance().Write(name, value);
     }
     // If init hasn't started its main loop, then it won't be handling property changed messages
     // anyway, so there's no need to try to send them.
-    auto lock = std::lock_guard{accept_messages_lock};
+    auto messages_lock = std::lock_guard{accept_messages_lock};
     if (accept_messages) {
         PropertyChanged(name, value);
     }
@@ -304,6 +327,15 @@ class SocketConnection {
         return result == sizeof(value);
     }
 
+    bool SendUint32s(const std::vector<uint32_t>& values) {
+        if (!socket_.ok()) {
+            return true;
+        }
+        size_t size = values.size() * sizeof(uint32_t);
+        int result = TEMP_FAILURE_RETRY(send(socket_, values.data(), size, 0));
+        return result == static_cast<int>(size);
+    }
+
     // bool GetSourceContext(std::string* source_context) const {
     //     char* c_source_context = nullptr;
     //     if (getpeercon(socket_, &c_source_context) != 0) {
@@ -316,6 +348,8 @@ class SocketConnection {
 
     [[nodiscard]] int Release() { return socket_.release(); }
 
+    int fd() const { return socket_.get(); }
+
     const ucred& cred() { return cred_; }
 
   private:
@@ -528,30 +562,36 @@ uint32_t HandlePropertySet(const std::string& name, const std::string& value,
     return PropertySet(name, value, error);
 }
 
-static void handle_property_set_fd() {
-    static constexpr uint32_t kDefaultSocketTimeout = 2000; /* ms */
+static constexpr uint32_t kDefaultSocketTimeout = 2000; /* ms */
 
-    int s = accept4(property_set_fd, nullptr, nullptr, SOCK_CLOEXEC);
-    if (s == -1) {
-        return;
-    }
+// Connections of clients that asked to keep using them with PROP_MSG_KEEP_ALIVE, by fd. Only the
+// property service thread touches these; workers hand new ones over through
+// |new_persistent_connections|.
+static Epoll* property_set_epoll = nullptr;
+static std::map<int, std::unique_ptr<SocketConnection>> persistent_connections;
+static std::atomic<size_t> persistent_connection_count = 0;
+static constexpr size_t kMaxPersistentConnections = 32;
+static constexpr uint32_t kMaxBatchSize = 256;
 
-    ucred cr;
-    socklen_t cr_size = sizeof(cr);
-    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
-        close(s);
-        PLOG(ERROR) << "sys_prop: unable to get SO_PEERCRED";
-        return;
-    }
+static std::mutex new_persistent_connections_lock;
+static std::vector<std::unique_ptr<SocketConnection>> new_persistent_connections;
+static unique_fd new_persistent_connection_fd;
+
+static void HandlePersistentConnection(int fd);
+
+static bool MayKeepConnection(const ucred& cr) {
+    return cr.uid == AID_ROOT || cr.uid == AID_SYSTEM;
+}
 
-    SocketConnection socket(s, cr);
+// Reads and handles one command. Returns whether the connection should stay open for more.
+static bool HandlePropertyMessage(std::unique_ptr<SocketConnection>& socket, bool persistent) {
     uint32_t timeout_ms = kDefaultSocketTimeout;
 
     uint32_t cmd = 0;
-    if (!socket.RecvUint32(&cmd, &timeout_ms)) {
+    if (!socket->RecvUint32(&cmd, &timeout_ms)) {
         PLOG(ERROR) << "sys_prop: error while reading command from the socket";
-        socket.SendUint32(PROP_ERROR_READ_CMD);
-        return;
+        socket->SendUint32(PROP_ERROR_READ_CMD);
+        return false;
     }
 
     switch (cmd) {
@@ -559,22 +599,22 @@ static void handle_property_set_fd() {
         char prop_name[PROP_NAME_MAX];
         char prop_value[PROP_VALUE_MAX];
 
-        if (!socket.RecvChars(prop_name, PROP_NAME_MAX, &timeout_ms) ||
-            !socket.RecvChars(prop_value, PROP_VALUE_MAX, &timeout_ms)) {
+        if (!socket->RecvChars(prop_name, PROP_NAME_MAX, &timeout_ms) ||
+            !socket->RecvChars(prop_value, PROP_VALUE_MAX, &timeout_ms)) {
           PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP): error while reading name/value from the socket";
-          return;
+          return false;
         }
 
         prop_name[PROP_NAME_MAX-1] = 0;
         prop_value[PROP_VALUE_MAX-1] = 0;
 
         std::string source_context;
-        // if (!socket.GetSourceContext(&source_context)) {
+        // if (!socket->GetSourceContext(&source_context)) {
         //     PLOG(ERROR) << "Unable to set property '" << prop_name << "': getpeercon() failed";
-        //     return;
+        //     return false;
         // }
 
-        const auto& cr = socket.cred();
+        const auto& cr = socket->cred();
         std::string error;
         uint32_t result =
                 HandlePropertySet(prop_name, prop_value, source_context, cr, nullptr, &error);
@@ -583,44 +623,202 @@ static void handle_property_set_fd() {
                        << " gid:" << cr.gid << " pid:" << cr.pid << ": " << error;
         }
 
-        break;
+        return persistent;
       }
 
     case PROP_MSG_SETPROP2: {
         std::string name;
         std::string value;
-        if (!socket.RecvString(&name, &timeout_ms) ||
-            !socket.RecvString(&value, &timeout_ms)) {
+        if (!socket->RecvString(&name, &timeout_ms) ||
+            !socket->RecvString(&value, &timeout_ms)) {
           PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP2): error while reading name/value from the socket";
-          socket.SendUint32(PROP_ERROR_READ_DATA);
-          return;
+          socket->SendUint32(PROP_ERROR_READ_DATA);
+          return false;
         }
 
         std::string source_context;
-        // if (!socket.GetSourceContext(&source_context)) {
+        // if (!socket->GetSourceContext(&source_context)) {
         //     PLOG(ERROR) << "Unable to set property '" << name << "': getpeercon() failed";
-        //     socket.SendUint32(PROP_ERROR_PERMISSION_DENIED);
-        //     return;
+        //     socket->SendUint32(PROP_ERROR_PERMISSION_DENIED);
+        //     return false;
         // }
 
-        const auto& cr = socket.cred();
+        // A persistent connection cannot be handed over to init to reply to a control message
+        // later, so its control messages are acknowledged once they are queued.
+        const auto& cr = socket->cred();
         std::string error;
-        uint32_t result = HandlePropertySet(name, value, source_context, cr, &socket, &error);
+        uint32_t result = HandlePropertySet(name, value, source_context, cr,
+                                            persistent ? nullptr : socket.get(), &error);
         if (result != PROP_SUCCESS) {
             LOG(ERROR) << "Unable to set property '" << name << "' from uid:" << cr.uid
                        << " gid:" << cr.gid << " pid:" << cr.pid << ": " << error;
         }
-        socket.SendUint32(result);
-        break;
+        socket->SendUint32(result);
+        return persistent;
+      }
+
+    case PROP_MSG_SETPROP_BATCH: {
+        // Read the whole batch first, so that a malformed one sets nothing.
+        uint32_t count = 0;
+        std::vector<std::pair<std::string, std::string>> entries;
+        bool ok = socket->RecvUint32(&count, &timeout_ms) && count <= kMaxBatchSize;
+        for (uint32_t i = 0; ok && i < count; ++i) {
+            auto& [name, value] = entries.emplace_back();
+            ok = socket->RecvString(&name, &timeout_ms) && socket->RecvString(&value, &timeout_ms);
+        }
+        if (!ok) {
+            PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): error while reading the batch from "
+                           "the socket";
+            socket->SendUint32(PROP_ERROR_READ_DATA);
+            return false;
+        }
+
+        std::string source_context;
+        const auto& cr = socket->cred();
+        std::vector<uint32_t> results;
+        for (const auto& [name, value] : entries) {
+            std::string error;
+            uint32_t result = HandlePropertySet(name, value, source_context, cr, nullptr, &error);
+            if (result != PROP_SUCCESS) {
+                LOG(ERROR) << "Unable to set property '" << name << "' from uid:" << cr.uid
+                           << " gid:" << cr.gid << " pid:" << cr.pid << ": " << error;
+            }
+            results.emplace_back(result);
+        }
+        socket->SendUint32s(results);
+        return persistent;
+      }
+
+    case PROP_MSG_KEEP_ALIVE: {
+        if (persistent) {
+            socket->SendUint32(PROP_SUCCESS);
+            return true;
+        }
+        const auto& cr = socket->cred();
+        bool allowed = MayKeepConnection(cr);
+        if (allowed && persistent_connection_count.fetch_add(1) >= kMaxPersistentConnections) {
+            persistent_connection_count--;
+            allowed = false;
+        }
+        if (!allowed) {
+            LOG(ERROR) << "sys_prop: not keeping the connection of uid:" << cr.uid
+                       << " pid:" << cr.pid << " open";
+            socket->SendUint32(PROP_ERROR_PERMISSION_DENIED);
+            return false;
+        }
+        socket->SendUint32(PROP_SUCCESS);
+        {
+            auto lock = std::lock_guard{new_persistent_connections_lock};
+            new_persistent_connections.emplace_back(std::move(socket));
+        }
+        uint64_t counter = 1;
+        TEMP_FAILURE_RETRY(write(new_persistent_connection_fd, &counter, sizeof(counter)));
+        return true;
       }
 
     default:
         LOG(ERROR) << "sys_prop: invalid command " << cmd;
-        socket.SendUint32(PROP_ERROR_INVALID_CMD);
-        break;
+        socket->SendUint32(PROP_ERROR_INVALID_CMD);
+        return false;
+    }
+}
+
+// Commands on persistent connections come from root and system only, so they are handled on the
+// property service thread itself rather than queued behind new connections.
+static void HandlePersistentConnection(int fd) {
+    auto it = persistent_connections.find(fd);
+    if (it == persistent_connections.end()) return;
+
+    // The client hanging up is how a persistent connection normally ends.
+    char c;
+    bool open = TEMP_FAILURE_RETRY(recv(fd, &c, sizeof(c), MSG_PEEK | MSG_DONTWAIT)) > 0;
+    if (!open || !HandlePropertyMessage(it->second, true)) {
+        if (auto result = property_set_epoll->UnregisterHandler(fd); !result.ok()) {
+            LOG(ERROR) << "sys_prop: " << result.error();
+        }
+        persistent_connections.erase(it);
+        persistent_connection_count--;
     }
 }
 
+static void HandleNewPersistentConnections() {
+    uint64_t counter;
+    TEMP_FAILURE_RETRY(read(new_persistent_connection_fd, &counter, sizeof(counter)));
+
+    auto lock = std::lock_guard{new_persistent_connections_lock};
+    for (auto& socket : new_persistent_connections) {
+        int fd = socket->fd();
+        if (auto result = property_set_epoll->RegisterHandler(
+                    fd, [fd]() { HandlePersistentConnection(fd); });
+            !result.ok()) {
+            LOG(ERROR) << "sys_prop: " << result.error();
+            persistent_connection_count--;
+            continue;
+        }
+        persistent_connections.emplace(fd, std::move(socket));
+    }
+    new_persistent_connections.clear();
+}
+
+// Reading a message can wait up to kDefaultSocketTimeout on a slow client, and validating it takes
+// a while too, so new connections are handled on a few workers instead of the property service
+// thread. PropertySet() orders the resulting property area updates.
+class PropertySetWorkers {
+  public:
+    static constexpr size_t kNumThreads = 4;
+
+    void Start() {
+        for (size_t i = 0; i < kNumThreads; ++i) {
+            std::thread{&PropertySetWorkers::ThreadFunction, this}.detach();
+        }
+    }
+
+    void Queue(std::unique_ptr<SocketConnection> socket) {
+        {
+            auto lock = std::lock_guard{lock_};
+            sockets_.emplace(std::move(socket));
+        }
+        cv_.notify_one();
+    }
+
+  private:
+    void ThreadFunction() {
+        auto lock = std::unique_lock{lock_};
+        while (true) {
+            cv_.wait(lock, [this] { return !sockets_.empty(); });
+            auto socket = std::move(sockets_.front());
+            sockets_.pop();
+            lock.unlock();
+            HandlePropertyMessage(socket, false);
+            socket.reset();
+            lock.lock();
+        }
+    }
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::queue<std::unique_ptr<SocketConnection>> sockets_;
+};
+
+static PropertySetWorkers property_set_workers;
+
+static void handle_property_set_fd() {
+    int s = accept4(property_set_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (s == -1) {
+        return;
+    }
+
+    ucred cr;
+    socklen_t cr_size = sizeof(cr);
+    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
+        close(s);
+        PLOG(ERROR) << "sys_prop: unable to get SO_PEERCRED";
+        return;
+    }
+
+    property_set_workers.Queue(std::make_unique<SocketConnection>(s, cr));
+}
+
 uint32_t InitPropertySet(const std::string& name, const std::string& value) {
     uint32_t result = 0;
     ucred cr = {.pid = 1, .uid = 0, .gid = 0};
@@ -633,15 +831,14 @@ uint32_t InitPropertySet(const std::string& name, const std::string& value) {
     return result;
 }
 
-static Result<void> load_properties_from_file(const char*, const char*,
-                                              std::map<std::string, std::string>*);
+static Result<void> ParsePropertyFile(const char*, const char*, PropertyFileEntries*);
 
 /*
  * Filter is used to decide which properties to load: NULL loads all keys,
  * "ro.foo.*" is a prefix match, and "ro.foo.bar" is an exact match.
  */
 static void LoadProperties(char* data, const char* filter, const char* filename,
-                           std::map<std::string, std::string>* properties) {
+                           PropertyFileEntries* entries) {
     char *key, *value, *eol, *sol, *tmp, *fn;
     size_t flen = 0;
 
@@ -695,7 +892,7 @@ static void LoadProperties(char* data, const char* filter, const char* filename,
                 continue;
             }
 
-            if (auto res = load_properties_from_file(expanded_filename->c_str(), key, properties);
+            if (auto res = ParsePropertyFile(expanded_filename->c_str(), key, entries);
                 !res.ok()) {
                 LOG(WARNING) << res.error();
             }
@@ -727,14 +924,7 @@ static void LoadProperties(char* data, const char* filter, const char* filename,
             // ucred cr = {.pid = 1, .uid = 0, .gid = 0};
             std::string error;
             // if (CheckPermissions(key, value, context, cr, &error) == PROP_SUCCESS) {
-                auto it = properties->find(key);
-                if (it == properties->end()) {
-                    (*properties)[key] = value;
-                } else if (it->second != value) {
-                    LOG(WARNING) << "Overriding previous property '" << key << "':'" << it->second
-                                 << "' with new value '" << value << "'";
-                    it->second = value;
-                }
+                entries->emplace_back(key, value);
             // } else {
             //     LOG(ERROR) << "Do not have permissions to set '" << key << "' to '" << value
             //                << "' in property file '" << filename << "': " << error;
@@ -745,8 +935,8 @@ static void LoadProperties(char* data, const char* filter, const char* filename,
 
 // Filter is used to decide which properties to load: NULL loads all keys,
 // "ro.foo.*" is a prefix match, and "ro.foo.bar" is an exact match.
-static Result<void> load_properties_from_file(const char* filename, const char* filter,
-                                              std::map<std::string, std::string>* properties) {
+static Result<void> ParsePropertyFile(const char* filename, const char* filter,
+                                      PropertyFileEntries* entries) {
     Timer t;
     auto file_contents = ReadFile(filename);
     if (!file_contents.ok()) {
@@ -755,20 +945,65 @@ static Result<void> load_properties_from_file(const char* filename, const char*
     }
     file_contents->push_back('\n');
 
-    LoadProperties(file_contents->data(), filter, filename, properties);
+    LoadProperties(file_contents->data(), filter, filename, entries);
     LOG(VERBOSE) << "(Loading properties from " << filename << " took " << t << ".)";
     return {};
 }
 
-static void LoadPropertiesFromSecondStageRes(std::map<std::string, std::string>* properties) {
-    std::string prop = GetRamdiskPropForSecondStage();
-    if (access(prop.c_str(), R_OK) != 0) {
-        CHECK(errno == ENOENT) << "Cannot access " << prop << ": " << strerror(errno);
-        return;
+// Later entries override earlier ones, whether they are "ro." properties or not.
+static void MergeProperties(const PropertyFileEntries& entries,
+                            std::map<std::string, std::string>* properties) {
+    for (const auto& [key, value] : entries) {
+        auto it = properties->find(key);
+        if (it == properties->end()) {
+            properties->emplace(key, value);
+        } else if (it->second != value) {
+            LOG(WARNING) << "Overriding previous property '" << key << "':'" << it->second
+                         << "' with new value '" << value << "'";
+            it->second = value;
+        }
     }
-    if (auto res = load_properties_from_file(prop.c_str(), nullptr, properties); !res.ok()) {
-        LOG(WARNING) << res.error();
+}
+
+static Result<void> load_properties_from_file(const char* filename, const char* filter,
+                                              std::map<std::string, std::string>* properties) {
+    PropertyFileEntries entries;
+    if (auto res = ParsePropertyFile(filename, filter, &entries); !res.ok()) {
+        return res.error();
+    }
+    MergeProperties(entries, properties);
+    return {};
+}
+
+std::map<std::string, Result<PropertyFileEntries>> ParsePropertyFiles(
+        const std::vector<std::string>& filenames, size_t num_threads) {
+    std::vector<std::optional<Result<PropertyFileEntries>>> results(filenames.size());
+    std::atomic<size_t> next_file = 0;
+    auto parse_files = [&]() {
+        for (size_t i = next_file++; i < filenames.size(); i = next_file++) {
+            PropertyFileEntries entries;
+            if (auto res = ParsePropertyFile(filenames[i].c_str(), nullptr, &entries); res.ok()) {
+                results[i] = std::move(entries);
+            } else {
+                results[i] = res.error();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(num_threads, filenames.size()); ++i) {
+        threads.emplace_back(parse_files);
+    }
+    parse_files();
+    for (auto& thread : threads) {
+        thread.join();
     }
+
+    std::map<std::string, Result<PropertyFileEntries>> parsed_files;
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        parsed_files.emplace(filenames[i], std::move(*results[i]));
+    }
+    return parsed_files;
 }
 
 // persist.sys.usb.config values can't be combined on build-time when property
@@ -1059,15 +1294,52 @@ static void property_initialize_ro_vendor_api_level() {
     }
 }
 
+// The number of threads PropertyLoadBootDefaults() reads and parses property files on.
+static constexpr size_t kPropertyFileThreads = 4;
+
 void PropertyLoadBootDefaults() {
     // We read the properties and their values into a map, in order to always allow properties
     // loaded in the later property files to override the properties in loaded in the earlier
     // property files, regardless of if they are "ro." properties or not.
     std::map<std::string, std::string> properties;
 
+    // Every file that may be loaded below is read and parsed up front, in parallel. They are still
+    // merged into the map one at a time in the order below, so precedence is unchanged.
+    std::vector<std::string> property_files;
     if (IsRecoveryMode()) {
-        if (auto res = load_properties_from_file("/prop.default", nullptr, &properties);
-            !res.ok()) {
+        property_files.emplace_back("/prop.default");
+    }
+    std::string second_stage_res_prop = GetRamdiskPropForSecondStage();
+    property_files.emplace_back(second_stage_res_prop);
+    property_files.emplace_back("/system/build.prop");
+    for (const auto& partition : {"system_ext", "odm", "product"}) {
+        property_files.emplace_back(StringPrintf("/%s/etc/build.prop", partition));
+        property_files.emplace_back(StringPrintf("/%s/default.prop", partition));
+        property_files.emplace_back(StringPrintf("/%s/build.prop", partition));
+    }
+    for (const auto& file : {"/system_dlkm/etc/build.prop", "/vendor/default.prop",
+                             "/vendor/build.prop", "/vendor_dlkm/etc/build.prop",
+                             "/odm_dlkm/etc/build.prop", kDebugRamdiskProp}) {
+        property_files.emplace_back(file);
+    }
+    auto parsed_files = ParsePropertyFiles(property_files, kPropertyFileThreads);
+
+    const auto load_properties = [&parsed_files](const std::string& filename,
+                                                 std::map<std::string, std::string>* into)
+            -> Result<void> {
+        auto it = parsed_files.find(filename);
+        if (it == parsed_files.end()) {
+            return load_properties_from_file(filename.c_str(), nullptr, into);
+        }
+        if (!it->second.ok()) {
+            return it->second.error();
+        }
+        MergeProperties(*it->second, into);
+        return {};
+    };
+
+    if (IsRecoveryMode()) {
+        if (auto res = load_properties("/prop.default", &properties); !res.ok()) {
             LOG(ERROR) << res.error();
         }
     }
@@ -1075,10 +1347,11 @@ void PropertyLoadBootDefaults() {
     // /<part>/etc/build.prop is the canonical location of the build-time properties since S.
     // Falling back to /<part>/defalt.prop and /<part>/build.prop only when legacy path has to
     // be supported, which is controlled by the support_legacy_path_until argument.
-    const auto load_properties_from_partition = [&properties](const std::string& partition,
-                                                              int support_legacy_path_until) {
+    const auto load_properties_from_partition = [&properties, &load_properties](
+                                                        const std::string& partition,
+                                                        int support_legacy_path_until) {
         auto path = "/" + partition + "/etc/build.prop";
-        if (load_properties_from_file(path.c_str(), nullptr, &properties).ok()) {
+        if (load_properties(path, &properties).ok()) {
             return;
         }
         // To read ro.<partition>.build.version.sdk, temporarily load the legacy paths into a
@@ -1087,8 +1360,8 @@ void PropertyLoadBootDefaults() {
         std::map<std::string, std::string> temp;
         auto legacy_path1 = "/" + partition + "/default.prop";
         auto legacy_path2 = "/" + partition + "/build.prop";
-        load_properties_from_file(legacy_path1.c_str(), nullptr, &temp);
-        load_properties_from_file(legacy_path2.c_str(), nullptr, &temp);
+        load_properties(legacy_path1, &temp);
+        load_properties(legacy_path2, &temp);
         bool support_legacy_path = false;
         auto version_prop_name = "ro." + partition + ".build.version.sdk";
         auto it = temp.find(version_prop_name);
@@ -1102,10 +1375,10 @@ void PropertyLoadBootDefaults() {
         }
         if (support_legacy_path) {
             // We don't update temp into properties directly as it might skip any (future) logic
-            // for resolving duplicates implemented in load_properties_from_file.  Instead, read
+            // for resolving duplicates implemented in MergeProperties.  Instead, read
             // the files again into the properties map.
-            load_properties_from_file(legacy_path1.c_str(), nullptr, &properties);
-            load_properties_from_file(legacy_path2.c_str(), nullptr, &properties);
+            load_properties(legacy_path1, &properties);
+            load_properties(legacy_path2, &properties);
         } else {
             LOG(FATAL) << legacy_path1 << " and " << legacy_path2 << " were not loaded "
                        << "because " << version_prop_name << "(" << it->second << ") is newer "
@@ -1115,31 +1388,36 @@ void PropertyLoadBootDefaults() {
 
     // Order matters here. The more the partition is specific to a product, the higher its
     // precedence is.
-    LoadPropertiesFromSecondStageRes(&properties);
+    if (access(second_stage_res_prop.c_str(), R_OK) == 0) {
+        if (auto res = load_properties(second_stage_res_prop, &properties); !res.ok()) {
+            LOG(WARNING) << res.error();
+        }
+    } else {
+        CHECK(errno == ENOENT) << "Cannot access " << second_stage_res_prop << ": "
+                               << strerror(errno);
+    }
 
     // system should have build.prop, unlike the other partitions
-    if (auto res = load_properties_from_file("/system/build.prop", nullptr, &properties);
-        !res.ok()) {
+    if (auto res = load_properties("/system/build.prop", &properties); !res.ok()) {
         LOG(WARNING) << res.error();
     }
 
     load_properties_from_partition("system_ext", /* support_legacy_path_until */ 30);
-    load_properties_from_file("/system_dlkm/etc/build.prop", nullptr, &properties);
+    load_properties("/system_dlkm/etc/build.prop", &properties);
     // TODO(b/117892318): uncomment the following condition when vendor.imgs for aosp_* targets are
     // all updated.
     // if (SelinuxGetVendorAndroidVersion() <= __ANDROID_API_R__) {
-    load_properties_from_file("/vendor/default.prop", nullptr, &properties);
+    load_properties("/vendor/default.prop", &properties);
     // }
-    load_properties_from_file("/vendor/build.prop", nullptr, &properties);
-    load_properties_from_file("/vendor_dlkm/etc/build.prop", nullptr, &properties);
-    load_properties_from_file("/odm_dlkm/etc/build.prop", nullptr, &properties);
+    load_properties("/vendor/build.prop", &properties);
+    load_properties("/vendor_dlkm/etc/build.prop", &properties);
+    load_properties("/odm_dlkm/etc/build.prop", &properties);
     load_properties_from_partition("odm", /* support_legacy_path_until */ 28);
     load_properties_from_partition("product", /* support_legacy_path_until */ 30);
 
     if (access(kDebugRamdiskProp, R_OK) == 0) {
         LOG(INFO) << "Loading " << kDebugRamdiskProp;
-        if (auto res = load_properties_from_file(kDebugRamdiskProp, nullptr, &properties);
-            !res.ok()) {
+        if (auto res = load_properties(kDebugRamdiskProp, &properties); !res.ok()) {
             LOG(WARNING) << res.error();
         }
     }
@@ -1162,14 +1440,20 @@ void PropertyLoadBootDefaults() {
     update_sys_usb_config();
 }
 
-bool LoadPropertyInfoFromFile(const std::string& filename,
-                              std::vector<PropertyInfoEntry>* property_infos) {
+static bool ReadPropertyContextsFile(const std::string& filename,
+                                     std::vector<std::pair<std::string, std::string>>* files) {
     auto file_contents = std::string();
     if (!ReadFileToString(filename, &file_contents)) {
         PLOG(ERROR) << "Could not read properties from '" << filename << "'";
         return false;
     }
+    files->emplace_back(filename, std::move(file_contents));
+    return true;
+}
 
+static void LoadPropertyInfoFromContents(const std::string& filename,
+                                         const std::string& file_contents,
+                                         std::vector<PropertyInfoEntry>* property_infos) {
     auto errors = std::vector<std::string>{};
     bool require_prefix_or_exact = true;//SelinuxGetVendorAndroidVersion() >= __ANDROID_API_R__;
     ParsePropertyInfoFile(file_contents, require_prefix_or_exact, property_infos, &errors);
@@ -1178,59 +1462,76 @@ bool LoadPropertyInfoFromFile(const std::string& filename,
     for (const auto& error : errors) {
         LOG(ERROR) << "Could not read line from '" << filename << "': " << error;
     }
-
-    return true;
 }
 
+// Property info serialized during a previous boot. /metadata is mounted by first stage init, if the
+// device has it, so this is available before the property area is initialized.
+static constexpr const char kPropertyInfoCachePath[] = "/metadata/init/property_info_cache";
+
 void CreateSerializedPropertyInfo() {
-    auto property_infos = std::vector<PropertyInfoEntry>();
+    auto property_contexts = std::vector<std::pair<std::string, std::string>>();
     // if (access("/system/etc/selinux/plat_property_contexts", R_OK) != -1) {
-    //     if (!LoadPropertyInfoFromFile("/system/etc/selinux/plat_property_contexts",
-    //                                   &property_infos)) {
+    //     if (!ReadPropertyContextsFile("/system/etc/selinux/plat_property_contexts",
+    //                                   &property_contexts)) {
     //         return;
     //     }
     //     // Don't check for failure here, since we don't always have all of these partitions.
     //     // E.g. In case of recovery, the vendor partition will not have mounted and we
     //     // still need the system / platform properties to function.
     //     if (access("/dev/selinux/apex_property_contexts", R_OK) != -1) {
-    //         LoadPropertyInfoFromFile("/dev/selinux/apex_property_contexts", &property_infos);
+    //         ReadPropertyContextsFile("/dev/selinux/apex_property_contexts", &property_contexts);
     //     }
     //     if (access("/system_ext/etc/selinux/system_ext_property_contexts", R_OK) != -1) {
-    //         LoadPropertyInfoFromFile("/system_ext/etc/selinux/system_ext_property_contexts",
-    //                                  &property_infos);
+    //         ReadPropertyContextsFile("/system_ext/etc/selinux/system_ext_property_contexts",
+    //                                  &property_contexts);
     //     }
     //     if (access("/vendor/etc/selinux/vendor_property_contexts", R_OK) != -1) {
-    //         LoadPropertyInfoFromFile("/vendor/etc/selinux/vendor_property_contexts",
-    //                                  &property_infos);
+    //         ReadPropertyContextsFile("/vendor/etc/selinux/vendor_property_contexts",
+    //                                  &property_contexts);
     //     }
     //     if (access("/product/etc/selinux/product_property_contexts", R_OK) != -1) {
-    //         LoadPropertyInfoFromFile("/product/etc/selinux/product_property_contexts",
-    //                                  &property_infos);
+    //         ReadPropertyContextsFile("/product/etc/selinux/product_property_contexts",
+    //                                  &property_contexts);
     //     }
     //     if (access("/odm/etc/selinux/odm_property_contexts", R_OK) != -1) {
-    //         LoadPropertyInfoFromFile("/odm/etc/selinux/odm_property_contexts", &property_infos);
+    //         ReadPropertyContextsFile("/odm/etc/selinux/odm_property_contexts",
+    //                                  &property_contexts);
     //     }
     // } else {
-    //     if (!LoadPropertyInfoFromFile("/plat_property_contexts", &property_infos)) {
+    //     if (!ReadPropertyContextsFile("/plat_property_contexts", &property_contexts)) {
     //         return;
     //     }
-    //     LoadPropertyInfoFromFile("/system_ext_property_contexts", &property_infos);
-    //     LoadPropertyInfoFromFile("/vendor_property_contexts", &property_infos);
-    //     LoadPropertyInfoFromFile("/product_property_contexts", &property_infos);
-    //     LoadPropertyInfoFromFile("/odm_property_contexts", &property_infos);
-    //     LoadPropertyInfoFromFile("/dev/selinux/apex_property_contexts", &property_infos);
+    //     ReadPropertyContextsFile("/system_ext_property_contexts", &property_contexts);
+    //     ReadPropertyContextsFile("/vendor_property_contexts", &property_contexts);
+    //     ReadPropertyContextsFile("/product_property_contexts", &property_contexts);
+    //     ReadPropertyContextsFile("/odm_property_contexts", &property_contexts);
+    //     ReadPropertyContextsFile("/dev/selinux/apex_property_contexts", &property_contexts);
     // }
 
-    auto serialized_contexts = std::string();
-    auto error = std::string();
-    if (!BuildTrie(property_infos, "u:object_r:default_prop:s0", "string", &serialized_contexts,
-                   &error)) {
-        LOG(ERROR) << "Unable to serialize property contexts: " << error;
-        return;
+    // Parsing and serializing takes much longer than reading the files, so the result is reused
+    // for as long as the files stay the same.
+    auto cache = PropertyInfoCache(property_contexts);
+    auto serialized_contexts = cache.Load(kPropertyInfoCachePath);
+    if (!serialized_contexts) {
+        auto property_infos = std::vector<PropertyInfoEntry>();
+        for (const auto& [filename, file_contents] : property_contexts) {
+            LoadPropertyInfoFromContents(filename, file_contents, &property_infos);
+        }
+
+        serialized_contexts.emplace();
+        auto error = std::string();
+        if (!BuildTrie(property_infos, "u:object_r:default_prop:s0", "string",
+                       &*serialized_contexts, &error)) {
+            LOG(ERROR) << "Unable to serialize property contexts: " << error;
+            return;
+        }
+        if (auto result = cache.Save(kPropertyInfoCachePath, *serialized_contexts); !result.ok()) {
+            LOG(WARNING) << "Could not save property info cache: " << result.error();
+        }
     }
 
     constexpr static const char kPropertyInfosPath[] = "/dev/__properties__/property_info";
-    if (!WriteStringToFile(serialized_contexts, kPropertyInfosPath, 0444, 0, 0, false)) {
+    if (!WriteStringToFile(*serialized_contexts, kPropertyInfosPath, 0444, 0, 0, false)) {
         PLOG(ERROR) << "Unable to write serialized property infos to file";
     }
     // selinux_android_restorecon(kPropertyInfosPath, 0);
@@ -1306,6 +1607,10 @@ void PropertyInit() {
     // selinux_callback cb;
     // cb.func_audit = PropertyAuditCallback;
     // selinux_set_callback(SELINUX_CB_AUDIT, cb);
+    // // Lets CheckMacPerms() notice policy reloads through selinux_status_policyload().
+    // if (selinux_status_open(true) < 0) {
+    //     PLOG(ERROR) << "selinux_status_open() failed";
+    // }
 
     mkdir("/dev/__properties__", S_IRWXU | S_IXGRP | S_IXOTH);
     CreateSerializedPropertyInfo();
@@ -1371,11 +1676,23 @@ static void PropertyServiceThread() {
         LOG(FATAL) << result.error();
     }
 
+    property_set_epoll = &epoll;
     if (auto result = epoll.RegisterHandler(property_set_fd, handle_property_set_fd);
         !result.ok()) {
         LOG(FATAL) << result.error();
     }
 
+    new_persistent_connection_fd.reset(eventfd(0, EFD_CLOEXEC));
+    if (new_persistent_connection_fd == -1) {
+        PLOG(FATAL) << "Failed to create eventfd for persistent property connections";
+    }
+    if (auto result = epoll.RegisterHandler(new_persistent_connection_fd,
+                                            HandleNewPersistentConnections);
+        !result.ok()) {
+        LOG(FATAL) << result.error();
+    }
+    property_set_workers.Start();
+
     if (auto result = epoll.RegisterHandler(init_socket, HandleInitSocket); !result.ok()) {
         LOG(FATAL) << result.error();
     }
@@ -16,19 +16,43 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <sys/socket.h>
 
+#include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "epoll.h"
+#include "result.h"
 
 namespace android {
 namespace init {
 
 static constexpr const char kRestoreconProperty[] = "selinux.restorecon_recursive";
 
+// Property service commands in addition to bionic's PROP_MSG_SETPROP and PROP_MSG_SETPROP2.
+//
+// PROP_MSG_SETPROP_BATCH is followed by a uint32_t count of at most 256 and that many name and
+// value strings, each sent as for PROP_MSG_SETPROP2. The reply is one uint32_t result per entry.
+static constexpr uint32_t PROP_MSG_SETPROP_BATCH = 0x00020002;
+// PROP_MSG_KEEP_ALIVE makes the property service keep reading commands from the connection until
+// the client closes it, instead of closing it after the next command. Only root and system may do
+// this. The reply is a uint32_t result. Control messages sent over such a connection are
+// acknowledged once queued rather than once handled.
+static constexpr uint32_t PROP_MSG_KEEP_ALIVE = 0x00020003;
+
 // bool CanReadProperty(const std::string& source_context, const std::string& name);
 
+// The properties of a property file in the order they appear, with imported files expanded.
+using PropertyFileEntries = std::vector<std::pair<std::string, std::string>>;
+
+// Reads and parses each of |filenames| on up to |num_threads| threads. Files that could not be
+// read map to an error.
+std::map<std::string, Result<PropertyFileEntries>> ParsePropertyFiles(
+        const std::vector<std::string>& filenames, size_t num_threads);
+
 void PropertyInit();
 void StartPropertyService(int* epoll_socket);
 
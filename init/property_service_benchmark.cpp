@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "property_service.h"
+
+using namespace std::string_literals;
+
+namespace android {
+namespace init {
+
+// Reads and parses the device's own property files, as PropertyLoadBootDefaults() does, on the
+// given number of threads.
+static void BenchmarkParsePropertyFiles(benchmark::State& state) {
+    std::vector<std::string> property_files = {"/system/build.prop"};
+    for (const auto& partition : {"system_ext", "system_dlkm", "vendor", "vendor_dlkm", "odm",
+                                  "odm_dlkm", "product"}) {
+        property_files.emplace_back("/"s + partition + "/etc/build.prop");
+        property_files.emplace_back("/"s + partition + "/build.prop");
+    }
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(ParsePropertyFiles(property_files, state.range(0)));
+    }
+}
+
+BENCHMARK(BenchmarkParsePropertyFiles)->Arg(1)->Arg(4);
+
+}  // namespace init
+}  // namespace android
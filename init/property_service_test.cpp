@@ -21,13 +21,21 @@
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
+#include <android-base/file.h>
 #include <android-base/properties.h>
 #include <android-base/scopeguard.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
 
+#include "property_service.h"
+
 using android::base::GetProperty;
 using android::base::SetProperty;
+using android::base::unique_fd;
+using android::base::WriteStringToFile;
+
+using namespace std::string_literals;
 
 namespace android {
 namespace init {
@@ -77,6 +85,60 @@ TEST(property_service, non_utf8_value) {
     EXPECT_TRUE(SetProperty("property_service_utf8_test", "\xF0\x90\x80\x80"));
 }
 
+static void SendUint32(int fd, uint32_t value) {
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(value)), send(fd, &value, sizeof(value), 0));
+}
+
+static void SendString(int fd, const std::string& value) {
+    SendUint32(fd, value.size());
+    ASSERT_EQ(static_cast<ssize_t>(value.size()), send(fd, value.data(), value.size(), 0));
+}
+
+static uint32_t RecvUint32(int fd) {
+    uint32_t value = 0;
+    EXPECT_EQ(static_cast<ssize_t>(sizeof(value)),
+              TEMP_FAILURE_RETRY(recv(fd, &value, sizeof(value), MSG_WAITALL)));
+    return value;
+}
+
+TEST(property_service, batch_on_kept_alive_connection) {
+    if (getuid() != 0) {
+        GTEST_SKIP() << "Skipping test, must be run as root.";
+        return;
+    }
+
+    unique_fd fd(socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    ASSERT_NE(fd, -1);
+
+    static const char* property_service_socket = "/dev/socket/" PROP_SERVICE_NAME;
+    sockaddr_un addr = {};
+    addr.sun_family = AF_LOCAL;
+    strlcpy(addr.sun_path, property_service_socket, sizeof(addr.sun_path));
+
+    socklen_t addr_len = strlen(property_service_socket) + offsetof(sockaddr_un, sun_path) + 1;
+    ASSERT_NE(connect(fd, reinterpret_cast<sockaddr*>(&addr), addr_len), -1);
+
+    SendUint32(fd, PROP_MSG_KEEP_ALIVE);
+    ASSERT_EQ(static_cast<uint32_t>(PROP_SUCCESS), RecvUint32(fd));
+
+    for (const auto& value : {"first", "second"}) {
+        SendUint32(fd, PROP_MSG_SETPROP_BATCH);
+        SendUint32(fd, 3);
+        SendString(fd, "property_service_batch_test.a");
+        SendString(fd, value);
+        SendString(fd, "");
+        SendString(fd, value);
+        SendString(fd, "property_service_batch_test.b");
+        SendString(fd, value);
+
+        EXPECT_EQ(static_cast<uint32_t>(PROP_SUCCESS), RecvUint32(fd));
+        EXPECT_EQ(static_cast<uint32_t>(PROP_ERROR_INVALID_NAME), RecvUint32(fd));
+        EXPECT_EQ(static_cast<uint32_t>(PROP_SUCCESS), RecvUint32(fd));
+        EXPECT_EQ(value, GetProperty("property_service_batch_test.a", ""));
+        EXPECT_EQ(value, GetProperty("property_service_batch_test.b", ""));
+    }
+}
+
 TEST(property_service, userspace_reboot_not_supported) {
     if (getuid() != 0) {
         GTEST_SKIP() << "Skipping test, must be run as root.";
@@ -125,5 +187,30 @@ TEST(property_service, check_fingerprint_with_legacy_build_id) {
     ASSERT_EQ(android::base::Join(fingerprint_fields, ""), fingerprint);
 }
 
+TEST(property_service, parse_property_files) {
+    TemporaryDir dir;
+    std::string first = dir.path + "/first.prop"s;
+    std::string second = dir.path + "/second.prop"s;
+    std::string imported = dir.path + "/imported.prop"s;
+    std::string missing = dir.path + "/missing.prop"s;
+    ASSERT_TRUE(WriteStringToFile(
+            "# comment\n a.b = 1 \nimport " + imported + " imported.*\na.b=2\n", first));
+    ASSERT_TRUE(WriteStringToFile("ctl.start=adbd\nc.d=3", second));
+    ASSERT_TRUE(WriteStringToFile("imported.x=4\nnot_imported=5\n", imported));
+
+    auto parsed_files = ParsePropertyFiles({first, second, missing}, 2);
+    ASSERT_EQ(3u, parsed_files.size());
+
+    ASSERT_TRUE(parsed_files.at(first).ok());
+    PropertyFileEntries expected_first = {{"a.b", "1"}, {"imported.x", "4"}, {"a.b", "2"}};
+    EXPECT_EQ(expected_first, *parsed_files.at(first));
+
+    ASSERT_TRUE(parsed_files.at(second).ok());
+    PropertyFileEntries expected_second = {{"c.d", "3"}};
+    EXPECT_EQ(expected_second, *parsed_files.at(second));
+
+    EXPECT_FALSE(parsed_files.at(missing).ok());
+}
+
 }  // namespace init
 }  // namespace android
@@ -33,10 +33,14 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <algorithm>
 #include <chrono>
+#include <future>
+#include <map>
 #include <memory>
 #include <set>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include <InitProperties.sysprop.h>
@@ -60,6 +64,7 @@
 #include "builtin_arguments.h"
 #include "init.h"
 #include "mount_namespace.h"
+#include "persistent_properties.h"
 #include "property_service.h"
 #include "reboot_utils.h"
 #include "service.h"
@@ -177,6 +182,8 @@ class MountEntry {
         return android::base::StartsWith(mntent.mnt_fsname, "/data/");
     }
 
+    const std::string& mnt_dir() const { return mnt_dir_; }
+
   private:
     bool IsF2Fs() const { return mnt_type_ == "f2fs"; }
 
@@ -214,9 +221,35 @@ static Result<void> CallVdc(const std::string& system, const std::string& cmd) {
     return Error() << "'/system/bin/vdc " << system << " " << cmd << "' failed : " << status;
 }
 
-static void LogShutdownTime(UmountStat stat, Timer* t) {
+// Times the consecutive phases of DoReboot, for LogShutdownTime.
+class ShutdownPhases {
+  public:
+    // Records that |phase| ended now. It started when the previous phase ended.
+    void End(const char* phase) {
+        auto now = boot_clock::now();
+        phases_.emplace_back(
+                phase, std::chrono::duration_cast<std::chrono::milliseconds>(now - last_end_));
+        last_end_ = now;
+    }
+
+    std::string ToString() const {
+        std::string result;
+        for (const auto& [phase, duration] : phases_) {
+            if (!result.empty()) result += ",";
+            result += phase + "="s + std::to_string(duration.count());
+        }
+        return result;
+    }
+
+  private:
+    boot_clock::time_point last_end_ = boot_clock::now();
+    std::vector<std::pair<const char*, std::chrono::milliseconds>> phases_;
+};
+
+static void LogShutdownTime(UmountStat stat, Timer* t, const ShutdownPhases& phases) {
     LOG(WARNING) << "powerctl_shutdown_time_ms:" << std::to_string(t->duration().count()) << ":"
                  << stat;
+    LOG(WARNING) << "powerctl_shutdown_phases_ms:" << phases.ToString();
 }
 
 static bool IsDataMounted(const std::string& fstype) {
@@ -277,6 +310,45 @@ static void DumpUmountDebuggingInfo() {
     WriteStringToFile("w", PROC_SYSRQ);
 }
 
+// Unmounts |entries|, which are in reverse mount order. Entries that no other entry is mounted
+// under are unmounted concurrently, since umount() of each filesystem waits for its own writeback;
+// then the next level up, and so on. Returns true if all of them were unmounted.
+static bool UmountConcurrently(std::vector<MountEntry>* entries, bool force) {
+    auto is_under = [](const std::string& dir, const std::string& parent) {
+        return parent == "/" || android::base::StartsWith(dir, parent + "/");
+    };
+
+    bool all_done = true;
+    std::vector<MountEntry*> remaining;
+    for (auto& entry : *entries) remaining.push_back(&entry);
+    while (!remaining.empty()) {
+        std::vector<MountEntry*> level;
+        std::vector<MountEntry*> later;
+        for (MountEntry* entry : remaining) {
+            bool has_child = std::any_of(remaining.begin(), remaining.end(), [&](MountEntry* e) {
+                return e != entry && is_under(e->mnt_dir(), entry->mnt_dir());
+            });
+            (has_child ? later : level).push_back(entry);
+        }
+        if (level.empty()) {
+            // Only possible with duplicate mount points; fall back to mount order.
+            level.push_back(later.front());
+            later.erase(later.begin());
+        }
+
+        std::vector<std::future<bool>> results;
+        for (MountEntry* entry : level) {
+            results.push_back(std::async(std::launch::async,
+                                         [entry, force] { return entry->Umount(force); }));
+        }
+        for (auto& result : results) {
+            if (!result.get()) all_done = false;
+        }
+        remaining = std::move(later);
+    }
+    return all_done;
+}
+
 static UmountStat UmountPartitions(std::chrono::milliseconds timeout) {
     Timer t;
     /* data partition needs all pending writes to be completed and all emulated partitions
@@ -301,9 +373,7 @@ static UmountStat UmountPartitions(std::chrono::milliseconds timeout) {
                 sync();
             }
         }
-        for (auto& entry : block_devices) {
-            if (!entry.Umount(timeout == 0ms)) unmount_done = false;
-        }
+        if (!UmountConcurrently(&block_devices, timeout == 0ms)) unmount_done = false;
         if (unmount_done) {
             return UMOUNT_STAT_SUCCESS;
         }
@@ -587,6 +657,7 @@ int StopServicesAndLogViolations(const std::set<std::string>& services,
 static void DoReboot(unsigned int cmd, const std::string& reason, const std::string& reboot_target,
                      bool run_fsck) {
     Timer t;
+    ShutdownPhases phases;
     LOG(INFO) << "Reboot start, reason: " << reason << ", reboot_target: " << reboot_target;
 
     bool is_thermal_shutdown = cmd == ANDROID_RB_THERMOFF;
@@ -632,6 +703,9 @@ static void DoReboot(unsigned int cmd, const std::string& reason, const std::str
     }
     PersistRebootReason(reason.c_str() + skip, true);
 
+    // Persistent properties set just before the reboot may still be waiting to be coalesced.
+    PersistentPropertyWriter::GetInstance().Flush();
+
     // If /data isn't mounted then we can skip the extra reboot steps below, since we don't need to
     // worry about unmounting it.
     if (!IsDataMounted("*")) {
@@ -703,16 +777,20 @@ static void DoReboot(unsigned int cmd, const std::string& reason, const std::str
         }
     }
 
+    phases.End("prepare");
+
     // optional shutdown step
     // 1. terminate all services except shutdown critical ones. wait for delay to finish
     if (shutdown_timeout > 0ms) {
         StopServicesAndLogViolations(stop_first, shutdown_timeout / 2, true /* SIGTERM */);
     }
+    phases.End("sigterm");
     // Send SIGKILL to ones that didn't terminate cleanly.
     StopServicesAndLogViolations(stop_first, 0ms, false /* SIGKILL */);
     SubcontextTerminate();
     // Reap subcontext pids.
     ReapAnyOutstandingChildren();
+    phases.End("sigkill");
 
     // 3. send volume abort_fuse and volume shutdown to vold
     Service* vold_service = ServiceList::GetInstance().FindService("vold");
@@ -727,15 +805,22 @@ static void DoReboot(unsigned int cmd, const std::string& reason, const std::str
     }
     // logcat stopped here
     StopServices(kDebuggingServices, 0ms, false /* SIGKILL */);
+    phases.End("vold");
     // 4. sync, try umount, and optionally run fsck for user shutdown
+    // 5. drop caches and disable zram backing device, if exist
+    // The swapoff() of zram only reads pages back from the backing device, so it runs while the
+    // sync() writes back dirty pages.
+    auto zram = std::async(std::launch::async, [] { return KillZramBackingDevice(); });
     {
         Timer sync_timer;
         LOG(INFO) << "sync() before umount...";
         sync();
         LOG(INFO) << "sync() before umount took" << sync_timer;
     }
-    // 5. drop caches and disable zram backing device, if exist
-    KillZramBackingDevice();
+    if (auto result = zram.get(); !result.ok()) {
+        LOG(WARNING) << result.error();
+    }
+    phases.End("sync_and_zram");
 
     LOG(INFO) << "Ready to unmount apexes. So far shutdown sequence took " << t;
     // 6. unmount active apexes, otherwise they might prevent clean unmount of /data.
@@ -744,6 +829,7 @@ static void DoReboot(unsigned int cmd, const std::string& reason, const std::str
     // }
     UmountStat stat =
             TryUmountAndFsck(cmd, run_fsck, shutdown_timeout - t.duration(), &reboot_semaphore);
+    phases.End(run_fsck ? "umount_and_fsck" : "umount");
     // Follow what linux shutdown is doing: one more sync with little bit delay
     {
         Timer sync_timer;
@@ -752,7 +838,8 @@ static void DoReboot(unsigned int cmd, const std::string& reason, const std::str
         LOG(INFO) << "sync() after umount took" << sync_timer;
     }
     if (!is_thermal_shutdown) std::this_thread::sleep_for(100ms);
-    LogShutdownTime(stat, &t);
+    phases.End("final_sync");
+    LogShutdownTime(stat, &t, phases);
 
     // Send signal to terminate reboot monitor thread.
     reboot_monitor_run = false;
@@ -796,6 +883,27 @@ static std::chrono::milliseconds GetMillisProperty(const std::string& name,
     return std::chrono::milliseconds(std::move(value));
 }
 
+// Adds a oneshot action for the userspace-reboot-start-services trigger that starts the services in
+// |names| that aren't running yet.
+static void QueueRestartServices(std::vector<std::string> names) {
+    auto action = std::make_unique<Action>(true, nullptr, "<Builtin Action>", 0,
+                                           "userspace-reboot-start-services",
+                                           std::map<std::string, std::string>{});
+    auto start_services = [names = std::move(names)](const BuiltinArguments&) -> Result<void> {
+        for (const auto& name : names) {
+            Service* s = ServiceList::GetInstance().FindService(name);
+            if (s == nullptr || s->IsRunning()) continue;
+            LOG(INFO) << "Restarting service '" << name << "'";
+            if (auto result = s->Start(); !result.ok()) {
+                LOG(ERROR) << "Could not restart service '" << name << "': " << result.error();
+            }
+        }
+        return {};
+    };
+    action->AddCommand(std::move(start_services), {"userspace-reboot-start-services"}, 0);
+    ActionManager::GetInstance().AddAction(std::move(action));
+}
+
 static Result<void> DoUserspaceReboot() {
     LOG(INFO) << "Userspace reboot initiated";
     // An ugly way to pass a more precise reason on why fallback to hard reboot was triggered.
@@ -818,10 +926,16 @@ static Result<void> DoUserspaceReboot() {
         sub_reason = "resetprop";
         return Error() << "Failed to reset sys.powerctl property";
     }
+    // In fast mode init keeps the actions and services it parsed at boot, and instead of running
+    // the whole boot sequence again after /data is remounted, it restarts the services that were
+    // running. See userspace-reboot-fast-resume in init.rc.
+    bool fast = GetBoolProperty("init.userspace_reboot.fast", false);
+    LOG(INFO) << "Userspace reboot mode: " << (fast ? "fast" : "full");
     std::set<std::string> stop_first;
     // Remember the services that were enabled. We will need to manually enable them again otherwise
     // triggers like class_start won't restart them.
     std::set<std::string> were_enabled;
+    std::vector<std::string> were_running;
     for (const auto& s : ServiceList::GetInstance().services_in_shutdown_order()) {
         if (s->is_post_data() && !kDebuggingServices.count(s->name())) {
             stop_first.insert(s->name());
@@ -830,7 +944,11 @@ static Result<void> DoUserspaceReboot() {
         if (s->is_post_data() && s->IsEnabled()) {
             were_enabled.insert(s->name());
         }
+        if (s->is_post_data() && s->IsRunning() && !(s->flags() & SVC_TEMPORARY)) {
+            were_running.emplace_back(s->name());
+        }
     }
+    PersistentPropertyWriter::GetInstance().Flush();
     {
         Timer sync_timer;
         LOG(INFO) << "sync() before terminating services...";
@@ -892,23 +1010,26 @@ static Result<void> DoUserspaceReboot() {
         sub_reason = "ns_switch";
         return Error() << "Failed to switch to bootstrap namespace";
     }
-    ActionManager::GetInstance().RemoveActionIf([](const auto& action) -> bool {
-        if (action->IsFromApex()) {
-            std::string trigger_name = action->BuildTriggersString();
-            LOG(INFO) << "Removing action (" << trigger_name << ") from (" << action->filename()
-                      << ":" << action->line() << ")";
-            return true;
-        }
-        return false;
-    });
-    // Remove services that were defined in an APEX
-    ServiceList::GetInstance().RemoveServiceIf([](const std::unique_ptr<Service>& s) -> bool {
-        if (s->is_from_apex()) {
-            LOG(INFO) << "Removing service '" << s->name() << "' because it's defined in an APEX";
-            return true;
-        }
-        return false;
-    });
+    if (!fast) {
+        ActionManager::GetInstance().RemoveActionIf([](const auto& action) -> bool {
+            if (action->IsFromApex()) {
+                std::string trigger_name = action->BuildTriggersString();
+                LOG(INFO) << "Removing action (" << trigger_name << ") from ("
+                          << action->filename() << ":" << action->line() << ")";
+                return true;
+            }
+            return false;
+        });
+        // Remove services that were defined in an APEX
+        ServiceList::GetInstance().RemoveServiceIf([](const std::unique_ptr<Service>& s) -> bool {
+            if (s->is_from_apex()) {
+                LOG(INFO) << "Removing service '" << s->name()
+                          << "' because it's defined in an APEX";
+                return true;
+            }
+            return false;
+        });
+    }
     // Re-enable services
     for (const auto& s : ServiceList::GetInstance()) {
         if (were_enabled.count(s->name())) {
@@ -918,7 +1039,12 @@ static Result<void> DoUserspaceReboot() {
     }
     ServiceList::GetInstance().ResetState();
     LeaveShutdown();
-    ActionManager::GetInstance().QueueEventTrigger("userspace-reboot-resume");
+    if (fast) {
+        QueueRestartServices(std::move(were_running));
+        ActionManager::GetInstance().QueueEventTrigger("userspace-reboot-fast-resume");
+    } else {
+        ActionManager::GetInstance().QueueEventTrigger("userspace-reboot-resume");
+    }
     guard.Disable();  // Go on with userspace reboot.
     return {};
 }
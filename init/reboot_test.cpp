@@ -192,5 +192,38 @@ TEST_F(RebootTest, StopServicesSIGKILL) {
     EXPECT_EQ(nullptr, oneshot_service_after_stop);
 }
 
+TEST_F(RebootTest, StartServicesInParallel) {
+    if (getuid() != 0) {
+        GTEST_SKIP() << "Skipping test, must be run as root.";
+        return;
+    }
+
+    AddTestService("A");
+    AddTestService("B");
+    AddTestService("C");
+
+    std::vector<Service*> services;
+    for (const auto& name : {"A", "B", "C"}) {
+        auto service = ServiceList::GetInstance().FindService(name);
+        ASSERT_NE(nullptr, service);
+        services.emplace_back(service);
+    }
+
+    auto results = Service::StartAllIfNotDisabled(services, 2);
+    ASSERT_EQ(services.size(), results.size());
+    for (size_t i = 0; i < services.size(); i++) {
+        EXPECT_RESULT_OK(results[i]);
+        EXPECT_TRUE(services[i]->IsRunning());
+        EXPECT_GT(services[i]->pid(), 0);
+    }
+    EXPECT_NE(services[0]->pid(), services[1]->pid());
+    EXPECT_NE(services[1]->pid(), services[2]->pid());
+
+    EXPECT_EQ(0, StopServicesAndLogViolations({"A", "B", "C"}, 10s, /* terminate= */ true));
+    for (const auto& service : services) {
+        EXPECT_FALSE(service->IsRunning());
+    }
+}
+
 }  // namespace init
 }  // namespace android
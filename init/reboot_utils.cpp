@@ -31,6 +31,7 @@
 #include <cutils/android_reboot.h>
 // #include <unwindstack/AndroidUnwinder.h>
 
+#include "buffered_kernel_logger.h"
 #include "capabilities.h"
 #include "reboot_utils.h"
 #include "util.h"
@@ -110,6 +111,7 @@ bool IsRebootCapable() {
 
 void __attribute__((noreturn)) RebootSystem(unsigned int cmd, const std::string& rebootTarget) {
     LOG(INFO) << "Reboot ending, jumping to kernel";
+    FlushKernelLog();
 
     if (!IsRebootCapable()) {
         // On systems where init does not have the capability of rebooting the
@@ -82,6 +82,8 @@
 #include <ziparchive/zip_archive.h>
 
 #include "block_dev_initializer.h"
+#include "buffered_kernel_logger.h"
+#include "compiled_policy_cache.h"
 #include "debug_ramdisk.h"
 #include "reboot_utils.h"
 #include "snapuserd_transition.h"
@@ -329,6 +331,10 @@ struct PolicyFile {
     std::string path;
 };
 
+// Policy compiled during a previous boot. /metadata is mounted by first stage init, if the device
+// has it.
+constexpr const char kCompiledSepolicyCachePath[] = "/metadata/init/compiled_sepolicy";
+
 bool OpenSplitPolicy(PolicyFile* policy_file) {
     // IMPLEMENTATION NOTE: Split policy consists of three or more CIL files:
     // * platform -- policy needed due to logic contained in the system image,
@@ -482,6 +488,26 @@ bool OpenSplitPolicy(PolicyFile* policy_file) {
     if (!apex_policy_cil_file.empty()) {
         compile_args.push_back(apex_policy_cil_file.c_str());
     }
+
+    // Compiling takes seconds, so reuse the policy compiled during a previous boot for as long as
+    // the inputs stay the same. /metadata isn't protected by verified boot, so the cache is only
+    // trusted where the bootloader is unlocked anyway, which covers GSIs and mixed builds.
+    std::optional<CompiledPolicyCache> cache;
+    if (AvbHandle::IsDeviceUnlocked()) {
+        std::vector<std::string> cache_args;
+        for (const char* arg : compile_args) {
+            if (arg != compiled_sepolicy) cache_args.emplace_back(arg);
+        }
+        cache.emplace(cache_args);
+        if (unique_fd fd = cache->Load(kCompiledSepolicyCachePath); fd != -1) {
+            LOG(INFO) << "Using SELinux policy compiled during a previous boot";
+            unlink(compiled_sepolicy);
+            policy_file->fd = std::move(fd);
+            policy_file->path = kCompiledSepolicyCachePath;
+            return true;
+        }
+    }
+
     compile_args.push_back(nullptr);
 
     if (!ForkExecveAndWaitForCompletion(compile_args[0], (char**)compile_args.data())) {
@@ -490,6 +516,18 @@ bool OpenSplitPolicy(PolicyFile* policy_file) {
     }
     unlink(compiled_sepolicy);
 
+    if (cache) {
+        std::string policy;
+        if (!android::base::ReadFdToString(compiled_sepolicy_fd, &policy) ||
+            lseek(compiled_sepolicy_fd, 0, SEEK_SET) == -1) {
+            PLOG(ERROR) << "Failed to read compiled policy " << compiled_sepolicy;
+            return false;
+        }
+        if (auto result = cache->Save(kCompiledSepolicyCachePath, policy); !result.ok()) {
+            LOG(WARNING) << "Could not save compiled policy cache: " << result.error();
+        }
+    }
+
     policy_file->fd = std::move(compiled_sepolicy_fd);
     policy_file->path = compiled_sepolicy;
     return true;
@@ -787,6 +825,9 @@ void SelinuxRestoreContext() {
     selinux_android_restorecon(SnapshotManager::GetGlobalRollbackIndicatorPath().c_str(), 0);
     selinux_android_restorecon("/metadata/gsi", SELINUX_ANDROID_RESTORECON_RECURSE |
                                                         SELINUX_ANDROID_RESTORECON_SKIP_SEHASH);
+    // The compiled policy cache is written before the policy is loaded.
+    selinux_android_restorecon("/metadata/init", 0);
+    selinux_android_restorecon(kCompiledSepolicyCachePath, 0);
 }
 
 int SelinuxKlogCallback(int type, const char* fmt, ...) {
@@ -896,14 +937,23 @@ void MountMissingSystemPartitions() {
         return;
     }
 
-    BlockDevInitializer block_dev_init;
+    // Create the nodes of all missing device-mapper devices with a single wait.
+    DeviceSet missing_devices;
+    for (const auto& entry : extra_fstab) {
+        if (access(entry.blk_device.c_str(), F_OK) != 0) {
+            missing_devices.dm_devices.emplace(android::base::Basename(entry.blk_device));
+        }
+    }
+    if (!missing_devices.dm_devices.empty()) {
+        BlockDevInitializer block_dev_init;
+        block_dev_init.InitDeviceSet(std::move(missing_devices));
+    }
+
     for (auto& entry : extra_fstab) {
         if (access(entry.blk_device.c_str(), F_OK) != 0) {
-            auto block_dev = android::base::Basename(entry.blk_device);
-            if (!block_dev_init.InitDmDevice(block_dev)) {
-                LOG(ERROR) << "Failed to find device-mapper node: " << block_dev;
-                continue;
-            }
+            LOG(ERROR) << "Failed to find device-mapper node: "
+                       << android::base::Basename(entry.blk_device);
+            continue;
         }
         if (fs_mgr_do_mount_one(entry)) {
             LOG(ERROR) << "Could not mount " << entry.mount_point;
@@ -995,6 +1045,7 @@ int SetupSelinux(char** argv) {
 
     const char* path = "/system/bin/init";
     const char* args[] = {path, "second_stage", nullptr};
+    FlushKernelLog();
     execv(path, const_cast<char**>(args));
 
     // execv() only returns if an error happened, in which case we
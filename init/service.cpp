@@ -16,12 +16,17 @@
 
 #include "service.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <thread>
 
 #include <fcntl.h>
 #include <inttypes.h>
 #include <linux/securebits.h>
 #include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -39,6 +44,7 @@
 // #include <selinux/selinux.h>
 
 // #include "lmkd_service.h"
+#include "boot_trace.h"
 #include "service_list.h"
 #include "util.h"
 
@@ -104,19 +110,28 @@ namespace init {
 //     return computed_context;
 // }
 
-static bool ExpandArgsAndExecv(const std::vector<std::string>& args, bool sigstop) {
-    std::vector<std::string> expanded_args;
-    std::vector<char*> c_strings;
-
-    expanded_args.resize(args.size());
-    c_strings.push_back(const_cast<char*>(args[0].data()));
+static Result<std::vector<std::string>> ExpandArgs(const std::vector<std::string>& args) {
+    std::vector<std::string> expanded_args(args.size());
+    expanded_args[0] = args[0];
     for (std::size_t i = 1; i < args.size(); ++i) {
         auto expanded_arg = ExpandProps(args[i]);
         if (!expanded_arg.ok()) {
-            LOG(FATAL) << args[0] << ": cannot expand arguments': " << expanded_arg.error();
+            return Error() << args[0] << ": cannot expand arguments': " << expanded_arg.error();
         }
         expanded_args[i] = *expanded_arg;
-        c_strings.push_back(expanded_args[i].data());
+    }
+    return expanded_args;
+}
+
+static bool ExpandArgsAndExecv(const std::vector<std::string>& args, bool sigstop) {
+    auto expanded_args = ExpandArgs(args);
+    if (!expanded_args.ok()) {
+        LOG(FATAL) << expanded_args.error();
+    }
+
+    std::vector<char*> c_strings;
+    for (auto& arg : *expanded_args) {
+        c_strings.push_back(arg.data());
     }
     c_strings.push_back(nullptr);
 
@@ -127,9 +142,55 @@ static bool ExpandArgsAndExecv(const std::vector<std::string>& args, bool sigsto
     return execv(c_strings[0], c_strings.data()) == 0;
 }
 
+// Returns init's environment with |vars| set in it, the way setenv() would.
+static std::vector<std::string> BuildEnvironment(
+        const std::vector<std::pair<std::string, std::string>>& vars) {
+    std::vector<std::string> env;
+    for (char** entry = environ; *entry; ++entry) {
+        env.emplace_back(*entry);
+    }
+    for (const auto& [key, value] : vars) {
+        auto prefix = key + "=";
+        auto iter = std::find_if(env.begin(), env.end(), [&prefix](const std::string& entry) {
+            return StartsWith(entry, prefix);
+        });
+        if (iter != env.end()) {
+            *iter = prefix + value;
+        } else {
+            env.emplace_back(prefix + value);
+        }
+    }
+    return env;
+}
+
+static std::vector<char*> ToCStrings(std::vector<std::string>* strings) {
+    std::vector<char*> c_strings;
+    for (auto& string : *strings) {
+        c_strings.push_back(string.data());
+    }
+    c_strings.push_back(nullptr);
+    return c_strings;
+}
+
+// Covers the libprocessgroup and logging calls the vforked child makes before execve().
+static constexpr size_t kVforkStackSize = 1024 * 1024;
+
+// Everything a vforked child needs, prepared by init before clone(). The child reports the
+// call it failed in through |failed_call| and |error|, which init reads once it resumes.
+struct VforkState {
+    Service* service;
+    const std::vector<Descriptor>* descriptors;
+    std::vector<std::string> writepid_files;
+    std::vector<char*> argv;
+    std::vector<char*> envp;
+    const char* failed_call = nullptr;
+    int error = 0;
+};
+
 unsigned long Service::next_start_order_ = 1;
 bool Service::is_exec_service_running_ = false;
 std::chrono::time_point<std::chrono::steady_clock> Service::exec_service_started_;
+Service::ProcessActionScheduler Service::process_action_scheduler_;
 
 Service::Service(const std::string& name, Subcontext* subcontext_for_restart_commands,
                  const std::vector<std::string>& args, bool from_apex)
@@ -291,7 +352,7 @@ void Service::Reap(const siginfo_t& siginfo) {
     if (flags_ & SVC_EXEC) UnSetExec();
 
     if (name_ == "zygote" || name_ == "zygote64") {
-        removeAllEmptyProcessGroups();
+        removeAllEmptyProcessGroupsAsync();
     }
 
     if (flags_ & SVC_TEMPORARY) return;
@@ -352,6 +413,7 @@ void Service::Reap(const siginfo_t& siginfo) {
 
     flags_ &= (~SVC_RESTART);
     flags_ |= SVC_RESTARTING;
+    ScheduleProcessAction(time_started_ + restart_period_);
 
     // Execute all onrestart commands for this service.
     onrestart_.ExecuteAllCommands();
@@ -370,6 +432,10 @@ void Service::DumpState() const {
     for (const auto& file : files_) {
         LOG(INFO) << "  file " << file.name;
     }
+    if (spawn_duration_) {
+        LOG(INFO) << "  spawn " << spawn_duration_->count() << "us"
+                  << (spawned_with_vfork_ ? " (vfork)" : " (fork)");
+    }
 }
 
 
@@ -521,13 +587,184 @@ void Service::RunService(const std::optional<MountNamespace>& override_mount_nam
     }
 }
 
+// Runs in the child of SpawnWithVfork(). It shares init's memory until execve(), so it must not
+// modify anything init uses; init is suspended until then, so nothing changes underneath it.
+int Service::RunServiceVforked(void* arg) {
+    auto state = static_cast<VforkState*>(arg);
+    Service* service = state->service;
+
+    umask(077);
+
+    // pthread_atfork() handlers do not run for clone(), so undo init's signalfd setup here.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+
+    for (const auto& descriptor : *state->descriptors) {
+        descriptor.Inherit();
+    }
+
+    // init cannot create the process group while it is suspended, so the child joins it itself.
+    if (int ret = createProcessGroup(service->proc_attr_.uid, getpid(), false); ret != 0) {
+        state->failed_call = "createProcessGroup";
+        state->error = -ret;
+        return 127;
+    }
+
+    if (auto result = WritePidToFiles(&state->writepid_files); !result.ok()) {
+        LOG(ERROR) << "failed to write pid to files: " << result.error();
+    }
+
+    if (service->task_profiles_.size() > 0 && !SetTaskProfiles(getpid(), service->task_profiles_)) {
+        LOG(ERROR) << "failed to set task profiles";
+    }
+
+    // As requested, set our gid, supplemental gids, uid, context, and
+    // priority. Aborts on failure.
+    service->SetProcessAttributesAndCaps();
+
+    execve(state->argv[0], state->argv.data(), state->envp.data());
+    state->failed_call = "execv";
+    state->error = errno;
+    return 127;
+}
+
+// Starts the service with clone(CLONE_VM | CLONE_VFORK), which unlike fork() does not copy init's
+// page tables. The service has either called execve() or exited by the time this returns. It only
+// reads the service's state, so several services may be spawned from different threads at once.
+Service::VforkResult Service::SpawnWithVfork(const std::vector<Descriptor>& descriptors) {
+    VforkResult result;
+    auto spawn_started = boot_clock::now();
+    result.started = spawn_started;
+    auto set_duration = make_scope_guard([&result, spawn_started] {
+        result.duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                boot_clock::now() - spawn_started);
+    });
+
+    auto args = ExpandArgs(args_);
+    if (!args.ok()) {
+        result.pid = args.error();
+        return result;
+    }
+
+    auto vars = environment_vars_;
+    for (const auto& descriptor : descriptors) {
+        vars.emplace_back(descriptor.EnvironmentVariable());
+    }
+    auto env = BuildEnvironment(vars);
+
+    VforkState state;
+    state.service = this;
+    state.descriptors = &descriptors;
+    // WritePidToFiles() may add the default cpuset, which must not leak into writepid_files_.
+    state.writepid_files = writepid_files_;
+    state.argv = ToCStrings(&*args);
+    state.envp = ToCStrings(&env);
+
+    void* stack = mmap(nullptr, kVforkStackSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) {
+        result.pid = ErrnoError() << "mmap() for the vfork stack";
+        return result;
+    }
+    auto unmap_stack = make_scope_guard([stack] { munmap(stack, kVforkStackSize); });
+
+    pid_t pid = clone(&Service::RunServiceVforked, static_cast<char*>(stack) + kVforkStackSize,
+                      CLONE_VM | CLONE_VFORK | SIGCHLD, &state);
+    if (pid < 0) {
+        result.pid = ErrnoError() << "Failed to vfork";
+        return result;
+    }
+    result.pid = pid;
+
+    if (state.failed_call && !strcmp(state.failed_call, "execv")) {
+        LOG(ERROR) << "cannot execv('" << args_[0] << "'): " << strerror(state.error)
+                   << ". See the 'Debugging init' section of init's README.md for tips";
+    } else if (state.failed_call) {
+        errno = state.error;
+        result.process_group_result = ErrnoError()
+                                      << "createProcessGroup(" << proc_attr_.uid << ", " << pid
+                                      << ") failed for service '" << name_ << "'";
+    }
+    return result;
+}
+
 Result<void> Service::Start() {
-    auto reboot_on_failure = make_scope_guard([this] {
-        if (on_failure_reboot_target_) {
-            trigger_shutdown(*on_failure_reboot_target_);
+    std::optional<StartState> state;
+    auto result = PrepareStart(&state);
+    if (result.ok() && state) {
+        if (state->use_vfork) {
+            result = FinishVforkStart(SpawnWithVfork(state->descriptors));
+        } else {
+            result = StartWithFork(&*state);
         }
-    });
+    }
+    return CheckStartResult(std::move(result));
+}
+
+std::vector<Result<void>> Service::StartAllIfNotDisabled(const std::vector<Service*>& services,
+                                                         size_t num_threads) {
+    std::vector<Result<void>> results(services.size());
+    std::vector<std::optional<StartState>> states(services.size());
+
+    // Services that are forked keep their place in the order; the vforked ones are spawned
+    // afterwards, all at once.
+    std::vector<size_t> vforked;
+    for (size_t i = 0; i < services.size(); i++) {
+        Service* service = services[i];
+        if (service->flags_ & SVC_DISABLED) {
+            service->flags_ |= SVC_DISABLED_START;
+            continue;
+        }
+        results[i] = service->PrepareStart(&states[i]);
+        if (!results[i].ok() || !states[i]) {
+            results[i] = service->CheckStartResult(std::move(results[i]));
+        } else if (!states[i]->use_vfork || (service->flags_ & SVC_CONSOLE)) {
+            results[i] = service->CheckStartResult(service->StartWithFork(&*states[i]));
+        } else {
+            vforked.emplace_back(i);
+        }
+    }
+
+    std::vector<VforkResult> spawned(services.size());
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() -> void {
+        for (size_t n = next++; n < vforked.size(); n = next++) {
+            size_t i = vforked[n];
+            spawned[i] = services[i]->SpawnWithVfork(states[i]->descriptors);
+        }
+    };
+
+    num_threads = std::min(num_threads, vforked.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i : vforked) {
+        results[i] = services[i]->CheckStartResult(
+                services[i]->FinishVforkStart(std::move(spawned[i])));
+    }
+    return results;
+}
+
+// Shuts down if this failed start should reboot the device.
+Result<void> Service::CheckStartResult(Result<void> result) {
+    if (!result.ok() && on_failure_reboot_target_) {
+        trigger_shutdown(*on_failure_reboot_target_);
+    }
+    return result;
+}
 
+// Runs the part of Start() that comes before the service's process is created. Leaves |state|
+// empty if the service is already running.
+Result<void> Service::PrepareStart(std::optional<StartState>* state) {
     if (is_updatable() && !ServiceList::GetInstance().IsServicesUpdated()) {
         ServiceList::GetInstance().DelayService(*this);
         return Error() << "Cannot start an updatable service '" << name_
@@ -552,16 +789,9 @@ Result<void> Service::Start() {
                   << "' requested start, but it is already running (flags: " << flags_ << ")";
 
         // It is not an error to try to start a service that is already running.
-        reboot_on_failure.Disable();
         return {};
     }
 
-    std::unique_ptr<std::array<int, 2>, decltype(&ClosePipe)> pipefd(new std::array<int, 2>{-1, -1},
-                                                                     ClosePipe);
-    if (pipe(pipefd->data()) < 0) {
-        return ErrnoError() << "pipe()";
-    }
-
     if (Result<void> result = CheckConsole(); !result.ok()) {
         return result;
     }
@@ -595,24 +825,24 @@ Result<void> Service::Start() {
         use_bootstrap_ns_ = true;
     }
 
+    StartState& start = state->emplace();
+
     // For pre-apexd services, override mount namespace as "bootstrap" one before starting.
     // Note: "ueventd" is supposed to be run in "default" mount namespace even if it's pre-apexd
     // to support loading firmwares from APEXes.
-    std::optional<MountNamespace> override_mount_namespace;
     if (name_ == "ueventd") {
-        override_mount_namespace = NS_DEFAULT;
+        start.override_mount_namespace = NS_DEFAULT;
     } else if (use_bootstrap_ns_) {
-        override_mount_namespace = NS_BOOTSTRAP;
+        start.override_mount_namespace = NS_BOOTSTRAP;
     }
 
     post_data_ = ServiceList::GetInstance().IsPostData();
 
     LOG(INFO) << "starting service '" << name_ << "'...";
 
-    std::vector<Descriptor> descriptors;
     for (const auto& socket : sockets_) {
         if (auto result = socket.Create(scon); result.ok()) {
-            descriptors.emplace_back(std::move(*result));
+            start.descriptors.emplace_back(std::move(*result));
         } else {
             LOG(INFO) << "Could not create socket '" << socket.name << "': " << result.error();
         }
@@ -620,12 +850,58 @@ Result<void> Service::Start() {
 
     for (const auto& file : files_) {
         if (auto result = file.Create(); result.ok()) {
-            descriptors.emplace_back(std::move(*result));
+            start.descriptors.emplace_back(std::move(*result));
         } else {
             LOG(INFO) << "Could not open file '" << file.name << "': " << result.error();
         }
     }
 
+    start.use_memcg = swappiness_ != -1 || soft_limit_in_bytes_ != -1 || limit_in_bytes_ != -1 ||
+                      limit_percent_ != -1 || !limit_property_.empty();
+
+    // Services that need namespaces or memcg settings are set up by init between fork() and
+    // exec(), and sigstop needs a child that can stop itself, so only the rest are vforked.
+    start.use_vfork = !namespaces_.flags && namespaces_.namespaces_to_enter.empty() &&
+                      !start.override_mount_namespace && !start.use_memcg && !sigstop_;
+    return {};
+}
+
+// Records the process spawned by SpawnWithVfork() as the running service.
+Result<void> Service::FinishVforkStart(VforkResult spawned) {
+    if (!spawned.pid.ok()) {
+        pid_ = 0;
+        return spawned.pid.error();
+    }
+
+    time_started_ = boot_clock::now();
+    pid_ = *spawned.pid;
+    flags_ |= SVC_RUNNING;
+    start_order_ = next_start_order_++;
+    process_cgroup_empty_ = false;
+    spawned_with_vfork_ = true;
+    spawn_duration_ = spawned.duration;
+    BootTrace::GetInstance().Record(
+            {TraceEventType::kServiceStart, name_, "", spawned.started, spawned.duration});
+    if (timeout_period_) {
+        ScheduleProcessAction(time_started_ + *timeout_period_);
+    }
+
+    if (!spawned.process_group_result.ok()) {
+        return spawned.process_group_result;
+    }
+
+    NotifyStateChange("running");
+    return {};
+}
+
+Result<void> Service::StartWithFork(StartState* state) {
+    std::unique_ptr<std::array<int, 2>, decltype(&ClosePipe)> pipefd(new std::array<int, 2>{-1, -1},
+                                                                     ClosePipe);
+    if (pipe(pipefd->data()) < 0) {
+        return ErrnoError() << "pipe()";
+    }
+
+    auto spawn_started = boot_clock::now();
     pid_t pid = -1;
     if (namespaces_.flags) {
         pid = clone(nullptr, nullptr, namespaces_.flags | SIGCHLD, nullptr);
@@ -635,7 +911,7 @@ Result<void> Service::Start() {
 
     if (pid == 0) {
         umask(077);
-        RunService(override_mount_namespace, descriptors, std::move(pipefd));
+        RunService(state->override_mount_namespace, state->descriptors, std::move(pipefd));
         _exit(127);
     }
 
@@ -657,10 +933,12 @@ Result<void> Service::Start() {
     flags_ |= SVC_RUNNING;
     start_order_ = next_start_order_++;
     process_cgroup_empty_ = false;
+    spawned_with_vfork_ = false;
+    if (timeout_period_) {
+        ScheduleProcessAction(time_started_ + *timeout_period_);
+    }
 
-    bool use_memcg = swappiness_ != -1 || soft_limit_in_bytes_ != -1 || limit_in_bytes_ != -1 ||
-                      limit_percent_ != -1 || !limit_property_.empty();
-    errno = -createProcessGroup(proc_attr_.uid, pid_, use_memcg);
+    errno = -createProcessGroup(proc_attr_.uid, pid_, state->use_memcg);
     if (errno != 0) {
         if (char byte = 0; write((*pipefd)[1], &byte, 1) < 0) {
             return ErrnoError() << "sending notification failed";
@@ -669,7 +947,7 @@ Result<void> Service::Start() {
                        << ") failed for service '" << name_ << "'";
     }
 
-    if (use_memcg) {
+    if (state->use_memcg) {
         ConfigureMemcg();
     }
 
@@ -680,9 +958,12 @@ Result<void> Service::Start() {
     if (char byte = 1; write((*pipefd)[1], &byte, 1) < 0) {
         return ErrnoError() << "sending notification failed";
     }
+    spawn_duration_ =
+            std::chrono::duration_cast<std::chrono::microseconds>(boot_clock::now() - spawn_started);
+    BootTrace::GetInstance().Record(
+            {TraceEventType::kServiceStart, name_, "", spawn_started, *spawn_duration_});
 
     NotifyStateChange("running");
-    reboot_on_failure.Disable();
     return {};
 }
 
@@ -693,10 +974,19 @@ void Service::SetStartedInFirstStage(pid_t pid) {
     pid_ = pid;
     flags_ |= SVC_RUNNING;
     start_order_ = next_start_order_++;
+    if (timeout_period_) {
+        ScheduleProcessAction(time_started_ + *timeout_period_);
+    }
 
     NotifyStateChange("running");
 }
 
+void Service::ScheduleProcessAction(boot_clock::time_point time) const {
+    if (process_action_scheduler_) {
+        process_action_scheduler_(*this, time);
+    }
+}
+
 void Service::ResetFlagsForStart() {
     // Starting a service removes it from the disabled or reset state and
     // immediately takes it out of the restarting state if it was in there.
@@ -20,6 +20,7 @@
 #include <sys/types.h>
 
 #include <chrono>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <set>
@@ -80,6 +81,11 @@ class Service {
     Result<void> ExecStart();
     Result<void> Start();
     Result<void> StartIfNotDisabled();
+    // Calls StartIfNotDisabled() on each of |services|, but spawns the ones that need no setup
+    // between fork() and exec() from up to |num_threads| threads at once. Returns the results in
+    // the order of |services|.
+    static std::vector<Result<void>> StartAllIfNotDisabled(const std::vector<Service*>& services,
+                                                           size_t num_threads);
     Result<void> Enable();
     void Reset();
     void Stop();
@@ -101,6 +107,14 @@ class Service {
     bool MarkSocketPersistent(const std::string& socket_name);
     size_t CheckAllCommands() const { return onrestart_.CheckAllCommands(); }
 
+    // Called whenever a service gets a new restart or timeout deadline, so that init can check
+    // on it then instead of polling every service.
+    using ProcessActionScheduler =
+            std::function<void(const Service& service, android::base::boot_clock::time_point time)>;
+    static void set_process_action_scheduler(ProcessActionScheduler scheduler) {
+        process_action_scheduler_ = std::move(scheduler);
+    }
+
     static bool is_exec_service_running() { return is_exec_service_running_; }
     static std::chrono::time_point<std::chrono::steady_clock> exec_service_started() {
         return exec_service_started_;
@@ -155,10 +169,32 @@ class Service {
             const std::vector<Descriptor>& descriptors,
             std::unique_ptr<std::array<int, 2>, void (*)(const std::array<int, 2>* pipe)> pipefd);
 
+    // What PrepareStart() hands to the part of Start() that creates the process.
+    struct StartState {
+        std::vector<Descriptor> descriptors;
+        std::optional<MountNamespace> override_mount_namespace;
+        bool use_memcg = false;
+        bool use_vfork = false;
+    };
+    struct VforkResult {
+        Result<pid_t> pid;
+        Result<void> process_group_result;
+        android::base::boot_clock::time_point started;
+        std::chrono::microseconds duration{};
+    };
+    Result<void> PrepareStart(std::optional<StartState>* state);
+    Result<void> StartWithFork(StartState* state);
+    VforkResult SpawnWithVfork(const std::vector<Descriptor>& descriptors);
+    Result<void> FinishVforkStart(VforkResult spawned);
+    Result<void> CheckStartResult(Result<void> result);
+    void ScheduleProcessAction(android::base::boot_clock::time_point time) const;
+    static int RunServiceVforked(void* state);
+
     static unsigned long next_start_order_;
     static bool is_exec_service_running_;
     static std::chrono::time_point<std::chrono::steady_clock> exec_service_started_;
     static pid_t exec_service_pid_;
+    static ProcessActionScheduler process_action_scheduler_;
 
     std::string name_;
     std::set<std::string> classnames_;
@@ -166,6 +202,8 @@ class Service {
     unsigned flags_;
     pid_t pid_;
     android::base::boot_clock::time_point time_started_;  // time of last start
+    std::optional<std::chrono::microseconds> spawn_duration_;  // time init spent in last start
+    bool spawned_with_vfork_ = false;  // whether the last start used vfork instead of fork
     android::base::boot_clock::time_point time_crashed_;  // first crash within inspection window
     int crash_count_;                     // number of times crashed within window
     std::chrono::minutes fatal_crash_window_ = 4min;  // fatal() when more than 4 crashes in it
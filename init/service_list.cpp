@@ -60,6 +60,28 @@ void ServiceList::RemoveService(const Service& svc) {
     }
 
     services_.erase(svc_it);
+    services_by_pid_.clear();
+}
+
+Service* ServiceList::FindServiceByPid(pid_t pid) {
+    if (pid <= 0) {
+        return nullptr;
+    }
+    // Services start and stop without telling the list, so an entry is only trusted if the
+    // service still has that pid.
+    if (auto it = services_by_pid_.find(pid); it != services_by_pid_.end() &&
+                                              it->second->pid() == pid) {
+        return it->second;
+    }
+
+    services_by_pid_.clear();
+    for (const auto& service : services_) {
+        if (service->pid() > 0) {
+            services_by_pid_.emplace(service->pid(), service.get());
+        }
+    }
+    auto it = services_by_pid_.find(pid);
+    return it != services_by_pid_.end() ? it->second : nullptr;
 }
 
 void ServiceList::DumpState() const {
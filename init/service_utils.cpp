@@ -148,22 +148,30 @@ void OpenConsole(const std::string& console) {
 }  // namespace
 
 void Descriptor::Publish() const {
-    auto published_name = name_;
+    Inherit();
 
-    for (auto& c : published_name) {
-        c = isalnum(c) ? c : '_';
-    }
+    auto [name, value] = EnvironmentVariable();
+    setenv(name.c_str(), value.c_str(), 1);
+}
 
+void Descriptor::Inherit() const {
     int fd = fd_.get();
     // For safety, the FD is created as CLOEXEC, so that must be removed before publishing.
     auto fd_flags = fcntl(fd, F_GETFD);
     fd_flags &= ~FD_CLOEXEC;
     if (fcntl(fd, F_SETFD, fd_flags) != 0) {
-        PLOG(ERROR) << "Failed to remove CLOEXEC from '" << published_name << "'";
+        PLOG(ERROR) << "Failed to remove CLOEXEC from '" << name_ << "'";
+    }
+}
+
+std::pair<std::string, std::string> Descriptor::EnvironmentVariable() const {
+    auto published_name = name_;
+
+    for (auto& c : published_name) {
+        c = isalnum(c) ? c : '_';
     }
 
-    std::string val = std::to_string(fd);
-    setenv(published_name.c_str(), val.c_str(), 1);
+    return {published_name, std::to_string(fd_.get())};
 }
 
 Result<Descriptor> SocketDescriptor::Create(const std::string& global_context) const {
@@ -21,6 +21,7 @@
 
 #include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <android-base/unique_fd.h>
@@ -41,6 +42,13 @@ class Descriptor {
     // called when starting a service after fork() and before exec().
     void Publish() const;
 
+    // Inherit() only unsets FD_CLOEXEC from the FD, for callers that pass EnvironmentVariable()
+    // to exec() themselves instead of calling setenv().
+    void Inherit() const;
+
+    // EnvironmentVariable() returns the name and value under which the FD is published.
+    std::pair<std::string, std::string> EnvironmentVariable() const;
+
   private:
     std::string name_;
     android::base::unique_fd fd_;
@@ -16,9 +16,11 @@
 
 #include "sigchld_handler.h"
 
+#include <poll.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -27,8 +29,10 @@
 #include <android-base/logging.h>
 #include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
 
 #include <thread>
+#include <unordered_set>
 
 #include "init.h"
 #include "service.h"
@@ -38,11 +42,14 @@ using android::base::boot_clock;
 using android::base::make_scope_guard;
 using android::base::StringPrintf;
 using android::base::Timer;
+using android::base::unique_fd;
 
 namespace android {
 namespace init {
 
-static pid_t ReapOneProcess() {
+// Reaps one zombie child, if there is one, and returns its pid. Temporary services that exited
+// are added to |temporary_services| rather than removed from the ServiceList one at a time.
+static pid_t ReapOneProcess(std::unordered_set<const Service*>* temporary_services) {
     siginfo_t siginfo = {};
     // This returns a zombie pid or informs us that there are no zombies left to be reaped.
     // It does NOT reap the pid; that is done below.
@@ -67,7 +74,7 @@ static pid_t ReapOneProcess() {
     if (SubcontextChildReap(pid)) {
         name = "Subcontext";
     } else {
-        service = ServiceList::GetInstance().FindService(pid, &Service::pid);
+        service = ServiceList::GetInstance().FindServiceByPid(pid);
 
         if (service) {
             name = StringPrintf("Service '%s' (pid %d)", service->name().c_str(), pid);
@@ -100,32 +107,83 @@ static pid_t ReapOneProcess() {
     service->Reap(siginfo);
 
     if (service->flags() & SVC_TEMPORARY) {
-        ServiceList::GetInstance().RemoveService(*service);
+        temporary_services->emplace(service);
     }
 
     return pid;
 }
 
+// Reaps every zombie child and returns their pids.
+static std::vector<pid_t> ReapProcesses() {
+    std::vector<pid_t> pids;
+    std::unordered_set<const Service*> temporary_services;
+    pid_t pid;
+    while ((pid = ReapOneProcess(&temporary_services)) != 0) {
+        pids.emplace_back(pid);
+    }
+
+    if (!temporary_services.empty()) {
+        ServiceList::GetInstance().RemoveServiceIf([&](const std::unique_ptr<Service>& s) {
+            return temporary_services.count(s.get()) > 0;
+        });
+    }
+    return pids;
+}
+
 void ReapAnyOutstandingChildren() {
-    while (ReapOneProcess() != 0) {
+    ReapProcesses();
+}
+
+// Opens a pidfd for every pid in |pids|, in order. Returns an empty vector if that isn't possible,
+// e.g. because the kernel predates pidfd_open().
+static std::vector<unique_fd> OpenPidfds(const std::vector<pid_t>& pids) {
+    std::vector<unique_fd> pidfds;
+    for (pid_t pid : pids) {
+        unique_fd pidfd(syscall(__NR_pidfd_open, pid, 0));
+        if (pidfd == -1) {
+            if (errno != ENOSYS) PLOG(WARNING) << "pidfd_open(" << pid << ") failed";
+            return {};
+        }
+        pidfds.emplace_back(std::move(pidfd));
     }
+    return pidfds;
 }
 
 void WaitToBeReaped(const std::vector<pid_t>& pids, std::chrono::milliseconds timeout) {
     Timer t;
     std::vector<pid_t> alive_pids(pids.begin(), pids.end());
+    // A pidfd becomes readable once its process exits, so with pidfds init sleeps until one of the
+    // processes is gone rather than polling for zombies every 50ms.
+    std::vector<unique_fd> pidfds = OpenPidfds(alive_pids);
+    std::vector<pollfd> pfds;
     while (!alive_pids.empty() && t.duration() < timeout) {
-        pid_t pid;
-        while ((pid = ReapOneProcess()) != 0) {
-            auto it = std::find(alive_pids.begin(), alive_pids.end(), pid);
-            if (it != alive_pids.end()) {
-                alive_pids.erase(it);
+        std::vector<pid_t> reaped = ReapProcesses();
+        for (size_t i = alive_pids.size(); i-- > 0;) {
+            bool gone = std::find(reaped.begin(), reaped.end(), alive_pids[i]) != reaped.end();
+            // A process whose pidfd was readable has exited even if something else reaped it.
+            if (!pfds.empty() && (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) gone = true;
+            if (gone) {
+                alive_pids.erase(alive_pids.begin() + i);
+                if (!pidfds.empty()) pidfds.erase(pidfds.begin() + i);
             }
         }
         if (alive_pids.empty()) {
             break;
         }
-        std::this_thread::sleep_for(50ms);
+        if (pidfds.empty()) {
+            std::this_thread::sleep_for(50ms);
+            continue;
+        }
+        pfds.clear();
+        for (const auto& pidfd : pidfds) {
+            pfds.push_back({.fd = pidfd.get(), .events = POLLIN});
+        }
+        auto remaining = std::max(timeout - t.duration(), 0ms);
+        if (TEMP_FAILURE_RETRY(poll(pfds.data(), pfds.size(), remaining.count())) == -1) {
+            PLOG(ERROR) << "poll on pidfds failed";
+            pfds.clear();
+            pidfds.clear();
+        }
     }
     LOG(INFO) << "Waiting for " << pids.size() << " pids to be reaped took " << t << " with "
               << alive_pids.size() << " of them still running";
@@ -226,6 +226,17 @@ void SnapuserdSelinuxHelper::StartTransition() {
 
     argv_.emplace_back("snapuserd");
     argv_.emplace_back("-no_socket");
+
+    // The first-stage daemon has parsed the COWs already. Take its metadata
+    // before its handlers exit on the table swaps below, so that the new
+    // daemon doesn't parse them again while I/O to the snapshots is blocked.
+    if (auto client = SnapuserdClient::Connect(android::snapshot::kSnapuserdSocket, 3s)) {
+        metadata_fd_ = client->ExportMetadata();
+    }
+    if (metadata_fd_ >= 0) {
+        argv_.emplace_back("-metadata_fd=" + std::to_string(metadata_fd_.get()));
+    }
+
     if (!sm_->DetachSnapuserdForSelinux(&argv_)) {
         LOG(FATAL) << "Could not perform selinux transition";
     }
@@ -314,9 +325,10 @@ void SnapuserdSelinuxHelper::RelaunchFirstStageSnapuserd() {
         PLOG(FATAL) << "Fork to relaunch snapuserd failed";
     }
     if (pid > 0) {
-        // We don't need the descriptor anymore, and it should be closed to
+        // We don't need the descriptors anymore, and they should be closed to
         // avoid leaking into subprocesses.
         close(fd.value());
+        metadata_fd_ = {};
 
         setenv(kSnapuserdFirstStagePidVar, std::to_string(pid).c_str(), 1);
 
@@ -343,6 +355,10 @@ void SnapuserdSelinuxHelper::RelaunchFirstStageSnapuserd() {
     if (fcntl(fd.value(), F_SETFD, FD_CLOEXEC) < 0) {
         PLOG(FATAL) << "fcntl FD_CLOEXEC failed for snapuserd fd";
     }
+    // Without the metadata, snapuserd parses the COWs itself.
+    if (metadata_fd_ >= 0 && fcntl(metadata_fd_.get(), F_SETFD, 0) < 0) {
+        PLOG(ERROR) << "fcntl failed for snapuserd metadata fd";
+    }
 
     std::vector<char*> argv;
     for (auto& arg : argv_) {
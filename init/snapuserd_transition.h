@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 
+#include <android-base/unique_fd.h>
 #include <libsnapshot/snapshot.h>
 
 #include "block_dev_initializer.h"
@@ -62,6 +63,8 @@ class SnapuserdSelinuxHelper final {
     BlockDevInitializer block_dev_init_;
     pid_t old_pid_;
     std::vector<std::string> argv_;
+    // COW metadata parsed by the first-stage daemon, for the new one.
+    android::base::unique_fd metadata_fd_;
 };
 
 // Remove /dev/socket/snapuserd. This ensures that (1) the existing snapuserd
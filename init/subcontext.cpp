@@ -22,6 +22,10 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <optional>
+
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
@@ -70,6 +74,8 @@ class SubcontextProcess {
                     SubcontextReply* reply) const;
     void ExpandArgs(const SubcontextCommand::ExpandArgsCommand& expand_args_command,
                     SubcontextReply* reply) const;
+    void RunBatch(const SubcontextCommand::ExecuteBatchCommand& execute_batch_command,
+                  SubcontextReply* reply) const;
 
     const BuiltinFunctionMap* function_map_;
     const std::string context_;
@@ -117,6 +123,50 @@ void SubcontextProcess::ExpandArgs(const SubcontextCommand::ExpandArgsCommand& e
     }
 }
 
+// Successes take up only a few bytes each, and a batch is cut short after this much of its reply
+// is used, leaving the rest of the reply for a failure and its error string.
+static constexpr size_t kBatchReplySizeLimit = kBufferSize / 4;
+
+void SubcontextProcess::RunBatch(const SubcontextCommand::ExecuteBatchCommand& execute_batch_command,
+                                 SubcontextReply* reply) const {
+    auto* batch_reply = reply->mutable_execute_batch_reply();
+    for (const auto& command : execute_batch_command.commands()) {
+        android::base::Timer t;
+        auto command_reply = SubcontextReply();
+        RunCommand(command, &command_reply);
+
+        auto* result = batch_reply->add_results();
+        if (command_reply.reply_case() == SubcontextReply::kFailure) {
+            *result->mutable_failure() = std::move(*command_reply.mutable_failure());
+        } else {
+            result->set_success(true);
+        }
+        result->set_duration_ms(t.duration().count());
+
+        // Stop after a failure rather than risk another one not fitting in the reply, and after
+        // a shutdown was triggered, like init would before running its next command. The
+        // commands that did not run go in init's next batch.
+        if (!result->success() || !shutdown_command.empty() ||
+            reply->ByteSizeLong() > kBatchReplySizeLimit) {
+            break;
+        }
+    }
+
+    // A single command whose error string is too long for a reply makes the subcontext abort, but
+    // the commands before it in the batch did run, so its error string is cut short instead.
+    if (batch_reply->results_size() == 0) {
+        return;
+    }
+    auto* last_result = batch_reply->mutable_results(batch_reply->results_size() - 1);
+    size_t shutdown_size = shutdown_command.empty() ? 0 : shutdown_command.size() + 3;
+    size_t reply_size = reply->ByteSizeLong() + shutdown_size;
+    if (last_result->has_failure() && reply_size > kBufferSize) {
+        auto* error_string = last_result->mutable_failure()->mutable_error_string();
+        error_string->resize(error_string->size() -
+                             std::min(error_string->size(), reply_size - kBufferSize));
+    }
+}
+
 void SubcontextProcess::MainLoop() {
     pollfd ufd[1];
     ufd[0].events = POLLIN;
@@ -156,6 +206,10 @@ void SubcontextProcess::MainLoop() {
                 ExpandArgs(subcontext_command.expand_args_command(), &reply);
                 break;
             }
+            case SubcontextCommand::kExecuteBatchCommand: {
+                RunBatch(subcontext_command.execute_batch_command(), &reply);
+                break;
+            }
             default:
                 LOG(FATAL) << "Unknown message type from init: "
                            << subcontext_command.command_case();
@@ -319,6 +373,56 @@ Result<void> Subcontext::Execute(const std::vector<std::string>& args) {
     return {};
 }
 
+std::vector<Subcontext::BatchResult> Subcontext::ExecuteBatch(
+        const std::vector<std::vector<std::string>>& commands) {
+    // Send as many commands as fit in one message.
+    auto subcontext_command = SubcontextCommand();
+    auto* batch = subcontext_command.mutable_execute_batch_command();
+    for (const auto& args : commands) {
+        auto* command = batch->add_commands();
+        std::copy(args.begin(), args.end(), RepeatedPtrFieldBackInserter(command->mutable_args()));
+        if (batch->commands_size() > 1 && subcontext_command.ByteSizeLong() > kBufferSize) {
+            batch->mutable_commands()->RemoveLast();
+            break;
+        }
+    }
+
+    android::base::Timer t;
+    auto subcontext_reply = TransmitMessage(subcontext_command);
+    std::optional<ResultError<>> error;
+    if (!subcontext_reply.ok()) {
+        error = subcontext_reply.error();
+    } else if (subcontext_reply->reply_case() != SubcontextReply::kExecuteBatchReply) {
+        error = Error() << "Unexpected message type from subcontext: "
+                        << subcontext_reply->reply_case();
+    } else if (auto& reply = subcontext_reply->execute_batch_reply();
+               reply.results_size() == 0 || reply.results_size() > batch->commands_size()) {
+        error = Error() << "Unexpected number of results from subcontext: "
+                        << reply.results_size();
+    }
+
+    // There is no telling which of the commands ran, so they all failed.
+    std::vector<BatchResult> results;
+    if (error) {
+        for (int i = 0; i < batch->commands_size(); i++) {
+            results.push_back({*error, t.duration()});
+        }
+        return results;
+    }
+
+    for (const auto& command_result : subcontext_reply->execute_batch_reply().results()) {
+        auto duration = std::chrono::milliseconds(command_result.duration_ms());
+        if (command_result.has_failure()) {
+            auto& failure = command_result.failure();
+            results.push_back(
+                    {ResultError<>(failure.error_string(), failure.error_errno()), duration});
+        } else {
+            results.push_back({{}, duration});
+        }
+    }
+    return results;
+}
+
 Result<std::vector<std::string>> Subcontext::ExpandArgs(const std::vector<std::string>& args) {
     auto subcontext_command = SubcontextCommand{};
     std::copy(args.begin(), args.end(),
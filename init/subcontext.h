@@ -18,6 +18,7 @@
 
 #include <signal.h>
 
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -43,7 +44,17 @@ class Subcontext {
         }
     }
 
+    // The outcome of one of the commands of ExecuteBatch().
+    struct BatchResult {
+        Result<void> result;
+        std::chrono::milliseconds duration;
+    };
+
     Result<void> Execute(const std::vector<std::string>& args);
+    // Executes consecutive commands in a single round trip. The subcontext may stop before the
+    // end of |commands|, e.g. after a failure, so this returns the results of the commands that
+    // were run, in order. There is always at least one.
+    std::vector<BatchResult> ExecuteBatch(const std::vector<std::vector<std::string>>& commands);
     Result<std::vector<std::string>> ExpandArgs(const std::vector<std::string>& args);
     void Restart();
     bool PathMatchesSubcontext(const std::string& path) const;
@@ -148,6 +148,51 @@ TEST(subcontext, TriggerShutdown) {
     EXPECT_EQ(kTestShutdownCommand, trigger_shutdown_command);
 }
 
+TEST(subcontext, ExecuteBatch) {
+    RunTest([](auto& subcontext) {
+        auto first_pid = subcontext.pid();
+
+        auto commands = std::vector<std::vector<std::string>>{
+                {"add_word", "this"},
+                {"add_word", "is"},
+                {"generate_sane_error"},
+                {"add_word", "batched"},
+        };
+        auto results = subcontext.ExecuteBatch(commands);
+
+        // The batch stops after a failure.
+        ASSERT_EQ(3U, results.size());
+        EXPECT_RESULT_OK(results[0].result);
+        EXPECT_RESULT_OK(results[1].result);
+        ASSERT_FALSE(results[2].result.ok());
+        EXPECT_EQ("Sane error!", results[2].result.error().message());
+
+        commands.erase(commands.begin(), commands.begin() + 3);
+        commands.push_back({"return_words_as_error"});
+        results = subcontext.ExecuteBatch(commands);
+        ASSERT_EQ(2U, results.size());
+        EXPECT_RESULT_OK(results[0].result);
+        ASSERT_FALSE(results[1].result.ok());
+        EXPECT_EQ("this is batched", results[1].result.error().message());
+        EXPECT_EQ(first_pid, subcontext.pid());
+    });
+}
+
+TEST(subcontext, ExecuteBatchTriggerShutdown) {
+    static constexpr const char kTestShutdownCommand[] = "reboot,test-shutdown-command";
+    static std::string trigger_shutdown_command;
+    trigger_shutdown = [](const std::string& command) { trigger_shutdown_command = command; };
+    RunTest([](auto& subcontext) {
+        auto results = subcontext.ExecuteBatch({
+                {"trigger_shutdown", kTestShutdownCommand},
+                {"generate_sane_error"},
+        });
+        ASSERT_EQ(1U, results.size());
+        EXPECT_RESULT_OK(results[0].result);
+    });
+    EXPECT_EQ(kTestShutdownCommand, trigger_shutdown_command);
+}
+
 TEST(subcontext, ExpandArgs) {
     RunTest([](auto& subcontext) {
         auto args = std::vector<std::string>{
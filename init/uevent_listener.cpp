@@ -19,13 +19,20 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <string.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include <memory>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/strings.h>
 #include <cutils/uevent.h>
 
+using android::base::unique_fd;
+
 namespace android {
 namespace init {
 
@@ -86,7 +93,10 @@ static void ParseEvent(const char* msg, Uevent* uevent) {
     }
 }
 
-UeventListener::UeventListener(size_t uevent_socket_rcvbuf_size) {
+UeventListener::UeventListener(size_t uevent_socket_rcvbuf_size)
+    : batch_buffer_(kUeventBatchSize * (UEVENT_MSG_LEN + 2)),
+      batch_(kUeventBatchSize),
+      batch_results_(kUeventBatchSize) {
     device_fd_.reset(uevent_open_socket(uevent_socket_rcvbuf_size, true));
     if (device_fd_ == -1) {
         LOG(FATAL) << "Could not open uevent socket";
@@ -95,26 +105,77 @@ UeventListener::UeventListener(size_t uevent_socket_rcvbuf_size) {
     fcntl(device_fd_, F_SETFL, O_NONBLOCK);
 }
 
-ReadUeventResult UeventListener::ReadUevent(Uevent* uevent) const {
-    char msg[UEVENT_MSG_LEN + 2];
-    int n = uevent_kernel_multicast_recv(device_fd_, msg, UEVENT_MSG_LEN);
+// Applies the checks of uevent_kernel_multicast_recv() to a message received with recvmmsg().
+static bool IsKernelMulticast(const msghdr& hdr) {
+    const cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS) return false;
+
+    auto addr = reinterpret_cast<const sockaddr_nl*>(hdr.msg_name);
+    return addr->nl_pid == 0 && addr->nl_groups != 0;
+}
+
+bool UeventListener::ReceiveBatch() const {
+    batch_next_ = 0;
+    batch_size_ = 0;
+
+    mmsghdr msgs[kUeventBatchSize];
+    iovec iovs[kUeventBatchSize];
+    sockaddr_nl addrs[kUeventBatchSize];
+    char control[kUeventBatchSize][CMSG_SPACE(sizeof(ucred))];
+    for (size_t i = 0; i < kUeventBatchSize; ++i) {
+        iovs[i] = {&batch_buffer_[i * (UEVENT_MSG_LEN + 2)], UEVENT_MSG_LEN};
+        msgs[i].msg_hdr = {
+                .msg_name = &addrs[i],
+                .msg_namelen = sizeof(addrs[i]),
+                .msg_iov = &iovs[i],
+                .msg_iovlen = 1,
+                .msg_control = control[i],
+                .msg_controllen = sizeof(control[i]),
+        };
+        msgs[i].msg_len = 0;
+    }
+
+    int n = TEMP_FAILURE_RETRY(recvmmsg(device_fd_, msgs, kUeventBatchSize, 0, nullptr));
     if (n <= 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
             PLOG(ERROR) << "Error reading from Uevent Fd";
         }
-        return ReadUeventResult::kFailed;
-    }
-    if (n >= UEVENT_MSG_LEN) {
-        LOG(ERROR) << "Uevent overflowed buffer, discarding";
-        return ReadUeventResult::kInvalid;
+        return false;
     }
 
-    msg[n] = '\0';
-    msg[n + 1] = '\0';
+    for (int i = 0; i < n; ++i) {
+        char* msg = &batch_buffer_[i * (UEVENT_MSG_LEN + 2)];
+        size_t length = msgs[i].msg_len;
+        if (!IsKernelMulticast(msgs[i].msg_hdr)) {
+            LOG(ERROR) << "Ignoring uevent that did not come from the kernel";
+            batch_results_[i] = ReadUeventResult::kInvalid;
+            continue;
+        }
+        if (length >= UEVENT_MSG_LEN) {
+            LOG(ERROR) << "Uevent overflowed buffer, discarding";
+            batch_results_[i] = ReadUeventResult::kInvalid;
+            continue;
+        }
+
+        msg[length] = '\0';
+        msg[length + 1] = '\0';
 
-    ParseEvent(msg, uevent);
+        ParseEvent(msg, &batch_[i]);
+        batch_results_[i] = ReadUeventResult::kSuccess;
+    }
+    batch_size_ = n;
+    return true;
+}
 
-    return ReadUeventResult::kSuccess;
+// Uevents are received in batches and handed out one at a time, so that those a callback stopped
+// short of are still returned by the next call.
+ReadUeventResult UeventListener::ReadUevent(const Uevent** uevent) const {
+    if (batch_next_ == batch_size_ && !ReceiveBatch()) {
+        return ReadUeventResult::kFailed;
+    }
+    size_t i = batch_next_++;
+    *uevent = &batch_[i];
+    return batch_results_[i];
 }
 
 // RegenerateUevents*() walks parts of the /sys tree and pokes the uevent files to cause the kernel
@@ -125,59 +186,113 @@ ReadUeventResult UeventListener::ReadUevent(Uevent* uevent) const {
 // make sure we don't overrun the socket's buffer.
 //
 
-ListenerAction UeventListener::RegenerateUeventsForDir(DIR* d,
-                                                       const ListenerCallback& callback) const {
-    int dfd = dirfd(d);
-
-    int fd = openat(dfd, "uevent", O_WRONLY | O_CLOEXEC);
-    if (fd >= 0) {
-        write(fd, "add\n", 4);
-        close(fd);
-
-        Uevent uevent;
-        ReadUeventResult result;
-        while ((result = ReadUevent(&uevent)) != ReadUeventResult::kFailed) {
-            // Skip processing the uevent if it is invalid.
-            if (result == ReadUeventResult::kInvalid) continue;
-            if (callback(uevent) == ListenerAction::kStop) return ListenerAction::kStop;
-        }
+// /sys/devices has thousands of directories, so they are read with getdents64() into one large
+// buffer rather than through a DIR stream each.
+static constexpr size_t kDirentBufferSize = 32 * 1024;
+
+bool UeventListener::PokeUevent(int dfd, const char* uevent_file) const {
+    unique_fd fd(openat(dfd, uevent_file, O_WRONLY | O_CLOEXEC));
+    if (fd < 0) return false;
+    write(fd, "add\n", 4);
+    return true;
+}
+
+ListenerAction UeventListener::DrainUevents(const ListenerCallback& callback) const {
+    const Uevent* uevent;
+    ReadUeventResult result;
+    while ((result = ReadUevent(&uevent)) != ReadUeventResult::kFailed) {
+        // Skip processing the uevent if it is invalid.
+        if (result == ReadUeventResult::kInvalid) continue;
+        if (callback(*uevent) == ListenerAction::kStop) return ListenerAction::kStop;
+    }
+    return ListenerAction::kContinue;
+}
+
+ListenerAction UeventListener::RegenerateUeventsForDir(
+        int dfd, std::string* path, std::vector<char>* buffer, const ListenerCallback& callback,
+        std::vector<std::string>* uevent_paths) const {
+    if (PokeUevent(dfd, "uevent")) {
+        if (uevent_paths) uevent_paths->emplace_back(*path);
+        if (DrainUevents(callback) == ListenerAction::kStop) return ListenerAction::kStop;
     }
 
-    dirent* de;
-    while ((de = readdir(d)) != nullptr) {
-        if (de->d_type != DT_DIR || de->d_name[0] == '.') continue;
+    // Collect the subdirectories before descending, so that the walk shares a single buffer.
+    std::vector<std::string> subdirs;
+    while (true) {
+        long n = syscall(__NR_getdents64, dfd, buffer->data(), buffer->size());
+        if (n <= 0) break;
+        for (long pos = 0; pos < n;) {
+            auto de = reinterpret_cast<const dirent64*>(buffer->data() + pos);
+            pos += de->d_reclen;
+            if (de->d_type != DT_DIR || de->d_name[0] == '.') continue;
+            subdirs.emplace_back(de->d_name);
+        }
+    }
 
-        fd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (const auto& name : subdirs) {
+        unique_fd fd(openat(dfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
         if (fd < 0) continue;
 
-        std::unique_ptr<DIR, decltype(&closedir)> d2(fdopendir(fd), closedir);
-        if (d2 == 0) {
-            close(fd);
-        } else {
-            if (RegenerateUeventsForDir(d2.get(), callback) == ListenerAction::kStop) {
-                return ListenerAction::kStop;
-            }
-        }
+        size_t length = path->size();
+        path->append("/").append(name);
+        auto action = RegenerateUeventsForDir(fd, path, buffer, callback, uevent_paths);
+        path->resize(length);
+        if (action == ListenerAction::kStop) return ListenerAction::kStop;
     }
 
     // default is always to continue looking for uevents
     return ListenerAction::kContinue;
 }
 
-ListenerAction UeventListener::RegenerateUeventsForPath(const std::string& path,
-                                                        const ListenerCallback& callback) const {
-    std::unique_ptr<DIR, decltype(&closedir)> d(opendir(path.c_str()), closedir);
-    if (!d) return ListenerAction::kContinue;
+ListenerAction UeventListener::RegenerateUeventsForPath(
+        const std::string& path, const ListenerCallback& callback,
+        std::vector<std::string>* uevent_paths) const {
+    unique_fd fd(open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd < 0) return ListenerAction::kContinue;
 
-    return RegenerateUeventsForDir(d.get(), callback);
+    std::vector<char> buffer(kDirentBufferSize);
+    std::string current_path = path;
+    return RegenerateUeventsForDir(fd, &current_path, &buffer, callback, uevent_paths);
 }
 
 static const char* kRegenerationPaths[] = {"/sys/devices"};
 
-void UeventListener::RegenerateUevents(const ListenerCallback& callback) const {
+ListenerAction UeventListener::RegenerateUevents(const ListenerCallback& callback,
+                                                 std::vector<std::string>* uevent_paths) const {
     for (const auto path : kRegenerationPaths) {
-        if (RegenerateUeventsForPath(path, callback) == ListenerAction::kStop) return;
+        if (RegenerateUeventsForPath(path, callback, uevent_paths) == ListenerAction::kStop) {
+            return ListenerAction::kStop;
+        }
+    }
+    return ListenerAction::kContinue;
+}
+
+ListenerAction UeventListener::RegenerateUeventsFromPaths(
+        const std::vector<std::string>& uevent_paths, const ListenerCallback& callback) const {
+    for (const auto& path : uevent_paths) {
+        if (!PokeUevent(AT_FDCWD, (path + "/uevent").c_str())) continue;
+        if (DrainUevents(callback) == ListenerAction::kStop) return ListenerAction::kStop;
+    }
+    return ListenerAction::kContinue;
+}
+
+Result<void> WriteUeventPaths(const std::string& file, const std::vector<std::string>& paths) {
+    if (!android::base::WriteStringToFile(android::base::Join(paths, '\n'), file)) {
+        return ErrnoError() << "Could not write " << file;
+    }
+    return {};
+}
+
+Result<std::vector<std::string>> ReadUeventPaths(const std::string& file) {
+    std::string content;
+    if (!android::base::ReadFileToString(file, &content)) {
+        return ErrnoError() << "Could not read " << file;
+    }
+    std::vector<std::string> paths;
+    for (auto& path : android::base::Split(content, "\n")) {
+        if (!path.empty()) paths.emplace_back(std::move(path));
     }
+    return paths;
 }
 
 void UeventListener::Poll(const ListenerCallback& callback,
@@ -212,12 +327,12 @@ void UeventListener::Poll(const ListenerCallback& callback,
         if (ufd.revents & POLLIN) {
             // We're non-blocking, so if we receive a poll event keep processing until
             // we have exhausted all uevent messages.
-            Uevent uevent;
+            const Uevent* uevent;
             ReadUeventResult result;
             while ((result = ReadUevent(&uevent)) != ReadUeventResult::kFailed) {
                 // Skip processing the uevent if it is invalid.
                 if (result == ReadUeventResult::kInvalid) continue;
-                if (callback(uevent) == ListenerAction::kStop) return;
+                if (callback(*uevent) == ListenerAction::kStop) return;
             }
         }
     }
@@ -22,9 +22,12 @@
 #include <chrono>
 #include <functional>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 
+#include "result.h"
 #include "uevent.h"
 
 #define UEVENT_MSG_LEN 8192
@@ -45,21 +48,50 @@ enum class ReadUeventResult {
 
 using ListenerCallback = std::function<ListenerAction(const Uevent&)>;
 
+// Where first stage init leaves the uevent directories found by a complete walk of /sys, so that
+// ueventd's cold boot can poke them without walking /sys again.
+static constexpr char kColdbootUeventPathsFile[] = "/dev/.coldboot_uevent_paths";
+
+Result<void> WriteUeventPaths(const std::string& file, const std::vector<std::string>& paths);
+Result<std::vector<std::string>> ReadUeventPaths(const std::string& file);
+
 class UeventListener {
   public:
     UeventListener(size_t uevent_socket_rcvbuf_size);
 
-    void RegenerateUevents(const ListenerCallback& callback) const;
+    // If |uevent_paths| is set, the directories whose uevent files were poked are appended to it.
+    ListenerAction RegenerateUevents(const ListenerCallback& callback,
+                                     std::vector<std::string>* uevent_paths = nullptr) const;
     ListenerAction RegenerateUeventsForPath(const std::string& path,
-                                            const ListenerCallback& callback) const;
+                                            const ListenerCallback& callback,
+                                            std::vector<std::string>* uevent_paths = nullptr) const;
+    // Pokes the uevent files of |uevent_paths| only, without walking any directories.
+    ListenerAction RegenerateUeventsFromPaths(const std::vector<std::string>& uevent_paths,
+                                              const ListenerCallback& callback) const;
     void Poll(const ListenerCallback& callback,
               const std::optional<std::chrono::milliseconds> relative_timeout = {}) const;
 
   private:
-    ReadUeventResult ReadUevent(Uevent* uevent) const;
-    ListenerAction RegenerateUeventsForDir(DIR* d, const ListenerCallback& callback) const;
+    // Enough for a burst of hotplug events while keeping the buffers to half a megabyte.
+    static constexpr size_t kUeventBatchSize = 64;
+
+    bool ReceiveBatch() const;
+    ReadUeventResult ReadUevent(const Uevent** uevent) const;
+    bool PokeUevent(int dfd, const char* uevent_file) const;
+    ListenerAction DrainUevents(const ListenerCallback& callback) const;
+    ListenerAction RegenerateUeventsForDir(int dfd, std::string* path, std::vector<char>* buffer,
+                                           const ListenerCallback& callback,
+                                           std::vector<std::string>* uevent_paths) const;
 
     android::base::unique_fd device_fd_;
+
+    // The last batch received and how much of it has been handed out. The Uevents are parsed in
+    // place, so their strings keep their capacity from one batch to the next.
+    mutable std::vector<char> batch_buffer_;
+    mutable std::vector<Uevent> batch_;
+    mutable std::vector<ReadUeventResult> batch_results_;
+    mutable size_t batch_size_ = 0;
+    mutable size_t batch_next_ = 0;
 };
 
 }  // namespace init
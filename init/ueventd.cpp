@@ -24,23 +24,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <new>
 #include <set>
+#include <string_view>
 #include <thread>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/unique_fd.h>
 #include <fstab/fstab.h>
 // #include <selinux/android.h>
 // #include <selinux/selinux.h>
 
+#include "buffered_kernel_logger.h"
 #include "devices.h"
 #include "firmware_handler.h"
 #include "modalias_handler.h"
+#include "parallel_restorecon.h"
 // #include "selabel.h"
 // #include "selinux.h"
 #include "uevent_handler.h"
@@ -88,10 +97,11 @@
 // 1) ueventd regenerates uevents by doing the /sys traversal and listens to the netlink socket for
 //    the generated uevents.  It writes these uevents into a queue represented by a vector.
 //
-// 2) ueventd forks 'n' separate uevent handler subprocesses and has each of them to handle the
-//    uevents in the queue based on a starting offset (their process number) and a stride (the total
-//    number of processes).  Note that no IPC happens at this point and only const functions from
-//    DeviceHandler should be called from this context.
+// 2) ueventd forks 'n' separate uevent handler subprocesses, which take small batches of uevents
+//    from the queue through a cursor in shared memory until the queue is exhausted, so that a
+//    subprocess that hits slow uevents does not hold up cold boot while the others sit idle.  The
+//    cursor is the only IPC at this point and only const functions from DeviceHandler should be
+//    called from this context.
 //
 // 3) In parallel to the subprocesses handling the uevents, the main thread of ueventd calls
 //    selinux_android_restorecon() recursively on /sys/class, /sys/block, and /sys/devices.
@@ -100,7 +110,13 @@
 //    subprocess handlers to complete and exit.  Once this happens, it marks coldboot as having
 //    completed.
 //
-// At this point, ueventd is single threaded, poll()'s and then handles any future uevents.
+// At this point, ueventd poll()'s and then handles any future uevents.  By default it does so on
+// its single thread.  With parallel_uevent_handling enabled, it instead forks a pool of uevent
+// handler subprocesses, for the same reasons as above, and passes each uevent to one of them over
+// a socket.  The subprocess is picked by a hash of the uevent's devpath, so the uevents for a given
+// device are still handled one at a time and in the order the kernel sent them, while the uevents
+// for different devices, such as a slow module load and an unrelated hotplug, no longer wait on
+// each other.
 
 // Lastly, it should be noted that uevents that occur during the coldboot process are handled
 // without issue after the coldboot process completes.  This is because the uevent listener is
@@ -116,23 +132,32 @@ class ColdBoot {
     ColdBoot(UeventListener& uevent_listener,
              std::vector<std::unique_ptr<UeventHandler>>& uevent_handlers,
              bool enable_parallel_restorecon,
-             std::vector<std::string> parallel_restorecon_queue)
+             std::vector<std::string> parallel_restorecon_queue, bool enable_uevent_cache)
         : uevent_listener_(uevent_listener),
           uevent_handlers_(uevent_handlers),
           num_handler_subprocesses_(std::thread::hardware_concurrency() ?: 4),
           enable_parallel_restorecon_(enable_parallel_restorecon),
-          parallel_restorecon_queue_(parallel_restorecon_queue) {}
+          parallel_restorecon_queue_(parallel_restorecon_queue),
+          enable_uevent_cache_(enable_uevent_cache) {}
 
     void Run();
 
   private:
-    void UeventHandlerMain(unsigned int process_num, unsigned int total_processes);
+    void UeventHandlerMain(unsigned int process_num);
     void RegenerateUevents();
     void ForkSubProcesses();
     void WaitForSubProcesses();
     void RestoreConHandler(unsigned int process_num, unsigned int total_processes);
     void GenerateRestoreCon(const std::string& directory);
 
+    // Shared with the subprocesses, which claim work by advancing these.
+    struct Cursors {
+        std::atomic<size_t> next_uevent;
+        std::atomic<size_t> next_restorecon;
+    };
+    static_assert(std::atomic<size_t>::is_always_lock_free,
+                  "cold boot cursors must be usable across processes");
+
     UeventListener& uevent_listener_;
     std::vector<std::unique_ptr<UeventHandler>>& uevent_handlers_;
 
@@ -143,25 +168,44 @@ class ColdBoot {
 
     std::set<pid_t> subprocess_pids_;
 
+    Cursors* cursors_ = nullptr;
+
     std::vector<std::string> restorecon_queue_;
 
     std::vector<std::string> parallel_restorecon_queue_;
+
+    bool enable_uevent_cache_;
 };
 
-void ColdBoot::UeventHandlerMain(unsigned int process_num, unsigned int total_processes) {
-    for (unsigned int i = process_num; i < uevent_queue_.size(); i += total_processes) {
-        auto& uevent = uevent_queue_[i];
+// Small enough that the subprocesses finish close together when some uevents, such as firmware
+// loads, are slow; large enough that they are not all contending for the cursor.
+static constexpr size_t kUeventBatchSize = 8;
 
-        for (auto& uevent_handler : uevent_handlers_) {
-            uevent_handler->HandleUevent(uevent);
+void ColdBoot::UeventHandlerMain(unsigned int process_num) {
+    android::base::Timer t;
+    size_t handled = 0;
+
+    while (true) {
+        size_t begin = cursors_->next_uevent.fetch_add(kUeventBatchSize);
+        if (begin >= uevent_queue_.size()) break;
+        size_t end = std::min(begin + kUeventBatchSize, uevent_queue_.size());
+
+        for (size_t i = begin; i < end; ++i) {
+            for (auto& uevent_handler : uevent_handlers_) {
+                uevent_handler->HandleUevent(uevent_queue_[i]);
+            }
         }
+        handled += end - begin;
     }
+
+    LOG(INFO) << "Coldboot subprocess " << process_num << " handled " << handled << " uevents in "
+              << t.duration().count() << "ms";
 }
 
 void ColdBoot::RestoreConHandler(unsigned int process_num, unsigned int total_processes) {
 //     android::base::Timer t_process;
 
-//     for (unsigned int i = process_num; i < restorecon_queue_.size(); i += total_processes) {
+//     for (size_t i; (i = cursors_->next_restorecon++) < restorecon_queue_.size();) {
 //         android::base::Timer t;
 //         auto& dir = restorecon_queue_[i];
 
@@ -208,13 +252,32 @@ void ColdBoot::GenerateRestoreCon(const std::string& directory) {
 }
 
 void ColdBoot::RegenerateUevents() {
-    uevent_listener_.RegenerateUevents([this](const Uevent& uevent) {
+    auto callback = [this](const Uevent& uevent) {
         uevent_queue_.emplace_back(uevent);
         return ListenerAction::kContinue;
-    });
+    };
+
+    // The list is only valid for the first cold boot; a restarted ueventd walks /sys again.
+    auto uevent_paths = ReadUeventPaths(kColdbootUeventPathsFile);
+    unlink(kColdbootUeventPathsFile);
+    if (enable_uevent_cache_ && uevent_paths.ok()) {
+        LOG(INFO) << "Regenerating uevents for " << uevent_paths->size()
+                  << " paths found by first stage init";
+        uevent_listener_.RegenerateUeventsFromPaths(*uevent_paths, callback);
+        return;
+    }
+
+    uevent_listener_.RegenerateUevents(callback);
 }
 
 void ColdBoot::ForkSubProcesses() {
+    void* cursors = mmap(nullptr, sizeof(Cursors), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cursors == MAP_FAILED) {
+        PLOG(FATAL) << "mmap() failed for the cold boot cursors";
+    }
+    cursors_ = new (cursors) Cursors{0, 0};
+
     for (unsigned int i = 0; i < num_handler_subprocesses_; ++i) {
         auto pid = fork();
         if (pid < 0) {
@@ -222,7 +285,7 @@ void ColdBoot::ForkSubProcesses() {
         }
 
         if (pid == 0) {
-            UeventHandlerMain(i, num_handler_subprocesses_);
+            UeventHandlerMain(i);
             if (enable_parallel_restorecon_) {
                 RestoreConHandler(i, num_handler_subprocesses_);
             }
@@ -287,15 +350,157 @@ void ColdBoot::Run() {
     ForkSubProcesses();
 
     // if (!enable_parallel_restorecon_) {
-    //     selinux_android_restorecon("/sys", SELINUX_ANDROID_RESTORECON_RECURSE);
+    //     ParallelRestorecon restorecon({.flags = SELINUX_ANDROID_RESTORECON_RECURSE});
+    //     if (auto result = restorecon.Run({"/sys"}); !result.ok()) {
+    //         LOG(ERROR) << "Could not restorecon /sys: " << result.error();
+    //     }
     // }
 
     WaitForSubProcesses();
 
+    munmap(cursors_, sizeof(Cursors));
+    cursors_ = nullptr;
+
     android::base::SetProperty(kColdBootDoneProp, "true");
     LOG(INFO) << "Coldboot took " << cold_boot_timer.duration().count() / 1000.0f << " seconds";
 }
 
+class UeventWorkerPool {
+  public:
+    UeventWorkerPool(std::vector<std::unique_ptr<UeventHandler>>& uevent_handlers,
+                     unsigned int num_workers)
+        : uevent_handlers_(uevent_handlers), num_workers_(num_workers) {}
+
+    void Start();
+    void Dispatch(const Uevent& uevent);
+
+  private:
+    void WorkerMain(unsigned int worker_num, android::base::borrowed_fd socket);
+
+    std::vector<std::unique_ptr<UeventHandler>>& uevent_handlers_;
+    unsigned int num_workers_;
+
+    // The parent's end of each worker's socket, indexed by worker.
+    std::vector<android::base::unique_fd> sockets_;
+};
+
+static void AppendUeventString(const std::string& str, std::string* buf) {
+    uint32_t size = str.size();
+    buf->append(reinterpret_cast<const char*>(&size), sizeof(size));
+    buf->append(str);
+}
+
+static void AppendUeventInt(int value, std::string* buf) {
+    buf->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool ConsumeUeventString(std::string_view* buf, std::string* str) {
+    uint32_t size;
+    if (buf->size() < sizeof(size)) return false;
+    memcpy(&size, buf->data(), sizeof(size));
+    buf->remove_prefix(sizeof(size));
+    if (buf->size() < size) return false;
+    str->assign(buf->data(), size);
+    buf->remove_prefix(size);
+    return true;
+}
+
+static bool ConsumeUeventInt(std::string_view* buf, int* value) {
+    if (buf->size() < sizeof(*value)) return false;
+    memcpy(value, buf->data(), sizeof(*value));
+    buf->remove_prefix(sizeof(*value));
+    return true;
+}
+
+static std::string SerializeUevent(const Uevent& uevent) {
+    std::string buf;
+    for (const auto* str : {&uevent.action, &uevent.path, &uevent.subsystem, &uevent.firmware,
+                            &uevent.partition_name, &uevent.device_name, &uevent.modalias}) {
+        AppendUeventString(*str, &buf);
+    }
+    for (int value : {uevent.partition_num, uevent.major, uevent.minor}) {
+        AppendUeventInt(value, &buf);
+    }
+    return buf;
+}
+
+static bool DeserializeUevent(std::string_view buf, Uevent* uevent) {
+    for (auto* str : {&uevent->action, &uevent->path, &uevent->subsystem, &uevent->firmware,
+                      &uevent->partition_name, &uevent->device_name, &uevent->modalias}) {
+        if (!ConsumeUeventString(&buf, str)) return false;
+    }
+    for (auto* value : {&uevent->partition_num, &uevent->major, &uevent->minor}) {
+        if (!ConsumeUeventInt(&buf, value)) return false;
+    }
+    return buf.empty();
+}
+
+void UeventWorkerPool::WorkerMain(unsigned int worker_num, android::base::borrowed_fd socket) {
+    // The fields of a uevent are all taken from a message of at most UEVENT_MSG_LEN bytes, so this
+    // leaves plenty of room for the length prefixes.
+    std::vector<char> buffer(2 * UEVENT_MSG_LEN);
+    Uevent uevent;
+
+    while (true) {
+        ssize_t size =
+                TEMP_FAILURE_RETRY(recv(socket.get(), buffer.data(), buffer.size(), MSG_TRUNC));
+        if (size == 0) {
+            // ueventd exited; init will start a new one with a new pool.
+            return;
+        }
+        if (size < 0) {
+            PLOG(FATAL) << "Uevent worker " << worker_num << " failed to receive a uevent";
+        }
+        if (static_cast<size_t>(size) > buffer.size() ||
+            !DeserializeUevent({buffer.data(), static_cast<size_t>(size)}, &uevent)) {
+            LOG(ERROR) << "Uevent worker " << worker_num << " dropping malformed " << size
+                       << "-byte uevent";
+            continue;
+        }
+
+        for (auto& uevent_handler : uevent_handlers_) {
+            uevent_handler->HandleUevent(uevent);
+        }
+    }
+}
+
+void UeventWorkerPool::Start() {
+    for (unsigned int i = 0; i < num_workers_; ++i) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+            PLOG(FATAL) << "socketpair() failed for uevent worker " << i;
+        }
+        android::base::unique_fd parent_socket(sockets[0]);
+        android::base::unique_fd worker_socket(sockets[1]);
+
+        auto pid = fork();
+        if (pid < 0) {
+            PLOG(FATAL) << "fork() failed!";
+        }
+
+        if (pid == 0) {
+            // Holding on to the other workers' sockets would keep them from seeing ueventd exit.
+            sockets_.clear();
+            parent_socket.reset();
+            WorkerMain(i, worker_socket);
+            _exit(EXIT_SUCCESS);
+        }
+
+        sockets_.emplace_back(std::move(parent_socket));
+    }
+    LOG(INFO) << "Handling uevents on " << num_workers_ << " subprocesses";
+}
+
+void UeventWorkerPool::Dispatch(const Uevent& uevent) {
+    auto& socket = sockets_[std::hash<std::string>{}(uevent.path) % sockets_.size()];
+    auto buf = SerializeUevent(uevent);
+
+    // As during cold boot, a worker that dies is treated as ueventd itself crashing.
+    if (TEMP_FAILURE_RETRY(send(socket.get(), buf.data(), buf.size(), MSG_NOSIGNAL)) == -1) {
+        PLOG(FATAL) << "Could not pass the uevent for " << uevent.path << " to its worker";
+    }
+}
+
 static UeventdConfiguration GetConfiguration() {
     auto hardware = android::base::GetProperty("ro.hardware", "");
 
@@ -338,7 +543,7 @@ int ueventd_main(int argc, char** argv) {
      */
     umask(000);
 
-    android::base::InitLogging(argv, &android::base::KernelLogger);
+    android::base::InitLogging(argv, &BufferedKernelLogger);
 
     LOG(INFO) << "ueventd started!";
 
@@ -366,7 +571,8 @@ int ueventd_main(int argc, char** argv) {
     if (!android::base::GetBoolProperty(kColdBootDoneProp, false)) {
         ColdBoot cold_boot(uevent_listener, uevent_handlers,
                            ueventd_configuration.enable_parallel_restorecon,
-                           ueventd_configuration.parallel_restorecon_dirs);
+                           ueventd_configuration.parallel_restorecon_dirs,
+                           ueventd_configuration.enable_coldboot_uevent_cache);
         cold_boot.Run();
     }
 
@@ -383,6 +589,16 @@ int ueventd_main(int argc, char** argv) {
 
     // Restore prio before main loop
     setpriority(PRIO_PROCESS, 0, 0);
+    if (ueventd_configuration.enable_parallel_uevent_handling) {
+        UeventWorkerPool worker_pool(uevent_handlers, std::thread::hardware_concurrency() ?: 4);
+        worker_pool.Start();
+        uevent_listener.Poll([&worker_pool](const Uevent& uevent) {
+            worker_pool.Dispatch(uevent);
+            return ListenerAction::kContinue;
+        });
+        return 0;
+    }
+
     uevent_listener.Poll([&uevent_handlers](const Uevent& uevent) {
         for (auto& uevent_handler : uevent_handlers) {
             uevent_handler->HandleUevent(uevent);
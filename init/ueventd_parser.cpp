@@ -285,6 +285,12 @@ UeventdConfiguration ParseConfig(const std::vector<std::string>& configs) {
     parser.AddSingleLineParser("parallel_restorecon",
                                std::bind(ParseEnabledDisabledLine, _1,
                                          &ueventd_configuration.enable_parallel_restorecon));
+    parser.AddSingleLineParser("coldboot_uevent_cache",
+                               std::bind(ParseEnabledDisabledLine, _1,
+                                         &ueventd_configuration.enable_coldboot_uevent_cache));
+    parser.AddSingleLineParser("parallel_uevent_handling",
+                               std::bind(ParseEnabledDisabledLine, _1,
+                                         &ueventd_configuration.enable_parallel_uevent_handling));
 
     for (const auto& config : configs) {
         parser.ParseConfig(config);
@@ -78,6 +78,8 @@ void TestUeventdFile(const std::string& content, const UeventdConfiguration& exp
     TestVector(expected.external_firmware_handlers, result.external_firmware_handlers,
                TestExternalFirmwareHandler);
     EXPECT_EQ(expected.parallel_restorecon_dirs, result.parallel_restorecon_dirs);
+    EXPECT_EQ(expected.enable_coldboot_uevent_cache, result.enable_coldboot_uevent_cache);
+    EXPECT_EQ(expected.enable_parallel_uevent_handling, result.enable_parallel_uevent_handling);
 }
 
 TEST(ueventd_parser, EmptyFile) {
@@ -274,6 +276,18 @@ parallel_restorecon disabled
 )";
 
     TestUeventdFile(ueventd_file2, {{}, {}, {}, {}, {}, {}, true, 0, false});
+
+    auto ueventd_file3 = R"(
+coldboot_uevent_cache enabled
+)";
+
+    TestUeventdFile(ueventd_file3, {{}, {}, {}, {}, {}, {}, false, 0, false, true});
+
+    auto ueventd_file4 = R"(
+parallel_uevent_handling enabled
+)";
+
+    TestUeventdFile(ueventd_file4, {{}, {}, {}, {}, {}, {}, false, 0, false, false, true});
 }
 
 TEST(ueventd_parser, AllTogether) {
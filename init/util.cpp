@@ -42,6 +42,8 @@
 #include <cutils/sockets.h>
 // #include <selinux/android.h>
 
+#include "buffered_kernel_logger.h"
+
 #ifdef INIT_FULL_SOURCES
 #include <android/api-level.h>
 #include <sys/system_properties.h>
@@ -586,6 +588,7 @@ Result<MkdirOptions> ParseMkdir(const std::vector<std::string>& args) {
 Result<MountAllOptions> ParseMountAll(const std::vector<std::string>& args) {
     bool compat_mode = false;
     bool import_rc = false;
+    bool parallel = false;
     // if (SelinuxGetVendorAndroidVersion() <= __ANDROID_API_Q__) {
     //     if (args.size() <= 1) {
     //         return Error() << "mount_all requires at least 1 argument";
@@ -607,6 +610,9 @@ Result<MountAllOptions> ParseMountAll(const std::vector<std::string>& args) {
             first_option_arg = na;
             mode = MOUNT_MODE_LATE;
             import_rc = false;
+        } else if (args[na] == "--parallel") {
+            first_option_arg = na;
+            parallel = true;
         }
     }
 
@@ -622,7 +628,7 @@ Result<MountAllOptions> ParseMountAll(const std::vector<std::string>& args) {
         rc_paths.push_back(args[na]);
     }
 
-    return MountAllOptions{rc_paths, fstab_path, mode, import_rc};
+    return MountAllOptions{rc_paths, fstab_path, mode, import_rc, parallel};
 }
 
 // Result<std::pair<int, std::vector<std::string>>> ParseRestorecon(
@@ -728,7 +734,7 @@ void SetStdioToDevNull(char** argv) {
 
 void InitKernelLogging(char** argv) {
     SetFatalRebootTarget();
-    android::base::InitLogging(argv, &android::base::KernelLogger, InitAborter);
+    android::base::InitLogging(argv, &BufferedKernelLogger, InitAborter);
 }
 
 bool IsRecoveryMode() {
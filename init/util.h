@@ -88,6 +88,7 @@ struct MountAllOptions {
     std::string fstab_path;
     mount_mode mode;
     bool import_rc;
+    bool parallel;
 };
 
 Result<MountAllOptions> ParseMountAll(const std::vector<std::string>& args);
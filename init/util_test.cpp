@@ -183,5 +183,19 @@ TEST(util, CleanDirPath) {
     EXPECT_EQ("/foo/bar", CleanDirPath("//foo//bar"));
 }
 
+TEST(util, ParseMountAll) {
+    auto options = ParseMountAll({"mount_all", "/vendor/etc/fstab", "--late", "--parallel"});
+    ASSERT_TRUE(options.ok()) << options.error();
+    EXPECT_EQ("/vendor/etc/fstab", options->fstab_path);
+    EXPECT_EQ(MOUNT_MODE_LATE, options->mode);
+    EXPECT_TRUE(options->parallel);
+
+    options = ParseMountAll({"mount_all", "--early"});
+    ASSERT_TRUE(options.ok()) << options.error();
+    EXPECT_EQ("", options->fstab_path);
+    EXPECT_EQ(MOUNT_MODE_EARLY, options->mode);
+    EXPECT_FALSE(options->parallel);
+}
+
 }  // namespace init
 }  // namespace android
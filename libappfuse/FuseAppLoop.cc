@@ -29,7 +29,8 @@ namespace fuse {
 
 namespace {
 
-bool HandleLookUp(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* callback) {
+template <typename Buffer>
+bool HandleLookUp(FuseAppLoop* loop, Buffer* buffer, FuseAppLoopCallback* callback) {
     // AppFuse does not support directory structure now.
     // It can lookup only files under the mount point.
     if (buffer->request.header.nodeid != FUSE_ROOT_ID) {
@@ -54,7 +55,8 @@ bool HandleLookUp(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* ca
     return true;
 }
 
-bool HandleGetAttr(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* callback) {
+template <typename Buffer>
+bool HandleGetAttr(FuseAppLoop* loop, Buffer* buffer, FuseAppLoopCallback* callback) {
     if (buffer->request.header.nodeid == FUSE_ROOT_ID) {
         return loop->ReplyGetAttr(buffer->request.header.unique, buffer->request.header.nodeid, 0,
                                   S_IFDIR | 0777);
@@ -64,8 +66,9 @@ bool HandleGetAttr(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* c
     }
 }
 
-bool HandleRead(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* callback) {
-    if (buffer->request.read_in.size > kFuseMaxRead) {
+template <typename Buffer>
+bool HandleRead(FuseAppLoop* loop, Buffer* buffer, FuseAppLoopCallback* callback) {
+    if (buffer->request.read_in.size > sizeof(buffer->response.read_data)) {
         return loop->ReplySimple(buffer->request.header.unique, -EINVAL);
     }
 
@@ -74,8 +77,9 @@ bool HandleRead(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* call
     return true;
 }
 
-bool HandleWrite(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* callback) {
-    if (buffer->request.write_in.size > kFuseMaxWrite) {
+template <typename Buffer>
+bool HandleWrite(FuseAppLoop* loop, Buffer* buffer, FuseAppLoopCallback* callback) {
+    if (buffer->request.write_in.size > sizeof(buffer->request.write_data)) {
         return loop->ReplySimple(buffer->request.header.unique, -EINVAL);
     }
 
@@ -85,7 +89,8 @@ bool HandleWrite(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* cal
     return true;
 }
 
-bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCallback* callback) {
+template <typename Buffer>
+bool HandleMessage(FuseAppLoop* loop, Buffer* buffer, int fd, FuseAppLoopCallback* callback) {
     if (!buffer->request.Read(fd)) {
         return false;
     }
@@ -127,11 +132,36 @@ bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCal
     }
 }
 
+template <typename Buffer>
+void RunLoop(FuseAppLoop* loop, Buffer* buffer, int fd, EpollController* epoll_controller,
+             int* last_event, int* break_event, FuseAppLoopCallback* callback) {
+    while (true) {
+        if (!epoll_controller->Wait(1)) {
+            break;
+        }
+        *last_event = 0;
+        *reinterpret_cast<int*>(epoll_controller->events()[0].data.ptr) =
+            epoll_controller->events()[0].events;
+
+        if (*break_event != 0 || (*last_event & ~EPOLLIN) != 0) {
+            break;
+        }
+
+        if (!HandleMessage(loop, buffer, fd, callback)) {
+            break;
+        }
+    }
+}
+
 } // namespace
 
 FuseAppLoopCallback::~FuseAppLoopCallback() = default;
 
-FuseAppLoop::FuseAppLoop(base::unique_fd&& fd) : fd_(std::move(fd)) {}
+FuseAppLoop::FuseAppLoop(base::unique_fd&& fd) : FuseAppLoop(std::move(fd), FuseInitOptions()) {}
+
+FuseAppLoop::FuseAppLoop(base::unique_fd&& fd, const FuseInitOptions& options)
+    : fd_(std::move(fd)),
+      max_transfer_(std::min<size_t>(options.max_transfer, kFuseMaxLargeTransfer)) {}
 
 void FuseAppLoop::Break() {
     const int64_t value = 1;
@@ -182,7 +212,7 @@ bool FuseAppLoop::ReplyOpen(uint64_t unique, uint64_t fh) {
 }
 
 bool FuseAppLoop::ReplyWrite(uint64_t unique, uint32_t size) {
-    CHECK(size <= kFuseMaxWrite);
+    CHECK(size <= std::max<size_t>(max_transfer_, kFuseMaxWrite));
     FuseSimpleResponse response;
     response.Reset(sizeof(fuse_write_out), kFuseSuccess, unique);
     response.write_out.size = size;
@@ -190,10 +220,11 @@ bool FuseAppLoop::ReplyWrite(uint64_t unique, uint32_t size) {
 }
 
 bool FuseAppLoop::ReplyRead(uint64_t unique, uint32_t size, const void* data) {
-    CHECK(size <= kFuseMaxRead);
+    const size_t max_read = std::max<size_t>(max_transfer_, kFuseMaxRead);
+    CHECK(size <= max_read);
     FuseSimpleResponse response;
     response.ResetHeader(size, kFuseSuccess, unique);
-    return response.WriteWithBody(fd_, sizeof(FuseResponse), data);
+    return response.WriteWithBody(fd_, sizeof(fuse_out_header) + max_read, data);
 }
 
 void FuseAppLoop::Start(FuseAppLoopCallback* callback) {
@@ -223,22 +254,13 @@ void FuseAppLoop::Start(FuseAppLoopCallback* callback) {
     last_event = 0;
     break_event = 0;
 
-    FuseBuffer buffer;
-    while (true) {
-        if (!epoll_controller->Wait(1)) {
-            break;
-        }
-        last_event = 0;
-        *reinterpret_cast<int*>(epoll_controller->events()[0].data.ptr) =
-            epoll_controller->events()[0].events;
-
-        if (break_event != 0 || (last_event & ~EPOLLIN) != 0) {
-            break;
-        }
-
-        if (!HandleMessage(this, &buffer, fd_, callback)) {
-            break;
-        }
+    if (max_transfer_ > kFuseMaxWrite) {
+        std::unique_ptr<FuseLargeBuffer> buffer(new FuseLargeBuffer);
+        RunLoop(this, buffer.get(), fd_, epoll_controller.get(), &last_event, &break_event,
+                callback);
+    } else {
+        FuseBuffer buffer;
+        RunLoop(this, &buffer, fd_, epoll_controller.get(), &last_event, &break_event, callback);
     }
 
     LOG(VERBOSE) << "FuseAppLoop exit";
@@ -19,6 +19,7 @@
 #include <sys/epoll.h>
 #include <sys/socket.h>
 
+#include <thread>
 #include <unordered_map>
 
 #include <android-base/logging.h>
@@ -58,7 +59,8 @@ void GetObservedEvents(FuseBridgeState state, int* device_events, int* proxy_eve
     }
 }
 
-void LogResponseError(const std::string& message, const FuseResponse& response) {
+template <typename Response>
+void LogResponseError(const std::string& message, const Response& response) {
     LOG(ERROR) << message << ": header.len=" << response.header.len
                << " header.error=" << response.header.error
                << " header.unique=" << response.header.unique;
@@ -67,18 +69,27 @@ void LogResponseError(const std::string& message, const FuseResponse& response)
 
 class FuseBridgeEntry {
   public:
-    FuseBridgeEntry(int mount_id, base::unique_fd&& dev_fd, base::unique_fd&& proxy_fd)
+    FuseBridgeEntry(int mount_id, base::unique_fd&& dev_fd, base::unique_fd&& proxy_fd,
+                    const FuseInitOptions& options)
         : mount_id_(mount_id),
           device_fd_(std::move(dev_fd)),
           proxy_fd_(std::move(proxy_fd)),
+          options_(options),
           state_(FuseBridgeState::kWaitToReadEither),
           last_state_(FuseBridgeState::kWaitToReadEither),
           last_device_events_({this, 0}),
           last_proxy_events_({this, 0}),
-          open_count_(0) {}
+          open_count_(0) {
+        if (options_.max_transfer > kFuseMaxWrite) {
+            large_buffer_.reset(new FuseLargeBuffer);
+        } else {
+            buffer_.reset(new FuseBuffer);
+        }
+    }
 
-    // Transfer bytes depends on availability of FDs and the internal |state_|.
-    void Transfer(FuseBridgeLoopCallback* callback) {
+    // Transfer bytes depends on availability of FDs and the internal |state_|. |mounted| is set
+    // when FUSE_INIT has been answered.
+    void Transfer(bool* mounted) {
         constexpr int kUnexpectedEventMask = ~(EPOLLIN | EPOLLOUT);
         const bool unexpected_event = (last_device_events_.events & kUnexpectedEventMask) ||
                                       (last_proxy_events_.events & kUnexpectedEventMask);
@@ -100,39 +111,50 @@ class FuseBridgeEntry {
             return;
         }
 
+        if (large_buffer_) {
+            state_ = Step(large_buffer_.get(), device_read_ready, proxy_read_ready,
+                          proxy_write_ready, mounted);
+        } else {
+            state_ = Step(buffer_.get(), device_read_ready, proxy_read_ready, proxy_write_ready,
+                          mounted);
+        }
+    }
+
+    bool IsClosing() const { return state_ == FuseBridgeState::kClosing; }
+
+    int mount_id() const { return mount_id_; }
+
+  private:
+    friend class BridgeEpollController;
+
+    template <typename Buffer>
+    FuseBridgeState Step(Buffer* buffer, bool device_read_ready, bool proxy_read_ready,
+                         bool proxy_write_ready, bool* mounted) {
         switch (state_) {
             case FuseBridgeState::kWaitToReadEither:
                 if (proxy_read_ready) {
-                    state_ = ReadFromProxy();
+                    return ReadFromProxy(buffer);
                 } else if (device_read_ready) {
-                    state_ = ReadFromDevice(callback);
+                    return ReadFromDevice(buffer, mounted);
                 }
-                return;
+                return state_;
 
             case FuseBridgeState::kWaitToReadProxy:
                 CHECK(proxy_read_ready);
-                state_ = ReadFromProxy();
-                return;
+                return ReadFromProxy(buffer);
 
             case FuseBridgeState::kWaitToWriteProxy:
                 CHECK(proxy_write_ready);
-                state_ = WriteToProxy();
-                return;
+                return WriteToProxy(buffer);
 
             case FuseBridgeState::kClosing:
-                return;
+                return state_;
         }
     }
 
-    bool IsClosing() const { return state_ == FuseBridgeState::kClosing; }
-
-    int mount_id() const { return mount_id_; }
-
-  private:
-    friend class BridgeEpollController;
-
-    FuseBridgeState ReadFromProxy() {
-        switch (buffer_.response.ReadOrAgain(proxy_fd_)) {
+    template <typename Buffer>
+    FuseBridgeState ReadFromProxy(Buffer* buffer) {
+        switch (buffer->response.ReadOrAgain(proxy_fd_)) {
             case ResultOrAgain::kSuccess:
                 break;
             case ResultOrAgain::kFailure:
@@ -141,16 +163,16 @@ class FuseBridgeEntry {
                 return FuseBridgeState::kWaitToReadProxy;
         }
 
-        if (!buffer_.response.Write(device_fd_)) {
-            LogResponseError("Failed to write a reply from proxy to device", buffer_.response);
+        if (!buffer->response.Write(device_fd_)) {
+            LogResponseError("Failed to write a reply from proxy to device", buffer->response);
             return FuseBridgeState::kClosing;
         }
 
-        auto it = opcode_map_.find(buffer_.response.header.unique);
+        auto it = opcode_map_.find(buffer->response.header.unique);
         if (it != opcode_map_.end()) {
             switch (it->second) {
                 case FUSE_OPEN:
-                    if (buffer_.response.header.error == fuse::kFuseSuccess) {
+                    if (buffer->response.header.error == fuse::kFuseSuccess) {
                         open_count_++;
                     }
                     break;
@@ -173,14 +195,15 @@ class FuseBridgeEntry {
         return FuseBridgeState::kWaitToReadEither;
     }
 
-    FuseBridgeState ReadFromDevice(FuseBridgeLoopCallback* callback) {
+    template <typename Buffer>
+    FuseBridgeState ReadFromDevice(Buffer* buffer, bool* mounted) {
         LOG(VERBOSE) << "ReadFromDevice";
-        if (!buffer_.request.Read(device_fd_)) {
+        if (!buffer->request.Read(device_fd_)) {
             return FuseBridgeState::kClosing;
         }
 
-        const uint32_t opcode = buffer_.request.header.opcode;
-        const uint64_t unique = buffer_.request.header.unique;
+        const uint32_t opcode = buffer->request.header.opcode;
+        const uint64_t unique = buffer->request.header.unique;
         LOG(VERBOSE) << "Read a fuse packet, opcode=" << opcode << " unique=" << unique;
         if (unique == 0) {
             return FuseBridgeState::kWaitToReadEither;
@@ -190,6 +213,14 @@ class FuseBridgeEntry {
                 // Do not reply to FUSE_FORGET.
                 return FuseBridgeState::kWaitToReadEither;
 
+            case FUSE_BATCH_FORGET:
+                // Same as FUSE_FORGET, but only sent once we negotiated 7.16 or later.
+                if (minor_version_ >= 16) {
+                    return FuseBridgeState::kWaitToReadEither;
+                }
+                buffer->HandleNotImpl();
+                break;
+
             case FUSE_LOOKUP:
             case FUSE_GETATTR:
             case FUSE_OPEN:
@@ -198,41 +229,45 @@ class FuseBridgeEntry {
             case FUSE_RELEASE:
             case FUSE_FSYNC:
                 if (opcode == FUSE_OPEN || opcode == FUSE_RELEASE) {
-                    opcode_map_.emplace(buffer_.request.header.unique, opcode);
+                    opcode_map_.emplace(buffer->request.header.unique, opcode);
                 }
-                return WriteToProxy();
+                return WriteToProxy(buffer);
 
             case FUSE_INIT:
-                buffer_.HandleInit();
+                buffer->HandleInit(options_);
+                if (buffer->response.header.error == kFuseSuccess) {
+                    minor_version_ = buffer->response.init_out.minor;
+                }
                 break;
 
             default:
-                buffer_.HandleNotImpl();
+                buffer->HandleNotImpl();
                 break;
         }
 
-        if (!buffer_.response.Write(device_fd_)) {
-            LogResponseError("Failed to write a response to device", buffer_.response);
+        if (!buffer->response.Write(device_fd_)) {
+            LogResponseError("Failed to write a response to device", buffer->response);
             return FuseBridgeState::kClosing;
         }
 
         if (opcode == FUSE_INIT) {
-            callback->OnMount(mount_id_);
+            *mounted = true;
         }
 
         return FuseBridgeState::kWaitToReadEither;
     }
 
-    FuseBridgeState WriteToProxy() {
-        switch (buffer_.request.WriteOrAgain(proxy_fd_)) {
+    template <typename Buffer>
+    FuseBridgeState WriteToProxy(Buffer* buffer) {
+        switch (buffer->request.WriteOrAgain(proxy_fd_)) {
             case ResultOrAgain::kSuccess:
                 return FuseBridgeState::kWaitToReadEither;
             case ResultOrAgain::kFailure:
                 LOG(ERROR) << "Failed to write a request to proxy:"
-                           << " header.len=" << buffer_.request.header.len
-                           << " header.opcode=" << buffer_.request.header.opcode
-                           << " header.unique=" << buffer_.request.header.unique
-                           << " header.nodeid=" << buffer_.request.header.nodeid;
+                           << " header.len=" << buffer->request.header.len
+                           << " header.opcode=" << buffer->request.header.opcode
+                           << " header.unique=" << buffer->request.header.unique
+                           << " header.nodeid=" << buffer->request.header.nodeid;
                 return FuseBridgeState::kClosing;
             case ResultOrAgain::kAgain:
                 return FuseBridgeState::kWaitToWriteProxy;
@@ -242,7 +277,12 @@ class FuseBridgeEntry {
     const int mount_id_;
     base::unique_fd device_fd_;
     base::unique_fd proxy_fd_;
-    FuseBuffer buffer_;
+    const FuseInitOptions options_;
+    uint32_t minor_version_ = 0;
+
+    // Only one of these is allocated, depending on |options_.max_transfer|.
+    std::unique_ptr<FuseBuffer> buffer_;
+    std::unique_ptr<FuseLargeBuffer> large_buffer_;
     FuseBridgeState state_;
     FuseBridgeState last_state_;
     FuseBridgeEntryEvent last_device_events_;
@@ -313,23 +353,44 @@ class BridgeEpollController : private EpollController {
 
 std::recursive_mutex FuseBridgeLoop::mutex_;
 
-FuseBridgeLoop::FuseBridgeLoop() : opened_(true) {
-    base::unique_fd epoll_fd(epoll_create1(EPOLL_CLOEXEC));
-    if (epoll_fd.get() == -1) {
-        PLOG(ERROR) << "Failed to open FD for epoll";
-        opened_ = false;
-        return;
-    }
-    epoll_controller_.reset(new BridgeEpollController(std::move(epoll_fd)));
-}
+FuseBridgeLoop::FuseBridgeLoop() : opened_(true), started_(false) {}
 
-FuseBridgeLoop::~FuseBridgeLoop() { CHECK(bridges_.empty()); }
+FuseBridgeLoop::~FuseBridgeLoop() {
+    CHECK(bridges_.empty());
+    CHECK(workers_.empty());
+}
 
 bool FuseBridgeLoop::AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd) {
+    return AddBridge(mount_id, std::move(dev_fd), std::move(proxy_fd), FuseInitOptions());
+}
+
+bool FuseBridgeLoop::AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd,
+                               FuseInitOptions options) {
     LOG(VERBOSE) << "Adding bridge " << mount_id;
 
+    // A message has to fit in the socket send buffer, so don't negotiate transfers the proxy
+    // socket can't carry. The kernel reserves 32 bytes of the buffer for itself.
+    options.max_transfer = std::min<size_t>(options.max_transfer, kFuseMaxLargeTransfer);
+    if (options.max_transfer > kFuseMaxWrite) {
+        int send_buffer_size = 0;
+        socklen_t len = sizeof(send_buffer_size);
+        if (getsockopt(proxy_fd, SOL_SOCKET, SO_SNDBUF, &send_buffer_size, &len) == -1) {
+            PLOG(ERROR) << "Failed to get buffer size for proxy socket";
+            send_buffer_size = 0;
+        }
+        const size_t max_message_size = std::max(send_buffer_size - 32, 0);
+        constexpr size_t kWriteHeaderSize = sizeof(fuse_in_header) + sizeof(fuse_write_in);
+        const size_t max_transfer =
+                max_message_size > kWriteHeaderSize ? max_message_size - kWriteHeaderSize : 0;
+        if (max_transfer < options.max_transfer) {
+            LOG(WARNING) << "Proxy socket for mount " << mount_id << " can't carry "
+                         << options.max_transfer << " byte transfers";
+            options.max_transfer = std::max<size_t>(max_transfer, kFuseMaxWrite);
+        }
+    }
+
     std::unique_ptr<FuseBridgeEntry> bridge(
-        new FuseBridgeEntry(mount_id, std::move(dev_fd), std::move(proxy_fd)));
+        new FuseBridgeEntry(mount_id, std::move(dev_fd), std::move(proxy_fd), options));
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (!opened_) {
         LOG(ERROR) << "Tried to add a mount to a closed bridge";
@@ -339,52 +400,90 @@ bool FuseBridgeLoop::AddBridge(int mount_id, base::unique_fd dev_fd, base::uniqu
         LOG(ERROR) << "Tried to add a mount point that has already been added";
         return false;
     }
-    if (!epoll_controller_->AddBridgePoll(bridge.get())) {
-        return false;
-    }
 
+    FuseBridgeEntry* const entry = bridge.get();
     bridges_.emplace(mount_id, std::move(bridge));
+    if (started_) {
+        workers_.emplace_back(&FuseBridgeLoop::RunBridge, this, entry);
+    }
     return true;
 }
 
-bool FuseBridgeLoop::ProcessEventLocked(const std::unordered_set<FuseBridgeEntry*>& entries,
-                                        FuseBridgeLoopCallback* callback) {
-    for (auto entry : entries) {
-        entry->Transfer(callback);
-        if (!epoll_controller_->UpdateOrDeleteBridgePoll(entry)) {
-            return false;
+void FuseBridgeLoop::RunBridge(FuseBridgeEntry* bridge) {
+    const int mount_id = bridge->mount_id();
+    LOG(VERBOSE) << "Start worker for bridge " << mount_id;
+
+    // Each mount polls only its own two FDs, so a slow transfer on one mount doesn't hold up the
+    // others. The entry is owned by |bridges_| and stays alive until this thread reports it
+    // closed below.
+    base::unique_fd epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+    if (epoll_fd.get() == -1) {
+        PLOG(ERROR) << "Failed to open FD for epoll";
+        PostEvent({mount_id, MountEvent::kClosed});
+        return;
+    }
+    BridgeEpollController epoll_controller(std::move(epoll_fd));
+    if (!epoll_controller.AddBridgePoll(bridge)) {
+        PostEvent({mount_id, MountEvent::kClosed});
+        return;
+    }
+
+    std::unordered_set<FuseBridgeEntry*> entries;
+    while (epoll_controller.Wait(1, &entries)) {
+        LOG(VERBOSE) << "Receive epoll events for bridge " << mount_id;
+        bool mounted = false;
+        bridge->Transfer(&mounted);
+        if (mounted) {
+            PostEvent({mount_id, MountEvent::kMounted});
         }
-        if (entry->IsClosing()) {
-            const int mount_id = entry->mount_id();
-            bridges_.erase(mount_id);
-            callback->OnClosed(mount_id);
-            if (bridges_.size() == 0) {
-                // All bridges are now closed.
-                return false;
-            }
+        if (!epoll_controller.UpdateOrDeleteBridgePoll(bridge) || bridge->IsClosing()) {
+            break;
         }
     }
-    return true;
+    PostEvent({mount_id, MountEvent::kClosed});
+}
+
+void FuseBridgeLoop::PostEvent(const MountEvent& event) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    events_.push(event);
+    events_cv_.notify_one();
 }
 
 void FuseBridgeLoop::Start(FuseBridgeLoopCallback* callback) {
     LOG(DEBUG) << "Start fuse bridge loop";
-    std::unordered_set<FuseBridgeEntry*> entries;
+    std::unique_lock<std::recursive_mutex> lock(mutex_);
+    started_ = true;
+    for (const auto& it : bridges_) {
+        workers_.emplace_back(&FuseBridgeLoop::RunBridge, this, it.second.get());
+    }
+
+    // Callbacks are always invoked on this thread, with |mutex_| held, in the order the workers
+    // reported them.
     while (true) {
-        const bool wait_result = epoll_controller_->Wait(bridges_.size(), &entries);
-        LOG(VERBOSE) << "Receive epoll events";
-        {
-            std::lock_guard<std::recursive_mutex> lock(mutex_);
-            if (!(wait_result && ProcessEventLocked(entries, callback))) {
-                for (auto it = bridges_.begin(); it != bridges_.end();) {
-                    callback->OnClosed(it->second->mount_id());
-                    it = bridges_.erase(it);
-                }
-                opened_ = false;
-                return;
-            }
+        events_cv_.wait(lock, [this] { return !events_.empty(); });
+        const MountEvent event = events_.front();
+        events_.pop();
+        if (event.type == MountEvent::kMounted) {
+            callback->OnMount(event.mount_id);
+            continue;
+        }
+        bridges_.erase(event.mount_id);
+        callback->OnClosed(event.mount_id);
+        if (bridges_.empty()) {
+            // All bridges are now closed.
+            break;
         }
     }
+    opened_ = false;
+
+    // Every worker has posted its close event, so they are only unwinding at this point.
+    std::vector<std::thread> workers;
+    workers.swap(workers_);
+    events_ = {};
+    lock.unlock();
+    for (auto& worker : workers) {
+        worker.join();
+    }
 }
 
 void FuseBridgeLoop::Lock() {
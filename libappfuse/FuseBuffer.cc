@@ -135,8 +135,14 @@ ResultOrAgain WriteInternal(const FuseMessage<T>* self, int fd, int sockflag, co
 
 static_assert(std::is_standard_layout<FuseBuffer>::value,
               "FuseBuffer must be standard layout union.");
+static_assert(std::is_standard_layout<FuseLargeBuffer>::value,
+              "FuseLargeBuffer must be standard layout union.");
 
 bool SetupMessageSockets(base::unique_fd (*result)[2]) {
+    return SetupMessageSockets(result, sizeof(FuseBuffer));
+}
+
+bool SetupMessageSockets(base::unique_fd (*result)[2], size_t max_message_size) {
     base::unique_fd fds[2];
     {
         int raw_fds[2];
@@ -148,9 +154,9 @@ bool SetupMessageSockets(base::unique_fd (*result)[2]) {
         fds[1].reset(raw_fds[1]);
     }
 
-    constexpr int kMaxMessageSize = sizeof(FuseBuffer);
-    if (setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &kMaxMessageSize, sizeof(int)) != 0 ||
-        setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &kMaxMessageSize, sizeof(int)) != 0) {
+    const int max_message_size_int = max_message_size;
+    if (setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &max_message_size_int, sizeof(int)) != 0 ||
+        setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &max_message_size_int, sizeof(int)) != 0) {
         PLOG(ERROR) << "Failed to update buffer size for socket";
         return false;
     }
@@ -186,7 +192,8 @@ ResultOrAgain FuseMessage<T>::WriteOrAgain(int fd) const {
     return WriteInternal(this, fd, MSG_DONTWAIT, nullptr, sizeof(T));
 }
 
-void FuseRequest::Reset(
+template <size_t N>
+void FuseRequestBase<N>::Reset(
     uint32_t data_length, uint32_t opcode, uint64_t unique) {
   memset(this, 0, sizeof(fuse_in_header) + data_length);
   header.len = sizeof(fuse_in_header) + data_length;
@@ -208,13 +215,15 @@ void FuseResponseBase<N>::Reset(uint32_t data_length, int32_t error, uint64_t un
     ResetHeader(data_length, error, unique);
 }
 
-void FuseBuffer::HandleInit() {
+template <size_t N>
+void FuseBufferBase<N>::HandleInit(const FuseInitOptions& options) {
   const fuse_init_in* const in = &request.init_in;
 
   // Before writing |out|, we need to copy data from |in|.
   const uint64_t unique = request.header.unique;
   const uint32_t minor = in->minor;
   const uint32_t max_readahead = in->max_readahead;
+  const uint32_t in_flags = in->flags;
 
   // Kernel 2.6.16 is the first stable kernel with struct fuse_init_out
   // defined (fuse version 7.6). The structure is the same from 7.6 through
@@ -228,11 +237,38 @@ void FuseBuffer::HandleInit() {
     return;
   }
 
-  // We limit ourselves to minor=15 because we don't handle BATCH_FORGET yet.
-  // Thus we need to use FUSE_COMPAT_22_INIT_OUT_SIZE.
+  // By default we limit ourselves to minor=15, and thus need to use
+  // FUSE_COMPAT_22_INIT_OUT_SIZE. Writeback cache (7.23) and max_pages (7.28)
+  // need a newer minor, in which case the bridge drops FUSE_BATCH_FORGET (7.16).
+  uint32_t out_minor = std::min(minor, 15u);
+  uint32_t out_flags = FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES;
+  uint32_t max_write = kFuseMaxWrite;
+  uint16_t max_pages = 0;
+
+  if (options.async_read) {
+    out_flags |= in_flags & FUSE_ASYNC_READ;
+  }
+#if defined(FUSE_WRITEBACK_CACHE)
+  if (options.writeback_cache && minor >= 23 && (in_flags & FUSE_WRITEBACK_CACHE)) {
+    out_minor = std::min(minor, 28u);
+    out_flags |= FUSE_WRITEBACK_CACHE;
+  }
+#endif
+#if defined(FUSE_MAX_PAGES)
+  const uint32_t max_transfer = std::min<size_t>(options.max_transfer, N);
+  if (max_transfer > kFuseMaxWrite && minor >= 28 && (in_flags & FUSE_MAX_PAGES)) {
+    const uint32_t page_size = getpagesize();
+    out_minor = 28;
+    out_flags |= FUSE_MAX_PAGES;
+    max_write = max_transfer;
+    max_pages = max_transfer / page_size;
+  }
+#endif
+
 #if defined(FUSE_COMPAT_22_INIT_OUT_SIZE)
   // FUSE_KERNEL_VERSION >= 23.
-  const size_t response_size = FUSE_COMPAT_22_INIT_OUT_SIZE;
+  const size_t response_size =
+      out_minor > 22 ? sizeof(fuse_init_out) : FUSE_COMPAT_22_INIT_OUT_SIZE;
 #else
   const size_t response_size = sizeof(fuse_init_out);
 #endif
@@ -240,15 +276,21 @@ void FuseBuffer::HandleInit() {
   response.Reset(response_size, kFuseSuccess, unique);
   fuse_init_out* const out = &response.init_out;
   out->major = FUSE_KERNEL_VERSION;
-  out->minor = std::min(minor, 15u);
+  out->minor = out_minor;
   out->max_readahead = max_readahead;
-  out->flags = FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES;
+  out->flags = out_flags;
   out->max_background = 32;
   out->congestion_threshold = 32;
-  out->max_write = kFuseMaxWrite;
+  out->max_write = max_write;
+#if defined(FUSE_MAX_PAGES)
+  out->max_pages = max_pages;
+#else
+  (void)max_pages;
+#endif
 }
 
-void FuseBuffer::HandleNotImpl() {
+template <size_t N>
+void FuseBufferBase<N>::HandleNotImpl() {
   LOG(VERBOSE) << "NOTIMPL op=" << request.header.opcode << " uniq="
       << request.header.unique << " nid=" << request.header.nodeid;
   // Add volatile as a workaround for compiler issue which removes the temporary
@@ -258,10 +300,17 @@ void FuseBuffer::HandleNotImpl() {
 }
 
 template class FuseMessage<FuseRequest>;
+template class FuseMessage<FuseRequestBase<kFuseMaxLargeTransfer>>;
 template class FuseMessage<FuseResponse>;
+template class FuseMessage<FuseResponseBase<kFuseMaxLargeTransfer>>;
 template class FuseMessage<FuseSimpleResponse>;
+template struct FuseRequestBase<kFuseMaxWrite>;
+template struct FuseRequestBase<kFuseMaxLargeTransfer>;
 template struct FuseResponseBase<0u>;
 template struct FuseResponseBase<kFuseMaxRead>;
+template struct FuseResponseBase<kFuseMaxLargeTransfer>;
+template union FuseBufferBase<kFuseMaxWrite>;
+template union FuseBufferBase<kFuseMaxLargeTransfer>;
 
 }  // namespace fuse
 }  // namespace android
@@ -46,9 +46,15 @@ class FuseAppLoop final {
   public:
     FuseAppLoop(base::unique_fd&& fd);
 
+    // Serve requests of up to |options.max_transfer| bytes. Use the same options as the bridge
+    // on the other end of |fd|.
+    FuseAppLoop(base::unique_fd&& fd, const FuseInitOptions& options);
+
     void Start(FuseAppLoopCallback* callback);
     void Break();
 
+    // Reply methods may be called from any thread, and in any order, so callbacks can answer
+    // later. With FuseInitOptions::async_read several reads can be outstanding at once.
     bool ReplySimple(uint64_t unique, int32_t result);
     bool ReplyLookup(uint64_t unique, uint64_t inode, int64_t size);
     bool ReplyGetAttr(uint64_t unique, uint64_t inode, int64_t size, int mode);
@@ -59,6 +65,7 @@ class FuseAppLoop final {
   private:
     base::unique_fd fd_;
     base::unique_fd break_fd_;
+    const size_t max_transfer_;
 
     // Lock for multi-threading.
     std::mutex mutex_;
@@ -17,10 +17,13 @@
 #ifndef ANDROID_LIBAPPFUSE_FUSEBRIDGELOOP_H_
 #define ANDROID_LIBAPPFUSE_FUSEBRIDGELOOP_H_
 
+#include <condition_variable>
 #include <map>
 #include <mutex>
 #include <queue>
+#include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/macros.h>
 
@@ -37,36 +40,54 @@ class FuseBridgeLoopCallback {
 };
 
 class FuseBridgeEntry;
-class BridgeEpollController;
 
 class FuseBridgeLoop final {
   public:
     FuseBridgeLoop();
     ~FuseBridgeLoop();
 
+    // Run the loop until all bridges are closed. Every bridge is served by its own worker thread;
+    // |callback| is invoked on the calling thread only.
     void Start(FuseBridgeLoopCallback* callback);
 
     // Add bridge to the loop. It's OK to invoke the method from a different
     // thread from one which invokes |Start|.
     bool AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd);
 
+    // Same as above, negotiating |options| with the kernel. |max_transfer| is lowered to what
+    // the proxy socket can carry.
+    bool AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd,
+                   FuseInitOptions options);
+
     static void Lock();
 
     static void Unlock();
 
   private:
-    bool ProcessEventLocked(const std::unordered_set<FuseBridgeEntry*>& entries,
-                            FuseBridgeLoopCallback* callback);
+    struct MountEvent {
+        enum Type { kMounted, kClosed };
+        int mount_id;
+        Type type;
+    };
 
-    std::unique_ptr<BridgeEpollController> epoll_controller_;
+    void RunBridge(FuseBridgeEntry* bridge);
+    void PostEvent(const MountEvent& event);
 
     // Map between |mount_id| and bridge entry.
     std::map<int, std::unique_ptr<FuseBridgeEntry>> bridges_;
 
+    // Per-mount worker threads, joined when |Start| returns.
+    std::vector<std::thread> workers_;
+
+    // Events reported by the workers, consumed by the thread running |Start|.
+    std::queue<MountEvent> events_;
+    std::condition_variable_any events_cv_;
+
     // Lock for multi-threading.
     static std::recursive_mutex mutex_;
 
     bool opened_;
+    bool started_;
 
     DISALLOW_COPY_AND_ASSIGN(FuseBridgeLoop);
 };
@@ -29,9 +29,28 @@ constexpr size_t kFuseMaxWrite = 128 * 1024;
 constexpr size_t kFuseMaxRead = 128 * 1024;
 constexpr int32_t kFuseSuccess = 0;
 
+// Upper bound of a read or write negotiated through FuseInitOptions::max_transfer.
+constexpr size_t kFuseMaxLargeTransfer = 1024 * 1024;
+
+// Parameters to negotiate in FUSE_INIT. The defaults keep the 128KiB transfers and protocol 7.15
+// both ends of the proxy socket have always assumed; the other end has to be set up with the same
+// options.
+struct FuseInitOptions {
+    // Maximum size of a read or write, up to kFuseMaxLargeTransfer. Sizes above kFuseMaxWrite
+    // need FUSE_MAX_PAGES from the kernel, and a proxy socket set up for FuseLargeBuffer.
+    uint32_t max_transfer = kFuseMaxWrite;
+    // Let the kernel issue several reads of a file at once.
+    bool async_read = false;
+    // Let the kernel cache writes and flush them in page-sized batches.
+    bool writeback_cache = false;
+};
+
 // Setup sockets to transfer FuseMessage.
 bool SetupMessageSockets(base::unique_fd (*sockets)[2]);
 
+// Same as above, for messages of up to |max_message_size| bytes.
+bool SetupMessageSockets(base::unique_fd (*sockets)[2], size_t max_message_size);
+
 enum class ResultOrAgain {
     kSuccess,
     kFailure,
@@ -50,13 +69,14 @@ class FuseMessage {
 
 // FuseRequest represents file operation requests from /dev/fuse. It starts
 // from fuse_in_header. The body layout depends on the operation code.
-struct FuseRequest : public FuseMessage<FuseRequest> {
+template <size_t N>
+struct FuseRequestBase : public FuseMessage<FuseRequestBase<N>> {
   fuse_in_header header;
   union {
     // for FUSE_WRITE
     struct {
       fuse_write_in write_in;
-      char write_data[kFuseMaxWrite];
+      char write_data[N];
     };
     // for FUSE_OPEN
     fuse_open_in open_in;
@@ -65,11 +85,13 @@ struct FuseRequest : public FuseMessage<FuseRequest> {
     // for FUSE_READ
     fuse_read_in read_in;
     // for FUSE_LOOKUP
-    char lookup_name[kFuseMaxWrite];
+    char lookup_name[N];
   };
   void Reset(uint32_t data_length, uint32_t opcode, uint64_t unique);
 };
 
+using FuseRequest = FuseRequestBase<kFuseMaxWrite>;
+
 // FuseResponse represents file operation responses to /dev/fuse. It starts
 // from fuse_out_header. The body layout depends on the operation code.
 template <size_t N>
@@ -98,14 +120,22 @@ using FuseSimpleResponse = FuseResponseBase<0u>;
 
 // To reduce memory usage, FuseBuffer shares the memory region for request and
 // response.
-union FuseBuffer final {
-  FuseRequest request;
-  FuseResponse response;
+template <size_t N>
+union FuseBufferBase final {
+  FuseRequestBase<N> request;
+  FuseResponseBase<N> response;
 
-  void HandleInit();
+  void HandleInit(const FuseInitOptions& options = FuseInitOptions());
   void HandleNotImpl();
 };
 
+static_assert(kFuseMaxWrite == kFuseMaxRead, "FuseBuffer is sized for both directions.");
+using FuseBuffer = FuseBufferBase<kFuseMaxWrite>;
+
+// Buffer for bridges and app loops negotiating transfers above kFuseMaxWrite. It's 1MiB, so
+// allocate it on the heap.
+using FuseLargeBuffer = FuseBufferBase<kFuseMaxLargeTransfer>;
+
 }  // namespace fuse
 }  // namespace android
 
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specic language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <memory>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include "libappfuse/FuseAppLoop.h"
+#include "libappfuse/FuseBridgeLoop.h"
+
+namespace android {
+namespace fuse {
+namespace {
+
+class NullBridgeCallback : public FuseBridgeLoopCallback {
+  public:
+    void OnMount(int /* mount_id */) override {}
+    void OnClosed(int /* mount_id */) override {}
+};
+
+// Answers every read with |data_|, like an app serving a file from memory.
+class ReadCallback : public FuseAppLoopCallback {
+  public:
+    explicit ReadCallback(FuseAppLoop* loop) : loop_(loop), data_(new char[kFuseMaxLargeTransfer]) {
+        memset(data_.get(), 'a', kFuseMaxLargeTransfer);
+    }
+
+    void OnLookup(uint64_t unique, uint64_t) override { loop_->ReplySimple(unique, -ENOENT); }
+    void OnGetAttr(uint64_t unique, uint64_t) override { loop_->ReplySimple(unique, -ENOENT); }
+    void OnFsync(uint64_t unique, uint64_t) override { loop_->ReplySimple(unique, 0); }
+    void OnWrite(uint64_t unique, uint64_t, uint64_t, uint32_t size, const void*) override {
+        loop_->ReplyWrite(unique, size);
+    }
+    void OnRead(uint64_t unique, uint64_t, uint64_t, uint32_t size) override {
+        loop_->ReplyRead(unique, size, data_.get());
+    }
+    void OnOpen(uint64_t unique, uint64_t) override { loop_->ReplyOpen(unique, 1); }
+    void OnRelease(uint64_t unique, uint64_t) override { loop_->ReplySimple(unique, 0); }
+
+  private:
+    FuseAppLoop* const loop_;
+    std::unique_ptr<char[]> data_;
+};
+
+// Reads a file through the bridge and the app loop in |state.range(0)| byte requests, with the
+// test acting as /dev/fuse.
+void BM_BridgeRead(benchmark::State& state) {
+    base::SetMinimumLogSeverity(base::WARNING);
+    const uint32_t transfer_size = state.range(0);
+    FuseInitOptions options;
+    options.max_transfer = transfer_size;
+
+    base::unique_fd dev_sockets[2];
+    base::unique_fd proxy_sockets[2];
+    if (!SetupMessageSockets(&dev_sockets, sizeof(FuseLargeBuffer)) ||
+        !SetupMessageSockets(&proxy_sockets, sizeof(FuseLargeBuffer))) {
+        state.SkipWithError("Failed to set up sockets");
+        return;
+    }
+
+    NullBridgeCallback bridge_callback;
+    FuseBridgeLoop bridge_loop;
+    bridge_loop.AddBridge(1, std::move(dev_sockets[1]), std::move(proxy_sockets[0]), options);
+    std::thread bridge_thread([&] { bridge_loop.Start(&bridge_callback); });
+
+    FuseAppLoop app_loop(std::move(proxy_sockets[1]), options);
+    ReadCallback app_callback(&app_loop);
+    std::thread app_thread([&] { app_loop.Start(&app_callback); });
+
+    std::unique_ptr<FuseLargeBuffer> buffer(new FuseLargeBuffer);
+    uint64_t unique = 0;
+    for (auto _ : state) {
+        buffer->request.Reset(sizeof(fuse_read_in), FUSE_READ, ++unique);
+        buffer->request.header.nodeid = 2;
+        buffer->request.read_in.offset = unique * transfer_size;
+        buffer->request.read_in.size = transfer_size;
+        if (!buffer->request.Write(dev_sockets[0]) || !buffer->response.Read(dev_sockets[0]) ||
+            buffer->response.header.error != kFuseSuccess) {
+            state.SkipWithError("Read through the bridge failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * transfer_size);
+
+    // Closing the device side closes the bridge, which in turn closes the app loop's socket.
+    dev_sockets[0].reset();
+    bridge_thread.join();
+    app_thread.join();
+}
+BENCHMARK(BM_BridgeRead)->Arg(kFuseMaxRead)->Arg(kFuseMaxLargeTransfer)->UseRealTime();
+
+}  // namespace
+}  // namespace fuse
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -210,5 +210,59 @@ TEST_F(FuseBridgeLoopTest, Proxy) {
   Close();
 }
 
+TEST(FuseBridgeLoopMultiMountTest, MountsAreServedIndependently) {
+  base::unique_fd dev_sockets[2][2];
+  base::unique_fd proxy_sockets[2][2];
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(SetupMessageSockets(&dev_sockets[i]));
+    ASSERT_TRUE(SetupMessageSockets(&proxy_sockets[i]));
+  }
+
+  Callback callback;
+  FuseBridgeLoop loop;
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(loop.AddBridge(i + 1, std::move(dev_sockets[i][1]),
+                               std::move(proxy_sockets[i][0])));
+  }
+  std::thread thread([&] { loop.Start(&callback); });
+
+  // Leave a request pending on the first mount's proxy without replying.
+  FuseRequest request;
+  memset(&request, 0, sizeof(FuseRequest));
+  request.header.opcode = FUSE_READ;
+  request.header.unique = 1u;
+  request.header.len = sizeof(fuse_in_header);
+  ASSERT_TRUE(request.Write(dev_sockets[0][0]));
+  ASSERT_TRUE(request.Read(proxy_sockets[0][1]));
+
+  // The second mount still gets its reply.
+  memset(&request, 0, sizeof(FuseRequest));
+  request.header.opcode = FUSE_GETATTR;
+  request.header.unique = 2u;
+  request.header.len = sizeof(fuse_in_header);
+  ASSERT_TRUE(request.Write(dev_sockets[1][0]));
+  ASSERT_TRUE(request.Read(proxy_sockets[1][1]));
+
+  FuseResponse response;
+  memset(&response, 0, sizeof(FuseResponse));
+  response.header.len = sizeof(fuse_out_header);
+  response.header.unique = 2u;
+  response.header.error = kFuseSuccess;
+  ASSERT_TRUE(response.Write(proxy_sockets[1][1]));
+
+  memset(&response, 0, sizeof(FuseResponse));
+  ASSERT_TRUE(response.Read(dev_sockets[1][0]));
+  EXPECT_EQ(2u, response.header.unique);
+
+  // Closing one mount keeps the loop running until the other one is closed too.
+  dev_sockets[1][0].reset();
+  proxy_sockets[1][1].reset();
+  EXPECT_TRUE(thread.joinable());
+  dev_sockets[0][0].reset();
+  proxy_sockets[0][1].reset();
+  thread.join();
+  EXPECT_TRUE(callback.closed);
+}
+
 }  // namespace fuse
 }  // namespace android
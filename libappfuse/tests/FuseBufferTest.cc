@@ -20,6 +20,7 @@
 #include <string.h>
 #include <sys/socket.h>
 
+#include <memory>
 #include <thread>
 
 #include <android-base/unique_fd.h>
@@ -177,6 +178,54 @@ TEST(FuseBufferTest, HandleInit) {
   EXPECT_EQ(kFuseMaxWrite, buffer.response.init_out.max_write);
 }
 
+TEST(FuseBufferTest, HandleInitWithOptions) {
+  std::unique_ptr<FuseLargeBuffer> buffer(new FuseLargeBuffer);
+  memset(buffer.get(), 0, sizeof(FuseLargeBuffer));
+
+  buffer->request.header.opcode = FUSE_INIT;
+  buffer->request.init_in.major = FUSE_KERNEL_VERSION;
+  buffer->request.init_in.minor = FUSE_KERNEL_MINOR_VERSION;
+  buffer->request.init_in.flags = FUSE_ASYNC_READ | FUSE_WRITEBACK_CACHE | FUSE_MAX_PAGES;
+
+  FuseInitOptions options;
+  options.max_transfer = kFuseMaxLargeTransfer;
+  options.async_read = true;
+  options.writeback_cache = true;
+  buffer->HandleInit(options);
+
+  ASSERT_EQ(sizeof(fuse_out_header) + sizeof(fuse_init_out), buffer->response.header.len);
+  EXPECT_EQ(kFuseSuccess, buffer->response.header.error);
+  EXPECT_EQ(28u, buffer->response.init_out.minor);
+  EXPECT_EQ(static_cast<unsigned int>(FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES | FUSE_ASYNC_READ |
+                                      FUSE_WRITEBACK_CACHE | FUSE_MAX_PAGES),
+            buffer->response.init_out.flags);
+  EXPECT_EQ(kFuseMaxLargeTransfer, buffer->response.init_out.max_write);
+  EXPECT_EQ(kFuseMaxLargeTransfer / getpagesize(), buffer->response.init_out.max_pages);
+}
+
+TEST(FuseBufferTest, HandleInitWithOptionsOnOldKernel) {
+  std::unique_ptr<FuseLargeBuffer> buffer(new FuseLargeBuffer);
+  memset(buffer.get(), 0, sizeof(FuseLargeBuffer));
+
+  buffer->request.header.opcode = FUSE_INIT;
+  buffer->request.init_in.major = FUSE_KERNEL_VERSION;
+  buffer->request.init_in.minor = 22;
+  buffer->request.init_in.flags = FUSE_ASYNC_READ;
+
+  FuseInitOptions options;
+  options.max_transfer = kFuseMaxLargeTransfer;
+  options.async_read = true;
+  options.writeback_cache = true;
+  buffer->HandleInit(options);
+
+  ASSERT_EQ(sizeof(fuse_out_header) + FUSE_COMPAT_22_INIT_OUT_SIZE,
+            buffer->response.header.len);
+  EXPECT_EQ(15u, buffer->response.init_out.minor);
+  EXPECT_EQ(static_cast<unsigned int>(FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES | FUSE_ASYNC_READ),
+            buffer->response.init_out.flags);
+  EXPECT_EQ(kFuseMaxWrite, buffer->response.init_out.max_write);
+}
+
 TEST(FuseBufferTest, HandleNotImpl) {
   FuseBuffer buffer;
   memset(&buffer, 0, sizeof(FuseBuffer));
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIOUring.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+
+struct asyncio_uring {
+    int fd;
+    unsigned flags;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    // Shared with the kernel.
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_flags;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    io_uring_cqe* cqes;
+    unsigned cq_mask;
+
+    // The tail including entries that have been prepared but not yet submitted.
+    unsigned sqe_tail;
+};
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+template <typename T>
+static T* RingAt(void* ring, uint32_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+static void UnmapRings(asyncio_uring* ring) {
+    if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+}
+
+int asyncio_uring_setup(unsigned entries, unsigned flags, asyncio_uring** ringp) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (flags & ASYNCIO_URING_IOPOLL) params.flags |= IORING_SETUP_IOPOLL;
+    if (flags & ASYNCIO_URING_SQPOLL) params.flags |= IORING_SETUP_SQPOLL;
+
+    asyncio_uring* ring = new (std::nothrow) asyncio_uring();
+    if (ring == nullptr) {
+        errno = ENOMEM;
+        return -1;
+    }
+    ring->flags = flags;
+    ring->sq_ring = ring->cq_ring = MAP_FAILED;
+    ring->sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd == -1) {
+        delete ring;
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring->sq_ring_size = ring->cq_ring_size = std::max(ring->sq_ring_size, ring->cq_ring_size);
+    }
+    ring->sq_ring = mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring != MAP_FAILED) {
+        ring->cq_ring = single_mmap ? ring->sq_ring
+                                    : mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    if (ring->cq_ring != MAP_FAILED) {
+        ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        ring->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ring->sqes_size,
+                                                     PROT_READ | PROT_WRITE,
+                                                     MAP_SHARED | MAP_POPULATE, ring->fd,
+                                                     IORING_OFF_SQES));
+    }
+    if (ring->sqes == MAP_FAILED) {
+        int saved_errno = errno;
+        UnmapRings(ring);
+        close(ring->fd);
+        delete ring;
+        errno = saved_errno;
+        return -1;
+    }
+
+    ring->sq_head = RingAt<unsigned>(ring->sq_ring, params.sq_off.head);
+    ring->sq_tail = RingAt<unsigned>(ring->sq_ring, params.sq_off.tail);
+    ring->sq_flags = RingAt<unsigned>(ring->sq_ring, params.sq_off.flags);
+    ring->sq_array = RingAt<unsigned>(ring->sq_ring, params.sq_off.array);
+    ring->sq_mask = *RingAt<unsigned>(ring->sq_ring, params.sq_off.ring_mask);
+    ring->sq_entries = *RingAt<unsigned>(ring->sq_ring, params.sq_off.ring_entries);
+    ring->cq_head = RingAt<unsigned>(ring->cq_ring, params.cq_off.head);
+    ring->cq_tail = RingAt<unsigned>(ring->cq_ring, params.cq_off.tail);
+    ring->cqes = RingAt<io_uring_cqe>(ring->cq_ring, params.cq_off.cqes);
+    ring->cq_mask = *RingAt<unsigned>(ring->cq_ring, params.cq_off.ring_mask);
+    ring->sqe_tail = *ring->sq_tail;
+
+    *ringp = ring;
+    return 0;
+}
+
+void asyncio_uring_destroy(asyncio_uring* ring) {
+    if (ring == nullptr) return;
+    UnmapRings(ring);
+    close(ring->fd);
+    delete ring;
+}
+
+int asyncio_uring_register_buffers(asyncio_uring* ring, const iovec* iovecs, unsigned nr) {
+    return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iovecs, nr);
+}
+
+int asyncio_uring_register_files(asyncio_uring* ring, const int* fds, unsigned nr) {
+    return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, nr);
+}
+
+int asyncio_uring_prep(asyncio_uring* ring, int fd, const void* buf, uint64_t count,
+                       int64_t offset, bool read, int buf_index, unsigned flags,
+                       uint64_t user_data) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    unsigned index = ring->sqe_tail & ring->sq_mask;
+    io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    if (buf_index >= 0) {
+        sqe->opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe->buf_index = buf_index;
+    } else {
+        sqe->opcode = read ? IORING_OP_READ : IORING_OP_WRITE;
+    }
+    if (flags & ASYNCIO_URING_FIXED_FILE) sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = count;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return 0;
+}
+
+int asyncio_uring_submit(asyncio_uring* ring, unsigned wait_nr) {
+    unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+    // Publishes the prepared entries to the kernel.
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    unsigned enter_flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (ring->flags & ASYNCIO_URING_SQPOLL) {
+        // The polling thread picks the entries up by itself unless it has gone idle, so a
+        // syscall is only needed to wake it or to wait.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+            enter_flags |= IORING_ENTER_SQ_WAKEUP;
+        }
+        if (enter_flags != 0 && io_uring_enter(ring->fd, to_submit, wait_nr, enter_flags) == -1) {
+            return -1;
+        }
+        return to_submit;
+    }
+    if (to_submit == 0 && wait_nr == 0) return 0;
+    return io_uring_enter(ring->fd, to_submit, wait_nr, enter_flags);
+}
+
+int asyncio_uring_peek(asyncio_uring* ring, asyncio_uring_cqe* cqes, unsigned max_nr) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned n = std::min(tail - head, max_nr);
+    for (unsigned i = 0; i < n; i++) {
+        const io_uring_cqe& cqe = ring->cqes[(head + i) & ring->cq_mask];
+        cqes[i].user_data = cqe.user_data;
+        cqes[i].res = cqe.res;
+    }
+    // Hands the reaped entries back to the kernel.
+    __atomic_store_n(ring->cq_head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+int asyncio_uring_wait(asyncio_uring* ring, asyncio_uring_cqe* cqes, unsigned min_nr,
+                       unsigned max_nr) {
+    unsigned n = asyncio_uring_peek(ring, cqes, max_nr);
+    while (n < min_nr) {
+        if (io_uring_enter(ring->fd, 0, min_nr - n, IORING_ENTER_GETEVENTS) == -1 &&
+            errno != EINTR) {
+            // Don't drop completions that were already reaped.
+            return n > 0 ? static_cast<int>(n) : -1;
+        }
+        n += asyncio_uring_peek(ring, cqes + n, max_nr - n);
+    }
+    return n;
+}
+
+#else
+
+struct asyncio_uring {};
+
+int asyncio_uring_setup(unsigned, unsigned, asyncio_uring**) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void asyncio_uring_destroy(asyncio_uring*) {}
+
+int asyncio_uring_register_buffers(asyncio_uring*, const iovec*, unsigned) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int asyncio_uring_register_files(asyncio_uring*, const int*, unsigned) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int asyncio_uring_prep(asyncio_uring*, int, const void*, uint64_t, int64_t, bool, int, unsigned,
+                       uint64_t) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int asyncio_uring_submit(asyncio_uring*, unsigned) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int asyncio_uring_peek(asyncio_uring*, asyncio_uring_cqe*, unsigned) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int asyncio_uring_wait(asyncio_uring*, asyncio_uring_cqe*, unsigned, unsigned) {
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ASYNCIO_URING_H
+#define _ASYNCIO_URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Provides kernel io_uring operations, the successor to the aio operations in AsyncIO.h.
+ *
+ * Reads and writes are queued in memory shared with the kernel and submitted in batches with a
+ * single syscall, and completions are reaped from shared memory without one. Buffers and fds can
+ * be registered once instead of being looked up on every operation. Unlike aio, operations on
+ * buffered files don't block submission.
+ *
+ * Like the aio operations, functions return -1 and set errno on failure. On kernels without
+ * io_uring, asyncio_uring_setup() fails with ENOSYS and callers should fall back to aio.
+ */
+
+struct asyncio_uring;
+
+struct asyncio_uring_cqe {
+    /* The user_data of the operation. */
+    uint64_t user_data;
+    /* The number of bytes transferred, or -errno. */
+    int32_t res;
+};
+
+/* Flags for asyncio_uring_setup(). */
+/* Busy-poll for completions instead of waiting for interrupts. Only for files opened O_DIRECT. */
+#define ASYNCIO_URING_IOPOLL (1U << 0)
+/* Have a kernel thread poll for submissions, so that most submits need no syscall. */
+#define ASYNCIO_URING_SQPOLL (1U << 1)
+
+/* Flags for asyncio_uring_prep(). */
+/* |fd| is an index into the files registered with asyncio_uring_register_files(). */
+#define ASYNCIO_URING_FIXED_FILE (1U << 0)
+
+int asyncio_uring_setup(unsigned entries, unsigned flags, struct asyncio_uring** ringp);
+void asyncio_uring_destroy(struct asyncio_uring* ring);
+
+int asyncio_uring_register_buffers(struct asyncio_uring* ring, const struct iovec* iovecs,
+                                   unsigned nr);
+int asyncio_uring_register_files(struct asyncio_uring* ring, const int* fds, unsigned nr);
+
+/*
+ * Queues a read or write without submitting it. If |buf_index| is not negative, |buf| must lie
+ * within the registered buffer with that index. Fails with EBUSY if the submission queue is full.
+ */
+int asyncio_uring_prep(struct asyncio_uring* ring, int fd, const void* buf, uint64_t count,
+                       int64_t offset, bool read, int buf_index, unsigned flags,
+                       uint64_t user_data);
+
+/*
+ * Submits all queued operations with a single syscall, and waits until at least |wait_nr|
+ * operations have completed. Returns the number of operations submitted.
+ */
+int asyncio_uring_submit(struct asyncio_uring* ring, unsigned wait_nr);
+
+/* Reaps up to |max_nr| completed operations without a syscall. Returns the number reaped. */
+int asyncio_uring_peek(struct asyncio_uring* ring, struct asyncio_uring_cqe* cqes,
+                       unsigned max_nr);
+
+/*
+ * Reaps at least |min_nr| and up to |max_nr| completed operations, waiting in the kernel only
+ * while fewer than |min_nr| have completed. Returns the number reaped.
+ */
+int asyncio_uring_wait(struct asyncio_uring* ring, struct asyncio_uring_cqe* cqes,
+                       unsigned min_nr, unsigned max_nr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif  // _ASYNCIO_URING_H
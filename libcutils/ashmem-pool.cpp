@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/ashmem.h>
+
+/*
+ * A pool of shared memory regions in power-of-two size classes. Released regions keep their fd
+ * and mapping; their pages are handed back to the kernel, so that an idle region costs address
+ * space but no memory, and reads back as zeroes like a new one. Acquiring one then takes no
+ * system call at all, instead of a memfd_create(), an ftruncate() and an mmap().
+ */
+#define LOG_TAG "ashmem"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <log/log.h>
+#include <utils/Compat.h>
+
+// Pooled classes run from one page up to this many pages; bigger regions are not pooled.
+static constexpr size_t kMaxClassPages = 2048;
+
+struct ashmem_pool_region {
+    int fd;
+    void* addr;
+    size_t size;
+};
+
+struct ashmem_pool {
+    std::string name;
+    size_t max_idle;
+    size_t page_size;
+    size_t num_classes;
+
+    std::mutex lock;
+    std::vector<std::vector<ashmem_pool_region>> idle;
+    std::unordered_map<int, ashmem_pool_region> in_use;
+    ashmem_pool_stats stats;
+};
+
+// Returns the class index of a region of |size| bytes, or pool->num_classes if it is too big.
+static size_t size_class(const ashmem_pool* pool, size_t size) {
+    size_t pages = (size + pool->page_size - 1) / pool->page_size;
+    size_t cls = 0;
+    while (cls < pool->num_classes && (static_cast<size_t>(1) << cls) < pages) cls++;
+    return cls;
+}
+
+static void free_region(const ashmem_pool_region& region) {
+    munmap(region.addr, region.size);
+    close(region.fd);
+}
+
+// Frees the pages of |region|, leaving it as a new one would be: the same size, full of zeroes.
+static bool purge_region(const ashmem_pool_region& region) {
+#if defined(MADV_REMOVE)
+    if (madvise(region.addr, region.size, MADV_REMOVE) == 0) return true;
+#endif
+    return TEMP_FAILURE_RETRY(ftruncate(region.fd, 0)) == 0 &&
+           TEMP_FAILURE_RETRY(ftruncate(region.fd, region.size)) == 0;
+}
+
+// Sealed regions cannot be handed out as new ones again.
+static bool is_sealed(int fd) {
+#if defined(F_GET_SEALS)
+    int seals = fcntl(fd, F_GET_SEALS);
+    return seals > 0;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+struct ashmem_pool* ashmem_pool_create(const char* name, size_t max_idle_per_class) {
+    ashmem_pool* pool = new ashmem_pool;
+    pool->name = name ? name : "ashmem_pool";
+    pool->max_idle = max_idle_per_class;
+    pool->page_size = getpagesize();
+    pool->num_classes = 0;
+    while ((static_cast<size_t>(1) << pool->num_classes) <= kMaxClassPages) pool->num_classes++;
+    pool->idle.resize(pool->num_classes);
+    pool->stats = {};
+    return pool;
+}
+
+void ashmem_pool_destroy(struct ashmem_pool* pool) {
+    if (!pool) return;
+    for (auto& regions : pool->idle) {
+        for (auto& region : regions) free_region(region);
+    }
+    if (!pool->in_use.empty()) {
+        ALOGW("ashmem_pool_destroy(%s): %zu regions still acquired", pool->name.c_str(),
+              pool->in_use.size());
+        for (auto& entry : pool->in_use) free_region(entry.second);
+    }
+    delete pool;
+}
+
+int ashmem_pool_acquire(struct ashmem_pool* pool, size_t size, void** addr) {
+    if (size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t cls = size_class(pool, size);
+    ashmem_pool_region region = {};
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        if (cls < pool->num_classes && !pool->idle[cls].empty()) {
+            region = pool->idle[cls].back();
+            pool->idle[cls].pop_back();
+            pool->stats.idle_regions--;
+            pool->stats.idle_size -= region.size;
+            pool->stats.hits++;
+            found = true;
+        } else {
+            pool->stats.misses++;
+        }
+    }
+
+    if (!found) {
+        size_t pages = (size + pool->page_size - 1) / pool->page_size;
+        region.size = (cls < pool->num_classes ? static_cast<size_t>(1) << cls : pages) *
+                      pool->page_size;
+        region.fd = ashmem_create_region(pool->name.c_str(), region.size);
+        if (region.fd < 0) return -1;
+        region.addr = mmap(nullptr, region.size, PROT_READ | PROT_WRITE, MAP_SHARED, region.fd, 0);
+        if (region.addr == MAP_FAILED) {
+            int saved_errno = errno;
+            ALOGE("ashmem_pool_acquire(%s, %zu): mmap failed: %s", pool->name.c_str(), size,
+                  strerror(errno));
+            close(region.fd);
+            errno = saved_errno;
+            return -1;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->in_use[region.fd] = region;
+    }
+    if (addr) *addr = region.addr;
+    return region.fd;
+}
+
+int ashmem_pool_release(struct ashmem_pool* pool, int fd) {
+    ashmem_pool_region region;
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        auto it = pool->in_use.find(fd);
+        if (it == pool->in_use.end()) {
+            errno = EBADF;
+            return -1;
+        }
+        region = it->second;
+        pool->in_use.erase(it);
+    }
+
+    size_t cls = size_class(pool, region.size);
+    bool recycle = cls < pool->num_classes && !is_sealed(fd) && purge_region(region);
+    if (recycle) {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        if (pool->idle[cls].size() < pool->max_idle) {
+            pool->idle[cls].push_back(region);
+            pool->stats.idle_regions++;
+            pool->stats.idle_size += region.size;
+            pool->stats.recycled++;
+            return 0;
+        }
+    }
+
+    free_region(region);
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->stats.discarded++;
+    return 0;
+}
+
+void ashmem_pool_get_stats(struct ashmem_pool* pool, struct ashmem_pool_stats* stats) {
+    std::lock_guard<std::mutex> guard(pool->lock);
+    *stats = pool->stats;
+}
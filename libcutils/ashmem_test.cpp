@@ -280,3 +280,77 @@ TEST(AshmemTest, ForkMultiRegionTest) {
         EXPECT_EQ(0, munmap(region, size));
     }
 }
+
+TEST(AshmemTest, PoolReuse) {
+    constexpr size_t page = PAGE_SIZE;
+    ashmem_pool* pool = ashmem_pool_create("pool_test", 4);
+    ASSERT_NE(nullptr, pool);
+
+    void* addr;
+    int fd = ashmem_pool_acquire(pool, 3 * page, &addr);
+    ASSERT_GE(fd, 0);
+    ASSERT_TRUE(ashmem_valid(fd));
+    // Rounded up to the size class.
+    ASSERT_EQ(4 * page, static_cast<size_t>(ashmem_get_size_region(fd)));
+    memset(addr, 0xa5, 4 * page);
+    ASSERT_EQ(0, ashmem_pool_release(pool, fd));
+
+    // The same class gets the same region back, cleared like a new one.
+    void* addr2;
+    int fd2 = ashmem_pool_acquire(pool, 4 * page, &addr2);
+    ASSERT_EQ(fd, fd2);
+    ASSERT_EQ(addr, addr2);
+    uint8_t zeroes[4 * page] = {};
+    EXPECT_EQ(0, memcmp(addr2, zeroes, sizeof(zeroes)));
+
+    // Another class does not.
+    int fd3 = ashmem_pool_acquire(pool, page, nullptr);
+    ASSERT_GE(fd3, 0);
+    EXPECT_NE(fd, fd3);
+
+    ASSERT_EQ(0, ashmem_pool_release(pool, fd2));
+    ASSERT_EQ(0, ashmem_pool_release(pool, fd3));
+    EXPECT_EQ(-1, ashmem_pool_release(pool, fd3));
+    EXPECT_EQ(EBADF, errno);
+
+    ashmem_pool_stats stats;
+    ashmem_pool_get_stats(pool, &stats);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(2u, stats.misses);
+    EXPECT_EQ(3u, stats.recycled);
+    EXPECT_EQ(0u, stats.discarded);
+    EXPECT_EQ(2u, stats.idle_regions);
+    EXPECT_EQ(5 * page, stats.idle_size);
+
+    ashmem_pool_destroy(pool);
+}
+
+TEST(AshmemTest, PoolDiscardsSealedAndSurplus) {
+    constexpr size_t page = PAGE_SIZE;
+    ashmem_pool* pool = ashmem_pool_create("pool_test", 1);
+    ASSERT_NE(nullptr, pool);
+
+    // A region made read-only cannot be handed out as a new one.
+    int sealed = ashmem_pool_acquire(pool, page, nullptr);
+    ASSERT_GE(sealed, 0);
+    ASSERT_EQ(0, ashmem_set_prot_region(sealed, PROT_READ));
+    ASSERT_EQ(0, ashmem_pool_release(pool, sealed));
+
+    // Only one idle region per class is kept.
+    int fd1 = ashmem_pool_acquire(pool, page, nullptr);
+    int fd2 = ashmem_pool_acquire(pool, page, nullptr);
+    ASSERT_GE(fd1, 0);
+    ASSERT_GE(fd2, 0);
+    ASSERT_EQ(0, ashmem_pool_release(pool, fd1));
+    ASSERT_EQ(0, ashmem_pool_release(pool, fd2));
+
+    ashmem_pool_stats stats;
+    ashmem_pool_get_stats(pool, &stats);
+    EXPECT_EQ(0u, stats.hits);
+    EXPECT_EQ(3u, stats.misses);
+    EXPECT_EQ(1u, stats.recycled);
+    EXPECT_EQ(2u, stats.discarded);
+    EXPECT_EQ(1u, stats.idle_regions);
+
+    ashmem_pool_destroy(pool);
+}
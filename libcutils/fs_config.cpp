@@ -32,7 +32,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <android-base/strings.h>
 #include <cutils/fs.h>
@@ -272,6 +275,10 @@ static bool is_partition(const std::string& path) {
     return false;
 }
 
+// partitions that can also be mounted under another one
+static constexpr const char* kLogicalPartitions[] = {"system/product/", "system/system_ext/",
+                                                     "system/vendor/", "vendor/odm/"};
+
 // alias prefixes of "<partition>/<stuff>" to "system/<partition>/<stuff>" or
 // "system/<partition>/<stuff>" to "<partition>/<stuff>"
 static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char* path, size_t plen) {
@@ -300,8 +307,6 @@ static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char*
     if (fnmatch(pattern.c_str(), input.c_str(), fnm_flags) == 0) return true;
 
     // Check match between logical partition's files and patterns.
-    static constexpr const char* kLogicalPartitions[] = {"system/product/", "system/system_ext/",
-                                                         "system/vendor/", "vendor/odm/"};
     for (auto& logical_partition : kLogicalPartitions) {
         if (StartsWith(input, logical_partition)) {
             std::string input_in_partition = input.substr(input.find('/') + 1);
@@ -317,6 +322,33 @@ static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char*
 auto __for_testing_only__fs_config_cmp = fs_config_cmp;
 #endif
 
+// Reads the next entry of an fs_config_(dirs|files) override file. Returns false at the end of
+// the file, or if the entry is corrupted.
+static bool fs_config_read_entry(int fd, const char* name, fs_path_config_from_file* header,
+                                 std::string* prefix) {
+    if (TEMP_FAILURE_RETRY(read(fd, header, sizeof(*header))) != sizeof(*header)) {
+        return false;
+    }
+    uint16_t host_len = header->len;
+    ssize_t len, remainder = host_len - sizeof(*header);
+    if (remainder <= 0) {
+        ALOGE("%s len is corrupted", name);
+        return false;
+    }
+    prefix->resize(remainder);
+    if (TEMP_FAILURE_RETRY(read(fd, prefix->data(), remainder)) != remainder) {
+        ALOGE("%s prefix is truncated", name);
+        return false;
+    }
+    len = strnlen(prefix->data(), remainder);
+    if (len >= remainder) {  // missing a terminating null
+        ALOGE("%s is corrupted", name);
+        return false;
+    }
+    prefix->resize(len);
+    return true;
+}
+
 void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
                unsigned* mode, uint64_t* capabilities) {
     const struct fs_path_config* pc;
@@ -334,32 +366,9 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
         int fd = fs_config_open(dir, which, target_out_path);
         if (fd < 0) continue;
 
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char* prefix;
-            uint16_t host_len = header.len;
-            ssize_t len, remainder = host_len - sizeof(header);
-            if (remainder <= 0) {
-                ALOGE("%s len is corrupted", conf[which][dir]);
-                break;
-            }
-            prefix = static_cast<char*>(calloc(1, remainder));
-            if (!prefix) {
-                ALOGE("%s out of memory", conf[which][dir]);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", conf[which][dir]);
-                break;
-            }
-            len = strnlen(prefix, remainder);
-            if (len >= remainder) {  // missing a terminating null
-                free(prefix);
-                ALOGE("%s is corrupted", conf[which][dir]);
-                break;
-            }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
+        std::string prefix;
+        while (fs_config_read_entry(fd, conf[which][dir], &header, &prefix)) {
+            if (fs_config_cmp(dir, prefix.c_str(), prefix.size(), path, plen)) {
                 close(fd);
                 *uid = header.uid;
                 *gid = header.gid;
@@ -367,7 +376,6 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
                 *capabilities = header.capabilities;
                 return;
             }
-            free(prefix);
         }
         close(fd);
     }
@@ -382,3 +390,145 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
     *mode = (*mode & (~07777)) | pc->mode;
     *capabilities = pc->capabilities;
 }
+
+// A rule of a loaded fs_config, with its pattern already massaged the way fs_config_cmp() does it
+// for every lookup.
+struct fs_config_rule {
+    std::string pattern;
+    // The pattern matches only itself: compare it instead of calling fnmatch().
+    bool literal;
+    unsigned mode;
+    unsigned uid;
+    unsigned gid;
+    uint64_t capabilities;
+};
+
+// The rules for either files or directories, in the order they apply, indexed by the part of their
+// pattern before any wildcard. A path can only match rules whose literal prefix is a prefix of the
+// path, so a lookup binary searches each prefix length in use instead of trying every rule.
+struct fs_config_table {
+    std::vector<fs_config_rule> rules;
+    fs_config_rule fallback;
+    // (literal prefix, rule index), sorted.
+    std::vector<std::pair<std::string, size_t>> index;
+    // The distinct lengths of the literal prefixes, ascending.
+    std::vector<size_t> prefix_lengths;
+};
+
+struct fs_config_handle {
+    fs_config_table tables[2];  // Indexed by the dir argument of fs_config().
+};
+
+static void fs_config_add_rule(fs_config_table* table, bool dir, const char* prefix,
+                               unsigned mode, unsigned uid, unsigned gid,
+                               uint64_t capabilities) {
+    std::string pattern(prefix);
+    if (dir && !EndsWith(pattern, "/*")) {
+        pattern.append(EndsWith(pattern, "/") ? "*" : "/*");
+    }
+    size_t literal_len = pattern.find_first_of("*?[");
+    bool literal = literal_len == std::string::npos;
+    if (literal) literal_len = pattern.size();
+
+    table->index.emplace_back(pattern.substr(0, literal_len), table->rules.size());
+    table->rules.push_back({std::move(pattern), literal, mode, uid, gid, capabilities});
+}
+
+static void fs_config_build_index(fs_config_table* table) {
+    std::sort(table->index.begin(), table->index.end());
+    for (const auto& entry : table->index) {
+        table->prefix_lengths.push_back(entry.first.size());
+    }
+    std::sort(table->prefix_lengths.begin(), table->prefix_lengths.end());
+    table->prefix_lengths.erase(
+            std::unique(table->prefix_lengths.begin(), table->prefix_lengths.end()),
+            table->prefix_lengths.end());
+}
+
+// Lowers *best to the index of the first rule before it that matches input.
+static void fs_config_find_rule(const fs_config_table& table, const std::string& input,
+                                size_t* best) {
+    const std::string_view path(input);
+    for (size_t len : table.prefix_lengths) {
+        if (len > path.size()) break;
+        const std::string_view prefix = path.substr(0, len);
+        auto it = std::lower_bound(table.index.begin(), table.index.end(), prefix,
+                                   [](const std::pair<std::string, size_t>& entry,
+                                      std::string_view key) { return entry.first < key; });
+        // Entries with the same prefix are sorted by rule index.
+        for (; it != table.index.end() && it->first == prefix && it->second < *best; ++it) {
+            const fs_config_rule& rule = table.rules[it->second];
+            bool match = rule.literal ? rule.pattern == input
+                                      : fnmatch(rule.pattern.c_str(), input.c_str(),
+                                                FNM_NOESCAPE) == 0;
+            if (match) {
+                *best = it->second;
+                break;
+            }
+        }
+    }
+}
+
+struct fs_config_handle* fs_config_load(const char* target_out_path) {
+    auto handle = new fs_config_handle;
+    for (int dir = 0; dir < 2; dir++) {
+        fs_config_table* table = &handle->tables[dir];
+
+        // Override files first, in the order fs_config() reads them.
+        for (size_t which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
+            int fd = fs_config_open(dir, which, target_out_path);
+            if (fd < 0) continue;
+
+            struct fs_path_config_from_file header;
+            std::string prefix;
+            while (fs_config_read_entry(fd, conf[which][dir], &header, &prefix)) {
+                fs_config_add_rule(table, dir, prefix.c_str(), header.mode, header.uid,
+                                   header.gid, header.capabilities);
+            }
+            close(fd);
+        }
+
+        const struct fs_path_config* pc;
+        for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
+            fs_config_add_rule(table, dir, pc->prefix, pc->mode, pc->uid, pc->gid,
+                               pc->capabilities);
+        }
+        table->fallback = {"", true, pc->mode, pc->uid, pc->gid, pc->capabilities};
+
+        fs_config_build_index(table);
+    }
+    return handle;
+}
+
+void fs_config_lookup(const struct fs_config_handle* handle, const char* path, int dir,
+                      unsigned* uid, unsigned* gid, unsigned* mode, uint64_t* capabilities) {
+    const fs_config_table& table = handle->tables[dir ? 1 : 0];
+
+    if (path[0] == '/') {
+        path++;
+    }
+    std::string input(path);
+    if (dir && !EndsWith(input, "/")) {
+        input.append("/");
+    }
+
+    size_t best = table.rules.size();
+    fs_config_find_rule(table, input, &best);
+    for (auto& logical_partition : kLogicalPartitions) {
+        if (StartsWith(input, logical_partition)) {
+            std::string input_in_partition = input.substr(input.find('/') + 1);
+            if (!is_partition(input_in_partition)) continue;
+            fs_config_find_rule(table, input_in_partition, &best);
+        }
+    }
+
+    const fs_config_rule& rule = best < table.rules.size() ? table.rules[best] : table.fallback;
+    *uid = rule.uid;
+    *gid = rule.gid;
+    *mode = (*mode & (~07777)) | rule.mode;
+    *capabilities = rule.capabilities;
+}
+
+void fs_config_free(struct fs_config_handle* handle) {
+    delete handle;
+}
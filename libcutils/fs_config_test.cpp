@@ -15,8 +15,11 @@
  */
 
 #include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -25,6 +28,7 @@
 #include <android-base/strings.h>
 
 #include <private/android_filesystem_config.h>
+#include <private/fs_config.h>
 
 #include "fs_config.h"
 
@@ -161,6 +165,7 @@ static bool check_fs_config_cmp(const fs_config_cmp_test* tests) {
     return retval;
 }
 
+#define ALIGN(x, alignment) (((x) + ((alignment)-1)) & ~((alignment)-1))
 #define endof(pointer, field) (offsetof(typeof(*(pointer)), field) + sizeof((pointer)->field))
 
 static bool check_unique(const std::string& config, const std::string& prefix) {
@@ -258,3 +263,98 @@ TEST(fs_config, odm_files_alias) {
 TEST(fs_config, system_alias) {
     EXPECT_FALSE(check_fs_config_cmp(fs_config_cmp_tests));
 }
+
+static std::string override_entry(uint16_t mode, uint16_t uid, uint16_t gid, uint64_t capabilities,
+                                  const std::string& prefix) {
+    size_t len = ALIGN(sizeof(fs_path_config_from_file) + prefix.size() + 1, sizeof(uint64_t));
+    std::string entry(len, '\0');
+    auto pc = reinterpret_cast<fs_path_config_from_file*>(entry.data());
+    pc->len = len;
+    pc->mode = mode;
+    pc->uid = uid;
+    pc->gid = gid;
+    pc->capabilities = capabilities;
+    memcpy(pc->prefix, prefix.c_str(), prefix.size());
+    return entry;
+}
+
+// Every path a rule of the built-in tables or of the overrides below was written for, with the
+// wildcards filled in, plus some that no specific rule covers.
+static std::vector<std::string> lookup_test_paths() {
+    std::vector<std::string> paths = {
+            "",
+            "system",
+            "system/bin/sh",
+            "/system/bin/sh",
+            "system/vendor/bin/wifi",
+            "vendor/odm/bin/wifi",
+            "vendor/odm/lib/hw/x.so",
+            "odm/bin/wifi",
+            "product/app/Foo/Foo.apk",
+            "system/product/app/Foo/Foo.apk",
+            "data/local/tmp/x",
+            "override/exact",
+            "override/exact2",
+            "override/glob/a/b",
+            "system/vendor/override/glob/a",
+            "nowhere/at/all",
+    };
+    for (const fs_path_config* configs :
+         {__for_testing_only__android_dirs, __for_testing_only__android_files}) {
+        for (const fs_path_config* pc = configs; pc->prefix; ++pc) {
+            std::string path = android::base::StringReplace(pc->prefix, "*", "x", true);
+            paths.push_back(path);
+            paths.push_back(path + "/y");
+            paths.push_back("system/" + path);
+        }
+    }
+    return paths;
+}
+
+TEST(fs_config, lookup_matches_fs_config) {
+    TemporaryDir out;
+    std::string etc = std::string(out.path) + "/system/etc";
+    ASSERT_EQ(0, mkdir((std::string(out.path) + "/system").c_str(), 0755));
+    ASSERT_EQ(0, mkdir(etc.c_str(), 0755));
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            override_entry(0600, AID_SYSTEM, AID_SYSTEM, 0, "override/exact") +
+                    override_entry(0640, AID_SHELL, AID_SHELL, 1, "override/glob/*") +
+                    override_entry(0750, AID_ROOT, AID_SHELL, 0, "vendor/override/*") +
+                    override_entry(0700, AID_ROOT, AID_ROOT, 0, "system/bin/sh"),
+            etc + "/fs_config_files"));
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            override_entry(0700, AID_SYSTEM, AID_SHELL, 0, "override") +
+                    override_entry(0750, AID_SHELL, AID_SYSTEM, 0, "vendor/odm/lib/"),
+            etc + "/fs_config_dirs"));
+    std::string target_out_path = std::string(out.path) + "/system";
+
+    fs_config_handle* handle = fs_config_load(target_out_path.c_str());
+    ASSERT_NE(nullptr, handle);
+    for (const std::string& path : lookup_test_paths()) {
+        for (int dir = 0; dir < 2; ++dir) {
+            unsigned uid = 0, gid = 0, mode = 0100000;
+            uint64_t capabilities = 0;
+            fs_config(path.c_str(), dir, target_out_path.c_str(), &uid, &gid, &mode,
+                      &capabilities);
+
+            unsigned lookup_uid = 0, lookup_gid = 0, lookup_mode = 0100000;
+            uint64_t lookup_capabilities = 0;
+            fs_config_lookup(handle, path.c_str(), dir, &lookup_uid, &lookup_gid, &lookup_mode,
+                             &lookup_capabilities);
+
+            EXPECT_EQ(uid, lookup_uid) << path << " dir=" << dir;
+            EXPECT_EQ(gid, lookup_gid) << path << " dir=" << dir;
+            EXPECT_EQ(mode, lookup_mode) << path << " dir=" << dir;
+            EXPECT_EQ(capabilities, lookup_capabilities) << path << " dir=" << dir;
+        }
+    }
+
+    // Make sure the overrides were seen at all.
+    unsigned uid, gid, mode = 0;
+    uint64_t capabilities;
+    fs_config_lookup(handle, "system/vendor/override/x", false, &uid, &gid, &mode, &capabilities);
+    EXPECT_EQ(0750u, mode);
+    fs_config_lookup(handle, "system/bin/sh", false, &uid, &gid, &mode, &capabilities);
+    EXPECT_EQ(0700u, mode);
+    fs_config_free(handle);
+}
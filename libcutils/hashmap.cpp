@@ -19,27 +19,92 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
-typedef struct Entry Entry;
-struct Entry {
+/*
+ * Open addressing. Entries live in the slot array itself, so a put does not allocate unless the
+ * table grows. Next to the slots is one control byte per slot, holding 7 bits of the entry's hash
+ * or marking the slot empty or deleted. Lookups scan the control bytes of a group of slots at a
+ * time and only look at slots whose byte matches, so a probe rarely touches a slot that does not
+ * hold the key. Removed entries leave a tombstone behind, which keeps removing entries from a
+ * hashmapForEach() callback safe.
+ *
+ * Growing is incremental: the old table is kept next to the new one and every put or get moves
+ * a few of its slots over, so no single put pays for rehashing the whole map.
+ */
+
+typedef struct Slot Slot;
+struct Slot {
     void* key;
-    int hash;
     void* value;
-    Entry* next;
+    int hash;
+};
+
+// Control bytes. Full slots have the low 7 bits of their hash, so the top bit tells them apart.
+static const uint8_t kCtrlEmpty = 0x80;
+static const uint8_t kCtrlDeleted = 0xfe;
+
+// Slots whose control bytes are scanned together, as one 64-bit word.
+static const size_t kGroupWidth = 8;
+static const uint64_t kLsbs = 0x0101010101010101ull;
+static const uint64_t kMsbs = 0x8080808080808080ull;
+
+static const size_t kNotFound = SIZE_MAX;
+
+typedef struct Table Table;
+struct Table {
+    uint8_t* ctrl;
+    Slot* slots;      // In the same allocation as ctrl.
+    size_t capacity;  // A power of 2 no smaller than kGroupWidth, or 0 for no table.
+    size_t size;      // Full slots.
+    size_t used;      // Full and deleted slots.
 };
 
+// Old slots moved to the new table by each put or get while growing. The new table has room
+// for at least a quarter of its capacity in puts before it fills up, and this finishes the move
+// in a quarter of the old capacity.
+static const size_t kMigrationStep = 4;
+
 struct Hashmap {
-    Entry** buckets;
-    size_t bucketCount;
+    Table table;
+    // The table being emptied into |table| while growing; its slots below |migrated| are done.
+    Table old;
+    size_t migrated;
+    // Nesting depth of hashmapForEach() calls, which must not see slots move.
+    size_t iterating;
     int (*hash)(void* key);
     bool (*equals)(void* keyA, void* keyB);
     pthread_mutex_t lock;
-    size_t size;
 };
 
+// 0.75 load factor, counting tombstones.
+static inline size_t maxUsed(size_t capacity) {
+    return capacity * 3 / 4;
+}
+
+static bool initTable(Table* table, size_t capacity) {
+    // Slots first, so they stay pointer aligned.
+    uint8_t* memory = static_cast<uint8_t*>(malloc(capacity * (sizeof(Slot) + 1)));
+    if (memory == NULL) {
+        return false;
+    }
+    table->slots = reinterpret_cast<Slot*>(memory);
+    table->ctrl = memory + capacity * sizeof(Slot);
+    memset(table->ctrl, kCtrlEmpty, capacity);
+    table->capacity = capacity;
+    table->size = 0;
+    table->used = 0;
+    return true;
+}
+
+static void freeTable(Table* table) {
+    free(table->slots);
+    *table = Table{};
+}
+
 Hashmap* hashmapCreate(size_t initialCapacity,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
     assert(hash != NULL);
@@ -51,20 +116,20 @@ Hashmap* hashmapCreate(size_t initialCapacity,
     }
 
     // 0.75 load factor.
-    size_t minimumBucketCount = initialCapacity * 4 / 3;
-    map->bucketCount = 1;
-    while (map->bucketCount <= minimumBucketCount) {
-        // Bucket count must be power of 2.
-        map->bucketCount <<= 1;
+    size_t minimumCapacity = initialCapacity * 4 / 3;
+    size_t capacity = kGroupWidth;
+    while (capacity <= minimumCapacity) {
+        // Capacity must be power of 2.
+        capacity <<= 1;
     }
 
-    map->buckets = static_cast<Entry**>(calloc(map->bucketCount, sizeof(Entry*)));
-    if (map->buckets == NULL) {
+    if (!initTable(&map->table, capacity)) {
         free(map);
         return NULL;
     }
-
-    map->size = 0;
+    map->old = Table{};
+    map->migrated = 0;
+    map->iterating = 0;
 
     map->hash = hash;
     map->equals = equals;
@@ -93,39 +158,172 @@ static inline int hashKey(Hashmap* map, void* key) {
     return h;
 }
 
-static inline size_t calculateIndex(size_t bucketCount, int hash) {
-    return ((size_t) hash) & (bucketCount - 1);
+// The control byte of a full slot: the bits of the hash not used to pick its group.
+static inline uint8_t ctrlForHash(int hash) {
+    return ((unsigned int) hash) & 0x7f;
 }
 
-static void expandIfNecessary(Hashmap* map) {
-    // If the load factor exceeds 0.75...
-    if (map->size > (map->bucketCount * 3 / 4)) {
-        // Start off with a 0.33 load factor.
-        size_t newBucketCount = map->bucketCount << 1;
-        Entry** newBuckets = static_cast<Entry**>(calloc(newBucketCount, sizeof(Entry*)));
-        if (newBuckets == NULL) {
-            // Abort expansion.
-            return;
-        }
+// The first group to probe.
+static inline size_t calculateGroup(size_t capacity, int hash) {
+    return (((unsigned int) hash) >> 7) & (capacity / kGroupWidth - 1);
+}
+
+static inline uint64_t loadGroup(const uint8_t* ctrl) {
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof(group));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group);
+#endif
+    return group;
+}
+
+// Sets the top bit of each byte of |group| equal to |ctrl|. May also set it for bytes after
+// one that does, which callers check against the control byte itself.
+static inline uint64_t matchCtrl(uint64_t group, uint8_t ctrl) {
+    uint64_t x = group ^ (kLsbs * ctrl);
+    return (x - kLsbs) & ~x & kMsbs;
+}
+
+// Sets the top bit of each empty byte of |group|: those with the top bit set and bit 1 clear.
+static inline uint64_t matchEmpty(uint64_t group) {
+    return group & ~(group << 6) & kMsbs;
+}
+
+// Sets the top bit of each empty or deleted byte of |group|.
+static inline uint64_t matchFree(uint64_t group) {
+    return group & kMsbs;
+}
+
+static inline size_t lowestMatch(uint64_t mask) {
+    return __builtin_ctzll(mask) / 8;
+}
 
-        // Move over existing entries.
-        size_t i;
-        for (i = 0; i < map->bucketCount; i++) {
-            Entry* entry = map->buckets[i];
-            while (entry != NULL) {
-                Entry* next = entry->next;
-                size_t index = calculateIndex(newBucketCount, entry->hash);
-                entry->next = newBuckets[index];
-                newBuckets[index] = entry;
-                entry = next;
+/**
+ * Returns the index of the slot holding |key| in |table|, or kNotFound. If |freeIndex| is
+ * given, it is set to the slot a new entry for |key| should go in: the first tombstone or empty
+ * slot of the probe.
+ */
+static size_t findSlot(const Table* table, void* key, int hash, bool (*equals)(void*, void*),
+        size_t* freeIndex) {
+    if (freeIndex != NULL) {
+        *freeIndex = kNotFound;
+    }
+    if (table->capacity == 0) {
+        return kNotFound;
+    }
+
+    const uint8_t ctrl = ctrlForHash(hash);
+    const size_t groupMask = table->capacity / kGroupWidth - 1;
+    size_t g = calculateGroup(table->capacity, hash);
+    for (size_t probes = 0; probes <= groupMask; probes++, g = (g + 1) & groupMask) {
+        const size_t base = g * kGroupWidth;
+        const uint64_t group = loadGroup(&table->ctrl[base]);
+        for (uint64_t match = matchCtrl(group, ctrl); match != 0; match &= match - 1) {
+            size_t index = base + lowestMatch(match);
+            const Slot* slot = &table->slots[index];
+            if (table->ctrl[index] != ctrl) {
+                continue;
+            }
+            if (slot->key == key || (slot->hash == hash && equals(slot->key, key))) {
+                return index;
             }
         }
+        if (freeIndex != NULL && *freeIndex == kNotFound) {
+            uint64_t free = matchFree(group);
+            if (free != 0) {
+                *freeIndex = base + lowestMatch(free);
+            }
+        }
+        // A key is never put past a group with an empty slot in it.
+        if (matchEmpty(group) != 0) {
+            break;
+        }
+    }
+    return kNotFound;
+}
 
-        // Copy over internals.
-        free(map->buckets);
-        map->buckets = newBuckets;
-        map->bucketCount = newBucketCount;
+/**
+ * Returns the index a new entry with |hash| should go in, for a key known not to be in |table|.
+ */
+static size_t findFreeSlot(const Table* table, int hash) {
+    const size_t groupMask = table->capacity / kGroupWidth - 1;
+    size_t g = calculateGroup(table->capacity, hash);
+    for (size_t probes = 0; probes <= groupMask; probes++, g = (g + 1) & groupMask) {
+        const size_t base = g * kGroupWidth;
+        uint64_t free = matchFree(loadGroup(&table->ctrl[base]));
+        if (free != 0) {
+            return base + lowestMatch(free);
+        }
     }
+    return kNotFound;
+}
+
+static void fillSlot(Table* table, size_t index, void* key, int hash, void* value) {
+    if (table->ctrl[index] == kCtrlEmpty) {
+        table->used++;
+    }
+    table->ctrl[index] = ctrlForHash(hash);
+    table->slots[index] = Slot{key, value, hash};
+    table->size++;
+}
+
+static void* removeSlot(Table* table, size_t index) {
+    void* value = table->slots[index].value;
+    table->ctrl[index] = kCtrlDeleted;
+    table->size--;
+    return value;
+}
+
+/**
+ * Moves up to |count| slots of the old table into the new one, freeing the old table once it is
+ * empty.
+ */
+static void migrate(Hashmap* map, size_t count) {
+    Table* old = &map->old;
+    while (count-- > 0 && map->migrated < old->capacity) {
+        size_t index = map->migrated++;
+        if ((old->ctrl[index] & 0x80) != 0) {
+            continue;
+        }
+        const Slot* slot = &old->slots[index];
+        fillSlot(&map->table, findFreeSlot(&map->table, slot->hash), slot->key, slot->hash,
+                 slot->value);
+        old->size--;
+    }
+    if (map->migrated == old->capacity) {
+        freeTable(old);
+        map->migrated = 0;
+    }
+}
+
+/**
+ * Starts moving the entries of the table, which is at its load factor, to a new one. Returns
+ * false if that is out of memory and the table has no room left for another entry.
+ */
+static bool growTable(Hashmap* map) {
+    Table* table = &map->table;
+
+    // Only one move at a time: finish the last one before starting another.
+    if (map->old.capacity != 0) {
+        migrate(map, map->old.capacity);
+    }
+
+    // Rehash at the same size if it is mostly tombstones we are out of room for; otherwise
+    // start off with a load factor below 0.375.
+    size_t newCapacity = table->capacity;
+    if (table->size + 1 > table->capacity / 2) {
+        newCapacity <<= 1;
+    }
+
+    Table newTable;
+    if (!initTable(&newTable, newCapacity)) {
+        // Keep going over the load factor while there is an empty slot left.
+        return table->used + 1 < table->capacity;
+    }
+    map->old = *table;
+    map->migrated = 0;
+    *table = newTable;
+    return true;
 }
 
 void hashmapLock(Hashmap* map) {
@@ -137,16 +335,8 @@ void hashmapUnlock(Hashmap* map) {
 }
 
 void hashmapFree(Hashmap* map) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry* next = entry->next;
-            free(entry);
-            entry = next;
-        }
-    }
-    free(map->buckets);
+    freeTable(&map->table);
+    freeTable(&map->old);
     pthread_mutex_destroy(&map->lock);
     free(map);
 }
@@ -166,109 +356,99 @@ int hashmapHash(void* key, size_t keySize) {
     return h;
 }
 
-static Entry* createEntry(void* key, int hash, void* value) {
-    Entry* entry = static_cast<Entry*>(malloc(sizeof(Entry)));
-    if (entry == NULL) {
-        return NULL;
-    }
-    entry->key = key;
-    entry->hash = hash;
-    entry->value = value;
-    entry->next = NULL;
-    return entry;
-}
-
-static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
-        bool (*equals)(void*, void*)) {
-    if (keyA == keyB) {
-        return true;
-    }
-    if (hashA != hashB) {
-        return false;
-    }
-    return equals(keyA, keyB);
-}
-
 void* hashmapPut(Hashmap* map, void* key, void* value) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, value);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            map->size++;
-            expandIfNecessary(map);
-            return NULL;
-        }
 
-        // Replace existing entry.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* oldValue = current->value;
-            current->value = value;
+    if (map->old.capacity != 0) {
+        migrate(map, kMigrationStep);
+
+        // Replace an existing entry that has not been moved yet.
+        size_t index = findSlot(&map->old, key, hash, map->equals, NULL);
+        if (index != kNotFound) {
+            void* oldValue = map->old.slots[index].value;
+            map->old.slots[index].value = value;
             return oldValue;
         }
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Replace existing entry.
+    size_t freeIndex;
+    size_t index = findSlot(&map->table, key, hash, map->equals, &freeIndex);
+    if (index != kNotFound) {
+        void* oldValue = map->table.slots[index].value;
+        map->table.slots[index].value = value;
+        return oldValue;
     }
+
+    // Add a new entry, reusing a tombstone as is. Taking an empty slot past the load factor
+    // grows the table first, which moves slots around, so find the free slot again after.
+    if (map->table.ctrl[freeIndex] == kCtrlEmpty &&
+            map->table.used + 1 > maxUsed(map->table.capacity)) {
+        if (!growTable(map)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        freeIndex = findFreeSlot(&map->table, hash);
+    }
+    fillSlot(&map->table, freeIndex, key, hash, value);
+    return NULL;
 }
 
 void* hashmapGet(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
 
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return entry->value;
-        }
-        entry = entry->next;
+    // Gets move old slots too, or a map that is only read after growing would keep probing two
+    // tables. Not from hashmapForEach(), though, where that would skip or repeat entries.
+    if (map->old.capacity != 0 && map->iterating == 0) {
+        migrate(map, kMigrationStep);
     }
 
+    size_t index = findSlot(&map->table, key, hash, map->equals, NULL);
+    if (index != kNotFound) {
+        return map->table.slots[index].value;
+    }
+    if (map->old.capacity != 0) {
+        index = findSlot(&map->old, key, hash, map->equals, NULL);
+        if (index != kNotFound) {
+            return map->old.slots[index].value;
+        }
+    }
     return NULL;
 }
 
 void* hashmapRemove(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    // Pointer to the current entry.
-    Entry** p = &(map->buckets[index]);
-    Entry* current;
-    while ((current = *p) != NULL) {
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* value = current->value;
-            *p = current->next;
-            free(current);
-            map->size--;
-            return value;
-        }
 
-        p = &current->next;
+    // This does not move any old slots, so that it is safe from hashmapForEach().
+    size_t index = findSlot(&map->table, key, hash, map->equals, NULL);
+    if (index != kNotFound) {
+        return removeSlot(&map->table, index);
+    }
+    if (map->old.capacity != 0) {
+        index = findSlot(&map->old, key, hash, map->equals, NULL);
+        if (index != kNotFound) {
+            return removeSlot(&map->old, index);
+        }
     }
-
     return NULL;
 }
 
+static bool forEachSlot(Table* table, size_t start,
+        bool (*callback)(void* key, void* value, void* context), void* context) {
+    for (size_t i = start; i < table->capacity; i++) {
+        if ((table->ctrl[i] & 0x80) == 0 &&
+                !callback(table->slots[i].key, table->slots[i].value, context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void hashmapForEach(Hashmap* map, bool (*callback)(void* key, void* value, void* context),
                     void* context) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry *next = entry->next;
-            if (!callback(entry->key, entry->value, context)) {
-                return;
-            }
-            entry = next;
-        }
+    map->iterating++;
+    if (forEachSlot(&map->old, map->migrated, callback, context)) {
+        forEachSlot(&map->table, 0, callback, context);
     }
+    map->iterating--;
 }
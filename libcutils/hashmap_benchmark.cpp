@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+// String keys hashed and compared the way str_parms does it.
+int StrHash(void* key) {
+    return hashmapHash(key, strlen(static_cast<char*>(key)));
+}
+
+bool StrEquals(void* keyA, void* keyB) {
+    return strcmp(static_cast<char*>(keyA), static_cast<char*>(keyB)) == 0;
+}
+
+std::vector<std::string> MakeKeys(size_t count, const char* prefix) {
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        keys.push_back(prefix + std::to_string(i));
+    }
+    return keys;
+}
+
+Hashmap* MakeMap(std::vector<std::string>& keys) {
+    Hashmap* map = hashmapCreate(0, StrHash, StrEquals);
+    for (auto& key : keys) {
+        hashmapPut(map, key.data(), key.data());
+    }
+    return map;
+}
+
+}  // namespace
+
+static void BM_hashmap_put(benchmark::State& state) {
+    std::vector<std::string> keys = MakeKeys(state.range(0), "key");
+    for (auto _ : state) {
+        Hashmap* map = MakeMap(keys);
+        hashmapFree(map);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_hashmap_put)->RangeMultiplier(8)->Range(8, 32768);
+
+static void BM_hashmap_get_hit(benchmark::State& state) {
+    std::vector<std::string> keys = MakeKeys(state.range(0), "key");
+    Hashmap* map = MakeMap(keys);
+    for (auto _ : state) {
+        for (auto& key : keys) {
+            benchmark::DoNotOptimize(hashmapGet(map, key.data()));
+        }
+    }
+    hashmapFree(map);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_hashmap_get_hit)->RangeMultiplier(8)->Range(8, 32768);
+
+static void BM_hashmap_get_miss(benchmark::State& state) {
+    std::vector<std::string> keys = MakeKeys(state.range(0), "key");
+    std::vector<std::string> missing = MakeKeys(state.range(0), "missing");
+    Hashmap* map = MakeMap(keys);
+    for (auto _ : state) {
+        for (auto& key : missing) {
+            benchmark::DoNotOptimize(hashmapGet(map, key.data()));
+        }
+    }
+    hashmapFree(map);
+    state.SetItemsProcessed(state.iterations() * missing.size());
+}
+BENCHMARK(BM_hashmap_get_miss)->RangeMultiplier(8)->Range(8, 32768);
+
+// Removes and re-adds every key, the pattern of str_parms_add_str() on existing keys.
+static void BM_hashmap_remove_put(benchmark::State& state) {
+    std::vector<std::string> keys = MakeKeys(state.range(0), "key");
+    Hashmap* map = MakeMap(keys);
+    for (auto _ : state) {
+        for (auto& key : keys) {
+            hashmapRemove(map, key.data());
+            hashmapPut(map, key.data(), key.data());
+        }
+    }
+    hashmapFree(map);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_hashmap_remove_put)->RangeMultiplier(8)->Range(8, 32768);
+
+static bool CountEntry(void*, void*, void* context) {
+    (*static_cast<size_t*>(context))++;
+    return true;
+}
+
+static void BM_hashmap_foreach(benchmark::State& state) {
+    std::vector<std::string> keys = MakeKeys(state.range(0), "key");
+    Hashmap* map = MakeMap(keys);
+    for (auto _ : state) {
+        size_t count = 0;
+        hashmapForEach(map, CountEntry, &count);
+        benchmark::DoNotOptimize(count);
+    }
+    hashmapFree(map);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_hashmap_foreach)->RangeMultiplier(8)->Range(8, 32768);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+
+#include <stdint.h>
+
+#include <map>
+
+#include <gtest/gtest.h>
+
+// Keys and values are small integers cast to pointers, so that tests need no storage.
+static void* P(uintptr_t i) {
+    return reinterpret_cast<void*>(i);
+}
+
+static int IntHash(void* key) {
+    return static_cast<int>(reinterpret_cast<uintptr_t>(key));
+}
+
+// Every key in the same probe sequence.
+static int CollidingHash(void*) {
+    return 42;
+}
+
+static bool IntEquals(void* keyA, void* keyB) {
+    return keyA == keyB;
+}
+
+static bool Collect(void* key, void* value, void* context) {
+    auto* entries = static_cast<std::map<uintptr_t, uintptr_t>*>(context);
+    EXPECT_TRUE(entries->emplace(reinterpret_cast<uintptr_t>(key),
+                                 reinterpret_cast<uintptr_t>(value)).second);
+    return true;
+}
+
+static std::map<uintptr_t, uintptr_t> Entries(Hashmap* map) {
+    std::map<uintptr_t, uintptr_t> entries;
+    hashmapForEach(map, Collect, &entries);
+    return entries;
+}
+
+TEST(hashmap, put_get_remove) {
+    Hashmap* map = hashmapCreate(0, IntHash, IntEquals);
+    ASSERT_NE(nullptr, map);
+
+    EXPECT_EQ(nullptr, hashmapPut(map, P(1), P(10)));
+    EXPECT_EQ(nullptr, hashmapPut(map, P(2), P(20)));
+    EXPECT_EQ(P(10), hashmapGet(map, P(1)));
+    EXPECT_EQ(P(20), hashmapGet(map, P(2)));
+    EXPECT_EQ(nullptr, hashmapGet(map, P(3)));
+
+    EXPECT_EQ(P(10), hashmapPut(map, P(1), P(11)));
+    EXPECT_EQ(P(11), hashmapGet(map, P(1)));
+
+    EXPECT_EQ(P(11), hashmapRemove(map, P(1)));
+    EXPECT_EQ(nullptr, hashmapGet(map, P(1)));
+    EXPECT_EQ(nullptr, hashmapRemove(map, P(1)));
+    EXPECT_EQ(P(20), hashmapGet(map, P(2)));
+
+    hashmapFree(map);
+}
+
+// Checks every entry before, during and after the map grows, with every key colliding or not.
+static void CheckGrowth(int (*hash)(void*), size_t count) {
+    Hashmap* map = hashmapCreate(0, hash, IntEquals);
+    ASSERT_NE(nullptr, map);
+
+    std::map<uintptr_t, uintptr_t> expected;
+    for (uintptr_t i = 1; i <= count; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, P(i), P(i * 10)));
+        expected[i] = i * 10;
+        // Entries put before the last growth started have to be found wherever they are.
+        ASSERT_EQ(P(i / 2 * 10), hashmapGet(map, P(i / 2)));
+    }
+    EXPECT_EQ(expected, Entries(map));
+
+    // Remove every other entry, then put them back with new values.
+    for (uintptr_t i = 1; i <= count; i += 2) {
+        ASSERT_EQ(P(i * 10), hashmapRemove(map, P(i)));
+        expected.erase(i);
+    }
+    EXPECT_EQ(expected, Entries(map));
+    for (uintptr_t i = 1; i <= count; i += 2) {
+        ASSERT_EQ(nullptr, hashmapPut(map, P(i), P(i)));
+        expected[i] = i;
+    }
+    EXPECT_EQ(expected, Entries(map));
+
+    hashmapFree(map);
+}
+
+TEST(hashmap, grow) {
+    CheckGrowth(IntHash, 10000);
+}
+
+TEST(hashmap, grow_colliding) {
+    CheckGrowth(CollidingHash, 300);
+}
+
+// Lots of removes and puts of new keys in a map that never grows: tombstones must not fill it.
+TEST(hashmap, churn) {
+    Hashmap* map = hashmapCreate(8, IntHash, IntEquals);
+    ASSERT_NE(nullptr, map);
+    for (uintptr_t i = 1; i <= 100000; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, P(i), P(i)));
+        if (i > 4) {
+            ASSERT_EQ(P(i - 4), hashmapRemove(map, P(i - 4)));
+        }
+    }
+    EXPECT_EQ(4u, Entries(map).size());
+    hashmapFree(map);
+}
+
+static bool RemoveEntry(void* key, void* value, void* context) {
+    EXPECT_EQ(value, hashmapRemove(static_cast<Hashmap*>(context), key));
+    return true;
+}
+
+// str_parms empties maps this way.
+TEST(hashmap, remove_in_for_each) {
+    Hashmap* map = hashmapCreate(0, IntHash, IntEquals);
+    ASSERT_NE(nullptr, map);
+    for (uintptr_t i = 1; i <= 1000; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, P(i), P(i)));
+    }
+    hashmapForEach(map, RemoveEntry, map);
+    EXPECT_TRUE(Entries(map).empty());
+    hashmapFree(map);
+}
+
+static bool StopAfterOne(void*, void*, void* context) {
+    (*static_cast<int*>(context))++;
+    return false;
+}
+
+TEST(hashmap, for_each_stops) {
+    Hashmap* map = hashmapCreate(0, IntHash, IntEquals);
+    ASSERT_NE(nullptr, map);
+    for (uintptr_t i = 1; i <= 10; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, P(i), P(i)));
+    }
+    int calls = 0;
+    hashmapForEach(map, StopAfterOne, &calls);
+    EXPECT_EQ(1, calls);
+    hashmapFree(map);
+}
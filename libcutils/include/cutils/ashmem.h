@@ -17,6 +17,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 #if defined(__BIONIC__)
 #include <linux/ashmem.h>
@@ -33,6 +34,42 @@ int ashmem_pin_region(int fd, size_t offset, size_t len);
 int ashmem_unpin_region(int fd, size_t offset, size_t len);
 int ashmem_get_size_region(int fd);
 
+/*
+ * A pool of regions for processes that create and drop short-lived shared
+ * buffers at a high rate. Regions come in power-of-two page counts and are
+ * mapped read-write by the pool. A released region has its pages freed and
+ * is handed out again, zeroed, by a later acquire of the same size class.
+ *
+ * Only release a region once no other process uses it anymore: the pool
+ * cannot tell whether the peer it was sent to still has it mapped. Regions
+ * that have been sealed, e.g. by ashmem_set_prot_region(), are closed on
+ * release instead of being reused.
+ */
+struct ashmem_pool;
+
+struct ashmem_pool_stats {
+    uint64_t hits;         /* acquires served from the pool */
+    uint64_t misses;       /* acquires that created a region */
+    uint64_t recycled;     /* releases kept for reuse */
+    uint64_t discarded;    /* releases closed: sealed, too big, or the class was full */
+    size_t idle_regions;   /* regions waiting for reuse */
+    size_t idle_size;      /* their total size, in address space; their pages are freed */
+};
+
+/* Keeps at most `max_idle_per_class' released regions of each size class. */
+struct ashmem_pool *ashmem_pool_create(const char *name, size_t max_idle_per_class);
+/* Closes every region of the pool, including any still acquired. */
+void ashmem_pool_destroy(struct ashmem_pool *pool);
+/*
+ * Returns the fd of a zeroed region of at least `size' bytes, or -1, and
+ * sets `*addr', if not NULL, to the pool's read-write mapping of it. Do not
+ * close the fd or unmap the mapping; release the region instead.
+ */
+int ashmem_pool_acquire(struct ashmem_pool *pool, size_t size, void **addr);
+/* Returns an acquired region to the pool. Returns -1 with errno EBADF if `fd' is not one. */
+int ashmem_pool_release(struct ashmem_pool *pool, int fd);
+void ashmem_pool_get_stats(struct ashmem_pool *pool, struct ashmem_pool_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
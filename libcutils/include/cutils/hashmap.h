@@ -78,7 +78,8 @@ void* hashmapRemove(Hashmap* map, void* key);
 
 /**
  * Invokes the given callback on each entry in the map. Stops iterating if
- * the callback returns false.
+ * the callback returns false. The callback may remove entries from the map,
+ * but must not put any.
  */
 void hashmapForEach(Hashmap* map, bool (*callback)(void* key, void* value, void* context),
                     void* context);
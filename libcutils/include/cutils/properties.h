@@ -19,6 +19,7 @@
 #include <sys/cdefs.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 #if __has_include(<sys/system_properties.h>)
 #include <sys/system_properties.h>
@@ -112,6 +113,62 @@ int property_set(const char *key, const char *value);
 
 int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);
 
+/* property_list_prefix: like property_list, but only calls propfn for the
+** properties whose key starts with prefix.
+*/
+int property_list_prefix(const char* prefix,
+                         void (*propfn)(const char* key, const char* value, void* cookie),
+                         void* cookie);
+
+struct property_snapshot_entry {
+    const char* key;
+    char value[PROPERTY_VALUE_MAX];
+    int8_t changed;
+
+    /* Private to property_snapshot_update. */
+    uint32_t serial;
+    const void* info;
+};
+
+struct property_snapshot {
+    struct property_snapshot_entry* entries;
+    size_t count;
+
+    /* Private to property_snapshot_update. */
+    uint32_t area_serial;
+    int8_t valid;
+};
+
+/* property_snapshot_update: reads a set of properties in one pass, for
+** callers that poll many properties. Returns the number of entries whose
+** value changed since the previous call; every entry counts as changed on
+** the first call.
+**
+** The caller zero-initializes the snapshot and its entries, then fills in
+** entries, count and the key of each entry. Each call sets value (like
+** property_get with an empty default) and changed of every entry.
+**
+** Only the properties whose serial moved are copied, and nothing is read
+** at all if no property was set since the previous call. If a property is
+** set during the pass, the pass is repeated, so the values are consistent
+** with each other as long as properties are not being set continuously.
+*/
+int property_snapshot_update(struct property_snapshot* snapshot);
+
+/* property_snapshot_wait: blocks until a property of the snapshot is set,
+** or until relative_timeout passes if it is not NULL, then updates the
+** snapshot like property_snapshot_update. Returns the number of entries
+** whose value changed, 0 on timeout, or -errno. A snapshot that was never
+** updated is updated and returned right away.
+**
+** Only the snapshot's own properties wake the caller, unlike waiting on
+** the global property serial, which wakes on every property set in the
+** system. While any of the properties does not exist yet, or on kernels
+** without futex_waitv, it falls back to waking on every property set.
+*/
+int property_snapshot_wait(struct property_snapshot* snapshot,
+                           const struct timespec* relative_timeout);
+
 #if defined(__BIONIC_FORTIFY)
 #define __property_get_err_str "property_get() called with too small of a buffer"
 
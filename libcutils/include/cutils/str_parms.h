@@ -17,6 +17,7 @@
 #ifndef __CUTILS_STR_PARMS_H
 #define __CUTILS_STR_PARMS_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
 
@@ -55,6 +56,42 @@ char *str_parms_to_str(struct str_parms *str_parms);
 /* debug */
 void str_parms_dump(struct str_parms *str_parms);
 
+/*
+ * Allocation-free parsing, for callers on latency-sensitive paths that parse
+ * a parameter string, look a few keys up, and throw it away. Keys and values
+ * are spans into the caller's buffer, which must outlive them; they are not
+ * NUL-terminated.
+ */
+
+struct str_parms_span {
+    const char *data;
+    size_t len;
+};
+
+struct str_parms_pair {
+    struct str_parms_span key;
+    struct str_parms_span value;
+};
+
+// Parses the 'len' bytes at 'str' the way str_parms_create_str() does, into at
+// most 'max_pairs' pairs. A key seen again replaces the value of its first
+// pair, so pairs are unique and in the order their keys first appear.
+// Returns the number of pairs, or -ENOSPC if there were more than 'max_pairs'
+// (the first 'max_pairs' are still filled in).
+int str_parms_parse(const char *str, size_t len, struct str_parms_pair *pairs,
+                    size_t max_pairs);
+
+// Returns the pair with the given NUL-terminated key, or NULL. Lookup is
+// linear, which beats hashing for the handful of pairs parameter strings hold.
+const struct str_parms_pair *str_parms_find(const struct str_parms_pair *pairs,
+                                            size_t count, const char *key);
+
+// Writes the pairs as "key=value;key=value" into 'buf', truncating and always
+// NUL-terminating if 'size' is non-zero. Returns the length of the whole
+// string, not counting the NUL, like snprintf().
+size_t str_parms_format(const struct str_parms_pair *pairs, size_t count,
+                        char *buf, size_t size);
+
 __END_DECLS
 
 #endif /* __CUTILS_STR_PARMS_H */
@@ -89,6 +89,18 @@ __BEGIN_DECLS
 #error ATRACE_TAG must be defined to be one of the tags defined in cutils/trace.h
 #endif
 
+/**
+ * The ATRACE_COMPILED_TAGS macro can be defined before including this header
+ * to the set of tags that may ever be traced from the including code.  Trace
+ * calls for any other tag given as a constant, including ATRACE_TAG_NEVER, are
+ * compiled out entirely instead of checking the enabled tags at run time.
+ * For example a module that only ever wants its graphics traces in a build:
+ * #define ATRACE_COMPILED_TAGS  ATRACE_TAG_GRAPHICS
+ */
+#ifndef ATRACE_COMPILED_TAGS
+#define ATRACE_COMPILED_TAGS ATRACE_TAG_VALID_MASK
+#endif
+
 /**
  * Opens the trace file for writing and reads the property for initial tags.
  * The atrace.tags.enableflags property sets the tags to trace.
@@ -148,6 +160,9 @@ uint64_t atrace_get_enabled_tags();
 #define ATRACE_ENABLED() atrace_is_tag_enabled(ATRACE_TAG)
 static inline uint64_t atrace_is_tag_enabled(uint64_t tag)
 {
+    if ((tag & ATRACE_COMPILED_TAGS) == 0) {
+        return 0;
+    }
     return atrace_get_enabled_tags() & tag;
 }
 
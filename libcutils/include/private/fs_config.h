@@ -47,4 +47,17 @@ __BEGIN_DECLS
 void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
                unsigned* mode, uint64_t* capabilities);
 
+/*
+ * fs_config() reads the partition override files again on every call. Tools that look up
+ * many paths load the configuration once instead: fs_config_lookup() gives the same answers
+ * as fs_config() with the same target_out_path, without touching the file system and
+ * without trying every rule in turn.
+ */
+struct fs_config_handle;
+
+struct fs_config_handle* fs_config_load(const char* target_out_path);
+void fs_config_lookup(const struct fs_config_handle* handle, const char* path, int dir,
+                      unsigned* uid, unsigned* gid, unsigned* mode, uint64_t* capabilities);
+void fs_config_free(struct fs_config_handle* handle);
+
 __END_DECLS
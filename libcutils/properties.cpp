@@ -95,6 +95,10 @@ int property_get(const char* key, char* value, const char* default_value) {
 
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include <atomic>
 
 struct callback_data {
     void (*callback)(const char* name, const char* value, void* cookie);
@@ -115,4 +119,174 @@ int property_list(void (*fn)(const char* name, const char* value, void* cookie),
     return __system_property_foreach(property_list_callback, &data);
 }
 
+struct prefix_callback_data {
+    const char* prefix;
+    size_t prefix_length;
+    callback_data data;
+};
+
+static void prefix_trampoline(void* raw_data, const char* name, const char* value,
+                              unsigned serial) {
+    prefix_callback_data* data = reinterpret_cast<prefix_callback_data*>(raw_data);
+    if (strncmp(name, data->prefix, data->prefix_length) == 0) {
+        trampoline(&data->data, name, value, serial);
+    }
+}
+
+static void property_list_prefix_callback(const prop_info* pi, void* data) {
+    __system_property_read_callback(pi, prefix_trampoline, data);
+}
+
+int property_list_prefix(const char* prefix,
+                         void (*fn)(const char* name, const char* value, void* cookie),
+                         void* cookie) {
+    prefix_callback_data data = {prefix, strlen(prefix), {fn, cookie}};
+    return __system_property_foreach(property_list_prefix_callback, &data);
+}
+
+static void snapshot_callback(void* raw_entry, const char* /*name*/, const char* value,
+                              unsigned serial) {
+    property_snapshot_entry* entry = reinterpret_cast<property_snapshot_entry*>(raw_entry);
+    snprintf(entry->value, PROPERTY_VALUE_MAX, "%s", value);
+    entry->serial = serial;
+}
+
+// Returns whether the entry's value changed.
+static bool snapshot_entry(property_snapshot_entry* entry) {
+    // Properties are never removed, so a prop_info stays valid once found.
+    const prop_info* pi = static_cast<const prop_info*>(entry->info);
+    if (!pi) {
+        pi = __system_property_find(entry->key);
+        if (!pi) return false;
+        entry->info = pi;
+    } else if (__system_property_serial(pi) == entry->serial) {
+        return false;
+    }
+
+    char old_value[PROPERTY_VALUE_MAX];
+    memcpy(old_value, entry->value, sizeof(old_value));
+    __system_property_read_callback(pi, snapshot_callback, entry);
+    return strcmp(old_value, entry->value) != 0;
+}
+
+int property_snapshot_update(property_snapshot* snapshot) {
+    if (!snapshot || (!snapshot->entries && snapshot->count)) return -EINVAL;
+
+    for (size_t i = 0; i < snapshot->count; ++i) {
+        snapshot->entries[i].changed = !snapshot->valid;
+    }
+
+    // Like a seqlock reader: start over if a property was set while reading.
+    static constexpr int kMaxPasses = 4;
+    for (int pass = 0; pass < kMaxPasses; ++pass) {
+        uint32_t area_serial = __system_property_area_serial();
+        if (snapshot->valid && area_serial == snapshot->area_serial) break;
+
+        for (size_t i = 0; i < snapshot->count; ++i) {
+            if (snapshot_entry(&snapshot->entries[i])) snapshot->entries[i].changed = true;
+        }
+        snapshot->area_serial = area_serial;
+        snapshot->valid = true;
+    }
+
+    int changed = 0;
+    for (size_t i = 0; i < snapshot->count; ++i) {
+        if (snapshot->entries[i].changed) changed++;
+    }
+    return changed;
+}
+
+#if !defined(__NR_futex_waitv)
+#define __NR_futex_waitv 449
+#endif
+
+// The kernel's struct futex_waitv, for Linux 5.16 and later.
+struct futex_waiter {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t reserved;
+};
+static constexpr uint32_t kFutex2SizeU32 = 0x02;
+static constexpr size_t kFutexWaitvMax = 128;
+
+static std::atomic<bool> futex_waitv_unsupported = false;
+
+// Waits on the serials of all of the snapshot's properties at once. Returns 1 once one of them may
+// have changed, 0 on timeout, or -ENOENT if they can't be waited on individually.
+static int wait_for_entries(const property_snapshot* snapshot, const timespec* deadline) {
+    if (futex_waitv_unsupported || snapshot->count > kFutexWaitvMax) return -ENOENT;
+
+    futex_waiter waiters[kFutexWaitvMax];
+    for (size_t i = 0; i < snapshot->count; ++i) {
+        const property_snapshot_entry& entry = snapshot->entries[i];
+        if (!entry.info) return -ENOENT;
+        // The serial is the first member of bionic's prop_info, and is the futex that
+        // __system_property_wait() waits on and that every update of the property wakes.
+        waiters[i] = {entry.serial, reinterpret_cast<uintptr_t>(entry.info), kFutex2SizeU32, 0};
+    }
+
+    if (syscall(__NR_futex_waitv, waiters, snapshot->count, 0, deadline, CLOCK_MONOTONIC) >= 0) {
+        return 1;
+    }
+    switch (errno) {
+        case EAGAIN:  // A serial already moved.
+        case EINTR:
+            return 1;
+        case ETIMEDOUT:
+            return 0;
+        case ENOSYS:
+            futex_waitv_unsupported = true;
+            return -ENOENT;
+        default:
+            return -errno;
+    }
+}
+
+// Waits for any property to be set. Returns 1 once one may have been, or 0 on timeout.
+static int wait_for_area(const property_snapshot* snapshot, const timespec* deadline) {
+    timespec remaining;
+    if (deadline) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining.tv_sec = deadline->tv_sec - now.tv_sec;
+        remaining.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+        if (remaining.tv_nsec < 0) {
+            remaining.tv_sec--;
+            remaining.tv_nsec += 1000000000;
+        }
+        if (remaining.tv_sec < 0) return 0;
+    }
+    uint32_t new_serial;
+    return __system_property_wait(nullptr, snapshot->area_serial, &new_serial,
+                                  deadline ? &remaining : nullptr);
+}
+
+int property_snapshot_wait(property_snapshot* snapshot, const timespec* relative_timeout) {
+    if (!snapshot || !snapshot->entries || !snapshot->count) return -EINVAL;
+    if (!snapshot->valid) return property_snapshot_update(snapshot);
+
+    timespec deadline;
+    if (relative_timeout) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += relative_timeout->tv_sec;
+        deadline.tv_nsec += relative_timeout->tv_nsec;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    const timespec* deadline_ptr = relative_timeout ? &deadline : nullptr;
+
+    while (true) {
+        int woken = wait_for_entries(snapshot, deadline_ptr);
+        if (woken == -ENOENT) woken = wait_for_area(snapshot, deadline_ptr);
+        if (woken <= 0) return woken;
+
+        // A property may be set to the value it already had.
+        int changed = property_snapshot_update(snapshot);
+        if (changed) return changed;
+    }
+}
+
 #endif
@@ -19,8 +19,10 @@
 #include <limits.h>
 
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <android/log.h>
 #include <android-base/macros.h>
@@ -376,4 +378,70 @@ TEST_F(PropertiesTest, property_get_int32) {
     }
 }
 
+#if defined(__BIONIC__)
+TEST_F(PropertiesTest, property_snapshot_update) {
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "first"));
+
+    property_snapshot_entry entries[2] = {};
+    entries[0].key = PROPERTY_TEST_KEY;
+    entries[1].key = PROPERTY_TEST_KEY ".unset";
+    property_snapshot snapshot = {};
+    snapshot.entries = entries;
+    snapshot.count = arraysize(entries);
+
+    EXPECT_EQ(2, property_snapshot_update(&snapshot));
+    EXPECT_STREQ("first", entries[0].value);
+    EXPECT_STREQ("", entries[1].value);
+
+    EXPECT_EQ(0, property_snapshot_update(&snapshot));
+    EXPECT_FALSE(entries[0].changed);
+    EXPECT_FALSE(entries[1].changed);
+
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "second"));
+    EXPECT_EQ(1, property_snapshot_update(&snapshot));
+    EXPECT_TRUE(entries[0].changed);
+    EXPECT_FALSE(entries[1].changed);
+    EXPECT_STREQ("second", entries[0].value);
+}
+
+TEST_F(PropertiesTest, property_snapshot_wait) {
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "first"));
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY ".other", "first"));
+
+    property_snapshot_entry entries[1] = {};
+    entries[0].key = PROPERTY_TEST_KEY;
+    property_snapshot snapshot = {};
+    snapshot.entries = entries;
+    snapshot.count = arraysize(entries);
+    EXPECT_EQ(1, property_snapshot_wait(&snapshot, nullptr));
+
+    // Neither setting another property nor setting the same value is a change.
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY ".other", "second"));
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "first"));
+    timespec timeout = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+    EXPECT_EQ(0, property_snapshot_wait(&snapshot, &timeout));
+
+    std::thread setter([] { property_set(PROPERTY_TEST_KEY, "second"); });
+    timeout = {.tv_sec = 10, .tv_nsec = 0};
+    EXPECT_EQ(1, property_snapshot_wait(&snapshot, &timeout));
+    EXPECT_STREQ("second", entries[0].value);
+    setter.join();
+}
+
+static void CollectProperty(const char* key, const char* value, void* cookie) {
+    reinterpret_cast<std::map<std::string, std::string>*>(cookie)->emplace(key, value);
+}
+
+TEST_F(PropertiesTest, property_list_prefix) {
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "value"));
+
+    std::map<std::string, std::string> properties;
+    ASSERT_OK(property_list_prefix(PROPERTY_TEST_KEY, CollectProperty, &properties));
+    EXPECT_EQ(1u, properties.count(PROPERTY_TEST_KEY));
+    for (const auto& [key, value] : properties) {
+        EXPECT_EQ(0u, key.find(PROPERTY_TEST_KEY)) << key;
+    }
+}
+#endif
+
 } // namespace android
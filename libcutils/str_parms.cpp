@@ -136,43 +136,66 @@ void str_parms_destroy(struct str_parms *str_parms)
     free(str_parms);
 }
 
+/*
+ * Finds the next "key=value" pair in [*cursor, end), advancing *cursor past
+ * it. Empty pairs and pairs with an empty key are skipped; a pair without '='
+ * has an empty value.
+ */
+static bool next_pair(const char **cursor, const char *end,
+                      struct str_parms_span *key, struct str_parms_span *value)
+{
+    const char *p = *cursor;
+    while (p < end) {
+        const char *pair_end = static_cast<const char *>(memchr(p, ';', end - p));
+        if (!pair_end)
+            pair_end = end;
+
+        const char *eq = static_cast<const char *>(memchr(p, '=', pair_end - p));
+        const char *key_end = eq ? eq : pair_end;
+        if (key_end != p) {
+            key->data = p;
+            key->len = key_end - p;
+            value->data = eq ? eq + 1 : pair_end;
+            value->len = pair_end - value->data;
+            *cursor = pair_end;
+            return true;
+        }
+        p = pair_end + 1;
+    }
+    *cursor = end;
+    return false;
+}
+
+static bool span_eq(const struct str_parms_span *a, const struct str_parms_span *b)
+{
+    return a->len == b->len && !memcmp(a->data, b->data, a->len);
+}
+
 struct str_parms *str_parms_create_str(const char *_string)
 {
     struct str_parms *str_parms;
-    char *str;
-    char *kvpair;
-    char *tmpstr;
+    const char *cursor = _string;
+    const char *end = _string + strlen(_string);
+    struct str_parms_span key_span, value_span;
     int items = 0;
 
     str_parms = str_parms_create();
     if (!str_parms)
-        goto err_create_str_parms;
-
-    str = strdup(_string);
-    if (!str)
-        goto err_strdup;
+        return NULL;
 
     ALOGV("%s: source string == '%s'\n", __func__, _string);
 
-    kvpair = strtok_r(str, ";", &tmpstr);
-    while (kvpair && *kvpair) {
-        char *eq = strchr(kvpair, '='); /* would love strchrnul */
-        char *value;
-        char *key;
+    /* copy each key and value straight out of the source string */
+    while (next_pair(&cursor, end, &key_span, &value_span)) {
+        char *key = strndup(key_span.data, key_span.len);
+        char *value = strndup(value_span.data, value_span.len);
         void *old_val;
 
-        if (eq == kvpair)
-            goto next_pair;
-
-        if (eq) {
-            key = strndup(kvpair, eq - kvpair);
-            if (*(++eq))
-                value = strdup(eq);
-            else
-                value = strdup("");
-        } else {
-            key = strdup(kvpair);
-            value = strdup("");
+        if (!key || !value) {
+            free(key);
+            free(value);
+            str_parms_destroy(str_parms);
+            return NULL;
         }
 
         /* if we replaced a value, free it */
@@ -186,21 +209,12 @@ struct str_parms *str_parms_create_str(const char *_string)
         }
 
         items++;
-next_pair:
-        kvpair = strtok_r(NULL, ";", &tmpstr);
     }
 
     if (!items)
         ALOGV("%s: no items found in string\n", __func__);
 
-    free(str);
-
     return str_parms;
-
-err_strdup:
-    str_parms_destroy(str_parms);
-err_create_str_parms:
-    return NULL;
 }
 
 int str_parms_add_str(struct str_parms *str_parms, const char *key,
@@ -367,3 +381,71 @@ void str_parms_dump(struct str_parms *str_parms)
 {
     hashmapForEach(str_parms->map, dump_entry, str_parms);
 }
+
+int str_parms_parse(const char *str, size_t len, struct str_parms_pair *pairs,
+                    size_t max_pairs)
+{
+    const char *cursor = str;
+    const char *end = str + len;
+    struct str_parms_span key, value;
+    size_t count = 0;
+    bool overflow = false;
+
+    while (next_pair(&cursor, end, &key, &value)) {
+        size_t i;
+        for (i = 0; i < count; i++) {
+            if (span_eq(&pairs[i].key, &key))
+                break;
+        }
+        if (i < count) {
+            pairs[i].value = value;
+        } else if (count < max_pairs) {
+            pairs[count].key = key;
+            pairs[count].value = value;
+            count++;
+        } else {
+            /* keep going: a later pair may still replace a value we have */
+            overflow = true;
+        }
+    }
+
+    return overflow ? -ENOSPC : (int)count;
+}
+
+const struct str_parms_pair *str_parms_find(const struct str_parms_pair *pairs,
+                                            size_t count, const char *key)
+{
+    struct str_parms_span key_span = { key, strlen(key) };
+    for (size_t i = 0; i < count; i++) {
+        if (span_eq(&pairs[i].key, &key_span))
+            return &pairs[i];
+    }
+    return NULL;
+}
+
+/* appends 'len' bytes at 'data' to what fits of 'buf', counting them all */
+static void append(char *buf, size_t size, size_t *pos, const char *data, size_t len)
+{
+    if (*pos + 1 < size) {
+        size_t room = size - 1 - *pos;
+        memcpy(buf + *pos, data, len < room ? len : room);
+    }
+    *pos += len;
+}
+
+size_t str_parms_format(const struct str_parms_pair *pairs, size_t count,
+                        char *buf, size_t size)
+{
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i)
+            append(buf, size, &pos, ";", 1);
+        append(buf, size, &pos, pairs[i].key.data, pairs[i].key.len);
+        append(buf, size, &pos, "=", 1);
+        append(buf, size, &pos, pairs[i].value.data, pairs[i].value.len);
+    }
+    if (size)
+        buf[pos < size ? pos : size - 1] = '\0';
+    return pos;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/str_parms.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <benchmark/benchmark.h>
+
+// What an audio HAL typically gets from setParameters().
+static const char kParams[] = "routing=2;sampling_rate=48000;format=1;channels=3;screen_state=on";
+
+static void BM_str_parms_create_get(benchmark::State& state) {
+    for (auto _ : state) {
+        str_parms* parms = str_parms_create_str(kParams);
+        int rate;
+        benchmark::DoNotOptimize(str_parms_get_int(parms, "sampling_rate", &rate));
+        benchmark::DoNotOptimize(str_parms_has_key(parms, "screen_state"));
+        str_parms_destroy(parms);
+    }
+}
+BENCHMARK(BM_str_parms_create_get);
+
+static void BM_str_parms_parse_find(benchmark::State& state) {
+    const size_t len = strlen(kParams);
+    for (auto _ : state) {
+        str_parms_pair pairs[16];
+        int count = str_parms_parse(kParams, len, pairs, 16);
+        benchmark::DoNotOptimize(str_parms_find(pairs, count, "sampling_rate"));
+        benchmark::DoNotOptimize(str_parms_find(pairs, count, "screen_state"));
+    }
+}
+BENCHMARK(BM_str_parms_parse_find);
+
+static void BM_str_parms_to_str(benchmark::State& state) {
+    str_parms* parms = str_parms_create_str(kParams);
+    for (auto _ : state) {
+        char* str = str_parms_to_str(parms);
+        benchmark::DoNotOptimize(str);
+        free(str);
+    }
+    str_parms_destroy(parms);
+}
+BENCHMARK(BM_str_parms_to_str);
+
+static void BM_str_parms_format(benchmark::State& state) {
+    str_parms_pair pairs[16];
+    int count = str_parms_parse(kParams, strlen(kParams), pairs, 16);
+    for (auto _ : state) {
+        char buf[128];
+        benchmark::DoNotOptimize(str_parms_format(pairs, count, buf, sizeof(buf)));
+    }
+}
+BENCHMARK(BM_str_parms_format);
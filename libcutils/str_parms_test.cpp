@@ -17,6 +17,11 @@
 #include <cutils/str_parms.h>
 #include <gtest/gtest.h>
 
+#include <errno.h>
+#include <string.h>
+
+#include <string>
+
 static void test_str_parms_str(const char* str, const char* expected) {
     str_parms* str_parms = str_parms_create_str(str);
     str_parms_add_str(str_parms, "dude", "woah");
@@ -55,3 +60,66 @@ TEST(str_parms, put_ENOMEM) {
     ASSERT_EQ(ENOMEM, errno);
     test_str_parms_str("foo=bar;baz=", "foo=bar;baz=");
 }
+
+static std::string parse_and_format(const char* str, size_t max_pairs = 8) {
+    str_parms_pair pairs[8];
+    int count = str_parms_parse(str, strlen(str), pairs, max_pairs);
+    EXPECT_GE(count, 0) << str;
+    if (count < 0) return "";
+    char buf[128];
+    size_t len = str_parms_format(pairs, count, buf, sizeof(buf));
+    EXPECT_EQ(strlen(buf), len);
+    return buf;
+}
+
+TEST(str_parms, parse) {
+    EXPECT_EQ("", parse_and_format(""));
+    EXPECT_EQ("", parse_and_format(";;"));
+    EXPECT_EQ("", parse_and_format("=bar;"));
+    EXPECT_EQ("foo=", parse_and_format("foo=;"));
+    EXPECT_EQ("foo=bar;baz=", parse_and_format("foo=bar;baz"));
+    EXPECT_EQ("foo=bar=baz", parse_and_format("foo=bar=baz"));
+    EXPECT_EQ("foo=bar2;baz=bat", parse_and_format("foo=bar1;baz=bat;foo=bar2"));
+}
+
+TEST(str_parms, parse_does_not_read_past_len) {
+    const char str[] = "foo=bar;baz=bat";
+    str_parms_pair pairs[2];
+    ASSERT_EQ(1, str_parms_parse(str, strlen("foo=ba"), pairs, 2));
+    EXPECT_EQ(std::string("ba"), std::string(pairs[0].value.data, pairs[0].value.len));
+}
+
+TEST(str_parms, parse_ENOSPC) {
+    str_parms_pair pairs[2];
+    const char* str = "a=1;b=2;c=3;a=4";
+    ASSERT_EQ(-ENOSPC, str_parms_parse(str, strlen(str), pairs, 2));
+    // The pairs that fit are still there, with later values applied.
+    EXPECT_EQ(std::string("4"), std::string(pairs[0].value.data, pairs[0].value.len));
+    EXPECT_EQ(std::string("2"), std::string(pairs[1].value.data, pairs[1].value.len));
+}
+
+TEST(str_parms, find) {
+    const char* str = "routing=2;sampling_rate=48000;format";
+    str_parms_pair pairs[4];
+    int count = str_parms_parse(str, strlen(str), pairs, 4);
+    ASSERT_EQ(3, count);
+
+    const str_parms_pair* pair = str_parms_find(pairs, count, "sampling_rate");
+    ASSERT_NE(nullptr, pair);
+    EXPECT_EQ(std::string("48000"), std::string(pair->value.data, pair->value.len));
+    ASSERT_NE(nullptr, str_parms_find(pairs, count, "format"));
+    EXPECT_EQ(0u, str_parms_find(pairs, count, "format")->value.len);
+    EXPECT_EQ(nullptr, str_parms_find(pairs, count, "sampling"));
+    EXPECT_EQ(nullptr, str_parms_find(pairs, count, "routing=2"));
+}
+
+TEST(str_parms, format_truncates) {
+    const char* str = "foo=bar;baz=bat";
+    str_parms_pair pairs[2];
+    ASSERT_EQ(2, str_parms_parse(str, strlen(str), pairs, 2));
+
+    char buf[8];
+    EXPECT_EQ(strlen(str), str_parms_format(pairs, 2, buf, sizeof(buf)));
+    EXPECT_STREQ("foo=bar", buf);
+    EXPECT_EQ(strlen(str), str_parms_format(pairs, 2, nullptr, 0));
+}
@@ -20,6 +20,7 @@
 #include <mutex>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -47,6 +48,7 @@ class Modprobe {
     std::string MakeCanonical(const std::string& module_path);
     bool InsmodWithDeps(const std::string& module_name, const std::string& parameters);
     bool Insmod(const std::string& path_name, const std::string& parameters);
+    void Prefetch(const std::string& path_name);
     bool Rmmod(const std::string& module_name);
     std::vector<std::string> GetDependencies(const std::string& module);
     bool ModuleExists(const std::string& module_name);
@@ -54,6 +56,9 @@ class Modprobe {
                    const std::string& value);
     std::string GetKernelCmdline();
     bool IsBlocklisted(const std::string& module_name);
+    std::vector<std::string> GetListedModulePaths();
+    void BuildAliasIndex();
+    std::vector<size_t> FindAliases(const std::string& name);
 
     bool ParseDepCallback(const std::string& base_path, const std::vector<std::string>& args);
     bool ParseAliasCallback(const std::vector<std::string>& args);
@@ -65,6 +70,9 @@ class Modprobe {
     void ParseCfg(const std::string& cfg, std::function<bool(const std::vector<std::string>&)> f);
 
     std::vector<std::pair<std::string, std::string>> module_aliases_;
+    // The literal prefix of each alias and its index in |module_aliases_|, sorted.
+    std::vector<std::pair<std::string_view, size_t>> alias_index_;
+    std::vector<size_t> alias_prefix_lengths_;
     std::unordered_map<std::string, std::vector<std::string>> module_deps_;
     std::vector<std::pair<std::string, std::string>> module_pre_softdep_;
     std::vector<std::pair<std::string, std::string>> module_post_softdep_;
@@ -16,25 +16,61 @@
 
 #include <modprobe/modprobe.h>
 
+#include <fcntl.h>
 #include <fnmatch.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <optional>
+#include <queue>
 #include <set>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/mapped_file.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 
 #include <basename.h>
 
+namespace {
+
+// Reads ahead the given modules on a background thread, in the order they are about to be loaded,
+// so that finit_module() finds them in the page cache instead of waiting on storage.
+class ModulePrefetcher {
+  public:
+    ModulePrefetcher(std::vector<std::string> paths,
+                     std::function<void(const std::string&)> prefetch)
+        : thread_([this, paths = std::move(paths), prefetch = std::move(prefetch)] {
+              for (const auto& path : paths) {
+                  if (stop_) return;
+                  prefetch(path);
+              }
+          }) {}
+    ~ModulePrefetcher() {
+        stop_ = true;
+        thread_.join();
+    }
+
+  private:
+    std::atomic<bool> stop_ = false;
+    std::thread thread_;
+};
+
+}  // namespace
+
 std::string Modprobe::MakeCanonical(const std::string& module_path) {
     auto start = module_path.find_last_of('/');
     if (start == std::string::npos) {
@@ -226,18 +262,33 @@ bool Modprobe::ParseBlocklistCallback(const std::vector<std::string>& args) {
 
 void Modprobe::ParseCfg(const std::string& cfg,
                         std::function<bool(const std::vector<std::string>&)> f) {
-    std::string cfg_contents;
-    if (!android::base::ReadFileToString(cfg, &cfg_contents, false)) {
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(cfg.c_str(), O_RDONLY | O_CLOEXEC)));
+    struct stat st;
+    if (fd == -1 || fstat(fd.get(), &st) == -1 || st.st_size == 0) {
+        return;
+    }
+    // Walk the file in place instead of copying it and splitting it into lines first;
+    // modules.dep and modules.alias are large enough for that to show up in first stage init.
+    auto mapped = android::base::MappedFile::FromFd(fd, 0, st.st_size, PROT_READ);
+    if (!mapped) {
         return;
     }
 
-    std::vector<std::string> lines = android::base::Split(cfg_contents, "\n");
-    for (const std::string line : lines) {
+    std::string_view contents(mapped->data(), mapped->size());
+    std::vector<std::string> args;
+    while (!contents.empty()) {
+        auto line = contents.substr(0, contents.find('\n'));
+        contents.remove_prefix(std::min(line.size() + 1, contents.size()));
         if (line.empty() || line[0] == '#') {
             continue;
         }
-        const std::vector<std::string> args = android::base::Split(line, " ");
-        if (args.empty()) continue;
+        args.clear();
+        while (true) {
+            auto end = line.find(' ');
+            args.emplace_back(line.substr(0, end));
+            if (end == std::string_view::npos) break;
+            line.remove_prefix(end + 1);
+        }
         f(args);
     }
     return;
@@ -343,6 +394,42 @@ Modprobe::Modprobe(const std::vector<std::string>& base_paths, const std::string
     }
 
     ParseKernelCmdlineOptions();
+    BuildAliasIndex();
+}
+
+// modules.alias has tens of thousands of patterns and most of them are "bus:literal*" style, so
+// sort the aliases by their literal prefix, the part before the first wildcard. A lookup then only
+// runs fnmatch() against the aliases whose prefix the name starts with, found with one binary
+// search per distinct prefix length.
+void Modprobe::BuildAliasIndex() {
+    std::set<size_t> lengths;
+    for (size_t i = 0; i < module_aliases_.size(); ++i) {
+        const auto& alias = module_aliases_[i].first;
+        auto prefix = std::string_view(alias).substr(0, alias.find_first_of("*?[\\"));
+        alias_index_.emplace_back(prefix, i);
+        lengths.emplace(prefix.size());
+    }
+    std::sort(alias_index_.begin(), alias_index_.end());
+    alias_prefix_lengths_.assign(lengths.begin(), lengths.end());
+}
+
+// Returns the aliases matching |name|, in the order they appear in modules.alias.
+std::vector<size_t> Modprobe::FindAliases(const std::string& name) {
+    std::vector<size_t> matches;
+    for (size_t length : alias_prefix_lengths_) {
+        if (length > name.size()) break;
+        auto prefix = std::string_view(name).substr(0, length);
+        auto it = std::lower_bound(
+                alias_index_.begin(), alias_index_.end(), prefix,
+                [](const auto& entry, std::string_view p) { return entry.first < p; });
+        for (; it != alias_index_.end() && it->first == prefix; ++it) {
+            if (fnmatch(module_aliases_[it->second].first.c_str(), name.c_str(), 0) == 0) {
+                matches.emplace_back(it->second);
+            }
+        }
+    }
+    std::sort(matches.begin(), matches.end());
+    return matches;
 }
 
 std::vector<std::string> Modprobe::GetDependencies(const std::string& module) {
@@ -409,8 +496,8 @@ bool Modprobe::LoadWithAliases(const std::string& module_name, bool strict,
 
     // use aliases to expand list of modules to load (multiple modules
     // may alias themselves to the requested name)
-    for (const auto& [alias, aliased_module] : module_aliases_) {
-        if (fnmatch(alias.c_str(), module_name.c_str(), 0) != 0) continue;
+    for (size_t alias : FindAliases(module_name)) {
+        const auto& aliased_module = module_aliases_[alias].second;
         LOG(VERBOSE) << "Found alias for '" << module_name << "': '" << aliased_module;
         if (module_loaded_.count(MakeCanonical(aliased_module))) continue;
         modules_to_load.emplace(aliased_module);
@@ -441,98 +528,209 @@ bool Modprobe::IsBlocklisted(const std::string& module_name) {
     return module_blocklist_.count(canonical_name) > 0;
 }
 
-// Another option to load kernel modules. load in independent modules in parallel
-// and then load modules which only have soft dependency, third update dependency list of other
-// remaining modules, repeat these steps until all modules are loaded.
+// Another option to load kernel modules: the listed modules, their hard dependencies and their
+// soft dependencies form a graph whose edges say which module has to be loaded first. A module is
+// queued as soon as the last of its prerequisites is done, and the queued modules with the longest
+// chain of modules waiting on them are loaded first, on |num_threads| threads.
 bool Modprobe::LoadModulesParallel(int num_threads) {
-    bool ret = true;
-    std::map<std::string, std::set<std::string>> mod_with_deps;
-    std::map<std::string, std::set<std::string>> mod_with_softdeps;
+    struct Edge {
+        size_t to;
+        bool hard;
+    };
+    struct Node {
+        std::string name;
+        std::string path;
+        std::vector<Edge> dependents;
+        std::vector<size_t> hard_prerequisites;
+        size_t prerequisites = 0;
+        size_t depth = 0;
+        // It, or a module that depends on it, was listed; otherwise it is only a soft dependency.
+        bool required = false;
+        bool failed = false;
+    };
+    std::vector<Node> nodes;
+    std::map<std::string, size_t> node_index;
+    std::set<std::pair<size_t, size_t>> edges;
+
+    auto add_edge = [&](size_t from, size_t to, bool hard) {
+        if (from == to || !edges.emplace(from, to).second) return;
+        nodes[from].dependents.push_back({to, hard});
+        if (hard) nodes[to].hard_prerequisites.emplace_back(from);
+        nodes[to].prerequisites++;
+    };
+
+    // Returns the node of a module and adds the nodes of everything it depends on, or returns
+    // nothing if the module cannot be loaded.
+    std::function<std::optional<size_t>(const std::string&)> add_module;
+    // Expands aliases, as LoadWithAliases() does.
+    auto add_modules = [&](const std::string& module_name) {
+        std::set<std::string> names = {MakeCanonical(module_name)};
+        for (size_t alias : FindAliases(module_name)) {
+            names.emplace(MakeCanonical(module_aliases_[alias].second));
+        }
+        std::vector<size_t> result;
+        for (const auto& name : names) {
+            if (auto node = add_module(name)) result.emplace_back(*node);
+        }
+        return result;
+    };
+    add_module = [&](const std::string& name) -> std::optional<size_t> {
+        if (auto it = node_index.find(name); it != node_index.end()) return it->second;
+        if (!ModuleExists(name)) return {};
+
+        auto dependencies = GetDependencies(name);
+        size_t node = nodes.size();
+        nodes.push_back({.name = name, .path = dependencies[0]});
+        node_index.emplace(name, node);
+
+        for (auto dep = dependencies.begin() + 1; dep != dependencies.end(); ++dep) {
+            auto dep_node = add_module(MakeCanonical(*dep));
+            if (dep_node) {
+                add_edge(*dep_node, node, true);
+            } else {
+                nodes[node].failed = true;
+            }
+        }
+        for (const auto& [module, softdep] : module_pre_softdep_) {
+            if (MakeCanonical(module) != name) continue;
+            for (size_t softdep_node : add_modules(softdep)) add_edge(softdep_node, node, false);
+        }
+        for (const auto& [module, softdep] : module_post_softdep_) {
+            if (MakeCanonical(module) != name) continue;
+            for (size_t softdep_node : add_modules(softdep)) add_edge(node, softdep_node, false);
+        }
+        return node;
+    };
 
-    // Get dependencies
+    bool ret = true;
+    std::vector<size_t> roots;
     for (const auto& module : module_load_) {
-        auto dependencies = GetDependencies(MakeCanonical(module));
-
-        for (auto dep = dependencies.rbegin(); dep != dependencies.rend(); dep++) {
-            mod_with_deps[module].emplace(*dep);
+        auto module_nodes = add_modules(module);
+        if (module_nodes.empty() && !IsBlocklisted(module)) {
+            LOG(ERROR) << "LoadModulesParallel was unable to load " << module;
+            ret = false;
+        }
+        roots.insert(roots.end(), module_nodes.begin(), module_nodes.end());
+    }
+
+    // Hard dependencies are required by whatever requires their dependents.
+    std::vector<size_t> stack = roots;
+    while (!stack.empty()) {
+        size_t node = stack.back();
+        stack.pop_back();
+        if (nodes[node].required) continue;
+        nodes[node].required = true;
+        stack.insert(stack.end(), nodes[node].hard_prerequisites.begin(),
+                     nodes[node].hard_prerequisites.end());
+    }
+
+    // Order the graph, which also finds soft dependency cycles, then work out each module's depth
+    // from the modules waiting on it.
+    std::vector<size_t> order;
+    std::vector<size_t> pending(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        pending[i] = nodes[i].prerequisites;
+        if (!pending[i]) order.emplace_back(i);
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (const auto& edge : nodes[order[i]].dependents) {
+            if (--pending[edge.to] == 0) order.emplace_back(edge.to);
         }
     }
-
-    // Get soft dependencies
-    for (const auto& [it_mod, it_softdep] : module_pre_softdep_) {
-        mod_with_softdeps[MakeCanonical(it_mod)].emplace(it_softdep);
+    if (order.size() != nodes.size()) {
+        LOG(ERROR) << "Module dependencies have a cycle, loading modules serially";
+        return LoadListedModules();
     }
-
-    // Get soft post dependencies
-    for (const auto& [it_mod, it_softdep] : module_post_softdep_) {
-        mod_with_softdeps[MakeCanonical(it_mod)].emplace(it_softdep);
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        auto& node = nodes[*it];
+        for (const auto& edge : node.dependents) {
+            node.depth = std::max(node.depth, nodes[edge.to].depth + 1);
+        }
     }
 
-    while (!mod_with_deps.empty()) {
-        std::vector<std::thread> threads;
-        std::vector<std::string> mods_path_to_load;
-        std::vector<std::string> mods_with_softdep_to_load;
-        std::mutex vector_lock;
+    ModulePrefetcher prefetcher(GetListedModulePaths(),
+                                [this](const std::string& path) { Prefetch(path); });
 
-        // Find independent modules and modules only having soft dependencies
-        for (const auto& [it_mod, it_dep] : mod_with_deps) {
-            if (it_dep.size() == 1 && mod_with_softdeps[it_mod].empty()) {
-                mods_path_to_load.emplace_back(*(it_dep.begin()));
-            } else if (it_dep.size() == 1) {
-                mods_with_softdep_to_load.emplace_back(it_mod);
-            }
-        }
+    auto shallower = [&nodes](size_t a, size_t b) { return nodes[a].depth < nodes[b].depth; };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(shallower)> ready(shallower);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i].prerequisites) ready.emplace(i);
+    }
 
-        // Load independent modules in parallel
-        auto thread_function = [&] {
-            std::unique_lock lk(vector_lock);
-            while (!mods_path_to_load.empty()) {
-                auto mod_path_to_load = std::move(mods_path_to_load.back());
-                mods_path_to_load.pop_back();
+    std::mutex lock;
+    std::condition_variable cv;
+    size_t unfinished = nodes.size();
+    std::vector<std::pair<std::chrono::microseconds, size_t>> load_times;
 
+    auto thread_function = [&] {
+        std::unique_lock lk(lock);
+        while (true) {
+            cv.wait(lk, [&] { return !ready.empty() || unfinished == 0; });
+            if (ready.empty()) return;
+            size_t node = ready.top();
+            ready.pop();
+
+            bool loaded = false;
+            if (!nodes[node].failed) {
                 lk.unlock();
-                ret &= Insmod(mod_path_to_load, "");
+                auto start = std::chrono::steady_clock::now();
+                loaded = Insmod(nodes[node].path, "");
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start);
                 lk.lock();
+                load_times.emplace_back(duration, node);
             }
-        };
-
-        std::generate_n(std::back_inserter(threads), num_threads,
-                        [&] { return std::thread(thread_function); });
-
-        // Wait for the threads.
-        for (auto& thread : threads) {
-            thread.join();
-        }
-
-        // Since we cannot assure if these soft dependencies tree are overlap,
-        // we loaded these modules one by one.
-        for (auto dep = mods_with_softdep_to_load.rbegin(); dep != mods_with_softdep_to_load.rend();
-             dep++) {
-            ret &= LoadWithAliases(*dep, true);
-        }
 
-        std::lock_guard guard(module_loaded_lock_);
-        // Remove loaded module form mod_with_deps and soft dependencies of other modules
-        for (const auto& module_loaded : module_loaded_) {
-            mod_with_deps.erase(module_loaded);
-
-            for (auto& [mod, softdeps] : mod_with_softdeps) {
-                softdeps.erase(module_loaded);
+            if (!loaded) {
+                nodes[node].failed = true;
+                if (nodes[node].required && !IsBlocklisted(nodes[node].name)) ret = false;
             }
-        }
-
-        // Remove loaded module form dependencies of other modules which are not loaded yet
-        for (const auto& module_loaded_path : module_loaded_paths_) {
-            for (auto& [mod, deps] : mod_with_deps) {
-                deps.erase(module_loaded_path);
+            for (const auto& edge : nodes[node].dependents) {
+                if (!loaded && edge.hard) nodes[edge.to].failed = true;
+                if (--nodes[edge.to].prerequisites == 0) {
+                    ready.emplace(edge.to);
+                    cv.notify_one();
+                }
             }
+            if (--unfinished == 0) cv.notify_all();
         }
+    };
+
+    android::base::Timer t;
+    std::vector<std::thread> threads;
+    std::generate_n(std::back_inserter(threads), std::max(num_threads, 1),
+                    [&] { return std::thread(thread_function); });
+    for (auto& thread : threads) {
+        thread.join();
     }
 
+    LOG(INFO) << "Loaded " << load_times.size() << " modules on " << threads.size()
+              << " threads in " << t;
+    static constexpr size_t kSlowestModulesReported = 10;
+    std::sort(load_times.begin(), load_times.end(), std::greater<>());
+    for (size_t i = 0; i < std::min(load_times.size(), kSlowestModulesReported); ++i) {
+        LOG(INFO) << "  " << nodes[load_times[i].second].name << ": "
+                  << load_times[i].first.count() / 1000.0 << "ms";
+    }
     return ret;
 }
 
+// Returns the listed modules and their hard dependencies, in about the order they get loaded.
+std::vector<std::string> Modprobe::GetListedModulePaths() {
+    std::vector<std::string> paths;
+    std::set<std::string> seen;
+    for (const auto& module : module_load_) {
+        auto dependencies = GetDependencies(MakeCanonical(module));
+        for (auto dep = dependencies.rbegin(); dep != dependencies.rend(); ++dep) {
+            if (seen.emplace(*dep).second) paths.emplace_back(*dep);
+        }
+    }
+    return paths;
+}
+
 bool Modprobe::LoadListedModules(bool strict) {
+    ModulePrefetcher prefetcher(GetListedModulePaths(),
+                                [this](const std::string& path) { Prefetch(path); });
     auto ret = true;
     for (const auto& module : module_load_) {
         if (!LoadWithAliases(module, true)) {
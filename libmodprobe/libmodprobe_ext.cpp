@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
@@ -71,6 +72,16 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
     return true;
 }
 
+void Modprobe::Prefetch(const std::string& path_name) {
+    android::base::unique_fd fd(
+            TEMP_FAILURE_RETRY(open(path_name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1) {
+        return;
+    }
+    // Only starts the reads; closing the file does not cancel them.
+    posix_fadvise(fd.get(), 0, 0, POSIX_FADV_WILLNEED);
+}
+
 bool Modprobe::Rmmod(const std::string& module_name) {
     auto canonical_name = MakeCanonical(module_name);
     int ret = syscall(__NR_delete_module, canonical_name.c_str(), O_NONBLOCK);
@@ -60,6 +60,8 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
     return true;
 }
 
+void Modprobe::Prefetch(const std::string&) {}
+
 bool Modprobe::Rmmod(const std::string& module_name) {
     for (auto it = modules_loaded.begin(); it != modules_loaded.end(); it++) {
         if (*it == module_name || android::base::StartsWith(*it, module_name + " ")) {
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <functional>
 
 #include <android-base/file.h>
@@ -219,3 +220,84 @@ TEST(libmodprobe, ModuleDepLineWithoutColonIsSkipped) {
     Modprobe m({dir.path});
     EXPECT_FALSE(m.LoadWithAliases("no_colon", true));
 }
+
+TEST(libmodprobe, LoadModulesParallelOrdersDependencies) {
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            "mod_a.ko: mod_b.ko mod_c.ko\n"
+            "mod_b.ko: mod_c.ko\n"
+            "mod_c.ko:\n"
+            "mod_d.ko:\n"
+            "mod_e.ko:\n"
+            "mod_f.ko:\n",
+            dir_path + "/modules.dep", 0600, getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile("softdep mod_a pre: mod_de post: mod_f\n",
+                                                 dir_path + "/modules.softdep", 0600, getuid(),
+                                                 getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile("alias mod_de mod_d\nalias mod_de mod_e\n",
+                                                 dir_path + "/modules.alias", 0600, getuid(),
+                                                 getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile("mod_a.ko\nmissing.ko\n", dir_path + "/modules.load",
+                                                 0600, getuid(), getgid()));
+
+    kernel_cmdline = "";
+    test_modules.clear();
+    for (const auto& module : {"mod_a", "mod_b", "mod_c", "mod_d", "mod_e", "mod_f"}) {
+        test_modules.emplace_back(dir_path + "/" + module + ".ko");
+    }
+    modules_loaded.clear();
+
+    // The fake Insmod() is not thread safe.
+    Modprobe m({dir.path}, "modules.load", false);
+    EXPECT_FALSE(m.LoadModulesParallel(1));
+
+    auto position = [&](const std::string& module) {
+        auto it = std::find(modules_loaded.begin(), modules_loaded.end(),
+                            dir_path + "/" + module + ".ko");
+        EXPECT_NE(modules_loaded.end(), it) << module << " was not loaded";
+        return it - modules_loaded.begin();
+    };
+    ASSERT_EQ(6u, modules_loaded.size());
+    EXPECT_LT(position("mod_c"), position("mod_b"));
+    EXPECT_LT(position("mod_b"), position("mod_a"));
+    EXPECT_LT(position("mod_d"), position("mod_a"));
+    EXPECT_LT(position("mod_e"), position("mod_a"));
+    EXPECT_LT(position("mod_a"), position("mod_f"));
+}
+
+TEST(libmodprobe, LoadWithAliasesMatchesWildcards) {
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            "mod_a.ko:\nmod_b.ko:\nmod_c.ko:\nmod_d.ko:\nmod_e.ko:\n", dir_path + "/modules.dep",
+            0600, getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            "alias pci:v00001234d*sv* mod_a\n"
+            "alias pci:v0000* mod_b\n"
+            "alias *usb* mod_c\n"
+            "alias pci:v00001234d00005678 mod_d\n"
+            "alias [p]ci:* mod_e\n",
+            dir_path + "/modules.alias", 0600, getuid(), getgid()));
+
+    kernel_cmdline = "";
+    test_modules.clear();
+    for (const auto& module : {"mod_a", "mod_b", "mod_c", "mod_d", "mod_e"}) {
+        test_modules.emplace_back(dir_path + "/" + module + ".ko");
+    }
+    modules_loaded.clear();
+
+    Modprobe m({dir.path});
+    EXPECT_TRUE(m.LoadWithAliases("pci:v00001234d00005678", true));
+    std::vector<std::string> expected = {
+            dir_path + "/mod_b.ko",
+            dir_path + "/mod_d.ko",
+            dir_path + "/mod_e.ko",
+    };
+    EXPECT_EQ(expected, modules_loaded);
+
+    modules_loaded.clear();
+    EXPECT_TRUE(m.LoadWithAliases("usb:v1d2", true));
+    EXPECT_EQ(std::vector<std::string>{dir_path + "/mod_c.ko"}, modules_loaded);
+    EXPECT_FALSE(m.LoadWithAliases("acpi:none", true));
+}
@@ -78,4 +78,37 @@ bool packagelist_parse_file(const char* path, bool (*callback)(pkg_info* info, v
 /** Frees the given `pkg_info`. */
 void packagelist_free(pkg_info* info);
 
+/**
+ * An index of a package list, for callers that look packages up repeatedly.
+ * The file is memory-mapped and indexed by name and uid on the first lookup,
+ * and again on the first lookup after it is replaced or modified.
+ * An index can be used from several threads at once.
+ */
+typedef struct packagelist_index packagelist_index;
+
+/**
+ * Creates an index of the package list at `path`, or of the system's default
+ * package list if `path` is NULL. The file isn't read until the first lookup.
+ * Returns NULL if out of memory.
+ */
+packagelist_index* packagelist_index_create(const char* path);
+
+/** Frees the given index. */
+void packagelist_index_free(packagelist_index* index);
+
+/**
+ * Looks up the package called `name`.
+ * Returns a `pkg_info` that the caller should free with packagelist_free(),
+ * or NULL with errno set if there's no such package or the list can't be read.
+ */
+pkg_info* packagelist_index_find_by_name(packagelist_index* index, const char* name);
+
+/**
+ * Looks up the package with the given uid. If packages share the uid, the
+ * first one in the list is returned.
+ * Returns a `pkg_info` that the caller should free with packagelist_free(),
+ * or NULL with errno set if there's no such package or the list can't be read.
+ */
+pkg_info* packagelist_index_find_by_uid(packagelist_index* index, uid_t uid);
+
 __END_DECLS
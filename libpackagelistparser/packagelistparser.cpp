@@ -19,12 +19,22 @@
 #include <packagelistparser/packagelistparser.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <log/log.h>
 
@@ -125,8 +135,10 @@ bool packagelist_parse_file(const char* path, bool (*callback)(pkg_info*, void*)
   return true;
 }
 
+static constexpr const char* kPackageListPath = "/data/system/packages.list";
+
 bool packagelist_parse(bool (*callback)(pkg_info*, void*), void* user_data) {
-  return packagelist_parse_file("/data/system/packages.list", callback, user_data);
+  return packagelist_parse_file(kPackageListPath, callback, user_data);
 }
 
 void packagelist_free(pkg_info* info) {
@@ -138,3 +150,154 @@ void packagelist_free(pkg_info* info) {
   delete[] info->gids.gids;
   free(info);
 }
+
+struct packagelist_index {
+  std::string path;
+
+  std::mutex lock;
+
+  // The mapped file, and what it was when mapped. PackageManager replaces the
+  // list by renaming a new file over it, so the mapping stays valid until we
+  // notice and map the new one.
+  const char* data = nullptr;
+  size_t size = 0;
+  bool mapped = false;
+  dev_t dev = 0;
+  ino_t ino = 0;
+  timespec mtime = {};
+
+  // The offset of each line, and the index of each package's line by name and
+  // by uid.
+  std::vector<size_t> lines;
+  std::unordered_map<std::string_view, size_t> by_name;
+  std::unordered_map<uid_t, size_t> by_uid;
+
+  ~packagelist_index() { Unmap(); }
+
+  void Unmap() {
+    if (data != nullptr) munmap(const_cast<char*>(data), size);
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    lines.clear();
+    by_name.clear();
+    by_uid.clear();
+  }
+
+  bool Changed(const struct stat& st) const {
+    return !mapped || st.st_dev != dev || st.st_ino != ino ||
+           static_cast<size_t>(st.st_size) != size || st.st_mtim.tv_sec != mtime.tv_sec ||
+           st.st_mtim.tv_nsec != mtime.tv_nsec;
+  }
+
+  // Maps and indexes the file again if it changed since it was last mapped.
+  bool Refresh() {
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) {
+      ALOGE("couldn't stat '%s': %s", path.c_str(), strerror(errno));
+      return false;
+    }
+    if (!Changed(st)) return true;
+
+    Unmap();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      ALOGE("couldn't open '%s': %s", path.c_str(), strerror(errno));
+      return false;
+    }
+    // Use the file we opened, in case it was replaced since the stat().
+    if (fstat(fd, &st) == -1) {
+      ALOGE("couldn't stat '%s': %s", path.c_str(), strerror(errno));
+      close(fd);
+      return false;
+    }
+    if (st.st_size > 0) {
+      void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) {
+        ALOGE("couldn't mmap '%s': %s", path.c_str(), strerror(errno));
+        close(fd);
+        return false;
+      }
+      data = static_cast<const char*>(map);
+      size = st.st_size;
+    }
+    close(fd);
+    mapped = true;
+    dev = st.st_dev;
+    ino = st.st_ino;
+    mtime = st.st_mtim;
+
+    for (size_t pos = 0; pos < size;) {
+      const char* line = data + pos;
+      const char* end = static_cast<const char*>(memchr(line, '\n', size - pos));
+      size_t length = end ? end - line : size - pos;
+
+      // Only the name and uid are needed here; the rest of the line is parsed
+      // when the package is looked up.
+      std::string_view fields(line, length);
+      size_t name_end = fields.find(' ');
+      if (name_end != std::string_view::npos && name_end > 0) {
+        by_name.emplace(fields.substr(0, name_end), lines.size());
+        unsigned long long uid = 0;
+        size_t i = name_end + 1;
+        for (; i < length && line[i] >= '0' && line[i] <= '9' && uid <= UID_MAX; i++) {
+          uid = uid * 10 + (line[i] - '0');
+        }
+        if (i > name_end + 1 && uid <= UID_MAX) by_uid.emplace(uid, lines.size());
+      }
+      lines.push_back(pos);
+      pos += length + 1;
+    }
+    return true;
+  }
+
+  pkg_info* ParseLine(size_t line_index) {
+    size_t pos = lines[line_index];
+    const char* line = data + pos;
+    const char* end = static_cast<const char*>(memchr(line, '\n', size - pos));
+    std::string copy(line, end ? end - line : size - pos);
+
+    std::unique_ptr<pkg_info, decltype(&packagelist_free)> info(
+        static_cast<pkg_info*>(calloc(1, sizeof(pkg_info))), &packagelist_free);
+    if (!info) {
+      errno = ENOMEM;
+      return nullptr;
+    }
+    if (!parse_line(path.c_str(), line_index + 1, copy.c_str(), info.get())) {
+      errno = EINVAL;
+      return nullptr;
+    }
+    return info.release();
+  }
+
+  template <typename Map, typename Key>
+  pkg_info* Find(Map packagelist_index::*map, const Key& key) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!Refresh()) return nullptr;
+    auto it = (this->*map).find(key);
+    if (it == (this->*map).end()) {
+      errno = ENOENT;
+      return nullptr;
+    }
+    return ParseLine(it->second);
+  }
+};
+
+packagelist_index* packagelist_index_create(const char* path) {
+  packagelist_index* index = new (std::nothrow) packagelist_index;
+  if (!index) return nullptr;
+  index->path = path ? path : kPackageListPath;
+  return index;
+}
+
+void packagelist_index_free(packagelist_index* index) {
+  delete index;
+}
+
+pkg_info* packagelist_index_find_by_name(packagelist_index* index, const char* name) {
+  return index->Find(&packagelist_index::by_name, std::string_view(name));
+}
+
+pkg_info* packagelist_index_find_by_uid(packagelist_index* index, uid_t uid) {
+  return index->Find(&packagelist_index::by_uid, uid);
+}
@@ -16,7 +16,11 @@
 
 #include <packagelistparser/packagelistparser.h>
 
+#include <errno.h>
+#include <stdio.h>
+
 #include <memory>
+#include <string>
 
 #include <android-base/file.h>
 
@@ -132,3 +136,81 @@ TEST(packagelistparser, system_package_list) {
 TEST(packagelistparser, packagelist_free_nullptr) {
   packagelist_free(nullptr);
 }
+
+TEST(packagelistparser, index_lookup) {
+  TemporaryFile tf;
+  android::base::WriteStringToFile(
+      "com.test.a0 10014 0 /data/user/0/com.test.a0 platform none\n"
+      "com.test.a1 10007 1 /data/user/0/com.test.a1 platform 1023,3003\n"
+      // Shares a uid with com.test.a1.
+      "com.test.a2 10007 0 /data/user/0/com.test.a2 platform none 1 123\n",
+      tf.path);
+
+  std::unique_ptr<packagelist_index, decltype(&packagelist_index_free)> index(
+      packagelist_index_create(tf.path), &packagelist_index_free);
+  ASSERT_NE(nullptr, index);
+
+  pkg_info* info = packagelist_index_find_by_name(index.get(), "com.test.a1");
+  ASSERT_NE(nullptr, info);
+  ASSERT_EQ(10007, info->uid);
+  ASSERT_TRUE(info->debuggable);
+  ASSERT_STREQ("/data/user/0/com.test.a1", info->data_dir);
+  ASSERT_EQ(2U, info->gids.cnt);
+  ASSERT_EQ(3003U, info->gids.gids[1]);
+  packagelist_free(info);
+
+  info = packagelist_index_find_by_name(index.get(), "com.test.a2");
+  ASSERT_NE(nullptr, info);
+  ASSERT_TRUE(info->profileable_from_shell);
+  ASSERT_EQ(123, info->version_code);
+  packagelist_free(info);
+
+  info = packagelist_index_find_by_uid(index.get(), 10007);
+  ASSERT_NE(nullptr, info);
+  ASSERT_STREQ("com.test.a1", info->name);
+  packagelist_free(info);
+
+  errno = 0;
+  ASSERT_EQ(nullptr, packagelist_index_find_by_name(index.get(), "com.test"));
+  ASSERT_EQ(ENOENT, errno);
+  errno = 0;
+  ASSERT_EQ(nullptr, packagelist_index_find_by_uid(index.get(), 10000));
+  ASSERT_EQ(ENOENT, errno);
+}
+
+TEST(packagelistparser, index_sees_replaced_file) {
+  TemporaryDir td;
+  std::string path = td.path + std::string("/packages.list");
+  std::string tmp_path = path + ".tmp";
+  android::base::WriteStringToFile("com.test.a0 10014 0 / platform none\n", path);
+
+  std::unique_ptr<packagelist_index, decltype(&packagelist_index_free)> index(
+      packagelist_index_create(path.c_str()), &packagelist_index_free);
+  ASSERT_NE(nullptr, index);
+
+  pkg_info* info = packagelist_index_find_by_uid(index.get(), 10014);
+  ASSERT_NE(nullptr, info);
+  ASSERT_STREQ("com.test.a0", info->name);
+  packagelist_free(info);
+
+  // Replace the list the way PackageManager does.
+  android::base::WriteStringToFile("com.test.a1 10014 0 / platform none\n", tmp_path);
+  ASSERT_EQ(0, rename(tmp_path.c_str(), path.c_str()));
+
+  info = packagelist_index_find_by_uid(index.get(), 10014);
+  ASSERT_NE(nullptr, info);
+  ASSERT_STREQ("com.test.a1", info->name);
+  packagelist_free(info);
+  ASSERT_EQ(nullptr, packagelist_index_find_by_name(index.get(), "com.test.a0"));
+}
+
+TEST(packagelistparser, system_package_list_index) {
+  std::unique_ptr<packagelist_index, decltype(&packagelist_index_free)> index(
+      packagelist_index_create(nullptr), &packagelist_index_free);
+  ASSERT_NE(nullptr, index);
+
+  pkg_info* info = packagelist_index_find_by_name(index.get(), "com.android.shell");
+  ASSERT_NE(nullptr, info);
+  ASSERT_EQ(2000U, info->uid);
+  packagelist_free(info);
+}
@@ -147,6 +147,60 @@ CgroupMap::CgroupMap() {
     }
 }
 
+TaskGroupCache& TaskGroupCache::GetInstance() {
+    // Deliberately leak this object to avoid a race between destruction on
+    // process exit and concurrent access from another thread.
+    static auto* instance = new TaskGroupCache;
+    return *instance;
+}
+
+// A cgroup v2 controller may be mounted below the root of the hierarchy, which /proc/<tid>/cgroup
+// gives groups relative to, so only v1 controllers are cached.
+static bool IsCached(const CgroupController& controller) {
+    return controller.version() == 1;
+}
+
+void TaskGroupCache::Enable(bool enable) {
+    std::lock_guard<std::mutex> lock(lock_);
+    enabled_.store(enable, std::memory_order_relaxed);
+    if (!enable) groups_.clear();
+}
+
+void TaskGroupCache::Record(const CgroupController& controller, int tid, const std::string& group) {
+    if (!enabled() || !IsCached(controller)) return;
+    std::lock_guard<std::mutex> lock(lock_);
+    auto& groups = groups_[controller.name()];
+    if (groups.size() >= kMaxThreads && groups.find(tid) == groups.end()) {
+        groups.clear();
+    }
+    groups[tid] = group;
+}
+
+void TaskGroupCache::Forget(const CgroupController& controller, int tid) {
+    if (!enabled() || !IsCached(controller)) return;
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = groups_.find(controller.name());
+    if (it != groups_.end()) it->second.erase(tid);
+}
+
+void TaskGroupCache::ForgetAll(const CgroupController& controller) {
+    if (!enabled() || !IsCached(controller)) return;
+    std::lock_guard<std::mutex> lock(lock_);
+    groups_.erase(controller.name());
+}
+
+bool TaskGroupCache::Lookup(const CgroupController& controller, int tid,
+                            std::string* group) const {
+    if (!enabled() || !IsCached(controller)) return false;
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = groups_.find(controller.name());
+    if (it == groups_.end()) return false;
+    auto group_it = it->second.find(tid);
+    if (group_it == it->second.end()) return false;
+    *group = group_it->second;
+    return true;
+}
+
 CgroupMap& CgroupMap::GetInstance() {
     // Deliberately leak this object to avoid a race between destruction on
     // process exit and concurrent access from another thread.
@@ -19,10 +19,12 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android/cgrouprc.h>
@@ -71,3 +73,31 @@ class CgroupMap {
     bool LoadRcFile();
     void Print() const;
 };
+
+// Remembers the group that this process last moved each thread to, per v1 controller, so that
+// the group of those threads can be known without reading /proc/<tid>/cgroup. Moves made by other
+// processes are not seen, so it is only enabled on request, by processes that manage the groups
+// of the threads they query. Every method does nothing while it is disabled.
+class TaskGroupCache {
+  public:
+    static TaskGroupCache& GetInstance();
+
+    // Disabling it also forgets every thread.
+    void Enable(bool enable);
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void Record(const CgroupController& controller, int tid, const std::string& group);
+    void Forget(const CgroupController& controller, int tid);
+    // For when whole processes are moved, which moves threads this cache can't name.
+    void ForgetAll(const CgroupController& controller);
+    bool Lookup(const CgroupController& controller, int tid, std::string* group) const;
+
+  private:
+    // Past this, threads are forgotten rather than kept for tids that may have been reused.
+    static constexpr size_t kMaxThreads = 4096;
+
+    std::atomic<bool> enabled_ = false;
+    mutable std::mutex lock_;
+    // Indexed by controller name.
+    std::unordered_map<std::string, std::unordered_map<int, std::string>> groups_;
+};
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace cgrouprc {
+namespace format {
+
+// Written by init next to cgroup.rc, see CgroupSetup().
+static constexpr const char* TASK_PROFILES_RC_PATH = "/dev/cgroup_info/task_profiles.rc";
+
+// Compiled form of the task_profiles.json files, to be mmapped into process address space.
+// Every string is an offset into the string table at the end of the file. The header is followed,
+// in order, by the sections, attributes, profiles, actions, params, aggregate profiles, aggregate
+// members and the string table.
+struct TaskProfilesFile {
+    uint32_t version_;
+    uint32_t section_count_;
+    uint32_t attribute_count_;
+    uint32_t profile_count_;
+    uint32_t action_count_;
+    uint32_t param_count_;
+    uint32_t aggregate_count_;
+    uint32_t member_count_;
+    uint32_t strings_size_;
+
+    static constexpr uint32_t FILE_VERSION_1 = 1;
+    static constexpr uint32_t FILE_CURR_VERSION = FILE_VERSION_1;
+};
+
+// Records coming from one source json file. Sections are applied in order so that later files
+// override earlier ones the same way as when the json files are loaded one after another.
+struct TaskProfilesSection {
+    uint32_t first_attribute_;
+    uint32_t attribute_count_;
+    uint32_t first_profile_;
+    uint32_t profile_count_;
+    uint32_t first_aggregate_;
+    uint32_t aggregate_count_;
+};
+
+struct TaskProfileAttribute {
+    uint32_t name_;
+    uint32_t controller_;
+    uint32_t file_;
+    uint32_t file_v2_;
+};
+
+struct TaskProfileEntry {
+    uint32_t name_;
+    uint32_t first_action_;
+    uint32_t action_count_;
+};
+
+struct TaskProfileAction {
+    uint32_t name_;
+    uint32_t first_param_;
+    uint32_t param_count_;
+};
+
+struct TaskProfileParam {
+    uint32_t key_;
+    uint32_t value_;
+};
+
+struct TaskAggregateProfile {
+    uint32_t name_;
+    uint32_t first_member_;
+    uint32_t member_count_;
+};
+
+// Read-only view over a TaskProfilesFile image. Init() checks that every record and string
+// offset lies within |size| bytes, so the accessors don't need to.
+class TaskProfilesFileView {
+  public:
+    bool Init(const void* data, size_t size);
+
+    const TaskProfilesFile& header() const { return *header_; }
+    const TaskProfilesSection& section(uint32_t i) const { return sections_[i]; }
+    const TaskProfileAttribute& attribute(uint32_t i) const { return attributes_[i]; }
+    const TaskProfileEntry& profile(uint32_t i) const { return profiles_[i]; }
+    const TaskProfileAction& action(uint32_t i) const { return actions_[i]; }
+    const TaskProfileParam& param(uint32_t i) const { return params_[i]; }
+    const TaskAggregateProfile& aggregate(uint32_t i) const { return aggregates_[i]; }
+    const char* member(uint32_t i) const { return string(members_[i]); }
+    const char* string(uint32_t offset) const { return strings_ + offset; }
+
+  private:
+    const TaskProfilesFile* header_ = nullptr;
+    const TaskProfilesSection* sections_ = nullptr;
+    const TaskProfileAttribute* attributes_ = nullptr;
+    const TaskProfileEntry* profiles_ = nullptr;
+    const TaskProfileAction* actions_ = nullptr;
+    const TaskProfileParam* params_ = nullptr;
+    const TaskAggregateProfile* aggregates_ = nullptr;
+    const uint32_t* members_ = nullptr;
+    const char* strings_ = nullptr;
+};
+
+// Accumulates records and serializes them into a TaskProfilesFile image. Records are added in
+// file order: BeginSection(), then its attributes, profiles with their actions and params, and
+// aggregate profiles with their members.
+class TaskProfilesFileBuilder {
+  public:
+    void BeginSection();
+    void AddAttribute(const std::string& name, const std::string& controller,
+                      const std::string& file, const std::string& file_v2);
+    void BeginProfile(const std::string& name);
+    void BeginAction(const std::string& name);
+    void AddParam(const std::string& key, const std::string& value);
+    void BeginAggregate(const std::string& name);
+    void AddMember(const std::string& profile_name);
+
+    std::string Serialize() const;
+
+  private:
+    std::vector<TaskProfilesSection> sections_;
+    std::vector<TaskProfileAttribute> attributes_;
+    std::vector<TaskProfileEntry> profiles_;
+    std::vector<TaskProfileAction> actions_;
+    std::vector<TaskProfileParam> params_;
+    std::vector<TaskAggregateProfile> aggregates_;
+    std::vector<uint32_t> members_;
+    std::string strings_;
+    std::map<std::string, uint32_t> string_offsets_;
+
+    uint32_t AddString(const std::string& str);
+};
+
+}  // namespace format
+}  // namespace cgrouprc
+}  // namespace android
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <processgroup/format/task_profiles_file.h>
+
+namespace android {
+namespace cgrouprc {
+namespace format {
+
+// Returns true if [first, first + count) lies within [0, limit).
+static bool IsRangeValid(uint32_t first, uint32_t count, uint32_t limit) {
+    return static_cast<uint64_t>(first) + count <= limit;
+}
+
+template <typename T>
+static const T* Consume(const char** cursor, uint32_t count) {
+    const T* records = reinterpret_cast<const T*>(*cursor);
+    *cursor += static_cast<size_t>(count) * sizeof(T);
+    return records;
+}
+
+bool TaskProfilesFileView::Init(const void* data, size_t size) {
+    if (size < sizeof(TaskProfilesFile)) {
+        return false;
+    }
+    const auto* header = static_cast<const TaskProfilesFile*>(data);
+    if (header->version_ != TaskProfilesFile::FILE_CURR_VERSION) {
+        return false;
+    }
+
+    uint64_t expected = sizeof(TaskProfilesFile) +
+                        uint64_t{header->section_count_} * sizeof(TaskProfilesSection) +
+                        uint64_t{header->attribute_count_} * sizeof(TaskProfileAttribute) +
+                        uint64_t{header->profile_count_} * sizeof(TaskProfileEntry) +
+                        uint64_t{header->action_count_} * sizeof(TaskProfileAction) +
+                        uint64_t{header->param_count_} * sizeof(TaskProfileParam) +
+                        uint64_t{header->aggregate_count_} * sizeof(TaskAggregateProfile) +
+                        uint64_t{header->member_count_} * sizeof(uint32_t) + header->strings_size_;
+    if (expected != size) {
+        return false;
+    }
+
+    const char* cursor = static_cast<const char*>(data) + sizeof(TaskProfilesFile);
+    auto sections = Consume<TaskProfilesSection>(&cursor, header->section_count_);
+    auto attributes = Consume<TaskProfileAttribute>(&cursor, header->attribute_count_);
+    auto profiles = Consume<TaskProfileEntry>(&cursor, header->profile_count_);
+    auto actions = Consume<TaskProfileAction>(&cursor, header->action_count_);
+    auto params = Consume<TaskProfileParam>(&cursor, header->param_count_);
+    auto aggregates = Consume<TaskAggregateProfile>(&cursor, header->aggregate_count_);
+    auto members = Consume<uint32_t>(&cursor, header->member_count_);
+    const char* strings = cursor;
+
+    // Every string must be NUL-terminated within the table.
+    uint32_t strings_size = header->strings_size_;
+    if (strings_size == 0 || strings[strings_size - 1] != '\0') {
+        return false;
+    }
+    auto is_string = [strings_size](uint32_t offset) { return offset < strings_size; };
+
+    for (uint32_t i = 0; i < header->section_count_; ++i) {
+        const auto& s = sections[i];
+        if (!IsRangeValid(s.first_attribute_, s.attribute_count_, header->attribute_count_) ||
+            !IsRangeValid(s.first_profile_, s.profile_count_, header->profile_count_) ||
+            !IsRangeValid(s.first_aggregate_, s.aggregate_count_, header->aggregate_count_)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->attribute_count_; ++i) {
+        const auto& a = attributes[i];
+        if (!is_string(a.name_) || !is_string(a.controller_) || !is_string(a.file_) ||
+            !is_string(a.file_v2_)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->profile_count_; ++i) {
+        const auto& p = profiles[i];
+        if (!is_string(p.name_) ||
+            !IsRangeValid(p.first_action_, p.action_count_, header->action_count_)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->action_count_; ++i) {
+        const auto& a = actions[i];
+        if (!is_string(a.name_) ||
+            !IsRangeValid(a.first_param_, a.param_count_, header->param_count_)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->param_count_; ++i) {
+        if (!is_string(params[i].key_) || !is_string(params[i].value_)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->aggregate_count_; ++i) {
+        const auto& a = aggregates[i];
+        if (!is_string(a.name_) ||
+            !IsRangeValid(a.first_member_, a.member_count_, header->member_count_)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->member_count_; ++i) {
+        if (!is_string(members[i])) {
+            return false;
+        }
+    }
+
+    header_ = header;
+    sections_ = sections;
+    attributes_ = attributes;
+    profiles_ = profiles;
+    actions_ = actions;
+    params_ = params;
+    aggregates_ = aggregates;
+    members_ = members;
+    strings_ = strings;
+    return true;
+}
+
+uint32_t TaskProfilesFileBuilder::AddString(const std::string& str) {
+    auto iter = string_offsets_.find(str);
+    if (iter != string_offsets_.end()) {
+        return iter->second;
+    }
+    uint32_t offset = strings_.size();
+    strings_.append(str.c_str(), str.size() + 1);
+    string_offsets_.emplace(str, offset);
+    return offset;
+}
+
+void TaskProfilesFileBuilder::BeginSection() {
+    TaskProfilesSection section = {};
+    section.first_attribute_ = attributes_.size();
+    section.first_profile_ = profiles_.size();
+    section.first_aggregate_ = aggregates_.size();
+    sections_.push_back(section);
+}
+
+void TaskProfilesFileBuilder::AddAttribute(const std::string& name, const std::string& controller,
+                                           const std::string& file, const std::string& file_v2) {
+    attributes_.push_back(
+            {AddString(name), AddString(controller), AddString(file), AddString(file_v2)});
+    sections_.back().attribute_count_++;
+}
+
+void TaskProfilesFileBuilder::BeginProfile(const std::string& name) {
+    profiles_.push_back({AddString(name), static_cast<uint32_t>(actions_.size()), 0});
+    sections_.back().profile_count_++;
+}
+
+void TaskProfilesFileBuilder::BeginAction(const std::string& name) {
+    actions_.push_back({AddString(name), static_cast<uint32_t>(params_.size()), 0});
+    profiles_.back().action_count_++;
+}
+
+void TaskProfilesFileBuilder::AddParam(const std::string& key, const std::string& value) {
+    params_.push_back({AddString(key), AddString(value)});
+    actions_.back().param_count_++;
+}
+
+void TaskProfilesFileBuilder::BeginAggregate(const std::string& name) {
+    aggregates_.push_back({AddString(name), static_cast<uint32_t>(members_.size()), 0});
+    sections_.back().aggregate_count_++;
+}
+
+void TaskProfilesFileBuilder::AddMember(const std::string& profile_name) {
+    members_.push_back(AddString(profile_name));
+    aggregates_.back().member_count_++;
+}
+
+template <typename T>
+static void Append(std::string* out, const std::vector<T>& records) {
+    out->append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+}
+
+std::string TaskProfilesFileBuilder::Serialize() const {
+    TaskProfilesFile header = {};
+    header.version_ = TaskProfilesFile::FILE_CURR_VERSION;
+    header.section_count_ = sections_.size();
+    header.attribute_count_ = attributes_.size();
+    header.profile_count_ = profiles_.size();
+    header.action_count_ = actions_.size();
+    header.param_count_ = params_.size();
+    header.aggregate_count_ = aggregates_.size();
+    header.member_count_ = members_.size();
+    // Keep the table non-empty so that a file without any string still validates.
+    std::string strings = strings_.empty() ? std::string(1, '\0') : strings_;
+    header.strings_size_ = strings.size();
+
+    std::string out(reinterpret_cast<const char*>(&header), sizeof(header));
+    Append(&out, sections_);
+    Append(&out, attributes_);
+    Append(&out, profiles_);
+    Append(&out, actions_);
+    Append(&out, params_);
+    Append(&out, aggregates_);
+    Append(&out, members_);
+    out.append(strings);
+    return out;
+}
+
+}  // namespace format
+}  // namespace cgrouprc
+}  // namespace android
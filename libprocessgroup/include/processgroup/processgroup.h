@@ -31,6 +31,10 @@ bool CgroupGetAttributePath(const std::string& attr_name, std::string* path);
 bool CgroupGetAttributePathForTask(const std::string& attr_name, int tid, std::string* path);
 
 bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use_fd_cache = false);
+// Same as SetTaskProfiles() for every tid in |tids|, but opens each cgroup file only once for the
+// whole batch. Use it when moving all the threads of an app at once.
+bool SetTasksProfiles(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                      bool use_fd_cache = false);
 bool SetProcessProfiles(uid_t uid, pid_t pid, const std::vector<std::string>& profiles);
 
 #ifndef __ANDROID_VNDK__
@@ -46,6 +50,13 @@ bool UsePerAppMemcg();
 // should be active again. E.g. Zygote specialization for child process.
 void DropTaskProfilesResourceCaching();
 
+// Makes get_sched_policy() answer from the groups that this process last moved each thread to,
+// through SetTaskProfiles(), SetTasksProfiles() or set_sched_policy(), instead of reading
+// /proc/<tid>/cgroup. Threads this process hasn't moved are still looked up in /proc. Moves made
+// by other processes, and tids reused after a thread exits, are not seen, so only enable this in a
+// process that manages the groups of the threads it queries. Disabling it forgets every thread.
+void EnableTaskGroupCache(bool enable);
+
 // Return 0 and removes the cgroup if there are no longer any processes in it.
 // Returns -1 in the case of an error occurring or if there are processes still running
 // even after retrying for up to 200ms.
@@ -68,6 +79,10 @@ bool setProcessGroupLimit(uid_t uid, int initialPid, int64_t limitInBytes);
 
 void removeAllProcessGroups(void);
 void removeAllEmptyProcessGroups(void);
+// Same as removeAllEmptyProcessGroups(), but done on a background thread that returns right away.
+// Groups that still have processes are removed as soon as they become empty, where the kernel
+// reports it through cgroup.events.
+void removeAllEmptyProcessGroupsAsync(void);
 
 // Provides the path for an attribute in a specific process group
 // Returns false in case of error, true in case of success
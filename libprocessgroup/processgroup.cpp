@@ -22,9 +22,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -36,17 +41,20 @@
 #include <set>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <cutils/android_filesystem_config.h>
 #include <processgroup/processgroup.h>
 #include "task_profiles.h"
 
 using android::base::GetBoolProperty;
+using android::base::ReadFdToString;
 using android::base::StartsWith;
 using android::base::StringPrintf;
 using android::base::WriteStringToFile;
@@ -54,6 +62,9 @@ using android::base::WriteStringToFile;
 using namespace std::chrono_literals;
 
 #define PROCESSGROUP_CGROUP_PROCS_FILE "/cgroup.procs"
+#define PROCESSGROUP_CGROUP_KILL_FILE "/cgroup.kill"
+#define PROCESSGROUP_CGROUP_FREEZE_FILE "/cgroup.freeze"
+#define PROCESSGROUP_CGROUP_EVENTS_FILE "/cgroup.events"
 
 bool CgroupGetControllerPath(const std::string& cgroup_name, std::string* path) {
     auto controller = CgroupMap::GetInstance().FindController(cgroup_name);
@@ -147,6 +158,10 @@ void DropTaskProfilesResourceCaching() {
     TaskProfiles::GetInstance().DropResourceCaching(ProfileAction::RCT_PROCESS);
 }
 
+void EnableTaskGroupCache(bool enable) {
+    TaskGroupCache::GetInstance().Enable(enable);
+}
+
 bool SetProcessProfiles(uid_t uid, pid_t pid, const std::vector<std::string>& profiles) {
     return TaskProfiles::GetInstance().SetProcessProfiles(uid, pid, profiles, false);
 }
@@ -159,6 +174,11 @@ bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use
     return TaskProfiles::GetInstance().SetTaskProfiles(tid, profiles, use_fd_cache);
 }
 
+bool SetTasksProfiles(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                      bool use_fd_cache) {
+    return TaskProfiles::GetInstance().SetTaskProfiles(tids, profiles, use_fd_cache);
+}
+
 // C wrapper for SetProcessProfiles.
 // No need to have this in the header file because this function is specifically for crosvm. Crosvm
 // which is written in Rust has its own declaration of this foreign function and doesn't rely on the
@@ -182,6 +202,21 @@ static std::string ConvertUidPidToPath(const char* cgroup, uid_t uid, int pid) {
     return StringPrintf("%s/uid_%d/pid_%d", cgroup, uid, pid);
 }
 
+// Reads the "populated" key of cgroup.events. Returns 1 if the cgroup or any of its descendants
+// has a live process, 0 if none does, and -1 on error.
+static int ReadCgroupPopulated(int events_fd) {
+    std::string events;
+    if (lseek(events_fd, 0, SEEK_SET) != 0 || !ReadFdToString(events_fd, &events)) {
+        return -1;
+    }
+    static constexpr const char kKey[] = "populated ";
+    auto pos = events.find(kKey);
+    if (pos == std::string::npos || pos + strlen(kKey) >= events.size()) {
+        return -1;
+    }
+    return events[pos + strlen(kKey)] == '1' ? 1 : 0;
+}
+
 static int RemoveProcessGroup(const char* cgroup, uid_t uid, int pid, unsigned int retries) {
     int ret = 0;
     auto uid_pid_path = ConvertUidPidToPath(cgroup, uid, pid);
@@ -288,6 +323,205 @@ void removeAllEmptyProcessGroups() {
     removeAllProcessGroupsInternal(true);
 }
 
+// Removes stale process groups on a background thread, so that a sweep over thousands of them
+// (e.g. after zygote restarts) doesn't hold up the caller. Groups that are still populated are
+// watched through cgroup.events (cgroup v2 only) and removed once their last process exits,
+// rather than being left behind until the next sweep.
+class ProcessGroupReaper {
+  public:
+    static ProcessGroupReaper& GetInstance() {
+        // Deliberately leak this object, its thread runs for the lifetime of the process.
+        static auto* instance = new ProcessGroupReaper;
+        return *instance;
+    }
+
+    // Returns false if the reaper thread can't be started.
+    bool RequestSweep();
+
+  private:
+    // Every rmdir() takes the kernel's cgroup lock, so pause between batches to let concurrent
+    // createProcessGroup() calls through.
+    static constexpr size_t kBatchSize = 64;
+
+    std::mutex mutex_;
+    bool started_ = false;
+    android::base::unique_fd wake_fd_;
+    android::base::unique_fd inotify_fd_;
+    // Watch descriptor to process group path. Only used by the reaper thread.
+    std::map<int, std::string> watched_;
+
+    void ThreadLoop();
+    void Sweep();
+    void Watch(const std::string& path);
+    void HandleEvents();
+    void RemoveIfEmpty(int wd);
+};
+
+bool ProcessGroupReaper::RequestSweep() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!started_) {
+        wake_fd_.reset(eventfd(0, EFD_CLOEXEC));
+        if (wake_fd_ < 0) {
+            PLOG(ERROR) << "Failed to create eventfd for the process group reaper";
+            return false;
+        }
+        // Without inotify the reaper still sweeps, it just can't wait for busy groups.
+        inotify_fd_.reset(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+        std::thread(&ProcessGroupReaper::ThreadLoop, this).detach();
+        started_ = true;
+    }
+    // Requests made while a sweep is pending are coalesced by the eventfd counter.
+    return eventfd_write(wake_fd_, 1) == 0;
+}
+
+void ProcessGroupReaper::ThreadLoop() {
+    struct pollfd fds[2] = {
+            {.fd = wake_fd_, .events = POLLIN, .revents = 0},
+            {.fd = inotify_fd_, .events = POLLIN, .revents = 0},
+    };
+    while (true) {
+        if (TEMP_FAILURE_RETRY(poll(fds, 2, -1)) < 0) {
+            PLOG(ERROR) << "Process group reaper failed to poll";
+            return;
+        }
+        if (fds[0].revents & POLLIN) {
+            eventfd_t count;
+            eventfd_read(wake_fd_, &count);
+            Sweep();
+        }
+        if (fds[1].revents & POLLIN) {
+            HandleEvents();
+        }
+    }
+}
+
+void ProcessGroupReaper::Sweep() {
+    std::vector<std::string> cgroups;
+    std::string path, memcg_apps_path;
+
+    if (CgroupGetControllerPath(CGROUPV2_CONTROLLER_NAME, &path)) {
+        cgroups.push_back(path);
+    }
+    if (CgroupGetMemcgAppsPath(&memcg_apps_path) && memcg_apps_path != path) {
+        cgroups.push_back(memcg_apps_path);
+    }
+
+    // List everything first so that the directories aren't modified while being read.
+    std::vector<std::string> uid_paths, pid_paths;
+    for (const auto& cgroup_root_path : cgroups) {
+        std::unique_ptr<DIR, decltype(&closedir)> root(opendir(cgroup_root_path.c_str()), closedir);
+        if (root == NULL) {
+            PLOG(ERROR) << __func__ << " failed to open " << cgroup_root_path;
+            continue;
+        }
+        dirent* dir;
+        while ((dir = readdir(root.get())) != nullptr) {
+            if (dir->d_type != DT_DIR || !StartsWith(dir->d_name, "uid_")) {
+                continue;
+            }
+            auto uid_path = StringPrintf("%s/%s", cgroup_root_path.c_str(), dir->d_name);
+            std::unique_ptr<DIR, decltype(&closedir)> uid(opendir(uid_path.c_str()), closedir);
+            if (uid == NULL) {
+                continue;
+            }
+            dirent* pid_dir;
+            while ((pid_dir = readdir(uid.get())) != nullptr) {
+                if (pid_dir->d_type == DT_DIR && StartsWith(pid_dir->d_name, "pid_")) {
+                    pid_paths.push_back(StringPrintf("%s/%s", uid_path.c_str(), pid_dir->d_name));
+                }
+            }
+            uid_paths.push_back(std::move(uid_path));
+        }
+    }
+
+    // rmdir() fails with EBUSY for groups that still have processes, so there is no need to
+    // check cgroup.procs first.
+    for (size_t i = 0; i < pid_paths.size(); ++i) {
+        if (i > 0 && i % kBatchSize == 0) {
+            std::this_thread::sleep_for(1ms);
+        }
+        const auto& pid_path = pid_paths[i];
+        LOG(VERBOSE) << "Removing " << pid_path;
+        if (rmdir(pid_path.c_str()) == -1) {
+            if (errno == EBUSY) {
+                Watch(pid_path);
+            } else if (errno != ENOENT) {
+                PLOG(WARNING) << "Failed to remove " << pid_path;
+            }
+        }
+    }
+    for (const auto& uid_path : uid_paths) {
+        LOG(VERBOSE) << "Removing " << uid_path;
+        if (rmdir(uid_path.c_str()) == -1 && errno != EBUSY && errno != ENOENT) {
+            PLOG(WARNING) << "Failed to remove " << uid_path;
+        }
+    }
+}
+
+void ProcessGroupReaper::Watch(const std::string& path) {
+    if (inotify_fd_ < 0) {
+        return;
+    }
+    auto events_path = path + PROCESSGROUP_CGROUP_EVENTS_FILE;
+    int wd = inotify_add_watch(inotify_fd_, events_path.c_str(), IN_MODIFY);
+    if (wd < 0) {
+        // No cgroup.events on cgroup v1; the next sweep will retry.
+        return;
+    }
+    watched_[wd] = path;
+    // The last process may have exited before the watch was added.
+    RemoveIfEmpty(wd);
+}
+
+void ProcessGroupReaper::HandleEvents() {
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t len;
+    while ((len = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+        for (char* ptr = buf; ptr < buf + len;) {
+            auto event = reinterpret_cast<const struct inotify_event*>(ptr);
+            if (event->mask & IN_IGNORED) {
+                // The group was removed, by us or by someone else.
+                watched_.erase(event->wd);
+            } else {
+                RemoveIfEmpty(event->wd);
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+void ProcessGroupReaper::RemoveIfEmpty(int wd) {
+    auto iter = watched_.find(wd);
+    if (iter == watched_.end()) {
+        return;
+    }
+    const std::string& path = iter->second;
+
+    auto events_path = path + PROCESSGROUP_CGROUP_EVENTS_FILE;
+    android::base::unique_fd events_fd(
+            TEMP_FAILURE_RETRY(open(events_path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (events_fd >= 0 && ReadCgroupPopulated(events_fd) != 0) {
+        return;
+    }
+
+    LOG(VERBOSE) << "Removing " << path;
+    if (rmdir(path.c_str()) == -1 && errno == EBUSY) {
+        // Repopulated, e.g. by a child group; keep waiting.
+        return;
+    }
+    // Drop the uid group too if this was its last process group.
+    rmdir(android::base::Dirname(path).c_str());
+    inotify_rm_watch(inotify_fd_, wd);
+    watched_.erase(iter);
+}
+
+void removeAllEmptyProcessGroupsAsync() {
+    LOG(VERBOSE) << "removeAllEmptyProcessGroupsAsync()";
+    if (!ProcessGroupReaper::GetInstance().RequestSweep()) {
+        removeAllProcessGroupsInternal(true);
+    }
+}
+
 /**
  * Process groups are primarily created by the Zygote, meaning that uid/pid groups are created by
  * the user root. Ownership for the newly created cgroup and all of its files must thus be
@@ -411,6 +645,110 @@ static int DoKillProcessGroupOnce(const char* cgroup, uid_t uid, int initialPid,
     return feof(fd.get()) ? processes : -1;
 }
 
+// Returns the number of processes in the cgroup at |group_path|, 0 if it no longer exists, or -1
+// on error.
+static int CountProcesses(const std::string& group_path) {
+    auto path = group_path + PROCESSGROUP_CGROUP_PROCS_FILE;
+    std::unique_ptr<FILE, decltype(&fclose)> fd(fopen(path.c_str(), "re"), fclose);
+    if (!fd) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    int processes = 0;
+    pid_t pid;
+    while (fscanf(fd.get(), "%d\n", &pid) == 1) {
+        processes++;
+    }
+    return feof(fd.get()) ? processes : -1;
+}
+
+// Waits up to |timeout| for the cgroup at |group_path| to have no live processes. The kernel
+// reports a change of cgroup.events as a modification, so this sleeps on inotify instead of
+// polling cgroup.procs. Returns 1 once the cgroup is empty, 0 on timeout, and -1 if cgroup.events
+// can't be watched, e.g. on cgroup v1.
+static int WaitForCgroupEmpty(const std::string& group_path, std::chrono::milliseconds timeout) {
+    auto path = group_path + PROCESSGROUP_CGROUP_EVENTS_FILE;
+    android::base::unique_fd events_fd(
+            TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (events_fd < 0) {
+        return errno == ENOENT && access(group_path.c_str(), F_OK) != 0 ? 1 : -1;
+    }
+    android::base::unique_fd inotify_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, path.c_str(), IN_MODIFY) < 0) {
+        return -1;
+    }
+
+    // The watch is in place before the first read, so no change can be missed.
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+        int populated = ReadCgroupPopulated(events_fd);
+        if (populated <= 0) {
+            return populated == 0 ? 1 : -1;
+        }
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+            return 0;
+        }
+        struct pollfd pfd = {.fd = inotify_fd, .events = POLLIN, .revents = 0};
+        int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, remaining.count()));
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret > 0) {
+            // Drain the queue; the events themselves carry nothing we need.
+            char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+            while (read(inotify_fd, buf, sizeof(buf)) > 0) {
+            }
+        }
+    }
+}
+
+// Writes |value| to the cgroup |file| if the kernel provides it. Returns false if it doesn't or
+// the write fails.
+static bool WriteCgroupFile(const std::string& group_path, const char* file, const char* value) {
+    auto path = group_path + file;
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_WRONLY | O_CLOEXEC)));
+    if (fd < 0) {
+        return false;
+    }
+    if (TEMP_FAILURE_RETRY(write(fd, value, strlen(value))) < 0) {
+        PLOG(WARNING) << "Failed to write '" << value << "' to " << path;
+        return false;
+    }
+    return true;
+}
+
+// Kills every process in the cgroup at once by writing to cgroup.kill (Linux 5.14+), which also
+// catches processes forked while the kill is in progress. Returns the number of processes left in
+// the cgroup, following DoKillProcessGroupOnce(): 0 once it is empty, or the number that were
+// killed if |retries| is 0 and we didn't wait. Returns -1 if cgroup.kill is not available, in
+// which case the caller falls back to signalling each process.
+static int KillProcessGroupWithCgroupKill(const std::string& group_path, int retries,
+                                          int* max_processes) {
+    int processes = CountProcesses(group_path);
+    if (processes <= 0) {
+        return processes;
+    }
+    if (!WriteCgroupFile(group_path, PROCESSGROUP_CGROUP_KILL_FILE, "1")) {
+        return -1;
+    }
+    if (max_processes != nullptr) {
+        *max_processes = processes;
+    }
+    LOG(VERBOSE) << "Killed " << processes << " processes through " << group_path
+                 << PROCESSGROUP_CGROUP_KILL_FILE;
+    if (retries == 0) {
+        return processes;
+    }
+
+    // Same upper bound as the retry loop in KillProcessGroup().
+    if (WaitForCgroupEmpty(group_path, retries * 5ms) == 1) {
+        return 0;
+    }
+    processes = CountProcesses(group_path);
+    return processes < 0 ? 0 : processes;
+}
+
 static int KillProcessGroup(uid_t uid, int initialPid, int signal, int retries,
                             int* max_processes) {
     std::string hierarchy_root_path;
@@ -423,18 +761,42 @@ static int KillProcessGroup(uid_t uid, int initialPid, int signal, int retries,
         *max_processes = 0;
     }
 
-    int retry = retries;
-    int processes;
-    while ((processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal)) > 0) {
-        if (max_processes != nullptr && processes > *max_processes) {
-            *max_processes = processes;
+    auto group_path = ConvertUidPidToPath(cgroup, uid, initialPid);
+    int processes = -1;
+    if (signal == SIGKILL) {
+        processes = KillProcessGroupWithCgroupKill(group_path, retries, max_processes);
+    }
+
+    if (processes < 0) {
+        // Freeze the group while signalling it one process at a time, so that nothing it forks in
+        // the meantime escapes. SIGKILL still takes effect on frozen tasks; other signals are
+        // delivered once the group is thawed.
+        bool frozen = signal == SIGKILL &&
+                      WriteCgroupFile(group_path, PROCESSGROUP_CGROUP_FREEZE_FILE, "1");
+
+        int retry = retries;
+        while ((processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal)) > 0) {
+            if (frozen) {
+                WriteCgroupFile(group_path, PROCESSGROUP_CGROUP_FREEZE_FILE, "0");
+                frozen = false;
+            }
+            if (max_processes != nullptr && processes > *max_processes) {
+                *max_processes = processes;
+            }
+            LOG(VERBOSE) << "Killed " << processes << " processes for processgroup "
+                         << initialPid;
+            if (retry > 0) {
+                // Wake up as soon as the group empties rather than after the full 5ms.
+                if (WaitForCgroupEmpty(group_path, 5ms) < 0) {
+                    std::this_thread::sleep_for(5ms);
+                }
+                --retry;
+            } else {
+                break;
+            }
         }
-        LOG(VERBOSE) << "Killed " << processes << " processes for processgroup " << initialPid;
-        if (retry > 0) {
-            std::this_thread::sleep_for(5ms);
-            --retry;
-        } else {
-            break;
+        if (frozen) {
+            WriteCgroupFile(group_path, PROCESSGROUP_CGROUP_FREEZE_FILE, "0");
         }
     }
 
@@ -159,6 +159,8 @@ static int getCGroupSubsys(int tid, const char* subsys, std::string& subgroup) {
 
     if (!controller.IsUsable()) return -1;
 
+    if (TaskGroupCache::GetInstance().Lookup(controller, tid, &subgroup)) return 0;
+
     if (!controller.GetTaskGroup(tid, &subgroup))
         return -1;
 
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <processgroup/processgroup.h>
+#include <processgroup/sched_policy.h>
+
+static void RunGetSchedPolicy(benchmark::State& state, bool use_cache) {
+    EnableTaskGroupCache(use_cache);
+    // Moving the thread into the group it is already in is enough for the cache to know it.
+    SchedPolicy policy;
+    if (get_sched_policy(gettid(), &policy) != 0 || set_sched_policy(gettid(), policy) != 0) {
+        state.SkipWithError("Unable to get and set the sched policy of this thread");
+        EnableTaskGroupCache(false);
+        return;
+    }
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(get_sched_policy(gettid(), &policy));
+    }
+    EnableTaskGroupCache(false);
+}
+
+// Reads /proc/<tid>/cgroup on every call.
+static void BenchmarkGetSchedPolicyUncached(benchmark::State& state) {
+    RunGetSchedPolicy(state, false);
+}
+BENCHMARK(BenchmarkGetSchedPolicyUncached);
+
+// Answers from the group that set_sched_policy() moved the thread to.
+static void BenchmarkGetSchedPolicyCached(benchmark::State& state) {
+    RunGetSchedPolicy(state, true);
+}
+BENCHMARK(BenchmarkGetSchedPolicyCached);
+
+BENCHMARK_MAIN();
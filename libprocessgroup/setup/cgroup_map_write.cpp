@@ -40,10 +40,12 @@
 #include <json/reader.h>
 #include <json/value.h>
 #include <processgroup/format/cgroup_file.h>
+#include <processgroup/format/task_profiles_file.h>
 #include <processgroup/processgroup.h>
 #include <processgroup/setup.h>
 
 #include "cgroup_descriptor.h"
+#include "task_profiles_write.h"
 
 using android::base::GetUintProperty;
 using android::base::StringPrintf;
@@ -451,5 +453,11 @@ bool CgroupSetup() {
         return false;
     }
 
+    // Precompile task profiles next to <CGROUPS_RC_PATH>. This is only an optimization:
+    // libprocessgroup falls back to the json files if the compiled form is missing.
+    if (!WriteTaskProfilesRcFile()) {
+        LOG(WARNING) << "Failed to write " << format::TASK_PROFILES_RC_PATH << " file";
+    }
+
     return true;
 }
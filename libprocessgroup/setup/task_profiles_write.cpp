@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "libprocessgroup"
+
+#include "task_profiles_write.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <json/reader.h>
+#include <json/value.h>
+#include <processgroup/format/task_profiles_file.h>
+
+using android::base::GetUintProperty;
+using android::base::StringPrintf;
+using android::base::unique_fd;
+
+namespace android {
+namespace cgrouprc {
+
+// Must match the files and load order used by TaskProfiles in libprocessgroup.
+static constexpr const char* TASK_PROFILE_DB_FILE = "/etc/task_profiles.json";
+static constexpr const char* TASK_PROFILE_DB_VENDOR_FILE = "/vendor/etc/task_profiles.json";
+
+static constexpr const char* TEMPLATE_TASK_PROFILE_API_FILE =
+        "/etc/task_profiles/task_profiles_%u.json";
+
+static bool CompileTaskProfilesFile(const std::string& file_name,
+                                    format::TaskProfilesFileBuilder* builder) {
+    std::string json_doc;
+
+    if (!android::base::ReadFileToString(file_name, &json_doc)) {
+        PLOG(ERROR) << "Failed to read task profiles from " << file_name;
+        return false;
+    }
+
+    Json::CharReaderBuilder reader_builder;
+    std::unique_ptr<Json::CharReader> reader(reader_builder.newCharReader());
+    Json::Value root;
+    std::string errorMessage;
+    if (!reader->parse(&*json_doc.begin(), &*json_doc.end(), &root, &errorMessage)) {
+        LOG(ERROR) << "Failed to parse task profiles: " << errorMessage;
+        return false;
+    }
+
+    builder->BeginSection();
+
+    const Json::Value& attr = root["Attributes"];
+    for (Json::Value::ArrayIndex i = 0; i < attr.size(); ++i) {
+        builder->AddAttribute(attr[i]["Name"].asString(), attr[i]["Controller"].asString(),
+                              attr[i]["File"].asString(), attr[i]["FileV2"].asString());
+    }
+
+    const Json::Value& profiles_val = root["Profiles"];
+    for (Json::Value::ArrayIndex i = 0; i < profiles_val.size(); ++i) {
+        const Json::Value& profile_val = profiles_val[i];
+        builder->BeginProfile(profile_val["Name"].asString());
+
+        const Json::Value& actions = profile_val["Actions"];
+        for (Json::Value::ArrayIndex act_idx = 0; act_idx < actions.size(); ++act_idx) {
+            const Json::Value& action_val = actions[act_idx];
+            builder->BeginAction(action_val["Name"].asString());
+
+            // Params are looked up by name when the action is created, so keep all of them.
+            const Json::Value& params_val = action_val["Params"];
+            if (!params_val.isObject()) {
+                continue;
+            }
+            for (const auto& key : params_val.getMemberNames()) {
+                const Json::Value& value = params_val[key];
+                if (value.isConvertibleTo(Json::stringValue)) {
+                    builder->AddParam(key, value.asString());
+                }
+            }
+        }
+    }
+
+    const Json::Value& aggregateprofiles_val = root["AggregateProfiles"];
+    for (Json::Value::ArrayIndex i = 0; i < aggregateprofiles_val.size(); ++i) {
+        const Json::Value& aggregateprofile_val = aggregateprofiles_val[i];
+        builder->BeginAggregate(aggregateprofile_val["Name"].asString());
+
+        const Json::Value& aggregateprofiles = aggregateprofile_val["Profiles"];
+        for (Json::Value::ArrayIndex pf_idx = 0; pf_idx < aggregateprofiles.size(); ++pf_idx) {
+            builder->AddMember(aggregateprofiles[pf_idx].asString());
+        }
+    }
+
+    return true;
+}
+
+bool WriteTaskProfilesRcFile() {
+    format::TaskProfilesFileBuilder builder;
+
+    if (!CompileTaskProfilesFile(TASK_PROFILE_DB_FILE, &builder)) {
+        return false;
+    }
+
+    unsigned int api_level = GetUintProperty<unsigned int>("ro.product.first_api_level", 0);
+    if (api_level > 0) {
+        std::string api_profiles_path = StringPrintf(TEMPLATE_TASK_PROFILE_API_FILE, api_level);
+        if (!access(api_profiles_path.c_str(), F_OK) || errno != ENOENT) {
+            if (!CompileTaskProfilesFile(api_profiles_path, &builder)) {
+                return false;
+            }
+        }
+    }
+
+    if (!access(TASK_PROFILE_DB_VENDOR_FILE, F_OK) &&
+        !CompileTaskProfilesFile(TASK_PROFILE_DB_VENDOR_FILE, &builder)) {
+        return false;
+    }
+
+    // Write a temporary file and rename it into place so that readers never map a partial file.
+    std::string tmp_path = std::string(format::TASK_PROFILES_RC_PATH) + ".tmp";
+    unique_fd fd(TEMP_FAILURE_RETRY(open(tmp_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC,
+                                         S_IRUSR | S_IRGRP | S_IROTH)));
+    if (fd < 0) {
+        PLOG(ERROR) << "open() failed for " << tmp_path;
+        return false;
+    }
+
+    if (!android::base::WriteStringToFd(builder.Serialize(), fd) || fchmod(fd, 0644) < 0) {
+        PLOG(ERROR) << "Failed to write " << tmp_path;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    if (rename(tmp_path.c_str(), format::TASK_PROFILES_RC_PATH) < 0) {
+        PLOG(ERROR) << "rename() failed for " << format::TASK_PROFILES_RC_PATH;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}  // namespace cgrouprc
+}  // namespace android
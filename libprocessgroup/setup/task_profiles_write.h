@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace android {
+namespace cgrouprc {
+
+// Compiles the system, API-level and vendor task_profiles.json files into TASK_PROFILES_RC_PATH
+// so that processes can mmap them instead of parsing json. Nothing is written if any of the json
+// files can't be parsed, leaving libprocessgroup to load (and report errors on) the json itself.
+bool WriteTaskProfilesRcFile();
+
+}  // namespace cgrouprc
+}  // namespace android
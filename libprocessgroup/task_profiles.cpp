@@ -18,7 +18,12 @@
 #define LOG_TAG "libprocessgroup"
 
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "task_profiles.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <string>
 
 #include <android-base/file.h>
@@ -29,6 +34,7 @@
 #include <android-base/threads.h>
 
 #include <cutils/android_filesystem_config.h>
+#include <processgroup/format/task_profiles_file.h>
 
 #include <json/reader.h>
 #include <json/value.h>
@@ -44,6 +50,8 @@ using android::base::StringPrintf;
 using android::base::StringReplace;
 using android::base::unique_fd;
 using android::base::WriteStringToFile;
+using android::cgrouprc::format::TASK_PROFILES_RC_PATH;
+using android::cgrouprc::format::TaskProfilesFileView;
 
 static constexpr const char* TASK_PROFILE_DB_FILE = "/etc/task_profiles.json";
 static constexpr const char* TASK_PROFILE_DB_VENDOR_FILE = "/vendor/etc/task_profiles.json";
@@ -114,6 +122,16 @@ bool FdCacheHelper::IsAppDependentPath(const std::string& path) {
 
 IProfileAttribute::~IProfileAttribute() = default;
 
+bool ProfileAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    bool success = true;
+    for (int tid : tids) {
+        if (!ExecuteForTask(tid)) {
+            success = false;
+        }
+    }
+    return success;
+}
+
 void ProfileAttribute::Reset(const CgroupController& controller, const std::string& file_name) {
     controller_ = controller;
     file_name_ = file_name;
@@ -225,6 +243,29 @@ bool SetAttributeAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool SetAttributeAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    // The attribute belongs to the cgroup, not to the task, so write it once per distinct path.
+    // Threads of one process usually share it.
+    std::string last_path;
+    bool success = true;
+    for (int tid : tids) {
+        std::string path;
+        if (!attribute_->GetPathForTask(tid, &path)) {
+            LOG(ERROR) << "Failed to find cgroup for tid " << tid;
+            success = false;
+            continue;
+        }
+        if (path == last_path) {
+            continue;
+        }
+        if (!ExecuteForTask(tid)) {
+            success = false;
+        }
+        last_path = std::move(path);
+    }
+    return success;
+}
+
 SetCgroupAction::SetCgroupAction(const CgroupController& c, const std::string& p)
     : controller_(c), path_(p) {
     FdCacheHelper::Init(controller_.GetTasksFilePath(path_), fd_[ProfileAction::RCT_TASK]);
@@ -267,6 +308,18 @@ bool SetCgroupAction::AddTidToCgroup(int tid, int fd, const char* controller_nam
     return false;
 }
 
+bool SetCgroupAction::AddTidsToCgroup(const std::vector<int>& tids, int fd,
+                                      const char* controller_name) {
+    // The kernel takes one tid per write, so keep going after a failure and report it at the end.
+    bool success = true;
+    for (int tid : tids) {
+        if (!AddTidToCgroup(tid, fd, controller_name)) {
+            success = false;
+        }
+    }
+    return success;
+}
+
 ProfileAction::CacheUseResult SetCgroupAction::UseCachedFd(ResourceCacheType cache_type,
                                                            int id) const {
     std::lock_guard<std::mutex> lock(fd_mutex_);
@@ -295,6 +348,9 @@ ProfileAction::CacheUseResult SetCgroupAction::UseCachedFd(ResourceCacheType cac
 }
 
 bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
+    // Every thread of the process moves, and the cache can't tell which those are.
+    TaskGroupCache::GetInstance().ForgetAll(controller_);
+
     CacheUseResult result = UseCachedFd(ProfileAction::RCT_PROCESS, pid);
     if (result != ProfileAction::UNUSED) {
         return result == ProfileAction::SUCCESS;
@@ -316,6 +372,36 @@ bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
 }
 
 bool SetCgroupAction::ExecuteForTask(int tid) const {
+    bool moved = MoveTask(tid);
+    UpdateTaskGroupCache(&tid, 1, moved);
+    return moved;
+}
+
+bool SetCgroupAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    bool moved = MoveTasks(tids);
+    UpdateTaskGroupCache(tids.data(), tids.size(), moved);
+    return moved;
+}
+
+// A thread is only remembered in its new group once this action is known to have moved it.
+void SetCgroupAction::UpdateTaskGroupCache(const int* tids, size_t count, bool moved) const {
+    auto& cache = TaskGroupCache::GetInstance();
+    if (!cache.enabled()) return;
+    {
+        std::lock_guard<std::mutex> lock(fd_mutex_);
+        // Without access to the tasks file, the action succeeds without moving anything.
+        if (fd_[ProfileAction::RCT_TASK] == FdCacheHelper::FDS_INACCESSIBLE) moved = false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (moved) {
+            cache.Record(controller_, tids[i], path_);
+        } else {
+            cache.Forget(controller_, tids[i]);
+        }
+    }
+}
+
+bool SetCgroupAction::MoveTask(int tid) const {
     CacheUseResult result = UseCachedFd(ProfileAction::RCT_TASK, tid);
     if (result != ProfileAction::UNUSED) {
         return result == ProfileAction::SUCCESS;
@@ -336,6 +422,43 @@ bool SetCgroupAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool SetCgroupAction::MoveTasks(const std::vector<int>& tids) const {
+    {
+        std::lock_guard<std::mutex> lock(fd_mutex_);
+        const unique_fd& fd = fd_[ProfileAction::RCT_TASK];
+        if (FdCacheHelper::IsCached(fd)) {
+            if (!AddTidsToCgroup(tids, fd, controller()->name())) {
+                LOG(ERROR) << "Failed to add tasks into cgroup";
+                return false;
+            }
+            return true;
+        }
+        if (fd == FdCacheHelper::FDS_INACCESSIBLE) {
+            // no permissions to access the file, ignore
+            return true;
+        }
+        if (fd == FdCacheHelper::FDS_APP_DEPENDENT) {
+            // application-dependent path can't be used with tid
+            LOG(ERROR) << "Application profile can't be applied to a thread";
+            return false;
+        }
+    }
+
+    // fd was not cached, open the file once for all the tids
+    std::string tasks_path = controller()->GetTasksFilePath(path_);
+    unique_fd tmp_fd(TEMP_FAILURE_RETRY(open(tasks_path.c_str(), O_WRONLY | O_CLOEXEC)));
+    if (tmp_fd < 0) {
+        PLOG(WARNING) << "Failed to open " << tasks_path;
+        return false;
+    }
+    if (!AddTidsToCgroup(tids, tmp_fd, controller()->name())) {
+        LOG(ERROR) << "Failed to add tasks into cgroup";
+        return false;
+    }
+
+    return true;
+}
+
 void SetCgroupAction::EnableResourceCaching(ResourceCacheType cache_type) {
     std::lock_guard<std::mutex> lock(fd_mutex_);
     // Return early to prevent unnecessary calls to controller_.Get{Tasks|Procs}FilePath() which
@@ -512,6 +635,13 @@ bool ApplyProfileAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool ApplyProfileAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    for (const auto& profile : profiles_) {
+        profile->ExecuteForTasks(tids);
+    }
+    return true;
+}
+
 void ApplyProfileAction::EnableResourceCaching(ResourceCacheType cache_type) {
     for (const auto& profile : profiles_) {
         profile->EnableResourceCaching(cache_type);
@@ -552,6 +682,23 @@ bool TaskProfile::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool TaskProfile::ExecuteForTasks(const std::vector<int>& tids) const {
+    std::vector<int> resolved;
+    const std::vector<int>* targets = &tids;
+    if (std::find(tids.begin(), tids.end(), 0) != tids.end()) {
+        resolved = tids;
+        std::replace(resolved.begin(), resolved.end(), 0, static_cast<int>(GetThreadId()));
+        targets = &resolved;
+    }
+    for (const auto& element : elements_) {
+        if (!element->ExecuteForTasks(*targets)) {
+            LOG(VERBOSE) << "Applying profile action " << element->Name() << " failed";
+            return false;
+        }
+    }
+    return true;
+}
+
 void TaskProfile::EnableResourceCaching(ProfileAction::ResourceCacheType cache_type) {
     if (res_cached_) {
         return;
@@ -590,6 +737,12 @@ TaskProfiles& TaskProfiles::GetInstance() {
 }
 
 TaskProfiles::TaskProfiles() {
+    // Use the profiles init compiled at boot if available, which saves parsing json in every
+    // process.
+    if (LoadCompiled(CgroupMap::GetInstance(), TASK_PROFILES_RC_PATH)) {
+        return;
+    }
+
     // load system task profiles
     if (!Load(CgroupMap::GetInstance(), TASK_PROFILE_DB_FILE)) {
         LOG(ERROR) << "Loading " << TASK_PROFILE_DB_FILE << " for [" << getpid() << "] failed";
@@ -615,6 +768,134 @@ TaskProfiles::TaskProfiles() {
     }
 }
 
+bool TaskProfiles::AddAttribute(const CgroupMap& cg_map, const std::string& name,
+                                const std::string& controller_name, const std::string& file_attr,
+                                const std::string& file_v2_attr) {
+    if (!file_v2_attr.empty() && file_attr.empty()) {
+        LOG(ERROR) << "Attribute " << name << " has FileV2 but no File property";
+        return false;
+    }
+
+    auto controller = cg_map.FindController(controller_name);
+    if (controller.HasValue()) {
+        auto iter = attributes_.find(name);
+        if (iter == attributes_.end()) {
+            attributes_[name] =
+                    std::make_unique<ProfileAttribute>(controller, file_attr, file_v2_attr);
+        } else {
+            iter->second->Reset(controller, file_attr);
+        }
+    } else {
+        LOG(WARNING) << "Controller " << controller_name << " is not found";
+    }
+    return true;
+}
+
+std::unique_ptr<ProfileAction> TaskProfiles::CreateAction(
+        const CgroupMap& cg_map, const std::string& action_name,
+        const std::function<std::string(const char*)>& param) const {
+    if (action_name == "JoinCgroup") {
+        std::string controller_name = param("Controller");
+        std::string path = param("Path");
+
+        auto controller = cg_map.FindController(controller_name);
+        if (controller.HasValue()) {
+            return std::make_unique<SetCgroupAction>(controller, path);
+        }
+        LOG(WARNING) << "JoinCgroup: controller " << controller_name << " is not found";
+    } else if (action_name == "SetTimerSlack") {
+        std::string slack_value = param("Slack");
+        char* end;
+        unsigned long slack;
+
+        slack = strtoul(slack_value.c_str(), &end, 10);
+        if (end > slack_value.c_str()) {
+            return std::make_unique<SetTimerSlackAction>(slack);
+        }
+        LOG(WARNING) << "SetTimerSlack: invalid parameter: " << slack_value;
+    } else if (action_name == "SetAttribute") {
+        std::string attr_name = param("Name");
+        std::string attr_value = param("Value");
+        bool optional = strcmp(param("Optional").c_str(), "true") == 0;
+
+        auto iter = attributes_.find(attr_name);
+        if (iter != attributes_.end()) {
+            return std::make_unique<SetAttributeAction>(iter->second.get(), attr_value, optional);
+        }
+        LOG(WARNING) << "SetAttribute: unknown attribute: " << attr_name;
+    } else if (action_name == "SetClamps") {
+        std::string boost_value = param("Boost");
+        std::string clamp_value = param("Clamp");
+        char* end;
+        unsigned long boost;
+
+        boost = strtoul(boost_value.c_str(), &end, 10);
+        if (end > boost_value.c_str()) {
+            unsigned long clamp = strtoul(clamp_value.c_str(), &end, 10);
+            if (end > clamp_value.c_str()) {
+                return std::make_unique<SetClampsAction>(boost, clamp);
+            }
+            LOG(WARNING) << "SetClamps: invalid parameter " << clamp_value;
+        } else {
+            LOG(WARNING) << "SetClamps: invalid parameter: " << boost_value;
+        }
+    } else if (action_name == "WriteFile") {
+        std::string attr_filepath = param("FilePath");
+        std::string attr_procfilepath = param("ProcFilePath");
+        std::string attr_value = param("Value");
+        // FilePath and Value are mandatory
+        if (!attr_filepath.empty() && !attr_value.empty()) {
+            std::string attr_logfailures = param("LogFailures");
+            bool logfailures = attr_logfailures.empty() || attr_logfailures == "true";
+            return std::make_unique<WriteFileAction>(attr_filepath, attr_procfilepath, attr_value,
+                                                     logfailures);
+        } else if (attr_filepath.empty()) {
+            LOG(WARNING) << "WriteFile: invalid parameter: "
+                         << "empty filepath";
+        } else if (attr_value.empty()) {
+            LOG(WARNING) << "WriteFile: invalid parameter: "
+                         << "empty value";
+        }
+    } else {
+        LOG(WARNING) << "Unknown profile action: " << action_name;
+    }
+    return nullptr;
+}
+
+void TaskProfiles::AddProfile(const std::shared_ptr<TaskProfile>& profile) {
+    const std::string& profile_name = profile->Name();
+    auto iter = profiles_.find(profile_name);
+    if (iter == profiles_.end()) {
+        profiles_[profile_name] = profile;
+    } else {
+        // Move the content rather that replace the profile because old profile might be
+        // referenced from an aggregate profile if vendor overrides task profiles
+        profile->MoveTo(iter->second.get());
+    }
+}
+
+void TaskProfiles::AddAggregateProfile(const std::string& aggregateprofile_name,
+                                       const std::vector<std::string>& profile_names) {
+    std::vector<std::shared_ptr<TaskProfile>> profiles;
+
+    for (const auto& profile_name : profile_names) {
+        if (profile_name == aggregateprofile_name) {
+            LOG(WARNING) << "AggregateProfiles: recursive profile name: " << profile_name;
+            return;
+        }
+        auto iter = profiles_.find(profile_name);
+        if (iter == profiles_.end()) {
+            LOG(WARNING) << "AggregateProfiles: undefined profile name: " << profile_name;
+            return;
+        }
+        profiles.push_back(iter->second);
+    }
+
+    auto profile = std::make_shared<TaskProfile>(aggregateprofile_name);
+    profile->Add(std::make_unique<ApplyProfileAction>(profiles));
+    profiles_[aggregateprofile_name] = profile;
+}
+
 bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
     std::string json_doc;
 
@@ -634,28 +915,10 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
 
     const Json::Value& attr = root["Attributes"];
     for (Json::Value::ArrayIndex i = 0; i < attr.size(); ++i) {
-        std::string name = attr[i]["Name"].asString();
-        std::string controller_name = attr[i]["Controller"].asString();
-        std::string file_attr = attr[i]["File"].asString();
-        std::string file_v2_attr = attr[i]["FileV2"].asString();
-
-        if (!file_v2_attr.empty() && file_attr.empty()) {
-            LOG(ERROR) << "Attribute " << name << " has FileV2 but no File property";
+        if (!AddAttribute(cg_map, attr[i]["Name"].asString(), attr[i]["Controller"].asString(),
+                          attr[i]["File"].asString(), attr[i]["FileV2"].asString())) {
             return false;
         }
-
-        auto controller = cg_map.FindController(controller_name);
-        if (controller.HasValue()) {
-            auto iter = attributes_.find(name);
-            if (iter == attributes_.end()) {
-                attributes_[name] =
-                        std::make_unique<ProfileAttribute>(controller, file_attr, file_v2_attr);
-            } else {
-                iter->second->Reset(controller, file_attr);
-            }
-        } else {
-            LOG(WARNING) << "Controller " << controller_name << " is not found";
-        }
     }
 
     const Json::Value& profiles_val = root["Profiles"];
@@ -668,118 +931,112 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
 
         for (Json::Value::ArrayIndex act_idx = 0; act_idx < actions.size(); ++act_idx) {
             const Json::Value& action_val = actions[act_idx];
-            std::string action_name = action_val["Name"].asString();
             const Json::Value& params_val = action_val["Params"];
-            if (action_name == "JoinCgroup") {
-                std::string controller_name = params_val["Controller"].asString();
-                std::string path = params_val["Path"].asString();
-
-                auto controller = cg_map.FindController(controller_name);
-                if (controller.HasValue()) {
-                    profile->Add(std::make_unique<SetCgroupAction>(controller, path));
-                } else {
-                    LOG(WARNING) << "JoinCgroup: controller " << controller_name << " is not found";
-                }
-            } else if (action_name == "SetTimerSlack") {
-                std::string slack_value = params_val["Slack"].asString();
-                char* end;
-                unsigned long slack;
-
-                slack = strtoul(slack_value.c_str(), &end, 10);
-                if (end > slack_value.c_str()) {
-                    profile->Add(std::make_unique<SetTimerSlackAction>(slack));
-                } else {
-                    LOG(WARNING) << "SetTimerSlack: invalid parameter: " << slack_value;
-                }
-            } else if (action_name == "SetAttribute") {
-                std::string attr_name = params_val["Name"].asString();
-                std::string attr_value = params_val["Value"].asString();
-                bool optional = strcmp(params_val["Optional"].asString().c_str(), "true") == 0;
-
-                auto iter = attributes_.find(attr_name);
-                if (iter != attributes_.end()) {
-                    profile->Add(std::make_unique<SetAttributeAction>(iter->second.get(),
-                                                                      attr_value, optional));
-                } else {
-                    LOG(WARNING) << "SetAttribute: unknown attribute: " << attr_name;
-                }
-            } else if (action_name == "SetClamps") {
-                std::string boost_value = params_val["Boost"].asString();
-                std::string clamp_value = params_val["Clamp"].asString();
-                char* end;
-                unsigned long boost;
-
-                boost = strtoul(boost_value.c_str(), &end, 10);
-                if (end > boost_value.c_str()) {
-                    unsigned long clamp = strtoul(clamp_value.c_str(), &end, 10);
-                    if (end > clamp_value.c_str()) {
-                        profile->Add(std::make_unique<SetClampsAction>(boost, clamp));
-                    } else {
-                        LOG(WARNING) << "SetClamps: invalid parameter " << clamp_value;
-                    }
-                } else {
-                    LOG(WARNING) << "SetClamps: invalid parameter: " << boost_value;
-                }
-            } else if (action_name == "WriteFile") {
-                std::string attr_filepath = params_val["FilePath"].asString();
-                std::string attr_procfilepath = params_val["ProcFilePath"].asString();
-                std::string attr_value = params_val["Value"].asString();
-                // FilePath and Value are mandatory
-                if (!attr_filepath.empty() && !attr_value.empty()) {
-                    std::string attr_logfailures = params_val["LogFailures"].asString();
-                    bool logfailures = attr_logfailures.empty() || attr_logfailures == "true";
-                    profile->Add(std::make_unique<WriteFileAction>(attr_filepath, attr_procfilepath,
-                                                                   attr_value, logfailures));
-                } else if (attr_filepath.empty()) {
-                    LOG(WARNING) << "WriteFile: invalid parameter: "
-                                 << "empty filepath";
-                } else if (attr_value.empty()) {
-                    LOG(WARNING) << "WriteFile: invalid parameter: "
-                                 << "empty value";
-                }
-            } else {
-                LOG(WARNING) << "Unknown profile action: " << action_name;
+            auto action = CreateAction(cg_map, action_val["Name"].asString(),
+                                       [&params_val](const char* key) {
+                                           return params_val[key].asString();
+                                       });
+            if (action) {
+                profile->Add(std::move(action));
             }
         }
-        auto iter = profiles_.find(profile_name);
-        if (iter == profiles_.end()) {
-            profiles_[profile_name] = profile;
-        } else {
-            // Move the content rather that replace the profile because old profile might be
-            // referenced from an aggregate profile if vendor overrides task profiles
-            profile->MoveTo(iter->second.get());
-            profile.reset();
-        }
+        AddProfile(profile);
     }
 
     const Json::Value& aggregateprofiles_val = root["AggregateProfiles"];
     for (Json::Value::ArrayIndex i = 0; i < aggregateprofiles_val.size(); ++i) {
         const Json::Value& aggregateprofile_val = aggregateprofiles_val[i];
 
-        std::string aggregateprofile_name = aggregateprofile_val["Name"].asString();
         const Json::Value& aggregateprofiles = aggregateprofile_val["Profiles"];
-        std::vector<std::shared_ptr<TaskProfile>> profiles;
-        bool ret = true;
-
+        std::vector<std::string> profile_names;
         for (Json::Value::ArrayIndex pf_idx = 0; pf_idx < aggregateprofiles.size(); ++pf_idx) {
-            std::string profile_name = aggregateprofiles[pf_idx].asString();
-
-            if (profile_name == aggregateprofile_name) {
-                LOG(WARNING) << "AggregateProfiles: recursive profile name: " << profile_name;
-                ret = false;
-                break;
-            } else if (profiles_.find(profile_name) == profiles_.end()) {
-                LOG(WARNING) << "AggregateProfiles: undefined profile name: " << profile_name;
-                ret = false;
-                break;
-            } else {
-                profiles.push_back(profiles_[profile_name]);
+            profile_names.push_back(aggregateprofiles[pf_idx].asString());
+        }
+        AddAggregateProfile(aggregateprofile_val["Name"].asString(), profile_names);
+    }
+
+    return true;
+}
+
+bool TaskProfiles::LoadCompiled(const CgroupMap& cg_map, const std::string& file_name) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(file_name.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd < 0) {
+        // Not compiled yet (e.g. early init) or not supported (e.g. host); use the json files.
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "open() failed for " << file_name;
+        }
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        PLOG(ERROR) << "fstat() failed for " << file_name;
+        return false;
+    }
+
+    size_t file_size = sb.st_size;
+    void* file_data = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (file_data == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to mmap " << file_name;
+        return false;
+    }
+    std::unique_ptr<void, std::function<void(void*)>> mapping(
+            file_data, [file_size](void* data) { munmap(data, file_size); });
+
+    TaskProfilesFileView view;
+    if (!view.Init(file_data, file_size)) {
+        LOG(ERROR) << "Invalid file format " << file_name;
+        return false;
+    }
+
+    // Sections are applied in the order their json files would have been loaded. A bad attribute
+    // skips the rest of its section, like a failed Load() skips the rest of its file.
+    for (uint32_t s = 0; s < view.header().section_count_; ++s) {
+        const auto& section = view.section(s);
+        bool ok = true;
+
+        for (uint32_t i = 0; i < section.attribute_count_ && ok; ++i) {
+            const auto& attr = view.attribute(section.first_attribute_ + i);
+            ok = AddAttribute(cg_map, view.string(attr.name_), view.string(attr.controller_),
+                              view.string(attr.file_), view.string(attr.file_v2_));
+        }
+        if (!ok) {
+            LOG(ERROR) << "Loading section " << s << " of " << file_name << " for [" << getpid()
+                       << "] failed";
+            continue;
+        }
+
+        for (uint32_t i = 0; i < section.profile_count_; ++i) {
+            const auto& entry = view.profile(section.first_profile_ + i);
+            auto profile = std::make_shared<TaskProfile>(view.string(entry.name_));
+
+            for (uint32_t a = 0; a < entry.action_count_; ++a) {
+                const auto& action_rec = view.action(entry.first_action_ + a);
+                auto action = CreateAction(
+                        cg_map, view.string(action_rec.name_),
+                        [&view, &action_rec](const char* key) -> std::string {
+                            for (uint32_t p = 0; p < action_rec.param_count_; ++p) {
+                                const auto& param = view.param(action_rec.first_param_ + p);
+                                if (strcmp(view.string(param.key_), key) == 0) {
+                                    return view.string(param.value_);
+                                }
+                            }
+                            return "";
+                        });
+                if (action) {
+                    profile->Add(std::move(action));
+                }
             }
+            AddProfile(profile);
         }
-        if (ret) {
-            auto profile = std::make_shared<TaskProfile>(aggregateprofile_name);
-            profile->Add(std::make_unique<ApplyProfileAction>(profiles));
-            profiles_[aggregateprofile_name] = profile;
+
+        for (uint32_t i = 0; i < section.aggregate_count_; ++i) {
+            const auto& aggregate = view.aggregate(section.first_aggregate_ + i);
+            std::vector<std::string> profile_names;
+            for (uint32_t m = 0; m < aggregate.member_count_; ++m) {
+                profile_names.push_back(view.member(aggregate.first_member_ + m));
+            }
+            AddAggregateProfile(view.string(aggregate.name_), profile_names);
         }
     }
 
@@ -845,3 +1102,32 @@ bool TaskProfiles::SetTaskProfiles(int tid, const std::vector<std::string>& prof
     }
     return success;
 }
+
+bool TaskProfiles::SetTaskProfiles(const std::vector<int>& tids,
+                                   const std::vector<std::string>& profiles, bool use_fd_cache) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    bool success = true;
+    for (const auto& name : profiles) {
+        TaskProfile* profile = GetProfile(name);
+        if (profile != nullptr) {
+            if (use_fd_cache) {
+                profile->EnableResourceCaching(ProfileAction::RCT_TASK);
+            }
+            if (!profile->ExecuteForTasks(tids)) {
+                PLOG(WARNING) << "Failed to apply " << name << " task profile to " << tids.size()
+                              << " tasks";
+                success = false;
+            }
+        } else {
+            PLOG(WARNING) << "Failed to find " << name << " task profile";
+            success = false;
+        }
+    }
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    LOG(VERBOSE) << "Applied " << profiles.size() << " task profiles to " << tids.size()
+                 << " tasks in " << us << "us";
+    return success;
+}
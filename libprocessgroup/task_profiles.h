@@ -18,7 +18,9 @@
 
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -69,6 +71,9 @@ class ProfileAction {
     // Default implementations will fail
     virtual bool ExecuteForProcess(uid_t, pid_t) const { return false; };
     virtual bool ExecuteForTask(int) const { return false; };
+    // Applies the action to every tid in |tids|. The default implementation calls
+    // ExecuteForTask() for each of them and fails if any of those does.
+    virtual bool ExecuteForTasks(const std::vector<int>& tids) const;
 
     virtual void EnableResourceCaching(ResourceCacheType) {}
     virtual void DropResourceCaching(ResourceCacheType) {}
@@ -113,6 +118,7 @@ class SetAttributeAction : public ProfileAction {
     const char* Name() const override { return "SetAttribute"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(const std::vector<int>& tids) const override;
 
   private:
     const IProfileAttribute* attribute_;
@@ -128,6 +134,7 @@ class SetCgroupAction : public ProfileAction {
     const char* Name() const override { return "SetCgroup"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(const std::vector<int>& tids) const override;
     void EnableResourceCaching(ResourceCacheType cache_type) override;
     void DropResourceCaching(ResourceCacheType cache_type) override;
 
@@ -140,7 +147,11 @@ class SetCgroupAction : public ProfileAction {
     mutable std::mutex fd_mutex_;
 
     static bool AddTidToCgroup(int tid, int fd, const char* controller_name);
+    static bool AddTidsToCgroup(const std::vector<int>& tids, int fd, const char* controller_name);
     CacheUseResult UseCachedFd(ResourceCacheType cache_type, int id) const;
+    bool MoveTask(int tid) const;
+    bool MoveTasks(const std::vector<int>& tids) const;
+    void UpdateTaskGroupCache(const int* tids, size_t count, bool moved) const;
 };
 
 // Write to file action
@@ -176,6 +187,7 @@ class TaskProfile {
 
     bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     bool ExecuteForTask(int tid) const;
+    bool ExecuteForTasks(const std::vector<int>& tids) const;
     void EnableResourceCaching(ProfileAction::ResourceCacheType cache_type);
     void DropResourceCaching(ProfileAction::ResourceCacheType cache_type);
 
@@ -194,6 +206,7 @@ class ApplyProfileAction : public ProfileAction {
     const char* Name() const override { return "ApplyProfileAction"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(const std::vector<int>& tids) const override;
     void EnableResourceCaching(ProfileAction::ResourceCacheType cache_type) override;
     void DropResourceCaching(ProfileAction::ResourceCacheType cache_type) override;
 
@@ -212,6 +225,10 @@ class TaskProfiles {
     bool SetProcessProfiles(uid_t uid, pid_t pid, const std::vector<std::string>& profiles,
                             bool use_fd_cache);
     bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use_fd_cache);
+    // Applies |profiles| to every tid in |tids|, one profile at a time, so that each cgroup file
+    // is opened (or its cached fd locked) once for the whole batch rather than once per tid.
+    bool SetTaskProfiles(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                         bool use_fd_cache);
 
   private:
     std::map<std::string, std::shared_ptr<TaskProfile>> profiles_;
@@ -220,4 +237,19 @@ class TaskProfiles {
     TaskProfiles();
 
     bool Load(const CgroupMap& cg_map, const std::string& file_name);
+    // Loads the profiles compiled by init (see TASK_PROFILES_RC_PATH). Returns false if the file
+    // is missing or malformed, in which case the json files should be loaded instead.
+    bool LoadCompiled(const CgroupMap& cg_map, const std::string& file_name);
+
+    // Shared by Load() and LoadCompiled(). |param| returns the value of an action parameter, or
+    // an empty string if it is not set.
+    bool AddAttribute(const CgroupMap& cg_map, const std::string& name,
+                      const std::string& controller_name, const std::string& file_attr,
+                      const std::string& file_v2_attr);
+    std::unique_ptr<ProfileAction> CreateAction(
+            const CgroupMap& cg_map, const std::string& action_name,
+            const std::function<std::string(const char*)>& param) const;
+    void AddProfile(const std::shared_ptr<TaskProfile>& profile);
+    void AddAggregateProfile(const std::string& aggregateprofile_name,
+                             const std::vector<std::string>& profile_names);
 };
@@ -18,6 +18,7 @@
 #include <android-base/logging.h>
 #include <gtest/gtest.h>
 #include <mntent.h>
+#include <processgroup/format/task_profiles_file.h>
 #include <processgroup/processgroup.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -30,6 +31,8 @@ using ::android::base::LogId;
 using ::android::base::LogSeverity;
 using ::android::base::SetLogger;
 using ::android::base::VERBOSE;
+using ::android::cgrouprc::format::TaskProfilesFileBuilder;
+using ::android::cgrouprc::format::TaskProfilesFileView;
 using ::testing::TestWithParam;
 using ::testing::Values;
 
@@ -206,4 +209,68 @@ INSTANTIATE_TEST_SUITE_P(
                         .log_prefix = "Failed to write",
                         .log_suffix = geteuid() == 0 ? "Invalid argument" : "Permission denied"}));
 
+// Records the tids it is applied to.
+class RecordingAction : public ProfileAction {
+  public:
+    RecordingAction(int failing_tid) : failing_tid_(failing_tid) {}
+    const char* Name() const override { return "Recording"; }
+    bool ExecuteForTask(int tid) const override {
+        tids_.push_back(tid);
+        return tid != failing_tid_;
+    }
+    const std::vector<int>& tids() const { return tids_; }
+
+  private:
+    int failing_tid_;
+    mutable std::vector<int> tids_;
+};
+
+TEST(TaskProfiles, ExecuteForTasksVisitsEveryTid) {
+    auto action = std::make_unique<RecordingAction>(3);
+    const RecordingAction* recorded = action.get();
+    TaskProfile profile("test");
+    profile.Add(std::move(action));
+
+    // A failure for one tid is reported, but doesn't stop the batch.
+    EXPECT_FALSE(profile.ExecuteForTasks({1, 3, 0}));
+    ASSERT_EQ(recorded->tids().size(), 3);
+    EXPECT_EQ(recorded->tids()[0], 1);
+    EXPECT_EQ(recorded->tids()[1], 3);
+    // 0 means the calling thread, as it does for ExecuteForTask().
+    EXPECT_EQ(recorded->tids()[2], gettid());
+
+    EXPECT_TRUE(profile.ExecuteForTasks({}));
+}
+
+TEST(TaskProfilesFile, RoundTrip) {
+    TaskProfilesFileBuilder builder;
+    builder.BeginSection();
+    builder.AddAttribute("UClampMin", "cpu", "cpu.uclamp.min", "");
+    builder.BeginProfile("HighPerformance");
+    builder.BeginAction("JoinCgroup");
+    builder.AddParam("Controller", "cpu");
+    builder.AddParam("Path", "foreground");
+    builder.BeginSection();
+    builder.BeginAggregate("SCHED_SP_DEFAULT");
+    builder.AddMember("HighPerformance");
+    std::string image = builder.Serialize();
+
+    TaskProfilesFileView view;
+    ASSERT_TRUE(view.Init(image.data(), image.size()));
+    ASSERT_EQ(view.header().section_count_, 2);
+    EXPECT_EQ(view.section(0).attribute_count_, 1);
+    EXPECT_EQ(view.section(0).profile_count_, 1);
+    EXPECT_EQ(view.section(1).aggregate_count_, 1);
+    EXPECT_STREQ(view.string(view.attribute(0).file_), "cpu.uclamp.min");
+    EXPECT_STREQ(view.string(view.attribute(0).file_v2_), "");
+    const auto& action = view.action(view.profile(0).first_action_);
+    EXPECT_STREQ(view.string(action.name_), "JoinCgroup");
+    ASSERT_EQ(action.param_count_, 2);
+    EXPECT_STREQ(view.string(view.param(action.first_param_ + 1).value_), "foreground");
+    EXPECT_STREQ(view.member(view.aggregate(0).first_member_), "HighPerformance");
+
+    // A truncated file must not be accepted.
+    EXPECT_FALSE(view.Init(image.data(), image.size() - 1));
+}
+
 }  // namespace
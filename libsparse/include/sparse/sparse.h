@@ -186,6 +186,16 @@ int64_t sparse_file_len(struct sparse_file *s, bool sparse, bool crc);
  */
 unsigned int sparse_file_block_size(struct sparse_file *s);
 
+/**
+ * sparse_file_expanded_len - return the length of the expanded image
+ *
+ * @s - sparse file cookie
+ *
+ * Returns the length passed to sparse_file_new, or read from the header of an
+ * imported sparse file.  Unlike sparse_file_len, no data is read.
+ */
+int64_t sparse_file_expanded_len(struct sparse_file *s);
+
 /**
  * sparse_file_callback - call a callback for blocks in sparse file
  *
@@ -293,6 +303,47 @@ struct sparse_file *sparse_file_import(int fd, bool verbose, bool crc);
  */
 struct sparse_file* sparse_file_import_buf(char* buf, size_t len, bool verbose, bool crc);
 
+/**
+ * struct sparse_stream_callbacks - callbacks for sparse_file_import_stream
+ *
+ * @header - called once before any chunk with the block size and length of
+ *           the expanded image, or NULL
+ * @data - called with the contents of blocks starting at block; a data chunk
+ *         may be split over several calls, each a whole number of blocks
+ * @fill - called for len bytes starting at block that are filled with fill_val
+ * @skip - called for len bytes starting at block whose contents are not
+ *         specified ("don't care"), or NULL
+ *
+ * Each callback should return negative on error, 0 on success.  The data
+ * pointer is only valid for the duration of the call.
+ */
+struct sparse_stream_callbacks {
+	int (*header)(void *priv, unsigned int block_size, int64_t len);
+	int (*data)(void *priv, const void *data, size_t len, unsigned int block);
+	int (*fill)(void *priv, uint32_t fill_val, uint64_t len, unsigned int block);
+	int (*skip)(void *priv, uint64_t len, unsigned int block);
+};
+
+/**
+ * sparse_file_import_stream - read a sparse file from a stream
+ *
+ * @fd - file descriptor to read from
+ * @verbose - print verbose errors while reading the sparse file
+ * @crc - verify the crc of the sparse file
+ * @callbacks - functions to call for the header and each chunk
+ * @priv - value that will be passed as the first argument to the callbacks
+ *
+ * Reads a file in the Android sparse file format front to back, without
+ * seeking, and calls the callbacks for each chunk in order.  Unlike
+ * sparse_file_import, fd may be a pipe or a socket, and no sparse file
+ * cookie is created, so the data does not need to be kept anywhere.  Reading
+ * stops at the end of the sparse file, even if fd has more data.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_import_stream(int fd, bool verbose, bool crc,
+		const struct sparse_stream_callbacks *callbacks, void *priv);
+
 /**
  * sparse_file_import_auto - import an existing sparse or normal file
  *
@@ -324,6 +375,95 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose);
 int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 		struct sparse_file **out_s, int out_s_count);
 
+/**
+ * struct sparse_file_piece - a piece of a sparse file, see sparse_file_plan_pieces
+ *
+ * @start_block - first block of the piece
+ * @end_block - block after the last block of the piece
+ * @len - size of the piece in the Android sparse file format
+ */
+struct sparse_file_piece {
+	unsigned int start_block;
+	unsigned int end_block;
+	int64_t len;
+};
+
+/**
+ * sparse_file_plan_pieces - plan how to split a sparse file into pieces
+ *
+ * @s - sparse file cookie
+ * @max_len - maximum size of a piece
+ * @crc - whether the pieces will have a crc chunk
+ * @pieces - array of pieces to fill in
+ * @pieces_count - size of pieces array
+ *
+ * Like sparse_file_resparse, but only computes the pieces without changing s
+ * or creating new sparse files, and without reading any data.  The pieces
+ * cover consecutive block ranges, each no larger than max_len in the sparse
+ * format, and the data is spread evenly over as few pieces as possible.  Each
+ * piece can then be written with sparse_file_callback_piece, in any order.
+ *
+ * Returns the number of pieces that would have been written to pieces if it
+ * were big enough, or negative errno on error.
+ */
+int sparse_file_plan_pieces(struct sparse_file *s, unsigned int max_len, bool crc,
+		struct sparse_file_piece *pieces, int pieces_count);
+
+/**
+ * sparse_file_callback_piece - call a callback for blocks in a piece of a sparse file
+ *
+ * @s - sparse file cookie
+ * @piece - piece returned by sparse_file_plan_pieces
+ * @crc - append a crc chunk
+ * @write - function to call for each block
+ * @priv - value that will be passed as the first argument to write
+ *
+ * Same as sparse_file_callback in the sparse format, but only writes the
+ * blocks of piece, as a sparse file of the same length as s.  Exactly
+ * piece->len bytes are passed to write.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_callback_piece(struct sparse_file *s, const struct sparse_file_piece *piece,
+		bool crc, int (*write)(void *priv, const void *data, size_t len), void *priv);
+
+/**
+ * sparse_file_copy_blocks - add a range of blocks of one sparse file to another
+ *
+ * @out - sparse file cookie to add the blocks to
+ * @in - sparse file cookie to copy the blocks from
+ * @start_block - first block to copy
+ * @end_block - block after the last block to copy
+ *
+ * Adds the data and fill chunks of in that fall within blocks
+ * [start_block, end_block) to out, at the same offsets.  Both files must have
+ * the same block size, and the blocks must not already be used in out.  The
+ * data itself is not copied: out refers to the same memory, files and file
+ * descriptors as in, which must stay valid until out is destroyed.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_copy_blocks(struct sparse_file *out, struct sparse_file *in,
+		unsigned int start_block, unsigned int end_block);
+
+/**
+ * sparse_file_copy_blocks_to - add a range of blocks of one sparse file to another, moved
+ *
+ * @out - sparse file cookie to add the blocks to
+ * @out_block - block of out that start_block of in is added at
+ * @in - sparse file cookie to copy the blocks from
+ * @start_block - first block to copy
+ * @end_block - block after the last block to copy
+ *
+ * Same as sparse_file_copy_blocks, except that the blocks are added to out
+ * starting at out_block rather than at start_block.  This lets the chunks of
+ * one sparse image be placed inside a larger one without expanding them.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_copy_blocks_to(struct sparse_file *out, unsigned int out_block,
+		struct sparse_file *in, unsigned int start_block, unsigned int end_block);
+
 /**
  * sparse_file_verbose - set a sparse file cookie to print verbose errors
  *
@@ -333,6 +473,34 @@ int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
  */
 void sparse_file_verbose(struct sparse_file *s);
 
+/**
+ * sparse_file_set_threads - set the number of threads used to write a sparse file
+ *
+ * @s - sparse file cookie
+ * @threads - number of threads, or 0 to choose automatically
+ *
+ * When writing with more than one thread, gzip compression and the crc of
+ * large data chunks are computed on worker threads, and the results are
+ * written out in chunk order.  The expanded output is the same as with a
+ * single thread.  By default, images of at least 128MB use one thread per
+ * CPU and smaller images use a single thread.
+ */
+void sparse_file_set_threads(struct sparse_file *s, unsigned int threads);
+
+/**
+ * sparse_file_set_progress - report progress while writing a sparse file
+ *
+ * @s - sparse file cookie
+ * @progress - function to call as chunks are written, or NULL
+ * @priv - value that will be passed as the first argument to progress
+ *
+ * While s is written with sparse_file_write or sparse_file_callback, progress
+ * is called after each chunk with the number of bytes of the expanded image
+ * written so far, and the length of the expanded image.
+ */
+void sparse_file_set_progress(struct sparse_file *s,
+		void (*progress)(void *priv, int64_t done, int64_t total), void *priv);
+
 /**
  * sparse_print_verbose - function called to print verbose errors
  *
@@ -30,6 +30,9 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#include <thread>
+#include <vector>
+
 #include "defs.h"
 #include "output_file.h"
 #include "sparse_crc32.h"
@@ -56,6 +59,22 @@
 
 #define FILL_ZERO_BUFSIZE (2 * 1024 * 1024)
 
+/*
+ * Parallel output: data chunks are checksummed in slices of at least
+ * CRC_SLICE_LEN bytes, and gzip output is deflated in GZ_SEGMENT_LEN segments,
+ * each primed with the GZ_DICT_LEN bytes that precede it so that compression
+ * barely suffers from the split.
+ */
+#define CRC_SLICE_LEN (4 * 1024 * 1024)
+#define GZ_SEGMENT_LEN (1024 * 1024)
+#define GZ_DICT_LEN (32 * 1024)
+
+/*
+ * fd and file backed chunks are mapped and handed to the output this much at
+ * a time, which bounds the address space used for chunks of any size.
+ */
+#define FD_MAP_WINDOW (64 * 1024 * 1024)
+
 #define container_of(inner, outer_t, elem) ((outer_t*)((char*)(inner)-offsetof(outer_t, elem)))
 
 struct output_file_ops {
@@ -66,8 +85,15 @@ struct output_file_ops {
   void (*close)(struct output_file*);
 };
 
+/*
+ * A data chunk is written as begin_data_chunk(), any number of write_data()
+ * calls that add up to len, and end_data_chunk(), so that it can be streamed
+ * from a source that is not in memory all at once.
+ */
 struct sparse_file_ops {
-  int (*write_data_chunk)(struct output_file* out, uint64_t len, void* data);
+  int (*begin_data_chunk)(struct output_file* out, uint64_t len);
+  int (*write_data)(struct output_file* out, uint64_t len, void* data);
+  int (*end_data_chunk)(struct output_file* out, uint64_t len);
   int (*write_fill_chunk)(struct output_file* out, uint64_t len, uint32_t fill_val);
   int (*write_skip_chunk)(struct output_file* out, uint64_t len);
   int (*write_end_chunk)(struct output_file* out);
@@ -80,6 +106,7 @@ struct output_file {
   struct output_file_ops* ops;
   struct sparse_file_ops* sparse_ops;
   int use_crc;
+  unsigned int threads;
   unsigned int block_size;
   int64_t len;
   char* zero_buf;
@@ -94,6 +121,19 @@ struct output_file_gz {
 
 #define to_output_file_gz(_o) container_of((_o), struct output_file_gz, out)
 
+struct output_file_pgz {
+  struct output_file out;
+  int fd;
+  uint32_t crc32;
+  int64_t in_total;
+  char* in_buf;
+  size_t in_len;
+  char dict[GZ_DICT_LEN];
+  size_t dict_len;
+};
+
+#define to_output_file_pgz(_o) container_of((_o), struct output_file_pgz, out)
+
 struct output_file_normal {
   struct output_file out;
   int fd;
@@ -254,6 +294,249 @@ static struct output_file_ops gz_file_ops = {
     .close = gz_file_close,
 };
 
+/*
+ * Runs fn(0) ... fn(count - 1) on up to 'threads' threads, including the
+ * calling one, and returns when all of them are done.
+ */
+template <typename F>
+static void run_parallel(unsigned int threads, size_t count, F fn) {
+  std::vector<std::thread> workers;
+  size_t nr_workers = std::min<size_t>(threads, count);
+
+  for (size_t t = 1; t < nr_workers; t++) {
+    workers.emplace_back([=, &fn]() {
+      for (size_t i = t; i < count; i += nr_workers) fn(i);
+    });
+  }
+  for (size_t i = 0; i < count; i += std::max<size_t>(nr_workers, 1)) fn(i);
+  for (auto& worker : workers) worker.join();
+}
+
+/*
+ * zlib and sparse_crc32 compute the same crc, so slices can be checksummed
+ * independently and combined with crc32_combine.
+ */
+static uint32_t output_file_crc32(struct output_file* out, uint32_t crc, const void* data,
+                                  size_t len) {
+  const char* p = reinterpret_cast<const char*>(data);
+  size_t slices = std::min<size_t>(out->threads, len / CRC_SLICE_LEN);
+
+  if (slices <= 1) {
+    return sparse_crc32(crc, data, len);
+  }
+
+  size_t slice_len = ALIGN(DIV_ROUND_UP(len, slices), 4096);
+  std::vector<uint32_t> crcs(slices);
+  run_parallel(out->threads, slices, [&](size_t i) {
+    size_t start = std::min(i * slice_len, len);
+    size_t end = std::min(start + slice_len, len);
+    crcs[i] = sparse_crc32(0, p + start, end - start);
+  });
+
+  for (size_t i = 0; i < slices; i++) {
+    size_t start = std::min(i * slice_len, len);
+    size_t end = std::min(start + slice_len, len);
+    crc = crc32_combine(crc, crcs[i], end - start);
+  }
+  return crc;
+}
+
+struct pgz_segment {
+  const char* dict;
+  size_t dict_len;
+  const char* data;
+  size_t len;
+  std::vector<unsigned char> out;
+  uint32_t crc32;
+  int ret;
+};
+
+/*
+ * Deflates one segment as a run of raw deflate blocks that ends on a byte
+ * boundary, so that segments compressed independently can be concatenated
+ * into a single stream.  Only the last segment carries the final block.
+ */
+static void pgz_deflate_segment(struct pgz_segment* seg, bool last) {
+  z_stream strm = {};
+  int ret;
+
+  seg->crc32 = sparse_crc32(0, seg->data, seg->len);
+
+  ret = deflateInit2(&strm, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  if (ret != Z_OK) {
+    seg->ret = -ENOMEM;
+    return;
+  }
+  if (seg->dict_len) {
+    deflateSetDictionary(&strm, reinterpret_cast<const Bytef*>(seg->dict), seg->dict_len);
+  }
+
+  seg->out.resize(deflateBound(&strm, seg->len) + 16);
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(seg->data));
+  strm.avail_in = seg->len;
+  strm.next_out = seg->out.data();
+  strm.avail_out = seg->out.size();
+  ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+  seg->ret = (ret == (last ? Z_STREAM_END : Z_OK) && !strm.avail_in) ? 0 : -EIO;
+  seg->out.resize(strm.total_out);
+  deflateEnd(&strm);
+}
+
+static int pgz_write_all(int fd, const void* data, size_t len) {
+  const char* p = reinterpret_cast<const char*>(data);
+  ssize_t ret;
+
+  while (len > 0) {
+    ret = write(fd, p, len);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      error_errno("write");
+      return -1;
+    }
+    p += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/* Compresses the buffered input on the worker threads and writes it out in order. */
+static int pgz_flush(struct output_file_pgz* outpgz, bool last) {
+  size_t count = std::max<size_t>(DIV_ROUND_UP(outpgz->in_len, GZ_SEGMENT_LEN), last ? 1 : 0);
+  std::vector<pgz_segment> segs(count);
+  int ret;
+
+  for (size_t i = 0; i < count; i++) {
+    size_t start = i * GZ_SEGMENT_LEN;
+    segs[i].data = outpgz->in_buf + start;
+    segs[i].len = std::min<size_t>(outpgz->in_len - start, GZ_SEGMENT_LEN);
+    if (i == 0) {
+      segs[i].dict = outpgz->dict;
+      segs[i].dict_len = outpgz->dict_len;
+    } else {
+      segs[i].dict = segs[i].data - GZ_DICT_LEN;
+      segs[i].dict_len = GZ_DICT_LEN;
+    }
+  }
+
+  run_parallel(outpgz->out.threads, count,
+               [&](size_t i) { pgz_deflate_segment(&segs[i], last && i == count - 1); });
+
+  for (size_t i = 0; i < count; i++) {
+    if (segs[i].ret < 0) {
+      error("deflate failed");
+      return segs[i].ret;
+    }
+    ret = pgz_write_all(outpgz->fd, segs[i].out.data(), segs[i].out.size());
+    if (ret < 0) {
+      return ret;
+    }
+    outpgz->crc32 = crc32_combine(outpgz->crc32, segs[i].crc32, segs[i].len);
+  }
+
+  if (outpgz->in_len >= GZ_DICT_LEN) {
+    memcpy(outpgz->dict, outpgz->in_buf + outpgz->in_len - GZ_DICT_LEN, GZ_DICT_LEN);
+    outpgz->dict_len = GZ_DICT_LEN;
+  }
+  outpgz->in_len = 0;
+
+  return 0;
+}
+
+static int pgz_file_open(struct output_file* out, int fd) {
+  struct output_file_pgz* outpgz = to_output_file_pgz(out);
+  /* gzip member header: deflate, no flags, no mtime, maximum compression, unix */
+  static const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 2, 3};
+
+  outpgz->fd = fd;
+  return pgz_write_all(fd, header, sizeof(header));
+}
+
+static int pgz_file_write(struct output_file* out, void* data, size_t len) {
+  struct output_file_pgz* outpgz = to_output_file_pgz(out);
+  size_t buf_size = (size_t)out->threads * GZ_SEGMENT_LEN;
+  size_t to_copy;
+  int ret;
+
+  if (!outpgz->in_buf) {
+    outpgz->in_buf = reinterpret_cast<char*>(malloc(buf_size));
+    if (!outpgz->in_buf) {
+      error_errno("malloc in_buf");
+      return -ENOMEM;
+    }
+  }
+
+  while (len > 0) {
+    to_copy = std::min(len, buf_size - outpgz->in_len);
+    memcpy(outpgz->in_buf + outpgz->in_len, data, to_copy);
+    outpgz->in_len += to_copy;
+    outpgz->in_total += to_copy;
+    data = (char*)data + to_copy;
+    len -= to_copy;
+
+    if (outpgz->in_len == buf_size) {
+      ret = pgz_flush(outpgz, false);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static int pgz_file_skip(struct output_file* out, int64_t cnt) {
+  uint64_t write_len;
+  int ret;
+
+  /* Like gzseek, skipping forward writes zeroes. */
+  while (cnt > 0) {
+    write_len = std::min(cnt, (int64_t)FILL_ZERO_BUFSIZE);
+    ret = pgz_file_write(out, out->zero_buf, write_len);
+    if (ret < 0) {
+      return ret;
+    }
+    cnt -= write_len;
+  }
+  return 0;
+}
+
+static int pgz_file_pad(struct output_file* out, int64_t len) {
+  struct output_file_pgz* outpgz = to_output_file_pgz(out);
+
+  if (outpgz->in_total >= len) {
+    return 0;
+  }
+
+  return pgz_file_skip(out, len - outpgz->in_total);
+}
+
+static void pgz_file_close(struct output_file* out) {
+  struct output_file_pgz* outpgz = to_output_file_pgz(out);
+  unsigned char trailer[8];
+  uint32_t isize = (uint32_t)outpgz->in_total;
+
+  if (!pgz_flush(outpgz, true)) {
+    for (int i = 0; i < 4; i++) {
+      trailer[i] = outpgz->crc32 >> (8 * i);
+      trailer[i + 4] = isize >> (8 * i);
+    }
+    pgz_write_all(outpgz->fd, trailer, sizeof(trailer));
+  }
+
+  free(outpgz->in_buf);
+  free(outpgz);
+}
+
+static struct output_file_ops pgz_file_ops = {
+    .open = pgz_file_open,
+    .skip = pgz_file_skip,
+    .pad = pgz_file_pad,
+    .write = pgz_file_write,
+    .close = pgz_file_close,
+};
+
 static int callback_file_open(struct output_file* out __unused, int fd __unused) {
   return 0;
 }
@@ -373,14 +656,13 @@ static int write_sparse_fill_chunk(struct output_file* out, uint64_t len, uint32
   return 0;
 }
 
-static int write_sparse_data_chunk(struct output_file* out, uint64_t len, void* data) {
+static int write_sparse_data_chunk_begin(struct output_file* out, uint64_t len) {
   chunk_header_t chunk_header;
-  uint64_t rnd_up_len, zero_len;
+  uint64_t rnd_up_len;
   int ret;
 
   /* Round up the data length to a multiple of the block size */
   rnd_up_len = ALIGN(len, out->block_size);
-  zero_len = rnd_up_len - len;
 
   /* Finally we can safely emit a chunk of data */
   chunk_header.chunk_type = CHUNK_TYPE_RAW;
@@ -388,34 +670,38 @@ static int write_sparse_data_chunk(struct output_file* out, uint64_t len, void*
   chunk_header.chunk_sz = rnd_up_len / out->block_size;
   chunk_header.total_sz = CHUNK_HEADER_LEN + rnd_up_len;
   ret = out->ops->write(out, &chunk_header, sizeof(chunk_header));
-
   if (ret < 0) return -1;
+
+  return 0;
+}
+
+static int write_sparse_data(struct output_file* out, uint64_t len, void* data) {
+  int ret;
+
   ret = out->ops->write(out, data, len);
   if (ret < 0) return -1;
-  if (zero_len) {
-    uint64_t len = zero_len;
-    uint64_t write_len;
-    while (len) {
-      write_len = std::min(len, (uint64_t)FILL_ZERO_BUFSIZE);
-      ret = out->ops->write(out, out->zero_buf, write_len);
-      if (ret < 0) {
-        return ret;
-      }
-      len -= write_len;
-    }
-  }
 
   if (out->use_crc) {
-    out->crc32 = sparse_crc32(out->crc32, data, len);
-    if (zero_len) {
-      uint64_t len = zero_len;
-      uint64_t write_len;
-      while (len) {
-        write_len = std::min(len, (uint64_t)FILL_ZERO_BUFSIZE);
-        out->crc32 = sparse_crc32(out->crc32, out->zero_buf, write_len);
-        len -= write_len;
-      }
+    out->crc32 = output_file_crc32(out, out->crc32, data, len);
+  }
+
+  return 0;
+}
+
+static int write_sparse_data_chunk_end(struct output_file* out, uint64_t len) {
+  uint64_t rnd_up_len, zero_len;
+  int ret;
+
+  rnd_up_len = ALIGN(len, out->block_size);
+  zero_len = rnd_up_len - len;
+
+  while (zero_len) {
+    uint64_t write_len = std::min(zero_len, (uint64_t)FILL_ZERO_BUFSIZE);
+    ret = write_sparse_data(out, write_len, out->zero_buf);
+    if (ret < 0) {
+      return ret;
     }
+    zero_len -= write_len;
   }
 
   out->cur_out_ptr += rnd_up_len;
@@ -450,26 +736,31 @@ int write_sparse_end_chunk(struct output_file* out) {
 }
 
 static struct sparse_file_ops sparse_file_ops = {
-    .write_data_chunk = write_sparse_data_chunk,
+    .begin_data_chunk = write_sparse_data_chunk_begin,
+    .write_data = write_sparse_data,
+    .end_data_chunk = write_sparse_data_chunk_end,
     .write_fill_chunk = write_sparse_fill_chunk,
     .write_skip_chunk = write_sparse_skip_chunk,
     .write_end_chunk = write_sparse_end_chunk,
 };
 
-static int write_normal_data_chunk(struct output_file* out, uint64_t len, void* data) {
-  int ret;
-  uint64_t rnd_up_len = ALIGN(len, out->block_size);
+static int write_normal_data_chunk_begin(struct output_file* out __unused,
+                                         uint64_t len __unused) {
+  return 0;
+}
 
-  ret = out->ops->write(out, data, len);
-  if (ret < 0) {
-    return ret;
-  }
+static int write_normal_data(struct output_file* out, uint64_t len, void* data) {
+  return out->ops->write(out, data, len);
+}
+
+static int write_normal_data_chunk_end(struct output_file* out, uint64_t len) {
+  uint64_t rnd_up_len = ALIGN(len, out->block_size);
 
   if (rnd_up_len > len) {
-    ret = out->ops->skip(out, rnd_up_len - len);
+    return out->ops->skip(out, rnd_up_len - len);
   }
 
-  return ret;
+  return 0;
 }
 
 static int write_normal_fill_chunk(struct output_file* out, uint64_t len, uint32_t fill_val) {
@@ -504,7 +795,9 @@ int write_normal_end_chunk(struct output_file* out) {
 }
 
 static struct sparse_file_ops normal_file_ops = {
-    .write_data_chunk = write_normal_data_chunk,
+    .begin_data_chunk = write_normal_data_chunk_begin,
+    .write_data = write_normal_data,
+    .end_data_chunk = write_normal_data_chunk_end,
     .write_fill_chunk = write_normal_fill_chunk,
     .write_skip_chunk = write_normal_skip_chunk,
     .write_end_chunk = write_normal_end_chunk,
@@ -520,7 +813,7 @@ void output_file_close(struct output_file* out) {
 }
 
 static int output_file_init(struct output_file* out, int block_size, int64_t len, bool sparse,
-                            int chunks, bool crc) {
+                            int chunks, bool crc, unsigned int threads) {
   int ret;
 
   out->len = len;
@@ -529,6 +822,7 @@ static int output_file_init(struct output_file* out, int block_size, int64_t len
   out->chunk_cnt = 0;
   out->crc32 = 0;
   out->use_crc = crc;
+  out->threads = std::max(threads, 1U);
 
   // don't use sparse format block size as it can takes up to 32GB
   out->zero_buf = reinterpret_cast<char*>(calloc(FILL_ZERO_BUFSIZE, 1));
@@ -595,6 +889,20 @@ static struct output_file* output_file_new_gz(void) {
   return &outgz->out;
 }
 
+static struct output_file* output_file_new_pgz(unsigned int threads) {
+  struct output_file_pgz* outpgz =
+      reinterpret_cast<struct output_file_pgz*>(calloc(1, sizeof(struct output_file_pgz)));
+  if (!outpgz) {
+    error_errno("malloc struct outpgz");
+    return nullptr;
+  }
+
+  outpgz->out.ops = &pgz_file_ops;
+  outpgz->out.threads = threads;
+
+  return &outpgz->out;
+}
+
 static struct output_file* output_file_new_normal(void) {
   struct output_file_normal* outn =
       reinterpret_cast<struct output_file_normal*>(calloc(1, sizeof(struct output_file_normal)));
@@ -610,7 +918,8 @@ static struct output_file* output_file_new_normal(void) {
 
 struct output_file* output_file_open_callback(int (*write)(void*, const void*, size_t), void* priv,
                                               unsigned int block_size, int64_t len, int gz __unused,
-                                              int sparse, int chunks, int crc) {
+                                              int sparse, int chunks, int crc,
+                                              unsigned int threads) {
   int ret;
   struct output_file_callback* outc;
 
@@ -625,7 +934,7 @@ struct output_file* output_file_open_callback(int (*write)(void*, const void*, s
   outc->priv = priv;
   outc->write = write;
 
-  ret = output_file_init(&outc->out, block_size, len, sparse, chunks, crc);
+  ret = output_file_init(&outc->out, block_size, len, sparse, chunks, crc, threads);
   if (ret < 0) {
     free(outc);
     return nullptr;
@@ -635,11 +944,13 @@ struct output_file* output_file_open_callback(int (*write)(void*, const void*, s
 }
 
 struct output_file* output_file_open_fd(int fd, unsigned int block_size, int64_t len, int gz,
-                                        int sparse, int chunks, int crc) {
+                                        int sparse, int chunks, int crc, unsigned int threads) {
   int ret;
   struct output_file* out;
 
-  if (gz) {
+  if (gz && threads > 1) {
+    out = output_file_new_pgz(threads);
+  } else if (gz) {
     out = output_file_new_gz();
   } else {
     out = output_file_new_normal();
@@ -650,7 +961,7 @@ struct output_file* output_file_open_fd(int fd, unsigned int block_size, int64_t
 
   out->ops->open(out, fd);
 
-  ret = output_file_init(out, block_size, len, sparse, chunks, crc);
+  ret = output_file_init(out, block_size, len, sparse, chunks, crc, threads);
   if (ret < 0) {
     free(out);
     return nullptr;
@@ -661,7 +972,13 @@ struct output_file* output_file_open_fd(int fd, unsigned int block_size, int64_t
 
 /* Write a contiguous region of data blocks from a memory buffer */
 int write_data_chunk(struct output_file* out, uint64_t len, void* data) {
-  return out->sparse_ops->write_data_chunk(out, len, data);
+  int ret;
+
+  ret = out->sparse_ops->begin_data_chunk(out, len);
+  if (ret < 0) return ret;
+  ret = out->sparse_ops->write_data(out, len, data);
+  if (ret < 0) return ret;
+  return out->sparse_ops->end_data_chunk(out, len);
 }
 
 /* Write a contiguous region of data blocks with a fill value */
@@ -669,11 +986,33 @@ int write_fill_chunk(struct output_file* out, uint64_t len, uint32_t fill_val) {
   return out->sparse_ops->write_fill_chunk(out, len, fill_val);
 }
 
+/*
+ * Maps the chunk FD_MAP_WINDOW at a time and passes the mapping itself to the
+ * output, so the data goes from the page cache to the output (or to a
+ * sparse_file_callback() consumer) without being copied.  Each window is
+ * unmapped once written.
+ */
 int write_fd_chunk(struct output_file* out, uint64_t len, int fd, int64_t offset) {
-  auto m = android::base::MappedFile::FromFd(fd, offset, len, PROT_READ);
-  if (!m) return -errno;
+  uint64_t pos, map_len;
+  int ret;
+
+#ifdef __linux__
+  posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  ret = out->sparse_ops->begin_data_chunk(out, len);
+  if (ret < 0) return ret;
+
+  for (pos = 0; pos < len; pos += map_len) {
+    map_len = std::min(len - pos, (uint64_t)FD_MAP_WINDOW);
+    auto m = android::base::MappedFile::FromFd(fd, offset + pos, map_len, PROT_READ);
+    if (!m) return -errno;
+
+    ret = out->sparse_ops->write_data(out, m->size(), m->data());
+    if (ret < 0) return ret;
+  }
 
-  return out->sparse_ops->write_data_chunk(out, m->size(), m->data());
+  return out->sparse_ops->end_data_chunk(out, len);
 }
 
 /* Write a contiguous region of data blocks from a file */
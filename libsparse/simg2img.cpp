@@ -16,6 +16,7 @@
 
 #include <sparse/sparse.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -33,6 +34,76 @@ void usage() {
   fprintf(stderr, "Usage: simg2img <sparse_image_files> <raw_image_file>\n");
 }
 
+struct stream_out {
+  int fd;
+  unsigned int block_size;
+  int64_t len;
+};
+
+static int write_all_at(int fd, const void* data, size_t len, int64_t offset) {
+  const char* p = (const char*)data;
+
+  while (len > 0) {
+    ssize_t ret = pwrite(fd, p, len, offset);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    p += ret;
+    len -= ret;
+    offset += ret;
+  }
+  return 0;
+}
+
+static int stream_header(void* priv, unsigned int block_size, int64_t len) {
+  struct stream_out* out = (struct stream_out*)priv;
+
+  out->block_size = block_size;
+  out->len = len;
+  return 0;
+}
+
+static int stream_data(void* priv, const void* data, size_t len, unsigned int block) {
+  struct stream_out* out = (struct stream_out*)priv;
+
+  return write_all_at(out->fd, data, len, (int64_t)block * out->block_size);
+}
+
+static int stream_fill(void* priv, uint32_t fill_val, uint64_t len, unsigned int block) {
+  struct stream_out* out = (struct stream_out*)priv;
+  uint32_t buf[4096];
+  int64_t offset = (int64_t)block * out->block_size;
+
+  for (size_t i = 0; i < sizeof(buf) / sizeof(buf[0]); i++) buf[i] = fill_val;
+
+  while (len > 0) {
+    size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+    int ret = write_all_at(out->fd, buf, chunk, offset);
+    if (ret < 0) return ret;
+    len -= chunk;
+    offset += chunk;
+  }
+  return 0;
+}
+
+/* Converts a sparse image from a pipe, which sparse_file_import can't read. */
+static int convert_stream(int in, int out) {
+  struct stream_out priv = {.fd = out};
+  struct sparse_stream_callbacks callbacks = {
+      .header = stream_header,
+      .data = stream_data,
+      .fill = stream_fill,
+      .skip = nullptr,
+  };
+  int ret;
+
+  ret = sparse_file_import_stream(in, true, false, &callbacks, &priv);
+  if (ret < 0) return ret;
+
+  return ftruncate(out, priv.len) < 0 ? -errno : 0;
+}
+
 int main(int argc, char* argv[]) {
   int in;
   int out;
@@ -61,6 +132,15 @@ int main(int argc, char* argv[]) {
       }
     }
 
+    if (lseek(in, 0, SEEK_CUR) < 0) {
+      if (convert_stream(in, out) < 0) {
+        fprintf(stderr, "Failed to convert sparse stream\n");
+        exit(-1);
+      }
+      close(in);
+      continue;
+    }
+
     s = sparse_file_import(in, true, false);
     if (!s) {
       fprintf(stderr, "Failed to read sparse file\n");
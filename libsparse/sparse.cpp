@@ -15,8 +15,12 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <thread>
+
 #include <sparse/sparse.h>
 
 #include "defs.h"
@@ -88,35 +92,41 @@ unsigned int sparse_count_chunks(struct sparse_file* s) {
   return chunks;
 }
 
-static int sparse_file_write_block(struct output_file* out, struct backed_block* bb) {
+/* Writes len bytes of a backed block, starting skip bytes into it */
+static int sparse_file_write_block_part(struct output_file* out, struct backed_block* bb,
+                                        uint64_t skip, uint64_t len) {
   int ret = -EINVAL;
 
   switch (backed_block_type(bb)) {
     case BACKED_BLOCK_DATA:
-      ret = write_data_chunk(out, backed_block_len(bb), backed_block_data(bb));
+      ret = write_data_chunk(out, len, (char*)backed_block_data(bb) + skip);
       break;
     case BACKED_BLOCK_FILE:
-      ret = write_file_chunk(out, backed_block_len(bb), backed_block_filename(bb),
-                             backed_block_file_offset(bb));
+      ret = write_file_chunk(out, len, backed_block_filename(bb),
+                             backed_block_file_offset(bb) + skip);
       break;
     case BACKED_BLOCK_FD:
-      ret = write_fd_chunk(out, backed_block_len(bb), backed_block_fd(bb),
-                           backed_block_file_offset(bb));
+      ret = write_fd_chunk(out, len, backed_block_fd(bb), backed_block_file_offset(bb) + skip);
       break;
     case BACKED_BLOCK_FILL:
-      ret = write_fill_chunk(out, backed_block_len(bb), backed_block_fill_val(bb));
+      ret = write_fill_chunk(out, len, backed_block_fill_val(bb));
       break;
   }
 
   return ret;
 }
 
-static int write_all_blocks(struct sparse_file* s, struct output_file* out) {
+static int sparse_file_write_block(struct output_file* out, struct backed_block* bb) {
+  return sparse_file_write_block_part(out, bb, 0, backed_block_len(bb));
+}
+
+static int write_all_blocks(struct sparse_file* s, struct output_file* out, bool progress) {
   struct backed_block* bb;
   unsigned int last_block = 0;
   int64_t pad;
   int ret = 0;
 
+  progress = progress && s->progress;
   for (bb = backed_block_iter_new(s->backed_block_list); bb; bb = backed_block_iter_next(bb)) {
     if (backed_block_block(bb) > last_block) {
       unsigned int blocks = backed_block_block(bb) - last_block;
@@ -125,6 +135,9 @@ static int write_all_blocks(struct sparse_file* s, struct output_file* out) {
     ret = sparse_file_write_block(out, bb);
     if (ret) return ret;
     last_block = backed_block_block(bb) + DIV_ROUND_UP(backed_block_len(bb), s->block_size);
+    if (progress) {
+      s->progress(s->progress_priv, std::min((int64_t)last_block * s->block_size, s->len), s->len);
+    }
   }
 
   pad = s->len - (int64_t)last_block * s->block_size;
@@ -132,10 +145,23 @@ static int write_all_blocks(struct sparse_file* s, struct output_file* out) {
   if (pad > 0) {
     write_skip_chunk(out, pad);
   }
+  if (progress && pad > 0) {
+    s->progress(s->progress_priv, s->len, s->len);
+  }
 
   return 0;
 }
 
+/* Images smaller than this are written on a single thread by default. */
+#define PARALLEL_MIN_LEN (128LL << 20)
+#define PARALLEL_MAX_THREADS 16U
+
+static unsigned int sparse_file_threads(struct sparse_file* s) {
+  if (s->threads) return s->threads;
+  if (s->len < PARALLEL_MIN_LEN) return 1;
+  return std::clamp(std::thread::hardware_concurrency(), 1U, PARALLEL_MAX_THREADS);
+}
+
 /*
  * This is a workaround for 32-bit Windows: Limit the block size to 64 MB before
  * fastboot executable binary for windows 64-bit is released (b/156057250).
@@ -154,11 +180,12 @@ int sparse_file_write(struct sparse_file* s, int fd, bool gz, bool sparse, bool
   }
 
   chunks = sparse_count_chunks(s);
-  out = output_file_open_fd(fd, s->block_size, s->len, gz, sparse, chunks, crc);
+  out = output_file_open_fd(fd, s->block_size, s->len, gz, sparse, chunks, crc,
+                            sparse_file_threads(s));
 
   if (!out) return -ENOMEM;
 
-  ret = write_all_blocks(s, out);
+  ret = write_all_blocks(s, out, true);
 
   output_file_close(out);
 
@@ -172,11 +199,12 @@ int sparse_file_callback(struct sparse_file* s, bool sparse, bool crc,
   struct output_file* out;
 
   chunks = sparse_count_chunks(s);
-  out = output_file_open_callback(write, priv, s->block_size, s->len, false, sparse, chunks, crc);
+  out = output_file_open_callback(write, priv, s->block_size, s->len, false, sparse, chunks, crc,
+                                  sparse_file_threads(s));
 
   if (!out) return -ENOMEM;
 
-  ret = write_all_blocks(s, out);
+  ret = write_all_blocks(s, out, true);
 
   output_file_close(out);
 
@@ -211,7 +239,7 @@ int sparse_file_foreach_chunk(struct sparse_file* s, bool sparse, bool crc,
   chk.block = chk.nr_blocks = 0;
   chunks = sparse_count_chunks(s);
   out = output_file_open_callback(foreach_chunk_write, &chk, s->block_size, s->len, false, sparse,
-                                  chunks, crc);
+                                  chunks, crc, sparse_file_threads(s));
 
   if (!out) return -ENOMEM;
 
@@ -240,12 +268,12 @@ int64_t sparse_file_len(struct sparse_file* s, bool sparse, bool crc) {
   struct output_file* out;
 
   out = output_file_open_callback(out_counter_write, &count, s->block_size, s->len, false, sparse,
-                                  chunks, crc);
+                                  chunks, crc, sparse_file_threads(s));
   if (!out) {
     return -1;
   }
 
-  ret = write_all_blocks(s, out);
+  ret = write_all_blocks(s, out, false);
 
   output_file_close(out);
 
@@ -260,6 +288,10 @@ unsigned int sparse_file_block_size(struct sparse_file* s) {
   return s->block_size;
 }
 
+int64_t sparse_file_expanded_len(struct sparse_file* s) {
+  return s->len;
+}
+
 static struct backed_block* move_chunks_up_to_len(struct sparse_file* from, struct sparse_file* to,
                                                   unsigned int len) {
   int64_t count = 0;
@@ -280,7 +312,7 @@ static struct backed_block* move_chunks_up_to_len(struct sparse_file* from, stru
 
   start = backed_block_iter_new(from->backed_block_list);
   out_counter = output_file_open_callback(out_counter_write, &count, to->block_size, to->len, false,
-                                          true, 0, false);
+                                          true, 0, false, 1);
   if (!out_counter) {
     return nullptr;
   }
@@ -355,6 +387,259 @@ int sparse_file_resparse(struct sparse_file* in_s, unsigned int max_len, struct
   return c;
 }
 
+/*
+ * Calls visit(bb, block, skip, len) for the part of each backed block that
+ * falls within blocks [start, end): len bytes starting skip bytes into bb,
+ * which land at block.
+ */
+template <typename F>
+static int foreach_block_in_range(struct sparse_file* s, unsigned int start, unsigned int end,
+                                  F visit) {
+  struct backed_block* bb;
+  int ret;
+
+  for (bb = backed_block_iter_new(s->backed_block_list); bb; bb = backed_block_iter_next(bb)) {
+    unsigned int bb_start = backed_block_block(bb);
+    unsigned int bb_end = bb_start + DIV_ROUND_UP(backed_block_len(bb), s->block_size);
+    if (bb_end <= start) continue;
+    if (bb_start >= end) break;
+
+    unsigned int part_start = std::max(bb_start, start);
+    unsigned int part_end = std::min(bb_end, end);
+    uint64_t skip = (uint64_t)(part_start - bb_start) * s->block_size;
+    uint64_t len =
+        std::min(backed_block_len(bb) - skip, (uint64_t)(part_end - part_start) * s->block_size);
+    ret = visit(bb, part_start, skip, len);
+    if (ret < 0) return ret;
+  }
+
+  return 0;
+}
+
+/*
+ * Size in the sparse format of a file that holds blocks [start, end) of s, and
+ * the number of chunks in it, not counting the crc chunk.
+ */
+static int64_t sparse_file_piece_len(struct sparse_file* s, unsigned int start, unsigned int end,
+                                     bool crc, unsigned int* chunks) {
+  unsigned int last_block = 0;
+  int64_t len = sizeof(sparse_header_t);
+
+  *chunks = 0;
+  foreach_block_in_range(s, start, end,
+                         [&](struct backed_block* bb, unsigned int block, uint64_t, uint64_t part) {
+                           if (block > last_block) {
+                             (*chunks)++;
+                             len += sizeof(chunk_header_t);
+                           }
+                           (*chunks)++;
+                           len += sizeof(chunk_header_t);
+                           if (backed_block_type(bb) == BACKED_BLOCK_FILL) {
+                             len += sizeof(uint32_t);
+                           } else {
+                             len += ALIGN(part, s->block_size);
+                           }
+                           last_block = block + DIV_ROUND_UP(part, s->block_size);
+                           return 0;
+                         });
+  if (s->len > (int64_t)last_block * s->block_size) {
+    (*chunks)++;
+    len += sizeof(chunk_header_t);
+  }
+  if (crc) {
+    len += sizeof(chunk_header_t) + sizeof(uint32_t);
+  }
+
+  return len;
+}
+
+/*
+ * Greedily fills pieces of at most limit bytes in block order, splitting data
+ * chunks at block boundaries where needed.  Returns the number of pieces, or
+ * -EINVAL if some chunk cannot fit in a piece by itself.
+ */
+static int plan_pieces(struct sparse_file* s, unsigned int limit, bool crc,
+                       struct sparse_file_piece* pieces, int pieces_count) {
+  /* The header, a leading and a trailing skip chunk, and the crc chunk */
+  int64_t overhead = sizeof(sparse_header_t) + 2 * sizeof(chunk_header_t) +
+                     (crc ? sizeof(chunk_header_t) + sizeof(uint32_t) : 0);
+  int64_t budget = (int64_t)limit - overhead;
+  unsigned int total_blocks = DIV_ROUND_UP(s->len, s->block_size);
+  unsigned int piece_start = 0;
+  unsigned int last_block = 0;
+  int64_t cur = 0;
+  bool empty = true;
+  int count = 0;
+
+  auto close_piece = [&](unsigned int end) {
+    if (count < pieces_count) {
+      pieces[count].start_block = piece_start;
+      pieces[count].end_block = end;
+    }
+    count++;
+    piece_start = last_block = end;
+    cur = 0;
+    empty = true;
+  };
+
+  int ret = foreach_block_in_range(
+      s, 0, total_blocks,
+      [&](struct backed_block* bb, unsigned int block, uint64_t, uint64_t len) -> int {
+        bool fill = backed_block_type(bb) == BACKED_BLOCK_FILL;
+
+        while (len) {
+          int64_t gap = (!empty && block > last_block) ? sizeof(chunk_header_t) : 0;
+          int64_t cost = sizeof(chunk_header_t) + (fill ? sizeof(uint32_t) : ALIGN(len, s->block_size));
+          uint64_t take = len;
+
+          if (cur + gap + cost > budget) {
+            int64_t avail = budget - cur - gap - (int64_t)sizeof(chunk_header_t);
+            uint64_t blocks = (!fill && avail > 0) ? avail / s->block_size : 0;
+            if (!blocks) {
+              if (empty) return -EINVAL;
+              close_piece(block);
+              continue;
+            }
+            take = blocks * s->block_size;
+            cost = sizeof(chunk_header_t) + take;
+          }
+
+          cur += gap + cost;
+          empty = false;
+          last_block = block + DIV_ROUND_UP(take, s->block_size);
+          len -= take;
+          if (len) {
+            close_piece(last_block);
+          }
+          block = last_block;
+        }
+        return 0;
+      });
+  if (ret < 0) return ret;
+
+  close_piece(total_blocks);
+  return count;
+}
+
+int sparse_file_plan_pieces(struct sparse_file* s, unsigned int max_len, bool crc,
+                            struct sparse_file_piece* pieces, int pieces_count) {
+  unsigned int lo, hi;
+  unsigned int chunks;
+  int count;
+  int i;
+
+  count = plan_pieces(s, max_len, crc, nullptr, 0);
+  if (count < 0) return count;
+
+  /*
+   * The smallest limit that still needs only count pieces spreads the
+   * data evenly over them.
+   */
+  lo = 1;
+  hi = max_len;
+  while (count > 1 && lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    int c = plan_pieces(s, mid, crc, nullptr, 0);
+    if (c > 0 && c <= count) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  count = plan_pieces(s, hi, crc, pieces, pieces_count);
+  for (i = 0; i < std::min(count, pieces_count); i++) {
+    pieces[i].len =
+        sparse_file_piece_len(s, pieces[i].start_block, pieces[i].end_block, crc, &chunks);
+  }
+
+  return count;
+}
+
+int sparse_file_callback_piece(struct sparse_file* s, const struct sparse_file_piece* piece,
+                               bool crc, int (*write)(void* priv, const void* data, size_t len),
+                               void* priv) {
+  struct output_file* out;
+  unsigned int chunks;
+  unsigned int last_block = 0;
+  int64_t pad;
+  int ret;
+
+  if (piece->start_block > piece->end_block) return -EINVAL;
+
+  sparse_file_piece_len(s, piece->start_block, piece->end_block, crc, &chunks);
+  out = output_file_open_callback(write, priv, s->block_size, s->len, false, true, chunks, crc,
+                                  sparse_file_threads(s));
+  if (!out) return -ENOMEM;
+
+  ret = foreach_block_in_range(
+      s, piece->start_block, piece->end_block,
+      [&](struct backed_block* bb, unsigned int block, uint64_t skip, uint64_t len) -> int {
+        int ret;
+        if (block > last_block) {
+          ret = write_skip_chunk(out, (int64_t)(block - last_block) * s->block_size);
+          if (ret < 0) return ret;
+        }
+        ret = sparse_file_write_block_part(out, bb, skip, len);
+        if (ret < 0) return ret;
+        last_block = block + DIV_ROUND_UP(len, s->block_size);
+        return 0;
+      });
+
+  if (!ret) {
+    pad = s->len - (int64_t)last_block * s->block_size;
+    if (pad > 0) {
+      ret = write_skip_chunk(out, pad);
+    }
+  }
+
+  output_file_close(out);
+
+  return ret;
+}
+
+int sparse_file_copy_blocks(struct sparse_file* out, struct sparse_file* in,
+                            unsigned int start_block, unsigned int end_block) {
+  return sparse_file_copy_blocks_to(out, start_block, in, start_block, end_block);
+}
+
+int sparse_file_copy_blocks_to(struct sparse_file* out, unsigned int out_block,
+                               struct sparse_file* in, unsigned int start_block,
+                               unsigned int end_block) {
+  if (out->block_size != in->block_size || start_block > end_block) return -EINVAL;
+  if (end_block - start_block > UINT_MAX - out_block) return -EINVAL;
+
+  return foreach_block_in_range(
+      in, start_block, end_block,
+      [&](struct backed_block* bb, unsigned int in_block, uint64_t skip, uint64_t len) -> int {
+        unsigned int block = out_block + (in_block - start_block);
+        switch (backed_block_type(bb)) {
+          case BACKED_BLOCK_DATA:
+            return sparse_file_add_data(out, (char*)backed_block_data(bb) + skip, len, block);
+          case BACKED_BLOCK_FILE:
+            return sparse_file_add_file(out, backed_block_filename(bb),
+                                        backed_block_file_offset(bb) + skip, len, block);
+          case BACKED_BLOCK_FD:
+            return sparse_file_add_fd(out, backed_block_fd(bb), backed_block_file_offset(bb) + skip,
+                                      len, block);
+          case BACKED_BLOCK_FILL:
+            return sparse_file_add_fill(out, backed_block_fill_val(bb), len, block);
+        }
+        return -EINVAL;
+      });
+}
+
 void sparse_file_verbose(struct sparse_file* s) {
   s->verbose = true;
 }
+
+void sparse_file_set_threads(struct sparse_file* s, unsigned int threads) {
+  s->threads = threads;
+}
+
+void sparse_file_set_progress(struct sparse_file* s,
+                              void (*progress)(void* priv, int64_t done, int64_t total),
+                              void* priv) {
+  s->progress = progress;
+  s->progress_priv = priv;
+}
@@ -45,8 +45,25 @@
 /* Code taken from FreeBSD 8 */
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-static uint32_t crc32_tab[] = {
+#include <array>
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "sparse_crc32.h"
+
+static constexpr uint32_t crc32_tab[] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
     0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
     0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
@@ -81,17 +98,225 @@ static uint32_t crc32_tab[] = {
     0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d};
 
 /*
- * A function that calculates the CRC-32 based on the table above is
- * given below for documentation purposes. An equivalent implementation
- * of this function that's actually used in the kernel can be found
- * in sys/libkern.h, where it can be inlined.
+ * Tables for slicing-by-8: crc32_slice_tab[k][b] is the crc of byte b
+ * followed by k zero bytes, so eight table lookups advance the crc by eight
+ * bytes at once.
  */
+static constexpr std::array<std::array<uint32_t, 256>, 8> make_slice_tables() {
+  std::array<std::array<uint32_t, 256>, 8> tab = {};
+  for (int i = 0; i < 256; i++) tab[0][i] = crc32_tab[i];
+  for (int k = 1; k < 8; k++) {
+    for (int i = 0; i < 256; i++) {
+      tab[k][i] = (tab[k - 1][i] >> 8) ^ crc32_tab[tab[k - 1][i] & 0xFF];
+    }
+  }
+  return tab;
+}
 
-uint32_t sparse_crc32(uint32_t crc_in, const void* buf, size_t size) {
-  const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
-  uint32_t crc;
+static constexpr std::array<std::array<uint32_t, 256>, 8> crc32_slice_tab = make_slice_tables();
 
-  crc = crc_in ^ ~0U;
+/*
+ * All implementations below take and return the crc register, i.e. the crc
+ * without the initial and final inversion.
+ */
+static uint32_t crc32_bytes(uint32_t crc, const uint8_t* p, size_t size) {
   while (size--) crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-  return crc ^ ~0U;
+  return crc;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t* p, size_t size) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const auto& t = crc32_slice_tab;
+  uint32_t lo, hi;
+
+  while (size >= 8) {
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+          t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    p += 8;
+    size -= 8;
+  }
+#endif
+  return crc32_bytes(crc, p, size);
+}
+
+#if defined(__aarch64__)
+/* ARMv8 CRC32 instructions implement the same (bit-reflected) polynomial. */
+__attribute__((target("crc"))) static uint32_t crc32_armv8(uint32_t crc, const uint8_t* p,
+                                                           size_t size) {
+  uint64_t v;
+
+  while (size && ((uintptr_t)p & 7)) {
+    crc = __crc32b(crc, *p++);
+    size--;
+  }
+  while (size >= 32) {
+    memcpy(&v, p, 8);
+    crc = __crc32d(crc, v);
+    memcpy(&v, p + 8, 8);
+    crc = __crc32d(crc, v);
+    memcpy(&v, p + 16, 8);
+    crc = __crc32d(crc, v);
+    memcpy(&v, p + 24, 8);
+    crc = __crc32d(crc, v);
+    p += 32;
+    size -= 32;
+  }
+  while (size >= 8) {
+    memcpy(&v, p, 8);
+    crc = __crc32d(crc, v);
+    p += 8;
+    size -= 8;
+  }
+  while (size--) crc = __crc32b(crc, *p++);
+  return crc;
+}
+
+static bool cpu_has_armv8_crc32() {
+#if defined(__linux__)
+  return getauxval(AT_HWCAP) & HWCAP_CRC32;
+#elif defined(__APPLE__)
+  return true;
+#else
+  return false;
+#endif
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Folds 64 bytes at a time with carry-less multiplication, then reduces to
+ * 32 bits with a Barrett reduction, as described in "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009). The
+ * constants are the bit-reflected ones for the crc32 polynomial. Requires
+ * size >= 64 and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1"))) static uint32_t crc32_pclmul_fold(uint32_t crc,
+                                                                           const uint8_t* p,
+                                                                           size_t size) {
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+  x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+  x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+  x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  p += 64;
+  size -= 64;
+
+  x0 = k1k2;
+  while (size >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(p + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(p + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(p + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(p + 0x30)));
+    p += 64;
+    size -= 64;
+  }
+
+  /* Fold the four lanes into one. */
+  x0 = k3k4;
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  while (size >= 16) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)p)), x5);
+    p += 16;
+    size -= 16;
+  }
+
+  /* Fold 128 bits to 64. */
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /* Barrett reduction to 32 bits. */
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t* p, size_t size) {
+  if (size >= 64) {
+    size_t fold_size = size & ~(size_t)15;
+    crc = crc32_pclmul_fold(crc, p, fold_size);
+    p += fold_size;
+    size -= fold_size;
+  }
+  return crc32_slice8(crc, p, size);
+}
+
+static bool cpu_has_pclmul() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+typedef uint32_t (*crc32_impl_t)(uint32_t crc, const uint8_t* p, size_t size);
+
+static crc32_impl_t select_hw_crc32_impl() {
+#if defined(__aarch64__)
+  if (cpu_has_armv8_crc32()) return crc32_armv8;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+  if (cpu_has_pclmul()) return crc32_pclmul;
+#endif
+  return nullptr;
+}
+
+static crc32_impl_t hw_crc32_impl() {
+  static const crc32_impl_t impl = select_hw_crc32_impl();
+  return impl;
+}
+
+static uint32_t run_crc32(crc32_impl_t impl, uint32_t crc_in, const void* buf, size_t size) {
+  return impl(crc_in ^ ~0U, reinterpret_cast<const uint8_t*>(buf), size) ^ ~0U;
+}
+
+uint32_t sparse_crc32(uint32_t crc_in, const void* buf, size_t size) {
+  crc32_impl_t impl = hw_crc32_impl();
+  return run_crc32(impl ? impl : crc32_slice8, crc_in, buf, size);
+}
+
+uint32_t sparse_crc32_bytewise(uint32_t crc_in, const void* buf, size_t size) {
+  return run_crc32(crc32_bytes, crc_in, buf, size);
+}
+
+uint32_t sparse_crc32_slice8(uint32_t crc_in, const void* buf, size_t size) {
+  return run_crc32(crc32_slice8, crc_in, buf, size);
+}
+
+bool sparse_crc32_hw_supported() {
+  return hw_crc32_impl() != nullptr;
 }
@@ -19,6 +19,17 @@
 
 #include <stdint.h>
 
+#include <stddef.h>
+
+/*
+ * Uses ARMv8 CRC32 or x86 PCLMULQDQ instructions when the CPU has them, and
+ * slicing-by-8 otherwise.
+ */
 uint32_t sparse_crc32(uint32_t crc, const void* buf, size_t size);
 
+/* The individual implementations, for tests and benchmarks. */
+uint32_t sparse_crc32_bytewise(uint32_t crc, const void* buf, size_t size);
+uint32_t sparse_crc32_slice8(uint32_t crc, const void* buf, size_t size);
+bool sparse_crc32_hw_supported();
+
 #endif
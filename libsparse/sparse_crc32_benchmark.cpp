@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <zlib.h>
+
+#include "sparse_crc32.h"
+
+template <uint32_t (*Crc32)(uint32_t, const void*, size_t)>
+static void BM_crc32(benchmark::State& state) {
+  std::vector<uint8_t> buf(state.range(0));
+  for (auto& c : buf) c = rand();
+
+  uint32_t crc = 0;
+  for (auto _ : state) {
+    crc = Crc32(crc, buf.data(), buf.size());
+    benchmark::DoNotOptimize(crc);
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+}
+
+static uint32_t zlib_crc32(uint32_t crc, const void* buf, size_t size) {
+  return crc32(crc, reinterpret_cast<const Bytef*>(buf), size);
+}
+
+#define CRC32_BENCHMARK(fn) BENCHMARK_TEMPLATE(BM_crc32, fn)->Arg(64)->Arg(4096)->Arg(1 << 20)
+
+CRC32_BENCHMARK(sparse_crc32_bytewise);
+CRC32_BENCHMARK(sparse_crc32_slice8);
+CRC32_BENCHMARK(sparse_crc32);
+CRC32_BENCHMARK(zlib_crc32);
+
+BENCHMARK_MAIN();
@@ -27,6 +27,9 @@ struct sparse_file {
   unsigned int block_size;
   int64_t len;
   bool verbose;
+  unsigned int threads;
+  void (*progress)(void* priv, int64_t done, int64_t total);
+  void* progress_priv;
 
   struct backed_block_list* backed_block_list;
   struct output_file* out;
@@ -457,72 +457,138 @@ static int sparse_file_read_sparse(struct sparse_file* s, SparseFileSource* sour
   return 0;
 }
 
-static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* buf, int64_t offset,
-                                      int64_t remain) {
+/*
+ * Returns true if the block consists of a single repeated 32-bit value.  The
+ * block is compared 64 bytes at a time against the pattern with a branch-free
+ * inner loop, which the compiler turns into SIMD compares.
+ */
+static bool block_is_fill(const uint32_t* buf, unsigned int block_size) {
+  const unsigned int words = block_size / sizeof(uint32_t);
+  const uint32_t val = buf[0];
+  unsigned int i = 0;
+
+  for (; i + 16 <= words; i += 16) {
+    uint32_t diff = 0;
+    for (unsigned int j = 0; j < 16; j++) diff |= buf[i + j] ^ val;
+    if (diff) return false;
+  }
+  for (; i < words; i++) {
+    if (buf[i] != val) return false;
+  }
+  return true;
+}
+
+/*
+ * Reads [offset, offset + remain) in large batches, turning each run of
+ * uniform blocks into a fill chunk and each run of other blocks into an fd
+ * chunk.  The fd must be positioned at offset.
+ */
+static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* buf, size_t buf_len,
+                                      int64_t offset, int64_t remain) {
   int ret;
   unsigned int block = offset / s->block_size;
   unsigned int to_read;
-  unsigned int i;
+  unsigned int i, nr_blocks;
   bool sparse_block;
+  /* The current run of blocks: fill with run_fill, or data if !run_sparse. */
+  unsigned int run_block = block;
+  uint64_t run_len = 0;
+  int64_t run_offset = offset;
+  bool run_sparse = false;
+  uint32_t run_fill = 0;
 
   if (!buf) {
     return -ENOMEM;
   }
 
+  auto flush_run = [&]() -> int {
+    int ret = 0;
+    if (run_len) {
+      if (run_sparse) {
+        /* TODO: add flag to use skip instead of fill for buf[0] == 0 */
+        ret = sparse_file_add_fill(s, run_fill, run_len, run_block);
+      } else {
+        ret = sparse_file_add_fd(s, fd, run_offset, run_len, run_block);
+      }
+    }
+    run_len = 0;
+    return ret;
+  };
+
   while (remain > 0) {
-    to_read = std::min(remain, (int64_t)(s->block_size));
+    to_read = std::min(remain, (int64_t)buf_len);
     ret = read_all(fd, buf, to_read);
     if (ret < 0) {
       error("failed to read sparse file");
       return ret;
     }
 
-    if (to_read == s->block_size) {
-      sparse_block = true;
-      for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-        if (buf[0] != buf[i]) {
-          sparse_block = false;
-          break;
-        }
-      }
-    } else {
-      sparse_block = false;
-    }
+    nr_blocks = DIV_ROUND_UP(to_read, s->block_size);
+    for (i = 0; i < nr_blocks; i++) {
+      uint32_t* block_buf = buf + (size_t)i * s->block_size / sizeof(uint32_t);
+      unsigned int block_len = std::min(to_read - i * s->block_size, s->block_size);
 
-    if (sparse_block) {
-      /* TODO: add flag to use skip instead of fill for buf[0] == 0 */
-      sparse_file_add_fill(s, buf[0], to_read, block);
-    } else {
-      sparse_file_add_fd(s, fd, offset, to_read, block);
+      sparse_block = block_len == s->block_size && block_is_fill(block_buf, s->block_size);
+      if (run_len && (sparse_block != run_sparse || (sparse_block && block_buf[0] != run_fill))) {
+        ret = flush_run();
+        if (ret < 0) return ret;
+      }
+      if (!run_len) {
+        run_block = block;
+        run_offset = offset;
+        run_sparse = sparse_block;
+        run_fill = block_buf[0];
+      }
+      run_len += block_len;
+      block++;
+      offset += block_len;
     }
-
     remain -= to_read;
-    offset += to_read;
-    block++;
   }
 
-  return 0;
+  return flush_run();
 }
 
-static int sparse_file_read_normal(struct sparse_file* s, int fd) {
+/* Batches are a whole number of blocks, of about COPY_BUF_SIZE. */
+static size_t read_normal_buf_len(struct sparse_file* s) {
+  return (size_t)s->block_size * std::max<int64_t>(COPY_BUF_SIZE / s->block_size, 1);
+}
+
+static int sparse_file_read_all(struct sparse_file* s, int fd) {
   int ret;
-  uint32_t* buf = (uint32_t*)malloc(s->block_size);
+  size_t buf_len = read_normal_buf_len(s);
+  uint32_t* buf = (uint32_t*)malloc(buf_len);
 
   if (!buf)
     return -ENOMEM;
 
-  ret = do_sparse_file_read_normal(s, fd, buf, 0, s->len);
+  ret = do_sparse_file_read_normal(s, fd, buf, buf_len, 0, s->len);
   free(buf);
   return ret;
 }
 
 #ifdef __linux__
-static int sparse_file_read_hole(struct sparse_file* s, int fd) {
-  int ret;
-  uint32_t* buf = (uint32_t*)malloc(s->block_size);
+/*
+ * Walks the data extents of the file with SEEK_DATA/SEEK_HOLE and only reads
+ * those.  Holes are either left out of the sparse file, becoming "don't care"
+ * chunks, or added as zero fill chunks if fill_holes is set, as they would be
+ * if they had been read.  Returns -ENOTSUP if the fd cannot report holes.
+ */
+static int sparse_file_read_extents(struct sparse_file* s, int fd, bool fill_holes) {
+  int ret = 0;
+  size_t buf_len = read_normal_buf_len(s);
+  uint32_t* buf;
   int64_t end = 0;
   int64_t start = 0;
+  /* End of the last block that was read or filled. */
+  int64_t done = 0;
 
+  start = lseek(fd, 0, SEEK_DATA);
+  if (start < 0 && errno != ENXIO) {
+    return -ENOTSUP;
+  }
+
+  buf = (uint32_t*)malloc(buf_len);
   if (!buf) {
     return -ENOMEM;
   }
@@ -535,43 +601,85 @@ static int sparse_file_read_hole(struct sparse_file* s, int fd) {
         break;
 
       error("could not seek to data");
-      free(buf);
-      return -errno;
-    } else if (start > s->len) {
+      ret = -errno;
+      goto out;
+    } else if (start >= s->len) {
       break;
     }
 
     end = lseek(fd, start, SEEK_HOLE);
     if (end < 0) {
       error("could not seek to end");
-      free(buf);
-      return -errno;
+      ret = -errno;
+      goto out;
     }
     end = std::min(end, s->len);
 
-    start = ALIGN_DOWN(start, s->block_size);
-    end = ALIGN(end, s->block_size);
+    /* Extents that share a block must not add that block twice. */
+    start = std::max(ALIGN_DOWN(start, s->block_size), done);
+    int64_t read_end = std::min(ALIGN(end, (int64_t)s->block_size), s->len);
+    if (start >= read_end) {
+      continue;
+    }
+
+    if (fill_holes && start > done) {
+      ret = sparse_file_add_fill(s, 0, start - done, done / s->block_size);
+      if (ret < 0) goto out;
+    }
+
     if (lseek(fd, start, SEEK_SET) < 0) {
-      free(buf);
-      return -errno;
+      ret = -errno;
+      goto out;
     }
 
-    ret = do_sparse_file_read_normal(s, fd, buf, start, end - start);
+    ret = do_sparse_file_read_normal(s, fd, buf, buf_len, start, read_end - start);
     if (ret) {
-      free(buf);
-      return ret;
+      goto out;
     }
+    done = read_end;
   } while (end < s->len);
 
+  if (fill_holes && done < s->len) {
+    /* Whole blocks of the trailing hole are filled, a partial last block is read. */
+    int64_t fill_end = ALIGN_DOWN(s->len, (int64_t)s->block_size);
+    if (fill_end > done) {
+      ret = sparse_file_add_fill(s, 0, fill_end - done, done / s->block_size);
+      if (ret < 0) goto out;
+      done = fill_end;
+    }
+    if (done < s->len) {
+      if (lseek(fd, done, SEEK_SET) < 0) {
+        ret = -errno;
+        goto out;
+      }
+      ret = do_sparse_file_read_normal(s, fd, buf, buf_len, done, s->len - done);
+    }
+  }
+
+out:
   free(buf);
-  return 0;
+  return ret;
 }
 #else
-static int sparse_file_read_hole(struct sparse_file* s __unused, int fd __unused) {
+static int sparse_file_read_extents(struct sparse_file* s __unused, int fd __unused,
+                                    bool fill_holes __unused) {
   return -ENOTSUP;
 }
 #endif
 
+static int sparse_file_read_normal(struct sparse_file* s, int fd) {
+  int ret = sparse_file_read_extents(s, fd, true);
+
+  if (ret == -ENOTSUP) {
+    ret = sparse_file_read_all(s, fd);
+  }
+  return ret;
+}
+
+static int sparse_file_read_hole(struct sparse_file* s, int fd) {
+  return sparse_file_read_extents(s, fd, false);
+}
+
 int sparse_file_read(struct sparse_file* s, int fd, enum sparse_read_mode mode, bool crc) {
   if (crc && mode != SPARSE_READ_MODE_SPARSE) {
     return -EINVAL;
@@ -665,6 +773,256 @@ struct sparse_file* sparse_file_import_buf(char* buf, size_t len, bool verbose,
   return sparse_file_import_source(&source, verbose, crc);
 }
 
+/* Reads a sparse file front to back from an fd that need not be seekable */
+class SparseStreamReader {
+ public:
+  SparseStreamReader(int fd, bool verbose, bool crc, const struct sparse_stream_callbacks* cb,
+                     void* priv)
+      : fd_(fd), verbose_(verbose), crc_(crc), cb_(cb), priv_(priv) {}
+  ~SparseStreamReader() { free(buf_); }
+
+  int Run();
+
+ private:
+  int Read(void* ptr, size_t len) {
+    int ret = read_all(fd_, ptr, len);
+    if (ret == -EINVAL) ret = -EOVERFLOW;
+    if (ret == 0) offset_ += len;
+    return ret;
+  }
+
+  /* Reads and drops len bytes */
+  int Discard(uint64_t len) {
+    while (len) {
+      size_t chunk = std::min(len, (uint64_t)buf_len_);
+      int ret = Read(buf_, chunk);
+      if (ret < 0) return ret;
+      len -= chunk;
+    }
+    return 0;
+  }
+
+  /* Updates the crc with len bytes of a repeated 32-bit value */
+  void CrcFill(uint32_t fill_val, uint64_t len) {
+    uint32_t* fillbuf = reinterpret_cast<uint32_t*>(buf_);
+    for (size_t i = 0; i < buf_len_ / sizeof(fill_val); i++) {
+      fillbuf[i] = fill_val;
+    }
+    while (len) {
+      size_t chunk = std::min(len, (uint64_t)buf_len_);
+      crc32_ = sparse_crc32(crc32_, buf_, chunk);
+      len -= chunk;
+    }
+  }
+
+  int ProcessRaw(unsigned int data_size, unsigned int blocks, unsigned int block);
+  int ProcessFill(unsigned int data_size, unsigned int blocks, unsigned int block);
+  int ProcessSkip(unsigned int data_size, unsigned int blocks, unsigned int block);
+  int ProcessCrc32(unsigned int data_size);
+
+  int fd_;
+  bool verbose_;
+  bool crc_;
+  const struct sparse_stream_callbacks* cb_;
+  void* priv_;
+  sparse_header_t header_;
+  char* buf_ = nullptr;
+  size_t buf_len_ = 0;
+  uint32_t crc32_ = 0;
+  int64_t offset_ = 0;
+};
+
+int SparseStreamReader::ProcessRaw(unsigned int data_size, unsigned int blocks,
+                                   unsigned int block) {
+  uint64_t len = (uint64_t)blocks * header_.blk_sz;
+  int ret;
+
+  if (data_size != len) {
+    return -EINVAL;
+  }
+
+  while (len) {
+    size_t chunk = std::min(len, (uint64_t)buf_len_);
+    ret = Read(buf_, chunk);
+    if (ret < 0) return ret;
+    if (crc_) crc32_ = sparse_crc32(crc32_, buf_, chunk);
+    ret = cb_->data(priv_, buf_, chunk, block);
+    if (ret < 0) return ret;
+    block += chunk / header_.blk_sz;
+    len -= chunk;
+  }
+
+  return 0;
+}
+
+int SparseStreamReader::ProcessFill(unsigned int data_size, unsigned int blocks,
+                                    unsigned int block) {
+  uint64_t len = (uint64_t)blocks * header_.blk_sz;
+  uint32_t fill_val;
+  int ret;
+
+  if (data_size != sizeof(fill_val)) {
+    return -EINVAL;
+  }
+
+  ret = Read(&fill_val, sizeof(fill_val));
+  if (ret < 0) return ret;
+
+  if (crc_) CrcFill(fill_val, len);
+
+  return cb_->fill(priv_, fill_val, len, block);
+}
+
+int SparseStreamReader::ProcessSkip(unsigned int data_size, unsigned int blocks,
+                                    unsigned int block) {
+  uint64_t len = (uint64_t)blocks * header_.blk_sz;
+
+  if (data_size != 0) {
+    return -EINVAL;
+  }
+
+  if (crc_) CrcFill(0, len);
+
+  return cb_->skip ? cb_->skip(priv_, len, block) : 0;
+}
+
+int SparseStreamReader::ProcessCrc32(unsigned int data_size) {
+  uint32_t file_crc32;
+  int ret;
+
+  if (data_size != sizeof(file_crc32)) {
+    return -EINVAL;
+  }
+
+  ret = Read(&file_crc32, sizeof(file_crc32));
+  if (ret < 0) return ret;
+
+  if (crc_ && file_crc32 != crc32_) {
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+int SparseStreamReader::Run() {
+  chunk_header_t chunk_header;
+  unsigned int cur_block = 0;
+  unsigned int data_size;
+  unsigned int i;
+  int64_t offset;
+  int ret;
+
+  ret = Read(&header_, sizeof(header_));
+  if (ret < 0) {
+    verbose_error(verbose_, ret, "header");
+    return ret;
+  }
+
+  if (header_.magic != SPARSE_HEADER_MAGIC) {
+    verbose_error(verbose_, -EINVAL, "header magic");
+    return -EINVAL;
+  }
+
+  if (header_.major_version != SPARSE_HEADER_MAJOR_VER) {
+    verbose_error(verbose_, -EINVAL, "header major version");
+    return -EINVAL;
+  }
+
+  if (header_.file_hdr_sz < SPARSE_HEADER_LEN || header_.chunk_hdr_sz < CHUNK_HEADER_LEN ||
+      !header_.blk_sz || (header_.blk_sz % 4) || !header_.total_blks) {
+    verbose_error(verbose_, -EINVAL, "header");
+    return -EINVAL;
+  }
+
+  /* Whole blocks, about COPY_BUF_SIZE at a time */
+  buf_len_ = (size_t)header_.blk_sz * std::max<int64_t>(COPY_BUF_SIZE / header_.blk_sz, 1);
+  buf_ = reinterpret_cast<char*>(malloc(buf_len_));
+  if (!buf_) {
+    return -ENOMEM;
+  }
+
+  /* Skip the remaining bytes in a header that is longer than we expected */
+  ret = Discard(header_.file_hdr_sz - SPARSE_HEADER_LEN);
+  if (ret < 0) return ret;
+
+  if (cb_->header) {
+    ret = cb_->header(priv_, header_.blk_sz, (int64_t)header_.total_blks * header_.blk_sz);
+    if (ret < 0) return ret;
+  }
+
+  for (i = 0; i < header_.total_chunks; i++) {
+    offset = offset_;
+    ret = Read(&chunk_header, sizeof(chunk_header));
+    if (ret < 0) {
+      verbose_error(verbose_, ret, "chunk header at %" PRId64, offset);
+      return ret;
+    }
+    ret = Discard(header_.chunk_hdr_sz - CHUNK_HEADER_LEN);
+    if (ret < 0) return ret;
+
+    if (chunk_header.total_sz < header_.chunk_hdr_sz) {
+      verbose_error(verbose_, -EINVAL, "chunk size at %" PRId64, offset);
+      return -EINVAL;
+    }
+    data_size = chunk_header.total_sz - header_.chunk_hdr_sz;
+
+    if ((chunk_header.chunk_type == CHUNK_TYPE_RAW || chunk_header.chunk_type == CHUNK_TYPE_FILL ||
+         chunk_header.chunk_type == CHUNK_TYPE_DONT_CARE) &&
+        chunk_header.chunk_sz > header_.total_blks - cur_block) {
+      verbose_error(verbose_, -EINVAL, "chunk past the end at %" PRId64, offset);
+      return -EINVAL;
+    }
+
+    switch (chunk_header.chunk_type) {
+      case CHUNK_TYPE_RAW:
+        ret = ProcessRaw(data_size, chunk_header.chunk_sz, cur_block);
+        if (ret < 0) verbose_error(verbose_, ret, "data block at %" PRId64, offset);
+        break;
+      case CHUNK_TYPE_FILL:
+        ret = ProcessFill(data_size, chunk_header.chunk_sz, cur_block);
+        if (ret < 0) verbose_error(verbose_, ret, "fill block at %" PRId64, offset);
+        break;
+      case CHUNK_TYPE_DONT_CARE:
+        ret = ProcessSkip(data_size, chunk_header.chunk_sz, cur_block);
+        if (ret < 0) verbose_error(verbose_, ret, "skip block at %" PRId64, offset);
+        break;
+      case CHUNK_TYPE_CRC32:
+        ret = ProcessCrc32(data_size);
+        if (ret < 0) verbose_error(verbose_, ret, "crc block at %" PRId64, offset);
+        break;
+      default:
+        verbose_error(verbose_, -EINVAL, "unknown block %04X at %" PRId64,
+                      chunk_header.chunk_type, offset);
+        ret = Discard(data_size);
+        break;
+    }
+    if (ret < 0) return ret;
+
+    if (chunk_header.chunk_type == CHUNK_TYPE_RAW || chunk_header.chunk_type == CHUNK_TYPE_FILL ||
+        chunk_header.chunk_type == CHUNK_TYPE_DONT_CARE) {
+      cur_block += chunk_header.chunk_sz;
+    }
+  }
+
+  if (header_.total_blks != cur_block) {
+    verbose_error(verbose_, -EINVAL, "end of file, %u of %u blocks", cur_block,
+                  header_.total_blks);
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+int sparse_file_import_stream(int fd, bool verbose, bool crc,
+                              const struct sparse_stream_callbacks* callbacks, void* priv) {
+  if (!callbacks || !callbacks->data || !callbacks->fill) {
+    return -EINVAL;
+  }
+
+  SparseStreamReader reader(fd, verbose, crc, callbacks, priv);
+  return reader.Run();
+}
+
 struct sparse_file* sparse_file_import_auto(int fd, bool crc, bool verbose) {
   struct sparse_file* s;
   int64_t len;
@@ -17,6 +17,8 @@
 #pragma once
 
 #include <log/log_event_list.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/uio.h>
 
 #ifdef __cplusplus
@@ -29,6 +31,24 @@ void stats_log_close();
 int android_log_write_char_array(android_log_context ctx, const char* value, size_t len);
 extern int (*write_to_statsd)(struct iovec* vec, size_t nr);
 
+/*
+ * Batches writes to statsd: events are queued without blocking and sent from a writer thread,
+ * several per syscall. Events are then delivered up to a few tens of milliseconds late, and
+ * any still queued when the process exits are lost. Returns 0 or a negative errno.
+ */
+int stats_log_set_batching(bool enable);
+/* Asks the writer thread to send queued events now. */
+void stats_log_flush();
+
+struct stats_log_batch_stats {
+    uint64_t queued;     /* events queued for the writer thread */
+    uint64_t sent;       /* queued events the writer thread sent */
+    uint64_t flushes;    /* batches sent with a single syscall */
+    uint64_t overflowed; /* events that found the queue full, making the caller send it */
+    uint64_t dropped;    /* queued events statsd didn't accept */
+};
+void stats_log_get_batch_stats(struct stats_log_batch_stats* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,8 @@
  */
 #include "statsd_writer.h"
 
+#include "include/stats_event_list.h"
+
 #include <cutils/fs.h>
 #include <cutils/sockets.h>
 #include <cutils/threads.h>
@@ -24,11 +26,15 @@
 #include <poll.h>
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdarg.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -61,8 +67,11 @@ static int statsdAvailable();
 static int statsdOpen();
 static void statsdClose();
 static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr);
+static int statsdWriteNow(struct timespec* ts, struct iovec* vec, size_t nr, pid_t tid);
 static void statsdNoteDrop(int error, int tag);
 
+static atomic_bool batching_enabled = false;
+
 struct android_log_transport_write statsdLoggerWrite = {
         .name = "statsd",
         .sock = -EBADF,
@@ -153,7 +162,47 @@ static void statsdNoteDrop(int error, int tag) {
     atomic_exchange_explicit(&atom_tag, tag, memory_order_relaxed);
 }
 
+static void statsdReportDrops(int sock, android_log_header_t* header) {
+    int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (snapshot) {
+        android_log_event_long_t buffer;
+        header->id = LOG_ID_STATS;
+        // store the last log error in the tag field. This tag field is not used by statsd.
+        buffer.header.tag = atomic_load(&log_error);
+        buffer.payload.type = EVENT_TYPE_LONG;
+        // format:
+        // |atom_tag|dropped_count|
+        int64_t composed_long = atomic_load(&atom_tag);
+        // Send 2 int32's via an int64.
+        composed_long = ((composed_long << 32) | ((int64_t)snapshot));
+        buffer.payload.data = composed_long;
+
+        struct iovec vec[2] = {
+                {.iov_base = header, .iov_len = sizeof(*header)},
+                {.iov_base = &buffer, .iov_len = sizeof(buffer)},
+        };
+        ssize_t ret = TEMP_FAILURE_RETRY(writev(sock, vec, 2));
+        if (ret != (ssize_t)(sizeof(*header) + sizeof(buffer))) {
+            atomic_fetch_add_explicit(&dropped, snapshot, memory_order_relaxed);
+        }
+    }
+}
+
+static bool batchEnqueue(struct timespec* ts, struct iovec* vec, size_t nr);
+
 static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
+    if (atomic_load_explicit(&batching_enabled, memory_order_relaxed) &&
+        batchEnqueue(ts, vec, nr)) {
+        size_t len = 0;
+        for (size_t i = 0; i < nr; i++) {
+            len += vec[i].iov_len;
+        }
+        return len;
+    }
+    return statsdWriteNow(ts, vec, nr, gettid());
+}
+
+static int statsdWriteNow(struct timespec* ts, struct iovec* vec, size_t nr, pid_t tid) {
     ssize_t ret;
     int sock;
     static const unsigned headerLength = 1;
@@ -188,7 +237,7 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
      *  };
      */
 
-    header.tid = gettid();
+    header.tid = tid;
     header.realtime.tv_sec = ts->tv_sec;
     header.realtime.tv_nsec = ts->tv_nsec;
 
@@ -197,28 +246,7 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
 
     // If we dropped events before, try to tell statsd.
     if (sock >= 0) {
-        int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
-        if (snapshot) {
-            android_log_event_long_t buffer;
-            header.id = LOG_ID_STATS;
-            // store the last log error in the tag field. This tag field is not used by statsd.
-            buffer.header.tag = atomic_load(&log_error);
-            buffer.payload.type = EVENT_TYPE_LONG;
-            // format:
-            // |atom_tag|dropped_count|
-            int64_t composed_long = atomic_load(&atom_tag);
-            // Send 2 int32's via an int64.
-            composed_long = ((composed_long << 32) | ((int64_t)snapshot));
-            buffer.payload.data = composed_long;
-
-            newVec[headerLength].iov_base = &buffer;
-            newVec[headerLength].iov_len = sizeof(buffer);
-
-            ret = TEMP_FAILURE_RETRY(writev(sock, newVec, 2));
-            if (ret != (ssize_t)(sizeof(header) + sizeof(buffer))) {
-                atomic_fetch_add_explicit(&dropped, snapshot, memory_order_relaxed);
-            }
-        }
+        statsdReportDrops(sock, &header);
     }
 
     header.id = LOG_ID_STATS;
@@ -283,3 +311,303 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
 
     return ret;
 }
+
+/*
+ * Batched writes.
+ *
+ * When enabled, events are serialized into a ring of fixed-size slots instead of being written
+ * to the socket by the caller. A writer thread sends them with one sendmmsg() per batch, when
+ * BATCH_FLUSH_THRESHOLD events are pending or every BATCH_FLUSH_INTERVAL_MS. statsd reads one
+ * event per datagram, so each event stays its own message. Producers never block: events that
+ * don't fit a slot are written directly, and a caller that finds the ring full drains it.
+ *
+ * The ring is a bounded multi-producer queue: each slot's sequence number says whether it is
+ * free for the producer at that position or ready for the writer.
+ */
+#define BATCH_SLOTS 64
+#define BATCH_SLOT_PAYLOAD 512
+#define BATCH_FLUSH_THRESHOLD 16
+#define BATCH_FLUSH_INTERVAL_MS 20
+
+struct batch_slot {
+    atomic_uint seq;
+    uint16_t len;
+    android_log_header_t header;
+    uint8_t payload[BATCH_SLOT_PAYLOAD];
+};
+
+static struct batch_slot* batch_slots;
+static atomic_uint batch_enqueue_pos = 0;
+static atomic_uint batch_dequeue_pos = 0;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Held while draining the ring, by the writer thread or by a caller that found it full. */
+static pthread_mutex_t batch_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Set while this thread is queueing or draining events. */
+static __thread bool batch_busy;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool batch_thread_started = false;
+
+static atomic_uint_least64_t batch_queued = 0;
+static atomic_uint_least64_t batch_sent = 0;
+static atomic_uint_least64_t batch_flushes = 0;
+static atomic_uint_least64_t batch_overflowed = 0;
+static atomic_uint_least64_t batch_dropped = 0;
+
+static void batchWakeWriter() {
+    pthread_mutex_lock(&batch_lock);
+    pthread_cond_signal(&batch_cond);
+    pthread_mutex_unlock(&batch_lock);
+}
+
+static bool batchTryEnqueue(struct timespec* ts, struct iovec* vec, size_t nr, size_t len) {
+    if (batch_busy) {
+        return false;
+    }
+
+    struct batch_slot* slot;
+    unsigned pos = atomic_load_explicit(&batch_enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        slot = &batch_slots[pos % BATCH_SLOTS];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        if (diff == 0) {
+            batch_busy = true;
+            if (atomic_compare_exchange_weak_explicit(&batch_enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+            batch_busy = false;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&batch_enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->len = len;
+    slot->header.id = LOG_ID_STATS;
+    slot->header.tid = gettid();
+    slot->header.realtime.tv_sec = ts->tv_sec;
+    slot->header.realtime.tv_nsec = ts->tv_nsec;
+    uint8_t* p = slot->payload;
+    for (size_t i = 0; i < nr; i++) {
+        memcpy(p, vec[i].iov_base, vec[i].iov_len);
+        p += vec[i].iov_len;
+    }
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    batch_busy = false;
+    atomic_fetch_add_explicit(&batch_queued, 1, memory_order_relaxed);
+
+    unsigned pending = pos + 1 - atomic_load_explicit(&batch_dequeue_pos, memory_order_relaxed);
+    if (pending == BATCH_FLUSH_THRESHOLD) {
+        batchWakeWriter();
+    }
+    return true;
+}
+
+static size_t batchFlush();
+
+/*
+ * Returns false if the event must be written directly. Events stay in order: when the ring is
+ * full the caller drains it itself, which is also what slows down callers that log faster than
+ * the writer thread keeps up with.
+ */
+static bool batchEnqueue(struct timespec* ts, struct iovec* vec, size_t nr) {
+    size_t len = 0;
+    for (size_t i = 0; i < nr; i++) {
+        len += vec[i].iov_len;
+    }
+
+    if (len <= BATCH_SLOT_PAYLOAD) {
+        if (batchTryEnqueue(ts, vec, nr, len)) {
+            return true;
+        }
+        atomic_fetch_add_explicit(&batch_overflowed, 1, memory_order_relaxed);
+    }
+
+    /*
+     * A signal handler that interrupted this thread while it was queueing or draining can't wait
+     * for the ring, which would deadlock, so it writes directly.
+     */
+    if (batch_busy) {
+        return false;
+    }
+    unsigned target = atomic_load_explicit(&batch_enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        if (pthread_mutex_trylock(&batch_flush_lock) == 0) {
+            batch_busy = true;
+            while (batchFlush() == BATCH_SLOTS) {
+            }
+            batch_busy = false;
+            pthread_mutex_unlock(&batch_flush_lock);
+        } else {
+            sched_yield();
+        }
+
+        if (len <= BATCH_SLOT_PAYLOAD) {
+            if (batchTryEnqueue(ts, vec, nr, len)) {
+                return true;
+            }
+        } else if ((int)(atomic_load_explicit(&batch_dequeue_pos, memory_order_acquire) -
+                         target) >= 0) {
+            // Large events are written directly, after everything queued before them.
+            return false;
+        }
+    }
+}
+
+/* batch_flush_lock assumed. Returns the number of events taken from the ring. */
+static size_t batchFlush() {
+    struct mmsghdr msgs[BATCH_SLOTS];
+    struct iovec iovs[BATCH_SLOTS][2];
+    struct batch_slot* slots[BATCH_SLOTS];
+    unsigned pos = atomic_load_explicit(&batch_dequeue_pos, memory_order_relaxed);
+    size_t count = 0;
+
+    while (count < BATCH_SLOTS) {
+        struct batch_slot* slot = &batch_slots[(pos + count) % BATCH_SLOTS];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + count + 1) {
+            break;
+        }
+        iovs[count][0].iov_base = &slot->header;
+        iovs[count][0].iov_len = sizeof(slot->header);
+        iovs[count][1].iov_base = slot->payload;
+        iovs[count][1].iov_len = slot->len;
+        memset(&msgs[count], 0, sizeof(msgs[count]));
+        msgs[count].msg_hdr.msg_iov = iovs[count];
+        msgs[count].msg_hdr.msg_iovlen = 2;
+        slots[count] = slot;
+        count++;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t sent = 0;
+    int sock = atomic_load(&statsdLoggerWrite.sock);
+    if (sock >= 0) {
+        android_log_header_t header = {.tid = gettid()};
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        header.realtime.tv_sec = ts.tv_sec;
+        header.realtime.tv_nsec = ts.tv_nsec;
+        statsdReportDrops(sock, &header);
+
+        int ret = TEMP_FAILURE_RETRY(sendmmsg(sock, msgs, count, 0));
+        if (ret > 0) {
+            sent = ret;
+            atomic_fetch_add_explicit(&batch_flushes, 1, memory_order_relaxed);
+        }
+    }
+    // Whatever wasn't sent goes through the normal path, which reconnects to statsd if needed
+    // and accounts for drops.
+    for (size_t i = sent; i < count; i++) {
+        struct timespec ts = {
+                .tv_sec = slots[i]->header.realtime.tv_sec,
+                .tv_nsec = slots[i]->header.realtime.tv_nsec,
+        };
+        struct iovec vec = {.iov_base = slots[i]->payload, .iov_len = slots[i]->len};
+        if (statsdWriteNow(&ts, &vec, 1, slots[i]->header.tid) < 0) {
+            uint32_t tag = 0;
+            if (slots[i]->len >= sizeof(tag)) {
+                memcpy(&tag, slots[i]->payload, sizeof(tag));
+            }
+            statsdNoteDrop(-EAGAIN, tag);
+            atomic_fetch_add_explicit(&batch_dropped, 1, memory_order_relaxed);
+        } else {
+            sent++;
+        }
+    }
+    atomic_fetch_add_explicit(&batch_sent, sent, memory_order_relaxed);
+
+    for (size_t i = 0; i < count; i++) {
+        atomic_store_explicit(&slots[i]->seq, pos + i + BATCH_SLOTS, memory_order_release);
+    }
+    atomic_store_explicit(&batch_dequeue_pos, pos + count, memory_order_relaxed);
+    return count;
+}
+
+static void* batchWriterThread(void* arg __attribute__((unused))) {
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += BATCH_FLUSH_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&batch_lock);
+        pthread_cond_timedwait(&batch_cond, &batch_lock, &deadline);
+        pthread_mutex_unlock(&batch_lock);
+
+        pthread_mutex_lock(&batch_flush_lock);
+        batch_busy = true;
+        while (batchFlush() == BATCH_SLOTS) {
+        }
+        batch_busy = false;
+        pthread_mutex_unlock(&batch_flush_lock);
+    }
+    return NULL;
+}
+
+static void batchAtforkChild() {
+    // The writer thread doesn't survive fork; the child goes back to writing directly.
+    atomic_store(&batching_enabled, false);
+    atomic_store(&batch_thread_started, false);
+}
+
+int stats_log_set_batching(bool enable) {
+    if (!enable) {
+        atomic_store(&batching_enabled, false);
+        if (atomic_load(&batch_thread_started)) {
+            // Let the writer send what is already queued.
+            batchWakeWriter();
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&batch_lock);
+    if (!atomic_load(&batch_thread_started)) {
+        if (!batch_slots) {
+            batch_slots = calloc(BATCH_SLOTS, sizeof(*batch_slots));
+            if (!batch_slots) {
+                pthread_mutex_unlock(&batch_lock);
+                return -ENOMEM;
+            }
+            unsigned pos = atomic_load(&batch_enqueue_pos);
+            for (unsigned i = 0; i < BATCH_SLOTS; i++) {
+                atomic_init(&batch_slots[(pos + i) % BATCH_SLOTS].seq, pos + i);
+            }
+            pthread_atfork(NULL, NULL, batchAtforkChild);
+        }
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        int ret = pthread_create(&thread, &attr, batchWriterThread, NULL);
+        pthread_attr_destroy(&attr);
+        if (ret) {
+            pthread_mutex_unlock(&batch_lock);
+            return -ret;
+        }
+        atomic_store(&batch_thread_started, true);
+    }
+    atomic_store(&batching_enabled, true);
+    pthread_mutex_unlock(&batch_lock);
+    return 0;
+}
+
+void stats_log_flush() {
+    if (atomic_load(&batch_thread_started)) {
+        batchWakeWriter();
+    }
+}
+
+void stats_log_get_batch_stats(struct stats_log_batch_stats* stats) {
+    stats->queued = atomic_load_explicit(&batch_queued, memory_order_relaxed);
+    stats->sent = atomic_load_explicit(&batch_sent, memory_order_relaxed);
+    stats->flushes = atomic_load_explicit(&batch_flushes, memory_order_relaxed);
+    stats->overflowed = atomic_load_explicit(&batch_overflowed, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&batch_dropped, memory_order_relaxed);
+}
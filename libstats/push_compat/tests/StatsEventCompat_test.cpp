@@ -15,6 +15,7 @@
  */
 
 #include "include/StatsEventCompat.h"
+#include "include/stats_event_list.h"
 #include <android-base/properties.h>
 #include <android/api-level.h>
 #include <gtest/gtest.h>
@@ -27,3 +28,29 @@ TEST(StatsEventCompatTest, TestDynamicLoading) {
     StatsEventCompat event;
     EXPECT_EQ(mPlatformAtLeastR, event.useRSchema());
 }
+
+TEST(StatsEventCompatTest, TestBatchedWrites) {
+    // Atom 0 is not a valid atom, so statsd discards these events.
+    const uint64_t kNumEvents = 200;
+    {
+        stats_event_list event(0);
+        if (event.write(LOG_ID_STATS) < 0) {
+            GTEST_SKIP() << "statsd socket unavailable";
+        }
+    }
+
+    ASSERT_EQ(0, stats_log_set_batching(true));
+    stats_log_batch_stats before;
+    stats_log_get_batch_stats(&before);
+    for (uint64_t i = 0; i < kNumEvents; i++) {
+        stats_event_list event(0);
+        event << static_cast<int32_t>(i);
+        EXPECT_GE(event.write(LOG_ID_STATS), 0);
+    }
+    stats_log_batch_stats after;
+    stats_log_get_batch_stats(&after);
+    ASSERT_EQ(0, stats_log_set_batching(false));
+
+    EXPECT_EQ(kNumEvents, after.queued - before.queued);
+    EXPECT_LE(after.sent, after.queued);
+}
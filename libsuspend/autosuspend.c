@@ -113,3 +113,16 @@ void autosuspend_set_wakeup_callback(void (*func)(bool success)) {
 
     autosuspend_ops->set_wakeup_callback(func);
 }
+
+void autosuspend_set_event_driven(bool enabled) {
+    int ret;
+
+    ret = autosuspend_init();
+    if (ret) {
+        return;
+    }
+
+    ALOGV("set_event_driven %d", enabled);
+
+    autosuspend_ops->set_event_driven(enabled);
+}
@@ -28,6 +28,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
+
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/strings.h>
@@ -52,6 +54,7 @@ static int sleep_time = BASE_SLEEP_TIME;
 static constexpr char sys_power_state[] = "/sys/power/state";
 static constexpr char sys_power_wakeup_count[] = "/sys/power/wakeup_count";
 static bool autosuspend_is_init = false;
+static std::atomic<bool> event_driven = false;
 
 static void update_sleep_time(bool success) {
     if (success) {
@@ -64,25 +67,45 @@ static void update_sleep_time(bool success) {
 
 static void* suspend_thread_func(void* arg __attribute__((unused))) {
     bool success = true;
+    // The wakeup count of the last failed attempt, in event-driven mode.
+    std::string failed_wakeup_count;
 
     while (true) {
         update_sleep_time(success);
-        usleep(sleep_time);
+        // In event-driven mode, reading wakeup_count is the wait: the kernel blocks the read
+        // while any wakeup event is still being processed.
+        if (!event_driven) {
+            usleep(sleep_time);
+        }
         success = false;
         LOG(VERBOSE) << "read wakeup_count";
         lseek(wakeup_count_fd, 0, SEEK_SET);
         std::string wakeup_count;
         if (!ReadFdToString(wakeup_count_fd, &wakeup_count)) {
             PLOG(ERROR) << "error reading from " << sys_power_wakeup_count;
+            if (event_driven) usleep(sleep_time);
             continue;
         }
 
         wakeup_count = Trim(wakeup_count);
         if (wakeup_count.empty()) {
             LOG(ERROR) << "empty wakeup count";
+            if (event_driven) usleep(sleep_time);
             continue;
         }
 
+        if (event_driven && wakeup_count == failed_wakeup_count) {
+            // No wakeup event since the last attempt failed, so trying again now would most
+            // likely fail the same way. Back off as the default mode does.
+            LOG(VERBOSE) << "no wakeup event since failed attempt, backing off";
+            usleep(sleep_time);
+            continue;
+        }
+        if (event_driven && !failed_wakeup_count.empty()) {
+            // The last attempt failed because of a wakeup event, which isn't worth backing off for.
+            sleep_time = BASE_SLEEP_TIME;
+        }
+
         LOG(VERBOSE) << "wait";
         int ret = sem_wait(&suspend_lockout);
         if (ret < 0) {
@@ -103,6 +126,8 @@ static void* suspend_thread_func(void* arg __attribute__((unused))) {
             PLOG(ERROR) << "error writing to " << sys_power_wakeup_count;
         }
 
+        failed_wakeup_count = success ? "" : wakeup_count;
+
         LOG(VERBOSE) << "release sem";
         ret = sem_post(&suspend_lockout);
         if (ret < 0) {
@@ -224,11 +249,17 @@ static void autosuspend_set_wakeup_callback(void (*func)(bool success)) {
     wakeup_func = func;
 }
 
+static void autosuspend_set_event_driven(bool enabled) {
+    LOG(VERBOSE) << "autosuspend_set_event_driven: " << enabled;
+    event_driven = enabled;
+}
+
 struct autosuspend_ops autosuspend_wakeup_count_ops = {
     .enable = autosuspend_wakeup_count_enable,
     .disable = autosuspend_wakeup_count_disable,
     .force_suspend = force_suspend,
     .set_wakeup_callback = autosuspend_set_wakeup_callback,
+    .set_event_driven = autosuspend_set_event_driven,
 };
 
 struct autosuspend_ops* autosuspend_wakeup_count_init(void) {
@@ -64,6 +64,17 @@ int autosuspend_force_suspend(int timeout_ms);
  */
 void autosuspend_set_wakeup_callback(void (*func)(bool success));
 
+/*
+ * autosuspend_set_event_driven
+ *
+ * By default, autosuspend waits before each attempt to suspend, and backs off
+ * exponentially after failed attempts.  In event-driven mode it instead tries
+ * again as soon as the wakeup events that interrupted the last attempt have
+ * been processed, and only backs off when an attempt fails without any new
+ * wakeup event, for example because a driver refused to suspend.
+ */
+void autosuspend_set_event_driven(bool enabled);
+
 __END_DECLS
 
 #endif
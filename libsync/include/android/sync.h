@@ -37,6 +37,8 @@
  * break builds.
  */
 
+#include <stddef.h>
+
 #include "../ndk/sync.h"
 
 __BEGIN_DECLS
@@ -44,6 +46,33 @@ __BEGIN_DECLS
 /* timeout in msecs */
 int sync_wait(int fd, int timeout);
 
+/* Merges |count| sync files into one new sync file, as sync_merge() does for
+ * two. The files are merged pairwise in a balanced tree, so no intermediate
+ * sync file holds more than half of the fences, and intermediates are closed
+ * as soon as they have been merged. With a single input, returns a dup() of
+ * it. The inputs remain valid, and the caller is responsible for closing them.
+ *
+ * Returns the new fd, or -1 with errno set.
+ */
+int sync_merge_many(const char* name, const int* fds, size_t count);
+
+/* Waits with a single poll() for any of the |count| sync files to signal.
+ * Negative fds are ignored. timeout in msecs; -1 waits forever.
+ *
+ * Returns the index of a signaled sync file, or -1 with errno set: ETIME on
+ * timeout, EINVAL if a file is in error state or no fd is valid.
+ */
+int sync_wait_any(const int* fds, size_t count, int timeout);
+
+/* Waits for all of the |count| sync files to signal, polling the ones still
+ * pending together. Negative fds are ignored. timeout in msecs, for the whole
+ * wait; -1 waits forever.
+ *
+ * Returns 0, or -1 with errno set: ETIME on timeout, EINVAL if a file is in
+ * error state.
+ */
+int sync_wait_all(const int* fds, size_t count, int timeout);
+
 __END_DECLS
 
 #endif /* __SYS_CORE_SYNC_H */
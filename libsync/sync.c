@@ -22,7 +22,10 @@
 #include <poll.h>
 #include <stdatomic.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -206,6 +209,197 @@ int sync_merge(const char *name, int fd1, int fd2)
     return ret;
 }
 
+int sync_merge_many(const char *name, const int *fds, size_t count)
+{
+    int *level;
+    size_t i, n;
+    int ret;
+
+    if (count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (count == 1)
+        return fcntl(fds[0], F_DUPFD_CLOEXEC, 0);
+
+    // Merge pairs of the inputs into |level|, then pairs of |level| in place
+    // until one sync file is left. Every fd in |level| is ours to close.
+    n = (count + 1) / 2;
+    level = malloc(n * sizeof(*level));
+    if (!level)
+        return -1;
+    for (i = 0; i < n; i++) {
+        if (2 * i + 1 < count)
+            level[i] = sync_merge(name, fds[2 * i], fds[2 * i + 1]);
+        else
+            level[i] = fcntl(fds[2 * i], F_DUPFD_CLOEXEC, 0);
+        if (level[i] < 0)
+            goto fail;
+    }
+
+    while (n > 1) {
+        size_t next = (n + 1) / 2;
+        for (i = 0; i < next; i++) {
+            int fd;
+            if (2 * i + 1 >= n) {
+                level[i] = level[2 * i];
+                continue;
+            }
+            fd = sync_merge(name, level[2 * i], level[2 * i + 1]);
+            close(level[2 * i]);
+            close(level[2 * i + 1]);
+            level[i] = fd;
+            if (fd < 0) {
+                // The rest of this level hasn't been merged yet.
+                int saved_errno = errno;
+                size_t j;
+                for (j = 0; j < i; j++)
+                    close(level[j]);
+                for (j = 2 * i + 2; j < n; j++)
+                    close(level[j]);
+                free(level);
+                errno = saved_errno;
+                return -1;
+            }
+        }
+        n = next;
+    }
+
+    ret = level[0];
+    free(level);
+    return ret;
+
+fail:
+    {
+        int saved_errno = errno;
+        size_t j;
+        for (j = 0; j < i; j++)
+            close(level[j]);
+        free(level);
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Polls |fds| until at least one is ready, retrying on EINTR with the time
+// left of |timeout|. Returns poll()'s result, with errno set to ETIME on
+// timeout.
+static int poll_fences(struct pollfd *fds, size_t count, int timeout, int64_t deadline)
+{
+    int ret;
+
+    do {
+        if (timeout >= 0) {
+            int64_t left = deadline - now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        ret = poll(fds, count, timeout);
+        if (ret == 0) {
+            errno = ETIME;
+            return -1;
+        }
+    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+    return ret;
+}
+
+static struct pollfd *make_pollfds(const int *fds, size_t count, size_t *valid)
+{
+    struct pollfd *pfds;
+    size_t i;
+
+    pfds = calloc(count ? count : 1, sizeof(*pfds));
+    if (!pfds)
+        return NULL;
+    *valid = 0;
+    for (i = 0; i < count; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+        if (fds[i] >= 0)
+            (*valid)++;
+    }
+    return pfds;
+}
+
+int sync_wait_any(const int *fds, size_t count, int timeout)
+{
+    struct pollfd *pfds;
+    size_t i, valid;
+    int64_t deadline = timeout >= 0 ? now_ms() + timeout : 0;
+    int ret;
+
+    pfds = make_pollfds(fds, count, &valid);
+    if (!pfds)
+        return -1;
+    if (valid == 0) {
+        free(pfds);
+        errno = EINVAL;
+        return -1;
+    }
+
+    ret = poll_fences(pfds, count, timeout, deadline);
+    if (ret > 0) {
+        ret = -1;
+        for (i = 0; i < count; i++) {
+            if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+                ret = -1;
+                break;
+            }
+            if (pfds[i].revents && ret < 0)
+                ret = (int)i;
+        }
+        if (ret < 0)
+            errno = EINVAL;
+    }
+
+    free(pfds);
+    return ret;
+}
+
+int sync_wait_all(const int *fds, size_t count, int timeout)
+{
+    struct pollfd *pfds;
+    size_t i, pending;
+    int64_t deadline = timeout >= 0 ? now_ms() + timeout : 0;
+    int ret = 0;
+
+    pfds = make_pollfds(fds, count, &pending);
+    if (!pfds)
+        return -1;
+
+    while (pending > 0) {
+        ret = poll_fences(pfds, count, timeout, deadline);
+        if (ret < 0)
+            break;
+        ret = 0;
+        for (i = 0; i < count; i++) {
+            if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+                ret = -1;
+                errno = EINVAL;
+                break;
+            }
+            if (pfds[i].revents) {
+                // poll() ignores negative fds, so this one is done.
+                pfds[i].fd = -1;
+                pfds[i].revents = 0;
+                pending--;
+            }
+        }
+        if (ret < 0)
+            break;
+    }
+
+    free(pfds);
+    return ret;
+}
+
 static struct sync_fence_info_data *legacy_sync_fence_info(int fd)
 {
     struct sync_fence_info_data *legacy_info;
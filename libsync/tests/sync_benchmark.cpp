@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android/sync.h>
+#include <sw_sync.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+// Creates |count| fences on as many timelines, so that merging them can't drop any.
+class Fences {
+  public:
+    explicit Fences(int count) {
+        for (int i = 0; i < count; i++) {
+            int timeline = sw_sync_timeline_create();
+            timelines_.push_back(timeline);
+            fences_.push_back(sw_sync_fence_create(timeline, "benchmark", 1));
+        }
+    }
+    ~Fences() {
+        for (int fd : fences_) close(fd);
+        for (int fd : timelines_) close(fd);
+    }
+
+    bool valid() const {
+        for (int fd : fences_) {
+            if (fd < 0) return false;
+        }
+        return true;
+    }
+    void signal() {
+        for (int fd : timelines_) sw_sync_timeline_inc(fd, 1);
+    }
+    const std::vector<int>& fds() const { return fences_; }
+
+  private:
+    std::vector<int> timelines_;
+    std::vector<int> fences_;
+};
+
+// Merging one fence at a time into the result, the way callers of sync_merge() do.
+static void BM_sync_merge_linear(benchmark::State& state) {
+    Fences fences(state.range(0));
+    if (!fences.valid()) {
+        state.SkipWithError("sw_sync is not available");
+        return;
+    }
+    const auto& fds = fences.fds();
+    for (auto _ : state) {
+        int merged = dup(fds[0]);
+        for (size_t i = 1; i < fds.size(); i++) {
+            int next = sync_merge("benchmark", merged, fds[i]);
+            close(merged);
+            merged = next;
+        }
+        close(merged);
+    }
+}
+BENCHMARK(BM_sync_merge_linear)->RangeMultiplier(4)->Range(2, 128);
+
+static void BM_sync_merge_many(benchmark::State& state) {
+    Fences fences(state.range(0));
+    if (!fences.valid()) {
+        state.SkipWithError("sw_sync is not available");
+        return;
+    }
+    const auto& fds = fences.fds();
+    for (auto _ : state) {
+        close(sync_merge_many("benchmark", fds.data(), fds.size()));
+    }
+}
+BENCHMARK(BM_sync_merge_many)->RangeMultiplier(4)->Range(2, 128);
+
+// Waiting for signaled fences one sync_wait() at a time.
+static void BM_sync_wait_each(benchmark::State& state) {
+    Fences fences(state.range(0));
+    if (!fences.valid()) {
+        state.SkipWithError("sw_sync is not available");
+        return;
+    }
+    fences.signal();
+    for (auto _ : state) {
+        for (int fd : fences.fds()) sync_wait(fd, -1);
+    }
+}
+BENCHMARK(BM_sync_wait_each)->RangeMultiplier(4)->Range(2, 128);
+
+static void BM_sync_wait_all(benchmark::State& state) {
+    Fences fences(state.range(0));
+    if (!fences.valid()) {
+        state.SkipWithError("sw_sync is not available");
+        return;
+    }
+    fences.signal();
+    const auto& fds = fences.fds();
+    for (auto _ : state) {
+        sync_wait_all(fds.data(), fds.size(), -1);
+    }
+}
+BENCHMARK(BM_sync_wait_all)->RangeMultiplier(4)->Range(2, 128);
+
+BENCHMARK_MAIN();
@@ -477,6 +477,78 @@ TEST(FenceTest, MultiTimelineWait) {
     ASSERT_EQ(mergedFence.wait(100), 0);
 }
 
+TEST(FenceTest, MergeMany) {
+    SyncTimeline timelineA, timelineB;
+    ASSERT_TRUE(timelineA.isValid());
+    ASSERT_TRUE(timelineB.isValid());
+
+    vector<SyncFence> fences;
+    vector<int> fds;
+    for (int i = 1; i <= 5; i++) {
+        fences.emplace_back(timelineA, i);
+        fences.emplace_back(timelineB, i);
+    }
+    for (auto& fence : fences) {
+        ASSERT_TRUE(fence.isValid());
+        fds.push_back(fence.getFd());
+    }
+
+    int merged = sync_merge_many("mergeMany", fds.data(), fds.size());
+    ASSERT_GE(merged, 0);
+    ASSERT_EQ(sync_wait(merged, 0), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    // Only the last fence of each timeline is kept.
+    struct sync_file_info* info = sync_file_info(merged);
+    ASSERT_NE(info, nullptr);
+    ASSERT_EQ(info->num_fences, 2U);
+    sync_file_info_free(info);
+
+    timelineA.inc(5);
+    ASSERT_EQ(sync_wait(merged, 0), -1);
+    timelineB.inc(5);
+    ASSERT_EQ(sync_wait(merged, 0), 0);
+    close(merged);
+
+    // A single input is duplicated, and no inputs is an error.
+    merged = sync_merge_many("mergeOne", fds.data(), 1);
+    ASSERT_GE(merged, 0);
+    ASSERT_NE(merged, fds[0]);
+    close(merged);
+    ASSERT_EQ(sync_merge_many("mergeNone", fds.data(), 0), -1);
+    ASSERT_EQ(errno, EINVAL);
+}
+
+TEST(FenceTest, WaitAnyAll) {
+    SyncTimeline timelineA, timelineB;
+    ASSERT_TRUE(timelineA.isValid());
+    ASSERT_TRUE(timelineB.isValid());
+
+    SyncFence fenceA(timelineA, 1);
+    SyncFence fenceB(timelineB, 1);
+    int fds[] = {fenceA.getFd(), -1, fenceB.getFd()};
+
+    ASSERT_EQ(sync_wait_any(fds, 3, 0), -1);
+    ASSERT_EQ(errno, ETIME);
+    ASSERT_EQ(sync_wait_all(fds, 3, 0), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    timelineB.inc(1);
+    ASSERT_EQ(sync_wait_any(fds, 3, 0), 2);
+    ASSERT_EQ(sync_wait_all(fds, 3, 0), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    thread signaler{[&]() { timelineA.inc(1); }};
+    ASSERT_EQ(sync_wait_all(fds, 3, 1000), 0);
+    signaler.join();
+    ASSERT_EQ(sync_wait_any(fds, 3, 0), 0);
+
+    int none[] = {-1, -1};
+    ASSERT_EQ(sync_wait_all(none, 2, 0), 0);
+    ASSERT_EQ(sync_wait_any(none, 2, 0), -1);
+    ASSERT_EQ(errno, EINVAL);
+}
+
 TEST(FenceTest, GetInfoActive) {
     SyncTimeline timeline;
     ASSERT_TRUE(timeline.isValid());
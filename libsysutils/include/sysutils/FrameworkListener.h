@@ -18,7 +18,9 @@
 
 #include "SocketListener.h"
 
-#include <vector>
+#include <atomic>
+#include <string_view>
+#include <unordered_map>
 
 class FrameworkCommand;
 class SocketClient;
@@ -31,10 +33,11 @@ public:
     int errorRate;
 
 private:
-    int mCommandCount;
+    std::atomic<int> mCommandCount;
     bool mWithSeq;
-    std::vector<FrameworkCommand*> mCommands;
-    bool mSkipToNextNullByte;
+    // Keyed by FrameworkCommand::getCommand(), which outlives the registration.
+    std::unordered_map<std::string_view, FrameworkCommand*> mCommands;
+    std::atomic<bool> mSkipToNextNullByte;
 
 public:
     FrameworkListener(const char *socketName);
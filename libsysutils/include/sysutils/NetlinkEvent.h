@@ -42,12 +42,18 @@ private:
     Action mAction;
     char *mSubsystem;
     char *mParams[NL_PARAMS_MAX];
+    // Whether mPath, mSubsystem and mParams point into the buffer passed to decodeInPlace().
+    bool mBorrowsBuffer;
 
 public:
     NetlinkEvent();
     virtual ~NetlinkEvent();
 
     bool decode(char *buffer, int size, int format = NetlinkListener::NETLINK_FORMAT_ASCII);
+    // Like decode(), but ASCII events refer to their strings in |buffer| instead of copying
+    // them, so |buffer| must outlive the event.
+    bool decodeInPlace(char *buffer, int size,
+                       int format = NetlinkListener::NETLINK_FORMAT_ASCII);
     const char *findParam(const char *paramName);
 
     const char *getSubsystem() { return mSubsystem; }
@@ -65,6 +71,9 @@ public:
     bool parseRtMessage(const struct nlmsghdr *nh);
     bool parseNdUserOptMessage(const struct nlmsghdr *nh);
     struct nlattr* findNlAttr(const nlmsghdr* nl, size_t hdrlen, uint16_t attr);
+
+  private:
+    char *keepString(const char *s);
 };
 
 #endif
@@ -18,7 +18,12 @@
 
 #include <pthread.h>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <sysutils/SocketClient.h>
 #include "SocketClientCommand.h"
@@ -30,9 +35,18 @@ class SocketListener {
     std::unordered_map<int, SocketClient*> mClients;
     pthread_mutex_t         mClientsLock;
     int                     mCtrlPipe[2];
+    int                     mEpollFd;
     pthread_t               mThread;
     bool                    mUseCmdNum;
 
+    // Worker pool used when setDispatchThreads() was called with a non-zero count.
+    size_t                  mDispatchThreads;
+    std::vector<std::thread> mWorkers;
+    std::mutex              mWorkLock;
+    std::condition_variable mWorkCond;
+    std::deque<SocketClient*> mWork;
+    bool                    mStopWorkers;
+
 public:
     SocketListener(const char *socketName, bool listen);
     SocketListener(const char *socketName, bool listen, bool useCmdNum);
@@ -43,11 +57,16 @@ public:
     int startListener(int backlog);
     int stopListener();
 
+    // Calls onDataAvailable() from a pool of |threads| workers instead of the listener thread,
+    // so that a slow command doesn't hold up other clients. Data from any one client is still
+    // handled in order, by one worker at a time. Must be called before startListener().
+    void setDispatchThreads(size_t threads) { mDispatchThreads = threads; }
+
     void sendBroadcast(int code, const char *msg, bool addErrno);
 
     void runOnEachSocket(SocketClientCommand *command);
 
-    bool release(SocketClient *c) { return release(c, true); }
+    bool release(SocketClient *c);
 
 protected:
     virtual bool onDataAvailable(SocketClient *c) = 0;
@@ -59,8 +78,10 @@ private:
     // while processing it.
     std::vector<SocketClient*> snapshotClients();
 
-    bool release(SocketClient *c, bool wakeup);
     void runListener();
+    void runWorker();
+    void dispatch(SocketClient *c);
+    bool watchClient(int fd, int op);
     void init(const char *socketName, int socketFd, bool listen, bool useCmdNum);
 };
 #endif
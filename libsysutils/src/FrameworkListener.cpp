@@ -88,7 +88,8 @@ bool FrameworkListener::onDataAvailable(SocketClient *c) {
 }
 
 void FrameworkListener::registerCmd(FrameworkCommand *cmd) {
-    mCommands.push_back(cmd);
+    // As before, the first command registered under a name wins.
+    mCommands.emplace(cmd->getCommand(), cmd);
 }
 
 void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
@@ -189,13 +190,12 @@ void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
         goto out;
     }
 
-    for (auto* c : mCommands) {
-        if (!strcmp(argv[0], c->getCommand())) {
-            if (c->runCommand(cli, argc, argv)) {
-                SLOGW("Handler '%s' error (%s)", c->getCommand(), strerror(errno));
-            }
-            goto out;
+    if (auto it = mCommands.find(argv[0]); it != mCommands.end()) {
+        FrameworkCommand* c = it->second;
+        if (c->runCommand(cli, argc, argv)) {
+            SLOGW("Handler '%s' error (%s)", c->getCommand(), strerror(errno));
         }
+        goto out;
     }
     cli->sendMsg(500, "Command not recognized", false);
 out:
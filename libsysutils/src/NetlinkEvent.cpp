@@ -199,10 +199,13 @@ NetlinkEvent::NetlinkEvent() {
     memset(mParams, 0, sizeof(mParams));
     mPath = nullptr;
     mSubsystem = nullptr;
+    mBorrowsBuffer = false;
 }
 
 NetlinkEvent::~NetlinkEvent() {
     int i;
+    if (mBorrowsBuffer)
+        return;
     if (mPath)
         free(mPath);
     if (mSubsystem)
@@ -791,7 +794,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     return false;
                 }
             }
-            mPath = strdup(p+1);
+            mPath = keepString(p+1);
             first = 0;
         } else {
             const char* a;
@@ -807,9 +810,9 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     SLOGE("NetlinkEvent::parseAsciiNetlinkMessage: failed to parse SEQNUM=%s", a);
                 }
             } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != nullptr) {
-                mSubsystem = strdup(a);
+                mSubsystem = keepString(a);
             } else if (param_idx < NL_PARAMS_MAX) {
-                mParams[param_idx++] = strdup(s);
+                mParams[param_idx++] = keepString(s);
             }
         }
         s += strlen(s) + 1;
@@ -817,6 +820,16 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
     return true;
 }
 
+char *NetlinkEvent::keepString(const char *s) {
+    return mBorrowsBuffer ? const_cast<char *>(s) : strdup(s);
+}
+
+bool NetlinkEvent::decodeInPlace(char *buffer, int size, int format) {
+    // Binary events are formatted into new strings, so only ASCII events can borrow.
+    mBorrowsBuffer = (format == NetlinkListener::NETLINK_FORMAT_ASCII);
+    return decode(buffer, size, format);
+}
+
 bool NetlinkEvent::decode(char *buffer, int size, int format) {
     if (format == NetlinkListener::NETLINK_FORMAT_BINARY
             || format == NetlinkListener::NETLINK_FORMAT_BINARY_UNICAST) {
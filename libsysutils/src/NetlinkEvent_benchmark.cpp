@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sysutils/NetlinkEvent.h>
+
+#include <arpa/inet.h>
+#include <linux/if_addr.h>
+#include <linux/rtnetlink.h>
+#include <string.h>
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+// A battery uevent as captured from a device; these arrive every few seconds while charging.
+static const char kUevent[] =
+        "change@/devices/platform/battery/power_supply/battery\0"
+        "ACTION=change\0"
+        "DEVPATH=/devices/platform/battery/power_supply/battery\0"
+        "SUBSYSTEM=power_supply\0"
+        "POWER_SUPPLY_NAME=battery\0"
+        "POWER_SUPPLY_TYPE=Battery\0"
+        "POWER_SUPPLY_STATUS=Charging\0"
+        "POWER_SUPPLY_HEALTH=Good\0"
+        "POWER_SUPPLY_PRESENT=1\0"
+        "POWER_SUPPLY_CAPACITY=57\0"
+        "POWER_SUPPLY_VOLTAGE_NOW=3912000\0"
+        "POWER_SUPPLY_CURRENT_NOW=-1245000\0"
+        "POWER_SUPPLY_TEMP=312\0"
+        "SEQNUM=48213\0";
+
+static void BM_decode_uevent(benchmark::State& state) {
+    std::string buffer(kUevent, sizeof(kUevent));
+    for (auto _ : state) {
+        NetlinkEvent evt;
+        benchmark::DoNotOptimize(evt.decode(buffer.data(), buffer.size()));
+        benchmark::DoNotOptimize(evt.findParam("POWER_SUPPLY_CAPACITY"));
+    }
+}
+BENCHMARK(BM_decode_uevent);
+
+static void BM_decode_uevent_in_place(benchmark::State& state) {
+    std::string buffer(kUevent, sizeof(kUevent));
+    for (auto _ : state) {
+        NetlinkEvent evt;
+        benchmark::DoNotOptimize(evt.decodeInPlace(buffer.data(), buffer.size()));
+        benchmark::DoNotOptimize(evt.findParam("POWER_SUPPLY_CAPACITY"));
+    }
+}
+BENCHMARK(BM_decode_uevent_in_place);
+
+// An RTM_NEWADDR for an IPv6 address on the loopback interface.
+static std::string makeNewAddr() {
+    struct {
+        nlmsghdr nh;
+        ifaddrmsg ifa;
+        rtattr addr_rta;
+        in6_addr addr;
+        rtattr cache_rta;
+        ifa_cacheinfo cache;
+    } __attribute__((packed)) msg = {};
+    msg.nh.nlmsg_len = sizeof(msg);
+    msg.nh.nlmsg_type = RTM_NEWADDR;
+    msg.ifa.ifa_family = AF_INET6;
+    msg.ifa.ifa_prefixlen = 64;
+    msg.ifa.ifa_index = 1;
+    msg.addr_rta.rta_len = RTA_LENGTH(sizeof(msg.addr));
+    msg.addr_rta.rta_type = IFA_ADDRESS;
+    inet_pton(AF_INET6, "2001:db8::1", &msg.addr);
+    msg.cache_rta.rta_len = RTA_LENGTH(sizeof(msg.cache));
+    msg.cache_rta.rta_type = IFA_CACHEINFO;
+    msg.cache.ifa_prefered = 3600;
+    msg.cache.ifa_valid = 7200;
+    return std::string(reinterpret_cast<char*>(&msg), sizeof(msg));
+}
+
+static void BM_decode_newaddr(benchmark::State& state) {
+    std::string buffer = makeNewAddr();
+    for (auto _ : state) {
+        NetlinkEvent evt;
+        benchmark::DoNotOptimize(evt.decodeInPlace(buffer.data(), buffer.size(),
+                                                   NetlinkListener::NETLINK_FORMAT_BINARY));
+    }
+}
+BENCHMARK(BM_decode_newaddr);
+
+BENCHMARK_MAIN();
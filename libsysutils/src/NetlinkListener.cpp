@@ -24,7 +24,6 @@
 
 #include <linux/netlink.h> /* out of order because must follow sys/socket.h */
 
-#include <cutils/uevent.h>
 #include <log/log.h>
 #include <sysutils/NetlinkEvent.h>
 
@@ -43,33 +42,82 @@ NetlinkListener::NetlinkListener(int socket, int format) :
                             SocketListener(socket, false), mFormat(format) {
 }
 
+// Whether |hdr| came from the kernel, with the same checks as uevent_kernel_recv().
+static bool isKernelMessage(const struct msghdr& hdr, bool require_group) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        /* ignoring netlink message with no sender credentials */
+        return false;
+    }
+    const struct sockaddr_nl *addr = static_cast<const struct sockaddr_nl *>(hdr.msg_name);
+    if (addr->nl_pid != 0) {
+        /* ignore non-kernel */
+        return false;
+    }
+    if (require_group && addr->nl_groups == 0) {
+        /* ignore unicast messages when requested */
+        return false;
+    }
+    return true;
+}
+
 bool NetlinkListener::onDataAvailable(SocketClient *cli)
 {
     int socket = cli->getSocket();
-    ssize_t count;
-    uid_t uid = -1;
 
+    // Receive up to kBatchSize messages per syscall, each into its own slice of mBuffer. A
+    // slice is larger than any uevent or rtnetlink notification, but netfilter log packets can
+    // be bigger, so those are still received one at a time into the whole buffer.
+    static constexpr size_t kBatchSize = 4;
     bool require_group = true;
+    size_t batch = kBatchSize;
     if (mFormat == NETLINK_FORMAT_BINARY_UNICAST) {
         require_group = false;
+        batch = 1;
+    }
+    const size_t slot_size = sizeof(mBuffer) / batch;
+
+    struct mmsghdr msgs[kBatchSize] = {};
+    struct iovec iovs[kBatchSize];
+    struct sockaddr_nl addrs[kBatchSize];
+    char controls[kBatchSize][CMSG_SPACE(sizeof(struct ucred))];
+    for (size_t i = 0; i < batch; i++) {
+        iovs[i] = {mBuffer + i * slot_size, slot_size};
+        struct msghdr& hdr = msgs[i].msg_hdr;
+        hdr.msg_name = &addrs[i];
+        hdr.msg_namelen = sizeof(addrs[i]);
+        hdr.msg_iov = &iovs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = controls[i];
+        hdr.msg_controllen = sizeof(controls[i]);
     }
 
-    count = TEMP_FAILURE_RETRY(uevent_kernel_recv(socket,
-            mBuffer, sizeof(mBuffer), require_group, &uid));
+    int count = TEMP_FAILURE_RETRY(recvmmsg(socket, msgs, batch, MSG_WAITFORONE, nullptr));
     if (count < 0) {
-        SLOGE("recvmsg failed (%s)", strerror(errno));
+        SLOGE("recvmmsg failed (%s)", strerror(errno));
         return false;
     }
 
-    NetlinkEvent *evt = new NetlinkEvent();
-    if (evt->decode(mBuffer, count, mFormat)) {
-        onEvent(evt);
-    } else if (mFormat != NETLINK_FORMAT_BINARY) {
-        // Don't complain if parseBinaryNetlinkMessage returns false. That can
-        // just mean that the buffer contained no messages we're interested in.
-        SLOGE("Error decoding NetlinkEvent");
-    }
+    for (int i = 0; i < count; i++) {
+        char *buffer = static_cast<char *>(iovs[i].iov_base);
+        if (!isKernelMessage(msgs[i].msg_hdr, require_group)) {
+            /* clear residual potentially malicious data */
+            memset(buffer, 0, slot_size);
+            continue;
+        }
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            SLOGE("Dropping truncated netlink message");
+            continue;
+        }
 
-    delete evt;
+        NetlinkEvent evt;
+        if (evt.decodeInPlace(buffer, msgs[i].msg_len, mFormat)) {
+            onEvent(&evt);
+        } else if (mFormat != NETLINK_FORMAT_BINARY) {
+            // Don't complain if parseBinaryNetlinkMessage returns false. That can
+            // just mean that the buffer contained no messages we're interested in.
+            SLOGE("Error decoding NetlinkEvent");
+        }
+    }
     return true;
 }
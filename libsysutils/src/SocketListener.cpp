@@ -20,13 +20,14 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <iterator>
 #include <vector>
 
 #include <cutils/sockets.h>
@@ -35,7 +36,6 @@
 #include <sysutils/SocketClient.h>
 
 #define CtrlPipe_Shutdown 0
-#define CtrlPipe_Wakeup   1
 
 SocketListener::SocketListener(const char *socketName, bool listen) {
     init(socketName, -1, listen, false);
@@ -54,6 +54,10 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mSocketName = socketName;
     mSock = socketFd;
     mUseCmdNum = useCmdNum;
+    mCtrlPipe[0] = mCtrlPipe[1] = -1;
+    mEpollFd = -1;
+    mDispatchThreads = 0;
+    mStopWorkers = false;
     pthread_mutex_init(&mClientsLock, nullptr);
 }
 
@@ -65,6 +69,9 @@ SocketListener::~SocketListener() {
         close(mCtrlPipe[0]);
         close(mCtrlPipe[1]);
     }
+    if (mEpollFd != -1) {
+        close(mEpollFd);
+    }
     for (auto pair : mClients) {
         pair.second->decRef();
     }
@@ -101,6 +108,31 @@ int SocketListener::startListener(int backlog) {
         return -1;
     }
 
+    if ((mEpollFd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return -1;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = mCtrlPipe[0];
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mCtrlPipe[0], &ev)) {
+        SLOGE("epoll_ctl failed for control pipe (%s)", strerror(errno));
+        return -1;
+    }
+    if (mListen) {
+        ev.data.fd = mSock;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mSock, &ev)) {
+            SLOGE("epoll_ctl failed for socket (%s)", strerror(errno));
+            return -1;
+        }
+    } else if (!watchClient(mSock, EPOLL_CTL_ADD)) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < mDispatchThreads; ++i) {
+        mWorkers.emplace_back(&SocketListener::runWorker, this);
+    }
+
     if (pthread_create(&mThread, nullptr, SocketListener::threadStart, this)) {
         SLOGE("pthread_create (%s)", strerror(errno));
         return -1;
@@ -124,10 +156,27 @@ int SocketListener::stopListener() {
         SLOGE("Error joining to listener thread (%s)", strerror(errno));
         return -1;
     }
+    {
+        std::lock_guard<std::mutex> lock(mWorkLock);
+        mStopWorkers = true;
+        mWorkCond.notify_all();
+    }
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+    mWorkers.clear();
+    for (SocketClient* c : mWork) {
+        c->decRef();
+    }
+    mWork.clear();
+    mStopWorkers = false;
+
     close(mCtrlPipe[0]);
     close(mCtrlPipe[1]);
     mCtrlPipe[0] = -1;
     mCtrlPipe[1] = -1;
+    close(mEpollFd);
+    mEpollFd = -1;
 
     if (mSocketName && mSock > -1) {
         close(mSock);
@@ -149,82 +198,116 @@ void *SocketListener::threadStart(void *obj) {
     return nullptr;
 }
 
-void SocketListener::runListener() {
-    while (true) {
-        std::vector<pollfd> fds;
+bool SocketListener::watchClient(int fd, int op) {
+    // In worker mode a client is only reported again once its worker has re-armed it, which
+    // is what keeps its data from being handled by two workers at once.
+    struct epoll_event ev = {};
+    ev.events = mDispatchThreads ? EPOLLIN | EPOLLONESHOT : EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(mEpollFd, op, fd, &ev)) {
+        SLOGE("epoll_ctl(%d) failed for fd %d (%s)", op, fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
 
-        pthread_mutex_lock(&mClientsLock);
-        fds.reserve(2 + mClients.size());
-        fds.push_back({.fd = mCtrlPipe[0], .events = POLLIN});
-        if (mListen) fds.push_back({.fd = mSock, .events = POLLIN});
-        for (auto pair : mClients) {
-            // NB: calling out to an other object with mClientsLock held (safe)
-            const int fd = pair.second->getSocket();
-            if (fd != pair.first) SLOGE("fd mismatch: %d != %d", fd, pair.first);
-            fds.push_back({.fd = fd, .events = POLLIN});
-        }
-        pthread_mutex_unlock(&mClientsLock);
+void SocketListener::runListener() {
+    struct epoll_event events[16];
 
+    while (true) {
         SLOGV("mListen=%d, mSocketName=%s", mListen, mSocketName);
-        int rc = TEMP_FAILURE_RETRY(poll(fds.data(), fds.size(), -1));
+        int rc = TEMP_FAILURE_RETRY(epoll_wait(mEpollFd, events, std::size(events), -1));
         if (rc < 0) {
-            SLOGE("poll failed (%s) mListen=%d", strerror(errno), mListen);
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
             sleep(1);
             continue;
         }
 
-        if (fds[0].revents & (POLLIN | POLLERR)) {
-            char c = CtrlPipe_Shutdown;
-            TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
-            if (c == CtrlPipe_Shutdown) {
-                break;
-            }
-            continue;
-        }
-        if (mListen && (fds[1].revents & (POLLIN | POLLERR))) {
-            int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
-            if (c < 0) {
-                SLOGE("accept failed (%s)", strerror(errno));
-                sleep(1);
-                continue;
-            }
-            pthread_mutex_lock(&mClientsLock);
-            mClients[c] = new SocketClient(c, true, mUseCmdNum);
-            pthread_mutex_unlock(&mClientsLock);
-        }
-
         // Add all active clients to the pending list first, so we can release
         // the lock before invoking the callbacks.
         std::vector<SocketClient*> pending;
-        pthread_mutex_lock(&mClientsLock);
-        const int size = fds.size();
-        for (int i = mListen ? 2 : 1; i < size; ++i) {
-            const struct pollfd& p = fds[i];
-            if (p.revents & (POLLIN | POLLERR)) {
-                auto it = mClients.find(p.fd);
-                if (it == mClients.end()) {
-                    SLOGE("fd vanished: %d", p.fd);
+        for (int i = 0; i < rc; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == mCtrlPipe[0]) {
+                char c = CtrlPipe_Shutdown;
+                TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
+                if (c == CtrlPipe_Shutdown) {
+                    for (SocketClient* p : pending) p->decRef();
+                    return;
+                }
+                continue;
+            }
+            if (mListen && fd == mSock) {
+                int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
+                if (c < 0) {
+                    SLOGE("accept failed (%s)", strerror(errno));
+                    sleep(1);
                     continue;
                 }
+                pthread_mutex_lock(&mClientsLock);
+                mClients[c] = new SocketClient(c, true, mUseCmdNum);
+                watchClient(c, EPOLL_CTL_ADD);
+                pthread_mutex_unlock(&mClientsLock);
+                continue;
+            }
+
+            pthread_mutex_lock(&mClientsLock);
+            auto it = mClients.find(fd);
+            if (it == mClients.end()) {
+                SLOGE("fd vanished: %d", fd);
+            } else {
                 SocketClient* c = it->second;
                 pending.push_back(c);
                 c->incRef();
             }
+            pthread_mutex_unlock(&mClientsLock);
         }
-        pthread_mutex_unlock(&mClientsLock);
 
-        for (SocketClient* c : pending) {
-            // Process it, if false is returned, remove from the map
-            SLOGV("processing fd %d", c->getSocket());
-            if (!onDataAvailable(c)) {
-                release(c, false);
+        if (mDispatchThreads) {
+            std::lock_guard<std::mutex> lock(mWorkLock);
+            mWork.insert(mWork.end(), pending.begin(), pending.end());
+            mWorkCond.notify_all();
+        } else {
+            for (SocketClient* c : pending) {
+                dispatch(c);
             }
-            c->decRef();
         }
     }
 }
 
-bool SocketListener::release(SocketClient* c, bool wakeup) {
+void SocketListener::runWorker() {
+    while (true) {
+        SocketClient* c;
+        {
+            std::unique_lock<std::mutex> lock(mWorkLock);
+            mWorkCond.wait(lock, [this]() { return mStopWorkers || !mWork.empty(); });
+            if (mStopWorkers) return;
+            c = mWork.front();
+            mWork.pop_front();
+        }
+        dispatch(c);
+    }
+}
+
+// Consumes the reference the caller took on |c|.
+void SocketListener::dispatch(SocketClient* c) {
+    // Process it, if false is returned, remove from the map
+    SLOGV("processing fd %d", c->getSocket());
+    if (!onDataAvailable(c)) {
+        release(c);
+    }
+    if (mDispatchThreads) {
+        pthread_mutex_lock(&mClientsLock);
+        auto it = mClients.find(c->getSocket());
+        if (it != mClients.end() && it->second == c) {
+            watchClient(c->getSocket(), EPOLL_CTL_MOD);
+        }
+        pthread_mutex_unlock(&mClientsLock);
+    }
+    c->decRef();
+}
+
+bool SocketListener::release(SocketClient* c) {
     bool ret = false;
     /* if our sockets are connection-based, remove and destroy it */
     if (mListen && c) {
@@ -232,13 +315,12 @@ bool SocketListener::release(SocketClient* c, bool wakeup) {
         SLOGV("going to zap %d for %s", c->getSocket(), mSocketName);
         pthread_mutex_lock(&mClientsLock);
         ret = (mClients.erase(c->getSocket()) != 0);
+        if (ret) {
+            epoll_ctl(mEpollFd, EPOLL_CTL_DEL, c->getSocket(), nullptr);
+        }
         pthread_mutex_unlock(&mClientsLock);
         if (ret) {
             ret = c->decRef();
-            if (wakeup) {
-                char b = CtrlPipe_Wakeup;
-                TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &b, 1));
-            }
         }
     }
     return ret;
@@ -23,6 +23,7 @@
 #include <sys/un.h>
 
 #include <algorithm>
+#include <future>
 #include <memory>
 
 #include <android-base/file.h>
@@ -118,6 +119,33 @@ class TestListener : public FrameworkListener {
     }
 };
 
+// Test command which doesn't reply until |release| is ready.
+class BlockingCommand : public FrameworkCommand {
+  public:
+    BlockingCommand(std::shared_future<void> release)
+        : FrameworkCommand("block"), mRelease(std::move(release)) {}
+    ~BlockingCommand() override {}
+
+    int runCommand(SocketClient* cli, int, char**) {
+        mRelease.wait();
+        cli->sendMsg(43, "unblocked", /*addErrno=*/false, /*useCmdNum=*/false);
+        return 0;
+    }
+
+  private:
+    std::shared_future<void> mRelease;
+};
+
+// A test listener dispatching to worker threads.
+class WorkerListener : public FrameworkListener {
+  public:
+    WorkerListener(int fd, std::shared_future<void> release) : FrameworkListener(fd) {
+        registerCmd(new TestCommand);
+        registerCmd(new BlockingCommand(std::move(release)));
+        setDispatchThreads(2);
+    }
+};
+
 }  // unnamed namespace
 
 class FrameworkListenerTest : public testing::Test {
@@ -181,3 +209,32 @@ TEST_F(FrameworkListenerTest, MultipleClients) {
     EXPECT_EQ(std::string("42 test,2") + '\0', recvReply(client2.get()));
     EXPECT_EQ(std::string("42 test,1") + '\0', recvReply(client1.get()));
 }
+
+TEST(FrameworkListenerWorkerTest, SlowCommandDoesNotStallOtherClients) {
+    std::string path = testSocketPath();
+    unique_fd server_fd = serverSocket(path);
+    std::promise<void> release;
+    WorkerListener listener(server_fd.get(), release.get_future().share());
+    ASSERT_EQ(0, listener.startListener());
+
+    unique_fd slow = clientSocket(path);
+    unique_fd fast = clientSocket(path);
+    sendCmd(slow.get(), "block");
+    sendCmd(fast.get(), "test 1");
+    EXPECT_EQ(std::string("42 test,1") + '\0', recvReply(fast.get()));
+
+    // Commands from the blocked client are still handled in order.
+    sendCmd(slow.get(), "test 2");
+    release.set_value();
+    std::string expected = std::string("43 unblocked") + '\0' + "42 test,2" + '\0';
+    std::string reply;
+    while (reply.size() < expected.size()) {
+        std::string chunk = recvReply(slow.get());
+        if (chunk.empty()) break;
+        reply += chunk;
+    }
+    EXPECT_EQ(expected, reply);
+
+    EXPECT_EQ(0, listener.stopListener());
+    unlink(path.c_str());
+}
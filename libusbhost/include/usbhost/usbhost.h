@@ -267,6 +267,31 @@ struct usb_request *usb_request_wait(struct usb_device *dev, int timeoutMillis);
 /* Cancels a pending usb_request_queue() operation. */
 int usb_request_cancel(struct usb_request *req);
 
+/* Submits |count| requests, so that the device is kept busy while earlier ones complete.
+ * Returns the number of requests queued, which is less than |count| if queueing one failed,
+ * or -1 if none could be queued.
+ */
+int usb_request_queue_many(struct usb_request **reqs, int count);
+
+/* Reaps up to |max| completed requests into |reqs| with a single wakeup.
+ * Waits up to timeoutMillis for the first completion; -1 waits forever and 0 doesn't wait.
+ * Returns the number of requests reaped, 0 on timeout, or -1 for error.
+ *
+ * The fd from usb_device_get_fd() becomes writable (POLLOUT/EPOLLOUT) when requests have
+ * completed, so it can be added to an epoll set and this called with a zero timeout.
+ */
+int usb_request_reap_many(struct usb_device *dev, struct usb_request **reqs, int max,
+                          int timeoutMillis);
+
+/* Allocates a |length| byte buffer shared with the kernel for use as a usb_request buffer,
+ * which saves the kernel copying the data of each transfer.
+ * Returns NULL if the kernel doesn't support it, in which case any buffer can be used instead.
+ */
+void *usb_device_alloc_buffer(struct usb_device *device, size_t length);
+
+/* Releases a buffer from usb_device_alloc_buffer(). */
+void usb_device_free_buffer(struct usb_device *device, void *buffer, size_t length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,7 @@
 #include <stddef.h>
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/inotify.h>
@@ -777,3 +778,71 @@ int usb_request_cancel(struct usb_request *req)
     struct usbdevfs_urb *urb = ((struct usbdevfs_urb*)req->private_data);
     return ioctl(req->dev->fd, USBDEVFS_DISCARDURB, urb);
 }
+
+int usb_request_queue_many(struct usb_request **reqs, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (usb_request_queue(reqs[i]) < 0) {
+            D("[ queue urb %d of %d - error %d]\n", i, count, errno);
+            break;
+        }
+    }
+    return (i == 0 && count > 0) ? -1 : i;
+}
+
+int usb_request_reap_many(struct usb_device *dev, struct usb_request **reqs, int max,
+                          int timeoutMillis)
+{
+    int count = 0;
+
+    if (timeoutMillis > 0) {
+        struct pollfd p = {.fd = dev->fd, .events = POLLOUT, .revents = 0};
+
+        int res = TEMP_FAILURE_RETRY(poll(&p, 1, timeoutMillis));
+        if (res < 0) {
+            return -1;
+        }
+        if (res == 0) {
+            return 0;
+        }
+    }
+
+    // Block only for the first request, then take whatever else has already completed.
+    while (count < max) {
+        struct usbdevfs_urb *urb = NULL;
+        int block = (count == 0 && timeoutMillis == -1);
+        int res = TEMP_FAILURE_RETRY(ioctl(dev->fd, block ? USBDEVFS_REAPURB :
+                                           USBDEVFS_REAPURBNDELAY, &urb));
+        if (res < 0) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            D("[ reap urb - error %d]\n", errno);
+            return count > 0 ? count : -1;
+        }
+
+        struct usb_request *req = (struct usb_request*)urb->usercontext;
+        req->actual_length = urb->actual_length;
+        reqs[count++] = req;
+    }
+    return count;
+}
+
+void *usb_device_alloc_buffer(struct usb_device *device, size_t length)
+{
+    // usbfs transfers directly to and from buffers mapped from the device fd.
+    void *buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, device->fd, 0);
+    if (buffer == MAP_FAILED) {
+        D("[ usbfs mmap - error %d]\n", errno);
+        return NULL;
+    }
+    return buffer;
+}
+
+void usb_device_free_buffer(struct usb_device *device, void *buffer, size_t length)
+{
+    if (buffer)
+        munmap(buffer, length);
+}
@@ -22,7 +22,9 @@
 
 #define UNW_LOCAL_ONLY
 #include <cxxabi.h>
+#include <dlfcn.h>
 #include <libunwind.h>
+#include <string.h>
 
 #include <utils/CallStack.h>
 
@@ -75,6 +77,49 @@ void CallStack::update(int32_t ignoreDepth, pid_t tid) {
     }
 }
 
+size_t CallStack::captureRaw(uintptr_t* pcs, size_t maxFrames, int32_t ignoreDepth) {
+    if (ignoreDepth < 0) {
+        ignoreDepth = 0;
+    }
+    if (maxFrames > INT32_MAX) {
+        maxFrames = INT32_MAX;
+    }
+
+    // unw_backtrace() walks the stack through libunwind's cache of frame descriptions where it
+    // can, instead of a full unw_step() for each frame. The first frame it returns is our own.
+    static_assert(sizeof(uintptr_t) == sizeof(void*));
+    int count = unw_backtrace(reinterpret_cast<void**>(pcs), static_cast<int>(maxFrames));
+    const size_t skip = static_cast<size_t>(ignoreDepth) + 1;
+    if (count <= 0 || static_cast<size_t>(count) <= skip) {
+        return 0;
+    }
+    memmove(pcs, pcs + skip, (count - skip) * sizeof(uintptr_t));
+    return count - skip;
+}
+
+void CallStack::symbolize(const uintptr_t* pcs, size_t count) {
+    mFrameLines.clear();
+
+    for (size_t i = 0; i < count; i++) {
+        String8 line{String8::format("0x%lx", static_cast<unsigned long>(pcs[i]))};
+
+        // Only exported symbols can be found this way, where update() also sees local ones.
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void*>(pcs[i]), &info) != 0 && info.dli_sname != nullptr) {
+            const char* nameptr = info.dli_sname;
+            int status;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            if (status == 0) {
+                nameptr = demangled;
+            }
+            const uintptr_t offset = pcs[i] - reinterpret_cast<uintptr_t>(info.dli_saddr);
+            line.append(String8::format(" %s+0x%lx", nameptr, static_cast<unsigned long>(offset)));
+            std::free(demangled);
+        }
+        mFrameLines.push_back(line);
+    }
+}
+
 void CallStack::log(const char* logtag, android_LogPriority priority, const char* prefix) const {
     LogPrinter printer(logtag, priority, prefix, /*ignoreBlankLines*/false);
     print(printer);
@@ -42,17 +42,176 @@
 #include <errno.h>
 #include <assert.h>
 
+#if !defined(__MINGW32__)
+#include <sys/stat.h>
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#endif
+
 using namespace android;
 
 /*static*/ long FileMap::mPageSize = -1;
 
+#if !defined(__MINGW32__)
+namespace {
+
+// Transparent huge pages are PMD sized, which is 2MiB with 4KiB base pages.
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Maps a page aligned region, applying the CreateFlags that affect how it is mapped.
+// Returns MAP_FAILED on failure.
+void* mapRegion(int fd, off64_t offset, size_t length, int prot, int flags, long pageSize)
+{
+    int mapFlags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+    if (flags & FileMap::CREATE_POPULATE) mapFlags |= MAP_POPULATE;
+#endif
+
+    void* ptr = MAP_FAILED;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // File pages can only be collapsed into a huge page if the virtual address and the
+    // file offset are congruent modulo the huge page size, so reserve enough address space
+    // to find such an address and map the file over it.
+    size_t reserveLength;
+    if ((flags & FileMap::CREATE_HUGEPAGE) && !(prot & PROT_WRITE) &&
+            length >= kHugePageSize &&
+            !__builtin_add_overflow(length, kHugePageSize, &reserveLength)) {
+        void* reserve = mmap(nullptr, reserveLength, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserve != MAP_FAILED) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(reserve);
+            uintptr_t end = start + reserveLength;
+            uintptr_t aligned = start - start % kHugePageSize + offset % kHugePageSize;
+            if (aligned < start) aligned += kHugePageSize;
+            uintptr_t alignedEnd = aligned + (length + pageSize - 1) / pageSize * pageSize;
+
+            ptr = mmap64(reinterpret_cast<void*>(aligned), length, prot,
+                    mapFlags | MAP_FIXED, fd, offset);
+            if (ptr == MAP_FAILED) {
+                munmap(reserve, reserveLength);
+            } else {
+                if (aligned > start) munmap(reserve, aligned - start);
+                if (end > alignedEnd) {
+                    munmap(reinterpret_cast<void*>(alignedEnd), end - alignedEnd);
+                }
+                if (madvise(ptr, length, MADV_HUGEPAGE) != 0) {
+                    ALOGV("madvise(MADV_HUGEPAGE) failed: %s\n", strerror(errno));
+                }
+            }
+        }
+    }
+#endif
+    if (ptr == MAP_FAILED) {
+        ptr = mmap64(nullptr, length, prot, mapFlags, fd, offset);
+        if (ptr == MAP_FAILED) return MAP_FAILED;
+    }
+
+    if ((flags & FileMap::CREATE_PREFETCH) && madvise(ptr, length, MADV_WILLNEED) != 0) {
+        ALOGW("madvise(MADV_WILLNEED) failed: %s\n", strerror(errno));
+    }
+    return ptr;
+}
+
+// Process-wide cache of read-only mappings created with CREATE_SHARED.
+struct SharedMapKey {
+    dev_t   dev;
+    ino_t   ino;
+    off64_t offset;
+    size_t  length;
+
+    bool operator<(const SharedMapKey& other) const {
+        return std::tie(dev, ino, offset, length) <
+                std::tie(other.dev, other.ino, other.offset, other.length);
+    }
+};
+
+struct SharedMap {
+    void*   base;
+    size_t  refs;
+};
+
+struct SharedMapCache {
+    std::mutex lock;
+    std::map<SharedMapKey, SharedMap> maps;
+    std::map<void*, SharedMapKey> keys;
+};
+
+SharedMapCache& sharedMapCache()
+{
+    // Never destroyed, so that FileMaps can outlive static destructors.
+    static SharedMapCache* cache = new SharedMapCache();
+    return *cache;
+}
+
+// Returns a mapping of the region shared with other users, mapping it if there is none.
+// Returns MAP_FAILED on failure.
+void* acquireSharedMap(int fd, off64_t offset, size_t length, int flags, long pageSize)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ALOGE("fstat(%d) failed: %s\n", fd, strerror(errno));
+        return MAP_FAILED;
+    }
+    SharedMapKey key = {st.st_dev, st.st_ino, offset, length};
+
+    SharedMapCache& cache = sharedMapCache();
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        auto it = cache.maps.find(key);
+        if (it != cache.maps.end()) {
+            it->second.refs++;
+            return it->second.base;
+        }
+    }
+
+    // Map without holding the lock, since populating the region can take a while.
+    void* ptr = mapRegion(fd, offset, length, PROT_READ, flags, pageSize);
+    if (ptr == MAP_FAILED) return MAP_FAILED;
+
+    std::lock_guard<std::mutex> guard(cache.lock);
+    auto result = cache.maps.emplace(key, SharedMap{ptr, 1});
+    if (!result.second) {
+        // Somebody else mapped the same region in the meantime.
+        munmap(ptr, length);
+        result.first->second.refs++;
+        return result.first->second.base;
+    }
+    cache.keys.emplace(ptr, key);
+    return ptr;
+}
+
+void releaseSharedMap(void* base)
+{
+    SharedMapCache& cache = sharedMapCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    auto keyIt = cache.keys.find(base);
+    if (keyIt == cache.keys.end()) {
+        ALOGE("releasing unknown shared map %p\n", base);
+        return;
+    }
+    auto it = cache.maps.find(keyIt->second);
+    if (--it->second.refs > 0) return;
+
+    if (munmap(base, keyIt->second.length) != 0) {
+        ALOGD("munmap(%p, %zu) failed\n", base, keyIt->second.length);
+    }
+    cache.maps.erase(it);
+    cache.keys.erase(keyIt);
+}
+
+}  // namespace
+#endif
+
 // Constructor.  Create an empty object.
 FileMap::FileMap(void)
     : mFileName(nullptr),
       mBasePtr(nullptr),
       mBaseLength(0),
       mDataPtr(nullptr),
-      mDataLength(0)
+      mDataLength(0),
+      mShared(false)
 #if defined(__MINGW32__)
       ,
       mFileHandle(INVALID_HANDLE_VALUE),
@@ -68,7 +227,8 @@ FileMap::FileMap(FileMap&& other) noexcept
       mBaseLength(other.mBaseLength),
       mDataOffset(other.mDataOffset),
       mDataPtr(other.mDataPtr),
-      mDataLength(other.mDataLength)
+      mDataLength(other.mDataLength),
+      mShared(other.mShared)
 #if defined(__MINGW32__)
       ,
       mFileHandle(other.mFileHandle),
@@ -78,6 +238,7 @@ FileMap::FileMap(FileMap&& other) noexcept
     other.mFileName = nullptr;
     other.mBasePtr = nullptr;
     other.mDataPtr = nullptr;
+    other.mShared = false;
 #if defined(__MINGW32__)
     other.mFileHandle = INVALID_HANDLE_VALUE;
     other.mFileMapping = NULL;
@@ -92,9 +253,11 @@ FileMap& FileMap::operator=(FileMap&& other) noexcept {
     mDataOffset = other.mDataOffset;
     mDataPtr = other.mDataPtr;
     mDataLength = other.mDataLength;
+    mShared = other.mShared;
     other.mFileName = nullptr;
     other.mBasePtr = nullptr;
     other.mDataPtr = nullptr;
+    other.mShared = false;
 #if defined(__MINGW32__)
     mFileHandle = other.mFileHandle;
     mFileMapping = other.mFileMapping;
@@ -119,7 +282,9 @@ FileMap::~FileMap(void)
         CloseHandle(mFileMapping);
     }
 #else
-    if (mBasePtr && munmap(mBasePtr, mBaseLength) != 0) {
+    if (mShared) {
+        releaseSharedMap(mBasePtr);
+    } else if (mBasePtr && munmap(mBasePtr, mBaseLength) != 0) {
         ALOGD("munmap(%p, %zu) failed\n", mBasePtr, mBaseLength);
     }
 #endif
@@ -134,8 +299,16 @@ FileMap::~FileMap(void)
 // Returns "false" on failure.
 bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
         bool readOnly)
+{
+    return create(origFileName, fd, offset, length, readOnly, 0);
+}
+
+bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
+        bool readOnly, int flags)
 {
 #if defined(__MINGW32__)
+    (void)flags;
+
     int     adjust;
     off64_t adjOffset;
     size_t  adjLength;
@@ -195,11 +368,12 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
         return false;
     }
 
-    int flags = MAP_SHARED;
     int prot = PROT_READ;
     if (!readOnly) prot |= PROT_WRITE;
 
-    void* ptr = mmap64(nullptr, adjLength, prot, flags, fd, adjOffset);
+    bool shared = readOnly && (flags & CREATE_SHARED) && adjLength > 0;
+    void* ptr = shared ? acquireSharedMap(fd, adjOffset, adjLength, flags, mPageSize)
+                       : mapRegion(fd, adjOffset, adjLength, prot, flags, mPageSize);
     if (ptr == MAP_FAILED) {
         if (errno == EINVAL && length == 0) {
             ptr = nullptr;
@@ -210,6 +384,7 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
         }
     }
     mBasePtr = ptr;
+    mShared = shared;
 #endif // !defined(__MINGW32__)
 
     mFileName = origFileName != nullptr ? strdup(origFileName) : nullptr;
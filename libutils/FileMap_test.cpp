@@ -16,6 +16,8 @@
 
 #include "utils/FileMap.h"
 
+#include <string.h>
+
 #include <gtest/gtest.h>
 
 #include "android-base/file.h"
@@ -65,3 +67,53 @@ TEST(FileMap, offset_overflow) {
     android::FileMap m;
     ASSERT_FALSE(m.create("test", tf.fd, offset, length, true));
 }
+
+TEST(FileMap, shared_mapping) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    ASSERT_TRUE(android::base::WriteStringToFd("0123456789", tf.fd));
+
+    android::FileMap m2;
+    void* shared;
+    {
+        android::FileMap m1;
+        ASSERT_TRUE(m1.create("test", tf.fd, 2, 4, true, android::FileMap::CREATE_SHARED));
+        shared = m1.getDataPtr();
+        ASSERT_TRUE(m2.create("test", tf.fd, 2, 4, true,
+                              android::FileMap::CREATE_SHARED |
+                                      android::FileMap::CREATE_POPULATE));
+        ASSERT_EQ(shared, m2.getDataPtr());
+        ASSERT_EQ(0, memcmp("2345", m2.getDataPtr(), 4));
+
+        // A different region, or a map that didn't ask to share, gets its own mapping.
+        android::FileMap m3;
+        ASSERT_TRUE(m3.create("test", tf.fd, 2, 5, true, android::FileMap::CREATE_SHARED));
+        ASSERT_NE(shared, m3.getDataPtr());
+        android::FileMap m4;
+        ASSERT_TRUE(m4.create("test", tf.fd, 2, 4, true));
+        ASSERT_NE(shared, m4.getDataPtr());
+    }
+
+    // The mapping outlives the first map, and moves with the second.
+    android::FileMap m5(std::move(m2));
+    ASSERT_EQ(shared, m5.getDataPtr());
+    ASSERT_EQ(0, memcmp("2345", m5.getDataPtr(), 4));
+}
+
+TEST(FileMap, hugepage_mapping) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    const size_t length = 4 * 1024 * 1024;
+    ASSERT_EQ(0, ftruncate(tf.fd, length));
+
+    android::FileMap m;
+    ASSERT_TRUE(m.create("test", tf.fd, 0, length, true,
+                         android::FileMap::CREATE_HUGEPAGE | android::FileMap::CREATE_PREFETCH));
+    ASSERT_EQ(length, m.getDataLength());
+    const char* data = static_cast<const char*>(m.getDataPtr());
+    ASSERT_EQ(0, data[0]);
+    ASSERT_EQ(0, data[length - 1]);
+#if defined(__linux__)
+    ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(data) % (2 * 1024 * 1024));
+#endif
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/FlatKeyedVector.h>
+#include <utils/KeyedVector.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace android;
+
+// Looks up random keys, half of which are present, in a map with state.range(0) entries.
+template <typename MAP>
+static void BM_lookup(benchmark::State& state) {
+    const int size = state.range(0);
+    MAP map;
+    for (int i = 0; i < size; i++) {
+        map.add(2 * i, i);
+    }
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int> dist(0, 2 * size - 1);
+    std::vector<int> keys(1024);
+    for (int& key : keys) {
+        key = dist(rng);
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.indexOfKey(keys[i++ % keys.size()]));
+    }
+}
+BENCHMARK_TEMPLATE(BM_lookup, KeyedVector<int, int>)->Range(8, 64 << 10);
+BENCHMARK_TEMPLATE(BM_lookup, FlatKeyedVector<int, int>)->Range(8, 64 << 10);
+BENCHMARK_TEMPLATE(BM_lookup, FlatKeyedVector<int, int, FlatLayout::EYTZINGER>)
+        ->Range(8, 64 << 10);
+
+static void BM_lookup_std_map(benchmark::State& state) {
+    const int size = state.range(0);
+    std::map<int, int> map;
+    for (int i = 0; i < size; i++) {
+        map.emplace(2 * i, i);
+    }
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int> dist(0, 2 * size - 1);
+    std::vector<int> keys(1024);
+    for (int& key : keys) {
+        key = dist(rng);
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.find(keys[i++ % keys.size()]));
+    }
+}
+BENCHMARK(BM_lookup_std_map)->Range(8, 64 << 10);
+
+// Builds a map with state.range(0) entries in random order.
+template <typename MAP>
+static void BM_build(benchmark::State& state) {
+    const int size = state.range(0);
+    std::vector<int> keys(size);
+    for (int i = 0; i < size; i++) {
+        keys[i] = i;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(0));
+
+    for (auto _ : state) {
+        MAP map;
+        for (int key : keys) {
+            map.add(key, key);
+        }
+        benchmark::DoNotOptimize(map.size());
+    }
+}
+BENCHMARK_TEMPLATE(BM_build, KeyedVector<int, int>)->Range(8, 4 << 10);
+BENCHMARK_TEMPLATE(BM_build, FlatKeyedVector<int, int>)->Range(8, 4 << 10);
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/FlatKeyedVector.h>
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+using namespace android;
+
+template <typename T>
+class FlatKeyedVectorTest : public testing::Test {};
+
+using Layouts = testing::Types<FlatKeyedVector<int, int, FlatLayout::SORTED>,
+                               FlatKeyedVector<int, int, FlatLayout::EYTZINGER>>;
+TYPED_TEST_SUITE(FlatKeyedVectorTest, Layouts);
+
+TYPED_TEST(FlatKeyedVectorTest, MatchesKeyedVector) {
+    // Random operations give the same results as on a KeyedVector.
+    TypeParam flat;
+    KeyedVector<int, int> keyed;
+    srand(0);
+    for (int i = 0; i < 5000; i++) {
+        int key = rand() % 200;
+        switch (rand() % 4) {
+            case 0:
+            case 1:
+                ASSERT_EQ(keyed.add(key, i), flat.add(key, i));
+                break;
+            case 2:
+                ASSERT_EQ(keyed.removeItem(key), flat.removeItem(key));
+                break;
+            case 3:
+                ASSERT_EQ(keyed.indexOfKey(key), flat.indexOfKey(key));
+                break;
+        }
+        ASSERT_EQ(keyed.size(), flat.size());
+    }
+    for (size_t i = 0; i < keyed.size(); i++) {
+        EXPECT_EQ(keyed.keyAt(i), flat.keyAt(i));
+        EXPECT_EQ(keyed.valueAt(i), flat.valueAt(i));
+        EXPECT_EQ(keyed.valueFor(keyed.keyAt(i)), flat.valueFor(flat.keyAt(i)));
+    }
+    for (int key = -1; key <= 200; key++) {
+        EXPECT_EQ(keyed.indexOfKey(key), flat.indexOfKey(key));
+    }
+}
+
+TYPED_TEST(FlatKeyedVectorTest, Edits) {
+    TypeParam flat;
+    EXPECT_EQ(NAME_NOT_FOUND, flat.indexOfKey(1));
+    EXPECT_EQ(0, flat.add(3, 30));
+    EXPECT_EQ(0, flat.add(1, 10));
+    EXPECT_EQ(1, flat.add(2, 20));
+
+    flat.editValueFor(2) = 21;
+    EXPECT_EQ(21, flat.valueFor(2));
+    EXPECT_EQ(2, flat.replaceValueAt(2, 31));
+    EXPECT_EQ(31, flat[2]);
+    EXPECT_EQ(BAD_INDEX, flat.replaceValueAt(3, 0));
+
+    EXPECT_EQ(BAD_VALUE, flat.removeItemsAt(2, 2));
+    EXPECT_EQ(0, flat.removeItemsAt(0, 2));
+    EXPECT_EQ(1u, flat.size());
+    EXPECT_EQ(0, flat.indexOfKey(3));
+
+    TypeParam copy = flat;
+    flat.clear();
+    EXPECT_TRUE(flat.isEmpty());
+    EXPECT_EQ(NAME_NOT_FOUND, flat.indexOfKey(3));
+    EXPECT_EQ(0, copy.indexOfKey(3));
+}
+
+TEST(FlatSortedVectorTest, Strings) {
+    FlatSortedVector<String8, FlatLayout::EYTZINGER> flat;
+    SortedVector<String8> sorted;
+    for (const char* s : {"input", "binder", "surface", "audio", "binder", "vibrator"}) {
+        EXPECT_EQ(sorted.add(String8(s)), flat.add(String8(s)));
+    }
+    ASSERT_EQ(sorted.size(), flat.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        EXPECT_EQ(sorted[i], flat[i]);
+        EXPECT_EQ(ssize_t(i), flat.indexOf(sorted[i]));
+    }
+    EXPECT_EQ(sorted.orderOf(String8("camera")), flat.orderOf(String8("camera")));
+    EXPECT_EQ(NAME_NOT_FOUND, flat.indexOf(String8("camera")));
+    EXPECT_EQ(sorted.remove(String8("input")), flat.remove(String8("input")));
+    EXPECT_EQ(NAME_NOT_FOUND, flat.indexOf(String8("input")));
+}
+
+TEST(FlatKeyedVectorTest, DefaultValue) {
+    DefaultFlatKeyedVector<int, int, FlatLayout::EYTZINGER> flat(-1);
+    flat.add(1, 10);
+    EXPECT_EQ(10, flat.valueFor(1));
+    EXPECT_EQ(-1, flat.valueFor(2));
+}
@@ -71,7 +71,10 @@ static pthread_key_t gTLSKey = 0;
 
 Looper::Looper(bool allowNonCallbacks)
     : mAllowNonCallbacks(allowNonCallbacks),
+      mNextMessageSeq(0),
       mSendingMessage(false),
+      mPostedMessages(nullptr),
+      mNeedsWake(false),
       mPolling(false),
       mEpollRebuildRequired(false),
       mNextRequestSeq(WAKE_EVENT_FD_SEQ + 1),
@@ -85,6 +88,11 @@ Looper::Looper(bool allowNonCallbacks)
 }
 
 Looper::~Looper() {
+    for (PostedMessage* posted = mPostedMessages.load(); posted != nullptr; ) {
+        PostedMessage* next = posted->next;
+        delete posted;
+        posted = next;
+    }
 }
 
 void Looper::initTLSKey() {
@@ -151,6 +159,9 @@ void Looper::rebuildEpollLocked() {
     mEpollFd.reset(epoll_create1(EPOLL_CLOEXEC));
     LOG_ALWAYS_FATAL_IF(mEpollFd < 0, "Could not create epoll instance: %s", strerror(errno));
 
+    // Nothing stale survives a rebuild.
+    mStaleSequenceNumbers.clear();
+
     epoll_event wakeEvent = createEpollEvent(EPOLLIN, WAKE_EVENT_FD_SEQ);
     int result = epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, mWakeEventFd.get(), &wakeEvent);
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake event fd to epoll instance: %s",
@@ -177,6 +188,17 @@ void Looper::scheduleEpollRebuildLocked() {
     }
 }
 
+void Looper::markSequenceNumberStaleLocked(SequenceNumber seq) {
+    // Registrations of files that are still open elsewhere are never dropped by the kernel, so
+    // do not let them pile up forever.
+    static constexpr size_t kMaxStaleSequenceNumbers = 256;
+
+    mStaleSequenceNumbers.insert(seq);
+    if (mStaleSequenceNumbers.size() > kMaxStaleSequenceNumbers) {
+        scheduleEpollRebuildLocked();
+    }
+}
+
 int Looper::pollOnce(int timeoutMillis, int* outFd, int* outEvents, void** outData) {
     int result = 0;
     for (;;) {
@@ -240,10 +262,18 @@ int Looper::pollInner(int timeoutMillis) {
     // We are about to idle.
     mPolling = true;
 
+    // From here on, sendMessage() has to wake us up. It is enough to check for messages posted
+    // before that once: either we see them, or their sender sees mNeedsWake.
+    mNeedsWake.store(true);
+    if (mPostedMessages.load() != nullptr) {
+        timeoutMillis = 0;
+    }
+
     struct epoll_event eventItems[EPOLL_MAX_EVENTS];
     int eventCount = epoll_wait(mEpollFd.get(), eventItems, EPOLL_MAX_EVENTS, timeoutMillis);
 
     // No longer idling.
+    mNeedsWake.store(false);
     mPolling = false;
 
     // Acquire lock.
@@ -299,6 +329,10 @@ int Looper::pollInner(int timeoutMillis) {
                 if (epollEvents & EPOLLERR) events |= EVENT_ERROR;
                 if (epollEvents & EPOLLHUP) events |= EVENT_HANGUP;
                 mResponses.push({.seq = seq, .events = events, .request = request});
+            } else if (mStaleSequenceNumbers.count(seq) != 0) {
+                // The file behind an fd that was closed before it was removed is still open
+                // elsewhere, and it will keep reporting events until the epoll set is rebuilt.
+                scheduleEpollRebuildLocked();
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x for sequence number %" PRIu64
                       " that is no longer registered.",
@@ -310,9 +344,15 @@ Done: ;
 
     // Invoke pending message callbacks.
     mNextMessageUptime = LLONG_MAX;
-    while (mMessageEnvelopes.size() != 0) {
+    for (;;) {
+        // Pick up messages posted before and while the previous message was being handled.
+        drainPostedMessagesLocked();
+        if (mMessageEnvelopes.empty()) {
+            break;
+        }
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(0);
+        auto head = mMessageEnvelopes.begin();
+        const MessageEnvelope& messageEnvelope = head->second;
         if (messageEnvelope.uptime <= now) {
             // Remove the envelope from the list.
             // We keep a strong reference to the handler until the call to handleMessage
@@ -321,7 +361,7 @@ Done: ;
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                removeMessageLocked(head);
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -483,9 +523,10 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                     // before returning and unregistering itself.  Callback sequence number
                     // checks further ensure that the race is benign.
                     //
-                    // Unfortunately due to kernel limitations we need to rebuild the epoll
-                    // set from scratch because it may contain an old file handle that we are
-                    // now unable to remove since its file descriptor is no longer valid.
+                    // Unfortunately due to kernel limitations the epoll set may still
+                    // contain an old file handle that we are now unable to remove since its
+                    // file descriptor is no longer valid. It is remembered as stale, and the
+                    // epoll set is rebuilt from scratch only if it ever reports an event.
                     // No such problem would have occurred if we were using the poll system
                     // call instead, but that approach carries other disadvantages.
 #if DEBUG_CALLBACKS
@@ -499,7 +540,7 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                                 fd, strerror(errno));
                         return -1;
                     }
-                    scheduleEpollRebuildLocked();
+                    markSequenceNumberStaleLocked(seq_it->second);
                 } else {
                     ALOGE("Error modifying epoll events for fd %d: %s", fd, strerror(errno));
                     return -1;
@@ -547,9 +588,10 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
             // callback has the side-effect of closing the file descriptor before returning and
             // unregistering itself.
             //
-            // Unfortunately due to kernel limitations we need to rebuild the epoll
-            // set from scratch because it may contain an old file handle that we are
-            // now unable to remove since its file descriptor is no longer valid.
+            // Unfortunately due to kernel limitations the epoll set may still contain
+            // an old file handle that we are now unable to remove since its file
+            // descriptor is no longer valid. It is remembered as stale, and the epoll set
+            // is rebuilt from scratch only if it ever reports an event.
             // No such problem would have occurred if we were using the poll system
             // call instead, but that approach carries other disadvantages.
 #if DEBUG_CALLBACKS
@@ -557,7 +599,7 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
                   "being closed: %s",
                   this, strerror(errno));
 #endif
-            scheduleEpollRebuildLocked();
+            markSequenceNumberStaleLocked(seq);
         } else {
             // Some other error occurred.  This is really weird because it means
             // our list of callbacks got out of sync with the epoll set somehow.
@@ -573,7 +615,23 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
 
 void Looper::sendMessage(const sp<MessageHandler>& handler, const Message& message) {
     nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-    sendMessageAtTime(now, handler, message);
+#if DEBUG_CALLBACKS
+    ALOGD("%p ~ sendMessage - uptime=%" PRId64 ", handler=%p, what=%d",
+            this, now, handler.get(), message.what);
+#endif
+
+    // Immediate messages skip mLock: they are pushed onto mPostedMessages and the looper
+    // thread moves them into the queue.
+    PostedMessage* posted = new PostedMessage{now, handler, message, nullptr};
+    PostedMessage* head = mPostedMessages.load(std::memory_order_relaxed);
+    do {
+        posted->next = head;
+    } while (!mPostedMessages.compare_exchange_weak(head, posted));
+
+    // Only wake the looper if it is waiting, and only once per wait.
+    if (mNeedsWake.load() && mNeedsWake.exchange(false)) {
+        wake();
+    }
 }
 
 void Looper::sendMessageDelayed(nsecs_t uptimeDelay, const sp<MessageHandler>& handler,
@@ -589,17 +647,12 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    bool atHead;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        drainPostedMessagesLocked();
+        atHead = enqueueMessageLocked(uptime, handler, message);
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -611,7 +664,7 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (atHead) {
         wake();
     }
 }
@@ -624,12 +677,15 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
+        drainPostedMessagesLocked();
+        auto keys = mMessageKeysByHandler.find(handler.get());
+        if (keys == mMessageKeysByHandler.end()) {
+            return;
         }
+        for (const MessageKey& key : keys->second) {
+            mMessageEnvelopes.erase(key);
+        }
+        mMessageKeysByHandler.erase(keys);
     } // release lock
 }
 
@@ -641,16 +697,67 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
+        drainPostedMessagesLocked();
+        auto keys = mMessageKeysByHandler.find(handler.get());
+        if (keys == mMessageKeysByHandler.end()) {
+            return;
+        }
+        for (auto key = keys->second.begin(); key != keys->second.end(); ) {
+            auto it = mMessageEnvelopes.find(*key);
+            if (it->second.message.what == what) {
+                mMessageEnvelopes.erase(it);
+                key = keys->second.erase(key);
+            } else {
+                ++key;
             }
         }
+        if (keys->second.empty()) {
+            mMessageKeysByHandler.erase(keys);
+        }
     } // release lock
 }
 
+bool Looper::enqueueMessageLocked(nsecs_t uptime, const sp<MessageHandler>& handler,
+                                  const Message& message) {
+    // Messages sent for the same uptime are delivered in the order they were sent.
+    MessageKey key(uptime, mNextMessageSeq++);
+    auto it = mMessageEnvelopes.emplace_hint(mMessageEnvelopes.end(), key,
+                                             MessageEnvelope(uptime, handler, message));
+    mMessageKeysByHandler[handler.get()].insert(key);
+    return it == mMessageEnvelopes.begin();
+}
+
+void Looper::drainPostedMessagesLocked() {
+    PostedMessage* posted = mPostedMessages.exchange(nullptr, std::memory_order_acquire);
+    if (posted == nullptr) {
+        return;
+    }
+
+    // The stack holds the newest message first; enqueue them in the order they were posted.
+    PostedMessage* oldest = nullptr;
+    while (posted != nullptr) {
+        PostedMessage* next = posted->next;
+        posted->next = oldest;
+        oldest = posted;
+        posted = next;
+    }
+    while (oldest != nullptr) {
+        enqueueMessageLocked(oldest->uptime, oldest->handler, oldest->message);
+        PostedMessage* next = oldest->next;
+        delete oldest;
+        oldest = next;
+    }
+}
+
+void Looper::removeMessageLocked(MessageQueue::iterator it) {
+    auto keys = mMessageKeysByHandler.find(it->second.handler.get());
+    keys->second.erase(it->first);
+    if (keys->second.empty()) {
+        mMessageKeysByHandler.erase(keys);
+    }
+    mMessageEnvelopes.erase(it);
+}
+
 bool Looper::isPolling() const {
     return mPolling;
 }
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/Looper.h>
+
+#include <vector>
+
+using android::Looper;
+using android::Message;
+using android::MessageHandler;
+using android::sp;
+
+namespace {
+
+class NopMessageHandler : public MessageHandler {
+  public:
+    void handleMessage(const Message&) override {}
+};
+
+// Far enough in the future that none of the queued messages are ever delivered.
+constexpr nsecs_t kDelay = 3600 * 1000000000LL;
+
+// Fills a looper with |state.range(0)| delayed messages spread over 16 handlers.
+std::vector<sp<MessageHandler>> FillLooper(const sp<Looper>& looper, benchmark::State& state) {
+    std::vector<sp<MessageHandler>> handlers;
+    for (int i = 0; i < 16; i++) {
+        handlers.emplace_back(sp<NopMessageHandler>::make());
+    }
+    for (int64_t i = 0; i < state.range(0); i++) {
+        // Scatter the uptimes so that insertions do not all land at the tail.
+        nsecs_t delay = kDelay + ((i * 7919) % state.range(0)) * 1000;
+        looper->sendMessageDelayed(delay, handlers[i % handlers.size()],
+                                   Message(static_cast<int>(i)));
+    }
+    return handlers;
+}
+
+}  // namespace
+
+// Enqueues a message into a busy looper, then removes it again.
+void BM_Looper_sendAndRemoveMessage(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    auto handlers = FillLooper(looper, state);
+    sp<MessageHandler> handler = sp<NopMessageHandler>::make();
+    int64_t i = 0;
+    for (auto _ : state) {
+        looper->sendMessageDelayed(kDelay + (i++ % state.range(0)) * 1000, handler, Message(0));
+        looper->removeMessages(handler, 0);
+    }
+}
+BENCHMARK(BM_Looper_sendAndRemoveMessage)->Range(8, 8 << 10);
+
+// Removes the messages of a handler that has none pending, which is how most callers use
+// removeMessages() before sending a new message.
+void BM_Looper_removeMessagesOfIdleHandler(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    auto handlers = FillLooper(looper, state);
+    sp<MessageHandler> handler = sp<NopMessageHandler>::make();
+    for (auto _ : state) {
+        looper->removeMessages(handler);
+    }
+}
+BENCHMARK(BM_Looper_removeMessagesOfIdleHandler)->Range(8, 8 << 10);
+
+// Posts immediate messages from several threads while the looper thread drains them.
+void BM_Looper_sendMessage(benchmark::State& state) {
+    static sp<Looper> looper;
+    if (state.thread_index() == 0) {
+        looper = sp<Looper>::make(false);
+    }
+    sp<MessageHandler> handler = sp<NopMessageHandler>::make();
+    int64_t i = 0;
+    for (auto _ : state) {
+        looper->sendMessage(handler, Message(0));
+        if (state.thread_index() == 0 && (++i % 1024) == 0) {
+            looper->pollOnce(0);
+        }
+    }
+    if (state.thread_index() == 0) {
+        looper->pollOnce(0);
+        looper.clear();
+    }
+}
+BENCHMARK(BM_Looper_sendMessage)->ThreadRange(1, 8);
@@ -435,6 +435,54 @@ TEST_F(LooperTest, RemoveFd_WhenCallbackAddedThenRemovedTwice_ReturnsOnceFirstTi
             << "removeFd should return 0 second time because FD was no longer registered";
 }
 
+TEST_F(LooperTest, RemoveFd_WhenFdClosedBeforeRemoval_ShouldNotWakeLooper) {
+    Pipe pipe;
+    StubCallbackHandler handler(true);
+    handler.setCallback(mLooper, pipe.receiveFd, Looper::EVENT_INPUT);
+
+    // Closing the last reference to the file drops it from the epoll set, so there is nothing
+    // left to clean up.
+    ::close(pipe.receiveFd);
+    int result = mLooper->removeFd(pipe.receiveFd);
+    pipe.receiveFd = -1;
+
+    EXPECT_EQ(1, result)
+            << "removeFd should return 1 because FD was registered";
+
+    result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_TIMEOUT, result)
+            << "pollOnce result should be Looper::POLL_TIMEOUT because the epoll set was not rebuilt";
+}
+
+TEST_F(LooperTest, RemoveFd_WhenClosedFdIsStillOpenElsewhere_ShouldStopReportingEvents) {
+    Pipe pipe;
+    StubCallbackHandler handler(true);
+    handler.setCallback(mLooper, pipe.receiveFd, Looper::EVENT_INPUT);
+
+    // The file stays open through the duplicate, so its registration outlives the fd.
+    int dupFd = ::dup(pipe.receiveFd);
+    ::close(pipe.receiveFd);
+    int result = mLooper->removeFd(pipe.receiveFd);
+    pipe.receiveFd = dupFd;
+    pipe.writeSignal();
+
+    EXPECT_EQ(1, result)
+            << "removeFd should return 1 because FD was registered";
+
+    // The first event from the stale registration makes the looper rebuild its epoll set, after
+    // which the signal is no longer reported.
+    for (int i = 0; i < 5 && result != Looper::POLL_TIMEOUT; i++) {
+        result = mLooper->pollOnce(0);
+    }
+
+    EXPECT_EQ(Looper::POLL_TIMEOUT, result)
+            << "pollOnce result should be Looper::POLL_TIMEOUT because the stale registration "
+               "was removed";
+    EXPECT_EQ(0, handler.callbackCount)
+            << "callback should not be invoked for a removed fd";
+}
+
 TEST_F(LooperTest, PollOnce_WhenCallbackAddedTwice_OnlySecondCallbackShouldBeInvoked) {
     Pipe pipe;
     StubCallbackHandler handler1(true);
@@ -508,6 +556,31 @@ TEST_F(LooperTest, SendMessage_WhenMultipleMessagesAreEnqueued_ShouldInvokeHandl
             << "handled message";
 }
 
+TEST_F(LooperTest, SendMessage_WhenSentWhileLooperIsPolling_ShouldWakeLooper) {
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    std::thread sender([this, handler] {
+        while (!mLooper->isPolling()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        mLooper->sendMessage(handler, Message(MSG_TEST1));
+    });
+
+    StopWatch stopWatch("pollOnce");
+    int result = 0;
+    while (handler->messages.size() == 0 && ns2ms(stopWatch.elapsedTime()) < 1000) {
+        result = mLooper->pollOnce(1000);
+    }
+    int32_t elapsedMillis = ns2ms(stopWatch.elapsedTime());
+    sender.join();
+
+    EXPECT_NEAR(0, elapsedMillis, TIMING_TOLERANCE_MS)
+            << "elapsed time should approx. zero because the message woke the looper";
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because message was sent";
+    EXPECT_EQ(size_t(1), handler->messages.size())
+            << "handled message";
+}
+
 TEST_F(LooperTest, SendMessageDelayed_WhenSentToTheFuture_ShouldInvokeHandlerAfterDelayTime) {
     sp<StubMessageHandler> handler = new StubMessageHandler();
     mLooper->sendMessageDelayed(ms2ns(100), handler, Message(MSG_TEST1));
@@ -667,9 +740,10 @@ TEST_F(LooperTest, RemoveMessage_WhenRemovingAllMessagesForHandler_ShouldRemoveT
     int32_t elapsedMillis = ns2ms(stopWatch.elapsedTime());
 
     EXPECT_NEAR(0, elapsedMillis, TIMING_TOLERANCE_MS)
-            << "elapsed time should approx. zero because message was sent so looper was awoken";
-    EXPECT_EQ(Looper::POLL_WAKE, result)
-            << "pollOnce result should be Looper::POLL_WAKE because looper was awoken";
+            << "elapsed time should approx. zero because timeout was zero";
+    EXPECT_EQ(Looper::POLL_TIMEOUT, result)
+            << "pollOnce result should be Looper::POLL_TIMEOUT because the looper was not "
+               "polling when the messages were sent, so it was not woken up";
     EXPECT_EQ(size_t(0), handler->messages.size())
             << "no messages to handle";
 
@@ -713,6 +787,36 @@ TEST_F(LooperTest, RemoveMessage_WhenRemovingSomeMessagesForHandler_ShouldRemove
             << "no more messages to handle";
 }
 
+TEST_F(LooperTest, SendMessageAtTime_WhenSentOutOfOrder_ShouldInvokeHandlerInUptimeOrder) {
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    sp<StubMessageHandler> removedHandler = new StubMessageHandler();
+    mLooper->sendMessageAtTime(now - ms2ns(1000), handler, Message(MSG_TEST3));
+    mLooper->sendMessageAtTime(now - ms2ns(3000), handler, Message(MSG_TEST1));
+    mLooper->sendMessageAtTime(now - ms2ns(2500), removedHandler, Message(MSG_TEST1));
+    mLooper->sendMessageAtTime(now - ms2ns(2000), handler, Message(MSG_TEST2));
+    mLooper->sendMessageAtTime(now - ms2ns(2000), handler, Message(MSG_TEST4));
+    mLooper->sendMessageAtTime(now - ms2ns(1500), removedHandler, Message(MSG_TEST2));
+    mLooper->removeMessages(removedHandler);
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(4), handler->messages.size())
+            << "handled messages";
+    EXPECT_EQ(MSG_TEST1, handler->messages[0].what)
+            << "earliest message should be handled first";
+    EXPECT_EQ(MSG_TEST2, handler->messages[1].what)
+            << "messages with the same uptime should be handled in the order they were sent";
+    EXPECT_EQ(MSG_TEST4, handler->messages[2].what)
+            << "messages with the same uptime should be handled in the order they were sent";
+    EXPECT_EQ(MSG_TEST3, handler->messages[3].what)
+            << "latest message should be handled last";
+    EXPECT_EQ(size_t(0), removedHandler->messages.size())
+            << "removed messages should not be handled";
+}
+
 class LooperEventCallback : public LooperCallback {
   public:
     using Callback = std::function<int(int fd, int events)>;
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <benchmark/benchmark.h>
+#include <utils/JenkinsHash.h>
+#include <utils/LruCache.h>
+
+#include <vector>
+
+using android::FixedLruCache;
+using android::JenkinsHashMix;
+using android::JenkinsHashWhiten;
+using android::LruCache;
+
+namespace {
+
+constexpr size_t kNumKeys = 16 * 1024;
+
+// The same access pattern as LruCacheTest.StressTest: random keys drawn from kNumKeys, with a
+// put on every miss.
+std::vector<uint32_t> MakeKeys() {
+    std::vector<uint32_t> keys(kNumKeys);
+    srandom(12345);
+    for (auto& key : keys) {
+        key = JenkinsHashWhiten(JenkinsHashMix(0, random() % kNumKeys));
+    }
+    return keys;
+}
+
+template <typename Cache>
+void BM_GetOrPut(benchmark::State& state) {
+    Cache cache(state.range(0));
+    const std::vector<uint32_t> keys = MakeKeys();
+    size_t i = 0;
+    for (auto _ : state) {
+        uint32_t key = keys[i++ % kNumKeys];
+        if (cache.get(key) == 0) {
+            cache.put(key, key | 1);
+        }
+    }
+}
+BENCHMARK_TEMPLATE(BM_GetOrPut, LruCache<uint32_t, uint32_t>)->Range(64, 16 * 1024);
+BENCHMARK_TEMPLATE(BM_GetOrPut, FixedLruCache<uint32_t, uint32_t>)->Range(64, 16 * 1024);
+
+template <typename Cache>
+void BM_GetHit(benchmark::State& state) {
+    const uint32_t capacity = state.range(0);
+    Cache cache(capacity);
+    for (uint32_t key = 0; key < capacity; key++) {
+        cache.put(key, key | 1);
+    }
+    uint32_t key = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cache.get(key));
+        key = (key + 1) % capacity;
+    }
+}
+BENCHMARK_TEMPLATE(BM_GetHit, LruCache<uint32_t, uint32_t>)->Range(64, 16 * 1024);
+BENCHMARK_TEMPLATE(BM_GetHit, FixedLruCache<uint32_t, uint32_t>)->Range(64, 16 * 1024);
+
+}  // namespace
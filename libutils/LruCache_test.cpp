@@ -16,6 +16,8 @@
 
 #include <stdlib.h>
 
+#include <vector>
+
 #include <android/log.h>
 #include <gtest/gtest.h>
 #include <utils/JenkinsHash.h>
@@ -456,4 +458,148 @@ TEST_F(LruCacheTest, DontCopyKeyInGet) {
     cache.get(KeyFailsOnCopy(0));
 }
 
+
+TEST_F(LruCacheTest, FixedSimple) {
+    FixedLruCache<SimpleKey, StringValue> cache(100);
+
+    EXPECT_EQ(nullptr, cache.get(0));
+    EXPECT_TRUE(cache.put(1, "one"));
+    EXPECT_TRUE(cache.put(2, "two"));
+    EXPECT_TRUE(cache.put(3, "three"));
+    EXPECT_FALSE(cache.put(3, "drei"));
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_STREQ("two", cache.get(2));
+    EXPECT_STREQ("three", cache.get(3));
+    EXPECT_EQ(3u, cache.size());
+}
+
+TEST_F(LruCacheTest, FixedMaxCapacity) {
+    FixedLruCache<SimpleKey, StringValue> cache(2);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    EXPECT_STREQ("one", cache.get(1));
+    cache.put(3, "three");
+    EXPECT_EQ(nullptr, cache.get(2));
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_STREQ("three", cache.get(3));
+    EXPECT_EQ(2u, cache.size());
+}
+
+TEST_F(LruCacheTest, FixedRemoveLru) {
+    FixedLruCache<SimpleKey, StringValue> cache(100);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three");
+    EXPECT_STREQ("one", cache.peekOldestValue());
+    EXPECT_TRUE(cache.removeOldest());
+    EXPECT_EQ(nullptr, cache.get(1));
+    EXPECT_STREQ("two", cache.peekOldestValue());
+    EXPECT_TRUE(cache.remove(3));
+    EXPECT_FALSE(cache.remove(3));
+    EXPECT_STREQ("two", cache.get(2));
+    EXPECT_EQ(1u, cache.size());
+}
+
+TEST_F(LruCacheTest, FixedCollidingKeys) {
+    // Keys sharing their low bits land in the same probe runs; removing from the middle of a
+    // run must keep the rest of it reachable.
+    FixedLruCache<SimpleKey, int> cache(64);
+
+    for (int i = 0; i < 64; i++) {
+        ASSERT_TRUE(cache.put(i << 16, i));
+    }
+    for (int i = 0; i < 64; i += 3) {
+        ASSERT_TRUE(cache.remove(i << 16));
+    }
+    for (int i = 0; i < 64; i++) {
+        EXPECT_EQ(i % 3 ? i : 0, cache.get(i << 16));
+    }
+}
+
+TEST_F(LruCacheTest, FixedStressTest) {
+    const size_t kCacheSize = 512;
+    FixedLruCache<SimpleKey, int> cache(kCacheSize);
+    LruCache<SimpleKey, int> reference(kCacheSize);
+    const size_t kNumKeys = 16 * 1024;
+    const size_t kNumIters = 100000;
+
+    srandom(12345);
+    for (size_t i = 0; i < kNumIters; i++) {
+        int index = random() % kNumKeys;
+        uint32_t key = hash_int(index);
+        int expected = reference.get(key);
+        ASSERT_EQ(expected, cache.get(key));
+        if (expected == 0) {
+            reference.put(key, index + 1);
+            cache.put(key, index + 1);
+        } else if (random() % 8 == 0) {
+            reference.remove(key);
+            cache.remove(key);
+        }
+        ASSERT_EQ(reference.size(), cache.size());
+    }
+}
+
+TEST_F(LruCacheTest, FixedNoLeak) {
+    {
+        FixedLruCache<ComplexKey, ComplexValue> cache(2);
+
+        cache.put(ComplexKey(0), ComplexValue(0));
+        cache.put(ComplexKey(1), ComplexValue(1));
+        assertInstanceCount(2, 3);  // the member mNullValue counts as an instance
+        cache.put(ComplexKey(2), ComplexValue(2));
+        assertInstanceCount(2, 3);
+        cache.remove(ComplexKey(1));
+        assertInstanceCount(1, 2);
+        cache.clear();
+        assertInstanceCount(0, 1);
+        cache.put(ComplexKey(0), ComplexValue(0));
+        assertInstanceCount(1, 2);
+    }
+    assertInstanceCount(0, 0);
+}
+
+TEST_F(LruCacheTest, FixedCallbackRemovesKeyWorksOK) {
+    InvalidateKeyCallback callback;
+    FixedLruCache<KeyWithPointer, StringValue> cache(1);
+    cache.setOnEntryRemovedListener(&callback);
+    KeyWithPointer key1;
+    key1.ptr = new int(1);
+    KeyWithPointer key2;
+    key2.ptr = new int(2);
+
+    cache.put(key1, "one");
+    cache.put(key2, "two");
+    EXPECT_EQ(1U, cache.size());
+    EXPECT_STREQ("two", cache.get(key2));
+    cache.clear();
+}
+
+TEST_F(LruCacheTest, FixedIteratorIsOldestFirst) {
+    FixedLruCache<int, int> cache(100);
+
+    FixedLruCache<int, int>::Iterator empty(cache);
+    EXPECT_FALSE(empty.next());
+
+    cache.put(1, 4);
+    cache.put(2, 5);
+    cache.put(3, 6);
+    cache.get(1);
+
+    FixedLruCache<int, int>::Iterator it(cache);
+    std::vector<int> returnedKeys;
+    while (it.next()) {
+        returnedKeys.push_back(it.key());
+    }
+    EXPECT_EQ(std::vector<int>({2, 3, 1}), returnedKeys);
+}
+
+TEST_F(LruCacheTest, FixedDontCopyKeyInGet) {
+    FixedLruCache<KeyFailsOnCopy, KeyFailsOnCopy> cache(1);
+    // Check that get doesn't copy the key
+    cache.get(KeyFailsOnCopy(0));
+}
+
 }
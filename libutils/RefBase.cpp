@@ -790,6 +790,119 @@ void RefBase::onLastWeakRef(const void* /*id*/)
 
 // ---------------------------------------------------------------------------
 
+// The weakref_impl of a LazyWeakRefBase follows the OBJECT_LIFETIME_STRONG rules above, with
+// mBase left null: each strong reference also holds a weak one, and the object is deleted when
+// mStrong drops to zero. Nothing in that case looks at mBase.
+
+LazyWeakRefBase::~LazyWeakRefBase()
+{
+}
+
+RefBase::weakref_impl* LazyWeakRefBase::weakRefs() const
+{
+    uintptr_t refs = mRefs.load(std::memory_order_acquire);
+    if (!(refs & kInlineCount)) {
+        return reinterpret_cast<RefBase::weakref_impl*>(refs);
+    }
+
+    RefBase::weakref_impl* const impl = new RefBase::weakref_impl(nullptr);
+    do {
+        // A count of zero means there never was a strong reference.
+        const int32_t strong = static_cast<int32_t>(refs / kOneStrongRef);
+        impl->mStrong.store(strong != 0 ? strong : INITIAL_STRONG_VALUE,
+                std::memory_order_relaxed);
+        impl->mWeak.store(strong, std::memory_order_relaxed);
+        if (mRefs.compare_exchange_weak(refs, reinterpret_cast<uintptr_t>(impl),
+                std::memory_order_release, std::memory_order_acquire)) {
+            return impl;
+        }
+        // refs was updated by compare_exchange_weak: either the strong count changed, or
+        // another thread installed its own weakref_impl first.
+    } while (refs & kInlineCount);
+
+    delete impl;
+    return reinterpret_cast<RefBase::weakref_impl*>(refs);
+}
+
+void LazyWeakRefBase::incStrongShared(const void* id) const
+{
+    RefBase::weakref_impl* const refs = weakRefs();
+    refs->incWeak(id);
+
+    refs->addStrongRef(id);
+    const int32_t c = refs->mStrong.fetch_add(1, std::memory_order_relaxed);
+    ALOG_ASSERT(c > 0, "incStrong() called on %p after last strong ref", refs);
+    if (c == INITIAL_STRONG_VALUE) {
+        refs->mStrong.fetch_sub(INITIAL_STRONG_VALUE, std::memory_order_relaxed);
+    }
+}
+
+void LazyWeakRefBase::incStrongRequireStrong(const void* id) const
+{
+    uintptr_t refs = mRefs.load(std::memory_order_relaxed);
+    while (refs & kInlineCount) {
+        LOG_ALWAYS_FATAL_IF(refs == kInlineCount,
+                "incStrongRequireStrong() called on %p which isn't already owned", this);
+        if (mRefs.compare_exchange_weak(refs, refs + kOneStrongRef,
+                std::memory_order_relaxed)) {
+            return;
+        }
+    }
+
+    RefBase::weakref_impl* const impl = weakRefs();
+    impl->incWeak(id);
+
+    impl->addStrongRef(id);
+    const int32_t c = impl->mStrong.fetch_add(1, std::memory_order_relaxed);
+    LOG_ALWAYS_FATAL_IF(c <= 0 || c == INITIAL_STRONG_VALUE,
+            "incStrongRequireStrong() called on %p which isn't already owned", impl);
+}
+
+void LazyWeakRefBase::decStrongShared(const void* id) const
+{
+    RefBase::weakref_impl* const refs = weakRefs();
+    refs->removeStrongRef(id);
+    const int32_t c = refs->mStrong.fetch_sub(1, std::memory_order_release);
+    LOG_ALWAYS_FATAL_IF(BAD_STRONG(c), "decStrong() called on %p too many times", refs);
+    if (c == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        delete this;
+    }
+    // As in RefBase::decStrong(), refs outlives this and is freed by the final decWeak().
+    refs->decWeak(id);
+}
+
+void LazyWeakRefBase::reportDecStrongTooManyTimes()
+{
+    LOG_ALWAYS_FATAL("decStrong() called on a LazyWeakRefBase too many times");
+}
+
+int32_t LazyWeakRefBase::getStrongCount() const
+{
+    // Debugging only; No memory ordering guarantees.
+    const uintptr_t refs = mRefs.load(std::memory_order_acquire);
+    if (refs & kInlineCount) {
+        const int32_t strong = static_cast<int32_t>(refs / kOneStrongRef);
+        return strong != 0 ? strong : INITIAL_STRONG_VALUE;
+    }
+    return reinterpret_cast<RefBase::weakref_impl*>(refs)->mStrong.load(
+            std::memory_order_relaxed);
+}
+
+RefBase::weakref_type* LazyWeakRefBase::createWeak(const void* id) const
+{
+    RefBase::weakref_impl* const refs = weakRefs();
+    refs->incWeak(id);
+    return refs;
+}
+
+RefBase::weakref_type* LazyWeakRefBase::getWeakRefs() const
+{
+    return weakRefs();
+}
+
+// ---------------------------------------------------------------------------
+
 #if DEBUG_REFS
 void RefBase::renameRefs(size_t n, const ReferenceRenamer& renamer) {
     for (size_t i=0 ; i<n ; i++) {
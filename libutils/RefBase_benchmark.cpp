@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/RefBase.h>
+
+using android::LazyWeakRefBase;
+using android::RefBase;
+using android::sp;
+using android::VirtualLightRefBase;
+using android::wp;
+
+namespace {
+
+class StrongFoo : public RefBase {};
+class LightFoo : public VirtualLightRefBase {};
+class LazyFoo : public LazyWeakRefBase {};
+
+// RefBase allocates its weakref_impl here; LazyWeakRefBase and LightRefBase don't.
+template <typename T>
+void BM_make(benchmark::State& state) {
+    for (auto _ : state) {
+        sp<T> foo = sp<T>::make();
+        benchmark::DoNotOptimize(foo.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_make, StrongFoo);
+BENCHMARK_TEMPLATE(BM_make, LightFoo);
+BENCHMARK_TEMPLATE(BM_make, LazyFoo);
+
+// One incStrong() and one decStrong() per iteration.
+template <typename T>
+void BM_copy(benchmark::State& state) {
+    sp<T> foo = sp<T>::make();
+    for (auto _ : state) {
+        sp<T> copy = foo;
+        benchmark::DoNotOptimize(copy.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_copy, StrongFoo);
+BENCHMARK_TEMPLATE(BM_copy, LightFoo);
+BENCHMARK_TEMPLATE(BM_copy, LazyFoo);
+
+template <typename T>
+void BM_copy_contended(benchmark::State& state) {
+    static sp<T> foo;
+    if (state.thread_index() == 0) {
+        foo = sp<T>::make();
+    }
+    for (auto _ : state) {
+        sp<T> copy = foo;
+        benchmark::DoNotOptimize(copy.get());
+    }
+    if (state.thread_index() == 0) {
+        foo = nullptr;
+    }
+}
+BENCHMARK_TEMPLATE(BM_copy_contended, StrongFoo)->ThreadRange(1, 8);
+BENCHMARK_TEMPLATE(BM_copy_contended, LazyFoo)->ThreadRange(1, 8);
+
+// Once a wp<> exists, LazyWeakRefBase costs about the same as RefBase.
+template <typename T>
+void BM_promote(benchmark::State& state) {
+    sp<T> foo = sp<T>::make();
+    wp<T> weak = foo;
+    for (auto _ : state) {
+        sp<T> strong = weak.promote();
+        benchmark::DoNotOptimize(strong.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_promote, StrongFoo);
+BENCHMARK_TEMPLATE(BM_promote, LazyFoo);
+
+}  // namespace
@@ -430,3 +430,105 @@ TEST(RefBase, RacingPromotions) {
         ASSERT_EQ(NITERS, deleteCount) << "Deletions missed!";
     }  // Otherwise this is slow and probably pointless on a uniprocessor.
 }
+
+class LazyFoo : public LazyWeakRefBase {
+public:
+    LazyFoo(bool* deleted_check) : mDeleted(deleted_check) {
+        *mDeleted = false;
+    }
+
+    ~LazyFoo() {
+        *mDeleted = true;
+    }
+private:
+    bool* mDeleted;
+};
+
+TEST(LazyWeakRefBase, StrongOnly) {
+    bool isDeleted;
+    sp<LazyFoo> sp1 = sp<LazyFoo>::make(&isDeleted);
+    ASSERT_EQ(1, sp1->getStrongCount());
+    {
+        sp<LazyFoo> sp2 = sp1;
+        ASSERT_EQ(2, sp1->getStrongCount());
+    }
+    ASSERT_EQ(1, sp1->getStrongCount());
+    ASSERT_FALSE(isDeleted) << "deleted too early! still has a reference!";
+    sp1 = nullptr;
+    ASSERT_TRUE(isDeleted) << "foo was leaked!";
+}
+
+TEST(LazyWeakRefBase, WeakAfterStrong) {
+    bool isDeleted;
+    sp<LazyFoo> sp1 = sp<LazyFoo>::make(&isDeleted);
+    sp<LazyFoo> sp2 = sp1;
+    wp<LazyFoo> wp1 = sp1;
+    // The strong references are carried over, and each one holds a weak reference as in RefBase.
+    ASSERT_EQ(2, sp1->getStrongCount());
+    ASSERT_EQ(3, sp1->getWeakRefs()->getWeakCount());
+    ASSERT_TRUE(wp1 == sp1);
+    ASSERT_EQ(nullptr, wp1.get_refs()->refBase());
+
+    sp<LazyFoo> sp3 = wp1.promote();
+    ASSERT_EQ(sp1.get(), sp3.get());
+    ASSERT_EQ(3, sp1->getStrongCount());
+    sp1 = nullptr;
+    sp2 = nullptr;
+    ASSERT_FALSE(isDeleted) << "deleted too early! still has a reference!";
+    sp3 = nullptr;
+    ASSERT_TRUE(isDeleted) << "foo was leaked!";
+    ASSERT_TRUE(wp1.promote().get() == nullptr);
+}
+
+TEST(LazyWeakRefBase, WeakBeforeStrong) {
+    bool isDeleted;
+    LazyFoo* foo = new LazyFoo(&isDeleted);
+    ASSERT_EQ(INITIAL_STRONG_VALUE, foo->getStrongCount());
+    wp<LazyFoo> wp1(foo);
+    ASSERT_EQ(INITIAL_STRONG_VALUE, foo->getStrongCount());
+    ASSERT_EQ(1, foo->getWeakRefs()->getWeakCount());
+    {
+        sp<LazyFoo> sp1 = wp1.promote();
+        ASSERT_EQ(foo, sp1.get());
+        ASSERT_EQ(1, foo->getStrongCount());
+    }
+    ASSERT_TRUE(isDeleted) << "foo was leaked!";
+    ASSERT_TRUE(wp1.promote().get() == nullptr);
+}
+
+TEST(LazyWeakRefBase, AssertStrongRefExistsDeath) {
+    bool isDeleted;
+    LazyFoo* foo = new LazyFoo(&isDeleted);
+
+    // can only get a valid sp<> object when you construct it from an sp<>
+    EXPECT_DEATH(sp<LazyFoo>::fromExisting(foo), "");
+
+    delete foo;
+}
+
+static void promoteAndCopy(const wp<LazyFoo>& weak) {
+    for (int i = 0; i < NITERS / 100; ++i) {
+        sp<LazyFoo> strong = weak.promote();
+        ASSERT_NE(nullptr, strong.get());
+        sp<LazyFoo> copy = strong;
+    }
+}
+
+TEST(LazyWeakRefBase, RacingWeakCreation) {
+    for (int i = 0; i < 100; ++i) {
+        bool isDeleted;
+        sp<LazyFoo> sp1 = sp<LazyFoo>::make(&isDeleted);
+        // Both threads race to allocate the weak references while the strong count changes.
+        std::thread t([sp1] {
+            wp<LazyFoo> wp2 = sp1;
+            promoteAndCopy(wp2);
+        });
+        wp<LazyFoo> wp1 = sp1;
+        promoteAndCopy(wp1);
+        t.join();
+        ASSERT_EQ(1, sp1->getStrongCount());
+        ASSERT_EQ(2, sp1->getWeakRefs()->getWeakCount());
+        sp1 = nullptr;
+        ASSERT_TRUE(isDeleted) << "foo was leaked!";
+    }
+}
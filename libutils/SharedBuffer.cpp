@@ -27,6 +27,94 @@
 
 namespace android {
 
+// Buffers of up to kSmallBufferSizes bytes are rounded up to their size class and recycled
+// through a per-thread cache rather than handed back to malloc: most strings and vectors are
+// short-lived and a few dozen bytes long. mReserved holds the size class of such buffers, and
+// is 0 for any other buffer.
+//
+// Sanitizer builds skip the cache so that use-after-free of a buffer is still caught.
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(hwaddress_sanitizer)
+#define SHARED_BUFFER_NO_SMALL_BUFFER_CACHE
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define SHARED_BUFFER_NO_SMALL_BUFFER_CACHE
+#endif
+
+static constexpr size_t kSmallBufferSizes[] = {16, 32, 64};
+static constexpr uint32_t kNumSmallBufferClasses =
+        sizeof(kSmallBufferSizes) / sizeof(kSmallBufferSizes[0]);
+static constexpr uint32_t kMaxCachedSmallBuffers = 32;
+
+static inline uint32_t smallBufferClass(size_t size) {
+    for (uint32_t i = 0; i < kNumSmallBufferClasses; i++) {
+        if (size <= kSmallBufferSizes[i]) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+#if !defined(SHARED_BUFFER_NO_SMALL_BUFFER_CACHE)
+namespace {
+
+struct SmallBufferCache {
+    constexpr SmallBufferCache() : buffers{}, counts{} {}
+    ~SmallBufferCache();
+
+    SharedBuffer* buffers[kNumSmallBufferClasses][kMaxCachedSmallBuffers];
+    uint32_t counts[kNumSmallBufferClasses];
+};
+
+thread_local SmallBufferCache tSmallBufferCache;
+// Buffers released while the thread exits, after its cache is gone, go straight back to malloc.
+thread_local bool tSmallBufferCacheDestroyed = false;
+
+SmallBufferCache::~SmallBufferCache() {
+    tSmallBufferCacheDestroyed = true;
+    for (uint32_t i = 0; i < kNumSmallBufferClasses; i++) {
+        for (uint32_t j = 0; j < counts[i]; j++) {
+            free(buffers[i][j]);
+        }
+        counts[i] = 0;
+    }
+}
+
+}  // namespace
+#endif
+
+static SharedBuffer* takeSmallBuffer(uint32_t sizeClass) {
+#if !defined(SHARED_BUFFER_NO_SMALL_BUFFER_CACHE)
+    if (!tSmallBufferCacheDestroyed) {
+        SmallBufferCache& cache = tSmallBufferCache;
+        uint32_t& count = cache.counts[sizeClass - 1];
+        if (count > 0) {
+            return cache.buffers[sizeClass - 1][--count];
+        }
+    }
+#endif
+    return static_cast<SharedBuffer*>(
+            malloc(sizeof(SharedBuffer) + kSmallBufferSizes[sizeClass - 1]));
+}
+
+static bool cacheSmallBuffer(SharedBuffer* buffer, uint32_t sizeClass) {
+#if !defined(SHARED_BUFFER_NO_SMALL_BUFFER_CACHE)
+    if (!tSmallBufferCacheDestroyed) {
+        SmallBufferCache& cache = tSmallBufferCache;
+        uint32_t& count = cache.counts[sizeClass - 1];
+        if (count < kMaxCachedSmallBuffers) {
+            cache.buffers[sizeClass - 1][count++] = buffer;
+            return true;
+        }
+    }
+#else
+    (void)buffer;
+    (void)sizeClass;
+#endif
+    return false;
+}
+
 SharedBuffer* SharedBuffer::alloc(size_t size)
 {
     // Don't overflow if the combined size of the buffer / header is larger than
@@ -34,13 +122,16 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
     LOG_ALWAYS_FATAL_IF((size >= (SIZE_MAX - sizeof(SharedBuffer))),
                         "Invalid buffer size %zu", size);
 
-    SharedBuffer* sb = static_cast<SharedBuffer *>(malloc(sizeof(SharedBuffer) + size));
+    const uint32_t sizeClass = smallBufferClass(size);
+    SharedBuffer* sb = sizeClass ? takeSmallBuffer(sizeClass)
+                                 : static_cast<SharedBuffer*>(malloc(sizeof(SharedBuffer) + size));
     if (sb) {
         // Should be std::atomic_init(&sb->mRefs, 1);
         // But that generates a warning with some compilers.
         // The following is OK on Android-supported platforms.
         sb->mRefs.store(1, std::memory_order_relaxed);
         sb->mSize = size;
+        sb->mReserved = sizeClass;
         sb->mClientMetadata = 0;
     }
     return sb;
@@ -49,7 +140,11 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
 
 void SharedBuffer::dealloc(const SharedBuffer* released)
 {
-    free(const_cast<SharedBuffer*>(released));
+    SharedBuffer* buffer = const_cast<SharedBuffer*>(released);
+    if (buffer->mReserved != 0 && cacheSmallBuffer(buffer, buffer->mReserved)) {
+        return;
+    }
+    free(buffer);
 }
 
 SharedBuffer* SharedBuffer::edit() const
@@ -75,9 +170,15 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
         LOG_ALWAYS_FATAL_IF((newSize >= (SIZE_MAX - sizeof(SharedBuffer))),
                             "Invalid buffer size %zu", newSize);
 
+        // A small buffer already has room for anything up to the size of its class.
+        if (buf->mReserved != 0 && newSize <= kSmallBufferSizes[buf->mReserved - 1]) {
+            buf->mSize = newSize;
+            return buf;
+        }
         buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
         if (buf != nullptr) {
             buf->mSize = newSize;
+            buf->mReserved = 0;
             return buf;
         }
     }
@@ -102,6 +102,7 @@ private:
         // Must be sized to preserve correct alignment.
         mutable std::atomic<int32_t>        mRefs;
                 size_t                      mSize;
+                // Size class of buffers recycled by alloc()/dealloc(), or 0.
                 uint32_t                    mReserved;
 public:
         // mClientMetadata is reserved for client use.  It is initialized to 0
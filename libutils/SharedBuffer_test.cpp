@@ -20,6 +20,7 @@
 
 #include <memory>
 #include <stdint.h>
+#include <string.h>
 
 #include "SharedBuffer.h"
 
@@ -86,3 +87,41 @@ TEST(SharedBufferTest, editResize_zero_size) {
     ASSERT_EQ(0U, buf->size());
     buf->release();
 }
+
+TEST(SharedBufferTest, small_buffers_are_recycled) {
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(hwaddress_sanitizer)
+    GTEST_SKIP() << "small buffers are not cached under sanitizers";
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+    GTEST_SKIP() << "small buffers are not cached under sanitizers";
+#endif
+    android::SharedBuffer* buf = android::SharedBuffer::alloc(10);
+    ASSERT_NE(nullptr, buf);
+    buf->release();
+
+    // Any size in the same class reuses the buffer instead of allocating a new one.
+    android::SharedBuffer* buf2 = android::SharedBuffer::alloc(16);
+    ASSERT_EQ(buf, buf2);
+    ASSERT_EQ(16U, buf2->size());
+    buf2->release();
+}
+
+TEST(SharedBufferTest, editResize_small_buffer) {
+    android::SharedBuffer* buf = android::SharedBuffer::alloc(10);
+    memset(buf->data(), 'a', 10);
+
+    // Growing within the size class keeps the buffer in place.
+    buf = buf->editResize(16);
+    ASSERT_EQ(16U, buf->size());
+
+    // Growing past it moves the buffer to the heap but keeps its contents.
+    buf = buf->editResize(100);
+    ASSERT_NE(nullptr, buf);
+    ASSERT_EQ(100U, buf->size());
+    for (size_t i = 0; i < 10; i++) {
+        ASSERT_EQ('a', static_cast<char*>(buf->data())[i]);
+    }
+    buf->release();
+}
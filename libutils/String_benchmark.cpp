@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+#include <string>
+
+using android::String16;
+using android::String8;
+
+namespace {
+
+// Short strings fit SharedBuffer's small size classes and are recycled without going to malloc;
+// long ones are not, so the two show what the per-thread cache saves.
+const char* const kShort = "android.os.IBinder";
+const char* const kLong =
+        "android.hardware.graphics.composer3.IComposerClient/default, as seen from a binder "
+        "transaction";
+
+void BM_String8_construct(benchmark::State& state) {
+    const char* str = state.range(0) ? kLong : kShort;
+    for (auto _ : state) {
+        String8 s(str);
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String8_construct)->Arg(0)->Arg(1);
+
+void BM_String8_append(benchmark::State& state) {
+    for (auto _ : state) {
+        String8 s("android.");
+        s.append("os");
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String8_append);
+
+void BM_String16_construct(benchmark::State& state) {
+    const char* str = state.range(0) ? kLong : kShort;
+    for (auto _ : state) {
+        String16 s(str);
+        benchmark::DoNotOptimize(s.string());
+    }
+}
+BENCHMARK(BM_String16_construct)->Arg(0)->Arg(1);
+
+void BM_std_string_construct(benchmark::State& state) {
+    const char* str = state.range(0) ? kLong : kShort;
+    for (auto _ : state) {
+        std::string s(str);
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_std_string_construct)->Arg(0)->Arg(1);
+
+}  // namespace
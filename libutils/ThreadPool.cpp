@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ThreadPool"
+
+#include <utils/ThreadPool.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <log/log.h>
+#include <utils/AndroidThreads.h>
+
+namespace android {
+
+// The pool the calling thread is a worker of, and its index there.
+static thread_local const ThreadPool* tPool = nullptr;
+static thread_local size_t tWorker = ThreadPool::kAnyWorker;
+
+// Finds the CPU worker |worker| should be pinned to: the one at that index, modulo the count,
+// among those the process may run on. Returns -1 if there are none.
+static int cpuForWorker(size_t worker) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+    const int count = CPU_COUNT(&allowed);
+    if (count == 0) {
+        return -1;
+    }
+    int index = static_cast<int>(worker % count);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+ThreadPool::ThreadPool() : ThreadPool(Options()) {}
+
+ThreadPool::ThreadPool(const Options& options) {
+    size_t numThreads = options.numThreads;
+    if (numThreads == 0) {
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    mQueues.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++) {
+        mQueues.emplace_back(std::make_unique<WorkQueue>());
+    }
+
+    // Pick the CPUs before any worker changes its own affinity.
+    std::vector<int> cpus(numThreads, -1);
+    if (options.pinToCpus) {
+        for (size_t i = 0; i < numThreads; i++) {
+            cpus[i] = cpuForWorker(i);
+        }
+    }
+
+    mThreads.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++) {
+        const std::string name = options.name + ":" + std::to_string(i);
+        const int32_t priority = options.priority;
+        const int cpu = cpus[i];
+        mThreads.emplace_back([this, i, name, priority, cpu] {
+            androidSetThreadName(name.c_str());
+#if defined(__ANDROID__)
+            if (priority != PRIORITY_DEFAULT && androidSetThreadPriority(0, priority) != 0) {
+                ALOGW("Failed to set priority %d on %s: %s", priority, name.c_str(),
+                      strerror(errno));
+            }
+#else
+            (void)priority;
+#endif
+            if (cpu >= 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+                    ALOGW("Failed to pin %s to cpu %d: %s", name.c_str(), cpu, strerror(errno));
+                }
+            }
+            workerLoop(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mExiting = true;
+    }
+    mWorkAvailable.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::post(Task task, size_t affinity) {
+    size_t queue;
+    if (affinity != kAnyWorker) {
+        queue = affinity % mQueues.size();
+    } else if (tPool == this) {
+        queue = tWorker;
+    } else {
+        queue = mNextQueue.fetch_add(1, std::memory_order_relaxed) % mQueues.size();
+    }
+
+    mPending.fetch_add(1, std::memory_order_relaxed);
+    // Pairs with the mSleepers increment in workerLoop(): either that worker sees this task, or
+    // we see it asleep and wake it.
+    mQueued.fetch_add(1, std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lock(mQueues[queue]->mutex);
+        mQueues[queue]->tasks.push_back(std::move(task));
+    }
+    if (mSleepers.load(std::memory_order_seq_cst) != 0) {
+        std::lock_guard<std::mutex> lock(mLock);
+        mWorkAvailable.notify_one();
+    }
+}
+
+void ThreadPool::wait() {
+    LOG_ALWAYS_FATAL_IF(tPool == this, "ThreadPool::wait() called from worker %zu", tWorker);
+
+    std::unique_lock<std::mutex> lock(mLock);
+    mIdle.wait(lock, [this] { return mPending.load(std::memory_order_acquire) == 0; });
+}
+
+size_t ThreadPool::currentWorker() const {
+    return tPool == this ? tWorker : kAnyWorker;
+}
+
+bool ThreadPool::pop(size_t worker, Task* task) {
+    // Our own newest task first, then the oldest task of the next busy worker.
+    const size_t count = mQueues.size();
+    for (size_t i = 0; i < count; i++) {
+        WorkQueue& queue = *mQueues[(worker + i) % count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            *task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            *task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        mQueued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t worker) {
+    tPool = this;
+    tWorker = worker;
+
+    Task task;
+    while (true) {
+        if (pop(worker, &task)) {
+            task();
+            task = nullptr;
+            if (mPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(mLock);
+                mIdle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mLock);
+        mSleepers.fetch_add(1, std::memory_order_seq_cst);
+        mWorkAvailable.wait(lock, [this] {
+            return mExiting || mQueued.load(std::memory_order_seq_cst) != 0;
+        });
+        mSleepers.fetch_sub(1, std::memory_order_relaxed);
+        if (mExiting && mQueued.load(std::memory_order_relaxed) == 0) {
+            break;
+        }
+    }
+
+    tPool = nullptr;
+    tWorker = kAnyWorker;
+}
+
+}  // namespace android
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/ThreadPool.h>
+
+#include <atomic>
+
+using android::ThreadPool;
+
+namespace {
+
+constexpr int kTasks = 10000;
+
+ThreadPool::Options WithThreads(size_t numThreads) {
+    ThreadPool::Options options;
+    options.numThreads = numThreads;
+    return options;
+}
+
+// Many tiny tasks posted from outside the pool, spread round-robin over the queues.
+void BM_post_external(benchmark::State& state) {
+    ThreadPool pool(WithThreads(state.range(0)));
+    std::atomic<int> count(0);
+    for (auto _ : state) {
+        for (int i = 0; i < kTasks; i++) {
+            pool.post([&count] { count.fetch_add(1, std::memory_order_relaxed); });
+        }
+        pool.wait();
+    }
+    state.SetItemsProcessed(state.iterations() * kTasks);
+}
+BENCHMARK(BM_post_external)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+// The same tasks all posted to one queue, so the other workers have to steal them.
+void BM_post_stolen(benchmark::State& state) {
+    ThreadPool pool(WithThreads(state.range(0)));
+    std::atomic<int> count(0);
+    for (auto _ : state) {
+        for (int i = 0; i < kTasks; i++) {
+            pool.post([&count] { count.fetch_add(1, std::memory_order_relaxed); }, 0);
+        }
+        pool.wait();
+    }
+    state.SetItemsProcessed(state.iterations() * kTasks);
+}
+BENCHMARK(BM_post_stolen)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+void Split(ThreadPool* pool, std::atomic<int>* count, int depth) {
+    if (depth == 0) {
+        count->fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    pool->post([=] { Split(pool, count, depth - 1); });
+    pool->post([=] { Split(pool, count, depth - 1); });
+}
+
+// Recursively split work, posted from the workers themselves onto their own queues.
+void BM_post_nested(benchmark::State& state) {
+    ThreadPool pool(WithThreads(state.range(0)));
+    std::atomic<int> count(0);
+    for (auto _ : state) {
+        pool.post([&] { Split(&pool, &count, 13); });
+        pool.wait();
+    }
+    state.SetItemsProcessed(state.iterations() * ((2 << 13) - 1));
+}
+BENCHMARK(BM_post_nested)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+}  // namespace
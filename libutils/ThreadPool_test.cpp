@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/ThreadPool.h>
+
+#include <sched.h>
+
+#include <atomic>
+#include <mutex>
+#include <set>
+
+#include <gtest/gtest.h>
+
+using android::ThreadPool;
+
+namespace {
+
+ThreadPool::Options WithThreads(size_t numThreads) {
+    ThreadPool::Options options;
+    options.numThreads = numThreads;
+    return options;
+}
+
+// Splits [begin, end) in half until it is small, posting the halves from the worker.
+void SumRange(ThreadPool* pool, std::atomic<uint64_t>* sum, uint64_t begin, uint64_t end) {
+    if (end - begin <= 16) {
+        uint64_t total = 0;
+        for (uint64_t i = begin; i < end; i++) total += i;
+        *sum += total;
+        return;
+    }
+    const uint64_t mid = begin + (end - begin) / 2;
+    pool->post([=] { SumRange(pool, sum, begin, mid); });
+    pool->post([=] { SumRange(pool, sum, mid, end); });
+}
+
+}  // namespace
+
+TEST(ThreadPoolTest, DefaultsToOneWorkerPerCpu) {
+    ThreadPool pool;
+    EXPECT_EQ(std::max(std::thread::hardware_concurrency(), 1u), pool.size());
+}
+
+TEST(ThreadPoolTest, RunsEveryTask) {
+    ThreadPool pool(WithThreads(4));
+    std::atomic<int> count(0);
+    for (int i = 0; i < 10000; i++) {
+        pool.post([&count] { count++; });
+    }
+    pool.wait();
+    EXPECT_EQ(10000, count);
+}
+
+TEST(ThreadPoolTest, WaitsForNestedTasks) {
+    ThreadPool pool(WithThreads(4));
+    std::atomic<uint64_t> sum(0);
+    const uint64_t n = 100000;
+    pool.post([&] { SumRange(&pool, &sum, 0, n); });
+    pool.wait();
+    EXPECT_EQ(n * (n - 1) / 2, sum);
+}
+
+TEST(ThreadPoolTest, DestructorDrainsQueue) {
+    std::atomic<int> count(0);
+    {
+        ThreadPool pool(WithThreads(2));
+        for (int i = 0; i < 1000; i++) {
+            pool.post([&count] { count++; });
+        }
+    }
+    EXPECT_EQ(1000, count);
+}
+
+TEST(ThreadPoolTest, CurrentWorker) {
+    ThreadPool pool(WithThreads(3));
+    EXPECT_EQ(ThreadPool::kAnyWorker, pool.currentWorker());
+
+    std::mutex lock;
+    std::set<size_t> workers;
+    for (int i = 0; i < 100; i++) {
+        pool.post([&] {
+            std::lock_guard<std::mutex> guard(lock);
+            workers.insert(pool.currentWorker());
+        });
+    }
+    pool.wait();
+    for (size_t worker : workers) {
+        EXPECT_LT(worker, pool.size());
+    }
+}
+
+TEST(ThreadPoolTest, IdleWorkersSteal) {
+    ThreadPool pool(WithThreads(2));
+    std::atomic<bool> release(false);
+    std::atomic<int> count(0);
+
+    // Keep worker 0 busy, then queue more work on it: worker 1 has to steal it.
+    pool.post([&] { while (!release) sched_yield(); }, 0);
+    for (int i = 0; i < 100; i++) {
+        pool.post([&count] { count++; }, 0);
+    }
+    while (count != 100) sched_yield();
+    release = true;
+    pool.wait();
+}
+
+TEST(ThreadPoolTest, PinToCpus) {
+    cpu_set_t allowed;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+
+    ThreadPool::Options options = WithThreads(2);
+    options.pinToCpus = true;
+    ThreadPool pool(options);
+
+    std::atomic<int> pinned(0);
+    for (size_t i = 0; i < pool.size(); i++) {
+        pool.post([&] {
+            cpu_set_t set;
+            if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1) {
+                pinned++;
+            }
+        }, i);
+    }
+    pool.wait();
+    EXPECT_EQ(2, pinned);
+}
+
+TEST(ThreadPoolDeathTest, WaitFromWorker) {
+    // The pool is built inside the child: its workers would not survive the fork.
+    EXPECT_DEATH(
+            {
+                ThreadPool pool(WithThreads(1));
+                pool.post([&pool] { pool.wait(); });
+                pool.wait();
+            },
+            "called from worker");
+}
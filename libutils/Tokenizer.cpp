@@ -18,18 +18,106 @@
 
 #include <utils/Tokenizer.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <utils/Log.h>
 
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 // Enables debug output for the tokenizer.
 #define DEBUG_TOKENIZER 0
 
 
 namespace android {
 
-static inline bool isDelimiter(char ch, const char* delimiters) {
-    return strchr(delimiters, ch) != nullptr;
-}
+namespace {
+
+// Scanning compares each 16-byte block against every byte of a set, so sets larger than this
+// are scanned one byte at a time through the table instead.
+static constexpr size_t kMaxVectorSetSize = 8;
+
+/**
+ * Finds the first byte in [p, end) that is (or, if stopOnMember is false, is not) one of the
+ * bytes in a set.
+ */
+struct ByteScanner {
+    bool stopOnMember;
+    size_t setSize;
+    uint8_t set[kMaxVectorSetSize];
+    bool stop[256];
+
+    void init(const char* delimiters, bool newlineInSet, bool stopAtMember) {
+        stopOnMember = stopAtMember;
+        setSize = 0;
+        bool inSet[256] = {};
+        inSet[0] = true; // Embedded nulls are treated as delimiters.
+        for (const char* d = delimiters; *d; d++) {
+            inSet[uint8_t(*d)] = true;
+        }
+        inSet[uint8_t('\n')] = newlineInSet;
+        for (size_t ch = 0; ch < 256; ch++) {
+            stop[ch] = inSet[ch] == stopOnMember;
+            if (inSet[ch]) {
+                if (setSize < kMaxVectorSetSize) {
+                    set[setSize] = uint8_t(ch);
+                }
+                setSize += 1;
+            }
+        }
+    }
+
+    const char* find(const char* p, const char* end) const {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        if (setSize <= kMaxVectorSetSize) {
+            while (end - p >= 16) {
+#if defined(__SSE2__)
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                __m128i match = _mm_setzero_si128();
+                for (size_t i = 0; i < setSize; i++) {
+                    match = _mm_or_si128(match, _mm_cmpeq_epi8(block, _mm_set1_epi8(set[i])));
+                }
+                uint32_t bits = _mm_movemask_epi8(match);
+                if (!stopOnMember) bits ^= 0xffff;
+                if (bits) return p + __builtin_ctz(bits);
+#else
+                uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+                uint8x16_t match = vdupq_n_u8(0);
+                for (size_t i = 0; i < setSize; i++) {
+                    match = vorrq_u8(match, vceqq_u8(block, vdupq_n_u8(set[i])));
+                }
+                if (!stopOnMember) match = vmvnq_u8(match);
+                // Narrows each byte of the mask to a nibble, so that the first match is the
+                // lowest set nibble.
+                uint64_t bits = vget_lane_u64(
+                        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+                if (bits) return p + (__builtin_ctzll(bits) >> 2);
+#endif
+                p += 16;
+            }
+        }
+#endif
+        while (p != end && !stop[uint8_t(*p)]) {
+            p += 1;
+        }
+        return p;
+    }
+};
+
+} // namespace
+
+struct Tokenizer::DelimiterSet {
+    std::string delimiters;
+    // Stops at a delimiter or a newline.
+    ByteScanner token;
+    // Stops at anything but a delimiter, or at a newline.
+    ByteScanner skip;
+};
 
 Tokenizer::Tokenizer(const String8& filename, FileMap* fileMap, char* buffer,
         bool ownBuffer, size_t length) :
@@ -109,33 +197,46 @@ String8 Tokenizer::getLocation() const {
     return result;
 }
 
+const Tokenizer::DelimiterSet& Tokenizer::getDelimiterSet(const char* delimiters) {
+    // Callers pass the same few delimiter strings over and over, so only rebuild the byte
+    // classes when they change.
+    if (mDelimiterSet == nullptr) {
+        mDelimiterSet.reset(new DelimiterSet());
+    } else if (mDelimiterSet->delimiters == delimiters) {
+        return *mDelimiterSet;
+    }
+    mDelimiterSet->delimiters = delimiters;
+    mDelimiterSet->token.init(delimiters, true, true);
+    mDelimiterSet->skip.init(delimiters, false, false);
+    return *mDelimiterSet;
+}
+
 String8 Tokenizer::peekRemainderOfLine() const {
+    std::string_view line = peekRemainderOfLineView();
+    return String8(line.data(), line.size());
+}
+
+std::string_view Tokenizer::peekRemainderOfLineView() const {
     const char* end = getEnd();
-    const char* eol = mCurrent;
-    while (eol != end) {
-        char ch = *eol;
-        if (ch == '\n') {
-            break;
-        }
-        eol += 1;
+    const char* eol = static_cast<const char*>(memchr(mCurrent, '\n', end - mCurrent));
+    if (eol == nullptr) {
+        eol = end;
     }
-    return String8(mCurrent, eol - mCurrent);
+    return std::string_view(mCurrent, eol - mCurrent);
 }
 
 String8 Tokenizer::nextToken(const char* delimiters) {
+    std::string_view token = nextTokenView(delimiters);
+    return String8(token.data(), token.size());
+}
+
+std::string_view Tokenizer::nextTokenView(const char* delimiters) {
 #if DEBUG_TOKENIZER
     ALOGD("nextToken");
 #endif
-    const char* end = getEnd();
     const char* tokenStart = mCurrent;
-    while (mCurrent != end) {
-        char ch = *mCurrent;
-        if (ch == '\n' || isDelimiter(ch, delimiters)) {
-            break;
-        }
-        mCurrent += 1;
-    }
-    return String8(tokenStart, mCurrent - tokenStart);
+    mCurrent = getDelimiterSet(delimiters).token.find(mCurrent, getEnd());
+    return std::string_view(tokenStart, mCurrent - tokenStart);
 }
 
 void Tokenizer::nextLine() {
@@ -143,12 +244,12 @@ void Tokenizer::nextLine() {
     ALOGD("nextLine");
 #endif
     const char* end = getEnd();
-    while (mCurrent != end) {
-        char ch = *(mCurrent++);
-        if (ch == '\n') {
-            mLineNumber += 1;
-            break;
-        }
+    const char* eol = static_cast<const char*>(memchr(mCurrent, '\n', end - mCurrent));
+    if (eol == nullptr) {
+        mCurrent = end;
+    } else {
+        mCurrent = eol + 1;
+        mLineNumber += 1;
     }
 }
 
@@ -156,14 +257,7 @@ void Tokenizer::skipDelimiters(const char* delimiters) {
 #if DEBUG_TOKENIZER
     ALOGD("skipDelimiters");
 #endif
-    const char* end = getEnd();
-    while (mCurrent != end) {
-        char ch = *mCurrent;
-        if (ch == '\n' || !isDelimiter(ch, delimiters)) {
-            break;
-        }
-        mCurrent += 1;
-    }
+    mCurrent = getDelimiterSet(delimiters).skip.find(mCurrent, getEnd());
 }
 
 } // namespace android
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Tokenizer_test"
+
+#include <utils/Tokenizer.h>
+
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace android;
+
+static const char* kWhitespace = " \t\r";
+
+static std::unique_ptr<Tokenizer> makeTokenizer(const char* contents) {
+    Tokenizer* tokenizer;
+    EXPECT_EQ(OK, Tokenizer::fromContents(String8("test.txt"), contents, &tokenizer));
+    return std::unique_ptr<Tokenizer>(tokenizer);
+}
+
+TEST(TokenizerTest, Tokens) {
+    std::unique_ptr<Tokenizer> tokenizer = makeTokenizer("key 1 \tA\r\n  map  key 2 B\n");
+
+    EXPECT_EQ("key", tokenizer->nextTokenView(kWhitespace));
+    tokenizer->skipDelimiters(kWhitespace);
+    EXPECT_EQ("1", tokenizer->nextTokenView(kWhitespace));
+    tokenizer->skipDelimiters(kWhitespace);
+    EXPECT_STREQ("A", tokenizer->nextToken(kWhitespace).string());
+    tokenizer->skipDelimiters(kWhitespace);
+    EXPECT_TRUE(tokenizer->isEol());
+    EXPECT_EQ("", tokenizer->nextTokenView(kWhitespace));
+
+    tokenizer->nextLine();
+    EXPECT_EQ(2, tokenizer->getLineNumber());
+    tokenizer->skipDelimiters(kWhitespace);
+    EXPECT_EQ("map  key 2 B", tokenizer->peekRemainderOfLineView());
+    EXPECT_STREQ("map  key 2 B", tokenizer->peekRemainderOfLine().string());
+    EXPECT_EQ("map", tokenizer->nextTokenView(kWhitespace));
+
+    tokenizer->nextLine();
+    EXPECT_EQ(3, tokenizer->getLineNumber());
+    EXPECT_TRUE(tokenizer->isEof());
+    tokenizer->nextLine();
+    EXPECT_EQ(3, tokenizer->getLineNumber());
+}
+
+TEST(TokenizerTest, LongLines) {
+    // Long enough to cross several vector blocks, with the delimiters at every offset.
+    for (size_t prefix = 0; prefix < 40; prefix++) {
+        std::string token(prefix, 'x');
+        std::string spaces(prefix, ' ');
+        std::string contents = token + " \t" + spaces + token + "y\n" + spaces;
+        std::unique_ptr<Tokenizer> tokenizer = makeTokenizer(contents.c_str());
+
+        EXPECT_EQ(token, tokenizer->nextTokenView(kWhitespace));
+        tokenizer->skipDelimiters(kWhitespace);
+        EXPECT_EQ(token + "y", tokenizer->nextTokenView(kWhitespace));
+        EXPECT_TRUE(tokenizer->isEol());
+        tokenizer->skipDelimiters(kWhitespace);
+        EXPECT_EQ('\n', tokenizer->peekChar());
+
+        tokenizer->nextLine();
+        tokenizer->skipDelimiters(kWhitespace);
+        EXPECT_TRUE(tokenizer->isEof());
+    }
+}
+
+TEST(TokenizerTest, ChangingDelimiters) {
+    std::unique_ptr<Tokenizer> tokenizer = makeTokenizer("a=b,c d");
+
+    EXPECT_EQ("a", tokenizer->nextTokenView("="));
+    tokenizer->skipDelimiters("=");
+    EXPECT_EQ("b", tokenizer->nextTokenView(","));
+    tokenizer->skipDelimiters(",");
+    EXPECT_EQ("c", tokenizer->nextTokenView(kWhitespace));
+    tokenizer->skipDelimiters(kWhitespace);
+    EXPECT_EQ("d", tokenizer->nextTokenView("=,"));
+    EXPECT_TRUE(tokenizer->isEof());
+}
+
+TEST(TokenizerTest, ManyDelimiters) {
+    // More delimiters than are compared a block at a time.
+    const char* delimiters = " \t\r,;:=|()";
+    std::unique_ptr<Tokenizer> tokenizer =
+            makeTokenizer("first , ; : = | ( ) second_token_longer_than_a_block)");
+
+    EXPECT_EQ("first", tokenizer->nextTokenView(delimiters));
+    tokenizer->skipDelimiters(delimiters);
+    EXPECT_EQ("second_token_longer_than_a_block", tokenizer->nextTokenView(delimiters));
+    EXPECT_EQ(')', tokenizer->nextChar());
+    EXPECT_TRUE(tokenizer->isEof());
+}
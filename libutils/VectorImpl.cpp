@@ -39,6 +39,22 @@ static inline size_t max(size_t a, size_t b) {
     return a>b ? a : b;
 }
 
+// Items that can be moved with memmove can also be moved to a new buffer by editResize(), as
+// long as nobody else still references the old one. Items that can also be copied with memcpy
+// are safe to move out of a shared buffer too, since editResize() copies it.
+static inline bool isRelocatable(uint32_t flags) {
+    return (flags & VectorImpl::HAS_TRIVIAL_MOVE) ||
+           ((flags & VectorImpl::HAS_TRIVIAL_COPY) && (flags & VectorImpl::HAS_TRIVIAL_DTOR));
+}
+
+static inline bool canResizeInPlace(const void* storage, uint32_t flags) {
+    if (!storage || !isRelocatable(flags)) {
+        return false;
+    }
+    return ((flags & VectorImpl::HAS_TRIVIAL_COPY) && (flags & VectorImpl::HAS_TRIVIAL_DTOR)) ||
+           SharedBuffer::bufferFromData(storage)->onlyOwner();
+}
+
 // ----------------------------------------------------------------------------
 
 VectorImpl::VectorImpl(size_t itemSize, uint32_t flags)
@@ -339,6 +355,14 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
 
     size_t new_allocation_size = 0;
     LOG_ALWAYS_FATAL_IF(__builtin_mul_overflow(new_capacity, mItemSize, &new_allocation_size));
+    if (canResizeInPlace(mStorage, mFlags)) {
+        SharedBuffer* sb = SharedBuffer::bufferFromData(mStorage)->editResize(new_allocation_size);
+        if (!sb) {
+            return NO_MEMORY;
+        }
+        mStorage = sb->data();
+        return new_capacity;
+    }
     SharedBuffer* sb = SharedBuffer::alloc(new_allocation_size);
     if (sb) {
         void* array = sb->data();
@@ -405,11 +429,7 @@ void* VectorImpl::_grow(size_t where, size_t amount)
                             "new_alloc_size overflow");
 
         // ALOGV("grow vector %p, new_capacity=%d", this, (int)new_capacity);
-        if ((mStorage) &&
-            (mCount==where) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
-        {
+        if (canResizeInPlace(mStorage, mFlags)) {
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_alloc_size);
             if (sb) {
@@ -417,6 +437,11 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             } else {
                 return nullptr;
             }
+            if (where != mCount) {
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* to = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                memmove(to, from, (mCount - where)*mItemSize);
+            }
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
             if (sb) {
@@ -473,7 +498,21 @@ void VectorImpl::_shrink(size_t where, size_t amount)
         // we are always reducing the capacity of the underlying SharedBuffer.
         // In other words, (old_capacity * mItemSize) did not overflow, and
         // where < (where + amount) < new_capacity < old_capacity.
-        if ((where == new_size) &&
+        if (isRelocatable(mFlags) && SharedBuffer::bufferFromData(mStorage)->onlyOwner()) {
+            // Close the gap first, so that the buffer can simply be truncated. If editResize()
+            // fails the items stay where they are, with the old capacity.
+            void* to = reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize;
+            _do_destroy(to, amount);
+            if (where != new_size) {
+                const void* from = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                memmove(to, from, (new_size - where)*mItemSize);
+            }
+            const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
+            SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
+            if (sb) {
+                mStorage = sb->data();
+            }
+        } else if ((where == new_size) &&
             (mFlags & HAS_TRIVIAL_COPY) &&
             (mFlags & HAS_TRIVIAL_DTOR))
         {
@@ -546,11 +585,19 @@ void VectorImpl::_do_splat(void* dest, const void* item, size_t num) const {
 }
 
 void VectorImpl::_do_move_forward(void* dest, const void* from, size_t num) const {
-    do_move_forward(dest, from, num);
+    if (isRelocatable(mFlags)) {
+        memmove(dest, from, num*itemSize());
+    } else {
+        do_move_forward(dest, from, num);
+    }
 }
 
 void VectorImpl::_do_move_backward(void* dest, const void* from, size_t num) const {
-    do_move_backward(dest, from, num);
+    if (isRelocatable(mFlags)) {
+        memmove(dest, from, num*itemSize());
+    } else {
+        do_move_backward(dest, from, num);
+    }
 }
 
 /*****************************************************************************/
@@ -15,6 +15,7 @@
  */
 
 #include <benchmark/benchmark.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 #include <vector>
 
@@ -50,4 +51,46 @@ void BM_prepend_std_vector(benchmark::State& state) {
 }
 BENCHMARK(BM_prepend_std_vector);
 
+// No traits are declared for this type: they are deduced, so it grows with realloc and moves
+// with memmove.
+struct Point {
+    int x;
+    int y;
+};
+
+void BM_fill_android_vector_struct(benchmark::State& state) {
+    for (auto _ : state) {
+        android::Vector<Point> v;
+        for (int i = 0; i < state.range(0); i++) {
+            v.push(Point{i, i});
+        }
+        benchmark::DoNotOptimize(v.array());
+    }
+}
+BENCHMARK(BM_fill_android_vector_struct)->Range(8, 8 << 10);
+
+void BM_fill_std_vector_struct(benchmark::State& state) {
+    for (auto _ : state) {
+        std::vector<Point> v;
+        for (int i = 0; i < state.range(0); i++) {
+            v.push_back(Point{i, i});
+        }
+        benchmark::DoNotOptimize(v.data());
+    }
+}
+BENCHMARK(BM_fill_std_vector_struct)->Range(8, 8 << 10);
+
+// String8 is declared relocatable, so it is moved with memmove rather than copied.
+void BM_insert_android_vector_string8(benchmark::State& state) {
+    const android::String8 str("android.os.IBinder");
+    for (auto _ : state) {
+        android::Vector<android::String8> v;
+        for (int i = 0; i < state.range(0); i++) {
+            v.insertAt(str, v.size() / 2);
+        }
+        benchmark::DoNotOptimize(v.array());
+    }
+}
+BENCHMARK(BM_insert_android_vector_string8)->Range(8, 1 << 10);
+
 BENCHMARK_MAIN();
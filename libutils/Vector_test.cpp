@@ -22,6 +22,7 @@
 
 #include <android/log.h>
 #include <gtest/gtest.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 
 namespace android {
@@ -145,4 +146,67 @@ TEST_F(VectorTest, removeItemsAt_overflow) {
     ASSERT_DEATH(v.removeItemsAt(SIZE_MAX, SIZE_MAX), "overflow");
 }
 
+struct Point {
+    int x;
+    int y;
+};
+
+TEST_F(VectorTest, traits_Deduced) {
+    EXPECT_TRUE(traits<Point>::has_trivial_ctor);
+    EXPECT_TRUE(traits<Point>::has_trivial_dtor);
+    EXPECT_TRUE(traits<Point>::has_trivial_copy);
+    EXPECT_TRUE(traits<Point>::has_trivial_move);
+
+    // String8 is only declared relocatable.
+    EXPECT_FALSE(traits<String8>::has_trivial_copy);
+    EXPECT_TRUE(traits<String8>::has_trivial_move);
+}
+
+TEST_F(VectorTest, grow_Relocatable) {
+    Vector<String8> vector;
+    for (int i = 0; i < 100; i++) {
+        vector.insertAt(String8::format("%d", i), vector.size() / 2);
+    }
+    Vector<String8> other = vector;
+
+    // Growing and shrinking a shared buffer must copy the items, not move them.
+    vector.insertAt(String8("first"), 0);
+    for (size_t i = 0; i < 90; i++) {
+        vector.removeAt(1);
+    }
+    ASSERT_EQ(11U, vector.size());
+    EXPECT_STREQ("first", vector[0].c_str());
+
+    ASSERT_EQ(100U, other.size());
+    Vector<String8> expected;
+    for (int i = 0; i < 100; i++) {
+        expected.insertAt(String8::format("%d", i), expected.size() / 2);
+    }
+    for (size_t i = 0; i < other.size(); i++) {
+        EXPECT_EQ(expected[i], other[i]);
+    }
+    for (size_t i = 1; i < vector.size(); i++) {
+        EXPECT_EQ(expected[89 + i], vector[i]);
+    }
+}
+
+TEST_F(VectorTest, push_StableCapacity) {
+    Vector<int> vector;
+    while (vector.size() < vector.capacity() || vector.size() < 100) {
+        vector.push(0);
+    }
+    const size_t capacity = vector.capacity();
+    for (int i = 0; i < 100; i++) {
+        vector.push(0);
+        vector.pop();
+    }
+    EXPECT_LT(capacity, vector.capacity());
+    const size_t grown = vector.capacity();
+    for (int i = 0; i < 100; i++) {
+        vector.push(0);
+        vector.pop();
+    }
+    EXPECT_EQ(grown, vector.capacity());
+}
+
 } // namespace android
@@ -77,6 +77,16 @@ public:
     // Get the count of stack frames that are in this call stack.
     size_t size() const { return mFrameLines.size(); }
 
+    // Record the program counters of the current thread's stack into pcs, innermost first,
+    // without symbolizing them. Nothing is allocated, so this is cheap enough for sampling
+    // profilers and allocation trackers. The frames skipped by ignoreDepth are captured too
+    // and count against maxFrames. Returns the number of pcs recorded.
+    static size_t captureRaw(uintptr_t* pcs, size_t maxFrames, int32_t ignoreDepth = 1);
+
+    // Replace the stack frames with those of a stack captured earlier by captureRaw(),
+    // symbolizing them now. This must run in the process the pcs were captured in.
+    void symbolize(const uintptr_t* pcs, size_t count);
+
     // DO NOT USE ANYTHING BELOW HERE. The following public members are expected
     // to disappear again shortly, once a better replacement facility exists.
     // The replacement facility will be incompatible!
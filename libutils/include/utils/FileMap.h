@@ -66,6 +66,31 @@ public:
     bool create(const char* origFileName, int fd,
                 off64_t offset, size_t length, bool readOnly);
 
+    /*
+     * Options for create().  They are ignored on Windows.
+     */
+    enum CreateFlags {
+        // Fault in the whole region before returning (MAP_POPULATE).
+        CREATE_POPULATE = 1 << 0,
+        // Start asynchronous readahead of the whole region (MADV_WILLNEED).
+        CREATE_PREFETCH = 1 << 1,
+        // Align the mapping so that the kernel can back it with transparent
+        // huge pages, and ask it to.  Only applies to read-only regions of
+        // at least one huge page.
+        CREATE_HUGEPAGE = 1 << 2,
+        // Share the mapping with every other FileMap in the process that was
+        // created with this flag for the same file, offset and length.  The
+        // region is unmapped when the last of them is destroyed.  Only
+        // applies to read-only regions.
+        CREATE_SHARED = 1 << 3,
+    };
+
+    /*
+     * Like create() above, with a combination of CreateFlags.
+     */
+    bool create(const char* origFileName, int fd,
+                off64_t offset, size_t length, bool readOnly, int flags);
+
     ~FileMap(void);
 
     /*
@@ -116,6 +141,7 @@ private:
     off64_t     mDataOffset;    // offset used when map was created
     void*       mDataPtr;       // start of requested data, offset from base
     size_t      mDataLength;    // length, measured from "mDataPtr"
+    bool        mShared;        // mmap area is owned by the shared map cache
 #if defined(__MINGW32__)
     HANDLE      mFileHandle;    // Win32 file handle
     HANDLE      mFileMapping;   // Win32 file mapping handle
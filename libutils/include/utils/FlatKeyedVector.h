@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FLAT_KEYED_VECTOR_H
+#define ANDROID_FLAT_KEYED_VECTOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include <log/log.h>
+#include <utils/Errors.h>
+#include <utils/TypeHelpers.h>
+#include <utils/Vector.h>
+
+// ---------------------------------------------------------------------------
+
+namespace android {
+
+/*
+ * Drop-in replacements for SortedVector and KeyedVector for lookup-heavy code.
+ *
+ * Unlike those, they are plain templates: items are compared with operator< inline instead of
+ * through the virtual do_compare(), lookups are a binary search without unpredictable branches,
+ * and FlatKeyedVector keeps keys and values in separate arrays so that a search only touches
+ * keys. Copies are deep rather than copy-on-write.
+ */
+enum class FlatLayout {
+    // Lookups search the sorted items.
+    SORTED,
+    // Lookups search a copy of the keys in Eytzinger (breadth-first) order, which keeps the
+    // top of the search tree in a few cache lines and lets deeper levels be prefetched. Every
+    // modification rebuilds the copy, so this only suits maps that are rarely modified.
+    EYTZINGER,
+};
+
+namespace flat_detail {
+
+// Returns the index of the first of the sorted keys that is not less than |key|.
+template <typename KEY>
+inline size_t lowerBound(const KEY* keys, size_t n, const KEY& key) {
+    if (n == 0) return 0;
+    const KEY* base = keys;
+    while (n > 1) {
+        size_t half = n / 2;
+        // Compiles to a conditional move rather than a branch.
+        base = strictly_order_type(base[half], key) ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + strictly_order_type(*base, key);
+}
+
+template <typename KEY, FlatLayout LAYOUT>
+class FlatIndex;
+
+template <typename KEY>
+class FlatIndex<KEY, FlatLayout::SORTED> {
+public:
+    void rebuild(const std::vector<KEY>& /* keys */) {}
+
+    size_t lowerBound(const std::vector<KEY>& keys, const KEY& key) const {
+        return flat_detail::lowerBound(keys.data(), keys.size(), key);
+    }
+};
+
+template <typename KEY>
+class FlatIndex<KEY, FlatLayout::EYTZINGER> {
+public:
+    void rebuild(const std::vector<KEY>& keys) {
+        // Node k has children 2k and 2k + 1; node 0 is unused.
+        mKeys.resize(keys.size() + 1);
+        mRanks.resize(keys.size() + 1);
+        size_t rank = 0;
+        fill(keys, 1, &rank);
+    }
+
+    size_t lowerBound(const std::vector<KEY>& keys, const KEY& key) const {
+        const size_t n = keys.size();
+        size_t k = 1;
+        while (k <= n) {
+            // The descendants of k four or so levels down share a cache line.
+            __builtin_prefetch(reinterpret_cast<const char*>(mKeys.data()) +
+                               k * kPrefetchStride * sizeof(KEY));
+            k = 2 * k + strictly_order_type(mKeys[k], key);
+        }
+        // Undo the right turns after the last left turn, which was at the lower bound.
+        k >>= __builtin_ffsll(~static_cast<unsigned long long>(k));
+        return k == 0 ? n : mRanks[k];
+    }
+
+private:
+    static constexpr size_t kPrefetchStride = sizeof(KEY) < 64 ? 64 / sizeof(KEY) : 1;
+
+    void fill(const std::vector<KEY>& keys, size_t k, size_t* rank) {
+        if (k > keys.size()) return;
+        fill(keys, 2 * k, rank);
+        mKeys[k] = keys[*rank];
+        mRanks[k] = (*rank)++;
+        fill(keys, 2 * k + 1, rank);
+    }
+
+    std::vector<KEY> mKeys;
+    std::vector<size_t> mRanks;
+};
+
+}  // namespace flat_detail
+
+// ---------------------------------------------------------------------------
+
+template <typename TYPE, FlatLayout LAYOUT = FlatLayout::SORTED>
+class FlatSortedVector
+{
+public:
+    typedef TYPE    value_type;
+
+    inline  void            clear()                     { mItems.clear(); rebuild(); }
+
+    inline  size_t          size() const                { return mItems.size(); }
+    inline  bool            isEmpty() const             { return mItems.empty(); }
+    inline  size_t          capacity() const            { return mItems.capacity(); }
+            ssize_t         setCapacity(size_t size);
+
+    inline  const TYPE*     array() const               { return mItems.data(); }
+    //! you must keep it sorted!
+    inline  TYPE*           editArray()                 { return mItems.data(); }
+
+            ssize_t         indexOf(const TYPE& item) const;
+            size_t          orderOf(const TYPE& item) const;
+
+    inline  const TYPE&     operator [] (size_t index) const;
+    inline  const TYPE&     itemAt(size_t index) const  { return operator[](index); }
+    inline  const TYPE&     top() const                 { return mItems.back(); }
+
+            ssize_t         add(const TYPE& item);
+    //! editItemAt() MUST NOT change the order of this item
+    inline  TYPE&           editItemAt(size_t index)    { return mItems[index]; }
+
+            ssize_t         merge(const Vector<TYPE>& vector);
+            ssize_t         merge(const FlatSortedVector& vector);
+
+            ssize_t         remove(const TYPE& item);
+            ssize_t         removeItemsAt(size_t index, size_t count = 1);
+    inline  ssize_t         removeAt(size_t index)      { return removeItemsAt(index); }
+
+    typedef TYPE* iterator;
+    typedef TYPE const* const_iterator;
+
+    inline iterator begin() { return editArray(); }
+    inline iterator end()   { return editArray() + size(); }
+    inline const_iterator begin() const { return array(); }
+    inline const_iterator end() const   { return array() + size(); }
+    inline void reserve(size_t n) { setCapacity(n); }
+    inline bool empty() const{ return isEmpty(); }
+    inline iterator erase(iterator pos) {
+        ssize_t index = removeItemsAt(pos-array());
+        return begin() + index;
+    }
+
+private:
+    void rebuild() { mIndex.rebuild(mItems); }
+
+    std::vector<TYPE> mItems;
+    flat_detail::FlatIndex<TYPE, LAYOUT> mIndex;
+};
+
+// ---------------------------------------------------------------------------
+
+template <typename KEY, typename VALUE, FlatLayout LAYOUT = FlatLayout::SORTED>
+class FlatKeyedVector
+{
+public:
+    typedef KEY    key_type;
+    typedef VALUE  value_type;
+
+    inline  void            clear();
+
+    inline  size_t          size() const                { return mKeys.size(); }
+    inline  bool            isEmpty() const             { return mKeys.empty(); }
+    inline  size_t          capacity() const            { return mKeys.capacity(); }
+            ssize_t         setCapacity(size_t size);
+
+    inline bool isIdenticalTo(const FlatKeyedVector& rhs) const {
+        return mKeys.data() == rhs.mKeys.data();
+    }
+
+    const VALUE& valueFor(const KEY& key) const;
+    const VALUE& valueAt(size_t index) const            { return mValues[index]; }
+    const KEY& keyAt(size_t index) const                { return mKeys[index]; }
+    ssize_t indexOfKey(const KEY& key) const;
+    const VALUE& operator[](size_t index) const         { return valueAt(index); }
+
+            VALUE&          editValueFor(const KEY& key);
+            VALUE&          editValueAt(size_t index)   { return mValues[index]; }
+
+            ssize_t         add(const KEY& key, const VALUE& item);
+            ssize_t         replaceValueFor(const KEY& key, const VALUE& item);
+            ssize_t         replaceValueAt(size_t index, const VALUE& item);
+
+            ssize_t         removeItem(const KEY& key);
+            ssize_t         removeItemsAt(size_t index, size_t count = 1);
+
+private:
+    void rebuild() { mIndex.rebuild(mKeys); }
+
+    std::vector<KEY> mKeys;
+    std::vector<VALUE> mValues;
+    flat_detail::FlatIndex<KEY, LAYOUT> mIndex;
+};
+
+/**
+ * Variation of FlatKeyedVector that holds a default value to return when
+ * valueFor() is called with a key that doesn't exist.
+ */
+template <typename KEY, typename VALUE, FlatLayout LAYOUT = FlatLayout::SORTED>
+class DefaultFlatKeyedVector : public FlatKeyedVector<KEY, VALUE, LAYOUT>
+{
+public:
+    inline                  DefaultFlatKeyedVector(const VALUE& defValue = VALUE())
+                                : mDefault(defValue) {}
+            const VALUE&    valueFor(const KEY& key) const;
+
+private:
+            VALUE                                           mDefault;
+};
+
+// ---------------------------------------------------------------------------
+// No user serviceable parts from here...
+// ---------------------------------------------------------------------------
+
+template<typename TYPE, FlatLayout LAYOUT>
+ssize_t FlatSortedVector<TYPE, LAYOUT>::setCapacity(size_t size) {
+    if (size <= mItems.size()) return capacity();
+    mItems.reserve(size);
+    return size;
+}
+
+template<typename TYPE, FlatLayout LAYOUT> inline
+const TYPE& FlatSortedVector<TYPE, LAYOUT>::operator[](size_t index) const {
+    LOG_FATAL_IF(index>=size(),
+            "%s: index=%u out of range (%u)", __PRETTY_FUNCTION__,
+            int(index), int(size()));
+    return mItems[index];
+}
+
+template<typename TYPE, FlatLayout LAYOUT>
+ssize_t FlatSortedVector<TYPE, LAYOUT>::indexOf(const TYPE& item) const {
+    size_t i = mIndex.lowerBound(mItems, item);
+    if (i == mItems.size() || strictly_order_type(item, mItems[i])) return NAME_NOT_FOUND;
+    return i;
+}
+
+template<typename TYPE, FlatLayout LAYOUT>
+size_t FlatSortedVector<TYPE, LAYOUT>::orderOf(const TYPE& item) const {
+    return mIndex.lowerBound(mItems, item);
+}
+
+template<typename TYPE, FlatLayout LAYOUT>
+ssize_t FlatSortedVector<TYPE, LAYOUT>::add(const TYPE& item) {
+    size_t i = mIndex.lowerBound(mItems, item);
+    if (i == mItems.size() || strictly_order_type(item, mItems[i])) {
+        mItems.insert(mItems.begin() + i, item);
+        rebuild();
+    } else {
+        mItems[i] = item;
+    }
+    return i;
+}
+
+template<typename TYPE, FlatLayout LAYOUT>
+ssize_t FlatSortedVector<TYPE, LAYOUT>::merge(const Vector<TYPE>& vector) {
+    for (size_t i = 0; i < vector.size(); i++) {
+        add(vector[i]);
+    }
+    return OK;
+}
+
+template<typename TYPE, FlatLayout LAYOUT>
+ssize_t FlatSortedVector<TYPE, LAYOUT>::merge(const FlatSortedVector& vector) {
+    for (const TYPE& item : vector) {
+        add(item);
+    }
+    return OK;
+}
+
+template<typename TYPE, FlatLayout LAYOUT>
+ssize_t FlatSortedVector<TYPE, LAYOUT>::remove(const TYPE& item) {
+    ssize_t i = indexOf(item);
+    if (i >= 0) {
+        removeItemsAt(i);
+    }
+    return i;
+}
+
+template<typename TYPE, FlatLayout LAYOUT>
+ssize_t FlatSortedVector<TYPE, LAYOUT>::removeItemsAt(size_t index, size_t count) {
+    size_t end;
+    LOG_ALWAYS_FATAL_IF(__builtin_add_overflow(index, count, &end), "overflow: index=%zu count=%zu",
+                        index, count);
+    if (end > size()) return BAD_VALUE;
+    mItems.erase(mItems.begin() + index, mItems.begin() + end);
+    rebuild();
+    return index;
+}
+
+// ---------------------------------------------------------------------------
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT> inline
+void FlatKeyedVector<KEY, VALUE, LAYOUT>::clear() {
+    mKeys.clear();
+    mValues.clear();
+    rebuild();
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+ssize_t FlatKeyedVector<KEY, VALUE, LAYOUT>::setCapacity(size_t size) {
+    if (size <= mKeys.size()) return capacity();
+    mKeys.reserve(size);
+    mValues.reserve(size);
+    return size;
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+ssize_t FlatKeyedVector<KEY, VALUE, LAYOUT>::indexOfKey(const KEY& key) const {
+    size_t i = mIndex.lowerBound(mKeys, key);
+    if (i == mKeys.size() || strictly_order_type(key, mKeys[i])) return NAME_NOT_FOUND;
+    return i;
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+const VALUE& FlatKeyedVector<KEY, VALUE, LAYOUT>::valueFor(const KEY& key) const {
+    ssize_t i = this->indexOfKey(key);
+    LOG_ALWAYS_FATAL_IF(i<0, "%s: key not found", __PRETTY_FUNCTION__);
+    return mValues[i];
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+VALUE& FlatKeyedVector<KEY, VALUE, LAYOUT>::editValueFor(const KEY& key) {
+    ssize_t i = this->indexOfKey(key);
+    LOG_ALWAYS_FATAL_IF(i<0, "%s: key not found", __PRETTY_FUNCTION__);
+    return mValues[i];
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+ssize_t FlatKeyedVector<KEY, VALUE, LAYOUT>::add(const KEY& key, const VALUE& value) {
+    size_t i = mIndex.lowerBound(mKeys, key);
+    if (i == mKeys.size() || strictly_order_type(key, mKeys[i])) {
+        mKeys.insert(mKeys.begin() + i, key);
+        mValues.insert(mValues.begin() + i, value);
+        rebuild();
+    } else {
+        mKeys[i] = key;
+        mValues[i] = value;
+    }
+    return i;
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+ssize_t FlatKeyedVector<KEY, VALUE, LAYOUT>::replaceValueFor(const KEY& key, const VALUE& value) {
+    return add(key, value);
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+ssize_t FlatKeyedVector<KEY, VALUE, LAYOUT>::replaceValueAt(size_t index, const VALUE& item) {
+    if (index<size()) {
+        mValues[index] = item;
+        return static_cast<ssize_t>(index);
+    }
+    return BAD_INDEX;
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+ssize_t FlatKeyedVector<KEY, VALUE, LAYOUT>::removeItem(const KEY& key) {
+    ssize_t i = indexOfKey(key);
+    if (i >= 0) {
+        removeItemsAt(i);
+    }
+    return i;
+}
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+ssize_t FlatKeyedVector<KEY, VALUE, LAYOUT>::removeItemsAt(size_t index, size_t count) {
+    size_t end;
+    LOG_ALWAYS_FATAL_IF(__builtin_add_overflow(index, count, &end), "overflow: index=%zu count=%zu",
+                        index, count);
+    if (end > size()) return BAD_VALUE;
+    mKeys.erase(mKeys.begin() + index, mKeys.begin() + end);
+    mValues.erase(mValues.begin() + index, mValues.begin() + end);
+    rebuild();
+    return index;
+}
+
+// ---------------------------------------------------------------------------
+
+template<typename KEY, typename VALUE, FlatLayout LAYOUT>
+const VALUE& DefaultFlatKeyedVector<KEY, VALUE, LAYOUT>::valueFor(const KEY& key) const {
+    ssize_t i = this->indexOfKey(key);
+    return i >= 0 ? FlatKeyedVector<KEY, VALUE, LAYOUT>::valueAt(static_cast<size_t>(i))
+                  : mDefault;
+}
+
+}  // namespace android
+
+// ---------------------------------------------------------------------------
+
+#endif // ANDROID_FLAT_KEYED_VECTOR_H
@@ -26,7 +26,11 @@
 
 #include <android-base/unique_fd.h>
 
+#include <atomic>
+#include <map>
+#include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 namespace android {
@@ -456,9 +460,30 @@ private:
     android::base::unique_fd mWakeEventFd;  // immutable
     Mutex mLock;
 
-    Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    // Pending messages ordered by uptime, then by the order in which they were sent, so that
+    // both enqueueing and dequeueing are O(log n).
+    using MessageKey = std::pair<nsecs_t, uint64_t>;
+    using MessageQueue = std::map<MessageKey, MessageEnvelope>;
+    MessageQueue mMessageEnvelopes; // guarded by mLock
+    // The keys of the pending messages of each handler, so that removeMessages() only visits the
+    // messages of the handler it is given.
+    std::unordered_map<MessageHandler*, std::set<MessageKey>> mMessageKeysByHandler; // guarded by mLock
+    uint64_t mNextMessageSeq; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
+    // Messages posted with sendMessage() are pushed onto a lock-free stack, newest first, and
+    // moved into mMessageEnvelopes by whoever next takes mLock.
+    struct PostedMessage {
+        nsecs_t uptime;
+        sp<MessageHandler> handler;
+        Message message;
+        PostedMessage* next;
+    };
+    std::atomic<PostedMessage*> mPostedMessages;
+    // Set by the looper thread only while it is about to wait or waiting for events. The first
+    // sendMessage() that clears it wakes the looper; all others skip the eventfd write.
+    std::atomic<bool> mNeedsWake;
+
     // Whether we are currently waiting for work.  Not protected by a lock,
     // any use of it is racy anyway.
     volatile bool mPolling;
@@ -471,6 +496,11 @@ private:
     std::unordered_map<SequenceNumber, Request> mRequests;               // guarded by mLock
     std::unordered_map<int /*fd*/, SequenceNumber> mSequenceNumberByFd;  // guarded by mLock
 
+    // Sequence numbers of requests whose fd was closed before it could be removed from the epoll
+    // set. The kernel drops such registrations by itself once the last reference to the file
+    // goes away, so the epoll set is only rebuilt if one of them actually reports an event.
+    std::unordered_set<SequenceNumber> mStaleSequenceNumbers;  // guarded by mLock
+
     // The sequence number to use for the next fd that is added to the looper.
     // The sequence number 0 is reserved for the WakeEventFd.
     SequenceNumber mNextRequestSeq;  // guarded by mLock
@@ -483,9 +513,14 @@ private:
 
     int pollInner(int timeoutMillis);
     int removeSequenceNumberLocked(SequenceNumber seq);  // requires mLock
+    void removeMessageLocked(MessageQueue::iterator it);  // requires mLock
+    bool enqueueMessageLocked(nsecs_t uptime, const sp<MessageHandler>& handler,
+                              const Message& message);  // requires mLock
+    void drainPostedMessagesLocked();  // requires mLock
     void awoken();
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
+    void markSequenceNumberStaleLocked(SequenceNumber seq);
 
     static void initTLSKey();
     static void threadDestructor(void *st);
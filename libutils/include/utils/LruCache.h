@@ -17,7 +17,12 @@
 #ifndef ANDROID_UTILS_LRU_CACHE_H
 #define ANDROID_UTILS_LRU_CACHE_H
 
+#include <stdint.h>
+#include <string.h>
+
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <unordered_set>
 
 #include "utils/TypeHelpers.h"  // hash_t
@@ -294,5 +299,303 @@ void LruCache<TKey, TValue>::detachFromCache(Entry& entry) {
     entry.child = nullptr;
 }
 
+/**
+ * A fixed-capacity alternative to LruCache that never allocates after construction.
+ *
+ * Entries live in a slab sized for maxCapacity entries, and keys are found through an
+ * open-addressing index (linear probing, kept at most half full), so get() and put() touch no
+ * heap memory and make no virtual calls. The API mirrors LruCache, with two differences:
+ * maxCapacity must be non-zero, since there is no unlimited mode; and a put() of a key that is
+ * already present returns false without evicting the oldest entry. The Iterator walks the
+ * entries from the oldest to the youngest.
+ */
+template <typename TKey, typename TValue>
+class FixedLruCache {
+public:
+    explicit FixedLruCache(uint32_t maxCapacity);
+    ~FixedLruCache();
+
+    FixedLruCache(const FixedLruCache&) = delete;
+    FixedLruCache& operator=(const FixedLruCache&) = delete;
+
+    void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
+    size_t size() const { return mSize; }
+    const TValue& get(const TKey& key);
+    bool put(const TKey& key, const TValue& value);
+    bool remove(const TKey& key);
+    bool removeOldest();
+    void clear();
+    const TValue& peekOldestValue();
+
+private:
+    static constexpr uint32_t kNone = UINT32_MAX;
+    // Index slots hold an entry number plus one, so that zeroed memory is an empty index.
+    static constexpr uint32_t kEmptySlot = 0;
+
+    struct Entry {
+        TKey key;
+        TValue value;
+
+        Entry(const TKey& _key, const TValue& _value) : key(_key), value(_value) {}
+    };
+
+    typedef typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type EntryStorage;
+
+    Entry& entryAt(uint32_t entry) { return *reinterpret_cast<Entry*>(&mEntries[entry]); }
+    const Entry& entryAt(uint32_t entry) const {
+        return *reinterpret_cast<const Entry*>(&mEntries[entry]);
+    }
+
+    uint32_t homeSlot(const TKey& key) const {
+        // Fibonacci hashing spreads the identity hashes of integer keys over the whole index.
+        return (static_cast<uint32_t>(hash_type(key)) * 0x9E3779B9u) >> mIndexShift;
+    }
+
+    // Returns the index slot holding |key|, or the empty slot where it would be inserted.
+    uint32_t findSlot(const TKey& key) const;
+    // Returns the index slot holding |entry|, which must be in the cache.
+    uint32_t findSlotOfEntry(uint32_t entry) const;
+    // Empties |slot|, shifting back later entries of its probe run so lookups need no tombstones.
+    void eraseSlot(uint32_t slot);
+    void removeEntry(uint32_t slot);
+
+    void attachToCache(uint32_t entry);
+    void detachFromCache(uint32_t entry);
+
+    std::unique_ptr<EntryStorage[]> mEntries;
+    // LRU links of the live entries; the free list is threaded through mChild.
+    std::unique_ptr<uint32_t[]> mParent;
+    std::unique_ptr<uint32_t[]> mChild;
+    std::unique_ptr<uint32_t[]> mIndex;
+    uint32_t mIndexMask;
+    uint32_t mIndexShift;
+    OnEntryRemoved<TKey, TValue>* mListener;
+    uint32_t mOldest;
+    uint32_t mYoungest;
+    uint32_t mFree;
+    uint32_t mSize;
+    uint32_t mMaxCapacity;
+    TValue mNullValue;
+
+public:
+    // To be used like:
+    // while (it.next()) {
+    //   it.value(); it.key();
+    // }
+    class Iterator {
+    public:
+        Iterator(const FixedLruCache<TKey, TValue>& cache)
+            : mCache(cache), mEntry(kNone), mBeginReturned(false) {}
+
+        bool next() {
+            if (!mBeginReturned) {
+                mBeginReturned = true;
+                mEntry = mCache.mOldest;
+            } else if (mEntry != kNone) {
+                mEntry = mCache.mChild[mEntry];
+            }
+            return mEntry != kNone;
+        }
+
+        const TValue& value() const { return mCache.entryAt(mEntry).value; }
+
+        const TKey& key() const { return mCache.entryAt(mEntry).key; }
+
+    private:
+        const FixedLruCache<TKey, TValue>& mCache;
+        uint32_t mEntry;
+        bool mBeginReturned;
+    };
+};
+
+template <typename TKey, typename TValue>
+FixedLruCache<TKey, TValue>::FixedLruCache(uint32_t maxCapacity)
+    : mEntries(new EntryStorage[maxCapacity])
+    , mParent(new uint32_t[maxCapacity])
+    , mChild(new uint32_t[maxCapacity])
+    , mListener(nullptr)
+    , mOldest(kNone)
+    , mYoungest(kNone)
+    , mFree(kNone)
+    , mSize(0)
+    , mMaxCapacity(maxCapacity)
+    , mNullValue(0) {
+    uint32_t indexBits = 1;
+    while ((1u << indexBits) < 2 * static_cast<uint64_t>(maxCapacity)) {
+        indexBits++;
+    }
+    mIndex.reset(new uint32_t[1u << indexBits]);
+    mIndexMask = (1u << indexBits) - 1;
+    mIndexShift = 32 - indexBits;
+    clear();
+}
+
+template <typename TKey, typename TValue>
+FixedLruCache<TKey, TValue>::~FixedLruCache() {
+    clear();
+}
+
+template <typename K, typename V>
+void FixedLruCache<K, V>::setOnEntryRemovedListener(OnEntryRemoved<K, V>* listener) {
+    mListener = listener;
+}
+
+template <typename TKey, typename TValue>
+const TValue& FixedLruCache<TKey, TValue>::get(const TKey& key) {
+    uint32_t slot = findSlot(key);
+    if (mIndex[slot] == kEmptySlot) {
+        return mNullValue;
+    }
+    uint32_t entry = mIndex[slot] - 1;
+    detachFromCache(entry);
+    attachToCache(entry);
+    return entryAt(entry).value;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
+    if (mMaxCapacity == 0) {
+        return false;
+    }
+    uint32_t slot = findSlot(key);
+    if (mIndex[slot] != kEmptySlot) {
+        return false;
+    }
+    if (mSize >= mMaxCapacity) {
+        removeEntry(findSlotOfEntry(mOldest));
+        // Removal may have shifted entries into the slot we found.
+        slot = findSlot(key);
+    }
+
+    uint32_t entry = mFree;
+    mFree = mChild[entry];
+    new (&mEntries[entry]) Entry(key, value);
+    mIndex[slot] = entry + 1;
+    attachToCache(entry);
+    mSize++;
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::remove(const TKey& key) {
+    uint32_t slot = findSlot(key);
+    if (mIndex[slot] == kEmptySlot) {
+        return false;
+    }
+    removeEntry(slot);
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::removeOldest() {
+    if (mOldest == kNone) {
+        return false;
+    }
+    removeEntry(findSlotOfEntry(mOldest));
+    return true;
+}
+
+template <typename TKey, typename TValue>
+const TValue& FixedLruCache<TKey, TValue>::peekOldestValue() {
+    if (mOldest != kNone) {
+        return entryAt(mOldest).value;
+    }
+    return mNullValue;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::clear() {
+    if (mListener) {
+        for (uint32_t p = mOldest; p != kNone; p = mChild[p]) {
+            (*mListener)(entryAt(p).key, entryAt(p).value);
+        }
+    }
+    for (uint32_t p = mOldest; p != kNone; p = mChild[p]) {
+        entryAt(p).~Entry();
+    }
+    mOldest = kNone;
+    mYoungest = kNone;
+    mSize = 0;
+    memset(mIndex.get(), 0, (mIndexMask + 1) * sizeof(uint32_t));
+    mFree = kNone;
+    for (uint32_t entry = mMaxCapacity; entry > 0; entry--) {
+        mChild[entry - 1] = mFree;
+        mFree = entry - 1;
+    }
+}
+
+template <typename TKey, typename TValue>
+uint32_t FixedLruCache<TKey, TValue>::findSlot(const TKey& key) const {
+    uint32_t slot = homeSlot(key);
+    while (mIndex[slot] != kEmptySlot && !(entryAt(mIndex[slot] - 1).key == key)) {
+        slot = (slot + 1) & mIndexMask;
+    }
+    return slot;
+}
+
+template <typename TKey, typename TValue>
+uint32_t FixedLruCache<TKey, TValue>::findSlotOfEntry(uint32_t entry) const {
+    uint32_t slot = homeSlot(entryAt(entry).key);
+    while (mIndex[slot] != entry + 1) {
+        slot = (slot + 1) & mIndexMask;
+    }
+    return slot;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::eraseSlot(uint32_t slot) {
+    for (uint32_t next = (slot + 1) & mIndexMask; mIndex[next] != kEmptySlot;
+         next = (next + 1) & mIndexMask) {
+        uint32_t home = homeSlot(entryAt(mIndex[next] - 1).key);
+        // The entry at |next| may fill the hole unless its home lies between the two.
+        if (((next - home) & mIndexMask) >= ((next - slot) & mIndexMask)) {
+            mIndex[slot] = mIndex[next];
+            slot = next;
+        }
+    }
+    mIndex[slot] = kEmptySlot;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::removeEntry(uint32_t slot) {
+    uint32_t entry = mIndex[slot] - 1;
+    // Unindex first: the listener is allowed to invalidate the key.
+    eraseSlot(slot);
+    if (mListener) {
+        (*mListener)(entryAt(entry).key, entryAt(entry).value);
+    }
+    detachFromCache(entry);
+    entryAt(entry).~Entry();
+    mChild[entry] = mFree;
+    mFree = entry;
+    mSize--;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::attachToCache(uint32_t entry) {
+    mParent[entry] = mYoungest;
+    mChild[entry] = kNone;
+    if (mYoungest == kNone) {
+        mOldest = entry;
+    } else {
+        mChild[mYoungest] = entry;
+    }
+    mYoungest = entry;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::detachFromCache(uint32_t entry) {
+    if (mParent[entry] != kNone) {
+        mChild[mParent[entry]] = mChild[entry];
+    } else {
+        mOldest = mChild[entry];
+    }
+    if (mChild[entry] != kNone) {
+        mParent[mChild[entry]] = mParent[entry];
+    } else {
+        mYoungest = mParent[entry];
+    }
+}
+
 }
 #endif // ANDROID_UTILS_LRU_CACHE_H
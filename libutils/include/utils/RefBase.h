@@ -376,6 +376,7 @@ protected:
 
 private:
     friend class weakref_type;
+    friend class LazyWeakRefBase;
     class weakref_impl;
     
                             RefBase(const RefBase& o);
@@ -397,6 +398,89 @@ private:
 
 // ---------------------------------------------------------------------------
 
+// A RefBase alternative for objects that are mostly, or only, held through sp<>.
+//
+// The strong count lives in the object itself, so creating one doesn't allocate, and sp<> copies
+// cost a single atomic operation rather than two on a separate weakref_impl. The weakref_impl is
+// only allocated the first time a wp<> (or getWeakRefs()) asks for it; the count then moves into
+// it and the object behaves like a RefBase with OBJECT_LIFETIME_STRONG.
+//
+// There are no lifetime hooks: onFirstRef() and friends are never called, and refBase() returns
+// nullptr for the weak references of such objects.
+class LazyWeakRefBase
+{
+public:
+    inline  void            incStrong(const void* id) const {
+        uintptr_t refs = mRefs.load(std::memory_order_relaxed);
+        while (refs & kInlineCount) {
+            if (mRefs.compare_exchange_weak(refs, refs + kOneStrongRef,
+                    std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        incStrongShared(id);
+    }
+
+            void            incStrongRequireStrong(const void* id) const;
+
+    inline  void            decStrong(const void* id) const {
+        uintptr_t refs = mRefs.load(std::memory_order_relaxed);
+        while (refs & kInlineCount) {
+            if (refs == kInlineCount) {
+                reportDecStrongTooManyTimes();
+            }
+            if (mRefs.compare_exchange_weak(refs, refs - kOneStrongRef,
+                    std::memory_order_release, std::memory_order_relaxed)) {
+                if (refs == (kInlineCount | kOneStrongRef)) {
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    delete this;
+                }
+                return;
+            }
+        }
+        decStrongShared(id);
+    }
+
+            //! DEBUGGING ONLY: Get current strong ref count.
+            int32_t         getStrongCount() const;
+
+            RefBase::weakref_type* createWeak(const void* id) const;
+
+            // Unlike RefBase, this allocates the weak references if there were none yet.
+            RefBase::weakref_type* getWeakRefs() const;
+
+protected:
+    // As with RefBase, construct these with sp::make<>.
+    inline                  LazyWeakRefBase() : mRefs(kInlineCount) { }
+    virtual                 ~LazyWeakRefBase();
+
+private:
+    // While the low bit of mRefs is set, the rest of it is the strong count. Otherwise it
+    // points to the weakref_impl that now holds the counts; that never changes back.
+    static constexpr uintptr_t kInlineCount = 1;
+    static constexpr uintptr_t kOneStrongRef = 2;
+
+                            LazyWeakRefBase(const LazyWeakRefBase& o);
+            LazyWeakRefBase& operator=(const LazyWeakRefBase& o);
+
+            void            incStrongShared(const void* id) const;
+            void            decStrongShared(const void* id) const;
+    [[noreturn]] static void reportDecStrongTooManyTimes();
+
+            RefBase::weakref_impl* weakRefs() const;
+
+    friend class ReferenceMover;
+    inline static void renameRefs(size_t /*n*/, const ReferenceRenamer& /*renamer*/) { }
+    inline static void renameRefId(RefBase::weakref_type* /*ref*/, const void* /*old_id*/,
+                                   const void* /*new_id*/) { }
+    inline static void renameRefId(LazyWeakRefBase* /*ref*/, const void* /*old_id*/,
+                                   const void* /*new_id*/) { }
+
+    mutable std::atomic<uintptr_t> mRefs;
+};
+
+// ---------------------------------------------------------------------------
+
 template <typename T>
 class wp
 {
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <utils/ThreadDefs.h>
+
+namespace android {
+
+/*
+ * A fixed set of worker threads for running many small tasks.
+ *
+ * Every worker has its own queue. Tasks posted from a worker go to that worker's queue and are
+ * run newest first, which keeps recursively split work hot in its cache; idle workers steal the
+ * oldest tasks from the other queues. Tasks posted from other threads are spread over the queues
+ * round-robin, unless an affinity hint names a queue.
+ *
+ * Tasks must not throw. Destroying the pool waits for every task that was posted to finish.
+ */
+class ThreadPool {
+  public:
+    using Task = std::function<void()>;
+
+    // Passed as the affinity hint to let the pool pick a queue.
+    static constexpr size_t kAnyWorker = SIZE_MAX;
+
+    struct Options {
+        // 0 uses one worker per CPU.
+        size_t numThreads = 0;
+        // One of the ANDROID_PRIORITY constants, applied to every worker.
+        int32_t priority = PRIORITY_DEFAULT;
+        // Worker i is named "<name>:<i>".
+        std::string name = "ThreadPool";
+        // Pin worker i to the i-th CPU the process may run on, so that a worker's queue is
+        // also a per-core queue.
+        bool pinToCpus = false;
+    };
+
+    ThreadPool();
+    explicit ThreadPool(const Options& options);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queues |task|. |affinity| is a hint for which worker should run it, modulo size(); related
+    // tasks posted with the same hint tend to run on the same worker, and so the same CPU when
+    // the workers are pinned. Another worker may still steal it if that one is busy.
+    void post(Task task, size_t affinity = kAnyWorker);
+
+    // Blocks until every task posted so far, and every task those post, has finished. Must not
+    // be called from a worker.
+    void wait();
+
+    // The number of workers.
+    size_t size() const { return mQueues.size(); }
+
+    // The index of the calling worker of this pool, or kAnyWorker for any other thread.
+    size_t currentWorker() const;
+
+  private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(size_t worker);
+    bool pop(size_t worker, Task* task);
+
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;
+    std::vector<std::thread> mThreads;
+    std::atomic<size_t> mNextQueue{0};
+
+    // Tasks queued but not started yet.
+    std::atomic<size_t> mQueued{0};
+    // Tasks queued or running.
+    std::atomic<size_t> mPending{0};
+    // Workers waiting for mWorkAvailable. Posting only takes mLock when there are any.
+    std::atomic<size_t> mSleepers{0};
+
+    std::mutex mLock;
+    std::condition_variable mWorkAvailable;
+    std::condition_variable mIdle;
+    bool mExiting = false;
+};
+
+}  // namespace android
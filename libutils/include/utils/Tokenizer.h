@@ -18,6 +18,8 @@
 #define _UTILS_TOKENIZER_H
 
 #include <assert.h>
+#include <memory>
+#include <string_view>
 #include <utils/Errors.h>
 #include <utils/FileMap.h>
 #include <utils/String8.h>
@@ -88,6 +90,12 @@ public:
      */
     String8 peekRemainderOfLine() const;
 
+    /**
+     * Like peekRemainderOfLine() but without copying.
+     * The view remains valid for the lifetime of the tokenizer.
+     */
+    std::string_view peekRemainderOfLineView() const;
+
     /**
      * Gets the character at the current position and advances past it.
      * Returns null at end of file.
@@ -103,6 +111,12 @@ public:
      */
     String8 nextToken(const char* delimiters);
 
+    /**
+     * Like nextToken() but without copying.
+     * The view remains valid for the lifetime of the tokenizer.
+     */
+    std::string_view nextTokenView(const char* delimiters);
+
     /**
      * Advances to the next line.
      * Does nothing if already at the end of the file.
@@ -116,8 +130,12 @@ public:
     void skipDelimiters(const char* delimiters);
 
 private:
+    struct DelimiterSet;
+
     Tokenizer(const Tokenizer& other); // not copyable
 
+    const DelimiterSet& getDelimiterSet(const char* delimiters);
+
     String8 mFilename;
     FileMap* mFileMap;
     char* mBuffer;
@@ -127,6 +145,9 @@ private:
     const char* mCurrent;
     int32_t mLineNumber;
 
+    // Byte classes for the most recently used delimiters.
+    std::unique_ptr<DelimiterSet> mDelimiterSet;
+
     inline const char* getEnd() const { return mBuffer + mLength; }
 
 };
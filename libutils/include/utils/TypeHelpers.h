@@ -32,10 +32,17 @@ namespace android {
  * Types traits
  */
 
-template <typename T> struct trait_trivial_ctor { enum { value = false }; };
-template <typename T> struct trait_trivial_dtor { enum { value = false }; };
-template <typename T> struct trait_trivial_copy { enum { value = false }; };
-template <typename T> struct trait_trivial_move { enum { value = false }; };
+// By default these are deduced from the type itself; the ANDROID_*_TRAIT macros below can
+// still mark a type as trivial when the compiler can't tell, e.g. String8 is not trivially
+// copyable but can be relocated with memmove.
+template <typename T> struct trait_trivial_ctor
+{ enum { value = std::is_trivially_default_constructible<T>::value }; };
+template <typename T> struct trait_trivial_dtor
+{ enum { value = std::is_trivially_destructible<T>::value }; };
+template <typename T> struct trait_trivial_copy
+{ enum { value = std::is_trivially_copyable<T>::value }; };
+template <typename T> struct trait_trivial_move
+{ enum { value = std::is_trivially_copyable<T>::value }; };
 template <typename T> struct trait_pointer      { enum { value = false }; };
 template <typename T> struct trait_pointer<T*>  { enum { value = true }; };
 
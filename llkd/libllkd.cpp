@@ -39,6 +39,7 @@
 #include <ios>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -48,6 +49,7 @@
 #include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <cutils/android_get_control_file.h>
 #include <log/log_main.h>
 
@@ -96,6 +98,8 @@ seconds khtTimeout = duration_cast<seconds>(llkTimeoutMs * (1 + LLK_CHECKS_PER_T
 #ifdef __PTRACE_ENABLED__
 // list of stack symbols to search for persistence.
 std::unordered_set<std::string> llkCheckStackSymbols;
+// llkCheckStackSymbols by name, to their index in iteration order.
+std::unordered_map<std::string_view, char> llkCheckStackIndex;
 #endif
 
 // Ignorelist variables, initialized with comma separated lists of high false
@@ -177,6 +181,8 @@ class dir {
 
     operator bool() const { return fd >= 0; }
 
+    int getFd() const { return fd; }
+
     void reset(void) {
         if (fd >= 0) {
             ::close(fd);
@@ -222,6 +228,24 @@ bool llkIsMissingExeLink(pid_t tid) {
     return (ret == -1) && (errno == ENOENT);
 }
 
+// Reads /proc/<tid>/stat relative to the cached /proc directory into buf, rather than
+// building a path and a string for every thread on every cycle.
+bool llkReadStat(const char* tid, char* buf, size_t size) {
+    char path[32];
+    ::snprintf(path, sizeof(path), "%s/stat", tid);
+    android::base::unique_fd fd(::openat(llkTopDirectory.getFd(), path, O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        PLOG(DEBUG) << "Read " << procdir << path << " failed";
+        return false;
+    }
+    auto len = TEMP_FAILURE_RETRY(::pread(fd, buf, size - 1, 0));
+    if (len <= 0) {
+        return false;
+    }
+    buf[len] = '\0';
+    return true;
+}
+
 // Common routine where caller accepts empty content as error/passthrough.
 // Reduces the churn of reporting read errors in the callers.
 std::string ReadFile(std::string&& path) {
@@ -299,7 +323,9 @@ struct proc {
                                    // (others we do not monitor: S, R, T or ?)
 #ifdef __PTRACE_ENABLED__          // Privileged state checking
     char stack;                    // index in llkCheckStackSymbols for matches
-#endif                             // and with maximum index PROP_VALUE_MAX/2.
+                                   // and with maximum index PROP_VALUE_MAX/2.
+    uint64_t stackSwitches;        // nrSwitches when stack was last read.
+#endif                             // End privilege
     char comm[TASK_COMM_LEN + 3];  // space for adding '[' and ']'
     bool exeMissingValid;          // exeMissing has been cached
     bool cmdlineValid;             // cmdline has been cached
@@ -327,6 +353,7 @@ struct proc {
           state(state),
 #ifdef __PTRACE_ENABLED__
           stack(-1),
+          stackSwitches(0),
 #endif
           exeMissingValid(false),
           cmdlineValid(false),
@@ -386,6 +413,7 @@ struct proc {
 #ifdef __PTRACE_ENABLED__
         count_stack = 0ms;
         stack = -1;
+        stackSwitches = 0;
 #endif
         cmdline = "";
         comm[0] = '\0';
@@ -802,6 +830,38 @@ long long getSchedValue(const std::string& schedString, const char* key) {
 }
 
 #ifdef __PTRACE_ENABLED__
+void llkIndexStackSymbols() {
+    llkCheckStackIndex.clear();
+    char idx = -1;
+    for (const auto& stack : llkCheckStackSymbols) {
+        if (++idx < 0) break;
+        llkCheckStackIndex.emplace(stack, idx);
+    }
+}
+
+// Returns the lowest index in llkCheckStackSymbols of a symbol in kernel_stack, or -1. Each
+// line is of the form "[<0>] symbol+0x10/0x20", with symbol optionally suffixed by ".cfi", so
+// look up the symbol of each line rather than searching the stack for every configured one.
+char llkMatchStack(const std::string& kernel_stack) {
+    char match = -1;
+    std::string_view stack(kernel_stack);
+    for (size_t pos = stack.find("+0x"); pos != std::string_view::npos;
+         pos = stack.find("+0x", pos + 1)) {
+        auto start = stack.rfind(' ', pos);
+        if (start == std::string_view::npos) continue;
+        auto symbol = stack.substr(start + 1, pos - start - 1);
+        auto it = llkCheckStackIndex.find(symbol);
+        if ((it == llkCheckStackIndex.end()) && android::base::EndsWith(symbol, ".cfi")) {
+            symbol.remove_suffix(strlen(".cfi"));
+            it = llkCheckStackIndex.find(symbol);
+        }
+        if ((it != llkCheckStackIndex.end()) && ((match == char(-1)) || (it->second < match))) {
+            match = it->second;
+        }
+    }
+    return match;
+}
+
 bool llkCheckStack(proc* procp, const std::string& piddir) {
     if (llkCheckStackSymbols.empty()) return false;
     if (procp->state == 'Z') {  // No brains for Zombies
@@ -812,25 +872,21 @@ bool llkCheckStack(proc* procp, const std::string& piddir) {
 
     // Don't check process that are known to block ptrace, save sepolicy noise.
     if (llkSkipProc(procp, llkIgnorelistStack)) return false;
-    auto kernel_stack = ReadFile(piddir + "/stack");
-    if (kernel_stack.empty()) {
-        LOG(VERBOSE) << piddir << "/stack empty comm=" << procp->getComm()
-                     << " cmdline=" << procp->getCmdline();
-        return false;
-    }
-    // A scheduling incident that should not reset count_stack
-    if (kernel_stack.find(" cpu_worker_pools+0x") != std::string::npos) return false;
-    char idx = -1;
-    char match = -1;
-    std::string matched_stack_symbol = "<unknown>";
-    for (const auto& stack : llkCheckStackSymbols) {
-        if (++idx < 0) break;
-        if ((kernel_stack.find(" "s + stack + "+0x") != std::string::npos) ||
-            (kernel_stack.find(" "s + stack + ".cfi+0x") != std::string::npos)) {
-            match = idx;
-            matched_stack_symbol = stack;
-            break;
+
+    // A thread that has not been scheduled since its stack was last read still has the same
+    // stack, and so the same match. llkCheckSchedUpdate() has just refreshed nrSwitches.
+    char match = procp->stack;
+    if ((procp->nrSwitches == 0) || (procp->nrSwitches != procp->stackSwitches)) {
+        auto kernel_stack = ReadFile(piddir + "/stack");
+        if (kernel_stack.empty()) {
+            LOG(VERBOSE) << piddir << "/stack empty comm=" << procp->getComm()
+                         << " cmdline=" << procp->getCmdline();
+            return false;
         }
+        // A scheduling incident that should not reset count_stack
+        if (kernel_stack.find(" cpu_worker_pools+0x") != std::string::npos) return false;
+        match = llkMatchStack(kernel_stack);
+        procp->stackSwitches = procp->nrSwitches;
     }
     if (procp->stack != match) {
         procp->stack = match;
@@ -840,6 +896,10 @@ bool llkCheckStack(proc* procp, const std::string& piddir) {
     if (match == char(-1)) return false;
     procp->count_stack += llkCycle;
     if (procp->count_stack < llkStateTimeoutMs[llkStateStack]) return false;
+    std::string matched_stack_symbol = "<unknown>";
+    for (const auto& [symbol, idx] : llkCheckStackIndex) {
+        if (idx == match) matched_stack_symbol = symbol;
+    }
     LOG(WARNING) << "Found " << matched_stack_symbol << " in stack for pid " << procp->pid;
     return true;
 }
@@ -999,6 +1059,7 @@ milliseconds llkCheck(bool checkRunning) {
     auto myPid = ::getpid();
     auto myTid = ::gettid();
     auto dump = true;
+    auto candidates = false;
     for (auto dp = llkTopDirectory.read(); dp != nullptr; dp = llkTopDirectory.read()) {
         std::string piddir;
 
@@ -1021,8 +1082,8 @@ milliseconds llkCheck(bool checkRunning) {
             }
 
             // Get the process stat
-            std::string stat = ReadFile(piddir + "/stat");
-            if (stat.empty()) {
+            char stat[1024];
+            if (!llkReadStat(tp->d_name, stat, sizeof(stat))) {
                 continue;
             }
             unsigned tid = -1;
@@ -1035,7 +1096,7 @@ milliseconds llkCheck(bool checkRunning) {
             pdir[0] = '\0';
             // tid should not change value
             auto match = ::sscanf(
-                stat.c_str(),
+                stat,
                 "%u (%" ___STRING(
                     TASK_COMM_LEN) "[^)]) %c %u %*d %*d %*d %*d %*d %*d %*d %*d %*d %u %u %d",
                 &tid, pdir, &state, &ppid, &utime, &stime, &dummy);
@@ -1048,18 +1109,12 @@ milliseconds llkCheck(bool checkRunning) {
                 continue;
             }
 
-            // Get the process cgroup
-            auto cgroup = ReadFile(piddir + "/cgroup");
-            auto frozen = cgroup.find(":freezer:/frozen") != std::string::npos;
-
             auto procp = llkTidLookup(tid);
             if (procp == nullptr) {
-                procp = llkTidAlloc(tid, pid, ppid, pdir, utime + stime, state, frozen);
+                procp = llkTidAlloc(tid, pid, ppid, pdir, utime + stime, state, false);
             } else {
                 // comm can change ...
                 procp->setComm(pdir);
-                // frozen can change, too...
-                procp->setFrozen(frozen);
                 procp->updated = true;
                 // pid/ppid/tid wrap?
                 if (((procp->update != prevUpdate) && (procp->update != llkUpdate)) ||
@@ -1099,6 +1154,11 @@ milliseconds llkCheck(bool checkRunning) {
             if ((tid == myTid) || llkSkipPid(tid)) {
                 continue;
             }
+            candidates |= llkIsMonitorState(state);
+            // frozen can change, but only matters from here on, so only read the cgroup of
+            // threads that got this far rather than of every thread.
+            auto cgroup = ReadFile(piddir + "/cgroup");
+            procp->setFrozen(cgroup.find(":freezer:/frozen") != std::string::npos);
             if (procp->isFrozen()) {
                 break;
             }
@@ -1255,7 +1315,15 @@ milliseconds llkCheck(bool checkRunning) {
         llkTopDirectory.reset();
     }
 
+    // With no thread in Z or D state, nothing can be close to timing out, so stretch the next
+    // cycle; that only delays noticing a new one. Stack checks look at every thread.
     llkCycle = llkCheckMs;
+#ifdef __PTRACE_ENABLED__
+    if (!llkCheckStackSymbols.empty()) candidates = true;
+#endif
+    if (!candidates) {
+        llkCycle = std::min(llkCheckMs + llkCheckMs / 2, llkTimeoutMs);
+    }
 
     timespec end;
     ::clock_gettime(CLOCK_MONOTONIC_COARSE, &end);
@@ -1320,6 +1388,7 @@ bool llkInit(const char* threadname) {
     if (debuggable) {
         llkCheckStackSymbols = llkSplit(LLK_CHECK_STACK_PROPERTY, LLK_CHECK_STACK_DEFAULT);
     }
+    llkIndexStackSymbols();
     std::string defaultIgnorelistStack(LLK_IGNORELIST_STACK_DEFAULT);
     if (!debuggable) defaultIgnorelistStack += ",logd,/system/bin/logd";
     llkIgnorelistStack = llkSplit(LLK_IGNORELIST_STACK_PROPERTY, defaultIgnorelistStack);
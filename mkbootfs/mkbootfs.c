@@ -10,7 +10,13 @@
 #include <dirent.h>
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zstd.h>
 
 #include <private/android_filesystem_config.h>
 #include <private/fs_config.h>
@@ -22,6 +28,14 @@
 ** - dotfiles are ignored
 ** - directories named 'root' are ignored
 ** - device notes, pipes, etc are not supported (error)
+** - with -c the archive is compressed in independent 8MB chunks
+**   (lz4 legacy blocks or zstd frames), so that first stage init
+**   can decompress it on several threads; -j sets how many threads
+**   compress them, by default one per CPU
+** - with -l the directory is not walked; only the paths listed in
+**   the file, one per line and relative to the directory, are
+**   archived, in the order given, so parents must come before
+**   their children
 */
 
 void die(const char *why, ...)
@@ -43,6 +57,8 @@ struct fs_config_entry {
 
 static struct fs_config_entry* canned_config = NULL;
 static char *target_out_path = NULL;
+/* The compiled-in fs_config and the overrides under target_out_path, read once. */
+static struct fs_config_handle* loaded_fs_config = NULL;
 
 /* Each line in the canned file should be a path plus three ints (uid,
  * gid, mode). */
@@ -57,6 +73,9 @@ static char *target_out_path = NULL;
 static int verbose = 0;
 static int total_size = 0;
 
+/* The archive is written here, which is stdout unless it is compressed. */
+static FILE *output = NULL;
+
 static void fix_stat(const char *path, struct stat *s)
 {
     uint64_t capabilities;
@@ -81,10 +100,14 @@ static void fix_stat(const char *path, struct stat *s)
         s->st_gid = empty_path_config->gid;
         s->st_mode = empty_path_config->mode | (s->st_mode & ~07777);
     } else {
-        // Use the compiled-in fs_config() function.
+        // Use the compiled-in fs_config.
         unsigned st_mode = s->st_mode;
         int is_dir = S_ISDIR(s->st_mode) || strcmp(path, TRAILER) == 0;
-        fs_config(path, is_dir, target_out_path, &s->st_uid, &s->st_gid, &st_mode, &capabilities);
+        if (loaded_fs_config == NULL) {
+            loaded_fs_config = fs_config_load(target_out_path);
+        }
+        fs_config_lookup(loaded_fs_config, path, is_dir, &s->st_uid, &s->st_gid, &st_mode,
+                         &capabilities);
         s->st_mode = (typeof(s->st_mode)) st_mode;
     }
 }
@@ -98,13 +121,13 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
 
     while(total_size & 3) {
         total_size++;
-        putchar(0);
+        fputc(0, output);
     }
 
     fix_stat(out, s);
 //    fprintf(stderr, "_eject %s: mode=0%o\n", out, s->st_mode);
 
-    printf("%06x%08x%08x%08x%08x%08x%08x"
+    fprintf(output, "%06x%08x%08x%08x%08x%08x%08x"
            "%08x%08x%08x%08x%08x%08x%08x%s%c",
            0x070701,
            next_inode++,  //  s.st_ino,
@@ -130,11 +153,11 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
 
     while(total_size & 3) {
         total_size++;
-        putchar(0);
+        fputc(0, output);
     }
 
     if(datasize) {
-        fwrite(data, datasize, 1, stdout);
+        fwrite(data, datasize, 1, output);
         total_size += datasize;
     }
 }
@@ -147,7 +170,7 @@ static void _eject_trailer()
 
     while(total_size & 0xff) {
         total_size++;
-        putchar(0);
+        fputc(0, output);
     }
 }
 
@@ -230,15 +253,11 @@ static void _archive_dir(char *in, char *out, int ilen, int olen)
     closedir(d);
 }
 
-static void _archive(char *in, char *out, int ilen, int olen)
+/* Archives a single entry, returning non-zero if it is a directory. */
+static int _archive_entry(char *in, char *out, int olen)
 {
     struct stat s;
 
-    if(verbose) {
-        fprintf(stderr,"_archive('%s','%s',%d,%d)\n",
-                in, out, ilen, olen);
-    }
-
     if(lstat(in, &s)) die("could not stat '%s'\n", in);
 
     if(S_ISREG(s.st_mode)){
@@ -261,7 +280,7 @@ static void _archive(char *in, char *out, int ilen, int olen)
         close(fd);
     } else if(S_ISDIR(s.st_mode)) {
         _eject(&s, out, olen, 0, 0);
-        _archive_dir(in, out, ilen, olen);
+        return 1;
     } else if(S_ISLNK(s.st_mode)) {
         char buf[1024];
         int size;
@@ -271,6 +290,19 @@ static void _archive(char *in, char *out, int ilen, int olen)
     } else {
         die("Unknown '%s' (mode %d)?\n", in, s.st_mode);
     }
+    return 0;
+}
+
+static void _archive(char *in, char *out, int ilen, int olen)
+{
+    if(verbose) {
+        fprintf(stderr,"_archive('%s','%s',%d,%d)\n",
+                in, out, ilen, olen);
+    }
+
+    if(_archive_entry(in, out, olen)) {
+        _archive_dir(in, out, ilen, olen);
+    }
 }
 
 void archive(const char *start, const char *prefix)
@@ -284,6 +316,44 @@ void archive(const char *start, const char *prefix)
     _archive_dir(in, out, strlen(in), strlen(out));
 }
 
+void archive_list(const char *start, const char *prefix, const char *list)
+{
+    char in[8192];
+    char out[8192];
+    char line[CANNED_LINE_LENGTH];
+    int ilen = strlen(start);
+    int plen = strlen(prefix);
+
+    FILE* f = fopen(list, "r");
+    if (f == NULL) die("failed to open file list '%s'", list);
+
+    strcpy(in, start);
+    strcpy(out, prefix);
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int t = strcspn(line, "\n");
+        line[t] = 0;
+        if (t == 0) continue;
+        if (ilen + t + 2 > (int)sizeof(in) || plen + t + 2 > (int)sizeof(out)) {
+            die("path '%s' is too long", line);
+        }
+
+        in[ilen] = '/';
+        memcpy(in + ilen + 1, line, t + 1);
+        if (plen > 0) {
+            out[plen] = '/';
+            memcpy(out + plen + 1, line, t + 1);
+            _archive_entry(in, out, plen + t + 1);
+        } else {
+            memcpy(out, line, t + 1);
+            _archive_entry(in, out, t);
+        }
+    }
+    if (ferror(f)) die("failed to read file list '%s'", list);
+
+    fclose(f);
+}
+
 static void read_canned_config(char* filename)
 {
     int allocated = 8;
@@ -330,11 +400,141 @@ static void read_canned_config(char* filename)
 }
 
 
+/* Both formats are split into chunks of this size, which for lz4 is
+** also the block size of the legacy format the kernel accepts. */
+#define COMPRESS_CHUNK_SIZE (8 << 20)
+#define LZ4_LEGACY_MAGIC 0x184C2102
+
+static void write_le32(uint32_t value)
+{
+    unsigned char bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    fwrite(bytes, sizeof(bytes), 1, stdout);
+}
+
+/* The chunks are independent, so they are compressed on several threads,
+** which claim them in order, and then written out in order. */
+struct compress_state {
+    const char *compression;
+    const char *data;
+    size_t size;
+    size_t num_chunks;
+    size_t next_chunk;
+    pthread_mutex_t lock;
+    char **chunks;
+    size_t *chunk_sizes;
+};
+
+static size_t compress_chunk(const char *compression, const char *data, size_t len, char **out)
+{
+    if (strcmp(compression, "lz4") == 0) {
+        int bound = LZ4_compressBound(len);
+        *out = malloc(bound);
+        if (*out == NULL) die("failed to allocate compression buffer");
+        int n = LZ4_compress_HC(data, *out, len, bound, LZ4HC_CLEVEL_MAX);
+        if (n <= 0) die("lz4 compression failed");
+        return n;
+    }
+
+    // Each chunk is its own frame, which records its decompressed size.
+    size_t bound = ZSTD_compressBound(len);
+    *out = malloc(bound);
+    if (*out == NULL) die("failed to allocate compression buffer");
+    size_t n = ZSTD_compress(*out, bound, data, len, 19);
+    if (ZSTD_isError(n)) die("zstd compression failed: %s", ZSTD_getErrorName(n));
+    return n;
+}
+
+static void *compress_thread(void *arg)
+{
+    struct compress_state *state = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&state->lock);
+        size_t i = state->next_chunk++;
+        pthread_mutex_unlock(&state->lock);
+        if (i >= state->num_chunks) break;
+
+        size_t pos = i * COMPRESS_CHUNK_SIZE;
+        size_t len = state->size - pos < COMPRESS_CHUNK_SIZE ? state->size - pos
+                                                              : COMPRESS_CHUNK_SIZE;
+        state->chunk_sizes[i] =
+                compress_chunk(state->compression, state->data + pos, len, &state->chunks[i]);
+    }
+    return NULL;
+}
+
+static void compress_archive(const char *compression, const char *data, size_t size,
+                             long num_threads)
+{
+    struct compress_state state = {
+        .compression = compression,
+        .data = data,
+        .size = size,
+        .num_chunks = (size + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE,
+        .next_chunk = 0,
+    };
+    pthread_mutex_init(&state.lock, NULL);
+    state.chunks = calloc(state.num_chunks, sizeof(char*));
+    state.chunk_sizes = calloc(state.num_chunks, sizeof(size_t));
+    if (state.num_chunks && (state.chunks == NULL || state.chunk_sizes == NULL)) {
+        die("failed to allocate %zu chunks", state.num_chunks);
+    }
+
+    if (num_threads > (long)state.num_chunks) num_threads = state.num_chunks;
+    if (num_threads < 1) num_threads = 1;
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (threads == NULL) die("failed to allocate %ld threads", num_threads);
+    // This thread compresses chunks too.
+    for (long i = 1; i < num_threads; ++i) {
+        if (pthread_create(&threads[i], NULL, compress_thread, &state) != 0) {
+            die("failed to create compression thread");
+        }
+    }
+    compress_thread(&state);
+    for (long i = 1; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&state.lock);
+
+    if (strcmp(compression, "lz4") == 0) write_le32(LZ4_LEGACY_MAGIC);
+    for (size_t i = 0; i < state.num_chunks; ++i) {
+        if (strcmp(compression, "lz4") == 0) write_le32(state.chunk_sizes[i]);
+        fwrite(state.chunks[i], state.chunk_sizes[i], 1, stdout);
+        free(state.chunks[i]);
+    }
+    free(state.chunks);
+    free(state.chunk_sizes);
+}
+
 int main(int argc, char *argv[])
 {
+    const char *compression = NULL;
+    const char *file_list = NULL;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char *archive_data = NULL;
+    size_t archive_size = 0;
+
     argc--;
     argv++;
 
+    if (argc > 1 && strcmp(argv[0], "-c") == 0) {
+        compression = argv[1];
+        if (strcmp(compression, "lz4") != 0 && strcmp(compression, "zstd") != 0) {
+            die("unknown compression '%s', expected lz4 or zstd", compression);
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc > 1 && strcmp(argv[0], "-j") == 0) {
+        char *end;
+        num_threads = strtol(argv[1], &end, 10);
+        if (*end != 0 || num_threads < 1) die("invalid thread count '%s'", argv[1]);
+        argc -= 2;
+        argv += 2;
+    }
+
     if (argc > 1 && strcmp(argv[0], "-d") == 0) {
         target_out_path = argv[1];
         argc -= 2;
@@ -347,7 +547,21 @@ int main(int argc, char *argv[])
         argv += 2;
     }
 
+    if (argc > 1 && strcmp(argv[0], "-l") == 0) {
+        file_list = argv[1];
+        argc -= 2;
+        argv += 2;
+    }
+
     if(argc == 0) die("no directories to process?!");
+    if (file_list && argc != 1) die("-l takes exactly one directory");
+
+    if (compression) {
+        output = open_memstream(&archive_data, &archive_size);
+        if (output == NULL) die("failed to create archive buffer");
+    } else {
+        output = stdout;
+    }
 
     while(argc-- > 0){
         char *x = strchr(*argv, '=');
@@ -357,12 +571,22 @@ int main(int argc, char *argv[])
             x = "";
         }
 
-        archive(*argv, x);
+        if (file_list) {
+            archive_list(*argv, x, file_list);
+        } else {
+            archive(*argv, x);
+        }
 
         argv++;
     }
 
     _eject_trailer();
 
+    if (compression) {
+        if (fclose(output) != 0) die("failed to write archive");
+        compress_archive(compression, archive_data, archive_size, num_threads);
+        free(archive_data);
+    }
+
     return 0;
 }
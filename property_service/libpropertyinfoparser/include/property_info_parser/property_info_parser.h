@@ -54,6 +54,15 @@ struct TrieNodeInternal {
   uint32_t exact_match_entries;
 };
 
+// An entry of the exact match table: the full name of a property that has an exact match and the
+// result of looking it up in the trie.  Unused buckets have a name_offset of 0.
+struct ExactMatchTableEntry {
+  uint32_t hash;
+  uint32_t name_offset;
+  uint32_t context_index;
+  uint32_t type_index;
+};
+
 struct PropertyInfoAreaHeader {
   // The current version of this data as created by property service.
   uint32_t current_version;
@@ -63,8 +72,14 @@ struct PropertyInfoAreaHeader {
   uint32_t contexts_offset;
   uint32_t types_offset;
   uint32_t root_offset;
+  // Since version 2: a uint32_t count of buckets, a power of two, followed by that many
+  // ExactMatchTableEntry's, open addressed by PropertyNameHash() with linear probing; 0 if absent.
+  uint32_t exact_match_table_offset;
 };
 
+// FNV-1a hash of a property name, used to index the exact match table.
+uint32_t PropertyNameHash(const char* name);
+
 class SerializedData {
  public:
   uint32_t size() const {
@@ -174,6 +189,7 @@ class PropertyInfoArea : private SerializedData {
  private:
   void CheckPrefixMatch(const char* remaining_name, const TrieNode& trie_node,
                         uint32_t* context_index, uint32_t* type_index) const;
+  bool FindExactMatch(const char* name, uint32_t* context_index, uint32_t* type_index) const;
 
   const PropertyInfoAreaHeader* header() const {
     return reinterpret_cast<const PropertyInfoAreaHeader*>(data_base());
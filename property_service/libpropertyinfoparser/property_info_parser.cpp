@@ -47,6 +47,15 @@ int Find(uint32_t array_length, F&& f) {
 
 }  // namespace
 
+uint32_t PropertyNameHash(const char* name) {
+  uint32_t hash = 2166136261u;
+  for (; *name != '\0'; ++name) {
+    hash ^= static_cast<unsigned char>(*name);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
 // Binary search the list of contexts to find the index of a given context string.
 // Only should be used for TrieSerializer to construct the Trie.
 int PropertyInfoArea::FindContextIndex(const char* context) const {
@@ -107,8 +116,41 @@ void PropertyInfoArea::CheckPrefixMatch(const char* remaining_name, const TrieNo
   }
 }
 
+// Looks up a full property name in the exact match table, which holds the trie's answer for every
+// exact match so that the most commonly looked up properties take a single hash probe.
+bool PropertyInfoArea::FindExactMatch(const char* name, uint32_t* context_index,
+                                      uint32_t* type_index) const {
+  if (current_version() < 2 || header()->exact_match_table_offset == 0) return false;
+
+  uint32_t table_offset = header()->exact_match_table_offset;
+  uint32_t num_buckets = uint32(table_offset);
+  if (num_buckets == 0 || num_buckets == ~0u) return false;
+  auto entries = reinterpret_cast<const ExactMatchTableEntry*>(data_base() + table_offset +
+                                                               sizeof(uint32_t));
+
+  uint32_t hash = PropertyNameHash(name);
+  uint32_t bucket = hash & (num_buckets - 1);
+  for (uint32_t i = 0; i < num_buckets; ++i, bucket = (bucket + 1) & (num_buckets - 1)) {
+    const ExactMatchTableEntry& entry = entries[bucket];
+    if (entry.name_offset == 0) return false;
+    if (entry.hash != hash) continue;
+
+    const char* entry_name = c_string(entry.name_offset);
+    if (entry_name == nullptr || strcmp(entry_name, name) != 0) continue;
+
+    if (context_index != nullptr) *context_index = entry.context_index;
+    if (type_index != nullptr) *type_index = entry.type_index;
+    return true;
+  }
+  return false;
+}
+
 void PropertyInfoArea::GetPropertyInfoIndexes(const char* name, uint32_t* context_index,
                                               uint32_t* type_index) const {
+  if (FindExactMatch(name, context_index, type_index)) {
+    return;
+  }
+
   uint32_t return_context_index = ~0u;
   uint32_t return_type_index = ~0u;
   const char* remaining_name = name;
@@ -0,0 +1,126 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "property_info_serializer/property_info_serializer.h"
+
+#include "property_info_parser/property_info_parser.h"
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+namespace android {
+namespace properties {
+
+namespace {
+
+// The property_contexts files that init loads, in the order it loads them.
+const char* const kPropertyContextsFiles[] = {
+    "/system/etc/selinux/plat_property_contexts",
+    "/system_ext/etc/selinux/system_ext_property_contexts",
+    "/product/etc/selinux/product_property_contexts",
+    "/vendor/etc/selinux/vendor_property_contexts",
+    "/odm/etc/selinux/odm_property_contexts",
+};
+
+struct Corpus {
+  std::string serialized_trie;
+  // The property names of every entry, with something appended to prefix entries.
+  std::vector<std::string> names;
+  std::vector<std::string> exact_names;
+};
+
+const Corpus& GetCorpus() {
+  static const Corpus corpus = [] {
+    Corpus corpus;
+    std::vector<PropertyInfoEntry> property_infos;
+    for (const auto& file : kPropertyContextsFiles) {
+      std::string contents;
+      if (!android::base::ReadFileToString(file, &contents)) continue;
+      std::vector<std::string> errors;
+      ParsePropertyInfoFile(contents, false, &property_infos, &errors);
+    }
+    std::string error;
+    if (property_infos.empty() ||
+        !BuildTrie(property_infos, "u:object_r:default_prop:s0", "string", &corpus.serialized_trie,
+                   &error)) {
+      corpus.serialized_trie.clear();
+      return corpus;
+    }
+    for (const auto& property_info : property_infos) {
+      if (property_info.exact_match) {
+        corpus.names.emplace_back(property_info.name);
+        corpus.exact_names.emplace_back(property_info.name);
+      } else {
+        corpus.names.emplace_back(property_info.name + "suffix");
+      }
+    }
+    return corpus;
+  }();
+  return corpus;
+}
+
+void RunLookups(benchmark::State& state, bool use_exact_match_table,
+                const std::vector<std::string> Corpus::*names) {
+  const auto& corpus = GetCorpus();
+  if (corpus.serialized_trie.empty() || (corpus.*names).empty()) {
+    state.SkipWithError("No property_contexts found");
+    return;
+  }
+
+  auto serialized_trie = corpus.serialized_trie;
+  if (!use_exact_match_table) {
+    reinterpret_cast<PropertyInfoAreaHeader*>(serialized_trie.data())->current_version = 1;
+  }
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
+
+  for (auto _ : state) {
+    for (const auto& name : corpus.*names) {
+      uint32_t context_index;
+      uint32_t type_index;
+      property_info_area->GetPropertyInfoIndexes(name.c_str(), &context_index, &type_index);
+      benchmark::DoNotOptimize(context_index);
+      benchmark::DoNotOptimize(type_index);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (corpus.*names).size());
+}
+
+}  // namespace
+
+// Looks up every exact match and prefix of the device's property_contexts.
+static void BM_GetPropertyInfoIndexes(benchmark::State& state) {
+  RunLookups(state, true, &Corpus::names);
+}
+BENCHMARK(BM_GetPropertyInfoIndexes);
+
+static void BM_GetPropertyInfoIndexes_TrieOnly(benchmark::State& state) {
+  RunLookups(state, false, &Corpus::names);
+}
+BENCHMARK(BM_GetPropertyInfoIndexes_TrieOnly);
+
+// Looks up only the exact matches, which the exact match table answers without the trie.
+static void BM_GetPropertyInfoIndexes_ExactMatches(benchmark::State& state) {
+  RunLookups(state, true, &Corpus::exact_names);
+}
+BENCHMARK(BM_GetPropertyInfoIndexes_ExactMatches);
+
+static void BM_GetPropertyInfoIndexes_ExactMatches_TrieOnly(benchmark::State& state) {
+  RunLookups(state, false, &Corpus::exact_names);
+}
+BENCHMARK(BM_GetPropertyInfoIndexes_ExactMatches_TrieOnly);
+
+}  // namespace properties
+}  // namespace android
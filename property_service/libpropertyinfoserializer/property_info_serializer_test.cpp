@@ -18,6 +18,8 @@
 
 #include "property_info_parser/property_info_parser.h"
 
+#include <tuple>
+
 #include <gtest/gtest.h>
 
 namespace android {
@@ -39,7 +41,7 @@ TEST(propertyinfoserializer, TrieNodeCheck) {
   auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
 
   // Initial checks for property area.
-  EXPECT_EQ(1U, property_info_area->current_version());
+  EXPECT_EQ(2U, property_info_area->current_version());
   EXPECT_EQ(1U, property_info_area->minimum_supported_version());
 
   // Check the root node
@@ -888,5 +890,48 @@ TEST(propertyinfoserializer, GetPropertyInfo_empty_context_and_type) {
   EXPECT_STREQ("5th", type);
 }
 
+TEST(propertyinfoserializer, GetPropertyInfo_exact_match_table) {
+  auto property_info = std::vector<PropertyInfoEntry>{
+      {"persist.", "1st", "1st", false},
+      {"persist.radio", "2nd", "2nd", false},
+      {"persist.radio.exact", "3rd", "3rd", true},
+      {"persist.radio.exact_without_type", "4th", "", true},
+      {"persist.exact_without_context", "", "5th", true},
+      {"exact", "6th", "6th", true},
+  };
+
+  auto serialized_trie = std::string();
+  auto build_trie_error = std::string();
+  ASSERT_TRUE(BuildTrie(property_info, "default", "default", &serialized_trie, &build_trie_error))
+      << build_trie_error;
+
+  // Data written before the exact match table existed must still be looked up through the trie,
+  // with the same results.
+  auto version_1_trie = serialized_trie;
+  reinterpret_cast<PropertyInfoAreaHeader*>(version_1_trie.data())->current_version = 1;
+
+  auto expected_contexts_and_types = std::vector<std::tuple<std::string, std::string, std::string>>{
+      {"persist.radio.exact", "3rd", "3rd"},
+      {"persist.radio.exact_without_type", "4th", "2nd"},
+      {"persist.exact_without_context", "1st", "5th"},
+      {"exact", "6th", "6th"},
+      {"exac", "default", "default"},
+      {"exact.not", "default", "default"},
+      {"persist.radio.exact.not", "2nd", "2nd"},
+      {"persist.radio.exac", "2nd", "2nd"},
+  };
+
+  for (const auto& data : {serialized_trie, version_1_trie}) {
+    auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(data.data());
+    for (const auto& [property, expected_context, expected_type] : expected_contexts_and_types) {
+      const char* context;
+      const char* type;
+      property_info_area->GetPropertyInfo(property.c_str(), &context, &type);
+      EXPECT_STREQ(expected_context.c_str(), context) << property;
+      EXPECT_STREQ(expected_type.c_str(), type) << property;
+    }
+  }
+}
+
 }  // namespace properties
 }  // namespace android
@@ -20,6 +20,21 @@
 namespace android {
 namespace properties {
 
+namespace {
+
+// Collects the full names of every exact match below builder_node.
+void CollectExactMatchNames(const TrieBuilderNode& builder_node, const std::string& path,
+                            std::vector<std::string>* names) {
+  for (const auto& exact_match : builder_node.exact_matches()) {
+    names->emplace_back(path + exact_match.name);
+  }
+  for (const auto& child : builder_node.children()) {
+    CollectExactMatchNames(child, path + child.name() + ".", names);
+  }
+}
+
+}  // namespace
+
 // Serialized strings contains:
 // 1) A uint32_t count of elements in the below array
 // 2) A sorted array of uint32_t offsets pointing to null terminated strings
@@ -110,13 +125,45 @@ uint32_t TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node) {
   return trie_offset;
 }
 
+uint32_t TrieSerializer::WriteExactMatchTable(const TrieBuilderNode& builder_root) {
+  std::vector<std::string> names;
+  CollectExactMatchNames(builder_root, "", &names);
+
+  // Look everything up in the trie first, as the arena may move as the table is written.
+  std::vector<ExactMatchTableEntry> entries;
+  for (const auto& name : names) {
+    ExactMatchTableEntry entry;
+    entry.hash = PropertyNameHash(name.c_str());
+    serialized_info()->GetPropertyInfoIndexes(name.c_str(), &entry.context_index,
+                                              &entry.type_index);
+    entry.name_offset = arena_->AllocateAndWriteString(name);
+    entries.emplace_back(entry);
+  }
+
+  // Keep the table at most half full, so probes stay short and always find an empty bucket.
+  uint32_t num_buckets = 1;
+  while (num_buckets < entries.size() * 2) num_buckets *= 2;
+
+  uint32_t table_offset = arena_->size();
+  arena_->AllocateAndWriteUint32(num_buckets);
+  uint32_t buckets_offset;
+  arena_->AllocateData(sizeof(ExactMatchTableEntry) * num_buckets, &buckets_offset);
+  for (const auto& entry : entries) {
+    auto buckets = reinterpret_cast<ExactMatchTableEntry*>(arena_->uint32_array(buckets_offset));
+    uint32_t bucket = entry.hash & (num_buckets - 1);
+    while (buckets[bucket].name_offset != 0) bucket = (bucket + 1) & (num_buckets - 1);
+    buckets[bucket] = entry;
+  }
+  return table_offset;
+}
+
 TrieSerializer::TrieSerializer() {}
 
 std::string TrieSerializer::SerializeTrie(const TrieBuilder& trie_builder) {
   arena_.reset(new TrieNodeArena());
 
   auto header = arena_->AllocateObject<PropertyInfoAreaHeader>(nullptr);
-  header->current_version = 1;
+  header->current_version = 2;
   header->minimum_supported_version = 1;
 
   // Store where we're about to write the contexts.
@@ -132,6 +179,12 @@ std::string TrieSerializer::SerializeTrie(const TrieBuilder& trie_builder) {
 
   uint32_t root_trie_offset = WriteTrieNode(trie_builder.builder_root());
   header->root_offset = root_trie_offset;
+  header->exact_match_table_offset = 0;
+
+  // The exact match table is filled in from lookups in the trie written above.
+  header->size = arena_->size();
+  uint32_t exact_match_table_offset = WriteExactMatchTable(trie_builder.builder_root());
+  header->exact_match_table_offset = exact_match_table_offset;
 
   // Record the real size now that we've written everything
   header->size = arena_->size();
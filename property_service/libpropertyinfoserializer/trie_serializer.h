@@ -42,6 +42,10 @@ class TrieSerializer {
   // Returns the offset within arena.
   uint32_t WriteTrieNode(const TrieBuilderNode& builder_node);
 
+  // Writes the table of exact match names to their already serialized lookup results.
+  // Returns the offset within arena.
+  uint32_t WriteExactMatchTable(const TrieBuilderNode& builder_root);
+
   const PropertyInfoArea* serialized_info() const {
     return reinterpret_cast<const PropertyInfoArea*>(arena_->data().data());
   }
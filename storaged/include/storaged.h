@@ -51,6 +51,8 @@ friend class test_case_name##_##test_name##_Test
 
 #include "storaged_diskstats.h"
 #include "storaged_info.h"
+#include "storaged_task_sampler.h"
+#include "storaged_uid_io_log.h"
 #include "storaged_uid_monitor.h"
 #include "storaged.pb.h"
 #include "uid_info.h"
@@ -65,6 +67,9 @@ using namespace android;
 #define DEFAULT_PERIODIC_CHORES_INTERVAL_UID_IO_LIMIT ( 300 )
 #define DEFAULT_PERIODIC_CHORES_INTERVAL_FLUSH_PROTO ( 3600 )
 
+// Number of busiest uids whose tasks are sampled
+#define DEFAULT_TASK_IO_TOP_UIDS ( 5 )
+
 // UID IO threshold in bytes
 #define DEFAULT_PERIODIC_CHORES_UID_IO_THRESHOLD ( 1024 * 1024 * 1024ULL )
 
@@ -76,6 +81,9 @@ struct storaged_config {
     int periodic_chores_interval_uid_io;
     int periodic_chores_interval_flush_proto;
     int event_time_check_usec;  // check how much cputime spent in event loop
+    int disk_stats_sample_msec; // high-frequency diskstats sampling, 0 if off
+    int task_io_sample_msec;    // per-task io sampling, 0 if off
+    int task_io_top_uids;       // number of busiest uids whose tasks are sampled
 };
 
 struct HealthServicePair {
@@ -100,6 +108,7 @@ class storaged_t : public RefBase {
     storaged_config mConfig;
     unique_ptr<disk_stats_monitor> mDsm;
     uid_monitor mUidm;
+    unique_ptr<task_io_sampler> mTaskSampler;
     time_t mStarttime;
     std::shared_ptr<aidl::android::hardware::health::IHealth> health;
     sp<android::hardware::hidl_death_recipient> hidl_death_recp;
@@ -109,14 +118,24 @@ class storaged_t : public RefBase {
     static const uint32_t current_version;
     Mutex proto_lock;
     unordered_map<userid_t, bool> proto_loaded;
+    unordered_map<userid_t, unique_ptr<uid_io_log>> uid_io_logs;
+    // generation of the proto on disk, 0 if none was written
+    unordered_map<userid_t, uint64_t> log_generation;
+    // end_ts of the newest uid io item in the proto or its log
+    unordered_map<userid_t, uint64_t> last_flushed_ts;
     void load_proto(userid_t user_id);
     char* prepare_proto(userid_t user_id, StoragedProto* proto);
     void flush_proto(userid_t user_id, StoragedProto* proto);
-    void flush_proto_data(userid_t user_id, const char* data, ssize_t size);
+    bool flush_proto_data(userid_t user_id, const char* data, ssize_t size);
+    uid_io_log* get_uid_io_log(userid_t user_id);
+    bool append_uid_io_log(userid_t user_id, const StoragedProto& proto);
     string proto_path(userid_t user_id) {
         return string("/data/misc_ce/") + to_string(user_id) +
                "/storaged/storaged.proto";
     }
+    string log_path(userid_t user_id) {
+        return proto_path(user_id) + ".log";
+    }
     void init_health_service();
 
   public:
@@ -142,6 +161,22 @@ class storaged_t : public RefBase {
 
     uint32_t get_recent_perf(void) { return storage_info->get_recent_perf(); }
 
+    int get_disk_stats_sample_interval(void) {
+        return mDsm->enabled() ? mConfig.disk_stats_sample_msec : 0;
+    }
+    void sample_disk_stats(void) { mDsm->sample(); }
+    void get_disk_latency(struct disk_latency* latency) {
+        mDsm->get_latency(latency);
+    }
+
+    int get_task_io_sample_interval(void) {
+        return mTaskSampler ? mConfig.task_io_sample_msec : 0;
+    }
+    void sample_task_io(void) { mTaskSampler->sample(); }
+    vector<task_io_sample> get_task_io_samples(void) {
+        return mTaskSampler ? mTaskSampler->dump() : vector<task_io_sample>();
+    }
+
     map<uint64_t, struct uid_records> get_uid_records(
             double hours, uint64_t threshold, bool force_report) {
         return mUidm.dump(hours, threshold, force_report);
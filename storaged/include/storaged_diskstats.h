@@ -19,6 +19,8 @@
 
 #include <stdint.h>
 
+#include <atomic>
+
 #include <aidl/android/hardware/health/IHealth.h>
 
 // number of attributes diskstats has
@@ -141,9 +143,34 @@ public:
     }
 };
 
+/* Log2 histogram of samples. Buckets are atomic so that one thread can
+ * record samples while another one reads percentiles without locking.
+ */
+class latency_histogram {
+private:
+    static constexpr int NR_BUCKETS = 32;
+    std::atomic<uint64_t> mBuckets[NR_BUCKETS] = {};
+public:
+    void record(uint64_t value);
+    uint64_t count() const;
+    // upper bound of the bucket holding the given percentile, 0 if empty
+    uint64_t percentile(uint32_t pct) const;
+};
+
+struct disk_latency {
+    uint64_t nr_samples;
+    uint64_t read_p50;          // per-interval mean read latency (us)
+    uint64_t read_p99;
+    uint64_t write_p50;         // per-interval mean write latency (us)
+    uint64_t write_p99;
+    uint64_t queue_p50;         // per-interval mean queue depth
+    uint64_t queue_p99;
+};
+
 class disk_stats_monitor {
 private:
     FRIEND_TEST(storaged_test, disk_stats_monitor);
+    FRIEND_TEST(storaged_test, disk_stats_sample);
     const char* const DISK_STATS_PATH;
     struct disk_stats mPrevious;
     struct disk_stats mAccumulate;      /* reset after stall */
@@ -163,7 +190,13 @@ private:
     struct disk_perf mMean;
     struct disk_perf mStd;
     std::shared_ptr<aidl::android::hardware::health::IHealth> mHealth;
+    /* high-frequency sampling, only touched by the sampling thread */
+    struct disk_stats mSamplePrevious;
+    latency_histogram mReadLatency;
+    latency_histogram mWriteLatency;
+    latency_histogram mQueueDepth;
 
+    bool get_stats(struct disk_stats* stats);
     void update_mean();
     void update_std();
     void add(struct disk_perf* perf);
@@ -171,6 +204,7 @@ private:
     bool detect(struct disk_perf* perf);
 
     void update(struct disk_stats* stats);
+    void sample(struct disk_stats* stats);
 
 public:
   disk_stats_monitor(const std::shared_ptr<aidl::android::hardware::health::IHealth>& healthService,
@@ -191,10 +225,13 @@ public:
         mSigma(sigma),
         mMean(),
         mStd(),
-        mHealth(healthService) {}
+        mHealth(healthService),
+        mSamplePrevious() {}
   bool enabled() { return mHealth != nullptr || DISK_STATS_PATH != nullptr; }
   void update(void);
   void publish(void);
+  void sample(void);
+  void get_latency(struct disk_latency* latency) const;
 };
 
 #endif /* _STORAGED_DISKSTATS_H_ */
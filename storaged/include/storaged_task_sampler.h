@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _STORAGED_TASK_SAMPLER_H_
+#define _STORAGED_TASK_SAMPLER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <utils/Mutex.h>
+
+#include "uid_info.h"
+
+using namespace std;
+using namespace android;
+using namespace android::os::storaged;
+
+// I/O of one task over the last sampling interval
+struct task_io_sample {
+    uint32_t uid;
+    pid_t pid;
+    string comm;
+    uid_stat_t state;           // from the task's cpuset
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+};
+
+// parses read_bytes and write_bytes out of /proc/<pid>/io
+bool parse_proc_io(std::string_view s, uint64_t* read_bytes, uint64_t* write_bytes);
+// tells from /proc/<pid>/cgroup whether the task is in a background cpuset
+uid_stat_t parse_task_state(std::string_view cgroup);
+
+/*
+ * Attributes current I/O bursts to tasks. Each sample finds the uids whose
+ * I/O grew the most since the previous sample, then reads /proc/<pid>/io of
+ * their tasks. Memory is bounded by MAX_TASKS tracked tasks.
+ */
+class task_io_sampler {
+private:
+    // uid -> read + write bytes at the previous sample
+    unordered_map<uint32_t, uint64_t> prev_uid_bytes_;
+    struct task_state {
+        uint64_t read_bytes;
+        uint64_t write_bytes;
+        bool seen;              // still present at the latest sample
+    };
+    // pid -> bytes at the previous sample
+    unordered_map<pid_t, task_state> prev_tasks_;
+    // contents of /proc/uid_io/stats, kept to reuse its storage
+    string uid_io_buffer_;
+    // tasks of the last sample with I/O, largest first
+    vector<task_io_sample> samples_;
+    // protects samples_
+    Mutex samples_mutex_;
+    const size_t top_uids_;
+
+    // returns the top_uids_ uids with the most I/O growth since the last call
+    unordered_set<uint32_t> get_busy_uids();
+
+public:
+    explicit task_io_sampler(size_t top_uids) : top_uids_(top_uids) {}
+    // called by the task sampling thread
+    void sample();
+    // called by dumpsys
+    vector<task_io_sample> dump();
+
+    static constexpr size_t MAX_TASKS = 512;
+};
+
+#endif /* _STORAGED_TASK_SAMPLER_H_ */
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _STORAGED_UID_IO_LOG_H_
+#define _STORAGED_UID_IO_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
+
+#include "storaged.pb.h"
+
+using namespace std;
+using namespace storaged_proto;
+
+/*
+ * Append-only log of uid io records kept next to a user's proto, so that a
+ * flush only writes the records added since the previous one instead of the
+ * whole proto. Records are delta encoded against the previous one and stored
+ * as varints. The file is mmapped and appends are written through the mapping.
+ *
+ * The log belongs to one proto generation: when the proto is rewritten in
+ * full, its new generation is stored in it and the log is reset to it. A log
+ * whose generation doesn't match the proto's holds nothing the proto lacks.
+ */
+class uid_io_log {
+  public:
+    uid_io_log() = default;
+    ~uid_io_log();
+
+    // Maps |path|, creating or reinitializing it with room for |capacity|
+    // bytes of records if it is missing or invalid.
+    bool open(const string& path, size_t capacity = DEFAULT_CAPACITY);
+
+    uint64_t generation() const;
+    // Drops all records and starts |generation|.
+    bool reset(uint64_t generation);
+    // Appends |item|. Returns false, leaving the log as is, if it doesn't fit.
+    bool append(const UidIOItem& item);
+    // Adds all records to |usage|. Returns false if a record is corrupt;
+    // records before it are still added.
+    bool replay(UidIOUsage* usage) const;
+
+    static constexpr size_t DEFAULT_CAPACITY = 256 * 1024;
+
+  private:
+    struct header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t generation;
+        uint64_t capacity;     // bytes available for records
+        uint64_t used;         // bytes of records written
+        uint64_t last_end_ts;  // base for the next record's end_ts delta
+    };
+
+    static constexpr uint32_t MAGIC = 0x4c4f4955;  // "UIOL"
+    static constexpr uint32_t VERSION = 1;
+
+    android::base::unique_fd fd_;
+    void* map_ = nullptr;
+    size_t map_size_ = 0;
+
+    header* hdr() const { return static_cast<header*>(map_); }
+    uint8_t* records() const { return static_cast<uint8_t*>(map_) + sizeof(header); }
+    bool init(size_t capacity);
+    void unmap();
+    bool sync(const void* addr, size_t len);
+
+    DISALLOW_COPY_AND_ASSIGN(uid_io_log);
+};
+
+#endif /* _STORAGED_UID_IO_LOG_H_ */
@@ -19,7 +19,10 @@
 
 #include <stdint.h>
 
+#include <time.h>
+
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -39,7 +42,7 @@ using namespace android::os::storaged;
 
 class uid_info : public UidInfo {
 public:
-    bool parse_uid_io_stats(string&& s);
+    bool parse_uid_io_stats(std::string_view s);
 };
 
 class io_usage {
@@ -83,6 +86,17 @@ private:
 
     // last dump from /proc/uid_io/stats, uid -> uid_info
     unordered_map<uint32_t, uid_info> last_uid_io_stats_;
+    // the dump before, only used while updating last_uid_io_stats_ to reuse its entries
+    unordered_map<uint32_t, uid_info> prev_uid_io_stats_;
+    unordered_map<uint32_t, task_info> prev_tasks_;
+    // contents of /proc/uid_io/stats, kept to reuse its storage
+    string uid_io_buffer_;
+    // uid -> name from the package manager, resolved once per uid
+    unordered_map<uint32_t, string> uid_names_;
+    // uid -> package name from packages.list, used to invalidate uid_names_
+    unordered_map<uint32_t, string> package_list_names_;
+    // mtime of packages.list when package_list_names_ was read
+    struct timespec package_list_mtime_;
     // current io usage for next report, app name -> uid_io_usage
     unordered_map<string, uid_io_usage> curr_io_stats_;
     // io usage records, end timestamp -> {start timestamp, vector of records}
@@ -98,9 +112,14 @@ private:
 
     // reads from /proc/uid_io/stats
     unordered_map<uint32_t, uid_info> get_uid_io_stats_locked();
+    // drops names of uids installed, removed or reassigned since packages.list was last read
+    void invalidate_uid_names_locked();
+    // looks up the names of uids in uid_io_buffer_ that aren't in uid_names_ yet
+    void resolve_uid_names_locked();
+    void get_uid_name_locked(uint32_t uid, string* name);
     // flushes curr_io_stats to records
     void add_records_locked(uint64_t curr_ts);
-    // updates curr_io_stats and set last_uid_io_stats
+    // adds the growth since last_uid_io_stats to curr_io_stats and updates last_uid_io_stats
     void update_curr_io_stats_locked();
     // writes io_history to protobuf
     void update_uid_io_proto(unordered_map<int, StoragedProto>* protos);
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <vector>
 
 #include <android-base/macros.h>
@@ -55,6 +56,26 @@ void* storaged_main(void* /* unused */) {
     return NULL;
 }
 
+// Function of storaged's diskstats sampling thread
+void* storaged_sample_disk_stats(void* /* unused */) {
+    useconds_t interval = storaged_sp->get_disk_stats_sample_interval() * MSEC_TO_USEC;
+    for (;;) {
+        storaged_sp->sample_disk_stats();
+        usleep(interval);
+    }
+    return NULL;
+}
+
+// Function of storaged's task I/O sampling thread
+void* storaged_sample_task_io(void* /* unused */) {
+    useconds_t interval = storaged_sp->get_task_io_sample_interval() * MSEC_TO_USEC;
+    for (;;) {
+        storaged_sp->sample_task_io();
+        usleep(interval);
+    }
+    return NULL;
+}
+
 void help_message(void) {
     printf("usage: storaged [OPTION]\n");
     printf("  -u    --uid                   Dump uid I/O usage to stdout\n");
@@ -129,6 +150,24 @@ int main(int argc, char** argv) {
             return -1;
         }
 
+        if (storaged_sp->get_disk_stats_sample_interval() > 0) {
+            pthread_t storaged_sample_thread;
+            errno = pthread_create(&storaged_sample_thread, NULL,
+                                   storaged_sample_disk_stats, NULL);
+            if (errno != 0) {
+                PLOG(ERROR) << "Failed to create diskstats sampling thread";
+            }
+        }
+
+        if (storaged_sp->get_task_io_sample_interval() > 0) {
+            pthread_t storaged_task_thread;
+            errno = pthread_create(&storaged_task_thread, NULL,
+                                   storaged_sample_task_io, NULL);
+            if (errno != 0) {
+                PLOG(ERROR) << "Failed to create task I/O sampling thread";
+            }
+        }
+
         if (StoragedService::start() != android::OK ||
             StoragedPrivateService::start() != android::OK) {
             PLOG(ERROR) << "Failed to start storaged service";
@@ -64,6 +64,11 @@ constexpr ssize_t benchmark_unit_size = 16 * 1024;  // 16KB
 
 constexpr ssize_t min_benchmark_size = 128 * 1024;  // 128KB
 
+uint64_t last_end_ts(const UidIOUsage& usage) {
+    int size = usage.uid_io_items_size();
+    return size ? usage.uid_io_items(size - 1).end_ts() : 0;
+}
+
 }  // namespace
 
 const uint32_t storaged_t::current_version = 4;
@@ -199,6 +204,19 @@ storaged_t::storaged_t(void) {
     mConfig.event_time_check_usec =
         property_get_int32("ro.storaged.event.perf_check", 0);
 
+    mConfig.disk_stats_sample_msec =
+        property_get_int32("ro.storaged.disk_stats.sample_interval_ms", 0);
+
+    mConfig.task_io_sample_msec =
+        property_get_int32("ro.storaged.task_io.sample_interval_ms", 0);
+
+    mConfig.task_io_top_uids =
+        property_get_int32("ro.storaged.task_io.top_uids", DEFAULT_TASK_IO_TOP_UIDS);
+
+    if (mConfig.task_io_sample_msec > 0 && mConfig.task_io_top_uids > 0 && mUidm.enabled()) {
+        mTaskSampler = make_unique<task_io_sampler>(mConfig.task_io_top_uids);
+    }
+
     mConfig.periodic_chores_interval_disk_stats_publish =
         property_get_int32("ro.storaged.disk_stats_pub",
                            DEFAULT_PERIODIC_CHORES_INTERVAL_DISK_STATS_PUBLISH);
@@ -229,7 +247,11 @@ void storaged_t::remove_user_ce(userid_t user_id) {
 
     proto_loaded[user_id] = false;
     mUidm.clear_user_history(user_id);
+    uid_io_logs.erase(user_id);
+    log_generation.erase(user_id);
+    last_flushed_ts.erase(user_id);
     RemoveFileIfExists(proto_path(user_id), nullptr);
+    RemoveFileIfExists(log_path(user_id), nullptr);
 }
 
 void storaged_t::load_proto(userid_t user_id) {
@@ -253,10 +275,26 @@ void storaged_t::load_proto(userid_t user_id) {
     }
 
     mUidm.load_uid_io_proto(user_id, proto.uid_io_usage());
+    log_generation[user_id] = proto.log_generation();
+    last_flushed_ts[user_id] = last_end_ts(uid_io_usage);
 
     if (user_id == USER_SYSTEM) {
         storage_info->load_perf_history_proto(proto.perf_history());
+        return;
+    }
+
+    uid_io_log* log = get_uid_io_log(user_id);
+    if (log == nullptr || !proto.log_generation() ||
+        log->generation() != proto.log_generation()) {
+        return;
     }
+
+    UidIOUsage log_usage;
+    if (!log->replay(&log_usage)) {
+        LOG(WARNING) << "Ignoring corrupt records in " << log_path(user_id);
+    }
+    mUidm.load_uid_io_proto(user_id, log_usage);
+    last_flushed_ts[user_id] = max(last_flushed_ts[user_id], last_end_ts(log_usage));
 }
 
 char* storaged_t:: prepare_proto(userid_t user_id, StoragedProto* proto) {
@@ -292,7 +330,7 @@ char* storaged_t:: prepare_proto(userid_t user_id, StoragedProto* proto) {
     return data;
 }
 
-void storaged_t::flush_proto_data(userid_t user_id,
+bool storaged_t::flush_proto_data(userid_t user_id,
                                   const char* data, ssize_t size) {
     string proto_file = proto_path(user_id);
     string tmp_file = proto_file + "_tmp";
@@ -302,7 +340,7 @@ void storaged_t::flush_proto_data(userid_t user_id,
                  S_IRUSR | S_IWUSR)));
     if (fd == -1) {
         PLOG(ERROR) << "Faied to open tmp file: " << tmp_file;
-        return;
+        return false;
     }
 
     if (user_id == USER_SYSTEM) {
@@ -317,7 +355,7 @@ void storaged_t::flush_proto_data(userid_t user_id,
             ret = write(fd, data, MIN(benchmark_unit_size, size));
             if (ret <= 0) {
                 PLOG(ERROR) << "Faied to write tmp file: " << tmp_file;
-                return;
+                return false;
             }
             end = steady_clock::now();
             /*
@@ -340,19 +378,66 @@ void storaged_t::flush_proto_data(userid_t user_id,
     } else {
         if (!WriteFully(fd, data, size)) {
             PLOG(ERROR) << "Faied to write tmp file: " << tmp_file;
-            return;
+            return false;
         }
     }
 
     fd.reset(-1);
-    rename(tmp_file.c_str(), proto_file.c_str());
+    if (rename(tmp_file.c_str(), proto_file.c_str()) != 0) {
+        PLOG(ERROR) << "Faied to rename " << tmp_file;
+        return false;
+    }
+    return true;
 }
 
 void storaged_t::flush_proto(userid_t user_id, StoragedProto* proto) {
+    uid_io_log* log = user_id == USER_SYSTEM ? nullptr : get_uid_io_log(user_id);
+    /*
+     * The new generation must differ from whatever the log holds, so that a
+     * crash before the log is reset below can't replay stale records.
+     */
+    uint64_t generation = max(log_generation[user_id],
+                              log ? log->generation() : 0) + 1;
+    proto->set_log_generation(generation);
+
     unique_ptr<char> proto_data(prepare_proto(user_id, proto));
     if (proto_data == nullptr) return;
 
-    flush_proto_data(user_id, proto_data.get(), proto->ByteSize());
+    if (!flush_proto_data(user_id, proto_data.get(), proto->ByteSize())) return;
+
+    log_generation[user_id] = generation;
+    last_flushed_ts[user_id] = last_end_ts(proto->uid_io_usage());
+    if (log) log->reset(generation);
+}
+
+uid_io_log* storaged_t::get_uid_io_log(userid_t user_id) {
+    auto it = uid_io_logs.find(user_id);
+    if (it != uid_io_logs.end()) return it->second.get();
+
+    auto log = make_unique<uid_io_log>();
+    if (!log->open(log_path(user_id))) return nullptr;
+    return (uid_io_logs[user_id] = std::move(log)).get();
+}
+
+/*
+ * Appends the uid io items newer than the last flush to the user's log.
+ * Returns false if the proto has to be rewritten instead: no proto has been
+ * written yet, the log belongs to another proto, or it is full.
+ */
+bool storaged_t::append_uid_io_log(userid_t user_id, const StoragedProto& proto) {
+    uint64_t generation = log_generation[user_id];
+    if (!generation) return false;
+
+    uid_io_log* log = get_uid_io_log(user_id);
+    if (log == nullptr || log->generation() != generation) return false;
+
+    uint64_t& last_ts = last_flushed_ts[user_id];
+    for (const auto& item : proto.uid_io_usage().uid_io_items()) {
+        if (item.end_ts() <= last_ts) continue;
+        if (!log->append(item)) return false;
+        last_ts = item.end_ts();
+    }
+    return true;
 }
 
 void storaged_t::flush_protos(unordered_map<int, StoragedProto>* protos) {
@@ -362,9 +447,15 @@ void storaged_t::flush_protos(unordered_map<int, StoragedProto>* protos) {
         /*
          * Don't flush proto if we haven't attempted to load it from file.
          */
-        if (proto_loaded[it.first]) {
-            flush_proto(it.first, &it.second);
+        if (!proto_loaded[it.first]) continue;
+        /*
+         * The system user's proto is always rewritten in full since that
+         * write doubles as the storage bandwidth benchmark.
+         */
+        if (it.first != USER_SYSTEM && append_uid_io_log(it.first, it.second)) {
+            continue;
         }
+        flush_proto(it.first, &it.second);
     }
 }
 
@@ -207,6 +207,45 @@ void add_disk_stats(struct disk_stats* src, struct disk_stats* dst)
     }
 }
 
+/* latency_histogram */
+void latency_histogram::record(uint64_t value)
+{
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+    if (bucket >= NR_BUCKETS) bucket = NR_BUCKETS - 1;
+    mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::count() const
+{
+    uint64_t total = 0;
+    for (const auto& bucket : mBuckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t latency_histogram::percentile(uint32_t pct) const
+{
+    uint64_t counts[NR_BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < NR_BUCKETS; i++) {
+        counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) return 0;
+
+    uint64_t rank = (total * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < NR_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            // bucket i holds values in [2^(i-1), 2^i)
+            return i ? (1ULL << i) - 1 : 0;
+        }
+    }
+    return (1ULL << (NR_BUCKETS - 1)) - 1;
+}
+
 /* disk_stats_monitor */
 void disk_stats_monitor::update_mean()
 {
@@ -293,21 +332,66 @@ void disk_stats_monitor::update(struct disk_stats* curr)
     mPrevious = *curr;
 }
 
+bool disk_stats_monitor::get_stats(struct disk_stats* stats) {
+    if (mHealth != nullptr) {
+        return get_disk_stats_from_health_hal(mHealth, stats);
+    }
+    return parse_disk_stats(DISK_STATS_PATH, stats);
+}
+
 void disk_stats_monitor::update() {
     disk_stats curr;
-    if (mHealth != nullptr) {
-        if (!get_disk_stats_from_health_hal(mHealth, &curr)) {
-            return;
-        }
-    } else {
-        if (!parse_disk_stats(DISK_STATS_PATH, &curr)) {
-            return;
-        }
+    if (!get_stats(&curr)) {
+        return;
     }
 
     update(&curr);
 }
 
+void disk_stats_monitor::sample(struct disk_stats* curr)
+{
+    if (mSamplePrevious.end_time == 0) {
+        mSamplePrevious = *curr;
+        return;
+    }
+
+    disk_stats inc;
+    get_inc_disk_stats(&mSamplePrevious, curr, &inc);
+    mSamplePrevious = *curr;
+
+    // diskstats ticks are in ms
+    if (inc.read_ios) {
+        mReadLatency.record(inc.read_ticks * MSEC_TO_USEC / inc.read_ios);
+    }
+    if (inc.write_ios) {
+        mWriteLatency.record(inc.write_ticks * MSEC_TO_USEC / inc.write_ios);
+    }
+    uint64_t elapsed = inc.end_time - inc.start_time;
+    if (inc.io_ticks && elapsed) {
+        mQueueDepth.record((inc.io_in_queue + (elapsed >> 1)) / elapsed);
+    }
+}
+
+void disk_stats_monitor::sample() {
+    disk_stats curr;
+    if (!get_stats(&curr)) {
+        return;
+    }
+
+    sample(&curr);
+}
+
+void disk_stats_monitor::get_latency(struct disk_latency* latency) const
+{
+    latency->nr_samples = mQueueDepth.count();
+    latency->read_p50 = mReadLatency.percentile(50);
+    latency->read_p99 = mReadLatency.percentile(99);
+    latency->write_p50 = mWriteLatency.percentile(50);
+    latency->write_p99 = mWriteLatency.percentile(99);
+    latency->queue_p50 = mQueueDepth.percentile(50);
+    latency->queue_p99 = mQueueDepth.percentile(99);
+}
+
 void disk_stats_monitor::publish(void)
 {
     struct disk_perf perf = get_disk_perf(&mAccumulate_pub);
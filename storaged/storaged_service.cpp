@@ -107,6 +107,8 @@ status_t StoragedService::dump(int fd, const Vector<String16>& args) {
     uint64_t threshold = 0;
     bool force_report = false;
     bool debug = false;
+    bool latency = false;
+    bool tasks = false;
     for (size_t i = 0; i < args.size(); i++) {
         const auto& arg = args[i];
         if (arg == String16("--hours")) {
@@ -138,6 +140,41 @@ status_t StoragedService::dump(int fd, const Vector<String16>& args) {
             debug = true;
             continue;
         }
+        if (arg == String16("--latency")) {
+            latency = true;
+            continue;
+        }
+        if (arg == String16("--tasks")) {
+            tasks = true;
+            continue;
+        }
+    }
+
+    if (latency) {
+        if (!storaged_sp->get_disk_stats_sample_interval()) {
+            dprintf(fd, "diskstats sampling is disabled\n");
+            return OK;
+        }
+        struct disk_latency lat;
+        storaged_sp->get_disk_latency(&lat);
+        dprintf(fd, "samples %" PRIu64 "\n", lat.nr_samples);
+        dprintf(fd, "read_us p50 %" PRIu64 " p99 %" PRIu64 "\n", lat.read_p50, lat.read_p99);
+        dprintf(fd, "write_us p50 %" PRIu64 " p99 %" PRIu64 "\n", lat.write_p50, lat.write_p99);
+        dprintf(fd, "queue p50 %" PRIu64 " p99 %" PRIu64 "\n", lat.queue_p50, lat.queue_p99);
+        return OK;
+    }
+
+    if (tasks) {
+        if (!storaged_sp->get_task_io_sample_interval()) {
+            dprintf(fd, "task I/O sampling is disabled\n");
+            return OK;
+        }
+        for (const auto& task : storaged_sp->get_task_io_samples()) {
+            dprintf(fd, "%u %d %s %s %" PRIu64 " %" PRIu64 "\n", task.uid, task.pid,
+                    task.comm.c_str(), task.state == FOREGROUND ? "fg" : "bg",
+                    task.read_bytes, task.write_bytes);
+        }
+        return OK;
     }
 
     uint64_t last_ts = 0;
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "storaged"
+
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <charconv>
+#include <memory>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "storaged_task_sampler.h"
+#include "storaged_uid_monitor.h"
+
+using namespace android::base;
+
+namespace {
+
+const char* UID_IO_STATS_PATH = "/proc/uid_io/stats";
+
+bool parse_field(std::string_view s, std::string_view key, uint64_t* out)
+{
+    size_t pos = s.find(key);
+    if (pos == std::string_view::npos) return false;
+    s.remove_prefix(pos + key.size());
+    while (!s.empty() && s.front() == ' ') s.remove_prefix(1);
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+    return ec == std::errc() && ptr != s.data();
+}
+
+uint64_t delta(uint64_t curr, uint64_t prev)
+{
+    // counters restart when a pid is reused
+    return curr >= prev ? curr - prev : curr;
+}
+
+} // namespace
+
+bool parse_proc_io(std::string_view s, uint64_t* read_bytes, uint64_t* write_bytes)
+{
+    // "cancelled_write_bytes:" also ends in "write_bytes:", match whole lines
+    return parse_field(s, "\nread_bytes:", read_bytes) &&
+           parse_field(s, "\nwrite_bytes:", write_bytes);
+}
+
+uid_stat_t parse_task_state(std::string_view cgroup)
+{
+    size_t pos = cgroup.find(":cpuset:");
+    if (pos == std::string_view::npos) return FOREGROUND;
+    std::string_view cpuset = cgroup.substr(pos + strlen(":cpuset:"));
+    cpuset = cpuset.substr(0, cpuset.find('\n'));
+    if (cpuset == "/background" || cpuset == "/system-background" ||
+        cpuset == "/restricted") {
+        return BACKGROUND;
+    }
+    return FOREGROUND;
+}
+
+unordered_set<uint32_t> task_io_sampler::get_busy_uids()
+{
+    unordered_set<uint32_t> busy;
+    if (!ReadFileToString(UID_IO_STATS_PATH, &uid_io_buffer_)) {
+        PLOG(ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
+        return busy;
+    }
+
+    vector<pair<uint64_t, uint32_t>> growth;
+    unordered_map<uint32_t, uint64_t> curr_uid_bytes;
+    for (const auto& line : Split(uid_io_buffer_, "\n")) {
+        if (line.empty() || StartsWith(line, "task")) continue;
+        uid_info u;
+        if (!u.parse_uid_io_stats(line)) continue;
+        uint64_t bytes = u.io[FOREGROUND].read_bytes + u.io[FOREGROUND].write_bytes +
+                         u.io[BACKGROUND].read_bytes + u.io[BACKGROUND].write_bytes;
+        curr_uid_bytes[u.uid] = bytes;
+
+        auto prev = prev_uid_bytes_.find(u.uid);
+        if (prev != prev_uid_bytes_.end() && bytes > prev->second) {
+            growth.emplace_back(bytes - prev->second, u.uid);
+        }
+    }
+    prev_uid_bytes_.swap(curr_uid_bytes);
+
+    size_t n = min(top_uids_, growth.size());
+    partial_sort(growth.begin(), growth.begin() + n, growth.end(),
+                 [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (size_t i = 0; i < n; i++) {
+        busy.insert(growth[i].second);
+    }
+    return busy;
+}
+
+void task_io_sampler::sample()
+{
+    unordered_set<uint32_t> uids = get_busy_uids();
+    for (auto& it : prev_tasks_) {
+        it.second.seen = false;
+    }
+
+    vector<task_io_sample> samples;
+    unique_ptr<DIR, decltype(&closedir)> dir(opendir("/proc"), closedir);
+    while (!uids.empty() && dir) {
+        struct dirent* ent = readdir(dir.get());
+        if (ent == nullptr) break;
+
+        pid_t pid;
+        if (!ParseInt(ent->d_name, &pid, 1)) continue;
+
+        string path = string("/proc/") + ent->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !uids.count(st.st_uid)) continue;
+
+        string buffer;
+        uint64_t read_bytes, write_bytes;
+        if (!ReadFileToString(path + "/io", &buffer) ||
+            !parse_proc_io(buffer, &read_bytes, &write_bytes)) {
+            continue;
+        }
+
+        auto prev = prev_tasks_.find(pid);
+        if (prev == prev_tasks_.end()) {
+            // The first sample of a task only sets its baseline.
+            if (prev_tasks_.size() < MAX_TASKS) {
+                prev_tasks_[pid] = {read_bytes, write_bytes, true};
+            }
+            continue;
+        }
+
+        task_io_sample s = {
+            .uid = st.st_uid,
+            .pid = pid,
+            .state = FOREGROUND,
+            .read_bytes = delta(read_bytes, prev->second.read_bytes),
+            .write_bytes = delta(write_bytes, prev->second.write_bytes),
+        };
+        prev->second = {read_bytes, write_bytes, true};
+        if (s.read_bytes + s.write_bytes == 0) continue;
+
+        if (ReadFileToString(path + "/comm", &s.comm)) {
+            s.comm = Trim(s.comm);
+        }
+        if (ReadFileToString(path + "/cgroup", &buffer)) {
+            s.state = parse_task_state(buffer);
+        }
+        samples.push_back(std::move(s));
+    }
+
+    for (auto it = prev_tasks_.begin(); it != prev_tasks_.end();) {
+        it = it->second.seen ? next(it) : prev_tasks_.erase(it);
+    }
+
+    sort(samples.begin(), samples.end(), [](const auto& a, const auto& b) {
+        return a.read_bytes + a.write_bytes > b.read_bytes + b.write_bytes;
+    });
+
+    Mutex::Autolock _l(samples_mutex_);
+    samples_.swap(samples);
+}
+
+vector<task_io_sample> task_io_sampler::dump()
+{
+    Mutex::Autolock _l(samples_mutex_);
+    return samples_;
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "storaged"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <android-base/logging.h>
+
+#include "storaged_uid_io_log.h"
+
+using android::base::unique_fd;
+
+namespace {
+
+void put_varint(string* out, uint64_t v)
+{
+    while (v >= 0x80) {
+        out->push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back(static_cast<char>(v));
+}
+
+/* timestamps may go backwards if the clock is changed */
+void put_signed(string* out, int64_t v)
+{
+    put_varint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+void put_string(string* out, const string& s)
+{
+    put_varint(out, s.size());
+    out->append(s);
+}
+
+void put_io(string* out, const IOUsage& io)
+{
+    put_varint(out, io.rd_fg_chg_on());
+    put_varint(out, io.rd_fg_chg_off());
+    put_varint(out, io.rd_bg_chg_on());
+    put_varint(out, io.rd_bg_chg_off());
+    put_varint(out, io.wr_fg_chg_on());
+    put_varint(out, io.wr_fg_chg_off());
+    put_varint(out, io.wr_bg_chg_on());
+    put_varint(out, io.wr_bg_chg_off());
+}
+
+class reader {
+  public:
+    reader(const uint8_t* data, size_t size) : pos_(data), end_(data + size) {}
+
+    bool done() const { return pos_ == end_; }
+
+    bool get_varint(uint64_t* v)
+    {
+        *v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos_ == end_) return false;
+            uint8_t b = *pos_++;
+            *v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool get_signed(int64_t* v)
+    {
+        uint64_t u;
+        if (!get_varint(&u)) return false;
+        *v = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+        return true;
+    }
+
+    bool get_string(string* s)
+    {
+        uint64_t len;
+        if (!get_varint(&len) || len > static_cast<size_t>(end_ - pos_)) return false;
+        s->assign(reinterpret_cast<const char*>(pos_), len);
+        pos_ += len;
+        return true;
+    }
+
+    bool get_io(IOUsage* io)
+    {
+        uint64_t v[8];
+        for (auto& x : v) {
+            if (!get_varint(&x)) return false;
+        }
+        io->set_rd_fg_chg_on(v[0]);
+        io->set_rd_fg_chg_off(v[1]);
+        io->set_rd_bg_chg_on(v[2]);
+        io->set_rd_bg_chg_off(v[3]);
+        io->set_wr_fg_chg_on(v[4]);
+        io->set_wr_fg_chg_off(v[5]);
+        io->set_wr_bg_chg_on(v[6]);
+        io->set_wr_bg_chg_off(v[7]);
+        return true;
+    }
+
+  private:
+    const uint8_t* pos_;
+    const uint8_t* end_;
+};
+
+/* decodes one record into |item| */
+bool get_item(reader* r, uint64_t* last_end_ts, UidIOItem* item)
+{
+    int64_t end_delta, start_delta;
+    uint64_t nr_entries;
+    if (!r->get_signed(&end_delta) || !r->get_signed(&start_delta) ||
+        !r->get_varint(&nr_entries)) {
+        return false;
+    }
+    *last_end_ts += end_delta;
+    item->set_end_ts(*last_end_ts);
+    UidIORecords* recs = item->mutable_records();
+    recs->set_start_ts(*last_end_ts - start_delta);
+
+    for (uint64_t i = 0; i < nr_entries; i++) {
+        UidRecord* rec = recs->add_entries();
+        uint64_t user_id, nr_tasks;
+        if (!r->get_string(rec->mutable_uid_name()) || !r->get_varint(&user_id) ||
+            !r->get_io(rec->mutable_uid_io()) || !r->get_varint(&nr_tasks)) {
+            return false;
+        }
+        rec->set_user_id(user_id);
+        for (uint64_t j = 0; j < nr_tasks; j++) {
+            TaskIOUsage* task = rec->add_task_io();
+            if (!r->get_string(task->mutable_task_name()) || !r->get_io(task->mutable_ios())) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+uid_io_log::~uid_io_log()
+{
+    unmap();
+}
+
+void uid_io_log::unmap()
+{
+    if (map_ != nullptr) {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+}
+
+bool uid_io_log::sync(const void* addr, size_t len)
+{
+    // msync() needs a page aligned address
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr) & ~(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(addr) + len;
+    if (msync(reinterpret_cast<void*>(start), end - start, MS_SYNC) != 0) {
+        PLOG(ERROR) << "Failed to sync uid io log";
+        return false;
+    }
+    return true;
+}
+
+bool uid_io_log::init(size_t capacity)
+{
+    unmap();
+    size_t size = sizeof(header) + capacity;
+    // the file stays sparse until records are written
+    if (ftruncate(fd_, 0) != 0 || ftruncate(fd_, size) != 0) {
+        PLOG(ERROR) << "Failed to size uid io log";
+        return false;
+    }
+    map_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map_ == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to map uid io log";
+        map_ = nullptr;
+        return false;
+    }
+    map_size_ = size;
+    *hdr() = {
+        .magic = MAGIC,
+        .version = VERSION,
+        .generation = 0,
+        .capacity = capacity,
+        .used = 0,
+        .last_end_ts = 0,
+    };
+    return sync(hdr(), sizeof(header));
+}
+
+bool uid_io_log::open(const string& path, size_t capacity)
+{
+    unmap();
+    fd_.reset(TEMP_FAILURE_RETRY(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+                                        S_IRUSR | S_IWUSR)));
+    if (fd_ == -1) {
+        PLOG(ERROR) << "Failed to open " << path;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        PLOG(ERROR) << "Failed to stat " << path;
+        return false;
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(header)) {
+        return init(capacity);
+    }
+
+    map_ = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map_ == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to map " << path;
+        map_ = nullptr;
+        return false;
+    }
+    map_size_ = st.st_size;
+
+    const header* h = hdr();
+    if (h->magic != MAGIC || h->version != VERSION ||
+        h->capacity != map_size_ - sizeof(header) || h->used > h->capacity) {
+        LOG(WARNING) << "Discarding invalid uid io log " << path;
+        return init(capacity);
+    }
+    return true;
+}
+
+uint64_t uid_io_log::generation() const
+{
+    return map_ ? hdr()->generation : 0;
+}
+
+bool uid_io_log::reset(uint64_t generation)
+{
+    if (!map_) return false;
+    header* h = hdr();
+    h->generation = generation;
+    h->used = 0;
+    h->last_end_ts = 0;
+    return sync(h, sizeof(header));
+}
+
+bool uid_io_log::append(const UidIOItem& item)
+{
+    if (!map_) return false;
+    header* h = hdr();
+
+    string rec;
+    const UidIORecords& recs = item.records();
+    put_signed(&rec, item.end_ts() - h->last_end_ts);
+    put_signed(&rec, item.end_ts() - recs.start_ts());
+    put_varint(&rec, recs.entries_size());
+    for (const auto& entry : recs.entries()) {
+        put_string(&rec, entry.uid_name());
+        put_varint(&rec, entry.user_id());
+        put_io(&rec, entry.uid_io());
+        put_varint(&rec, entry.task_io_size());
+        for (const auto& task : entry.task_io()) {
+            put_string(&rec, task.task_name());
+            put_io(&rec, task.ios());
+        }
+    }
+
+    if (rec.size() > h->capacity - h->used) {
+        return false;
+    }
+
+    // The record only becomes visible once the header says so, so a crash
+    // in between loses it rather than leaving a torn record behind.
+    uint8_t* dst = records() + h->used;
+    memcpy(dst, rec.data(), rec.size());
+    if (!sync(dst, rec.size())) return false;
+    h->used += rec.size();
+    h->last_end_ts = item.end_ts();
+    return sync(h, sizeof(header));
+}
+
+bool uid_io_log::replay(UidIOUsage* usage) const
+{
+    if (!map_) return false;
+    const header* h = hdr();
+
+    reader r(records(), h->used);
+    uint64_t last_end_ts = 0;
+    while (!r.done()) {
+        UidIOItem item;
+        if (!get_item(&r, &last_end_ts, &item)) {
+            LOG(WARNING) << "Corrupt uid io log record";
+            return false;
+        }
+        *usage->add_uid_io_items() = item;
+    }
+    return true;
+}
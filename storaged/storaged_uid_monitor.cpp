@@ -17,9 +17,13 @@
 #define LOG_TAG "storaged"
 
 #include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 
+#include <charconv>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -32,6 +36,7 @@
 #include <android-base/stringprintf.h>
 #include <binder/IServiceManager.h>
 #include <log/log_event_list.h>
+#include <packagelistparser/packagelistparser.h>
 
 #include "storaged.h"
 #include "storaged_uid_monitor.h"
@@ -44,8 +49,36 @@ using namespace storaged_proto;
 
 namespace {
 
-bool refresh_uid_names;
 const char* UID_IO_STATS_PATH = "/proc/uid_io/stats";
+// read by packagelist_parse()
+const char* PACKAGES_LIST_PATH = "/data/system/packages.list";
+
+/* parses |s|, which must hold nothing but the number */
+template <typename T>
+bool parse_number(std::string_view s, T* out)
+{
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+    return ec == std::errc() && ptr == s.data() + s.size();
+}
+
+/* calls |fn| on each non-empty line of |buffer| */
+template <typename Fn>
+void for_each_line(std::string_view buffer, Fn fn)
+{
+    while (!buffer.empty()) {
+        size_t end = buffer.find('\n');
+        std::string_view line = buffer.substr(0, end);
+        buffer.remove_prefix(end == std::string_view::npos ? buffer.size() : end + 1);
+        if (!line.empty()) {
+            fn(line);
+        }
+    }
+}
+
+bool is_task_line(std::string_view line)
+{
+    return line.compare(0, 4, "task") == 0;
+}
 
 } // namepsace
 
@@ -56,21 +89,28 @@ std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats()
 };
 
 /* return true on parse success and false on failure */
-bool uid_info::parse_uid_io_stats(std::string&& s)
+bool uid_info::parse_uid_io_stats(std::string_view s)
 {
-    std::vector<std::string> fields = Split(s, " ");
-    if (fields.size() < 11 ||
-        !ParseUint(fields[0],  &uid) ||
-        !ParseUint(fields[1],  &io[FOREGROUND].rchar) ||
-        !ParseUint(fields[2],  &io[FOREGROUND].wchar) ||
-        !ParseUint(fields[3],  &io[FOREGROUND].read_bytes) ||
-        !ParseUint(fields[4],  &io[FOREGROUND].write_bytes) ||
-        !ParseUint(fields[5],  &io[BACKGROUND].rchar) ||
-        !ParseUint(fields[6],  &io[BACKGROUND].wchar) ||
-        !ParseUint(fields[7],  &io[BACKGROUND].read_bytes) ||
-        !ParseUint(fields[8],  &io[BACKGROUND].write_bytes) ||
-        !ParseUint(fields[9],  &io[FOREGROUND].fsync) ||
-        !ParseUint(fields[10], &io[BACKGROUND].fsync)) {
+    std::string_view fields[11];
+    std::string_view rest = s;
+    size_t count = 0;
+    while (count < 11 && !rest.empty()) {
+        size_t end = rest.find(' ');
+        fields[count++] = rest.substr(0, end);
+        rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+    }
+    if (count < 11 ||
+        !parse_number(fields[0],  &uid) ||
+        !parse_number(fields[1],  &io[FOREGROUND].rchar) ||
+        !parse_number(fields[2],  &io[FOREGROUND].wchar) ||
+        !parse_number(fields[3],  &io[FOREGROUND].read_bytes) ||
+        !parse_number(fields[4],  &io[FOREGROUND].write_bytes) ||
+        !parse_number(fields[5],  &io[BACKGROUND].rchar) ||
+        !parse_number(fields[6],  &io[BACKGROUND].wchar) ||
+        !parse_number(fields[7],  &io[BACKGROUND].read_bytes) ||
+        !parse_number(fields[8],  &io[BACKGROUND].write_bytes) ||
+        !parse_number(fields[9],  &io[FOREGROUND].fsync) ||
+        !parse_number(fields[10], &io[BACKGROUND].fsync)) {
         LOG(WARNING) << "Invalid uid I/O stats: \"" << s << "\"";
         return false;
     }
@@ -78,27 +118,38 @@ bool uid_info::parse_uid_io_stats(std::string&& s)
 }
 
 /* return true on parse success and false on failure */
-bool task_info::parse_task_io_stats(std::string&& s)
+bool task_info::parse_task_io_stats(std::string_view s)
 {
-    std::vector<std::string> fields = Split(s, ",");
-    size_t size = fields.size();
-    if (size < 13 ||
-        !ParseInt(fields[size - 11],  &pid) ||
-        !ParseUint(fields[size - 10],  &io[FOREGROUND].rchar) ||
-        !ParseUint(fields[size - 9],  &io[FOREGROUND].wchar) ||
-        !ParseUint(fields[size - 8],  &io[FOREGROUND].read_bytes) ||
-        !ParseUint(fields[size - 7],  &io[FOREGROUND].write_bytes) ||
-        !ParseUint(fields[size - 6],  &io[BACKGROUND].rchar) ||
-        !ParseUint(fields[size - 5],  &io[BACKGROUND].wchar) ||
-        !ParseUint(fields[size - 4],  &io[BACKGROUND].read_bytes) ||
-        !ParseUint(fields[size - 3], &io[BACKGROUND].write_bytes) ||
-        !ParseUint(fields[size - 2], &io[FOREGROUND].fsync) ||
-        !ParseUint(fields[size - 1], &io[BACKGROUND].fsync)) {
+    // The task name may contain commas, so take the 11 numbers from the end.
+    std::string_view fields[11];
+    std::string_view head = s;
+    for (int i = 10; i >= 0; i--) {
+        size_t start = head.rfind(',');
+        if (start == std::string_view::npos) {
+            LOG(WARNING) << "Invalid task I/O stats: \"" << s << "\"";
+            return false;
+        }
+        fields[i] = head.substr(start + 1);
+        head = head.substr(0, start);
+    }
+    // what is left is "task,<comm>"
+    size_t comm_start = head.find(',');
+    if (comm_start == std::string_view::npos ||
+        !parse_number(fields[0],  &pid) ||
+        !parse_number(fields[1],  &io[FOREGROUND].rchar) ||
+        !parse_number(fields[2],  &io[FOREGROUND].wchar) ||
+        !parse_number(fields[3],  &io[FOREGROUND].read_bytes) ||
+        !parse_number(fields[4],  &io[FOREGROUND].write_bytes) ||
+        !parse_number(fields[5],  &io[BACKGROUND].rchar) ||
+        !parse_number(fields[6],  &io[BACKGROUND].wchar) ||
+        !parse_number(fields[7],  &io[BACKGROUND].read_bytes) ||
+        !parse_number(fields[8], &io[BACKGROUND].write_bytes) ||
+        !parse_number(fields[9], &io[FOREGROUND].fsync) ||
+        !parse_number(fields[10], &io[BACKGROUND].fsync)) {
         LOG(WARNING) << "Invalid task I/O stats: \"" << s << "\"";
         return false;
     }
-    comm = Join(std::vector<std::string>(
-                fields.begin() + 1, fields.end() - 11), ',');
+    comm.assign(head.substr(comm_start + 1));
     return true;
 }
 
@@ -117,81 +168,160 @@ bool io_usage::is_zero() const
 
 namespace {
 
-void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_names)
+/* returns false if the package manager can't be reached */
+bool get_uid_names(const vector<int>& uids, vector<std::string>* names)
 {
     sp<IServiceManager> sm = defaultServiceManager();
     if (sm == NULL) {
         LOG(ERROR) << "defaultServiceManager failed";
-        return;
+        return false;
     }
 
     sp<IBinder> binder = sm->getService(String16("package_native"));
     if (binder == NULL) {
         LOG(ERROR) << "getService package_native failed";
-        return;
+        return false;
     }
 
     sp<IPackageManagerNative> package_mgr = interface_cast<IPackageManagerNative>(binder);
-    std::vector<std::string> names;
-    binder::Status status = package_mgr->getNamesForUids(uids, &names);
+    binder::Status status = package_mgr->getNamesForUids(uids, names);
     if (!status.isOk()) {
         LOG(ERROR) << "package_native::getNamesForUids failed: " << status.exceptionMessage();
-        return;
+        return false;
     }
+    return names->size() == uids.size();
+}
 
-    for (uint32_t i = 0; i < uid_names.size(); i++) {
-        if (!names[i].empty()) {
-            *uid_names[i] = names[i];
-        }
-    }
+bool add_package_list_name(pkg_info* info, void* user_data)
+{
+    auto* names = static_cast<std::unordered_map<uint32_t, std::string>*>(user_data);
+    // keep the first package of a shared uid
+    names->emplace(info->uid, info->name);
+    packagelist_free(info);
+    return true;
+}
 
-    refresh_uid_names = false;
+/*
+ * returns in |delta| how much the bytes read and written in |curr| grew over |prev|, charged to
+ * |charger_stat|. Counters that went backwards count as zero. Returns false if nothing grew.
+ */
+bool get_io_delta(const io_stats* prev, const io_stats* curr, charger_stat_t charger_stat,
+                  io_usage* delta)
+{
+    bool changed = false;
+    for (int i = 0; i < UID_STATS; i++) {
+        uint64_t rd = curr[i].read_bytes > prev[i].read_bytes ?
+                curr[i].read_bytes - prev[i].read_bytes : 0;
+        uint64_t wr = curr[i].write_bytes > prev[i].write_bytes ?
+                curr[i].write_bytes - prev[i].write_bytes : 0;
+        delta->bytes[READ][i][charger_stat] = rd;
+        delta->bytes[WRITE][i][charger_stat] = wr;
+        changed |= rd || wr;
+    }
+    return changed;
 }
 
 } // namespace
 
-std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats_locked()
+void uid_monitor::invalidate_uid_names_locked()
 {
-    std::unordered_map<uint32_t, uid_info> uid_io_stats;
-    std::string buffer;
-    if (!ReadFileToString(UID_IO_STATS_PATH, &buffer)) {
-        PLOG(ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
-        return uid_io_stats;
+    struct stat st;
+    if (stat(PACKAGES_LIST_PATH, &st) != 0) {
+        return;
+    }
+    if (st.st_mtim.tv_sec == package_list_mtime_.tv_sec &&
+        st.st_mtim.tv_nsec == package_list_mtime_.tv_nsec) {
+        return;
     }
 
-    std::vector<std::string> io_stats = Split(std::move(buffer), "\n");
-    uid_info u;
-    vector<int> uids;
-    vector<std::string*> uid_names;
+    std::unordered_map<uint32_t, std::string> names;
+    if (!packagelist_parse(add_package_list_name, &names)) {
+        LOG(WARNING) << "Failed to parse " << PACKAGES_LIST_PATH;
+        return;
+    }
+    package_list_mtime_ = st.st_mtim;
 
-    for (uint32_t i = 0; i < io_stats.size(); i++) {
-        if (io_stats[i].empty()) {
-            continue;
+    // uids that were installed, removed or given to another package since the last parse
+    for (const auto& [uid, name] : package_list_names_) {
+        auto it = names.find(uid);
+        if (it == names.end() || it->second != name) {
+            uid_names_.erase(uid);
         }
+    }
+    for (const auto& [uid, name] : names) {
+        if (package_list_names_.find(uid) == package_list_names_.end()) {
+            uid_names_.erase(uid);
+        }
+    }
+    package_list_names_ = std::move(names);
+}
 
-        if (io_stats[i].compare(0, 4, "task")) {
-            if (!u.parse_uid_io_stats(std::move(io_stats[i])))
-                continue;
-            uid_io_stats[u.uid] = u;
-            uid_io_stats[u.uid].name = std::to_string(u.uid);
-            uids.push_back(u.uid);
-            uid_names.push_back(&uid_io_stats[u.uid].name);
-            if (last_uid_io_stats_.find(u.uid) == last_uid_io_stats_.end()) {
-                refresh_uid_names = true;
-            } else {
-                uid_io_stats[u.uid].name = last_uid_io_stats_[u.uid].name;
-            }
-        } else {
-            task_info t;
-            if (!t.parse_task_io_stats(std::move(io_stats[i])))
-                continue;
-            uid_io_stats[u.uid].tasks[t.pid] = t;
+void uid_monitor::resolve_uid_names_locked()
+{
+    vector<int> uids;
+    std::unordered_set<uint32_t> seen;
+    for_each_line(uid_io_buffer_, [&](std::string_view line) {
+        if (is_task_line(line)) {
+            return;
         }
+        uint32_t uid;
+        if (parse_number(line.substr(0, line.find(' ')), &uid) &&
+            uid_names_.find(uid) == uid_names_.end() && seen.insert(uid).second) {
+            uids.push_back(uid);
+        }
+    });
+    if (uids.empty()) {
+        return;
+    }
+
+    vector<std::string> names;
+    if (!get_uid_names(uids, &names)) {
+        // try again on the next collection
+        return;
+    }
+    for (size_t i = 0; i < uids.size(); i++) {
+        uid_names_[uids[i]] = names[i].empty() ? std::to_string(uids[i]) : names[i];
+    }
+}
+
+void uid_monitor::get_uid_name_locked(uint32_t uid, std::string* name)
+{
+    auto it = uid_names_.find(uid);
+    if (it != uid_names_.end()) {
+        *name = it->second;
+    } else {
+        // not resolved yet, the next collection retries
+        *name = std::to_string(uid);
     }
+}
 
-    if (!uids.empty() && refresh_uid_names) {
-        get_uid_names(uids, uid_names);
+std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats_locked()
+{
+    std::unordered_map<uint32_t, uid_info> uid_io_stats;
+    if (!ReadFileToString(UID_IO_STATS_PATH, &uid_io_buffer_)) {
+        PLOG(ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
+        return uid_io_stats;
     }
+    invalidate_uid_names_locked();
+    resolve_uid_names_locked();
+
+    uid_info* curr = nullptr;
+    for_each_line(uid_io_buffer_, [&](std::string_view line) {
+        if (!is_task_line(line)) {
+            uid_info u;
+            curr = nullptr;
+            if (!u.parse_uid_io_stats(line))
+                return;
+            curr = &uid_io_stats[u.uid];
+            *curr = u;
+            get_uid_name_locked(u.uid, &curr->name);
+        } else if (curr != nullptr) {
+            task_info t;
+            if (!t.parse_task_io_stats(line))
+                return;
+            curr->tasks[t.pid] = t;
+        }
+    });
 
     return uid_io_stats;
 }
@@ -302,65 +432,83 @@ std::map<uint64_t, struct uid_records> uid_monitor::dump(
 
 void uid_monitor::update_curr_io_stats_locked()
 {
-    std::unordered_map<uint32_t, uid_info> uid_io_stats =
-        get_uid_io_stats_locked();
-    if (uid_io_stats.empty()) {
+    if (!ReadFileToString(UID_IO_STATS_PATH, &uid_io_buffer_)) {
+        PLOG(ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
         return;
     }
-
-    for (const auto& it : uid_io_stats) {
-        const uid_info& uid = it.second;
-        if (curr_io_stats_.find(uid.name) == curr_io_stats_.end()) {
-            curr_io_stats_[uid.name] = {};
+    if (uid_io_buffer_.empty()) {
+        return;
+    }
+    invalidate_uid_names_locked();
+    resolve_uid_names_locked();
+
+    // Update last_uid_io_stats_ in place, moving its entries over from the previous dump rather
+    // than building a new map. Uids and tasks that are gone are dropped with what is left behind.
+    prev_uid_io_stats_.swap(last_uid_io_stats_);
+
+    uid_info* curr = nullptr;
+    uid_io_usage* usage = nullptr;
+    auto get_usage = [&]() -> uid_io_usage& {
+        // only uids whose I/O grew get an entry
+        if (usage == nullptr) {
+            usage = &curr_io_stats_[curr->name];
+            usage->user_id = multiuser_get_user_id(curr->uid);
         }
+        return *usage;
+    };
+
+    for_each_line(uid_io_buffer_, [&](std::string_view line) {
+        if (!is_task_line(line)) {
+            prev_tasks_.clear();
+            curr = nullptr;
+            usage = nullptr;
+
+            uid_info u;
+            if (!u.parse_uid_io_stats(line))
+                return;
+
+            auto node = prev_uid_io_stats_.extract(u.uid);
+            if (node.empty()) {
+                curr = &last_uid_io_stats_[u.uid];
+                curr->uid = u.uid;
+                memset(curr->io, 0, sizeof(curr->io));
+            } else {
+                curr = &last_uid_io_stats_.insert(std::move(node)).position->second;
+            }
+            get_uid_name_locked(u.uid, &curr->name);
+
+            io_usage delta;
+            if (get_io_delta(curr->io, u.io, charger_stat_, &delta)) {
+                get_usage().uid_ios += delta;
+            }
+            memcpy(curr->io, u.io, sizeof(curr->io));
+            prev_tasks_.swap(curr->tasks);
+        } else if (curr != nullptr) {
+            task_info t;
+            if (!t.parse_task_io_stats(line))
+                return;
+
+            auto node = prev_tasks_.extract(t.pid);
+            task_info* task;
+            if (node.empty()) {
+                task = &curr->tasks[t.pid];
+                memset(task->io, 0, sizeof(task->io));
+            } else {
+                task = &curr->tasks.insert(std::move(node)).position->second;
+            }
 
-        struct uid_io_usage& usage = curr_io_stats_[uid.name];
-        usage.user_id = multiuser_get_user_id(uid.uid);
-
-        int64_t fg_rd_delta = uid.io[FOREGROUND].read_bytes -
-            last_uid_io_stats_[uid.uid].io[FOREGROUND].read_bytes;
-        int64_t bg_rd_delta = uid.io[BACKGROUND].read_bytes -
-            last_uid_io_stats_[uid.uid].io[BACKGROUND].read_bytes;
-        int64_t fg_wr_delta = uid.io[FOREGROUND].write_bytes -
-            last_uid_io_stats_[uid.uid].io[FOREGROUND].write_bytes;
-        int64_t bg_wr_delta = uid.io[BACKGROUND].write_bytes -
-            last_uid_io_stats_[uid.uid].io[BACKGROUND].write_bytes;
-
-        usage.uid_ios.bytes[READ][FOREGROUND][charger_stat_] +=
-            (fg_rd_delta < 0) ? 0 : fg_rd_delta;
-        usage.uid_ios.bytes[READ][BACKGROUND][charger_stat_] +=
-            (bg_rd_delta < 0) ? 0 : bg_rd_delta;
-        usage.uid_ios.bytes[WRITE][FOREGROUND][charger_stat_] +=
-            (fg_wr_delta < 0) ? 0 : fg_wr_delta;
-        usage.uid_ios.bytes[WRITE][BACKGROUND][charger_stat_] +=
-            (bg_wr_delta < 0) ? 0 : bg_wr_delta;
-
-        for (const auto& task_it : uid.tasks) {
-            const task_info& task = task_it.second;
-            const pid_t pid = task_it.first;
-            const std::string& comm = task_it.second.comm;
-            int64_t task_fg_rd_delta = task.io[FOREGROUND].read_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[FOREGROUND].read_bytes;
-            int64_t task_bg_rd_delta = task.io[BACKGROUND].read_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[BACKGROUND].read_bytes;
-            int64_t task_fg_wr_delta = task.io[FOREGROUND].write_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[FOREGROUND].write_bytes;
-            int64_t task_bg_wr_delta = task.io[BACKGROUND].write_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[BACKGROUND].write_bytes;
-
-            io_usage& task_usage = usage.task_ios[comm];
-            task_usage.bytes[READ][FOREGROUND][charger_stat_] +=
-                (task_fg_rd_delta < 0) ? 0 : task_fg_rd_delta;
-            task_usage.bytes[READ][BACKGROUND][charger_stat_] +=
-                (task_bg_rd_delta < 0) ? 0 : task_bg_rd_delta;
-            task_usage.bytes[WRITE][FOREGROUND][charger_stat_] +=
-                (task_fg_wr_delta < 0) ? 0 : task_fg_wr_delta;
-            task_usage.bytes[WRITE][BACKGROUND][charger_stat_] +=
-                (task_bg_wr_delta < 0) ? 0 : task_bg_wr_delta;
+            io_usage delta;
+            if (get_io_delta(task->io, t.io, charger_stat_, &delta)) {
+                get_usage().task_ios[t.comm] += delta;
+            }
+            task->pid = t.pid;
+            task->comm = std::move(t.comm);
+            memcpy(task->io, t.io, sizeof(task->io));
         }
-    }
+    });
 
-    last_uid_io_stats_ = uid_io_stats;
+    prev_tasks_.clear();
+    prev_uid_io_stats_.clear();
 }
 
 void uid_monitor::report(unordered_map<int, StoragedProto>* protos)
@@ -536,5 +684,5 @@ void uid_monitor::init(charger_stat_t stat)
 }
 
 uid_monitor::uid_monitor()
-    : enabled_(!access(UID_IO_STATS_PATH, R_OK)) {
+    : package_list_mtime_{}, enabled_(!access(UID_IO_STATS_PATH, R_OK)) {
 }
@@ -26,6 +26,7 @@
 #include <gtest/gtest.h>
 
 #include <aidl/android/hardware/health/IHealth.h>
+#include <android-base/file.h>
 #include <healthhalutils/HealthHalUtils.h>
 #include <storaged.h>               // data structures
 #include <storaged_utils.h>         // functions to test
@@ -368,6 +369,47 @@ TEST(storaged_test, disk_stats_monitor) {
     }
 }
 
+TEST(storaged_test, latency_histogram) {
+    latency_histogram hist;
+    EXPECT_EQ(hist.percentile(50), 0UL);
+
+    for (int i = 0; i < 98; i++) {
+        hist.record(100);
+    }
+    hist.record(5000);
+    hist.record(5000);
+    EXPECT_EQ(hist.count(), 100UL);
+    EXPECT_EQ(hist.percentile(50), 127UL);
+    EXPECT_EQ(hist.percentile(98), 127UL);
+    EXPECT_EQ(hist.percentile(99), 8191UL);
+}
+
+TEST(storaged_test, disk_stats_sample) {
+    disk_stats_monitor dsm(nullptr);
+    struct disk_stats stats = {};
+    stats.end_time = 1000;
+    dsm.sample(&stats);
+
+    // 10 reads taking 20ms and 4 writes taking 2ms over 100ms
+    for (int i = 0; i < 10; i++) {
+        stats.read_ios += 10;
+        stats.read_ticks += 20;
+        stats.write_ios += 4;
+        stats.write_ticks += 2;
+        stats.io_ticks += 50;
+        stats.io_in_queue += 300;
+        stats.end_time += 100;
+        dsm.sample(&stats);
+    }
+
+    struct disk_latency latency;
+    dsm.get_latency(&latency);
+    EXPECT_EQ(latency.nr_samples, 10UL);
+    EXPECT_EQ(latency.read_p50, 2047UL);
+    EXPECT_EQ(latency.write_p99, 511UL);
+    EXPECT_EQ(latency.queue_p50, 3UL);
+}
+
 TEST(storaged_test, storage_info_t) {
     storage_info_t si;
     time_point<steady_clock> tp;
@@ -695,3 +737,97 @@ TEST(storaged_test, load_uid_io_proto) {
     uidm.load_uid_io_proto(0, user_0);
     ASSERT_LE(io_history.size(), size_t(uid_monitor::MAX_UID_RECORDS_SIZE));
 }
+
+TEST(storaged_test, parse_uid_io_stats) {
+    uid_info uid;
+    ASSERT_TRUE(uid.parse_uid_io_stats("10001 1 2 3 4 5 6 7 8 9 10"));
+    EXPECT_EQ(uid.uid, 10001UL);
+    EXPECT_EQ(uid.io[FOREGROUND].read_bytes, 3UL);
+    EXPECT_EQ(uid.io[BACKGROUND].write_bytes, 8UL);
+    EXPECT_EQ(uid.io[BACKGROUND].fsync, 10UL);
+    EXPECT_FALSE(uid.parse_uid_io_stats("10001 1 2 3"));
+    EXPECT_FALSE(uid.parse_uid_io_stats("10001 1 2 3 4 5 6 7 8 9 x"));
+
+    // Task names may contain commas.
+    task_info task;
+    ASSERT_TRUE(task.parse_task_io_stats("task,Binder:1,2,123,1,2,3,4,5,6,7,8,9,10"));
+    EXPECT_EQ(task.comm, "Binder:1,2");
+    EXPECT_EQ(task.pid, 123);
+    EXPECT_EQ(task.io[FOREGROUND].write_bytes, 4UL);
+    EXPECT_EQ(task.io[BACKGROUND].fsync, 10UL);
+    EXPECT_FALSE(task.parse_task_io_stats("task,123,1,2,3,4,5,6,7,8,9,10"));
+}
+
+TEST(storaged_test, uid_io_log) {
+    TemporaryFile tf;
+    UidIOUsage usage;
+    for (uint64_t ts = 3600; ts <= 3 * 3600; ts += 3600) {
+        UidIOItem* item = usage.add_uid_io_items();
+        item->set_end_ts(ts);
+        UidIORecords* recs = item->mutable_records();
+        recs->set_start_ts(ts - 3600);
+        UidRecord* rec = recs->add_entries();
+        rec->set_uid_name("app" + to_string(ts));
+        rec->set_user_id(10);
+        rec->mutable_uid_io()->set_wr_fg_chg_on(ts * 1000);
+        TaskIOUsage* task = rec->add_task_io();
+        task->set_task_name("task");
+        task->mutable_ios()->set_rd_bg_chg_off(ts);
+    }
+
+    {
+        uid_io_log log;
+        ASSERT_TRUE(log.open(tf.path));
+        ASSERT_TRUE(log.reset(7));
+        for (const auto& item : usage.uid_io_items()) {
+            ASSERT_TRUE(log.append(item));
+        }
+    }
+
+    uid_io_log log;
+    ASSERT_TRUE(log.open(tf.path));
+    EXPECT_EQ(log.generation(), 7UL);
+    UidIOUsage replayed;
+    ASSERT_TRUE(log.replay(&replayed));
+    ASSERT_EQ(replayed.uid_io_items_size(), usage.uid_io_items_size());
+    for (int i = 0; i < usage.uid_io_items_size(); i++) {
+        const UidIOItem& expected = usage.uid_io_items(i);
+        const UidIOItem& actual = replayed.uid_io_items(i);
+        EXPECT_EQ(actual.end_ts(), expected.end_ts());
+        EXPECT_EQ(actual.records().start_ts(), expected.records().start_ts());
+        ASSERT_EQ(actual.records().entries_size(), 1);
+        const UidRecord& rec = actual.records().entries(0);
+        EXPECT_EQ(rec.uid_name(), expected.records().entries(0).uid_name());
+        EXPECT_EQ(rec.user_id(), 10U);
+        EXPECT_EQ(rec.uid_io().wr_fg_chg_on(), expected.end_ts() * 1000);
+        ASSERT_EQ(rec.task_io_size(), 1);
+        EXPECT_EQ(rec.task_io(0).task_name(), "task");
+        EXPECT_EQ(rec.task_io(0).ios().rd_bg_chg_off(), expected.end_ts());
+    }
+
+    // Records that don't fit are rejected.
+    uid_io_log small;
+    TemporaryFile tf2;
+    ASSERT_TRUE(small.open(tf2.path, 16));
+    EXPECT_FALSE(small.append(usage.uid_io_items(0)));
+
+    ASSERT_TRUE(log.reset(8));
+    replayed.Clear();
+    ASSERT_TRUE(log.replay(&replayed));
+    EXPECT_EQ(replayed.uid_io_items_size(), 0);
+}
+
+TEST(storaged_test, task_io_sampler_parsers) {
+    uint64_t read_bytes = 0, write_bytes = 0;
+    ASSERT_TRUE(parse_proc_io("rchar: 100\nwchar: 200\nsyscr: 3\nsyscw: 4\n"
+                              "read_bytes: 4096\nwrite_bytes: 8192\n"
+                              "cancelled_write_bytes: 512\n",
+                              &read_bytes, &write_bytes));
+    EXPECT_EQ(read_bytes, 4096UL);
+    EXPECT_EQ(write_bytes, 8192UL);
+    EXPECT_FALSE(parse_proc_io("rchar: 100\nwchar: 200\n", &read_bytes, &write_bytes));
+
+    EXPECT_EQ(parse_task_state("1:cpuset:/background\n0::/uid_10001/pid_123\n"), BACKGROUND);
+    EXPECT_EQ(parse_task_state("1:cpuset:/top-app\n0::/uid_10001/pid_123\n"), FOREGROUND);
+    EXPECT_EQ(parse_task_state("0::/uid_10001/pid_123\n"), FOREGROUND);
+}
@@ -26,6 +26,8 @@ const uint32_t TRUSTY_KEYMASTER_RECV_BUF_SIZE = 2 * PAGE_SIZE;
 const uint32_t TRUSTY_KEYMASTER_SEND_BUF_SIZE =
         (PAGE_SIZE - sizeof(struct keymaster_message) - 16 /* tipc header */);
 
+// Calls may be made from several threads at once; each is dispatched over its own channel to
+// the TA, with up to a small fixed number of channels opened as needed.
 int trusty_keymaster_connect(void);
 int trusty_keymaster_call(uint32_t cmd, void* in, uint32_t in_size, uint8_t* out,
                           uint32_t* out_size);
@@ -26,6 +26,8 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include <variant>
 #include <vector>
 
@@ -38,21 +40,103 @@
 
 #define TRUSTY_DEVICE_NAME "/dev/trusty-ipc-dev0"
 
-static int handle_ = -1;
-
 static const int timeout_ms = 10 * 1000;
 static const int max_timeout_ms = 60 * 1000;
 
+// Calls are dispatched over a pool of channels so that concurrent callers don't queue behind
+// one another's round trips. Channels beyond the first are opened on demand, so single-threaded
+// clients only ever use one.
+static const size_t kMaxChannels = 4;
+
+static std::mutex channels_lock_;
+static std::condition_variable channel_released_;
+static std::vector<int> idle_channels_;
+static size_t open_channels_ = 0;
+static size_t max_channels_ = kMaxChannels;
+static bool connected_ = false;
+
 int trusty_keymaster_connect() {
+    std::lock_guard<std::mutex> lock(channels_lock_);
+    if (connected_ && open_channels_ > 0) {
+        return 0;
+    }
+
     int rc = tipc_connect(TRUSTY_DEVICE_NAME, KEYMASTER_PORT);
     if (rc < 0) {
         return rc;
     }
 
-    handle_ = rc;
+    idle_channels_.push_back(rc);
+    open_channels_++;
+    max_channels_ = kMaxChannels;
+    connected_ = true;
     return 0;
 }
 
+// Returns an idle channel, opening a new one if all are busy and the pool isn't full, or a
+// negative error.
+static int AcquireChannel() {
+    std::unique_lock<std::mutex> lock(channels_lock_);
+    while (true) {
+        if (!connected_) {
+            return -EINVAL;
+        }
+        if (!idle_channels_.empty()) {
+            int handle = idle_channels_.back();
+            idle_channels_.pop_back();
+            return handle;
+        }
+        if (open_channels_ < max_channels_) {
+            open_channels_++;
+            lock.unlock();
+            int rc = tipc_connect(TRUSTY_DEVICE_NAME, KEYMASTER_PORT);
+            lock.lock();
+            if (rc >= 0) {
+                return rc;
+            }
+            open_channels_--;
+            if (open_channels_ == 0) {
+                return rc;
+            }
+            // The TA won't take more connections; make do with the ones we have.
+            ALOGW("failed to open additional channel to %s: %d\n", KEYMASTER_PORT, rc);
+            max_channels_ = open_channels_;
+        }
+        channel_released_.wait(lock);
+    }
+}
+
+// Returns a channel to the pool. Channels that failed are closed, so that the next caller
+// reconnects instead of reusing a channel in an unknown state.
+static void ReleaseChannel(int handle, bool failed) {
+    std::lock_guard<std::mutex> lock(channels_lock_);
+    if (failed || !connected_) {
+        tipc_close(handle);
+        open_channels_--;
+    } else {
+        idle_channels_.push_back(handle);
+    }
+    channel_released_.notify_one();
+}
+
+class ChannelLease {
+  public:
+    ChannelLease() : handle_(AcquireChannel()) {}
+    ~ChannelLease() {
+        if (handle_ >= 0) {
+            ReleaseChannel(handle_, failed_);
+        }
+    }
+    int get() const { return handle_; }
+    void succeeded() { failed_ = false; }
+    ChannelLease(const ChannelLease&) = delete;
+    ChannelLease& operator=(const ChannelLease&) = delete;
+
+  private:
+    int handle_;
+    bool failed_ = true;
+};
+
 class VectorEraser {
   public:
     VectorEraser(std::vector<uint8_t>* v) : _v(v) {}
@@ -74,9 +158,11 @@ class VectorEraser {
 
 std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, void* in,
                                                                 uint32_t in_size) {
-    if (handle_ < 0) {
+    ChannelLease channel;
+    int handle = channel.get();
+    if (handle < 0) {
         ALOGE("not connected\n");
-        return -EINVAL;
+        return handle;
     }
 
     size_t msg_size = in_size + sizeof(struct keymaster_message);
@@ -94,7 +180,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
     int poll_timeout_ms = timeout_ms;
     while (true) {
         struct pollfd pfd;
-        pfd.fd = handle_;
+        pfd.fd = handle;
         pfd.events = POLLOUT;
         pfd.revents = 0;
 
@@ -116,7 +202,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
         break;
     }
 
-    ssize_t rc = write(handle_, msg, msg_size);
+    ssize_t rc = write(handle, msg, msg_size);
     if (timed_out) {
         ALOGW("write for cmd %d finished after %lld nsecs", cmd,
               (long long)(systemTime(SYSTEM_TIME_MONOTONIC) - start_time_ns));
@@ -163,7 +249,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
         poll_timeout_ms = timeout_ms;
         while (true) {
             struct pollfd pfd;
-            pfd.fd = handle_;
+            pfd.fd = handle;
             pfd.events = POLLIN;
             pfd.revents = 0;
 
@@ -184,7 +270,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
             }
             break;
         }
-        rc = readv(handle_, iov, 2);
+        rc = readv(handle, iov, 2);
         if (timed_out) {
             ALOGW("readv for cmd %d finished after %lld nsecs", cmd,
                   (long long)(systemTime(SYSTEM_TIME_MONOTONIC) - start_time_ns));
@@ -212,6 +298,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
 
     out.resize(write_pos - out.data());
     out_eraser.disarm();
+    channel.succeeded();
     return out;
 }
 
@@ -237,10 +324,15 @@ int trusty_keymaster_call(uint32_t cmd, void* in, uint32_t in_size, uint8_t* out
 }
 
 void trusty_keymaster_disconnect() {
-    if (handle_ >= 0) {
-        tipc_close(handle_);
+    std::lock_guard<std::mutex> lock(channels_lock_);
+    // Channels in use are closed when they are released.
+    for (int handle : idle_channels_) {
+        tipc_close(handle);
     }
-    handle_ = -1;
+    open_channels_ -= idle_channels_.size();
+    idle_channels_.clear();
+    connected_ = false;
+    channel_released_.notify_all();
 }
 
 keymaster_error_t translate_error(int err) {
@@ -303,9 +395,7 @@ keymaster_error_t trusty_keymaster_send(uint32_t command, const keymaster::Seria
         return rsp->error;
     } else {
         auto rc = std::get<int>(response);
-        // Reset the connection on tipc error
-        trusty_keymaster_disconnect();
-        trusty_keymaster_connect();
+        // The channel that failed has been closed, and is replaced on the next call.
         ALOGE("tipc error: %d\n", rc);
         // TODO(swillden): Distinguish permanent from transient errors and set error_ appropriately.
         return translate_error(rc);
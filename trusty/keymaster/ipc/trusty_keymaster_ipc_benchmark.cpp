@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the round trip latency of calls to the Trusty keymaster TA, from one thread and
+// from several threads at once, e.g.:
+//   trusty_keymaster_ipc_benchmark --benchmark_filter=BM_GetVersion
+
+#include <benchmark/benchmark.h>
+
+#include <keymaster/android_keymaster_messages.h>
+#include <trusty_keymaster/ipc/trusty_keymaster_ipc.h>
+
+static void BM_GetVersion(benchmark::State& state) {
+    if (state.thread_index() == 0 && trusty_keymaster_connect() != 0) {
+        state.SkipWithError("failed to connect to the keymaster TA");
+    }
+    keymaster::GetVersionRequest request;
+    for (auto _ : state) {
+        keymaster::GetVersionResponse response;
+        if (trusty_keymaster_send(KM_GET_VERSION, request, &response) != KM_ERROR_OK) {
+            state.SkipWithError("KM_GET_VERSION failed");
+            break;
+        }
+    }
+    if (state.thread_index() == 0) {
+        trusty_keymaster_disconnect();
+    }
+}
+BENCHMARK(BM_GetVersion)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
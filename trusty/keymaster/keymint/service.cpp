@@ -47,9 +47,10 @@ int main() {
         return -1;
     }
 
-    // Zero threads seems like a useless pool but below we'll join this thread to it, increasing
-    // the pool size to 1.
-    ABinderProcess_setThreadPoolMaxThreadCount(0);
+    // Below we'll join this thread to the pool, increasing its size by one. The IPC layer
+    // dispatches concurrent calls over separate channels, so let requests from different clients
+    // proceed in parallel rather than queueing behind one another.
+    ABinderProcess_setThreadPoolMaxThreadCount(3);
 
     auto keyMint = addService<TrustyKeyMintDevice>(trustyKeymaster);
     auto secureClock = addService<TrustySecureClock>(trustyKeymaster);
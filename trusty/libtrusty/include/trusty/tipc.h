@@ -21,6 +21,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/uio.h>
 #include <trusty/ipc.h>
 
@@ -28,6 +30,44 @@ int tipc_connect(const char *dev_name, const char *srv_name);
 ssize_t tipc_send(int fd, const struct iovec* iov, int iovcnt, struct trusty_shm* shm, int shmcnt);
 int tipc_close(int fd);
 
+/*
+ * A long-lived shared memory region. Once registered with a service, messages can refer to data
+ * in the region by offset instead of carrying it, so large payloads aren't copied through the
+ * message buffer. Using a region requires the service to support it in its protocol.
+ */
+struct tipc_shm_region {
+    int fd;      /* dma-buf backing the region, owned by the caller */
+    void* base;  /* local mapping of the region */
+    size_t size;
+    uint32_t id; /* identifies the region in descriptors */
+};
+
+/* Sent on the wire after the message from tipc_shm_send(), to locate its payload. */
+struct tipc_shm_desc {
+    uint32_t region_id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t len;
+};
+
+/* Maps |size| bytes of the dma-buf |dmabuf_fd| as a region. Returns 0 or a negative errno. */
+int tipc_shm_region_map(int dmabuf_fd, size_t size, struct tipc_shm_region* region);
+/* Unmaps a region. The service must have been told to release it, and the fd is not closed. */
+void tipc_shm_region_unmap(struct tipc_shm_region* region);
+
+/*
+ * Sends the message in |iov|, which the service should treat as registering |region|, with the
+ * region's memory attached using |transfer| (see enum transfer_kind).
+ */
+ssize_t tipc_shm_register(int fd, const struct tipc_shm_region* region, const struct iovec* iov,
+                          int iovcnt, uint32_t transfer);
+/*
+ * Sends the message in |iov| followed by a struct tipc_shm_desc for |len| bytes at |offset| in
+ * |region|, without copying the data itself.
+ */
+ssize_t tipc_shm_send(int fd, const struct tipc_shm_region* region, uint64_t offset, uint64_t len,
+                      const struct iovec* iov, int iovcnt);
+
 #ifdef __cplusplus
 }
 #endif
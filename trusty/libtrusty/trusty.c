@@ -23,11 +23,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <log/log.h>
 
 #include <trusty/ipc.h>
+#include <trusty/tipc.h>
 
 int tipc_connect(const char* dev_name, const char* srv_name) {
     int fd;
@@ -68,6 +70,63 @@ ssize_t tipc_send(int fd, const struct iovec* iov, int iovcnt, struct trusty_shm
     return rc;
 }
 
-void tipc_close(int fd) {
-    close(fd);
+int tipc_close(int fd) {
+    return close(fd);
+}
+
+#define TIPC_SHM_MAX_IOV 16
+
+static uint32_t next_shm_region_id = 1;
+
+int tipc_shm_region_map(int dmabuf_fd, size_t size, struct tipc_shm_region* region) {
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd, 0);
+    if (base == MAP_FAILED) {
+        int rc = -errno;
+        ALOGE("%s: failed to map shared memory (err=%d)\n", __func__, errno);
+        return rc;
+    }
+
+    region->fd = dmabuf_fd;
+    region->base = base;
+    region->size = size;
+    region->id = __atomic_fetch_add(&next_shm_region_id, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void tipc_shm_region_unmap(struct tipc_shm_region* region) {
+    if (region->base) {
+        munmap(region->base, region->size);
+    }
+    region->base = NULL;
+    region->size = 0;
+}
+
+ssize_t tipc_shm_register(int fd, const struct tipc_shm_region* region, const struct iovec* iov,
+                          int iovcnt, uint32_t transfer) {
+    struct trusty_shm shm = {
+            .fd = region->fd,
+            .transfer = transfer,
+    };
+    return tipc_send(fd, iov, iovcnt, &shm, 1);
+}
+
+ssize_t tipc_shm_send(int fd, const struct tipc_shm_region* region, uint64_t offset, uint64_t len,
+                      const struct iovec* iov, int iovcnt) {
+    if (iovcnt < 0 || iovcnt >= TIPC_SHM_MAX_IOV || offset > region->size ||
+        len > region->size - offset) {
+        ALOGE("%s: invalid shared memory message\n", __func__);
+        return -EINVAL;
+    }
+
+    struct tipc_shm_desc desc = {
+            .region_id = region->id,
+            .reserved = 0,
+            .offset = offset,
+            .len = len,
+    };
+    struct iovec tx[TIPC_SHM_MAX_IOV];
+    memcpy(tx, iov, iovcnt * sizeof(*iov));
+    tx[iovcnt].iov_base = &desc;
+    tx[iovcnt].iov_len = sizeof(desc);
+    return tipc_send(fd, tx, iovcnt + 1, NULL, 0);
 }
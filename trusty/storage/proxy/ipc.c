@@ -31,6 +31,7 @@
 #define TRUSTY_RECONNECT_TIMEOUT_SEC 5
 
 static int tipc_fd = -1;
+static enum storage_err *deferred_result;
 
 int ipc_connect(const char *device, const char *port)
 {
@@ -100,6 +101,12 @@ int ipc_respond(struct storage_msg *msg, void *out, size_t out_size)
 
     assert(tipc_fd >=  0);
 
+    if (deferred_result) {
+        if (*deferred_result == STORAGE_NO_ERROR)
+            *deferred_result = msg->result;
+        return 0;
+    }
+
     msg->cmd |= STORAGE_RESP_BIT;
 
     rc = writev(tipc_fd, iovs, out ? 2 : 1);
@@ -112,4 +119,7 @@ int ipc_respond(struct storage_msg *msg, void *out, size_t out_size)
     return 0;
 }
 
-
+void ipc_defer_responses(enum storage_err *result)
+{
+    deferred_result = result;
+}
@@ -16,9 +16,17 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <trusty/interface/storage.h>
 
 int ipc_connect(const char *device, const char *service_name);
 void ipc_disconnect(void);
 ssize_t ipc_get_msg(struct storage_msg *msg, void *req_buf, size_t req_buf_len);
 int ipc_respond(struct storage_msg *msg, void *out, size_t out_size);
+
+/*
+ * While |result| is non-NULL, ipc_respond() sends nothing and instead stores
+ * the result of the first failed response in |*result|. Used to implement
+ * STORAGE_MSG_FLAG_BATCH.
+ */
+void ipc_defer_responses(enum storage_err *result);
@@ -113,8 +113,45 @@ static int drop_privs(void) {
     return 0;
 }
 
+/*
+ * State of the STORAGE_MSG_FLAG_BATCH transaction in progress. Responses to
+ * batched messages are withheld; the message that ends the batch gets the
+ * first error of the batch instead, if there was one. The rest of a batch is
+ * skipped once a message in it has failed.
+ */
+static struct {
+    bool active;
+    enum storage_err result;
+} batch;
+
 static int handle_req(struct storage_msg* msg, const void* req, size_t req_len) {
     int rc;
+    bool batched = msg->flags & STORAGE_MSG_FLAG_BATCH;
+
+    /* only batched writes may still be in flight while another request runs */
+    if (!(batched && msg->cmd == STORAGE_FILE_WRITE)) {
+        enum storage_err err = storage_wait_async_io();
+        if (err != STORAGE_NO_ERROR && batch.active && batch.result == STORAGE_NO_ERROR) {
+            batch.result = err;
+        }
+    }
+
+    if (batched) {
+        if (!batch.active) {
+            batch.active = true;
+            ipc_defer_responses(&batch.result);
+        }
+        if (batch.result != STORAGE_NO_ERROR) return 0;
+    } else if (batch.active) {
+        enum storage_err result = batch.result;
+        batch.active = false;
+        batch.result = STORAGE_NO_ERROR;
+        ipc_defer_responses(NULL);
+        if (result != STORAGE_NO_ERROR) {
+            msg->result = result;
+            return ipc_respond(msg, NULL, 0);
+        }
+    }
 
     if ((msg->flags & STORAGE_MSG_FLAG_POST_COMMIT) && (msg->cmd != STORAGE_RPMB_SEND)) {
         /*
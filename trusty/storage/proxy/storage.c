@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,7 +31,10 @@
 #include "log.h"
 #include "storage.h"
 
-#define FD_TBL_SIZE 64
+/* initial size of the fd table, which grows to cover the largest fd in use */
+#define FD_TBL_MIN_SIZE 64
+/* number of parent directories whose fds are kept open */
+#define DIR_CACHE_SIZE 8
 #define MAX_READ_SIZE 4096
 
 #define ALTERNATE_DATA_DIR "alternate/"
@@ -44,7 +48,20 @@ enum sync_state {
 static const char *ssdir_name;
 
 static enum sync_state fs_state;
-static enum sync_state fd_state[FD_TBL_SIZE];
+/* indexed by fd, which is also the handle given out for the file */
+static enum sync_state *fd_state;
+static size_t fd_tbl_size;
+
+/*
+ * Directories that files were created in or deleted from. Their entries are
+ * synced at the next checkpoint rather than by reopening and syncing the
+ * directory on every create or delete.
+ */
+static struct {
+    char *path;
+    int fd;
+    enum sync_state state;
+} dir_cache[DIR_CACHE_SIZE];
 
 static bool alternate_mode;
 
@@ -53,11 +70,69 @@ static struct {
    uint8_t data[MAX_READ_SIZE];
 }  read_rsp;
 
+/*
+ * Writes that are part of a STORAGE_MSG_FLAG_BATCH transaction and the fsyncs
+ * of a checkpoint are handed to a small pool of I/O workers, so that
+ * independent files are written and synced concurrently. Each fd always goes
+ * to the same worker, and each worker runs its jobs in order, so operations on
+ * one file keep their order. Any other request first waits for the queued jobs
+ * with storage_wait_async_io().
+ */
+#define IO_WORKER_COUNT 4
+#define IO_WORKER_QUEUE_DEPTH 16
+
+enum io_job_type {
+    IO_JOB_WRITE,
+    IO_JOB_FSYNC,
+};
+
+struct io_job {
+    enum io_job_type type;
+    int fd;
+    off_t offset;
+    size_t size;
+    uint8_t *data;
+};
+
+static struct io_worker {
+    pthread_t thread;
+    struct io_job jobs[IO_WORKER_QUEUE_DEPTH];
+    unsigned int head;
+    unsigned int count;
+} io_workers[IO_WORKER_COUNT];
+
+static bool io_workers_started;
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t io_done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int io_pending; /* jobs queued or running */
+static int io_error;            /* errno of the first failed job */
+
+/* Grows the fd table to cover |fd|. Returns false if that fails. */
+static bool grow_fd_tbl(uint32_t fd)
+{
+    if (fd < fd_tbl_size)
+        return true;
+
+    size_t size = fd_tbl_size ? fd_tbl_size : FD_TBL_MIN_SIZE;
+    while (size <= fd)
+        size *= 2;
+
+    enum sync_state *tbl = realloc(fd_state, size * sizeof(*tbl));
+    if (!tbl)
+        return false;
+    for (size_t i = fd_tbl_size; i < size; i++)
+        tbl[i] = SS_UNUSED;
+    fd_state = tbl;
+    fd_tbl_size = size;
+    return true;
+}
+
 static uint32_t insert_fd(int open_flags, int fd)
 {
     uint32_t handle = fd;
 
-    if (handle < FD_TBL_SIZE) {
+    if (grow_fd_tbl(handle)) {
             fd_state[fd] = SS_CLEAN; /* fd clean */
             if (open_flags & O_TRUNC) {
                 fd_state[fd] = SS_DIRTY;  /* set fd dirty */
@@ -74,7 +149,7 @@ static uint32_t insert_fd(int open_flags, int fd)
 static int lookup_fd(uint32_t handle, bool dirty)
 {
     if (dirty) {
-        if (handle < FD_TBL_SIZE) {
+        if (handle < fd_tbl_size) {
             fd_state[handle] = SS_DIRTY;
         } else {
             fs_state = SS_DIRTY;
@@ -85,7 +160,7 @@ static int lookup_fd(uint32_t handle, bool dirty)
 
 static int remove_fd(uint32_t handle)
 {
-    if (handle < FD_TBL_SIZE) {
+    if (handle < fd_tbl_size) {
         fd_state[handle] = SS_UNUSED; /* set to uninstalled */
     }
     return handle;
@@ -159,6 +234,135 @@ static ssize_t read_with_retry(int fd, void *buf_, size_t size, off_t offset)
     return rcnt;
 }
 
+static void *io_worker_main(void *arg)
+{
+    struct io_worker *worker = arg;
+
+    pthread_mutex_lock(&io_lock);
+    while (true) {
+        while (worker->count == 0)
+            pthread_cond_wait(&io_work_cond, &io_lock);
+        struct io_job job = worker->jobs[worker->head];
+        pthread_mutex_unlock(&io_lock);
+
+        int rc;
+        if (job.type == IO_JOB_WRITE) {
+            rc = write_with_retry(job.fd, job.data, job.size, job.offset);
+            if (rc < 0)
+                ALOGW("%s: error writing file (fd=%d): %s\n",
+                      __func__, job.fd, strerror(errno));
+        } else {
+            rc = fsync(job.fd);
+            if (rc < 0)
+                ALOGE("fsync for fd=%d failed: %s\n", job.fd, strerror(errno));
+        }
+        int error = rc < 0 ? errno : 0;
+        free(job.data);
+
+        pthread_mutex_lock(&io_lock);
+        worker->head = (worker->head + 1) % IO_WORKER_QUEUE_DEPTH;
+        worker->count--;
+        io_pending--;
+        if (error && !io_error)
+            io_error = error;
+        pthread_cond_broadcast(&io_done_cond);
+    }
+    return NULL;
+}
+
+static void io_workers_start(void)
+{
+    for (uint i = 0; i < IO_WORKER_COUNT; i++) {
+        int rc = pthread_create(&io_workers[i].thread, NULL, io_worker_main, &io_workers[i]);
+        if (rc != 0) {
+            /* without all the workers, fall back to synchronous I/O */
+            ALOGE("%s: failed to start I/O worker: %s\n", __func__, strerror(rc));
+            return;
+        }
+    }
+    io_workers_started = true;
+}
+
+/*
+ * Queues |job| on the worker for its fd, waiting for room if that worker is
+ * busy. Returns false if there are no workers, in which case the caller has to
+ * do the I/O itself.
+ */
+static bool io_queue(struct io_job job)
+{
+    if (!io_workers_started)
+        return false;
+
+    struct io_worker *worker = &io_workers[(uint)job.fd % IO_WORKER_COUNT];
+
+    pthread_mutex_lock(&io_lock);
+    while (worker->count == IO_WORKER_QUEUE_DEPTH)
+        pthread_cond_wait(&io_done_cond, &io_lock);
+    worker->jobs[(worker->head + worker->count) % IO_WORKER_QUEUE_DEPTH] = job;
+    worker->count++;
+    io_pending++;
+    pthread_cond_broadcast(&io_work_cond);
+    pthread_mutex_unlock(&io_lock);
+    return true;
+}
+
+/*
+ * Waits for all queued jobs to finish. Returns the errno of the first job that
+ * failed since the last call, or 0.
+ */
+static int io_wait(void)
+{
+    pthread_mutex_lock(&io_lock);
+    while (io_pending)
+        pthread_cond_wait(&io_done_cond, &io_lock);
+    int error = io_error;
+    io_error = 0;
+    pthread_mutex_unlock(&io_lock);
+    return error;
+}
+
+enum storage_err storage_wait_async_io(void)
+{
+    return translate_errno(io_wait());
+}
+
+/*
+ * Marks the directory containing |path| as needing a sync at the next
+ * checkpoint. Falls back to syncing it right away if it can't be cached.
+ */
+static void sync_parent(const char* path) {
+    char* parent_path = dirname(path);
+    int free_slot = -1;
+
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        if (!dir_cache[i].path) {
+            if (free_slot < 0) free_slot = i;
+        } else if (!strcmp(dir_cache[i].path, parent_path)) {
+            dir_cache[i].state = SS_DIRTY;
+            return;
+        }
+    }
+
+    int parent_fd = TEMP_FAILURE_RETRY(open(parent_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (parent_fd < 0) {
+        ALOGE("%s: failed to open parent directory \"%s\" for sync: %s\n", __func__, parent_path,
+              strerror(errno));
+        return;
+    }
+
+    if (free_slot >= 0) {
+        dir_cache[free_slot].path = strdup(parent_path);
+        if (dir_cache[free_slot].path) {
+            dir_cache[free_slot].fd = parent_fd;
+            dir_cache[free_slot].state = SS_DIRTY;
+            return;
+        }
+    }
+
+    fsync(parent_fd);
+    close(parent_fd);
+}
+
 int storage_file_delete(struct storage_msg *msg,
                         const void *r, size_t req_len)
 {
@@ -202,6 +406,7 @@ int storage_file_delete(struct storage_msg *msg,
     }
 
     ALOGV("%s: \"%s\"\n", __func__, path);
+    sync_parent(path);
     msg->result = STORAGE_NO_ERROR;
 
 err_response:
@@ -210,19 +415,6 @@ err_response:
     return ipc_respond(msg, NULL, 0);
 }
 
-static void sync_parent(const char* path) {
-    int parent_fd;
-    char* parent_path = dirname(path);
-    parent_fd = TEMP_FAILURE_RETRY(open(parent_path, O_RDONLY));
-    if (parent_fd >= 0) {
-        fsync(parent_fd);
-        close(parent_fd);
-    } else {
-        ALOGE("%s: failed to open parent directory \"%s\" for sync: %s\n", __func__, parent_path,
-              strerror(errno));
-    }
-}
-
 int storage_file_open(struct storage_msg* msg, const void* r, size_t req_len) {
     char* path = NULL;
     const struct storage_file_open_req *req = r;
@@ -356,10 +548,12 @@ int storage_file_close(struct storage_msg *msg,
         goto err_response;
     }
 
+    /* nothing was written since the last sync if the fd is tracked as clean */
+    bool clean = req->handle < fd_tbl_size && fd_state[req->handle] == SS_CLEAN;
     int fd = remove_fd(req->handle);
     ALOGV("%s: handle = %u: fd = %u\n", __func__, req->handle, fd);
 
-    int rc = fsync(fd);
+    int rc = clean ? 0 : fsync(fd);
     if (rc < 0) {
         rc = errno;
         ALOGE("%s: fsync failed for fd=%u: %s\n",
@@ -398,8 +592,26 @@ int storage_file_write(struct storage_msg *msg,
     }
 
     int fd = lookup_fd(req->handle, true);
-    if (write_with_retry(fd, &req->data[0], req_len - sizeof(*req),
-                         req->offset) < 0) {
+    size_t size = req_len - sizeof(*req);
+
+    if (msg->flags & STORAGE_MSG_FLAG_BATCH) {
+        /*
+         * No response is due until the batch ends, so the write can complete
+         * in the background; a failure is reported by storage_wait_async_io().
+         */
+        uint8_t *data = malloc(size);
+        if (data) {
+            memcpy(data, &req->data[0], size);
+            struct io_job job = {IO_JOB_WRITE, fd, req->offset, size, data};
+            if (io_queue(job)) {
+                msg->result = STORAGE_NO_ERROR;
+                goto err_response;
+            }
+            free(data);
+        }
+    }
+
+    if (write_with_retry(fd, &req->data[0], size, req->offset) < 0) {
         rc = errno;
         ALOGW("%s: error writing file (fd=%d): %s\n",
               __func__, fd, strerror(errno));
@@ -520,11 +732,13 @@ int storage_init(const char *dirname)
     alternate_mode = is_gsi_running();
 
     fs_state = SS_CLEAN;
-    for (uint i = 0; i < FD_TBL_SIZE; i++) {
-        fd_state[i] = SS_UNUSED;  /* uninstalled */
+    if (!grow_fd_tbl(FD_TBL_MIN_SIZE - 1)) {
+        ALOGE("%s: failed to allocate fd table\n", __func__);
+        return -1;
     }
 
     ssdir_name = dirname;
+    io_workers_start();
     return 0;
 }
 
@@ -533,18 +747,49 @@ int storage_sync_checkpoint(void)
     int rc;
 
     /* sync fd table and reset it to clean state first */
-    for (uint fd = 0; fd < FD_TBL_SIZE; fd++) {
-         if (fd_state[fd] == SS_DIRTY) {
-             if (fs_state == SS_CLEAN) {
-                 /* need to sync individual fd */
-                 rc = fsync(fd);
-                 if (rc < 0) {
-                     ALOGE("fsync for fd=%d failed: %s\n", fd, strerror(errno));
-                     return rc;
-                 }
-             }
-             fd_state[fd] = SS_CLEAN; /* set to clean */
-         }
+    if (fs_state == SS_CLEAN) {
+        /* need to sync individual fds, which the I/O workers do in parallel */
+        for (uint fd = 0; fd < fd_tbl_size; fd++) {
+            if (fd_state[fd] == SS_DIRTY) {
+                struct io_job job = {IO_JOB_FSYNC, fd, 0, 0, NULL};
+                if (!io_queue(job)) {
+                    rc = fsync(fd);
+                    if (rc < 0) {
+                        ALOGE("fsync for fd=%d failed: %s\n", fd, strerror(errno));
+                        return rc;
+                    }
+                }
+            }
+        }
+    }
+
+    /* directories with new or deleted entries */
+    for (uint i = 0; i < DIR_CACHE_SIZE; i++) {
+        if (dir_cache[i].path && dir_cache[i].state == SS_DIRTY) {
+            struct io_job job = {IO_JOB_FSYNC, dir_cache[i].fd, 0, 0, NULL};
+            if (!io_queue(job)) {
+                rc = fsync(dir_cache[i].fd);
+                if (rc < 0) {
+                    ALOGE("fsync for \"%s\" failed: %s\n", dir_cache[i].path, strerror(errno));
+                    return rc;
+                }
+            }
+        }
+    }
+
+    /* the queued fsyncs come after any queued writes to the same fd */
+    rc = io_wait();
+    if (rc) {
+        ALOGE("%s: failed to sync: %s\n", __func__, strerror(rc));
+        return -1;
+    }
+
+    for (uint fd = 0; fd < fd_tbl_size; fd++) {
+        if (fd_state[fd] == SS_DIRTY)
+            fd_state[fd] = SS_CLEAN; /* set to clean */
+    }
+    for (uint i = 0; i < DIR_CACHE_SIZE; i++) {
+        dir_cache[i].state = SS_CLEAN;
     }
 
     /* check if we need to sync all filesystems */
@@ -553,8 +798,7 @@ int storage_sync_checkpoint(void)
          * We sync all filesystems here because we don't know what filesystem
          * needs syncing if there happen to be other filesystems symlinked under
          * the root data directory. This should not happen in the normal case
-         * because our fd table is large enough to handle the few open files we
-         * use.
+         * because the fd table grows to track every open file.
          */
         sync();
         fs_state = SS_CLEAN;
@@ -562,4 +806,3 @@ int storage_sync_checkpoint(void)
 
     return 0;
 }
-
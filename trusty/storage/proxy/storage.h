@@ -43,3 +43,9 @@ int storage_init(const char *dirname);
 
 int storage_sync_checkpoint(void);
 
+/*
+ * Waits for the writes queued by batched storage_file_write() calls. Returns
+ * the error of the first one that failed, if any.
+ */
+enum storage_err storage_wait_async_io(void);
+